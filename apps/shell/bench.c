@@ -0,0 +1,1428 @@
+/**
+ * AAAos Kernel Shell - Storage and Checksum Benchmarks Implementation
+ *
+ * Latencies are collected per operation in clock cycles, converted to
+ * nanoseconds, then sorted once at the end of a run for the percentiles.
+ */
+
+#include "bench.h"
+#include "shell.h"
+#include "../../kernel/include/vga.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../../fs/vfs/vfs.h"
+#include "../../net/tcp/tcp.h"
+#include "../../net/udp/udp.h"
+
+/* Defaults of the shell commands */
+#define BENCH_DEFAULT_BLOCK_KB  4
+#define BENCH_DEFAULT_DEPTH     1
+#define BENCH_DEFAULT_OPS       1024
+#define BENCH_DEFAULT_FILES     256
+#define BENCH_DEFAULT_FILE_KB   64
+#define BENCH_DEFAULT_CSUM_LEN  1500
+#define BENCH_DEFAULT_CSUM_OPS  4096
+#define BENCH_DEFAULT_PIX_W     1920
+#define BENCH_DEFAULT_PIX_H     1080
+#define BENCH_DEFAULT_PIX_OPS   32
+#define NETBENCH_DEFAULT_STREAM_SIZE    16384
+#define NETBENCH_DEFAULT_STREAM_OPS     4096
+#define NETBENCH_DEFAULT_RR_SIZE        64
+#define NETBENCH_DEFAULT_RR_OPS         4096
+#define NETBENCH_DEFAULT_UDP_OPS        8192
+#define NETBENCH_DEFAULT_CONNECTS       256
+#define NETBENCH_DEFAULT_PING_SECONDS   5
+
+/* ========== Helpers ========== */
+
+static size_t bench_strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static bool bench_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Parse a decimal number
+ * @return false if s is not one
+ */
+static bool bench_parse(const char *s, uint64_t *out) {
+    uint64_t value = 0;
+    if (!*s) {
+        return false;
+    }
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(*s - '0');
+    }
+    *out = value;
+    return true;
+}
+
+/**
+ * xorshift64 step, for random offsets
+ */
+static uint64_t bench_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * Build "<dir>/bench<index>" into path (VFS_PATH_MAX bytes)
+ */
+static void bench_file_name(char *path, const char *dir, uint32_t index) {
+    size_t len = bench_strlen(dir);
+    for (size_t i = 0; i < len; i++) {
+        path[i] = dir[i];
+    }
+    if (len == 0 || path[len - 1] != '/') {
+        path[len++] = '/';
+    }
+
+    const char *prefix = "bench";
+    for (size_t i = 0; prefix[i]; i++) {
+        path[len++] = prefix[i];
+    }
+
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + index % 10);
+        index /= 10;
+    } while (index);
+    while (n) {
+        path[len++] = digits[--n];
+    }
+    path[len] = '\0';
+}
+
+/* ========== Latency Samples ========== */
+
+typedef struct {
+    uint64_t *samples;                  /* Nanoseconds */
+    uint32_t count;
+    uint32_t capacity;
+} bench_lat_t;
+
+static bool bench_lat_init(bench_lat_t *lat, uint32_t capacity) {
+    lat->samples = kmalloc((size_t)capacity * sizeof(uint64_t));
+    lat->count = 0;
+    lat->capacity = capacity;
+    return lat->samples != NULL;
+}
+
+static void bench_lat_add(bench_lat_t *lat, uint64_t cycles) {
+    if (lat->count < lat->capacity) {
+        lat->samples[lat->count++] = clock_cycles_to_ns(cycles);
+    }
+}
+
+static void bench_sift_down(uint64_t *a, uint32_t root, uint32_t count) {
+    for (;;) {
+        uint32_t child = root * 2 + 1;
+        if (child >= count) {
+            return;
+        }
+        if (child + 1 < count && a[child + 1] > a[child]) {
+            child++;
+        }
+        if (a[root] >= a[child]) {
+            return;
+        }
+        uint64_t t = a[root];
+        a[root] = a[child];
+        a[child] = t;
+        root = child;
+    }
+}
+
+/**
+ * Sort the samples (heapsort: no recursion, no extra memory) and fill in
+ * the percentiles, then free them
+ */
+static void bench_lat_finish(bench_lat_t *lat, bench_result_t *res) {
+    uint64_t *a = lat->samples;
+    uint32_t n = lat->count;
+
+    for (uint32_t i = n / 2; i-- > 0;) {
+        bench_sift_down(a, i, n);
+    }
+    for (uint32_t end = n; end-- > 1;) {
+        uint64_t t = a[0];
+        a[0] = a[end];
+        a[end] = t;
+        bench_sift_down(a, 0, end);
+    }
+
+    if (n > 0) {
+        res->p50_ns = a[(n - 1) / 2];
+        res->p99_ns = a[((uint64_t)n * 99 - 1) / 100];
+        res->max_ns = a[n - 1];
+    }
+    kfree(a);
+    lat->samples = NULL;
+}
+
+/* ========== Block Benchmark ========== */
+
+/**
+ * One request kept in flight
+ */
+typedef struct {
+    blk_request_t req;
+    uint64_t start;                     /* Cycles at submission */
+    volatile uint64_t end;              /* Cycles at completion */
+    physaddr_t buffer;
+    bool busy;
+} bench_slot_t;
+
+static void blkbench_done(blk_request_t *req) {
+    bench_slot_t *slot = req->ctx;
+    slot->end = clock_cycles();
+}
+
+int blkbench_run(blk_queue_t *q, const blkbench_config_t *cfg, bench_result_t *res) {
+    if (!q || !cfg || !res || cfg->block_sectors == 0 ||
+        cfg->block_sectors * BLK_SECTOR_SIZE > BENCH_MAX_BLOCK ||
+        cfg->depth == 0 || cfg->depth > BENCH_MAX_DEPTH ||
+        cfg->ops == 0 || cfg->ops > BENCH_MAX_OPS) {
+        return BENCH_ERR_INVAL;
+    }
+
+    uint64_t span = cfg->span_sectors;
+    if (span == 0) {
+        if (q->limits.total_sectors <= cfg->start_lba) {
+            return BENCH_ERR_INVAL;
+        }
+        span = q->limits.total_sectors - cfg->start_lba;
+    }
+    uint64_t blocks = span / cfg->block_sectors;
+    if (blocks == 0) {
+        return BENCH_ERR_INVAL;
+    }
+
+    *res = (bench_result_t){ 0 };
+    bench_lat_t lat;
+    if (!bench_lat_init(&lat, cfg->ops)) {
+        return BENCH_ERR_NOMEM;
+    }
+
+    /* Buffers from the physical map suit every driver */
+    size_t pages = ALIGN_UP((size_t)cfg->block_sectors * BLK_SECTOR_SIZE, PAGE_SIZE) / PAGE_SIZE;
+    bench_slot_t *slots = kcalloc(cfg->depth, sizeof(bench_slot_t));
+    bool ok = slots != NULL;
+    for (uint32_t s = 0; ok && s < cfg->depth; s++) {
+        slots[s].buffer = pmm_alloc_pages(pages);
+        ok = slots[s].buffer != 0;
+    }
+    if (!ok) {
+        for (uint32_t s = 0; slots && s < cfg->depth && slots[s].buffer; s++) {
+            pmm_free_pages(slots[s].buffer, pages);
+        }
+        kfree(slots);
+        kfree(lat.samples);
+        return BENCH_ERR_NOMEM;
+    }
+    for (uint32_t s = 0; s < cfg->depth; s++) {
+        uint8_t *data = (uint8_t*)(VMM_KERNEL_PHYS_MAP + slots[s].buffer);
+        for (size_t i = 0; i < pages * PAGE_SIZE; i++) {
+            data[i] = (uint8_t)(i + s);
+        }
+    }
+
+    uint64_t seed = clock_cycles() | 1;
+    uint64_t next_block = 0;
+    uint32_t issued = 0, finished = 0;
+    uint64_t run_start = clock_cycles();
+
+    for (uint32_t s = 0; finished < cfg->ops; s = (s + 1) % cfg->depth) {
+        bench_slot_t *slot = &slots[s];
+
+        if (slot->busy) {
+            int status = blk_wait(q, &slot->req, 1);
+            /* The status is stored just before the callback runs */
+            while (slot->end == 0) {
+                __asm__ __volatile__("pause");
+            }
+            slot->busy = false;
+            finished++;
+            if (status == BLK_OK) {
+                bench_lat_add(&lat, slot->end - slot->start);
+                res->ops++;
+                res->bytes += (uint64_t)cfg->block_sectors * BLK_SECTOR_SIZE;
+            } else {
+                res->errors++;
+            }
+        }
+
+        if (issued < cfg->ops) {
+            uint64_t block = cfg->random ? bench_random(&seed) % blocks : next_block++ % blocks;
+            slot->req = (blk_request_t){
+                .op = cfg->op,
+                .lba = cfg->start_lba + block * cfg->block_sectors,
+                .count = cfg->block_sectors,
+                .buffer = (void*)(VMM_KERNEL_PHYS_MAP + slot->buffer),
+                .done = blkbench_done,
+                .ctx = slot,
+            };
+            slot->end = 0;
+            slot->start = clock_cycles();
+            issued++;
+            if (blk_submit(q, &slot->req) == BLK_OK) {
+                slot->busy = true;
+            } else {
+                res->errors++;
+                finished++;
+            }
+        }
+    }
+
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - run_start);
+    bench_lat_finish(&lat, res);
+
+    for (uint32_t s = 0; s < cfg->depth; s++) {
+        pmm_free_pages(slots[s].buffer, pages);
+    }
+    kfree(slots);
+    return BENCH_OK;
+}
+
+/* ========== Filesystem Benchmarks ========== */
+
+int fsbench_files(const char *dir, uint32_t count, fsbench_files_result_t *res) {
+    if (!dir || !res || count == 0 || count > BENCH_MAX_OPS ||
+        bench_strlen(dir) + 16 >= VFS_PATH_MAX) {
+        return BENCH_ERR_INVAL;
+    }
+    if (!vfs_is_directory(dir)) {
+        int result = vfs_mkdir(dir, 0755);
+        if (result != VFS_OK) {
+            return result;
+        }
+    }
+
+    *res = (fsbench_files_result_t){ 0 };
+    char *path = kmalloc(VFS_PATH_MAX);
+    bench_lat_t lat;
+    if (!path || !bench_lat_init(&lat, count)) {
+        kfree(path);
+        return BENCH_ERR_NOMEM;
+    }
+
+    /* Create */
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < count; i++) {
+        bench_file_name(path, dir, i);
+        uint64_t t = clock_cycles();
+        if (vfs_create(path, 0644) == VFS_OK) {
+            bench_lat_add(&lat, clock_cycles() - t);
+            res->create.ops++;
+        } else {
+            res->create.errors++;
+        }
+    }
+    res->create.elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+    bench_lat_finish(&lat, &res->create);
+
+    /* Stat */
+    vfs_stat_t st;
+    bench_lat_init(&lat, count);
+    start = clock_cycles();
+    for (uint32_t i = 0; lat.samples && i < count; i++) {
+        bench_file_name(path, dir, i);
+        uint64_t t = clock_cycles();
+        if (vfs_stat(path, &st) == VFS_OK) {
+            bench_lat_add(&lat, clock_cycles() - t);
+            res->stat.ops++;
+        } else {
+            res->stat.errors++;
+        }
+    }
+    res->stat.elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+    if (lat.samples) {
+        bench_lat_finish(&lat, &res->stat);
+    }
+
+    /* List: every entry of the directory, which holds at least count */
+    bench_lat_init(&lat, BENCH_MAX_OPS);
+    start = clock_cycles();
+    vfs_dir_t *d = lat.samples ? vfs_opendir(dir) : NULL;
+    if (d) {
+        for (;;) {
+            uint64_t t = clock_cycles();
+            vfs_dirent_t *entry = vfs_readdir(d);
+            if (!entry) {
+                break;
+            }
+            bench_lat_add(&lat, clock_cycles() - t);
+            res->list.ops++;
+        }
+        vfs_closedir(d);
+    } else {
+        res->list.errors++;
+    }
+    res->list.elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+    if (lat.samples) {
+        bench_lat_finish(&lat, &res->list);
+    }
+
+    /* Unlink */
+    bench_lat_init(&lat, count);
+    start = clock_cycles();
+    for (uint32_t i = 0; i < count; i++) {
+        bench_file_name(path, dir, i);
+        uint64_t t = clock_cycles();
+        if (vfs_unlink(path) == VFS_OK) {
+            if (lat.samples) {
+                bench_lat_add(&lat, clock_cycles() - t);
+            }
+            res->unlink.ops++;
+        } else {
+            res->unlink.errors++;
+        }
+    }
+    res->unlink.elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+    if (lat.samples) {
+        bench_lat_finish(&lat, &res->unlink);
+    }
+
+    kfree(path);
+    return BENCH_OK;
+}
+
+/**
+ * Stream a file through vfs_read or vfs_write
+ */
+static int fsbench_stream(vfs_file_t *file, bool write, uint64_t size, uint32_t block_size,
+                          bench_result_t *res) {
+    uint8_t *buf = kmalloc(block_size);
+    bench_lat_t lat;
+    if (!buf || !bench_lat_init(&lat, BENCH_MAX_OPS)) {
+        kfree(buf);
+        return BENCH_ERR_NOMEM;
+    }
+    for (uint32_t i = 0; i < block_size; i++) {
+        buf[i] = (uint8_t)i;
+    }
+
+    *res = (bench_result_t){ 0 };
+    uint64_t start = clock_cycles();
+    while (!write || res->bytes < size) {
+        size_t n = block_size;
+        if (write && size - res->bytes < n) {
+            n = (size_t)(size - res->bytes);
+        }
+
+        uint64_t t = clock_cycles();
+        ssize_t done = write ? vfs_write(file, buf, n) : vfs_read(file, buf, n);
+        if (done <= 0) {
+            if (done < 0) {
+                res->errors++;
+            }
+            break;
+        }
+        bench_lat_add(&lat, clock_cycles() - t);
+        res->ops++;
+        res->bytes += (uint64_t)done;
+    }
+    if (write) {
+        vfs_sync(file);
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+
+    bench_lat_finish(&lat, res);
+    kfree(buf);
+    return BENCH_OK;
+}
+
+int fsbench_read(const char *path, uint32_t block_size, bench_result_t *res) {
+    if (!path || !res || block_size == 0 || block_size > BENCH_MAX_BLOCK) {
+        return BENCH_ERR_INVAL;
+    }
+
+    vfs_file_t *file = vfs_open(path, VFS_O_RDONLY);
+    if (!file) {
+        return vfs_get_error();
+    }
+    int result = fsbench_stream(file, false, 0, block_size, res);
+    vfs_close(file);
+    return result;
+}
+
+int fsbench_write(const char *path, uint64_t size, uint32_t block_size, bench_result_t *res) {
+    if (!path || !res || size == 0 || block_size == 0 || block_size > BENCH_MAX_BLOCK) {
+        return BENCH_ERR_INVAL;
+    }
+
+    vfs_file_t *file = vfs_open(path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    if (!file) {
+        return vfs_get_error();
+    }
+    int result = fsbench_stream(file, true, size, block_size, res);
+    vfs_close(file);
+    return result;
+}
+
+/* ========== Checksum Benchmark ========== */
+
+int csumbench_run(csum_impl_t impl, size_t len, uint32_t iters, bench_result_t *res,
+                  uint16_t *sum) {
+    if (!res || !sum || len == 0 || len > BENCH_MAX_BLOCK || iters == 0 ||
+        iters > BENCH_MAX_OPS) {
+        return BENCH_ERR_INVAL;
+    }
+    if (!csum_impl_available(impl)) {
+        return BENCH_ERR_INVAL;
+    }
+
+    /* One byte past an aligned start, as headers often are */
+    uint8_t *buf = kmalloc(len + 1);
+    bench_lat_t lat;
+    if (!buf || !bench_lat_init(&lat, iters)) {
+        kfree(buf);
+        return BENCH_ERR_NOMEM;
+    }
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i <= len; i++) {
+        buf[i] = (uint8_t)bench_random(&seed);
+    }
+
+    *res = (bench_result_t){ 0 };
+    uint32_t partial = 0;
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < iters; i++) {
+        uint64_t t = clock_cycles();
+        partial = csum_partial_impl(impl, buf + 1, len, 0);
+        bench_lat_add(&lat, clock_cycles() - t);
+        res->ops++;
+        res->bytes += len;
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+    *sum = csum_fold(partial);
+
+    bench_lat_finish(&lat, res);
+    kfree(buf);
+    return BENCH_OK;
+}
+
+/* ========== Pixel Benchmark ========== */
+
+int pixbench_run(pixops_impl_t impl, pixops_op_t op, int w, int h, uint32_t iters,
+                 bench_result_t *res, uint32_t *hash) {
+    if (!res || !hash || w <= 0 || h <= 0 || (uint64_t)w * h > BENCH_MAX_PIXELS ||
+        op >= PIXOPS_OP_COUNT || iters == 0 || iters > BENCH_MAX_OPS) {
+        return BENCH_ERR_INVAL;
+    }
+    if (!pixops_impl_available(impl)) {
+        return BENCH_ERR_INVAL;
+    }
+
+    size_t pixels = (size_t)w * h;
+    uint32_t *src = kmalloc(pixels * sizeof(uint32_t));
+    uint32_t *dst = kmalloc(pixels * sizeof(uint32_t));
+    bench_lat_t lat;
+    if (!src || !dst || !bench_lat_init(&lat, iters)) {
+        kfree(src);
+        kfree(dst);
+        return BENCH_ERR_NOMEM;
+    }
+
+    /* Random pixels, a quarter each fully transparent and opaque */
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i < pixels; i++) {
+        uint32_t pixel = (uint32_t)bench_random(&seed);
+        switch (pixel & 3) {
+            case 0: pixel &= 0x00FFFFFF; break;
+            case 1: pixel |= 0xFF000000; break;
+            default: break;
+        }
+        src[i] = pixel;
+        dst[i] = (uint32_t)bench_random(&seed) | 0xFF000000;
+    }
+
+    *res = (bench_result_t){ 0 };
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < iters; i++) {
+        uint64_t t = clock_cycles();
+        pixops_rect_impl(impl, op, dst, w, src, w, w, h, src[i % pixels]);
+        bench_lat_add(&lat, clock_cycles() - t);
+        res->ops++;
+        res->bytes += pixels * sizeof(uint32_t);
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+
+    /* FNV-1a over the result */
+    uint32_t h32 = 2166136261u;
+    for (size_t i = 0; i < pixels; i++) {
+        h32 = (h32 ^ dst[i]) * 16777619u;
+    }
+    *hash = h32;
+
+    bench_lat_finish(&lat, res);
+    kfree(src);
+    kfree(dst);
+    return BENCH_OK;
+}
+
+/* ========== Network Benchmarks ========== */
+
+/**
+ * Peer played by the benchmark itself for loopback runs
+ * Pumped whenever the client would otherwise wait, since loopback
+ * delivery happens inline and nothing else drains the peer's sockets.
+ */
+typedef struct {
+    tcp_socket_t *listener;
+    tcp_socket_t *conn;                 /* Latest accepted connection */
+    udp_socket_t *udp;
+    bool echo;                          /* Send back what arrives */
+    uint64_t received;                  /* Bytes or datagrams taken in */
+    uint8_t *buf;
+} netbench_peer_t;
+
+static bool netbench_is_loopback(uint32_t ip) {
+    return (ip >> 24) == 127;
+}
+
+static bool netbench_peer_open(netbench_peer_t *peer, const netbench_config_t *cfg,
+                               uint16_t port, bool udp, bool echo) {
+    *peer = (netbench_peer_t){ .echo = echo };
+    if (!netbench_is_loopback(cfg->peer_ip)) {
+        return true;
+    }
+
+    peer->buf = kmalloc(BENCH_MAX_BLOCK);
+    if (!peer->buf) {
+        return false;
+    }
+    if (udp) {
+        peer->udp = udp_bind(port);
+        if (peer->udp) {
+            udp_set_nonblock(peer->udp, true);
+        }
+        return peer->udp != NULL;
+    }
+
+    peer->listener = tcp_socket_create();
+    if (!peer->listener || tcp_bind(peer->listener, port) != TCP_OK ||
+        tcp_listen(peer->listener, 8) != TCP_OK) {
+        return false;
+    }
+    tcp_set_nonblock(peer->listener, true);
+    return true;
+}
+
+static void netbench_peer_close(netbench_peer_t *peer) {
+    if (peer->conn) {
+        tcp_close(peer->conn);
+    }
+    if (peer->listener) {
+        tcp_close(peer->listener);
+    }
+    if (peer->udp) {
+        udp_close(peer->udp);
+    }
+    kfree(peer->buf);
+    peer->buf = NULL;
+}
+
+/**
+ * Accept, drain and echo what the client sent
+ * @return true if anything happened
+ */
+static bool netbench_peer_pump(netbench_peer_t *peer) {
+    bool progress = false;
+
+    if (peer->udp) {
+        while (udp_recvfrom(peer->udp, peer->buf, BENCH_MAX_BLOCK, NULL, NULL) > 0) {
+            peer->received++;
+            progress = true;
+        }
+        return progress;
+    }
+    if (!peer->listener) {
+        return false;
+    }
+
+    tcp_socket_t *conn = tcp_accept(peer->listener);
+    if (conn) {
+        if (peer->conn) {
+            tcp_close(peer->conn);
+        }
+        tcp_set_nonblock(conn, true);
+        peer->conn = conn;
+        progress = true;
+    }
+    if (!peer->conn) {
+        return progress;
+    }
+
+    for (;;) {
+        ssize_t n = tcp_recv(peer->conn, peer->buf, BENCH_MAX_BLOCK);
+        if (n <= 0) {
+            break;
+        }
+        peer->received += (uint64_t)n;
+        progress = true;
+        for (ssize_t off = 0; peer->echo && off < n;) {
+            ssize_t sent = tcp_send(peer->conn, peer->buf + off, (size_t)(n - off));
+            if (sent <= 0) {
+                break;
+            }
+            off += sent;
+        }
+    }
+
+    /* The client closed its side */
+    if (tcp_poll_events(peer->conn) & POLL_HUP) {
+        tcp_close(peer->conn);
+        peer->conn = NULL;
+        progress = true;
+    }
+    return progress;
+}
+
+/**
+ * Let the peer or the rest of the system run while the client waits
+ */
+static void netbench_idle(netbench_peer_t *peer) {
+    if (!netbench_peer_pump(peer)) {
+        scheduler_yield();
+    }
+}
+
+/**
+ * Connect a client socket to the peer
+ * @return The connected socket, or NULL
+ */
+static tcp_socket_t *netbench_dial(const netbench_config_t *cfg, uint16_t port,
+                                   netbench_peer_t *peer) {
+    tcp_socket_t *sock = tcp_socket_create();
+    if (!sock) {
+        return NULL;
+    }
+    tcp_set_nonblock(sock, true);
+    tcp_set_nodelay(sock, true);
+    if (tcp_bind(sock, 0) != TCP_OK || tcp_connect(sock, cfg->peer_ip, port) != TCP_OK) {
+        tcp_abort(sock);
+        return NULL;
+    }
+
+    uint64_t deadline = timer_now_ms() + NETBENCH_TIMEOUT_MS;
+    while (!tcp_is_connected(sock)) {
+        if (sock->state == TCP_STATE_CLOSED || timer_now_ms() >= deadline) {
+            tcp_abort(sock);
+            return NULL;
+        }
+        netbench_idle(peer);
+    }
+    return sock;
+}
+
+/**
+ * Pattern to send, BENCH_MAX_BLOCK bytes
+ */
+static uint8_t *netbench_pattern(void) {
+    uint8_t *buf = kmalloc(BENCH_MAX_BLOCK);
+    for (size_t i = 0; buf && i < BENCH_MAX_BLOCK; i++) {
+        buf[i] = (uint8_t)i;
+    }
+    return buf;
+}
+
+static bool netbench_valid(const netbench_config_t *cfg, size_t max_size) {
+    return cfg && cfg->size > 0 && cfg->size <= max_size && cfg->count > 0 &&
+           cfg->count <= BENCH_MAX_OPS;
+}
+
+/**
+ * Send the stream and wait for it to be acknowledged, then close sock
+ */
+static int netbench_stream_send(tcp_socket_t *sock, const netbench_config_t *cfg, uint8_t *buf,
+                                bench_lat_t *lat, netbench_peer_t *peer, bench_result_t *res) {
+    int result = BENCH_OK;
+    uint64_t run_start = clock_cycles();
+    uint64_t deadline = timer_now_ms() + NETBENCH_TIMEOUT_MS;
+    for (uint32_t i = 0; i < cfg->count && result == BENCH_OK;) {
+        uint64_t start = clock_cycles();
+        ssize_t sent = tcp_send(sock, buf, cfg->size);
+        if (sent > 0) {
+            bench_lat_add(lat, clock_cycles() - start);
+            res->bytes += (uint64_t)sent;
+            res->ops++;
+            i++;
+            deadline = timer_now_ms() + NETBENCH_TIMEOUT_MS;
+        } else if (sent != TCP_ERR_WOULDBLOCK && sent != 0) {
+            res->errors++;
+            result = BENCH_ERR_CONNECT;
+        } else if (timer_now_ms() >= deadline) {
+            result = BENCH_ERR_TIMEOUT;
+        } else {
+            netbench_idle(peer);
+        }
+    }
+
+    /* Done once the peer has acknowledged every byte */
+    while (result == BENCH_OK && (sock->send_buf.used > 0 || sock->snd_una != sock->snd_max)) {
+        if (!tcp_is_connected(sock) || timer_now_ms() >= deadline) {
+            result = BENCH_ERR_TIMEOUT;
+            break;
+        }
+        netbench_idle(peer);
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - run_start);
+    tcp_close(sock);
+    netbench_peer_pump(peer);
+    return result;
+}
+
+int netbench_tcp_stream(const netbench_config_t *cfg, bench_result_t *res) {
+    if (!netbench_valid(cfg, BENCH_MAX_BLOCK) || !res) {
+        return BENCH_ERR_INVAL;
+    }
+
+    *res = (bench_result_t){ 0 };
+    netbench_peer_t peer = { 0 };
+    bench_lat_t lat = { 0 };
+    uint8_t *buf = netbench_pattern();
+    if (!buf || !bench_lat_init(&lat, cfg->count) ||
+        !netbench_peer_open(&peer, cfg, cfg->port, false, false)) {
+        netbench_peer_close(&peer);
+        kfree(lat.samples);
+        kfree(buf);
+        return BENCH_ERR_NOMEM;
+    }
+
+    tcp_socket_t *sock = netbench_dial(cfg, cfg->port, &peer);
+    int result = sock ? netbench_stream_send(sock, cfg, buf, &lat, &peer, res)
+                      : BENCH_ERR_CONNECT;
+
+    bench_lat_finish(&lat, res);
+    netbench_peer_close(&peer);
+    kfree(buf);
+    return result;
+}
+
+/**
+ * Run the request/response exchanges, then close sock
+ */
+static int netbench_rr_exchange(tcp_socket_t *sock, const netbench_config_t *cfg, uint8_t *buf,
+                                bench_lat_t *lat, netbench_peer_t *peer, bench_result_t *res) {
+    int result = BENCH_OK;
+    uint64_t run_start = clock_cycles();
+    for (uint32_t i = 0; i < cfg->count && result == BENCH_OK; i++) {
+        uint64_t start = clock_cycles();
+        uint64_t deadline = timer_now_ms() + NETBENCH_TIMEOUT_MS;
+        size_t sent = 0, got = 0;
+
+        while (got < cfg->size && result == BENCH_OK) {
+            ssize_t n = 0;
+            if (sent < cfg->size) {
+                n = tcp_send(sock, buf + sent, cfg->size - sent);
+                if (n > 0) {
+                    sent += (size_t)n;
+                }
+            }
+            ssize_t r = tcp_recv(sock, buf + BENCH_MAX_BLOCK / 2, cfg->size - got);
+            if (r > 0) {
+                got += (size_t)r;
+            }
+            if ((n < 0 && n != TCP_ERR_WOULDBLOCK) || (r < 0 && r != TCP_ERR_WOULDBLOCK) ||
+                !tcp_is_connected(sock)) {
+                res->errors++;
+                result = BENCH_ERR_CONNECT;
+            } else if (timer_now_ms() >= deadline) {
+                result = BENCH_ERR_TIMEOUT;
+            } else if (n <= 0 && r <= 0) {
+                netbench_idle(peer);
+            }
+        }
+        if (result == BENCH_OK) {
+            bench_lat_add(lat, clock_cycles() - start);
+            res->ops++;
+            res->bytes += 2 * (uint64_t)cfg->size;
+        }
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - run_start);
+    tcp_close(sock);
+    netbench_peer_pump(peer);
+    return result;
+}
+
+int netbench_tcp_rr(const netbench_config_t *cfg, bench_result_t *res) {
+    /* Responses land in the second half of the buffer */
+    if (!netbench_valid(cfg, BENCH_MAX_BLOCK / 2) || !res) {
+        return BENCH_ERR_INVAL;
+    }
+
+    *res = (bench_result_t){ 0 };
+    netbench_peer_t peer = { 0 };
+    bench_lat_t lat = { 0 };
+    uint8_t *buf = netbench_pattern();
+    if (!buf || !bench_lat_init(&lat, cfg->count) ||
+        !netbench_peer_open(&peer, cfg, cfg->port + 1, false, true)) {
+        netbench_peer_close(&peer);
+        kfree(lat.samples);
+        kfree(buf);
+        return BENCH_ERR_NOMEM;
+    }
+
+    tcp_socket_t *sock = netbench_dial(cfg, cfg->port + 1, &peer);
+    int result = sock ? netbench_rr_exchange(sock, cfg, buf, &lat, &peer, res)
+                      : BENCH_ERR_CONNECT;
+
+    bench_lat_finish(&lat, res);
+    netbench_peer_close(&peer);
+    kfree(buf);
+    return result;
+}
+
+int netbench_udp(const netbench_config_t *cfg, bench_result_t *res, uint64_t *received) {
+    if (!netbench_valid(cfg, UDP_MAX_PAYLOAD) || !res || !received) {
+        return BENCH_ERR_INVAL;
+    }
+
+    *res = (bench_result_t){ 0 };
+    *received = 0;
+    netbench_peer_t peer = { 0 };
+    bench_lat_t lat = { 0 };
+    uint8_t *buf = netbench_pattern();
+    udp_socket_t *sock = NULL;
+    if (!buf || !bench_lat_init(&lat, cfg->count) ||
+        !netbench_peer_open(&peer, cfg, cfg->port + 2, true, false) ||
+        !(sock = udp_bind(0))) {
+        netbench_peer_close(&peer);
+        kfree(lat.samples);
+        kfree(buf);
+        return BENCH_ERR_NOMEM;
+    }
+
+    uint64_t run_start = clock_cycles();
+    for (uint32_t i = 0; i < cfg->count; i++) {
+        uint64_t start = clock_cycles();
+        ssize_t sent = udp_sendto(sock, cfg->peer_ip, cfg->port + 2, buf, cfg->size);
+        if (sent > 0) {
+            bench_lat_add(&lat, clock_cycles() - start);
+            res->ops++;
+            res->bytes += (uint64_t)sent;
+        } else {
+            res->errors++;
+        }
+        netbench_peer_pump(&peer);
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - run_start);
+    netbench_peer_pump(&peer);
+    *received = peer.received;
+
+    udp_close(sock);
+    bench_lat_finish(&lat, res);
+    netbench_peer_close(&peer);
+    kfree(buf);
+    return BENCH_OK;
+}
+
+int netbench_connect(const netbench_config_t *cfg, bench_result_t *res) {
+    if (!cfg || !res || cfg->count == 0 || cfg->count > BENCH_MAX_OPS) {
+        return BENCH_ERR_INVAL;
+    }
+
+    *res = (bench_result_t){ 0 };
+    netbench_peer_t peer = { 0 };
+    bench_lat_t lat = { 0 };
+    if (!bench_lat_init(&lat, cfg->count) ||
+        !netbench_peer_open(&peer, cfg, cfg->port + 1, false, true)) {
+        netbench_peer_close(&peer);
+        kfree(lat.samples);
+        return BENCH_ERR_NOMEM;
+    }
+
+    uint64_t run_start = clock_cycles();
+    for (uint32_t i = 0; i < cfg->count; i++) {
+        uint64_t start = clock_cycles();
+        tcp_socket_t *sock = netbench_dial(cfg, cfg->port + 1, &peer);
+        if (!sock) {
+            res->errors++;
+            continue;
+        }
+        bench_lat_add(&lat, clock_cycles() - start);
+        res->ops++;
+        tcp_close(sock);
+        netbench_peer_pump(&peer);
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - run_start);
+
+    bench_lat_finish(&lat, res);
+    netbench_peer_close(&peer);
+    return res->ops > 0 ? BENCH_OK : BENCH_ERR_CONNECT;
+}
+
+int netbench_ping(uint32_t ip, uint32_t seconds, ping_stats_t *stats) {
+    if (!stats || seconds == 0) {
+        return BENCH_ERR_INVAL;
+    }
+    if (ping_start(ip) != ICMP_OK) {
+        return BENCH_ERR_CONNECT;
+    }
+
+    uint64_t end = timer_now_ms() + (uint64_t)seconds * 1000;
+    while (timer_now_ms() < end) {
+        scheduler_yield();
+    }
+    ping_stop();
+    *stats = *ping_get_stats();
+    return BENCH_OK;
+}
+
+/* ========== Shell Commands ========== */
+
+static void bench_print(const char *name, const bench_result_t *res) {
+    uint64_t ns = res->elapsed_ns ? res->elapsed_ns : 1;
+    uint64_t iops = res->ops * NSEC_PER_SEC / ns;
+    uint64_t kbps = res->bytes * (NSEC_PER_SEC / 1024) / ns;
+
+    vga_printf("%s: %llu ops, %llu IOPS, %llu.%02llu MB/s, p50 %llu us, p99 %llu us,"
+               " max %llu us",
+               name, res->ops, iops, kbps / 1024, (kbps % 1024) * 100 / 1024,
+               res->p50_ns / 1000, res->p99_ns / 1000, res->max_ns / 1000);
+    if (res->errors) {
+        vga_printf("  (%u errors)", res->errors);
+    }
+    vga_puts("\n");
+
+    kprintf("[BENCH] %s: ops=%llu iops=%llu kbps=%llu p50=%lluns p99=%lluns max=%lluns "
+            "errors=%u\n", name, res->ops, iops, kbps, res->p50_ns, res->p99_ns,
+            res->max_ns, res->errors);
+}
+
+/**
+ * blkbench <dev> <seqread|seqwrite|randread|randwrite> [bs_kb] [depth] [ops] [-f]
+ */
+static int cmd_blkbench(int argc, char *argv[]) {
+    if (argc < 3) {
+        vga_puts("Block devices:\n");
+        for (int i = 0; blk_get(i); i++) {
+            blk_queue_t *q = blk_get(i);
+            vga_printf("  %s: %llu sectors, depth %u\n", q->name,
+                       q->limits.total_sectors, q->limits.depth);
+        }
+        return argc == 1 ? 0 : 1;
+    }
+
+    blk_queue_t *q = blk_find(argv[1]);
+    if (!q) {
+        vga_printf("blkbench: no device %s\n", argv[1]);
+        return 1;
+    }
+
+    blkbench_config_t cfg = {
+        .block_sectors = BENCH_DEFAULT_BLOCK_KB * 1024 / BLK_SECTOR_SIZE,
+        .depth = BENCH_DEFAULT_DEPTH,
+        .ops = BENCH_DEFAULT_OPS,
+    };
+    if (bench_streq(argv[2], "seqread")) {
+        cfg.op = BLK_OP_READ;
+    } else if (bench_streq(argv[2], "seqwrite")) {
+        cfg.op = BLK_OP_WRITE;
+    } else if (bench_streq(argv[2], "randread")) {
+        cfg.op = BLK_OP_READ;
+        cfg.random = true;
+    } else if (bench_streq(argv[2], "randwrite")) {
+        cfg.op = BLK_OP_WRITE;
+        cfg.random = true;
+    } else {
+        vga_printf("blkbench: unknown mode %s\n", argv[2]);
+        return 1;
+    }
+
+    bool force = false;
+    int position = 0;
+    for (int i = 3; i < argc; i++) {
+        uint64_t value;
+        if (bench_streq(argv[i], "-f")) {
+            force = true;
+        } else if (bench_parse(argv[i], &value) && value > 0 && value <= UINT32_MAX) {
+            if (position == 0) {
+                cfg.block_sectors = (uint32_t)(value * 1024 / BLK_SECTOR_SIZE);
+            } else if (position == 1) {
+                cfg.depth = (uint32_t)value;
+            } else if (position == 2) {
+                cfg.ops = (uint32_t)value;
+            }
+            position++;
+        } else {
+            vga_printf("blkbench: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (cfg.op == BLK_OP_WRITE && !force) {
+        vga_puts("blkbench: writes destroy data on the device; add -f to run\n");
+        return 1;
+    }
+
+    bench_result_t res;
+    int result = blkbench_run(q, &cfg, &res);
+    if (result != BENCH_OK) {
+        vga_printf("blkbench: cannot run (%d)\n", result);
+        return 1;
+    }
+
+    vga_printf("%s %s, %u KB blocks, depth %u:\n", q->name, argv[2],
+               cfg.block_sectors * BLK_SECTOR_SIZE / 1024, cfg.depth);
+    bench_print(argv[2], &res);
+    return 0;
+}
+
+/**
+ * fsbench files <dir> [count] | read <file> [bs_kb] | write <file> <size_kb> [bs_kb]
+ */
+static int cmd_fsbench(int argc, char *argv[]) {
+    if (argc < 3) {
+        vga_puts("Usage: fsbench files <dir> [count]\n"
+                 "       fsbench read <file> [bs_kb]\n"
+                 "       fsbench write <file> <size_kb> [bs_kb]\n");
+        return 1;
+    }
+
+    uint64_t args[2] = { 0, 0 };
+    int nargs = 0;
+    for (int i = 3; i < argc && nargs < 2; i++) {
+        if (!bench_parse(argv[i], &args[nargs]) || args[nargs] == 0 ||
+            args[nargs] > UINT32_MAX) {
+            vga_printf("fsbench: bad argument %s\n", argv[i]);
+            return 1;
+        }
+        nargs++;
+    }
+
+    int result;
+    if (bench_streq(argv[1], "files")) {
+        uint32_t count = nargs > 0 ? (uint32_t)args[0] : BENCH_DEFAULT_FILES;
+        fsbench_files_result_t res;
+        result = fsbench_files(argv[2], count, &res);
+        if (result == BENCH_OK) {
+            vga_printf("%s, %u files:\n", argv[2], count);
+            bench_print("create", &res.create);
+            bench_print("stat", &res.stat);
+            bench_print("list", &res.list);
+            bench_print("unlink", &res.unlink);
+        }
+    } else if (bench_streq(argv[1], "read")) {
+        uint32_t block = (nargs > 0 ? (uint32_t)args[0] : BENCH_DEFAULT_FILE_KB) * 1024;
+        bench_result_t res;
+        result = fsbench_read(argv[2], block, &res);
+        if (result == BENCH_OK) {
+            bench_print("read", &res);
+        }
+    } else if (bench_streq(argv[1], "write") && nargs > 0) {
+        uint32_t block = (nargs > 1 ? (uint32_t)args[1] : BENCH_DEFAULT_FILE_KB) * 1024;
+        bench_result_t res;
+        result = fsbench_write(argv[2], args[0] * 1024, block, &res);
+        if (result == BENCH_OK) {
+            bench_print("write", &res);
+        }
+    } else {
+        vga_printf("fsbench: unknown test %s\n", argv[1]);
+        return 1;
+    }
+
+    if (result != BENCH_OK) {
+        vga_printf("fsbench: cannot run (%d)\n", result);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * csumbench [bytes] [iterations]
+ */
+static int cmd_csumbench(int argc, char *argv[]) {
+    uint64_t args[2] = { BENCH_DEFAULT_CSUM_LEN, BENCH_DEFAULT_CSUM_OPS };
+    for (int i = 1; i < argc && i <= 2; i++) {
+        if (!bench_parse(argv[i], &args[i - 1]) || args[i - 1] == 0 ||
+            args[i - 1] > UINT32_MAX) {
+            vga_printf("csumbench: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    vga_printf("Checksum of %llu bytes, %llu iterations:\n", args[0], args[1]);
+    bool first = true;
+    uint16_t reference = 0;
+    for (int impl = 0; impl < CSUM_IMPL_COUNT; impl++) {
+        const char *name = csum_impl_name((csum_impl_t)impl);
+        if (!csum_impl_available((csum_impl_t)impl)) {
+            vga_printf("  %s: not available\n", name);
+            continue;
+        }
+
+        bench_result_t res;
+        uint16_t sum;
+        int result = csumbench_run((csum_impl_t)impl, (size_t)args[0], (uint32_t)args[1],
+                                   &res, &sum);
+        if (result != BENCH_OK) {
+            vga_printf("csumbench: cannot run (%d)\n", result);
+            return 1;
+        }
+
+        uint64_t ns = res.elapsed_ns ? res.elapsed_ns : 1;
+        uint64_t mbps = res.bytes * (NSEC_PER_SEC / (1024 * 1024)) / ns;
+        vga_printf("  %s: p50 %llu ns, p99 %llu ns, %llu MB/s, sum 0x%04x%s\n", name,
+                   res.p50_ns, res.p99_ns, mbps, sum,
+                   (!first && sum != reference) ? " MISMATCH" : "");
+        kprintf("[BENCH] csum %s: len=%llu p50=%lluns p99=%lluns mbps=%llu sum=0x%04x\n",
+                name, args[0], res.p50_ns, res.p99_ns, mbps, sum);
+        if (first) {
+            reference = sum;
+            first = false;
+        }
+    }
+    return 0;
+}
+
+/**
+ * pixbench [width] [height] [iterations]
+ */
+static int cmd_pixbench(int argc, char *argv[]) {
+    uint64_t args[3] = { BENCH_DEFAULT_PIX_W, BENCH_DEFAULT_PIX_H, BENCH_DEFAULT_PIX_OPS };
+    for (int i = 1; i < argc && i <= 3; i++) {
+        if (!bench_parse(argv[i], &args[i - 1]) || args[i - 1] == 0 ||
+            args[i - 1] > BENCH_MAX_PIXELS) {
+            vga_printf("pixbench: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    vga_printf("Pixel operations on %llux%llu, %llu iterations:\n", args[0], args[1], args[2]);
+    for (int op = 0; op < PIXOPS_OP_COUNT; op++) {
+        const char *op_name = pixops_op_name((pixops_op_t)op);
+        uint32_t reference = 0;
+        uint64_t scalar_ns = 0;
+
+        for (int impl = 0; impl < PIXOPS_IMPL_COUNT; impl++) {
+            const char *name = pixops_impl_name((pixops_impl_t)impl);
+            if (!pixops_impl_available((pixops_impl_t)impl)) {
+                vga_printf("  %s %s: not available\n", op_name, name);
+                continue;
+            }
+
+            bench_result_t res;
+            uint32_t hash;
+            int result = pixbench_run((pixops_impl_t)impl, (pixops_op_t)op, (int)args[0],
+                                      (int)args[1], (uint32_t)args[2], &res, &hash);
+            if (result != BENCH_OK) {
+                vga_printf("pixbench: cannot run (%d)\n", result);
+                return 1;
+            }
+
+            uint64_t ns = res.elapsed_ns ? res.elapsed_ns : 1;
+            uint64_t mbps = res.bytes * (NSEC_PER_SEC / (1024 * 1024)) / ns;
+            if (impl == PIXOPS_IMPL_SCALAR) {
+                reference = hash;
+                scalar_ns = res.p50_ns;
+            }
+            uint64_t speedup = res.p50_ns ? scalar_ns * 10 / res.p50_ns : 0;
+            vga_printf("  %s %s: p50 %llu us, %llu MB/s, %llu.%llux%s\n", op_name, name,
+                       res.p50_ns / 1000, mbps, speedup / 10, speedup % 10,
+                       hash != reference ? " MISMATCH" : "");
+            kprintf("[BENCH] pix %s %s: %llux%llu p50=%lluns p99=%lluns mbps=%llu hash=0x%08x\n",
+                    op_name, name, args[0], args[1], res.p50_ns, res.p99_ns, mbps, hash);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Parse a dotted-quad IPv4 address into host byte order
+ */
+static bool bench_parse_ip(const char *s, uint32_t *out) {
+    uint32_t ip = 0;
+    for (int part = 0; part < 4; part++) {
+        uint32_t value = 0;
+        int digits = 0;
+        while (*s >= '0' && *s <= '9' && digits < 4) {
+            value = value * 10 + (uint32_t)(*s++ - '0');
+            digits++;
+        }
+        if (digits == 0 || value > 255 || *s != (part < 3 ? '.' : '\0')) {
+            return false;
+        }
+        if (part < 3) {
+            s++;
+        }
+        ip = (ip << 8) | value;
+    }
+    *out = ip;
+    return true;
+}
+
+static void netbench_print(const char *name, const netbench_config_t *cfg,
+                           const bench_result_t *res) {
+    uint64_t ns = res->elapsed_ns ? res->elapsed_ns : 1;
+    uint64_t rate = res->ops * NSEC_PER_SEC / ns;
+    uint64_t cgbps = res->bytes * 800 / ns;       /* Hundredths of Gbit/s */
+
+    vga_printf("%s %u B: %llu ops, %llu/s, %llu.%02llu Gbps, p50 %llu ns, p99 %llu ns,"
+               " max %llu ns", name, cfg->size, res->ops, rate, cgbps / 100, cgbps % 100,
+               res->p50_ns, res->p99_ns, res->max_ns);
+    if (res->errors) {
+        vga_printf("  (%u errors)", res->errors);
+    }
+    vga_puts("\n");
+
+    kprintf("[BENCH] net %s: size=%u ops=%llu rate=%llu cgbps=%llu p50=%lluns p99=%lluns "
+            "max=%lluns errors=%u\n", name, cfg->size, res->ops, rate, cgbps,
+            res->p50_ns, res->p99_ns, res->max_ns, res->errors);
+}
+
+/**
+ * Run one network test and print it
+ * @return 0 on success, 1 if it could not run
+ */
+static int netbench_run_test(const char *test, netbench_config_t cfg, bool size_set,
+                             bool count_set) {
+    static const uint32_t udp_sizes[] = { 64, 512, 1472 };
+    bench_result_t res;
+    int result;
+
+    if (bench_streq(test, "stream")) {
+        cfg.size = size_set ? cfg.size : NETBENCH_DEFAULT_STREAM_SIZE;
+        cfg.count = count_set ? cfg.count : NETBENCH_DEFAULT_STREAM_OPS;
+        result = netbench_tcp_stream(&cfg, &res);
+        if (result == BENCH_OK) {
+            netbench_print("tcp stream", &cfg, &res);
+        }
+    } else if (bench_streq(test, "rr")) {
+        cfg.size = size_set ? cfg.size : NETBENCH_DEFAULT_RR_SIZE;
+        cfg.count = count_set ? cfg.count : NETBENCH_DEFAULT_RR_OPS;
+        result = netbench_tcp_rr(&cfg, &res);
+        if (result == BENCH_OK) {
+            netbench_print("tcp rr", &cfg, &res);
+        }
+    } else if (bench_streq(test, "udp")) {
+        cfg.count = count_set ? cfg.count : NETBENCH_DEFAULT_UDP_OPS;
+        result = BENCH_OK;
+        for (size_t i = 0; i < sizeof(udp_sizes) / sizeof(udp_sizes[0]); i++) {
+            if (size_set && i > 0) {
+                break;
+            }
+            cfg.size = size_set ? cfg.size : udp_sizes[i];
+            uint64_t received;
+            result = netbench_udp(&cfg, &res, &received);
+            if (result != BENCH_OK) {
+                break;
+            }
+            netbench_print("udp", &cfg, &res);
+            if (netbench_is_loopback(cfg.peer_ip)) {
+                vga_printf("  received %llu of %llu\n", received, res.ops);
+            }
+        }
+    } else if (bench_streq(test, "connect")) {
+        cfg.size = 0;
+        cfg.count = count_set ? cfg.count : NETBENCH_DEFAULT_CONNECTS;
+        result = netbench_connect(&cfg, &res);
+        if (result == BENCH_OK) {
+            netbench_print("tcp connect", &cfg, &res);
+        }
+    } else if (bench_streq(test, "ping")) {
+        ping_stats_t stats;
+        uint32_t seconds = count_set ? cfg.count : NETBENCH_DEFAULT_PING_SECONDS;
+        result = netbench_ping(cfg.peer_ip, seconds, &stats);
+        if (result == BENCH_OK) {
+            vga_printf("ping: %u sent, %u received, rtt min/avg/max %u/%u/%u ms\n",
+                       stats.packets_sent, stats.packets_received, stats.rtt_min,
+                       stats.rtt_avg, stats.rtt_max);
+            kprintf("[BENCH] net ping: sent=%u received=%u min=%ums avg=%ums max=%ums\n",
+                    stats.packets_sent, stats.packets_received, stats.rtt_min,
+                    stats.rtt_avg, stats.rtt_max);
+        }
+    } else {
+        vga_printf("netbench: unknown test %s\n", test);
+        return 1;
+    }
+
+    if (result != BENCH_OK) {
+        vga_printf("netbench: %s failed (%d)\n", test, result);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * netbench <stream|rr|udp|connect|ping|all> [ip] [size] [count]
+ */
+static int cmd_netbench(int argc, char *argv[]) {
+    if (argc < 2) {
+        vga_puts("Usage: netbench <stream|rr|udp|connect|ping|all> [ip] [size] [count]\n"
+                 "       ip defaults to 127.0.0.1 (served in-kernel); for another host\n"
+                 "       run scripts/netbench-peer.py there. For ping, count is seconds.\n");
+        return 1;
+    }
+
+    netbench_config_t cfg = { .peer_ip = NETBENCH_LOOPBACK, .port = NETBENCH_PORT };
+    if (argc > 2 && !bench_parse_ip(argv[2], &cfg.peer_ip)) {
+        vga_printf("netbench: bad address %s\n", argv[2]);
+        return 1;
+    }
+    uint64_t args[2] = { 0, 0 };
+    for (int i = 3; i < argc && i <= 4; i++) {
+        if (!bench_parse(argv[i], &args[i - 3]) || args[i - 3] == 0 ||
+            args[i - 3] > BENCH_MAX_BLOCK) {
+            vga_printf("netbench: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    cfg.size = (uint32_t)args[0];
+    cfg.count = (uint32_t)args[1];
+
+    if (!bench_streq(argv[1], "all")) {
+        return netbench_run_test(argv[1], cfg, argc > 3, argc > 4);
+    }
+
+    static const char *tests[] = { "stream", "rr", "udp", "connect", "ping" };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        failed |= netbench_run_test(tests[i], cfg, argc > 3, argc > 4);
+    }
+    return failed;
+}
+
+static const shell_command_t bench_commands[] = {
+    {"blkbench", "Benchmark a block device",
+     "<dev> <seqread|seqwrite|randread|randwrite> [bs_kb] [depth] [ops] [-f]", cmd_blkbench},
+    {"fsbench",  "Benchmark the filesystem",
+     "files <dir> [count] | read <file> [bs_kb] | write <file> <size_kb> [bs_kb]", cmd_fsbench},
+    {"csumbench", "Benchmark the internet checksum implementations",
+     "[bytes] [iterations]", cmd_csumbench},
+    {"pixbench", "Benchmark the pixel fill, copy and blend kernels",
+     "[width] [height] [iterations]", cmd_pixbench},
+    {"netbench", "Benchmark the network stack",
+     "<stream|rr|udp|connect|ping|all> [ip] [size] [count]", cmd_netbench},
+};
+
+void bench_register_commands(void) {
+    for (size_t i = 0; i < sizeof(bench_commands) / sizeof(bench_commands[0]); i++) {
+        if (shell_register_command(&bench_commands[i]) < 0) {
+            kprintf("[SHELL] Warning: Failed to register command '%s'\n",
+                    bench_commands[i].name);
+        }
+    }
+}
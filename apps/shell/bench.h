@@ -0,0 +1,192 @@
+/**
+ * AAAos Kernel Shell - Storage and Checksum Benchmarks
+ *
+ * Measures the block layer (any registered device: AHCI drives, NVMe
+ * namespaces) and the filesystems behind the VFS. Each run reports
+ * operations per second, throughput and the median and 99th percentile
+ * latency, timed with the TSC clock.
+ *
+ * The block benchmark keeps a fixed number of requests in flight: each
+ * slot is resubmitted as soon as its request finishes, so the device
+ * sees a steady queue depth. The filesystem benchmarks time each create,
+ * stat, directory entry and unlink separately, and stream a file through
+ * vfs_read/vfs_write at a chosen block size.
+ *
+ * The checksum benchmark times each internet checksum implementation
+ * (checksum.h) on the same buffer and checks that they agree. The pixel
+ * benchmark does the same for the fill, copy and blend kernels (pixops.h)
+ * on a screen-sized buffer.
+ *
+ * The network benchmarks drive tcp_send/tcp_recv and udp_sendto against
+ * a peer at NETBENCH_PORT (stream sink), NETBENCH_PORT + 1 (echo) and
+ * NETBENCH_PORT + 2 (UDP sink). For a 127.x.x.x peer the benchmark plays
+ * the peer itself, over the loopback device; for any other address,
+ * scripts/netbench-peer.py runs the peer on the host at the far end of
+ * the e1000 link. Ping latency comes from ping_start's statistics.
+ *
+ * All of this is also reachable from the shell: bench_register_commands
+ * adds "blkbench", "fsbench", "csumbench", "pixbench" and "netbench".
+ */
+
+#ifndef _AAAOS_SHELL_BENCH_H
+#define _AAAOS_SHELL_BENCH_H
+
+#include "../../kernel/include/types.h"
+#include "../../drivers/block/blk.h"
+#include "../../net/core/checksum.h"
+#include "../../drivers/video/pixops.h"
+#include "../../net/icmp/icmp.h"
+
+/* Limits */
+#define BENCH_MAX_OPS           65536   /* Latency samples per run */
+#define BENCH_MAX_DEPTH         64      /* Block requests in flight */
+#define BENCH_MAX_BLOCK         (1024 * 1024)   /* Largest block size in bytes */
+#define BENCH_MAX_PIXELS        (4096 * 2160)   /* Largest pixel benchmark buffer */
+
+/* Network benchmark peer */
+#define NETBENCH_PORT           5201    /* Stream sink; echo and UDP sink follow */
+#define NETBENCH_LOOPBACK       0x7F000001      /* 127.0.0.1 */
+#define NETBENCH_TIMEOUT_MS     5000    /* Longest wait without progress */
+
+/* Error codes */
+#define BENCH_OK                0
+#define BENCH_ERR_INVAL         (-22)
+#define BENCH_ERR_NOMEM         (-12)
+#define BENCH_ERR_TIMEOUT       (-110)
+#define BENCH_ERR_CONNECT       (-111)
+
+/**
+ * Result of one run
+ */
+typedef struct bench_result {
+    uint64_t ops;                       /* Operations that finished */
+    uint64_t bytes;                     /* Data moved */
+    uint64_t elapsed_ns;                /* Wall time of the run */
+    uint64_t p50_ns;                    /* Median latency */
+    uint64_t p99_ns;                    /* 99th percentile latency */
+    uint64_t max_ns;                    /* Longest latency */
+    uint32_t errors;                    /* Operations that failed */
+} bench_result_t;
+
+/**
+ * Block benchmark parameters
+ */
+typedef struct blkbench_config {
+    blk_op_t op;                        /* Read or write */
+    bool random;                        /* Random offsets, otherwise sequential */
+    uint32_t block_sectors;             /* Sectors per request */
+    uint32_t depth;                     /* Requests in flight (1..BENCH_MAX_DEPTH) */
+    uint32_t ops;                       /* Requests in the run (1..BENCH_MAX_OPS) */
+    uint64_t start_lba;                 /* First sector of the region used */
+    uint64_t span_sectors;              /* Size of the region, 0 for the rest of the device */
+} blkbench_config_t;
+
+/**
+ * Filesystem metadata benchmark result, one per phase
+ */
+typedef struct fsbench_files_result {
+    bench_result_t create;
+    bench_result_t stat;
+    bench_result_t list;                /* One operation per directory entry read */
+    bench_result_t unlink;
+} fsbench_files_result_t;
+
+/**
+ * Run a block benchmark
+ * Writes destroy the sectors they cover.
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int blkbench_run(blk_queue_t *q, const blkbench_config_t *cfg, bench_result_t *res);
+
+/**
+ * Create, stat, list and unlink count files in a directory
+ * The directory is created if missing; the files are removed afterwards.
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int fsbench_files(const char *dir, uint32_t count, fsbench_files_result_t *res);
+
+/**
+ * Read a whole file sequentially
+ * @param block_size Bytes per vfs_read call
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int fsbench_read(const char *path, uint32_t block_size, bench_result_t *res);
+
+/**
+ * Write a file of size bytes sequentially, replacing its contents
+ * @param block_size Bytes per vfs_write call
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int fsbench_write(const char *path, uint64_t size, uint32_t block_size, bench_result_t *res);
+
+/**
+ * Time one checksum implementation over a buffer of len bytes
+ * @param iters Checksums to compute (1..BENCH_MAX_OPS)
+ * @param sum Set to the folded checksum, for comparing implementations
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int csumbench_run(csum_impl_t impl, size_t len, uint32_t iters, bench_result_t *res,
+                  uint16_t *sum);
+
+/**
+ * Time one pixel operation on a w x h buffer
+ * Every implementation starts from the same buffer contents, so equal
+ * hashes mean equal results.
+ * @param iters Operations on the whole buffer (1..BENCH_MAX_OPS)
+ * @param hash Set to a hash of the result
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int pixbench_run(pixops_impl_t impl, pixops_op_t op, int w, int h, uint32_t iters,
+                 bench_result_t *res, uint32_t *hash);
+
+/**
+ * Network benchmark parameters
+ */
+typedef struct netbench_config {
+    uint32_t peer_ip;                   /* Host byte order; 127.x.x.x serves itself */
+    uint16_t port;                      /* Base port of the peer (NETBENCH_PORT) */
+    uint32_t size;                      /* Bytes per send, request or datagram */
+    uint32_t count;                     /* Sends, transactions, datagrams or connections */
+} netbench_config_t;
+
+/**
+ * Stream count sends of size bytes to the sink
+ * Timed until the peer has acknowledged everything; latency is per send.
+ * @return BENCH_OK, or a negative error code if the run failed
+ */
+int netbench_tcp_stream(const netbench_config_t *cfg, bench_result_t *res);
+
+/**
+ * Exchange count size-byte requests and responses with the echo peer
+ * Latency is per round trip; size is at most BENCH_MAX_BLOCK / 2.
+ * @return BENCH_OK, or a negative error code if the run failed
+ */
+int netbench_tcp_rr(const netbench_config_t *cfg, bench_result_t *res);
+
+/**
+ * Send count size-byte datagrams to the UDP sink
+ * @param received Set to the datagrams the sink got (loopback only, else 0)
+ * @return BENCH_OK, or a negative error code if the run could not start
+ */
+int netbench_udp(const netbench_config_t *cfg, bench_result_t *res, uint64_t *received);
+
+/**
+ * Open and close count connections to the echo peer
+ * Latency is from tcp_connect until the connection is established.
+ * @return BENCH_OK, or a negative error code if no connection succeeded
+ */
+int netbench_connect(const netbench_config_t *cfg, bench_result_t *res);
+
+/**
+ * Ping a host with ping_start for seconds seconds
+ * @return BENCH_OK, or a negative error code if the ping could not start
+ */
+int netbench_ping(uint32_t ip, uint32_t seconds, ping_stats_t *stats);
+
+/**
+ * Register the "blkbench", "fsbench", "csumbench", "pixbench" and "netbench"
+ * shell commands
+ */
+void bench_register_commands(void);
+
+#endif /* _AAAOS_SHELL_BENCH_H */
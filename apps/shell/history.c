@@ -0,0 +1,367 @@
+/**
+ * AAAos Kernel Shell - Command History Implementation
+ */
+
+#include "history.h"
+#include "shell.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/heap.h"
+#include "../../fs/vfs/vfs.h"
+#include "../../lib/libc/string.h"
+
+/* Slots of the first trigram table (power of two) */
+#define HISTORY_TRIGRAM_SLOTS   1024
+
+/**
+ * Trigram and the entries holding it
+ */
+typedef struct {
+    uint32_t key;                       /* The three characters; 0 for a free slot */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ids;                      /* Entry numbers, ascending */
+} history_trigram_t;
+
+/* Entries: NUL-terminated commands packed in one arena */
+static char *history_text;
+static size_t history_text_len;
+static size_t history_text_capacity;
+static uint32_t *history_offsets;       /* Start of each entry in the arena */
+static uint32_t history_entries;
+static uint32_t history_capacity;
+
+/* Trigram index (open addressing, linear probing) */
+static history_trigram_t *history_trigrams;
+static uint32_t history_trigram_slots;
+static uint32_t history_trigram_used;
+
+/* History file */
+static bool history_loaded;
+static vfs_file_t *history_file;        /* Opened for appending on the first add */
+static bool history_file_failed;
+
+static uint32_t history_trigram_key(const char *s) {
+    return (uint32_t)(uint8_t)s[0] << 16 | (uint32_t)(uint8_t)s[1] << 8 | (uint8_t)s[2];
+}
+
+static uint32_t history_trigram_slot(uint32_t key) {
+    return (key * 2654435761u) & (history_trigram_slots - 1);
+}
+
+/**
+ * Double the trigram table (or create it)
+ */
+static bool history_trigram_grow(void) {
+    uint32_t slots = history_trigram_slots ? history_trigram_slots * 2 : HISTORY_TRIGRAM_SLOTS;
+    history_trigram_t *table = (history_trigram_t*)kmalloc(slots * sizeof(history_trigram_t));
+    if (!table) {
+        return false;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        table[i].key = 0;
+    }
+
+    history_trigram_t *old = history_trigrams;
+    uint32_t old_slots = history_trigram_slots;
+    history_trigrams = table;
+    history_trigram_slots = slots;
+
+    for (uint32_t i = 0; i < old_slots; i++) {
+        if (old[i].key) {
+            uint32_t slot = history_trigram_slot(old[i].key);
+            while (table[slot].key) {
+                slot = (slot + 1) & (slots - 1);
+            }
+            table[slot] = old[i];
+        }
+    }
+    kfree(old);
+    return true;
+}
+
+/**
+ * Find a trigram's entry list
+ * @param create Add the trigram if it is missing
+ * @return The list, or NULL if missing (or out of memory)
+ */
+static history_trigram_t* history_trigram_find(uint32_t key, bool create) {
+    /* Keep the table at most three quarters full */
+    if (create && (history_trigram_used + 1) * 4 > history_trigram_slots * 3 &&
+        !history_trigram_grow()) {
+        return NULL;
+    }
+    if (!history_trigrams) {
+        return NULL;
+    }
+
+    uint32_t slot = history_trigram_slot(key);
+    while (history_trigrams[slot].key) {
+        if (history_trigrams[slot].key == key) {
+            return &history_trigrams[slot];
+        }
+        slot = (slot + 1) & (history_trigram_slots - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    history_trigram_t *t = &history_trigrams[slot];
+    t->key = key;
+    t->count = 0;
+    t->capacity = 0;
+    t->ids = NULL;
+    history_trigram_used++;
+    return t;
+}
+
+/**
+ * Add an entry to the lists of its trigrams
+ */
+static bool history_index_entry(uint32_t id) {
+    const char *entry = history_text + history_offsets[id];
+
+    for (size_t i = 0; entry[i] && entry[i + 1] && entry[i + 2]; i++) {
+        history_trigram_t *t = history_trigram_find(history_trigram_key(entry + i), true);
+        if (!t) {
+            return false;
+        }
+        if (t->count > 0 && t->ids[t->count - 1] == id) {
+            continue;               /* Trigram repeats within the entry */
+        }
+        if (t->count == t->capacity) {
+            uint32_t capacity = t->capacity ? t->capacity * 2 : 4;
+            uint32_t *ids = (uint32_t*)krealloc(t->ids, capacity * sizeof(uint32_t));
+            if (!ids) {
+                return false;
+            }
+            t->ids = ids;
+            t->capacity = capacity;
+        }
+        t->ids[t->count++] = id;
+    }
+    return true;
+}
+
+/**
+ * Drop the older half of the entries and index the rest again
+ */
+static void history_drop_oldest(void) {
+    uint32_t drop = history_entries - history_entries / 2;
+    uint32_t base = history_offsets[drop];
+
+    memmove(history_text, history_text + base, history_text_len - base);
+    history_text_len -= base;
+    history_entries -= drop;
+    for (uint32_t i = 0; i < history_entries; i++) {
+        history_offsets[i] = history_offsets[i + drop] - base;
+    }
+
+    for (uint32_t i = 0; i < history_trigram_slots; i++) {
+        if (history_trigrams[i].key) {
+            kfree(history_trigrams[i].ids);
+            history_trigrams[i].key = 0;
+        }
+    }
+    history_trigram_used = 0;
+    for (uint32_t i = 0; i < history_entries; i++) {
+        history_index_entry(i);
+    }
+}
+
+/**
+ * Store and index a new entry
+ * @return false if it was skipped or there was no memory for it
+ */
+static bool history_store(const char *cmd, size_t len) {
+    if (len == 0 ||
+        (history_entries > 0 &&
+         strcmp(history_text + history_offsets[history_entries - 1], cmd) == 0)) {
+        return false;
+    }
+    if (history_entries == SHELL_HISTORY_MAX) {
+        history_drop_oldest();
+    }
+
+    if (history_entries == history_capacity) {
+        uint32_t capacity = history_capacity ? history_capacity * 2 : 64;
+        uint32_t *offsets = (uint32_t*)krealloc(history_offsets, capacity * sizeof(uint32_t));
+        if (!offsets) {
+            return false;
+        }
+        history_offsets = offsets;
+        history_capacity = capacity;
+    }
+    if (history_text_len + len + 1 > history_text_capacity) {
+        size_t capacity = history_text_capacity ? history_text_capacity * 2 : 4096;
+        while (capacity < history_text_len + len + 1) {
+            capacity *= 2;
+        }
+        char *text = (char*)krealloc(history_text, capacity);
+        if (!text) {
+            return false;
+        }
+        history_text = text;
+        history_text_capacity = capacity;
+    }
+
+    uint32_t id = history_entries;
+    history_offsets[id] = (uint32_t)history_text_len;
+    memcpy(history_text + history_text_len, cmd, len);
+    history_text[history_text_len + len] = '\0';
+
+    /* Lists may already hold id from a failed attempt; searches verify
+     * every match, so that is harmless */
+    if (!history_index_entry(id)) {
+        kprintf("[SHELL] Out of memory indexing history\n");
+        return false;
+    }
+    history_text_len += len + 1;
+    history_entries++;
+    return true;
+}
+
+/**
+ * Read the history file, the first time history is used
+ */
+static void history_load(void) {
+    if (history_loaded) {
+        return;
+    }
+    history_loaded = true;
+
+    vfs_file_t *file = vfs_open(SHELL_HISTORY_PATH, VFS_O_RDONLY);
+    if (!file) {
+        return;
+    }
+
+    /* Overlong lines are cut to what the shell can take */
+    char buf[512];
+    char line[SHELL_MAX_INPUT];
+    size_t len = 0;
+    ssize_t n;
+
+    while ((n = vfs_read(file, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                if (len < sizeof(line) - 1) {
+                    line[len++] = buf[i];
+                }
+                continue;
+            }
+            line[len] = '\0';
+            history_store(line, len);
+            len = 0;
+        }
+    }
+    if (len > 0) {
+        line[len] = '\0';
+        history_store(line, len);
+    }
+    vfs_close(file);
+
+    kprintf("[SHELL] Loaded %u history entries\n", history_entries);
+}
+
+/**
+ * Append an entry to the history file
+ */
+static void history_save(const char *cmd, size_t len) {
+    if (history_file_failed) {
+        return;
+    }
+    if (!history_file) {
+        history_file = vfs_open(SHELL_HISTORY_PATH, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_APPEND);
+        if (!history_file) {
+            kprintf("[SHELL] Cannot open %s, history is not saved\n", SHELL_HISTORY_PATH);
+            history_file_failed = true;
+            return;
+        }
+    }
+
+    char line[SHELL_MAX_INPUT + 1];
+    memcpy(line, cmd, len);
+    line[len] = '\n';
+    if (vfs_write(history_file, line, len + 1) != (ssize_t)(len + 1)) {
+        kprintf("[SHELL] Failed to write %s, history is not saved\n", SHELL_HISTORY_PATH);
+        vfs_close(history_file);
+        history_file = NULL;
+        history_file_failed = true;
+    }
+}
+
+void history_add(const char *cmd) {
+    history_load();
+
+    size_t len = strlen(cmd);
+    if (len >= SHELL_MAX_INPUT) {
+        len = SHELL_MAX_INPUT - 1;
+    }
+    if (history_store(cmd, len)) {
+        history_save(cmd, len);
+    }
+}
+
+uint32_t history_count(void) {
+    history_load();
+    return history_entries;
+}
+
+const char* history_get(uint32_t index) {
+    history_load();
+    if (index >= history_entries) {
+        return NULL;
+    }
+    return history_text + history_offsets[index];
+}
+
+int64_t history_search(const char *query, uint32_t before) {
+    history_load();
+
+    size_t len = strlen(query);
+    if (len == 0) {
+        return -1;
+    }
+    if (before > history_entries) {
+        before = history_entries;
+    }
+
+    if (len < 3) {
+        for (uint32_t id = before; id-- > 0; ) {
+            if (strstr(history_text + history_offsets[id], query)) {
+                return id;
+            }
+        }
+        return -1;
+    }
+
+    /* Only entries holding every trigram of the query can match; try
+     * those of its rarest one */
+    history_trigram_t *rarest = NULL;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        history_trigram_t *t = history_trigram_find(history_trigram_key(query + i), false);
+        if (!t || t->count == 0) {
+            return -1;
+        }
+        if (!rarest || t->count < rarest->count) {
+            rarest = t;
+        }
+    }
+
+    /* Newest listed entry before the given one */
+    uint32_t lo = 0, hi = rarest->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (rarest->ids[mid] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo-- > 0) {
+        uint32_t id = rarest->ids[lo];
+        if (id < history_entries && strstr(history_text + history_offsets[id], query)) {
+            return id;
+        }
+    }
+    return -1;
+}
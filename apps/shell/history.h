@@ -0,0 +1,52 @@
+/**
+ * AAAos Kernel Shell - Command History
+ *
+ * Every command entered is appended to SHELL_HISTORY_PATH, so history
+ * outlives the session; the file is only written at its end. It is read
+ * back the first time history is used rather than when the shell starts.
+ *
+ * Entries live in one append-only text arena. For reverse search each
+ * entry's trigrams (substrings of three characters) are indexed: a hash
+ * table maps every trigram to the ascending list of entries holding it.
+ * A query is only compared against the entries listed under its rarest
+ * trigram, newest first, which keeps searching tens of thousands of
+ * entries fast. Queries shorter than a trigram are matched by scanning.
+ */
+
+#ifndef _AAAOS_SHELL_HISTORY_H
+#define _AAAOS_SHELL_HISTORY_H
+
+#include "../../kernel/include/types.h"
+
+#define SHELL_HISTORY_PATH      "/.shell_history"
+#define SHELL_HISTORY_MAX       65536   /* Entries kept; the oldest half goes when full */
+
+/**
+ * Add a command to the history
+ * Empty commands and repeats of the last one are skipped.
+ * @param cmd Command line
+ */
+void history_add(const char *cmd);
+
+/**
+ * Number of entries, oldest first
+ */
+uint32_t history_count(void);
+
+/**
+ * Get an entry
+ * @param index Entry number (0 is the oldest)
+ * @return The command, or NULL if there is no such entry
+ */
+const char* history_get(uint32_t index);
+
+/**
+ * Find the newest entry before another that contains a string
+ * @param query String to look for
+ * @param before Entry to search back from (exclusive), history_count()
+ *               to search everything
+ * @return Entry number, or -1 if none matches
+ */
+int64_t history_search(const char *query, uint32_t before);
+
+#endif /* _AAAOS_SHELL_HISTORY_H */
@@ -0,0 +1,202 @@
+/**
+ * AAAos Kernel Shell - Network Diagnostics Implementation
+ */
+
+#include "netcmd.h"
+#include "shell.h"
+#include "../../kernel/include/vga.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../../net/core/nettrace.h"
+#include "../../fs/vfs/vfs.h"
+
+/* Events "nettrace events" lists by default */
+#define NETCMD_DEFAULT_EVENTS   32
+
+static bool netcmd_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Parse a decimal number
+ * @return false if s is not one
+ */
+static bool netcmd_parse(const char *s, uint64_t *out) {
+    uint64_t value = 0;
+    if (!*s) {
+        return false;
+    }
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(*s - '0');
+    }
+    *out = value;
+    return true;
+}
+
+/**
+ * Print each stage's counters and latency histogram
+ */
+static void netcmd_show(void) {
+    vga_printf("Tracing %s, capture %s (%u frames)\n",
+               nettrace_enabled ? "on" : "off", nettrace_capturing ? "on" : "off",
+               nettrace_capture_count());
+
+    for (int s = 0; s < NETTRACE_NUM_STAGES; s++) {
+        nettrace_stage_stats_t st;
+        nettrace_get_stats((nettrace_stage_t)s, &st);
+        vga_printf("%s: %llu events, %llu drops, avg %llu ns, max %llu ns\n",
+                   nettrace_stage_name((nettrace_stage_t)s), st.events, st.drops,
+                   st.samples ? st.total_ns / st.samples : 0ULL, st.max_ns);
+
+        if (st.samples == 0) {
+            continue;
+        }
+        uint64_t peak = 1;
+        for (int b = 0; b < NETTRACE_LAT_BUCKETS; b++) {
+            peak = MAX(peak, st.buckets[b]);
+        }
+        for (int b = 0; b < NETTRACE_LAT_BUCKETS; b++) {
+            if (st.buckets[b] == 0) {
+                continue;
+            }
+            uint64_t lo = b == 0 ? 0 : (1ULL << (b + NETTRACE_LAT_MIN_SHIFT));
+            char bar[33];
+            int width = (int)(st.buckets[b] * 32 / peak);
+            for (int i = 0; i < width; i++) {
+                bar[i] = '#';
+            }
+            bar[width > 0 ? width : 0] = '\0';
+            vga_printf("  >= %8llu ns %8llu %s\n", lo, st.buckets[b], bar);
+        }
+    }
+}
+
+/**
+ * List the latest events recorded on a CPU
+ */
+static int netcmd_events(uint32_t cpu, uint32_t max) {
+    nettrace_event_t *events = (nettrace_event_t *)kmalloc(max * sizeof(nettrace_event_t));
+    if (!events) {
+        vga_puts("nettrace: out of memory\n");
+        return 1;
+    }
+
+    uint32_t count = nettrace_read(cpu, events, max);
+    vga_printf("CPU %u, %u events:\n", cpu, count);
+    uint64_t first = count ? events[0].cycles : 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const nettrace_event_t *ev = &events[i];
+        vga_printf("  +%10llu ns %s len %u, %u ns\n",
+                   clock_cycles_to_ns(ev->cycles - first),
+                   nettrace_stage_name((nettrace_stage_t)ev->stage), ev->len, ev->latency_ns);
+    }
+    kfree(events);
+    return 0;
+}
+
+/**
+ * Write the captured frames to a file
+ */
+static int netcmd_save(const char *path) {
+    size_t size = nettrace_pcap_size();
+    void *buf = kmalloc(size);
+    if (!buf) {
+        vga_puts("nettrace: out of memory\n");
+        return 1;
+    }
+    size = nettrace_pcap_export(buf, size);
+
+    vfs_file_t *file = vfs_open(path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    if (!file) {
+        vga_printf("nettrace: cannot open %s: %s\n", path, vfs_strerror(vfs_get_error()));
+        kfree(buf);
+        return 1;
+    }
+    ssize_t written = vfs_write(file, buf, size);
+    vfs_close(file);
+    kfree(buf);
+
+    if (written != (ssize_t)size) {
+        vga_printf("nettrace: write to %s failed\n", path);
+        return 1;
+    }
+    vga_printf("Saved %u frames (%llu bytes) to %s\n", nettrace_capture_count(),
+               (uint64_t)size, path);
+    return 0;
+}
+
+/**
+ * nettrace on|off|reset|show | events [cpu] [count] | pcap start|stop|save <file>
+ */
+static int cmd_nettrace(int argc, char *argv[]) {
+    if (argc < 2 || netcmd_streq(argv[1], "show")) {
+        netcmd_show();
+        return 0;
+    }
+
+    if (netcmd_streq(argv[1], "on") || netcmd_streq(argv[1], "off")) {
+        nettrace_enable(netcmd_streq(argv[1], "on"));
+        return 0;
+    }
+    if (netcmd_streq(argv[1], "reset")) {
+        nettrace_reset();
+        return 0;
+    }
+
+    if (netcmd_streq(argv[1], "events")) {
+        uint64_t cpu = 0;
+        uint64_t count = NETCMD_DEFAULT_EVENTS;
+        if ((argc > 2 && (!netcmd_parse(argv[2], &cpu) || cpu >= PERCPU_MAX_CPUS)) ||
+            (argc > 3 && (!netcmd_parse(argv[3], &count) || count == 0 ||
+                          count > NETTRACE_RING_SIZE))) {
+            vga_puts("nettrace: bad argument\n");
+            return 1;
+        }
+        return netcmd_events((uint32_t)cpu, (uint32_t)count);
+    }
+
+    if (netcmd_streq(argv[1], "pcap") && argc > 2) {
+        if (netcmd_streq(argv[2], "start")) {
+            if (nettrace_capture_start() != 0) {
+                vga_puts("nettrace: cannot allocate the capture ring\n");
+                return 1;
+            }
+            return 0;
+        }
+        if (netcmd_streq(argv[2], "stop")) {
+            nettrace_capture_stop();
+            return 0;
+        }
+        if (netcmd_streq(argv[2], "save") && argc > 3) {
+            return netcmd_save(argv[3]);
+        }
+    }
+
+    vga_puts("Usage: nettrace [on|off|reset|show]\n"
+             "       nettrace events [cpu] [count]\n"
+             "       nettrace pcap start|stop|save <file>\n");
+    return 1;
+}
+
+static const shell_command_t netcmd_commands[] = {
+    {"nettrace", "Trace the network receive path and capture frames",
+     "[on|off|reset|show] | events [cpu] [count] | pcap start|stop|save <file>", cmd_nettrace},
+};
+
+void netcmd_register_commands(void) {
+    for (size_t i = 0; i < sizeof(netcmd_commands) / sizeof(netcmd_commands[0]); i++) {
+        if (shell_register_command(&netcmd_commands[i]) < 0) {
+            kprintf("[SHELL] Warning: Failed to register command '%s'\n",
+                    netcmd_commands[i].name);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+/**
+ * AAAos Kernel Shell - Network Diagnostics
+ *
+ * "nettrace" drives receive path tracing and packet capture (nettrace.h):
+ * it turns tracing on and off, shows per-stage latency histograms and
+ * drop counters, lists the latest events of a CPU, and saves captured
+ * frames as a pcap file.
+ */
+
+#ifndef _AAAOS_SHELL_NETCMD_H
+#define _AAAOS_SHELL_NETCMD_H
+
+/**
+ * Register the "nettrace" shell command
+ */
+void netcmd_register_commands(void);
+
+#endif /* _AAAOS_SHELL_NETCMD_H */
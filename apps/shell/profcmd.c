@@ -0,0 +1,155 @@
+/**
+ * AAAos Kernel Shell - Profiler Command Implementation
+ */
+
+#include "profcmd.h"
+#include "shell.h"
+#include "../../kernel/include/vga.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/sched/kprof.h"
+#include "../../fs/vfs/vfs.h"
+
+static bool profcmd_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Parse a decimal number
+ * @return false if s is not one
+ */
+static bool profcmd_parse(const char *s, uint64_t *out) {
+    uint64_t value = 0;
+    if (!*s) {
+        return false;
+    }
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(*s - '0');
+    }
+    *out = value;
+    return true;
+}
+
+static void profcmd_show(void) {
+    kprof_stats_t st;
+    kprof_get_stats(&st);
+
+    const char *mode = st.mode == KPROF_MODE_PMU ? "cycle counter" :
+                       st.mode == KPROF_MODE_TIMER ? "timer" : "none";
+    vga_printf("Profiler %s, %u Hz, %s driven\n", kprof_running() ? "running" : "stopped",
+               st.hz, mode);
+    vga_printf("%llu samples (%llu user mode), %llu kept\n", st.samples, st.user, st.kept);
+}
+
+/**
+ * Read a whole file into a kmalloc'd buffer
+ * @return The buffer, or NULL
+ */
+static void *profcmd_read_file(const char *path, size_t *size) {
+    vfs_stat_t st;
+    if (vfs_stat(path, &st) != VFS_OK || st.st_size == 0) {
+        return NULL;
+    }
+
+    void *buf = kmalloc((size_t)st.st_size);
+    vfs_file_t *file = buf ? vfs_open(path, VFS_O_RDONLY) : NULL;
+    if (!file) {
+        kfree(buf);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < st.st_size) {
+        ssize_t n = vfs_read(file, (uint8_t *)buf + done, (size_t)st.st_size - done);
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    vfs_close(file);
+
+    if (done != st.st_size) {
+        kfree(buf);
+        return NULL;
+    }
+    *size = done;
+    return buf;
+}
+
+/**
+ * Print the folded stacks, named from a kernel image if one can be read
+ */
+static int profcmd_dump(const char *path) {
+    size_t size = 0;
+    void *elf = profcmd_read_file(path, &size);
+    if (!elf) {
+        vga_printf("prof: cannot read %s, printing addresses only\n", path);
+    }
+
+    int stacks = kprof_dump(elf, size);
+    kfree(elf);
+    if (stacks < 0) {
+        vga_puts("prof: out of memory\n");
+        return 1;
+    }
+    vga_printf("%d stacks written to serial console as [PROF-FOLDED] lines\n", stacks);
+    return 0;
+}
+
+/**
+ * prof start [hz] | stop | show | dump [kernel.elf]
+ */
+static int cmd_prof(int argc, char *argv[]) {
+    if (argc < 2 || profcmd_streq(argv[1], "show")) {
+        profcmd_show();
+        return 0;
+    }
+
+    if (profcmd_streq(argv[1], "start")) {
+        uint64_t hz = KPROF_HZ;
+        if (argc > 2 && (!profcmd_parse(argv[2], &hz) || hz == 0 || hz > KPROF_MAX_HZ)) {
+            vga_printf("prof: rate must be 1-%u Hz\n", KPROF_MAX_HZ);
+            return 1;
+        }
+        if (!kprof_start((uint32_t)hz)) {
+            vga_puts("prof: cannot start (already running?)\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (profcmd_streq(argv[1], "stop")) {
+        kprof_stop();
+        profcmd_show();
+        return 0;
+    }
+    if (profcmd_streq(argv[1], "dump")) {
+        return profcmd_dump(argc > 2 ? argv[2] : PROFCMD_DEFAULT_KERNEL);
+    }
+
+    vga_puts("Usage: prof [show]\n"
+             "       prof start [hz]\n"
+             "       prof stop\n"
+             "       prof dump [kernel.elf]\n");
+    return 1;
+}
+
+static const shell_command_t profcmd_commands[] = {
+    {"prof", "Sample where the kernel spends its time",
+     "[show] | start [hz] | stop | dump [kernel.elf]", cmd_prof},
+};
+
+void profcmd_register_commands(void) {
+    for (size_t i = 0; i < sizeof(profcmd_commands) / sizeof(profcmd_commands[0]); i++) {
+        if (shell_register_command(&profcmd_commands[i]) < 0) {
+            kprintf("[SHELL] Warning: Failed to register command '%s'\n",
+                    profcmd_commands[i].name);
+        }
+    }
+}
@@ -0,0 +1,20 @@
+/**
+ * AAAos Kernel Shell - Profiler Command
+ *
+ * "prof" starts and stops the sampling profiler (kprof.h), shows how
+ * many samples it holds, and prints them to serial console as folded
+ * stacks named from the symbol table of a kernel ELF file.
+ */
+
+#ifndef _AAAOS_SHELL_PROFCMD_H
+#define _AAAOS_SHELL_PROFCMD_H
+
+/* Kernel image "prof dump" reads symbols from by default */
+#define PROFCMD_DEFAULT_KERNEL  "/boot/kernel.elf"
+
+/**
+ * Register the "prof" shell command
+ */
+void profcmd_register_commands(void);
+
+#endif /* _AAAOS_SHELL_PROFCMD_H */
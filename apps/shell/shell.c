@@ -5,22 +5,32 @@
  */
 
 #include "shell.h"
+#include "bench.h"
+#include "history.h"
+#include "netcmd.h"
+#include "profcmd.h"
+#include "statcmd.h"
+#include "stress.h"
 #include "../../kernel/include/vga.h"
 #include "../../kernel/include/serial.h"
 #include "../../kernel/include/types.h"
 #include "../../kernel/arch/x86_64/io.h"
 #include "../../kernel/mm/pmm.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/init/bootprof.h"
+#include "../../kernel/ipc/pipe.h"
+#include "../../kernel/log/log.h"
 #include "../../drivers/input/keyboard.h"
+#include "../../lib/libc/string.h"
 
 /* ========== Forward Declarations ========== */
-static void shell_add_to_history(const char *cmd);
 static void shell_history_up(void);
 static void shell_history_down(void);
 static int shell_parse_args(char *cmdline, char *argv[], int max_args);
-static size_t shell_strlen(const char *s);
-static int shell_strcmp(const char *s1, const char *s2);
-static char* shell_strcpy(char *dest, const char *src);
-static void shell_memset(void *ptr, int value, size_t num);
+static bool shell_stage_output(char c);
 
 /* ========== Global Shell State ========== */
 static shell_state_t shell_state;
@@ -28,63 +38,43 @@ static shell_state_t shell_state;
 /* Maximum number of commands */
 #define SHELL_MAX_COMMANDS  32
 
-/* Command table */
+/* Command table, in registration order */
 static shell_command_t shell_commands[SHELL_MAX_COMMANDS];
 static int shell_command_count = 0;
 
+/* Hash of command names: each bucket chains table indices plus one
+ * through shell_command_next, 0 ending a chain */
+#define SHELL_COMMAND_BUCKETS   64      /* Power of two */
+static int shell_command_buckets[SHELL_COMMAND_BUCKETS];
+static int shell_command_next[SHELL_MAX_COMMANDS];
+
+/**
+ * One command of a running pipeline
+ */
+typedef struct {
+    const shell_command_t *cmd;
+    int argc;
+    char *argv[SHELL_MAX_ARGS];
+    process_t *proc;                    /* Thread running it */
+    int in_fd, out_fd;                  /* Pipe ends, -1 for the console */
+    pipe_t *in, *out;
+    bool out_closed;                    /* Next stage stopped reading */
+    char line[128];                     /* Output not yet written to the pipe */
+    size_t line_len;
+    int result;
+    uint64_t ticks;                     /* CPU ticks used when it finished */
+    uint64_t switches;                  /* Times it was switched to */
+} shell_stage_t;
+
+static shell_stage_t shell_stages[SHELL_MAX_STAGES];
+static int shell_stage_count;
+static volatile uint32_t shell_stages_running;  /* Stage threads not yet finished */
+
 /* Tick counter for uptime (incremented by timer interrupt) */
 static volatile uint64_t tick_count = 0;
 
 /* ========== String Utility Functions ========== */
 
-static size_t shell_strlen(const char *s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
-}
-
-static int shell_strcmp(const char *s1, const char *s2) {
-    while (*s1 && *s1 == *s2) {
-        s1++;
-        s2++;
-    }
-    return (unsigned char)*s1 - (unsigned char)*s2;
-}
-
-static int shell_strncmp(const char *s1, const char *s2, size_t n) {
-    while (n && *s1 && *s1 == *s2) {
-        s1++;
-        s2++;
-        n--;
-    }
-    if (n == 0) return 0;
-    return (unsigned char)*s1 - (unsigned char)*s2;
-}
-
-static char* shell_strcpy(char *dest, const char *src) {
-    char *ret = dest;
-    while ((*dest++ = *src++));
-    return ret;
-}
-
-static char* shell_strncpy(char *dest, const char *src, size_t n) {
-    char *ret = dest;
-    while (n && (*dest++ = *src++)) n--;
-    while (n--) *dest++ = '\0';
-    return ret;
-}
-
-static void shell_memset(void *ptr, int value, size_t num) {
-    unsigned char *p = (unsigned char*)ptr;
-    while (num--) *p++ = (unsigned char)value;
-}
-
-static void shell_memcpy(void *dest, const void *src, size_t n) {
-    unsigned char *d = (unsigned char*)dest;
-    const unsigned char *s = (const unsigned char*)src;
-    while (n--) *d++ = *s++;
-}
-
 /* Skip leading whitespace */
 static char* shell_skip_whitespace(char *s) {
     while (*s == ' ' || *s == '\t') s++;
@@ -111,6 +101,10 @@ static const shell_command_t builtin_commands[] = {
     {"version",  "Show OS version",                      NULL,           cmd_version},
     {"date",     "Show current date/time",               NULL,           cmd_date},
     {"cpuinfo",  "Show CPU information",                 NULL,           cmd_cpuinfo},
+    {"grep",     "Print piped lines containing a pattern", "<pattern>",  cmd_grep},
+    {"wc",       "Count piped lines, words and bytes",   NULL,           cmd_wc},
+    {"bootprof", "Show time taken by each boot stage",   NULL,           cmd_bootprof},
+    {"loglevel", "Show or set the serial log level",     "[error|warn|info|debug]", cmd_loglevel},
     {NULL, NULL, NULL, NULL}  /* Sentinel */
 };
 
@@ -533,7 +527,7 @@ int cmd_cpuinfo(int argc, char *argv[]) {
 
     if (max_ext_cpuid >= 0x80000004) {
         char brand[49];
-        shell_memset(brand, 0, sizeof(brand));
+        memset(brand, 0, sizeof(brand));
 
         /* Functions 0x80000002 - 0x80000004 return brand string */
         for (uint32_t i = 0; i < 3; i++) {
@@ -561,43 +555,205 @@ int cmd_cpuinfo(int argc, char *argv[]) {
     return 0;
 }
 
+/**
+ * Print a line if it contains a pattern
+ */
+static bool shell_grep_line(const char *line, size_t len, const char *pattern, size_t plen) {
+    for (size_t i = 0; i + plen <= len; i++) {
+        if (strncmp(line + i, pattern, plen) == 0) {
+            vga_puts(line);
+            vga_putc('\n');
+            return true;
+        }
+    }
+    return false;
+}
+
+int cmd_grep(int argc, char *argv[]) {
+    if (argc < 2) {
+        vga_puts("Usage: grep <pattern>\n");
+        return 1;
+    }
+
+    size_t plen = strlen(argv[1]);
+    char line[SHELL_MAX_INPUT];
+    size_t len = 0;
+    char buf[128];
+    ssize_t n;
+    int matches = 0;
+
+    /* Longer lines are matched on their start only */
+    while ((n = shell_read_input(buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                if (len < sizeof(line) - 1) {
+                    line[len++] = buf[i];
+                }
+                continue;
+            }
+            line[len] = '\0';
+            matches += shell_grep_line(line, len, argv[1], plen);
+            len = 0;
+        }
+    }
+    if (n < 0) {
+        vga_puts("grep: input must be piped in\n");
+        return 1;
+    }
+    if (len > 0) {
+        line[len] = '\0';
+        matches += shell_grep_line(line, len, argv[1], plen);
+    }
+
+    return matches > 0 ? 0 : 1;
+}
+
+int cmd_wc(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    uint64_t lines = 0, words = 0, bytes = 0;
+    bool in_word = false;
+    char buf[128];
+    ssize_t n;
+
+    while ((n = shell_read_input(buf, sizeof(buf))) > 0) {
+        bytes += (uint64_t)n;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                lines++;
+            }
+            if (shell_is_whitespace(buf[i]) || buf[i] == '\n') {
+                in_word = false;
+            } else if (!in_word) {
+                in_word = true;
+                words++;
+            }
+        }
+    }
+    if (n < 0) {
+        vga_puts("wc: input must be piped in\n");
+        return 1;
+    }
+
+    vga_printf("%llu lines, %llu words, %llu bytes\n", lines, words, bytes);
+    return 0;
+}
+
+int cmd_bootprof(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int64_t last = 0;
+
+    vga_puts("Boot profile (time since the first stamp):\n");
+    for (int i = 0; i < BOOTPROF_STAGE_COUNT; i++) {
+        int64_t us = bootprof_stage_us((bootprof_stage_t)i);
+        if (us < 0) {
+            continue;
+        }
+        vga_printf("%s: %llu.%03llu ms (+%llu us)\n", bootprof_stage_name((bootprof_stage_t)i),
+                   (uint64_t)us / 1000, (uint64_t)us % 1000,
+                   (uint64_t)(us > last ? us - last : 0));
+        last = us;
+    }
+
+    /* Same figures on serial, in the form scripts/bootprof-compare.py reads */
+    bootprof_dump();
+    return 0;
+}
+
+int cmd_loglevel(int argc, char *argv[]) {
+    if (argc > 1) {
+        int level = SERIAL_LOG_ERROR;
+        while (level <= SERIAL_LOG_DEBUG && strcmp(argv[1], serial_log_level_name(level)) != 0) {
+            level++;
+        }
+        if (level > SERIAL_LOG_DEBUG) {
+            vga_printf("loglevel: unknown level '%s'\n", argv[1]);
+            return 1;
+        }
+        serial_set_log_level(level);
+    }
+
+    serial_stats_t stats;
+    serial_get_stats(&stats);
+    vga_printf("Log level: %s\n", serial_log_level_name(serial_log_level));
+    vga_printf("Serial: %llu bytes queued, %llu written, %llu dropped, %llu interrupts\n",
+               stats.queued, stats.written, stats.dropped, stats.interrupts);
+
+    log_stats_t log;
+    log_get_stats(&log);
+    vga_printf("Log ring: %llu records, %llu printed, %llu lost, %llu rate-limited\n",
+               log.records, log.printed, log.lost, log.suppressed);
+    return 0;
+}
+
 /* ========== Shell Core Functions ========== */
 
 void shell_init(void) {
     kprintf("[SHELL] Initializing kernel shell\n");
 
     /* Initialize shell state */
-    shell_memset(&shell_state, 0, sizeof(shell_state_t));
+    memset(&shell_state, 0, sizeof(shell_state_t));
     shell_state.running = true;
     shell_state.echo_enabled = true;
 
     /* Register built-in commands */
     shell_command_count = 0;
+    memset(shell_command_buckets, 0, sizeof(shell_command_buckets));
     for (int i = 0; builtin_commands[i].name != NULL; i++) {
         if (shell_register_command(&builtin_commands[i]) < 0) {
             kprintf("[SHELL] Warning: Failed to register command '%s'\n",
                     builtin_commands[i].name);
         }
     }
+    bench_register_commands();
+    netcmd_register_commands();
+    profcmd_register_commands();
+    statcmd_register_commands();
+    stress_register_commands();
+
+    /* Output of pipeline stages goes to the next stage */
+    vga_set_output_hook(shell_stage_output);
 
     kprintf("[SHELL] Registered %d commands\n", shell_command_count);
 }
 
+/**
+ * Hash bucket of a command name (FNV-1a)
+ */
+static uint32_t shell_command_bucket(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash & (SHELL_COMMAND_BUCKETS - 1);
+}
+
 int shell_register_command(const shell_command_t *cmd) {
     if (shell_command_count >= SHELL_MAX_COMMANDS) {
         return -1;
     }
 
-    shell_memcpy(&shell_commands[shell_command_count], cmd, sizeof(shell_command_t));
-    shell_command_count++;
+    /* The first command registered under a name keeps it */
+    int index = shell_command_count++;
+    memcpy(&shell_commands[index], cmd, sizeof(shell_command_t));
+    shell_command_next[index] = 0;
+    if (!shell_find_command(cmd->name)) {
+        uint32_t bucket = shell_command_bucket(cmd->name);
+        shell_command_next[index] = shell_command_buckets[bucket];
+        shell_command_buckets[bucket] = index + 1;
+    }
 
     return 0;
 }
 
 const shell_command_t* shell_find_command(const char *name) {
-    for (int i = 0; i < shell_command_count; i++) {
-        if (shell_strcmp(shell_commands[i].name, name) == 0) {
-            return &shell_commands[i];
+    int i = shell_command_buckets[shell_command_bucket(name)];
+    for (; i > 0; i = shell_command_next[i - 1]) {
+        if (strcmp(shell_commands[i - 1].name, name) == 0) {
+            return &shell_commands[i - 1];
         }
     }
     return NULL;
@@ -618,39 +774,12 @@ void shell_print_prompt(void) {
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts(SHELL_PROMPT);
     vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
-}
-
-static void shell_add_to_history(const char *cmd) {
-    /* Don't add empty commands */
-    if (cmd[0] == '\0') {
-        return;
-    }
-
-    /* Don't add duplicate of last command */
-    if (shell_state.history_count > 0 &&
-        shell_strcmp(shell_state.history[shell_state.history_count - 1], cmd) == 0) {
-        return;
-    }
-
-    /* Add command to history */
-    if (shell_state.history_count < SHELL_HISTORY_SIZE) {
-        shell_strcpy(shell_state.history[shell_state.history_count], cmd);
-        shell_state.history_count++;
-    } else {
-        /* Shift history up and add at end */
-        for (int i = 0; i < SHELL_HISTORY_SIZE - 1; i++) {
-            shell_strcpy(shell_state.history[i], shell_state.history[i + 1]);
-        }
-        shell_strcpy(shell_state.history[SHELL_HISTORY_SIZE - 1], cmd);
-    }
-
-    /* Reset history index */
-    shell_state.history_index = shell_state.history_count;
+    bootprof_mark(BOOTPROF_SHELL_PROMPT);
 }
 
 static void shell_clear_input_line(void) {
     /* Move cursor to start of input and clear */
-    int prompt_len = shell_strlen(SHELL_PROMPT);
+    int prompt_len = strlen(SHELL_PROMPT);
     int x = vga_get_cursor_x();
     int y = vga_get_cursor_y();
 
@@ -676,43 +805,155 @@ static void shell_redraw_input(void) {
     }
 
     /* Move cursor to correct position */
-    int prompt_len = shell_strlen(SHELL_PROMPT);
+    int prompt_len = strlen(SHELL_PROMPT);
     int y = vga_get_cursor_y();
     vga_set_cursor(prompt_len + shell_state.input_pos, y);
 }
 
-static void shell_history_up(void) {
-    if (shell_state.history_index > 0) {
-        shell_state.history_index--;
+/**
+ * Show a history entry in place of the input
+ */
+static void shell_show_history(int index) {
+    shell_state.history_index = index;
+    strcpy(shell_state.input_buffer, history_get((uint32_t)index));
+    shell_state.input_len = strlen(shell_state.input_buffer);
+    shell_state.input_pos = shell_state.input_len;
+}
 
-        /* Copy history entry to input buffer */
-        shell_strcpy(shell_state.input_buffer,
-                     shell_state.history[shell_state.history_index]);
-        shell_state.input_len = shell_strlen(shell_state.input_buffer);
-        shell_state.input_pos = shell_state.input_len;
+static void shell_history_up(void) {
+    int index = shell_state.history_index;
+    if (index < 0) {
+        index = (int)history_count();
+    }
 
+    if (index > 0) {
+        shell_clear_input_line();
+        shell_show_history(index - 1);
         shell_redraw_input();
     }
 }
 
 static void shell_history_down(void) {
-    if (shell_state.history_index < shell_state.history_count) {
-        shell_state.history_index++;
-
-        if (shell_state.history_index < shell_state.history_count) {
-            /* Copy history entry to input buffer */
-            shell_strcpy(shell_state.input_buffer,
-                         shell_state.history[shell_state.history_index]);
-            shell_state.input_len = shell_strlen(shell_state.input_buffer);
-            shell_state.input_pos = shell_state.input_len;
+    if (shell_state.history_index < 0) {
+        return;
+    }
+
+    shell_clear_input_line();
+    if (shell_state.history_index + 1 < (int)history_count()) {
+        shell_show_history(shell_state.history_index + 1);
+    } else {
+        /* Clear input */
+        shell_state.history_index = -1;
+        shell_state.input_buffer[0] = '\0';
+        shell_state.input_len = 0;
+        shell_state.input_pos = 0;
+    }
+    shell_redraw_input();
+}
+
+/**
+ * Redraw the whole input row: prompt and input
+ */
+static void shell_redraw_row(void) {
+    int y = vga_get_cursor_y();
+
+    vga_set_cursor(0, y);
+    for (int i = 0; i < VGA_WIDTH - 1; i++) {
+        vga_putc(' ');
+    }
+    vga_set_cursor(0, y);
+    shell_print_prompt();
+    for (size_t i = 0; i < shell_state.input_len; i++) {
+        vga_putc(shell_state.input_buffer[i]);
+    }
+    vga_set_cursor((int)(strlen(SHELL_PROMPT) + shell_state.input_pos), y);
+}
+
+/**
+ * Draw the reverse search row, cut to the width of the screen
+ */
+static void shell_draw_search(const char *query, int64_t match, bool failing) {
+    char row[VGA_WIDTH];
+    size_t len = 0;
+    const char *parts[] = {
+        failing ? "(failing reverse-i-search)`" : "(reverse-i-search)`",
+        query,
+        "': ",
+        match >= 0 ? history_get((uint32_t)match) : "",
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(parts); i++) {
+        for (const char *p = parts[i]; *p && len < sizeof(row) - 1; p++) {
+            row[len++] = *p;
+        }
+    }
+
+    int y = vga_get_cursor_y();
+    vga_set_cursor(0, y);
+    for (size_t i = 0; i < sizeof(row) - 1; i++) {
+        vga_putc(i < len ? row[i] : ' ');
+    }
+    vga_set_cursor((int)len, y);
+}
+
+/**
+ * Ctrl-R: search the history backwards as a query is typed
+ * Typing narrows the search from the entry found so far, Ctrl-R again
+ * finds an older match. Enter runs the entry found, Escape gives up,
+ * any other key edits the entry found.
+ * @return true if the input is to be run now
+ */
+static bool shell_reverse_search(void) {
+    char query[SHELL_MAX_INPUT];
+    size_t query_len = 0;
+    int64_t match = -1;
+    bool failing = false;
+    key_event_t event;
+
+    query[0] = '\0';
+    shell_draw_search(query, match, failing);
+
+    while (1) {
+        if (!keyboard_get_event(&event) || !event.pressed) {
+            continue;
+        }
+
+        bool ctrl = (event.modifiers & MOD_CTRL) != 0;
+        int64_t found = match;
+
+        if (ctrl && event.keycode == KEY_R) {
+            if (query_len > 0) {
+                found = history_search(query, match >= 0 ? (uint32_t)match : history_count());
+            }
+        } else if (event.keycode == KEY_BACKSPACE) {
+            if (query_len > 0) {
+                query[--query_len] = '\0';
+            }
+            found = history_search(query, history_count());
+        } else if (event.keycode == KEY_ESCAPE) {
+            shell_redraw_row();
+            return false;
+        } else if (event.keycode != KEY_ENTER && event.ascii >= 32 && event.ascii < 127) {
+            if (query_len < sizeof(query) - 1) {
+                query[query_len++] = event.ascii;
+                query[query_len] = '\0';
+            }
+            /* A longer query matches no newer entry than the shorter one */
+            found = history_search(query, match >= 0 ? (uint32_t)match + 1 : history_count());
         } else {
-            /* Clear input */
-            shell_state.input_buffer[0] = '\0';
-            shell_state.input_len = 0;
-            shell_state.input_pos = 0;
+            /* Enter or an editing key: take the entry found */
+            if (match >= 0) {
+                shell_show_history((int)match);
+            }
+            shell_redraw_row();
+            return event.keycode == KEY_ENTER;
         }
 
-        shell_redraw_input();
+        failing = found < 0 && query_len > 0;
+        if (found >= 0 || query_len == 0) {
+            match = found;
+        }
+        shell_draw_search(query, match, failing);
     }
 }
 
@@ -721,7 +962,7 @@ int shell_readline(char *buf, size_t max) {
     shell_state.input_buffer[0] = '\0';
     shell_state.input_len = 0;
     shell_state.input_pos = 0;
-    shell_state.history_index = shell_state.history_count;
+    shell_state.history_index = -1;
 
     key_event_t event;
 
@@ -736,12 +977,20 @@ int shell_readline(char *buf, size_t max) {
             continue;
         }
 
+        /* Ctrl-R: reverse search; Enter in it ends the line */
+        if ((event.modifiers & MOD_CTRL) && event.keycode == KEY_R) {
+            if (!shell_reverse_search()) {
+                continue;
+            }
+            event.keycode = KEY_ENTER;
+        }
+
         /* Handle special keys */
         switch (event.keycode) {
             case KEY_ENTER:
                 /* End of line */
                 vga_putc('\n');
-                shell_strncpy(buf, shell_state.input_buffer,
+                strncpy(buf, shell_state.input_buffer,
                               MIN(shell_state.input_len + 1, max));
                 buf[max - 1] = '\0';
                 return shell_state.input_len;
@@ -823,7 +1072,7 @@ int shell_readline(char *buf, size_t max) {
             case KEY_HOME:
                 shell_state.input_pos = 0;
                 {
-                    int prompt_len = shell_strlen(SHELL_PROMPT);
+                    int prompt_len = strlen(SHELL_PROMPT);
                     int y = vga_get_cursor_y();
                     vga_set_cursor(prompt_len, y);
                 }
@@ -832,7 +1081,7 @@ int shell_readline(char *buf, size_t max) {
             case KEY_END:
                 shell_state.input_pos = shell_state.input_len;
                 {
-                    int prompt_len = shell_strlen(SHELL_PROMPT);
+                    int prompt_len = strlen(SHELL_PROMPT);
                     int y = vga_get_cursor_y();
                     vga_set_cursor(prompt_len + shell_state.input_len, y);
                 }
@@ -844,7 +1093,7 @@ int shell_readline(char *buf, size_t max) {
                 shell_state.input_buffer[0] = '\0';
                 shell_state.input_len = 0;
                 shell_state.input_pos = 0;
-                shell_state.history_index = shell_state.history_count;
+                shell_state.history_index = -1;
                 break;
 
             default:
@@ -906,20 +1155,141 @@ static int shell_parse_args(char *cmdline, char *argv[], int max_args) {
     return argc;
 }
 
-int shell_execute(const char *cmdline) {
-    /* Copy command line (we need to modify it for parsing) */
-    char cmd_copy[SHELL_MAX_INPUT];
-    shell_strncpy(cmd_copy, cmdline, SHELL_MAX_INPUT - 1);
-    cmd_copy[SHELL_MAX_INPUT - 1] = '\0';
+/* ========== Pipelines ========== */
 
-    /* Skip leading whitespace */
-    char *cmd = shell_skip_whitespace(cmd_copy);
+/**
+ * Pipeline stage the calling thread runs, or NULL
+ */
+static shell_stage_t* shell_current_stage(void) {
+    if (shell_stages_running == 0) {
+        return NULL;
+    }
 
-    /* Empty command */
-    if (*cmd == '\0') {
-        return 0;
+    process_t *self = process_get_current();
+    for (int i = 0; self && i < shell_stage_count; i++) {
+        if (shell_stages[i].proc == self) {
+            return &shell_stages[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Write a stage's buffered output to the next stage
+ */
+static void shell_stage_flush(shell_stage_t *stage) {
+    if (stage->line_len > 0 && !stage->out_closed &&
+        pipe_write(stage->out, stage->line, stage->line_len) < (ssize_t)stage->line_len) {
+        /* Nobody reads the rest */
+        stage->out_closed = true;
+    }
+    stage->line_len = 0;
+}
+
+/**
+ * Console output hook: takes the output of a stage with a pipe after it
+ */
+static bool shell_stage_output(char c) {
+    shell_stage_t *stage = shell_current_stage();
+    if (!stage || !stage->out) {
+        return false;
+    }
+
+    stage->line[stage->line_len++] = c;
+    if (c == '\n' || stage->line_len == sizeof(stage->line)) {
+        shell_stage_flush(stage);
+    }
+    return true;
+}
+
+/**
+ * Close the pipe ends a stage holds
+ * Closing the write end is what ends the next stage's input.
+ */
+static void shell_stage_close(shell_stage_t *stage) {
+    if (stage->in_fd >= 0) {
+        pipe_close_fd(stage->in_fd);
+        stage->in_fd = -1;
+    }
+    if (stage->out_fd >= 0) {
+        pipe_close_fd(stage->out_fd);
+        stage->out_fd = -1;
+    }
+}
+
+/**
+ * Mark a stage finished and wake the shell if it was the last one
+ */
+static void shell_stage_done(void) {
+    __atomic_sub_fetch(&shell_stages_running, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&shell_stages_running, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Thread running one pipeline stage
+ */
+static void shell_stage_entry(void *arg) {
+    shell_stage_t *stage = (shell_stage_t*)arg;
+
+    stage->result = stage->cmd->handler(stage->argc, stage->argv);
+    shell_stage_flush(stage);
+    shell_stage_close(stage);
+
+    process_t *self = process_get_current();
+    stage->ticks = self->total_ticks;
+    stage->switches = self->switches;
+    shell_stage_done();
+}
+
+ssize_t shell_read_input(char *buf, size_t max) {
+    shell_stage_t *stage = shell_current_stage();
+    if (!stage || !stage->in) {
+        return -1;
+    }
+
+    /* A closed write end is the end of the input */
+    ssize_t n = pipe_read(stage->in, buf, max);
+    return n < 0 ? 0 : n;
+}
+
+/**
+ * Split a command line at the '|' characters outside quotes
+ * @return Number of commands, or -1 if there are more than max
+ */
+static int shell_split_pipeline(char *cmd, char *commands[], int max) {
+    int count = 0;
+    char quote = '\0';
+
+    commands[count++] = cmd;
+    for (char *p = cmd; *p; p++) {
+        if (quote) {
+            if (*p == quote) {
+                quote = '\0';
+            }
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '|') {
+            if (count == max) {
+                return -1;
+            }
+            *p = '\0';
+            commands[count++] = p + 1;
+        }
     }
+    return count;
+}
 
+static void shell_unknown_command(const char *name) {
+    vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    vga_printf("Unknown command: %s\n", name);
+    vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+    vga_puts("Type 'help' for a list of commands.\n");
+}
+
+/**
+ * Run a single command in the shell itself
+ */
+static int shell_run_command(char *cmd, uint64_t *ticks, uint64_t *switches) {
     /* Parse arguments */
     char *argv[SHELL_MAX_ARGS];
     int argc = shell_parse_args(cmd, argv, SHELL_MAX_ARGS);
@@ -933,16 +1303,21 @@ int shell_execute(const char *cmdline) {
     /* Look up command */
     const shell_command_t *cmd_entry = shell_find_command(argv[0]);
     if (cmd_entry == NULL) {
-        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-        vga_printf("Unknown command: %s\n", argv[0]);
-        vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
-        vga_puts("Type 'help' for a list of commands.\n");
+        shell_unknown_command(argv[0]);
         return -1;
     }
 
     /* Execute command */
+    process_t *self = process_get_current();
+    uint64_t start_ticks = self ? self->total_ticks : 0;
+    uint64_t start_switches = self ? self->switches : 0;
+
     int result = cmd_entry->handler(argc, argv);
 
+    if (self) {
+        *ticks = self->total_ticks - start_ticks;
+        *switches = self->switches - start_switches;
+    }
     if (result != 0) {
         kprintf("[SHELL] Command '%s' returned %d\n", argv[0], result);
     }
@@ -950,6 +1325,151 @@ int shell_execute(const char *cmdline) {
     return result;
 }
 
+/**
+ * Run the commands of a pipeline concurrently, each in a thread of the
+ * shell's process with its output piped into the next one's input
+ * @return Result of the last command
+ */
+static int shell_run_pipeline(char *commands[], int count, uint64_t *ticks,
+                              uint64_t *switches) {
+    process_t *self = process_get_current();
+    if (!self || !scheduler_is_running()) {
+        vga_puts("Pipelines need the scheduler running\n");
+        return -1;
+    }
+    if (shell_stages_running != 0) {
+        vga_puts("A pipeline is already running\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        shell_stage_t *stage = &shell_stages[i];
+        memset(stage, 0, sizeof(*stage));
+        stage->in_fd = -1;
+        stage->out_fd = -1;
+        stage->result = -1;
+
+        stage->argc = shell_parse_args(commands[i], stage->argv, SHELL_MAX_ARGS);
+        if (stage->argc == 0) {
+            vga_puts("Syntax error: empty command in pipeline\n");
+            return -1;
+        }
+        stage->cmd = shell_find_command(stage->argv[0]);
+        if (!stage->cmd) {
+            shell_unknown_command(stage->argv[0]);
+            return -1;
+        }
+    }
+
+    kprintf("[SHELL] Executing pipeline of %d commands\n", count);
+
+    for (int i = 0; i + 1 < count; i++) {
+        int fds[2];
+        if (pipe_create(fds) != PIPE_SUCCESS) {
+            vga_puts("Failed to create pipe\n");
+            for (int j = 0; j <= i; j++) {
+                shell_stage_close(&shell_stages[j]);
+            }
+            return -1;
+        }
+        shell_stages[i].out_fd = fds[1];
+        shell_stages[i].out = pipe_get(fds[1]);
+        shell_stages[i + 1].in_fd = fds[0];
+        shell_stages[i + 1].in = pipe_get(fds[0]);
+    }
+
+    /* Nothing runs until every thread exists, so each can find its stage */
+    int created = 0;
+    for (; created < count; created++) {
+        shell_stage_t *stage = &shell_stages[created];
+        stage->proc = thread_create(self, stage->cmd->name, shell_stage_entry, stage);
+        if (!stage->proc) {
+            break;
+        }
+    }
+    shell_stage_count = count;
+    shell_stages_running = (uint32_t)created;
+
+    /* Commands without a thread never run; their neighbours see the
+     * pipes between them closed */
+    bool failed = created < count;
+    for (int i = created; i < count; i++) {
+        shell_stage_close(&shell_stages[i]);
+    }
+    for (int i = 0; i < created; i++) {
+        if (!scheduler_add(shell_stages[i].proc)) {
+            kprintf("[SHELL] Failed to schedule '%s'\n", shell_stages[i].cmd->name);
+            shell_stage_close(&shell_stages[i]);
+            shell_stage_done();
+            failed = true;
+        }
+    }
+
+    uint32_t running;
+    while ((running = shell_stages_running) != 0) {
+        waitq_wait(&shell_stages_running, running);
+    }
+
+    for (int i = 0; i < count; i++) {
+        *ticks += shell_stages[i].ticks;
+        *switches += shell_stages[i].switches;
+    }
+    shell_stage_count = 0;
+
+    if (failed) {
+        vga_puts("Failed to start pipeline\n");
+        return -1;
+    }
+    return shell_stages[count - 1].result;
+}
+
+int shell_execute(const char *cmdline) {
+    /* Copy command line (we need to modify it for parsing) */
+    char cmd_copy[SHELL_MAX_INPUT];
+    strncpy(cmd_copy, cmdline, SHELL_MAX_INPUT - 1);
+    cmd_copy[SHELL_MAX_INPUT - 1] = '\0';
+
+    /* Skip leading whitespace */
+    char *cmd = shell_skip_whitespace(cmd_copy);
+
+    /* Empty command */
+    if (*cmd == '\0') {
+        return 0;
+    }
+
+    /* "time" prefix */
+    bool timed = false;
+    if (strncmp(cmd, "time", 4) == 0 && (cmd[4] == '\0' || shell_is_whitespace(cmd[4]))) {
+        timed = true;
+        cmd = shell_skip_whitespace(cmd + 4);
+        if (*cmd == '\0') {
+            vga_puts("Usage: time <command> [| <command>...]\n");
+            return 1;
+        }
+    }
+
+    char *commands[SHELL_MAX_STAGES];
+    int count = shell_split_pipeline(cmd, commands, SHELL_MAX_STAGES);
+    if (count < 0) {
+        vga_printf("Too many commands in pipeline (max %d)\n", SHELL_MAX_STAGES);
+        return -1;
+    }
+
+    uint64_t start = clock_monotonic_ns();
+    uint64_t ticks = 0, switches = 0;
+    int result = count == 1 ? shell_run_command(commands[0], &ticks, &switches)
+                            : shell_run_pipeline(commands, count, &ticks, &switches);
+
+    if (timed) {
+        uint64_t wall_ms = (clock_monotonic_ns() - start) / 1000000;
+        uint64_t cpu_ms = ticks * SCHED_TICK_NS / 1000000;
+        vga_printf("real %llu.%03llus  cpu %llu.%03llus  %llu context switches\n",
+                   wall_ms / 1000, wall_ms % 1000, cpu_ms / 1000, cpu_ms % 1000, switches);
+    }
+
+    return result;
+}
+
 void shell_run(void) {
     char input[SHELL_MAX_INPUT];
 
@@ -975,7 +1495,7 @@ void shell_run(void) {
         }
 
         /* Add to history */
-        shell_add_to_history(input);
+        history_add(input);
 
         /* Execute command */
         shell_execute(input);
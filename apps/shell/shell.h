@@ -13,7 +13,7 @@
 /* Shell configuration */
 #define SHELL_MAX_INPUT         256     /* Maximum input line length */
 #define SHELL_MAX_ARGS          16      /* Maximum number of arguments */
-#define SHELL_HISTORY_SIZE      16      /* Number of commands to remember */
+#define SHELL_MAX_STAGES        8       /* Maximum commands in a pipeline */
 #define SHELL_PROMPT            "aaos> " /* Shell prompt */
 
 /* Shell version */
@@ -47,9 +47,7 @@ typedef struct {
     size_t input_pos;                        /* Cursor position in input */
     size_t input_len;                        /* Length of current input */
 
-    char history[SHELL_HISTORY_SIZE][SHELL_MAX_INPUT]; /* Command history */
-    int history_count;                       /* Number of commands in history */
-    int history_index;                       /* Current history position */
+    int history_index;                       /* History entry shown, -1 if none */
 
     bool running;                            /* Shell is running */
     bool echo_enabled;                       /* Echo input to screen */
@@ -71,6 +69,9 @@ void shell_run(void);
 /**
  * Execute a command line
  * Parses the command and arguments, then invokes the appropriate handler.
+ * Commands joined by '|' run concurrently as threads, each one's output
+ * piped into the next one's input. A leading "time" reports the wall
+ * time, CPU time and context switches taken.
  * @param cmdline The command line to execute
  * @return 0 on success, non-zero on error
  */
@@ -78,13 +79,24 @@ int shell_execute(const char *cmdline);
 
 /**
  * Read a line of input from the keyboard
- * Handles line editing (backspace, etc.) and arrow keys for history.
+ * Handles line editing (backspace, etc.), arrow keys for history and
+ * Ctrl-R for reverse search of it.
  * @param buf Buffer to store the input
  * @param max Maximum number of characters to read
  * @return Number of characters read, or -1 on error
  */
 int shell_readline(char *buf, size_t max);
 
+/**
+ * Read the output of the previous command in a pipeline
+ * Blocks until some is written.
+ * @param buf Buffer to read into
+ * @param max Size of the buffer
+ * @return Bytes read, 0 at the end of the input, or -1 if the calling
+ *         command's input is not piped
+ */
+ssize_t shell_read_input(char *buf, size_t max);
+
 /**
  * Print shell prompt
  */
@@ -174,4 +186,24 @@ int cmd_date(int argc, char *argv[]);
  */
 int cmd_cpuinfo(int argc, char *argv[]);
 
+/**
+ * grep - Print piped lines containing a pattern
+ */
+int cmd_grep(int argc, char *argv[]);
+
+/**
+ * wc - Count piped lines, words and bytes
+ */
+int cmd_wc(int argc, char *argv[]);
+
+/**
+ * bootprof - Show time taken by each boot stage
+ */
+int cmd_bootprof(int argc, char *argv[]);
+
+/**
+ * loglevel - Show or set the serial log level
+ */
+int cmd_loglevel(int argc, char *argv[]);
+
 #endif /* _AAAOS_SHELL_H */
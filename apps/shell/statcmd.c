@@ -0,0 +1,248 @@
+/**
+ * AAAos Kernel Shell - Kernel Metrics Implementation
+ */
+
+#include "statcmd.h"
+#include "shell.h"
+#include "../../kernel/include/vga.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/stats/kstat.h"
+#include "../../kernel/sched/spinlock.h"
+#include "../../kernel/sched/clock.h"
+#include "../../fs/statsfs/statsfs.h"
+
+static bool statcmd_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static bool statcmd_has_prefix(const char *s, const char *prefix) {
+    while (*prefix && *s == *prefix) {
+        s++;
+        prefix++;
+    }
+    return *prefix == '\0';
+}
+
+/**
+ * One line per metric whose name starts with prefix
+ */
+static int statcmd_list(const char *prefix) {
+    char text[KSTAT_TEXT_MAX];
+    uint32_t shown = 0;
+
+    for (size_t i = 0; i < kstat_count(); i++) {
+        const kstat_t *k = kstat_get(i);
+        if (!statcmd_has_prefix(k->name, prefix)) {
+            continue;
+        }
+
+        /* Histograms: the summary line only */
+        kstat_format(k, text, sizeof(text));
+        for (char *c = text; *c; c++) {
+            if (*c == '\n') {
+                *c = '\0';
+                break;
+            }
+        }
+        vga_printf("%s %s\n", k->name, text);
+        shown++;
+    }
+    if (shown == 0) {
+        vga_printf("stats: no metric starts with '%s'\n", prefix);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Everything about one metric
+ */
+static int statcmd_show(const char *name) {
+    const kstat_t *k = kstat_find(name);
+    if (!k) {
+        vga_printf("stats: no metric '%s'\n", name);
+        return 1;
+    }
+
+    char text[KSTAT_TEXT_MAX];
+    kstat_format(k, text, sizeof(text));
+    vga_printf("%s (%s): %s\n", k->name, kstat_type_name(k->type), k->desc);
+    vga_puts(text);
+
+    if (k->type != KSTAT_GAUGE) {
+        for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+            uint64_t value = kstat_read_cpu(k, cpu);
+            if (value != 0) {
+                vga_printf("  CPU %u: %llu\n", cpu, value);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * stats [prefix] | show <name> | trace <name> on|off | mount [path]
+ */
+static int cmd_stats(int argc, char *argv[]) {
+    if (argc < 2) {
+        return statcmd_list("");
+    }
+
+    if (statcmd_streq(argv[1], "show") && argc > 2) {
+        return statcmd_show(argv[2]);
+    }
+
+    if (statcmd_streq(argv[1], "trace") && argc > 3) {
+        bool on = statcmd_streq(argv[3], "on");
+        if (!on && !statcmd_streq(argv[3], "off")) {
+            vga_puts("Usage: stats trace <name> on|off\n");
+            return 1;
+        }
+        if (!kstat_trace_enable(kstat_find(argv[2]), on)) {
+            vga_printf("stats: no tracepoint '%s'\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (statcmd_streq(argv[1], "mount")) {
+        const char *path = argc > 2 ? argv[2] : STATSFS_DEFAULT_PATH;
+        int result = statsfs_init();
+        if (result == VFS_OK) {
+            result = vfs_mount(path, "statsfs", NULL);
+        }
+        if (result != VFS_OK) {
+            vga_printf("stats: cannot mount statsfs at %s: %s\n", path, vfs_strerror(result));
+            return 1;
+        }
+        vga_printf("statsfs mounted at %s\n", path);
+        return 0;
+    }
+
+    if (statcmd_streq(argv[1], "show") || statcmd_streq(argv[1], "trace")) {
+        vga_puts("Usage: stats [prefix]\n"
+                 "       stats show <name>\n"
+                 "       stats trace <name> on|off\n"
+                 "       stats mount [path]\n");
+        return 1;
+    }
+    return statcmd_list(argv[1]);
+}
+
+/* Most lock classes "locks" ranks, and rows shown by default */
+#define STATCMD_MAX_LOCKS       64
+#define STATCMD_TOP_LOCKS       10
+
+typedef struct statcmd_lock {
+    const lock_class_t *cls;
+    lockstat_t stat;
+} statcmd_lock_t;
+
+/**
+ * Nanoseconds in TSC cycles (cycles before the clock is calibrated)
+ */
+static uint64_t statcmd_cycles_ns(uint64_t cycles) {
+    uint64_t khz = clock_tsc_khz();
+    return khz ? cycles * NSEC_PER_MSEC / khz : cycles;
+}
+
+static uint64_t statcmd_avg(uint64_t sum, uint64_t n) {
+    return n ? sum / n : 0;
+}
+
+/**
+ * The count hottest lock classes, by time spent waiting for them
+ */
+static int statcmd_locks_top(uint32_t count) {
+    static statcmd_lock_t locks[STATCMD_MAX_LOCKS];
+    uint32_t n = 0;
+
+    for (const lock_class_t *cls = lockstat_classes(); cls && n < STATCMD_MAX_LOCKS;
+         cls = cls->next) {
+        statcmd_lock_t entry = { cls, { 0 } };
+        lockstat_read(cls, &entry.stat);
+
+        /* Insertion sort: most wait time, then most contention, first */
+        uint32_t i = n++;
+        while (i > 0 && (locks[i - 1].stat.wait_cycles < entry.stat.wait_cycles ||
+                         (locks[i - 1].stat.wait_cycles == entry.stat.wait_cycles &&
+                          locks[i - 1].stat.contended < entry.stat.contended))) {
+            locks[i] = locks[i - 1];
+            i--;
+        }
+        locks[i] = entry;
+    }
+
+    if (!lockstat_enabled) {
+        vga_puts("locks: profiling is off, \"locks on\" starts it\n");
+    }
+    if (n == 0) {
+        vga_puts("locks: no lock taken since profiling started\n");
+        return lockstat_enabled ? 0 : 1;
+    }
+
+    vga_printf("%-22s %10s %9s %6s %9s %9s %10s\n", "class", "acquired", "contended",
+               "spins", "wait ns", "hold ns", "max hold");
+    for (uint32_t i = 0; i < n && i < count; i++) {
+        const lockstat_t *st = &locks[i].stat;
+        vga_printf("%-22s %10llu %9llu %6llu %9llu %9llu %10llu\n", locks[i].cls->name,
+                   st->acquired, st->contended, statcmd_avg(st->spins, st->contended),
+                   statcmd_cycles_ns(statcmd_avg(st->wait_cycles, st->contended)),
+                   statcmd_cycles_ns(statcmd_avg(st->hold_cycles, st->releases)),
+                   statcmd_cycles_ns(st->hold_max));
+    }
+    return 0;
+}
+
+/**
+ * locks [count] | on | off | reset
+ */
+static int cmd_locks(int argc, char *argv[]) {
+    if (argc > 1 && statcmd_streq(argv[1], "on")) {
+        lockstat_enable(true);
+        vga_puts("Lock profiling on\n");
+        return 0;
+    }
+    if (argc > 1 && statcmd_streq(argv[1], "off")) {
+        lockstat_enable(false);
+        vga_puts("Lock profiling off\n");
+        return 0;
+    }
+    if (argc > 1 && statcmd_streq(argv[1], "reset")) {
+        lockstat_reset();
+        return 0;
+    }
+
+    uint32_t count = STATCMD_TOP_LOCKS;
+    if (argc > 1) {
+        count = 0;
+        for (const char *c = argv[1]; *c; c++) {
+            if (*c < '0' || *c > '9') {
+                vga_puts("Usage: locks [count] | on | off | reset\n");
+                return 1;
+            }
+            count = count * 10 + (uint32_t)(*c - '0');
+        }
+    }
+    return statcmd_locks_top(count);
+}
+
+static const shell_command_t statcmd_commands[] = {
+    {"stats", "Show kernel counters, histograms and tracepoints",
+     "[prefix] | show <name> | trace <name> on|off | mount [path]", cmd_stats},
+    {"locks", "Show the most contended spinlock classes",
+     "[count] | on | off | reset", cmd_locks},
+};
+
+void statcmd_register_commands(void) {
+    for (size_t i = 0; i < sizeof(statcmd_commands) / sizeof(statcmd_commands[0]); i++) {
+        if (shell_register_command(&statcmd_commands[i]) < 0) {
+            kprintf("[SHELL] Warning: Failed to register command '%s'\n",
+                    statcmd_commands[i].name);
+        }
+    }
+}
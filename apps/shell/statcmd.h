@@ -0,0 +1,22 @@
+/**
+ * AAAos Kernel Shell - Kernel Metrics
+ *
+ * "stats" lists the metrics of the kstat registry (kstat.h) with their
+ * current values, shows one in detail with its per-CPU shares, turns
+ * tracepoints on and off, and mounts statsfs to export them as files.
+ *
+ * "locks" turns spinlock profiling (spinlock.h) on and off and ranks the
+ * lock classes by time spent waiting for them, with their acquisitions,
+ * contended acquisitions, spins per contended acquisition, and average
+ * wait, average hold and longest hold in nanoseconds.
+ */
+
+#ifndef _AAAOS_SHELL_STATCMD_H
+#define _AAAOS_SHELL_STATCMD_H
+
+/**
+ * Register the "stats" and "locks" shell commands
+ */
+void statcmd_register_commands(void);
+
+#endif /* _AAAOS_SHELL_STATCMD_H */
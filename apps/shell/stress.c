@@ -0,0 +1,732 @@
+/**
+ * AAAos Kernel Shell - Stress and Scalability Tests Implementation
+ *
+ * Workers wait on the run's start word, loop until the run's stop flag is
+ * set, then tell their partner to finish: a quit byte through the pipe, a
+ * quit flag and a last semaphore post, a quit message to the receiver, or
+ * a closed connection. The shell thread reaps nothing; a worker exits by
+ * returning from its entry point once it has dropped the run's count of
+ * running threads.
+ */
+
+#include "stress.h"
+#include "shell.h"
+#include "../../kernel/include/vga.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../kernel/ipc/pipe.h"
+#include "../../kernel/ipc/message.h"
+#include "../../kernel/ipc/semaphore.h"
+#include "../../net/tcp/tcp.h"
+
+/* Defaults of the shell command */
+#define STRESS_DEFAULT_WORKERS  2
+#define STRESS_DEFAULT_MS       1000
+
+/* Workload parameters */
+#define STRESS_ALLOC_SLOTS      32      /* Live objects per worker */
+#define STRESS_ALLOC_MAX        2048    /* Largest object */
+#define STRESS_MSG_SIZE         64
+#define STRESS_TCP_CHUNK        1024
+#define STRESS_TCP_TIMEOUT_MS   2000    /* Longest wait for a loopback connection */
+#define STRESS_LOOPBACK         0x7F000001
+
+/* First payload byte that ends a partner's loop */
+#define STRESS_QUIT             0xFF
+
+struct stress_run;
+
+/**
+ * One thread of a run
+ * Timed workers record operations; partners and receivers only serve.
+ */
+typedef struct stress_worker {
+    struct stress_run *run;
+    process_t *proc;
+    struct stress_worker *peer;         /* Partner, or the receiver of a sender */
+    uint32_t cpu;
+    bool timed;
+    volatile bool quit;                 /* Set for a partner when its worker is done */
+    uint32_t senders;                   /* Receivers: senders still running */
+    pipe_t *in;
+    pipe_t *out;
+    int fds[2];                         /* Timed pipe workers: write end of out, read end of in */
+    int peer_fds[2];
+    semaphore_t *wait_sem;
+    semaphore_t *post_sem;
+    tcp_socket_t *listener;             /* TCP partners */
+    uint16_t port;
+    uint64_t seed;
+    uint64_t ops;
+    uint64_t max_cycles;
+    uint32_t errors;
+    uint32_t hist[STRESS_HIST_BUCKETS];
+} stress_worker_t;
+
+typedef struct stress_run {
+    stress_test_t test;
+    volatile uint32_t go;               /* 0 until the timed phase starts */
+    volatile bool stop;
+    volatile uint32_t running;          /* Threads not finished yet */
+    uint32_t count;
+    stress_worker_t workers[];
+} stress_run_t;
+
+static const char *stress_names[STRESS_NUM_TESTS] = {
+    "alloc", "pipe", "msg", "sem", "tcp"
+};
+
+const char *stress_test_name(stress_test_t test) {
+    return test < STRESS_NUM_TESTS ? stress_names[test] : "?";
+}
+
+/* ========== Helpers ========== */
+
+static bool stress_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Parse a decimal number
+ * @return false if s is not one
+ */
+static bool stress_parse(const char *s, uint64_t *out) {
+    uint64_t value = 0;
+    if (!*s) {
+        return false;
+    }
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(*s - '0');
+    }
+    *out = value;
+    return true;
+}
+
+static uint64_t stress_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* ========== Latency Histogram ========== */
+
+static uint32_t stress_bucket(uint64_t cycles) {
+    if (cycles < STRESS_HIST_SUB) {
+        return (uint32_t)cycles;
+    }
+    uint32_t msb = 63 - (uint32_t)__builtin_clzll(cycles);
+    return (msb - 2) * STRESS_HIST_SUB + (uint32_t)((cycles >> (msb - 3)) & (STRESS_HIST_SUB - 1));
+}
+
+/**
+ * Largest cycle count that falls in a bucket
+ */
+static uint64_t stress_bucket_top(uint32_t bucket) {
+    if (bucket < STRESS_HIST_SUB) {
+        return bucket;
+    }
+    uint32_t shift = bucket / STRESS_HIST_SUB - 1;
+    uint64_t low = (uint64_t)(STRESS_HIST_SUB + bucket % STRESS_HIST_SUB) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+static void stress_record(stress_worker_t *w, uint64_t cycles) {
+    w->ops++;
+    w->hist[stress_bucket(cycles)]++;
+    if (cycles > w->max_cycles) {
+        w->max_cycles = cycles;
+    }
+}
+
+/**
+ * Latency below which a fraction (per mille) of the operations finished
+ */
+static uint64_t stress_percentile(const uint32_t *hist, uint64_t total, uint32_t permille) {
+    uint64_t want = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (uint32_t b = 0; b < STRESS_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want && seen > 0) {
+            return clock_cycles_to_ns(stress_bucket_top(b));
+        }
+    }
+    return 0;
+}
+
+/* ========== Workloads ========== */
+
+static void stress_alloc(stress_worker_t *w) {
+    void *slots[STRESS_ALLOC_SLOTS] = { 0 };
+
+    while (!w->run->stop) {
+        uint64_t r = stress_random(&w->seed);
+        uint32_t slot = (uint32_t)(r % STRESS_ALLOC_SLOTS);
+        size_t size = 16 + (size_t)((r >> 16) % (STRESS_ALLOC_MAX - 16));
+
+        uint64_t start = clock_cycles();
+        kfree(slots[slot]);
+        slots[slot] = kmalloc(size);
+        stress_record(w, clock_cycles() - start);
+        if (!slots[slot]) {
+            w->errors++;
+        }
+    }
+
+    for (uint32_t i = 0; i < STRESS_ALLOC_SLOTS; i++) {
+        kfree(slots[i]);
+    }
+}
+
+static void stress_pipe(stress_worker_t *w) {
+    uint8_t token = 0;
+
+    if (!w->timed) {
+        while (pipe_read(w->in, &token, 1) == 1 && token != STRESS_QUIT) {
+            if (pipe_write(w->out, &token, 1) != 1) {
+                break;
+            }
+        }
+        return;
+    }
+
+    while (!w->run->stop) {
+        uint64_t start = clock_cycles();
+        token = 1;
+        if (pipe_write(w->out, &token, 1) != 1 || pipe_read(w->in, &token, 1) != 1) {
+            w->errors++;
+            break;
+        }
+        stress_record(w, clock_cycles() - start);
+    }
+    token = STRESS_QUIT;
+    pipe_write(w->out, &token, 1);
+}
+
+static void stress_sem(stress_worker_t *w) {
+    if (!w->timed) {
+        while (sem_wait(w->wait_sem) == SEM_SUCCESS && !w->quit) {
+            sem_post(w->post_sem);
+        }
+        return;
+    }
+
+    while (!w->run->stop) {
+        uint64_t start = clock_cycles();
+        if (sem_post(w->post_sem) != SEM_SUCCESS || sem_wait(w->wait_sem) != SEM_SUCCESS) {
+            w->errors++;
+            break;
+        }
+        stress_record(w, clock_cycles() - start);
+    }
+    if (w->peer) {
+        w->peer->quit = true;
+    }
+    sem_post(w->post_sem);
+}
+
+/**
+ * Send one message, waiting while the receiver's queue or the pool is full
+ */
+static int stress_msg_send(uint32_t pid, const uint8_t *msg) {
+    for (;;) {
+        int result = msg_send(pid, msg, STRESS_MSG_SIZE);
+        if (result != MSG_ERR_QUEUE_FULL && result != MSG_ERR_NO_MEMORY) {
+            return result;
+        }
+        scheduler_yield();
+    }
+}
+
+static void stress_msg(stress_worker_t *w) {
+    uint8_t msg[STRESS_MSG_SIZE] = { 0 };
+
+    if (!w->timed) {
+        while (w->senders > 0) {
+            if (msg_receive(msg, sizeof(msg)) <= 0) {
+                w->errors++;
+                break;
+            }
+            if (msg[0] == STRESS_QUIT) {
+                w->senders--;
+            }
+        }
+        return;
+    }
+
+    uint32_t pid = w->peer->proc->pid;
+    while (!w->run->stop) {
+        uint64_t start = clock_cycles();
+        if (stress_msg_send(pid, msg) != MSG_SUCCESS) {
+            w->errors++;
+            break;
+        }
+        stress_record(w, clock_cycles() - start);
+    }
+    msg[0] = STRESS_QUIT;
+    stress_msg_send(pid, msg);
+}
+
+/**
+ * Drain the connection until the worker closes it
+ */
+static void stress_tcp_serve(stress_worker_t *w, uint8_t *buf) {
+    tcp_socket_t *conn = NULL;
+
+    for (;;) {
+        bool progress = false;
+        if (!conn) {
+            conn = tcp_accept(w->listener);
+            if (conn) {
+                tcp_set_nonblock(conn, true);
+                progress = true;
+            } else if (w->quit) {
+                return;
+            }
+        }
+        while (conn && tcp_recv(conn, buf, STRESS_TCP_CHUNK) > 0) {
+            progress = true;
+        }
+        if (conn && (tcp_poll_events(conn) & POLL_HUP)) {
+            tcp_close(conn);
+            return;
+        }
+        if (!progress) {
+            scheduler_yield();
+        }
+    }
+}
+
+/**
+ * Connect to the partner's listener
+ * @return The connected socket, or NULL
+ */
+static tcp_socket_t *stress_tcp_dial(uint16_t port) {
+    tcp_socket_t *sock = tcp_socket_create();
+    if (!sock) {
+        return NULL;
+    }
+    tcp_set_nonblock(sock, true);
+    tcp_set_nodelay(sock, true);
+    if (tcp_bind(sock, 0) != TCP_OK || tcp_connect(sock, STRESS_LOOPBACK, port) != TCP_OK) {
+        tcp_abort(sock);
+        return NULL;
+    }
+
+    uint64_t deadline = timer_now_ms() + STRESS_TCP_TIMEOUT_MS;
+    while (!tcp_is_connected(sock)) {
+        if (sock->state == TCP_STATE_CLOSED || timer_now_ms() >= deadline) {
+            tcp_abort(sock);
+            return NULL;
+        }
+        scheduler_yield();
+    }
+    return sock;
+}
+
+/**
+ * Send one chunk, yielding while the send buffer is full
+ * @return false on an error, or if the run stopped while the buffer was full
+ */
+static bool stress_tcp_send(stress_worker_t *w, tcp_socket_t *sock, const uint8_t *buf) {
+    for (size_t off = 0; off < STRESS_TCP_CHUNK;) {
+        ssize_t n = tcp_send(sock, buf + off, STRESS_TCP_CHUNK - off);
+        if (n > 0) {
+            off += (size_t)n;
+        } else if ((n == 0 || n == TCP_ERR_WOULDBLOCK) && !w->run->stop) {
+            scheduler_yield();
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void stress_tcp(stress_worker_t *w) {
+    uint8_t *buf = kmalloc(STRESS_TCP_CHUNK);
+    if (!buf) {
+        w->errors++;
+        if (w->peer) {
+            w->peer->quit = true;
+        }
+        return;
+    }
+
+    if (!w->timed) {
+        stress_tcp_serve(w, buf);
+        kfree(buf);
+        return;
+    }
+
+    for (size_t i = 0; i < STRESS_TCP_CHUNK; i++) {
+        buf[i] = (uint8_t)i;
+    }
+    tcp_socket_t *sock = stress_tcp_dial(w->port);
+    if (!sock) {
+        w->errors++;
+    }
+    while (sock && !w->run->stop) {
+        uint64_t start = clock_cycles();
+        if (!stress_tcp_send(w, sock, buf)) {
+            w->errors += !w->run->stop;
+            break;
+        }
+        stress_record(w, clock_cycles() - start);
+    }
+    if (sock) {
+        tcp_close(sock);
+    }
+    w->peer->quit = true;
+    kfree(buf);
+}
+
+static void stress_entry(void *arg) {
+    stress_worker_t *w = (stress_worker_t *)arg;
+    stress_run_t *run = w->run;
+
+    while (run->go == 0) {
+        waitq_wait(&run->go, 0);
+    }
+
+    switch (run->test) {
+        case STRESS_ALLOC:  stress_alloc(w); break;
+        case STRESS_PIPE:   stress_pipe(w); break;
+        case STRESS_MSG:    stress_msg(w); break;
+        case STRESS_SEM:    stress_sem(w); break;
+        case STRESS_TCP:    stress_tcp(w); break;
+        default:            break;
+    }
+
+    __atomic_sub_fetch(&run->running, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&run->running, WAITQ_WAKE_ALL);
+}
+
+/* ========== Runs ========== */
+
+static uint32_t stress_thread_count(const stress_config_t *cfg) {
+    uint32_t per_cpu = cfg->workers;
+    if (cfg->test == STRESS_MSG) {
+        per_cpu += 1;
+    } else if (cfg->test != STRESS_ALLOC) {
+        per_cpu *= 2;
+    }
+    return cfg->cpus * per_cpu;
+}
+
+/**
+ * Lay out the threads: per CPU a receiver (msg), then each timed worker
+ * followed by its partner (pipe, sem, tcp)
+ */
+static void stress_layout(stress_run_t *run, const stress_config_t *cfg) {
+    uint32_t n = 0;
+
+    for (uint32_t cpu = 0; cpu < cfg->cpus; cpu++) {
+        stress_worker_t *receiver = NULL;
+        if (cfg->test == STRESS_MSG) {
+            receiver = &run->workers[n++];
+            receiver->cpu = cpu;
+        }
+        for (uint32_t i = 0; i < cfg->workers; i++) {
+            stress_worker_t *w = &run->workers[n++];
+            w->cpu = cpu;
+            w->timed = true;
+            w->peer = receiver;
+            if (cfg->test == STRESS_ALLOC || cfg->test == STRESS_MSG) {
+                continue;
+            }
+            stress_worker_t *partner = &run->workers[n++];
+            partner->cpu = cpu;
+            partner->peer = w;
+            w->peer = partner;
+        }
+    }
+
+    for (uint32_t i = 0; i < run->count; i++) {
+        run->workers[i].run = run;
+        run->workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        run->workers[i].fds[0] = run->workers[i].fds[1] = -1;
+        run->workers[i].peer_fds[0] = run->workers[i].peer_fds[1] = -1;
+    }
+}
+
+/**
+ * Create what a timed worker and its partner share
+ */
+static bool stress_setup_pair(stress_run_t *run, stress_worker_t *w, uint32_t index) {
+    stress_worker_t *p = w->peer;
+
+    switch (run->test) {
+        case STRESS_PIPE: {
+            int a[2];
+            int b[2];
+            if (pipe_create(a) != PIPE_SUCCESS) {
+                return false;
+            }
+            w->fds[0] = a[0];
+            w->fds[1] = a[1];
+            if (pipe_create(b) != PIPE_SUCCESS) {
+                return false;
+            }
+            p->peer_fds[0] = b[0];
+            p->peer_fds[1] = b[1];
+            w->out = pipe_get(a[1]);
+            p->in = pipe_get(a[0]);
+            p->out = pipe_get(b[1]);
+            w->in = pipe_get(b[0]);
+            return w->out && w->in && p->out && p->in;
+        }
+        case STRESS_SEM:
+            w->post_sem = p->wait_sem = sem_create(0);
+            w->wait_sem = p->post_sem = sem_create(0);
+            return w->post_sem && w->wait_sem;
+        case STRESS_TCP:
+            w->port = (uint16_t)(STRESS_TCP_PORT + index);
+            p->listener = tcp_socket_create();
+            if (!p->listener || tcp_bind(p->listener, w->port) != TCP_OK ||
+                tcp_listen(p->listener, 1) != TCP_OK) {
+                return false;
+            }
+            tcp_set_nonblock(p->listener, true);
+            return true;
+        default:
+            return true;
+    }
+}
+
+static void stress_teardown(stress_run_t *run) {
+    for (uint32_t i = 0; i < run->count; i++) {
+        stress_worker_t *w = &run->workers[i];
+        for (int e = 0; e < 2; e++) {
+            if (w->fds[e] >= 0) {
+                pipe_close_fd(w->fds[e]);
+            }
+            if (w->peer_fds[e] >= 0) {
+                pipe_close_fd(w->peer_fds[e]);
+            }
+        }
+        if (w->timed && w->post_sem) {
+            sem_destroy(w->post_sem);
+            sem_destroy(w->wait_sem);
+        }
+        if (w->listener) {
+            tcp_close(w->listener);
+        }
+    }
+}
+
+/**
+ * Create and pin the threads, stopping at the first failure
+ * A partner is only created after its worker and a sender after its
+ * receiver. After a failure the run starts already stopped, so a worker
+ * whose partner is missing only sends its quit and returns.
+ * @return Threads created
+ */
+static uint32_t stress_spawn(stress_run_t *run) {
+    uint32_t created = 0;
+    uint32_t pairs = 0;
+
+    for (; created < run->count; created++) {
+        stress_worker_t *w = &run->workers[created];
+        bool first_of_pair = w->timed && w->peer && run->test != STRESS_MSG;
+        if (first_of_pair && !stress_setup_pair(run, w, pairs++)) {
+            break;
+        }
+        w->proc = thread_create(NULL, w->timed ? "stress" : "stress-peer", stress_entry, w);
+        if (!w->proc) {
+            break;
+        }
+        scheduler_pin(w->proc, w->cpu);
+        if (w->timed && run->test == STRESS_MSG) {
+            w->peer->senders++;
+        }
+    }
+    return created;
+}
+
+int stress_run(const stress_config_t *cfg, stress_result_t *res) {
+    if (!cfg || !res || cfg->test >= STRESS_NUM_TESTS || cfg->cpus == 0 ||
+        cfg->cpus > percpu_online_count() || cfg->workers == 0 || cfg->duration_ms == 0 ||
+        cfg->duration_ms > STRESS_MAX_MS || stress_thread_count(cfg) > STRESS_MAX_THREADS) {
+        return STRESS_ERR_INVAL;
+    }
+
+    uint32_t count = stress_thread_count(cfg);
+    stress_run_t *run = kcalloc(1, sizeof(stress_run_t) + count * sizeof(stress_worker_t));
+    if (!run) {
+        return STRESS_ERR_NOMEM;
+    }
+    run->test = cfg->test;
+    run->count = count;
+    stress_layout(run, cfg);
+
+    *res = (stress_result_t){ 0 };
+    uint32_t created = stress_spawn(run);
+    run->running = created;
+    for (uint32_t i = 0; i < created; i++) {
+        scheduler_add(run->workers[i].proc);
+    }
+    res->threads = created;
+    run->stop = created < count;
+
+    uint64_t start = clock_cycles();
+    __atomic_store_n(&run->go, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&run->go, WAITQ_WAKE_ALL);
+    if (!run->stop) {
+        timer_sleep_ms(cfg->duration_ms);
+        run->stop = true;
+    }
+    res->elapsed_ns = clock_cycles_to_ns(clock_cycles() - start);
+
+    uint64_t deadline = timer_now_ms() + STRESS_DRAIN_MS;
+    while (run->running > 0 && timer_now_ms() < deadline) {
+        timer_sleep_ms(10);
+    }
+    if (run->running > 0) {
+        /* The stragglers still use the run; leave it to them */
+        kprintf("[STRESS] %u of %u threads did not finish\n", run->running, created);
+        return STRESS_ERR_TIMEOUT;
+    }
+
+    uint32_t *hist = kcalloc(STRESS_HIST_BUCKETS, sizeof(uint32_t));
+    for (uint32_t i = 0; i < created; i++) {
+        stress_worker_t *w = &run->workers[i];
+        res->ops += w->ops;
+        res->errors += w->errors;
+        res->max_ns = MAX(res->max_ns, clock_cycles_to_ns(w->max_cycles));
+        for (uint32_t b = 0; hist && b < STRESS_HIST_BUCKETS; b++) {
+            hist[b] += w->hist[b];
+        }
+    }
+    if (hist) {
+        res->p50_ns = stress_percentile(hist, res->ops, 500);
+        res->p99_ns = stress_percentile(hist, res->ops, 990);
+        res->p999_ns = stress_percentile(hist, res->ops, 999);
+        kfree(hist);
+    }
+
+    stress_teardown(run);
+    kfree(run);
+    return created == count ? STRESS_OK : STRESS_ERR_NOMEM;
+}
+
+/* ========== Shell Command ========== */
+
+static bool stress_parse_test(const char *name, stress_test_t *test) {
+    for (uint32_t t = 0; t < STRESS_NUM_TESTS; t++) {
+        if (stress_streq(name, stress_names[t])) {
+            *test = (stress_test_t)t;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Run a workload on 1, 2, 4, ... and max_cpus CPUs
+ * @return 0, or 1 if a run failed or a step scaled below STRESS_MIN_EFFICIENCY
+ */
+static int stress_scale(stress_test_t test, uint32_t workers, uint32_t ms, uint32_t max_cpus) {
+    uint64_t base_rate = 0;
+    int failed = 0;
+
+    vga_printf("%s: %u timed threads per CPU, %u ms per step\n", stress_test_name(test),
+               workers, ms);
+    vga_puts(" CPUs threads      ops/s  scale  p50 ns  p99 ns  p99.9 ns    max ns\n");
+
+    for (uint32_t cpus = 1;; cpus = MIN(cpus * 2, max_cpus)) {
+        stress_config_t cfg = { test, cpus, workers, ms };
+        stress_result_t res;
+        int result = stress_run(&cfg, &res);
+        if (result == STRESS_ERR_INVAL || result == STRESS_ERR_TIMEOUT) {
+            vga_printf("%5u  %s\n", cpus, result == STRESS_ERR_INVAL ? "too many threads" :
+                                          "workers did not finish");
+            return 1;
+        }
+
+        uint64_t rate = res.ops * NSEC_PER_SEC / (res.elapsed_ns ? res.elapsed_ns : 1);
+        if (cpus == 1) {
+            base_rate = rate;
+        }
+        uint64_t efficiency = base_rate ? rate * 100 / (base_rate * cpus) : 0;
+        bool regressed = cpus > 1 && efficiency < STRESS_MIN_EFFICIENCY;
+
+        vga_printf("%5u %7u %10llu %5llu%% %7llu %7llu %9llu %9llu%s%s\n", cpus, res.threads,
+                   rate, efficiency, res.p50_ns, res.p99_ns, res.p999_ns, res.max_ns,
+                   regressed ? "  SCALING" : "", result != STRESS_OK || res.errors ?
+                   "  ERRORS" : "");
+        kprintf("[STRESS] %s: cpus=%u threads=%u ops=%llu ops_per_sec=%llu efficiency=%llu "
+                "p50=%lluns p99=%lluns p999=%lluns max=%lluns errors=%u%s\n",
+                stress_test_name(test), cpus, res.threads, res.ops, rate, efficiency,
+                res.p50_ns, res.p99_ns, res.p999_ns, res.max_ns, res.errors,
+                regressed ? " regression" : "");
+
+        failed |= regressed || result != STRESS_OK || res.errors;
+        if (cpus == max_cpus) {
+            break;
+        }
+    }
+    return failed;
+}
+
+/**
+ * stress <alloc|pipe|msg|sem|tcp|all> [workers per CPU] [ms per step] [max CPUs]
+ */
+static int cmd_stress(int argc, char *argv[]) {
+    stress_test_t test = STRESS_ALLOC;
+    bool all = argc > 1 && stress_streq(argv[1], "all");
+
+    if (argc < 2 || (!all && !stress_parse_test(argv[1], &test))) {
+        vga_puts("Usage: stress <alloc|pipe|msg|sem|tcp|all> [workers] [ms] [cpus]\n"
+                 "       workers are timed threads per CPU; runs on 1, 2, 4, ... cpus\n");
+        return 1;
+    }
+
+    uint64_t args[3] = { STRESS_DEFAULT_WORKERS, STRESS_DEFAULT_MS, percpu_online_count() };
+    uint64_t limits[3] = { STRESS_MAX_THREADS, STRESS_MAX_MS, percpu_online_count() };
+    for (int i = 2; i < argc && i <= 4; i++) {
+        if (!stress_parse(argv[i], &args[i - 2]) || args[i - 2] == 0 ||
+            args[i - 2] > limits[i - 2]) {
+            vga_printf("stress: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (uint32_t t = 0; t < STRESS_NUM_TESTS; t++) {
+        if (all || t == (uint32_t)test) {
+            failed |= stress_scale((stress_test_t)t, (uint32_t)args[0], (uint32_t)args[1],
+                                   (uint32_t)args[2]);
+        }
+    }
+    return failed;
+}
+
+static const shell_command_t stress_commands[] = {
+    {"stress", "Stress the allocator, IPC and TCP and check how they scale",
+     "<alloc|pipe|msg|sem|tcp|all> [workers] [ms] [cpus]", cmd_stress},
+};
+
+void stress_register_commands(void) {
+    for (size_t i = 0; i < sizeof(stress_commands) / sizeof(stress_commands[0]); i++) {
+        if (shell_register_command(&stress_commands[i]) < 0) {
+            kprintf("[SHELL] Warning: Failed to register command '%s'\n",
+                    stress_commands[i].name);
+        }
+    }
+}
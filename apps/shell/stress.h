@@ -0,0 +1,99 @@
+/**
+ * AAAos Kernel Shell - Stress and Scalability Tests
+ *
+ * A run pins worker kernel threads to the first cpus CPUs, releases them
+ * together, lets them loop for a fixed time and then stops them. Each
+ * worker times every operation into a log-linear latency histogram, so a
+ * run reports throughput and the median, 99th and 99.9th percentile and
+ * worst latency over all workers.
+ *
+ * The workloads, with workers threads per CPU:
+ *   alloc  kmalloc/kfree churn over a set of live objects of mixed sizes
+ *   pipe   one-byte ping-pong with a partner on the same CPU, per round trip
+ *   msg    msg_send fan-in to one receiving thread per CPU, per send
+ *   sem    semaphore handoff with a partner on the same CPU, per round trip
+ *   tcp    1KB sends over a loopback connection to a draining partner
+ *
+ * The "stress" shell command repeats a workload on 1, 2, 4, ... CPUs and
+ * compares each step with linear scaling from one CPU; a step below
+ * STRESS_MIN_EFFICIENCY percent of it is reported as a scaling regression
+ * and makes the command fail, so a script can catch it from the
+ * "[STRESS]" lines on the serial console.
+ */
+
+#ifndef _AAAOS_SHELL_STRESS_H
+#define _AAAOS_SHELL_STRESS_H
+
+#include "../../kernel/include/types.h"
+
+/* Limits */
+#define STRESS_MAX_THREADS      128     /* Threads in one run, partners included */
+#define STRESS_MAX_MS           60000   /* Longest run */
+#define STRESS_DRAIN_MS         5000    /* Wait for workers to finish after a run */
+#define STRESS_MIN_EFFICIENCY   50      /* Percent of linear scaling a step must reach */
+#define STRESS_TCP_PORT         5301    /* First loopback port of the tcp workload */
+
+/* Latency histogram: 8 buckets per power of two of TSC cycles */
+#define STRESS_HIST_SUB         8
+#define STRESS_HIST_BUCKETS     ((64 - 2) * STRESS_HIST_SUB)
+
+/* Error codes */
+#define STRESS_OK               0
+#define STRESS_ERR_INVAL        (-22)
+#define STRESS_ERR_NOMEM        (-12)
+#define STRESS_ERR_TIMEOUT      (-110)
+
+/* Workloads */
+typedef enum {
+    STRESS_ALLOC = 0,
+    STRESS_PIPE,
+    STRESS_MSG,
+    STRESS_SEM,
+    STRESS_TCP,
+    STRESS_NUM_TESTS
+} stress_test_t;
+
+/**
+ * Run parameters
+ */
+typedef struct stress_config {
+    stress_test_t test;
+    uint32_t cpus;                      /* CPUs 0..cpus-1 take part */
+    uint32_t workers;                   /* Timed threads per CPU */
+    uint32_t duration_ms;
+} stress_config_t;
+
+/**
+ * Result of one run
+ */
+typedef struct stress_result {
+    uint32_t threads;                   /* Threads started, partners included */
+    uint64_t ops;                       /* Timed operations that finished */
+    uint64_t elapsed_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    uint32_t errors;                    /* Operations that failed */
+} stress_result_t;
+
+/**
+ * Run one workload
+ * @return STRESS_OK, STRESS_ERR_NOMEM if not every thread could start
+ *         (res then covers those that did), STRESS_ERR_TIMEOUT if workers
+ *         were still running STRESS_DRAIN_MS after the end, or
+ *         STRESS_ERR_INVAL
+ */
+int stress_run(const stress_config_t *cfg, stress_result_t *res);
+
+/**
+ * Name of a workload ("alloc", "pipe", ...)
+ */
+const char *stress_test_name(stress_test_t test);
+
+/**
+ * Register the "stress" shell command
+ */
+void stress_register_commands(void);
+
+#endif /* _AAAOS_SHELL_STRESS_H */
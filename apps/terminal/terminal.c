@@ -8,6 +8,7 @@
 #include "terminal.h"
 #include "../../kernel/include/serial.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/sched/clock.h"
 #include "../../lib/libc/string.h"
 #include "../../drivers/video/framebuffer.h"
 #include "../../drivers/input/keyboard.h"
@@ -46,6 +47,12 @@ static void terminal_tab(terminal_t *term);
 static void terminal_backspace(terminal_t *term);
 static void terminal_scroll_up(terminal_t *term, int lines);
 static void terminal_scroll_down(terminal_t *term, int lines);
+static bool terminal_scroll_pixels(terminal_t *term, int lines);
+static void terminal_apply_scroll(terminal_t *term);
+static void terminal_output_frame(terminal_t *term);
+static void terminal_sb_push(terminal_t *term, const terminal_cell_t *cells);
+static const uint8_t *terminal_sb_find(terminal_t *term, uint32_t index);
+static void terminal_sb_expand(terminal_t *term, const uint8_t *rec, terminal_cell_t *cells);
 static terminal_line_t *terminal_alloc_line(uint32_t width);
 static void terminal_free_line(terminal_line_t *line);
 static void terminal_clear_cell(terminal_t *term, terminal_cell_t *cell);
@@ -140,28 +147,8 @@ terminal_t *terminal_create(uint32_t width_chars, uint32_t height_chars)
         term->buffer[i].dirty = true;
     }
 
-    /* Allocate scrollback buffer */
-    term->scrollback_size = TERMINAL_SCROLLBACK_LINES;
-    term->scrollback = (terminal_line_t *)kmalloc(term->scrollback_size * sizeof(terminal_line_t));
-    if (!term->scrollback) {
-        kprintf("[terminal] Failed to allocate scrollback buffer\n");
-        /* Free screen buffer */
-        for (i = 0; i < height_chars; i++) {
-            kfree(term->buffer[i].cells);
-        }
-        kfree(term->buffer);
-        kfree(term);
-        return NULL;
-    }
-
-    /* Initialize scrollback lines to NULL (allocated on demand) */
-    for (i = 0; i < term->scrollback_size; i++) {
-        term->scrollback[i].cells = NULL;
-        term->scrollback[i].dirty = false;
-    }
-
+    /* Scrollback chunks are allocated as lines scroll off */
     term->scrollback_count = 0;
-    term->scrollback_head = 0;
     term->scroll_offset = 0;
 
     /* Set default colors */
@@ -197,6 +184,9 @@ terminal_t *terminal_create(uint32_t width_chars, uint32_t height_chars)
     term->window = NULL;
     term->fullscreen = false;
     term->needs_redraw = true;
+    term->scroll_pending = 0;
+    term->drawn_cursor_y = -1;
+    term->next_frame_ns = 0;
 
     /* Terminal is ready */
     term->running = false;
@@ -228,14 +218,11 @@ void terminal_destroy(terminal_t *term)
         kfree(term->buffer);
     }
 
-    /* Free scrollback buffer */
-    if (term->scrollback) {
-        for (i = 0; i < term->scrollback_size; i++) {
-            if (term->scrollback[i].cells) {
-                kfree(term->scrollback[i].cells);
-            }
+    /* Free scrollback chunks */
+    for (i = 0; i < TERMINAL_SCROLLBACK_CHUNKS; i++) {
+        if (term->scrollback[i].data) {
+            kfree(term->scrollback[i].data);
         }
-        kfree(term->scrollback);
     }
 
     /* Destroy window if in windowed mode */
@@ -320,22 +307,47 @@ terminal_t *terminal_create_fullscreen(void)
 
 void terminal_putc(terminal_t *term, char c)
 {
-    if (!term) {
+    terminal_write(term, &c, 1);
+}
+
+void terminal_puts(terminal_t *term, const char *str)
+{
+    if (!term || !str) {
         return;
     }
 
-    terminal_process_char(term, c);
+    terminal_write(term, str, strlen(str));
 }
 
-void terminal_puts(terminal_t *term, const char *str)
+void terminal_write(terminal_t *term, const char *buf, size_t len)
 {
-    if (!term || !str) {
+    if (!term || !buf) {
         return;
     }
 
-    while (*str) {
-        terminal_putc(term, *str++);
+    /* Parse everything first; it only updates cells and dirty flags */
+    for (size_t i = 0; i < len; i++) {
+        terminal_process_char(term, buf[i]);
     }
+
+    terminal_output_frame(term);
+}
+
+/**
+ * Draw what output changed, if a frame is due
+ * Frames not due are dropped: the dirty lines and scrolls carry over to
+ * the next one, or to the input loop's draw.
+ */
+static void terminal_output_frame(terminal_t *term)
+{
+    uint64_t now = clock_monotonic_ns();
+
+    if (now < term->next_frame_ns) {
+        return;
+    }
+
+    term->next_frame_ns = now + NSEC_PER_SEC / TERMINAL_FRAME_RATE;
+    terminal_draw(term);
 }
 
 int terminal_printf(terminal_t *term, const char *fmt, ...)
@@ -683,8 +695,6 @@ static void terminal_scroll_up(terminal_t *term, int lines)
 {
     uint32_t y, x;
     uint32_t src_line;
-    terminal_line_t *sb_line;
-    uint32_t sb_index;
 
     if (lines <= 0 || (uint32_t)lines > term->height) {
         lines = (int)term->height;
@@ -692,36 +702,18 @@ static void terminal_scroll_up(terminal_t *term, int lines)
 
     /* Save top lines to scrollback */
     for (y = 0; y < (uint32_t)lines; y++) {
-        /* Calculate scrollback index */
-        sb_index = (term->scrollback_head + term->scrollback_count) % term->scrollback_size;
-
-        /* Allocate scrollback line if needed */
-        sb_line = &term->scrollback[sb_index];
-        if (!sb_line->cells) {
-            sb_line->cells = (terminal_cell_t *)kmalloc(term->width * sizeof(terminal_cell_t));
-        }
-
-        if (sb_line->cells) {
-            /* Copy line to scrollback */
-            memcpy(sb_line->cells, term->buffer[y].cells,
-                   term->width * sizeof(terminal_cell_t));
-
-            /* Update scrollback count */
-            if (term->scrollback_count < term->scrollback_size) {
-                term->scrollback_count++;
-            } else {
-                /* Scrollback is full, advance head */
-                term->scrollback_head = (term->scrollback_head + 1) % term->scrollback_size;
-            }
-        }
+        terminal_sb_push(term, term->buffer[y].cells);
     }
 
+    /* Move what is drawn along with the lines, if it can be */
+    bool moved = terminal_scroll_pixels(term, lines);
+
     /* Move lines up */
     for (y = 0; y < term->height - (uint32_t)lines; y++) {
         src_line = y + (uint32_t)lines;
         memcpy(term->buffer[y].cells, term->buffer[src_line].cells,
                term->width * sizeof(terminal_cell_t));
-        term->buffer[y].dirty = true;
+        term->buffer[y].dirty = moved ? term->buffer[src_line].dirty : true;
     }
 
     /* Clear bottom lines */
@@ -732,7 +724,9 @@ static void terminal_scroll_up(terminal_t *term, int lines)
         term->buffer[y].dirty = true;
     }
 
-    term->needs_redraw = true;
+    if (!moved) {
+        term->needs_redraw = true;
+    }
 }
 
 static void terminal_scroll_down(terminal_t *term, int lines)
@@ -744,12 +738,15 @@ static void terminal_scroll_down(terminal_t *term, int lines)
         lines = (int)term->height;
     }
 
+    /* Move what is drawn along with the lines, if it can be */
+    bool moved = terminal_scroll_pixels(term, -lines);
+
     /* Move lines down */
     for (y = term->height - 1; y >= (uint32_t)lines; y--) {
         src_line = (int)y - lines;
         memcpy(term->buffer[y].cells, term->buffer[src_line].cells,
                term->width * sizeof(terminal_cell_t));
-        term->buffer[y].dirty = true;
+        term->buffer[y].dirty = moved ? term->buffer[src_line].dirty : true;
     }
 
     /* Clear top lines */
@@ -760,7 +757,65 @@ static void terminal_scroll_down(terminal_t *term, int lines)
         term->buffer[y].dirty = true;
     }
 
-    term->needs_redraw = true;
+    if (!moved) {
+        term->needs_redraw = true;
+    }
+}
+
+/**
+ * Note that the pixels drawn are to move by whole lines (positive: up)
+ * Lines keep their dirty flags as they move, so only lines that were out
+ * of date and the lines scrolled in need drawing. The pixels themselves
+ * are moved once, by the sum of the scrolls, at the next draw.
+ * @return false if the screen has to be redrawn in full instead
+ */
+static bool terminal_scroll_pixels(terminal_t *term, int lines)
+{
+    /* A pending full redraw or a scrolled-back view shows other lines */
+    if (term->needs_redraw || term->scroll_offset != 0) {
+        return false;
+    }
+    if (!term->window && !(term->fullscreen && fb_is_initialized())) {
+        return false;
+    }
+
+    /* Nothing drawn would stay on screen */
+    int pending = term->scroll_pending + lines;
+    if (pending >= (int)term->height || -pending >= (int)term->height) {
+        term->scroll_pending = 0;
+        return false;
+    }
+
+    term->scroll_pending = pending;
+    return true;
+}
+
+/**
+ * Move the pixels drawn by the scrolls made since the last draw
+ */
+static void terminal_apply_scroll(terminal_t *term)
+{
+    int lines = term->scroll_pending;
+    int pixel_w = (int)term->width * TERMINAL_CHAR_WIDTH;
+    int pixel_h = (int)term->height * TERMINAL_CHAR_HEIGHT;
+
+    term->scroll_pending = 0;
+    if (lines == 0 || term->needs_redraw) {
+        return;
+    }
+
+    if (term->window) {
+        compositor_scroll_window(term->window, 0, 0, pixel_w, pixel_h,
+                                 -lines * TERMINAL_CHAR_HEIGHT);
+    } else {
+        fb_scroll_rect(0, 0, pixel_w, pixel_h, -lines * TERMINAL_CHAR_HEIGHT);
+    }
+
+    /* The cursor underline moved with its line */
+    int ghost = term->drawn_cursor_y - lines;
+    if (term->drawn_cursor_y >= 0 && ghost >= 0 && ghost < (int)term->height) {
+        term->buffer[ghost].dirty = true;
+    }
 }
 
 void terminal_scroll_view(terminal_t *term, int lines)
@@ -1201,6 +1256,220 @@ static int terminal_parse_int(const char **str, int default_val)
     return has_digit ? value : default_val;
 }
 
+/*============================================================================
+ * Scrollback Functions
+ *============================================================================*/
+
+/**
+ * Check if two cells belong in the same attribute run
+ */
+static inline bool terminal_sb_same_run(const terminal_cell_t *a, const terminal_cell_t *b)
+{
+    return a->fg_color == b->fg_color && a->bg_color == b->bg_color &&
+           a->attributes == b->attributes;
+}
+
+/**
+ * Size of a stored line's record
+ */
+static uint32_t terminal_sb_record_size(const uint8_t *rec)
+{
+    terminal_sb_record_t hdr;
+
+    memcpy(&hdr, rec, sizeof(hdr));
+    return (uint32_t)sizeof(hdr) + hdr.length + hdr.runs * (uint32_t)sizeof(terminal_sb_run_t);
+}
+
+/**
+ * Start a new, empty chunk at the end of the ring
+ * When all chunks are in use, or no more memory can be had, the oldest
+ * chunk is taken over and its lines dropped.
+ */
+static terminal_sb_chunk_t *terminal_sb_new_chunk(terminal_t *term)
+{
+    terminal_sb_chunk_t *chunk;
+    uint8_t *data = NULL;
+
+    if (term->scrollback_chunks < TERMINAL_SCROLLBACK_CHUNKS) {
+        data = (uint8_t *)kmalloc(TERMINAL_SCROLLBACK_CHUNK_SIZE);
+    }
+
+    if (!data) {
+        if (term->scrollback_chunks == 0) {
+            return NULL;
+        }
+
+        chunk = &term->scrollback[term->scrollback_first];
+        data = chunk->data;
+        chunk->data = NULL;
+        term->scrollback_count -= chunk->lines;
+        term->scrollback_first = (term->scrollback_first + 1) % TERMINAL_SCROLLBACK_CHUNKS;
+        term->scrollback_chunks--;
+        term->sb_cache_valid = false;
+
+        if ((uint32_t)term->scroll_offset > term->scrollback_count) {
+            term->scroll_offset = (int32_t)term->scrollback_count;
+        }
+    }
+
+    chunk = &term->scrollback[(term->scrollback_first + term->scrollback_chunks) %
+                              TERMINAL_SCROLLBACK_CHUNKS];
+    chunk->data = data;
+    chunk->used = 0;
+    chunk->lines = 0;
+    term->scrollback_chunks++;
+    return chunk;
+}
+
+/**
+ * Compress a line of the screen onto the end of the scrollback
+ */
+static void terminal_sb_push(terminal_t *term, const terminal_cell_t *cells)
+{
+    terminal_sb_record_t hdr;
+    terminal_sb_run_t run;
+    terminal_sb_chunk_t *chunk = NULL;
+    uint32_t length = term->width;
+    uint32_t runs = 0;
+    uint32_t size, x, end;
+    uint8_t *p;
+
+    /* Trailing blanks come back as default cells, so are not stored */
+    while (length > 0) {
+        const terminal_cell_t *cell = &cells[length - 1];
+        if ((cell->ch != ' ' && cell->ch != 0) || cell->bg_color != term->default_bg ||
+            (cell->attributes & ATTR_INVERSE)) {
+            break;
+        }
+        length--;
+    }
+
+    for (x = 0; x < length; x++) {
+        if (x == 0 || !terminal_sb_same_run(&cells[x], &cells[x - 1])) {
+            runs++;
+        }
+    }
+    size = (uint32_t)sizeof(hdr) + length + runs * (uint32_t)sizeof(run);
+
+    if (term->scrollback_chunks > 0) {
+        chunk = &term->scrollback[(term->scrollback_first + term->scrollback_chunks - 1) %
+                                  TERMINAL_SCROLLBACK_CHUNKS];
+        if (chunk->used + size > TERMINAL_SCROLLBACK_CHUNK_SIZE) {
+            chunk = NULL;
+        }
+    }
+    if (!chunk) {
+        chunk = terminal_sb_new_chunk(term);
+        if (!chunk) {
+            return;
+        }
+    }
+
+    p = chunk->data + chunk->used;
+    hdr.length = (uint16_t)length;
+    hdr.runs = (uint16_t)runs;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    for (x = 0; x < length; x++) {
+        *p++ = (uint8_t)(cells[x].ch ? cells[x].ch : ' ');
+    }
+
+    for (x = 0; x < length; x = end) {
+        end = x + 1;
+        while (end < length && terminal_sb_same_run(&cells[end], &cells[x])) {
+            end++;
+        }
+        run.count = (uint16_t)(end - x);
+        run.fg_color = cells[x].fg_color;
+        run.bg_color = cells[x].bg_color;
+        run.attributes = cells[x].attributes;
+        memcpy(p, &run, sizeof(run));
+        p += sizeof(run);
+    }
+
+    chunk->used += size;
+    chunk->lines++;
+    term->scrollback_count++;
+}
+
+/**
+ * Find a stored line's record
+ * @param index Line number, the oldest being 0
+ * @return The record, or NULL if there is no such line
+ *
+ * Lookups continue from the previous one when they move forward in the
+ * same chunk, so a view is read without rescanning.
+ */
+static const uint8_t *terminal_sb_find(terminal_t *term, uint32_t index)
+{
+    terminal_sb_chunk_t *chunk = NULL;
+    uint32_t slot = 0, line = 0, offset = 0;
+    uint32_t c;
+
+    if (index >= term->scrollback_count) {
+        return NULL;
+    }
+
+    for (c = 0; c < term->scrollback_chunks; c++) {
+        slot = (term->scrollback_first + c) % TERMINAL_SCROLLBACK_CHUNKS;
+        chunk = &term->scrollback[slot];
+        if (index < line + chunk->lines) {
+            break;
+        }
+        line += chunk->lines;
+    }
+
+    if (term->sb_cache_valid && term->sb_cache_chunk == slot &&
+        term->sb_cache_line >= line && term->sb_cache_line <= index) {
+        line = term->sb_cache_line;
+        offset = term->sb_cache_offset;
+    }
+
+    while (line < index) {
+        offset += terminal_sb_record_size(chunk->data + offset);
+        line++;
+    }
+
+    term->sb_cache_valid = true;
+    term->sb_cache_chunk = slot;
+    term->sb_cache_line = line;
+    term->sb_cache_offset = offset;
+    return chunk->data + offset;
+}
+
+/**
+ * Expand a stored line into a screen width of cells
+ */
+static void terminal_sb_expand(terminal_t *term, const uint8_t *rec, terminal_cell_t *cells)
+{
+    terminal_sb_record_t hdr;
+    terminal_sb_run_t run;
+    const uint8_t *text, *runs;
+    uint32_t x = 0, r, n;
+
+    memcpy(&hdr, rec, sizeof(hdr));
+    text = rec + sizeof(hdr);
+    runs = text + hdr.length;
+
+    for (r = 0; r < hdr.runs; r++) {
+        memcpy(&run, runs + r * sizeof(run), sizeof(run));
+        for (n = 0; n < run.count && x < term->width; n++, x++) {
+            cells[x].ch = (char)text[x];
+            cells[x].fg_color = run.fg_color;
+            cells[x].bg_color = run.bg_color;
+            cells[x].attributes = run.attributes;
+        }
+    }
+
+    for (; x < term->width; x++) {
+        cells[x].ch = ' ';
+        cells[x].fg_color = term->default_fg;
+        cells[x].bg_color = term->default_bg;
+        cells[x].attributes = 0;
+    }
+}
+
 /*============================================================================
  * Rendering Functions
  *============================================================================*/
@@ -1214,7 +1483,7 @@ void terminal_draw(terminal_t *term)
     }
 
     /* Only redraw if needed */
-    if (!term->needs_redraw) {
+    if (!term->needs_redraw && term->scroll_pending == 0) {
         /* Check for dirty lines */
         bool has_dirty = false;
         for (y = 0; y < term->height; y++) {
@@ -1228,64 +1497,96 @@ void terminal_draw(terminal_t *term)
         }
     }
 
-    /* Draw all lines */
+    /* Catch the pixels up with the lines first, in one move */
+    terminal_apply_scroll(term);
+
+    /* Draw the dirty lines, noting the band they span; scrolled back, the
+     * rows do not match the lines, so all are drawn */
+    bool all = term->needs_redraw || term->scroll_offset != 0;
+    uint32_t first = term->height, last = 0;
     for (y = 0; y < term->height; y++) {
-        if (term->needs_redraw || term->buffer[y].dirty) {
+        if (all || term->buffer[y].dirty) {
             terminal_draw_line(term, (int)y);
             term->buffer[y].dirty = false;
+            first = MIN(first, y);
+            last = y;
         }
     }
 
     /* Draw cursor */
+    term->drawn_cursor_y = -1;
     if (term->cursor_visible && term->cursor_blink_state && term->scroll_offset == 0) {
         terminal_draw_cursor(term);
+        term->drawn_cursor_y = term->cursor_y;
     }
 
     term->needs_redraw = false;
 
-    /* Update display */
+    /* Update display: only the lines drawn, scrolls were marked already */
+    if (term->window) {
+        if (first <= last) {
+            compositor_commit_window(term->window, 0, (int)first * TERMINAL_CHAR_HEIGHT,
+                                     term->window->width,
+                                     (int)(last - first + 1) * TERMINAL_CHAR_HEIGHT);
+        }
+        compositor_frame_tick();
+    }
+}
+
+/**
+ * Draw a run of cells in one color pair with cached glyphs
+ */
+static void terminal_draw_run(terminal_t *term, int pixel_y, uint32_t col, const char *text,
+                              uint32_t len, uint32_t fg, uint32_t bg)
+{
+    int pixel_x = (int)col * TERMINAL_CHAR_WIDTH;
+
     if (term->window) {
-        compositor_invalidate(term->window->x, term->window->y,
-                              term->window->width, term->window->height);
-        compositor_render();
+        fb_render_text(term->window->buffer, term->window->width, term->window->width,
+                       term->window->height, pixel_x, pixel_y, text, len, fg, bg);
+    } else {
+        fb_draw_text(pixel_x, pixel_y, text, len, fg, bg);
     }
 }
 
 void terminal_draw_line(terminal_t *term, int line)
 {
     uint32_t x;
-    int pixel_x, pixel_y;
-    terminal_cell_t *cell;
+    int pixel_y;
+    const terminal_cell_t *cells, *cell;
+    terminal_cell_t expanded[TERMINAL_MAX_WIDTH];
     uint32_t fg, bg;
-    uint32_t *dest_buffer;
-    int dest_x_offset = 0;
-    int dest_y_offset = 0;
+    char text[TERMINAL_MAX_WIDTH];
+    uint32_t run_start = 0;
+    uint32_t run_fg = 0, run_bg = 0;
 
     if (!term || line < 0 || (uint32_t)line >= term->height) {
         return;
     }
 
     /* Determine where to draw */
-    if (term->window) {
-        dest_buffer = term->window->buffer;
-        dest_x_offset = 0;
-        dest_y_offset = 0;
-    } else if (term->fullscreen) {
-        const framebuffer_t *fb = fb_get_info();
-        if (!fb || !fb->initialized) {
-            return;
-        }
-        dest_buffer = fb->address;
-        dest_x_offset = 0;
-        dest_y_offset = 0;
-    } else {
+    if (!term->window && !(term->fullscreen && fb_is_initialized())) {
         return;
     }
 
-    pixel_y = dest_y_offset + line * TERMINAL_CHAR_HEIGHT;
+    pixel_y = line * TERMINAL_CHAR_HEIGHT;
+
+    /* Scrolled back, the top rows are expanded from the scrollback */
+    cells = term->buffer[line].cells;
+    if (line < term->scroll_offset) {
+        const uint8_t *rec = terminal_sb_find(term, term->scrollback_count -
+                                              (uint32_t)term->scroll_offset + (uint32_t)line);
+        if (rec) {
+            terminal_sb_expand(term, rec, expanded);
+            cells = expanded;
+        }
+    } else if (term->scroll_offset > 0) {
+        cells = term->buffer[line - term->scroll_offset].cells;
+    }
 
-    for (x = 0; x < term->width; x++) {
-        cell = &term->buffer[line].cells[x];
+    /* Cells sharing colors are drawn as one run */
+    for (x = 0; x < term->width && x < TERMINAL_MAX_WIDTH; x++) {
+        cell = &cells[x];
 
         /* Get colors from palette */
         fg = term->palette[cell->fg_color & 0x0F];
@@ -1304,30 +1605,21 @@ void terminal_draw_line(terminal_t *term, int line)
             fg = term->palette[bright_idx];
         }
 
-        pixel_x = dest_x_offset + (int)x * TERMINAL_CHAR_WIDTH;
-
-        /* Draw character */
-        if (term->window) {
-            /* Draw to window buffer */
-            int cx, cy;
-            for (cy = 0; cy < TERMINAL_CHAR_HEIGHT; cy++) {
-                for (cx = 0; cx < TERMINAL_CHAR_WIDTH; cx++) {
-                    int buf_x = pixel_x + cx;
-                    int buf_y = pixel_y + cy;
-                    if (buf_x >= 0 && buf_x < term->window->width &&
-                        buf_y >= 0 && buf_y < term->window->height) {
-                        /* For now, just fill with background */
-                        dest_buffer[buf_y * term->window->width + buf_x] = bg;
-                    }
-                }
-            }
-            /* Draw the character using font (simplified - use framebuffer function) */
-            fb_draw_char(term->window->x + pixel_x, term->window->y + pixel_y,
-                         cell->ch ? cell->ch : ' ', fg, bg);
-        } else {
-            /* Draw directly to framebuffer */
-            fb_draw_char(pixel_x, pixel_y, cell->ch ? cell->ch : ' ', fg, bg);
+        if (x > run_start && (fg != run_fg || bg != run_bg)) {
+            terminal_draw_run(term, pixel_y, run_start, &text[run_start], x - run_start,
+                              run_fg, run_bg);
+            run_start = x;
+        }
+        if (x == run_start) {
+            run_fg = fg;
+            run_bg = bg;
         }
+        text[x] = cell->ch ? cell->ch : ' ';
+    }
+
+    if (x > run_start) {
+        terminal_draw_run(term, pixel_y, run_start, &text[run_start], x - run_start,
+                          run_fg, run_bg);
     }
 }
 
@@ -18,10 +18,12 @@
 #define TERMINAL_DEFAULT_HEIGHT     25      /* Default terminal height in characters */
 #define TERMINAL_MAX_WIDTH          256     /* Maximum terminal width */
 #define TERMINAL_MAX_HEIGHT         128     /* Maximum terminal height */
-#define TERMINAL_SCROLLBACK_LINES   1000    /* Number of scrollback lines */
+#define TERMINAL_SCROLLBACK_CHUNK_SIZE (32 * 1024) /* Bytes per scrollback chunk */
+#define TERMINAL_SCROLLBACK_CHUNKS  128     /* Most scrollback chunks (4 MiB) */
 #define TERMINAL_INPUT_BUFFER_SIZE  256     /* Input buffer size */
 #define TERMINAL_ESCAPE_BUFFER_SIZE 32      /* Escape sequence buffer size */
 #define TERMINAL_TAB_WIDTH          8       /* Tab stop width */
+#define TERMINAL_FRAME_RATE         60      /* Most frames drawn per second by output */
 
 /* Terminal font dimensions (using framebuffer font) */
 #define TERMINAL_CHAR_WIDTH         8       /* Character width in pixels */
@@ -83,6 +85,34 @@ typedef struct {
     bool            dirty;      /* Line needs to be redrawn */
 } terminal_line_t;
 
+/**
+ * Compressed scrollback
+ * Lines scrolled off the top are stored as records packed back to back in
+ * fixed-size chunks: a terminal_sb_record_t, the line's characters (UTF-8,
+ * which for the terminal's ASCII cells is one byte each), then one
+ * terminal_sb_run_t per run of cells sharing colors and attributes.
+ * Trailing blank cells are not stored. The chunks form a ring and the
+ * oldest one is reused, dropping its lines, when all are full; lines are
+ * expanded back into cells only when scrolled into view.
+ */
+typedef struct {
+    uint16_t        length;             /* Characters stored */
+    uint16_t        runs;               /* Attribute runs */
+} terminal_sb_record_t;
+
+typedef struct {
+    uint16_t        count;              /* Cells in the run */
+    uint8_t         fg_color;
+    uint8_t         bg_color;
+    uint8_t         attributes;
+} terminal_sb_run_t;
+
+typedef struct {
+    uint8_t         *data;              /* TERMINAL_SCROLLBACK_CHUNK_SIZE bytes */
+    uint32_t        used;               /* Bytes of records */
+    uint32_t        lines;              /* Records */
+} terminal_sb_chunk_t;
+
 /**
  * Terminal structure
  * Contains all state for a terminal instance
@@ -102,10 +132,14 @@ typedef struct terminal {
     terminal_line_t *buffer;            /* Array of lines for visible area */
 
     /* Scrollback buffer */
-    terminal_line_t *scrollback;        /* Array of scrollback lines */
-    uint32_t        scrollback_size;    /* Total scrollback capacity */
+    terminal_sb_chunk_t scrollback[TERMINAL_SCROLLBACK_CHUNKS]; /* Ring of chunks */
+    uint32_t        scrollback_first;   /* Chunk holding the oldest line */
+    uint32_t        scrollback_chunks;  /* Chunks in use */
     uint32_t        scrollback_count;   /* Number of lines in scrollback */
-    uint32_t        scrollback_head;    /* Index of oldest line in scrollback */
+    uint32_t        sb_cache_line;      /* Last line looked up (oldest is 0) */
+    uint32_t        sb_cache_chunk;     /* Chunk holding it */
+    uint32_t        sb_cache_offset;    /* Its record's offset in the chunk */
+    bool            sb_cache_valid;     /* The above describe a stored line */
     int32_t         scroll_offset;      /* Current scroll offset (0 = bottom) */
 
     /* Current text attributes */
@@ -129,6 +163,9 @@ typedef struct terminal {
     window_t        *window;            /* Associated window */
     bool            fullscreen;         /* Running in fullscreen mode */
     bool            needs_redraw;       /* Screen needs full redraw */
+    int32_t         scroll_pending;     /* Lines scrolled since the pixels were moved */
+    int32_t         drawn_cursor_y;     /* Line the cursor was last drawn on (-1: none) */
+    uint64_t        next_frame_ns;      /* Earliest time output may draw again */
 
     /* State */
     bool            running;            /* Terminal is running */
@@ -216,6 +253,18 @@ void terminal_putc(terminal_t *term, char c);
  */
 void terminal_puts(terminal_t *term, const char *str);
 
+/**
+ * Output a buffer to the terminal
+ * The whole buffer is parsed first and the screen drawn at most once,
+ * and not at all if a frame was drawn less than 1 / TERMINAL_FRAME_RATE
+ * seconds ago: under a flood of output the frames in between are
+ * dropped, so drawing never holds the output up.
+ * @param term Terminal instance
+ * @param buf Characters to output
+ * @param len Number of characters
+ */
+void terminal_write(terminal_t *term, const char *buf, size_t len);
+
 /**
  * Output a formatted string to the terminal (printf-style)
  * @param term Terminal instance
@@ -15,188 +15,318 @@
 #include "../../drivers/input/keyboard.h"
 
 /*============================================================================
- * Line Buffer Functions
+ * Document Access
  *============================================================================*/
 
 /**
- * Create a new line with given initial content
+ * Make sure the lines of a file being indexed are known as far as a line
  */
-line_t* line_create(const char *content, size_t length) {
-    line_t *line = (line_t*)kmalloc(sizeof(line_t));
-    if (!line) {
-        kprintf("editor: failed to allocate line structure\n");
-        return NULL;
+static void editor_index_to_line(editor_t *editor, size_t line) {
+    if (line >= editor->num_lines && piece_table_indexing(&editor->text)) {
+        piece_table_line_start(&editor->text, line);
+        editor->num_lines = piece_table_line_count(&editor->text);
     }
+}
 
-    /* Determine initial capacity */
-    size_t capacity = EDITOR_INITIAL_CAPACITY;
-    if (length >= capacity) {
-        capacity = length + 1;
+/**
+ * Index more of a file opened without reading it in
+ * Called between keys, so the line count fills in while the first screen
+ * is already shown.
+ */
+static void editor_index_step(editor_t *editor) {
+    if (!piece_table_indexing(&editor->text)) {
+        return;
     }
 
-    line->data = (char*)kmalloc(capacity);
-    if (!line->data) {
-        kprintf("editor: failed to allocate line data\n");
-        kfree(line);
-        return NULL;
-    }
+    size_t known = editor->num_lines;
+    piece_table_index_step(&editor->text, PIECE_TABLE_INDEX_STEP);
+    editor->num_lines = piece_table_line_count(&editor->text);
 
-    /* Copy content if provided */
-    if (content && length > 0) {
-        memcpy(line->data, content, length);
+    /* Rows past the lines known so far were drawn empty */
+    if ((size_t)(editor->scroll_y + editor->text_area_height) > known) {
+        editor->view_stale = true;
+    }
+    if (!piece_table_indexing(&editor->text)) {
+        kprintf("editor: indexed %zu lines\n", editor->num_lines);
     }
-    line->data[length] = '\0';
-    line->length = length;
-    line->capacity = capacity;
+}
+
+/**
+ * Read text of the file the document reads through
+ */
+static ssize_t editor_read_file(void *ctx, size_t offset, char *buf, size_t length) {
+    vfs_file_t *file = (vfs_file_t*)ctx;
 
-    return line;
+    if (vfs_seek(file, (int64_t)offset, VFS_SEEK_SET) < 0) {
+        return VFS_ERR_IO;
+    }
+    return vfs_read(file, buf, length);
 }
 
 /**
- * Destroy a line and free its memory
+ * Stop reading through the file the document was opened from
+ * The piece table must no longer be using it.
  */
-void line_destroy(line_t *line) {
-    if (line) {
-        if (line->data) {
-            kfree(line->data);
-        }
-        kfree(line);
+static void editor_close_file(editor_t *editor) {
+    if (editor->file) {
+        vfs_close(editor->file);
+        editor->file = NULL;
     }
 }
 
 /**
- * Ensure line has enough capacity
+ * Get a copy of one line of the document
  */
-bool line_ensure_capacity(line_t *line, size_t needed_capacity) {
-    if (!line) {
-        return false;
+line_t* editor_get_line(editor_t *editor, size_t idx) {
+    if (!editor) {
+        return NULL;
     }
 
-    if (line->capacity >= needed_capacity) {
-        return true;
+    editor_index_to_line(editor, idx);
+    if (idx >= editor->num_lines) {
+        return NULL;
     }
 
-    /* Double capacity until it's enough */
-    size_t new_capacity = line->capacity;
-    while (new_capacity < needed_capacity) {
-        new_capacity *= 2;
+    if (editor->line_valid && editor->line_index == idx) {
+        return &editor->line;
     }
 
-    /* Enforce maximum line length */
-    if (new_capacity > EDITOR_MAX_LINE_LENGTH) {
-        new_capacity = EDITOR_MAX_LINE_LENGTH;
-        if (needed_capacity > EDITOR_MAX_LINE_LENGTH) {
-            kprintf("editor: line too long\n");
-            return false;
+    size_t length = piece_table_line_length(&editor->text, idx);
+
+    /* Grow the copy as needed; if that fails, show the line cut short */
+    if (length + 1 > editor->line.capacity) {
+        size_t new_capacity = editor->line.capacity;
+        while (new_capacity < length + 1) {
+            new_capacity *= 2;
         }
-    }
 
-    char *new_data = (char*)krealloc(line->data, new_capacity);
-    if (!new_data) {
-        kprintf("editor: failed to expand line capacity\n");
-        return false;
+        char *new_data = (char*)krealloc(editor->line.data, new_capacity);
+        if (new_data) {
+            editor->line.data = new_data;
+            editor->line.capacity = new_capacity;
+        } else {
+            kprintf("editor: failed to expand line copy\n");
+            length = editor->line.capacity - 1;
+        }
     }
 
-    line->data = new_data;
-    line->capacity = new_capacity;
-    return true;
+    editor->line.length = piece_table_read(&editor->text,
+                                           piece_table_line_start(&editor->text, idx),
+                                           editor->line.data, length);
+
+    /* A CRLF line ending's CR is kept in the document but not shown */
+    editor->line.crlf = editor->line.length > 0 &&
+                        editor->line.data[editor->line.length - 1] == '\r';
+    if (editor->line.crlf) {
+        editor->line.length--;
+    }
+    editor->line.data[editor->line.length] = '\0';
+    editor->line_index = idx;
+    editor->line_valid = true;
+    return &editor->line;
 }
 
 /**
- * Insert character into line at position
+ * Offset in the document of a column of a line
  */
-bool line_insert_char(line_t *line, size_t pos, char c) {
-    if (!line || pos > line->length) {
-        return false;
-    }
+static size_t editor_offset(editor_t *editor, int line, int col) {
+    return piece_table_line_start(&editor->text, (size_t)line) + (size_t)col;
+}
 
-    /* Ensure capacity for one more character plus null terminator */
-    if (!line_ensure_capacity(line, line->length + 2)) {
-        return false;
-    }
+/**
+ * Move the cursor to an offset in the document
+ */
+static void editor_move_to_offset(editor_t *editor, size_t offset) {
+    size_t line = piece_table_line_at(&editor->text, offset);
 
-    /* Shift characters to the right */
-    memmove(line->data + pos + 1, line->data + pos, line->length - pos + 1);
-    line->data[pos] = c;
-    line->length++;
+    editor->cursor_y = (int)line;
+    editor->cursor_x = (int)(offset - piece_table_line_start(&editor->text, line));
+    editor_scroll_to_cursor(editor);
+}
 
-    return true;
+/**
+ * Note that the document was edited
+ */
+static void editor_text_changed(editor_t *editor) {
+    editor->num_lines = piece_table_line_count(&editor->text);
+    editor->line_valid = false;
+    editor->modified = true;
+    editor->view_stale = true;
+    editor->search_highlight = false;
 }
 
 /**
- * Delete character from line at position
+ * Replace the document with a kmalloc'd text, taking ownership of it
  */
-void line_delete_char(line_t *line, size_t pos) {
-    if (!line || pos >= line->length) {
-        return;
+static bool editor_set_text(editor_t *editor, char *text, size_t length) {
+    bool ok = true;
+
+    piece_table_destroy(&editor->text);
+    editor_close_file(editor);
+    if (!piece_table_init(&editor->text, text, length)) {
+        kprintf("editor: failed to index text\n");
+        piece_table_init(&editor->text, NULL, 0);
+        ok = false;
     }
 
-    /* Shift characters to the left */
-    memmove(line->data + pos, line->data + pos + 1, line->length - pos);
-    line->length--;
+    editor->num_lines = piece_table_line_count(&editor->text);
+    editor->line_valid = false;
+    editor->view_stale = true;
+    return ok;
 }
 
 /*============================================================================
- * Editor Line Management
+ * Text Search
  *============================================================================*/
 
 /**
- * Insert a new line into the editor at given position
+ * Query prepared for searching
  */
-bool editor_insert_line(editor_t *editor, size_t pos, line_t *line) {
-    if (!editor || !line || pos > editor->num_lines) {
-        return false;
+typedef struct {
+    const char  *query;
+    size_t      length;
+    uint8_t     skip[256];      /* Horspool shift for each last byte of a window */
+} editor_searcher_t;
+
+/* Searcher for highlighting matches while drawing */
+static editor_searcher_t editor_view_searcher;
+
+/* Searcher and read buffer for searching the document */
+static editor_searcher_t editor_doc_searcher;
+static char editor_search_chunk[EDITOR_SEARCH_CHUNK + 256];
+
+/**
+ * Prepare a query (at most 255 characters) for searching
+ */
+static void editor_searcher_init(editor_searcher_t *s, const char *query, size_t length) {
+    s->query = query;
+    s->length = length;
+    memset(s->skip, (int)length, sizeof(s->skip));
+    for (size_t i = 0; i + 1 < length; i++) {
+        s->skip[(uint8_t)query[i]] = (uint8_t)(length - 1 - i);
     }
+}
 
-    /* Check maximum lines */
-    if (editor->num_lines >= EDITOR_MAX_LINES) {
-        kprintf("editor: maximum lines reached\n");
-        return false;
+/**
+ * Find the first match in a buffer
+ * Short queries have too little to skip by, so for them the first byte is
+ * scanned for eight bytes at a time and each hit compared.
+ * @return The match, or NULL if there is none
+ */
+static const char* editor_search_buffer(const editor_searcher_t *s, const char *text,
+                                        size_t length) {
+    size_t n = s->length;
+    if (n == 0 || length < n) {
+        return NULL;
     }
 
-    /* Expand lines array if needed */
-    if (editor->num_lines >= editor->lines_capacity) {
-        size_t new_capacity = editor->lines_capacity * 2;
-        line_t **new_lines = (line_t**)krealloc(editor->lines,
-                                                 new_capacity * sizeof(line_t*));
-        if (!new_lines) {
-            kprintf("editor: failed to expand lines array\n");
-            return false;
+    const char *q = s->query;
+    size_t end = length - n + 1;        /* Positions a match can start at */
+
+    if (n < EDITOR_SEARCH_BMH_MIN) {
+        const uint64_t ones = 0x0101010101010101ULL;
+        const uint64_t pattern = ones * (uint8_t)q[0];
+        size_t i = 0;
+
+        while (i < end) {
+            if (end - i >= 8) {
+                uint64_t word;
+                memcpy(&word, text + i, sizeof(word));
+                word ^= pattern;
+                /* Lowest set bit marks the first zero byte, the first hit */
+                uint64_t hits = (word - ones) & ~word & (ones << 7);
+                if (!hits) {
+                    i += 8;
+                    continue;
+                }
+                i += (size_t)__builtin_ctzll(hits) / 8;
+            } else if (text[i] != q[0]) {
+                i++;
+                continue;
+            }
+            if (memcmp(text + i, q, n) == 0) {
+                return text + i;
+            }
+            i++;
         }
-        editor->lines = new_lines;
-        editor->lines_capacity = new_capacity;
+        return NULL;
     }
 
-    /* Shift lines down to make room */
-    if (pos < editor->num_lines) {
-        memmove(editor->lines + pos + 1, editor->lines + pos,
-                (editor->num_lines - pos) * sizeof(line_t*));
+    for (size_t i = 0; i < end; ) {
+        char last = text[i + n - 1];
+        if (last == q[n - 1] && memcmp(text + i, q, n - 1) == 0) {
+            return text + i;
+        }
+        i += s->skip[(uint8_t)last];
     }
-
-    editor->lines[pos] = line;
-    editor->num_lines++;
-
-    return true;
+    return NULL;
 }
 
 /**
- * Remove a line from the editor at given position
+ * Find the first (or last) match starting in a part of the document
+ * The document is read a chunk at a time, consecutive chunks overlapping
+ * by one character less than the query so no match falls between them.
  */
-void editor_remove_line(editor_t *editor, size_t pos) {
-    if (!editor || pos >= editor->num_lines) {
-        return;
-    }
+static bool editor_search_range(editor_t *editor, const editor_searcher_t *s,
+                                size_t from, size_t to, bool last, size_t *found) {
+    size_t doc_length = piece_table_length(&editor->text);
+    size_t pos = last ? to : from;
+
+    while (last ? pos > from : pos < to) {
+        size_t start = pos, end = pos;
+        if (last) {
+            start = pos - from > EDITOR_SEARCH_CHUNK ? pos - EDITOR_SEARCH_CHUNK : from;
+        } else {
+            end = to - pos > EDITOR_SEARCH_CHUNK ? pos + EDITOR_SEARCH_CHUNK : to;
+        }
 
-    /* Free the line */
-    line_destroy(editor->lines[pos]);
+        size_t want = end - start + s->length - 1;
+        if (want > doc_length - start) {
+            want = doc_length - start;
+        }
+        size_t got = piece_table_read(&editor->text, start, editor_search_chunk, want);
 
-    /* Shift lines up */
-    if (pos < editor->num_lines - 1) {
-        memmove(editor->lines + pos, editor->lines + pos + 1,
-                (editor->num_lines - pos - 1) * sizeof(line_t*));
+        const char *match = editor_search_buffer(s, editor_search_chunk, got);
+        while (match && last) {
+            size_t rest = got - (size_t)(match + 1 - editor_search_chunk);
+            const char *next = editor_search_buffer(s, match + 1, rest);
+            if (!next) {
+                break;
+            }
+            match = next;
+        }
+        if (match) {
+            *found = start + (size_t)(match - editor_search_chunk);
+            return true;
+        }
+        if (got < want) {
+            break;
+        }
+        pos = last ? start : end;
     }
+    return false;
+}
 
-    editor->num_lines--;
+/**
+ * Search the whole document, wrapping around
+ * @param from Offset a forward search starts at, or a backward one ends before
+ * @return true if found, with the offset of the match in found
+ */
+static bool editor_search(editor_t *editor, const char *query, size_t from, bool backward,
+                          size_t *found) {
+    size_t doc_length = piece_table_length(&editor->text);
+    editor_searcher_t *s = &editor_doc_searcher;
+
+    editor_searcher_init(s, query, strlen(query));
+    if (from > doc_length) {
+        from = doc_length;
+    }
+    if (backward) {
+        return editor_search_range(editor, s, 0, from, true, found) ||
+               editor_search_range(editor, s, from, doc_length, true, found);
+    }
+    return editor_search_range(editor, s, from, doc_length, false, found) ||
+           editor_search_range(editor, s, 0, from, false, found);
 }
 
 /*============================================================================
@@ -216,24 +346,18 @@ editor_t* editor_init(void) {
     /* Zero out the structure */
     memset(editor, 0, sizeof(editor_t));
 
-    /* Initialize lines array */
-    editor->lines_capacity = 256;
-    editor->lines = (line_t**)kmalloc(editor->lines_capacity * sizeof(line_t*));
-    if (!editor->lines) {
-        kprintf("editor: failed to allocate lines array\n");
-        kfree(editor);
-        return NULL;
-    }
+    /* Start with an empty document */
+    piece_table_init(&editor->text, NULL, 0);
+    editor->num_lines = 1;
 
-    /* Create initial empty line */
-    line_t *first_line = line_create(NULL, 0);
-    if (!first_line) {
-        kfree(editor->lines);
+    /* Copy of the line being looked at */
+    editor->line.capacity = EDITOR_INITIAL_CAPACITY;
+    editor->line.data = (char*)kmalloc(editor->line.capacity);
+    if (!editor->line.data) {
+        kprintf("editor: failed to allocate line copy\n");
         kfree(editor);
         return NULL;
     }
-    editor->lines[0] = first_line;
-    editor->num_lines = 1;
 
     /* Initialize display settings for VGA mode */
     editor->display_mode = EDITOR_MODE_VGA;
@@ -245,6 +369,7 @@ editor_t* editor_init(void) {
     editor->text_color = vga_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     editor->status_color = vga_color(VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GRAY);
     editor->line_num_color = vga_color(VGA_COLOR_DARK_GRAY, VGA_COLOR_BLACK);
+    editor->search_color = vga_color(VGA_COLOR_BLACK, VGA_COLOR_YELLOW);
 
     /* Framebuffer colors */
     editor->fb_text_fg = 0xFFFFFF;
@@ -262,6 +387,7 @@ editor_t* editor_init(void) {
     editor->has_filename = false;
     editor->modified = false;
     editor->readonly = false;
+    editor->view_stale = true;
 
     kprintf("editor: initialized successfully\n");
     return editor;
@@ -275,13 +401,9 @@ void editor_destroy(editor_t *editor) {
         return;
     }
 
-    /* Free all lines */
-    if (editor->lines) {
-        for (size_t i = 0; i < editor->num_lines; i++) {
-            line_destroy(editor->lines[i]);
-        }
-        kfree(editor->lines);
-    }
+    piece_table_destroy(&editor->text);
+    editor_close_file(editor);
+    kfree(editor->line.data);
 
     kfree(editor);
     kprintf("editor: destroyed\n");
@@ -295,14 +417,8 @@ void editor_new(editor_t *editor) {
         return;
     }
 
-    /* Free existing lines */
-    for (size_t i = 0; i < editor->num_lines; i++) {
-        line_destroy(editor->lines[i]);
-    }
-
-    /* Create single empty line */
-    editor->lines[0] = line_create(NULL, 0);
-    editor->num_lines = 1;
+    /* Start over with an empty document */
+    editor_set_text(editor, NULL, 0);
 
     /* Reset state */
     editor->filename[0] = '\0';
@@ -312,6 +428,7 @@ void editor_new(editor_t *editor) {
     editor->cursor_y = 0;
     editor->scroll_x = 0;
     editor->scroll_y = 0;
+    editor->view_stale = true;
 
     editor_set_status(editor, "New file");
 }
@@ -345,79 +462,15 @@ int editor_open(editor_t *editor, const char *filename) {
         return VFS_ERR_IO;
     }
 
-    /* Allocate buffer for file content */
-    size_t file_size = (size_t)stat.st_size;
-    char *buffer = NULL;
-
-    if (file_size > 0) {
-        buffer = (char*)kmalloc(file_size + 1);
-        if (!buffer) {
-            vfs_close(file);
-            return VFS_ERR_NOMEM;
-        }
-
-        /* Read file content */
-        ssize_t bytes_read = vfs_read(file, buffer, file_size);
-        if (bytes_read < 0) {
-            kfree(buffer);
-            vfs_close(file);
-            return (int)bytes_read;
-        }
-        buffer[bytes_read] = '\0';
-    }
-
-    vfs_close(file);
-
-    /* Clear existing content */
-    for (size_t i = 0; i < editor->num_lines; i++) {
-        line_destroy(editor->lines[i]);
-    }
-    editor->num_lines = 0;
-
-    /* Parse content into lines */
-    if (buffer && file_size > 0) {
-        char *start = buffer;
-        char *ptr = buffer;
-
-        while (*ptr) {
-            if (*ptr == '\n') {
-                size_t len = (size_t)(ptr - start);
-                /* Remove trailing CR if present (Windows line endings) */
-                if (len > 0 && start[len - 1] == '\r') {
-                    len--;
-                }
-
-                line_t *line = line_create(start, len);
-                if (line) {
-                    editor_insert_line(editor, editor->num_lines, line);
-                }
-                start = ptr + 1;
-            }
-            ptr++;
-        }
-
-        /* Handle last line (may not end with newline) */
-        if (start < ptr) {
-            size_t len = (size_t)(ptr - start);
-            if (len > 0 && start[len - 1] == '\r') {
-                len--;
-            }
-            line_t *line = line_create(start, len);
-            if (line) {
-                editor_insert_line(editor, editor->num_lines, line);
-            }
-        }
-
-        kfree(buffer);
-    }
-
-    /* Ensure at least one line exists */
-    if (editor->num_lines == 0) {
-        line_t *line = line_create(NULL, 0);
-        if (line) {
-            editor_insert_line(editor, 0, line);
-        }
-    }
+    /* Read the file through as it is looked at rather than up front: only
+     * the first screen's worth is read and indexed before it is shown */
+    piece_table_destroy(&editor->text);
+    editor_close_file(editor);
+    piece_table_init_source(&editor->text, editor_read_file, file, (size_t)stat.st_size);
+    editor->file = file;
+    editor->num_lines = piece_table_line_count(&editor->text);
+    editor->line_valid = false;
+    editor_index_step(editor);
 
     /* Update editor state */
     strncpy(editor->filename, filename, EDITOR_MAX_FILENAME - 1);
@@ -428,9 +481,10 @@ int editor_open(editor_t *editor, const char *filename) {
     editor->cursor_y = 0;
     editor->scroll_x = 0;
     editor->scroll_y = 0;
+    editor->view_stale = true;
 
     editor_set_status(editor, "File opened");
-    kprintf("editor: loaded %zu lines\n", editor->num_lines);
+    kprintf("editor: opened %zu bytes\n", (size_t)stat.st_size);
 
     return VFS_OK;
 }
@@ -461,6 +515,15 @@ int editor_save_as(editor_t *editor, const char *filename) {
 
     kprintf("editor: saving to '%s'\n", filename);
 
+    /* Truncating the file the document reads through would lose its text */
+    if (editor->file && strcmp(filename, editor->filename) == 0) {
+        if (!piece_table_load(&editor->text)) {
+            editor_set_status(editor, "Too large to save in place");
+            return VFS_ERR_NOMEM;
+        }
+        editor_close_file(editor);
+    }
+
     /* Open file for writing */
     vfs_file_t *file = vfs_open(filename, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
     if (!file) {
@@ -469,24 +532,31 @@ int editor_save_as(editor_t *editor, const char *filename) {
         return VFS_ERR_IO;
     }
 
-    /* Write each line */
-    for (size_t i = 0; i < editor->num_lines; i++) {
-        line_t *line = editor->lines[i];
+    /* Write the document a piece at a time */
+    size_t length = piece_table_length(&editor->text);
+    char chunk[512];
+    char last = '\n';
 
-        /* Write line content */
-        if (line->length > 0) {
-            ssize_t written = vfs_write(file, line->data, line->length);
-            if (written < 0) {
-                vfs_close(file);
-                return (int)written;
-            }
+    for (size_t offset = 0; offset < length; ) {
+        size_t n = piece_table_read(&editor->text, offset, chunk, sizeof(chunk));
+        if (n == 0) {
+            vfs_close(file);
+            editor_set_status(editor, "Read error");
+            return VFS_ERR_IO;
         }
-
-        /* Write newline (except for last line if it's empty) */
-        if (i < editor->num_lines - 1 || line->length > 0) {
-            char newline = '\n';
-            vfs_write(file, &newline, 1);
+        ssize_t written = vfs_write(file, chunk, n);
+        if (written < 0) {
+            vfs_close(file);
+            return (int)written;
         }
+        last = chunk[n - 1];
+        offset += n;
+    }
+
+    /* End the last line with a newline unless it is empty */
+    if (last != '\n') {
+        char newline = '\n';
+        vfs_write(file, &newline, 1);
     }
 
     vfs_close(file);
@@ -515,16 +585,23 @@ void editor_insert_char(editor_t *editor, char c) {
         return;
     }
 
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
 
     /* Clamp cursor to line length */
     if (editor->cursor_x > (int)line->length) {
         editor->cursor_x = (int)line->length;
     }
 
-    if (line_insert_char(line, (size_t)editor->cursor_x, c)) {
+    /* Enforce maximum line length */
+    if (line->length + 1 >= EDITOR_MAX_LINE_LENGTH) {
+        kprintf("editor: line too long\n");
+        return;
+    }
+
+    if (piece_table_insert(&editor->text, editor_offset(editor, editor->cursor_y,
+                                                        editor->cursor_x), &c, 1)) {
         editor->cursor_x++;
-        editor->modified = true;
+        editor_text_changed(editor);
     }
 }
 
@@ -538,31 +615,22 @@ void editor_delete_char(editor_t *editor) {
 
     if (editor->cursor_x > 0) {
         /* Delete character in current line */
-        line_t *line = editor->lines[editor->cursor_y];
-        editor->cursor_x--;
-        line_delete_char(line, (size_t)editor->cursor_x);
-        editor->modified = true;
+        size_t offset = editor_offset(editor, editor->cursor_y, editor->cursor_x);
+        if (piece_table_delete(&editor->text, offset - 1, 1)) {
+            editor->cursor_x--;
+            editor_text_changed(editor);
+        }
     } else if (editor->cursor_y > 0) {
-        /* Join with previous line */
-        line_t *curr_line = editor->lines[editor->cursor_y];
-        line_t *prev_line = editor->lines[editor->cursor_y - 1];
-
-        /* Move cursor to end of previous line */
-        editor->cursor_x = (int)prev_line->length;
-
-        /* Append current line to previous line */
-        if (curr_line->length > 0) {
-            if (line_ensure_capacity(prev_line, prev_line->length + curr_line->length + 1)) {
-                memcpy(prev_line->data + prev_line->length, curr_line->data, curr_line->length);
-                prev_line->length += curr_line->length;
-                prev_line->data[prev_line->length] = '\0';
-            }
+        /* Join with previous line by deleting the line ending it */
+        line_t *prev_line = editor_get_line(editor, (size_t)editor->cursor_y - 1);
+        size_t prev_length = prev_line->length;
+        size_t ending = prev_line->crlf ? 2 : 1;
+        size_t offset = editor_offset(editor, editor->cursor_y, 0);
+        if (piece_table_delete(&editor->text, offset - ending, ending)) {
+            editor->cursor_y--;
+            editor->cursor_x = (int)prev_length;
+            editor_text_changed(editor);
         }
-
-        /* Remove current line */
-        editor_remove_line(editor, (size_t)editor->cursor_y);
-        editor->cursor_y--;
-        editor->modified = true;
     }
 }
 
@@ -574,28 +642,20 @@ void editor_delete_char_forward(editor_t *editor) {
         return;
     }
 
-    line_t *line = editor->lines[editor->cursor_y];
-
-    if (editor->cursor_x < (int)line->length) {
-        /* Delete character at cursor */
-        line_delete_char(line, (size_t)editor->cursor_x);
-        editor->modified = true;
-    } else if (editor->cursor_y < (int)editor->num_lines - 1) {
-        /* Join with next line */
-        line_t *next_line = editor->lines[editor->cursor_y + 1];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
 
-        /* Append next line to current line */
-        if (next_line->length > 0) {
-            if (line_ensure_capacity(line, line->length + next_line->length + 1)) {
-                memcpy(line->data + line->length, next_line->data, next_line->length);
-                line->length += next_line->length;
-                line->data[line->length] = '\0';
-            }
+    /* At the end of a line this deletes its line ending, joining the next */
+    if (editor->cursor_x < (int)line->length ||
+        editor->cursor_y < (int)editor->num_lines - 1) {
+        size_t count = 1;
+        if (editor->cursor_x >= (int)line->length) {
+            editor->cursor_x = (int)line->length;
+            count = line->crlf ? 2 : 1;
+        }
+        size_t offset = editor_offset(editor, editor->cursor_y, editor->cursor_x);
+        if (piece_table_delete(&editor->text, offset, count)) {
+            editor_text_changed(editor);
         }
-
-        /* Remove next line */
-        editor_remove_line(editor, (size_t)editor->cursor_y + 1);
-        editor->modified = true;
     }
 }
 
@@ -607,36 +667,23 @@ void editor_newline(editor_t *editor) {
         return;
     }
 
-    line_t *curr_line = editor->lines[editor->cursor_y];
+    line_t *curr_line = editor_get_line(editor, (size_t)editor->cursor_y);
 
     /* Clamp cursor to line length */
     if (editor->cursor_x > (int)curr_line->length) {
         editor->cursor_x = (int)curr_line->length;
     }
 
-    /* Create new line with content after cursor */
-    size_t split_pos = (size_t)editor->cursor_x;
-    size_t remaining_len = curr_line->length - split_pos;
-
-    line_t *new_line = line_create(curr_line->data + split_pos, remaining_len);
-    if (!new_line) {
-        return;
-    }
-
-    /* Truncate current line */
-    curr_line->length = split_pos;
-    curr_line->data[split_pos] = '\0';
-
-    /* Insert new line */
-    if (!editor_insert_line(editor, (size_t)editor->cursor_y + 1, new_line)) {
-        line_destroy(new_line);
+    char newline = '\n';
+    if (!piece_table_insert(&editor->text, editor_offset(editor, editor->cursor_y,
+                                                         editor->cursor_x), &newline, 1)) {
         return;
     }
 
     /* Move cursor to start of new line */
     editor->cursor_y++;
     editor->cursor_x = 0;
-    editor->modified = true;
+    editor_text_changed(editor);
 }
 
 /**
@@ -657,19 +704,29 @@ void editor_insert_tab(editor_t *editor) {
  * Delete the current line
  */
 void editor_delete_line(editor_t *editor) {
-    if (!editor || editor->num_lines <= 1) {
-        /* Keep at least one line */
-        if (editor->num_lines == 1) {
-            line_t *line = editor->lines[0];
-            line->length = 0;
-            line->data[0] = '\0';
-            editor->cursor_x = 0;
-            editor->modified = true;
-        }
+    if (!editor || editor->cursor_y >= (int)editor->num_lines) {
         return;
     }
 
-    editor_remove_line(editor, (size_t)editor->cursor_y);
+    size_t start = editor_offset(editor, editor->cursor_y, 0);
+    size_t end;
+
+    if (editor->cursor_y < (int)editor->num_lines - 1) {
+        /* The line and its newline */
+        end = editor_offset(editor, editor->cursor_y + 1, 0);
+    } else {
+        /* The last line, with the newline before it; the only line is
+         * just emptied */
+        end = piece_table_length(&editor->text);
+        if (start > 0) {
+            start -= editor_get_line(editor, (size_t)editor->cursor_y - 1)->crlf ? 2 : 1;
+        }
+    }
+
+    if (end > start && !piece_table_delete(&editor->text, start, end - start)) {
+        return;
+    }
+    editor_text_changed(editor);
 
     /* Adjust cursor if needed */
     if (editor->cursor_y >= (int)editor->num_lines) {
@@ -677,12 +734,46 @@ void editor_delete_line(editor_t *editor) {
     }
 
     /* Clamp cursor x to new line length */
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
     if (editor->cursor_x > (int)line->length) {
         editor->cursor_x = (int)line->length;
     }
+}
 
-    editor->modified = true;
+/**
+ * Undo the last edit
+ */
+void editor_undo(editor_t *editor) {
+    size_t offset;
+
+    if (!editor) {
+        return;
+    }
+
+    if (!piece_table_undo(&editor->text, &offset)) {
+        editor_set_status(editor, "Nothing to undo");
+        return;
+    }
+    editor_text_changed(editor);
+    editor_move_to_offset(editor, offset);
+}
+
+/**
+ * Redo the last undone edit
+ */
+void editor_redo(editor_t *editor) {
+    size_t offset;
+
+    if (!editor) {
+        return;
+    }
+
+    if (!piece_table_redo(&editor->text, &offset)) {
+        editor_set_status(editor, "Nothing to redo");
+        return;
+    }
+    editor_text_changed(editor);
+    editor_move_to_offset(editor, offset);
 }
 
 /*============================================================================
@@ -699,6 +790,9 @@ void editor_move_cursor(editor_t *editor, int dx, int dy) {
 
     /* Move vertically */
     editor->cursor_y += dy;
+    if (editor->cursor_y > 0) {
+        editor_index_to_line(editor, (size_t)editor->cursor_y);
+    }
 
     /* Clamp to valid line range */
     if (editor->cursor_y < 0) {
@@ -709,14 +803,14 @@ void editor_move_cursor(editor_t *editor, int dx, int dy) {
     }
 
     /* Move horizontally */
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
     editor->cursor_x += dx;
 
     /* Handle wrapping */
     if (editor->cursor_x < 0) {
         if (editor->cursor_y > 0) {
             editor->cursor_y--;
-            line = editor->lines[editor->cursor_y];
+            line = editor_get_line(editor, (size_t)editor->cursor_y);
             editor->cursor_x = (int)line->length;
         } else {
             editor->cursor_x = 0;
@@ -749,7 +843,7 @@ void editor_home(editor_t *editor) {
  */
 void editor_end(editor_t *editor) {
     if (editor && editor->cursor_y < (int)editor->num_lines) {
-        line_t *line = editor->lines[editor->cursor_y];
+        line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
         editor->cursor_x = (int)line->length;
         editor_scroll_to_cursor(editor);
     }
@@ -769,7 +863,7 @@ void editor_page_up(editor_t *editor) {
     }
 
     /* Clamp cursor x to line length */
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
     if (editor->cursor_x > (int)line->length) {
         editor->cursor_x = (int)line->length;
     }
@@ -786,12 +880,13 @@ void editor_page_down(editor_t *editor) {
     }
 
     editor->cursor_y += editor->text_area_height;
+    editor_index_to_line(editor, (size_t)editor->cursor_y);
     if (editor->cursor_y >= (int)editor->num_lines) {
         editor->cursor_y = (int)editor->num_lines - 1;
     }
 
     /* Clamp cursor x to line length */
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
     if (editor->cursor_x > (int)line->length) {
         editor->cursor_x = (int)line->length;
     }
@@ -813,6 +908,7 @@ void editor_goto_line(editor_t *editor, int line_num) {
     if (target < 0) {
         target = 0;
     }
+    editor_index_to_line(editor, (size_t)target);
     if (target >= (int)editor->num_lines) {
         target = (int)editor->num_lines - 1;
     }
@@ -841,8 +937,10 @@ void editor_goto_end(editor_t *editor) {
         return;
     }
 
+    /* The end is only known once the whole file is indexed */
+    editor_index_to_line(editor, SIZE_MAX);
     editor->cursor_y = (int)editor->num_lines - 1;
-    line_t *line = editor->lines[editor->cursor_y];
+    line_t *line = editor_get_line(editor, (size_t)editor->cursor_y);
     editor->cursor_x = (int)line->length;
     editor_scroll_to_cursor(editor);
 }
@@ -927,14 +1025,9 @@ int editor_offset_to_screen(line_t *line, int offset) {
 }
 
 /**
- * Redraw the entire editor display
+ * Draw one row of the text area
  */
-void editor_draw(editor_t *editor) {
-    if (!editor) {
-        return;
-    }
-
-    /* Get VGA memory pointer */
+static void editor_draw_line(editor_t *editor, int y) {
     uint16_t *vga_buffer = (uint16_t*)VGA_MEMORY;
 
     int text_start_x = 0;
@@ -942,88 +1035,139 @@ void editor_draw(editor_t *editor) {
         text_start_x = editor->line_num_width;
     }
 
-    /* Draw each visible line */
-    for (int y = 0; y < editor->text_area_height; y++) {
-        int line_idx = editor->scroll_y + y;
-        int screen_y = y;
+    int line_idx = editor->scroll_y + y;
+    int screen_y = y;
 
-        /* Clear line */
-        for (int x = 0; x < editor->screen_width; x++) {
-            vga_buffer[screen_y * VGA_WIDTH + x] = vga_entry(' ', editor->text_color);
+    /* Clear line */
+    for (int x = 0; x < editor->screen_width; x++) {
+        vga_buffer[screen_y * VGA_WIDTH + x] = vga_entry(' ', editor->text_color);
+    }
+
+    line_t *line = editor_get_line(editor, (size_t)line_idx);
+    if (!line) {
+        /* Draw tilde for empty lines beyond file */
+        if (editor->show_line_numbers) {
+            vga_buffer[screen_y * VGA_WIDTH] = vga_entry('~', editor->line_num_color);
         }
+        return;
+    }
 
-        if (line_idx >= (int)editor->num_lines) {
-            /* Draw tilde for empty lines beyond file */
-            if (editor->show_line_numbers) {
-                vga_buffer[screen_y * VGA_WIDTH] = vga_entry('~', editor->line_num_color);
+    /* Draw line number */
+    if (editor->show_line_numbers) {
+        char num_buf[16];
+        int num_len = 0;
+        int num = line_idx + 1;
+
+        /* Convert number to string (reversed) */
+        char temp[16];
+        int temp_len = 0;
+        if (num == 0) {
+            temp[temp_len++] = '0';
+        } else {
+            while (num > 0) {
+                temp[temp_len++] = '0' + (num % 10);
+                num /= 10;
             }
-            continue;
         }
 
+        /* Right-align the number */
+        int padding = editor->line_num_width - 1 - temp_len;
+        for (int i = 0; i < padding; i++) {
+            num_buf[num_len++] = ' ';
+        }
+        while (temp_len > 0) {
+            num_buf[num_len++] = temp[--temp_len];
+        }
+        num_buf[num_len++] = ' ';
+
         /* Draw line number */
-        if (editor->show_line_numbers) {
-            char num_buf[16];
-            int num_len = 0;
-            int num = line_idx + 1;
-
-            /* Convert number to string (reversed) */
-            char temp[16];
-            int temp_len = 0;
-            if (num == 0) {
-                temp[temp_len++] = '0';
-            } else {
-                while (num > 0) {
-                    temp[temp_len++] = '0' + (num % 10);
-                    num /= 10;
-                }
-            }
+        for (int i = 0; i < editor->line_num_width && i < num_len; i++) {
+            vga_buffer[screen_y * VGA_WIDTH + i] =
+                vga_entry(num_buf[i], editor->line_num_color);
+        }
+    }
 
-            /* Right-align the number */
-            int padding = editor->line_num_width - 1 - temp_len;
-            for (int i = 0; i < padding; i++) {
-                num_buf[num_len++] = ' ';
-            }
-            while (temp_len > 0) {
-                num_buf[num_len++] = temp[--temp_len];
-            }
-            num_buf[num_len++] = ' ';
+    /* Draw line content, matches of the search query highlighted */
+    const editor_searcher_t *s = &editor_view_searcher;
+    const char *match = editor_search_buffer(s, line->data, line->length);
+    int screen_x = text_start_x;
+    int buffer_col = 0;
 
-            /* Draw line number */
-            for (int i = 0; i < editor->line_num_width && i < num_len; i++) {
-                vga_buffer[screen_y * VGA_WIDTH + i] =
-                    vga_entry(num_buf[i], editor->line_num_color);
-            }
+    for (size_t i = 0; i < line->length && screen_x < editor->screen_width; i++) {
+        char c = line->data[i];
+        size_t match_at = match ? (size_t)(match - line->data) : SIZE_MAX;
+
+        if (match && i >= match_at + s->length) {
+            match = editor_search_buffer(s, line->data + i, line->length - i);
+            match_at = match ? (size_t)(match - line->data) : SIZE_MAX;
         }
+        uint8_t color = i >= match_at ? editor->search_color : editor->text_color;
 
-        /* Draw line content */
-        line_t *line = editor->lines[line_idx];
-        int screen_x = text_start_x;
-        int buffer_col = 0;
-
-        for (size_t i = 0; i < line->length && screen_x < editor->screen_width; i++) {
-            char c = line->data[i];
-
-            /* Handle tabs */
-            if (c == '\t') {
-                int tab_width = EDITOR_TAB_WIDTH - (buffer_col % EDITOR_TAB_WIDTH);
-                for (int t = 0; t < tab_width && screen_x < editor->screen_width; t++) {
-                    if (buffer_col >= editor->scroll_x) {
-                        vga_buffer[screen_y * VGA_WIDTH + screen_x] =
-                            vga_entry(' ', editor->text_color);
-                        screen_x++;
-                    }
-                    buffer_col++;
-                }
-            } else {
+        /* Handle tabs */
+        if (c == '\t') {
+            int tab_width = EDITOR_TAB_WIDTH - (buffer_col % EDITOR_TAB_WIDTH);
+            for (int t = 0; t < tab_width && screen_x < editor->screen_width; t++) {
                 if (buffer_col >= editor->scroll_x) {
-                    vga_buffer[screen_y * VGA_WIDTH + screen_x] =
-                        vga_entry(c, editor->text_color);
+                    vga_buffer[screen_y * VGA_WIDTH + screen_x] = vga_entry(' ', color);
                     screen_x++;
                 }
                 buffer_col++;
             }
+        } else {
+            if (buffer_col >= editor->scroll_x) {
+                vga_buffer[screen_y * VGA_WIDTH + screen_x] = vga_entry(c, color);
+                screen_x++;
+            }
+            buffer_col++;
         }
     }
+}
+
+/**
+ * Redraw the editor display
+ * When only the view moved vertically since the last draw, the rows still
+ * on screen are moved in VGA memory and only the rows scrolled in are
+ * drawn. Any edit sets view_stale, which draws every row.
+ */
+void editor_draw(editor_t *editor) {
+    if (!editor) {
+        return;
+    }
+
+    uint16_t *vga_buffer = (uint16_t*)VGA_MEMORY;
+    int rows = editor->text_area_height;
+    int delta = editor->scroll_y - editor->drawn_scroll_y;
+    int first = 0, last = rows;
+
+    bool full = editor->view_stale || editor->scroll_x != editor->drawn_scroll_x ||
+                delta >= rows || -delta >= rows;
+
+    if (!full && delta > 0) {
+        /* View moved down: rows go up, new ones appear at the bottom */
+        memmove(vga_buffer, vga_buffer + delta * VGA_WIDTH,
+                (size_t)(rows - delta) * VGA_WIDTH * sizeof(uint16_t));
+        first = rows - delta;
+    } else if (!full && delta < 0) {
+        memmove(vga_buffer - delta * VGA_WIDTH, vga_buffer,
+                (size_t)(rows + delta) * VGA_WIDTH * sizeof(uint16_t));
+        last = -delta;
+    } else if (!full) {
+        /* Nothing in the text area changed */
+        first = last;
+    }
+
+    /* Highlight what is being typed at the search prompt, else the last query */
+    const char *query = editor->state == EDITOR_STATE_SEARCH ? editor->input_buffer
+                                                             : editor->search_query;
+    editor_searcher_init(&editor_view_searcher, query,
+                         editor->search_highlight ? strlen(query) : 0);
+
+    for (int y = first; y < last; y++) {
+        editor_draw_line(editor, y);
+    }
+    editor->drawn_scroll_x = editor->scroll_x;
+    editor->drawn_scroll_y = editor->scroll_y;
+    editor->view_stale = false;
 
     /* Draw status bar */
     editor_draw_status(editor);
@@ -1198,98 +1342,88 @@ void editor_start_search(editor_t *editor) {
         editor->state = EDITOR_STATE_SEARCH;
         editor->input_length = 0;
         editor->input_buffer[0] = '\0';
+        editor->search_origin = editor_offset(editor, editor->cursor_y, editor->cursor_x);
+        editor->search_highlight = true;
+        editor->view_stale = true;
         editor_set_status(editor, "Search: ");
     }
 }
 
 /**
- * Find next occurrence of search query
+ * Follow the query being typed at the search prompt
+ * Every character added can only move the first match from the origin
+ * further on, so the search resumes at the match of the query without
+ * it, and stops once that had none. Deleting a character goes back to
+ * the match remembered for the shorter query.
  */
-bool editor_find_next(editor_t *editor) {
-    if (!editor || editor->search_query[0] == '\0') {
-        return false;
+static void editor_search_update(editor_t *editor, bool added) {
+    size_t n = editor->input_length;
+    size_t hit = editor->search_origin;
+
+    if (n > 0 && added) {
+        size_t from = n > 1 ? editor->search_hits[n - 2] : editor->search_origin;
+        size_t *found = &editor->search_hits[n - 1];
+        if (from == SIZE_MAX || !editor_search(editor, editor->input_buffer, from, false, found)) {
+            *found = SIZE_MAX;
+        }
     }
-
-    size_t query_len = strlen(editor->search_query);
-
-    /* Start from cursor position */
-    int start_line = editor->cursor_y;
-    int start_col = editor->cursor_x + 1;
-
-    for (int i = 0; i < (int)editor->num_lines; i++) {
-        int line_idx = (start_line + i) % (int)editor->num_lines;
-        line_t *line = editor->lines[line_idx];
-
-        int search_start = (i == 0) ? start_col : 0;
-
-        /* Search in this line */
-        for (int j = search_start; j <= (int)line->length - (int)query_len; j++) {
-            bool match = true;
-            for (size_t k = 0; k < query_len; k++) {
-                if (line->data[j + k] != editor->search_query[k]) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) {
-                editor->cursor_y = line_idx;
-                editor->cursor_x = j;
-                editor->search_match_line = line_idx;
-                editor->search_match_col = j;
-                editor_scroll_to_cursor(editor);
-                editor_set_status(editor, "Found");
-                return true;
-            }
+    for (size_t i = n; i > 0; i--) {
+        if (editor->search_hits[i - 1] != SIZE_MAX) {
+            hit = editor->search_hits[i - 1];
+            break;
         }
     }
+    editor_move_to_offset(editor, hit);
+    editor->view_stale = true;
 
-    editor_set_status(editor, "Not found");
-    return false;
+    /* Show the end of a query too long for the status bar */
+    char msg[64] = "Search: ";
+    size_t shown = n < 40 ? n : 40;
+    strcat(msg, editor->input_buffer + n - shown);
+    if (n > 0 && editor->search_hits[n - 1] == SIZE_MAX) {
+        strcat(msg, " (not found)");
+    }
+    editor_set_status(editor, msg);
 }
 
 /**
- * Find previous occurrence of search query
+ * Find the query from the cursor onwards (or backwards) and move there
  */
-bool editor_find_prev(editor_t *editor) {
+static bool editor_find(editor_t *editor, bool backward) {
     if (!editor || editor->search_query[0] == '\0') {
         return false;
     }
 
-    size_t query_len = strlen(editor->search_query);
+    size_t cursor = editor_offset(editor, editor->cursor_y, editor->cursor_x);
+    size_t found;
 
-    /* Start from cursor position */
-    int start_line = editor->cursor_y;
-    int start_col = editor->cursor_x - 1;
-
-    for (int i = 0; i < (int)editor->num_lines; i++) {
-        int line_idx = (start_line - i + (int)editor->num_lines) % (int)editor->num_lines;
-        line_t *line = editor->lines[line_idx];
+    editor->search_highlight = true;
+    editor->view_stale = true;
+    if (!editor_search(editor, editor->search_query, backward ? cursor : cursor + 1,
+                       backward, &found)) {
+        editor_set_status(editor, "Not found");
+        return false;
+    }
 
-        int search_end = (i == 0) ? start_col : (int)line->length - (int)query_len;
+    editor_move_to_offset(editor, found);
+    editor->search_match_line = editor->cursor_y;
+    editor->search_match_col = editor->cursor_x;
+    editor_set_status(editor, "Found");
+    return true;
+}
 
-        /* Search in this line (backwards) */
-        for (int j = search_end; j >= 0; j--) {
-            bool match = true;
-            for (size_t k = 0; k < query_len; k++) {
-                if (line->data[j + k] != editor->search_query[k]) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) {
-                editor->cursor_y = line_idx;
-                editor->cursor_x = j;
-                editor->search_match_line = line_idx;
-                editor->search_match_col = j;
-                editor_scroll_to_cursor(editor);
-                editor_set_status(editor, "Found");
-                return true;
-            }
-        }
-    }
+/**
+ * Find next occurrence of search query
+ */
+bool editor_find_next(editor_t *editor) {
+    return editor_find(editor, false);
+}
 
-    editor_set_status(editor, "Not found");
-    return false;
+/**
+ * Find previous occurrence of search query
+ */
+bool editor_find_prev(editor_t *editor) {
+    return editor_find(editor, true);
 }
 
 /*============================================================================
@@ -1352,27 +1486,34 @@ void editor_handle_key(editor_t *editor, int key, uint16_t modifiers, char ascii
             return;
 
         case EDITOR_STATE_SEARCH:
-            /* Search mode */
+            /* Search mode: the cursor is already on the match */
             if (key == KEY_ENTER) {
                 strncpy(editor->search_query, editor->input_buffer, sizeof(editor->search_query) - 1);
                 editor->search_query[sizeof(editor->search_query) - 1] = '\0';
                 editor->state = EDITOR_STATE_NORMAL;
-                editor_find_next(editor);
+                if (editor->input_length == 0) {
+                    editor_set_status(editor, NULL);
+                } else if (editor->search_hits[editor->input_length - 1] == SIZE_MAX) {
+                    editor_set_status(editor, "Not found");
+                } else {
+                    editor->search_match_line = editor->cursor_y;
+                    editor->search_match_col = editor->cursor_x;
+                    editor_set_status(editor, "Found");
+                }
             } else if (key == KEY_ESCAPE) {
                 editor->state = EDITOR_STATE_NORMAL;
+                editor->search_highlight = false;
+                editor_move_to_offset(editor, editor->search_origin);
+                editor->view_stale = true;
                 editor_set_status(editor, NULL);
             } else if (key == KEY_BACKSPACE && editor->input_length > 0) {
                 editor->input_length--;
                 editor->input_buffer[editor->input_length] = '\0';
-                char msg[64] = "Search: ";
-                strcat(msg, editor->input_buffer);
-                editor_set_status(editor, msg);
+                editor_search_update(editor, false);
             } else if (ascii >= 32 && ascii < 127 && editor->input_length < sizeof(editor->input_buffer) - 1) {
                 editor->input_buffer[editor->input_length++] = ascii;
                 editor->input_buffer[editor->input_length] = '\0';
-                char msg[64] = "Search: ";
-                strcat(msg, editor->input_buffer);
-                editor_set_status(editor, msg);
+                editor_search_update(editor, true);
             }
             return;
 
@@ -1464,6 +1605,16 @@ void editor_handle_key(editor_t *editor, int key, uint16_t modifiers, char ascii
                 }
                 return;
 
+            case KEY_Z:
+                /* Ctrl+Z: Undo */
+                editor_undo(editor);
+                return;
+
+            case KEY_Y:
+                /* Ctrl+Y: Redo */
+                editor_redo(editor);
+                return;
+
             case KEY_HOME:
                 /* Ctrl+Home: Go to start */
                 editor_goto_start(editor);
@@ -1581,6 +1732,7 @@ void editor_run(editor_t *editor) {
     /* Clear screen and set up display */
     vga_clear();
     vga_enable_cursor(true);
+    editor->view_stale = true;
 
     /* Initial status message */
     editor_set_status(editor, "^S:Save ^Q:Quit ^G:Goto ^F:Find");
@@ -1592,6 +1744,9 @@ void editor_run(editor_t *editor) {
 
         /* Process input */
         editor_process_input(editor);
+
+        /* Carry on indexing a file opened without reading it in */
+        editor_index_step(editor);
     }
 
     /* Clean up display */
@@ -3,19 +3,27 @@
  *
  * A basic text editor for AAAos that supports opening, editing, and saving
  * text files. Works in both VGA text mode and graphical framebuffer mode.
+ *
+ * The document is held in a piece table (see piece_table.h), so opening a
+ * large file does not split it into lines and an edit costs O(log n)
+ * however long the file is. Lines are copied out only to be looked at.
+ * An opened file is read through rather than read in: the first screen is
+ * shown as soon as it is indexed and the rest is indexed between keys.
  */
 
 #ifndef _AAAOS_APP_TEXT_EDITOR_H
 #define _AAAOS_APP_TEXT_EDITOR_H
 
 #include "../../kernel/include/types.h"
+#include "piece_table.h"
 
 /* Editor configuration */
 #define EDITOR_MAX_FILENAME     256         /* Maximum filename length */
-#define EDITOR_MAX_LINES        65536       /* Maximum number of lines */
 #define EDITOR_MAX_LINE_LENGTH  4096        /* Maximum characters per line */
 #define EDITOR_TAB_WIDTH        4           /* Tab display width */
-#define EDITOR_INITIAL_CAPACITY 1024        /* Initial line capacity */
+#define EDITOR_SEARCH_CHUNK     4096        /* Document bytes searched per read */
+#define EDITOR_SEARCH_BMH_MIN   4           /* Shortest query searched with BMH skips */
+#define EDITOR_INITIAL_CAPACITY 1024        /* Initial capacity of the line copy */
 
 /* Editor status bar height (in lines/rows) */
 #define EDITOR_STATUS_HEIGHT    1
@@ -36,12 +44,13 @@ typedef enum {
 } editor_state_t;
 
 /**
- * Single line of text in the editor buffer
+ * Copy of one line of the document
  */
 typedef struct line {
     char    *data;              /* Line text data (null-terminated) */
     size_t  length;             /* Current length (excluding null) */
     size_t  capacity;           /* Allocated capacity */
+    bool    crlf;               /* Line ends in CR LF (the CR is not in data) */
 } line_t;
 
 /**
@@ -56,9 +65,12 @@ typedef struct editor {
     bool        readonly;                       /* true if file is read-only */
 
     /* Text buffer */
-    line_t      **lines;                        /* Array of line pointers */
+    piece_table_t text;                         /* The document */
+    struct vfs_file *file;                      /* File the document reads through */
     size_t      num_lines;                      /* Number of lines in buffer */
-    size_t      lines_capacity;                 /* Allocated capacity for lines array */
+    line_t      line;                           /* Copy of the line last looked at */
+    size_t      line_index;                     /* Which line that is */
+    bool        line_valid;                     /* line matches the document */
 
     /* Cursor position */
     int         cursor_x;                       /* Cursor column (0-based) */
@@ -73,6 +85,11 @@ typedef struct editor {
     int         screen_height;                  /* Screen height in characters */
     int         text_area_height;               /* Height available for text (minus status) */
 
+    /* What the text area shows, so a draw can skip or move rows */
+    int         drawn_scroll_x;                 /* scroll_x at the last draw */
+    int         drawn_scroll_y;                 /* scroll_y at the last draw */
+    bool        view_stale;                     /* Text changed since the last draw */
+
     /* Display mode */
     editor_mode_t display_mode;                 /* VGA or framebuffer mode */
 
@@ -89,11 +106,15 @@ typedef struct editor {
     char        search_query[256];              /* Last search query */
     int         search_match_line;              /* Line of last match */
     int         search_match_col;               /* Column of last match */
+    size_t      search_origin;                  /* Cursor offset when search started */
+    size_t      search_hits[256];               /* Match of each prefix of the input */
+    bool        search_highlight;               /* Show matches in the text area */
 
     /* Display colors (for VGA mode) */
     uint8_t     text_color;                     /* Normal text color */
     uint8_t     status_color;                   /* Status bar color */
     uint8_t     line_num_color;                 /* Line number color */
+    uint8_t     search_color;                   /* Search match color */
 
     /* Display colors (for framebuffer mode) */
     uint32_t    fb_text_fg;                     /* Text foreground color */
@@ -135,6 +156,8 @@ void editor_run(editor_t *editor);
 
 /**
  * Open a file for editing
+ * The file stays open and is read as its text is needed, so it must not
+ * be changed by anything else while it is being edited.
  * @param editor Editor instance
  * @param filename Path to file to open
  * @return 0 on success, negative error code on failure
@@ -203,6 +226,18 @@ void editor_insert_tab(editor_t *editor);
  */
 void editor_delete_line(editor_t *editor);
 
+/**
+ * Undo the last edit
+ * @param editor Editor instance
+ */
+void editor_undo(editor_t *editor);
+
+/**
+ * Redo the last undone edit
+ * @param editor Editor instance
+ */
+void editor_redo(editor_t *editor);
+
 /*============================================================================
  * Cursor Movement Functions
  *============================================================================*/
@@ -263,7 +298,9 @@ void editor_goto_end(editor_t *editor);
  *============================================================================*/
 
 /**
- * Redraw the entire editor display
+ * Redraw the editor display
+ * Rows still on screen are moved rather than drawn again when the view
+ * only scrolled vertically since the last draw.
  * @param editor Editor instance
  */
 void editor_draw(editor_t *editor);
@@ -318,6 +355,8 @@ void editor_process_input(editor_t *editor);
 
 /**
  * Start search mode
+ * The cursor follows the first match as the query is typed; Escape
+ * returns it to where the search started.
  * @param editor Editor instance
  */
 void editor_start_search(editor_t *editor);
@@ -337,62 +376,18 @@ bool editor_find_next(editor_t *editor);
 bool editor_find_prev(editor_t *editor);
 
 /*============================================================================
- * Line Buffer Functions (Internal)
+ * Document Access Functions
  *============================================================================*/
 
 /**
- * Create a new line with given initial content
- * @param content Initial content (can be NULL for empty line)
- * @param length Length of content
- * @return Pointer to new line, or NULL on failure
- */
-line_t* line_create(const char *content, size_t length);
-
-/**
- * Destroy a line and free its memory
- * @param line Line to destroy
- */
-void line_destroy(line_t *line);
-
-/**
- * Ensure line has enough capacity
- * @param line Line to grow
- * @param needed_capacity Minimum capacity needed
- * @return true on success, false on failure
- */
-bool line_ensure_capacity(line_t *line, size_t needed_capacity);
-
-/**
- * Insert character into line at position
- * @param line Line to modify
- * @param pos Position to insert at
- * @param c Character to insert
- * @return true on success, false on failure
- */
-bool line_insert_char(line_t *line, size_t pos, char c);
-
-/**
- * Delete character from line at position
- * @param line Line to modify
- * @param pos Position to delete at
- */
-void line_delete_char(line_t *line, size_t pos);
-
-/**
- * Insert a new line into the editor at given position
- * @param editor Editor instance
- * @param pos Position to insert at (0 = before first line)
- * @param line Line to insert
- * @return true on success, false on failure
- */
-bool editor_insert_line(editor_t *editor, size_t pos, line_t *line);
-
-/**
- * Remove a line from the editor at given position
+ * Get a copy of one line of the document
+ * The copy stays valid until another line is fetched or the document is
+ * edited.
  * @param editor Editor instance
- * @param pos Position of line to remove
+ * @param idx Line number (0-based)
+ * @return The line, or NULL if there is no such line
  */
-void editor_remove_line(editor_t *editor, size_t pos);
+line_t* editor_get_line(editor_t *editor, size_t idx);
 
 /*============================================================================
  * Utility Functions
@@ -0,0 +1,910 @@
+/**
+ * AAAos Text Editor - Piece Table Implementation
+ */
+
+#include "piece_table.h"
+#include "../../kernel/mm/heap.h"
+#include "../../lib/libc/string.h"
+
+/**
+ * Span of one of the buffers, as a treap node
+ */
+struct piece {
+    piece_t     *left;
+    piece_t     *right;
+    uint32_t    priority;               /* Treap heap key */
+    bool        added;                  /* Text is in the added buffer */
+    size_t      start;                  /* Offset in its buffer */
+    size_t      length;
+    size_t      newlines;               /* Newlines in this piece */
+    size_t      total_length;           /* Length of the subtree */
+    size_t      total_newlines;         /* Newlines in the subtree */
+};
+
+/*============================================================================
+ * Buffers
+ *============================================================================*/
+
+/**
+ * Number of a buffer's newlines before an offset
+ */
+static size_t buffer_newlines_before(const piece_buffer_t *buf, size_t offset) {
+    size_t lo = 0, hi = buf->newline_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (buf->newlines[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Record the newlines of a buffer's text from an offset on
+ */
+static bool buffer_index_newlines(piece_buffer_t *buf, size_t from) {
+    const char *end = buf->data + buf->length;
+    for (const char *p = buf->data + from; p < end; p++) {
+        p = memchr(p, '\n', (size_t)(end - p));
+        if (!p) {
+            break;
+        }
+
+        if (buf->newline_count == buf->newline_capacity) {
+            size_t capacity = buf->newline_capacity ? buf->newline_capacity * 2 : 256;
+            size_t *newlines = (size_t*)krealloc(buf->newlines, capacity * sizeof(size_t));
+            if (!newlines) {
+                return false;
+            }
+            buf->newlines = newlines;
+            buf->newline_capacity = capacity;
+        }
+        buf->newlines[buf->newline_count++] = (size_t)(p - buf->data);
+    }
+    return true;
+}
+
+/**
+ * Append text to a buffer
+ */
+static bool buffer_append(piece_buffer_t *buf, const char *text, size_t length) {
+    if (buf->length + length > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while (capacity < buf->length + length) {
+            capacity *= 2;
+        }
+
+        char *data = (char*)krealloc(buf->data, capacity);
+        if (!data) {
+            return false;
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+
+    size_t from = buf->length;
+    memcpy(buf->data + from, text, length);
+    buf->length += length;
+
+    if (!buffer_index_newlines(buf, from)) {
+        /* Forget the text rather than leave its newlines half indexed */
+        while (buf->newline_count > 0 && buf->newlines[buf->newline_count - 1] >= from) {
+            buf->newline_count--;
+        }
+        buf->length = from;
+        return false;
+    }
+    return true;
+}
+
+static void buffer_free(piece_buffer_t *buf) {
+    if (buf->data) {
+        kfree(buf->data);
+    }
+    if (buf->newlines) {
+        kfree(buf->newlines);
+    }
+}
+
+/*============================================================================
+ * File Windows
+ *============================================================================*/
+
+/**
+ * Find original text read through from the source
+ * @param avail Set to the bytes available from the returned pointer
+ * @return The text at offset, or NULL if it could not be read
+ */
+static const char *piece_window(piece_table_t *pt, size_t offset, size_t *avail) {
+    size_t base = offset - offset % PIECE_TABLE_WINDOW_SIZE;
+    piece_window_t *victim = &pt->windows[0];
+
+    for (int i = 0; i < PIECE_TABLE_WINDOWS; i++) {
+        piece_window_t *w = &pt->windows[i];
+        if (w->length && w->offset == base) {
+            w->stamp = ++pt->window_clock;
+            *avail = w->length - (offset - base);
+            return w->data + (offset - base);
+        }
+        if (w->stamp < victim->stamp) {
+            victim = w;
+        }
+    }
+
+    /* Read the window in place of the least recently used one */
+    if (!victim->data) {
+        victim->data = (char*)kmalloc(PIECE_TABLE_WINDOW_SIZE);
+        if (!victim->data) {
+            return NULL;
+        }
+    }
+
+    size_t want = MIN((size_t)PIECE_TABLE_WINDOW_SIZE, pt->original.length - base);
+    size_t got = 0;
+    victim->length = 0;
+    victim->stamp = 0;
+    while (got < want) {
+        ssize_t n = pt->source(pt->source_ctx, base + got, victim->data + got, want - got);
+        if (n <= 0) {
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+
+    victim->offset = base;
+    victim->length = want;
+    victim->stamp = ++pt->window_clock;
+    *avail = want - (offset - base);
+    return victim->data + (offset - base);
+}
+
+/**
+ * Copy text out of one of the buffers
+ */
+static bool buffer_copy(piece_table_t *pt, bool added, size_t start, char *dst, size_t length) {
+    if (added || pt->original.data) {
+        memcpy(dst, (added ? pt->added.data : pt->original.data) + start, length);
+        return true;
+    }
+
+    while (length > 0) {
+        size_t avail;
+        const char *data = piece_window(pt, start, &avail);
+        if (!data) {
+            return false;
+        }
+
+        size_t n = MIN(avail, length);
+        memcpy(dst, data, n);
+        dst += n;
+        start += n;
+        length -= n;
+    }
+    return true;
+}
+
+/*============================================================================
+ * Treap of Pieces
+ *============================================================================*/
+
+static const piece_buffer_t *piece_buffer(const piece_table_t *pt, const piece_t *p) {
+    return p->added ? &pt->added : &pt->original;
+}
+
+static size_t piece_count_newlines(const piece_table_t *pt, const piece_t *p) {
+    const piece_buffer_t *buf = piece_buffer(pt, p);
+    return buffer_newlines_before(buf, p->start + p->length) -
+           buffer_newlines_before(buf, p->start);
+}
+
+/**
+ * Recompute a node's subtree totals from its children
+ */
+static void piece_update(piece_t *p) {
+    p->total_length = p->length;
+    p->total_newlines = p->newlines;
+    if (p->left) {
+        p->total_length += p->left->total_length;
+        p->total_newlines += p->left->total_newlines;
+    }
+    if (p->right) {
+        p->total_length += p->right->total_length;
+        p->total_newlines += p->right->total_newlines;
+    }
+}
+
+static piece_t *piece_create(piece_table_t *pt, bool added, size_t start, size_t length) {
+    piece_t *p = (piece_t*)kmalloc(sizeof(piece_t));
+    if (!p) {
+        return NULL;
+    }
+
+    /* xorshift32 */
+    pt->seed ^= pt->seed << 13;
+    pt->seed ^= pt->seed >> 17;
+    pt->seed ^= pt->seed << 5;
+
+    p->left = NULL;
+    p->right = NULL;
+    p->priority = pt->seed;
+    p->added = added;
+    p->start = start;
+    p->length = length;
+    p->newlines = piece_count_newlines(pt, p);
+    piece_update(p);
+    return p;
+}
+
+static size_t piece_tree_length(const piece_table_t *pt) {
+    return pt->root ? pt->root->total_length : 0;
+}
+
+static void piece_free_tree(piece_t *p) {
+    while (p) {
+        piece_t *right = p->right;
+        piece_free_tree(p->left);
+        kfree(p);
+        p = right;
+    }
+}
+
+/**
+ * Split a subtree into the text before an offset and the text after it
+ * A piece straddling the offset is cut in two. On failure (out of memory)
+ * the subtree is left as it was.
+ */
+static bool piece_split(piece_table_t *pt, piece_t *p, size_t offset,
+                        piece_t **before, piece_t **after) {
+    piece_t *a, *b;
+
+    if (!p) {
+        *before = NULL;
+        *after = NULL;
+        return true;
+    }
+
+    size_t left_length = p->left ? p->left->total_length : 0;
+
+    if (offset <= left_length) {
+        if (!piece_split(pt, p->left, offset, &a, &b)) {
+            return false;
+        }
+        p->left = b;
+        piece_update(p);
+        *before = a;
+        *after = p;
+    } else if (offset >= left_length + p->length) {
+        if (!piece_split(pt, p->right, offset - left_length - p->length, &a, &b)) {
+            return false;
+        }
+        p->right = a;
+        piece_update(p);
+        *before = p;
+        *after = b;
+    } else {
+        size_t cut = offset - left_length;
+        piece_t *tail = piece_create(pt, p->added, p->start + cut, p->length - cut);
+        if (!tail) {
+            return false;
+        }
+
+        /* The tail takes over the right subtree, so it needs p's priority */
+        tail->priority = p->priority;
+        tail->right = p->right;
+        piece_update(tail);
+
+        p->right = NULL;
+        p->length = cut;
+        p->newlines -= tail->newlines;
+        piece_update(p);
+        *before = p;
+        *after = tail;
+    }
+    return true;
+}
+
+/**
+ * Join two subtrees, all of a's text before all of b's
+ */
+static piece_t *piece_merge(piece_t *a, piece_t *b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+
+    if (a->priority > b->priority) {
+        a->right = piece_merge(a->right, b);
+        piece_update(a);
+        return a;
+    }
+    b->left = piece_merge(a, b->left);
+    piece_update(b);
+    return b;
+}
+
+/**
+ * Grow the last piece of a subtree over the text right after it
+ * Typing goes on extending one piece rather than adding one per key, and
+ * indexing one piece rather than adding one per step.
+ */
+static bool piece_extend_last(piece_table_t *pt, piece_t *p, bool added, size_t start,
+                              size_t length) {
+    if (!p) {
+        return false;
+    }
+
+    if (p->right) {
+        if (!piece_extend_last(pt, p->right, added, start, length)) {
+            return false;
+        }
+    } else {
+        if (p->added != added || p->start + p->length != start) {
+            return false;
+        }
+        p->length += length;
+        p->newlines = piece_count_newlines(pt, p);
+    }
+    piece_update(p);
+    return true;
+}
+
+/**
+ * Take a range out of the document as a subtree of its own
+ */
+static bool piece_cut(piece_table_t *pt, size_t offset, size_t length, piece_t **pieces) {
+    piece_t *before, *rest, *after;
+
+    if (!piece_split(pt, pt->root, offset, &before, &rest)) {
+        return false;
+    }
+    if (!piece_split(pt, rest, length, pieces, &after)) {
+        pt->root = piece_merge(before, rest);
+        return false;
+    }
+    pt->root = piece_merge(before, after);
+    return true;
+}
+
+/**
+ * Put a subtree back into the document at an offset
+ */
+static bool piece_paste(piece_table_t *pt, size_t offset, piece_t *pieces) {
+    piece_t *before, *after;
+
+    if (!piece_split(pt, pt->root, offset, &before, &after)) {
+        return false;
+    }
+    pt->root = piece_merge(piece_merge(before, pieces), after);
+    return true;
+}
+
+/*============================================================================
+ * Undo Ring
+ *============================================================================*/
+
+static piece_edit_t *piece_table_edit(piece_table_t *pt, size_t index) {
+    return &pt->edits[(pt->edit_first + index) % PIECE_TABLE_UNDO_MAX];
+}
+
+/**
+ * Note an edit for undo, merging it into the previous one where it
+ * continues it
+ */
+static void piece_table_record(piece_table_t *pt, bool insert, size_t offset, size_t length,
+                               piece_t *pieces) {
+    piece_edit_t *e;
+
+    /* A new edit ends what could be redone */
+    while (pt->edit_count > pt->edit_done) {
+        pt->edit_count--;
+        piece_free_tree(piece_table_edit(pt, pt->edit_count)->pieces);
+    }
+
+    if (pt->edit_done > 0 && !pt->edit_sealed) {
+        e = piece_table_edit(pt, pt->edit_done - 1);
+        char last = 0;
+
+        if (insert && e->insert && e->offset + e->length == offset &&
+            piece_table_read(pt, offset - 1, &last, 1) == 1 && last != ' ' && last != '\n') {
+            e->length += length;
+            return;
+        }
+        if (!insert && !e->insert && offset + length == e->offset) {
+            e->pieces = piece_merge(pieces, e->pieces);
+            e->offset = offset;
+            e->length += length;
+            return;
+        }
+        if (!insert && !e->insert && offset == e->offset) {
+            e->pieces = piece_merge(e->pieces, pieces);
+            e->length += length;
+            return;
+        }
+    }
+    pt->edit_sealed = false;
+
+    /* Forget the oldest edit when the ring is full */
+    if (pt->edit_count == PIECE_TABLE_UNDO_MAX) {
+        piece_free_tree(pt->edits[pt->edit_first].pieces);
+        pt->edit_first = (pt->edit_first + 1) % PIECE_TABLE_UNDO_MAX;
+        pt->edit_count--;
+        pt->edit_done--;
+    }
+
+    e = piece_table_edit(pt, pt->edit_done);
+    e->insert = insert;
+    e->offset = offset;
+    e->length = length;
+    e->pieces = pieces;
+    pt->edit_done++;
+    pt->edit_count = pt->edit_done;
+}
+
+/*============================================================================
+ * Piece Table Interface
+ *============================================================================*/
+
+/**
+ * Set up a piece table holding some text
+ */
+bool piece_table_init(piece_table_t *pt, char *text, size_t length) {
+    memset(pt, 0, sizeof(piece_table_t));
+    pt->seed = 0x2545F491;
+
+    pt->original.data = text;
+    pt->original.length = text ? length : 0;
+    pt->original.capacity = pt->original.length;
+
+    if (!buffer_index_newlines(&pt->original, 0)) {
+        buffer_free(&pt->original);
+        memset(&pt->original, 0, sizeof(piece_buffer_t));
+        return false;
+    }
+
+    if (pt->original.length > 0) {
+        pt->root = piece_create(pt, false, 0, pt->original.length);
+        if (!pt->root) {
+            buffer_free(&pt->original);
+            memset(&pt->original, 0, sizeof(piece_buffer_t));
+            return false;
+        }
+    }
+    pt->indexed = pt->original.length;
+    return true;
+}
+
+/**
+ * Set up a piece table over text read on demand
+ */
+void piece_table_init_source(piece_table_t *pt, piece_source_fn source, void *ctx,
+                             size_t length) {
+    memset(pt, 0, sizeof(piece_table_t));
+    pt->seed = 0x2545F491;
+    pt->original.length = length;
+    pt->source = source;
+    pt->source_ctx = ctx;
+}
+
+/**
+ * Check if part of the original text still has to be indexed
+ */
+bool piece_table_indexing(const piece_table_t *pt) {
+    return pt->source && !pt->source_failed && pt->indexed < pt->original.length;
+}
+
+/**
+ * Index the next part of the original text
+ */
+bool piece_table_index_step(piece_table_t *pt, size_t bytes) {
+    piece_buffer_t *buf = &pt->original;
+    size_t from = pt->indexed;
+    size_t newlines = buf->newline_count;
+    size_t pos = from, end = from;
+
+    if (!piece_table_indexing(pt)) {
+        return false;
+    }
+
+    /* Note newlines up to the first one past the step's size */
+    while (pos < buf->length) {
+        size_t avail;
+        const char *data = piece_window(pt, pos, &avail);
+        if (!data) {
+            pt->source_failed = true;
+            break;
+        }
+
+        const char *newline = memchr(data, '\n', avail);
+        size_t i = newline ? (size_t)(newline - data) : avail;
+        if (i == avail) {
+            pos += avail;
+            if (pos == buf->length) {
+                end = pos;
+            }
+            continue;
+        }
+
+        pos += i;
+        if (buf->newline_count == buf->newline_capacity) {
+            size_t capacity = buf->newline_capacity ? buf->newline_capacity * 2 : 256;
+            size_t *grown = (size_t*)krealloc(buf->newlines, capacity * sizeof(size_t));
+            if (!grown) {
+                break;
+            }
+            buf->newlines = grown;
+            buf->newline_capacity = capacity;
+        }
+        buf->newlines[buf->newline_count++] = pos;
+        end = ++pos;
+
+        if (end - from >= bytes) {
+            break;
+        }
+    }
+
+    /* Move that much of the tail into the treap, after whatever it ends with */
+    if (end > from && !piece_extend_last(pt, pt->root, false, from, end - from)) {
+        piece_t *p = piece_create(pt, false, from, end - from);
+        if (!p) {
+            buf->newline_count = newlines;
+            return false;
+        }
+        pt->root = piece_merge(pt->root, p);
+    }
+    pt->indexed = end;
+    return piece_table_indexing(pt);
+}
+
+/**
+ * Index until a line is known, or the whole text is
+ */
+static void piece_table_index_lines(piece_table_t *pt, size_t line) {
+    while (piece_table_line_count(pt) <= line) {
+        if (!piece_table_index_step(pt, PIECE_TABLE_INDEX_STEP)) {
+            break;
+        }
+    }
+}
+
+/**
+ * Index until an offset is in the treap, or the whole text is
+ */
+static void piece_table_index_to(piece_table_t *pt, size_t offset) {
+    while (piece_tree_length(pt) < offset) {
+        if (!piece_table_index_step(pt, PIECE_TABLE_INDEX_STEP)) {
+            break;
+        }
+    }
+}
+
+/**
+ * Read all of the original text into memory, ending the use of its source
+ */
+bool piece_table_load(piece_table_t *pt) {
+    if (!pt->source) {
+        return true;
+    }
+
+    piece_table_index_to(pt, piece_table_length(pt));
+    if (pt->source_failed || pt->indexed < pt->original.length) {
+        return false;
+    }
+
+    char *data = (char*)kmalloc(pt->original.length ? pt->original.length : 1);
+    if (!data) {
+        return false;
+    }
+
+    size_t got = 0;
+    while (got < pt->original.length) {
+        ssize_t n = pt->source(pt->source_ctx, got, data + got, pt->original.length - got);
+        if (n <= 0) {
+            kfree(data);
+            return false;
+        }
+        got += (size_t)n;
+    }
+
+    pt->original.data = data;
+    pt->original.capacity = pt->original.length;
+    pt->source = NULL;
+    pt->source_ctx = NULL;
+    for (int i = 0; i < PIECE_TABLE_WINDOWS; i++) {
+        if (pt->windows[i].data) {
+            kfree(pt->windows[i].data);
+        }
+    }
+    memset(pt->windows, 0, sizeof(pt->windows));
+    return true;
+}
+
+/**
+ * Free everything a piece table holds
+ */
+void piece_table_destroy(piece_table_t *pt) {
+    piece_free_tree(pt->root);
+    for (size_t i = 0; i < pt->edit_count; i++) {
+        piece_free_tree(piece_table_edit(pt, i)->pieces);
+    }
+    for (int i = 0; i < PIECE_TABLE_WINDOWS; i++) {
+        if (pt->windows[i].data) {
+            kfree(pt->windows[i].data);
+        }
+    }
+    buffer_free(&pt->original);
+    buffer_free(&pt->added);
+    memset(pt, 0, sizeof(piece_table_t));
+}
+
+size_t piece_table_length(const piece_table_t *pt) {
+    return piece_tree_length(pt) + (pt->original.length - pt->indexed);
+}
+
+size_t piece_table_line_count(const piece_table_t *pt) {
+    return (pt->root ? pt->root->total_newlines : 0) + 1;
+}
+
+/**
+ * Offset of the first character of a line
+ */
+size_t piece_table_line_start(piece_table_t *pt, size_t line) {
+    const piece_t *p;
+    size_t base = 0;
+
+    if (line == 0) {
+        return 0;
+    }
+
+    piece_table_index_lines(pt, line);
+    p = pt->root;
+
+    /* The line starts after the document's line-th newline */
+    while (p) {
+        size_t left_newlines = p->left ? p->left->total_newlines : 0;
+        if (line <= left_newlines) {
+            p = p->left;
+            continue;
+        }
+
+        line -= left_newlines;
+        base += p->left ? p->left->total_length : 0;
+        if (line <= p->newlines) {
+            const piece_buffer_t *buf = piece_buffer(pt, p);
+            size_t index = buffer_newlines_before(buf, p->start) + line - 1;
+            return base + buf->newlines[index] - p->start + 1;
+        }
+
+        line -= p->newlines;
+        base += p->length;
+        p = p->right;
+    }
+    return piece_table_length(pt);
+}
+
+/**
+ * Length of a line, not counting its newline
+ */
+size_t piece_table_line_length(piece_table_t *pt, size_t line) {
+    size_t start = piece_table_line_start(pt, line);
+
+    piece_table_index_lines(pt, line + 1);
+    if (line + 1 < piece_table_line_count(pt)) {
+        return piece_table_line_start(pt, line + 1) - 1 - start;
+    }
+    return piece_table_length(pt) - start;
+}
+
+/**
+ * Line holding an offset
+ */
+size_t piece_table_line_at(piece_table_t *pt, size_t offset) {
+    const piece_t *p;
+    size_t line = 0;
+
+    piece_table_index_to(pt, offset);
+    p = pt->root;
+
+    /* Count the newlines before the offset */
+    while (p) {
+        size_t left_length = p->left ? p->left->total_length : 0;
+        if (offset <= left_length) {
+            p = p->left;
+            continue;
+        }
+
+        offset -= left_length;
+        line += p->left ? p->left->total_newlines : 0;
+        if (offset <= p->length) {
+            const piece_buffer_t *buf = piece_buffer(pt, p);
+            return line + buffer_newlines_before(buf, p->start + offset) -
+                   buffer_newlines_before(buf, p->start);
+        }
+
+        offset -= p->length;
+        line += p->newlines;
+        p = p->right;
+    }
+    return line;
+}
+
+static size_t piece_read(piece_table_t *pt, const piece_t *p, size_t offset,
+                         char *buf, size_t length, bool *ok) {
+    size_t copied = 0;
+
+    if (!p || length == 0) {
+        return 0;
+    }
+
+    size_t left_length = p->left ? p->left->total_length : 0;
+    if (offset < left_length) {
+        copied = piece_read(pt, p->left, offset, buf, length, ok);
+        if (!*ok) {
+            return copied;
+        }
+        offset = left_length;
+    }
+    offset -= left_length;
+
+    if (offset < p->length && copied < length) {
+        size_t n = MIN(p->length - offset, length - copied);
+        if (!buffer_copy(pt, p->added, p->start + offset, buf + copied, n)) {
+            *ok = false;
+            return copied;
+        }
+        copied += n;
+        offset = p->length;
+    }
+
+    if (copied < length && offset >= p->length) {
+        copied += piece_read(pt, p->right, offset - p->length, buf + copied,
+                             length - copied, ok);
+    }
+    return copied;
+}
+
+/**
+ * Copy text out of the document
+ */
+size_t piece_table_read(piece_table_t *pt, size_t offset, char *buf, size_t length) {
+    bool ok = true;
+    size_t tree_length = piece_tree_length(pt);
+    size_t copied = piece_read(pt, pt->root, offset, buf, length, &ok);
+
+    /* Then from the unindexed tail */
+    if (ok && copied < length && offset + copied >= tree_length) {
+        size_t start = pt->indexed + (offset + copied - tree_length);
+        if (start < pt->original.length) {
+            size_t n = MIN(length - copied, pt->original.length - start);
+            if (buffer_copy(pt, false, start, buf + copied, n)) {
+                copied += n;
+            }
+        }
+    }
+    return copied;
+}
+
+/**
+ * Insert text
+ */
+bool piece_table_insert(piece_table_t *pt, size_t offset, const char *text, size_t length) {
+    piece_t *before, *after;
+
+    if (offset > piece_table_length(pt)) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+
+    piece_table_index_to(pt, offset);
+    if (offset > piece_tree_length(pt)) {
+        return false;
+    }
+
+    size_t start = pt->added.length;
+    if (!buffer_append(&pt->added, text, length)) {
+        return false;
+    }
+    if (!piece_split(pt, pt->root, offset, &before, &after)) {
+        return false;
+    }
+
+    if (!piece_extend_last(pt, before, true, start, length)) {
+        piece_t *p = piece_create(pt, true, start, length);
+        if (!p) {
+            pt->root = piece_merge(before, after);
+            return false;
+        }
+        before = piece_merge(before, p);
+    }
+    pt->root = piece_merge(before, after);
+
+    piece_table_record(pt, true, offset, length, NULL);
+    return true;
+}
+
+/**
+ * Delete text
+ */
+bool piece_table_delete(piece_table_t *pt, size_t offset, size_t length) {
+    piece_t *pieces;
+
+    if (offset > piece_table_length(pt) || length > piece_table_length(pt) - offset) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+
+    piece_table_index_to(pt, offset + length);
+    if (offset + length > piece_tree_length(pt)) {
+        return false;
+    }
+
+    if (!piece_cut(pt, offset, length, &pieces)) {
+        return false;
+    }
+    piece_table_record(pt, false, offset, length, pieces);
+    return true;
+}
+
+/**
+ * Undo the last edit
+ */
+bool piece_table_undo(piece_table_t *pt, size_t *offset) {
+    if (pt->edit_done == 0) {
+        return false;
+    }
+
+    piece_edit_t *e = piece_table_edit(pt, pt->edit_done - 1);
+    if (e->insert) {
+        if (!piece_cut(pt, e->offset, e->length, &e->pieces)) {
+            return false;
+        }
+    } else {
+        if (!piece_paste(pt, e->offset, e->pieces)) {
+            return false;
+        }
+        e->pieces = NULL;
+    }
+
+    pt->edit_done--;
+    pt->edit_sealed = true;
+    if (offset) {
+        *offset = e->offset;
+    }
+    return true;
+}
+
+/**
+ * Redo the last undone edit
+ */
+bool piece_table_redo(piece_table_t *pt, size_t *offset) {
+    if (pt->edit_done == pt->edit_count) {
+        return false;
+    }
+
+    piece_edit_t *e = piece_table_edit(pt, pt->edit_done);
+    if (e->insert) {
+        if (!piece_paste(pt, e->offset, e->pieces)) {
+            return false;
+        }
+        e->pieces = NULL;
+    } else {
+        if (!piece_cut(pt, e->offset, e->length, &e->pieces)) {
+            return false;
+        }
+    }
+
+    pt->edit_done++;
+    pt->edit_sealed = true;
+    if (offset) {
+        *offset = e->offset + (e->insert ? e->length : 0);
+    }
+    return true;
+}
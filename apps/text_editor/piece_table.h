@@ -0,0 +1,212 @@
+/**
+ * AAAos Text Editor - Piece Table
+ *
+ * The document is never edited in place. The text it was opened with stays
+ * in the original buffer and everything typed is appended to the added
+ * buffer; the document is the sequence of pieces (spans of either buffer)
+ * held in a treap ordered by position. Every node keeps the length and
+ * newline count of its subtree, so finding an offset or the start of a
+ * line, inserting and deleting are O(log n) in the number of pieces.
+ * Each buffer keeps the offsets of its newlines, which turns counting the
+ * newlines of a piece into two binary searches.
+ *
+ * Since a piece's text never changes, undo is just moving pieces: a
+ * delete keeps the subtree it cut out and undoing it puts that subtree
+ * back; undoing an insert cuts its pieces out again for redo.
+ *
+ * A file can also be opened without reading it in: the original buffer
+ * is then read through a small cache of file windows, and the treap only
+ * covers the part of the file already indexed, an unindexed tail of the
+ * original text following it. Indexing moves the tail into the treap a
+ * step at a time, always ending just after a newline, both from an idle
+ * loop and on demand when a line or offset past it is asked for.
+ */
+
+#ifndef _AAAOS_APP_PIECE_TABLE_H
+#define _AAAOS_APP_PIECE_TABLE_H
+
+#include "../../kernel/include/types.h"
+
+#define PIECE_TABLE_UNDO_MAX    256             /* Edits kept for undo */
+#define PIECE_TABLE_WINDOW_SIZE (16 * 1024)     /* Bytes per cached file window */
+#define PIECE_TABLE_WINDOWS     16              /* File windows cached */
+#define PIECE_TABLE_INDEX_STEP  (64 * 1024)     /* Bytes indexed per step */
+
+typedef struct piece piece_t;
+
+/**
+ * Read original text from where it is stored
+ * @return Bytes read, 0 at the end, or negative on error
+ */
+typedef ssize_t (*piece_source_fn)(void *ctx, size_t offset, char *buf, size_t length);
+
+/**
+ * Cached window of the original text
+ */
+typedef struct {
+    char        *data;                  /* PIECE_TABLE_WINDOW_SIZE bytes */
+    size_t      offset;                 /* Offset of the window in the text */
+    size_t      length;                 /* Bytes held (0: unused) */
+    uint32_t    stamp;                  /* Last use, for eviction */
+} piece_window_t;
+
+/**
+ * Append-only text buffer and the offsets of its newlines
+ */
+typedef struct {
+    char        *data;
+    size_t      length;
+    size_t      capacity;
+    size_t      *newlines;              /* Offsets of '\n', ascending */
+    size_t      newline_count;
+    size_t      newline_capacity;
+} piece_buffer_t;
+
+/**
+ * One undoable edit
+ * While an edit's text is out of the document (an applied delete, or an
+ * undone insert) pieces holds it.
+ */
+typedef struct {
+    bool        insert;                 /* Edit inserted text (else deleted it) */
+    size_t      offset;                 /* Where it happened */
+    size_t      length;                 /* Characters inserted or deleted */
+    piece_t     *pieces;                /* Text out of the document, or NULL */
+} piece_edit_t;
+
+/**
+ * Piece table
+ */
+typedef struct {
+    piece_buffer_t  original;           /* Text the document was opened with */
+    piece_buffer_t  added;              /* Text inserted since */
+    piece_t         *root;              /* Treap of pieces */
+    uint32_t        seed;               /* Treap priority generator */
+
+    /* Original text read through from its source instead of held in
+     * memory; the treap holds it up to indexed, the rest follows */
+    piece_source_fn source;
+    void            *source_ctx;
+    bool            source_failed;      /* A read failed; indexing stopped */
+    size_t          indexed;
+    piece_window_t  windows[PIECE_TABLE_WINDOWS];
+    uint32_t        window_clock;
+
+    /* Undo ring: edits[first .. first + done) can be undone, the
+     * following ones up to first + count redone */
+    piece_edit_t    edits[PIECE_TABLE_UNDO_MAX];
+    size_t          edit_first;
+    size_t          edit_done;
+    size_t          edit_count;
+    bool            edit_sealed;        /* Next edit starts a new undo step */
+} piece_table_t;
+
+/**
+ * Set up a piece table holding some text
+ * @param pt Piece table
+ * @param text kmalloc'd text the table takes ownership of, or NULL
+ * @param length Length of text
+ * @return true on success, false if out of memory (text is freed)
+ */
+bool piece_table_init(piece_table_t *pt, char *text, size_t length);
+
+/**
+ * Set up a piece table over text read on demand
+ * Nothing is read until text is asked for; the text must not change
+ * while the table uses it.
+ * @param pt Piece table
+ * @param source Reads the text
+ * @param ctx Passed to source
+ * @param length Length of the text
+ */
+void piece_table_init_source(piece_table_t *pt, piece_source_fn source, void *ctx,
+                             size_t length);
+
+/**
+ * Index the next part of the original text
+ * @param bytes About how much to index (the step runs on to a newline)
+ * @return true while there is more left to index
+ */
+bool piece_table_index_step(piece_table_t *pt, size_t bytes);
+
+/**
+ * Check if part of the original text still has to be indexed
+ * Until it is, the line count only covers what has been.
+ */
+bool piece_table_indexing(const piece_table_t *pt);
+
+/**
+ * Read all of the original text into memory, ending the use of its source
+ * @return true on success, false if out of memory or a read failed
+ */
+bool piece_table_load(piece_table_t *pt);
+
+/**
+ * Free everything a piece table holds
+ */
+void piece_table_destroy(piece_table_t *pt);
+
+/**
+ * Length of the document
+ */
+size_t piece_table_length(const piece_table_t *pt);
+
+/**
+ * Number of lines (newlines plus one) indexed so far
+ */
+size_t piece_table_line_count(const piece_table_t *pt);
+
+/**
+ * Offset of the first character of a line
+ * Indexes as far as the line first.
+ * @return The offset, or the document length if there is no such line
+ */
+size_t piece_table_line_start(piece_table_t *pt, size_t line);
+
+/**
+ * Length of a line, not counting its newline
+ */
+size_t piece_table_line_length(piece_table_t *pt, size_t line);
+
+/**
+ * Line holding an offset
+ */
+size_t piece_table_line_at(piece_table_t *pt, size_t offset);
+
+/**
+ * Copy text out of the document
+ * @return Number of characters copied (less than length at the end)
+ */
+size_t piece_table_read(piece_table_t *pt, size_t offset, char *buf, size_t length);
+
+/**
+ * Insert text
+ * Inserts continuing the previous one are merged into a single undo step
+ * until a space or newline ends it.
+ * @return true on success, false if out of memory or offset is past the end
+ */
+bool piece_table_insert(piece_table_t *pt, size_t offset, const char *text, size_t length);
+
+/**
+ * Delete text
+ * Deletes next to the previous one (backspace or delete held down) are
+ * merged into a single undo step.
+ * @return true on success, false if out of memory or the range is past the end
+ */
+bool piece_table_delete(piece_table_t *pt, size_t offset, size_t length);
+
+/**
+ * Undo the last edit
+ * @param offset Set to where the edit happened
+ * @return true if there was an edit to undo
+ */
+bool piece_table_undo(piece_table_t *pt, size_t *offset);
+
+/**
+ * Redo the last undone edit
+ * @param offset Set to the end of the redone edit
+ * @return true if there was an edit to redo
+ */
+bool piece_table_redo(piece_table_t *pt, size_t *offset);
+
+#endif /* _AAAOS_APP_PIECE_TABLE_H */
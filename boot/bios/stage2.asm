@@ -5,7 +5,7 @@
 ; 3. Enter Protected Mode (32-bit)
 ; 4. Set up paging for Long Mode
 ; 5. Enter Long Mode (64-bit)
-; 6. Load and jump to kernel
+; 6. Load and jump to kernel (and an optional initramfs)
 
 [BITS 16]
 [ORG 0x7E00]
@@ -14,6 +14,9 @@
 KERNEL_LOAD_ADDR    equ 0x100000    ; 1MB - where kernel will be loaded
 KERNEL_START_SECTOR equ 9           ; Kernel starts at sector 10 (LBA 9)
 KERNEL_SECTORS      equ 256         ; Load up to 128KB of kernel
+INITRD_LOAD_ADDR    equ 0x30000     ; Initramfs stays in low memory, after the kernel copy
+INITRD_START_SECTOR equ KERNEL_START_SECTOR + KERNEL_SECTORS
+INITRD_SECTORS      equ 128         ; Up to 64KB of initramfs
 PAGE_PRESENT        equ (1 << 0)
 PAGE_WRITE          equ (1 << 1)
 PAGE_SIZE           equ (1 << 7)    ; 2MB pages
@@ -32,6 +35,9 @@ stage2_start:
     ; Load kernel to temporary location (below 1MB first, then copy)
     call load_kernel
 
+    ; Load the initramfs that follows it on disk (optional)
+    call load_initrd
+
     ; Print entering protected mode message
     mov si, msg_pmode
     call print_string_16
@@ -167,6 +173,20 @@ load_kernel:
     call print_string_16
     jmp $
 
+; Load initramfs from disk
+; A read error just boots without one; the kernel checks the archive magic.
+load_initrd:
+    mov ah, 0x42
+    mov dl, [boot_drive]
+    mov si, initrd_dap
+    int 0x13
+    jnc .done
+
+    mov dword [boot_info.initrd_addr], 0
+    mov dword [boot_info.initrd_size], 0
+.done:
+    ret
+
 ;-----------------------------------------
 ; 32-bit Protected Mode
 ;-----------------------------------------
@@ -337,6 +357,16 @@ kernel_dap:
     dw 0x1000                       ; Segment (0x1000:0x0000 = 0x10000)
     dq KERNEL_START_SECTOR          ; Starting LBA
 
+; Initramfs DAP for INT 13h
+align 4
+initrd_dap:
+    db 0x10                         ; Size
+    db 0                            ; Reserved
+    dw INITRD_SECTORS               ; Sectors to read
+    dw 0x0000                       ; Offset
+    dw INITRD_LOAD_ADDR >> 4        ; Segment (0x3000:0x0000 = 0x30000)
+    dq INITRD_START_SECTOR          ; Starting LBA
+
 ; Memory map storage
 memory_map_entries: dw 0
 align 8
@@ -347,12 +377,18 @@ memory_map:
 align 8
 boot_info:
     .magic:         dd 0xAAAB007    ; Magic number
+    .reserved:      dd 0
     .mem_map_addr:  dq memory_map
     .mem_map_count: dq 0
     .framebuffer:   dq 0xB8000      ; VGA text mode buffer
     .fb_width:      dd 80
     .fb_height:     dd 25
     .fb_bpp:        dd 16           ; Bits per character cell
+    .fb_pitch:      dd 160
+    .initrd_addr:   dq INITRD_LOAD_ADDR
+    .initrd_size:   dq INITRD_SECTORS * 512
+    .loader_start_tsc: dq 0         ; No loader timestamps from the BIOS path
+    .loader_exit_tsc:  dq 0
 
 ;-----------------------------------------
 ; GDT for 32-bit Protected Mode
@@ -6,11 +6,13 @@
  * - Memory map retrieval and conversion to E820 format
  * - Graphics Output Protocol (GOP) framebuffer setup
  * - ELF64 kernel loading
+ * - Initramfs loading
  * - ACPI RSDP discovery
  * - Boot services exit and kernel handoff
  *
  * Compiled as a PE32+ executable for UEFI systems.
  * Kernel path: /EFI/BOOT/kernel.elf
+ * Initramfs path: /EFI/BOOT/initrd.cpio (optional)
  */
 
 #include "uefi.h"
@@ -57,6 +59,10 @@ typedef struct __attribute__((packed)) {
     UINT32  fb_height;          /* Screen height */
     UINT32  fb_bpp;             /* Bits per pixel */
     UINT32  fb_pitch;           /* Bytes per line */
+    UINT64  initrd_addr;        /* Physical address of the initramfs, 0 if none */
+    UINT64  initrd_size;        /* Size of the initramfs in bytes */
+    UINT64  loader_start_tsc;   /* TSC when the loader began, 0 if unknown */
+    UINT64  loader_exit_tsc;    /* TSC just before jumping to the kernel */
 } boot_info_t;
 
 /* ELF64 Header structure */
@@ -129,23 +135,31 @@ static UINT64               g_kernel_entry = 0;
  * ============================================================================ */
 
 /**
- * Simple memory copy
+ * Simple memory set
  */
-static VOID mem_copy(VOID *dst, const VOID *src, UINTN size) {
+static VOID mem_set(VOID *dst, UINT8 value, UINTN size) {
     UINT8 *d = (UINT8 *)dst;
-    const UINT8 *s = (const UINT8 *)src;
     while (size--) {
-        *d++ = *s++;
+        *d++ = value;
     }
 }
 
 /**
- * Simple memory set
+ * Read the time stamp counter
  */
-static VOID mem_set(VOID *dst, UINT8 value, UINTN size) {
-    UINT8 *d = (UINT8 *)dst;
-    while (size--) {
-        *d++ = value;
+static UINT64 read_tsc(VOID) {
+    UINT32 low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((UINT64)high << 32) | low;
+}
+
+/**
+ * Record when the loader began, for the kernel's boot profile
+ * Called by each loader step; the first one sets it.
+ */
+static VOID loader_stamp_start(VOID) {
+    if (g_boot_info.loader_start_tsc == 0) {
+        g_boot_info.loader_start_tsc = read_tsc();
     }
 }
 
@@ -234,28 +248,27 @@ static UINT32 convert_memory_type(EFI_MEMORY_TYPE uefi_type) {
  * Get Memory Map from UEFI
  * ============================================================================ */
 
-EFI_STATUS get_memory_map(VOID) {
-    EFI_STATUS status;
-
-    print(L"[UEFI] Getting memory map...\r\n");
-
-    /* Get UEFI memory map */
+/**
+ * Fetch the UEFI memory map into g_uefi_mem_map
+ */
+static EFI_STATUS fetch_memory_map(VOID) {
     g_uefi_mem_map_size = sizeof(g_uefi_mem_map);
 
-    status = gBS->GetMemoryMap(
+    return gBS->GetMemoryMap(
         &g_uefi_mem_map_size,
         (EFI_MEMORY_DESCRIPTOR *)g_uefi_mem_map,
         &g_uefi_map_key,
         &g_uefi_desc_size,
         &g_uefi_desc_version
     );
+}
 
-    if (EFI_ERROR(status)) {
-        print(L"[UEFI] ERROR: Failed to get memory map\r\n");
-        return status;
-    }
-
-    /* Convert UEFI memory map to E820 format */
+/**
+ * Convert the fetched UEFI memory map to E820 format
+ * Done once, on the final map: it is plain memory work, so it can run
+ * after boot services are gone.
+ */
+static VOID convert_memory_map(VOID) {
     UINTN num_entries = g_uefi_mem_map_size / g_uefi_desc_size;
     g_memory_map_count = 0;
 
@@ -263,7 +276,6 @@ EFI_STATUS get_memory_map(VOID) {
         EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)
             (g_uefi_mem_map + i * g_uefi_desc_size);
 
-        /* Convert to E820 format */
         g_memory_map[g_memory_map_count].base = desc->PhysicalStart;
         g_memory_map[g_memory_map_count].length = desc->NumberOfPages * EFI_PAGE_SIZE;
         g_memory_map[g_memory_map_count].type = convert_memory_type(desc->Type);
@@ -271,9 +283,24 @@ EFI_STATUS get_memory_map(VOID) {
 
         g_memory_map_count++;
     }
+}
+
+EFI_STATUS get_memory_map(VOID) {
+    EFI_STATUS status;
+
+    loader_stamp_start();
+
+    print(L"[UEFI] Getting memory map...\r\n");
+
+    /* The kernel gets the final map, converted in exit_boot_services */
+    status = fetch_memory_map();
+    if (EFI_ERROR(status)) {
+        print(L"[UEFI] ERROR: Failed to get memory map\r\n");
+        return status;
+    }
 
     print(L"[UEFI] Memory map entries: ");
-    print_dec(g_memory_map_count);
+    print_dec(g_uefi_mem_map_size / g_uefi_desc_size);
     print(L"\r\n");
 
     return EFI_SUCCESS;
@@ -287,6 +314,8 @@ EFI_STATUS setup_framebuffer(VOID) {
     EFI_STATUS status;
     EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
 
+    loader_stamp_start();
+
     print(L"[UEFI] Setting up framebuffer...\r\n");
 
     /* Locate GOP */
@@ -379,10 +408,37 @@ EFI_STATUS setup_framebuffer(VOID) {
  * Load Kernel ELF
  * ============================================================================ */
 
+/* Most program headers a kernel image may have */
+#define MAX_KERNEL_PHDRS        32
+
+/**
+ * Read part of a file straight into place
+ */
+static EFI_STATUS read_file_at(EFI_FILE_PROTOCOL *file, UINT64 offset, VOID *buffer, UINTN size) {
+    EFI_STATUS status = file->SetPosition(file, offset);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    UINTN read_size = size;
+    status = file->Read(file, &read_size, buffer);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    return read_size == size ? EFI_SUCCESS : EFI_LOAD_ERROR;
+}
+
+/**
+ * Load the kernel ELF
+ * Only the headers go through a buffer: each segment is read from the
+ * file straight to its load address, and only its BSS part is cleared.
+ */
 EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
     EFI_STATUS status;
     EFI_FILE_PROTOCOL *kernel_file = NULL;
 
+    loader_stamp_start();
+
     print(L"[UEFI] Loading kernel: ");
     print(path);
     print(L"\r\n");
@@ -414,59 +470,53 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
     print_dec(kernel_size);
     print(L" bytes\r\n");
 
-    /* Allocate memory for kernel file */
-    VOID *kernel_buffer = NULL;
-    status = gBS->AllocatePool(EfiLoaderData, kernel_size, &kernel_buffer);
-    if (EFI_ERROR(status)) {
-        print(L"[UEFI] ERROR: Cannot allocate memory for kernel\r\n");
-        kernel_file->Close(kernel_file);
-        return status;
-    }
+    /* Read and validate the ELF header */
+    elf64_header_t elf_header;
+    elf64_header_t *elf = &elf_header;
 
-    /* Read kernel file */
-    UINTN read_size = kernel_size;
-    status = kernel_file->Read(kernel_file, &read_size, kernel_buffer);
-    kernel_file->Close(kernel_file);
-
-    if (EFI_ERROR(status) || read_size != kernel_size) {
+    status = read_file_at(kernel_file, 0, elf, sizeof(*elf));
+    if (EFI_ERROR(status)) {
         print(L"[UEFI] ERROR: Failed to read kernel file\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
-    /* Validate ELF header */
-    elf64_header_t *elf = (elf64_header_t *)kernel_buffer;
-
     if (elf->e_ident[0] != ELF_MAGIC_0 ||
         elf->e_ident[1] != ELF_MAGIC_1 ||
         elf->e_ident[2] != ELF_MAGIC_2 ||
         elf->e_ident[3] != ELF_MAGIC_3) {
         print(L"[UEFI] ERROR: Invalid ELF magic\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
     if (elf->e_ident[4] != ELFCLASS64) {
         print(L"[UEFI] ERROR: Not a 64-bit ELF\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
     if (elf->e_ident[5] != ELFDATA2LSB) {
         print(L"[UEFI] ERROR: Not little-endian ELF\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
     if (elf->e_machine != EM_X86_64) {
         print(L"[UEFI] ERROR: Not x86_64 ELF\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
     if (elf->e_type != ET_EXEC && elf->e_type != ET_DYN) {
         print(L"[UEFI] ERROR: Not an executable ELF\r\n");
-        gBS->FreePool(kernel_buffer);
+        kernel_file->Close(kernel_file);
+        return EFI_LOAD_ERROR;
+    }
+
+    if (elf->e_phnum > MAX_KERNEL_PHDRS || elf->e_phentsize != sizeof(elf64_phdr_t)) {
+        print(L"[UEFI] ERROR: Unsupported program header table\r\n");
+        kernel_file->Close(kernel_file);
         return EFI_LOAD_ERROR;
     }
 
@@ -475,8 +525,16 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
     print_hex(elf->e_entry);
     print(L"\r\n");
 
-    /* Process program headers and load segments */
-    elf64_phdr_t *phdrs = (elf64_phdr_t *)((UINT8 *)kernel_buffer + elf->e_phoff);
+    /* Read the program headers */
+    elf64_phdr_t phdrs[MAX_KERNEL_PHDRS];
+
+    status = read_file_at(kernel_file, elf->e_phoff, phdrs,
+                          elf->e_phnum * sizeof(elf64_phdr_t));
+    if (EFI_ERROR(status)) {
+        print(L"[UEFI] ERROR: Failed to read program headers\r\n");
+        kernel_file->Close(kernel_file);
+        return EFI_LOAD_ERROR;
+    }
 
     /* First pass: calculate memory requirements */
     UINT64 min_vaddr = 0xFFFFFFFFFFFFFFFF;
@@ -486,6 +544,12 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
         elf64_phdr_t *phdr = &phdrs[i];
 
         if (phdr->p_type == PT_LOAD) {
+            if (phdr->p_filesz > phdr->p_memsz ||
+                phdr->p_offset + phdr->p_filesz > kernel_size) {
+                print(L"[UEFI] ERROR: Segment outside the kernel file\r\n");
+                kernel_file->Close(kernel_file);
+                return EFI_LOAD_ERROR;
+            }
             if (phdr->p_vaddr < min_vaddr) {
                 min_vaddr = phdr->p_vaddr;
             }
@@ -495,6 +559,12 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
         }
     }
 
+    if (max_vaddr == 0) {
+        print(L"[UEFI] ERROR: Kernel has no loadable segments\r\n");
+        kernel_file->Close(kernel_file);
+        return EFI_LOAD_ERROR;
+    }
+
     /* For higher-half kernel, use physical address mapping */
     /* The kernel may be linked at 0xFFFFFFFF80100000 but loaded at 0x100000 */
     UINT64 load_base = 0x100000; /* Load at 1MB */
@@ -528,7 +598,7 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
                                      pages_needed, &kernel_phys);
         if (EFI_ERROR(status)) {
             print(L"[UEFI] ERROR: Cannot allocate pages for kernel\r\n");
-            gBS->FreePool(kernel_buffer);
+            kernel_file->Close(kernel_file);
             return status;
         }
         load_base = kernel_phys;
@@ -539,9 +609,6 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
     print_hex(kernel_phys);
     print(L"\r\n");
 
-    /* Clear allocated memory */
-    mem_set((VOID *)kernel_phys, 0, EFI_PAGES_TO_SIZE(pages_needed));
-
     /* Second pass: load segments */
     for (UINT16 i = 0; i < elf->e_phnum; i++) {
         elf64_phdr_t *phdr = &phdrs[i];
@@ -560,17 +627,26 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
             print_hex(phdr->p_filesz);
             print(L"\r\n");
 
-            /* Copy segment data */
+            /* Read segment data into place */
             if (phdr->p_filesz > 0) {
-                mem_copy((VOID *)segment_phys,
-                         (UINT8 *)kernel_buffer + phdr->p_offset,
-                         phdr->p_filesz);
+                status = read_file_at(kernel_file, phdr->p_offset,
+                                      (VOID *)segment_phys, phdr->p_filesz);
+                if (EFI_ERROR(status)) {
+                    print(L"[UEFI] ERROR: Failed to read kernel segment\r\n");
+                    gBS->FreePages(kernel_phys, pages_needed);
+                    kernel_file->Close(kernel_file);
+                    return EFI_LOAD_ERROR;
+                }
             }
 
-            /* BSS is already zeroed by mem_set above */
+            /* Clear BSS */
+            mem_set((UINT8 *)segment_phys + phdr->p_filesz, 0,
+                    phdr->p_memsz - phdr->p_filesz);
         }
     }
 
+    kernel_file->Close(kernel_file);
+
     /* Set kernel entry point */
     g_kernel_entry = elf->e_entry - offset;
 
@@ -581,8 +657,82 @@ EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
     print_hex(g_kernel_entry);
     print(L"\r\n");
 
-    /* Free kernel file buffer */
-    gBS->FreePool(kernel_buffer);
+    return EFI_SUCCESS;
+}
+
+/* ============================================================================
+ * Load Initramfs
+ * ============================================================================ */
+
+/**
+ * Load the initramfs archive into page-aligned memory
+ * The image is optional: without one the kernel boots from disk as before.
+ * Its pages stay allocated; the kernel reserves them from boot_info.
+ */
+EFI_STATUS load_initramfs(EFI_FILE_PROTOCOL *root, const CHAR16 *path) {
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL *initrd_file = NULL;
+
+    loader_stamp_start();
+
+    g_boot_info.initrd_addr = 0;
+    g_boot_info.initrd_size = 0;
+
+    status = root->Open(root, &initrd_file, (CHAR16 *)path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status)) {
+        print(L"[UEFI] No initramfs, booting without one\r\n");
+        return EFI_SUCCESS;
+    }
+
+    print(L"[UEFI] Loading initramfs: ");
+    print(path);
+    print(L"\r\n");
+
+    EFI_GUID file_info_guid = EFI_FILE_INFO_GUID;
+    UINT8 file_info_buffer[256];
+    UINTN file_info_size = sizeof(file_info_buffer);
+
+    status = initrd_file->GetInfo(initrd_file, &file_info_guid,
+                                  &file_info_size, file_info_buffer);
+    if (EFI_ERROR(status)) {
+        print(L"[UEFI] ERROR: Cannot get initramfs file info\r\n");
+        initrd_file->Close(initrd_file);
+        return status;
+    }
+
+    UINT64 initrd_size = ((EFI_FILE_INFO *)file_info_buffer)->FileSize;
+    if (initrd_size == 0) {
+        initrd_file->Close(initrd_file);
+        return EFI_SUCCESS;
+    }
+
+    EFI_PHYSICAL_ADDRESS initrd_phys = 0;
+    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData,
+                                EFI_SIZE_TO_PAGES(initrd_size), &initrd_phys);
+    if (EFI_ERROR(status)) {
+        print(L"[UEFI] ERROR: Cannot allocate pages for initramfs\r\n");
+        initrd_file->Close(initrd_file);
+        return status;
+    }
+
+    UINTN read_size = initrd_size;
+    status = initrd_file->Read(initrd_file, &read_size, (VOID *)initrd_phys);
+    initrd_file->Close(initrd_file);
+
+    if (EFI_ERROR(status) || read_size != initrd_size) {
+        print(L"[UEFI] ERROR: Failed to read initramfs\r\n");
+        gBS->FreePages(initrd_phys, EFI_SIZE_TO_PAGES(initrd_size));
+        return EFI_ERROR(status) ? status : EFI_LOAD_ERROR;
+    }
+
+    g_boot_info.initrd_addr = initrd_phys;
+    g_boot_info.initrd_size = initrd_size;
+
+    print(L"[UEFI] Initramfs at ");
+    print_hex(initrd_phys);
+    print(L", ");
+    print_dec(initrd_size);
+    print(L" bytes\r\n");
 
     return EFI_SUCCESS;
 }
@@ -600,42 +750,14 @@ EFI_STATUS EFIAPI exit_boot_services(VOID) {
     g_boot_info.magic = BOOT_MAGIC;
     g_boot_info.reserved = 0;
     g_boot_info.mem_map_addr = (UINT64)g_memory_map;
-    g_boot_info.mem_map_count = g_memory_map_count;
 
     /* Get final memory map (required for ExitBootServices) */
-    g_uefi_mem_map_size = sizeof(g_uefi_mem_map);
-
-    status = gBS->GetMemoryMap(
-        &g_uefi_mem_map_size,
-        (EFI_MEMORY_DESCRIPTOR *)g_uefi_mem_map,
-        &g_uefi_map_key,
-        &g_uefi_desc_size,
-        &g_uefi_desc_version
-    );
-
+    status = fetch_memory_map();
     if (EFI_ERROR(status)) {
         print(L"[UEFI] ERROR: Failed to get final memory map\r\n");
         return status;
     }
 
-    /* Update E820-format memory map */
-    UINTN num_entries = g_uefi_mem_map_size / g_uefi_desc_size;
-    g_memory_map_count = 0;
-
-    for (UINTN i = 0; i < num_entries && g_memory_map_count < MAX_MEMORY_MAP_ENTRIES; i++) {
-        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)
-            (g_uefi_mem_map + i * g_uefi_desc_size);
-
-        g_memory_map[g_memory_map_count].base = desc->PhysicalStart;
-        g_memory_map[g_memory_map_count].length = desc->NumberOfPages * EFI_PAGE_SIZE;
-        g_memory_map[g_memory_map_count].type = convert_memory_type(desc->Type);
-        g_memory_map[g_memory_map_count].acpi_attrs = 0;
-
-        g_memory_map_count++;
-    }
-
-    g_boot_info.mem_map_count = g_memory_map_count;
-
     print(L"[UEFI] Exiting boot services...\r\n");
 
     /* Disable watchdog timer */
@@ -646,15 +768,7 @@ EFI_STATUS EFIAPI exit_boot_services(VOID) {
 
     if (EFI_ERROR(status)) {
         /* Memory map may have changed, try again */
-        g_uefi_mem_map_size = sizeof(g_uefi_mem_map);
-
-        gBS->GetMemoryMap(
-            &g_uefi_mem_map_size,
-            (EFI_MEMORY_DESCRIPTOR *)g_uefi_mem_map,
-            &g_uefi_map_key,
-            &g_uefi_desc_size,
-            &g_uefi_desc_version
-        );
+        fetch_memory_map();
 
         status = gBS->ExitBootServices(gImageHandle, g_uefi_map_key);
 
@@ -671,6 +785,10 @@ EFI_STATUS EFIAPI exit_boot_services(VOID) {
     /* Disable interrupts */
     __asm__ volatile("cli");
 
+    /* The map the kernel gets is the one boot services were exited with */
+    convert_memory_map();
+    g_boot_info.mem_map_count = g_memory_map_count;
+
     /* Set up pointer to boot info for kernel */
     boot_info_t *boot_info_ptr = &g_boot_info;
 
@@ -679,6 +797,9 @@ EFI_STATUS EFIAPI exit_boot_services(VOID) {
     typedef void (*kernel_entry_t)(boot_info_t *);
     kernel_entry_t kernel_main = (kernel_entry_t)g_kernel_entry;
 
+    /* Last loader stamp; the kernel's boot profile starts from here */
+    g_boot_info.loader_exit_tsc = read_tsc();
+
     /* Call kernel - this should never return */
     kernel_main(boot_info_ptr);
 
@@ -703,5 +824,6 @@ UINT64 get_kernel_entry(VOID) {
  * ============================================================================ */
 
 boot_info_t *get_boot_info(VOID) {
+    loader_stamp_start();
     return &g_boot_info;
 }
@@ -0,0 +1,139 @@
+/**
+ * AAAos POSIX Compatibility Layer - Poll Header
+ *
+ * This header provides poll() and the epoll interface, mapped to the
+ * AAAos poll set system calls (SYS_EPOLL_CREATE, SYS_EPOLL_CTL and
+ * SYS_EPOLL_WAIT). Pipe descriptors and the calling process's message
+ * queue (EPOLL_FD_MSG_QUEUE) can be watched.
+ *
+ * Poll sets are edge-triggered: a descriptor is reported once per batch
+ * of new events, so it should be drained until EAGAIN before waiting
+ * again. EPOLLET is accepted and implied; poll() builds a temporary set
+ * and reports the descriptors' current state, as it always has.
+ */
+
+#ifndef _AAAOS_POSIX_POLL_H
+#define _AAAOS_POSIX_POLL_H
+
+#include "../../kernel/include/types.h"
+#include "errno.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ============================================================================
+ * Event Flags
+ * ============================================================================ */
+
+#define POLLIN          0x001   /* Data to read */
+#define POLLPRI         0x002   /* Urgent data to read (never reported) */
+#define POLLOUT         0x004   /* Writing will not block */
+#define POLLERR         0x008   /* Error condition (always reported) */
+#define POLLHUP         0x010   /* Hung up (always reported) */
+#define POLLNVAL        0x020   /* Invalid descriptor (poll only) */
+
+#define EPOLLIN         POLLIN
+#define EPOLLPRI        POLLPRI
+#define EPOLLOUT        POLLOUT
+#define EPOLLERR        POLLERR
+#define EPOLLHUP        POLLHUP
+#define EPOLLET         (1u << 31)  /* Edge-triggered (the only mode) */
+
+/* ============================================================================
+ * epoll_ctl Operations
+ * ============================================================================ */
+
+#define EPOLL_CTL_ADD   1       /* Start watching a descriptor */
+#define EPOLL_CTL_DEL   2       /* Stop watching a descriptor */
+#define EPOLL_CTL_MOD   3       /* Change events and data, re-reporting the state */
+
+/* Descriptor naming the caller's message queue (readable when messages wait) */
+#define EPOLL_FD_MSG_QUEUE  (-100)
+
+/* ============================================================================
+ * Type Definitions
+ * ============================================================================ */
+
+typedef unsigned int nfds_t;    /* Number of poll descriptors */
+
+/**
+ * Descriptor to poll
+ */
+struct pollfd {
+    int fd;                     /* Descriptor (negative entries are skipped) */
+    short events;               /* Requested events */
+    short revents;              /* Returned events */
+};
+
+/**
+ * User data of an epoll watch
+ */
+typedef union epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+/**
+ * Event of an epoll watch (packed, as on Linux x86_64)
+ */
+struct epoll_event {
+    uint32_t events;            /* EPOLL* events */
+    epoll_data_t data;          /* User data */
+} __attribute__((packed));
+
+/* ============================================================================
+ * Functions
+ * ============================================================================ */
+
+/**
+ * Wait for events on a set of descriptors
+ * @param fds Descriptors and requested events
+ * @param nfds Number of entries in fds
+ * @param timeout Milliseconds to wait, 0 to return at once, -1 forever
+ * @return Number of entries with revents set, 0 on timeout,
+ *         -1 on error (errno set)
+ */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+/**
+ * Create an epoll instance
+ * @param size Ignored, must be positive
+ * @return epoll descriptor (closed with close()), -1 on error (errno set)
+ */
+int epoll_create(int size);
+
+/**
+ * Create an epoll instance
+ * @param flags Must be 0
+ * @return epoll descriptor (closed with close()), -1 on error (errno set)
+ */
+int epoll_create1(int flags);
+
+/**
+ * Add, change or remove a watched descriptor
+ * @param epfd epoll descriptor
+ * @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param fd Pipe descriptor or EPOLL_FD_MSG_QUEUE
+ * @param event Events of interest and user data (may be NULL for DEL)
+ * @return 0 on success, -1 on error (errno set; EEXIST, ENOENT, EBADF)
+ */
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/**
+ * Wait for ready descriptors
+ * @param epfd epoll descriptor
+ * @param events Array to fill
+ * @param maxevents Array length (at most 64 are returned per call)
+ * @param timeout Milliseconds to wait, 0 to return at once, -1 forever
+ * @return Number of events, 0 on timeout, -1 on error (errno set)
+ */
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AAAOS_POSIX_POLL_H */
@@ -0,0 +1,721 @@
+/**
+ * AAAos Kernel - Block I/O Layer Implementation
+ *
+ * Queued commands are the first request of each merge chain; only those
+ * sit on the FIFO and sorted lists. Commands are built under the queue
+ * lock and handed to the driver after it is dropped, so the driver's
+ * completion path may call back into the queue.
+ */
+
+#include "blk.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/waitq.h"
+
+/* Requests the synchronous calls keep on the stack per burst */
+#define BLK_SYNC_BATCH          16
+
+static blk_queue_t blk_queues[BLK_MAX_QUEUES];
+static int blk_queue_count = 0;
+static volatile int blk_registry_lock = 0;
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static inline uint64_t blk_lock(blk_queue_t *q) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&q->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void blk_unlock(blk_queue_t *q, uint64_t flags) {
+    __sync_lock_release(&q->lock);
+    interrupts_restore(flags);
+}
+
+static bool blk_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static inline bool blk_req_pending(blk_request_t *req) {
+    return __atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == BLK_PENDING;
+}
+
+/*============================================================================
+ * Scheduler Lists
+ * All called with the queue lock held.
+ *============================================================================*/
+
+static void blk_fifo_append(blk_queue_t *q, int op, blk_request_t *req) {
+    req->fifo_next = NULL;
+    req->fifo_prev = q->fifo_tail[op];
+    if (q->fifo_tail[op]) {
+        q->fifo_tail[op]->fifo_next = req;
+    } else {
+        q->fifo_head[op] = req;
+    }
+    q->fifo_tail[op] = req;
+}
+
+static void blk_fifo_remove(blk_queue_t *q, int op, blk_request_t *req) {
+    if (req->fifo_prev) {
+        req->fifo_prev->fifo_next = req->fifo_next;
+    } else {
+        q->fifo_head[op] = req->fifo_next;
+    }
+    if (req->fifo_next) {
+        req->fifo_next->fifo_prev = req->fifo_prev;
+    } else {
+        q->fifo_tail[op] = req->fifo_prev;
+    }
+}
+
+/**
+ * Insert a command into the sorted list after prev (NULL for the head)
+ */
+static void blk_sort_insert(blk_queue_t *q, int op, blk_request_t *prev, blk_request_t *req) {
+    req->sort_prev = prev;
+    req->sort_next = prev ? prev->sort_next : q->sorted[op];
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req;
+    }
+    if (prev) {
+        prev->sort_next = req;
+    } else {
+        q->sorted[op] = req;
+    }
+}
+
+static void blk_sort_remove(blk_queue_t *q, int op, blk_request_t *req) {
+    if (req->sort_prev) {
+        req->sort_prev->sort_next = req->sort_next;
+    } else {
+        q->sorted[op] = req->sort_next;
+    }
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req->sort_prev;
+    }
+    if (q->next[op] == req) {
+        q->next[op] = req->sort_next;
+    }
+}
+
+/**
+ * Put a front-merged request in the place of the command it now leads
+ */
+static void blk_replace(blk_queue_t *q, int op, blk_request_t *old, blk_request_t *req) {
+    req->fifo_prev = old->fifo_prev;
+    req->fifo_next = old->fifo_next;
+    if (req->fifo_prev) {
+        req->fifo_prev->fifo_next = req;
+    } else {
+        q->fifo_head[op] = req;
+    }
+    if (req->fifo_next) {
+        req->fifo_next->fifo_prev = req;
+    } else {
+        q->fifo_tail[op] = req;
+    }
+
+    req->sort_prev = old->sort_prev;
+    req->sort_next = old->sort_next;
+    if (req->sort_prev) {
+        req->sort_prev->sort_next = req;
+    } else {
+        q->sorted[op] = req;
+    }
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req;
+    }
+    if (q->next[op] == old) {
+        q->next[op] = req;
+    }
+}
+
+static bool blk_can_merge(blk_queue_t *q, blk_request_t *cmd, blk_request_t *req) {
+    return cmd->merge_sectors + req->count <= q->limits.max_sectors &&
+           cmd->merge_count < q->limits.max_segs;
+}
+
+/**
+ * Whether the buffer of after may follow that of before in one command
+ * Page-list devices (NVMe PRPs) can only start a new run of memory on a
+ * page boundary.
+ */
+static bool blk_buffers_join(blk_queue_t *q, blk_request_t *before, blk_request_t *after) {
+    if (!q->limits.page_segments) {
+        return true;
+    }
+    uint64_t end = (uint64_t)before->buffer + (uint64_t)before->count * BLK_SECTOR_SIZE;
+    return ((end | (uint64_t)after->buffer) & (PAGE_SIZE - 1)) == 0;
+}
+
+/**
+ * Merge a request into a queued command, or queue it as a new one
+ */
+static void blk_insert(blk_queue_t *q, blk_request_t *req) {
+    int op = req->op;
+
+    /* Commands on either side of the request's LBA */
+    blk_request_t *prev = NULL;
+    blk_request_t *next = q->sorted[op];
+    while (next && next->lba <= req->lba) {
+        prev = next;
+        next = next->sort_next;
+    }
+
+    req->merge_next = NULL;
+
+    if (prev && prev->lba + prev->merge_sectors == req->lba && blk_can_merge(q, prev, req) &&
+        blk_buffers_join(q, prev->merge_tail, req)) {
+        prev->merge_tail->merge_next = req;
+        prev->merge_tail = req;
+        prev->merge_sectors += req->count;
+        prev->merge_count++;
+        q->stats.back_merges++;
+        return;
+    }
+
+    if (next && req->lba + req->count == next->lba && blk_can_merge(q, next, req) &&
+        blk_buffers_join(q, req, next)) {
+        req->merge_next = next;
+        req->merge_tail = next->merge_tail;
+        req->merge_sectors = next->merge_sectors + req->count;
+        req->merge_count = next->merge_count + 1;
+        req->deadline_ns = next->deadline_ns;
+        blk_replace(q, op, next, req);
+        q->stats.front_merges++;
+        return;
+    }
+
+    uint64_t expire = op == BLK_OP_READ ? BLK_READ_EXPIRE_MS : BLK_WRITE_EXPIRE_MS;
+    req->deadline_ns = req->submit_ns + expire * NSEC_PER_MSEC;
+    req->merge_tail = req;
+    req->merge_sectors = req->count;
+    req->merge_count = 1;
+    blk_fifo_append(q, op, req);
+    blk_sort_insert(q, op, prev, req);
+
+    q->count[op]++;
+    q->stats.queued++;
+    if (q->stats.queued > q->stats.max_queued) {
+        q->stats.max_queued = q->stats.queued;
+    }
+}
+
+/**
+ * Choose the next command to dispatch and take it off the lists
+ * Continues the current sorted run for up to BLK_FIFO_BATCH commands,
+ * then picks a direction and starts a run at the next LBA, or at the
+ * oldest command if that one has expired.
+ */
+static blk_request_t* blk_pick(blk_queue_t *q, uint64_t now) {
+    int op = q->batch_op;
+    blk_request_t *req = q->next[op];
+
+    if (!req || q->batch >= BLK_FIFO_BATCH) {
+        if (q->count[BLK_OP_READ] &&
+            (!q->count[BLK_OP_WRITE] || q->starved < BLK_WRITES_STARVED)) {
+            op = BLK_OP_READ;
+            if (q->count[BLK_OP_WRITE]) {
+                q->starved++;
+            }
+        } else {
+            op = BLK_OP_WRITE;
+            q->starved = 0;
+        }
+
+        req = q->next[op];
+        blk_request_t *oldest = q->fifo_head[op];
+        if (oldest->deadline_ns <= now) {
+            if (req != oldest) {
+                q->stats.expired++;
+            }
+            req = oldest;
+        } else if (!req) {
+            req = oldest;
+        }
+        q->batch_op = op;
+        q->batch = 0;
+    }
+
+    blk_fifo_remove(q, op, req);
+    blk_sort_remove(q, op, req);
+    q->next[op] = req->sort_next;
+    q->batch++;
+    q->count[op]--;
+    q->stats.queued--;
+    return req;
+}
+
+/*============================================================================
+ * Dispatch and Completion
+ *============================================================================*/
+
+/**
+ * Report a command's requests and free its tag
+ */
+static void blk_finish(blk_queue_t *q, blk_cmd_t *cmd, int result) {
+    uint64_t now = timer_now_ns();
+    blk_request_t *list = cmd->reqs;
+    int op = cmd->op;
+
+    uint64_t flags = blk_lock(q);
+    for (blk_request_t *req = list; req; req = req->merge_next) {
+        uint64_t latency = now - req->submit_ns;
+        q->stats.completed[op]++;
+        q->stats.latency_ns[op] += latency;
+        if (latency > q->stats.latency_max_ns[op]) {
+            q->stats.latency_max_ns[op] = latency;
+        }
+        if (result != BLK_OK) {
+            q->stats.errors++;
+        }
+    }
+    q->stats.inflight--;
+    q->free_tags |= 1U << cmd->tag;
+    blk_unlock(q, flags);
+
+    while (list) {
+        blk_request_t *req = list;
+        blk_done_t done = req->done;
+
+        /* A synchronous waiter may drop the request as soon as status changes */
+        list = req->merge_next;
+        __atomic_store_n(&req->status, result, __ATOMIC_RELEASE);
+        if (done) {
+            done(req);
+        }
+    }
+
+    __atomic_fetch_add(&q->event, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&q->event, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Hand queued commands to the driver while it has free tags
+ * @param force Dispatch even if the queue is plugged
+ */
+static void blk_run(blk_queue_t *q, bool force) {
+    for (;;) {
+        uint64_t now = timer_now_ns();
+        uint32_t started = 0;
+
+        uint64_t flags = blk_lock(q);
+        while ((force || !q->plugged) && q->free_tags &&
+               (q->count[BLK_OP_READ] || q->count[BLK_OP_WRITE])) {
+            blk_request_t *req = blk_pick(q, now);
+            uint32_t tag = (uint32_t)__builtin_ctz(q->free_tags);
+            blk_cmd_t *cmd = &q->cmds[tag];
+
+            cmd->op = req->op;
+            cmd->lba = req->lba;
+            cmd->sectors = req->merge_sectors;
+            cmd->reqs = req;
+            cmd->dispatch_ns = now;
+            cmd->nsegs = 0;
+            for (blk_request_t *r = req; r; r = r->merge_next) {
+                cmd->segs[cmd->nsegs++] = (blk_seg_t){ r->lba, r->count, r->buffer };
+            }
+
+            q->free_tags &= ~(1U << tag);
+            started |= 1U << tag;
+            q->stats.dispatched++;
+            q->stats.inflight++;
+            q->stats.depth_sum += q->stats.inflight;
+            if (q->stats.inflight > q->stats.max_inflight) {
+                q->stats.max_inflight = q->stats.inflight;
+            }
+        }
+        blk_unlock(q, flags);
+
+        if (!started) {
+            return;
+        }
+
+        /* A rejected command frees its tag; go round again for what it held up */
+        bool rejected = false;
+        bool accepted = false;
+        for (uint32_t bits = started; bits; bits &= bits - 1) {
+            blk_cmd_t *cmd = &q->cmds[__builtin_ctz(bits)];
+            int result = q->ops->submit(q->device, cmd);
+            if (result != 0) {
+                kprintf("[BLK] %s: driver rejected %u sectors at %lu (%d)\n",
+                        q->name, cmd->sectors, cmd->lba, result);
+                blk_finish(q, cmd, result < 0 ? result : BLK_ERR_IO);
+                rejected = true;
+            } else {
+                accepted = true;
+            }
+        }
+        if (accepted && q->ops->commit) {
+            q->ops->commit(q->device);
+        }
+        if (!rejected) {
+            return;
+        }
+    }
+}
+
+void blk_complete(blk_cmd_t *cmd, int result) {
+    if (!cmd) {
+        return;
+    }
+
+    blk_queue_t *q = cmd->queue;
+    blk_finish(q, cmd, result);
+    blk_run(q, false);
+}
+
+/*============================================================================
+ * Registration
+ *============================================================================*/
+
+blk_queue_t* blk_register(const char *name, const blk_ops_t *ops, void *device,
+                          const blk_limits_t *limits) {
+    if (!name || !ops || !ops->submit || !limits || limits->depth == 0 ||
+        limits->depth > BLK_MAX_DEPTH || limits->max_sectors == 0 ||
+        limits->max_segs > BLK_MAX_SEGS) {
+        return NULL;
+    }
+
+    blk_cmd_t *cmds = kcalloc(limits->depth, sizeof(blk_cmd_t));
+    uint8_t *priv = limits->priv_size ? kcalloc(limits->depth, limits->priv_size) : NULL;
+    if (!cmds || (limits->priv_size && !priv)) {
+        kfree(cmds);
+        kfree(priv);
+        return NULL;
+    }
+
+    while (__sync_lock_test_and_set(&blk_registry_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    if (blk_queue_count >= BLK_MAX_QUEUES) {
+        __sync_lock_release(&blk_registry_lock);
+        kprintf("[BLK] No queue left for %s\n", name);
+        kfree(cmds);
+        kfree(priv);
+        return NULL;
+    }
+    blk_queue_t *q = &blk_queues[blk_queue_count];
+
+    *q = (blk_queue_t){ 0 };
+    size_t i;
+    for (i = 0; name[i] && i < BLK_NAME_MAX - 1; i++) {
+        q->name[i] = name[i];
+    }
+    q->name[i] = '\0';
+    q->ops = ops;
+    q->device = device;
+    q->limits = *limits;
+    if (q->limits.max_segs == 0) {
+        q->limits.max_segs = BLK_MAX_SEGS;
+    }
+    q->cmds = cmds;
+    q->priv = priv;
+    q->free_tags = limits->depth == 32 ? UINT32_MAX : (1U << limits->depth) - 1;
+    for (uint32_t tag = 0; tag < limits->depth; tag++) {
+        cmds[tag].queue = q;
+        cmds[tag].tag = tag;
+        cmds[tag].priv = priv ? priv + tag * limits->priv_size : NULL;
+    }
+    q->registered = true;
+
+    /* Lookups only see it once it is complete */
+    __atomic_store_n(&blk_queue_count, blk_queue_count + 1, __ATOMIC_RELEASE);
+    __sync_lock_release(&blk_registry_lock);
+
+    kprintf("[BLK] Registered %s: depth %u, %u sectors x %u segments per command\n",
+            q->name, q->limits.depth, q->limits.max_sectors, q->limits.max_segs);
+    return q;
+}
+
+blk_queue_t* blk_find(const char *name) {
+    int count = __atomic_load_n(&blk_queue_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; name && i < count; i++) {
+        if (blk_streq(blk_queues[i].name, name)) {
+            return &blk_queues[i];
+        }
+    }
+    return NULL;
+}
+
+blk_queue_t* blk_get(int index) {
+    if (index < 0 || index >= __atomic_load_n(&blk_queue_count, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &blk_queues[index];
+}
+
+/*============================================================================
+ * Submission
+ *============================================================================*/
+
+int blk_submit(blk_queue_t *q, blk_request_t *req) {
+    if (!q || !q->registered) {
+        return BLK_ERR_NODEV;
+    }
+    if (!req || (req->op != BLK_OP_READ && req->op != BLK_OP_WRITE) || req->count == 0 ||
+        req->count > q->limits.max_sectors || !req->buffer) {
+        return BLK_ERR_INVAL;
+    }
+    if (q->limits.total_sectors &&
+        (req->lba >= q->limits.total_sectors ||
+         req->count > q->limits.total_sectors - req->lba)) {
+        return BLK_ERR_INVAL;
+    }
+
+    req->status = BLK_PENDING;
+    req->submit_ns = timer_now_ns();
+
+    uint64_t flags = blk_lock(q);
+    blk_insert(q, req);
+    q->stats.submitted++;
+    /* A plugged queue holding too much lets the burst reach the driver */
+    bool force = q->plugged && q->stats.queued >= BLK_PLUG_MAX;
+    bool run = !q->plugged || force;
+    blk_unlock(q, flags);
+
+    if (run) {
+        blk_run(q, force);
+    }
+    return BLK_OK;
+}
+
+void blk_plug(blk_queue_t *q) {
+    if (!q) {
+        return;
+    }
+    uint64_t flags = blk_lock(q);
+    q->plugged++;
+    blk_unlock(q, flags);
+}
+
+void blk_unplug(blk_queue_t *q) {
+    if (!q) {
+        return;
+    }
+    uint64_t flags = blk_lock(q);
+    if (q->plugged > 0) {
+        q->plugged--;
+    }
+    bool run = q->plugged == 0;
+    blk_unlock(q, flags);
+
+    if (run) {
+        blk_run(q, false);
+    }
+}
+
+/*============================================================================
+ * Synchronous Interface
+ *============================================================================*/
+
+/**
+ * Timer callback: let sleeping waiters poll the driver
+ */
+static void blk_wait_tick(void *arg) {
+    blk_queue_t *q = arg;
+
+    __atomic_fetch_add(&q->event, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&q->event, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Wait for the queue's event word to move on from seen
+ * Sleeps once the scheduler runs, with a periodic timer so the driver is
+ * polled even if its interrupts never come; spins before that.
+ */
+static void blk_wait_event(blk_queue_t *q, uint32_t seen, ktimer_t *timer, bool *armed) {
+    if (!*armed && scheduler_is_running() && interrupts_enabled()) {
+        uint64_t interval = BLK_POLL_INTERVAL_MS * NSEC_PER_MSEC;
+        ktimer_init(timer, blk_wait_tick, q);
+        *armed = ktimer_start(timer, interval, interval);
+    }
+
+    if (*armed && interrupts_enabled()) {
+        waitq_wait(&q->event, seen);
+    } else {
+        __asm__ __volatile__("pause");
+    }
+}
+
+int blk_wait(blk_queue_t *q, blk_request_t *reqs, uint32_t count) {
+    ktimer_t timer;
+    bool armed = false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        while (blk_req_pending(&reqs[i])) {
+            /* A completion since this read has bumped the word already */
+            uint32_t seen = __atomic_load_n(&q->event, __ATOMIC_SEQ_CST);
+            if (q->ops->poll) {
+                q->ops->poll(q->device);
+            }
+            if (!blk_req_pending(&reqs[i])) {
+                break;
+            }
+            blk_wait_event(q, seen, &timer, &armed);
+        }
+    }
+
+    if (armed) {
+        ktimer_cancel(&timer);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (reqs[i].status != BLK_OK) {
+            return reqs[i].status;
+        }
+    }
+    return BLK_OK;
+}
+
+/**
+ * Transfer a list of segments, BLK_SYNC_BATCH requests per plugged burst
+ * Segments larger than a command are split.
+ */
+static int blk_rw(blk_queue_t *q, blk_op_t op, const blk_seg_t *segs, uint32_t count) {
+    if (!q || !q->registered) {
+        return BLK_ERR_NODEV;
+    }
+    if (!segs && count) {
+        return BLK_ERR_INVAL;
+    }
+
+    blk_request_t reqs[BLK_SYNC_BATCH];
+    uint32_t seg = 0, done = 0;
+    int result = BLK_OK;
+
+    while (seg < count && result == BLK_OK) {
+        uint32_t batch = 0;
+
+        blk_plug(q);
+        while (seg < count && batch < BLK_SYNC_BATCH) {
+            uint32_t n = MIN(segs[seg].count - done, q->limits.max_sectors);
+            reqs[batch] = (blk_request_t){
+                .op = op,
+                .lba = segs[seg].lba + done,
+                .count = n,
+                .buffer = (uint8_t *)segs[seg].buffer + (uint64_t)done * BLK_SECTOR_SIZE,
+            };
+            result = blk_submit(q, &reqs[batch]);
+            if (result != BLK_OK) {
+                break;
+            }
+            batch++;
+
+            done += n;
+            if (done >= segs[seg].count) {
+                seg++;
+                done = 0;
+            }
+        }
+        blk_unplug(q);
+
+        /* Everything submitted must finish before the requests leave the stack */
+        int batch_result = blk_wait(q, reqs, batch);
+        if (result == BLK_OK) {
+            result = batch_result;
+        }
+    }
+
+    return result;
+}
+
+int blk_read_sectors(void *q, uint64_t lba, uint32_t count, void *buffer) {
+    blk_seg_t seg = { lba, count, buffer };
+    return blk_rw(q, BLK_OP_READ, &seg, count ? 1 : 0);
+}
+
+int blk_write_sectors(void *q, uint64_t lba, uint32_t count, const void *buffer) {
+    blk_seg_t seg = { lba, count, (void *)buffer };
+    return blk_rw(q, BLK_OP_WRITE, &seg, count ? 1 : 0);
+}
+
+int blk_read_v(void *q, const blk_seg_t *segs, uint32_t count) {
+    return blk_rw(q, BLK_OP_READ, segs, count);
+}
+
+int blk_write_v(void *q, const blk_seg_t *segs, uint32_t count) {
+    return blk_rw(q, BLK_OP_WRITE, segs, count);
+}
+
+int blk_flush(void *device) {
+    blk_queue_t *q = device;
+    if (!q || !q->registered) {
+        return BLK_ERR_NODEV;
+    }
+
+    ktimer_t timer;
+    bool armed = false;
+
+    /* Plugged requests are dispatched by whoever plugged them */
+    for (;;) {
+        uint32_t seen = __atomic_load_n(&q->event, __ATOMIC_SEQ_CST);
+        if (q->ops->poll) {
+            q->ops->poll(q->device);
+        }
+
+        uint64_t flags = blk_lock(q);
+        bool idle = q->stats.queued == 0 && q->stats.inflight == 0;
+        blk_unlock(q, flags);
+        if (idle) {
+            break;
+        }
+        blk_wait_event(q, seen, &timer, &armed);
+    }
+
+    if (armed) {
+        ktimer_cancel(&timer);
+    }
+    return q->ops->flush ? q->ops->flush(q->device) : BLK_OK;
+}
+
+/*============================================================================
+ * Statistics
+ *============================================================================*/
+
+void blk_get_stats(blk_queue_t *q, blk_stats_t *stats) {
+    if (!q || !stats) {
+        return;
+    }
+    uint64_t flags = blk_lock(q);
+    *stats = q->stats;
+    blk_unlock(q, flags);
+}
+
+void blk_dump_stats(blk_queue_t *q) {
+    if (!q) {
+        return;
+    }
+
+    blk_stats_t stats;
+    blk_get_stats(q, &stats);
+
+    kprintf("[BLK] %s statistics:\n", q->name);
+    kprintf("[BLK]   Submitted:  %lu (%lu back, %lu front merges)\n",
+            stats.submitted, stats.back_merges, stats.front_merges);
+    kprintf("[BLK]   Dispatched: %lu commands (%lu for their deadline)\n",
+            stats.dispatched, stats.expired);
+    kprintf("[BLK]   Depth:      %u queued (max %u), %u in flight (max %u, avg %lu)\n",
+            stats.queued, stats.max_queued, stats.inflight, stats.max_inflight,
+            stats.dispatched ? stats.depth_sum / stats.dispatched : 0);
+    for (int op = BLK_OP_READ; op <= BLK_OP_WRITE; op++) {
+        uint64_t n = stats.completed[op];
+        kprintf("[BLK]   %s:     %lu done, latency avg %lu us, max %lu us\n",
+                op == BLK_OP_READ ? "Reads " : "Writes", n,
+                n ? stats.latency_ns[op] / n / 1000 : 0,
+                stats.latency_max_ns[op] / 1000);
+    }
+    kprintf("[BLK]   Errors:     %lu\n", stats.errors);
+}
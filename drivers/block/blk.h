@@ -0,0 +1,287 @@
+/**
+ * AAAos Kernel - Block I/O Layer
+ *
+ * Sits between filesystems and disk drivers. Each device has a request
+ * queue; callers submit sector requests to it, and the queue decides
+ * what the driver sees and in what order.
+ *
+ * A request whose sectors continue (or lead into) a queued request of the
+ * same direction is merged into it, so the driver gets one command with
+ * a segment per request. Queued commands are scheduled deadline-style:
+ * reads and writes each have a FIFO in arrival order and a list sorted by
+ * LBA. Dispatch walks the sorted list in batches, like an elevator,
+ * unless the oldest request of the chosen direction has passed its
+ * deadline. Reads are preferred, but writes are not passed over more than
+ * BLK_WRITES_STARVED times in a row.
+ *
+ * A plugged queue holds requests back, so a burst submitted between
+ * blk_plug and blk_unplug merges before any of it reaches the driver.
+ *
+ * Drivers complete commands from any context (usually their interrupt
+ * handler) with blk_complete. The synchronous calls below sleep until
+ * their requests finish, polling the driver now and then in case its
+ * interrupts are not arriving.
+ */
+
+#ifndef _AAAOS_DRIVERS_BLK_H
+#define _AAAOS_DRIVERS_BLK_H
+
+#include "../../kernel/include/types.h"
+
+/* Queue configuration */
+#define BLK_SECTOR_SIZE         512
+#define BLK_MAX_QUEUES          8       /* Registered devices */
+#define BLK_MAX_DEPTH           32      /* Commands in flight per device */
+#define BLK_MAX_SEGS            32      /* Requests merged into one command */
+#define BLK_NAME_MAX            16
+#define BLK_PLUG_MAX            64      /* A plugged queue dispatches beyond this */
+
+/* Scheduler tuning */
+#define BLK_READ_EXPIRE_MS      500     /* Deadline of a read */
+#define BLK_WRITE_EXPIRE_MS     5000    /* Deadline of a write */
+#define BLK_FIFO_BATCH          16      /* Commands dispatched in one sorted run */
+#define BLK_WRITES_STARVED      2       /* Read batches a write may wait out */
+#define BLK_POLL_INTERVAL_MS    10      /* Sleeping waiters poll the driver this often */
+
+/* Error codes */
+#define BLK_OK                  0
+#define BLK_ERR_IO              (-5)    /* The driver failed the request */
+#define BLK_ERR_INVAL           (-22)   /* Invalid argument */
+#define BLK_ERR_NODEV           (-19)   /* No such device */
+
+/* Status of a request that has not finished */
+#define BLK_PENDING             1
+
+typedef enum blk_op {
+    BLK_OP_READ = 0,
+    BLK_OP_WRITE = 1,
+} blk_op_t;
+
+/**
+ * Segment of a vectored request
+ * Same layout as the drivers' and the buffer cache's segments.
+ */
+typedef struct blk_seg {
+    uint64_t lba;                       /* First sector */
+    uint32_t count;                     /* Number of sectors */
+    void *buffer;                       /* As the driver requires (physically contiguous) */
+} blk_seg_t;
+
+struct blk_request;
+struct blk_queue;
+
+/**
+ * Completion callback
+ * Runs in the driver's completion context with no lock held.
+ */
+typedef void (*blk_done_t)(struct blk_request *req);
+
+/**
+ * Sector request
+ * Belongs to the block layer from blk_submit until it finishes.
+ */
+typedef struct blk_request {
+    blk_op_t op;                        /* Operation */
+    uint64_t lba;                       /* First sector */
+    uint32_t count;                     /* Number of sectors */
+    void *buffer;                       /* Data */
+    blk_done_t done;                    /* Called once when finished, or NULL */
+    void *ctx;                          /* For the submitter */
+    volatile int status;                /* BLK_PENDING, then BLK_OK or an error */
+
+    /* Block layer use */
+    uint64_t submit_ns;                 /* When it was submitted */
+    uint64_t deadline_ns;               /* When it expires (first of a command) */
+    struct blk_request *fifo_prev, *fifo_next;  /* Arrival order (first of a command) */
+    struct blk_request *sort_prev, *sort_next;  /* LBA order (first of a command) */
+    struct blk_request *merge_next;     /* Next request of the same command */
+    struct blk_request *merge_tail;     /* Last request of the command (first only) */
+    uint32_t merge_sectors;             /* Sectors of the command (first only) */
+    uint32_t merge_count;               /* Requests in the command (first only) */
+} blk_request_t;
+
+/**
+ * Command handed to the driver: merged requests, contiguous on the disk
+ */
+typedef struct blk_cmd {
+    struct blk_queue *queue;
+    blk_op_t op;
+    uint32_t tag;                       /* Below the queue's depth, unique while in flight */
+    uint64_t lba;                       /* segs[0].lba */
+    uint32_t sectors;                   /* Total of the segments */
+    uint32_t nsegs;
+    blk_seg_t segs[BLK_MAX_SEGS];       /* One per request, in LBA order */
+    blk_request_t *reqs;                /* First request; the rest follow merge_next */
+    uint64_t dispatch_ns;               /* When the driver got it */
+    void *priv;                         /* Driver area of the tag (priv_size bytes) */
+} blk_cmd_t;
+
+/**
+ * Driver operations
+ */
+typedef struct blk_ops {
+    /* Start a command; blk_complete reports it. Nonzero fails it at once. */
+    int (*submit)(void *device, blk_cmd_t *cmd);
+    /* Optional: complete finished commands without waiting for an interrupt */
+    void (*poll)(void *device);
+    /* Optional: write the device's cache to the medium */
+    int (*flush)(void *device);
+    /* Optional: start what submit queued, once per dispatch round (doorbells) */
+    void (*commit)(void *device);
+} blk_ops_t;
+
+/**
+ * Device limits and driver data
+ */
+typedef struct blk_limits {
+    uint32_t depth;                     /* Commands in flight (at most BLK_MAX_DEPTH) */
+    uint32_t max_sectors;               /* Largest command */
+    uint32_t max_segs;                  /* Most segments per command (at most BLK_MAX_SEGS) */
+    uint32_t priv_size;                 /* Bytes of cmd->priv per tag */
+    uint64_t total_sectors;             /* Device size, 0 if unknown */
+    bool page_segments;                 /* Merged buffers must meet on page boundaries */
+} blk_limits_t;
+
+/**
+ * Queue statistics
+ */
+typedef struct blk_stats {
+    uint64_t submitted;                 /* Requests submitted */
+    uint64_t back_merges;               /* Requests merged after a queued command */
+    uint64_t front_merges;              /* Requests merged before a queued command */
+    uint64_t dispatched;                /* Commands handed to the driver */
+    uint64_t expired;                   /* Commands dispatched for their deadline */
+    uint64_t completed[2];              /* Requests finished, per op */
+    uint64_t errors;                    /* Requests that failed */
+    uint64_t latency_ns[2];             /* Total submit-to-completion time, per op */
+    uint64_t latency_max_ns[2];         /* Longest, per op */
+    uint64_t depth_sum;                 /* Commands in flight, summed at each dispatch */
+    uint32_t queued;                    /* Commands waiting now */
+    uint32_t inflight;                  /* Commands in the driver now */
+    uint32_t max_queued;
+    uint32_t max_inflight;
+} blk_stats_t;
+
+/**
+ * Request queue of one device
+ */
+typedef struct blk_queue {
+    char name[BLK_NAME_MAX];
+    const blk_ops_t *ops;
+    void *device;                       /* Passed to the operations */
+    blk_limits_t limits;
+    bool registered;
+
+    /* Scheduler state (protected by lock) */
+    blk_request_t *fifo_head[2], *fifo_tail[2];
+    blk_request_t *sorted[2];           /* Lowest LBA first */
+    blk_request_t *next[2];             /* Where the current sorted run goes on */
+    uint32_t count[2];                  /* Commands queued per op */
+    int batch_op;                       /* Op of the current run */
+    uint32_t batch;                     /* Commands dispatched in the current run */
+    uint32_t starved;                   /* Read runs while writes waited */
+    uint32_t plugged;                   /* Nested blk_plug calls */
+    uint32_t free_tags;                 /* Bit set for each tag not in flight */
+    blk_cmd_t *cmds;                    /* depth commands, indexed by tag */
+    uint8_t *priv;                      /* depth * priv_size bytes */
+    blk_stats_t stats;
+
+    volatile uint32_t event;            /* Bumped when requests finish (wait queue word) */
+    volatile int lock;                  /* Taken with interrupts off */
+} blk_queue_t;
+
+/**
+ * Register a device
+ * @param name Short device name ("ahci0")
+ * @param ops Driver operations (kept by pointer)
+ * @param device Passed to the operations
+ * @param limits Device limits (copied)
+ * @return The device's queue, or NULL on error
+ */
+blk_queue_t* blk_register(const char *name, const blk_ops_t *ops, void *device,
+                          const blk_limits_t *limits);
+
+/**
+ * Find a registered device by name
+ * @return The device's queue, or NULL
+ */
+blk_queue_t* blk_find(const char *name);
+
+/**
+ * Get a registered device by index
+ * @return The device's queue, or NULL past the last one
+ */
+blk_queue_t* blk_get(int index);
+
+/**
+ * Queue a request
+ * op, lba, count, buffer, done and ctx must be filled in; done is called
+ * once the request finishes, unless an error is returned.
+ * @return BLK_OK if queued, negative error code if rejected
+ */
+int blk_submit(blk_queue_t *q, blk_request_t *req);
+
+/**
+ * Hold a queue's requests back from the driver (nests)
+ */
+void blk_plug(blk_queue_t *q);
+
+/**
+ * Undo one blk_plug, dispatching what is queued once the last is undone
+ */
+void blk_unplug(blk_queue_t *q);
+
+/**
+ * Report a finished command (driver use, any context)
+ * @param result BLK_OK, or an error for every request of the command
+ */
+void blk_complete(blk_cmd_t *cmd, int result);
+
+/**
+ * Wait for submitted requests to finish
+ * @return BLK_OK, or the first error among them
+ */
+int blk_wait(blk_queue_t *q, blk_request_t *reqs, uint32_t count);
+
+/**
+ * Read sectors (synchronous)
+ * The signature matches the filesystems' block operations, q as device.
+ * @return 0 on success, negative error code on failure
+ */
+int blk_read_sectors(void *q, uint64_t lba, uint32_t count, void *buffer);
+
+/**
+ * Write sectors (synchronous)
+ * @return 0 on success, negative error code on failure
+ */
+int blk_write_sectors(void *q, uint64_t lba, uint32_t count, const void *buffer);
+
+/**
+ * Read a list of segments as one plugged burst (synchronous)
+ * @return 0 on success, negative error code on failure
+ */
+int blk_read_v(void *q, const blk_seg_t *segs, uint32_t count);
+
+/**
+ * Write a list of segments as one plugged burst (synchronous)
+ * @return 0 on success, negative error code on failure
+ */
+int blk_write_v(void *q, const blk_seg_t *segs, uint32_t count);
+
+/**
+ * Wait for every queued write, then flush the device's cache
+ * @return 0 on success, negative error code on failure
+ */
+int blk_flush(void *q);
+
+/**
+ * Get queue statistics
+ */
+void blk_get_stats(blk_queue_t *q, blk_stats_t *stats);
+
+/**
+ * Print queue statistics (for debugging)
+ */
+void blk_dump_stats(blk_queue_t *q);
+
+#endif /* _AAAOS_DRIVERS_BLK_H */
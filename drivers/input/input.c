@@ -0,0 +1,175 @@
+/**
+ * AAAos Kernel - Input Event Rings
+ *
+ * The producer owns head and the slot contents up to it; the consumer
+ * owns tail. The one slot both may touch is the newest, which the
+ * producer merges motion into: the merge word says whether that is
+ * still allowed. It holds MERGE_OPEN(head) while the slot before head
+ * may be merged into, MERGE_BUSY(head) while the producer is merging,
+ * and 0 otherwise. Before reading the newest slot the consumer swaps
+ * MERGE_OPEN for 0, waiting out a merge in progress; after that the
+ * producer queues new motion in a fresh slot.
+ */
+
+#include "input.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/waitq.h"
+
+#define INPUT_RING_MASK         (INPUT_RING_SIZE - 1)
+
+#define MERGE_OPEN(head)        ((uint32_t)(head) * 4 + 1)
+#define MERGE_BUSY(head)        ((uint32_t)(head) * 4 + 2)
+
+_Static_assert((INPUT_RING_SIZE & INPUT_RING_MASK) == 0, "INPUT_RING_SIZE must be a power of 2");
+
+/**
+ * Check whether an event is relative motion that may be coalesced
+ */
+static bool is_motion(const input_event_t *event) {
+    return event->type == INPUT_EV_MOUSE &&
+           (event->mouse.event_type == MOUSE_EVENT_MOVE ||
+            event->mouse.event_type == MOUSE_EVENT_DRAG);
+}
+
+/**
+ * Try to fold a motion event into the newest slot (producer side)
+ */
+static bool try_merge(input_ring_t *ring, uint32_t head, const input_event_t *event) {
+    uint32_t open = MERGE_OPEN(head);
+
+    if (!__atomic_compare_exchange_n(&ring->merge, &open, MERGE_BUSY(head), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    mouse_event_t *last = &ring->events[(head - 1) & INPUT_RING_MASK].mouse;
+    if (last->event_type != event->mouse.event_type ||
+        last->buttons != event->mouse.buttons) {
+        __atomic_store_n(&ring->merge, 0, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    /* Keep the oldest timestamp: latency is counted from the first packet */
+    last->dx += event->mouse.dx;
+    last->dy += event->mouse.dy;
+    ring->events[(head - 1) & INPUT_RING_MASK].merged++;
+    ring->stats.coalesced++;
+
+    __atomic_store_n(&ring->merge, MERGE_OPEN(head), __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Stop the producer merging into the slot before head (consumer side)
+ */
+static void close_merge(input_ring_t *ring, uint32_t head) {
+    while (1) {
+        uint32_t merge = __atomic_load_n(&ring->merge, __ATOMIC_ACQUIRE);
+
+        if (merge == MERGE_BUSY(head)) {
+            /* The producer is an IRQ handler on another CPU; it is brief */
+            __asm__ __volatile__("pause");
+            continue;
+        }
+        if (merge != MERGE_OPEN(head)) {
+            return;
+        }
+        if (__atomic_compare_exchange_n(&ring->merge, &merge, 0, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+void input_ring_init(input_ring_t *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->merge = 0;
+    ring->seq = 0;
+    ring->waiters = 0;
+    ring->stats.events = 0;
+    ring->stats.coalesced = 0;
+    ring->stats.dropped = 0;
+}
+
+bool input_ring_push(input_ring_t *ring, const input_event_t *event) {
+    uint32_t head = ring->head;
+    bool motion = is_motion(event);
+
+    if (motion && try_merge(ring, head, event)) {
+        return true;
+    }
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= INPUT_RING_SIZE) {
+        ring->stats.dropped++;
+        return false;
+    }
+
+    input_event_t *slot = &ring->events[head & INPUT_RING_MASK];
+    *slot = *event;
+    slot->merged = 0;
+
+    /* Open the slot for merging before the consumer can see it */
+    __atomic_store_n(&ring->merge, motion ? MERGE_OPEN(head + 1) : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    ring->stats.events++;
+
+    __atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST) != 0) {
+        waitq_wake(&ring->seq, WAITQ_WAKE_ALL);
+    }
+    return true;
+}
+
+bool input_ring_pop(input_ring_t *ring, input_event_t *event) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (tail == head) {
+        return false;
+    }
+
+    if (tail + 1 == head) {
+        close_merge(ring, head);
+    }
+
+    *event = ring->events[tail & INPUT_RING_MASK];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void input_ring_wait(input_ring_t *ring, input_event_t *event) {
+    while (!input_ring_pop(ring, event)) {
+        __atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t seq = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+        if (input_ring_empty(ring)) {
+            waitq_wait(&ring->seq, seq);
+        }
+        __atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+bool input_ring_empty(const input_ring_t *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+void input_ring_flush(input_ring_t *ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    close_merge(ring, head);
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+void input_ring_get_stats(const input_ring_t *ring, input_ring_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->events = ring->stats.events;
+    stats->coalesced = ring->stats.coalesced;
+    stats->dropped = ring->stats.dropped;
+}
+
+uint64_t input_latency_ns(uint64_t timestamp) {
+    return clock_cycles_to_ns(clock_cycles() - timestamp);
+}
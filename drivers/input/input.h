@@ -0,0 +1,117 @@
+/**
+ * AAAos Kernel - Input Event Rings
+ *
+ * Shared event path of the input drivers. Each device has one ring that
+ * its driver's work item fills and one reader drains, so neither side
+ * takes a lock: the driver only writes the head, the reader only the
+ * tail. Relative mouse motion is coalesced: while the newest event in
+ * the ring is an unread motion event with the same button state, a new
+ * packet is added to its deltas instead of taking another slot, so a
+ * slow reader sees one event per frame rather than one per packet.
+ *
+ * Events carry the TSC count (clock_cycles) at which the interrupt
+ * arrived, so input-to-photon latency can be measured at the point the
+ * event is drawn. Blocking readers sleep on a wait queue.
+ */
+
+#ifndef _AAAOS_INPUT_H
+#define _AAAOS_INPUT_H
+
+#include "../../kernel/include/types.h"
+#include "keyboard.h"
+#include "mouse.h"
+
+/* Events per ring (power of 2) */
+#define INPUT_RING_SIZE         256
+
+/* Input event types */
+typedef enum {
+    INPUT_EV_NONE = 0,
+    INPUT_EV_KEY,               /* key_event_t */
+    INPUT_EV_MOUSE              /* mouse_event_t */
+} input_event_type_t;
+
+/**
+ * Input event (one ring slot)
+ */
+typedef struct {
+    input_event_type_t type;    /* Which member of the union is valid */
+    uint32_t merged;            /* Motion packets folded into this event */
+    union {
+        key_event_t key;
+        mouse_event_t mouse;
+    };
+} input_event_t;
+
+/**
+ * Input ring statistics
+ */
+typedef struct {
+    uint64_t events;            /* Events queued */
+    uint64_t coalesced;         /* Motion packets merged into a queued event */
+    uint64_t dropped;           /* Events lost to a full ring */
+} input_ring_stats_t;
+
+/**
+ * Single-producer, single-consumer input ring
+ */
+typedef struct {
+    volatile uint32_t head;     /* Next slot to fill (producer) */
+    volatile uint32_t tail;     /* Next slot to read (consumer) */
+    volatile uint32_t merge;    /* Whether the newest slot may still be merged into */
+    volatile uint32_t seq;      /* Bumped on every change; readers sleep on it */
+    volatile uint32_t waiters;  /* Readers sleeping on seq */
+    input_ring_stats_t stats;
+    input_event_t events[INPUT_RING_SIZE];
+} input_ring_t;
+
+/**
+ * Reset a ring to empty
+ * Not safe against a running producer; call before enabling its IRQ.
+ */
+void input_ring_init(input_ring_t *ring);
+
+/**
+ * Queue an event (producer side, from the device's work item)
+ * MOVE and DRAG mouse events are merged into the newest queued event
+ * when that is unread motion with the same buttons.
+ * @param ring Ring to fill
+ * @param event Event to queue
+ * @return false if the ring was full and the event was dropped
+ */
+bool input_ring_push(input_ring_t *ring, const input_event_t *event);
+
+/**
+ * Take the oldest event without blocking (consumer side)
+ * @return true if an event was available
+ */
+bool input_ring_pop(input_ring_t *ring, input_event_t *event);
+
+/**
+ * Take the oldest event, sleeping until one arrives (consumer side)
+ */
+void input_ring_wait(input_ring_t *ring, input_event_t *event);
+
+/**
+ * Check whether a ring has unread events
+ */
+bool input_ring_empty(const input_ring_t *ring);
+
+/**
+ * Discard all unread events (consumer side)
+ */
+void input_ring_flush(input_ring_t *ring);
+
+/**
+ * Get a ring's statistics
+ */
+void input_ring_get_stats(const input_ring_t *ring, input_ring_stats_t *stats);
+
+/**
+ * Time elapsed since an event's timestamp
+ * @param timestamp Event timestamp (TSC cycles)
+ * @return Nanoseconds since the interrupt that produced it
+ */
+uint64_t input_latency_ns(uint64_t timestamp);
+
+#endif /* _AAAOS_INPUT_H */
@@ -6,12 +6,13 @@
  */
 
 #include "keyboard.h"
+#include "input.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/workqueue.h"
 #include "../../kernel/arch/x86_64/io.h"
+#include "../../kernel/arch/x86_64/irq.h"
 #include "../../kernel/include/serial.h"
 
-/* Forward declaration of pic_eoi from idt.c */
-extern void pic_eoi(uint8_t irq);
-
 /*
  * Scancode Set 1 to ASCII translation tables (US QWERTY layout)
  */
@@ -132,10 +133,27 @@ static const keycode_t extended_scancode_to_keycode[128] = {
  * Keyboard state
  */
 
-/* Circular buffer for key events */
-static key_event_t event_buffer[KEYBOARD_BUFFER_SIZE];
-static volatile uint32_t buffer_head = 0;
-static volatile uint32_t buffer_tail = 0;
+/* Key events, from the keyboard work item to the reader */
+static input_ring_t key_ring;
+
+/*
+ * Scancodes read by IRQ1, waiting for the work item (power of 2). The
+ * item always runs on the boot CPU's worker, which also takes IRQ1, so
+ * it is the ring's only consumer and key_ring's only producer.
+ */
+#define KB_SCANCODE_RING    64
+
+typedef struct {
+    uint8_t code;
+    uint64_t timestamp;         /* clock_cycles() when IRQ1 read it */
+} kb_scancode_t;
+
+static kb_scancode_t scancode_ring[KB_SCANCODE_RING];
+static volatile uint32_t scancode_head = 0;    /* Written by IRQ1 */
+static volatile uint32_t scancode_tail = 0;    /* Written by the work item */
+
+static void keyboard_work_fn(void *arg);
+static work_t keyboard_work = WORK_INIT(keyboard_work_fn, NULL);
 
 /* Current modifier state */
 static volatile uint16_t current_modifiers = 0;
@@ -233,6 +251,7 @@ static bool keyboard_send_cmd(uint8_t cmd) {
 
 /**
  * Update keyboard LEDs
+ * With interrupts off, so IRQ1 does not take the controller's replies.
  */
 static void update_leds(void) {
     uint8_t leds = 0;
@@ -242,38 +261,37 @@ static void update_leds(void) {
     if (current_modifiers & MOD_CAPSLOCK)   leds |= LED_CAPSLOCK;
 
     if (leds != led_state) {
+        uint64_t flags = interrupts_save();
         led_state = leds;
         keyboard_send_cmd(KB_CMD_SET_LEDS);
         ps2_send_data(leds);
+        interrupts_restore(flags);
     }
 }
 
 /**
- * Add a key event to the buffer
+ * Queue a key event, stamped with the TSC count of its interrupt
  */
-static void buffer_add_event(key_event_t *event) {
-    uint32_t next_head = (buffer_head + 1) & (KEYBOARD_BUFFER_SIZE - 1);
+static void buffer_add_event(key_event_t *event, uint64_t timestamp) {
+    input_event_t ev;
+    ev.type = INPUT_EV_KEY;
+    ev.key = *event;
+    ev.key.timestamp = timestamp;
 
-    /* Drop event if buffer is full */
-    if (next_head == buffer_tail) {
+    if (!input_ring_push(&key_ring, &ev)) {
         kprintf("[KB] Warning: event buffer full, dropping event\n");
-        return;
     }
-
-    event_buffer[buffer_head] = *event;
-    buffer_head = next_head;
 }
 
 /**
- * Get a key event from the buffer (non-blocking)
+ * Get a key event from the ring (non-blocking)
  */
 static bool buffer_get_event(key_event_t *event) {
-    if (buffer_head == buffer_tail) {
-        return false;  /* Buffer empty */
+    input_event_t ev;
+    if (!input_ring_pop(&key_ring, &ev)) {
+        return false;  /* Ring empty */
     }
-
-    *event = event_buffer[buffer_tail];
-    buffer_tail = (buffer_tail + 1) & (KEYBOARD_BUFFER_SIZE - 1);
+    *event = ev.key;
     return true;
 }
 
@@ -308,7 +326,7 @@ static char scancode_to_ascii(uint8_t scancode, uint16_t modifiers) {
 /**
  * Process a scancode and generate key event
  */
-static void process_scancode(uint8_t scancode) {
+static void process_scancode(uint8_t scancode, uint64_t timestamp) {
     key_event_t event;
     bool is_release = (scancode & SCANCODE_RELEASE) != 0;
     uint8_t key_scancode = scancode & 0x7F;
@@ -405,7 +423,22 @@ static void process_scancode(uint8_t scancode) {
     }
 
     /* Add to buffer */
-    buffer_add_event(&event);
+    buffer_add_event(&event, timestamp);
+}
+
+/**
+ * Keyboard work item: decode the scancodes IRQ1 has read
+ */
+static void keyboard_work_fn(void *arg) {
+    UNUSED(arg);
+
+    uint32_t tail = scancode_tail;
+    while (tail != __atomic_load_n(&scancode_head, __ATOMIC_ACQUIRE)) {
+        kb_scancode_t sc = scancode_ring[tail & (KB_SCANCODE_RING - 1)];
+        tail++;
+        __atomic_store_n(&scancode_tail, tail, __ATOMIC_RELEASE);
+        process_scancode(sc.code, sc.timestamp);
+    }
 }
 
 /*
@@ -487,8 +520,7 @@ bool keyboard_init(void) {
     }
 
     /* Initialize state */
-    buffer_head = 0;
-    buffer_tail = 0;
+    input_ring_init(&key_ring);
     current_modifiers = MOD_NUMLOCK;  /* Num Lock on by default */
     expecting_extended = false;
     expecting_extended2 = false;
@@ -502,6 +534,7 @@ bool keyboard_init(void) {
 
     /* Register interrupt handler */
     idt_register_handler(IRQ_KEYBOARD, keyboard_handler);
+    irq_unmask(1);
     kprintf("[KB] Registered handler for IRQ1 (vector %d)\n", IRQ_KEYBOARD);
 
     keyboard_initialized = true;
@@ -516,8 +549,14 @@ void keyboard_handler(interrupt_frame_t *frame) {
     /* Read scancode from keyboard */
     uint8_t scancode = inb(PS2_DATA_PORT);
 
-    /* Process the scancode */
-    process_scancode(scancode);
+    /* Decoding waits for the work item; a full ring drops the scancode */
+    uint32_t head = scancode_head;
+    if (head - __atomic_load_n(&scancode_tail, __ATOMIC_ACQUIRE) < KB_SCANCODE_RING) {
+        scancode_ring[head & (KB_SCANCODE_RING - 1)] =
+            (kb_scancode_t){ scancode, clock_cycles() };
+        __atomic_store_n(&scancode_head, head + 1, __ATOMIC_RELEASE);
+    }
+    queue_work_on(0, &keyboard_work);
 
     /* EOI is sent by the common interrupt handler in idt.c */
 }
@@ -526,24 +565,17 @@ char keyboard_getchar(void) {
     key_event_t event;
 
     while (1) {
-        /* Wait for input */
-        while (buffer_head == buffer_tail) {
-            /* Enable interrupts while waiting */
-            __asm__ __volatile__("sti; hlt");
-        }
+        keyboard_get_event(&event);
 
-        /* Get event */
-        if (buffer_get_event(&event)) {
-            /* Only return on key press with valid ASCII */
-            if (event.pressed && event.ascii != 0) {
-                return event.ascii;
-            }
+        /* Only return on key press with valid ASCII */
+        if (event.pressed && event.ascii != 0) {
+            return event.ascii;
         }
     }
 }
 
 bool keyboard_has_input(void) {
-    return buffer_head != buffer_tail;
+    return !input_ring_empty(&key_ring);
 }
 
 uint8_t keyboard_get_scancode(void) {
@@ -554,16 +586,12 @@ uint8_t keyboard_get_scancode(void) {
 }
 
 bool keyboard_get_event(key_event_t *event) {
-    while (1) {
-        /* Wait for input */
-        while (buffer_head == buffer_tail) {
-            __asm__ __volatile__("sti; hlt");
-        }
+    input_event_t ev;
 
-        if (buffer_get_event(event)) {
-            return true;
-        }
-    }
+    /* Sleeps on the ring's wait queue until IRQ1 queues an event */
+    input_ring_wait(&key_ring, &ev);
+    *event = ev.key;
+    return true;
 }
 
 bool keyboard_poll_event(key_event_t *event) {
@@ -599,8 +627,7 @@ void keyboard_flush(void) {
     /* Disable interrupts while flushing */
     interrupts_disable();
 
-    buffer_head = 0;
-    buffer_tail = 0;
+    input_ring_flush(&key_ring);
 
     /* Also flush PS/2 controller buffer */
     while (inb(PS2_STATUS_PORT) & PS2_STATUS_OUTPUT) {
@@ -215,6 +215,7 @@ typedef struct {
     bool        pressed;        /* true = press, false = release */
     bool        extended;       /* true if extended scancode */
     char        ascii;          /* ASCII character (0 if non-printable) */
+    uint64_t    timestamp;      /* TSC cycles at the interrupt (clock_cycles) */
 } key_event_t;
 
 /* LED bits */
@@ -222,9 +223,6 @@ typedef struct {
 #define LED_NUMLOCK     0x02
 #define LED_CAPSLOCK    0x04
 
-/* Keyboard buffer size (must be power of 2) */
-#define KEYBOARD_BUFFER_SIZE    256
-
 /**
  * Initialize the PS/2 keyboard driver
  * Sets up the controller, registers IRQ handler, and enables the keyboard.
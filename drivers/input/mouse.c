@@ -6,12 +6,13 @@
  */
 
 #include "mouse.h"
+#include "input.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/workqueue.h"
 #include "../../kernel/arch/x86_64/io.h"
+#include "../../kernel/arch/x86_64/irq.h"
 #include "../../kernel/include/serial.h"
 
-/* Forward declaration of pic_eoi from idt.c */
-extern void pic_eoi(uint8_t irq);
-
 /*
  * Mouse state
  */
@@ -32,10 +33,26 @@ static volatile uint8_t prev_buttons = 0;
 static volatile uint8_t packet_buffer[3];
 static volatile uint8_t packet_index = 0;
 
-/* Event queue (circular buffer) */
-static mouse_event_t event_buffer[MOUSE_BUFFER_SIZE];
-static volatile uint32_t buffer_head = 0;
-static volatile uint32_t buffer_tail = 0;
+/* Mouse events, from the mouse work item to the reader; motion is coalesced */
+static input_ring_t mouse_ring;
+
+/*
+ * Packets assembled by IRQ12, waiting for the work item (power of 2).
+ * Like the keyboard's, the item runs on the boot CPU's worker only.
+ */
+#define MOUSE_PACKET_RING   32
+
+typedef struct {
+    uint8_t bytes[3];
+    uint64_t timestamp;         /* clock_cycles() when the last byte arrived */
+} mouse_packet_t;
+
+static mouse_packet_t packet_ring[MOUSE_PACKET_RING];
+static volatile uint32_t packet_head = 0;      /* Written by IRQ12 */
+static volatile uint32_t packet_tail = 0;      /* Written by the work item */
+
+static void mouse_work_fn(void *arg);
+static work_t mouse_work = WORK_INIT(mouse_work_fn, NULL);
 
 /* Driver initialized flag */
 static volatile bool mouse_initialized = false;
@@ -123,46 +140,40 @@ static bool mouse_send_cmd(uint8_t cmd) {
 }
 
 /**
- * Add a mouse event to the buffer
+ * Queue a mouse event (merged into the last one if both are motion)
  */
 static void buffer_add_event(mouse_event_t *event) {
-    uint32_t next_head = (buffer_head + 1) & (MOUSE_BUFFER_SIZE - 1);
-
-    /* Drop event if buffer is full */
-    if (next_head == buffer_tail) {
-        /* Don't spam logs - just silently drop */
-        return;
-    }
+    input_event_t ev;
+    ev.type = INPUT_EV_MOUSE;
+    ev.mouse = *event;
 
-    event_buffer[buffer_head] = *event;
-    buffer_head = next_head;
+    /* Drop event if the ring is full - don't spam logs */
+    input_ring_push(&mouse_ring, &ev);
 }
 
 /**
- * Get a mouse event from the buffer (non-blocking)
+ * Get a mouse event from the ring (non-blocking)
  */
 static bool buffer_get_event(mouse_event_t *event) {
-    if (buffer_head == buffer_tail) {
-        return false;  /* Buffer empty */
+    input_event_t ev;
+    if (!input_ring_pop(&mouse_ring, &ev)) {
+        return false;  /* Ring empty */
     }
-
-    *event = event_buffer[buffer_tail];
-    buffer_tail = (buffer_tail + 1) & (MOUSE_BUFFER_SIZE - 1);
+    *event = ev.mouse;
     return true;
 }
 
 /**
  * Process a complete 3-byte mouse packet
  */
-static void process_packet(void) {
-    uint8_t status = packet_buffer[0];
-    int32_t dx = (int32_t)packet_buffer[1];
-    int32_t dy = (int32_t)packet_buffer[2];
+static void process_packet(const mouse_packet_t *packet) {
+    uint8_t status = packet->bytes[0];
+    int32_t dx = (int32_t)packet->bytes[1];
+    int32_t dy = (int32_t)packet->bytes[2];
 
     /* Verify packet validity - bit 3 should always be 1 */
     if ((status & MOUSE_PKT_ALWAYS_ONE) == 0) {
-        kprintf("[MOUSE] Invalid packet (bit 3 not set), resynchronizing\n");
-        packet_index = 0;
+        kprintf("[MOUSE] Invalid packet (bit 3 not set), dropping it\n");
         return;
     }
 
@@ -208,6 +219,7 @@ static void process_packet(void) {
     event.dx = dx;
     event.dy = dy;
     event.buttons = buttons;
+    event.timestamp = packet->timestamp;
 
     /* Check for button changes */
     uint8_t buttons_changed = buttons ^ prev_buttons;
@@ -239,6 +251,21 @@ static void process_packet(void) {
     prev_buttons = buttons;
 }
 
+/**
+ * Mouse work item: decode the packets IRQ12 has assembled
+ */
+static void mouse_work_fn(void *arg) {
+    UNUSED(arg);
+
+    uint32_t tail = packet_tail;
+    while (tail != __atomic_load_n(&packet_head, __ATOMIC_ACQUIRE)) {
+        mouse_packet_t packet = packet_ring[tail & (MOUSE_PACKET_RING - 1)];
+        tail++;
+        __atomic_store_n(&packet_tail, tail, __ATOMIC_RELEASE);
+        process_packet(&packet);
+    }
+}
+
 /*
  * Public API
  */
@@ -324,11 +351,11 @@ bool mouse_init(void) {
     current_state.buttons = 0;
     prev_buttons = 0;
     packet_index = 0;
-    buffer_head = 0;
-    buffer_tail = 0;
+    input_ring_init(&mouse_ring);
 
     /* Register interrupt handler */
     idt_register_handler(IRQ_MOUSE, mouse_handler);
+    irq_unmask(12);
     kprintf("[MOUSE] Registered handler for IRQ12 (vector %d)\n", IRQ_MOUSE);
 
     mouse_initialized = true;
@@ -356,10 +383,19 @@ void mouse_handler(interrupt_frame_t *frame) {
     /* Add byte to packet buffer */
     packet_buffer[packet_index++] = data;
 
-    /* Check if we have a complete packet (3 bytes for standard PS/2 mouse) */
+    /* A complete packet (3 bytes for standard PS/2 mouse) waits for the work item */
     if (packet_index >= 3) {
-        process_packet();
         packet_index = 0;
+        uint32_t head = packet_head;
+        if (head - __atomic_load_n(&packet_tail, __ATOMIC_ACQUIRE) < MOUSE_PACKET_RING) {
+            mouse_packet_t *packet = &packet_ring[head & (MOUSE_PACKET_RING - 1)];
+            packet->bytes[0] = packet_buffer[0];
+            packet->bytes[1] = packet_buffer[1];
+            packet->bytes[2] = packet_buffer[2];
+            packet->timestamp = clock_cycles();
+            __atomic_store_n(&packet_head, head + 1, __ATOMIC_RELEASE);
+        }
+        queue_work_on(0, &mouse_work);
     }
 
     /* EOI is sent by the common interrupt handler in idt.c */
@@ -385,8 +421,14 @@ bool mouse_get_event(mouse_event_t *event) {
     return buffer_get_event(event);
 }
 
+void mouse_wait_event(mouse_event_t *event) {
+    input_event_t ev;
+    input_ring_wait(&mouse_ring, &ev);
+    *event = ev.mouse;
+}
+
 bool mouse_has_event(void) {
-    return buffer_head != buffer_tail;
+    return !input_ring_empty(&mouse_ring);
 }
 
 void mouse_set_bounds(int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y) {
@@ -433,13 +475,21 @@ void mouse_set_position(int32_t x, int32_t y) {
 void mouse_flush(void) {
     interrupts_disable();
 
-    buffer_head = 0;
-    buffer_tail = 0;
+    input_ring_flush(&mouse_ring);
     packet_index = 0;
 
     interrupts_enable();
 }
 
+void mouse_dump_stats(void) {
+    input_ring_stats_t stats;
+    input_ring_get_stats(&mouse_ring, &stats);
+
+    kprintf("[MOUSE] Events queued: %llu, packets coalesced: %llu, dropped: %llu\n",
+            (unsigned long long)stats.events, (unsigned long long)stats.coalesced,
+            (unsigned long long)stats.dropped);
+}
+
 const char* mouse_button_name(uint8_t buttons) {
     static char name_buffer[32];
     int pos = 0;
@@ -66,9 +66,6 @@
 #define MOUSE_PKT_X_OVERFLOW    0x40    /* X overflow */
 #define MOUSE_PKT_Y_OVERFLOW    0x80    /* Y overflow */
 
-/* Mouse event buffer size (must be power of 2) */
-#define MOUSE_BUFFER_SIZE       256
-
 /* Default screen bounds */
 #define MOUSE_DEFAULT_MAX_X     1024
 #define MOUSE_DEFAULT_MAX_Y     768
@@ -99,13 +96,15 @@ typedef struct {
 
 /**
  * Mouse event structure
- * Represents a single mouse event (movement or button change)
+ * Represents a single mouse event (movement or button change). A movement
+ * event sums the packets that arrived while it waited to be read.
  */
 typedef struct {
     int32_t dx;                     /* X delta (relative movement) */
     int32_t dy;                     /* Y delta (relative movement) */
     uint8_t buttons;                /* Current button state */
     mouse_event_type_t event_type;  /* Type of event */
+    uint64_t timestamp;             /* TSC cycles at the interrupt (clock_cycles) */
 } mouse_event_t;
 
 /**
@@ -137,6 +136,12 @@ void mouse_get_state(mouse_state_t *state);
  */
 bool mouse_get_event(mouse_event_t *event);
 
+/**
+ * Get the next mouse event, sleeping until one arrives
+ * @param event Pointer to mouse_event_t structure to fill
+ */
+void mouse_wait_event(mouse_event_t *event);
+
 /**
  * Check if mouse events are available
  * @return true if events are waiting in the queue
@@ -167,6 +172,11 @@ void mouse_set_position(int32_t x, int32_t y);
  */
 void mouse_flush(void);
 
+/**
+ * Print event queue statistics (including coalesced motion) to serial console
+ */
+void mouse_dump_stats(void);
+
 /**
  * Get human-readable name for button state
  * @param buttons Button bitmask
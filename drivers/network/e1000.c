@@ -9,6 +9,14 @@
 #include "../../kernel/include/serial.h"
 #include "../../kernel/mm/pmm.h"
 #include "../../kernel/mm/vmm.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/softirq.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../kernel/init/initcall.h"
+#include "../../net/ethernet/ethernet.h"
+#include "../../net/core/nettrace.h"
+#include "../../lib/libc/string.h"
 
 /* Global device state */
 static e1000_device_t e1000_dev;
@@ -20,25 +28,8 @@ static bool e1000_init_rx(void);
 static bool e1000_init_tx(void);
 static void e1000_enable_interrupts(void);
 static uint16_t e1000_eeprom_read(uint8_t addr);
-
-/* Memory copy function (simple implementation) */
-static void *memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
-    }
-    return dest;
-}
-
-/* Memory set function */
-static void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-    while (n--) {
-        *p++ = (uint8_t)c;
-    }
-    return s;
-}
+static void e1000_register_netdev(void);
+static void e1000_softirq(void);
 
 /**
  * Read a 32-bit value from e1000 MMIO register
@@ -55,92 +46,35 @@ static inline void e1000_write_reg(uint32_t offset, uint32_t value) {
 }
 
 /**
- * PCI configuration space read (32-bit)
+ * Find the e1000 among the enumerated PCI devices
  */
-static uint32_t pci_read_config(uint8_t bus, uint8_t device, uint8_t func, uint8_t offset) {
-    uint32_t address = (1U << 31) |              /* Enable bit */
-                       ((uint32_t)bus << 16) |
-                       ((uint32_t)device << 11) |
-                       ((uint32_t)func << 8) |
-                       (offset & 0xFC);          /* Align to 4 bytes */
-    outl(PCI_CONFIG_ADDRESS, address);
-    return inl(PCI_CONFIG_DATA);
-}
+static bool e1000_detect_pci(void) {
+    pci_device_t *dev = pci_find_device(E1000_VENDOR_ID, E1000_DEVICE_ID);
+    if (dev == NULL) {
+        kprintf("[e1000] No Intel e1000 device found\n");
+        return false;
+    }
 
-/**
- * PCI configuration space write (32-bit)
- */
-static void pci_write_config(uint8_t bus, uint8_t device, uint8_t func, uint8_t offset, uint32_t value) {
-    uint32_t address = (1U << 31) |
-                       ((uint32_t)bus << 16) |
-                       ((uint32_t)device << 11) |
-                       ((uint32_t)func << 8) |
-                       (offset & 0xFC);
-    outl(PCI_CONFIG_ADDRESS, address);
-    outl(PCI_CONFIG_DATA, value);
-}
+    e1000_dev.pci_dev = dev;
+    kprintf("[e1000] Found Intel e1000 at PCI %d:%d.%d\n",
+            dev->bus, dev->device, dev->function);
 
-/**
- * Scan PCI bus for e1000 device
- */
-static bool e1000_detect_pci(void) {
-    kprintf("[e1000] Scanning PCI bus for Intel e1000...\n");
-
-    for (uint16_t bus = 0; bus < 256; bus++) {
-        for (uint8_t device = 0; device < 32; device++) {
-            for (uint8_t func = 0; func < 8; func++) {
-                uint32_t vendor_device = pci_read_config(bus, device, func, PCI_VENDOR_ID);
-                uint16_t vendor = vendor_device & 0xFFFF;
-                uint16_t dev_id = (vendor_device >> 16) & 0xFFFF;
-
-                /* Skip invalid entries */
-                if (vendor == 0xFFFF) {
-                    continue;
-                }
-
-                /* Check for e1000 */
-                if (vendor == E1000_VENDOR_ID && dev_id == E1000_DEVICE_ID) {
-                    e1000_dev.pci_bus = bus;
-                    e1000_dev.pci_device = device;
-                    e1000_dev.pci_function = func;
-
-                    kprintf("[e1000] Found Intel e1000 at PCI %d:%d.%d\n",
-                            bus, device, func);
-
-                    /* Get BAR0 (MMIO base address) */
-                    uint32_t bar0 = pci_read_config(bus, device, func, PCI_BAR0);
-                    if (bar0 & 0x01) {
-                        kprintf("[e1000] ERROR: BAR0 is I/O mapped, expected MMIO\n");
-                        return false;
-                    }
-
-                    /* BAR0 bits [31:4] contain the base address */
-                    e1000_dev.mmio_phys = bar0 & 0xFFFFFFF0;
-                    e1000_dev.mmio_size = 128 * 1024;  /* 128 KB MMIO region */
-
-                    kprintf("[e1000] MMIO base physical: 0x%x\n", (uint32_t)e1000_dev.mmio_phys);
-
-                    /* Get interrupt line */
-                    uint32_t int_info = pci_read_config(bus, device, func, PCI_INTERRUPT_LINE);
-                    e1000_dev.irq = int_info & 0xFF;
-                    kprintf("[e1000] IRQ: %d\n", e1000_dev.irq);
-
-                    /* Enable bus mastering and memory space access */
-                    uint32_t cmd = pci_read_config(bus, device, func, PCI_COMMAND);
-                    cmd |= PCI_CMD_MEMORY | PCI_CMD_BUS_MASTER;
-                    cmd &= ~PCI_CMD_INT_DISABLE;  /* Enable interrupts */
-                    pci_write_config(bus, device, func, PCI_COMMAND, cmd);
-
-                    kprintf("[e1000] PCI command register: 0x%x\n", cmd);
-
-                    return true;
-                }
-            }
-        }
+    if (pci_bar_is_io(dev, 0)) {
+        kprintf("[e1000] ERROR: BAR0 is I/O mapped, expected MMIO\n");
+        return false;
     }
 
-    kprintf("[e1000] No Intel e1000 device found\n");
-    return false;
+    e1000_dev.mmio_phys = pci_get_bar(dev, 0);
+    e1000_dev.mmio_size = 128 * 1024;  /* 128 KB MMIO region */
+    kprintf("[e1000] MMIO base physical: 0x%llx\n", (unsigned long long)e1000_dev.mmio_phys);
+
+    e1000_dev.irq = dev->interrupt_line;
+    kprintf("[e1000] IRQ: %d\n", e1000_dev.irq);
+
+    /* Enable bus mastering and memory space access */
+    pci_enable_memory_space(dev);
+    pci_enable_bus_mastering(dev);
+    return true;
 }
 
 /**
@@ -250,19 +184,19 @@ static bool e1000_init_rx(void) {
     /* Clear descriptors */
     memset(e1000_dev.rx_descs, 0, desc_size);
 
-    /* Allocate receive buffers */
-    for (int i = 0; i < E1000_NUM_RX_DESC; i++) {
-        physaddr_t buf_phys = pmm_alloc_page();
-        if (buf_phys == 0) {
-            kprintf("[e1000] ERROR: Failed to allocate RX buffer %d\n", i);
-            return false;
-        }
+    /* Receive buffers come from a pool so frames can be passed up in place */
+    if (netbuf_pool_init(&e1000_dev.rx_pool, E1000_RX_POOL_SIZE, PAGE_SIZE,
+                         NETBUF_DEFAULT_HEADROOM) != 0) {
+        kprintf("[e1000] ERROR: Failed to allocate RX buffer pool\n");
+        return false;
+    }
 
-        e1000_dev.rx_buffers_phys[i] = buf_phys;
-        e1000_dev.rx_buffers[i] = (void *)(VMM_KERNEL_PHYS_MAP + buf_phys);
+    for (int i = 0; i < E1000_NUM_RX_DESC; i++) {
+        netbuf_t *buf = netbuf_pool_get(&e1000_dev.rx_pool);
 
-        /* Set up descriptor */
-        e1000_dev.rx_descs[i].buffer_addr = buf_phys;
+        /* Set up descriptor (the device writes at most E1000_RX_BUFFER_SIZE) */
+        e1000_dev.rx_bufs[i] = buf;
+        e1000_dev.rx_descs[i].buffer_addr = netbuf_data_phys(buf);
         e1000_dev.rx_descs[i].status = 0;
     }
 
@@ -283,6 +217,9 @@ static bool e1000_init_rx(void) {
 
     e1000_write_reg(E1000_RCTL, rctl);
 
+    /* Verify IPv4 and TCP/UDP checksums of received frames */
+    e1000_write_reg(E1000_RXCSUM, E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL);
+
     kprintf("[e1000] RX ring initialized at phys 0x%x\n", (uint32_t)e1000_dev.rx_descs_phys);
 
     return true;
@@ -329,6 +266,7 @@ static bool e1000_init_tx(void) {
     }
 
     e1000_dev.tx_cur = 0;
+    e1000_dev.tx_clean = 0;
 
     /* Configure TX descriptor ring registers */
     e1000_write_reg(E1000_TDBAL, (uint32_t)(e1000_dev.tx_descs_phys & 0xFFFFFFFF));
@@ -421,10 +359,17 @@ bool e1000_init(void) {
         return false;
     }
 
-    /* Register interrupt handler */
-    idt_register_handler(IRQ_BASE + e1000_dev.irq, e1000_handler);
-    kprintf("[e1000] Registered interrupt handler for IRQ %d (vector %d)\n",
-            e1000_dev.irq, IRQ_BASE + e1000_dev.irq);
+    /* Register interrupt handler: an MSI vector of its own if possible */
+    softirq_register(SOFTIRQ_NET_RX, e1000_softirq);
+    e1000_dev.vector = pci_irq_alloc(e1000_dev.pci_dev, 0, 0, e1000_handler);
+    if (e1000_dev.vector >= 0) {
+        kprintf("[e1000] Registered interrupt handler for MSI vector %d\n", e1000_dev.vector);
+    } else {
+        idt_register_handler(IRQ_BASE + e1000_dev.irq, e1000_handler);
+        pci_enable_interrupts(e1000_dev.pci_dev);
+        kprintf("[e1000] Registered interrupt handler for IRQ %d (vector %d)\n",
+                e1000_dev.irq, IRQ_BASE + e1000_dev.irq);
+    }
 
     /* Enable interrupts */
     e1000_enable_interrupts();
@@ -452,11 +397,14 @@ bool e1000_init(void) {
     }
 
     e1000_dev.initialized = true;
+    e1000_register_netdev();
     kprintf("[e1000] Driver initialized successfully\n");
 
     return true;
 }
 
+INITCALL(e1000, e1000_init, 0, "pci");
+
 /**
  * Reset the e1000 device
  */
@@ -485,6 +433,236 @@ void e1000_reset(void) {
     kprintf("[e1000] Device reset complete\n");
 }
 
+static inline uint64_t e1000_tx_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&e1000_dev.tx_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void e1000_tx_lock_release(uint64_t flags) {
+    __sync_lock_release(&e1000_dev.tx_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Descriptors that can be filled (one always stays empty)
+ */
+static inline uint32_t e1000_tx_free(void) {
+    uint32_t used = (e1000_dev.tx_cur + E1000_NUM_TX_DESC - e1000_dev.tx_clean) %
+                    E1000_NUM_TX_DESC;
+    return E1000_NUM_TX_DESC - 1 - used;
+}
+
+/**
+ * Reclaim descriptors the device is done with, freeing their netbufs
+ * Called with the TX lock held.
+ */
+static void e1000_tx_reclaim(void) {
+    while (e1000_dev.tx_clean != e1000_dev.tx_cur) {
+        uint32_t i = e1000_dev.tx_clean;
+        if (!(e1000_dev.tx_descs[i].status & E1000_TXD_STAT_DD)) {
+            break;
+        }
+
+        netbuf_t *buf = e1000_dev.tx_netbufs[i];
+        e1000_dev.tx_netbufs[i] = NULL;
+        while (buf) {
+            netbuf_t *next = buf->next;
+            netbuf_free(buf);
+            buf = next;
+        }
+        e1000_dev.tx_clean = (i + 1) % E1000_NUM_TX_DESC;
+    }
+}
+
+/**
+ * Make room for count descriptors, reclaiming once a batch has been sent
+ * Called with the TX lock held.
+ * @return true if count descriptors are free
+ */
+static bool e1000_tx_reserve(uint32_t count) {
+    if (e1000_tx_free() < count ||
+        E1000_NUM_TX_DESC - 1 - e1000_tx_free() >= E1000_TX_RECLAIM_BATCH) {
+        e1000_tx_reclaim();
+    }
+
+    /* Wait for the device to finish a few descriptors */
+    int timeout = 10000;
+    while (e1000_tx_free() < count) {
+        if (--timeout == 0) {
+            e1000_dev.tx_busy++;
+            return false;
+        }
+        __asm__ __volatile__("pause");
+        e1000_tx_reclaim();
+    }
+    return true;
+}
+
+/**
+ * Fill the next TX descriptor
+ * Called with the TX lock held, after e1000_tx_reserve.
+ * @param owner Chain to free once this descriptor is done, or NULL
+ */
+static void e1000_tx_queue(physaddr_t addr, size_t len, bool eop, netbuf_t *owner) {
+    uint32_t cur = e1000_dev.tx_cur;
+    e1000_tx_desc_t *desc = &e1000_dev.tx_descs[cur];
+
+    desc->buffer_addr = addr;
+    desc->length = (uint16_t)len;
+    desc->cmd = E1000_TXD_CMD_IFCS |   /* Insert FCS/CRC */
+                E1000_TXD_CMD_RS;      /* Report status */
+    if (eop) {
+        desc->cmd |= E1000_TXD_CMD_EOP;
+    }
+    desc->status = 0;  /* Clear status */
+    e1000_dev.tx_netbufs[cur] = owner;
+
+    e1000_dev.tx_cur = (cur + 1) % E1000_NUM_TX_DESC;
+}
+
+/**
+ * Fill the next TX descriptor as an extended data descriptor
+ * Called with the TX lock held, after e1000_tx_reserve.
+ */
+static void e1000_tx_queue_data(physaddr_t addr, size_t len, uint32_t cmd, uint8_t popts,
+                                netbuf_t *owner) {
+    uint32_t cur = e1000_dev.tx_cur;
+    e1000_data_desc_t *desc = (e1000_data_desc_t *)&e1000_dev.tx_descs[cur];
+
+    desc->buffer_addr = addr;
+    desc->cmd_and_length = (uint32_t)len | E1000_TXD_DTYP_DATA | cmd;
+    desc->status = 0;
+    desc->popts = popts;
+    desc->special = 0;
+    e1000_dev.tx_netbufs[cur] = owner;
+
+    e1000_dev.tx_cur = (cur + 1) % E1000_NUM_TX_DESC;
+}
+
+/**
+ * Store a 16-bit big-endian value into a frame
+ */
+static inline void e1000_put_be16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static inline uint16_t e1000_get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * Checksum offload and TSO layout of a frame
+ */
+typedef struct {
+    uint32_t l4_off;            /* Start of the TCP/UDP header */
+    uint32_t csum_off;          /* TCP/UDP checksum field */
+    uint32_t hdr_len;           /* Ethernet + IP + TCP headers (TSO) */
+    bool tcp;
+} e1000_tx_offload_t;
+
+/**
+ * Check an offloaded frame and prepare its headers for the device
+ * The TCP/UDP checksum field is seeded with the pseudo-header sum; for
+ * TSO the pseudo-header omits the length, and the IP total length and
+ * checksum are cleared, since the device fills them for each segment.
+ * @return false if the frame cannot be offloaded
+ */
+static bool e1000_tx_offload_prepare(netbuf_t *buf, size_t frame_len, e1000_tx_offload_t *off) {
+    uint8_t *frame = buf->data;
+    bool tso = (buf->flags & NETBUF_FLAG_TSO) != 0;
+
+    if (buf->len < ETH_HLEN + 20 || e1000_get_be16(frame + 12) != ETH_TYPE_IPV4) {
+        return false;
+    }
+
+    uint8_t *ip = frame + ETH_HLEN;
+    uint32_t ihl = (uint32_t)(ip[0] & 0x0F) * 4;
+    uint8_t proto = ip[9];
+    off->l4_off = ETH_HLEN + ihl;
+    off->tcp = proto == 6;
+    if (ihl < 20 || (!off->tcp && (proto != 17 || tso))) {
+        return false;
+    }
+
+    uint32_t l4_len = off->tcp ? 20 : 8;
+    if (buf->len < off->l4_off + l4_len) {
+        return false;
+    }
+    if (off->tcp) {
+        l4_len = (uint32_t)(frame[off->l4_off + 12] >> 4) * 4;
+        if (l4_len < 20 || buf->len < off->l4_off + l4_len) {
+            return false;
+        }
+    }
+    off->csum_off = off->l4_off + (off->tcp ? 16 : 6);
+    off->hdr_len = off->l4_off + l4_len;
+
+    if (tso) {
+        if (buf->mss == 0 || frame_len <= off->hdr_len) {
+            return false;
+        }
+        e1000_put_be16(ip + 2, 0);
+        e1000_put_be16(ip + 10, 0);
+    }
+
+    if (buf->flags & (NETBUF_FLAG_CSUM_L4 | NETBUF_FLAG_TSO)) {
+        uint32_t sum = 0;
+        for (int i = 12; i < 20; i += 2) {
+            sum += e1000_get_be16(ip + i);     /* Source and destination address */
+        }
+        sum += proto;
+        if (!tso) {
+            sum += (uint32_t)(frame_len - off->l4_off);
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        e1000_put_be16(frame + off->csum_off, (uint16_t)sum);
+    }
+    return true;
+}
+
+/**
+ * Fill the next TX descriptor with the context for an offloaded frame
+ * Called with the TX lock held, after e1000_tx_reserve.
+ */
+static void e1000_tx_queue_context(const netbuf_t *buf, size_t frame_len,
+                                   const e1000_tx_offload_t *off) {
+    uint32_t cur = e1000_dev.tx_cur;
+    e1000_context_desc_t *ctx = (e1000_context_desc_t *)&e1000_dev.tx_descs[cur];
+    uint8_t ihl = (uint8_t)(off->l4_off - ETH_HLEN);
+    uint32_t cmd = E1000_TXD_CMD_DEXT | E1000_TXD_CMD_RS | E1000_TXD_CMD_IP;
+
+    ctx->ipcss = ETH_HLEN;
+    ctx->ipcso = ETH_HLEN + 10;
+    ctx->ipcse = (uint16_t)(ETH_HLEN + ihl - 1);
+    ctx->tucss = (uint8_t)off->l4_off;
+    ctx->tucso = (uint8_t)off->csum_off;
+    ctx->tucse = 0;
+    ctx->hdr_len = 0;
+    ctx->mss = 0;
+    ctx->status = 0;
+
+    if (off->tcp) {
+        cmd |= E1000_TXD_CMD_TCP;
+    }
+    uint32_t paylen = 0;
+    if (buf->flags & NETBUF_FLAG_TSO) {
+        cmd |= E1000_TXD_CMD_TSE;
+        paylen = (uint32_t)(frame_len - off->hdr_len);
+        ctx->hdr_len = (uint8_t)off->hdr_len;
+        ctx->mss = buf->mss;
+    }
+    ctx->cmd_and_length = paylen | E1000_TXD_DTYP_CTX | E1000_TXD_CMD(cmd);
+    e1000_dev.tx_netbufs[cur] = NULL;
+
+    e1000_dev.tx_cur = (cur + 1) % E1000_NUM_TX_DESC;
+}
+
 /**
  * Send a network packet
  */
@@ -503,53 +681,167 @@ ssize_t e1000_send_packet(const void *data, size_t len) {
         return -1;
     }
 
-    /* Get current TX descriptor */
-    uint32_t cur = e1000_dev.tx_cur;
-    e1000_tx_desc_t *desc = &e1000_dev.tx_descs[cur];
+    uint64_t flags = e1000_tx_lock_acquire();
 
     /* Wait for descriptor to be available */
-    int timeout = 10000;
-    while (!(desc->status & E1000_TXD_STAT_DD)) {
-        if (--timeout == 0) {
-            kprintf("[e1000] ERROR: TX timeout waiting for descriptor\n");
-            return -1;
-        }
+    if (!e1000_tx_reserve(1)) {
+        e1000_tx_lock_release(flags);
+        kprintf("[e1000] ERROR: TX timeout waiting for descriptor\n");
+        return -1;
     }
 
-    /* Copy packet data to TX buffer */
+    /* Copy packet data to the TX buffer of the descriptor */
+    uint32_t cur = e1000_dev.tx_cur;
     memcpy(e1000_dev.tx_buffers[cur], data, len);
-
-    /* Set up descriptor */
-    desc->buffer_addr = e1000_dev.tx_buffers_phys[cur];
-    desc->length = len;
-    desc->cmd = E1000_TXD_CMD_EOP |    /* End of packet */
-                E1000_TXD_CMD_IFCS |   /* Insert FCS/CRC */
-                E1000_TXD_CMD_RS;      /* Report status */
-    desc->status = 0;  /* Clear status */
+    e1000_tx_queue(e1000_dev.tx_buffers_phys[cur], len, true, NULL);
 
     /* Advance tail pointer to trigger transmission */
-    e1000_dev.tx_cur = (cur + 1) % E1000_NUM_TX_DESC;
+    __sync_synchronize();
     e1000_write_reg(E1000_TDT, e1000_dev.tx_cur);
 
     /* Update statistics */
     e1000_dev.packets_sent++;
     e1000_dev.bytes_sent += len;
 
+    e1000_tx_lock_release(flags);
     return len;
 }
 
-/**
- * Receive a network packet
- */
-ssize_t e1000_receive_packet(void *buf, size_t max_len) {
-    if (!e1000_dev.initialized) {
+ssize_t e1000_send_netbuf(netbuf_t *buf) {
+    if (!e1000_dev.initialized || buf == NULL) {
         return -1;
     }
 
-    if (buf == NULL || max_len == 0) {
+    uint32_t offload = buf->flags & (NETBUF_FLAG_CSUM_IP | NETBUF_FLAG_CSUM_L4 | NETBUF_FLAG_TSO);
+
+    /* One descriptor per E1000_TX_MAX_DATA bytes of each non-empty buffer */
+    uint32_t frags = 0;
+    uint32_t descs = offload ? 1 : 0;
+    size_t len = 0;
+    for (netbuf_t *frag = buf; frag; frag = frag->next) {
+        if (frag->len == 0) {
+            continue;
+        }
+        if (frag->phys == 0) {
+            kprintf("[e1000] ERROR: TX buffer has no physical address\n");
+            return -1;
+        }
+        frags++;
+        descs += (uint32_t)((frag->len + E1000_TX_MAX_DATA - 1) / E1000_TX_MAX_DATA);
+        len += frag->len;
+    }
+
+    if (frags == 0 || frags > E1000_TX_MAX_FRAGS || descs > E1000_TX_MAX_DESCS) {
+        return -1;
+    }
+
+    size_t max_len = (offload & NETBUF_FLAG_TSO) ? E1000_TSO_MAX_SIZE : E1000_MAX_PACKET_SIZE;
+    if (len > max_len) {
+        kprintf("[e1000] ERROR: Packet too large (%d > %d)\n", (int)len, (int)max_len);
+        return -1;
+    }
+
+    e1000_tx_offload_t off = {0};
+    if (offload && !e1000_tx_offload_prepare(buf, len, &off)) {
+        kprintf("[e1000] ERROR: Frame cannot be offloaded\n");
         return -1;
     }
 
+    uint64_t flags = e1000_tx_lock_acquire();
+
+    if (!e1000_tx_reserve(descs)) {
+        e1000_tx_lock_release(flags);
+        return -1;
+    }
+
+    uint32_t cmd = E1000_TXD_CMD_DEXT | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS;
+    uint8_t popts = 0;
+    if (offload) {
+        e1000_tx_queue_context(buf, len, &off);
+        if (offload & NETBUF_FLAG_TSO) {
+            cmd |= E1000_TXD_CMD_TSE;
+            popts = E1000_TXD_POPTS_IXSM | E1000_TXD_POPTS_TXSM;
+        } else {
+            popts = ((offload & NETBUF_FLAG_CSUM_IP) ? E1000_TXD_POPTS_IXSM : 0) |
+                    ((offload & NETBUF_FLAG_CSUM_L4) ? E1000_TXD_POPTS_TXSM : 0);
+        }
+    }
+
+    /* The last descriptor carries EOP and frees the chain once it is done */
+    size_t left = len;
+    for (netbuf_t *frag = buf; frag; frag = frag->next) {
+        for (size_t done = 0; done < frag->len; ) {
+            size_t chunk = MIN(frag->len - done, (size_t)E1000_TX_MAX_DATA);
+            physaddr_t addr = netbuf_data_phys(frag) + done;
+            left -= chunk;
+            bool eop = left == 0;
+            if (offload) {
+                uint32_t dcmd = cmd | (eop ? E1000_TXD_CMD_EOP : 0);
+                e1000_tx_queue_data(addr, chunk, E1000_TXD_CMD(dcmd), popts, eop ? buf : NULL);
+            } else {
+                e1000_tx_queue(addr, chunk, eop, eop ? buf : NULL);
+            }
+            done += chunk;
+        }
+    }
+
+    __sync_synchronize();
+    e1000_write_reg(E1000_TDT, e1000_dev.tx_cur);
+
+    e1000_dev.packets_sent++;
+    e1000_dev.bytes_sent += len;
+
+    e1000_tx_lock_release(flags);
+    return len;
+}
+
+/* Network device operations (netdev.h) */
+
+static int e1000_netdev_xmit(netdev_t *dev, netbuf_t *buf, uint16_t queue) {
+    UNUSED(dev);
+    UNUSED(queue);
+    return e1000_send_netbuf(buf) < 0 ? -1 : 0;
+}
+
+static uint32_t e1000_netdev_poll(netdev_t *dev, uint16_t queue, uint32_t budget);
+
+/* RX buffers hold one standard frame, so the MTU cannot grow */
+static int e1000_netdev_set_mtu(netdev_t *dev, uint32_t mtu) {
+    UNUSED(dev);
+    return mtu <= ETH_DATA_MAX ? 0 : -1;
+}
+
+static const netdev_ops_t e1000_netdev_ops = {
+    .xmit = e1000_netdev_xmit,
+    .poll = e1000_netdev_poll,
+    .set_mtu = e1000_netdev_set_mtu,
+};
+
+/**
+ * Register the device with the stack
+ * The 82540EM has a single queue each way and no RSS.
+ */
+static void e1000_register_netdev(void) {
+    netdev_t *dev = &e1000_dev.netdev;
+    memcpy(dev->mac, e1000_dev.mac, sizeof(dev->mac));
+    dev->mtu = ETH_DATA_MAX;
+    dev->features = ETH_OFFLOAD_TX_CSUM | ETH_OFFLOAD_RX_CSUM | ETH_OFFLOAD_TSO;
+    dev->num_tx_queues = 1;
+    dev->num_rx_queues = 1;
+    dev->ops = &e1000_netdev_ops;
+    dev->priv = &e1000_dev;
+    if (netdev_register(dev) != 0) {
+        kprintf("[e1000] WARNING: Could not register network device\n");
+    }
+}
+
+/**
+ * Take the frame at the current RX descriptor
+ * @param out Set to the frame's buffer when one is returned
+ * @return Frame length, 0 if no packet is available, or -1 if the frame
+ *         was bad or dropped
+ */
+static ssize_t e1000_rx_take(netbuf_t **out) {
     /* Get current RX descriptor */
     uint32_t cur = e1000_dev.rx_cur;
     e1000_rx_desc_t *desc = &e1000_dev.rx_descs[cur];
@@ -559,45 +851,193 @@ ssize_t e1000_receive_packet(void *buf, size_t max_len) {
         return 0;  /* No packet available */
     }
 
-    /* Check for errors */
-    if (desc->errors) {
-        kprintf("[e1000] RX error: 0x%02x\n", desc->errors);
-        e1000_dev.errors++;
+    uint16_t len = desc->length;
+    netbuf_t *fresh = NULL;
 
-        /* Reset descriptor and continue */
-        desc->status = 0;
-        e1000_dev.rx_cur = (cur + 1) % E1000_NUM_RX_DESC;
-        e1000_write_reg(E1000_RDT, cur);
+    /* Checksum errors are left for the stack to find */
+    uint8_t errors = desc->errors & ~(E1000_RXD_ERR_TCPE | E1000_RXD_ERR_IPE);
 
-        return -1;
+    if (errors) {
+        kprintf("[e1000] RX error: 0x%02x\n", desc->errors);
+        e1000_dev.errors++;
+    } else if (len == 0 || len > E1000_RX_BUFFER_SIZE) {
+        e1000_dev.errors++;
+    } else if ((fresh = netbuf_pool_get(&e1000_dev.rx_pool)) == NULL) {
+        e1000_dev.rx_dropped++;
     }
 
-    /* Get packet length */
-    uint16_t len = desc->length;
-    if (len > max_len) {
-        len = max_len;
-    }
+    /* Hand the filled buffer up and put the fresh one in its place */
+    if (fresh) {
+        netbuf_t *buf = e1000_dev.rx_bufs[cur];
+        netbuf_put(buf, len);
+        buf->flags |= NETBUF_FLAG_RX;
+        if (!(desc->status & E1000_RXD_STAT_IXSM)) {
+            if ((desc->status & E1000_RXD_STAT_IPCS) && !(desc->errors & E1000_RXD_ERR_IPE)) {
+                buf->flags |= NETBUF_FLAG_CSUM_IP_OK;
+            }
+            if ((desc->status & E1000_RXD_STAT_TCPCS) && !(desc->errors & E1000_RXD_ERR_TCPE)) {
+                buf->flags |= NETBUF_FLAG_CSUM_L4_OK;
+            }
+        }
+        *out = buf;
 
-    /* Copy packet data */
-    memcpy(buf, e1000_dev.rx_buffers[cur], len);
+        e1000_dev.rx_bufs[cur] = fresh;
+        desc->buffer_addr = netbuf_data_phys(fresh);
 
-    /* Update statistics */
-    e1000_dev.packets_received++;
-    e1000_dev.bytes_received += len;
+        /* Update statistics */
+        e1000_dev.packets_received++;
+        e1000_dev.bytes_received += len;
+    }
 
     /* Reset descriptor for reuse */
     desc->status = 0;
 
     /* Advance to next descriptor */
-    uint32_t old_cur = cur;
     e1000_dev.rx_cur = (cur + 1) % E1000_NUM_RX_DESC;
 
     /* Update tail pointer to allow hardware to use this descriptor again */
-    e1000_write_reg(E1000_RDT, old_cur);
+    e1000_write_reg(E1000_RDT, cur);
+
+    return fresh ? (ssize_t)len : -1;
+}
+
+/**
+ * Receive a network packet
+ */
+ssize_t e1000_receive_packet(void *buf, size_t max_len) {
+    if (!e1000_dev.initialized) {
+        return -1;
+    }
+
+    if (buf == NULL || max_len == 0) {
+        return -1;
+    }
+
+    netbuf_t *frame = NULL;
+    ssize_t len = e1000_rx_take(&frame);
+    if (len <= 0) {
+        return len;
+    }
+
+    if ((size_t)len > max_len) {
+        len = (ssize_t)max_len;
+    }
+    memcpy(buf, frame->data, (size_t)len);
+    netbuf_free(frame);
 
     return len;
 }
 
+/**
+ * Receive a network packet without copying it
+ */
+netbuf_t *e1000_receive_buf(void) {
+    if (!e1000_dev.initialized) {
+        return NULL;
+    }
+
+    /* Bad and dropped frames are skipped over */
+    for (;;) {
+        netbuf_t *frame = NULL;
+        ssize_t len = e1000_rx_take(&frame);
+        if (len > 0) {
+            return frame;
+        }
+        if (len == 0) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Hand up to budget frames to the RX handler
+ * @return Frames handled
+ */
+static uint32_t e1000_rx_poll(uint32_t budget) {
+    uint32_t done = 0;
+    while (done < budget) {
+        netbuf_t *frame = NULL;
+        ssize_t len = e1000_rx_take(&frame);
+        if (len == 0) {
+            break;
+        }
+        if (len > 0) {
+            e1000_dev.rx_handler(frame);
+        }
+        done++;
+    }
+
+    e1000_dev.rx_polls++;
+    if (done == budget) {
+        e1000_dev.rx_budget_hits++;
+    }
+    return done;
+}
+
+static uint32_t e1000_netdev_poll(netdev_t *dev, uint16_t queue, uint32_t budget) {
+    uint32_t done = 0;
+    while (done < budget) {
+        netbuf_t *frame = NULL;
+        ssize_t len = e1000_rx_take(&frame);
+        if (len == 0) {
+            break;
+        }
+        if (len > 0) {
+            netdev_rx(dev, queue, frame);
+        }
+        done++;
+    }
+    return done;
+}
+
+/**
+ * RX poller: runs while the ring has frames, sleeps with interrupts on
+ */
+static void e1000_rx_thread(void *arg) {
+    UNUSED(arg);
+
+    for (;;) {
+        uint32_t seen = e1000_dev.rx_event;
+
+        if (e1000_rx_poll(E1000_POLL_BUDGET) == E1000_POLL_BUDGET) {
+            /* Still busy: let other processes run, then go on polling */
+            scheduler_yield();
+            continue;
+        }
+
+        /*
+         * Ring drained: unmask and sleep. A frame that lands in between
+         * raises an interrupt, which changes rx_event, so the wait
+         * returns at once.
+         */
+        e1000_write_reg(E1000_IMS, E1000_ICR_RX);
+        waitq_wait(&e1000_dev.rx_event, seen);
+    }
+}
+
+bool e1000_start_polling(e1000_rx_handler_t handler) {
+    if (!e1000_dev.initialized || handler == NULL || e1000_dev.rx_handler != NULL) {
+        return false;
+    }
+
+    /* Interrupt throttling and receive delay timers */
+    e1000_write_reg(E1000_ITR, E1000_ITR_DEFAULT);
+    e1000_write_reg(E1000_RDTR, E1000_RDTR_DEFAULT);
+    e1000_write_reg(E1000_RADV, E1000_RADV_DEFAULT);
+
+    e1000_dev.rx_handler = handler;
+    process_t *poller = thread_create(NULL, "e1000-rx", e1000_rx_thread, NULL);
+    if (!poller || !scheduler_add(poller)) {
+        kprintf("[e1000] ERROR: Failed to start RX poller\n");
+        e1000_dev.rx_handler = NULL;
+        return false;
+    }
+
+    kprintf("[e1000] Polled receive enabled (budget %d, ITR %d)\n",
+            E1000_POLL_BUDGET, E1000_ITR_DEFAULT);
+    return true;
+}
+
 /**
  * Get the MAC address
  */
@@ -612,7 +1052,7 @@ void e1000_get_mac(uint8_t mac[6]) {
 }
 
 /**
- * e1000 interrupt handler
+ * e1000 interrupt handler: acknowledge, and leave the causes to the softirq
  */
 void e1000_handler(interrupt_frame_t *frame) {
     UNUSED(frame);
@@ -625,6 +1065,21 @@ void e1000_handler(interrupt_frame_t *frame) {
         return;
     }
 
+    __atomic_fetch_or(&e1000_dev.icr_pending, icr, __ATOMIC_RELEASE);
+    softirq_raise(SOFTIRQ_NET_RX);
+
+    /* EOI is sent by the common interrupt handler in idt.c */
+}
+
+/**
+ * Network softirq: handle the causes the interrupt handler collected
+ */
+static void e1000_softirq(void) {
+    uint32_t icr = __atomic_exchange_n(&e1000_dev.icr_pending, 0, __ATOMIC_ACQUIRE);
+    if (icr == 0) {
+        return;
+    }
+
     /* Handle link status change */
     if (icr & E1000_ICR_LSC) {
         uint32_t status = e1000_read_reg(E1000_STATUS);
@@ -635,9 +1090,18 @@ void e1000_handler(interrupt_frame_t *frame) {
 
     /* Handle receive interrupt */
     if (icr & (E1000_ICR_RXT0 | E1000_ICR_RXDMT0)) {
-        /* Packets are available - they will be handled by polling or a receive thread */
-        /* For now, just log it */
+        e1000_dev.rx_interrupts++;
+        nettrace_event(NETTRACE_IRQ, 0);
+#ifdef E1000_DEBUG_TRACE
         kprintf("[e1000] Receive interrupt (ICR=0x%x)\n", icr);
+#endif
+    }
+
+    /* Polled receive: mask RX until the poller has drained the ring */
+    if ((icr & E1000_ICR_RX) && e1000_dev.rx_handler) {
+        e1000_write_reg(E1000_IMC, E1000_ICR_RX);
+        __atomic_fetch_add(&e1000_dev.rx_event, 1, __ATOMIC_SEQ_CST);
+        waitq_wake(&e1000_dev.rx_event, WAITQ_WAKE_ALL);
     }
 
     /* Handle receive overrun */
@@ -650,12 +1114,6 @@ void e1000_handler(interrupt_frame_t *frame) {
     if (icr & E1000_ICR_TXDW) {
         /* Transmission complete - could wake up waiting threads */
     }
-
-    /* Send EOI to PIC */
-    if (e1000_dev.irq >= 8) {
-        outb(0xA0, 0x20);  /* Slave PIC EOI */
-    }
-    outb(0x20, 0x20);  /* Master PIC EOI */
 }
 
 /**
@@ -13,30 +13,14 @@
 
 #include "../../kernel/include/types.h"
 #include "../../kernel/arch/x86_64/include/idt.h"
+#include "../pci/pci.h"
+#include "../../net/core/netbuf.h"
+#include "../../net/core/netdev.h"
 
 /* PCI identification */
 #define E1000_VENDOR_ID         0x8086
 #define E1000_DEVICE_ID         0x100E
 
-/* PCI configuration ports */
-#define PCI_CONFIG_ADDRESS      0xCF8
-#define PCI_CONFIG_DATA         0xCFC
-
-/* PCI configuration space offsets */
-#define PCI_VENDOR_ID           0x00
-#define PCI_DEVICE_ID           0x02
-#define PCI_COMMAND             0x04
-#define PCI_STATUS              0x06
-#define PCI_BAR0                0x10
-#define PCI_BAR1                0x14
-#define PCI_INTERRUPT_LINE      0x3C
-
-/* PCI command register bits */
-#define PCI_CMD_IO              BIT(0)
-#define PCI_CMD_MEMORY          BIT(1)
-#define PCI_CMD_BUS_MASTER      BIT(2)
-#define PCI_CMD_INT_DISABLE     BIT(10)
-
 /* e1000 MMIO Register Offsets */
 #define E1000_CTRL              0x0000      /* Device Control */
 #define E1000_STATUS            0x0008      /* Device Status */
@@ -57,6 +41,12 @@
 #define E1000_RDH               0x2810      /* RX Descriptor Head */
 #define E1000_RDT               0x2818      /* RX Descriptor Tail */
 #define E1000_RDTR              0x2820      /* RX Delay Timer */
+#define E1000_RADV              0x282C      /* RX Absolute Delay Timer */
+#define E1000_RXCSUM            0x5000      /* RX Checksum Control */
+
+/* RX Checksum Control bits */
+#define E1000_RXCSUM_IPOFL      BIT(8)      /* IPv4 header checksum offload */
+#define E1000_RXCSUM_TUOFL      BIT(9)      /* TCP/UDP checksum offload */
 
 /* Transmit Control */
 #define E1000_TCTL              0x0400      /* Transmit Control */
@@ -161,9 +151,27 @@
 
 /* Buffer sizes */
 #define E1000_RX_BUFFER_SIZE    2048
+#define E1000_RX_POOL_SIZE      (E1000_NUM_RX_DESC + 64)    /* Ring plus frames held upstream */
 #define E1000_TX_BUFFER_SIZE    2048
+#define E1000_TX_MAX_FRAGS      8           /* Buffers in one netbuf chain */
+#define E1000_TX_MAX_DESCS      32          /* Descriptors one frame may use */
+#define E1000_TX_MAX_DATA       4096        /* Bytes per TX data descriptor */
+#define E1000_TSO_MAX_SIZE      65535       /* Largest frame handed over for TSO */
+#define E1000_TX_RECLAIM_BATCH  32          /* Sent descriptors left before reclaiming */
 #define E1000_MAX_PACKET_SIZE   1518        /* Ethernet MTU + headers */
 
+/* Polled receive (e1000_start_polling) */
+#define E1000_POLL_BUDGET       64          /* Frames handled before the poller yields */
+#define E1000_ITR_DEFAULT       488         /* 256ns units: at most ~8000 interrupts/s */
+#define E1000_RDTR_DEFAULT      8           /* 1.024us units: wait for more frames */
+#define E1000_RADV_DEFAULT      32          /* 1.024us units: but no longer than this */
+#define E1000_ICR_RX            (E1000_ICR_RXT0 | E1000_ICR_RXDMT0 | E1000_ICR_RXO)
+
+/**
+ * Receives each frame the poller takes off the ring (owns the buffer)
+ */
+typedef void (*e1000_rx_handler_t)(netbuf_t *buf);
+
 /**
  * Receive Descriptor (legacy format)
  * 16 bytes, must be 16-byte aligned
@@ -225,15 +233,55 @@ typedef struct PACKED {
 #define E1000_TXD_STAT_LC       BIT(2)      /* Late Collision */
 #define E1000_TXD_STAT_TU       BIT(3)      /* Transmit Underrun */
 
+/**
+ * Transmit Context Descriptor
+ * Tells the device where the headers of the frames that follow are, for
+ * checksum offload and TCP segmentation.
+ */
+typedef struct PACKED {
+    uint8_t  ipcss;             /* IP checksum start */
+    uint8_t  ipcso;             /* IP checksum offset */
+    uint16_t ipcse;             /* IP checksum end (inclusive) */
+    uint8_t  tucss;             /* TCP/UDP checksum start */
+    uint8_t  tucso;             /* TCP/UDP checksum offset */
+    uint16_t tucse;             /* TCP/UDP checksum end, 0 for end of frame */
+    uint32_t cmd_and_length;    /* PAYLEN (19:0), DTYP (23:20), TUCMD (31:24) */
+    uint8_t  status;            /* Descriptor status */
+    uint8_t  hdr_len;           /* Header bytes copied into each segment (TSO) */
+    uint16_t mss;               /* Segment payload size (TSO) */
+} e1000_context_desc_t;
+
+/**
+ * Transmit Data Descriptor (extended format, follows a context descriptor)
+ */
+typedef struct PACKED {
+    uint64_t buffer_addr;       /* Physical address of transmit buffer */
+    uint32_t cmd_and_length;    /* DTALEN (19:0), DTYP (23:20), DCMD (31:24) */
+    uint8_t  status;            /* Descriptor status */
+    uint8_t  popts;             /* Packet options */
+    uint16_t special;           /* VLAN tag */
+} e1000_data_desc_t;
+
+/* Extended descriptor types and command bits (TUCMD/DCMD, shifted by 24) */
+#define E1000_TXD_DTYP_CTX      (0x0 << 20) /* Context descriptor */
+#define E1000_TXD_DTYP_DATA     (0x1 << 20) /* Data descriptor */
+#define E1000_TXD_CMD(bits)     ((uint32_t)(bits) << 24)
+#define E1000_TXD_CMD_TCP       BIT(0)      /* Context: TCP (otherwise UDP) */
+#define E1000_TXD_CMD_IP        BIT(1)      /* Context: IPv4 */
+#define E1000_TXD_CMD_TSE       BIT(2)      /* TCP segmentation enable */
+
+/* Data descriptor packet options */
+#define E1000_TXD_POPTS_IXSM    BIT(0)      /* Insert IP checksum */
+#define E1000_TXD_POPTS_TXSM    BIT(1)      /* Insert TCP/UDP checksum */
+
 /**
  * e1000 device state structure
  */
 typedef struct {
     /* PCI information */
-    uint8_t  pci_bus;           /* PCI bus number */
-    uint8_t  pci_device;        /* PCI device number */
-    uint8_t  pci_function;      /* PCI function number */
+    pci_device_t *pci_dev;      /* PCI function */
     uint8_t  irq;               /* Interrupt line */
+    int      vector;            /* MSI vector, or -1 on the legacy line */
 
     /* MMIO access */
     virtaddr_t mmio_base;       /* MMIO base virtual address */
@@ -246,8 +294,8 @@ typedef struct {
     /* Receive ring */
     e1000_rx_desc_t *rx_descs;  /* RX descriptor ring */
     physaddr_t rx_descs_phys;   /* Physical address of RX descriptors */
-    void     *rx_buffers[E1000_NUM_RX_DESC];  /* RX buffer pointers */
-    physaddr_t rx_buffers_phys[E1000_NUM_RX_DESC]; /* Physical addresses */
+    netbuf_t  *rx_bufs[E1000_NUM_RX_DESC];  /* Buffer behind each RX descriptor */
+    netbuf_pool_t rx_pool;      /* Where RX buffers come from and return to */
     uint32_t   rx_cur;          /* Current RX descriptor index */
 
     /* Transmit ring */
@@ -255,7 +303,10 @@ typedef struct {
     physaddr_t tx_descs_phys;   /* Physical address of TX descriptors */
     void     *tx_buffers[E1000_NUM_TX_DESC];  /* TX buffer pointers */
     physaddr_t tx_buffers_phys[E1000_NUM_TX_DESC]; /* Physical addresses */
+    netbuf_t  *tx_netbufs[E1000_NUM_TX_DESC];  /* Chain ending at each descriptor */
     uint32_t   tx_cur;          /* Current TX descriptor index */
+    uint32_t   tx_clean;        /* Oldest descriptor not yet reclaimed */
+    volatile int tx_lock;       /* Taken with interrupts off */
 
     /* Statistics */
     uint64_t   packets_sent;    /* Total packets sent */
@@ -263,6 +314,19 @@ typedef struct {
     uint64_t   bytes_sent;      /* Total bytes sent */
     uint64_t   bytes_received;  /* Total bytes received */
     uint64_t   errors;          /* Total errors */
+    uint64_t   tx_busy;         /* Sends refused because the TX ring was full */
+    uint64_t   rx_dropped;      /* Frames dropped because the RX pool was empty */
+    uint64_t   rx_interrupts;   /* RX interrupts taken */
+    uint64_t   rx_polls;        /* Poll passes over the ring */
+    uint64_t   rx_budget_hits;  /* Passes that used up the budget */
+
+    /* Polled receive */
+    e1000_rx_handler_t rx_handler;  /* Set while the poller runs */
+    volatile uint32_t rx_event; /* Bumped by the RX interrupt (wait queue word) */
+    volatile uint32_t icr_pending;  /* Causes read by the interrupt, for the softirq */
+
+    /* Stack interface (one TX and one RX queue) */
+    netdev_t   netdev;
 
     /* State flags */
     bool       initialized;     /* Driver initialized flag */
@@ -287,8 +351,25 @@ bool e1000_init(void);
  */
 ssize_t e1000_send_packet(const void *data, size_t len);
 
+/**
+ * Send a frame held in a netbuf chain without copying it
+ * Each buffer in the chain (linked through next) becomes one TX
+ * descriptor pointing at its data, so headers pushed into the headroom of
+ * the first buffer and payload in the following ones go out as one frame.
+ * The NETBUF_FLAG_CSUM_* and NETBUF_FLAG_TSO flags of the first buffer
+ * ask for checksum offload and segmentation of an IPv4 TCP/UDP frame;
+ * its Ethernet, IP and TCP/UDP headers must all be in that buffer.
+ * On success the driver owns the chain and frees it once the device has
+ * sent it; on failure the caller still owns it.
+ *
+ * @param buf First buffer of the frame
+ * @return Number of bytes queued, or -1 on error or if the ring is full
+ */
+ssize_t e1000_send_netbuf(netbuf_t *buf);
+
 /**
  * Receive a network packet
+ * Copies the frame; e1000_receive_buf avoids that.
  *
  * @param buf Buffer to store received packet
  * @param max_len Maximum buffer size
@@ -296,6 +377,31 @@ ssize_t e1000_send_packet(const void *data, size_t len);
  */
 ssize_t e1000_receive_packet(void *buf, size_t max_len);
 
+/**
+ * Receive a network packet without copying it
+ * Returns the buffer the device wrote the frame into and refills its
+ * descriptor from the RX pool. If the pool is empty the frame is dropped
+ * and its buffer stays in the ring.
+ *
+ * @return Buffer holding the frame (the caller frees it with netbuf_free),
+ *         or NULL if no packet is available
+ */
+netbuf_t *e1000_receive_buf(void);
+
+/**
+ * Move receive into a polling thread with interrupt mitigation
+ * An RX interrupt masks further RX interrupts and wakes the poller, which
+ * passes up to E1000_POLL_BUDGET frames to handler, then yields and goes
+ * on while the ring has frames. Once the ring is empty it unmasks RX
+ * interrupts and sleeps. ITR and the RX delay timers are programmed so a
+ * busy link raises a bounded number of interrupts.
+ * The e1000_receive_* calls must not be used once this has started.
+ *
+ * @param handler Receives each frame, in the poller thread
+ * @return true if the poller was started
+ */
+bool e1000_start_polling(e1000_rx_handler_t handler);
+
 /**
  * Get the MAC address of the e1000 device
  *
@@ -305,7 +411,8 @@ void e1000_get_mac(uint8_t mac[6]);
 
 /**
  * e1000 interrupt handler
- * Called when the e1000 generates an interrupt (packet received, etc.)
+ * Called when the e1000 generates an interrupt (packet received, etc.);
+ * it reads the causes and handles them from the NET_RX softirq.
  *
  * @param frame Interrupt frame
  */
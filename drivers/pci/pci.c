@@ -1,14 +1,23 @@
 /**
  * AAAos Kernel - PCI Bus Driver Implementation
  *
- * Implements PCI bus enumeration using Configuration Mechanism #1.
- * This uses I/O ports 0xCF8 (CONFIG_ADDRESS) and 0xCFC (CONFIG_DATA)
- * to access the PCI configuration space.
+ * Configuration space is reached through the ECAM window that ACPI's
+ * MCFG table describes, falling back to Configuration Mechanism #1
+ * (I/O ports 0xCF8 CONFIG_ADDRESS and 0xCFC CONFIG_DATA) without one.
+ * Enumeration walks from bus 0 through the bridges once at boot; the
+ * devices found are indexed by vendor/device ID and by class so that
+ * drivers can look them up without scanning.
  */
 
 #include "pci.h"
 #include "../../kernel/arch/x86_64/io.h"
+#include "../../kernel/arch/x86_64/acpi.h"
+#include "../../kernel/arch/x86_64/apic.h"
+#include "../../kernel/arch/x86_64/irq.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/init/initcall.h"
 
 /* ============================================================================
  * Private Data
@@ -20,6 +29,40 @@ static pci_device_t pci_devices[PCI_MAX_DEVICES];
 /* Number of detected devices */
 static uint32_t pci_device_count = 0;
 
+/* Source of each MSI vector, for moving it to another CPU */
+typedef struct pci_irq_owner {
+    pci_device_t* dev;
+    uint32_t index;
+} pci_irq_owner_t;
+
+static pci_irq_owner_t pci_irq_owners[IDT_MSI_COUNT];
+
+/* Hash buckets of each lookup index (power of 2) */
+#define PCI_INDEX_BUCKETS   64
+
+/*
+ * Lookup indexes. Each bucket chains device indices in enumeration
+ * order, so the *_next searches return devices in the order they did
+ * when they scanned the array; -1 ends a chain.
+ */
+static int16_t pci_id_head[PCI_INDEX_BUCKETS];
+static int16_t pci_id_tail[PCI_INDEX_BUCKETS];
+static int16_t pci_id_next[PCI_MAX_DEVICES];
+static int16_t pci_class_head[PCI_INDEX_BUCKETS];
+static int16_t pci_class_tail[PCI_INDEX_BUCKETS];
+static int16_t pci_class_next[PCI_MAX_DEVICES];
+
+/* ECAM window of segment 0, or NULL to use the configuration ports */
+static volatile uint8_t* pci_ecam = NULL;
+static uint8_t pci_ecam_start_bus = 0;
+static uint8_t pci_ecam_end_bus = 0;
+
+/* Serializes CONFIG_ADDRESS/CONFIG_DATA pairs (ECAM needs no lock) */
+static volatile int pci_port_lock = 0;
+
+/* Buses enumerated so far, one bit each */
+static uint32_t pci_bus_scanned[256 / 32];
+
 /* ============================================================================
  * Private Helper Functions
  * ============================================================================ */
@@ -38,6 +81,160 @@ static inline uint32_t pci_build_address(uint8_t bus, uint8_t device, uint8_t fu
     );
 }
 
+/**
+ * Kernel address of a configuration register in the ECAM window, or
+ * NULL if the bus is not in it
+ */
+static inline volatile uint8_t* pci_ecam_address(uint8_t bus, uint8_t device,
+                                                 uint8_t function, uint8_t offset) {
+    if (pci_ecam == NULL || bus < pci_ecam_start_bus || bus > pci_ecam_end_bus) {
+        return NULL;
+    }
+    return pci_ecam + (((uint64_t)(bus - pci_ecam_start_bus) << 20) |
+                       ((uint64_t)(device & 0x1F) << 15) |
+                       ((uint64_t)(function & 0x07) << 12) | offset);
+}
+
+/**
+ * Read the configuration dword holding offset through the ports
+ */
+static uint32_t pci_port_read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&pci_port_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+
+    outl(PCI_CONFIG_ADDRESS, pci_build_address(bus, device, function, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+
+    __sync_lock_release(&pci_port_lock);
+    interrupts_restore(flags);
+    return value;
+}
+
+/**
+ * Replace the bits in mask of the configuration dword holding offset
+ * through the ports (read-modify-write unless mask covers the dword)
+ */
+static void pci_port_write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset,
+                           uint32_t mask, uint32_t value) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&pci_port_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+
+    outl(PCI_CONFIG_ADDRESS, pci_build_address(bus, device, function, offset));
+    if (mask != 0xFFFFFFFF) {
+        value = (inl(PCI_CONFIG_DATA) & ~mask) | (value & mask);
+    }
+    outl(PCI_CONFIG_DATA, value);
+
+    __sync_lock_release(&pci_port_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Map segment 0's ECAM window if the MCFG table has one
+ */
+static void pci_ecam_init(void) {
+    const mcfg_t* mcfg = (const mcfg_t*)acpi_find_table(ACPI_MCFG_SIGNATURE);
+    if (mcfg == NULL || mcfg->header.length < sizeof(mcfg_t)) {
+        kprintf("[PCI] No MCFG table, using configuration ports\n");
+        return;
+    }
+
+    uint32_t count = (mcfg->header.length - sizeof(mcfg_t)) / sizeof(mcfg_allocation_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const mcfg_allocation_t* alloc = &mcfg->allocations[i];
+        if (alloc->segment != 0 || alloc->end_bus < alloc->start_bus) {
+            continue;
+        }
+
+        size_t pages = ((size_t)(alloc->end_bus - alloc->start_bus) + 1) << (20 - PAGE_SHIFT);
+        virtaddr_t virt = VMM_KERNEL_PHYS_MAP + alloc->base;
+        if (!vmm_map_pages(virt, alloc->base, pages, VMM_FLAGS_MMIO)) {
+            kprintf("[PCI] Cannot map ECAM window at 0x%llx\n", alloc->base);
+            return;
+        }
+
+        pci_ecam_start_bus = alloc->start_bus;
+        pci_ecam_end_bus = alloc->end_bus;
+        pci_ecam = (volatile uint8_t*)virt;
+        kprintf("[PCI] ECAM at 0x%llx, buses %02x-%02x\n",
+                alloc->base, alloc->start_bus, alloc->end_bus);
+        return;
+    }
+
+    kprintf("[PCI] MCFG has no segment 0 window, using configuration ports\n");
+}
+
+/**
+ * Bucket of a lookup key
+ */
+static inline uint32_t pci_index_hash(uint32_t key) {
+    return (key * 0x9E3779B1u) >> 26;
+}
+
+_Static_assert(PCI_INDEX_BUCKETS == 64, "pci_index_hash takes the top 6 bits");
+_Static_assert(PCI_MAX_DEVICES <= 32767, "device indices must fit the int16_t chains");
+
+static inline uint32_t pci_id_key(uint16_t vendor_id, uint16_t device_id) {
+    return ((uint32_t)vendor_id << 16) | device_id;
+}
+
+static inline uint32_t pci_class_key(uint8_t class_code, uint8_t subclass) {
+    return ((uint32_t)class_code << 8) | subclass;
+}
+
+/**
+ * Append device index i to a lookup chain
+ */
+static void pci_chain_append(int16_t* head, int16_t* tail, int16_t* next, uint32_t bucket,
+                             int16_t i) {
+    next[i] = -1;
+    if (tail[bucket] < 0) {
+        head[bucket] = i;
+    } else {
+        next[tail[bucket]] = i;
+    }
+    tail[bucket] = i;
+}
+
+/**
+ * Empty both lookup indexes
+ */
+static void pci_index_reset(void) {
+    for (int i = 0; i < PCI_INDEX_BUCKETS; i++) {
+        pci_id_head[i] = pci_id_tail[i] = -1;
+        pci_class_head[i] = pci_class_tail[i] = -1;
+    }
+}
+
+/**
+ * Add a newly enumerated device to the lookup indexes
+ */
+static void pci_index_add(uint32_t index) {
+    const pci_device_t* dev = &pci_devices[index];
+
+    pci_chain_append(pci_id_head, pci_id_tail, pci_id_next,
+                     pci_index_hash(pci_id_key(dev->vendor_id, dev->device_id)),
+                     (int16_t)index);
+    pci_chain_append(pci_class_head, pci_class_tail, pci_class_next,
+                     pci_index_hash(pci_class_key(dev->class_code, dev->subclass)),
+                     (int16_t)index);
+}
+
+/**
+ * Index of the device a *_next search continues after, or -1 to search
+ * from the start (start is NULL or not one of ours)
+ */
+static int pci_search_after(const pci_device_t* start) {
+    if (start == NULL || start < pci_devices || start >= pci_devices + pci_device_count) {
+        return -1;
+    }
+    return (int)(start - pci_devices);
+}
+
 /**
  * Check if a device exists at the given bus/device/function
  */
@@ -86,6 +283,8 @@ static void pci_read_device_info(pci_device_t* dev, uint8_t bus, uint8_t device,
     }
 }
 
+static void pci_scan_bus(uint8_t bus);
+
 /**
  * Scan a single PCI function
  */
@@ -102,6 +301,7 @@ static void pci_scan_function(uint8_t bus, uint8_t device, uint8_t function) {
     /* Read device info */
     pci_device_t* dev = &pci_devices[pci_device_count];
     pci_read_device_info(dev, bus, device, function);
+    pci_index_add(pci_device_count);
     pci_device_count++;
 
     /* If this is a PCI-to-PCI bridge, scan the secondary bus */
@@ -109,7 +309,7 @@ static void pci_scan_function(uint8_t bus, uint8_t device, uint8_t function) {
         uint8_t secondary_bus = pci_read_config8(bus, device, function, 0x19);
         kprintf("[PCI] Found PCI-to-PCI bridge at %02x:%02x.%x, secondary bus %02x\n",
                 bus, device, function, secondary_bus);
-        /* Note: We don't recursively scan here as the main enumeration will scan all buses */
+        pci_scan_bus(secondary_bus);
     }
 }
 
@@ -135,9 +335,15 @@ static void pci_scan_device(uint8_t bus, uint8_t device) {
 }
 
 /**
- * Scan a single PCI bus
+ * Scan a single PCI bus, once (bridges that loop back are ignored)
  */
 static void pci_scan_bus(uint8_t bus) {
+    uint32_t bit = 1u << (bus & 31);
+    if (pci_bus_scanned[bus / 32] & bit) {
+        return;
+    }
+    pci_bus_scanned[bus / 32] |= bit;
+
     for (uint8_t device = 0; device < 32; device++) {
         pci_scan_device(bus, device);
     }
@@ -148,53 +354,62 @@ static void pci_scan_bus(uint8_t bus) {
  * ============================================================================ */
 
 uint8_t pci_read_config8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset);
+    if (ecam) {
+        return *ecam;
+    }
     /* Read 32 bits and extract the correct byte */
-    uint32_t value = inl(PCI_CONFIG_DATA);
+    uint32_t value = pci_port_read(bus, device, function, offset);
     return (uint8_t)((value >> ((offset & 3) * 8)) & 0xFF);
 }
 
 uint16_t pci_read_config16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset & ~1);
+    if (ecam) {
+        return *(volatile uint16_t*)ecam;
+    }
     /* Read 32 bits and extract the correct word */
-    uint32_t value = inl(PCI_CONFIG_DATA);
+    uint32_t value = pci_port_read(bus, device, function, offset);
     return (uint16_t)((value >> ((offset & 2) * 8)) & 0xFFFF);
 }
 
 uint32_t pci_read_config32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
-    return inl(PCI_CONFIG_DATA);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset & ~3);
+    if (ecam) {
+        return *(volatile uint32_t*)ecam;
+    }
+    return pci_port_read(bus, device, function, offset);
 }
 
 void pci_write_config8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint8_t value) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset);
+    if (ecam) {
+        *ecam = value;
+        return;
+    }
     /* Read-modify-write to preserve other bytes */
-    uint32_t old_value = inl(PCI_CONFIG_DATA);
     int shift = (offset & 3) * 8;
-    old_value &= ~(0xFF << shift);
-    old_value |= ((uint32_t)value << shift);
-    outl(PCI_CONFIG_DATA, old_value);
+    pci_port_write(bus, device, function, offset, 0xFFu << shift, (uint32_t)value << shift);
 }
 
 void pci_write_config16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint16_t value) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset & ~1);
+    if (ecam) {
+        *(volatile uint16_t*)ecam = value;
+        return;
+    }
     /* Read-modify-write to preserve other bytes */
-    uint32_t old_value = inl(PCI_CONFIG_DATA);
     int shift = (offset & 2) * 8;
-    old_value &= ~(0xFFFF << shift);
-    old_value |= ((uint32_t)value << shift);
-    outl(PCI_CONFIG_DATA, old_value);
+    pci_port_write(bus, device, function, offset, 0xFFFFu << shift, (uint32_t)value << shift);
 }
 
 void pci_write_config32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
-    uint32_t address = pci_build_address(bus, device, function, offset);
-    outl(PCI_CONFIG_ADDRESS, address);
-    outl(PCI_CONFIG_DATA, value);
+    volatile uint8_t* ecam = pci_ecam_address(bus, device, function, offset & ~3);
+    if (ecam) {
+        *(volatile uint32_t*)ecam = value;
+        return;
+    }
+    pci_port_write(bus, device, function, offset, 0xFFFFFFFF, value);
 }
 
 /* ============================================================================
@@ -204,8 +419,14 @@ void pci_write_config32(uint8_t bus, uint8_t device, uint8_t function, uint8_t o
 void pci_init(void) {
     kprintf("[PCI] Initializing PCI bus driver...\n");
 
-    /* Reset device count */
+    /* Reset device count and indexes */
     pci_device_count = 0;
+    pci_index_reset();
+    for (int i = 0; i < 256 / 32; i++) {
+        pci_bus_scanned[i] = 0;
+    }
+
+    pci_ecam_init();
 
     /* Check if PCI is available by reading host bridge */
     uint16_t vendor = pci_read_config16(0, 0, 0, PCI_VENDOR_ID);
@@ -220,23 +441,17 @@ void pci_init(void) {
     uint8_t header_type = pci_read_config8(0, 0, 0, PCI_HEADER_TYPE);
 
     if ((header_type & PCI_HEADER_MULTIFUNCTION) == 0) {
-        /* Single PCI host controller - scan bus 0 only for direct devices,
-         * but scan all possible buses for devices behind bridges */
-        kprintf("[PCI] Single PCI host controller, scanning all buses...\n");
-        for (int bus = 0; bus < 256; bus++) {
-            pci_scan_bus((uint8_t)bus);
-        }
+        /* Single PCI host controller: bus 0, and the buses behind its bridges */
+        kprintf("[PCI] Single PCI host controller\n");
+        pci_scan_bus(0);
     } else {
-        /* Multiple PCI host controllers */
+        /* Multiple PCI host controllers: function N decodes bus N */
         kprintf("[PCI] Multiple PCI host controllers detected\n");
         for (uint8_t function = 0; function < 8; function++) {
             if (!pci_device_exists(0, 0, function)) {
                 break;
             }
-            /* Each function represents a different PCI domain, scan all buses */
-            for (int bus = 0; bus < 256; bus++) {
-                pci_scan_bus((uint8_t)bus);
-            }
+            pci_scan_bus(function);
         }
     }
 
@@ -246,6 +461,15 @@ void pci_init(void) {
     pci_print_all_devices();
 }
 
+/**
+ * Boot initcall: enumerate the buses
+ */
+static bool pci_initcall(void) {
+    pci_init();
+    return true;
+}
+INITCALL(pci, pci_initcall, 0);
+
 uint32_t pci_get_device_count(void) {
     return pci_device_count;
 }
@@ -266,20 +490,16 @@ pci_device_t* pci_find_device(uint16_t vendor_id, uint16_t device_id) {
 }
 
 pci_device_t* pci_find_device_next(uint16_t vendor_id, uint16_t device_id, pci_device_t* start) {
-    uint32_t start_index = 0;
-
-    if (start != NULL) {
-        /* Find the index of the start device */
-        for (uint32_t i = 0; i < pci_device_count; i++) {
-            if (&pci_devices[i] == start) {
-                start_index = i + 1;
-                break;
-            }
-        }
+    if (pci_device_count == 0) {
+        return NULL;  /* Not enumerated: the indexes are not set up */
     }
 
-    for (uint32_t i = start_index; i < pci_device_count; i++) {
-        if (pci_devices[i].vendor_id == vendor_id &&
+    int after = pci_search_after(start);
+    uint32_t bucket = pci_index_hash(pci_id_key(vendor_id, device_id));
+
+    for (int i = pci_id_head[bucket]; i >= 0; i = pci_id_next[i]) {
+        if (i > after &&
+            pci_devices[i].vendor_id == vendor_id &&
             pci_devices[i].device_id == device_id) {
             return &pci_devices[i];
         }
@@ -293,20 +513,16 @@ pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass) {
 }
 
 pci_device_t* pci_find_class_next(uint8_t class_code, uint8_t subclass, pci_device_t* start) {
-    uint32_t start_index = 0;
-
-    if (start != NULL) {
-        /* Find the index of the start device */
-        for (uint32_t i = 0; i < pci_device_count; i++) {
-            if (&pci_devices[i] == start) {
-                start_index = i + 1;
-                break;
-            }
-        }
+    if (pci_device_count == 0) {
+        return NULL;  /* Not enumerated: the indexes are not set up */
     }
 
-    for (uint32_t i = start_index; i < pci_device_count; i++) {
-        if (pci_devices[i].class_code == class_code &&
+    int after = pci_search_after(start);
+    uint32_t bucket = pci_index_hash(pci_class_key(class_code, subclass));
+
+    for (int i = pci_class_head[bucket]; i >= 0; i = pci_class_next[i]) {
+        if (i > after &&
+            pci_devices[i].class_code == class_code &&
             pci_devices[i].subclass == subclass) {
             return &pci_devices[i];
         }
@@ -496,6 +712,246 @@ void pci_disable_interrupts(pci_device_t* dev) {
             dev->bus, dev->device, dev->function);
 }
 
+uint8_t pci_find_capability(pci_device_t* dev, uint8_t id) {
+    if (dev == NULL) {
+        return 0;
+    }
+
+    uint16_t status = pci_read_config16(dev->bus, dev->device, dev->function, PCI_STATUS);
+    if (!(status & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    /* The list lives above the header; the bound stops a looping chain */
+    uint8_t offset = pci_read_config8(dev->bus, dev->device, dev->function, PCI_CAPABILITIES);
+    for (int i = 0; i < 48 && offset >= 0x40; i++) {
+        offset &= ~3;
+        uint8_t cap = pci_read_config8(dev->bus, dev->device, dev->function, offset);
+        if (cap == id) {
+            return offset;
+        }
+        offset = pci_read_config8(dev->bus, dev->device, dev->function, offset + 1);
+    }
+    return 0;
+}
+
+bool pci_enable_msi(pci_device_t* dev, uint8_t vector, uint8_t apic_id) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    if (cap == 0) {
+        return false;
+    }
+
+    uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                         cap + PCI_MSI_CONTROL);
+    uint32_t address = PCI_MSI_ADDRESS_BASE | ((uint32_t)apic_id << 12);
+
+    pci_write_config32(dev->bus, dev->device, dev->function, cap + PCI_MSI_ADDRESS_LO, address);
+    if (control & PCI_MSI_CTRL_64BIT) {
+        pci_write_config32(dev->bus, dev->device, dev->function, cap + PCI_MSI_ADDRESS_HI, 0);
+        pci_write_config16(dev->bus, dev->device, dev->function, cap + PCI_MSI_DATA_64, vector);
+    } else {
+        pci_write_config16(dev->bus, dev->device, dev->function, cap + PCI_MSI_DATA_32, vector);
+    }
+
+    /* One message only, then switch over from INTx */
+    control &= ~PCI_MSI_CTRL_MME_MASK;
+    control |= PCI_MSI_CTRL_ENABLE;
+    pci_write_config16(dev->bus, dev->device, dev->function, cap + PCI_MSI_CONTROL, control);
+
+    uint16_t command = pci_read_config16(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    command |= PCI_CMD_INT_DISABLE;
+    pci_write_config16(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+
+    kprintf("[PCI] Enabled MSI for %02x:%02x.%x (vector %u, APIC %u)\n",
+            dev->bus, dev->device, dev->function, vector, apic_id);
+    return true;
+}
+
+int pci_msix_table_size(pci_device_t* dev) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    if (cap == 0) {
+        return 0;
+    }
+
+    uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                         cap + PCI_MSIX_CONTROL);
+    return (control & PCI_MSIX_CTRL_SIZE_MASK) + 1;
+}
+
+/**
+ * Kernel address of an MSI-X table entry, or NULL
+ */
+static volatile uint32_t* pci_msix_entry(pci_device_t* dev, uint32_t entry) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    if (cap == 0) {
+        return NULL;
+    }
+
+    uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                         cap + PCI_MSIX_CONTROL);
+    if (entry > (uint32_t)(control & PCI_MSIX_CTRL_SIZE_MASK)) {
+        return NULL;
+    }
+
+    uint32_t table = pci_read_config32(dev->bus, dev->device, dev->function,
+                                       cap + PCI_MSIX_TABLE);
+    uint64_t bar = pci_get_bar(dev, table & PCI_MSIX_TABLE_BIR_MASK);
+    if (bar == 0) {
+        return NULL;
+    }
+
+    uint64_t offset = (table & ~(uint32_t)PCI_MSIX_TABLE_BIR_MASK) +
+                      (uint64_t)entry * PCI_MSIX_ENTRY_SIZE;
+    return (volatile uint32_t*)(VMM_KERNEL_PHYS_MAP + bar + offset);
+}
+
+bool pci_msix_set(pci_device_t* dev, uint32_t entry, uint8_t vector, uint8_t apic_id) {
+    volatile uint32_t* e = pci_msix_entry(dev, entry);
+    if (!e) {
+        return false;
+    }
+
+    /* Masked while the message changes, as the specification asks */
+    e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_MASKED;
+    e[PCI_MSIX_ENTRY_ADDR_LO / 4] = PCI_MSI_ADDRESS_BASE | ((uint32_t)apic_id << 12);
+    e[PCI_MSIX_ENTRY_ADDR_HI / 4] = 0;
+    e[PCI_MSIX_ENTRY_DATA / 4] = vector;
+    e[PCI_MSIX_ENTRY_CTRL / 4] &= ~(uint32_t)PCI_MSIX_ENTRY_MASKED;
+    return true;
+}
+
+bool pci_msix_enable(pci_device_t* dev) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    if (cap == 0) {
+        return false;
+    }
+
+    uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                         cap + PCI_MSIX_CONTROL);
+    control &= ~PCI_MSIX_CTRL_MASKALL;
+    control |= PCI_MSIX_CTRL_ENABLE;
+    pci_write_config16(dev->bus, dev->device, dev->function, cap + PCI_MSIX_CONTROL, control);
+
+    uint16_t command = pci_read_config16(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    command |= PCI_CMD_INT_DISABLE;
+    pci_write_config16(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+
+    kprintf("[PCI] Enabled MSI-X for %02x:%02x.%x (%u entries)\n",
+            dev->bus, dev->device, dev->function,
+            (control & PCI_MSIX_CTRL_SIZE_MASK) + 1);
+    return true;
+}
+
+uint32_t pci_irq_vector_count(pci_device_t* dev) {
+    int entries = pci_msix_table_size(dev);
+    if (entries > 0) {
+        return (uint32_t)entries;
+    }
+    return pci_find_capability(dev, PCI_CAP_ID_MSI) != 0 ? 1 : 0;
+}
+
+/**
+ * Point a vector's message at another CPU (irq_retarget_fn_t)
+ */
+static bool pci_irq_retarget(void* arg, uint32_t cpu) {
+    pci_irq_owner_t* owner = arg;
+    percpu_t* target = percpu_get(cpu);
+    if (target == NULL || owner->dev == NULL) {
+        return false;
+    }
+
+    pci_device_t* dev = owner->dev;
+    volatile uint32_t* e = pci_msix_entry(dev, owner->index);
+    if (e) {
+        uint8_t vector = (uint8_t)e[PCI_MSIX_ENTRY_DATA / 4];
+        return pci_msix_set(dev, owner->index, vector, (uint8_t)target->apic_id);
+    }
+
+    /* MSI: the destination is all in the low address word */
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    if (cap == 0) {
+        return false;
+    }
+    pci_write_config32(dev->bus, dev->device, dev->function, cap + PCI_MSI_ADDRESS_LO,
+                       PCI_MSI_ADDRESS_BASE | ((uint32_t)target->apic_id << 12));
+    return true;
+}
+
+int pci_irq_alloc(pci_device_t* dev, uint32_t index, uint32_t cpu, interrupt_handler_t handler) {
+    if (dev == NULL || handler == NULL || !apic_get_info()->enabled) {
+        return -1;
+    }
+
+    percpu_t* target = percpu_get(cpu);
+    if (target == NULL) {
+        return -1;
+    }
+
+    /* MSI-X when the device has it; plain MSI has the one message */
+    uint8_t msix_cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    if (msix_cap == 0 && (index != 0 || pci_find_capability(dev, PCI_CAP_ID_MSI) == 0)) {
+        return -1;
+    }
+
+    int vector = idt_alloc_vector(handler);
+    if (vector < 0) {
+        kprintf("[PCI] Out of MSI vectors for %02x:%02x.%x\n",
+                dev->bus, dev->device, dev->function);
+        return -1;
+    }
+
+    uint8_t apic_id = (uint8_t)target->apic_id;
+    bool ok;
+    if (msix_cap != 0) {
+        uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                             msix_cap + PCI_MSIX_CONTROL);
+        ok = pci_msix_set(dev, index, (uint8_t)vector, apic_id) &&
+             ((control & PCI_MSIX_CTRL_ENABLE) || pci_msix_enable(dev));
+    } else {
+        ok = pci_enable_msi(dev, (uint8_t)vector, apic_id);
+    }
+
+    if (!ok) {
+        idt_free_vector(vector);
+        return -1;
+    }
+
+    /* Network and storage queues are the ones worth balancing */
+    pci_irq_owner_t* owner = &pci_irq_owners[vector - IDT_MSI_BASE];
+    owner->dev = dev;
+    owner->index = index;
+    irq_set_target(vector, cpu, pci_irq_retarget, owner,
+                   dev->class_code == PCI_CLASS_NETWORK || dev->class_code == PCI_CLASS_STORAGE);
+    return vector;
+}
+
+void pci_irq_free(pci_device_t* dev, uint32_t index, int vector) {
+    if (dev == NULL || vector < 0) {
+        return;
+    }
+
+    irq_clear_target(vector);
+    if (vector >= IDT_MSI_BASE && vector < IDT_MSI_BASE + IDT_MSI_COUNT) {
+        pci_irq_owners[vector - IDT_MSI_BASE].dev = NULL;
+    }
+
+    /* Silence the source before its vector can be handed out again */
+    volatile uint32_t* e = pci_msix_entry(dev, index);
+    if (e) {
+        e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_MASKED;
+    } else {
+        uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+        if (cap != 0) {
+            uint16_t control = pci_read_config16(dev->bus, dev->device, dev->function,
+                                                 cap + PCI_MSI_CONTROL);
+            pci_write_config16(dev->bus, dev->device, dev->function, cap + PCI_MSI_CONTROL,
+                               control & ~PCI_MSI_CTRL_ENABLE);
+        }
+    }
+
+    idt_free_vector(vector);
+}
+
 /* ============================================================================
  * Debug/Utility Functions
  * ============================================================================ */
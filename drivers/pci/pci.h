@@ -1,15 +1,17 @@
 /**
  * AAAos Kernel - PCI Bus Driver
  *
- * Provides PCI bus enumeration and configuration space access.
- * Implements standard PCI configuration mechanism using I/O ports
- * 0xCF8 (CONFIG_ADDRESS) and 0xCFC (CONFIG_DATA).
+ * Provides PCI bus enumeration and configuration space access, through
+ * the PCI Express ECAM window (ACPI MCFG) or, without one, the standard
+ * configuration mechanism using I/O ports 0xCF8 (CONFIG_ADDRESS) and
+ * 0xCFC (CONFIG_DATA). Also hands out MSI/MSI-X vectors to drivers.
  */
 
 #ifndef _AAAOS_PCI_H
 #define _AAAOS_PCI_H
 
 #include "../../kernel/include/types.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
 
 /* PCI Configuration Space I/O Ports */
 #define PCI_CONFIG_ADDRESS  0xCF8
@@ -56,6 +58,46 @@
 #define PCI_CMD_FAST_BTB        (1 << 9)    /* Fast back-to-back enable */
 #define PCI_CMD_INT_DISABLE     (1 << 10)   /* Interrupt disable */
 
+/* PCI Status Register Bits */
+#define PCI_STATUS_CAP_LIST     (1 << 4)    /* Capability list present */
+
+/* PCI Capability IDs */
+#define PCI_CAP_ID_MSI          0x05        /* Message Signalled Interrupts */
+#define PCI_CAP_ID_MSIX         0x11        /* MSI-X */
+
+/* MSI Capability Registers (offsets from the capability) */
+#define PCI_MSI_CONTROL         0x02        /* 16-bit */
+#define PCI_MSI_ADDRESS_LO      0x04        /* 32-bit */
+#define PCI_MSI_ADDRESS_HI      0x08        /* 32-bit, 64-bit capable only */
+#define PCI_MSI_DATA_32         0x08        /* 16-bit */
+#define PCI_MSI_DATA_64         0x0C        /* 16-bit */
+
+/* MSI Message Control Bits */
+#define PCI_MSI_CTRL_ENABLE     (1 << 0)    /* MSI enable */
+#define PCI_MSI_CTRL_MME_MASK   (7 << 4)    /* Multiple message enable */
+#define PCI_MSI_CTRL_64BIT      (1 << 7)    /* 64-bit address capable */
+
+/* x86 MSI address: fixed delivery to one local APIC */
+#define PCI_MSI_ADDRESS_BASE    0xFEE00000
+
+/* MSI-X Capability Registers (offsets from the capability) */
+#define PCI_MSIX_CONTROL        0x02        /* 16-bit */
+#define PCI_MSIX_TABLE          0x04        /* 32-bit: offset | BAR indicator */
+
+/* MSI-X Message Control Bits */
+#define PCI_MSIX_CTRL_SIZE_MASK 0x07FF      /* Table size - 1 */
+#define PCI_MSIX_CTRL_MASKALL   (1 << 14)   /* Function mask */
+#define PCI_MSIX_CTRL_ENABLE    (1 << 15)   /* MSI-X enable */
+#define PCI_MSIX_TABLE_BIR_MASK 0x07
+
+/* MSI-X table entry (16 bytes each, in the BAR memory) */
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_ADDR_LO  0x00
+#define PCI_MSIX_ENTRY_ADDR_HI  0x04
+#define PCI_MSIX_ENTRY_DATA     0x08
+#define PCI_MSIX_ENTRY_CTRL     0x0C
+#define PCI_MSIX_ENTRY_MASKED   (1 << 0)
+
 /* PCI Header Type bits */
 #define PCI_HEADER_TYPE_MASK    0x7F
 #define PCI_HEADER_TYPE_NORMAL  0x00
@@ -376,6 +418,81 @@ void pci_enable_interrupts(pci_device_t* dev);
  */
 void pci_disable_interrupts(pci_device_t* dev);
 
+/**
+ * Find a capability in a device's capability list
+ * @param dev   Pointer to PCI device
+ * @param id    Capability ID (PCI_CAP_ID_*)
+ * @return Configuration space offset of the capability, or 0 if absent
+ */
+uint8_t pci_find_capability(pci_device_t* dev, uint8_t id);
+
+/**
+ * Deliver a device's interrupts as a single MSI message
+ * Edge-triggered, fixed delivery of vector to one local APIC. Legacy
+ * INTx is disabled while MSI is on.
+ * @param dev     Pointer to PCI device
+ * @param vector  IDT vector to raise
+ * @param apic_id Local APIC ID of the target CPU
+ * @return true on success, false if the device has no MSI capability
+ */
+bool pci_enable_msi(pci_device_t* dev, uint8_t vector, uint8_t apic_id);
+
+/**
+ * Number of MSI-X table entries of a device
+ * @param dev   Pointer to PCI device
+ * @return Table size, or 0 if the device has no MSI-X capability
+ */
+int pci_msix_table_size(pci_device_t* dev);
+
+/**
+ * Program and unmask one MSI-X table entry
+ * Entries left alone stay masked, so a driver sets up only the ones it
+ * uses before pci_msix_enable.
+ * @param dev     Pointer to PCI device
+ * @param entry   Table entry index
+ * @param vector  IDT vector to raise
+ * @param apic_id Local APIC ID of the target CPU
+ * @return true on success, false if there is no such entry
+ */
+bool pci_msix_set(pci_device_t* dev, uint32_t entry, uint8_t vector, uint8_t apic_id);
+
+/**
+ * Deliver a device's interrupts through its MSI-X table
+ * INTx is disabled while MSI-X is on.
+ * @param dev   Pointer to PCI device
+ * @return true on success, false if the device has no MSI-X capability
+ */
+bool pci_msix_enable(pci_device_t* dev);
+
+/**
+ * Number of interrupt vectors a device can be given with pci_irq_alloc
+ * @param dev   Pointer to PCI device
+ * @return MSI-X table size, 1 for MSI only, 0 for legacy INTx only
+ */
+uint32_t pci_irq_vector_count(pci_device_t* dev);
+
+/**
+ * Give a device interrupt its own vector, delivered to one CPU
+ * Takes a free MSI vector for handler and points MSI-X table entry
+ * index at the local APIC of cpu, turning MSI-X on with the first
+ * entry; a device with only MSI has the one message, index 0. The
+ * dispatcher sends the local APIC EOI, so handlers must not.
+ * @param dev     Pointer to PCI device
+ * @param index   MSI-X table entry (0 for MSI)
+ * @param cpu     CPU number (percpu_get) to interrupt
+ * @param handler Function to call when the interrupt occurs
+ * @return The vector, or -1 (no local APIC, no MSI/MSI-X, no free vector)
+ */
+int pci_irq_alloc(pci_device_t* dev, uint32_t index, uint32_t cpu, interrupt_handler_t handler);
+
+/**
+ * Mask an interrupt set up by pci_irq_alloc and give back its vector
+ * @param dev     Pointer to PCI device
+ * @param index   MSI-X table entry (0 for MSI)
+ * @param vector  Vector pci_irq_alloc returned
+ */
+void pci_irq_free(pci_device_t* dev, uint32_t index, int vector);
+
 /* ============================================================================
  * Debug/Utility Functions
  * ============================================================================ */
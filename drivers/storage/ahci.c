@@ -7,9 +7,18 @@
 
 #include "ahci.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/log/log.h"
 #include "../../kernel/mm/pmm.h"
 #include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/vmalloc.h"
 #include "../../kernel/arch/x86_64/io.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/softirq.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../kernel/init/initcall.h"
+#include "../../lib/libc/string.h"
 
 /* Maximum number of AHCI controllers supported */
 #define AHCI_MAX_CONTROLLERS    4
@@ -18,11 +27,22 @@
 #define AHCI_CMD_TIMEOUT        5000
 #define AHCI_SPIN_TIMEOUT       1000000
 
+/* Largest block layer command: every segment then fits one PRD entry */
+#define AHCI_BLK_MAX_SECTORS    (0x400000 / AHCI_SECTOR_SIZE)
+
+/* Pages of a buffer outside the physical map translated per command */
+#define AHCI_PAGE_BATCH         128
+
+/* Largest PRD entry (DBC is 22 bits, 0-based) */
+#define AHCI_PRD_MAX_BYTES      0x400000
+
 /* Memory allocation sizes */
 #define AHCI_CMD_LIST_SIZE      (sizeof(ahci_cmd_header_t) * AHCI_MAX_CMD_SLOTS)  /* 1KB */
 #define AHCI_FIS_SIZE           256
 #define AHCI_CMD_TABLE_SIZE     (sizeof(ahci_cmd_table_t) + sizeof(ahci_prdt_entry_t) * AHCI_MAX_PRDT_ENTRIES)
 
+_Static_assert(AHCI_CMD_TABLE_SIZE <= PAGE_SIZE, "command table must fit its page");
+
 /* Global state */
 static ahci_controller_t ahci_controllers[AHCI_MAX_CONTROLLERS];
 static int ahci_controller_count = 0;
@@ -31,27 +51,6 @@ static int ahci_controller_count = 0;
  * Helper Functions
  * ============================================================================ */
 
-/**
- * Simple memory set
- */
-static void ahci_memset(void* dest, uint8_t val, size_t size) {
-    uint8_t* d = (uint8_t*)dest;
-    for (size_t i = 0; i < size; i++) {
-        d[i] = val;
-    }
-}
-
-/**
- * Simple memory copy
- */
-static void ahci_memcpy(void* dest, const void* src, size_t size) {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
-    for (size_t i = 0; i < size; i++) {
-        d[i] = s[i];
-    }
-}
-
 /**
  * Simple delay loop (approximately microseconds)
  */
@@ -200,7 +199,7 @@ static int ahci_port_alloc_memory(ahci_controller_t* ctrl, int port) {
     /* Map to virtual address - using direct physical mapping */
     virtaddr_t cmd_list_virt = VMM_KERNEL_PHYS_MAP + cmd_list_phys;
     info->cmd_list = (ahci_cmd_header_t*)cmd_list_virt;
-    ahci_memset(info->cmd_list, 0, PAGE_SIZE);
+    memset(info->cmd_list, 0, PAGE_SIZE);
 
     /* Set CLB (Command List Base) */
     pt->clb = (uint32_t)(cmd_list_phys & 0xFFFFFFFF);
@@ -216,7 +215,7 @@ static int ahci_port_alloc_memory(ahci_controller_t* ctrl, int port) {
 
     virtaddr_t fis_virt = VMM_KERNEL_PHYS_MAP + fis_phys;
     info->fis_area = (ahci_fis_t*)fis_virt;
-    ahci_memset(info->fis_area, 0, PAGE_SIZE);
+    memset(info->fis_area, 0, PAGE_SIZE);
 
     /* Set FB (FIS Base) */
     pt->fb = (uint32_t)(fis_phys & 0xFFFFFFFF);
@@ -239,13 +238,17 @@ static int ahci_port_alloc_memory(ahci_controller_t* ctrl, int port) {
 
         virtaddr_t ct_virt = VMM_KERNEL_PHYS_MAP + ct_phys;
         info->cmd_tables[i] = (ahci_cmd_table_t*)ct_virt;
-        ahci_memset(info->cmd_tables[i], 0, PAGE_SIZE);
+        memset(info->cmd_tables[i], 0, PAGE_SIZE);
 
         /* Set up command header to point to this table */
         info->cmd_list[i].ctba = (uint32_t)(ct_phys & 0xFFFFFFFF);
         info->cmd_list[i].ctbau = (uint32_t)(ct_phys >> 32);
     }
 
+    /* Until IDENTIFY says otherwise, one non-queued command per slot */
+    info->ncq = false;
+    info->queue_depth = ctrl->num_cmd_slots;
+
     /* Clear interrupt status and error */
     pt->serr = (uint32_t)-1;    /* Clear all error bits */
     pt->is = (uint32_t)-1;      /* Clear all interrupt status bits */
@@ -260,94 +263,273 @@ static int ahci_port_alloc_memory(ahci_controller_t* ctrl, int port) {
     return AHCI_SUCCESS;
 }
 
+/* ============================================================================
+ * Request Queue
+ * ============================================================================ */
+
+/* Port interrupts that mean the commands in flight have failed */
+#define AHCI_PORT_INT_ERRORS    (AHCI_PORT_INT_TFES | AHCI_PORT_INT_HBFS | \
+                                 AHCI_PORT_INT_HBDS | AHCI_PORT_INT_IFS)
+
 /**
- * Find a free command slot
+ * Lock a port's queue
+ * Interrupts stay off while it is held, as the handler takes it too.
  */
-static int ahci_find_cmdslot(ahci_port_t* port, uint32_t num_slots) {
-    /* Slots in use are set in SACT and CI registers */
-    uint32_t slots = port->sact | port->ci;
+static inline uint64_t ahci_lock(ahci_port_info_t* info) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&info->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void ahci_unlock(ahci_port_info_t* info, uint64_t flags) {
+    __sync_lock_release(&info->lock);
+    interrupts_restore(flags);
+}
 
-    for (uint32_t i = 0; i < num_slots; i++) {
-        if ((slots & (1 << i)) == 0) {
-            return i;
+/**
+ * Controller owning a port number
+ */
+static ahci_controller_t* ahci_port_ctrl(int port) {
+    if (port < 0 || port >= AHCI_MAX_PORTS) {
+        return NULL;
+    }
+    for (int i = 0; i < ahci_controller_count; i++) {
+        if (ahci_controllers[i].ports_impl & (1U << port)) {
+            return &ahci_controllers[i];
         }
     }
+    return NULL;
+}
 
-    return -1;  /* No free slot */
+static inline uint32_t ahci_slot_mask(uint32_t slots) {
+    return slots >= 32 ? 0xFFFFFFFFU : (1U << slots) - 1;
 }
 
 /**
- * Wait for command completion
+ * Slots set in a slot mask (SWAR: the kernel has no POPCNT and links no libgcc)
  */
-static int ahci_wait_cmd(ahci_port_t* port, int slot, int timeout_ms) {
-    uint32_t slot_bit = 1 << slot;
-    int spin = 0;
+static inline uint32_t ahci_slot_count(uint32_t slots) {
+    slots = slots - ((slots >> 1) & 0x55555555U);
+    slots = (slots & 0x33333333U) + ((slots >> 2) & 0x33333333U);
+    slots = (slots + (slots >> 4)) & 0x0F0F0F0FU;
+    return (slots * 0x01010101U) >> 24;
+}
 
-    /* Wait for completion */
-    while (1) {
-        /* Check if slot is clear (command completed) */
-        if ((port->ci & slot_bit) == 0) {
-            break;
-        }
+/**
+ * Whether a request goes out as an NCQ command on this port
+ */
+static inline bool ahci_req_queued(const ahci_port_info_t* info, const ahci_request_t* req) {
+    return info->ncq && (req->op == AHCI_OP_READ || req->op == AHCI_OP_WRITE);
+}
 
-        /* Check for errors */
-        if (port->is & AHCI_PORT_INT_TFES) {
-            kprintf("[AHCI] Task file error during command\n");
-            return AHCI_ERR_TASK_FILE;
-        }
+/**
+ * Fill in a READ or WRITE DMA EXT command
+ */
+static void ahci_build_rw_fis(ahci_fis_reg_h2d_t* fis, uint8_t command,
+                              uint64_t lba, uint32_t count) {
+    memset(fis, 0, sizeof(*fis));
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->c = 1;  /* Command */
+    fis->command = command;
 
-        spin++;
-        if (spin >= timeout_ms * 1000) {
-            kprintf("[AHCI] Command timeout\n");
-            return AHCI_ERR_TIMEOUT;
+    /* LBA mode, 48-bit addressing */
+    fis->device = 1 << 6;  /* LBA mode */
+
+    fis->lba0 = (uint8_t)(lba & 0xFF);
+    fis->lba1 = (uint8_t)((lba >> 8) & 0xFF);
+    fis->lba2 = (uint8_t)((lba >> 16) & 0xFF);
+    fis->lba3 = (uint8_t)((lba >> 24) & 0xFF);
+    fis->lba4 = (uint8_t)((lba >> 32) & 0xFF);
+    fis->lba5 = (uint8_t)((lba >> 40) & 0xFF);
+
+    fis->countl = (uint8_t)(count & 0xFF);
+    fis->counth = (uint8_t)((count >> 8) & 0xFF);
+}
+
+/**
+ * Fill in a READ or WRITE FPDMA QUEUED command
+ * The sector count moves to the feature registers and the count
+ * register carries the slot as the command's tag.
+ */
+static void ahci_build_ncq_fis(ahci_fis_reg_h2d_t* fis, uint8_t command,
+                               uint64_t lba, uint32_t count, int tag) {
+    ahci_build_rw_fis(fis, command, lba, 0);
+    fis->featurel = (uint8_t)(count & 0xFF);
+    fis->featureh = (uint8_t)((count >> 8) & 0xFF);
+    fis->countl = (uint8_t)(tag << 3);
+}
+
+/**
+ * PRD table under construction
+ * With no table it only counts the entries a request needs.
+ */
+typedef struct {
+    ahci_prdt_entry_t* prdt;        /* Entries to fill, or NULL to count */
+    uint32_t count;                 /* Entries so far */
+    physaddr_t end;                 /* End of the last entry's region */
+    uint32_t size;                  /* Bytes of the last entry */
+} ahci_prd_builder_t;
+
+/**
+ * Add a physically contiguous region, growing the last entry if the
+ * region follows it
+ */
+static void ahci_prd_add(ahci_prd_builder_t* b, physaddr_t addr, uint32_t len) {
+    while (len > 0) {
+        if (b->count > 0 && addr == b->end && b->size < AHCI_PRD_MAX_BYTES) {
+            uint32_t grow = MIN(len, AHCI_PRD_MAX_BYTES - b->size);
+            b->size += grow;
+            b->end += grow;
+            addr += grow;
+            len -= grow;
+        } else {
+            uint32_t chunk = MIN(len, AHCI_PRD_MAX_BYTES);
+            b->count++;
+            b->size = chunk;
+            b->end = addr + chunk;
+            addr += chunk;
+            len -= chunk;
         }
 
-        ahci_delay(1);
+        if (b->prdt && b->count <= AHCI_MAX_PRDT_ENTRIES) {
+            physaddr_t base = b->end - b->size;
+            b->prdt[b->count - 1] = (ahci_prdt_entry_t){
+                .dba = (uint32_t)(base & 0xFFFFFFFF),
+                .dbau = (uint32_t)(base >> 32),
+                .dbc = b->size - 1,   /* 0-based count */
+            };
+        }
     }
+}
 
-    /* Check for errors after completion */
-    if (port->is & AHCI_PORT_INT_TFES) {
-        kprintf("[AHCI] Task file error after command\n");
-        return AHCI_ERR_TASK_FILE;
+/**
+ * Physical address of a segment buffer in the kernel physical map
+ * @return The address, or 0 if the buffer lies outside it
+ */
+static physaddr_t ahci_buffer_phys(const void* buffer) {
+    virtaddr_t virt = (virtaddr_t)buffer;
+    if (virt < VMM_KERNEL_PHYS_MAP || virt >= VMALLOC_BASE) {
+        return 0;
     }
-
-    return AHCI_SUCCESS;
+    return (physaddr_t)(virt - VMM_KERNEL_PHYS_MAP);
 }
 
-/* ============================================================================
- * ATA Commands
- * ============================================================================ */
-
 /**
- * Issue an ATA command
+ * Walk a request's data into a PRD builder
+ * Pure arithmetic on physical addresses, so it is safe under the port
+ * lock and in the interrupt handler.
  */
-static int ahci_issue_cmd(ahci_controller_t* ctrl, int port_num,
-                          ahci_fis_reg_h2d_t* fis,
-                          void* buf, uint32_t buf_size,
-                          int write) {
-    ahci_port_t* port = ahci_get_port(ctrl, port_num);
-    ahci_port_info_t* info = &ctrl->port_info[port_num];
+static void ahci_prd_build(ahci_prd_builder_t* b, const ahci_request_t* req) {
+    if (req->pages) {
+        uint32_t remaining = req->sectors * AHCI_SECTOR_SIZE;
+        uint32_t offset = req->page_offset;
+        for (uint32_t p = offset / PAGE_SIZE; remaining > 0; p++) {
+            uint32_t in_page = offset % PAGE_SIZE;
+            uint32_t len = MIN(remaining, PAGE_SIZE - in_page);
+            ahci_prd_add(b, req->pages[p] + in_page, len);
+            remaining -= len;
+            offset += len;
+        }
+        return;
+    }
 
-    if (!port || !info->present) {
-        return AHCI_ERR_NO_DEVICE;
+    for (uint32_t s = 0; s < req->nsegs; s++) {
+        ahci_prd_add(b, ahci_buffer_phys(req->segs[s].buffer),
+                     req->segs[s].count * AHCI_SECTOR_SIZE);
     }
+}
 
-    /* Clear interrupt status */
-    port->is = (uint32_t)-1;
+/**
+ * Check a request and total its sectors
+ */
+static int ahci_req_check(const ahci_port_info_t* info, ahci_request_t* req) {
+    if (req->op == AHCI_OP_FLUSH) {
+        req->sectors = 0;
+        return req->nsegs == 0 && info->type == AHCI_DEV_SATA
+               ? AHCI_SUCCESS : AHCI_ERR_UNSUPPORTED;
+    }
+    if (req->op == AHCI_OP_IDENTIFY) {
+        req->sectors = 1;
+        return req->nsegs == 1 && req->segs && req->segs[0].count == 1 && req->segs[0].buffer
+               ? AHCI_SUCCESS : AHCI_ERR_INVALID_PORT;
+    }
+    if (req->op != AHCI_OP_READ && req->op != AHCI_OP_WRITE) {
+        return AHCI_ERR_INVALID_PORT;
+    }
+    if (info->type != AHCI_DEV_SATA) {
+        return AHCI_ERR_UNSUPPORTED;
+    }
+    if (!req->segs || req->nsegs == 0 || (req->pages && req->nsegs != 1)) {
+        return AHCI_ERR_INVALID_PORT;
+    }
 
-    /* Find a free command slot */
-    int slot = ahci_find_cmdslot(port, ctrl->num_cmd_slots);
-    if (slot < 0) {
-        kprintf("[AHCI] No free command slot for port %d\n", port_num);
-        return AHCI_ERR_NOT_READY;
+    /* DMA regions must start on a word boundary */
+    uint32_t sectors = 0;
+    for (uint32_t s = 0; s < req->nsegs; s++) {
+        const ahci_seg_t* seg = &req->segs[s];
+        if (seg->count == 0 || seg->lba != req->segs[0].lba + sectors) {
+            return AHCI_ERR_INVALID_PORT;
+        }
+        if (!req->pages && (ahci_buffer_phys(seg->buffer) == 0 ||
+                            ((virtaddr_t)seg->buffer & 1))) {
+            return AHCI_ERR_BAD_BUFFER;
+        }
+        sectors += seg->count;
+        if (sectors > AHCI_MAX_CMD_SECTORS) {
+            return AHCI_ERR_TOO_LARGE;
+        }
     }
+    if (req->pages && (req->page_offset & 1)) {
+        return AHCI_ERR_BAD_BUFFER;
+    }
+    req->sectors = sectors;
+
+    ahci_prd_builder_t count = { 0 };
+    ahci_prd_build(&count, req);
+    return count.count <= AHCI_MAX_PRDT_ENTRIES ? AHCI_SUCCESS : AHCI_ERR_TOO_LARGE;
+}
 
-    /* Get command header and table */
+/**
+ * Build a request's command in a slot
+ * Called with the port lock held, on a request ahci_req_check passed.
+ */
+static void ahci_prepare(ahci_port_info_t* info, int slot, const ahci_request_t* req) {
     ahci_cmd_header_t* hdr = &info->cmd_list[slot];
     ahci_cmd_table_t* tbl = info->cmd_tables[slot];
-
-    /* Clear command table */
-    ahci_memset(tbl, 0, sizeof(ahci_cmd_table_t) + sizeof(ahci_prdt_entry_t) * AHCI_MAX_PRDT_ENTRIES);
+    bool write = req->op == AHCI_OP_WRITE;
+
+    /* Only the FIS is cleared: the PRD entries used are written in full */
+    memset(tbl->cfis, 0, sizeof(ahci_fis_reg_h2d_t));
+
+    /* Build the command FIS */
+    ahci_fis_reg_h2d_t* fis = (ahci_fis_reg_h2d_t*)tbl->cfis;
+    uint64_t lba = req->nsegs ? req->segs[0].lba : 0;
+    switch (req->op) {
+        case AHCI_OP_READ:
+        case AHCI_OP_WRITE:
+            if (ahci_req_queued(info, req)) {
+                ahci_build_ncq_fis(fis, write ? ATA_CMD_WRITE_FPDMA_QUEUED
+                                              : ATA_CMD_READ_FPDMA_QUEUED,
+                                   lba, req->sectors, slot);
+            } else {
+                ahci_build_rw_fis(fis, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+                                  lba, req->sectors);
+            }
+            break;
+        case AHCI_OP_FLUSH:
+            fis->fis_type = FIS_TYPE_REG_H2D;
+            fis->c = 1;
+            fis->command = ATA_CMD_FLUSH_CACHE_EXT;
+            break;
+        case AHCI_OP_IDENTIFY:
+            fis->fis_type = FIS_TYPE_REG_H2D;
+            fis->c = 1;
+            fis->command = (info->type == AHCI_DEV_SATAPI)
+                           ? ATA_CMD_IDENTIFY_PACKET : ATA_CMD_IDENTIFY;
+            break;
+    }
 
     /* Set up command header */
     hdr->cfl = sizeof(ahci_fis_reg_h2d_t) / 4;  /* FIS length in DWORDs */
@@ -358,51 +540,607 @@ static int ahci_issue_cmd(ahci_controller_t* ctrl, int port_num,
     hdr->b = 0;                                  /* Not BIST */
     hdr->c = 1;                                  /* Clear busy on R_OK */
     hdr->pmp = 0;                                /* Port multiplier port */
-    hdr->prdtl = 0;                              /* Will set if buffer provided */
     hdr->prdbc = 0;                              /* PRD byte count */
 
-    /* Copy the FIS to command table */
-    ahci_memcpy(tbl->cfis, fis, sizeof(ahci_fis_reg_h2d_t));
+    /* One PRD entry per physically contiguous run, split at 4MB */
+    ahci_prd_builder_t prds = { .prdt = tbl->prdt_entry };
+    ahci_prd_build(&prds, req);
+    if (prds.count > 0) {
+        tbl->prdt_entry[prds.count - 1].i = 1;  /* Interrupt on last */
+    }
+    hdr->prdtl = prds.count;
+}
+
+/**
+ * Issue pending requests while slots are free
+ * A non-queued command on an NCQ port waits for the queue to drain and
+ * then runs alone, as the drive would abort a mix of the two.
+ * Called with the port lock held.
+ */
+static void ahci_dispatch(ahci_controller_t* ctrl, int port_num) {
+    ahci_port_t* port = &ctrl->hba->ports[port_num];
+    ahci_port_info_t* info = &ctrl->port_info[port_num];
+    uint32_t mask = ahci_slot_mask(info->queue_depth);
+
+    while (info->pending && !info->exclusive) {
+        ahci_request_t* req = info->pending;
+        bool queued = ahci_req_queued(info, req);
+        uint32_t free_slots = ~info->busy & mask;
+
+        if (free_slots == 0 || (info->ncq && !queued && info->busy)) {
+            break;
+        }
+
+        int slot = __builtin_ctz(free_slots);
+        uint32_t bit = 1U << slot;
+
+        info->pending = req->next;
+        if (!info->pending) {
+            info->pending_tail = NULL;
+        }
+
+        ahci_prepare(info, slot, req);
+        info->slot_req[slot] = req;
+        info->busy |= bit;
+        if (info->ncq && !queued) {
+            info->exclusive = bit;
+        }
+
+        uint32_t inflight = ahci_slot_count(info->busy);
+        if (inflight > info->max_inflight) {
+            info->max_inflight = inflight;
+        }
+
+        /* NCQ commands stay active in SACT until the drive reports them done */
+        if (queued) {
+            port->sact = bit;
+        }
+        port->ci = bit;
+    }
+}
 
-    /* Set up PRDT if buffer provided */
-    if (buf && buf_size > 0) {
-        /* Get physical address of buffer */
-        physaddr_t buf_phys = (physaddr_t)((virtaddr_t)buf - VMM_KERNEL_PHYS_MAP);
+/**
+ * Take requests out of their slots onto a completion list
+ * Called with the port lock held.
+ */
+static ahci_request_t* ahci_retire(ahci_port_info_t* info, uint32_t slots, int result,
+                                   ahci_request_t* list) {
+    while (slots) {
+        int slot = __builtin_ctz(slots);
+        ahci_request_t* req = info->slot_req[slot];
+
+        slots &= slots - 1;
+        info->slot_req[slot] = NULL;
+        info->busy &= ~(1U << slot);
+        info->exclusive &= ~(1U << slot);
+        if (!req) {
+            continue;
+        }
 
-        /* Calculate number of PRD entries needed */
-        uint32_t prdt_count = (buf_size + 0x3FFFFF) / 0x400000;  /* Max 4MB per entry */
-        if (prdt_count > AHCI_MAX_PRDT_ENTRIES) {
-            prdt_count = AHCI_MAX_PRDT_ENTRIES;
+        req->result = result;
+        req->next = list;
+        list = req;
+        if (result == AHCI_SUCCESS) {
+            info->completed++;
+        } else {
+            info->failed++;
         }
+    }
+    return list;
+}
+
+/**
+ * Fail every command in flight and restart the port's command engine
+ * Commands the HBA had already finished are retired as successful.
+ * Called with the port lock held.
+ */
+static ahci_request_t* ahci_port_abort(ahci_controller_t* ctrl, int port_num, int error,
+                                       ahci_request_t* list) {
+    ahci_port_t* port = &ctrl->hba->ports[port_num];
+    ahci_port_info_t* info = &ctrl->port_info[port_num];
 
-        hdr->prdtl = prdt_count;
+    list = ahci_retire(info, info->busy & ~(port->sact | port->ci), AHCI_SUCCESS, list);
 
-        /* Set up PRD entries */
-        uint32_t remaining = buf_size;
-        physaddr_t addr = buf_phys;
+    log_event(SERIAL_LOG_ERROR, "AHCI",
+              "Port %d: error %d (IS=0x%08x TFD=0x%08x), failing %u command(s)\n",
+              port_num, error, port->is, port->tfd, ahci_slot_count(info->busy));
+    list = ahci_retire(info, info->busy, error, list);
 
-        for (uint32_t i = 0; i < prdt_count; i++) {
-            uint32_t chunk_size = (remaining > 0x400000) ? 0x400000 : remaining;
+    /* Stopping the engine clears CI and SACT */
+    ahci_stop_cmd(port);
+    port->serr = (uint32_t)-1;
+    port->is = (uint32_t)-1;
+    ahci_start_cmd(port);
 
-            tbl->prdt_entry[i].dba = (uint32_t)(addr & 0xFFFFFFFF);
-            tbl->prdt_entry[i].dbau = (uint32_t)(addr >> 32);
-            tbl->prdt_entry[i].dbc = chunk_size - 1;  /* 0-based count */
-            tbl->prdt_entry[i].i = (i == prdt_count - 1) ? 1 : 0;  /* Interrupt on last */
+    return list;
+}
 
-            addr += chunk_size;
-            remaining -= chunk_size;
+/**
+ * Report finished requests
+ * Called without the port lock: callbacks may submit more.
+ */
+static void ahci_finish(ahci_request_t* list) {
+    while (list) {
+        ahci_request_t* req = list;
+        ahci_done_t done = req->done;
+
+        /* A synchronous waiter may drop the request as soon as status changes */
+        list = req->next;
+        __atomic_store_n(&req->status, req->result, __ATOMIC_RELEASE);
+        if (done) {
+            done(req);
         }
     }
+}
+
+/**
+ * Retire a port's completed commands and issue more
+ * @param error Fail everything in flight with this error, or AHCI_SUCCESS
+ */
+static void ahci_port_service(ahci_controller_t* ctrl, int port_num, int error) {
+    ahci_port_t* port = &ctrl->hba->ports[port_num];
+    ahci_port_info_t* info = &ctrl->port_info[port_num];
+    ahci_request_t* done = NULL;
+
+    uint64_t flags = ahci_lock(info);
+
+    uint32_t is = port->is;
+    port->is = is;
+
+    if (error == AHCI_SUCCESS && (is & AHCI_PORT_INT_ERRORS)) {
+        error = (is & AHCI_PORT_INT_TFES) ? AHCI_ERR_TASK_FILE : AHCI_ERR_PORT_HUNG;
+    }
+
+    if (error != AHCI_SUCCESS && info->busy) {
+        done = ahci_port_abort(ctrl, port_num, error, done);
+    } else {
+        done = ahci_retire(info, info->busy & ~(port->sact | port->ci), AHCI_SUCCESS, done);
+    }
+    ahci_dispatch(ctrl, port_num);
 
-    /* Issue the command */
-    port->ci = 1 << slot;
+    ahci_unlock(info, flags);
 
-    /* Wait for completion */
-    int result = ahci_wait_cmd(port, slot, AHCI_CMD_TIMEOUT);
+    ahci_finish(done);
+
+    /* Sleeping waiters re-check their requests */
+    if (done) {
+        __atomic_fetch_add(&info->event, 1, __ATOMIC_SEQ_CST);
+        waitq_wake(&info->event, WAITQ_WAKE_ALL);
+    }
+}
+
+/**
+ * Queue a checked request and issue what fits
+ */
+static int ahci_queue(ahci_controller_t* ctrl, int port_num, ahci_request_t* req) {
+    ahci_port_info_t* info = &ctrl->port_info[port_num];
+
+    if (!info->present) {
+        return AHCI_ERR_NO_DEVICE;
+    }
+    int result = ahci_req_check(info, req);
+    if (result != AHCI_SUCCESS) {
+        return result;
+    }
+
+    req->status = AHCI_REQ_PENDING;
+    req->result = AHCI_REQ_PENDING;
+    req->next = NULL;
+
+    uint64_t flags = ahci_lock(info);
+    if (info->pending_tail) {
+        info->pending_tail->next = req;
+    } else {
+        info->pending = req;
+    }
+    info->pending_tail = req;
+    ahci_dispatch(ctrl, port_num);
+    ahci_unlock(info, flags);
+
+    return AHCI_SUCCESS;
+}
+
+/**
+ * Timer callback ending a waiter's sleep at its deadline
+ */
+static void ahci_wait_expired(void* arg) {
+    ahci_port_info_t* info = arg;
+
+    __atomic_fetch_add(&info->event, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&info->event, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Check if a waiter can sleep until the interrupt handler wakes it
+ */
+static bool ahci_can_sleep(ahci_controller_t* ctrl) {
+    return ctrl->irq_ok && scheduler_is_running() && interrupts_enabled();
+}
+
+static inline bool ahci_req_pending(ahci_request_t* req) {
+    return __atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == AHCI_REQ_PENDING;
+}
+
+/**
+ * Wait for requests to finish
+ * Sleeps on the port's event word while the controller's interrupts are
+ * known to arrive, and polls the port otherwise (early boot, interrupts
+ * off or unrouted). A port that makes no progress for AHCI_CMD_TIMEOUT
+ * has its commands failed; a sleeper that times out goes back to polling
+ * until the next interrupt, in case they were lost.
+ * @return AHCI_SUCCESS, or the first error among the requests
+ */
+static int ahci_wait(ahci_controller_t* ctrl, int port_num, ahci_request_t* reqs, uint32_t count) {
+    ahci_port_info_t* info = &ctrl->port_info[port_num];
+    ktimer_t timer;
+    bool armed = false;
+    uint64_t deadline = 0;
+    int spin = 0;
+
+    ktimer_init(&timer, ahci_wait_expired, info);
+
+    for (uint32_t i = 0; i < count; i++) {
+        while (ahci_req_pending(&reqs[i])) {
+            if (ahci_can_sleep(ctrl)) {
+                /* A completion since this read has bumped the word already */
+                uint32_t seen = __atomic_load_n(&info->event, __ATOMIC_SEQ_CST);
+                if (!ahci_req_pending(&reqs[i])) {
+                    break;
+                }
+
+                uint64_t now = timer_now_ns();
+                if (deadline == 0) {
+                    deadline = now + AHCI_CMD_TIMEOUT * NSEC_PER_MSEC;
+                    armed = ktimer_start(&timer, deadline - now, 0);
+                } else if (now >= deadline) {
+                    log_event(SERIAL_LOG_ERROR, "AHCI", "Command timeout on port %d\n", port_num);
+                    ctrl->irq_ok = false;
+                    ahci_port_service(ctrl, port_num, AHCI_ERR_TIMEOUT);
+                    deadline = 0;
+                    continue;
+                }
+
+                /* Without a timer a lost interrupt would never end the sleep */
+                if (armed) {
+                    waitq_wait(&info->event, seen);
+                    continue;
+                }
+            }
+
+            ahci_port_service(ctrl, port_num, AHCI_SUCCESS);
+            if (!ahci_req_pending(&reqs[i])) {
+                break;
+            }
+            if (++spin >= AHCI_CMD_TIMEOUT * 1000) {
+                log_event(SERIAL_LOG_ERROR, "AHCI", "Command timeout\n");
+                ahci_port_service(ctrl, port_num, AHCI_ERR_TIMEOUT);
+                spin = 0;
+                continue;
+            }
+            ahci_delay(1);
+        }
+        spin = 0;
+        deadline = 0;
+    }
 
+    if (armed) {
+        ktimer_cancel(&timer);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (reqs[i].status != AHCI_SUCCESS) {
+            return reqs[i].status;
+        }
+    }
+    return AHCI_SUCCESS;
+}
+
+/**
+ * Run one command to completion
+ */
+static int ahci_run(ahci_controller_t* ctrl, int port_num, ahci_op_t op,
+                    const ahci_seg_t* segs, uint32_t nsegs) {
+    ahci_request_t req = { .op = op, .segs = segs, .nsegs = nsegs };
+
+    int result = ahci_queue(ctrl, port_num, &req);
+    if (result != AHCI_SUCCESS) {
+        return result;
+    }
+    return ahci_wait(ctrl, port_num, &req, 1);
+}
+
+/**
+ * AHCI interrupt: mask the HBAs that have work and leave it to the softirq
+ * Their status stays set, so a level-triggered line deasserts only once
+ * GHC.IE is clear.
+ */
+static void ahci_interrupt(interrupt_frame_t* frame) {
+    UNUSED(frame);
+
+    bool raise = false;
+    for (int c = 0; c < ahci_controller_count; c++) {
+        ahci_controller_t* ctrl = &ahci_controllers[c];
+        if (ctrl->hba->is & ctrl->ports_impl) {
+            ctrl->hba->ghc &= ~AHCI_GHC_IE;
+            ctrl->irq_masked = true;
+            raise = true;
+        }
+    }
+    if (raise) {
+        softirq_raise(SOFTIRQ_BLOCK);
+    }
+}
+
+/**
+ * Block softirq: service every port the masked HBAs report, then unmask
+ */
+static void ahci_softirq(void) {
+    for (int c = 0; c < ahci_controller_count; c++) {
+        ahci_controller_t* ctrl = &ahci_controllers[c];
+        if (!ctrl->irq_masked) {
+            continue;
+        }
+        uint32_t pending = ctrl->hba->is & ctrl->ports_impl;
+
+        /* Port status is cleared before the HBA's */
+        for (uint32_t bits = pending; bits; bits &= bits - 1) {
+            int port_num = __builtin_ctz(bits);
+            if (ctrl->port_info[port_num].present) {
+                ahci_port_service(ctrl, port_num, AHCI_SUCCESS);
+            } else {
+                ctrl->hba->ports[port_num].is = (uint32_t)-1;
+            }
+        }
+        if (pending) {
+            ctrl->hba->is = pending;
+            ctrl->irq_ok = true;
+        }
+
+        /* A completion while masked sent no message: go round again */
+        ctrl->irq_masked = false;
+        ctrl->hba->ghc |= AHCI_GHC_IE;
+        if (ctrl->hba->is & ctrl->ports_impl) {
+            ctrl->hba->ghc &= ~AHCI_GHC_IE;
+            ctrl->irq_masked = true;
+            softirq_raise(SOFTIRQ_BLOCK);
+        }
+    }
+}
+
+/* ============================================================================
+ * ATA Commands
+ * ============================================================================ */
+
+/**
+ * Transfer a vectored request, one command per run of adjacent segments
+ * Up to a port's worth of commands are in flight at once.
+ */
+static int ahci_rw_v(int port, const ahci_seg_t* segs, uint32_t count, int write) {
+    if (port < 0 || port >= AHCI_MAX_PORTS || !segs || count == 0) {
+        return AHCI_ERR_INVALID_PORT;
+    }
+
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
+    if (!ctrl || !ctrl->port_info[port].present) {
+        return AHCI_ERR_NO_DEVICE;
+    }
+
+    if (ctrl->port_info[port].type != AHCI_DEV_SATA) {
+        return AHCI_ERR_UNSUPPORTED;
+    }
+
+    ahci_request_t reqs[AHCI_MAX_CMD_SLOTS];
+    int result = AHCI_SUCCESS;
+    uint32_t first = 0;
+
+    while (first < count && result == AHCI_SUCCESS) {
+        uint32_t batch = 0;
+
+        while (first < count && batch < AHCI_MAX_CMD_SLOTS) {
+            uint32_t sectors = segs[first].count;
+            uint32_t prds = (segs[first].count * AHCI_SECTOR_SIZE + 0x3FFFFF) / 0x400000;
+            uint32_t n = 1;
+
+            if (sectors == 0 || !segs[first].buffer || prds > AHCI_MAX_PRDT_ENTRIES) {
+                result = AHCI_ERR_INVALID_PORT;
+                break;
+            }
+
+            /* Extend the command while the next segment continues on the disk */
+            while (first + n < count) {
+                const ahci_seg_t* next = &segs[first + n];
+                uint32_t next_prds = (next->count * AHCI_SECTOR_SIZE + 0x3FFFFF) / 0x400000;
+                if (next->lba != segs[first].lba + sectors || !next->buffer ||
+                    next->count == 0 || sectors + next->count > AHCI_MAX_CMD_SECTORS ||
+                    prds + next_prds > AHCI_MAX_PRDT_ENTRIES) {
+                    break;
+                }
+                sectors += next->count;
+                prds += next_prds;
+                n++;
+            }
+
+            reqs[batch] = (ahci_request_t){
+                .op = write ? AHCI_OP_WRITE : AHCI_OP_READ,
+                .segs = &segs[first],
+                .nsegs = n,
+            };
+            result = ahci_queue(ctrl, port, &reqs[batch]);
+            if (result != AHCI_SUCCESS) {
+                break;
+            }
+            batch++;
+            first += n;
+        }
+
+        /* Everything queued must finish before its slots leave the stack */
+        int batch_result = ahci_wait(ctrl, port, reqs, batch);
+        if (result == AHCI_SUCCESS) {
+            result = batch_result;
+        }
+    }
+
+    if (result != AHCI_SUCCESS) {
+        log_event(SERIAL_LOG_ERROR, "AHCI", "%s of %u segment(s) on port %d failed with error %d\n",
+                  write ? "Write" : "Read", count, port, result);
+    }
     return result;
 }
 
+/**
+ * Transfer sectors through a page list, one command
+ */
+static int ahci_rw_pages(int port, uint64_t lba, uint32_t count, const physaddr_t* pages,
+                         uint32_t offset, int write) {
+    if (port < 0 || port >= AHCI_MAX_PORTS || !pages || count == 0) {
+        return AHCI_ERR_INVALID_PORT;
+    }
+
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
+    if (!ctrl || !ctrl->port_info[port].present) {
+        return AHCI_ERR_NO_DEVICE;
+    }
+
+    ahci_seg_t seg = { lba, count, NULL };
+    ahci_request_t req = {
+        .op = write ? AHCI_OP_WRITE : AHCI_OP_READ,
+        .segs = &seg,
+        .nsegs = 1,
+        .pages = pages,
+        .page_offset = offset,
+    };
+
+    int result = ahci_queue(ctrl, port, &req);
+    if (result == AHCI_SUCCESS) {
+        result = ahci_wait(ctrl, port, &req, 1);
+    }
+    if (result != AHCI_SUCCESS) {
+        log_event(SERIAL_LOG_ERROR, "AHCI",
+                  "%s of %u sectors at LBA %llu on port %d failed with error %d\n",
+                  write ? "Write" : "Read", count, lba, port, result);
+    }
+    return result;
+}
+
+/**
+ * Transfer sectors to or from any kernel buffer
+ * A buffer in the physical map goes out as it is. Any other is
+ * translated a batch of pages at a time in the caller's context (the
+ * VMM lock is not taken under the port lock or in the interrupt
+ * handler) and each batch sent as a page-list command.
+ */
+static int ahci_rw_buffer(int port, uint64_t lba, uint32_t count, void* buf, int write) {
+    if (ahci_buffer_phys(buf) != 0) {
+        ahci_seg_t seg = { lba, count, buf };
+        return ahci_rw_v(port, &seg, 1, write);
+    }
+
+    physaddr_t pages[AHCI_PAGE_BATCH];
+    virtaddr_t virt = (virtaddr_t)buf;
+    uint32_t offset = (uint32_t)(virt % PAGE_SIZE);
+    virtaddr_t page = virt - offset;
+
+    while (count > 0) {
+        /* Whole sectors that fit the batch of pages from offset */
+        uint32_t max = (AHCI_PAGE_BATCH * PAGE_SIZE - offset) / AHCI_SECTOR_SIZE;
+        uint32_t n = MIN(count, max);
+        uint32_t npages = (offset + n * AHCI_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        for (uint32_t p = 0; p < npages; p++) {
+            pages[p] = vmm_get_physical(page + (virtaddr_t)p * PAGE_SIZE);
+            if (pages[p] == 0) {
+                log_event(SERIAL_LOG_ERROR, "AHCI", "Buffer page 0x%llx is not mapped\n",
+                          page + (virtaddr_t)p * PAGE_SIZE);
+                return AHCI_ERR_BAD_BUFFER;
+            }
+        }
+
+        int result = ahci_rw_pages(port, lba, n, pages, offset, write);
+        if (result != AHCI_SUCCESS) {
+            return result;
+        }
+
+        /* The next batch starts in the page holding the first byte after this one */
+        uint64_t done = offset + (uint64_t)n * AHCI_SECTOR_SIZE;
+        page += (done / PAGE_SIZE) * PAGE_SIZE;
+        offset = (uint32_t)(done % PAGE_SIZE);
+        lba += n;
+        count -= n;
+    }
+    return AHCI_SUCCESS;
+}
+
+/* ============================================================================
+ * Block Layer
+ * ============================================================================ */
+
+/**
+ * Driver area of a block layer tag: the command as an AHCI request
+ */
+typedef struct {
+    ahci_request_t req;
+    ahci_seg_t segs[BLK_MAX_SEGS];
+    blk_cmd_t* cmd;
+} ahci_blk_tag_t;
+
+static void ahci_blk_done(ahci_request_t* req) {
+    ahci_blk_tag_t* tag = req->ctx;
+    blk_complete(tag->cmd, req->status == AHCI_SUCCESS ? BLK_OK : BLK_ERR_IO);
+}
+
+static int ahci_blk_submit(void* device, blk_cmd_t* cmd) {
+    ahci_blk_tag_t* tag = cmd->priv;
+
+    for (uint32_t s = 0; s < cmd->nsegs; s++) {
+        tag->segs[s] = (ahci_seg_t){ cmd->segs[s].lba, cmd->segs[s].count, cmd->segs[s].buffer };
+    }
+    tag->cmd = cmd;
+    tag->req = (ahci_request_t){
+        .op = cmd->op == BLK_OP_WRITE ? AHCI_OP_WRITE : AHCI_OP_READ,
+        .segs = tag->segs,
+        .nsegs = cmd->nsegs,
+        .done = ahci_blk_done,
+        .ctx = tag,
+    };
+    return ahci_submit((int)(uintptr_t)device, &tag->req);
+}
+
+static void ahci_blk_poll(void* device) {
+    ahci_poll((int)(uintptr_t)device);
+}
+
+static int ahci_blk_flush(void* device) {
+    return ahci_flush((int)(uintptr_t)device) == AHCI_SUCCESS ? BLK_OK : BLK_ERR_IO;
+}
+
+static const blk_ops_t ahci_blk_ops = {
+    .submit = ahci_blk_submit,
+    .poll = ahci_blk_poll,
+    .flush = ahci_blk_flush,
+};
+
+/**
+ * Give a SATA drive a block layer queue ("ahci<port>")
+ */
+static void ahci_blk_register(int port, ahci_port_info_t* info) {
+    char name[BLK_NAME_MAX] = "ahci";
+    int len = 4;
+    if (port >= 10) {
+        name[len++] = (char)('0' + port / 10);
+    }
+    name[len++] = (char)('0' + port % 10);
+    name[len] = '\0';
+
+    blk_limits_t limits = {
+        .depth = info->queue_depth,
+        .max_sectors = AHCI_BLK_MAX_SECTORS,
+        .max_segs = BLK_MAX_SEGS,
+        .priv_size = sizeof(ahci_blk_tag_t),
+        .total_sectors = info->sector_count,
+    };
+    info->blk = blk_register(name, &ahci_blk_ops, (void*)(uintptr_t)port, &limits);
+}
+
 /* ============================================================================
  * Public API Implementation
  * ============================================================================ */
@@ -417,7 +1155,7 @@ static int ahci_init_controller(pci_device_t* pci_dev) {
     }
 
     ahci_controller_t* ctrl = &ahci_controllers[ahci_controller_count];
-    ahci_memset(ctrl, 0, sizeof(ahci_controller_t));
+    memset(ctrl, 0, sizeof(ahci_controller_t));
 
     ctrl->pci_dev = pci_dev;
 
@@ -444,11 +1182,13 @@ static int ahci_init_controller(pci_device_t* pci_dev) {
     ctrl->num_ports = (cap & AHCI_CAP_NP_MASK) + 1;
     ctrl->num_cmd_slots = ((cap & AHCI_CAP_NCS_MASK) >> AHCI_CAP_NCS_SHIFT) + 1;
     ctrl->supports_64bit = (cap & AHCI_CAP_S64A) != 0;
+    ctrl->supports_ncq = (cap & AHCI_CAP_SNCQ) != 0;
     ctrl->ports_impl = ctrl->hba->pi;
 
-    kprintf("[AHCI] Capabilities: %d ports, %d cmd slots, 64-bit=%s\n",
+    kprintf("[AHCI] Capabilities: %d ports, %d cmd slots, 64-bit=%s, NCQ=%s\n",
             ctrl->num_ports, ctrl->num_cmd_slots,
-            ctrl->supports_64bit ? "yes" : "no");
+            ctrl->supports_64bit ? "yes" : "no",
+            ctrl->supports_ncq ? "yes" : "no");
     kprintf("[AHCI] Ports implemented: 0x%08x\n", ctrl->ports_impl);
 
     /* Print version */
@@ -482,6 +1222,19 @@ static int ahci_init_controller(pci_device_t* pci_dev) {
     /* Clear global interrupt status */
     ctrl->hba->is = (uint32_t)-1;
 
+    /*
+     * Completions are reaped by ahci_softirq, which ahci_interrupt raises
+     * (and by polling waiters).
+     * With a local APIC the HBA signals it by MSI on a vector of its own;
+     * otherwise on its legacy line.
+     */
+    ctrl->irq = pci_dev->interrupt_line;
+    ctrl->msi = pci_irq_alloc(pci_dev, 0, percpu_cpu_id(), ahci_interrupt) >= 0;
+    if (!ctrl->msi) {
+        idt_register_handler(IRQ_BASE + ctrl->irq, ahci_interrupt);
+        pci_enable_interrupts(pci_dev);
+    }
+
     /* Enable interrupts */
     ctrl->hba->ghc |= AHCI_GHC_IE;
 
@@ -517,7 +1270,7 @@ static int ahci_init_controller(pci_device_t* pci_dev) {
                         physaddr_t id_phys = pmm_alloc_page();
                         if (id_phys != 0) {
                             void* id_buf = (void*)(VMM_KERNEL_PHYS_MAP + id_phys);
-                            ahci_memset(id_buf, 0, 512);
+                            memset(id_buf, 0, 512);
 
                             if (ahci_identify(i, id_buf) == AHCI_SUCCESS) {
                                 uint16_t* id = (uint16_t*)id_buf;
@@ -541,6 +1294,19 @@ static int ahci_init_controller(pci_device_t* pci_dev) {
                                         ((uint32_t)id[61] << 16) | id[60];
                                 }
 
+                                /* Queue reads and writes if both ends can */
+                                uint32_t depth = (id[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1;
+                                if (ctrl->supports_ncq &&
+                                    (id[ATA_ID_SATA_CAP] & ATA_ID_SATA_CAP_NCQ)) {
+                                    ctrl->port_info[i].ncq = true;
+                                    ctrl->port_info[i].queue_depth =
+                                        MIN(depth, ctrl->num_cmd_slots);
+                                    kprintf("[AHCI] Port %d: NCQ, queue depth %u\n",
+                                            i, ctrl->port_info[i].queue_depth);
+                                }
+
+                                ahci_blk_register(i, &ctrl->port_info[i]);
+
                                 uint64_t size_mb = (ctrl->port_info[i].sector_count * 512) / (1024 * 1024);
                                 kprintf("[AHCI] Port %d: Model: %s\n", i, ctrl->port_info[i].model);
                                 kprintf("[AHCI] Port %d: Serial: %s\n", i, ctrl->port_info[i].serial);
@@ -593,6 +1359,15 @@ int ahci_init(void) {
     return ahci_controller_count;
 }
 
+/**
+ * Boot initcall: port spin-up runs alongside the other drivers
+ */
+static bool ahci_initcall(void) {
+    softirq_register(SOFTIRQ_BLOCK, ahci_softirq);
+    return ahci_init() >= 0;
+}
+INITCALL(ahci, ahci_initcall, 0, "pci");
+
 ahci_device_type_t ahci_probe_port(int port) {
     if (port < 0 || port >= AHCI_MAX_PORTS) {
         return AHCI_DEV_NULL;
@@ -630,30 +1405,13 @@ int ahci_identify(int port, void* buf) {
         return AHCI_ERR_INVALID_PORT;
     }
 
-    /* Find controller with this port */
-    ahci_controller_t* ctrl = NULL;
-    for (int i = 0; i < ahci_controller_count; i++) {
-        if (ahci_controllers[i].ports_impl & (1 << port)) {
-            ctrl = &ahci_controllers[i];
-            break;
-        }
-    }
-
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
     if (!ctrl || !ctrl->port_info[port].present) {
         return AHCI_ERR_NO_DEVICE;
     }
 
-    /* Build IDENTIFY DEVICE command */
-    ahci_fis_reg_h2d_t fis;
-    ahci_memset(&fis, 0, sizeof(fis));
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;  /* This is a command */
-    fis.command = (ctrl->port_info[port].type == AHCI_DEV_SATAPI)
-                  ? ATA_CMD_IDENTIFY_PACKET : ATA_CMD_IDENTIFY;
-    fis.device = 0;
-
-    /* Issue command */
-    return ahci_issue_cmd(ctrl, port, &fis, buf, 512, 0);
+    ahci_seg_t seg = { 0, 1, buf };
+    return ahci_run(ctrl, port, AHCI_OP_IDENTIFY, &seg, 1);
 }
 
 int ahci_read_sectors(int port, uint64_t lba, uint32_t count, void* buf) {
@@ -666,57 +1424,10 @@ int ahci_read_sectors(int port, uint64_t lba, uint32_t count, void* buf) {
         return AHCI_ERR_INVALID_PORT;
     }
 
-    /* Find controller with this port */
-    ahci_controller_t* ctrl = NULL;
-    for (int i = 0; i < ahci_controller_count; i++) {
-        if (ahci_controllers[i].ports_impl & (1 << port)) {
-            ctrl = &ahci_controllers[i];
-            break;
-        }
-    }
-
-    if (!ctrl || !ctrl->port_info[port].present) {
-        return AHCI_ERR_NO_DEVICE;
-    }
-
-    if (ctrl->port_info[port].type != AHCI_DEV_SATA) {
-        return AHCI_ERR_UNSUPPORTED;
-    }
+    log_event(SERIAL_LOG_DEBUG, "AHCI", "Reading %u sectors from LBA %llu on port %d\n",
+              count, lba, port);
 
-    kprintf("[AHCI] Reading %u sectors from LBA %llu on port %d\n", count, lba, port);
-
-    /* Build READ DMA EXT command */
-    ahci_fis_reg_h2d_t fis;
-    ahci_memset(&fis, 0, sizeof(fis));
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;  /* Command */
-    fis.command = ATA_CMD_READ_DMA_EXT;
-
-    /* LBA mode, 48-bit addressing */
-    fis.device = 1 << 6;  /* LBA mode */
-
-    /* Set LBA */
-    fis.lba0 = (uint8_t)(lba & 0xFF);
-    fis.lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis.lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis.lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis.lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis.lba5 = (uint8_t)((lba >> 40) & 0xFF);
-
-    /* Set sector count */
-    fis.countl = (uint8_t)(count & 0xFF);
-    fis.counth = (uint8_t)((count >> 8) & 0xFF);
-
-    /* Issue command */
-    int result = ahci_issue_cmd(ctrl, port, &fis, buf, count * AHCI_SECTOR_SIZE, 0);
-
-    if (result == AHCI_SUCCESS) {
-        kprintf("[AHCI] Read completed successfully\n");
-    } else {
-        kprintf("[AHCI] Read failed with error %d\n", result);
-    }
-
-    return result;
+    return ahci_rw_buffer(port, lba, count, buf, 0);
 }
 
 int ahci_write_sectors(int port, uint64_t lba, uint32_t count, const void* buf) {
@@ -729,57 +1440,47 @@ int ahci_write_sectors(int port, uint64_t lba, uint32_t count, const void* buf)
         return AHCI_ERR_INVALID_PORT;
     }
 
-    /* Find controller with this port */
-    ahci_controller_t* ctrl = NULL;
-    for (int i = 0; i < ahci_controller_count; i++) {
-        if (ahci_controllers[i].ports_impl & (1 << port)) {
-            ctrl = &ahci_controllers[i];
-            break;
-        }
-    }
-
-    if (!ctrl || !ctrl->port_info[port].present) {
-        return AHCI_ERR_NO_DEVICE;
-    }
-
-    if (ctrl->port_info[port].type != AHCI_DEV_SATA) {
-        return AHCI_ERR_UNSUPPORTED;
-    }
+    log_event(SERIAL_LOG_DEBUG, "AHCI", "Writing %u sectors to LBA %llu on port %d\n",
+              count, lba, port);
 
-    kprintf("[AHCI] Writing %u sectors to LBA %llu on port %d\n", count, lba, port);
+    return ahci_rw_buffer(port, lba, count, (void*)buf, 1);
+}
 
-    /* Build WRITE DMA EXT command */
-    ahci_fis_reg_h2d_t fis;
-    ahci_memset(&fis, 0, sizeof(fis));
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;  /* Command */
-    fis.command = ATA_CMD_WRITE_DMA_EXT;
+int ahci_read_pages(int port, uint64_t lba, uint32_t count, const physaddr_t* pages,
+                    uint32_t offset) {
+    return ahci_rw_pages(port, lba, count, pages, offset, 0);
+}
 
-    /* LBA mode, 48-bit addressing */
-    fis.device = 1 << 6;  /* LBA mode */
+int ahci_write_pages(int port, uint64_t lba, uint32_t count, const physaddr_t* pages,
+                     uint32_t offset) {
+    return ahci_rw_pages(port, lba, count, pages, offset, 1);
+}
 
-    /* Set LBA */
-    fis.lba0 = (uint8_t)(lba & 0xFF);
-    fis.lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis.lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis.lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis.lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis.lba5 = (uint8_t)((lba >> 40) & 0xFF);
+int ahci_read_sectors_v(int port, const ahci_seg_t* segs, uint32_t count) {
+    return ahci_rw_v(port, segs, count, 0);
+}
 
-    /* Set sector count */
-    fis.countl = (uint8_t)(count & 0xFF);
-    fis.counth = (uint8_t)((count >> 8) & 0xFF);
+int ahci_write_sectors_v(int port, const ahci_seg_t* segs, uint32_t count) {
+    return ahci_rw_v(port, segs, count, 1);
+}
 
-    /* Issue command (write direction) */
-    int result = ahci_issue_cmd(ctrl, port, &fis, (void*)buf, count * AHCI_SECTOR_SIZE, 1);
+int ahci_submit(int port, ahci_request_t* req) {
+    if (port < 0 || port >= AHCI_MAX_PORTS || !req) {
+        return AHCI_ERR_INVALID_PORT;
+    }
 
-    if (result == AHCI_SUCCESS) {
-        kprintf("[AHCI] Write completed successfully\n");
-    } else {
-        kprintf("[AHCI] Write failed with error %d\n", result);
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
+    if (!ctrl) {
+        return AHCI_ERR_NO_DEVICE;
     }
+    return ahci_queue(ctrl, port, req);
+}
 
-    return result;
+void ahci_poll(int port) {
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
+    if (ctrl && ctrl->port_info[port].present) {
+        ahci_port_service(ctrl, port, AHCI_SUCCESS);
+    }
 }
 
 int ahci_flush(int port) {
@@ -787,34 +1488,15 @@ int ahci_flush(int port) {
         return AHCI_ERR_INVALID_PORT;
     }
 
-    /* Find controller with this port */
-    ahci_controller_t* ctrl = NULL;
-    for (int i = 0; i < ahci_controller_count; i++) {
-        if (ahci_controllers[i].ports_impl & (1 << port)) {
-            ctrl = &ahci_controllers[i];
-            break;
-        }
-    }
-
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
     if (!ctrl || !ctrl->port_info[port].present) {
         return AHCI_ERR_NO_DEVICE;
     }
 
-    if (ctrl->port_info[port].type != AHCI_DEV_SATA) {
-        return AHCI_ERR_UNSUPPORTED;
-    }
-
     kprintf("[AHCI] Flushing cache on port %d\n", port);
 
-    /* Build FLUSH CACHE EXT command */
-    ahci_fis_reg_h2d_t fis;
-    ahci_memset(&fis, 0, sizeof(fis));
-    fis.fis_type = FIS_TYPE_REG_H2D;
-    fis.c = 1;  /* Command */
-    fis.command = ATA_CMD_FLUSH_CACHE_EXT;
-
-    /* Issue command (no data transfer) */
-    return ahci_issue_cmd(ctrl, port, &fis, NULL, 0, 0);
+    /* Runs once the commands ahead of it have finished */
+    return ahci_run(ctrl, port, AHCI_OP_FLUSH, NULL, 0);
 }
 
 int ahci_get_controller_count(void) {
@@ -827,3 +1509,8 @@ ahci_controller_t* ahci_get_controller(int index) {
     }
     return &ahci_controllers[index];
 }
+
+blk_queue_t* ahci_get_queue(int port) {
+    ahci_controller_t* ctrl = ahci_port_ctrl(port);
+    return ctrl ? ctrl->port_info[port].blk : NULL;
+}
@@ -7,6 +7,19 @@
  *
  * AHCI uses MMIO for all communication. The HBA (Host Bus Adapter)
  * base address comes from PCI BAR5.
+ *
+ * Each port keeps a queue of requests and fills every command slot it
+ * can. When the HBA and drive both support Native Command Queuing, reads
+ * and writes go out as READ/WRITE FPDMA QUEUED, so the drive works on up
+ * to its queue depth at once and picks the order. Completions are reaped
+ * by the AHCI interrupt handler, or by whoever polls the port, and
+ * reported through each request's callback. Each SATA drive is also
+ * registered with the block layer (blk.h), whose queue merges and orders
+ * requests before they reach ahci_submit. The synchronous calls below
+ * queue their commands the same way and then sleep on the port's wait
+ * queue, so other processes run while the transfer is in flight. Until
+ * the controller has raised an interrupt (MSI where available, the
+ * legacy line otherwise), and before the scheduler runs, they poll.
  */
 
 #ifndef _AAAOS_AHCI_H
@@ -14,6 +27,8 @@
 
 #include "../../kernel/include/types.h"
 #include "../pci/pci.h"
+#include "../block/blk.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
 
 /* AHCI constants */
 #define AHCI_MAX_PORTS          32      /* Maximum ports per HBA */
@@ -125,6 +140,13 @@
 #define ATA_CMD_IDENTIFY        0xEC    /* Identify Device */
 #define ATA_CMD_IDENTIFY_PACKET 0xA1    /* Identify Packet Device (ATAPI) */
 #define ATA_CMD_FLUSH_CACHE_EXT 0xEA    /* Flush Cache Extended */
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60    /* Read FPDMA Queued (NCQ) */
+#define ATA_CMD_WRITE_FPDMA_QUEUED  0x61    /* Write FPDMA Queued (NCQ) */
+
+/* IDENTIFY DEVICE words */
+#define ATA_ID_QUEUE_DEPTH      75      /* Bits 4:0: queue depth - 1 */
+#define ATA_ID_SATA_CAP         76      /* SATA capabilities */
+#define ATA_ID_SATA_CAP_NCQ     (1 << 8)    /* Native Command Queuing */
 
 /* ATA device types */
 typedef enum {
@@ -419,8 +441,71 @@ typedef struct PACKED ALIGNED(128) {
     ahci_prdt_entry_t prdt_entry[]; /* Physical Region Descriptor Table */
 } ahci_cmd_table_t;
 
-/* Maximum PRD entries per command (can be up to 65535) */
-#define AHCI_MAX_PRDT_ENTRIES   8
+/* Maximum PRD entries per command (can be up to 65535; 248 fill the table's page) */
+#define AHCI_MAX_PRDT_ENTRIES   248
+
+/* Most sectors one READ/WRITE DMA EXT command transfers */
+#define AHCI_MAX_CMD_SECTORS    65535
+
+/**
+ * Segment of a vectored request
+ * Segments whose sectors follow each other on the disk go out as one
+ * command. Each physically contiguous run of data takes one PRD entry
+ * (two segments that abut in memory share one).
+ */
+typedef struct {
+    uint64_t lba;                   /* First sector */
+    uint32_t count;                 /* Number of sectors */
+    void* buffer;                   /* Physically contiguous, in the kernel physical map */
+} ahci_seg_t;
+
+/**
+ * Request operations
+ */
+typedef enum {
+    AHCI_OP_READ = 0,
+    AHCI_OP_WRITE,
+    AHCI_OP_FLUSH,                  /* FLUSH CACHE EXT, no segments */
+    AHCI_OP_IDENTIFY                /* IDENTIFY (PACKET) DEVICE, one 1-sector segment */
+} ahci_op_t;
+
+/* Status of a request that has not finished */
+#define AHCI_REQ_PENDING        1
+
+struct ahci_request;
+
+/**
+ * Completion callback
+ * Runs in the interrupt handler or in a polling caller, with no driver
+ * lock held; it may submit further requests.
+ */
+typedef void (*ahci_done_t)(struct ahci_request* req);
+
+/**
+ * Asynchronous request: one command
+ * The segments follow each other on the disk from segs[0].lba. The
+ * request and its segments belong to the driver until it finishes.
+ *
+ * A page-list request has one segment without a buffer; its data starts
+ * page_offset bytes into pages[0] and continues through the following
+ * pages, so scattered frames (vmalloc areas, page cache pages) need no
+ * bounce buffer. Frames that happen to be adjacent share a PRD entry.
+ */
+typedef struct ahci_request {
+    ahci_op_t op;                   /* Operation */
+    const ahci_seg_t* segs;         /* Buffers */
+    uint32_t nsegs;                 /* Number of segments */
+    const physaddr_t* pages;        /* Page list, or NULL for segment buffers */
+    uint32_t page_offset;           /* Start of the data in pages[0] */
+    ahci_done_t done;               /* Called once when finished, or NULL */
+    void* ctx;                      /* For the submitter */
+    volatile int status;            /* AHCI_REQ_PENDING, then AHCI_SUCCESS or an error */
+
+    /* Driver use */
+    uint32_t sectors;               /* Total of the segments */
+    int result;                     /* Status once retired */
+    struct ahci_request* next;      /* Pending queue or completion list */
+} ahci_request_t;
 
 /**
  * Per-port driver state
@@ -434,6 +519,21 @@ typedef struct {
     uint64_t sector_count;          /* Total sectors (from IDENTIFY) */
     char model[41];                 /* Model string (from IDENTIFY) */
     char serial[21];                /* Serial number (from IDENTIFY) */
+
+    /* Request queue (protected by lock) */
+    bool ncq;                       /* Reads and writes go out as FPDMA QUEUED */
+    uint32_t queue_depth;           /* Command slots used at once */
+    uint32_t busy;                  /* Slots holding a request */
+    uint32_t exclusive;             /* Slot of a non-queued command on an NCQ port */
+    ahci_request_t* slot_req[AHCI_MAX_CMD_SLOTS]; /* Request in each busy slot */
+    ahci_request_t* pending;        /* Waiting for a slot, oldest first */
+    ahci_request_t* pending_tail;
+    uint64_t completed;             /* Requests finished successfully */
+    uint64_t failed;                /* Requests finished with an error */
+    uint32_t max_inflight;          /* Most slots busy at once */
+    volatile uint32_t event;        /* Bumped when requests finish (wait queue word) */
+    blk_queue_t* blk;               /* Block layer queue (SATA drives) */
+    volatile int lock;              /* Taken with interrupts off */
 } ahci_port_info_t;
 
 /**
@@ -446,6 +546,11 @@ typedef struct {
     uint32_t num_ports;             /* Number of implemented ports */
     uint32_t num_cmd_slots;         /* Number of command slots */
     bool supports_64bit;            /* 64-bit DMA addressing */
+    bool supports_ncq;              /* HBA supports Native Command Queuing */
+    uint8_t irq;                    /* PCI interrupt line */
+    bool msi;                       /* Interrupts arrive as MSI messages */
+    volatile bool irq_ok;           /* An interrupt has arrived; waiters may sleep */
+    volatile bool irq_masked;       /* GHC.IE off until the block softirq has run */
     ahci_port_info_t port_info[AHCI_MAX_PORTS]; /* Per-port info */
 } ahci_controller_t;
 
@@ -479,7 +584,8 @@ ahci_port_info_t* ahci_get_port_info(int port);
  * @param port Port number
  * @param lba Starting Logical Block Address
  * @param count Number of sectors to read (max 65535)
- * @param buf Buffer to store data (must be sector-aligned)
+ * @param buf Kernel buffer to store data (even address; one outside the
+ *            physical map, such as a vmalloc area, is handled page by page)
  * @return 0 on success, negative error code on failure
  */
 int ahci_read_sectors(int port, uint64_t lba, uint32_t count, void* buf);
@@ -489,11 +595,72 @@ int ahci_read_sectors(int port, uint64_t lba, uint32_t count, void* buf);
  * @param port Port number
  * @param lba Starting Logical Block Address
  * @param count Number of sectors to write (max 65535)
- * @param buf Buffer containing data to write
+ * @param buf Kernel buffer containing data to write (as for ahci_read_sectors)
  * @return 0 on success, negative error code on failure
  */
 int ahci_write_sectors(int port, uint64_t lba, uint32_t count, const void* buf);
 
+/**
+ * Read sectors into a list of physical pages
+ * One command: the data may cross at most AHCI_MAX_PRDT_ENTRIES runs of
+ * adjacent frames.
+ * @param port Port number
+ * @param lba Starting Logical Block Address
+ * @param count Number of sectors to read (max 65535)
+ * @param pages Frames, enough to hold offset + count sectors
+ * @param offset Start of the data in pages[0] (even)
+ * @return 0 on success, negative error code on failure
+ */
+int ahci_read_pages(int port, uint64_t lba, uint32_t count, const physaddr_t* pages,
+                    uint32_t offset);
+
+/**
+ * Write sectors from a list of physical pages
+ * @param port Port number
+ * @param lba Starting Logical Block Address
+ * @param count Number of sectors to write (max 65535)
+ * @param pages Frames, enough to hold offset + count sectors
+ * @param offset Start of the data in pages[0] (even)
+ * @return 0 on success, negative error code on failure
+ */
+int ahci_write_pages(int port, uint64_t lba, uint32_t count, const physaddr_t* pages,
+                     uint32_t offset);
+
+/**
+ * Read sectors into a list of buffers
+ * @param port Port number
+ * @param segs Segments, in any order of LBA
+ * @param count Number of segments
+ * @return 0 on success, negative error code on failure
+ */
+int ahci_read_sectors_v(int port, const ahci_seg_t* segs, uint32_t count);
+
+/**
+ * Write sectors from a list of buffers
+ * @param port Port number
+ * @param segs Segments, in any order of LBA
+ * @param count Number of segments
+ * @return 0 on success, negative error code on failure
+ */
+int ahci_write_sectors_v(int port, const ahci_seg_t* segs, uint32_t count);
+
+/**
+ * Queue a request on a port
+ * req->done is called once the command finishes; until then the request
+ * and its segments must stay valid.
+ * @param port Port number
+ * @param req Request with op, segs, nsegs, done and ctx filled in
+ * @return AHCI_SUCCESS if queued, negative error code if rejected
+ *         (done is then not called)
+ */
+int ahci_submit(int port, ahci_request_t* req);
+
+/**
+ * Finish any completed requests on a port without waiting for the interrupt
+ * @param port Port number
+ */
+void ahci_poll(int port);
+
 /**
  * Get drive identification data (ATA IDENTIFY command)
  * @param port Port number
@@ -522,6 +689,15 @@ int ahci_get_controller_count(void);
  */
 ahci_controller_t* ahci_get_controller(int index);
 
+/**
+ * Get the block layer queue of a SATA drive (registered as "ahci<port>")
+ * Filesystems go through this rather than the sector calls above, so
+ * their requests are merged and scheduled.
+ * @param port Port number
+ * @return The drive's queue, or NULL if it has none
+ */
+blk_queue_t* ahci_get_queue(int port);
+
 /* Error codes */
 #define AHCI_SUCCESS            0
 #define AHCI_ERR_NO_DEVICE      (-1)    /* No device on port */
@@ -532,5 +708,7 @@ ahci_controller_t* ahci_get_controller(int index);
 #define AHCI_ERR_INVALID_PORT   (-6)    /* Invalid port number */
 #define AHCI_ERR_NO_MEMORY      (-7)    /* Memory allocation failed */
 #define AHCI_ERR_UNSUPPORTED    (-8)    /* Unsupported device type */
+#define AHCI_ERR_TOO_LARGE      (-9)    /* Segments need more PRD entries than a table holds */
+#define AHCI_ERR_BAD_BUFFER     (-10)   /* Buffer unmapped, misaligned or not DMA-addressable */
 
 #endif /* _AAAOS_AHCI_H */
@@ -0,0 +1,736 @@
+/**
+ * AAAos Kernel - NVMe (NVM Express) Driver
+ *
+ * Implementation of PCIe SSD access through NVMe controllers.
+ * Based on the NVMe 1.4 base specification.
+ */
+
+#include "nvme.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/vmalloc.h"
+#include "../../kernel/arch/x86_64/apic.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/init/initcall.h"
+#include "../../lib/libc/string.h"
+
+/* Admin command timeout in milliseconds */
+#define NVME_ADMIN_TIMEOUT      2000
+
+/* PRP entries in one list page */
+#define NVME_PRP_PER_PAGE       (PAGE_SIZE / sizeof(uint64_t))
+
+/* Largest block layer command: a first PRP entry and one full list page */
+#define NVME_BLK_MAX_BYTES      (NVME_PRP_PER_PAGE * PAGE_SIZE)
+
+_Static_assert(sizeof(nvme_sqe_t) == 64, "submission entry is 64 bytes");
+_Static_assert(sizeof(nvme_cqe_t) == 16, "completion entry is 16 bytes");
+_Static_assert(NVME_IO_DEPTH <= 64, "command IDs are a 64-bit mask");
+_Static_assert(NVME_IO_DEPTH * sizeof(nvme_sqe_t) <= PAGE_SIZE, "queue fits its page");
+
+/* Global state */
+static nvme_controller_t nvme_controllers[NVME_MAX_CONTROLLERS];
+static int nvme_controller_count = 0;
+
+/* Queue signalled on each MSI vector (by vector - IDT_MSI_BASE) */
+static nvme_queue_t* nvme_vector_queue[IDT_MSI_COUNT];
+
+/* ============================================================================
+ * Helper Functions
+ * ============================================================================ */
+
+/**
+ * Copy and trim an identify string (space padded, not terminated)
+ */
+static void nvme_copy_string(char* dest, const uint8_t* src, int len) {
+    for (int i = 0; i < len; i++) {
+        dest[i] = (char)src[i];
+    }
+    dest[len] = '\0';
+
+    while (len > 0 && dest[len - 1] == ' ') {
+        dest[--len] = '\0';
+    }
+}
+
+static inline uint32_t nvme_read32(nvme_controller_t* ctrl, uint32_t reg) {
+    return *(volatile uint32_t*)(ctrl->regs + reg);
+}
+
+static inline void nvme_write32(nvme_controller_t* ctrl, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ctrl->regs + reg) = value;
+}
+
+static inline uint64_t nvme_read64(nvme_controller_t* ctrl, uint32_t reg) {
+    return *(volatile uint64_t*)(ctrl->regs + reg);
+}
+
+static inline void nvme_write64(nvme_controller_t* ctrl, uint32_t reg, uint64_t value) {
+    *(volatile uint64_t*)(ctrl->regs + reg) = value;
+}
+
+static inline uint64_t nvme_lock(nvme_queue_t* q) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&q->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void nvme_unlock(nvme_queue_t* q, uint64_t flags) {
+    __sync_lock_release(&q->lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Wait until CSTS.RDY reads as ready
+ */
+static bool nvme_wait_ready(nvme_controller_t* ctrl, bool ready) {
+    uint64_t deadline = timer_now_ns() + (uint64_t)ctrl->ready_timeout_ms * NSEC_PER_MSEC;
+    for (;;) {
+        uint32_t csts = nvme_read32(ctrl, NVME_REG_CSTS);
+        if (csts == 0xFFFFFFFF || (ready && (csts & NVME_CSTS_CFS))) {
+            return false;
+        }
+        if (((csts & NVME_CSTS_RDY) != 0) == ready) {
+            return true;
+        }
+        if (timer_now_ns() > deadline) {
+            return false;
+        }
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* ============================================================================
+ * Queues
+ * ============================================================================ */
+
+/**
+ * Allocate a queue pair's memory and find its doorbells
+ */
+static bool nvme_queue_alloc(nvme_controller_t* ctrl, nvme_queue_t* q, uint16_t qid,
+                             uint16_t depth) {
+    memset(q, 0, sizeof(nvme_queue_t));
+
+    q->sq_phys = pmm_alloc_page();
+    q->cq_phys = pmm_alloc_page();
+    if (q->sq_phys == 0 || q->cq_phys == 0) {
+        if (q->sq_phys) {
+            pmm_free_page(q->sq_phys);
+        }
+        if (q->cq_phys) {
+            pmm_free_page(q->cq_phys);
+        }
+        return false;
+    }
+    q->sq = (nvme_sqe_t*)(VMM_KERNEL_PHYS_MAP + q->sq_phys);
+    q->cq = (nvme_cqe_t*)(VMM_KERNEL_PHYS_MAP + q->cq_phys);
+    memset(q->sq, 0, PAGE_SIZE);
+    memset(q->cq, 0, PAGE_SIZE);
+
+    volatile uint8_t* doorbells = ctrl->regs + NVME_REG_DOORBELL;
+    q->sq_doorbell = (volatile uint32_t*)(doorbells + (2 * qid) * ctrl->doorbell_stride);
+    q->cq_doorbell = (volatile uint32_t*)(doorbells + (2 * qid + 1) * ctrl->doorbell_stride);
+    q->qid = qid;
+    q->depth = depth;
+    q->phase = 1;
+    q->vector = -1;
+    q->free_cids = (1ULL << (depth - 1)) - 1;    /* A full queue keeps one entry empty */
+    return true;
+}
+
+static void nvme_queue_free(nvme_queue_t* q) {
+    pmm_free_page(q->sq_phys);
+    pmm_free_page(q->cq_phys);
+    q->sq = NULL;
+    q->cq = NULL;
+}
+
+/**
+ * Run one admin command and wait for it (setup only)
+ * @param result Set to the completion's result dword if not NULL
+ */
+static int nvme_admin(nvme_controller_t* ctrl, nvme_sqe_t* sqe, uint32_t* result) {
+    nvme_queue_t* q = &ctrl->admin;
+    uint64_t flags = nvme_lock(q);
+
+    sqe->cdw0 = (sqe->cdw0 & 0xFF) | ((uint32_t)q->sq_tail << 16);
+    q->sq[q->sq_tail] = *sqe;
+    q->sq_tail = (uint16_t)((q->sq_tail + 1) % q->depth);
+    *q->sq_doorbell = q->sq_tail;
+    q->stats.submitted++;
+    q->stats.doorbells++;
+
+    uint64_t deadline = timer_now_ns() + (uint64_t)NVME_ADMIN_TIMEOUT * NSEC_PER_MSEC;
+    volatile nvme_cqe_t* cqe = &q->cq[q->cq_head];
+    while ((cqe->status & 1) != q->phase) {
+        if (timer_now_ns() > deadline) {
+            nvme_unlock(q, flags);
+            kprintf("[NVME] Admin command 0x%02x timed out\n", sqe->cdw0 & 0xFF);
+            return NVME_ERR_TIMEOUT;
+        }
+        __asm__ __volatile__("pause");
+    }
+
+    uint16_t status = cqe->status >> 1;
+    if (result) {
+        *result = cqe->result;
+    }
+    q->cq_head = (uint16_t)((q->cq_head + 1) % q->depth);
+    if (q->cq_head == 0) {
+        q->phase ^= 1;
+    }
+    *q->cq_doorbell = q->cq_head;
+    q->stats.completed++;
+
+    nvme_unlock(q, flags);
+
+    if (status != 0) {
+        kprintf("[NVME] Admin command 0x%02x failed (status 0x%03x)\n",
+                sqe->cdw0 & 0xFF, status);
+        return NVME_ERR_STATUS;
+    }
+    return NVME_SUCCESS;
+}
+
+/**
+ * Reap a queue's completions and finish their commands
+ * Any context; block layer completions run with no queue lock held.
+ */
+static void nvme_queue_reap(nvme_queue_t* q) {
+    blk_cmd_t* done[NVME_IO_DEPTH];
+    int results[NVME_IO_DEPTH];
+    uint32_t ndone = 0;
+
+    uint64_t flags = nvme_lock(q);
+    for (;;) {
+        volatile nvme_cqe_t* cqe = &q->cq[q->cq_head];
+        if ((cqe->status & 1) != q->phase) {
+            break;
+        }
+
+        uint16_t cid = cqe->cid;
+        uint16_t status = cqe->status >> 1;
+        q->cq_head = (uint16_t)((q->cq_head + 1) % q->depth);
+        if (q->cq_head == 0) {
+            q->phase ^= 1;
+        }
+
+        if (cid < q->depth && q->cmds[cid]) {
+            done[ndone] = q->cmds[cid];
+            results[ndone] = status == 0 ? BLK_OK : BLK_ERR_IO;
+            ndone++;
+            q->cmds[cid] = NULL;
+            q->free_cids |= 1ULL << cid;
+            if (status != 0) {
+                kprintf("[NVME] Queue %u: command %u failed (status 0x%03x)\n",
+                        q->qid, cid, status);
+            }
+        }
+    }
+    if (ndone) {
+        *q->cq_doorbell = q->cq_head;
+        q->stats.completed += ndone;
+    }
+    nvme_unlock(q, flags);
+
+    for (uint32_t i = 0; i < ndone; i++) {
+        blk_complete(done[i], results[i]);
+    }
+}
+
+/**
+ * MSI-X handler: each vector belongs to one completion queue
+ */
+static void nvme_interrupt(interrupt_frame_t* frame) {
+    uint64_t index = frame->int_no - IDT_MSI_BASE;
+    if (index >= IDT_MSI_COUNT || !nvme_vector_queue[index]) {
+        return;
+    }
+
+    nvme_queue_t* q = nvme_vector_queue[index];
+    q->stats.interrupts++;
+    nvme_queue_reap(q);
+}
+
+/**
+ * Give back the MSI-X vector of a queue that is being torn down
+ */
+static void nvme_release_vector(nvme_controller_t* ctrl, nvme_queue_t* q) {
+    if (q->vector < 0) {
+        return;
+    }
+    pci_irq_free(ctrl->pci_dev, q->qid, q->vector);
+    nvme_vector_queue[q->vector - IDT_MSI_BASE] = NULL;
+    q->vector = -1;
+}
+
+/**
+ * Create I/O queue pair qid, interrupting cpu if MSI-X is on
+ */
+static bool nvme_create_io_queue(nvme_controller_t* ctrl, uint16_t qid, uint32_t cpu) {
+    nvme_queue_t* q = &ctrl->io[qid - 1];
+    if (!nvme_queue_alloc(ctrl, q, qid, (uint16_t)ctrl->io_depth)) {
+        return false;
+    }
+
+    uint32_t cq_flags = NVME_QUEUE_PHYS_CONTIG;
+    if (ctrl->msix) {
+        int vector = pci_irq_alloc(ctrl->pci_dev, qid, cpu, nvme_interrupt);
+        if (vector >= 0) {
+            q->vector = vector;
+            nvme_vector_queue[vector - IDT_MSI_BASE] = q;
+            cq_flags |= NVME_CQ_IRQ_ENABLED;
+        }
+    }
+
+    /* Completion queue first: the submission queue names it */
+    nvme_sqe_t sqe = { 0 };
+    sqe.cdw0 = NVME_ADMIN_CREATE_CQ;
+    sqe.prp1 = q->cq_phys;
+    sqe.cdw10 = ((uint32_t)(q->depth - 1) << 16) | qid;
+    sqe.cdw11 = ((uint32_t)qid << 16) | cq_flags;
+    if (nvme_admin(ctrl, &sqe, NULL) != NVME_SUCCESS) {
+        nvme_release_vector(ctrl, q);
+        nvme_queue_free(q);
+        return false;
+    }
+
+    sqe = (nvme_sqe_t){ 0 };
+    sqe.cdw0 = NVME_ADMIN_CREATE_SQ;
+    sqe.prp1 = q->sq_phys;
+    sqe.cdw10 = ((uint32_t)(q->depth - 1) << 16) | qid;
+    sqe.cdw11 = ((uint32_t)qid << 16) | NVME_QUEUE_PHYS_CONTIG;
+    if (nvme_admin(ctrl, &sqe, NULL) != NVME_SUCCESS) {
+        nvme_release_vector(ctrl, q);
+        nvme_queue_free(q);
+        return false;
+    }
+
+    return true;
+}
+
+/* ============================================================================
+ * Block Layer
+ * ============================================================================ */
+
+/**
+ * Physical address of a physical-map buffer, or 0
+ * Translation through the page tables is not safe where submit can run
+ * (completion context), so buffers must come from the physical map.
+ */
+static physaddr_t nvme_buffer_phys(const void* buffer) {
+    virtaddr_t virt = (virtaddr_t)buffer;
+    if (virt < VMM_KERNEL_PHYS_MAP || virt >= VMALLOC_BASE) {
+        return 0;
+    }
+    return (physaddr_t)(virt - VMM_KERNEL_PHYS_MAP);
+}
+
+/**
+ * Describe a command's segments with PRP1/PRP2 and, if needed, a list
+ * The block layer only joins segments on page boundaries, so every entry
+ * after the first is page aligned.
+ */
+static bool nvme_build_prps(nvme_namespace_t* ns, blk_cmd_t* cmd, nvme_sqe_t* sqe) {
+    physaddr_t list_phys = ns->prp_lists[cmd->tag];
+    uint64_t* list = (uint64_t*)(VMM_KERNEL_PHYS_MAP + list_phys);
+    uint32_t entries = 0;
+
+    for (uint32_t s = 0; s < cmd->nsegs; s++) {
+        physaddr_t phys = nvme_buffer_phys(cmd->segs[s].buffer);
+        if (phys == 0) {
+            return false;
+        }
+        physaddr_t end = phys + (uint64_t)cmd->segs[s].count * NVME_SECTOR_SIZE;
+
+        while (phys < end) {
+            if (entries == 0) {
+                sqe->prp1 = phys;
+            } else if (entries - 1 < NVME_PRP_PER_PAGE) {
+                list[entries - 1] = phys;
+            } else {
+                return false;
+            }
+            entries++;
+            phys = (phys & PAGE_MASK) + PAGE_SIZE;
+        }
+    }
+
+    sqe->prp2 = entries == 2 ? list[0] : entries > 2 ? list_phys : 0;
+    return true;
+}
+
+/**
+ * Write a command to the submitting CPU's queue; nvme_blk_commit rings it
+ */
+static int nvme_blk_submit(void* device, blk_cmd_t* cmd) {
+    nvme_namespace_t* ns = device;
+    nvme_controller_t* ctrl = ns->ctrl;
+
+    nvme_sqe_t sqe = { 0 };
+    if (!nvme_build_prps(ns, cmd, &sqe)) {
+        return NVME_ERR_BAD_BUFFER;
+    }
+    sqe.nsid = ns->nsid;
+    sqe.cdw10 = (uint32_t)cmd->lba;
+    sqe.cdw11 = (uint32_t)(cmd->lba >> 32);
+    sqe.cdw12 = cmd->sectors - 1;
+
+    nvme_queue_t* q = &ctrl->io[percpu_cpu_id() % ctrl->io_count];
+    uint64_t flags = nvme_lock(q);
+
+    /* Namespace depths are sized so that this does not happen */
+    if (q->free_cids == 0) {
+        nvme_unlock(q, flags);
+        return BLK_ERR_IO;
+    }
+    uint16_t cid = (uint16_t)__builtin_ctzll(q->free_cids);
+    q->free_cids &= ~(1ULL << cid);
+    q->cmds[cid] = cmd;
+
+    uint32_t opcode = cmd->op == BLK_OP_WRITE ? NVME_CMD_WRITE : NVME_CMD_READ;
+    sqe.cdw0 = opcode | ((uint32_t)cid << 16);
+    q->sq[q->sq_tail] = sqe;
+    q->sq_tail = (uint16_t)((q->sq_tail + 1) % q->depth);
+    q->stats.submitted++;
+
+    nvme_unlock(q, flags);
+    return 0;
+}
+
+/**
+ * Ring the doorbell of every queue holding commands the controller has
+ * not been told about
+ */
+static void nvme_blk_commit(void* device) {
+    nvme_controller_t* ctrl = ((nvme_namespace_t*)device)->ctrl;
+
+    for (uint32_t i = 0; i < ctrl->io_count; i++) {
+        nvme_queue_t* q = &ctrl->io[i];
+        if (q->sq_rung == q->sq_tail) {
+            continue;
+        }
+
+        uint64_t flags = nvme_lock(q);
+        if (q->sq_rung != q->sq_tail) {
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            *q->sq_doorbell = q->sq_tail;
+            q->sq_rung = q->sq_tail;
+            q->stats.doorbells++;
+        }
+        nvme_unlock(q, flags);
+    }
+}
+
+static void nvme_blk_poll(void* device) {
+    nvme_controller_t* ctrl = ((nvme_namespace_t*)device)->ctrl;
+
+    for (uint32_t i = 0; i < ctrl->io_count; i++) {
+        nvme_queue_reap(&ctrl->io[i]);
+    }
+}
+
+static const blk_ops_t nvme_blk_ops = {
+    .submit = nvme_blk_submit,
+    .poll = nvme_blk_poll,
+    .commit = nvme_blk_commit,
+};
+
+/**
+ * Give a namespace a block layer queue ("nvme<c>n<nsid>")
+ */
+static void nvme_blk_register(int index, nvme_namespace_t* ns, uint32_t depth) {
+    for (uint32_t t = 0; t < depth; t++) {
+        ns->prp_lists[t] = pmm_alloc_page();
+        if (ns->prp_lists[t] == 0) {
+            kprintf("[NVME] No memory for PRP lists of namespace %u\n", ns->nsid);
+            while (t--) {
+                pmm_free_page(ns->prp_lists[t]);
+            }
+            return;
+        }
+    }
+
+    char name[BLK_NAME_MAX] = "nvme";
+    int len = 4;
+    name[len++] = (char)('0' + index);
+    name[len++] = 'n';
+    if (ns->nsid >= 10) {
+        name[len++] = (char)('0' + ns->nsid / 10);
+    }
+    name[len++] = (char)('0' + ns->nsid % 10);
+    name[len] = '\0';
+
+    blk_limits_t limits = {
+        .depth = depth,
+        .max_sectors = ns->ctrl->max_sectors,
+        .max_segs = BLK_MAX_SEGS,
+        .total_sectors = ns->sectors,
+        .page_segments = true,
+    };
+    ns->blk = blk_register(name, &nvme_blk_ops, ns, &limits);
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================ */
+
+/**
+ * Identify namespace nsid and add it to the controller if usable
+ * @param buf Page in the physical map for the identify data
+ * @return true if the namespace was added
+ */
+static bool nvme_identify_namespace(nvme_controller_t* ctrl, uint32_t nsid, uint8_t* buf) {
+    memset(buf, 0, PAGE_SIZE);
+
+    nvme_sqe_t sqe = { 0 };
+    sqe.cdw0 = NVME_ADMIN_IDENTIFY;
+    sqe.nsid = nsid;
+    sqe.prp1 = (physaddr_t)((virtaddr_t)buf - VMM_KERNEL_PHYS_MAP);
+    sqe.cdw10 = NVME_CNS_NAMESPACE;
+    if (nvme_admin(ctrl, &sqe, NULL) != NVME_SUCCESS) {
+        return false;
+    }
+
+    uint64_t sectors = *(uint64_t*)&buf[0];         /* NSZE */
+    if (sectors == 0) {
+        return false;
+    }
+
+    uint8_t format = buf[26] & 0x0F;                /* FLBAS */
+    uint32_t lbaf = *(uint32_t*)&buf[128 + 4 * format];
+    uint32_t lba_shift = (lbaf >> 16) & 0xFF;       /* LBADS */
+    if (lba_shift != 9) {
+        kprintf("[NVME] Namespace %u: %u-byte LBAs not supported\n", nsid, 1U << lba_shift);
+        return false;
+    }
+
+    nvme_namespace_t* ns = &ctrl->ns[ctrl->ns_count++];
+    ns->ctrl = ctrl;
+    ns->nsid = nsid;
+    ns->sectors = sectors;
+    kprintf("[NVME] Namespace %u: %llu MB (%llu sectors)\n", nsid,
+            sectors * NVME_SECTOR_SIZE / (1024 * 1024), sectors);
+    return true;
+}
+
+/**
+ * Initialize a single NVMe controller
+ */
+static int nvme_init_controller(pci_device_t* pci_dev) {
+    if (nvme_controller_count >= NVME_MAX_CONTROLLERS) {
+        kprintf("[NVME] Maximum controller count reached\n");
+        return -1;
+    }
+
+    int index = nvme_controller_count;
+    nvme_controller_t* ctrl = &nvme_controllers[index];
+    memset(ctrl, 0, sizeof(nvme_controller_t));
+    ctrl->pci_dev = pci_dev;
+
+    uint64_t bar = pci_get_bar(pci_dev, 0);
+    if (bar == 0) {
+        kprintf("[NVME] BAR0 not configured for device %02x:%02x.%x\n",
+                pci_dev->bus, pci_dev->device, pci_dev->function);
+        return -1;
+    }
+
+    kprintf("[NVME] Found controller at %02x:%02x.%x, BAR0=0x%llx\n",
+            pci_dev->bus, pci_dev->device, pci_dev->function, bar);
+
+    pci_enable_bus_mastering(pci_dev);
+    pci_enable_memory_space(pci_dev);
+    ctrl->regs = (volatile uint8_t*)(VMM_KERNEL_PHYS_MAP + bar);
+
+    uint64_t cap = nvme_read64(ctrl, NVME_REG_CAP);
+    uint32_t vs = nvme_read32(ctrl, NVME_REG_VS);
+    ctrl->doorbell_stride = 4U << NVME_CAP_DSTRD(cap);
+    ctrl->ready_timeout_ms = MAX(NVME_CAP_TO(cap), 1U) * 500;
+    ctrl->io_depth = MIN(NVME_IO_DEPTH, NVME_CAP_MQES(cap));
+    kprintf("[NVME] Version %u.%u, %u queue entries, doorbell stride %u\n",
+            vs >> 16, (vs >> 8) & 0xFF, NVME_CAP_MQES(cap), ctrl->doorbell_stride);
+
+    if (NVME_CAP_MPSMIN(cap) != 0) {
+        kprintf("[NVME] Controller does not support 4KB pages\n");
+        return -1;
+    }
+
+    /* Reset: disable and wait for the controller to stop */
+    nvme_write32(ctrl, NVME_REG_CC, nvme_read32(ctrl, NVME_REG_CC) & ~NVME_CC_EN);
+    if (!nvme_wait_ready(ctrl, false)) {
+        kprintf("[NVME] Timeout waiting for controller to disable\n");
+        return -1;
+    }
+
+    if (!nvme_queue_alloc(ctrl, &ctrl->admin, 0, NVME_ADMIN_DEPTH)) {
+        kprintf("[NVME] No memory for admin queues\n");
+        return -1;
+    }
+    nvme_write32(ctrl, NVME_REG_AQA, ((NVME_ADMIN_DEPTH - 1) << 16) | (NVME_ADMIN_DEPTH - 1));
+    nvme_write64(ctrl, NVME_REG_ASQ, ctrl->admin.sq_phys);
+    nvme_write64(ctrl, NVME_REG_ACQ, ctrl->admin.cq_phys);
+
+    /* Admin commands are polled; pin-based interrupts stay masked */
+    nvme_write32(ctrl, NVME_REG_INTMS, 0xFFFFFFFF);
+    nvme_write32(ctrl, NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    if (!nvme_wait_ready(ctrl, true)) {
+        kprintf("[NVME] Controller did not become ready\n");
+        nvme_queue_free(&ctrl->admin);
+        return -1;
+    }
+
+    physaddr_t id_phys = pmm_alloc_page();
+    if (id_phys == 0) {
+        nvme_queue_free(&ctrl->admin);
+        return -1;
+    }
+    uint8_t* id = (uint8_t*)(VMM_KERNEL_PHYS_MAP + id_phys);
+    memset(id, 0, PAGE_SIZE);
+
+    nvme_sqe_t sqe = { 0 };
+    sqe.cdw0 = NVME_ADMIN_IDENTIFY;
+    sqe.prp1 = id_phys;
+    sqe.cdw10 = NVME_CNS_CONTROLLER;
+    if (nvme_admin(ctrl, &sqe, NULL) != NVME_SUCCESS) {
+        pmm_free_page(id_phys);
+        nvme_queue_free(&ctrl->admin);
+        return -1;
+    }
+
+    nvme_copy_string(ctrl->serial, &id[4], 20);
+    nvme_copy_string(ctrl->model, &id[24], 40);
+    uint32_t namespaces = *(uint32_t*)&id[516];     /* NN */
+
+    /* MDTS is a power of two in minimum pages, 0 for no limit */
+    uint64_t max_bytes = NVME_BLK_MAX_BYTES;
+    if (id[77] != 0) {
+        max_bytes = MIN(max_bytes, (uint64_t)PAGE_SIZE << id[77]);
+    }
+    ctrl->max_sectors = (uint32_t)(max_bytes / NVME_SECTOR_SIZE);
+
+    kprintf("[NVME] Model: %s\n", ctrl->model);
+    kprintf("[NVME] Serial: %s\n", ctrl->serial);
+
+    /* One queue pair per CPU, as far as the controller and MSI-X allow */
+    uint32_t wanted = MIN(percpu_online_count(), NVME_MAX_IO_QUEUES);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    int msix_entries = pci_msix_table_size(pci_dev);
+    ctrl->msix = apic_get_info()->enabled && msix_entries >= 2;
+    if (ctrl->msix) {
+        wanted = MIN(wanted, (uint32_t)msix_entries - 1);
+    }
+
+    uint32_t granted = 0;
+    sqe = (nvme_sqe_t){ 0 };
+    sqe.cdw0 = NVME_ADMIN_SET_FEATURES;
+    sqe.cdw10 = NVME_FEAT_NUM_QUEUES;
+    sqe.cdw11 = ((wanted - 1) << 16) | (wanted - 1);
+    if (nvme_admin(ctrl, &sqe, &granted) != NVME_SUCCESS) {
+        pmm_free_page(id_phys);
+        nvme_queue_free(&ctrl->admin);
+        return -1;
+    }
+    wanted = MIN(wanted, (granted & 0xFFFF) + 1);
+    wanted = MIN(wanted, (granted >> 16) + 1);
+
+    for (uint32_t i = 0; i < wanted; i++) {
+        if (!nvme_create_io_queue(ctrl, (uint16_t)(i + 1), i)) {
+            break;
+        }
+        ctrl->io_count++;
+    }
+    if (ctrl->io_count == 0) {
+        kprintf("[NVME] Cannot create I/O queues\n");
+        pmm_free_page(id_phys);
+        nvme_queue_free(&ctrl->admin);
+        return -1;
+    }
+    kprintf("[NVME] %u I/O queue pair(s) of %u entries, %s\n", ctrl->io_count,
+            ctrl->io_depth, ctrl->msix ? "MSI-X per queue" : "polled");
+
+    for (uint32_t nsid = 1; nsid <= namespaces && ctrl->ns_count < NVME_MAX_NAMESPACES; nsid++) {
+        nvme_identify_namespace(ctrl, nsid, id);
+    }
+    pmm_free_page(id_phys);
+
+    /*
+     * Any namespace's commands may all land on one CPU's queue, so the
+     * queues' entries are split between namespaces. One entry of each
+     * queue always stays empty.
+     */
+    uint32_t depth = 0;
+    if (ctrl->ns_count > 0) {
+        depth = MIN(BLK_MAX_DEPTH, (ctrl->io_depth - 1) / ctrl->ns_count);
+    }
+    for (uint32_t n = 0; n < ctrl->ns_count && depth > 0; n++) {
+        nvme_blk_register(index, &ctrl->ns[n], depth);
+    }
+
+    nvme_controller_count++;
+    return (int)ctrl->ns_count;
+}
+
+/* ============================================================================
+ * Public API Implementation
+ * ============================================================================ */
+
+int nvme_init(void) {
+    kprintf("[NVME] Initializing NVMe driver\n");
+
+    nvme_controller_count = 0;
+    int total_namespaces = 0;
+
+    pci_device_t* dev = NULL;
+    while ((dev = pci_find_class_next(PCI_CLASS_STORAGE, PCI_SUBCLASS_NVM, dev)) != NULL) {
+        if (dev->prog_if == NVME_PROG_IF) {
+            int namespaces = nvme_init_controller(dev);
+            if (namespaces > 0) {
+                total_namespaces += namespaces;
+            }
+        }
+    }
+
+    if (nvme_controller_count == 0) {
+        kprintf("[NVME] No NVMe controllers found\n");
+    } else {
+        kprintf("[NVME] Found %d NVMe controller(s) with %d namespace(s)\n",
+                nvme_controller_count, total_namespaces);
+    }
+
+    return nvme_controller_count;
+}
+
+/**
+ * Boot initcall
+ */
+static bool nvme_initcall(void) {
+    return nvme_init() >= 0;
+}
+INITCALL(nvme, nvme_initcall, 0, "pci");
+
+nvme_controller_t* nvme_get_controller(int index) {
+    if (index < 0 || index >= nvme_controller_count) {
+        return NULL;
+    }
+    return &nvme_controllers[index];
+}
+
+void nvme_dump_stats(void) {
+    for (int c = 0; c < nvme_controller_count; c++) {
+        nvme_controller_t* ctrl = &nvme_controllers[c];
+        for (uint32_t i = 0; i < ctrl->io_count; i++) {
+            nvme_queue_t* q = &ctrl->io[i];
+            kprintf("[NVME] nvme%d queue %u: %llu submitted, %llu completed, "
+                    "%llu doorbells, %llu interrupts\n",
+                    c, q->qid, q->stats.submitted, q->stats.completed,
+                    q->stats.doorbells, q->stats.interrupts);
+        }
+    }
+}
@@ -0,0 +1,210 @@
+/**
+ * AAAos Kernel - NVMe (NVM Express) Driver
+ *
+ * Drives PCIe SSDs through the NVMe 1.x register interface. Controllers
+ * are found by PCI class (mass storage, non-volatile memory, prog_if 2).
+ * The admin queue is used only during setup, polled.
+ *
+ * Each online CPU gets its own I/O submission/completion queue pair, so
+ * CPUs submit without contending for one queue lock. With MSI-X, the
+ * completion queue of a CPU interrupts that CPU on a vector of its own
+ * and is reaped there; without it, completions are found by polling.
+ *
+ * Every namespace with 512-byte LBAs is registered with the block layer
+ * (blk.h) as "nvme<controller>n<nsid>". Commands are written to the
+ * submitting CPU's queue as the block layer dispatches them, and the
+ * doorbell is rung once per dispatch round (the commit operation), not
+ * once per command. Buffers are described by PRP entries, so merged
+ * requests only meet on page boundaries.
+ */
+
+#ifndef _AAAOS_NVME_H
+#define _AAAOS_NVME_H
+
+#include "../../kernel/include/types.h"
+#include "../pci/pci.h"
+#include "../block/blk.h"
+
+/* NVMe Programming Interface (class 0x01, subclass 0x08) */
+#define NVME_PROG_IF            0x02
+
+/* Driver configuration */
+#define NVME_MAX_CONTROLLERS    2
+#define NVME_MAX_NAMESPACES     4       /* Per controller */
+#define NVME_MAX_IO_QUEUES      16      /* One per CPU, up to PERCPU_MAX_CPUS */
+#define NVME_ADMIN_DEPTH        16      /* Admin queue entries */
+#define NVME_IO_DEPTH           64      /* I/O queue entries (capped by CAP.MQES) */
+#define NVME_SECTOR_SIZE        512
+
+/* Controller registers (offsets from BAR0) */
+#define NVME_REG_CAP            0x00    /* Capabilities (64-bit) */
+#define NVME_REG_VS             0x08    /* Version */
+#define NVME_REG_INTMS          0x0C    /* Interrupt mask set */
+#define NVME_REG_INTMC          0x10    /* Interrupt mask clear */
+#define NVME_REG_CC             0x14    /* Controller configuration */
+#define NVME_REG_CSTS           0x1C    /* Controller status */
+#define NVME_REG_AQA            0x24    /* Admin queue attributes */
+#define NVME_REG_ASQ            0x28    /* Admin submission queue base (64-bit) */
+#define NVME_REG_ACQ            0x30    /* Admin completion queue base (64-bit) */
+#define NVME_REG_DOORBELL       0x1000  /* First doorbell */
+
+/* CAP fields */
+#define NVME_CAP_MQES(cap)      ((uint32_t)((cap) & 0xFFFF) + 1)    /* Queue entries */
+#define NVME_CAP_TO(cap)        ((uint32_t)(((cap) >> 24) & 0xFF))  /* Ready timeout, 500ms */
+#define NVME_CAP_DSTRD(cap)     ((uint32_t)(((cap) >> 32) & 0xF))   /* Doorbell stride */
+#define NVME_CAP_MPSMIN(cap)    ((uint32_t)(((cap) >> 48) & 0xF))   /* Min page, 4KB << n */
+
+/* CC bits */
+#define NVME_CC_EN              (1 << 0)
+#define NVME_CC_IOSQES          (6 << 16)   /* 64-byte submission entries */
+#define NVME_CC_IOCQES          (4 << 20)   /* 16-byte completion entries */
+
+/* CSTS bits */
+#define NVME_CSTS_RDY           (1 << 0)
+#define NVME_CSTS_CFS           (1 << 1)    /* Controller fatal status */
+
+/* Admin opcodes */
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+/* NVM opcodes */
+#define NVME_CMD_FLUSH          0x00
+#define NVME_CMD_WRITE          0x01
+#define NVME_CMD_READ           0x02
+
+/* Identify CNS values */
+#define NVME_CNS_NAMESPACE      0x00
+#define NVME_CNS_CONTROLLER     0x01
+
+/* Feature identifiers */
+#define NVME_FEAT_NUM_QUEUES    0x07
+
+/* Queue creation flags (CDW11) */
+#define NVME_QUEUE_PHYS_CONTIG  (1 << 0)
+#define NVME_CQ_IRQ_ENABLED     (1 << 1)
+
+/* Error codes */
+#define NVME_SUCCESS            0
+#define NVME_ERR_TIMEOUT        (-1)
+#define NVME_ERR_STATUS         (-2)    /* The controller failed the command */
+#define NVME_ERR_NO_MEMORY      (-3)
+#define NVME_ERR_NO_DEVICE      (-4)
+#define NVME_ERR_BAD_BUFFER     (-5)    /* Buffer outside the physical map */
+
+/**
+ * Submission queue entry
+ */
+typedef struct PACKED {
+    uint32_t cdw0;                      /* Opcode (7:0), command ID (31:16) */
+    uint32_t nsid;
+    uint64_t rsvd;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} nvme_sqe_t;
+
+/**
+ * Completion queue entry
+ */
+typedef struct PACKED {
+    uint32_t result;                    /* Command specific */
+    uint32_t rsvd;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;                    /* Phase (bit 0), status field (15:1) */
+} nvme_cqe_t;
+
+/**
+ * Queue statistics
+ */
+typedef struct nvme_queue_stats {
+    uint64_t submitted;                 /* Commands written to the queue */
+    uint64_t completed;                 /* Completions reaped */
+    uint64_t doorbells;                 /* Submission doorbell writes */
+    uint64_t interrupts;                /* Interrupts taken */
+} nvme_queue_stats_t;
+
+/**
+ * Submission/completion queue pair
+ */
+typedef struct nvme_queue {
+    nvme_sqe_t* sq;
+    nvme_cqe_t* cq;
+    physaddr_t sq_phys;
+    physaddr_t cq_phys;
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+    uint16_t qid;
+    uint16_t depth;                     /* Entries; one stays empty */
+    uint16_t sq_tail;                   /* Next entry to write */
+    uint16_t sq_rung;                   /* Tail the controller was last told */
+    uint16_t cq_head;                   /* Next completion to read */
+    uint8_t phase;                      /* Phase bit of a new completion */
+    int vector;                         /* IDT vector, or -1 if polled */
+    uint64_t free_cids;                 /* Bit set for each command ID not in flight */
+    blk_cmd_t* cmds[NVME_IO_DEPTH];     /* In flight, by command ID */
+    nvme_queue_stats_t stats;
+    volatile int lock;                  /* Taken with interrupts off */
+} nvme_queue_t;
+
+struct nvme_controller;
+
+/**
+ * Namespace
+ */
+typedef struct nvme_namespace {
+    struct nvme_controller* ctrl;
+    uint32_t nsid;
+    uint64_t sectors;
+    blk_queue_t* blk;
+    physaddr_t prp_lists[BLK_MAX_DEPTH];    /* PRP list page of each block layer tag */
+} nvme_namespace_t;
+
+/**
+ * Controller
+ */
+typedef struct nvme_controller {
+    pci_device_t* pci_dev;
+    volatile uint8_t* regs;
+    uint32_t doorbell_stride;           /* Bytes between doorbells */
+    uint32_t ready_timeout_ms;
+    uint32_t max_sectors;               /* Largest transfer */
+    uint32_t io_depth;
+    char model[41];
+    char serial[21];
+    bool msix;
+    nvme_queue_t admin;
+    nvme_queue_t io[NVME_MAX_IO_QUEUES];
+    uint32_t io_count;
+    nvme_namespace_t ns[NVME_MAX_NAMESPACES];
+    uint32_t ns_count;
+} nvme_controller_t;
+
+/**
+ * Find and set up every NVMe controller
+ * Call after the application processors are online, so each gets a queue.
+ * @return Number of controllers initialized
+ */
+int nvme_init(void);
+
+/**
+ * Get a controller by index
+ * @return The controller, or NULL past the last one
+ */
+nvme_controller_t* nvme_get_controller(int index);
+
+/**
+ * Print per-queue statistics (for debugging)
+ */
+void nvme_dump_stats(void);
+
+#endif /* _AAAOS_NVME_H */
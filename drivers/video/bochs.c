@@ -0,0 +1,73 @@
+/**
+ * AAAos Kernel - Bochs/QEMU Display Interface (DISPI) Implementation
+ */
+
+#include "bochs.h"
+#include "../../kernel/arch/x86_64/io.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/sched/clock.h"
+
+static uint16_t bochs_read(uint16_t index) {
+    outw(BOCHS_DISPI_INDEX_PORT, index);
+    return inw(BOCHS_DISPI_DATA_PORT);
+}
+
+static void bochs_write(uint16_t index, uint16_t value) {
+    outw(BOCHS_DISPI_INDEX_PORT, index);
+    outw(BOCHS_DISPI_DATA_PORT, value);
+}
+
+/**
+ * Check for a DISPI display in a given mode
+ */
+uint32_t bochs_probe(uint32_t width, uint32_t height, uint32_t bpp, uint32_t pitch) {
+    uint16_t id = bochs_read(BOCHS_DISPI_ID);
+    if (id < BOCHS_DISPI_ID_MIN || id > BOCHS_DISPI_ID_MAX) {
+        return 0;
+    }
+
+    /* Only flip what the boot loader's framebuffer actually shows */
+    if (!(bochs_read(BOCHS_DISPI_ENABLE) & BOCHS_DISPI_ENABLED) ||
+        bochs_read(BOCHS_DISPI_XRES) != width || bochs_read(BOCHS_DISPI_YRES) != height ||
+        bochs_read(BOCHS_DISPI_BPP) != bpp ||
+        (uint32_t)bochs_read(BOCHS_DISPI_VIRT_WIDTH) * (bpp / 8) != pitch) {
+        kprintf("[BOCHS] DISPI 0x%x present but not in the boot mode\n", (uint32_t)id);
+        return 0;
+    }
+
+    /* The virtual height grows to whatever VRAM holds at this pitch */
+    uint32_t virt_height = bochs_read(BOCHS_DISPI_VIRT_HEIGHT);
+    kprintf("[BOCHS] DISPI 0x%x, %ux%u, virtual height %u\n",
+            (uint32_t)id, width, height, virt_height);
+    return height ? virt_height / height : 0;
+}
+
+/**
+ * Scan out the virtual screen from a given line
+ */
+void bochs_set_y_offset(uint32_t y) {
+    bochs_write(BOCHS_DISPI_X_OFFSET, 0);
+    bochs_write(BOCHS_DISPI_Y_OFFSET, (uint16_t)y);
+}
+
+/**
+ * Wait for the start of the next vertical retrace
+ */
+bool bochs_wait_vblank(uint64_t timeout_ns) {
+    uint64_t deadline = clock_monotonic_ns() + timeout_ns;
+
+    /* Let a retrace in progress end, then catch the next one starting */
+    while (inb(BOCHS_VGA_STATUS_PORT) & BOCHS_VGA_STATUS_VRETRACE) {
+        if (clock_monotonic_ns() >= deadline) {
+            return false;
+        }
+        __asm__ __volatile__("pause");
+    }
+    while (!(inb(BOCHS_VGA_STATUS_PORT) & BOCHS_VGA_STATUS_VRETRACE)) {
+        if (clock_monotonic_ns() >= deadline) {
+            return false;
+        }
+        __asm__ __volatile__("pause");
+    }
+    return true;
+}
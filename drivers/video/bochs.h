@@ -0,0 +1,62 @@
+/**
+ * AAAos Kernel - Bochs/QEMU Display Interface (DISPI)
+ *
+ * The Bochs VBE extensions, also emulated by QEMU's standard VGA, expose
+ * the linear framebuffer as a virtual screen taller than the visible one.
+ * Moving the Y offset selects which part is scanned out, which lets the
+ * framebuffer driver flip between whole pages. Vertical retrace is read
+ * from the legacy VGA input status register.
+ */
+
+#ifndef _AAAOS_BOCHS_H
+#define _AAAOS_BOCHS_H
+
+#include "../../kernel/include/types.h"
+
+/* I/O ports */
+#define BOCHS_DISPI_INDEX_PORT      0x01CE
+#define BOCHS_DISPI_DATA_PORT       0x01CF
+#define BOCHS_VGA_STATUS_PORT       0x03DA  /* Input status register 1 */
+
+/* Registers */
+#define BOCHS_DISPI_ID              0x0
+#define BOCHS_DISPI_XRES            0x1
+#define BOCHS_DISPI_YRES            0x2
+#define BOCHS_DISPI_BPP             0x3
+#define BOCHS_DISPI_ENABLE          0x4
+#define BOCHS_DISPI_VIRT_WIDTH      0x6
+#define BOCHS_DISPI_VIRT_HEIGHT     0x7
+#define BOCHS_DISPI_X_OFFSET        0x8
+#define BOCHS_DISPI_Y_OFFSET        0x9
+
+/* Interface versions with the virtual screen and offsets */
+#define BOCHS_DISPI_ID_MIN          0xB0C2
+#define BOCHS_DISPI_ID_MAX          0xB0C5
+
+#define BOCHS_DISPI_ENABLED         BIT(0)  /* ENABLE: VBE mode active */
+#define BOCHS_VGA_STATUS_VRETRACE   BIT(3)  /* Status: in vertical retrace */
+
+/**
+ * Check for a DISPI display in a given mode
+ * @param width Visible width the boot loader set up
+ * @param height Visible height
+ * @param bpp Bits per pixel
+ * @param pitch Bytes per scanline
+ * @return Number of whole pages the virtual screen holds, or 0 if there
+ *         is no DISPI display or it is in another mode
+ */
+uint32_t bochs_probe(uint32_t width, uint32_t height, uint32_t bpp, uint32_t pitch);
+
+/**
+ * Scan out the virtual screen from a given line
+ */
+void bochs_set_y_offset(uint32_t y);
+
+/**
+ * Wait for the start of the next vertical retrace
+ * @param timeout_ns Longest time to spin
+ * @return true if a retrace started, false on timeout
+ */
+bool bochs_wait_vblank(uint64_t timeout_ns);
+
+#endif /* _AAAOS_BOCHS_H */
@@ -5,19 +5,102 @@
  */
 
 #include "framebuffer.h"
+#include "pixops.h"
+#include "bochs.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/heap.h"
+#include "../../lib/libc/string.h"
 
 /* Global framebuffer state */
 static framebuffer_t fb_info = {
     .address = NULL,
+    .shadow = NULL,
     .width = 0,
     .height = 0,
     .pitch = 0,
     .bpp = 0,
     .size = 0,
+    .page_count = 1,
+    .front_page = 0,
     .initialized = false
 };
 
+/**
+ * Screen area a page has not caught up with yet
+ */
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} fb_rect_t;
+
+/* Scanout pages, and what each missed while the other was drawn on */
+static uint32_t *fb_pages[FB_MAX_PAGES];
+static fb_rect_t fb_stale[FB_MAX_PAGES][FB_STALE_RECTS];
+static uint32_t fb_stale_count[FB_MAX_PAGES];
+
+/* DISPI present, so the retrace can be read */
+static bool fb_has_vblank = false;
+
+/* Pointer sprite, and where it is drawn on the visible page */
+static uint32_t fb_cursor_image[FB_CURSOR_SIZE * FB_CURSOR_SIZE];
+static uint32_t fb_cursor_pixels[FB_CURSOR_SIZE * FB_CURSOR_SIZE];
+static int fb_cursor_hot_x;
+static int fb_cursor_hot_y;
+static int fb_cursor_x;
+static int fb_cursor_y;
+static bool fb_cursor_loaded = false;
+static bool fb_cursor_visible = false;
+static bool fb_cursor_drawn = false;
+static bool fb_cursor_hit = false;     /* Drawn over since it was put up */
+static fb_rect_t fb_cursor_rect;
+
+/* Built-in arrow: X outline, . fill, anything else see-through */
+static const char *const fb_arrow[] = {
+    "X",
+    "XX",
+    "X.X",
+    "X..X",
+    "X...X",
+    "X....X",
+    "X.....X",
+    "X......X",
+    "X.......X",
+    "X........X",
+    "X.........X",
+    "X..........X",
+    "X......XXXXX",
+    "X...X..X",
+    "X..XX..X",
+    "X.X  X..X",
+    "XX   X..X",
+    "X     X..X",
+    "      X..X",
+    "       XX",
+};
+
+static void fb_cursor_erase(void);
+static void fb_cursor_paint(void);
+
+/**
+ * Glyph cache slot: one character expanded in one color pair
+ */
+typedef struct {
+    uint32_t pixels[FB_FONT_WIDTH * FB_FONT_HEIGHT];
+    uint32_t fg;
+    uint32_t bg;
+    char ch;
+    bool valid;
+} fb_glyph_entry_t;
+
+static fb_glyph_entry_t fb_glyph_cache[FB_GLYPH_CACHE_SIZE];
+static fb_glyph_stats_t fb_glyph_stats;
+
+/* Where fb_draw_text assembles a run before putting it on screen */
+static uint32_t fb_text_run[FB_FONT_HEIGHT * FB_TEXT_RUN_MAX * FB_FONT_WIDTH];
+
 /**
  * Basic 8x16 bitmap font (ASCII 32-126)
  * Each character is 8 pixels wide and 16 pixels tall.
@@ -339,6 +422,46 @@ int fb_init(boot_info_t *boot_info) {
     fb_info.pitch = boot_info->fb_pitch;
     fb_info.bpp = boot_info->fb_bpp;
     fb_info.size = fb_info.pitch * fb_info.height;
+
+    /* A second page to flip to, if the display has room for one */
+    uint32_t pages = bochs_probe(fb_info.width, fb_info.height, fb_info.bpp, fb_info.pitch);
+    fb_has_vblank = pages > 0;
+    pages = MIN(MAX(pages, 1U), (uint32_t)FB_MAX_PAGES);
+
+    /* Stores to a write-combining mapping go out as whole bursts */
+    physaddr_t start = ALIGN_DOWN(boot_info->framebuffer, PAGE_SIZE);
+    physaddr_t end = ALIGN_UP(boot_info->framebuffer + (uint64_t)fb_info.size * pages,
+                              PAGE_SIZE);
+    if (!vmm_map_pages(start, start, (end - start) / PAGE_SIZE, VMM_FLAGS_FRAMEBUFFER)) {
+        kprintf("[FB] ERROR: Cannot map the framebuffer\n");
+        return -4;
+    }
+
+    /* Reads from VRAM are uncached even when writes combine; keep a copy */
+    if (fb_info.shadow) {
+        kfree(fb_info.shadow);
+    }
+    fb_info.shadow = (uint32_t *)kmalloc(fb_info.size);
+    if (fb_info.shadow) {
+        /* Whatever the firmware left on screen reads back as 0 */
+        memset(fb_info.shadow, 0, fb_info.size);
+    } else {
+        kprintf("[FB] Warning: No shadow buffer, reads will come from VRAM\n");
+    }
+
+    /* Pages catch up from the shadow, so flipping needs one */
+    fb_info.page_count = fb_info.shadow ? pages : 1;
+    fb_info.front_page = 0;
+    for (uint32_t i = 0; i < FB_MAX_PAGES; i++) {
+        fb_pages[i] = (uint32_t *)((uint8_t *)fb_info.address + (uint64_t)i * fb_info.size);
+        fb_stale_count[i] = 0;
+    }
+    if (fb_info.page_count > 1) {
+        bochs_set_y_offset(0);
+        fb_stale[1][0] = (fb_rect_t){ 0, 0, (int)fb_info.width, (int)fb_info.height };
+        fb_stale_count[1] = 1;
+    }
+    fb_cursor_drawn = false;
     fb_info.initialized = true;
 
     kprintf("[FB] Framebuffer initialized:\n");
@@ -347,6 +470,9 @@ int fb_init(boot_info_t *boot_info) {
     kprintf("[FB]   Pitch: %u bytes\n", fb_info.pitch);
     kprintf("[FB]   BPP: %u\n", fb_info.bpp);
     kprintf("[FB]   Size: %u bytes\n", fb_info.size);
+    kprintf("[FB]   Caching: %s\n", vmm_write_combining() ? "write-combining" : "write-through");
+    kprintf("[FB]   Pages: %u%s\n", fb_info.page_count,
+            fb_info.page_count > 1 ? " (page flipping)" : "");
 
     return 0;
 }
@@ -373,6 +499,97 @@ static inline uint32_t *fb_pixel_addr(int x, int y) {
     return (uint32_t *)((uint8_t *)fb_info.address + y * fb_info.pitch + x * (fb_info.bpp / 8));
 }
 
+/**
+ * Helper: Shadow pixel matching fb_pixel_addr (shadow must be set)
+ */
+static inline uint32_t *fb_shadow_addr(int x, int y) {
+    return (uint32_t *)((uint8_t *)fb_info.shadow + y * fb_info.pitch + x * (fb_info.bpp / 8));
+}
+
+/**
+ * Helper: Scanline length in pixels
+ */
+static inline uint32_t fb_pitch_pixels(void) {
+    return fb_info.pitch / (fb_info.bpp / 8);
+}
+
+/**
+ * Helper: Pixel on a given page
+ */
+static inline uint32_t *fb_page_addr(uint32_t page, int x, int y) {
+    return (uint32_t *)((uint8_t *)fb_pages[page] + y * fb_info.pitch + x * (fb_info.bpp / 8));
+}
+
+static inline uint64_t fb_rect_area(const fb_rect_t *r) {
+    return (uint64_t)r->w * (uint64_t)r->h;
+}
+
+static fb_rect_t fb_rect_union(const fb_rect_t *a, const fb_rect_t *b) {
+    int x0 = MIN(a->x, b->x);
+    int y0 = MIN(a->y, b->y);
+    int x1 = MAX(a->x + a->w, b->x + b->w);
+    int y1 = MAX(a->y + a->h, b->y + b->h);
+    return (fb_rect_t){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+/**
+ * Helper: Record that a page missed a clipped rectangle
+ * The rectangle joins an entry whose bounding box it fills exactly, else
+ * takes a free entry, else joins the entry it grows least.
+ */
+static void fb_mark_stale(uint32_t page, int x, int y, int w, int h) {
+    fb_rect_t r = { x, y, w, h };
+    fb_rect_t *list = fb_stale[page];
+    uint32_t count = fb_stale_count[page];
+    uint32_t best = 0;
+    uint64_t best_growth = UINT64_MAX;
+
+    for (uint32_t i = 0; i < count; i++) {
+        fb_rect_t u = fb_rect_union(&list[i], &r);
+        if (fb_rect_area(&u) <= fb_rect_area(&list[i]) + fb_rect_area(&r)) {
+            list[i] = u;
+            return;
+        }
+        uint64_t growth = fb_rect_area(&u) - fb_rect_area(&list[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+
+    if (count < FB_STALE_RECTS) {
+        list[count] = r;
+        fb_stale_count[page] = count + 1;
+    } else {
+        list[best] = fb_rect_union(&list[best], &r);
+    }
+}
+
+/**
+ * Helper: Note a clipped rectangle drawn on the visible page
+ */
+static inline void fb_touched(int x, int y, int w, int h) {
+    if (fb_cursor_drawn && x < fb_cursor_rect.x + fb_cursor_rect.w &&
+        x + w > fb_cursor_rect.x && y < fb_cursor_rect.y + fb_cursor_rect.h &&
+        y + h > fb_cursor_rect.y) {
+        fb_cursor_hit = true;
+    }
+    if (fb_info.page_count > 1) {
+        fb_mark_stale(fb_info.front_page ^ 1, x, y, w, h);
+    }
+}
+
+/**
+ * Helper: Fill a clipped rectangle on screen and in the shadow
+ */
+static void fb_fill_clipped(int x, int y, int w, int h, uint32_t color) {
+    pixops_fill_rect(fb_pixel_addr(x, y), fb_pitch_pixels(), w, h, color);
+    if (fb_info.shadow) {
+        pixops_fill_rect(fb_shadow_addr(x, y), fb_pitch_pixels(), w, h, color);
+    }
+    fb_touched(x, y, w, h);
+}
+
 /**
  * Helper: Check if coordinates are within bounds
  */
@@ -381,6 +598,16 @@ static inline bool fb_in_bounds(int x, int y) {
            y >= 0 && y < (int)fb_info.height;
 }
 
+/**
+ * Helper: Draw a pixel in bounds without noting it for the hidden page
+ */
+static inline void fb_plot(int x, int y, uint32_t color) {
+    *fb_pixel_addr(x, y) = color;
+    if (fb_info.shadow) {
+        *fb_shadow_addr(x, y) = color;
+    }
+}
+
 /**
  * Draw a single pixel
  */
@@ -388,7 +615,8 @@ void fb_put_pixel(int x, int y, uint32_t color) {
     if (!fb_info.initialized) return;
     if (!fb_in_bounds(x, y)) return;
 
-    *fb_pixel_addr(x, y) = color;
+    fb_plot(x, y, color);
+    fb_touched(x, y, 1, 1);
 }
 
 /**
@@ -398,7 +626,8 @@ uint32_t fb_get_pixel(int x, int y) {
     if (!fb_info.initialized) return 0;
     if (!fb_in_bounds(x, y)) return 0;
 
-    return *fb_pixel_addr(x, y);
+    /* VRAM reads are uncached, so use the shadow when there is one */
+    return fb_info.shadow ? *fb_shadow_addr(x, y) : *fb_pixel_addr(x, y);
 }
 
 /**
@@ -414,10 +643,7 @@ void fb_draw_hline(int x, int y, int w, uint32_t color) {
 
     if (x_start >= x_end) return;
 
-    uint32_t *pixel = fb_pixel_addr(x_start, y);
-    for (int i = x_start; i < x_end; i++) {
-        *pixel++ = color;
-    }
+    fb_fill_clipped(x_start, y, x_end - x_start, 1, color);
 }
 
 /**
@@ -433,13 +659,7 @@ void fb_draw_vline(int x, int y, int h, uint32_t color) {
 
     if (y_start >= y_end) return;
 
-    uint32_t *pixel = fb_pixel_addr(x, y_start);
-    uint32_t pitch_pixels = fb_info.pitch / (fb_info.bpp / 8);
-
-    for (int i = y_start; i < y_end; i++) {
-        *pixel = color;
-        pixel += pitch_pixels;
-    }
+    fb_fill_clipped(x, y_start, 1, y_end - y_start, color);
 }
 
 /**
@@ -456,17 +676,220 @@ void fb_fill_rect(int x, int y, int w, int h, uint32_t color) {
 
     if (x_start >= x_end || y_start >= y_end) return;
 
-    int row_width = x_end - x_start;
-    uint32_t pitch_pixels = fb_info.pitch / (fb_info.bpp / 8);
+    fb_fill_clipped(x_start, y_start, x_end - x_start, y_end - y_start, color);
+}
+
+/**
+ * Helper: Copy a buffer to the visible page, or with staged set to the
+ * page fb_present shows next
+ */
+static void fb_copy_in(int x, int y, int w, int h, const uint32_t *src, ptrdiff_t src_stride,
+                       bool staged) {
+    if (!fb_info.initialized || src == NULL) return;
 
-    uint32_t *row_start = fb_pixel_addr(x_start, y_start);
-    for (int row = y_start; row < y_end; row++) {
-        uint32_t *pixel = row_start;
-        for (int col = 0; col < row_width; col++) {
-            *pixel++ = color;
+    /* Clip to screen bounds, moving src along with the origin */
+    int x_start = (x < 0) ? 0 : x;
+    int y_start = (y < 0) ? 0 : y;
+    int x_end = (x + w > (int)fb_info.width) ? (int)fb_info.width : x + w;
+    int y_end = (y + h > (int)fb_info.height) ? (int)fb_info.height : y + h;
+
+    if (x_start >= x_end || y_start >= y_end) return;
+
+    src += (ptrdiff_t)(y_start - y) * src_stride + (x_start - x);
+    w = x_end - x_start;
+    h = y_end - y_start;
+
+    if (fb_info.shadow) {
+        pixops_copy_rect(fb_shadow_addr(x_start, y_start), fb_pitch_pixels(),
+                         src, src_stride, w, h);
+    }
+
+    if (staged && fb_info.page_count > 1) {
+        uint32_t back = fb_info.front_page ^ 1;
+        pixops_copy_rect(fb_page_addr(back, x_start, y_start), fb_pitch_pixels(),
+                         src, src_stride, w, h);
+        fb_mark_stale(fb_info.front_page, x_start, y_start, w, h);
+        return;
+    }
+
+    pixops_copy_rect(fb_pixel_addr(x_start, y_start), fb_pitch_pixels(), src, src_stride, w, h);
+    fb_touched(x_start, y_start, w, h);
+}
+
+/**
+ * Copy a buffer of pixels to the screen
+ */
+void fb_write_rect(int x, int y, int w, int h, const uint32_t *src, ptrdiff_t src_stride) {
+    fb_copy_in(x, y, w, h, src, src_stride, false);
+}
+
+/**
+ * Draw part of the next frame
+ */
+void fb_stage_rect(int x, int y, int w, int h, const uint32_t *src, ptrdiff_t src_stride) {
+    fb_copy_in(x, y, w, h, src, src_stride, true);
+}
+
+/**
+ * Show the frame built with fb_stage_rect
+ */
+bool fb_present(void) {
+    if (!fb_info.initialized) {
+        return false;
+    }
+    if (fb_info.page_count < 2) {
+        /* The frame went straight to the screen, maybe over the pointer */
+        if (fb_cursor_hit) {
+            fb_cursor_erase();
+            fb_cursor_paint();
         }
-        row_start += pitch_pixels;
+        return false;
+    }
+
+    /* Catch the hidden page up with what was drawn on the visible one */
+    uint32_t back = fb_info.front_page ^ 1;
+    uint32_t pitch_pixels = fb_pitch_pixels();
+    for (uint32_t i = 0; i < fb_stale_count[back]; i++) {
+        const fb_rect_t *r = &fb_stale[back][i];
+        pixops_copy_rect(fb_page_addr(back, r->x, r->y), pitch_pixels,
+                         fb_shadow_addr(r->x, r->y), pitch_pixels, r->w, r->h);
     }
+    fb_stale_count[back] = 0;
+
+    /* The offset is latched at the start of the next frame */
+    bochs_wait_vblank(FB_VBLANK_TIMEOUT_NS);
+    bochs_set_y_offset(back * fb_info.height);
+    fb_info.front_page = back;
+    fb_info.address = fb_pages[back];
+
+    /* The pointer stays on the old page until it catches up next time */
+    fb_cursor_drawn = false;
+    fb_cursor_paint();
+    return true;
+}
+
+/**
+ * Wait for the start of the next vertical retrace
+ */
+bool fb_wait_vblank(uint64_t timeout_ns) {
+    return fb_has_vblank && bochs_wait_vblank(timeout_ns);
+}
+
+/**
+ * Helper: Put the shadow back where the pointer is drawn
+ */
+static void fb_cursor_erase(void) {
+    if (!fb_cursor_drawn) {
+        return;
+    }
+
+    const fb_rect_t *r = &fb_cursor_rect;
+    pixops_copy_rect(fb_pixel_addr(r->x, r->y), fb_pitch_pixels(),
+                     fb_shadow_addr(r->x, r->y), fb_pitch_pixels(), r->w, r->h);
+    fb_cursor_drawn = false;
+}
+
+/**
+ * Helper: Blend the pointer over the shadow onto the visible page
+ */
+static void fb_cursor_paint(void) {
+    fb_cursor_hit = false;
+    if (!fb_cursor_visible || !fb_info.shadow || !fb_cursor_loaded) {
+        return;
+    }
+
+    /* Clip the sprite to the screen */
+    int left = fb_cursor_x - fb_cursor_hot_x;
+    int top = fb_cursor_y - fb_cursor_hot_y;
+    int x_start = MAX(left, 0);
+    int y_start = MAX(top, 0);
+    int x_end = MIN(left + FB_CURSOR_SIZE, (int)fb_info.width);
+    int y_end = MIN(top + FB_CURSOR_SIZE, (int)fb_info.height);
+    if (x_start >= x_end || y_start >= y_end) {
+        return;
+    }
+
+    int w = x_end - x_start;
+    int h = y_end - y_start;
+    for (int row = 0; row < h; row++) {
+        const uint32_t *under = fb_shadow_addr(x_start, y_start + row);
+        const uint32_t *sprite = &fb_cursor_image[(y_start - top + row) * FB_CURSOR_SIZE +
+                                                  (x_start - left)];
+        uint32_t *out = &fb_cursor_pixels[row * FB_CURSOR_SIZE];
+        for (int col = 0; col < w; col++) {
+            out[col] = pixops_blend_pixel(sprite[col], under[col]);
+        }
+    }
+    pixops_copy_rect(fb_pixel_addr(x_start, y_start), fb_pitch_pixels(),
+                     fb_cursor_pixels, FB_CURSOR_SIZE, w, h);
+
+    /* This page shows the pointer until it next catches up from the shadow */
+    fb_cursor_rect = (fb_rect_t){ x_start, y_start, w, h };
+    fb_cursor_drawn = true;
+    if (fb_info.page_count > 1) {
+        fb_mark_stale(fb_info.front_page, x_start, y_start, w, h);
+    }
+}
+
+/**
+ * Set the pointer image
+ */
+void fb_cursor_set_image(const uint32_t *image, int hot_x, int hot_y) {
+    if (image) {
+        memcpy(fb_cursor_image, image, sizeof(fb_cursor_image));
+    } else {
+        memset(fb_cursor_image, 0, sizeof(fb_cursor_image));
+        for (size_t row = 0; row < ARRAY_SIZE(fb_arrow); row++) {
+            for (size_t col = 0; fb_arrow[row][col]; col++) {
+                char c = fb_arrow[row][col];
+                if (c == 'X' || c == '.') {
+                    fb_cursor_image[row * FB_CURSOR_SIZE + col] =
+                        (c == 'X') ? FB_COLOR_BLACK : FB_COLOR_WHITE;
+                }
+            }
+        }
+    }
+    fb_cursor_hot_x = CLAMP(hot_x, 0, FB_CURSOR_SIZE - 1);
+    fb_cursor_hot_y = CLAMP(hot_y, 0, FB_CURSOR_SIZE - 1);
+    fb_cursor_loaded = true;
+
+    if (fb_info.initialized) {
+        fb_cursor_erase();
+        fb_cursor_paint();
+    }
+}
+
+/**
+ * Show or hide the pointer
+ */
+void fb_cursor_show(bool visible) {
+    if (!fb_cursor_loaded) {
+        fb_cursor_set_image(NULL, 0, 0);
+    }
+    fb_cursor_visible = visible;
+    if (!fb_info.initialized) {
+        return;
+    }
+
+    fb_cursor_erase();
+    fb_cursor_paint();
+}
+
+/**
+ * Move the pointer's hot spot to a screen position
+ */
+void fb_cursor_move(int x, int y) {
+    if (!fb_info.initialized) {
+        return;
+    }
+    if (x == fb_cursor_x && y == fb_cursor_y && !fb_cursor_hit) {
+        return;
+    }
+
+    fb_cursor_x = x;
+    fb_cursor_y = y;
+    fb_cursor_erase();
+    fb_cursor_paint();
 }
 
 /**
@@ -530,29 +953,107 @@ void fb_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
 }
 
 /**
- * Draw a character using 8x16 bitmap font
+ * Helper: Expanded pixels of a glyph in the given colors
+ * Looks the (character, fg, bg) triple up in the direct-mapped cache and
+ * expands the bitmap into its slot on a miss.
  */
-void fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg) {
-    if (!fb_info.initialized) return;
-
+static const uint32_t *fb_glyph(char c, uint32_t fg, uint32_t bg) {
     /* Only handle printable ASCII characters */
     if (c < 32 || c > 126) {
         c = '?';  /* Replace unprintable characters with '?' */
     }
 
-    const uint8_t *glyph = font_8x16[c - 32];
+    uint32_t hash = ((uint32_t)(uint8_t)c * 0x9E3779B1u) ^ (fg * 0x85EBCA77u) ^
+                    (bg * 0xC2B2AE3Du);
+    fb_glyph_entry_t *entry = &fb_glyph_cache[(hash >> 16) % FB_GLYPH_CACHE_SIZE];
 
+    if (entry->valid && entry->ch == c && entry->fg == fg && entry->bg == bg) {
+        fb_glyph_stats.hits++;
+        return entry->pixels;
+    }
+
+    fb_glyph_stats.misses++;
+    const uint8_t *bitmap = font_8x16[c - 32];
     for (int row = 0; row < FB_FONT_HEIGHT; row++) {
-        uint8_t bits = glyph[row];
+        uint8_t bits = bitmap[row];
+        uint32_t *out = &entry->pixels[row * FB_FONT_WIDTH];
         for (int col = 0; col < FB_FONT_WIDTH; col++) {
             /* Check if bit is set (MSB first) */
-            if (bits & (0x80 >> col)) {
-                fb_put_pixel(x + col, y + row, fg);
-            } else {
-                fb_put_pixel(x + col, y + row, bg);
-            }
+            out[col] = (bits & (0x80 >> col)) ? fg : bg;
         }
     }
+    entry->ch = c;
+    entry->fg = fg;
+    entry->bg = bg;
+    entry->valid = true;
+    return entry->pixels;
+}
+
+/**
+ * Render a run of characters into a pixel buffer
+ */
+void fb_render_text(uint32_t *dst, ptrdiff_t stride, int dst_w, int dst_h, int x, int y,
+                    const char *text, size_t len, uint32_t fg, uint32_t bg) {
+    if (dst == NULL || text == NULL) return;
+
+    /* Rows of the glyph cell inside the buffer */
+    int row0 = MAX(0, -y);
+    int row1 = MIN(FB_FONT_HEIGHT, dst_h - y);
+    if (row0 >= row1) return;
+
+    for (size_t i = 0; i < len; i++) {
+        int gx = x + (int)i * FB_FONT_WIDTH;
+        if (gx >= dst_w) break;
+        if (gx + FB_FONT_WIDTH <= 0) continue;
+
+        int col0 = MAX(0, -gx);
+        int col1 = MIN(FB_FONT_WIDTH, dst_w - gx);
+        const uint32_t *glyph = fb_glyph(text[i], fg, bg);
+
+        /* One span per glyph row */
+        for (int row = row0; row < row1; row++) {
+            memcpy(&dst[(ptrdiff_t)(y + row) * stride + gx + col0],
+                   &glyph[row * FB_FONT_WIDTH + col0],
+                   (size_t)(col1 - col0) * sizeof(uint32_t));
+        }
+    }
+}
+
+/**
+ * Draw a run of characters on one line
+ */
+void fb_draw_text(int x, int y, const char *text, size_t len, uint32_t fg, uint32_t bg) {
+    if (!fb_info.initialized) return;
+    if (text == NULL) return;
+
+    /* Assemble the run off screen, then put it out one scanline at a time */
+    while (len > 0) {
+        size_t n = MIN(len, (size_t)FB_TEXT_RUN_MAX);
+        int run_w = (int)n * FB_FONT_WIDTH;
+
+        fb_render_text(fb_text_run, run_w, run_w, FB_FONT_HEIGHT, 0, 0, text, n, fg, bg);
+        fb_write_rect(x, y, run_w, FB_FONT_HEIGHT, fb_text_run, run_w);
+
+        x += run_w;
+        text += n;
+        len -= n;
+    }
+}
+
+/**
+ * Get glyph cache statistics
+ */
+void fb_get_glyph_stats(fb_glyph_stats_t *stats) {
+    if (stats) {
+        *stats = fb_glyph_stats;
+    }
+}
+
+/**
+ * Draw a character using 8x16 bitmap font
+ */
+void fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg) {
+    fb_draw_text(x, y, &c, 1, fg, bg);
 }
 
 /**
@@ -565,28 +1066,48 @@ void fb_draw_string(int x, int y, const char *str, uint32_t fg, uint32_t bg) {
     int cur_x = x;
     int cur_y = y;
 
+    /* Printable characters collect into a run drawn in one go */
+    const char *run = str;
+    int run_x = x;
+    size_t run_len = 0;
+
     while (*str) {
-        if (*str == '\n') {
+        char ch = *str;
+
+        if (ch == '\n' || ch == '\r' || ch == '\t') {
+            fb_draw_text(run_x, cur_y, run, run_len, fg, bg);
+            run_len = 0;
+        }
+
+        if (ch == '\n') {
             cur_x = x;
             cur_y += FB_FONT_HEIGHT;
-        } else if (*str == '\r') {
+        } else if (ch == '\r') {
             cur_x = x;
-        } else if (*str == '\t') {
+        } else if (ch == '\t') {
             /* Tab = 4 spaces */
             cur_x += FB_FONT_WIDTH * 4;
         } else {
-            fb_draw_char(cur_x, cur_y, *str, fg, bg);
+            if (run_len == 0) {
+                run = str;
+                run_x = cur_x;
+            }
+            run_len++;
             cur_x += FB_FONT_WIDTH;
         }
 
         /* Wrap to next line if needed */
         if (cur_x + FB_FONT_WIDTH > (int)fb_info.width) {
+            fb_draw_text(run_x, cur_y, run, run_len, fg, bg);
+            run_len = 0;
             cur_x = x;
             cur_y += FB_FONT_HEIGHT;
         }
 
         str++;
     }
+
+    fb_draw_text(run_x, cur_y, run, run_len, fg, bg);
 }
 
 /**
@@ -597,13 +1118,8 @@ void fb_clear(uint32_t color) {
 
     kprintf("[FB] Clearing screen with color 0x%08x\n", color);
 
-    /* Fast fill using 32-bit writes */
-    uint32_t *pixel = fb_info.address;
-    uint32_t total_pixels = (fb_info.pitch / (fb_info.bpp / 8)) * fb_info.height;
-
-    for (uint32_t i = 0; i < total_pixels; i++) {
-        *pixel++ = color;
-    }
+    /* Whole scanlines, padding included, as one rectangle */
+    fb_fill_clipped(0, 0, fb_pitch_pixels(), fb_info.height, color);
 }
 
 /**
@@ -619,26 +1135,43 @@ void fb_scroll(int lines) {
 
     kprintf("[FB] Scrolling screen up by %d lines\n", lines);
 
-    uint32_t pitch_pixels = fb_info.pitch / (fb_info.bpp / 8);
-    uint32_t *dst = fb_info.address;
-    uint32_t *src = fb_info.address + (lines * pitch_pixels);
+    int kept = (int)fb_info.height - lines;
+    fb_scroll_rect(0, 0, fb_info.width, fb_info.height, -lines);
 
-    /* Copy rows up */
-    uint32_t rows_to_copy = fb_info.height - lines;
-    for (uint32_t row = 0; row < rows_to_copy; row++) {
-        for (uint32_t col = 0; col < fb_info.width; col++) {
-            dst[col] = src[col];
-        }
-        dst += pitch_pixels;
-        src += pitch_pixels;
-    }
+    /* Then clear the bottom lines */
+    fb_fill_clipped(0, kept, fb_info.width, lines, FB_COLOR_BLACK);
+}
 
-    /* Clear the bottom lines */
-    for (int row = 0; row < lines; row++) {
-        for (uint32_t col = 0; col < fb_info.width; col++) {
-            dst[col] = FB_COLOR_BLACK;
-        }
-        dst += pitch_pixels;
+/**
+ * Move the rows of a rectangle up or down
+ */
+void fb_scroll_rect(int x, int y, int w, int h, int dy) {
+    if (!fb_info.initialized) return;
+
+    /* Clip to screen bounds */
+    int x_start = (x < 0) ? 0 : x;
+    int y_start = (y < 0) ? 0 : y;
+    int x_end = (x + w > (int)fb_info.width) ? (int)fb_info.width : x + w;
+    int y_end = (y + h > (int)fb_info.height) ? (int)fb_info.height : y + h;
+
+    if (x_start >= x_end || y_start >= y_end) return;
+
+    w = x_end - x_start;
+    h = y_end - y_start;
+    if (dy == 0 || dy >= h || -dy >= h) return;
+
+    uint32_t pitch_pixels = fb_pitch_pixels();
+
+    /* Move rows in the shadow and write out the ones that moved */
+    if (fb_info.shadow) {
+        int moved_y = (dy < 0) ? y_start : y_start + dy;
+        int moved_h = (dy < 0) ? h + dy : h - dy;
+        pixops_scroll_rect(fb_shadow_addr(x_start, y_start), pitch_pixels, w, h, dy);
+        pixops_copy_rect(fb_pixel_addr(x_start, moved_y), pitch_pixels,
+                         fb_shadow_addr(x_start, moved_y), pitch_pixels, w, moved_h);
+        fb_touched(x_start, moved_y, w, moved_h);
+    } else {
+        pixops_scroll_rect(fb_pixel_addr(x_start, y_start), pitch_pixels, w, h, dy);
     }
 }
 
@@ -3,6 +3,27 @@
  *
  * Provides pixel-level graphics operations for VESA/GOP framebuffers.
  * Supports 32-bit ARGB color format (0xAARRGGBB).
+ *
+ * VRAM is mapped write-combining and treated as write-only: every write
+ * also goes to a shadow copy in RAM, and reads come from the shadow.
+ * Code writing through fb_get_info()->address directly bypasses the
+ * shadow; use fb_write_rect to put a whole buffer on screen instead.
+ *
+ * On a Bochs/QEMU display the driver keeps two scanout pages. fb_* calls
+ * draw on the visible page right away, while fb_stage_rect builds the next
+ * frame on the hidden one and fb_present flips to it at the next vertical
+ * retrace. Each page remembers what it missed while the other was drawn
+ * on and catches up from the shadow before it is shown.
+ *
+ * Text comes from a cache of glyphs already expanded in their colors,
+ * copied a row of pixels at a time.
+ *
+ * The mouse pointer is a sprite drawn on the visible page only, never in
+ * the shadow, so moving it just puts the shadow back where it was and
+ * blends the sprite in where it goes: two FB_CURSOR_SIZE squares, with no
+ * compositing. fb_present draws it again on each page it shows, and after
+ * drawing over the pointer on the visible page it is drawn again at the
+ * next fb_present or fb_cursor_move. The pointer needs the shadow.
  */
 
 #ifndef _AAAOS_FRAMEBUFFER_H
@@ -28,6 +49,24 @@
 #define FB_FONT_WIDTH       8
 #define FB_FONT_HEIGHT      16
 
+/* Glyphs kept expanded in their colors (8x16 pixels each) */
+#define FB_GLYPH_CACHE_SIZE 256
+
+/* Characters fb_draw_text assembles before writing them out */
+#define FB_TEXT_RUN_MAX     128
+
+/* Scanout pages used for flipping */
+#define FB_MAX_PAGES        2
+
+/* Areas a page may miss before they are merged into each other */
+#define FB_STALE_RECTS      16
+
+/* Pointer sprite width and height */
+#define FB_CURSOR_SIZE      32
+
+/* Longest fb_present waits for a vertical retrace (50 Hz frame) */
+#define FB_VBLANK_TIMEOUT_NS    20000000ULL
+
 /* Color manipulation macros */
 #define FB_MAKE_COLOR(a, r, g, b) \
     (((uint32_t)(a) << 24) | ((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
@@ -41,15 +80,26 @@
  * Framebuffer information structure
  */
 typedef struct {
-    uint32_t *address;      /* Pointer to framebuffer memory */
+    uint32_t *address;      /* Visible page of framebuffer memory (write-only) */
+    uint32_t *shadow;       /* RAM copy of the screen, same pitch, or NULL */
     uint32_t width;         /* Screen width in pixels */
     uint32_t height;        /* Screen height in pixels */
     uint32_t pitch;         /* Bytes per scanline */
     uint32_t bpp;           /* Bits per pixel */
-    uint32_t size;          /* Total framebuffer size in bytes */
+    uint32_t size;          /* Size of one page in bytes */
+    uint32_t page_count;    /* Scanout pages in use (1 without page flipping) */
+    uint32_t front_page;    /* Page being scanned out */
     bool initialized;       /* Framebuffer initialization status */
 } framebuffer_t;
 
+/**
+ * Glyph cache statistics
+ */
+typedef struct {
+    uint64_t hits;          /* Glyphs found already expanded */
+    uint64_t misses;        /* Glyphs expanded from the font bitmap */
+} fb_glyph_stats_t;
+
 /**
  * Initialize framebuffer from boot information
  * @param boot_info Pointer to boot information structure
@@ -85,6 +135,65 @@ void fb_put_pixel(int x, int y, uint32_t color);
  */
 uint32_t fb_get_pixel(int x, int y);
 
+/**
+ * Copy a buffer of pixels to the screen
+ * @param x Top-left X coordinate
+ * @param y Top-left Y coordinate
+ * @param w Width in pixels
+ * @param h Height in pixels
+ * @param src First pixel of the buffer
+ * @param src_stride Pixels from one buffer row to the next
+ */
+void fb_write_rect(int x, int y, int w, int h, const uint32_t *src, ptrdiff_t src_stride);
+
+/**
+ * Draw part of the next frame
+ * Same as fb_write_rect, except that with page flipping the pixels go to
+ * the hidden page and only appear at the next fb_present.
+ * @param x Top-left X coordinate
+ * @param y Top-left Y coordinate
+ * @param w Width in pixels
+ * @param h Height in pixels
+ * @param src First pixel of the buffer
+ * @param src_stride Pixels from one buffer row to the next
+ */
+void fb_stage_rect(int x, int y, int w, int h, const uint32_t *src, ptrdiff_t src_stride);
+
+/**
+ * Show the frame built with fb_stage_rect
+ * Brings the hidden page up to date, waits for the next vertical retrace
+ * (at most FB_VBLANK_TIMEOUT_NS) and scans it out.
+ * @return true if the pages were flipped, false without page flipping
+ */
+bool fb_present(void);
+
+/**
+ * Wait for the start of the next vertical retrace
+ * @param timeout_ns Longest time to wait
+ * @return true if a retrace started, false on timeout or if the display
+ *         cannot report it
+ */
+bool fb_wait_vblank(uint64_t timeout_ns);
+
+/**
+ * Set the pointer image
+ * @param image FB_CURSOR_SIZE x FB_CURSOR_SIZE ARGB pixels, blended over
+ *              the screen (NULL for the built-in arrow)
+ * @param hot_x Hot spot X within the image
+ * @param hot_y Hot spot Y within the image
+ */
+void fb_cursor_set_image(const uint32_t *image, int hot_x, int hot_y);
+
+/**
+ * Show or hide the pointer (hidden after fb_init)
+ */
+void fb_cursor_show(bool visible);
+
+/**
+ * Move the pointer's hot spot to a screen position
+ */
+void fb_cursor_move(int x, int y);
+
 /**
  * Fill a rectangle with solid color
  * @param x Top-left X coordinate
@@ -125,6 +234,43 @@ void fb_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
  */
 void fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg);
 
+/**
+ * Draw a run of characters on one line
+ * Control characters are drawn as '?' and nothing wraps. The glyphs are
+ * assembled off screen and written out one scanline at a time.
+ * @param x Top-left X coordinate
+ * @param y Top-left Y coordinate
+ * @param text Characters to draw (need not be terminated)
+ * @param len Number of characters
+ * @param fg Foreground color (0xAARRGGBB)
+ * @param bg Background color (0xAARRGGBB)
+ */
+void fb_draw_text(int x, int y, const char *text, size_t len, uint32_t fg, uint32_t bg);
+
+/**
+ * Render a run of characters into a pixel buffer
+ * Same as fb_draw_text, but into a w x h buffer (a window, say), clipped
+ * to it.
+ * @param dst First pixel of the buffer
+ * @param stride Pixels from one buffer row to the next
+ * @param dst_w Buffer width in pixels
+ * @param dst_h Buffer height in pixels
+ * @param x Top-left X coordinate in the buffer
+ * @param y Top-left Y coordinate in the buffer
+ * @param text Characters to draw
+ * @param len Number of characters
+ * @param fg Foreground color (0xAARRGGBB)
+ * @param bg Background color (0xAARRGGBB)
+ */
+void fb_render_text(uint32_t *dst, ptrdiff_t stride, int dst_w, int dst_h, int x, int y,
+                    const char *text, size_t len, uint32_t fg, uint32_t bg);
+
+/**
+ * Get glyph cache statistics
+ * @param stats Filled with the counters since boot
+ */
+void fb_get_glyph_stats(fb_glyph_stats_t *stats);
+
 /**
  * Draw a string
  * @param x Starting X coordinate
@@ -147,6 +293,18 @@ void fb_clear(uint32_t color);
  */
 void fb_scroll(int lines);
 
+/**
+ * Move the rows of a rectangle up or down, clipped to the screen
+ * The rows are moved in the shadow and written out, so VRAM is never
+ * read. The |dy| rows left behind keep their old contents.
+ * @param x Top-left X coordinate
+ * @param y Top-left Y coordinate
+ * @param w Width in pixels
+ * @param h Height in pixels
+ * @param dy Pixel rows to move by (negative moves them up)
+ */
+void fb_scroll_rect(int x, int y, int w, int h, int dy);
+
 /**
  * Draw a horizontal line (optimized)
  * @param x Starting X coordinate
@@ -0,0 +1,338 @@
+/**
+ * AAAos Kernel - Pixel Operations Implementation
+ *
+ * The vector versions are written with GCC vector extensions under a
+ * target attribute, since the kernel is otherwise built without SSE.
+ * Blending widens each byte to a 16-bit lane within its 128-bit half,
+ * multiplies by alpha there (255 * 255 still fits) and divides by 255
+ * exactly with (x + 1 + (x >> 8)) >> 8.
+ */
+
+#include "pixops.h"
+#include "../../kernel/arch/x86_64/fpu.h"
+
+/* Row kernel: n pixels; src or color unused depending on the operation */
+typedef void (*pixops_row_fn_t)(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color);
+
+/* ========== Scalar ========== */
+
+static void scalar_fill(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(src);
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = color;
+    }
+}
+
+static void scalar_copy(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+static void scalar_blend(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = pixops_blend_pixel(src[i], dst[i]);
+    }
+}
+
+#if defined(__x86_64__)
+
+/* Vector types */
+typedef uint8_t  pix_v16qu __attribute__((vector_size(16)));
+typedef uint16_t pix_v8hu __attribute__((vector_size(16)));
+typedef uint32_t pix_v4su __attribute__((vector_size(16)));
+typedef uint8_t  pix_v32qu __attribute__((vector_size(32)));
+typedef uint16_t pix_v16hu __attribute__((vector_size(32)));
+typedef uint32_t pix_v8su __attribute__((vector_size(32)));
+
+/* ========== SSE2 ========== */
+
+__attribute__((target("sse2")))
+static void sse2_fill(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(src);
+    const pix_v4su v = { color, color, color, color };
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __builtin_memcpy(dst + i, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 4, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 8, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 12, &v, sizeof(v));
+    }
+    for (; i + 4 <= n; i += 4) {
+        __builtin_memcpy(dst + i, &v, sizeof(v));
+    }
+    for (; i < n; i++) {
+        dst[i] = color;
+    }
+}
+
+__attribute__((target("sse2")))
+static void sse2_copy(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        pix_v4su a, b, c, d;
+        __builtin_memcpy(&a, src + i, sizeof(a));
+        __builtin_memcpy(&b, src + i + 4, sizeof(b));
+        __builtin_memcpy(&c, src + i + 8, sizeof(c));
+        __builtin_memcpy(&d, src + i + 12, sizeof(d));
+        __builtin_memcpy(dst + i, &a, sizeof(a));
+        __builtin_memcpy(dst + i + 4, &b, sizeof(b));
+        __builtin_memcpy(dst + i + 8, &c, sizeof(c));
+        __builtin_memcpy(dst + i + 12, &d, sizeof(d));
+    }
+    for (; i + 4 <= n; i += 4) {
+        pix_v4su a;
+        __builtin_memcpy(&a, src + i, sizeof(a));
+        __builtin_memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/**
+ * Blend two pixels held as 16-bit channels
+ */
+__attribute__((target("sse2")))
+static inline pix_v8hu sse2_blend_half(pix_v8hu fg, pix_v8hu bg) {
+    const pix_v8hu max = { 255, 255, 255, 255, 255, 255, 255, 255 };
+    const pix_v8hu one = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    pix_v8hu a = __builtin_shuffle(fg, (pix_v8hu){ 3, 3, 3, 3, 7, 7, 7, 7 });
+    pix_v8hu x = fg * a + bg * (max - a);
+    return (x + one + (x >> 8)) >> 8;
+}
+
+__attribute__((target("sse2")))
+static void sse2_blend(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    const pix_v16qu zero = { 0 };
+    const pix_v16qu lo_idx = { 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 };
+    const pix_v16qu hi_idx = { 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31 };
+    const pix_v16qu pack = { 0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30 };
+    const pix_v4su opaque = { 0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000 };
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        pix_v16qu s, d;
+        __builtin_memcpy(&s, src + i, sizeof(s));
+        __builtin_memcpy(&d, dst + i, sizeof(d));
+
+        pix_v8hu lo = sse2_blend_half((pix_v8hu)__builtin_shuffle(s, zero, lo_idx),
+                                      (pix_v8hu)__builtin_shuffle(d, zero, lo_idx));
+        pix_v8hu hi = sse2_blend_half((pix_v8hu)__builtin_shuffle(s, zero, hi_idx),
+                                      (pix_v8hu)__builtin_shuffle(d, zero, hi_idx));
+        pix_v4su out = (pix_v4su)__builtin_shuffle((pix_v16qu)lo, (pix_v16qu)hi, pack) | opaque;
+
+        /* Alpha 0 keeps dst untouched, alpha included */
+        pix_v4su keep = (pix_v4su)(((pix_v4su)s >> 24) == 0);
+        out = ((pix_v4su)d & keep) | (out & ~keep);
+        __builtin_memcpy(dst + i, &out, sizeof(out));
+    }
+    for (; i < n; i++) {
+        dst[i] = pixops_blend_pixel(src[i], dst[i]);
+    }
+}
+
+/* ========== AVX2 ========== */
+
+__attribute__((target("avx2")))
+static void avx2_fill(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(src);
+    const pix_v8su v = { color, color, color, color, color, color, color, color };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __builtin_memcpy(dst + i, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 8, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 16, &v, sizeof(v));
+        __builtin_memcpy(dst + i + 24, &v, sizeof(v));
+    }
+    for (; i + 8 <= n; i += 8) {
+        __builtin_memcpy(dst + i, &v, sizeof(v));
+    }
+    for (; i < n; i++) {
+        dst[i] = color;
+    }
+}
+
+__attribute__((target("avx2")))
+static void avx2_copy(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        pix_v8su a, b, c, d;
+        __builtin_memcpy(&a, src + i, sizeof(a));
+        __builtin_memcpy(&b, src + i + 8, sizeof(b));
+        __builtin_memcpy(&c, src + i + 16, sizeof(c));
+        __builtin_memcpy(&d, src + i + 24, sizeof(d));
+        __builtin_memcpy(dst + i, &a, sizeof(a));
+        __builtin_memcpy(dst + i + 8, &b, sizeof(b));
+        __builtin_memcpy(dst + i + 16, &c, sizeof(c));
+        __builtin_memcpy(dst + i + 24, &d, sizeof(d));
+    }
+    for (; i + 8 <= n; i += 8) {
+        pix_v8su a;
+        __builtin_memcpy(&a, src + i, sizeof(a));
+        __builtin_memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/**
+ * Blend four pixels held as 16-bit channels, two per 128-bit half
+ */
+__attribute__((target("avx2")))
+static inline pix_v16hu avx2_blend_half(pix_v16hu fg, pix_v16hu bg) {
+    const pix_v16hu max = { 255, 255, 255, 255, 255, 255, 255, 255,
+                            255, 255, 255, 255, 255, 255, 255, 255 };
+    const pix_v16hu one = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+    pix_v16hu a = __builtin_shuffle(fg, (pix_v16hu){ 3, 3, 3, 3, 7, 7, 7, 7,
+                                                     11, 11, 11, 11, 15, 15, 15, 15 });
+    pix_v16hu x = fg * a + bg * (max - a);
+    return (x + one + (x >> 8)) >> 8;
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend(uint32_t *dst, const uint32_t *src, size_t n, uint32_t color) {
+    UNUSED(color);
+    const pix_v32qu zero = { 0 };
+    /* Widen and narrow within each 128-bit half, as the unpack/pack instructions do */
+    const pix_v32qu lo_idx = { 0, 32, 1, 33, 2, 34, 3, 35, 4, 36, 5, 37, 6, 38, 7, 39,
+                               16, 48, 17, 49, 18, 50, 19, 51, 20, 52, 21, 53, 22, 54, 23, 55 };
+    const pix_v32qu hi_idx = { 8, 40, 9, 41, 10, 42, 11, 43, 12, 44, 13, 45, 14, 46, 15, 47,
+                               24, 56, 25, 57, 26, 58, 27, 59, 28, 60, 29, 61, 30, 62, 31, 63 };
+    const pix_v32qu pack = { 0, 2, 4, 6, 8, 10, 12, 14, 32, 34, 36, 38, 40, 42, 44, 46,
+                             16, 18, 20, 22, 24, 26, 28, 30, 48, 50, 52, 54, 56, 58, 60, 62 };
+    const pix_v8su opaque = { 0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000,
+                              0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000 };
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        pix_v32qu s, d;
+        __builtin_memcpy(&s, src + i, sizeof(s));
+        __builtin_memcpy(&d, dst + i, sizeof(d));
+
+        pix_v16hu lo = avx2_blend_half((pix_v16hu)__builtin_shuffle(s, zero, lo_idx),
+                                       (pix_v16hu)__builtin_shuffle(d, zero, lo_idx));
+        pix_v16hu hi = avx2_blend_half((pix_v16hu)__builtin_shuffle(s, zero, hi_idx),
+                                       (pix_v16hu)__builtin_shuffle(d, zero, hi_idx));
+        pix_v8su out = (pix_v8su)__builtin_shuffle((pix_v32qu)lo, (pix_v32qu)hi, pack) | opaque;
+
+        /* Alpha 0 keeps dst untouched, alpha included */
+        pix_v8su keep = (pix_v8su)(((pix_v8su)s >> 24) == 0);
+        out = ((pix_v8su)d & keep) | (out & ~keep);
+        __builtin_memcpy(dst + i, &out, sizeof(out));
+    }
+    for (; i < n; i++) {
+        dst[i] = pixops_blend_pixel(src[i], dst[i]);
+    }
+}
+
+#endif /* __x86_64__ */
+
+static const pixops_row_fn_t pixops_kernels[PIXOPS_IMPL_COUNT][PIXOPS_OP_COUNT] = {
+    [PIXOPS_IMPL_SCALAR] = { scalar_fill, scalar_copy, scalar_blend },
+#if defined(__x86_64__)
+    [PIXOPS_IMPL_SSE2]   = { sse2_fill, sse2_copy, sse2_blend },
+    [PIXOPS_IMPL_AVX2]   = { avx2_fill, avx2_copy, avx2_blend },
+#endif
+};
+
+bool pixops_impl_available(pixops_impl_t impl) {
+    switch (impl) {
+        case PIXOPS_IMPL_SCALAR:
+            return true;
+#if defined(__x86_64__)
+        case PIXOPS_IMPL_SSE2:
+            return fpu_enabled();
+        case PIXOPS_IMPL_AVX2:
+            return fpu_has_avx2();
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *pixops_impl_name(pixops_impl_t impl) {
+    static const char *names[PIXOPS_IMPL_COUNT] = { "scalar", "sse2", "avx2" };
+    return impl < PIXOPS_IMPL_COUNT ? names[impl] : "unknown";
+}
+
+const char *pixops_op_name(pixops_op_t op) {
+    static const char *names[PIXOPS_OP_COUNT] = { "fill", "copy", "blend" };
+    return op < PIXOPS_OP_COUNT ? names[op] : "unknown";
+}
+
+void pixops_rect_impl(pixops_impl_t impl, pixops_op_t op, uint32_t *dst, ptrdiff_t dst_stride,
+                      const uint32_t *src, ptrdiff_t src_stride, int w, int h, uint32_t color) {
+    if (w <= 0 || h <= 0 || op >= PIXOPS_OP_COUNT || !pixops_impl_available(impl)) {
+        return;
+    }
+
+    pixops_row_fn_t row_fn = pixops_kernels[impl][op];
+    if (impl == PIXOPS_IMPL_SCALAR) {
+        for (int row = 0; row < h; row++) {
+            row_fn(dst + row * dst_stride, src ? src + row * src_stride : NULL, (size_t)w, color);
+        }
+        return;
+    }
+
+    /* Bound the time spent with interrupts off */
+    int rows_per_section = MAX(1, PIXOPS_FPU_CHUNK / w);
+    for (int row = 0; row < h;) {
+        int end = MIN(h, row + rows_per_section);
+        kernel_fpu_begin();
+        for (; row < end; row++) {
+            row_fn(dst + row * dst_stride, src ? src + row * src_stride : NULL, (size_t)w, color);
+        }
+        kernel_fpu_end();
+    }
+}
+
+/**
+ * Best implementation for a w x h rectangle
+ */
+static pixops_impl_t pixops_pick(int w, int h) {
+#if defined(__x86_64__)
+    if ((int64_t)w * h >= PIXOPS_SIMD_MIN && fpu_enabled()) {
+        return pixops_impl_available(PIXOPS_IMPL_AVX2) ? PIXOPS_IMPL_AVX2 : PIXOPS_IMPL_SSE2;
+    }
+#endif
+    UNUSED(w);
+    UNUSED(h);
+    return PIXOPS_IMPL_SCALAR;
+}
+
+void pixops_fill_rect(uint32_t *dst, ptrdiff_t stride, int w, int h, uint32_t color) {
+    pixops_rect_impl(pixops_pick(w, h), PIXOPS_FILL, dst, stride, NULL, 0, w, h, color);
+}
+
+void pixops_copy_rect(uint32_t *dst, ptrdiff_t dst_stride,
+                      const uint32_t *src, ptrdiff_t src_stride, int w, int h) {
+    pixops_rect_impl(pixops_pick(w, h), PIXOPS_COPY, dst, dst_stride, src, src_stride, w, h, 0);
+}
+
+void pixops_blend_rect(uint32_t *dst, ptrdiff_t dst_stride,
+                       const uint32_t *src, ptrdiff_t src_stride, int w, int h) {
+    pixops_rect_impl(pixops_pick(w, h), PIXOPS_BLEND, dst, dst_stride, src, src_stride, w, h, 0);
+}
+
+void pixops_scroll_rect(uint32_t *buf, ptrdiff_t stride, int w, int h, int dy) {
+    if (w <= 0 || dy == 0 || dy >= h || -dy >= h) {
+        return;
+    }
+
+    int rows = h - (dy > 0 ? dy : -dy);
+    if (dy < 0) {
+        /* Up: top row first, each row read before it is overwritten */
+        pixops_copy_rect(buf, stride, buf - dy * stride, stride, w, rows);
+    } else {
+        /* Down: bottom row first */
+        uint32_t *last = buf + (ptrdiff_t)(h - 1) * stride;
+        pixops_copy_rect(last, -stride, last - dy * stride, -stride, w, rows);
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * AAAos Kernel - Pixel Operations
+ *
+ * Rectangle fill, copy, ARGB blend and scroll on 32-bit pixel buffers,
+ * shared by the framebuffer driver and the compositor. Each operation
+ * has a scalar version and SSE2 and AVX2 versions, chosen at run time
+ * from CPUID. The vector versions run inside kernel_fpu_begin, which
+ * keeps interrupts off, so a large rectangle is split into sections of at
+ * most PIXOPS_FPU_CHUNK pixels; rectangles under PIXOPS_SIMD_MIN pixels
+ * stay scalar, where saving the FPU state would cost more than it saves.
+ *
+ * Strides are in pixels and may be negative (rows walked bottom up).
+ */
+
+#ifndef _AAAOS_PIXOPS_H
+#define _AAAOS_PIXOPS_H
+
+#include "../../kernel/include/types.h"
+
+/* Smallest rectangle worth saving the FPU state for (pixels) */
+#define PIXOPS_SIMD_MIN         256
+
+/* Most pixels handled in one kernel_fpu_begin section */
+#define PIXOPS_FPU_CHUNK        (64 * 1024)
+
+/**
+ * Implementations (for benchmarking and cross-checking)
+ */
+typedef enum {
+    PIXOPS_IMPL_SCALAR = 0,     /* One pixel per step */
+    PIXOPS_IMPL_SSE2,           /* Four pixels per vector */
+    PIXOPS_IMPL_AVX2,           /* Eight pixels per vector */
+    PIXOPS_IMPL_COUNT
+} pixops_impl_t;
+
+/**
+ * Operations
+ */
+typedef enum {
+    PIXOPS_FILL = 0,            /* dst = color */
+    PIXOPS_COPY,                /* dst = src */
+    PIXOPS_BLEND,               /* dst = src over dst (pixops_blend_pixel) */
+    PIXOPS_OP_COUNT
+} pixops_op_t;
+
+/**
+ * Blend one ARGB pixel over another
+ * Alpha 0 leaves bg as it is; otherwise each channel becomes
+ * (fg * a + bg * (255 - a)) / 255 and the result is opaque.
+ */
+static inline uint32_t pixops_blend_pixel(uint32_t fg, uint32_t bg) {
+    uint32_t a = fg >> 24;
+    if (a == 0) {
+        return bg;
+    }
+    if (a == 255) {
+        return fg;
+    }
+
+    uint32_t inv = 255 - a;
+    uint32_t r = (((fg >> 16) & 0xFF) * a + ((bg >> 16) & 0xFF) * inv) / 255;
+    uint32_t g = (((fg >> 8) & 0xFF) * a + ((bg >> 8) & 0xFF) * inv) / 255;
+    uint32_t b = ((fg & 0xFF) * a + (bg & 0xFF) * inv) / 255;
+    return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+/**
+ * Fill a w x h rectangle with a color
+ */
+void pixops_fill_rect(uint32_t *dst, ptrdiff_t stride, int w, int h, uint32_t color);
+
+/**
+ * Copy a w x h rectangle (the two must not overlap)
+ */
+void pixops_copy_rect(uint32_t *dst, ptrdiff_t dst_stride,
+                      const uint32_t *src, ptrdiff_t src_stride, int w, int h);
+
+/**
+ * Blend a w x h rectangle of ARGB pixels over dst
+ */
+void pixops_blend_rect(uint32_t *dst, ptrdiff_t dst_stride,
+                       const uint32_t *src, ptrdiff_t src_stride, int w, int h);
+
+/**
+ * Move the rows of a w x h rectangle by dy (negative moves them up)
+ * The |dy| rows left behind keep their old contents.
+ */
+void pixops_scroll_rect(uint32_t *buf, ptrdiff_t stride, int w, int h, int dy);
+
+/**
+ * Check if an implementation can run on this CPU
+ */
+bool pixops_impl_available(pixops_impl_t impl);
+
+/**
+ * Name of an implementation ("scalar", "sse2", "avx2")
+ */
+const char *pixops_impl_name(pixops_impl_t impl);
+
+/**
+ * Name of an operation ("fill", "copy", "blend")
+ */
+const char *pixops_op_name(pixops_op_t op);
+
+/**
+ * Run an operation with a given implementation
+ * Does nothing if the implementation is not available. src is ignored
+ * by PIXOPS_FILL and color by the others.
+ */
+void pixops_rect_impl(pixops_impl_t impl, pixops_op_t op, uint32_t *dst, ptrdiff_t dst_stride,
+                      const uint32_t *src, ptrdiff_t src_stride, int w, int h, uint32_t color);
+
+#endif /* _AAAOS_PIXOPS_H */
@@ -0,0 +1,1219 @@
+/**
+ * AAAos Block Buffer Cache Implementation
+ *
+ * Blocks live in a fixed table and are found through a hash on (device,
+ * block number). A block that is being read or written back is BUSY: its
+ * owner does the device I/O without holding the cache lock, and anyone
+ * else who wants the block sleeps on its state word until the I/O ends.
+ * Users pin a block while they copy to or from it, so the CLOCK hand and
+ * the reclaimer only take blocks nobody is using.
+ */
+
+#include "bcache.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/reclaim.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/clock.h"
+#include "../../lib/libc/string.h"
+
+/* Block flags */
+#define BLK_VALID           BIT(0)  /* Data matches the device (plus dirty sectors) */
+#define BLK_BUSY            BIT(1)  /* Owner is loading, filling or writing it back */
+#define BLK_REFERENCED      BIT(2)  /* Used since the CLOCK hand last passed */
+
+#define BCACHE_FULL_MASK    ((uint8_t)((1u << BCACHE_SECTORS_PER_BLOCK) - 1))
+
+#define BCACHE_HASH(dev, block) \
+    ((((uintptr_t)(dev) >> 4) ^ (uintptr_t)(block) ^ ((uintptr_t)(block) >> 8)) & \
+     (BCACHE_HASH_SIZE - 1))
+
+/**
+ * Cached block
+ * Keyed blocks always hold a frame; free slots may not.
+ */
+typedef struct bcache_block {
+    bcache_dev_t *dev;                  /* NULL when the slot is free */
+    uint64_t block;                     /* Block number on the device */
+    physaddr_t frame;                   /* 0 when no frame is held */
+    uint8_t *data;                      /* Frame through the physical map */
+    struct bcache_block *hash_next;
+    uint32_t flags;                     /* BLK_* */
+    volatile uint32_t state;            /* Bumped when BUSY clears (waitq word) */
+    uint32_t pins;                      /* Users copying or waiting */
+    uint64_t dirtied_ms;                /* When it went from clean to dirty */
+    uint8_t dirty;                      /* One bit per dirty sector */
+    uint8_t sectors;                    /* Sectors backed by the device */
+} bcache_block_t;
+
+_Static_assert(BCACHE_SECTORS_PER_BLOCK <= 8, "dirty mask is one byte");
+
+static bcache_block_t bcache_blocks[BCACHE_MAX_BLOCKS];
+static bcache_block_t *bcache_hash[BCACHE_HASH_SIZE];
+static uint32_t bcache_hand = 0;
+
+/* Protects the table, the hash and every block's metadata */
+static volatile int bcache_lock = 0;
+
+static bcache_stats_t bcache_stats;
+
+/* Gives clean frames back under memory pressure, even from an allocation */
+static size_t bcache_reclaimable(void);
+static shrinker_t bcache_shrinker = {
+    .name = "fs.bcache",
+    .count = bcache_reclaimable,
+    .scan = bcache_reclaim,
+    .flags = SHRINKER_DIRECT,
+};
+
+/**
+ * Queued readahead range
+ */
+typedef struct bcache_ra_req {
+    bcache_dev_t *dev;
+    uint64_t block;
+    uint32_t count;
+} bcache_ra_req_t;
+
+/* Readahead queue; the lock also guards the active device and buffer */
+static bcache_ra_req_t bcache_ra_queue[BCACHE_RA_QUEUE_SIZE];
+static uint32_t bcache_ra_head = 0;
+static uint32_t bcache_ra_tail = 0;
+static volatile int bcache_ra_lock = 0;
+static volatile uint32_t bcache_ra_event = 0;   /* Bumped on every enqueue */
+static volatile uint32_t bcache_ra_done = 0;    /* Bumped when a request ends */
+static bcache_dev_t *bcache_ra_active = NULL;   /* Device being read ahead */
+static uint8_t *bcache_ra_buffer = NULL;        /* Contiguous run buffer */
+static bool bcache_ra_thread = false;
+
+/* Write-back state (tuning and the flush buffer under the cache lock) */
+static bcache_writeback_t bcache_wb = {
+    .background_pct = BCACHE_DIRTY_BACKGROUND,
+    .limit_pct = BCACHE_DIRTY_LIMIT,
+    .expire_ms = BCACHE_DIRTY_EXPIRE_MS,
+    .interval_ms = BCACHE_FLUSH_INTERVAL_MS,
+};
+static volatile uint32_t bcache_dirty_count = 0;
+static volatile uint32_t bcache_flush_event = 0;    /* Bumped to wake the flusher */
+static volatile int bcache_flush_buffer_lock = 0;   /* Owner of the flush buffer */
+static uint8_t *bcache_flush_buffer = NULL;
+static bool bcache_flush_thread = false;
+
+static inline void bcache_lock_acquire(void) {
+    while (__sync_lock_test_and_set(&bcache_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline bool bcache_lock_try(void) {
+    return __sync_lock_test_and_set(&bcache_lock, 1) == 0;
+}
+
+static inline void bcache_lock_release(void) {
+    __sync_lock_release(&bcache_lock);
+}
+
+static inline void bcache_ra_acquire(void) {
+    while (__sync_lock_test_and_set(&bcache_ra_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void bcache_ra_release(void) {
+    __sync_lock_release(&bcache_ra_lock);
+}
+
+/*============================================================================
+ * Table Management (cache lock held)
+ *============================================================================*/
+
+static bcache_block_t *bcache_lookup(bcache_dev_t *dev, uint64_t block) {
+    bcache_block_t *b = bcache_hash[BCACHE_HASH(dev, block)];
+    while (b && (b->dev != dev || b->block != block)) {
+        b = b->hash_next;
+    }
+    return b;
+}
+
+static void bcache_hash_insert(bcache_block_t *b) {
+    uint32_t bucket = BCACHE_HASH(b->dev, b->block);
+    b->hash_next = bcache_hash[bucket];
+    bcache_hash[bucket] = b;
+}
+
+static void bcache_hash_remove(bcache_block_t *b) {
+    bcache_block_t **link = &bcache_hash[BCACHE_HASH(b->dev, b->block)];
+    while (*link && *link != b) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = b->hash_next;
+    }
+    b->hash_next = NULL;
+    b->dev = NULL;
+}
+
+/**
+ * Add dirty sectors, counting the block the first time
+ */
+static void bcache_set_dirty(bcache_block_t *b, uint8_t mask) {
+    if (!mask) {
+        return;
+    }
+    if (!b->dirty) {
+        bcache_dirty_count++;
+        b->dirtied_ms = timer_now_ms();
+    }
+    b->dirty |= mask;
+}
+
+/**
+ * Clear and return a block's dirty sectors
+ */
+static uint8_t bcache_take_dirty(bcache_block_t *b) {
+    uint8_t mask = b->dirty;
+    if (mask) {
+        bcache_dirty_count--;
+    }
+    b->dirty = 0;
+    return mask;
+}
+
+static inline uint32_t bcache_dirty_threshold(uint32_t pct) {
+    return (uint32_t)((uint64_t)BCACHE_MAX_BLOCKS * pct / 100);
+}
+
+/**
+ * Drop a block's key and give its frame back to the PMM
+ */
+static void bcache_release_frame(bcache_block_t *b) {
+    if (b->dev) {
+        bcache_hash_remove(b);
+    }
+    if (b->frame) {
+        pmm_free_page(b->frame);
+        b->frame = 0;
+        b->data = NULL;
+        bcache_stats.blocks--;
+    }
+    b->flags = 0;
+    bcache_take_dirty(b);
+}
+
+/**
+ * End a BUSY period and wake whoever waits for the block
+ */
+static void bcache_unbusy(bcache_block_t *b) {
+    b->flags &= ~BLK_BUSY;
+    __atomic_fetch_add(&b->state, 1, __ATOMIC_RELEASE);
+    waitq_wake(&b->state, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Find a slot for a new block
+ * Grows the cache while the PMM has frames to spare, then runs the CLOCK
+ * hand over unpinned, idle blocks. A dirty victim is returned BUSY and
+ * pinned in *writeback for the caller to write out before retrying.
+ * @return Unkeyed slot holding a frame, or NULL
+ */
+static bcache_block_t *bcache_alloc_slot(bcache_block_t **writeback) {
+    *writeback = NULL;
+
+    if (pmm_get_free_pages() > BCACHE_MIN_FREE_PAGES) {
+        for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS; i++) {
+            bcache_block_t *b = &bcache_blocks[i];
+            if (b->frame) {
+                continue;
+            }
+            /* The PMM's reclaim call back into us fails its try-lock */
+            physaddr_t frame = pmm_alloc_page();
+            if (!frame) {
+                break;
+            }
+            b->frame = frame;
+            b->data = (uint8_t *)(frame + VMM_KERNEL_PHYS_MAP);
+            bcache_stats.blocks++;
+            return b;
+        }
+    }
+
+    bcache_block_t *dirty_victim = NULL;
+    for (uint32_t scanned = 0; scanned < 2 * BCACHE_MAX_BLOCKS; scanned++) {
+        bcache_block_t *b = &bcache_blocks[bcache_hand];
+        bcache_hand = (bcache_hand + 1) % BCACHE_MAX_BLOCKS;
+
+        if (!b->frame || b->pins || (b->flags & BLK_BUSY)) {
+            continue;
+        }
+        if (!b->dev) {
+            return b;
+        }
+        if (b->flags & BLK_REFERENCED) {
+            b->flags &= ~BLK_REFERENCED;
+            continue;
+        }
+        if (b->dirty) {
+            if (!dirty_victim) {
+                dirty_victim = b;
+            }
+            continue;
+        }
+
+        bcache_hash_remove(b);
+        b->flags = 0;
+        bcache_stats.evictions++;
+        return b;
+    }
+
+    if (dirty_victim) {
+        dirty_victim->flags |= BLK_BUSY;
+        dirty_victim->pins++;
+        *writeback = dirty_victim;
+    }
+    return NULL;
+}
+
+/*============================================================================
+ * Device I/O (cache lock not held; the block is BUSY)
+ *============================================================================*/
+
+static int bcache_load(bcache_block_t *b) {
+    uint64_t lba = b->block * BCACHE_SECTORS_PER_BLOCK;
+    if (b->dev->read_sectors(b->dev->device, lba, b->sectors, b->data) != 0) {
+        kprintf("[BCACHE] Read failed at sector %lu\n", lba);
+        return BCACHE_ERR_IO;
+    }
+    if (b->sectors < BCACHE_SECTORS_PER_BLOCK) {
+        memset(b->data + b->sectors * BCACHE_SECTOR_SIZE, 0,
+                      (BCACHE_SECTORS_PER_BLOCK - b->sectors) * BCACHE_SECTOR_SIZE);
+    }
+    return BCACHE_OK;
+}
+
+/**
+ * Write each run of dirty sectors in one device call
+ * @return Number of runs written, or negative error code
+ */
+static int bcache_write_runs(bcache_block_t *b, uint8_t mask) {
+    uint64_t lba = b->block * BCACHE_SECTORS_PER_BLOCK;
+    int runs = 0;
+
+    for (uint32_t i = 0; i < BCACHE_SECTORS_PER_BLOCK; ) {
+        if (!(mask & (1u << i))) {
+            i++;
+            continue;
+        }
+        uint32_t start = i;
+        while (i < BCACHE_SECTORS_PER_BLOCK && (mask & (1u << i))) {
+            i++;
+        }
+        if (b->dev->write_sectors(b->dev->device, lba + start, i - start,
+                                  b->data + start * BCACHE_SECTOR_SIZE) != 0) {
+            kprintf("[BCACHE] Write failed at sector %lu\n", lba + start);
+            return BCACHE_ERR_IO;
+        }
+        runs++;
+    }
+    return runs;
+}
+
+/**
+ * Write back a BUSY, pinned block and release it
+ * Called with the cache lock held; drops it around the I/O. Sectors
+ * dirtied during the write stay dirty for the next one.
+ */
+static int bcache_writeback(bcache_block_t *b) {
+    uint8_t mask = bcache_take_dirty(b);
+    bcache_lock_release();
+
+    int result = bcache_write_runs(b, mask);
+
+    bcache_lock_acquire();
+    if (result < 0) {
+        bcache_set_dirty(b, mask);
+    } else {
+        bcache_stats.writebacks += result;
+        result = BCACHE_OK;
+    }
+    b->pins--;
+    bcache_unbusy(b);
+    return result;
+}
+
+static inline bool bcache_fully_dirty(const bcache_block_t *b) {
+    return b && b->dirty == BCACHE_FULL_MASK && !(b->flags & BLK_BUSY);
+}
+
+/**
+ * Write back a dirty, idle block together with its neighbours
+ * Consecutive wholly dirty blocks go out in one device write, straight
+ * from their frames on a vectored device and through the flush buffer
+ * otherwise; a partly dirty block, or one flushed while someone else has
+ * the buffer, is written on its own. Called with the cache lock held;
+ * drops it around the I/O.
+ * @return BCACHE_OK or negative error code
+ */
+static int bcache_flush_block(bcache_block_t *b) {
+    bool vec = b->dev->write_vec != NULL;
+    if (!bcache_fully_dirty(b) ||
+        (!vec && (!bcache_flush_buffer ||
+                  __sync_lock_test_and_set(&bcache_flush_buffer_lock, 1)))) {
+        b->flags |= BLK_BUSY;
+        b->pins++;
+        return bcache_writeback(b);
+    }
+
+    bcache_dev_t *dev = b->dev;
+    uint64_t first = b->block;
+    while (first > 0 && b->block - first + 1 < BCACHE_FLUSH_MAX_BLOCKS &&
+           bcache_fully_dirty(bcache_lookup(dev, first - 1))) {
+        first--;
+    }
+
+    bcache_block_t *run[BCACHE_FLUSH_MAX_BLOCKS];
+    uint32_t n = 0;
+    while (n < BCACHE_FLUSH_MAX_BLOCKS) {
+        bcache_block_t *next = bcache_lookup(dev, first + n);
+        if (!bcache_fully_dirty(next)) {
+            break;
+        }
+        next->flags |= BLK_BUSY;
+        next->pins++;
+        bcache_take_dirty(next);
+        run[n++] = next;
+    }
+    bcache_lock_release();
+
+    int result;
+    if (vec) {
+        bcache_seg_t segs[BCACHE_FLUSH_MAX_BLOCKS];
+        for (uint32_t i = 0; i < n; i++) {
+            segs[i].lba = (first + i) * BCACHE_SECTORS_PER_BLOCK;
+            segs[i].count = BCACHE_SECTORS_PER_BLOCK;
+            segs[i].buffer = run[i]->data;
+        }
+        result = dev->write_vec(dev->device, segs, n);
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            memcpy(bcache_flush_buffer + i * BCACHE_BLOCK_SIZE, run[i]->data,
+                          BCACHE_BLOCK_SIZE);
+        }
+        result = dev->write_sectors(dev->device, first * BCACHE_SECTORS_PER_BLOCK,
+                                    n * BCACHE_SECTORS_PER_BLOCK, bcache_flush_buffer);
+        __sync_lock_release(&bcache_flush_buffer_lock);
+    }
+    if (result != 0) {
+        kprintf("[BCACHE] Write failed at sector %lu (%u blocks)\n",
+                first * BCACHE_SECTORS_PER_BLOCK, n);
+    }
+
+    bcache_lock_acquire();
+    for (uint32_t i = 0; i < n; i++) {
+        if (result != 0) {
+            bcache_set_dirty(run[i], BCACHE_FULL_MASK);
+        }
+        run[i]->pins--;
+        bcache_unbusy(run[i]);
+    }
+    if (result == 0) {
+        bcache_stats.writebacks++;
+    }
+    return result == 0 ? BCACHE_OK : BCACHE_ERR_IO;
+}
+
+/**
+ * Write back expired blocks, and any others while too many are dirty
+ * Called with the cache lock held; drops it around the I/O.
+ * @param target Dirty block count to get down to
+ */
+static void bcache_flush_pass(uint32_t target) {
+    uint64_t now = timer_now_ms();
+
+    for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS; i++) {
+        bcache_block_t *b = &bcache_blocks[i];
+        if (!b->dev || !b->dirty || (b->flags & BLK_BUSY)) {
+            continue;
+        }
+        bool expired = now - b->dirtied_ms >= bcache_wb.expire_ms;
+        if (expired || bcache_dirty_count > target) {
+            bcache_flush_block(b);
+        }
+    }
+}
+
+static void bcache_flush_tick(void *arg) {
+    UNUSED(arg);
+    __atomic_fetch_add(&bcache_flush_event, 1, __ATOMIC_RELEASE);
+    waitq_wake(&bcache_flush_event, 1);
+}
+
+static void bcache_flusher(void *arg) {
+    UNUSED(arg);
+
+    ktimer_t timer;
+    ktimer_init_soft(&timer, bcache_flush_tick, NULL);
+
+    for (;;) {
+        uint32_t seen = bcache_flush_event;
+
+        bcache_lock_acquire();
+        bcache_flush_pass(bcache_dirty_threshold(bcache_wb.background_pct));
+        uint64_t interval = bcache_wb.interval_ms;
+        bcache_lock_release();
+
+        ktimer_cancel(&timer);
+        ktimer_start(&timer, interval * NSEC_PER_MSEC, 0);
+        waitq_wait(&bcache_flush_event, seen);
+    }
+}
+
+/*============================================================================
+ * Block Access
+ *============================================================================*/
+
+/**
+ * Sectors of a block the device backs (the last block may be short)
+ * @return Sector count, 0 past the end of the device
+ */
+static uint32_t bcache_block_sectors(bcache_dev_t *dev, uint64_t block) {
+    if (!dev->total_sectors) {
+        return BCACHE_SECTORS_PER_BLOCK;
+    }
+    uint64_t first = block * BCACHE_SECTORS_PER_BLOCK;
+    if (first >= dev->total_sectors) {
+        return 0;
+    }
+    return (uint32_t)MIN((uint64_t)BCACHE_SECTORS_PER_BLOCK, dev->total_sectors - first);
+}
+
+/**
+ * Get a pinned block
+ * @param fill Load the block's contents if it is not cached
+ * @param owned Set when the caller got a new, unfilled block, which stays
+ *              BUSY until bcache_put(..., true)
+ * @return Block, or NULL with *err set
+ */
+static bcache_block_t *bcache_get(bcache_dev_t *dev, uint64_t block, bool fill,
+                                  bool *owned, int *err) {
+    uint32_t sectors = bcache_block_sectors(dev, block);
+    if (!sectors) {
+        *err = BCACHE_ERR_INVAL;
+        return NULL;
+    }
+
+    *owned = false;
+    bcache_lock_acquire();
+
+    for (;;) {
+        bcache_block_t *b = bcache_lookup(dev, block);
+        if (b) {
+            b->flags |= BLK_REFERENCED;
+            if (b->flags & BLK_BUSY) {
+                /* Pinned so the slot keeps its key while we sleep */
+                uint32_t seen = b->state;
+                b->pins++;
+                bcache_lock_release();
+                waitq_wait(&b->state, seen);
+                bcache_lock_acquire();
+                b->pins--;
+                continue;
+            }
+            if (!(b->flags & BLK_VALID)) {
+                /* An earlier load failed; retry it */
+                bcache_hash_remove(b);
+                b->flags = 0;
+                continue;
+            }
+            b->pins++;
+            bcache_stats.hits++;
+            bcache_lock_release();
+            return b;
+        }
+
+        bcache_block_t *writeback;
+        b = bcache_alloc_slot(&writeback);
+        if (!b) {
+            if (writeback) {
+                bcache_writeback(writeback);
+                continue;
+            }
+            bcache_lock_release();
+            kprintf("[BCACHE] No block available\n");
+            *err = BCACHE_ERR_NOMEM;
+            return NULL;
+        }
+
+        b->dev = dev;
+        b->block = block;
+        b->sectors = (uint8_t)sectors;
+        b->flags = BLK_BUSY | BLK_REFERENCED;
+        b->dirty = 0;
+        b->pins = 1;
+        bcache_hash_insert(b);
+        bcache_stats.misses++;
+        bcache_lock_release();
+
+        if (!fill) {
+            *owned = true;
+            return b;
+        }
+
+        int result = bcache_load(b);
+
+        bcache_lock_acquire();
+        if (result == BCACHE_OK) {
+            b->flags |= BLK_VALID;
+        }
+        bcache_unbusy(b);
+        if (result != BCACHE_OK) {
+            b->pins--;
+            if (!b->pins) {
+                bcache_hash_remove(b);
+                b->flags = 0;
+            }
+            bcache_lock_release();
+            *err = result;
+            return NULL;
+        }
+        bcache_lock_release();
+        return b;
+    }
+}
+
+/**
+ * Unpin a block
+ * @param dirty Sectors the caller wrote
+ * @param owned The caller filled a new block from bcache_get
+ */
+static void bcache_put(bcache_block_t *b, uint8_t dirty, bool owned) {
+    bcache_lock_acquire();
+    uint32_t was_dirty = bcache_dirty_count;
+    bcache_set_dirty(b, dirty);
+    if (owned) {
+        b->flags |= BLK_VALID;
+        bcache_unbusy(b);
+    }
+    b->pins--;
+
+    /* Too dirty: the writer pays for write-back until back under the limit */
+    uint32_t limit = bcache_dirty_threshold(bcache_wb.limit_pct);
+    if (bcache_dirty_count > limit) {
+        bcache_flush_pass(limit);
+    }
+    uint32_t background = bcache_dirty_threshold(bcache_wb.background_pct);
+    bool kick = bcache_flush_thread && was_dirty <= background && bcache_dirty_count > background;
+    bcache_lock_release();
+
+    if (kick) {
+        bcache_flush_tick(NULL);
+    }
+}
+
+/**
+ * Dirty mask of the sectors a byte range in a block touches
+ */
+static uint8_t bcache_sector_mask(bcache_block_t *b, size_t in, size_t n) {
+    uint32_t first = in / BCACHE_SECTOR_SIZE;
+    uint32_t last = (in + n - 1) / BCACHE_SECTOR_SIZE;
+    uint32_t mask = ((1u << (last + 1)) - 1) & ~((1u << first) - 1);
+    return (uint8_t)(mask & ((1u << b->sectors) - 1));
+}
+
+/*============================================================================
+ * Readahead
+ *============================================================================*/
+
+/**
+ * Load a run of uncached blocks with one device read
+ * The run ends early at a cached block, the end of the device, or when
+ * no clean slot is free (readahead never writes back to make room).
+ * The caller owns bcache_ra_buffer, which vectored devices do without.
+ * @return Blocks the run covered (loaded or not), 0 if it could not start
+ */
+static uint32_t bcache_fill_run(bcache_dev_t *dev, uint64_t first, uint32_t count) {
+    bcache_block_t *run[BCACHE_RA_MAX_BLOCKS];
+    uint32_t n = 0;
+    uint32_t sectors = 0;
+
+    bcache_lock_acquire();
+    while (n < count) {
+        uint32_t block_sectors = bcache_block_sectors(dev, first + n);
+        if (!block_sectors || bcache_lookup(dev, first + n)) {
+            break;
+        }
+
+        bcache_block_t *writeback;
+        bcache_block_t *b = bcache_alloc_slot(&writeback);
+        if (!b) {
+            if (writeback) {
+                writeback->pins--;
+                bcache_unbusy(writeback);
+            }
+            break;
+        }
+
+        /* Not referenced: unused readahead is the first thing CLOCK takes */
+        b->dev = dev;
+        b->block = first + n;
+        b->sectors = (uint8_t)block_sectors;
+        b->flags = BLK_BUSY;
+        b->dirty = 0;
+        b->pins = 1;
+        bcache_hash_insert(b);
+
+        run[n++] = b;
+        sectors += block_sectors;
+        if (block_sectors < BCACHE_SECTORS_PER_BLOCK) {
+            break;
+        }
+    }
+    bcache_lock_release();
+
+    if (!n) {
+        return 0;
+    }
+
+    int result;
+    if (dev->read_vec) {
+        bcache_seg_t segs[BCACHE_RA_MAX_BLOCKS];
+        for (uint32_t i = 0; i < n; i++) {
+            segs[i].lba = (first + i) * BCACHE_SECTORS_PER_BLOCK;
+            segs[i].count = run[i]->sectors;
+            segs[i].buffer = run[i]->data;
+        }
+        result = dev->read_vec(dev->device, segs, n);
+    } else {
+        result = dev->read_sectors(dev->device, first * BCACHE_SECTORS_PER_BLOCK,
+                                   sectors, bcache_ra_buffer);
+    }
+    if (result == 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            size_t bytes = run[i]->sectors * BCACHE_SECTOR_SIZE;
+            if (!dev->read_vec) {
+                memcpy(run[i]->data, bcache_ra_buffer + i * BCACHE_BLOCK_SIZE, bytes);
+            }
+            memset(run[i]->data + bytes, 0, BCACHE_BLOCK_SIZE - bytes);
+        }
+    } else {
+        kprintf("[BCACHE] Readahead failed at sector %lu\n",
+                first * BCACHE_SECTORS_PER_BLOCK);
+    }
+
+    bcache_lock_acquire();
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_block_t *b = run[i];
+        if (result == 0) {
+            b->flags |= BLK_VALID;
+        }
+        bcache_unbusy(b);
+        b->pins--;
+        if (result != 0 && !b->pins) {
+            bcache_hash_remove(b);
+            b->flags = 0;
+        }
+    }
+    if (result == 0) {
+        bcache_stats.readahead += n;
+    }
+    bcache_lock_release();
+
+    return n;
+}
+
+/**
+ * Read ahead a request's blocks, skipping those already cached
+ */
+static void bcache_ra_run(const bcache_ra_req_t *req) {
+    uint64_t block = req->block;
+    uint64_t end = req->block + req->count;
+
+    while (block < end) {
+        uint32_t count = (uint32_t)MIN(end - block, (uint64_t)BCACHE_RA_MAX_BLOCKS);
+        uint32_t done = bcache_fill_run(req->dev, block, count);
+        if (!done) {
+            /* Cached already, or no room; step past it */
+            bcache_lock_acquire();
+            bool cached = bcache_lookup(req->dev, block) != NULL;
+            bcache_lock_release();
+            if (!cached) {
+                break;
+            }
+            done = 1;
+        }
+        block += done;
+    }
+}
+
+/**
+ * Finish a request: release the run buffer and wake invalidators
+ */
+static void bcache_ra_finish(void) {
+    bcache_ra_acquire();
+    bcache_ra_active = NULL;
+    __atomic_fetch_add(&bcache_ra_done, 1, __ATOMIC_RELEASE);
+    bcache_ra_release();
+    waitq_wake(&bcache_ra_done, WAITQ_WAKE_ALL);
+}
+
+static void bcache_ra_worker(void *arg) {
+    UNUSED(arg);
+
+    for (;;) {
+        bcache_ra_acquire();
+        if (bcache_ra_head == bcache_ra_tail) {
+            uint32_t seen = bcache_ra_event;
+            bcache_ra_release();
+            waitq_wait(&bcache_ra_event, seen);
+            continue;
+        }
+        bcache_ra_req_t req = bcache_ra_queue[bcache_ra_head % BCACHE_RA_QUEUE_SIZE];
+        bcache_ra_head++;
+        bcache_ra_active = req.dev;
+        bcache_ra_release();
+
+        bcache_ra_run(&req);
+        bcache_ra_finish();
+    }
+}
+
+/**
+ * Drop a device's queued readahead and wait out the one running
+ */
+static void bcache_ra_cancel(bcache_dev_t *dev) {
+    bcache_ra_acquire();
+
+    uint32_t kept = bcache_ra_head;
+    for (uint32_t i = bcache_ra_head; i != bcache_ra_tail; i++) {
+        bcache_ra_req_t *req = &bcache_ra_queue[i % BCACHE_RA_QUEUE_SIZE];
+        if (req->dev != dev) {
+            bcache_ra_queue[kept++ % BCACHE_RA_QUEUE_SIZE] = *req;
+        }
+    }
+    bcache_ra_tail = kept;
+
+    while (bcache_ra_active == dev) {
+        uint32_t seen = bcache_ra_done;
+        bcache_ra_release();
+        waitq_wait(&bcache_ra_done, seen);
+        bcache_ra_acquire();
+    }
+
+    bcache_ra_release();
+}
+
+/*============================================================================
+ * Direct Reads
+ *============================================================================*/
+
+/**
+ * Read sectors from the device straight into a caller's buffer
+ * One segment per physically contiguous piece of the buffer. Each page is
+ * written to first, so demand-zero and copy-on-write pages are private
+ * and present before the device writes them.
+ */
+static int bcache_direct_run(bcache_dev_t *dev, uint64_t lba, uint32_t sectors,
+                             uint8_t *dest) {
+    bcache_seg_t segs[BCACHE_DIRECT_MAX_BLOCKS + 1];
+    uint32_t n = 0;
+    uintptr_t va = (uintptr_t)dest;
+    size_t left = (size_t)sectors * BCACHE_SECTOR_SIZE;
+
+    while (left > 0) {
+        size_t piece = MIN(left, PAGE_SIZE - (va % PAGE_SIZE));
+        volatile uint8_t *touch = (volatile uint8_t *)va;
+        *touch = *touch;
+
+        physaddr_t phys = vmm_get_physical(va);
+        if (!phys) {
+            return BCACHE_ERR_INVAL;
+        }
+        uint8_t *buffer = (uint8_t *)(phys + VMM_KERNEL_PHYS_MAP);
+        uint32_t count = (uint32_t)(piece / BCACHE_SECTOR_SIZE);
+
+        if (n && (uint8_t *)segs[n - 1].buffer +
+                 segs[n - 1].count * BCACHE_SECTOR_SIZE == buffer) {
+            segs[n - 1].count += count;
+        } else {
+            segs[n].lba = lba;
+            segs[n].count = count;
+            segs[n].buffer = buffer;
+            n++;
+        }
+
+        lba += count;
+        va += piece;
+        left -= piece;
+    }
+
+    if (dev->read_vec(dev->device, segs, n) != 0) {
+        kprintf("[BCACHE] Direct read failed at sector %lu\n", segs[0].lba);
+        return BCACHE_ERR_IO;
+    }
+    return BCACHE_OK;
+}
+
+/*============================================================================
+ * Public Interface
+ *============================================================================*/
+
+void bcache_init(void) {
+    kprintf("[BCACHE] Initializing block buffer cache...\n");
+
+    memset(bcache_blocks, 0, sizeof(bcache_blocks));
+    memset(bcache_hash, 0, sizeof(bcache_hash));
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+    bcache_hand = 0;
+
+    if (!shrinker_register(&bcache_shrinker)) {
+        kprintf("[BCACHE] Warning: could not register a shrinker\n");
+    }
+
+    /* Readahead needs a contiguous buffer for its runs */
+    physaddr_t ra_phys = pmm_alloc_pages(BCACHE_RA_MAX_BLOCKS);
+    if (ra_phys) {
+        bcache_ra_buffer = (uint8_t *)(ra_phys + VMM_KERNEL_PHYS_MAP);
+        process_t *worker = thread_create(NULL, "bcache-ra", bcache_ra_worker, NULL);
+        bcache_ra_thread = worker && scheduler_add(worker);
+    } else {
+        kprintf("[BCACHE] Warning: no readahead buffer, readahead disabled\n");
+    }
+    if (ra_phys && !bcache_ra_thread) {
+        kprintf("[BCACHE] Warning: no readahead thread, readers read ahead themselves\n");
+    }
+
+    /* Write-back: a buffer for coalesced runs and the flusher thread */
+    physaddr_t flush_phys = pmm_alloc_pages(BCACHE_FLUSH_MAX_BLOCKS);
+    if (flush_phys) {
+        bcache_flush_buffer = (uint8_t *)(flush_phys + VMM_KERNEL_PHYS_MAP);
+    }
+    process_t *flusher = thread_create(NULL, "bcache-flush", bcache_flusher, NULL);
+    bcache_flush_thread = flusher && scheduler_add(flusher);
+    if (!bcache_flush_thread) {
+        kprintf("[BCACHE] Warning: no flusher thread, dirty blocks wait for sync or eviction\n");
+    }
+
+    kprintf("[BCACHE] Up to %u blocks of %u bytes\n",
+            BCACHE_MAX_BLOCKS, BCACHE_BLOCK_SIZE);
+}
+
+void bcache_dev_init(bcache_dev_t *dev, void *device,
+                     int (*read_sectors)(void *, uint64_t, uint32_t, void *),
+                     int (*write_sectors)(void *, uint64_t, uint32_t, const void *),
+                     uint64_t total_sectors) {
+    dev->device = device;
+    dev->read_sectors = read_sectors;
+    dev->write_sectors = write_sectors;
+    dev->read_vec = NULL;
+    dev->write_vec = NULL;
+    dev->total_sectors = total_sectors;
+}
+
+void bcache_dev_set_vec(bcache_dev_t *dev,
+                        int (*read_vec)(void *, const bcache_seg_t *, uint32_t),
+                        int (*write_vec)(void *, const bcache_seg_t *, uint32_t)) {
+    dev->read_vec = read_vec;
+    dev->write_vec = write_vec;
+}
+
+int bcache_read(bcache_dev_t *dev, uint64_t offset, void *buf, size_t len) {
+    if (!dev || !dev->read_sectors || (!buf && len)) {
+        return BCACHE_ERR_INVAL;
+    }
+
+    uint8_t *dest = (uint8_t *)buf;
+    while (len > 0) {
+        uint64_t block = offset / BCACHE_BLOCK_SIZE;
+        size_t in = offset % BCACHE_BLOCK_SIZE;
+        size_t n = MIN(len, BCACHE_BLOCK_SIZE - in);
+
+        bool owned;
+        int err;
+        bcache_block_t *b = bcache_get(dev, block, true, &owned, &err);
+        if (!b) {
+            return err;
+        }
+        memcpy(dest, b->data + in, n);
+        bcache_put(b, 0, false);
+
+        dest += n;
+        offset += n;
+        len -= n;
+    }
+    return BCACHE_OK;
+}
+
+int bcache_read_direct(bcache_dev_t *dev, uint64_t offset, void *buf, size_t len) {
+    if (!dev || !dev->read_sectors || (!buf && len)) {
+        return BCACHE_ERR_INVAL;
+    }
+    if (!dev->read_vec || len < BCACHE_DIRECT_MIN || offset % BCACHE_SECTOR_SIZE ||
+        len % BCACHE_SECTOR_SIZE || (uintptr_t)buf % BCACHE_SECTOR_SIZE) {
+        return bcache_read(dev, offset, buf, len);
+    }
+
+    uint8_t *dest = (uint8_t *)buf;
+    uint64_t sector = offset / BCACHE_SECTOR_SIZE;
+    uint64_t left = len / BCACHE_SECTOR_SIZE;
+
+    while (left > 0) {
+        uint64_t block = sector / BCACHE_SECTORS_PER_BLOCK;
+        uint32_t head = BCACHE_SECTORS_PER_BLOCK - sector % BCACHE_SECTORS_PER_BLOCK;
+
+        /* Sectors up to the next cached block (or the run limit) */
+        uint64_t run = 0;
+        bcache_lock_acquire();
+        for (uint32_t i = 0; run < left && i < BCACHE_DIRECT_MAX_BLOCKS; i++) {
+            if (!bcache_block_sectors(dev, block + i) || bcache_lookup(dev, block + i)) {
+                break;
+            }
+            run += i ? BCACHE_SECTORS_PER_BLOCK : head;
+        }
+        run = MIN(run, left);
+        if (run) {
+            bcache_stats.direct += run;
+        }
+        bcache_lock_release();
+
+        int result;
+        if (run) {
+            result = bcache_direct_run(dev, sector, (uint32_t)run, dest);
+        } else {
+            run = MIN((uint64_t)head, left);
+            result = bcache_read(dev, sector * BCACHE_SECTOR_SIZE, dest,
+                                 run * BCACHE_SECTOR_SIZE);
+        }
+        if (result != BCACHE_OK) {
+            return result;
+        }
+
+        dest += run * BCACHE_SECTOR_SIZE;
+        sector += run;
+        left -= run;
+    }
+    return BCACHE_OK;
+}
+
+int bcache_write(bcache_dev_t *dev, uint64_t offset, const void *buf, size_t len) {
+    if (!dev || !dev->read_sectors || !dev->write_sectors || (!buf && len)) {
+        return BCACHE_ERR_INVAL;
+    }
+
+    const uint8_t *src = (const uint8_t *)buf;
+    while (len > 0) {
+        uint64_t block = offset / BCACHE_BLOCK_SIZE;
+        size_t in = offset % BCACHE_BLOCK_SIZE;
+        size_t n = MIN(len, BCACHE_BLOCK_SIZE - in);
+
+        /* A write covering the whole block needs nothing from the device */
+        bool whole = (in == 0 && n == BCACHE_BLOCK_SIZE);
+        bool owned;
+        int err;
+        bcache_block_t *b = bcache_get(dev, block, !whole, &owned, &err);
+        if (!b) {
+            return err;
+        }
+        memcpy(b->data + in, src, n);
+        bcache_put(b, bcache_sector_mask(b, in, n), owned);
+
+        src += n;
+        offset += n;
+        len -= n;
+    }
+    return BCACHE_OK;
+}
+
+void bcache_readahead(bcache_dev_t *dev, uint64_t offset, size_t len) {
+    if (!dev || !dev->read_sectors || !len || !bcache_ra_buffer) {
+        return;
+    }
+
+    bcache_ra_req_t req = {
+        .dev = dev,
+        .block = offset / BCACHE_BLOCK_SIZE,
+        .count = (uint32_t)((offset + len - 1) / BCACHE_BLOCK_SIZE -
+                            offset / BCACHE_BLOCK_SIZE + 1),
+    };
+
+    bcache_ra_acquire();
+    if (bcache_ra_thread) {
+        if (bcache_ra_tail - bcache_ra_head < BCACHE_RA_QUEUE_SIZE) {
+            bcache_ra_queue[bcache_ra_tail % BCACHE_RA_QUEUE_SIZE] = req;
+            bcache_ra_tail++;
+            __atomic_fetch_add(&bcache_ra_event, 1, __ATOMIC_RELEASE);
+            bcache_ra_release();
+            waitq_wake(&bcache_ra_event, 1);
+            return;
+        }
+        bcache_ra_release();
+        return;
+    }
+
+    /* No thread: read ahead here, unless someone else has the buffer */
+    if (bcache_ra_active) {
+        bcache_ra_release();
+        return;
+    }
+    bcache_ra_active = dev;
+    bcache_ra_release();
+
+    bcache_ra_run(&req);
+    bcache_ra_finish();
+}
+
+int bcache_sync(bcache_dev_t *dev) {
+    int result = BCACHE_OK;
+
+    bcache_lock_acquire();
+    for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS; i++) {
+        bcache_block_t *b = &bcache_blocks[i];
+        /* Busy blocks may be mid write-back; wait for those too */
+        while (b->dev && (!dev || b->dev == dev) && (b->dirty || (b->flags & BLK_BUSY))) {
+            if (b->flags & BLK_BUSY) {
+                uint32_t seen = b->state;
+                b->pins++;
+                bcache_lock_release();
+                waitq_wait(&b->state, seen);
+                bcache_lock_acquire();
+                b->pins--;
+                continue;
+            }
+            int err = bcache_flush_block(b);
+            if (err != BCACHE_OK) {
+                if (result == BCACHE_OK) {
+                    result = err;
+                }
+                break;
+            }
+        }
+    }
+    bcache_lock_release();
+
+    return result;
+}
+
+int bcache_invalidate(bcache_dev_t *dev) {
+    if (!dev) {
+        return BCACHE_ERR_INVAL;
+    }
+
+    bcache_ra_cancel(dev);
+    int result = bcache_sync(dev);
+
+    bcache_lock_acquire();
+    for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS; i++) {
+        bcache_block_t *b = &bcache_blocks[i];
+        if (b->dev != dev) {
+            continue;
+        }
+        if (b->pins || (b->flags & BLK_BUSY)) {
+            kprintf("[BCACHE] Warning: block %lu still in use\n", b->block);
+            continue;
+        }
+        if (b->dirty) {
+            kprintf("[BCACHE] Warning: dropping dirty block %lu\n", b->block);
+        }
+        bcache_release_frame(b);
+    }
+    bcache_lock_release();
+
+    return result;
+}
+
+/**
+ * Frames held by clean, unused blocks (racy; a hint for the shrinker)
+ */
+static size_t bcache_reclaimable(void) {
+    size_t count = 0;
+    for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS; i++) {
+        const bcache_block_t *b = &bcache_blocks[i];
+        if (b->frame && !b->pins && !b->dirty && !(b->flags & BLK_BUSY)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t bcache_reclaim(size_t pages) {
+    /* Called from inside the PMM: never wait for a cache user */
+    if (!bcache_lock_try()) {
+        return 0;
+    }
+
+    size_t freed = 0;
+
+    /* Unreferenced blocks first, then any clean block */
+    for (int pass = 0; pass < 2 && freed < pages; pass++) {
+        for (uint32_t i = 0; i < BCACHE_MAX_BLOCKS && freed < pages; i++) {
+            bcache_block_t *b = &bcache_blocks[i];
+            if (!b->frame || b->pins || b->dirty || (b->flags & BLK_BUSY)) {
+                continue;
+            }
+            if (pass == 0 && (b->flags & BLK_REFERENCED)) {
+                continue;
+            }
+            bcache_release_frame(b);
+            freed++;
+        }
+    }
+
+    bcache_stats.reclaimed += freed;
+    bcache_lock_release();
+
+    return freed;
+}
+
+bool bcache_set_writeback(const bcache_writeback_t *config) {
+    if (!config || config->background_pct > config->limit_pct || config->limit_pct > 100 ||
+        !config->interval_ms) {
+        return false;
+    }
+
+    bcache_lock_acquire();
+    bcache_wb = *config;
+    bcache_lock_release();
+
+    /* Let the flusher pick up the new interval now */
+    if (bcache_flush_thread) {
+        bcache_flush_tick(NULL);
+    }
+    return true;
+}
+
+void bcache_get_writeback(bcache_writeback_t *config) {
+    if (!config) {
+        return;
+    }
+
+    bcache_lock_acquire();
+    *config = bcache_wb;
+    bcache_lock_release();
+}
+
+void bcache_get_stats(bcache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    bcache_lock_acquire();
+    *stats = bcache_stats;
+    stats->dirty = bcache_dirty_count;
+    bcache_lock_release();
+}
+
+void bcache_dump_stats(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+
+    kprintf("[BCACHE] Statistics:\n");
+    kprintf("[BCACHE]   Blocks:     %u (%u dirty)\n", stats.blocks, stats.dirty);
+    kprintf("[BCACHE]   Hits:       %lu\n", stats.hits);
+    kprintf("[BCACHE]   Misses:     %lu\n", stats.misses);
+    kprintf("[BCACHE]   Evictions:  %lu\n", stats.evictions);
+    kprintf("[BCACHE]   Writebacks: %lu\n", stats.writebacks);
+    kprintf("[BCACHE]   Reclaimed:  %lu\n", stats.reclaimed);
+    kprintf("[BCACHE]   Readahead:  %lu\n", stats.readahead);
+    kprintf("[BCACHE]   Direct:     %lu sectors\n", stats.direct);
+}
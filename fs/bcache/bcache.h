@@ -0,0 +1,207 @@
+/**
+ * AAAos Block Buffer Cache
+ *
+ * A cache of device blocks shared by all filesystems, between them and
+ * the sector-level block device operations. Blocks are one page each and
+ * are keyed by (device, block number), so the same data read twice is
+ * read from the disk once, whichever file or directory it belongs to.
+ *
+ * Writes are write-back: they dirty the sectors they touch, which go to
+ * the device when the block is evicted, when the flusher thread finds it
+ * expired or the cache too dirty, or when the device is synced. Only
+ * dirty sectors are written, so a block that covers metadata the
+ * filesystem writes directly is never written back stale, and runs of
+ * wholly dirty blocks go out as one device write.
+ *
+ * Eviction is CLOCK: every hit sets a block's referenced bit, and the
+ * hand clears it on its first pass and takes the block on its second.
+ * The cache grows while the PMM has frames to spare and gives clean
+ * blocks back when an allocation would otherwise fail (pmm.h reclaim).
+ *
+ * Readahead requests are queued to a kernel thread, which reads whole
+ * runs of missing blocks at once while the reader is still busy with the
+ * data before them.
+ */
+
+#ifndef _AAAOS_FS_BCACHE_H
+#define _AAAOS_FS_BCACHE_H
+
+#include "../../kernel/include/types.h"
+
+/* Cache configuration */
+#define BCACHE_BLOCK_SIZE       PAGE_SIZE
+#define BCACHE_SECTOR_SIZE      512
+#define BCACHE_SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / BCACHE_SECTOR_SIZE)
+#define BCACHE_MAX_BLOCKS       1024    /* At most 4MB cached */
+#define BCACHE_HASH_SIZE        256     /* Lookup buckets (power of two) */
+#define BCACHE_MIN_FREE_PAGES   256     /* Evict rather than grow below this */
+#define BCACHE_RA_MAX_BLOCKS    32      /* Largest readahead device read (128KB) */
+#define BCACHE_RA_QUEUE_SIZE    32      /* Pending readahead requests */
+#define BCACHE_FLUSH_MAX_BLOCKS 32      /* Largest coalesced write-back (128KB) */
+#define BCACHE_DIRECT_MIN       (64 * 1024) /* Smallest read bypassing the cache */
+#define BCACHE_DIRECT_MAX_BLOCKS 32     /* Largest direct device read (128KB) */
+
+/* Write-back defaults (see bcache_set_writeback) */
+#define BCACHE_DIRTY_BACKGROUND 10      /* Flusher writes ahead above this % dirty */
+#define BCACHE_DIRTY_LIMIT      40      /* Writers flush themselves above this % */
+#define BCACHE_DIRTY_EXPIRE_MS  3000    /* Oldest a dirty block may get */
+#define BCACHE_FLUSH_INTERVAL_MS 500    /* Flusher wakeup period */
+
+/* Error codes (VFS values) */
+#define BCACHE_OK               0
+#define BCACHE_ERR_IO           (-5)    /* Device read or write failed */
+#define BCACHE_ERR_NOMEM        (-12)   /* No block could be allocated or evicted */
+#define BCACHE_ERR_INVAL        (-22)   /* Invalid argument */
+
+/**
+ * Segment of a vectored device request
+ */
+typedef struct bcache_seg {
+    uint64_t lba;                       /* First sector */
+    uint32_t count;                     /* Number of sectors */
+    void *buffer;                       /* Physically contiguous */
+} bcache_seg_t;
+
+/**
+ * Cached block device
+ * Embedded by the filesystem that mounts the device.
+ */
+typedef struct bcache_dev {
+    void *device;                       /* Passed to the operations */
+    int (*read_sectors)(void *device, uint64_t lba, uint32_t count, void *buffer);
+    int (*write_sectors)(void *device, uint64_t lba, uint32_t count, const void *buffer);
+    /* Optional: a list of segments in one request, without a bounce buffer */
+    int (*read_vec)(void *device, const bcache_seg_t *segs, uint32_t count);
+    int (*write_vec)(void *device, const bcache_seg_t *segs, uint32_t count);
+    uint64_t total_sectors;             /* Device size, 0 if unknown */
+} bcache_dev_t;
+
+/**
+ * Write-back tuning
+ */
+typedef struct bcache_writeback {
+    uint32_t background_pct;            /* Flush without waiting for expiry above this */
+    uint32_t limit_pct;                 /* Writers wait for write-back above this */
+    uint32_t expire_ms;                 /* Flush blocks dirty for this long */
+    uint32_t interval_ms;               /* How often the flusher looks */
+} bcache_writeback_t;
+
+/**
+ * Cache statistics
+ */
+typedef struct bcache_stats {
+    uint64_t hits;                      /* Blocks found in the cache */
+    uint64_t misses;                    /* Blocks read from the device */
+    uint64_t evictions;                 /* Blocks reused for another key */
+    uint64_t writebacks;                /* Dirty sector runs written out */
+    uint64_t reclaimed;                 /* Frames given back to the PMM */
+    uint64_t readahead;                 /* Blocks loaded ahead of a reader */
+    uint64_t direct;                    /* Sectors read straight into callers' buffers */
+    uint32_t blocks;                    /* Blocks holding a frame */
+    uint32_t dirty;                     /* Of which dirty */
+} bcache_stats_t;
+
+/**
+ * Initialize the cache and register it with the PMM
+ */
+void bcache_init(void);
+
+/**
+ * Prepare a device for caching
+ * @param total_sectors Device size in sectors, 0 if unknown
+ */
+void bcache_dev_init(bcache_dev_t *dev, void *device,
+                     int (*read_sectors)(void *, uint64_t, uint32_t, void *),
+                     int (*write_sectors)(void *, uint64_t, uint32_t, const void *),
+                     uint64_t total_sectors);
+
+/**
+ * Give a device vectored operations
+ * Runs of blocks are then read and written straight to and from their
+ * frames, one request per run, instead of through a contiguous buffer.
+ */
+void bcache_dev_set_vec(bcache_dev_t *dev,
+                        int (*read_vec)(void *, const bcache_seg_t *, uint32_t),
+                        int (*write_vec)(void *, const bcache_seg_t *, uint32_t));
+
+/**
+ * Read bytes from a device through the cache
+ * @param offset Byte offset on the device
+ * @return BCACHE_OK or negative error code
+ */
+int bcache_read(bcache_dev_t *dev, uint64_t offset, void *buf, size_t len);
+
+/**
+ * Read bytes for a bulk reader, around the cache where it can
+ * Sectors of blocks that are not cached are read by the device straight
+ * into buf, without being cached; cached blocks (which may be dirty) are
+ * copied from the cache. Needs a vectored device, offset, len and buf
+ * aligned to sectors and at least BCACHE_DIRECT_MIN bytes; anything
+ * else is an ordinary bcache_read.
+ * @param buf Kernel or current user buffer (faulted in before the I/O)
+ * @return BCACHE_OK or negative error code
+ */
+int bcache_read_direct(bcache_dev_t *dev, uint64_t offset, void *buf, size_t len);
+
+/**
+ * Write bytes to a device through the cache (write-back)
+ * @param offset Byte offset on the device
+ * @return BCACHE_OK or negative error code
+ */
+int bcache_write(bcache_dev_t *dev, uint64_t offset, const void *buf, size_t len);
+
+/**
+ * Start loading a byte range into the cache in the background
+ * A hint: cached blocks are skipped, and the request is dropped if the
+ * queue is full. Missing blocks are read in runs of up to
+ * BCACHE_RA_MAX_BLOCKS, one device call per run. Without a readahead
+ * thread the caller does the reads itself.
+ * @param offset Byte offset on the device
+ */
+void bcache_readahead(bcache_dev_t *dev, uint64_t offset, size_t len);
+
+/**
+ * Write back a device's dirty blocks
+ * A barrier: returns once every write made before the call, including
+ * any the flusher has in flight, is on the device.
+ * @param dev Device, or NULL for every device
+ * @return BCACHE_OK or the first error
+ */
+int bcache_sync(bcache_dev_t *dev);
+
+/**
+ * Write back and drop every block of a device (before unmounting it)
+ * @return BCACHE_OK or the first write-back error
+ */
+int bcache_invalidate(bcache_dev_t *dev);
+
+/**
+ * Free clean, unused blocks (the cache's shrinker, see reclaim.h)
+ * Safe inside an allocation: it only try-locks the cache.
+ * @param pages Frames wanted
+ * @return Frames freed
+ */
+size_t bcache_reclaim(size_t pages);
+
+/**
+ * Change write-back tuning (percentages of BCACHE_MAX_BLOCKS)
+ * @return false if the values are out of range
+ */
+bool bcache_set_writeback(const bcache_writeback_t *config);
+
+/**
+ * Get write-back tuning
+ */
+void bcache_get_writeback(bcache_writeback_t *config);
+
+/**
+ * Get cache statistics
+ */
+void bcache_get_stats(bcache_stats_t *stats);
+
+/**
+ * Print cache statistics (for debugging)
+ */
+void bcache_dump_stats(void);
+
+#endif /* _AAAOS_FS_BCACHE_H */
@@ -6,7 +6,10 @@
 
 #include "fat32.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/log/log.h"
 #include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/heap.h"
+#include "../../lib/libc/string.h"
 
 /*============================================================================
  * Private Helper Functions - Forward Declarations
@@ -15,7 +18,13 @@
 static int fat32_read_boot_sector(fat32_fs_t *fs);
 static int fat32_read_fsinfo(fat32_fs_t *fs);
 static int fat32_write_fsinfo(fat32_fs_t *fs);
+static int fat32_fat_cache_init(fat32_fs_t *fs);
+static void fat32_fat_cache_free(fat32_fs_t *fs);
 static int fat32_flush_fat_cache(fat32_fs_t *fs);
+static int fat32_build_free_map(fat32_fs_t *fs);
+static void fat32_free_free_map(fat32_fs_t *fs);
+static void fat32_note_free(fat32_fs_t *fs, uint32_t cluster, bool free);
+static void fat32_dir_index_free_all(fat32_fs_t *fs);
 static uint32_t fat32_read_fat_entry(fat32_fs_t *fs, uint32_t cluster);
 static int fat32_write_fat_entry(fat32_fs_t *fs, uint32_t cluster, uint32_t value);
 static int fat32_find_entry_in_dir(fat32_fs_t *fs, uint32_t dir_cluster,
@@ -23,8 +32,7 @@ static int fat32_find_entry_in_dir(fat32_fs_t *fs, uint32_t dir_cluster,
                                    uint32_t *out_entry_index);
 static char* fat32_path_next_component(const char *path, char *component, size_t max_len);
 static int fat32_strcmp_83(const char *name, fat32_dir_entry_t *entry);
-static void fat32_memset(void *dest, uint8_t val, size_t n);
-static void fat32_memcpy(void *dest, const void *src, size_t n);
+static int fat32_strcasecmp(const char *a, const char *b);
 static size_t fat32_strlen(const char *s);
 static int fat32_strncmp(const char *s1, const char *s2, size_t n);
 static char fat32_toupper(char c);
@@ -39,7 +47,8 @@ static vfs_ops_t fat32_vfs_ops = {
     .read       = fat32_vfs_read,
     .write      = fat32_vfs_write,
     .truncate   = NULL,     /* TODO: Implement */
-    .sync       = NULL,     /* TODO: Implement */
+    .sync       = fat32_vfs_sync,
+    .readahead  = fat32_vfs_readahead,
     .readdir    = fat32_vfs_readdir,
     .finddir    = fat32_vfs_finddir,
     .mkdir      = fat32_vfs_mkdir,
@@ -50,6 +59,7 @@ static vfs_ops_t fat32_vfs_ops = {
     .stat       = fat32_vfs_stat,
     .chmod      = NULL,     /* FAT32 doesn't support Unix permissions */
     .chown      = NULL,     /* FAT32 doesn't support ownership */
+    .release    = NULL,
     .mount      = fat32_vfs_mount,
     .unmount    = fat32_vfs_unmount,
     .sync_fs    = NULL,     /* TODO: Implement */
@@ -60,21 +70,6 @@ static vfs_ops_t fat32_vfs_ops = {
  * String/Memory Utility Functions
  *============================================================================*/
 
-static void fat32_memset(void *dest, uint8_t val, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    while (n--) {
-        *d++ = val;
-    }
-}
-
-static void fat32_memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
-    }
-}
-
 static size_t fat32_strlen(const char *s) {
     size_t len = 0;
     while (*s++) len++;
@@ -135,7 +130,7 @@ fat32_fs_t* fat32_mount(void *device, fat32_block_ops_t *block_ops) {
         return NULL;
     }
     fat32_fs_t *fs = (fat32_fs_t *)(fs_phys + VMM_KERNEL_PHYS_MAP);
-    fat32_memset(fs, 0, sizeof(fat32_fs_t));
+    memset(fs, 0, sizeof(fat32_fs_t));
 
     fs->device = device;
     fs->block_ops = block_ops;
@@ -173,6 +168,13 @@ fat32_fs_t* fat32_mount(void *device, fat32_block_ops_t *block_ops) {
     kprintf("[FAT32]   Total clusters: %u\n", fs->total_clusters);
     kprintf("[FAT32]   Root cluster: %u\n", fs->root_cluster);
 
+    /* Cluster data is cached by device block; FAT and FSInfo sectors are not */
+    bcache_dev_init(&fs->bdev, device, block_ops->read_sectors,
+                    block_ops->write_sectors, total_sectors);
+    if (block_ops->read_sectors_v && block_ops->write_sectors_v) {
+        bcache_dev_set_vec(&fs->bdev, block_ops->read_sectors_v, block_ops->write_sectors_v);
+    }
+
     /* Read FSInfo sector */
     if (fat32_read_fsinfo(fs) != 0) {
         kprintf("[FAT32] Warning: Failed to read FSInfo sector\n");
@@ -191,9 +193,16 @@ fat32_fs_t* fat32_mount(void *device, fat32_block_ops_t *block_ops) {
     fs->cluster_buffer = (uint8_t *)(cluster_buf_phys + VMM_KERNEL_PHYS_MAP);
 
     /* Initialize FAT cache */
-    for (int i = 0; i < FAT32_FAT_CACHE_SIZE; i++) {
-        fs->fat_cache[i].valid = false;
-        fs->fat_cache[i].dirty = false;
+    if (fat32_fat_cache_init(fs) != 0) {
+        kprintf("[FAT32] Failed to allocate FAT cache\n");
+        pmm_free_pages(cluster_buf_phys, cluster_pages);
+        pmm_free_page(fs_phys);
+        return NULL;
+    }
+
+    /* Free-cluster bitmap; without it allocation scans the FAT */
+    if (fat32_build_free_map(fs) != 0) {
+        kprintf("[FAT32] Warning: No free-cluster bitmap\n");
     }
 
     fs->mounted = true;
@@ -210,8 +219,12 @@ int fat32_unmount(fat32_fs_t *fs) {
 
     kprintf("[FAT32] Unmounting volume\n");
 
-    /* Flush all dirty data */
+    /* Flush all dirty data and drop the volume's cached blocks */
     fat32_sync(fs);
+    bcache_invalidate(&fs->bdev);
+    fat32_fat_cache_free(fs);
+    fat32_free_free_map(fs);
+    fat32_dir_index_free_all(fs);
 
     /* Free cluster buffer */
     if (fs->cluster_buffer) {
@@ -244,7 +257,7 @@ static int fat32_read_boot_sector(fat32_fs_t *fs) {
     }
 
     /* Copy BPB to filesystem state */
-    fat32_memcpy(&fs->bpb, sector, sizeof(fat32_bpb_t));
+    memcpy(&fs->bpb, sector, sizeof(fat32_bpb_t));
 
     /* Validate boot signature */
     if (fs->bpb.boot_sector_sig != FAT32_BOOT_SIGNATURE) {
@@ -346,52 +359,167 @@ static int fat32_write_fsinfo(fat32_fs_t *fs) {
  * FAT Table Operations
  *============================================================================*/
 
-static uint32_t fat32_read_fat_entry(fat32_fs_t *fs, uint32_t cluster) {
-    /* Calculate which FAT sector contains this entry */
-    uint32_t fat_offset = cluster * 4;  /* 4 bytes per FAT32 entry */
-    uint32_t fat_sector = fs->fat_start_sector + (fat_offset / fs->bpb.bytes_per_sector);
-    uint32_t entry_offset = fat_offset % fs->bpb.bytes_per_sector;
+/*
+ * FAT sectors go through the block cache like cluster data, so evicting a
+ * dirty FAT cache entry only dirties the cached block and the flusher
+ * writes it out with its neighbours.
+ */
+static int fat32_read_cached_sector(fat32_fs_t *fs, uint32_t sector, void *buf) {
+    return bcache_read(&fs->bdev, (uint64_t)sector * FAT32_SECTOR_SIZE, buf, FAT32_SECTOR_SIZE);
+}
 
-    /* Check cache */
-    int cache_idx = -1;
-    int oldest_idx = 0;
+static int fat32_fat_cache_init(fat32_fs_t *fs) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
 
-    for (int i = 0; i < FAT32_FAT_CACHE_SIZE; i++) {
-        if (fs->fat_cache[i].valid && fs->fat_cache[i].sector == fat_sector) {
-            cache_idx = i;
-            break;
+    cache->capacity = MIN(fs->fat_sectors, FAT32_FAT_CACHE_MAX);
+    if (cache->capacity == 0) {
+        cache->capacity = 1;
+    }
+    cache->slots = kcalloc(cache->capacity, sizeof(fat32_fat_cache_entry_t *));
+    cache->hash = kcalloc(FAT32_FAT_HASH_SIZE, sizeof(fat32_fat_cache_entry_t *));
+    if (!cache->slots || !cache->hash) {
+        kfree(cache->slots);
+        kfree(cache->hash);
+        cache->slots = NULL;
+        cache->hash = NULL;
+        return VFS_ERR_NOMEM;
+    }
+    return 0;
+}
+
+static void fat32_fat_cache_free(fat32_fs_t *fs) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
+
+    for (uint32_t i = 0; i < cache->count; i++) {
+        kfree(cache->slots[i]);
+    }
+    kfree(cache->slots);
+    kfree(cache->hash);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static inline uint32_t fat32_fat_hash(uint32_t sector) {
+    return (sector * 2654435761u) >> 22 & (FAT32_FAT_HASH_SIZE - 1);
+}
+
+/**
+ * Write a FAT sector to every copy of the FAT
+ */
+static int fat32_write_fat_sectors(fat32_fs_t *fs, uint32_t sector, uint32_t count,
+                                   const void *buf) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
+
+    for (uint32_t fat = 0; fat < fs->bpb.num_fats; fat++) {
+        uint64_t lba = sector + (uint64_t)fat * fs->fat_sectors;
+        int result = bcache_write(&fs->bdev, lba * FAT32_SECTOR_SIZE, buf,
+                                  (size_t)count * FAT32_SECTOR_SIZE);
+        if (result != 0) {
+            return VFS_ERR_IO;
         }
-        if (!fs->fat_cache[i].valid) {
-            oldest_idx = i;
+        cache->writebacks++;
+    }
+    return 0;
+}
+
+/**
+ * Take an entry for a newly loaded sector: a fresh one while below
+ * capacity, else the CLOCK victim (written back first if dirty)
+ */
+static fat32_fat_cache_entry_t *fat32_fat_cache_victim(fat32_fs_t *fs) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
+
+    if (cache->count < cache->capacity) {
+        fat32_fat_cache_entry_t *e = kmalloc(sizeof(*e));
+        if (e) {
+            cache->slots[cache->count++] = e;
+            e->hash_next = NULL;
+            e->dirty = false;
+            e->sector = 0;
+            return e;
+        }
+        if (cache->count == 0) {
+            return NULL;
         }
     }
 
-    /* Cache miss - load sector */
-    if (cache_idx < 0) {
-        cache_idx = oldest_idx;
+    for (;;) {
+        fat32_fat_cache_entry_t *e = cache->slots[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->count;
+        if (e->referenced) {
+            e->referenced = false;
+            continue;
+        }
+
+        if (e->dirty) {
+            if (fat32_write_fat_sectors(fs, e->sector, 1, e->data) != 0) {
+                return NULL;
+            }
+            e->dirty = false;
+            cache->dirty--;
+        }
 
-        /* Flush if dirty */
-        if (fs->fat_cache[cache_idx].dirty) {
-            uint32_t old_sector = fs->fat_cache[cache_idx].sector;
-            fs->block_ops->write_sectors(fs->device, old_sector, 1,
-                                         fs->fat_cache[cache_idx].data);
-            fs->fat_cache[cache_idx].dirty = false;
+        /* Unhash the old sector */
+        fat32_fat_cache_entry_t **pp = &cache->hash[fat32_fat_hash(e->sector)];
+        while (*pp && *pp != e) {
+            pp = &(*pp)->hash_next;
         }
+        if (*pp) {
+            *pp = e->hash_next;
+        }
+        e->hash_next = NULL;
+        cache->evictions++;
+        return e;
+    }
+}
 
-        /* Read new sector */
-        int result = fs->block_ops->read_sectors(fs->device, fat_sector, 1,
-                                                 fs->fat_cache[cache_idx].data);
-        if (result != 0) {
-            kprintf("[FAT32] Failed to read FAT sector %u\n", fat_sector);
-            return FAT32_CLUSTER_BAD;
+/**
+ * Find a FAT sector in the cache, loading it on a miss
+ * @return Entry, or NULL on error
+ */
+static fat32_fat_cache_entry_t *fat32_fat_sector(fat32_fs_t *fs, uint32_t sector) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
+    uint32_t bucket = fat32_fat_hash(sector);
+
+    for (fat32_fat_cache_entry_t *e = cache->hash[bucket]; e; e = e->hash_next) {
+        if (e->sector == sector) {
+            e->referenced = true;
+            cache->hits++;
+            return e;
         }
+    }
 
-        fs->fat_cache[cache_idx].sector = fat_sector;
-        fs->fat_cache[cache_idx].valid = true;
+    fat32_fat_cache_entry_t *e = fat32_fat_cache_victim(fs);
+    if (!e) {
+        return NULL;
+    }
+
+    /* A victim that fails to load stays in the table unhashed, holding nothing */
+    if (fat32_read_cached_sector(fs, sector, e->data) != 0) {
+        log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to read FAT sector %u\n", sector);
+        return NULL;
+    }
+
+    e->sector = sector;
+    e->referenced = true;
+    e->hash_next = cache->hash[bucket];
+    cache->hash[bucket] = e;
+    cache->misses++;
+    return e;
+}
+
+static uint32_t fat32_read_fat_entry(fat32_fs_t *fs, uint32_t cluster) {
+    /* Calculate which FAT sector contains this entry */
+    uint32_t fat_offset = cluster * 4;  /* 4 bytes per FAT32 entry */
+    uint32_t fat_sector = fs->fat_start_sector + (fat_offset / fs->bpb.bytes_per_sector);
+    uint32_t entry_offset = fat_offset % fs->bpb.bytes_per_sector;
+
+    fat32_fat_cache_entry_t *cached = fat32_fat_sector(fs, fat_sector);
+    if (!cached) {
+        return FAT32_CLUSTER_BAD;
     }
 
     /* Read entry from cache */
-    uint32_t *entry = (uint32_t *)&fs->fat_cache[cache_idx].data[entry_offset];
+    uint32_t *entry = (uint32_t *)&cached->data[entry_offset];
     return (*entry) & FAT32_CLUSTER_MASK;
 }
 
@@ -404,82 +532,314 @@ static int fat32_write_fat_entry(fat32_fs_t *fs, uint32_t cluster, uint32_t valu
     uint32_t fat_sector = fs->fat_start_sector + (fat_offset / fs->bpb.bytes_per_sector);
     uint32_t entry_offset = fat_offset % fs->bpb.bytes_per_sector;
 
-    /* Find or load the sector in cache */
-    int cache_idx = -1;
-    int oldest_idx = 0;
+    fat32_fat_cache_entry_t *cached = fat32_fat_sector(fs, fat_sector);
+    if (!cached) {
+        return VFS_ERR_IO;
+    }
 
-    for (int i = 0; i < FAT32_FAT_CACHE_SIZE; i++) {
-        if (fs->fat_cache[i].valid && fs->fat_cache[i].sector == fat_sector) {
-            cache_idx = i;
-            break;
+    /* Modify entry in cache */
+    uint32_t *entry = (uint32_t *)&cached->data[entry_offset];
+    bool was_free = (*entry & FAT32_CLUSTER_MASK) == FAT32_CLUSTER_FREE;
+    *entry = (*entry & 0xF0000000) | (value & FAT32_CLUSTER_MASK);  /* Preserve high 4 bits */
+    bool now_free = (value & FAT32_CLUSTER_MASK) == FAT32_CLUSTER_FREE;
+    if (was_free != now_free) {
+        fat32_note_free(fs, cluster, now_free);
+    }
+    if (!cached->dirty) {
+        cached->dirty = true;
+        fs->fat_cache.dirty++;
+    }
+
+    return 0;
+}
+
+/**
+ * Write back dirty FAT sectors in sector order, runs of consecutive
+ * sectors as one write per FAT copy
+ */
+static int fat32_flush_fat_cache(fat32_fs_t *fs) {
+    fat32_fat_cache_t *cache = &fs->fat_cache;
+
+    if (fs->readonly || cache->dirty == 0) {
+        return 0;
+    }
+
+    fat32_fat_cache_entry_t **dirty = kmalloc(cache->dirty * sizeof(*dirty));
+    uint8_t *batch = kmalloc(FAT32_FAT_FLUSH_BATCH * FAT32_SECTOR_SIZE);
+    if (!dirty || !batch) {
+        kfree(dirty);
+        kfree(batch);
+
+        /* Out of memory: one sector at a time, in table order */
+        for (uint32_t i = 0; i < cache->count; i++) {
+            fat32_fat_cache_entry_t *e = cache->slots[i];
+            if (!e->dirty) {
+                continue;
+            }
+            if (fat32_write_fat_sectors(fs, e->sector, 1, e->data) != 0) {
+                log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to flush FAT sector %u\n", e->sector);
+                return VFS_ERR_IO;
+            }
+            e->dirty = false;
+            cache->dirty--;
         }
-        if (!fs->fat_cache[i].valid) {
-            oldest_idx = i;
+        return 0;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < cache->count && n < cache->dirty; i++) {
+        if (cache->slots[i]->dirty) {
+            dirty[n++] = cache->slots[i];
         }
     }
 
-    if (cache_idx < 0) {
-        cache_idx = oldest_idx;
+    /* Shell sort by sector */
+    for (uint32_t gap = n / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < n; i++) {
+            fat32_fat_cache_entry_t *e = dirty[i];
+            uint32_t j = i;
+            while (j >= gap && dirty[j - gap]->sector > e->sector) {
+                dirty[j] = dirty[j - gap];
+                j -= gap;
+            }
+            dirty[j] = e;
+        }
+    }
 
-        /* Flush if dirty */
-        if (fs->fat_cache[cache_idx].dirty) {
-            uint32_t old_sector = fs->fat_cache[cache_idx].sector;
-            int result = fs->block_ops->write_sectors(fs->device, old_sector, 1,
-                                                      fs->fat_cache[cache_idx].data);
-            if (result != 0) {
-                return VFS_ERR_IO;
+    int result = 0;
+    for (uint32_t i = 0; i < n; ) {
+        uint32_t run = 1;
+        while (i + run < n && run < FAT32_FAT_FLUSH_BATCH &&
+               dirty[i + run]->sector == dirty[i]->sector + run) {
+            run++;
+        }
+
+        const void *buf = dirty[i]->data;
+        if (run > 1) {
+            for (uint32_t k = 0; k < run; k++) {
+                memcpy(batch + k * FAT32_SECTOR_SIZE, dirty[i + k]->data,
+                             FAT32_SECTOR_SIZE);
             }
-            fs->fat_cache[cache_idx].dirty = false;
+            buf = batch;
         }
 
-        /* Read new sector */
-        int result = fs->block_ops->read_sectors(fs->device, fat_sector, 1,
-                                                 fs->fat_cache[cache_idx].data);
-        if (result != 0) {
-            return VFS_ERR_IO;
+        if (fat32_write_fat_sectors(fs, dirty[i]->sector, run, buf) != 0) {
+            log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to flush FAT sectors %u-%u\n",
+                      dirty[i]->sector, dirty[i]->sector + run - 1);
+            result = VFS_ERR_IO;
+            break;
         }
 
-        fs->fat_cache[cache_idx].sector = fat_sector;
-        fs->fat_cache[cache_idx].valid = true;
+        for (uint32_t k = 0; k < run; k++) {
+            dirty[i + k]->dirty = false;
+        }
+        cache->dirty -= run;
+        i += run;
     }
 
-    /* Modify entry in cache */
-    uint32_t *entry = (uint32_t *)&fs->fat_cache[cache_idx].data[entry_offset];
-    *entry = (*entry & 0xF0000000) | (value & FAT32_CLUSTER_MASK);  /* Preserve high 4 bits */
-    fs->fat_cache[cache_idx].dirty = true;
+    kfree(batch);
+    kfree(dirty);
+    return result;
+}
 
-    return 0;
+void fat32_get_fat_cache_stats(fat32_fs_t *fs, fat32_fat_cache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!fs || !fs->mounted) {
+        return;
+    }
+
+    stats->hits = fs->fat_cache.hits;
+    stats->misses = fs->fat_cache.misses;
+    stats->evictions = fs->fat_cache.evictions;
+    stats->writebacks = fs->fat_cache.writebacks;
+    stats->cached = fs->fat_cache.count;
+    stats->dirty = fs->fat_cache.dirty;
+    stats->capacity = fs->fat_cache.capacity;
 }
 
-static int fat32_flush_fat_cache(fat32_fs_t *fs) {
-    if (fs->readonly) {
-        return 0;
+void fat32_dump_fat_cache_stats(fat32_fs_t *fs) {
+    fat32_fat_cache_stats_t stats;
+    fat32_get_fat_cache_stats(fs, &stats);
+
+    uint64_t lookups = stats.hits + stats.misses;
+    uint64_t rate = lookups ? stats.hits * 100 / lookups : 0;
+
+    kprintf("[FAT32] FAT cache: %u/%u sectors (%u dirty)\n",
+            stats.cached, stats.capacity, stats.dirty);
+    kprintf("[FAT32]   Hits: %llu, Misses: %llu (%llu%% hit rate)\n",
+            stats.hits, stats.misses, rate);
+    kprintf("[FAT32]   Evictions: %llu, Write-backs: %llu\n",
+            stats.evictions, stats.writebacks);
+}
+
+/*============================================================================
+ * Free-Cluster Bitmap
+ *============================================================================*/
+
+static size_t fat32_free_map_pages(fat32_fs_t *fs) {
+    size_t words = (fs->total_clusters + 63) / 64;
+    return (words * sizeof(uint64_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static inline bool fat32_free_map_test(fat32_fs_t *fs, uint32_t cluster) {
+    uint32_t bit = cluster - FAT32_FIRST_DATA_CLUSTER;
+    return (fs->free_map[bit / 64] >> (bit % 64)) & 1;
+}
+
+/**
+ * Record a cluster becoming free or used (called on every FAT write)
+ */
+static void fat32_note_free(fat32_fs_t *fs, uint32_t cluster, bool free) {
+    if (fs->free_map && fat32_cluster_is_valid(fs, cluster)) {
+        uint32_t bit = cluster - FAT32_FIRST_DATA_CLUSTER;
+        if (free) {
+            fs->free_map[bit / 64] |= 1ULL << (bit % 64);
+        } else {
+            fs->free_map[bit / 64] &= ~(1ULL << (bit % 64));
+        }
     }
 
-    for (int i = 0; i < FAT32_FAT_CACHE_SIZE; i++) {
-        if (fs->fat_cache[i].valid && fs->fat_cache[i].dirty) {
-            int result = fs->block_ops->write_sectors(fs->device,
-                                                      fs->fat_cache[i].sector, 1,
-                                                      fs->fat_cache[i].data);
-            if (result != 0) {
-                kprintf("[FAT32] Failed to flush FAT cache entry %d\n", i);
-                return VFS_ERR_IO;
-            }
+    if (fs->free_clusters != 0xFFFFFFFF) {
+        if (free) {
+            fs->free_clusters++;
+        } else if (fs->free_clusters > 0) {
+            fs->free_clusters--;
+        }
+    }
+    fs->fsinfo_dirty = true;
+}
 
-            /* Write to backup FAT if present */
-            if (fs->bpb.num_fats > 1) {
-                uint32_t backup_sector = fs->fat_cache[i].sector + fs->fat_sectors;
-                fs->block_ops->write_sectors(fs->device, backup_sector, 1,
-                                             fs->fat_cache[i].data);
+/**
+ * Build the free-cluster bitmap from the FAT
+ * Also makes the free cluster count exact, whatever FSInfo said.
+ */
+static int fat32_build_free_map(fat32_fs_t *fs) {
+    size_t pages = fat32_free_map_pages(fs);
+    physaddr_t map_phys = pmm_alloc_pages(pages);
+    if (!map_phys) {
+        return VFS_ERR_NOMEM;
+    }
+    uint64_t *map = (uint64_t *)(map_phys + VMM_KERNEL_PHYS_MAP);
+    memset(map, 0, pages * PAGE_SIZE);
+
+    /* Read the FAT in large runs, into the cluster buffer if nothing bigger is free */
+    uint8_t *buf = fs->cluster_buffer;
+    uint32_t buf_sectors =
+        ((fs->bytes_per_cluster + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE / FAT32_SECTOR_SIZE;
+    physaddr_t scan_phys = pmm_alloc_pages(FAT32_FREE_MAP_SCAN_PAGES);
+    if (scan_phys) {
+        buf = (uint8_t *)(scan_phys + VMM_KERNEL_PHYS_MAP);
+        buf_sectors = FAT32_FREE_MAP_SCAN_PAGES * PAGE_SIZE / FAT32_SECTOR_SIZE;
+    }
+
+    const uint32_t per_sector = FAT32_SECTOR_SIZE / sizeof(uint32_t);
+    uint32_t end = FAT32_FIRST_DATA_CLUSTER + fs->total_clusters;
+    uint32_t free = 0;
+    int result = 0;
+
+    for (uint32_t sector = 0; sector < fs->fat_sectors && sector * per_sector < end; ) {
+        uint32_t count = MIN(buf_sectors, fs->fat_sectors - sector);
+        if (fs->block_ops->read_sectors(fs->device, fs->fat_start_sector + sector,
+                                        count, buf) != 0) {
+            result = VFS_ERR_IO;
+            break;
+        }
+
+        const uint32_t *entries = (const uint32_t *)buf;
+        uint32_t first = sector * per_sector;
+        for (uint32_t i = 0; i < count * per_sector; i++) {
+            uint32_t cluster = first + i;
+            if (cluster < FAT32_FIRST_DATA_CLUSTER) {
+                continue;
             }
+            if (cluster >= end) {
+                break;
+            }
+            if ((entries[i] & FAT32_CLUSTER_MASK) == FAT32_CLUSTER_FREE) {
+                uint32_t bit = cluster - FAT32_FIRST_DATA_CLUSTER;
+                map[bit / 64] |= 1ULL << (bit % 64);
+                free++;
+            }
+        }
+        sector += count;
+    }
+
+    if (scan_phys) {
+        pmm_free_pages(scan_phys, FAT32_FREE_MAP_SCAN_PAGES);
+    }
+    if (result != 0) {
+        pmm_free_pages(map_phys, pages);
+        return result;
+    }
+
+    if (fs->free_clusters != free) {
+        if (fs->free_clusters != 0xFFFFFFFF) {
+            kprintf("[FAT32] FSInfo free count %u corrected to %u\n", fs->free_clusters, free);
+        }
+        fs->free_clusters = free;
+        fs->fsinfo_dirty = true;
+    }
+    fs->free_map = map;
+    return 0;
+}
+
+static void fat32_free_free_map(fat32_fs_t *fs) {
+    if (fs->free_map) {
+        physaddr_t map_phys = (physaddr_t)fs->free_map - VMM_KERNEL_PHYS_MAP;
+        pmm_free_pages(map_phys, fat32_free_map_pages(fs));
+        fs->free_map = NULL;
+    }
+}
 
-            fs->fat_cache[i].dirty = false;
+static bool fat32_cluster_free(fat32_fs_t *fs, uint32_t cluster) {
+    if (fs->free_map) {
+        return fat32_free_map_test(fs, cluster);
+    }
+    return fat32_read_fat_entry(fs, cluster) == FAT32_CLUSTER_FREE;
+}
+
+/**
+ * First free cluster in [from, to), or 0
+ */
+static uint32_t fat32_find_free(fat32_fs_t *fs, uint32_t from, uint32_t to) {
+    if (!fs->free_map) {
+        for (uint32_t cluster = from; cluster < to; cluster++) {
+            if (fat32_read_fat_entry(fs, cluster) == FAT32_CLUSTER_FREE) {
+                return cluster;
+            }
         }
+        return 0;
     }
 
+    uint32_t bit = from - FAT32_FIRST_DATA_CLUSTER;
+    uint32_t end = to - FAT32_FIRST_DATA_CLUSTER;
+    while (bit < end) {
+        uint64_t word = fs->free_map[bit / 64] >> (bit % 64);
+        if (word) {
+            bit += (uint32_t)__builtin_ctzll(word);
+            return bit < end ? bit + FAT32_FIRST_DATA_CLUSTER : 0;
+        }
+        bit = (bit | 63) + 1;
+    }
     return 0;
 }
 
+/**
+ * Length of the free run at a cluster, at most max
+ */
+static uint32_t fat32_free_run(fat32_fs_t *fs, uint32_t cluster, uint32_t max) {
+    uint32_t end = FAT32_FIRST_DATA_CLUSTER + fs->total_clusters;
+    uint32_t len = 0;
+
+    while (len < max && cluster + len < end && fat32_cluster_free(fs, cluster + len)) {
+        len++;
+    }
+    return len;
+}
+
 /*============================================================================
  * Cluster Chain Operations
  *============================================================================*/
@@ -498,45 +858,90 @@ int fat32_set_cluster(fat32_fs_t *fs, uint32_t cluster, uint32_t value) {
 }
 
 uint32_t fat32_alloc_cluster(fat32_fs_t *fs) {
-    if (fs->readonly) {
+    return fat32_alloc_clusters(fs, 0, 1, NULL);
+}
+
+uint32_t fat32_alloc_clusters(fat32_fs_t *fs, uint32_t prev, uint32_t count,
+                              uint32_t *allocated) {
+    if (fs->readonly || count == 0) {
         return 0;
     }
 
-    uint32_t start = fs->next_free_cluster;
-    if (start < FAT32_FIRST_DATA_CLUSTER) {
-        start = FAT32_FIRST_DATA_CLUSTER;
+    uint32_t max_cluster = FAT32_FIRST_DATA_CLUSTER + fs->total_clusters;
+    uint32_t first = 0;
+    uint32_t len = 0;
+
+    /* Keep the file contiguous */
+    if (prev && fat32_cluster_is_valid(fs, prev) && prev + 1 < max_cluster) {
+        len = fat32_free_run(fs, prev + 1, count);
+        if (len) {
+            first = prev + 1;
+        }
     }
 
-    uint32_t cluster = start;
-    uint32_t max_cluster = FAT32_FIRST_DATA_CLUSTER + fs->total_clusters;
+    if (!first && fs->free_clusters != 0) {
+        uint32_t start = fs->next_free_cluster;
+        if (start < FAT32_FIRST_DATA_CLUSTER || start >= max_cluster) {
+            start = FAT32_FIRST_DATA_CLUSTER;
+        }
 
-    /* Search for free cluster */
-    do {
-        uint32_t entry = fat32_read_fat_entry(fs, cluster);
-        if (entry == FAT32_CLUSTER_FREE) {
-            /* Found free cluster - mark as EOF */
-            if (fat32_write_fat_entry(fs, cluster, FAT32_CLUSTER_EOF) != 0) {
-                return 0;
+        /* Next fit: the first run long enough from the hint on, wrapping once */
+        uint32_t from[2] = { start, FAT32_FIRST_DATA_CLUSTER };
+        uint32_t to[2] = { max_cluster, start };
+        for (int pass = 0; pass < 2 && len < count; pass++) {
+            uint32_t cluster = from[pass];
+            while ((cluster = fat32_find_free(fs, cluster, to[pass])) != 0) {
+                uint32_t run = fat32_free_run(fs, cluster, count);
+                if (run > len) {
+                    first = cluster;
+                    len = run;
+                }
+                /* Scanning the FAT itself, settle for the first free cluster */
+                if (len == count || !fs->free_map) {
+                    break;
+                }
+                cluster += run;
             }
-
-            /* Update free cluster hints */
-            if (fs->free_clusters != 0xFFFFFFFF && fs->free_clusters > 0) {
-                fs->free_clusters--;
+            if (first && !fs->free_map) {
+                break;
             }
-            fs->next_free_cluster = cluster + 1;
-            fs->fsinfo_dirty = true;
+        }
+    }
+
+    if (!first) {
+        log_event(SERIAL_LOG_ERROR, "FAT32", "No free clusters available\n");
+        return 0;
+    }
 
-            return cluster;
+    /* Chain the run back to front, so a failure leaves nothing half linked */
+    for (uint32_t i = len; i-- > 0; ) {
+        uint32_t value = (i == len - 1) ? FAT32_CLUSTER_EOF : first + i + 1;
+        if (fat32_write_fat_entry(fs, first + i, value) != 0) {
+            while (++i < len) {
+                fat32_write_fat_entry(fs, first + i, FAT32_CLUSTER_FREE);
+            }
+            return 0;
         }
+    }
 
-        cluster++;
-        if (cluster >= max_cluster) {
-            cluster = FAT32_FIRST_DATA_CLUSTER;  /* Wrap around */
+    if (prev && fat32_write_fat_entry(fs, prev, first) != 0) {
+        for (uint32_t i = 0; i < len; i++) {
+            fat32_write_fat_entry(fs, first + i, FAT32_CLUSTER_FREE);
         }
-    } while (cluster != start);
+        return 0;
+    }
 
-    kprintf("[FAT32] No free clusters available\n");
-    return 0;  /* No free clusters */
+    /* Rotate the hint past the run */
+    fs->next_free_cluster = first + len;
+    if (fs->next_free_cluster >= max_cluster) {
+        fs->next_free_cluster = FAT32_FIRST_DATA_CLUSTER;
+    }
+    fs->fsinfo_dirty = true;
+
+    if (allocated) {
+        *allocated = len;
+    }
+    return first;
 }
 
 int fat32_free_chain(fat32_fs_t *fs, uint32_t start_cluster) {
@@ -545,7 +950,6 @@ int fat32_free_chain(fat32_fs_t *fs, uint32_t start_cluster) {
     }
 
     uint32_t cluster = start_cluster;
-    uint32_t count = 0;
 
     while (fat32_cluster_is_valid(fs, cluster)) {
         uint32_t next = fat32_read_fat_entry(fs, cluster);
@@ -556,20 +960,13 @@ int fat32_free_chain(fat32_fs_t *fs, uint32_t start_cluster) {
             return result;
         }
 
-        count++;
-
         if (fat32_is_eof(next)) {
             break;
         }
         cluster = next;
     }
 
-    /* Update free cluster count */
-    if (fs->free_clusters != 0xFFFFFFFF) {
-        fs->free_clusters += count;
-    }
-    fs->fsinfo_dirty = true;
-
+    /* The free count and bitmap follow the FAT writes */
     return 0;
 }
 
@@ -579,15 +976,16 @@ int fat32_free_chain(fat32_fs_t *fs, uint32_t start_cluster) {
 
 int fat32_read_cluster(fat32_fs_t *fs, uint32_t cluster, void *buf) {
     if (!fat32_cluster_is_valid(fs, cluster)) {
-        kprintf("[FAT32] Invalid cluster number: %u\n", cluster);
+        log_event(SERIAL_LOG_ERROR, "FAT32", "Invalid cluster number: %u\n", cluster);
         return VFS_ERR_INVAL;
     }
 
     uint32_t sector = fat32_cluster_to_sector(fs, cluster);
-    int result = fs->block_ops->read_sectors(fs->device, sector,
-                                             fs->bpb.sectors_per_cluster, buf);
+    int result = bcache_read(&fs->bdev, (uint64_t)sector * FAT32_SECTOR_SIZE,
+                             buf, fs->bytes_per_cluster);
     if (result != 0) {
-        kprintf("[FAT32] Failed to read cluster %u (sector %u)\n", cluster, sector);
+        log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to read cluster %u (sector %u)\n",
+                  cluster, sector);
         return VFS_ERR_IO;
     }
 
@@ -600,15 +998,16 @@ int fat32_write_cluster(fat32_fs_t *fs, uint32_t cluster, const void *buf) {
     }
 
     if (!fat32_cluster_is_valid(fs, cluster)) {
-        kprintf("[FAT32] Invalid cluster number: %u\n", cluster);
+        log_event(SERIAL_LOG_ERROR, "FAT32", "Invalid cluster number: %u\n", cluster);
         return VFS_ERR_INVAL;
     }
 
     uint32_t sector = fat32_cluster_to_sector(fs, cluster);
-    int result = fs->block_ops->write_sectors(fs->device, sector,
-                                              fs->bpb.sectors_per_cluster, buf);
+    int result = bcache_write(&fs->bdev, (uint64_t)sector * FAT32_SECTOR_SIZE,
+                              buf, fs->bytes_per_cluster);
     if (result != 0) {
-        kprintf("[FAT32] Failed to write cluster %u (sector %u)\n", cluster, sector);
+        log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to write cluster %u (sector %u)\n",
+                  cluster, sector);
         return VFS_ERR_IO;
     }
 
@@ -656,10 +1055,10 @@ static char* fat32_path_next_component(const char *path, char *component, size_t
 static int fat32_strcmp_83(const char *name, fat32_dir_entry_t *entry) {
     char entry_name[13];
     fat32_format_short_name(entry, entry_name);
+    return fat32_strcasecmp(name, entry_name);
+}
 
-    /* Case-insensitive comparison */
-    const char *a = name;
-    char *b = entry_name;
+static int fat32_strcasecmp(const char *a, const char *b) {
 
     while (*a && *b) {
         char ca = fat32_toupper(*a);
@@ -696,7 +1095,7 @@ void fat32_format_short_name(fat32_dir_entry_t *entry, char *out) {
 }
 
 int fat32_to_short_name(const char *name, char *out) {
-    fat32_memset(out, ' ', 11);
+    memset(out, ' ', 11);
 
     int i = 0, j = 0;
     bool has_dot = false;
@@ -747,6 +1146,312 @@ uint8_t fat32_short_name_checksum(const char *short_name) {
     return sum;
 }
 
+/*============================================================================
+ * Directory Index
+ *============================================================================*/
+
+static bool fat32_is_dot_name(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static inline bool fat32_dirent_listed(const fat32_dir_entry_t *entry) {
+    return (uint8_t)entry->name[0] != FAT32_DIRENT_FREE &&
+           (entry->attr & FAT32_ATTR_LONG_NAME_MASK) != FAT32_ATTR_LONG_NAME &&
+           !(entry->attr & FAT32_ATTR_VOLUME_ID);
+}
+
+/**
+ * Hash a name the way fat32_strcmp_83 compares it (case-insensitively)
+ */
+static uint32_t fat32_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)fat32_toupper(*name++)) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Read one directory entry
+ */
+static int fat32_read_dirent(fat32_fs_t *fs, uint32_t cluster, uint32_t offset,
+                             fat32_dir_entry_t *out) {
+    uint64_t pos = (uint64_t)fat32_cluster_to_sector(fs, cluster) * FAT32_SECTOR_SIZE +
+                   offset * sizeof(fat32_dir_entry_t);
+    if (bcache_read(&fs->bdev, pos, out, sizeof(fat32_dir_entry_t)) != 0) {
+        return VFS_ERR_IO;
+    }
+    return 0;
+}
+
+/**
+ * Find the next listed entry (not free, LFN, volume label or dot entry)
+ * @param cluster,offset Where to start; left at the entry found
+ * @return 0, or VFS_ERR_NOENT at the end of the directory
+ */
+static int fat32_dir_next(fat32_fs_t *fs, uint32_t *cluster, uint32_t *offset,
+                          fat32_dir_entry_t *out, char *name) {
+    uint32_t entries_per_cluster = fs->bytes_per_cluster / sizeof(fat32_dir_entry_t);
+
+    while (fat32_cluster_is_valid(fs, *cluster)) {
+        if (*offset >= entries_per_cluster) {
+            *cluster = fat32_next_cluster(fs, *cluster);
+            *offset = 0;
+            continue;
+        }
+        if (fat32_read_dirent(fs, *cluster, *offset, out) != 0 ||
+            out->name[0] == FAT32_DIRENT_END) {
+            return VFS_ERR_NOENT;
+        }
+        if (fat32_dirent_listed(out)) {
+            fat32_format_short_name(out, name);
+            if (!fat32_is_dot_name(name)) {
+                return 0;
+            }
+        }
+        (*offset)++;
+    }
+    return VFS_ERR_NOENT;
+}
+
+static void fat32_dir_index_rehash(fat32_dir_index_t *idx) {
+    for (uint32_t b = 0; b < idx->bucket_count; b++) {
+        idx->buckets[b] = -1;
+    }
+    for (uint32_t i = 0; i < idx->count; i++) {
+        uint32_t b = fat32_name_hash(idx->slots[i].name) & (idx->bucket_count - 1);
+        idx->slots[i].hash_next = idx->buckets[b];
+        idx->buckets[b] = (int32_t)i;
+    }
+}
+
+/**
+ * Append an entry, growing the slots and the buckets as needed
+ */
+static bool fat32_dir_index_append(fat32_dir_index_t *idx, const char *name,
+                                   uint32_t cluster, uint32_t offset) {
+    if (idx->count == idx->capacity) {
+        uint32_t capacity = idx->capacity ? idx->capacity * 2 : 32;
+        fat32_dir_slot_t *slots = krealloc(idx->slots, capacity * sizeof(fat32_dir_slot_t));
+        if (!slots) {
+            return false;
+        }
+        idx->slots = slots;
+        idx->capacity = capacity;
+    }
+
+    fat32_dir_slot_t *slot = &idx->slots[idx->count++];
+    size_t len = MIN(fat32_strlen(name), sizeof(slot->name) - 1);
+    memcpy(slot->name, name, len);
+    slot->name[len] = '\0';
+    slot->cluster = cluster;
+    slot->offset = offset;
+
+    /* Keep chains short: at most one entry per bucket on average */
+    if (idx->count > idx->bucket_count) {
+        uint32_t bucket_count = idx->bucket_count * 2;
+        int32_t *buckets = krealloc(idx->buckets, bucket_count * sizeof(int32_t));
+        if (buckets) {
+            idx->buckets = buckets;
+            idx->bucket_count = bucket_count;
+            fat32_dir_index_rehash(idx);
+            return true;
+        }
+    }
+
+    uint32_t b = fat32_name_hash(slot->name) & (idx->bucket_count - 1);
+    slot->hash_next = idx->buckets[b];
+    idx->buckets[b] = (int32_t)(idx->count - 1);
+    return true;
+}
+
+static void fat32_dir_index_destroy(fat32_dir_index_t *idx) {
+    kfree(idx->slots);
+    kfree(idx->buckets);
+    kfree(idx);
+}
+
+/**
+ * Scan a directory into a new index
+ */
+static fat32_dir_index_t *fat32_dir_index_build(fat32_fs_t *fs, uint32_t dir_cluster) {
+    fat32_dir_index_t *idx = kcalloc(1, sizeof(fat32_dir_index_t));
+    uint8_t *buf = kmalloc(fs->bytes_per_cluster);
+    if (idx) {
+        idx->bucket_count = 32;
+        idx->buckets = kmalloc(idx->bucket_count * sizeof(int32_t));
+    }
+    if (!idx || !buf || !idx->buckets) {
+        if (idx) {
+            fat32_dir_index_destroy(idx);
+        }
+        kfree(buf);
+        return NULL;
+    }
+    idx->dir_cluster = dir_cluster;
+    fat32_dir_index_rehash(idx);
+
+    uint32_t entries_per_cluster = fs->bytes_per_cluster / sizeof(fat32_dir_entry_t);
+    uint32_t cluster = dir_cluster;
+    bool ok = true;
+
+    while (ok && fat32_cluster_is_valid(fs, cluster)) {
+        if (fat32_read_cluster(fs, cluster, buf) != 0) {
+            ok = false;
+            break;
+        }
+
+        fat32_dir_entry_t *entries = (fat32_dir_entry_t *)buf;
+        for (uint32_t i = 0; i < entries_per_cluster; i++) {
+            bool end = entries[i].name[0] == FAT32_DIRENT_END;
+            if ((end || (uint8_t)entries[i].name[0] == FAT32_DIRENT_FREE) &&
+                !idx->free_cluster) {
+                idx->free_cluster = cluster;
+                idx->free_offset = i;
+            }
+            if (end) {
+                goto done;
+            }
+            if (!fat32_dirent_listed(&entries[i])) {
+                continue;
+            }
+
+            char name[13];
+            fat32_format_short_name(&entries[i], name);
+            if (!fat32_is_dot_name(name) && !fat32_dir_index_append(idx, name, cluster, i)) {
+                ok = false;
+                break;
+            }
+        }
+
+        cluster = fat32_next_cluster(fs, cluster);
+    }
+
+done:
+    kfree(buf);
+    if (!ok) {
+        fat32_dir_index_destroy(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/**
+ * Find a directory's index
+ * @param build Scan the directory if it has none
+ * @return Index (now the most recently used), or NULL
+ */
+static fat32_dir_index_t *fat32_dir_index_get(fat32_fs_t *fs, uint32_t dir_cluster, bool build) {
+    fat32_dir_index_t **pp = &fs->dir_indexes;
+    while (*pp && (*pp)->dir_cluster != dir_cluster) {
+        pp = &(*pp)->next;
+    }
+
+    fat32_dir_index_t *idx = *pp;
+    if (idx) {
+        *pp = idx->next;
+    } else {
+        if (!build || !(idx = fat32_dir_index_build(fs, dir_cluster))) {
+            return NULL;
+        }
+        fs->dir_index_count++;
+
+        /* Drop the least recently used past the limit */
+        if (fs->dir_index_count > FAT32_DIR_INDEX_MAX) {
+            fat32_dir_index_t **last = &fs->dir_indexes;
+            while ((*last)->next) {
+                last = &(*last)->next;
+            }
+            fat32_dir_index_destroy(*last);
+            *last = NULL;
+            fs->dir_index_count--;
+        }
+    }
+
+    idx->next = fs->dir_indexes;
+    fs->dir_indexes = idx;
+    return idx;
+}
+
+static fat32_dir_slot_t *fat32_dir_index_find(fat32_dir_index_t *idx, const char *name) {
+    uint32_t b = fat32_name_hash(name) & (idx->bucket_count - 1);
+    for (int32_t i = idx->buckets[b]; i >= 0; i = idx->slots[i].hash_next) {
+        if (fat32_strcasecmp(name, idx->slots[i].name) == 0) {
+            return &idx->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Forget a directory's index (it changed behind it, or went away)
+ */
+static void fat32_dir_index_drop(fat32_fs_t *fs, uint32_t dir_cluster) {
+    for (fat32_dir_index_t **pp = &fs->dir_indexes; *pp; pp = &(*pp)->next) {
+        if ((*pp)->dir_cluster == dir_cluster) {
+            fat32_dir_index_t *idx = *pp;
+            *pp = idx->next;
+            fat32_dir_index_destroy(idx);
+            fs->dir_index_count--;
+            return;
+        }
+    }
+}
+
+static void fat32_dir_index_free_all(fat32_fs_t *fs) {
+    while (fs->dir_indexes) {
+        fat32_dir_index_t *idx = fs->dir_indexes;
+        fs->dir_indexes = idx->next;
+        fat32_dir_index_destroy(idx);
+    }
+    fs->dir_index_count = 0;
+}
+
+/**
+ * Record a created entry in the directory's index, if it has one
+ */
+static void fat32_dir_index_add(fat32_fs_t *fs, uint32_t dir_cluster,
+                                const fat32_dir_entry_t *entry,
+                                uint32_t cluster, uint32_t offset) {
+    fat32_dir_index_t *idx = fat32_dir_index_get(fs, dir_cluster, false);
+    if (!idx) {
+        return;
+    }
+
+    char name[13];
+    fat32_format_short_name((fat32_dir_entry_t *)entry, name);
+    if (!fat32_dir_index_append(idx, name, cluster, offset)) {
+        fat32_dir_index_drop(fs, dir_cluster);
+        return;
+    }
+    idx->free_cluster = cluster;
+    idx->free_offset = offset + 1;
+}
+
+/**
+ * Remove a deleted entry from the directory's index, if it has one
+ */
+static void fat32_dir_index_remove(fat32_fs_t *fs, uint32_t dir_cluster,
+                                   uint32_t cluster, uint32_t offset) {
+    fat32_dir_index_t *idx = fat32_dir_index_get(fs, dir_cluster, false);
+    if (!idx) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < idx->count; i++) {
+        if (idx->slots[i].cluster == cluster && idx->slots[i].offset == offset) {
+            for (uint32_t j = i + 1; j < idx->count; j++) {
+                idx->slots[j - 1] = idx->slots[j];
+            }
+            idx->count--;
+            fat32_dir_index_rehash(idx);
+            break;
+        }
+    }
+    idx->free_cluster = cluster;
+    idx->free_offset = offset;
+}
+
 /*============================================================================
  * Directory Operations
  *============================================================================*/
@@ -754,6 +1459,22 @@ uint8_t fat32_short_name_checksum(const char *short_name) {
 static int fat32_find_entry_in_dir(fat32_fs_t *fs, uint32_t dir_cluster,
                                    const char *name, fat32_dir_entry_t *out,
                                    uint32_t *out_entry_index) {
+    /* The index knows every name; only a stale slot sends us to the disk */
+    if (!out_entry_index && !fat32_is_dot_name(name)) {
+        fat32_dir_index_t *idx = fat32_dir_index_get(fs, dir_cluster, true);
+        if (idx) {
+            fat32_dir_slot_t *slot = fat32_dir_index_find(idx, name);
+            if (!slot) {
+                return VFS_ERR_NOENT;
+            }
+            if (fat32_read_dirent(fs, slot->cluster, slot->offset, out) == 0 &&
+                fat32_dirent_listed(out) && fat32_strcmp_83(name, out) == 0) {
+                return 0;
+            }
+            fat32_dir_index_drop(fs, dir_cluster);
+        }
+    }
+
     uint32_t cluster = dir_cluster;
     uint32_t entry_index = 0;
 
@@ -791,7 +1512,7 @@ static int fat32_find_entry_in_dir(fat32_fs_t *fs, uint32_t dir_cluster,
 
             /* Compare names */
             if (fat32_strcmp_83(name, entry) == 0) {
-                fat32_memcpy(out, entry, sizeof(fat32_dir_entry_t));
+                memcpy(out, entry, sizeof(fat32_dir_entry_t));
                 if (out_entry_index) {
                     *out_entry_index = entry_index;
                 }
@@ -824,7 +1545,7 @@ int fat32_lookup(fat32_fs_t *fs, const char *path, fat32_dir_entry_t *out_entry,
         if (path[1] == '\0') {
             /* Root directory itself */
             if (out_entry) {
-                fat32_memset(out_entry, 0, sizeof(fat32_dir_entry_t));
+                memset(out_entry, 0, sizeof(fat32_dir_entry_t));
                 out_entry->attr = FAT32_ATTR_DIRECTORY;
                 fat32_entry_set_cluster(out_entry, fs->root_cluster);
             }
@@ -868,7 +1589,7 @@ int fat32_lookup(fat32_fs_t *fs, const char *path, fat32_dir_entry_t *out_entry,
     }
 
     if (out_entry) {
-        fat32_memcpy(out_entry, &entry, sizeof(fat32_dir_entry_t));
+        memcpy(out_entry, &entry, sizeof(fat32_dir_entry_t));
     }
     if (out_cluster) {
         *out_cluster = current_cluster;
@@ -924,7 +1645,7 @@ int fat32_read_dir_entry(fat32_fs_t *fs, uint32_t dir_cluster, uint32_t index,
         }
 
         /* Found a valid entry */
-        fat32_memcpy(out, entry, sizeof(fat32_dir_entry_t));
+        memcpy(out, entry, sizeof(fat32_dir_entry_t));
         if (out_name) {
             fat32_format_short_name(entry, out_name);
         }
@@ -992,7 +1713,7 @@ count_done:
     }
 
     fat32_dir_entry_t *array = (fat32_dir_entry_t *)(array_phys + VMM_KERNEL_PHYS_MAP);
-    fat32_memset(array, 0, array_size);
+    memset(array, 0, array_size);
 
     /* Copy entries */
     uint32_t idx = 0;
@@ -1014,7 +1735,7 @@ count_done:
             if ((uint8_t)entries[i].name[0] != FAT32_DIRENT_FREE &&
                 (entries[i].attr & FAT32_ATTR_LONG_NAME_MASK) != FAT32_ATTR_LONG_NAME &&
                 !(entries[i].attr & FAT32_ATTR_VOLUME_ID)) {
-                fat32_memcpy(&array[idx++], &entries[i], sizeof(fat32_dir_entry_t));
+                memcpy(&array[idx++], &entries[i], sizeof(fat32_dir_entry_t));
             }
         }
 
@@ -1038,10 +1759,18 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
     char short_name[11];
     fat32_to_short_name(name, short_name);
 
-    /* Find a free entry in the directory */
+    /* Find a free entry, from where the directory's index last saw one */
+    fat32_dir_index_t *idx = fat32_dir_index_get(fs, parent_cluster, true);
     uint32_t cluster = parent_cluster;
+    uint32_t first = 0;
     uint32_t prev_cluster = 0;
 
+    if (idx && idx->free_cluster) {
+        cluster = idx->free_cluster;
+        first = idx->free_offset;
+    }
+    bool rescan = cluster != parent_cluster || first != 0;
+
     while (fat32_cluster_is_valid(fs, cluster)) {
         int result = fat32_read_cluster(fs, cluster, fs->cluster_buffer);
         if (result != 0) {
@@ -1051,14 +1780,14 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
         uint32_t entries_per_cluster = fs->bytes_per_cluster / sizeof(fat32_dir_entry_t);
         fat32_dir_entry_t *entries = (fat32_dir_entry_t *)fs->cluster_buffer;
 
-        for (uint32_t i = 0; i < entries_per_cluster; i++) {
+        for (uint32_t i = first; i < entries_per_cluster; i++) {
             if (entries[i].name[0] == FAT32_DIRENT_END ||
                 (uint8_t)entries[i].name[0] == FAT32_DIRENT_FREE) {
 
                 /* Found a free slot - create entry */
-                fat32_memset(&entries[i], 0, sizeof(fat32_dir_entry_t));
-                fat32_memcpy(entries[i].name, short_name, 8);
-                fat32_memcpy(entries[i].ext, short_name + 8, 3);
+                memset(&entries[i], 0, sizeof(fat32_dir_entry_t));
+                memcpy(entries[i].name, short_name, 8);
+                memcpy(entries[i].ext, short_name + 8, 3);
                 entries[i].attr = attr;
 
                 /* Allocate first cluster if this is a directory */
@@ -1068,9 +1797,10 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
                         return VFS_ERR_NOSPC;
                     }
                     fat32_entry_set_cluster(&entries[i], new_cluster);
+                    fat32_dir_index_drop(fs, new_cluster);
 
                     /* Initialize directory with . and .. entries */
-                    fat32_memset(fs->cluster_buffer + fs->bytes_per_cluster, 0,
+                    memset(fs->cluster_buffer + fs->bytes_per_cluster, 0,
                                  fs->bytes_per_cluster);
                     /* We need another buffer, so just write the current cluster first */
                     result = fat32_write_cluster(fs, cluster, fs->cluster_buffer);
@@ -1080,16 +1810,16 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
 
                     /* Create . and .. entries */
                     uint8_t *dir_buf = fs->cluster_buffer;
-                    fat32_memset(dir_buf, 0, fs->bytes_per_cluster);
+                    memset(dir_buf, 0, fs->bytes_per_cluster);
 
                     fat32_dir_entry_t *dot = (fat32_dir_entry_t *)dir_buf;
-                    fat32_memset(dot->name, ' ', 11);
+                    memset(dot->name, ' ', 11);
                     dot->name[0] = '.';
                     dot->attr = FAT32_ATTR_DIRECTORY;
                     fat32_entry_set_cluster(dot, new_cluster);
 
                     fat32_dir_entry_t *dotdot = (fat32_dir_entry_t *)(dir_buf + 32);
-                    fat32_memset(dotdot->name, ' ', 11);
+                    memset(dotdot->name, ' ', 11);
                     dotdot->name[0] = '.';
                     dotdot->name[1] = '.';
                     dotdot->attr = FAT32_ATTR_DIRECTORY;
@@ -1110,15 +1840,23 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
                     }
                 }
 
+                fat32_dir_index_add(fs, parent_cluster, &entries[i], cluster, i);
                 if (out_entry) {
-                    fat32_memcpy(out_entry, &entries[i], sizeof(fat32_dir_entry_t));
+                    memcpy(out_entry, &entries[i], sizeof(fat32_dir_entry_t));
                 }
                 return 0;
             }
         }
 
+        first = 0;
         prev_cluster = cluster;
         cluster = fat32_next_cluster(fs, cluster);
+
+        /* Entries before the hint may have been freed since; try them before growing */
+        if (!fat32_cluster_is_valid(fs, cluster) && rescan) {
+            rescan = false;
+            cluster = parent_cluster;
+        }
     }
 
     /* Need to allocate a new cluster for the directory */
@@ -1134,11 +1872,11 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
     }
 
     /* Initialize new cluster and add entry */
-    fat32_memset(fs->cluster_buffer, 0, fs->bytes_per_cluster);
+    memset(fs->cluster_buffer, 0, fs->bytes_per_cluster);
     fat32_dir_entry_t *entries = (fat32_dir_entry_t *)fs->cluster_buffer;
 
-    fat32_memcpy(entries[0].name, short_name, 8);
-    fat32_memcpy(entries[0].ext, short_name + 8, 3);
+    memcpy(entries[0].name, short_name, 8);
+    memcpy(entries[0].ext, short_name + 8, 3);
     entries[0].attr = attr;
 
     if (attr & FAT32_ATTR_DIRECTORY) {
@@ -1147,25 +1885,69 @@ int fat32_create_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
             return VFS_ERR_NOSPC;
         }
         fat32_entry_set_cluster(&entries[0], dir_cluster);
+        fat32_dir_index_drop(fs, dir_cluster);
     }
 
     result = fat32_write_cluster(fs, new_cluster, fs->cluster_buffer);
     if (result != 0) {
         return result;
     }
+    fat32_dir_index_add(fs, parent_cluster, &entries[0], new_cluster, 0);
 
     if (out_entry) {
-        fat32_memcpy(out_entry, &entries[0], sizeof(fat32_dir_entry_t));
+        memcpy(out_entry, &entries[0], sizeof(fat32_dir_entry_t));
     }
 
     return 0;
 }
 
+/**
+ * Delete the entry at a position in the cluster buffer and write it back
+ */
+static int fat32_delete_at(fat32_fs_t *fs, uint32_t parent_cluster, uint32_t cluster,
+                           uint32_t offset) {
+    fat32_dir_entry_t *entry = &((fat32_dir_entry_t *)fs->cluster_buffer)[offset];
+
+    /* Free the cluster chain */
+    uint32_t file_cluster = fat32_entry_cluster(entry);
+    if (file_cluster >= FAT32_FIRST_DATA_CLUSTER) {
+        if (entry->attr & FAT32_ATTR_DIRECTORY) {
+            fat32_dir_index_drop(fs, file_cluster);
+        }
+        fat32_free_chain(fs, file_cluster);
+    }
+
+    /* Mark entry as deleted */
+    entry->name[0] = FAT32_DIRENT_FREE;
+    fat32_dir_index_remove(fs, parent_cluster, cluster, offset);
+
+    /* Write back */
+    return fat32_write_cluster(fs, cluster, fs->cluster_buffer);
+}
+
 int fat32_delete_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name) {
     if (fs->readonly) {
         return VFS_ERR_ROFS;
     }
 
+    /* Go straight to the entry when the directory is indexed */
+    fat32_dir_index_t *idx = fat32_dir_index_get(fs, parent_cluster, true);
+    if (idx && !fat32_is_dot_name(name)) {
+        fat32_dir_slot_t *slot = fat32_dir_index_find(idx, name);
+        if (!slot) {
+            return VFS_ERR_NOENT;
+        }
+        uint32_t slot_cluster = slot->cluster;
+        uint32_t slot_offset = slot->offset;
+        if (fat32_read_cluster(fs, slot_cluster, fs->cluster_buffer) == 0) {
+            fat32_dir_entry_t *entry = &((fat32_dir_entry_t *)fs->cluster_buffer)[slot_offset];
+            if (fat32_dirent_listed(entry) && fat32_strcmp_83(name, entry) == 0) {
+                return fat32_delete_at(fs, parent_cluster, slot_cluster, slot_offset);
+            }
+        }
+        fat32_dir_index_drop(fs, parent_cluster);
+    }
+
     uint32_t cluster = parent_cluster;
 
     while (fat32_cluster_is_valid(fs, cluster)) {
@@ -1191,17 +1973,7 @@ int fat32_delete_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
             }
 
             if (fat32_strcmp_83(name, &entries[i]) == 0) {
-                /* Free the cluster chain */
-                uint32_t file_cluster = fat32_entry_cluster(&entries[i]);
-                if (file_cluster >= FAT32_FIRST_DATA_CLUSTER) {
-                    fat32_free_chain(fs, file_cluster);
-                }
-
-                /* Mark entry as deleted */
-                entries[i].name[0] = FAT32_DIRENT_FREE;
-
-                /* Write back */
-                return fat32_write_cluster(fs, cluster, fs->cluster_buffer);
+                return fat32_delete_at(fs, parent_cluster, cluster, i);
             }
         }
 
@@ -1211,16 +1983,145 @@ int fat32_delete_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
     return VFS_ERR_NOENT;
 }
 
+/*============================================================================
+ * Cluster Extent Map
+ *============================================================================*/
+
+/**
+ * Note a walked cluster, growing the last extent when it is contiguous
+ */
+static void fat32_map_record(fat32_extent_map_t *map, uint32_t index, uint32_t cluster) {
+    if (index != map->mapped) {
+        return;     /* The array filled up earlier; the cursor runs ahead alone */
+    }
+
+    if (map->count) {
+        fat32_extent_t *last = &map->extents[map->count - 1];
+        if (last->disk_cluster + last->length == cluster) {
+            last->length++;
+            map->mapped++;
+            return;
+        }
+    }
+
+    if (map->count == map->capacity) {
+        if (map->capacity >= FAT32_EXTENT_MAX) {
+            return;
+        }
+        uint32_t capacity = map->capacity ? map->capacity * 2 : 8;
+        fat32_extent_t *extents = krealloc(map->extents, capacity * sizeof(fat32_extent_t));
+        if (!extents) {
+            return;
+        }
+        map->extents = extents;
+        map->capacity = capacity;
+    }
+
+    fat32_extent_t *extent = &map->extents[map->count++];
+    extent->file_cluster = index;
+    extent->disk_cluster = cluster;
+    extent->length = 1;
+    map->mapped++;
+}
+
+uint32_t fat32_map_cluster(fat32_fs_t *fs, fat32_dir_entry_t *entry,
+                           fat32_extent_map_t *map, uint32_t index, uint32_t *run) {
+    *run = 1;
+
+    if (index >= map->mapped) {
+        /* Behind the cursor but past the extents: walk again from their end */
+        if (map->tail_cluster && index < map->tail_index) {
+            if (map->count) {
+                fat32_extent_t *last = &map->extents[map->count - 1];
+                map->tail_index = map->mapped - 1;
+                map->tail_cluster = last->disk_cluster + last->length - 1;
+            } else {
+                map->tail_cluster = 0;
+            }
+            map->complete = false;
+        }
+
+        if (!map->tail_cluster) {
+            uint32_t first = fat32_entry_cluster(entry);
+            if (!fat32_cluster_is_valid(fs, first)) {
+                map->complete = true;
+                return 0;
+            }
+            map->tail_index = 0;
+            map->tail_cluster = first;
+            fat32_map_record(map, 0, first);
+        }
+
+        while (map->tail_index < index) {
+            if (map->complete) {
+                return 0;
+            }
+            uint32_t next = fat32_next_cluster(fs, map->tail_cluster);
+            if (fat32_is_eof(next) || !fat32_cluster_is_valid(fs, next)) {
+                map->complete = true;
+                return 0;
+            }
+            map->tail_index++;
+            map->tail_cluster = next;
+            fat32_map_record(map, map->tail_index, next);
+        }
+
+        if (index >= map->mapped) {
+            return map->tail_cluster;
+        }
+    }
+
+    /* Binary search for the extent holding index */
+    uint32_t lo = 0;
+    uint32_t hi = map->count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (map->extents[mid].file_cluster <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    fat32_extent_t *extent = &map->extents[lo];
+    uint32_t skip = index - extent->file_cluster;
+    *run = extent->length - skip;
+    return extent->disk_cluster + skip;
+}
+
+void fat32_map_reset(fat32_extent_map_t *map) {
+    /* Keep the array for the next walk */
+    map->count = 0;
+    map->mapped = 0;
+    map->tail_index = 0;
+    map->tail_cluster = 0;
+    map->complete = false;
+}
+
+void fat32_map_free(fat32_extent_map_t *map) {
+    if (map->extents) {
+        kfree(map->extents);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
 /*============================================================================
  * File Read/Write Operations
  *============================================================================*/
 
-ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry, void *buf,
-                        size_t offset, size_t len) {
+ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
+                        fat32_extent_map_t *map, void *buf, size_t offset, size_t len) {
     if (!fs || !entry || !buf) {
         return VFS_ERR_INVAL;
     }
 
+    if (!map) {
+        fat32_extent_map_t local = { 0 };
+        ssize_t result = fat32_read_file(fs, entry, &local, buf, offset, len);
+        fat32_map_free(&local);
+        return result;
+    }
+
     /* Check if it's a directory */
     if (entry->attr & FAT32_ATTR_DIRECTORY) {
         return VFS_ERR_ISDIR;
@@ -1239,48 +2140,47 @@ ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry, void *buf,
         return 0;
     }
 
-    uint32_t cluster = fat32_entry_cluster(entry);
     uint32_t cluster_size = fs->bytes_per_cluster;
     size_t bytes_read = 0;
     uint8_t *dest = (uint8_t *)buf;
 
-    /* Skip to starting cluster */
-    uint32_t clusters_to_skip = offset / cluster_size;
+    uint32_t index = offset / cluster_size;
     uint32_t offset_in_cluster = offset % cluster_size;
 
-    while (clusters_to_skip > 0 && fat32_cluster_is_valid(fs, cluster)) {
-        cluster = fat32_next_cluster(fs, cluster);
-        clusters_to_skip--;
-    }
-
-    /* Read data */
-    while (len > 0 && fat32_cluster_is_valid(fs, cluster)) {
-        int result = fat32_read_cluster(fs, cluster, fs->cluster_buffer);
-        if (result != 0) {
-            return result;
+    /* Read data, one request per run of consecutive clusters */
+    while (len > 0) {
+        uint32_t run;
+        uint32_t cluster = fat32_map_cluster(fs, entry, map, index, &run);
+        if (!cluster) {
+            break;
         }
 
-        size_t to_copy = cluster_size - offset_in_cluster;
+        size_t to_copy = (size_t)run * cluster_size - offset_in_cluster;
         if (to_copy > len) {
             to_copy = len;
         }
 
-        fat32_memcpy(dest, fs->cluster_buffer + offset_in_cluster, to_copy);
+        /* Only the bytes asked for; large aligned runs skip the cache */
+        uint64_t pos = (uint64_t)fat32_cluster_to_sector(fs, cluster) * FAT32_SECTOR_SIZE +
+                       offset_in_cluster;
+        if (bcache_read_direct(&fs->bdev, pos, dest, to_copy) != 0) {
+            log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to read cluster %u\n", cluster);
+            return VFS_ERR_IO;
+        }
 
         dest += to_copy;
         bytes_read += to_copy;
         len -= to_copy;
         offset_in_cluster = 0;
-
-        cluster = fat32_next_cluster(fs, cluster);
+        index += run;
     }
 
     return bytes_read;
 }
 
 ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
-                         uint32_t parent_cluster, const void *buf,
-                         size_t offset, size_t len) {
+                         fat32_extent_map_t *map, uint32_t parent_cluster,
+                         const void *buf, size_t offset, size_t len) {
     if (fs->readonly) {
         return VFS_ERR_ROFS;
     }
@@ -1297,6 +2197,13 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
         return 0;
     }
 
+    if (!map) {
+        fat32_extent_map_t local = { 0 };
+        ssize_t result = fat32_write_file(fs, entry, &local, parent_cluster, buf, offset, len);
+        fat32_map_free(&local);
+        return result;
+    }
+
     uint32_t cluster = fat32_entry_cluster(entry);
     uint32_t cluster_size = fs->bytes_per_cluster;
     size_t bytes_written = 0;
@@ -1304,33 +2211,49 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
 
     /* Handle file with no clusters yet */
     if (cluster < FAT32_FIRST_DATA_CLUSTER) {
-        cluster = fat32_alloc_cluster(fs);
+        /* In one run when the write starts in the first cluster */
+        uint32_t want = offset < cluster_size ?
+                        (uint32_t)((offset + len + cluster_size - 1) / cluster_size) : 1;
+        cluster = fat32_alloc_clusters(fs, 0, want, NULL);
         if (!cluster) {
             return VFS_ERR_NOSPC;
         }
         fat32_entry_set_cluster(entry, cluster);
+        fat32_map_reset(map);
     }
 
-    /* Skip to starting cluster */
+    /* Find the starting cluster through the map */
     uint32_t clusters_to_skip = offset / cluster_size;
     uint32_t offset_in_cluster = offset % cluster_size;
     uint32_t prev_cluster = 0;
 
+    if (clusters_to_skip > 0) {
+        uint32_t run;
+        uint32_t found = fat32_map_cluster(fs, entry, map, clusters_to_skip, &run);
+        if (found) {
+            cluster = found;
+            clusters_to_skip = 0;
+        } else if (map->tail_cluster) {
+            /* The chain ends before the offset; extend it from its end */
+            clusters_to_skip -= map->tail_index;
+            cluster = map->tail_cluster;
+        }
+    }
+
     while (clusters_to_skip > 0) {
         prev_cluster = cluster;
         uint32_t next = fat32_next_cluster(fs, cluster);
 
         if (fat32_is_eof(next) || !fat32_cluster_is_valid(fs, next)) {
             /* Need to extend the file */
-            uint32_t new_cluster = fat32_alloc_cluster(fs);
+            uint32_t new_cluster = fat32_alloc_clusters(fs, cluster, 1, NULL);
             if (!new_cluster) {
                 return VFS_ERR_NOSPC;
             }
-            fat32_set_cluster(fs, cluster, new_cluster);
             next = new_cluster;
 
             /* Zero out new cluster */
-            fat32_memset(fs->cluster_buffer, 0, cluster_size);
+            memset(fs->cluster_buffer, 0, cluster_size);
             fat32_write_cluster(fs, new_cluster, fs->cluster_buffer);
         }
 
@@ -1340,22 +2263,17 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
 
     /* Write data */
     while (len > 0) {
-        /* Read current cluster content for partial writes */
-        int result = fat32_read_cluster(fs, cluster, fs->cluster_buffer);
-        if (result != 0) {
-            fat32_memset(fs->cluster_buffer, 0, cluster_size);
-        }
-
         size_t to_copy = cluster_size - offset_in_cluster;
         if (to_copy > len) {
             to_copy = len;
         }
 
-        fat32_memcpy(fs->cluster_buffer + offset_in_cluster, src, to_copy);
-
-        result = fat32_write_cluster(fs, cluster, fs->cluster_buffer);
-        if (result != 0) {
-            return result;
+        /* The cache reads in only the blocks a partial write needs */
+        uint64_t pos = (uint64_t)fat32_cluster_to_sector(fs, cluster) * FAT32_SECTOR_SIZE +
+                       offset_in_cluster;
+        if (bcache_write(&fs->bdev, pos, src, to_copy) != 0) {
+            log_event(SERIAL_LOG_ERROR, "FAT32", "Failed to write cluster %u\n", cluster);
+            return VFS_ERR_IO;
         }
 
         src += to_copy;
@@ -1368,12 +2286,12 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
             uint32_t next = fat32_next_cluster(fs, cluster);
 
             if (fat32_is_eof(next) || !fat32_cluster_is_valid(fs, next)) {
-                /* Need more clusters */
-                uint32_t new_cluster = fat32_alloc_cluster(fs);
+                /* Need more clusters: as many as the rest of the write, in one run */
+                uint32_t want = (uint32_t)((len + cluster_size - 1) / cluster_size);
+                uint32_t new_cluster = fat32_alloc_clusters(fs, cluster, want, NULL);
                 if (!new_cluster) {
                     break;  /* Return partial write */
                 }
-                fat32_set_cluster(fs, cluster, new_cluster);
                 next = new_cluster;
             }
 
@@ -1381,6 +2299,9 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
         }
     }
 
+    /* Clusters may have been appended past the map's end of chain */
+    map->complete = false;
+
     /* Update file size if necessary */
     size_t new_end = offset + bytes_written;
     if (new_end > entry->file_size) {
@@ -1393,11 +2314,17 @@ ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
 }
 
 int fat32_truncate_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
-                        uint32_t parent_cluster, uint32_t new_size) {
+                        fat32_extent_map_t *map, uint32_t parent_cluster,
+                        uint32_t new_size) {
     if (fs->readonly) {
         return VFS_ERR_ROFS;
     }
 
+    /* Freed clusters must not be found through the map again */
+    if (map && new_size < entry->file_size) {
+        fat32_map_reset(map);
+    }
+
     uint32_t old_size = entry->file_size;
     uint32_t cluster_size = fs->bytes_per_cluster;
 
@@ -1452,11 +2379,16 @@ int fat32_sync(fat32_fs_t *fs) {
         return VFS_ERR_INVAL;
     }
 
+    /* Dirty FAT sectors into the block cache, then all of it to the disk */
     int result = fat32_flush_fat_cache(fs);
     if (result != 0) {
         return result;
     }
 
+    if (bcache_sync(&fs->bdev) != 0) {
+        return VFS_ERR_IO;
+    }
+
     if (fs->fsinfo_dirty) {
         result = fat32_write_fsinfo(fs);
         if (result != 0) {
@@ -1523,10 +2455,10 @@ int fat32_vfs_close(vfs_node_t *node) {
         return VFS_ERR_INVAL;
     }
 
-    /* Sync if dirty */
+    /* Hand FAT updates to the block cache; the flusher writes them out */
     if (node->dirty && node->mount) {
         fat32_fs_t *fs = (fat32_fs_t *)node->mount->fs_data;
-        fat32_sync(fs);
+        fat32_flush_fat_cache(fs);
     }
 
     return VFS_OK;
@@ -1542,7 +2474,7 @@ ssize_t fat32_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset
         return VFS_ERR_INVAL;
     }
 
-    return fat32_read_file(file->fs, &file->entry, buf, (size_t)offset, size);
+    return fat32_read_file(file->fs, &file->entry, &file->map, buf, (size_t)offset, size);
 }
 
 ssize_t fat32_vfs_write(vfs_node_t *node, const void *buf, size_t size, uint64_t offset) {
@@ -1559,7 +2491,7 @@ ssize_t fat32_vfs_write(vfs_node_t *node, const void *buf, size_t size, uint64_t
     /* In a full implementation, we'd track the parent cluster */
     fat32_fs_t *fs = file->fs;
 
-    ssize_t result = fat32_write_file(fs, &file->entry, fs->root_cluster, buf,
+    ssize_t result = fat32_write_file(fs, &file->entry, &file->map, fs->root_cluster, buf,
                                       (size_t)offset, size);
     if (result > 0) {
         node->size = file->entry.file_size;
@@ -1569,6 +2501,54 @@ ssize_t fat32_vfs_write(vfs_node_t *node, const void *buf, size_t size, uint64_t
     return result;
 }
 
+int fat32_vfs_sync(vfs_node_t *node) {
+    if (!node || !node->mount) {
+        return VFS_ERR_INVAL;
+    }
+
+    /* A barrier: everything written so far is on the disk on return */
+    int result = fat32_sync((fat32_fs_t *)node->mount->fs_data);
+    if (result == VFS_OK) {
+        node->dirty = false;
+    }
+    return result;
+}
+
+int fat32_vfs_readahead(vfs_node_t *node, uint64_t offset, size_t size) {
+    if (!node || !size) {
+        return VFS_ERR_INVAL;
+    }
+
+    fat32_file_t *file = (fat32_file_t *)node->fs_data;
+    if (!file || file->is_dir) {
+        return VFS_ERR_INVAL;
+    }
+
+    fat32_fs_t *fs = file->fs;
+    uint32_t cluster_size = fs->bytes_per_cluster;
+    uint32_t index = offset / cluster_size;
+    uint32_t in_cluster = offset % cluster_size;
+
+    /* One request per run of physically consecutive clusters */
+    while (size > 0) {
+        uint32_t run;
+        uint32_t cluster = fat32_map_cluster(fs, &file->entry, &file->map, index, &run);
+        if (!cluster) {
+            break;
+        }
+
+        uint64_t pos = (uint64_t)fat32_cluster_to_sector(fs, cluster) * FAT32_SECTOR_SIZE +
+                       in_cluster;
+        size_t n = MIN(size, (size_t)run * cluster_size - in_cluster);
+        bcache_readahead(&fs->bdev, pos, n);
+
+        size -= n;
+        in_cluster = 0;
+        index += run;
+    }
+    return VFS_OK;
+}
+
 vfs_dirent_t* fat32_vfs_readdir(vfs_node_t *dir, uint32_t index) {
     if (!dir || dir->type != VFS_NODE_DIRECTORY) {
         return NULL;
@@ -1582,28 +2562,50 @@ vfs_dirent_t* fat32_vfs_readdir(vfs_node_t *dir, uint32_t index) {
     /* Allocate dirent structure */
     static vfs_dirent_t dirent;  /* Static for simplicity; should be dynamic */
 
+    fat32_fs_t *fs = file->fs;
     fat32_dir_entry_t entry;
     char name[FAT32_MAX_NAME + 1];
 
-    /* Skip . and .. entries (index 0 and 1 often) */
-    uint32_t actual_index = index;
-    int result;
-
-    do {
-        result = fat32_read_dir_entry(file->fs, file->first_cluster, actual_index,
-                                      &entry, name);
-        if (result != 0) {
+    /* Indexed directories list in index order, one lookup per entry */
+    fat32_dir_index_t *idx = fat32_dir_index_get(fs, file->first_cluster, true);
+    if (idx) {
+        if (index >= idx->count) {
             return NULL;
         }
+        fat32_dir_slot_t *slot = &idx->slots[index];
+        if (fat32_read_dirent(fs, slot->cluster, slot->offset, &entry) == 0 &&
+            fat32_dirent_listed(&entry) && fat32_strcmp_83(slot->name, &entry) == 0) {
+            fat32_format_short_name(&entry, name);
+            goto found;
+        }
+        fat32_dir_index_drop(fs, file->first_cluster);
+    }
 
-        /* Skip . and .. */
-        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
-            actual_index++;
-            continue;
+    /* Otherwise continue from the cursor, or count from the start after a seek */
+    uint32_t cluster = file->rd_cluster;
+    uint32_t offset = file->rd_offset;
+    uint32_t skip = 0;
+    if (!cluster || index != file->rd_index) {
+        cluster = file->first_cluster;
+        offset = 0;
+        skip = index;
+    }
+
+    for (;;) {
+        if (fat32_dir_next(fs, &cluster, &offset, &entry, name) != 0) {
+            file->rd_cluster = 0;
+            return NULL;
         }
+        if (skip-- == 0) {
+            break;
+        }
+        offset++;
+    }
+    file->rd_index = index + 1;
+    file->rd_cluster = cluster;
+    file->rd_offset = offset + 1;
 
-        break;
-    } while (1);
+found:
 
     /* Fill in dirent */
     dirent.d_ino = fat32_entry_cluster(&entry);
@@ -1615,7 +2617,7 @@ vfs_dirent_t* fat32_vfs_readdir(vfs_node_t *dir, uint32_t index) {
     if (name_len > VFS_NAME_MAX) {
         name_len = VFS_NAME_MAX;
     }
-    fat32_memcpy(dirent.d_name, name, name_len);
+    memcpy(dirent.d_name, name, name_len);
     dirent.d_name[name_len] = '\0';
 
     return &dirent;
@@ -1646,16 +2648,16 @@ vfs_node_t* fat32_vfs_finddir(vfs_node_t *dir, const char *name) {
     }
 
     /* Allocate FAT32 file handle */
-    physaddr_t file_phys = pmm_alloc_page();
+    physaddr_t file_phys = pmm_alloc_pages(FAT32_FILE_PAGES);
     if (!file_phys) {
         vfs_free_node(node);
         return NULL;
     }
 
     fat32_file_t *file = (fat32_file_t *)(file_phys + VMM_KERNEL_PHYS_MAP);
-    fat32_memset(file, 0, sizeof(fat32_file_t));
+    memset(file, 0, sizeof(fat32_file_t));
     file->fs = fs;
-    fat32_memcpy(&file->entry, &entry, sizeof(fat32_dir_entry_t));
+    memcpy(&file->entry, &entry, sizeof(fat32_dir_entry_t));
     file->first_cluster = fat32_entry_cluster(&entry);
     file->current_cluster = file->first_cluster;
     file->is_dir = (entry.attr & FAT32_ATTR_DIRECTORY) != 0;
@@ -1665,7 +2667,7 @@ vfs_node_t* fat32_vfs_finddir(vfs_node_t *dir, const char *name) {
     fat32_format_short_name(&entry, formatted_name);
     size_t name_len = fat32_strlen(formatted_name);
     if (name_len > VFS_NAME_MAX) name_len = VFS_NAME_MAX;
-    fat32_memcpy(node->name, formatted_name, name_len);
+    memcpy(node->name, formatted_name, name_len);
     node->name[name_len] = '\0';
 
     node->type = (entry.attr & FAT32_ATTR_DIRECTORY) ?
@@ -1810,7 +2812,7 @@ int fat32_vfs_mount(vfs_mount_t *mount, void *device) {
     }
 
     /* Allocate file handle for root */
-    physaddr_t file_phys = pmm_alloc_page();
+    physaddr_t file_phys = pmm_alloc_pages(FAT32_FILE_PAGES);
     if (!file_phys) {
         vfs_free_node(root);
         fat32_unmount(fs);
@@ -1818,7 +2820,7 @@ int fat32_vfs_mount(vfs_mount_t *mount, void *device) {
     }
 
     fat32_file_t *root_file = (fat32_file_t *)(file_phys + VMM_KERNEL_PHYS_MAP);
-    fat32_memset(root_file, 0, sizeof(fat32_file_t));
+    memset(root_file, 0, sizeof(fat32_file_t));
     root_file->fs = fs;
     root_file->first_cluster = fs->root_cluster;
     root_file->current_cluster = fs->root_cluster;
@@ -1851,8 +2853,10 @@ int fat32_vfs_unmount(vfs_mount_t *mount) {
 
     /* Free root node file handle */
     if (mount->root && mount->root->fs_data) {
-        physaddr_t file_phys = (physaddr_t)mount->root->fs_data - VMM_KERNEL_PHYS_MAP;
-        pmm_free_page(file_phys);
+        fat32_file_t *root_file = (fat32_file_t *)mount->root->fs_data;
+        fat32_map_free(&root_file->map);
+        physaddr_t file_phys = (physaddr_t)root_file - VMM_KERNEL_PHYS_MAP;
+        pmm_free_pages(file_phys, FAT32_FILE_PAGES);
     }
 
     /* Free root node */
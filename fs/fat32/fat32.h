@@ -19,6 +19,7 @@
 
 #include "../../kernel/include/types.h"
 #include "../vfs/vfs.h"
+#include "../bcache/bcache.h"
 
 /*============================================================================
  * FAT32 Constants
@@ -73,8 +74,16 @@
 #define FAT32_MAX_NAME              255
 #define FAT32_SHORT_NAME_LEN        11
 
-/* FAT cache size (number of sectors to cache) */
-#define FAT32_FAT_CACHE_SIZE        16
+/* FAT cache: up to 4096 sectors (2MB, the whole FAT of a 2GB volume at 4K clusters) */
+#define FAT32_FAT_CACHE_MAX         4096
+#define FAT32_FAT_HASH_SIZE         1024    /* Lookup buckets (power of two) */
+#define FAT32_FAT_FLUSH_BATCH       16      /* Consecutive sectors per write-back */
+
+/* FAT sectors read per device call while building the free-cluster bitmap */
+#define FAT32_FREE_MAP_SCAN_PAGES   16
+
+/* Directory name indexes kept per volume (least recently used dropped) */
+#define FAT32_DIR_INDEX_MAX         16
 
 /*============================================================================
  * FAT32 On-Disk Structures
@@ -201,6 +210,26 @@ typedef struct {
      */
     int (*write_sectors)(void *device, uint64_t lba, uint32_t count, const void *buffer);
 
+    /**
+     * Read sectors into a list of buffers (optional)
+     * Segments that follow each other on the disk should become one device
+     * command (e.g. one AHCI command with a PRD entry per segment).
+     * @param device Device-specific data
+     * @param segs Segments to read
+     * @param count Number of segments
+     * @return 0 on success, negative error code on failure
+     */
+    int (*read_sectors_v)(void *device, const bcache_seg_t *segs, uint32_t count);
+
+    /**
+     * Write sectors from a list of buffers (optional)
+     * @param device Device-specific data
+     * @param segs Segments to write
+     * @param count Number of segments
+     * @return 0 on success, negative error code on failure
+     */
+    int (*write_sectors_v)(void *device, const bcache_seg_t *segs, uint32_t count);
+
     /**
      * Flush pending writes to device
      * @param device Device-specific data
@@ -212,13 +241,72 @@ typedef struct {
 /**
  * FAT cache entry
  */
-typedef struct {
+typedef struct fat32_fat_cache_entry {
     uint32_t    sector;             /* Cached FAT sector number */
     bool        dirty;              /* Cache entry has been modified */
-    bool        valid;              /* Cache entry contains valid data */
+    bool        referenced;         /* Used since the CLOCK hand last passed */
+    struct fat32_fat_cache_entry *hash_next;
     uint8_t     data[FAT32_SECTOR_SIZE]; /* Cached sector data */
 } fat32_fat_cache_entry_t;
 
+/**
+ * FAT sector cache
+ * Entries are allocated as sectors are first used, up to capacity, and
+ * then replaced in CLOCK order.
+ */
+typedef struct {
+    fat32_fat_cache_entry_t **slots;    /* Entries in CLOCK order */
+    fat32_fat_cache_entry_t **hash;     /* Buckets of FAT32_FAT_HASH_SIZE */
+    uint32_t    count;              /* Entries allocated */
+    uint32_t    capacity;           /* Most entries (at most the FAT size) */
+    uint32_t    hand;               /* Next slot CLOCK looks at */
+    uint32_t    dirty;              /* Entries waiting for write-back */
+    uint64_t    hits;
+    uint64_t    misses;
+    uint64_t    evictions;
+    uint64_t    writebacks;         /* Device writes made by write-back */
+} fat32_fat_cache_t;
+
+/**
+ * FAT cache statistics
+ */
+typedef struct {
+    uint64_t    hits;               /* Lookups answered from the cache */
+    uint64_t    misses;             /* Sectors read from the device */
+    uint64_t    evictions;          /* Entries reused for another sector */
+    uint64_t    writebacks;         /* Device writes made by write-back */
+    uint32_t    cached;             /* Sectors held */
+    uint32_t    dirty;              /* Of which dirty */
+    uint32_t    capacity;           /* Most sectors held */
+} fat32_fat_cache_stats_t;
+
+/**
+ * Entry of a directory index
+ */
+typedef struct {
+    char        name[13];           /* Formatted short name */
+    uint32_t    cluster;            /* Directory cluster holding the entry */
+    uint32_t    offset;             /* Entry number within that cluster */
+    int32_t     hash_next;          /* Next slot in the bucket, -1 at the end */
+} fat32_dir_slot_t;
+
+/**
+ * Name index of one directory
+ * Built by scanning the directory on first use, then kept up to date by
+ * fat32_create_entry and fat32_delete_entry. Dot entries are left out.
+ */
+typedef struct fat32_dir_index {
+    struct fat32_dir_index *next;   /* Volume's list, most recently used first */
+    uint32_t    dir_cluster;        /* First cluster of the directory */
+    fat32_dir_slot_t *slots;        /* Entries in listing order (kmalloc) */
+    uint32_t    count;
+    uint32_t    capacity;
+    int32_t     *buckets;           /* First slot per bucket, -1 if empty (kmalloc) */
+    uint32_t    bucket_count;       /* Power of two */
+    uint32_t    free_cluster;       /* Where to look for a free entry (0: start) */
+    uint32_t    free_offset;
+} fat32_dir_index_t;
+
 /**
  * FAT32 Filesystem State
  * Main structure holding all mount-related information
@@ -227,6 +315,7 @@ typedef struct {
     /* Block device interface */
     void                    *device;        /* Device-specific data */
     fat32_block_ops_t       *block_ops;     /* Block device operations */
+    bcache_dev_t            bdev;           /* Cluster data goes through the block cache */
 
     /* BPB information (cached from boot sector) */
     fat32_bpb_t             bpb;            /* Copy of BPB */
@@ -243,9 +332,14 @@ typedef struct {
     uint32_t                free_clusters;      /* Free cluster count */
     uint32_t                next_free_cluster;  /* Hint for next free cluster */
     bool                    fsinfo_dirty;       /* FSInfo needs to be written */
+    uint64_t                *free_map;          /* Bit per data cluster, set if free */
 
     /* FAT cache */
-    fat32_fat_cache_entry_t fat_cache[FAT32_FAT_CACHE_SIZE];
+    fat32_fat_cache_t       fat_cache;
+
+    /* Directory name indexes */
+    fat32_dir_index_t       *dir_indexes;
+    uint32_t                dir_index_count;
 
     /* Cluster buffer (for reading full clusters) */
     uint8_t                 *cluster_buffer;
@@ -258,6 +352,34 @@ typedef struct {
     vfs_mount_t             *vfs_mount;         /* Associated VFS mount */
 } fat32_fs_t;
 
+/* Cluster runs cached per file; past this, chains are walked from the last one */
+#define FAT32_EXTENT_MAX            256
+
+/**
+ * Run of consecutive clusters in a file's chain
+ */
+typedef struct {
+    uint32_t    file_cluster;       /* Index of the run's first cluster in the file */
+    uint32_t    disk_cluster;       /* Its cluster number on the volume */
+    uint32_t    length;             /* Clusters in the run */
+} fat32_extent_t;
+
+/**
+ * Map of a file's cluster chain, filled in lazily as the file is accessed
+ * Extents cover the first `mapped` clusters; the walk cursor (tail) is the
+ * furthest cluster visited, which runs ahead of the extents once the
+ * array is full.
+ */
+typedef struct {
+    fat32_extent_t  *extents;       /* Sorted by file_cluster (kmalloc) */
+    uint32_t        count;
+    uint32_t        capacity;
+    uint32_t        mapped;         /* Clusters covered by extents */
+    uint32_t        tail_index;     /* Walk cursor: index in the file... */
+    uint32_t        tail_cluster;   /* ...and cluster number (0 before the first) */
+    bool            complete;       /* The cursor is at the end of the chain */
+} fat32_extent_map_t;
+
 /**
  * FAT32 file handle
  * Used internally to track open files
@@ -272,8 +394,15 @@ typedef struct {
     char                path[VFS_PATH_MAX]; /* Full path to file */
     bool                dirty;              /* File has been modified */
     bool                is_dir;             /* Is a directory */
+    fat32_extent_map_t  map;                /* Cluster chain extents */
+    uint32_t            rd_index;           /* Readdir cursor: next index... */
+    uint32_t            rd_cluster;         /* ...and where to look for it (0: unset) */
+    uint32_t            rd_offset;
 } fat32_file_t;
 
+/* Pages backing one fat32_file_t (the path buffer alone fills a page) */
+#define FAT32_FILE_PAGES    ((sizeof(fat32_file_t) + PAGE_SIZE - 1) / PAGE_SIZE)
+
 /*============================================================================
  * FAT32 Core Functions
  *============================================================================*/
@@ -342,6 +471,19 @@ int fat32_set_cluster(fat32_fs_t *fs, uint32_t cluster, uint32_t value);
  */
 uint32_t fat32_alloc_cluster(fat32_fs_t *fs);
 
+/**
+ * Allocate a run of consecutive clusters, chained and ending in EOF
+ * Tries the clusters after prev first, then the first free run of count
+ * from the rotating hint, then the longest run found.
+ * @param fs Filesystem state
+ * @param prev Cluster to link the run to, or 0
+ * @param count Clusters wanted
+ * @param allocated Output clusters in the run (1 to count), may be NULL
+ * @return First cluster of the run, or 0 on failure (no free clusters)
+ */
+uint32_t fat32_alloc_clusters(fat32_fs_t *fs, uint32_t prev, uint32_t count,
+                              uint32_t *allocated);
+
 /**
  * Free a cluster chain
  * @param fs Filesystem state
@@ -420,22 +562,47 @@ int fat32_delete_entry(fat32_fs_t *fs, uint32_t parent_cluster, const char *name
  * FAT32 File Functions
  *============================================================================*/
 
+/**
+ * Find the cluster holding part of a file
+ * @param map Extent map of the file (filled in as needed)
+ * @param index Cluster index within the file
+ * @param run Set to the number of clusters from there that are
+ *            consecutive on disk (at least 1)
+ * @return Cluster number, or 0 past the end of the chain
+ */
+uint32_t fat32_map_cluster(fat32_fs_t *fs, fat32_dir_entry_t *entry,
+                           fat32_extent_map_t *map, uint32_t index, uint32_t *run);
+
+/**
+ * Forget a map after its file's chain was cut or replaced
+ * Appending clusters does not require this.
+ */
+void fat32_map_reset(fat32_extent_map_t *map);
+
+/**
+ * Free a map's extents
+ */
+void fat32_map_free(fat32_extent_map_t *map);
+
 /**
  * Read data from a file
+ * Each run of consecutive clusters is read with one request.
  * @param fs Filesystem state
  * @param entry Directory entry of the file
+ * @param map Extent map of the file, or NULL for a one-off map
  * @param buf Buffer to read into
  * @param offset Byte offset within file
  * @param len Number of bytes to read
  * @return Number of bytes read, or negative error code on failure
  */
-ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry, void *buf,
-                        size_t offset, size_t len);
+ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
+                        fat32_extent_map_t *map, void *buf, size_t offset, size_t len);
 
 /**
  * Write data to a file
  * @param fs Filesystem state
  * @param entry Directory entry of the file (will be updated)
+ * @param map Extent map of the file, or NULL for a one-off map
  * @param parent_cluster Parent directory cluster (to update entry)
  * @param buf Buffer to write from
  * @param offset Byte offset within file
@@ -443,19 +610,21 @@ ssize_t fat32_read_file(fat32_fs_t *fs, fat32_dir_entry_t *entry, void *buf,
  * @return Number of bytes written, or negative error code on failure
  */
 ssize_t fat32_write_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
-                         uint32_t parent_cluster, const void *buf,
-                         size_t offset, size_t len);
+                         fat32_extent_map_t *map, uint32_t parent_cluster,
+                         const void *buf, size_t offset, size_t len);
 
 /**
  * Truncate or extend a file
  * @param fs Filesystem state
  * @param entry Directory entry of the file
+ * @param map Extent map of the file (reset when clusters are freed), or NULL
  * @param parent_cluster Parent directory cluster
  * @param new_size New file size
  * @return 0 on success, negative error code on failure
  */
 int fat32_truncate_file(fat32_fs_t *fs, fat32_dir_entry_t *entry,
-                        uint32_t parent_cluster, uint32_t new_size);
+                        fat32_extent_map_t *map, uint32_t parent_cluster,
+                        uint32_t new_size);
 
 /*============================================================================
  * FAT32 VFS Integration
@@ -481,6 +650,16 @@ ssize_t fat32_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset
  */
 ssize_t fat32_vfs_write(vfs_node_t *node, const void *buf, size_t size, uint64_t offset);
 
+/**
+ * VFS sync - write back everything on the volume before returning
+ */
+int fat32_vfs_sync(vfs_node_t *node);
+
+/**
+ * VFS readahead - queue a file range for loading into the block cache
+ */
+int fat32_vfs_readahead(vfs_node_t *node, uint64_t offset, size_t size);
+
 /**
  * VFS readdir callback
  */
@@ -600,6 +779,8 @@ uint8_t fat32_short_name_checksum(const char *short_name);
 
 /**
  * Sync all dirty data to disk
+ * A barrier: returns once every earlier write to the volume, cached or
+ * not, has reached the device.
  * @param fs Filesystem state
  * @return 0 on success, negative error code on failure
  */
@@ -614,4 +795,14 @@ int fat32_sync(fat32_fs_t *fs);
  */
 int fat32_statfs(fat32_fs_t *fs, uint64_t *total_bytes, uint64_t *free_bytes);
 
+/**
+ * Get FAT cache statistics
+ */
+void fat32_get_fat_cache_stats(fat32_fs_t *fs, fat32_fat_cache_stats_t *stats);
+
+/**
+ * Print FAT cache statistics (for debugging)
+ */
+void fat32_dump_fat_cache_stats(fat32_fs_t *fs);
+
 #endif /* _AAAOS_FAT32_H */
@@ -0,0 +1,236 @@
+/**
+ * AAAos Initramfs Implementation
+ *
+ * Walks the newc cpio archive once, creating each entry through the VFS
+ * and attaching file contents to the archive memory.
+ */
+
+#include "initramfs.h"
+#include "../vfs/vfs.h"
+#include "../tmpfs/tmpfs.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/heap.h"
+
+/* newc header: magic followed by 13 fields of 8 hex digits */
+#define CPIO_HEADER_SIZE        110
+#define CPIO_FIELD_MODE         1
+#define CPIO_FIELD_FILESIZE     6
+#define CPIO_FIELD_NAMESIZE     11
+
+/* Mode bits */
+#define CPIO_S_IFMT             0170000
+#define CPIO_S_IFDIR            0040000
+#define CPIO_S_IFREG            0100000
+
+/*============================================================================
+ * Archive Parsing
+ *============================================================================*/
+
+static size_t initramfs_strlen(const char *s) {
+    size_t len = 0;
+    while (*s++) len++;
+    return len;
+}
+
+static bool initramfs_streq(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decode header field n
+ * @return false if the field is not hexadecimal
+ */
+static bool initramfs_field(const char *header, int n, uint32_t *out) {
+    const char *p = header + 6 + n * 8;
+    uint32_t value = 0;
+
+    for (int i = 0; i < 8; i++) {
+        char c = p[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+
+    *out = value;
+    return true;
+}
+
+static bool initramfs_magic_ok(const char *header) {
+    return initramfs_streq(header, INITRAMFS_MAGIC, 6) ||
+           initramfs_streq(header, INITRAMFS_MAGIC_CRC, 6);
+}
+
+/*============================================================================
+ * Unpacking
+ *============================================================================*/
+
+/**
+ * Create every missing directory above path
+ * Archives list directories before their contents, so this is only
+ * needed for ones that leave them out.
+ */
+static void initramfs_make_parents(char *path, size_t prefix_len) {
+    for (char *p = path + prefix_len + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            vfs_mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+}
+
+/**
+ * Create a regular file whose contents stay in the archive
+ */
+static int initramfs_add_file(char *path, size_t prefix_len, uint32_t mode,
+                              const uint8_t *data, uint32_t size) {
+    int result = vfs_create(path, mode & 0777);
+    if (result == VFS_ERR_NOENT) {
+        initramfs_make_parents(path, prefix_len);
+        result = vfs_create(path, mode & 0777);
+    }
+    if (result != VFS_OK) {
+        return result;
+    }
+
+    vfs_node_t *node = vfs_lookup(path);
+    if (!node) {
+        return VFS_ERR_NOENT;
+    }
+    result = tmpfs_attach(node, data, size);
+    vfs_unref_node(node);
+    return result;
+}
+
+static int initramfs_add_dir(char *path, size_t prefix_len, uint32_t mode) {
+    int result = vfs_mkdir(path, mode & 0777);
+    if (result == VFS_ERR_NOENT) {
+        initramfs_make_parents(path, prefix_len);
+        result = vfs_mkdir(path, mode & 0777);
+    }
+    return result == VFS_ERR_EXIST ? VFS_OK : result;
+}
+
+int initramfs_load(const boot_info_t *boot_info, const char *path) {
+    if (!boot_info_valid(boot_info) || !boot_info->initrd_size || !path) {
+        return VFS_ERR_NOENT;
+    }
+
+    const uint8_t *archive = (const uint8_t *)(boot_info->initrd_addr + VMM_KERNEL_PHYS_MAP);
+    uint64_t archive_size = boot_info->initrd_size;
+
+    if (archive_size < CPIO_HEADER_SIZE || !initramfs_magic_ok((const char *)archive)) {
+        kprintf("[INITRAMFS] No cpio archive at 0x%llx\n", boot_info->initrd_addr);
+        return VFS_ERR_INVAL;
+    }
+
+    size_t prefix_len = initramfs_strlen(path);
+    while (prefix_len > 0 && path[prefix_len - 1] == '/') {
+        prefix_len--;
+    }
+    if (prefix_len + 2 > VFS_PATH_MAX) {
+        return VFS_ERR_NAMETOOLONG;
+    }
+
+    int result = vfs_mount(path, "tmpfs", NULL);
+    if (result != VFS_OK) {
+        kprintf("[INITRAMFS] Cannot mount tmpfs at %s: %d\n", path, result);
+        return result;
+    }
+
+    char *full = kmalloc(VFS_PATH_MAX);
+    if (!full) {
+        return VFS_ERR_NOMEM;
+    }
+    for (size_t i = 0; i < prefix_len; i++) {
+        full[i] = path[i];
+    }
+    full[prefix_len] = '/';
+
+    kprintf("[INITRAMFS] Unpacking %llu bytes into %s\n", archive_size, path);
+
+    int created = 0;
+    uint64_t pos = 0;
+    while (pos + CPIO_HEADER_SIZE <= archive_size) {
+        const char *header = (const char *)(archive + pos);
+        uint32_t mode, size, name_size;
+        if (!initramfs_magic_ok(header) ||
+            !initramfs_field(header, CPIO_FIELD_MODE, &mode) ||
+            !initramfs_field(header, CPIO_FIELD_FILESIZE, &size) ||
+            !initramfs_field(header, CPIO_FIELD_NAMESIZE, &name_size)) {
+            kprintf("[INITRAMFS] Bad header at offset %llu\n", pos);
+            break;
+        }
+
+        /* Name (NUL-terminated) and data are each padded to 4 bytes */
+        uint64_t name_pos = pos + CPIO_HEADER_SIZE;
+        uint64_t data_pos = ALIGN_UP(name_pos + name_size, 4);
+        if (name_size == 0 || data_pos + size > archive_size ||
+            archive[name_pos + name_size - 1] != '\0') {
+            kprintf("[INITRAMFS] Truncated entry at offset %llu\n", pos);
+            break;
+        }
+        pos = ALIGN_UP(data_pos + size, 4);
+
+        const char *name = (const char *)(archive + name_pos);
+        if (initramfs_streq(name, INITRAMFS_TRAILER, sizeof(INITRAMFS_TRAILER))) {
+            break;
+        }
+
+        /* Entries are relative to the mount ("./bin/sh", "bin/sh" or "/bin/sh") */
+        while (name[0] == '.' && name[1] == '/') {
+            name += 2;
+        }
+        while (name[0] == '/') {
+            name++;
+        }
+        if (name[0] == '\0' || (name[0] == '.' && name[1] == '\0')) {
+            continue;
+        }
+
+        size_t name_len = initramfs_strlen(name);
+        if (prefix_len + 1 + name_len >= VFS_PATH_MAX) {
+            kprintf("[INITRAMFS] Skipping %s: path too long\n", name);
+            continue;
+        }
+        for (size_t i = 0; i <= name_len; i++) {
+            full[prefix_len + 1 + i] = name[i];
+        }
+
+        switch (mode & CPIO_S_IFMT) {
+            case CPIO_S_IFDIR:
+                result = initramfs_add_dir(full, prefix_len, mode);
+                break;
+            case CPIO_S_IFREG:
+                result = initramfs_add_file(full, prefix_len, mode, archive + data_pos, size);
+                break;
+            default:
+                /* Symlinks, devices and FIFOs have no tmpfs counterpart */
+                continue;
+        }
+
+        if (result == VFS_OK) {
+            created++;
+        } else {
+            kprintf("[INITRAMFS] Cannot create %s: %s\n", full, vfs_strerror(result));
+        }
+    }
+
+    kfree(full);
+    kprintf("[INITRAMFS] %d entries unpacked\n", created);
+    return created;
+}
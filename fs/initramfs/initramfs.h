@@ -0,0 +1,38 @@
+/**
+ * AAAos Initramfs
+ *
+ * The bootloader can load an archive of files along with the kernel and
+ * pass it in boot_info_t (initrd_addr, initrd_size). It is unpacked into
+ * a tmpfs mount, so the shell and core applications are there before any
+ * disk driver or filesystem has been brought up.
+ *
+ * The archive is an uncompressed cpio in the "newc" format (as written by
+ * `find . | cpio -o -H newc`). File contents are not copied: each file is
+ * attached to the archive in place (tmpfs_attach), and only pages that
+ * are later written get memory of their own. Directories and regular
+ * files are created; other entry types (symlinks, devices) are skipped.
+ */
+
+#ifndef _AAAOS_FS_INITRAMFS_H
+#define _AAAOS_FS_INITRAMFS_H
+
+#include "../../kernel/include/types.h"
+#include "../../kernel/include/boot.h"
+
+/* newc header magic (and the variant with checksums, "070702") */
+#define INITRAMFS_MAGIC         "070701"
+#define INITRAMFS_MAGIC_CRC     "070702"
+#define INITRAMFS_TRAILER       "TRAILER!!!"
+
+/**
+ * Mount a tmpfs and unpack the boot initramfs into it
+ * Needs the VFS and tmpfs initialized (vfs_init, tmpfs_init) and the
+ * archive's frames reserved (pmm_init does so).
+ * @param boot_info Boot information from the bootloader
+ * @param path Mount point, usually "/"
+ * @return Number of files and directories created, or negative error code
+ *         (VFS_ERR_NOENT when the bootloader passed no archive)
+ */
+int initramfs_load(const boot_info_t *boot_info, const char *path);
+
+#endif /* _AAAOS_FS_INITRAMFS_H */
@@ -0,0 +1,257 @@
+/**
+ * AAAos statsfs - Kernel Metrics as Files
+ *
+ * A file's VFS node points at its kstat_t; the root has no fs_data. A
+ * file's size is the length of its text when it was opened or stat'ed,
+ * so a value that grows a digit in between reads one byte short.
+ */
+
+#include "statsfs.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/stats/kstat.h"
+
+static int statsfs_vfs_open(vfs_node_t *node, int flags);
+static ssize_t statsfs_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset);
+static ssize_t statsfs_vfs_write(vfs_node_t *node, const void *buf, size_t size,
+                                 uint64_t offset);
+static vfs_dirent_t* statsfs_vfs_readdir(vfs_node_t *dir, uint32_t index);
+static vfs_node_t* statsfs_vfs_finddir(vfs_node_t *dir, const char *name);
+static int statsfs_vfs_stat(vfs_node_t *node, vfs_stat_t *stat);
+static int statsfs_vfs_mount(vfs_mount_t *mount, void *device);
+static int statsfs_vfs_unmount(vfs_mount_t *mount);
+
+static vfs_ops_t statsfs_vfs_ops = {
+    .open       = statsfs_vfs_open,
+    .read       = statsfs_vfs_read,
+    .write      = statsfs_vfs_write,
+    .readdir    = statsfs_vfs_readdir,
+    .finddir    = statsfs_vfs_finddir,
+    .stat       = statsfs_vfs_stat,
+    .mount      = statsfs_vfs_mount,
+    .unmount    = statsfs_vfs_unmount,
+};
+
+static bool statsfs_registered = false;
+
+/* Entry returned by readdir; the VFS copies it before the next call */
+static vfs_dirent_t statsfs_dirent;
+
+/* Permissions of the root, of tracepoint files and of the others */
+#define STATSFS_DIR_MODE    (VFS_S_IRUSR | VFS_S_IXUSR | VFS_S_IRGRP | VFS_S_IXGRP | \
+                             VFS_S_IROTH | VFS_S_IXOTH)
+#define STATSFS_FILE_MODE   (VFS_S_IRUSR | VFS_S_IRGRP | VFS_S_IROTH)
+#define STATSFS_TRACE_MODE  (STATSFS_FILE_MODE | VFS_S_IWUSR)
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static void statsfs_copy_name(char *dest, const char *src) {
+    size_t i = 0;
+    while (src[i] && i < VFS_NAME_MAX) {
+        dest[i] = src[i];
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+/**
+ * Inode number of a metric file (the root is 1)
+ */
+static uint64_t statsfs_ino(const kstat_t *k) {
+    return (uint64_t)(k - kstat_get(0)) + 2;
+}
+
+static size_t statsfs_text_len(const kstat_t *k) {
+    char text[KSTAT_TEXT_MAX];
+    return kstat_format(k, text, sizeof(text));
+}
+
+/**
+ * Check that an option word matches, ignoring a trailing newline
+ */
+static bool statsfs_word(const char *buf, size_t size, const char *word) {
+    while (size > 0 && (buf[size - 1] == '\n' || buf[size - 1] == ' ')) {
+        size--;
+    }
+    size_t i = 0;
+    while (i < size && word[i] && buf[i] == word[i]) {
+        i++;
+    }
+    return i == size && word[i] == '\0';
+}
+
+/*============================================================================
+ * Initialization
+ *============================================================================*/
+
+int statsfs_init(void) {
+    if (statsfs_registered) {
+        return VFS_OK;
+    }
+
+    int result = vfs_register_fs("statsfs", &statsfs_vfs_ops);
+    if (result != VFS_OK) {
+        kprintf("[STATSFS] Failed to register with VFS: %d\n", result);
+        return result;
+    }
+    statsfs_registered = true;
+
+    kprintf("[STATSFS] statsfs registered, %llu metrics\n", (uint64_t)kstat_count());
+    return VFS_OK;
+}
+
+/*============================================================================
+ * VFS Integration Callbacks
+ *============================================================================*/
+
+static int statsfs_vfs_open(vfs_node_t *node, int flags) {
+    UNUSED(flags);
+
+    if (!node) {
+        return VFS_ERR_INVAL;
+    }
+    if (node->fs_data) {
+        node->size = statsfs_text_len((const kstat_t *)node->fs_data);
+    }
+    return VFS_OK;
+}
+
+static ssize_t statsfs_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset) {
+    if (!node || !buf) {
+        return VFS_ERR_INVAL;
+    }
+    if (!node->fs_data) {
+        return VFS_ERR_ISDIR;
+    }
+
+    char text[KSTAT_TEXT_MAX];
+    size_t len = kstat_format((const kstat_t *)node->fs_data, text, sizeof(text));
+    if (offset >= len) {
+        return 0;
+    }
+
+    size_t n = MIN(size, (size_t)(len - offset));
+    uint8_t *dest = (uint8_t *)buf;
+    for (size_t i = 0; i < n; i++) {
+        dest[i] = (uint8_t)text[offset + i];
+    }
+    return (ssize_t)n;
+}
+
+static ssize_t statsfs_vfs_write(vfs_node_t *node, const void *buf, size_t size,
+                                 uint64_t offset) {
+    UNUSED(offset);
+
+    if (!node || !buf) {
+        return VFS_ERR_INVAL;
+    }
+
+    const kstat_t *k = (const kstat_t *)node->fs_data;
+    if (!k || k->type != KSTAT_TRACEPOINT) {
+        return VFS_ERR_ACCES;
+    }
+
+    const char *text = (const char *)buf;
+    if (statsfs_word(text, size, "on") || statsfs_word(text, size, "1")) {
+        kstat_trace_enable(k, true);
+    } else if (statsfs_word(text, size, "off") || statsfs_word(text, size, "0")) {
+        kstat_trace_enable(k, false);
+    } else {
+        return VFS_ERR_INVAL;
+    }
+    return (ssize_t)size;
+}
+
+static vfs_dirent_t* statsfs_vfs_readdir(vfs_node_t *dir, uint32_t index) {
+    if (!dir || dir->fs_data) {
+        return NULL;
+    }
+
+    const kstat_t *k = kstat_get(index);
+    if (!k) {
+        return NULL;
+    }
+
+    statsfs_dirent.d_ino = statsfs_ino(k);
+    statsfs_dirent.d_type = VFS_NODE_FILE;
+    statsfs_copy_name(statsfs_dirent.d_name, k->name);
+    return &statsfs_dirent;
+}
+
+static vfs_node_t* statsfs_vfs_finddir(vfs_node_t *dir, const char *name) {
+    if (!dir || dir->fs_data || !name) {
+        return NULL;
+    }
+
+    const kstat_t *k = kstat_find(name);
+    vfs_node_t *vnode = k ? vfs_alloc_node() : NULL;
+    if (!vnode) {
+        return NULL;
+    }
+
+    statsfs_copy_name(vnode->name, k->name);
+    vnode->type = VFS_NODE_FILE;
+    vnode->permissions = k->type == KSTAT_TRACEPOINT ? STATSFS_TRACE_MODE : STATSFS_FILE_MODE;
+    vnode->inode = statsfs_ino(k);
+    vnode->size = statsfs_text_len(k);
+    vnode->nlink = 1;
+    vnode->mount = dir->mount;
+    vnode->parent = dir;
+    vnode->fs_data = (void *)k;
+    return vnode;
+}
+
+static int statsfs_vfs_stat(vfs_node_t *node, vfs_stat_t *stat) {
+    if (!node || !stat) {
+        return VFS_ERR_INVAL;
+    }
+
+    const kstat_t *k = (const kstat_t *)node->fs_data;
+    *stat = (vfs_stat_t){ 0 };
+    stat->st_ino = node->inode;
+    stat->st_mode = node->permissions;
+    stat->st_nlink = k ? 1 : 2;
+    stat->st_size = k ? statsfs_text_len(k) : 0;
+    stat->st_blksize = KSTAT_TEXT_MAX;
+    stat->st_type = node->type;
+    return VFS_OK;
+}
+
+static int statsfs_vfs_mount(vfs_mount_t *mount, void *device) {
+    UNUSED(device);
+
+    if (!mount) {
+        return VFS_ERR_INVAL;
+    }
+
+    vfs_node_t *root = vfs_alloc_node();
+    if (!root) {
+        return VFS_ERR_NOMEM;
+    }
+    statsfs_copy_name(root->name, "/");
+    root->type = VFS_NODE_DIRECTORY;
+    root->permissions = STATSFS_DIR_MODE;
+    root->inode = 1;
+    root->nlink = 2;
+    root->mount = mount;
+    root->fs_data = NULL;
+
+    mount->root = root;
+    mount->readonly = false;        /* Tracepoint files take writes */
+
+    kprintf("[STATSFS] Mounted at %s\n", mount->path);
+    return VFS_OK;
+}
+
+static int statsfs_vfs_unmount(vfs_mount_t *mount) {
+    if (!mount) {
+        return VFS_ERR_INVAL;
+    }
+    if (mount->root) {
+        vfs_free_node(mount->root);
+        mount->root = NULL;
+    }
+    kprintf("[STATSFS] Unmounted %s\n", mount->path);
+    return VFS_OK;
+}
@@ -0,0 +1,30 @@
+/**
+ * AAAos statsfs - Kernel Metrics as Files
+ *
+ * A read-only directory with one file per metric of the kstat registry
+ * (kernel/stats/kstat.h), named after the metric, e.g. "ipc.pipe.created".
+ * Nothing is stored: reading a file renders the metric's current value
+ * with kstat_format. Writing "on" or "off" (or "1" or "0") to a
+ * tracepoint's file enables or disables it; the other files refuse
+ * writes.
+ *
+ * Mounted with vfs_mount(path, "statsfs", NULL) once statsfs_init has
+ * registered the type; the "stats mount" shell command does both.
+ */
+
+#ifndef _AAAOS_FS_STATSFS_H
+#define _AAAOS_FS_STATSFS_H
+
+#include "../../kernel/include/types.h"
+#include "../vfs/vfs.h"
+
+/* Where "stats mount" puts it by default */
+#define STATSFS_DEFAULT_PATH    "/stats"
+
+/**
+ * Register the statsfs filesystem type with the VFS
+ * @return VFS_OK on success (also if already registered), error code on failure
+ */
+int statsfs_init(void);
+
+#endif /* _AAAOS_FS_STATSFS_H */
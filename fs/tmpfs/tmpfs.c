@@ -0,0 +1,1015 @@
+/**
+ * AAAos tmpfs - In-Memory Filesystem Implementation
+ *
+ * One spinlock per mount covers its tree, its nodes' contents and its
+ * usage counters. Buffers passed to read and write are faulted in before
+ * the lock is taken, so copying never faults while holding it.
+ */
+
+#include "tmpfs.h"
+#include "../../kernel/include/serial.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/slab.h"
+#include "../../kernel/sched/clock.h"
+#include "../../lib/libc/string.h"
+
+/*============================================================================
+ * VFS Operations - Forward Declarations
+ *============================================================================*/
+
+static int tmpfs_vfs_open(vfs_node_t *node, int flags);
+static int tmpfs_vfs_close(vfs_node_t *node);
+static ssize_t tmpfs_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset);
+static ssize_t tmpfs_vfs_write(vfs_node_t *node, const void *buf, size_t size,
+                               uint64_t offset);
+static int tmpfs_vfs_truncate(vfs_node_t *node, uint64_t size);
+static int tmpfs_vfs_sync(vfs_node_t *node);
+static vfs_dirent_t* tmpfs_vfs_readdir(vfs_node_t *dir, uint32_t index);
+static vfs_node_t* tmpfs_vfs_finddir(vfs_node_t *dir, const char *name);
+static int tmpfs_vfs_mkdir(vfs_node_t *parent, const char *name, uint32_t permissions);
+static int tmpfs_vfs_rmdir(vfs_node_t *parent, const char *name);
+static int tmpfs_vfs_create(vfs_node_t *parent, const char *name, uint32_t permissions);
+static int tmpfs_vfs_unlink(vfs_node_t *parent, const char *name);
+static int tmpfs_vfs_rename(vfs_node_t *old_parent, const char *old_name,
+                            vfs_node_t *new_parent, const char *new_name);
+static int tmpfs_vfs_stat(vfs_node_t *node, vfs_stat_t *stat);
+static int tmpfs_vfs_chmod(vfs_node_t *node, uint32_t mode);
+static int tmpfs_vfs_chown(vfs_node_t *node, uint32_t uid, uint32_t gid);
+static void tmpfs_vfs_release(vfs_node_t *node);
+static int tmpfs_vfs_mount(vfs_mount_t *mount, void *device);
+static int tmpfs_vfs_unmount(vfs_mount_t *mount);
+static int tmpfs_vfs_sync_fs(vfs_mount_t *mount);
+static int tmpfs_vfs_statfs(vfs_mount_t *mount, void *buf);
+
+/*============================================================================
+ * VFS Operations Table
+ *============================================================================*/
+
+static vfs_ops_t tmpfs_vfs_ops = {
+    .open       = tmpfs_vfs_open,
+    .close      = tmpfs_vfs_close,
+    .read       = tmpfs_vfs_read,
+    .write      = tmpfs_vfs_write,
+    .truncate   = tmpfs_vfs_truncate,
+    .sync       = tmpfs_vfs_sync,
+    .readahead  = NULL,     /* Already in memory */
+    .readdir    = tmpfs_vfs_readdir,
+    .finddir    = tmpfs_vfs_finddir,
+    .mkdir      = tmpfs_vfs_mkdir,
+    .rmdir      = tmpfs_vfs_rmdir,
+    .create     = tmpfs_vfs_create,
+    .unlink     = tmpfs_vfs_unlink,
+    .rename     = tmpfs_vfs_rename,
+    .stat       = tmpfs_vfs_stat,
+    .chmod      = tmpfs_vfs_chmod,
+    .chown      = tmpfs_vfs_chown,
+    .release    = tmpfs_vfs_release,
+    .mount      = tmpfs_vfs_mount,
+    .unmount    = tmpfs_vfs_unmount,
+    .sync_fs    = tmpfs_vfs_sync_fs,
+    .statfs     = tmpfs_vfs_statfs
+};
+
+/* Object cache for nodes, created by tmpfs_init() */
+static kmem_cache_t *tmpfs_node_cache = NULL;
+
+/*============================================================================
+ * String/Memory Utility Functions
+ *============================================================================*/
+
+static size_t tmpfs_strlen(const char *s) {
+    size_t len = 0;
+    while (*s++) len++;
+    return len;
+}
+
+static int tmpfs_strcmp(const char *s1, const char *s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+/*============================================================================
+ * Locking and Helpers
+ *============================================================================*/
+
+static inline void tmpfs_lock(tmpfs_fs_t *fs) {
+    while (__sync_lock_test_and_set(&fs->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void tmpfs_unlock(tmpfs_fs_t *fs) {
+    __sync_lock_release(&fs->lock);
+}
+
+static inline tmpfs_fs_t* tmpfs_fs_of(vfs_node_t *node) {
+    return (node && node->mount) ? (tmpfs_fs_t *)node->mount->fs_data : NULL;
+}
+
+/**
+ * Current time in seconds, 0 before the clock runs
+ */
+static uint64_t tmpfs_now(void) {
+    return clock_ready() ? clock_realtime_ns() / 1000000000ULL : 0;
+}
+
+/**
+ * Touch every page of a buffer so copying into or out of it cannot fault
+ * @param write Fault the pages in writable (for a read's destination)
+ */
+static void tmpfs_prefault(const void *buf, size_t len, bool write) {
+    if (!len) {
+        return;
+    }
+    uintptr_t va = (uintptr_t)buf & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t end = (uintptr_t)buf + len;
+    for (; va < end; va += PAGE_SIZE) {
+        volatile uint8_t *touch = (volatile uint8_t *)MAX(va, (uintptr_t)buf);
+        if (write) {
+            *touch = *touch;
+        } else {
+            (void)*touch;
+        }
+    }
+}
+
+/**
+ * Check a new entry's name
+ * @return VFS_OK or negative error code
+ */
+static int tmpfs_check_name(const char *name) {
+    size_t len = tmpfs_strlen(name);
+    if (len == 0 || tmpfs_strcmp(name, ".") == 0 || tmpfs_strcmp(name, "..") == 0) {
+        return VFS_ERR_INVAL;
+    }
+    if (len > VFS_NAME_MAX) {
+        return VFS_ERR_NAMETOOLONG;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '/') {
+            return VFS_ERR_INVAL;
+        }
+    }
+    return VFS_OK;
+}
+
+/*============================================================================
+ * File Pages
+ *============================================================================*/
+
+static inline uint8_t* tmpfs_page_data(physaddr_t frame) {
+    return (uint8_t *)(frame + VMM_KERNEL_PHYS_MAP);
+}
+
+/**
+ * Read bytes that have no frame: backing contents, or zeros past them
+ */
+static void tmpfs_read_hole(tmpfs_node_t *node, uint64_t pos, uint8_t *dest, size_t n) {
+    size_t from_backing = 0;
+    if (node->backing && pos < node->backing_size) {
+        from_backing = (size_t)MIN((uint64_t)n, node->backing_size - pos);
+        memcpy(dest, node->backing + pos, from_backing);
+    }
+    memset(dest + from_backing, 0, n - from_backing);
+}
+
+/**
+ * Make room in a file's page index for pages [0, count)
+ * @return VFS_OK or negative error code
+ */
+static int tmpfs_reserve_slots(tmpfs_node_t *node, uint64_t count) {
+    if (count <= node->page_slots) {
+        return VFS_OK;
+    }
+    if (count > TMPFS_MAX_FILE_PAGES) {
+        return VFS_ERR_FBIG;
+    }
+
+    uint64_t slots = node->page_slots ? node->page_slots : 8;
+    while (slots < count) {
+        slots *= 2;
+    }
+    slots = MIN(slots, TMPFS_MAX_FILE_PAGES);
+
+    physaddr_t *pages = krealloc(node->pages, slots * sizeof(physaddr_t));
+    if (!pages) {
+        return VFS_ERR_NOMEM;
+    }
+    memset(pages + node->page_slots, 0,
+                 (slots - node->page_slots) * sizeof(physaddr_t));
+    node->pages = pages;
+    node->page_slots = slots;
+    return VFS_OK;
+}
+
+/**
+ * Get the frame behind a file page, allocating a zeroed one for a hole
+ * @return Frame, or 0 with *error set
+ */
+static physaddr_t tmpfs_get_page(tmpfs_fs_t *fs, tmpfs_node_t *node, uint64_t index,
+                                 int *error) {
+    int result = tmpfs_reserve_slots(node, index + 1);
+    if (result != VFS_OK) {
+        *error = result;
+        return 0;
+    }
+    if (node->pages[index]) {
+        return node->pages[index];
+    }
+
+    if (fs->max_pages && fs->pages >= fs->max_pages) {
+        *error = VFS_ERR_NOSPC;
+        return 0;
+    }
+    physaddr_t frame = pmm_alloc_page();
+    if (!frame) {
+        *error = VFS_ERR_NOMEM;
+        return 0;
+    }
+    tmpfs_read_hole(node, index * PAGE_SIZE, tmpfs_page_data(frame), PAGE_SIZE);
+
+    node->pages[index] = frame;
+    node->page_count++;
+    fs->pages++;
+    return frame;
+}
+
+/**
+ * Cut a file's contents to size bytes
+ * Whole pages past the end go back to the PMM and backing memory past it
+ * is forgotten; the tail of a partial last page is zeroed, so growing the
+ * file again reads zeros there.
+ */
+static void tmpfs_drop_pages(tmpfs_fs_t *fs, tmpfs_node_t *node, uint64_t size) {
+    uint64_t keep = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    node->backing_size = MIN(node->backing_size, size);
+    if (!node->backing_size) {
+        node->backing = NULL;
+    }
+
+    for (uint64_t i = keep; i < node->page_slots; i++) {
+        if (node->pages[i]) {
+            pmm_free_page(node->pages[i]);
+            node->pages[i] = 0;
+            node->page_count--;
+            fs->pages--;
+        }
+    }
+
+    if (size % PAGE_SIZE && keep <= node->page_slots && node->pages[keep - 1]) {
+        size_t tail = size % PAGE_SIZE;
+        memset(tmpfs_page_data(node->pages[keep - 1]) + tail, 0, PAGE_SIZE - tail);
+    }
+
+    if (!keep && node->pages) {
+        kfree(node->pages);
+        node->pages = NULL;
+        node->page_slots = 0;
+    }
+}
+
+/*============================================================================
+ * Nodes
+ *============================================================================*/
+
+static tmpfs_node_t* tmpfs_node_alloc(tmpfs_fs_t *fs, vfs_node_type_t type,
+                                      const char *name, uint32_t permissions) {
+    if (fs->max_nodes && fs->nodes >= fs->max_nodes) {
+        return NULL;
+    }
+
+    tmpfs_node_t *node = kmem_cache_zalloc(tmpfs_node_cache);
+    if (!node) {
+        return NULL;
+    }
+
+    size_t len = MIN(tmpfs_strlen(name), (size_t)VFS_NAME_MAX);
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    node->type = type;
+    node->ino = fs->next_ino++;
+    node->permissions = permissions;
+    node->atime = node->mtime = node->ctime = tmpfs_now();
+
+    fs->nodes++;
+    return node;
+}
+
+static void tmpfs_node_free(tmpfs_fs_t *fs, tmpfs_node_t *node) {
+    tmpfs_drop_pages(fs, node, 0);
+    fs->nodes--;
+    kmem_cache_free(tmpfs_node_cache, node);
+}
+
+static tmpfs_node_t* tmpfs_child(tmpfs_node_t *dir, const char *name, tmpfs_node_t **prev) {
+    tmpfs_node_t *p = NULL;
+    for (tmpfs_node_t *c = dir->children; c; p = c, c = c->next) {
+        if (tmpfs_strcmp(c->name, name) == 0) {
+            if (prev) {
+                *prev = p;
+            }
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void tmpfs_link(tmpfs_node_t *dir, tmpfs_node_t *node) {
+    node->parent = dir;
+    node->next = NULL;
+    if (dir->children_tail) {
+        dir->children_tail->next = node;
+    } else {
+        dir->children = node;
+    }
+    dir->children_tail = node;
+    dir->child_count++;
+    dir->mtime = dir->ctime = tmpfs_now();
+}
+
+static void tmpfs_unlink_child(tmpfs_node_t *dir, tmpfs_node_t *node, tmpfs_node_t *prev) {
+    if (prev) {
+        prev->next = node->next;
+    } else {
+        dir->children = node->next;
+    }
+    if (dir->children_tail == node) {
+        dir->children_tail = prev;
+    }
+    dir->child_count--;
+    dir->rd_next = NULL;    /* Indexes after node moved down one */
+    dir->mtime = dir->ctime = tmpfs_now();
+
+    node->parent = NULL;
+    node->next = NULL;
+}
+
+/**
+ * Get rid of a node that has left the tree
+ * Freed now if nothing refers to it, otherwise when the last VFS node goes.
+ */
+static void tmpfs_retire(tmpfs_fs_t *fs, tmpfs_node_t *node) {
+    if (node->vnodes == 0) {
+        tmpfs_node_free(fs, node);
+        return;
+    }
+    node->next = fs->orphans;
+    fs->orphans = node;
+}
+
+/**
+ * Find a directory's node under the lock
+ * @return Node, or NULL if dir is not a tmpfs directory
+ */
+static tmpfs_node_t* tmpfs_dir_of(vfs_node_t *dir) {
+    if (!dir || dir->type != VFS_NODE_DIRECTORY || !tmpfs_fs_of(dir)) {
+        return NULL;
+    }
+    tmpfs_node_t *node = (tmpfs_node_t *)dir->fs_data;
+    return (node && node->type == VFS_NODE_DIRECTORY) ? node : NULL;
+}
+
+/**
+ * Fill a VFS node from a tmpfs node and count the reference
+ */
+static void tmpfs_fill_vnode(vfs_node_t *vnode, tmpfs_node_t *node, vfs_mount_t *mount) {
+    size_t len = tmpfs_strlen(node->name);
+    memcpy(vnode->name, node->name, len + 1);
+    vnode->type = node->type;
+    vnode->permissions = node->permissions;
+    vnode->uid = node->uid;
+    vnode->gid = node->gid;
+    vnode->inode = node->ino;
+    vnode->size = node->size;
+    vnode->atime = node->atime;
+    vnode->mtime = node->mtime;
+    vnode->ctime = node->ctime;
+    vnode->nlink = (node->type == VFS_NODE_DIRECTORY) ? 2 : 1;
+    vnode->mount = mount;
+    vnode->fs_data = node;
+    node->vnodes++;
+}
+
+/*============================================================================
+ * Initialization
+ *============================================================================*/
+
+int tmpfs_init(void) {
+    kprintf("[TMPFS] Initializing tmpfs\n");
+
+    if (!tmpfs_node_cache) {
+        tmpfs_node_cache = kmem_cache_create("tmpfs_node", sizeof(tmpfs_node_t), 0, NULL);
+        if (!tmpfs_node_cache) {
+            kprintf("[TMPFS] Failed to create node cache\n");
+            return VFS_ERR_NOMEM;
+        }
+    }
+
+    int result = vfs_register_fs("tmpfs", &tmpfs_vfs_ops);
+    if (result != VFS_OK) {
+        kprintf("[TMPFS] Failed to register with VFS: %d\n", result);
+        return result;
+    }
+
+    kprintf("[TMPFS] tmpfs registered successfully\n");
+    return VFS_OK;
+}
+
+/*============================================================================
+ * VFS Integration Callbacks
+ *============================================================================*/
+
+static int tmpfs_vfs_open(vfs_node_t *node, int flags) {
+    UNUSED(flags);
+
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    /* Another VFS node may have changed the size since this one was made */
+    tmpfs_lock(fs);
+    node->size = ((tmpfs_node_t *)node->fs_data)->size;
+    tmpfs_unlock(fs);
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_close(vfs_node_t *node) {
+    if (!node) {
+        return VFS_ERR_INVAL;
+    }
+    node->dirty = false;
+    return VFS_OK;
+}
+
+static ssize_t tmpfs_vfs_read(vfs_node_t *node, void *buf, size_t size, uint64_t offset) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !buf || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *file = (tmpfs_node_t *)node->fs_data;
+    if (file->type == VFS_NODE_DIRECTORY) {
+        return VFS_ERR_ISDIR;
+    }
+
+    tmpfs_prefault(buf, size, true);
+    tmpfs_lock(fs);
+
+    if (offset >= file->size) {
+        tmpfs_unlock(fs);
+        return 0;
+    }
+    size = (size_t)MIN((uint64_t)size, file->size - offset);
+
+    uint8_t *dest = (uint8_t *)buf;
+    size_t done = 0;
+    while (done < size) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        size_t in_page = (offset + done) % PAGE_SIZE;
+        size_t n = MIN(size - done, PAGE_SIZE - in_page);
+
+        physaddr_t frame = index < file->page_slots ? file->pages[index] : 0;
+        if (frame) {
+            memcpy(dest + done, tmpfs_page_data(frame) + in_page, n);
+        } else {
+            tmpfs_read_hole(file, offset + done, dest + done, n);
+        }
+        done += n;
+    }
+    file->atime = tmpfs_now();
+
+    tmpfs_unlock(fs);
+    return (ssize_t)done;
+}
+
+static ssize_t tmpfs_vfs_write(vfs_node_t *node, const void *buf, size_t size,
+                               uint64_t offset) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !buf || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *file = (tmpfs_node_t *)node->fs_data;
+    if (file->type == VFS_NODE_DIRECTORY) {
+        return VFS_ERR_ISDIR;
+    }
+    if (offset + size < offset) {
+        return VFS_ERR_FBIG;
+    }
+
+    tmpfs_prefault(buf, size, false);
+    tmpfs_lock(fs);
+
+    const uint8_t *src = (const uint8_t *)buf;
+    size_t done = 0;
+    int error = VFS_OK;
+    while (done < size) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        size_t in_page = (offset + done) % PAGE_SIZE;
+        size_t n = MIN(size - done, PAGE_SIZE - in_page);
+
+        physaddr_t frame = tmpfs_get_page(fs, file, index, &error);
+        if (!frame) {
+            break;
+        }
+        memcpy(tmpfs_page_data(frame) + in_page, src + done, n);
+        done += n;
+    }
+
+    if (done) {
+        file->size = MAX(file->size, offset + done);
+        file->mtime = file->ctime = tmpfs_now();
+        node->size = file->size;
+    }
+
+    tmpfs_unlock(fs);
+    return done ? (ssize_t)done : error;
+}
+
+static int tmpfs_vfs_truncate(vfs_node_t *node, uint64_t size) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *file = (tmpfs_node_t *)node->fs_data;
+    if (file->type == VFS_NODE_DIRECTORY) {
+        return VFS_ERR_ISDIR;
+    }
+    if ((size + PAGE_SIZE - 1) / PAGE_SIZE > TMPFS_MAX_FILE_PAGES) {
+        return VFS_ERR_FBIG;
+    }
+
+    tmpfs_lock(fs);
+    /* Growing leaves a hole; shrinking gives the pages back */
+    if (size < file->size) {
+        tmpfs_drop_pages(fs, file, size);
+    }
+    file->size = size;
+    file->mtime = file->ctime = tmpfs_now();
+    node->size = size;
+    tmpfs_unlock(fs);
+
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_sync(vfs_node_t *node) {
+    if (!node) {
+        return VFS_ERR_INVAL;
+    }
+    /* Nothing to write back */
+    node->dirty = false;
+    return VFS_OK;
+}
+
+static vfs_dirent_t* tmpfs_vfs_readdir(vfs_node_t *dir, uint32_t index) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(dir);
+    tmpfs_node_t *node = tmpfs_dir_of(dir);
+    if (!node) {
+        return NULL;
+    }
+
+    tmpfs_lock(fs);
+
+    /* Continue from the cursor, or count from the start after a seek */
+    tmpfs_node_t *child;
+    if (node->rd_next && index == node->rd_index) {
+        child = node->rd_next;
+    } else {
+        child = node->children;
+        for (uint32_t i = 0; child && i < index; i++) {
+            child = child->next;
+        }
+    }
+
+    if (!child) {
+        node->rd_next = NULL;
+        tmpfs_unlock(fs);
+        return NULL;
+    }
+    node->rd_index = index + 1;
+    node->rd_next = child->next;
+
+    vfs_dirent_t *dirent = &fs->dirent;
+    dirent->d_ino = child->ino;
+    dirent->d_type = child->type;
+    memcpy(dirent->d_name, child->name, tmpfs_strlen(child->name) + 1);
+
+    tmpfs_unlock(fs);
+    return dirent;
+}
+
+static vfs_node_t* tmpfs_vfs_finddir(vfs_node_t *dir, const char *name) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(dir);
+    tmpfs_node_t *node = tmpfs_dir_of(dir);
+    if (!node || !name) {
+        return NULL;
+    }
+
+    vfs_node_t *vnode = vfs_alloc_node();
+    if (!vnode) {
+        return NULL;
+    }
+
+    tmpfs_lock(fs);
+    tmpfs_node_t *child = tmpfs_child(node, name, NULL);
+    if (child) {
+        tmpfs_fill_vnode(vnode, child, dir->mount);
+        vnode->parent = dir;
+    }
+    tmpfs_unlock(fs);
+
+    if (!child) {
+        vfs_free_node(vnode);
+        return NULL;
+    }
+    return vnode;
+}
+
+/**
+ * Add an empty file or directory to a directory
+ */
+static int tmpfs_add(vfs_node_t *parent, const char *name, vfs_node_type_t type,
+                     uint32_t permissions) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(parent);
+    tmpfs_node_t *dir = tmpfs_dir_of(parent);
+    if (!dir || !name) {
+        return VFS_ERR_INVAL;
+    }
+
+    int result = tmpfs_check_name(name);
+    if (result != VFS_OK) {
+        return result;
+    }
+
+    tmpfs_lock(fs);
+    if (tmpfs_child(dir, name, NULL)) {
+        tmpfs_unlock(fs);
+        return VFS_ERR_EXIST;
+    }
+
+    tmpfs_node_t *node = tmpfs_node_alloc(fs, type, name, permissions);
+    if (!node) {
+        bool full = fs->max_nodes && fs->nodes >= fs->max_nodes;
+        tmpfs_unlock(fs);
+        return full ? VFS_ERR_NOSPC : VFS_ERR_NOMEM;
+    }
+    node->uid = parent->uid;
+    node->gid = parent->gid;
+    tmpfs_link(dir, node);
+    tmpfs_unlock(fs);
+
+    return VFS_OK;
+}
+
+/**
+ * Take a name out of a directory
+ * @param want_dir Remove a directory (which must be empty) rather than a file
+ */
+static int tmpfs_remove(vfs_node_t *parent, const char *name, bool want_dir) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(parent);
+    tmpfs_node_t *dir = tmpfs_dir_of(parent);
+    if (!dir || !name) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_lock(fs);
+    tmpfs_node_t *prev = NULL;
+    tmpfs_node_t *node = tmpfs_child(dir, name, &prev);
+    int result = VFS_OK;
+    if (!node) {
+        result = VFS_ERR_NOENT;
+    } else if (want_dir && node->type != VFS_NODE_DIRECTORY) {
+        result = VFS_ERR_NOTDIR;
+    } else if (!want_dir && node->type == VFS_NODE_DIRECTORY) {
+        result = VFS_ERR_ISDIR;
+    } else if (node->children) {
+        result = VFS_ERR_NOTEMPTY;
+    }
+
+    if (result == VFS_OK) {
+        tmpfs_unlink_child(dir, node, prev);
+        tmpfs_retire(fs, node);
+    }
+    tmpfs_unlock(fs);
+
+    return result;
+}
+
+static int tmpfs_vfs_mkdir(vfs_node_t *parent, const char *name, uint32_t permissions) {
+    return tmpfs_add(parent, name, VFS_NODE_DIRECTORY, permissions);
+}
+
+static int tmpfs_vfs_rmdir(vfs_node_t *parent, const char *name) {
+    return tmpfs_remove(parent, name, true);
+}
+
+static int tmpfs_vfs_create(vfs_node_t *parent, const char *name, uint32_t permissions) {
+    return tmpfs_add(parent, name, VFS_NODE_FILE, permissions);
+}
+
+static int tmpfs_vfs_unlink(vfs_node_t *parent, const char *name) {
+    return tmpfs_remove(parent, name, false);
+}
+
+static int tmpfs_vfs_rename(vfs_node_t *old_parent, const char *old_name,
+                            vfs_node_t *new_parent, const char *new_name) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(old_parent);
+    tmpfs_node_t *from = tmpfs_dir_of(old_parent);
+    tmpfs_node_t *to = tmpfs_dir_of(new_parent);
+    if (!from || !to || !old_name || !new_name || tmpfs_fs_of(new_parent) != fs) {
+        return VFS_ERR_INVAL;
+    }
+
+    int result = tmpfs_check_name(new_name);
+    if (result != VFS_OK) {
+        return result;
+    }
+
+    tmpfs_lock(fs);
+
+    tmpfs_node_t *prev = NULL;
+    tmpfs_node_t *node = tmpfs_child(from, old_name, &prev);
+    if (!node) {
+        tmpfs_unlock(fs);
+        return VFS_ERR_NOENT;
+    }
+
+    /* A directory cannot move into its own subtree */
+    if (node->type == VFS_NODE_DIRECTORY) {
+        for (tmpfs_node_t *p = to; p; p = p->parent) {
+            if (p == node) {
+                tmpfs_unlock(fs);
+                return VFS_ERR_INVAL;
+            }
+        }
+    }
+
+    /* An existing target of the same kind is replaced */
+    tmpfs_node_t *target_prev = NULL;
+    tmpfs_node_t *target = tmpfs_child(to, new_name, &target_prev);
+    if (target == node) {
+        tmpfs_unlock(fs);
+        return VFS_OK;
+    }
+    if (target) {
+        if (target->type == VFS_NODE_DIRECTORY && node->type != VFS_NODE_DIRECTORY) {
+            result = VFS_ERR_ISDIR;
+        } else if (target->type != VFS_NODE_DIRECTORY && node->type == VFS_NODE_DIRECTORY) {
+            result = VFS_ERR_NOTDIR;
+        } else if (target->children) {
+            result = VFS_ERR_NOTEMPTY;
+        }
+        if (result != VFS_OK) {
+            tmpfs_unlock(fs);
+            return result;
+        }
+        tmpfs_unlink_child(to, target, target_prev);
+        tmpfs_retire(fs, target);
+        /* The target may have sat just before the node */
+        tmpfs_child(from, old_name, &prev);
+    }
+
+    tmpfs_unlink_child(from, node, prev);
+    size_t len = tmpfs_strlen(new_name);
+    memcpy(node->name, new_name, len + 1);
+    node->ctime = tmpfs_now();
+    tmpfs_link(to, node);
+
+    tmpfs_unlock(fs);
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_stat(vfs_node_t *node, vfs_stat_t *stat) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !stat || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *tn = (tmpfs_node_t *)node->fs_data;
+
+    tmpfs_lock(fs);
+    stat->st_ino = tn->ino;
+    stat->st_mode = tn->permissions;
+    stat->st_nlink = (tn->type == VFS_NODE_DIRECTORY) ? 2 : (tn->parent || tn == fs->root);
+    stat->st_uid = tn->uid;
+    stat->st_gid = tn->gid;
+    stat->st_size = tn->size;
+    stat->st_blksize = PAGE_SIZE;
+    stat->st_blocks = tn->page_count * (PAGE_SIZE / 512);
+    stat->st_atime = tn->atime;
+    stat->st_mtime = tn->mtime;
+    stat->st_ctime = tn->ctime;
+    stat->st_type = tn->type;
+    tmpfs_unlock(fs);
+
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_chmod(vfs_node_t *node, uint32_t mode) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *tn = (tmpfs_node_t *)node->fs_data;
+    tmpfs_lock(fs);
+    tn->permissions = mode & 0777;
+    tn->ctime = tmpfs_now();
+    node->permissions = tn->permissions;
+    tmpfs_unlock(fs);
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_chown(vfs_node_t *node, uint32_t uid, uint32_t gid) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !node->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_node_t *tn = (tmpfs_node_t *)node->fs_data;
+    tmpfs_lock(fs);
+    tn->uid = node->uid = uid;
+    tn->gid = node->gid = gid;
+    tn->ctime = tmpfs_now();
+    tmpfs_unlock(fs);
+    return VFS_OK;
+}
+
+static void tmpfs_vfs_release(vfs_node_t *node) {
+    tmpfs_fs_t *fs = tmpfs_fs_of(node);
+    if (!fs || !node->fs_data) {
+        return;
+    }
+
+    tmpfs_node_t *tn = (tmpfs_node_t *)node->fs_data;
+    node->fs_data = NULL;
+
+    tmpfs_lock(fs);
+    if (tn->vnodes > 0) {
+        tn->vnodes--;
+    }
+    if (tn->vnodes == 0 && !tn->parent && tn != fs->root) {
+        /* The last reference to an unlinked node */
+        tmpfs_node_t **link = &fs->orphans;
+        while (*link && *link != tn) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            *link = tn->next;
+            tmpfs_node_free(fs, tn);
+        }
+    }
+    tmpfs_unlock(fs);
+}
+
+static int tmpfs_vfs_mount(vfs_mount_t *mount, void *device) {
+    if (!mount) {
+        return VFS_ERR_INVAL;
+    }
+
+    kprintf("[TMPFS] Mounting at %s\n", mount->path);
+
+    tmpfs_fs_t *fs = kcalloc(1, sizeof(tmpfs_fs_t));
+    if (!fs) {
+        return VFS_ERR_NOMEM;
+    }
+    fs->next_ino = 1;
+
+    /* Options are optional: no device means no limits */
+    if (device) {
+        const tmpfs_options_t *options = (const tmpfs_options_t *)device;
+        fs->max_pages = (options->max_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+        fs->max_nodes = options->max_nodes;
+    }
+
+    fs->root = tmpfs_node_alloc(fs, VFS_NODE_DIRECTORY, "/",
+                                VFS_S_IRUSR | VFS_S_IWUSR | VFS_S_IXUSR |
+                                VFS_S_IRGRP | VFS_S_IWGRP | VFS_S_IXGRP |
+                                VFS_S_IROTH | VFS_S_IWOTH | VFS_S_IXOTH);
+    vfs_node_t *root = fs->root ? vfs_alloc_node() : NULL;
+    if (!root) {
+        if (fs->root) {
+            tmpfs_node_free(fs, fs->root);
+        }
+        kfree(fs);
+        return VFS_ERR_NOMEM;
+    }
+
+    tmpfs_fill_vnode(root, fs->root, mount);
+    mount->fs_data = fs;
+    mount->root = root;
+    fs->vfs_mount = mount;
+
+    kprintf("[TMPFS] Mounted at %s (limit %lu pages, %lu nodes)\n",
+            mount->path, fs->max_pages, fs->max_nodes);
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_unmount(vfs_mount_t *mount) {
+    if (!mount || !mount->fs_data) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_fs_t *fs = (tmpfs_fs_t *)mount->fs_data;
+
+    /* Free the tree bottom-up without recursing */
+    tmpfs_node_t *node = fs->root;
+    while (node) {
+        if (node->children) {
+            node = node->children;
+            continue;
+        }
+        tmpfs_node_t *parent = node->parent;
+        if (parent) {
+            parent->children = node->next;
+        }
+        tmpfs_node_free(fs, node);
+        node = parent;
+    }
+
+    while (fs->orphans) {
+        tmpfs_node_t *next = fs->orphans->next;
+        tmpfs_node_free(fs, fs->orphans);
+        fs->orphans = next;
+    }
+
+    if (mount->root) {
+        vfs_free_node(mount->root);
+        mount->root = NULL;
+    }
+    mount->fs_data = NULL;
+    kfree(fs);
+
+    kprintf("[TMPFS] Unmounted %s\n", mount->path);
+    return VFS_OK;
+}
+
+static int tmpfs_vfs_sync_fs(vfs_mount_t *mount) {
+    return mount ? VFS_OK : VFS_ERR_INVAL;
+}
+
+static int tmpfs_vfs_statfs(vfs_mount_t *mount, void *buf) {
+    if (!mount || !mount->fs_data || !buf) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_fs_t *fs = (tmpfs_fs_t *)mount->fs_data;
+    tmpfs_statfs_t *st = (tmpfs_statfs_t *)buf;
+
+    tmpfs_lock(fs);
+    st->block_size = PAGE_SIZE;
+    st->blocks = fs->max_pages;
+    st->blocks_used = fs->pages;
+    st->nodes = fs->max_nodes;
+    st->nodes_used = fs->nodes;
+    tmpfs_unlock(fs);
+
+    return VFS_OK;
+}
+
+int tmpfs_attach(vfs_node_t *node, const void *data, uint64_t size) {
+    if (!node || !node->mount || node->mount->ops != &tmpfs_vfs_ops || (!data && size)) {
+        return VFS_ERR_INVAL;
+    }
+
+    tmpfs_fs_t *fs = (tmpfs_fs_t *)node->mount->fs_data;
+    tmpfs_node_t *file = (tmpfs_node_t *)node->fs_data;
+    if (!fs || !file || file->type != VFS_NODE_FILE) {
+        return VFS_ERR_INVAL;
+    }
+    if ((size + PAGE_SIZE - 1) / PAGE_SIZE > TMPFS_MAX_FILE_PAGES) {
+        return VFS_ERR_FBIG;
+    }
+
+    tmpfs_lock(fs);
+    if (file->size || file->page_count) {
+        tmpfs_unlock(fs);
+        return VFS_ERR_BUSY;
+    }
+    file->backing = (const uint8_t *)data;
+    file->backing_size = size;
+    file->size = size;
+    node->size = size;
+    tmpfs_unlock(fs);
+
+    return VFS_OK;
+}
+
+void tmpfs_dump_stats(vfs_mount_t *mount) {
+    tmpfs_statfs_t st;
+    if (tmpfs_vfs_statfs(mount, &st) != VFS_OK) {
+        return;
+    }
+
+    kprintf("[TMPFS] %s usage:\n", mount->path);
+    kprintf("[TMPFS]   Pages: %lu of %lu\n", st.blocks_used, st.blocks);
+    kprintf("[TMPFS]   Nodes: %lu of %lu\n", st.nodes_used, st.nodes);
+}
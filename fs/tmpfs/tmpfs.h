@@ -0,0 +1,120 @@
+/**
+ * AAAos tmpfs - In-Memory Filesystem
+ *
+ * A filesystem that lives entirely in RAM, for scratch data that never
+ * needs to reach a disk. Nodes come from a slab cache and file contents
+ * are kept in whole PMM pages indexed by file page, reached through the
+ * kernel's direct physical mapping; pages that were never written are
+ * holes and read as zeros. Nothing is ever written to a device, so reads
+ * and writes run at memory speed and sync is a no-op.
+ *
+ * Mounted with vfs_mount(path, "tmpfs", options), where options is a
+ * tmpfs_options_t giving optional size limits, or NULL for none. All of
+ * a mount's memory is released when it is unmounted. A node that is
+ * unlinked while the VFS still refers to it (an open file, say) lives on
+ * until the last reference is released.
+ *
+ * A file can also be given read-only backing memory (tmpfs_attach), such
+ * as a boot archive: its pages are read straight from that memory and
+ * only copied into frames of their own when they are written.
+ */
+
+#ifndef _AAAOS_FS_TMPFS_H
+#define _AAAOS_FS_TMPFS_H
+
+#include "../../kernel/include/types.h"
+#include "../vfs/vfs.h"
+
+/* Largest file, in pages (bounds the page index) */
+#define TMPFS_MAX_FILE_PAGES    (1ULL << 26)    /* 256GB */
+
+/**
+ * Mount options
+ */
+typedef struct tmpfs_options {
+    uint64_t max_bytes;                 /* File data limit, 0 for no limit */
+    uint64_t max_nodes;                 /* File and directory limit, 0 for no limit */
+} tmpfs_options_t;
+
+/**
+ * Filesystem node (file or directory)
+ */
+typedef struct tmpfs_node {
+    char name[VFS_NAME_MAX + 1];
+    vfs_node_type_t type;
+    uint64_t ino;
+    uint32_t permissions;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;                      /* Bytes, for files */
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+
+    struct tmpfs_node *parent;          /* NULL for the root and unlinked nodes */
+    struct tmpfs_node *next;            /* Sibling in the parent's list, or next orphan */
+    uint32_t vnodes;                    /* VFS nodes referring to this node */
+
+    /* Directories */
+    struct tmpfs_node *children;        /* Oldest first, so readdir indexes stay put */
+    struct tmpfs_node *children_tail;
+    uint32_t child_count;
+    uint32_t rd_index;                  /* readdir cursor: index of rd_next */
+    struct tmpfs_node *rd_next;
+
+    /* Files */
+    physaddr_t *pages;                  /* Frame of each file page, 0 for a hole */
+    uint64_t page_slots;                /* Length of pages */
+    uint64_t page_count;                /* Frames held */
+    const uint8_t *backing;             /* Read-only contents behind the holes, or NULL */
+    uint64_t backing_size;
+} tmpfs_node_t;
+
+/**
+ * Mounted tmpfs instance
+ */
+typedef struct tmpfs_fs {
+    tmpfs_node_t *root;
+    tmpfs_node_t *orphans;              /* Unlinked, still referred to by VFS nodes */
+    vfs_mount_t *vfs_mount;
+    uint64_t max_pages;                 /* 0 for no limit */
+    uint64_t max_nodes;                 /* 0 for no limit */
+    uint64_t pages;                     /* Data frames in use */
+    uint64_t nodes;                     /* Nodes in use, unlinked ones included */
+    uint64_t next_ino;
+    vfs_dirent_t dirent;                /* Returned by readdir */
+    volatile int lock;
+} tmpfs_fs_t;
+
+/**
+ * Usage of a mount (the statfs buffer)
+ */
+typedef struct tmpfs_statfs {
+    uint64_t block_size;                /* PAGE_SIZE */
+    uint64_t blocks;                    /* Page limit, 0 for no limit */
+    uint64_t blocks_used;
+    uint64_t nodes;                     /* Node limit, 0 for no limit */
+    uint64_t nodes_used;
+} tmpfs_statfs_t;
+
+/**
+ * Register tmpfs with the VFS
+ * @return VFS_OK on success, error code on failure
+ */
+int tmpfs_init(void);
+
+/**
+ * Give an empty tmpfs file existing contents without copying them
+ * Reads come from data until a page is written, which copies that page.
+ * @param node File on a tmpfs mount, with size 0
+ * @param data Memory that stays valid and unchanged for the file's lifetime
+ * @return VFS_OK on success, error code on failure
+ */
+int tmpfs_attach(vfs_node_t *node, const void *data, uint64_t size);
+
+/**
+ * Print a mount's usage (for debugging)
+ */
+void tmpfs_dump_stats(vfs_mount_t *mount);
+
+#endif /* _AAAOS_FS_TMPFS_H */
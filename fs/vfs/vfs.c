@@ -7,68 +7,17 @@
 
 #include "vfs.h"
 #include "../../kernel/include/serial.h"
-
-/*============================================================================
- * String utility functions (minimal implementations for kernel use)
- *============================================================================*/
-
-static size_t vfs_strlen(const char *s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
-}
-
-static int vfs_strcmp(const char *s1, const char *s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
-static int vfs_strncmp(const char *s1, const char *s2, size_t n) {
-    while (n && *s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-        n--;
-    }
-    if (n == 0) return 0;
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
-static char* vfs_strcpy(char *dest, const char *src) {
-    char *d = dest;
-    while ((*d++ = *src++));
-    return dest;
-}
-
-static char* vfs_strncpy(char *dest, const char *src, size_t n) {
-    size_t i;
-    for (i = 0; i < n && src[i]; i++) {
-        dest[i] = src[i];
-    }
-    for (; i < n; i++) {
-        dest[i] = '\0';
-    }
-    return dest;
-}
-
-static void* vfs_memset(void *s, int c, size_t n) {
-    unsigned char *p = s;
-    while (n--) {
-        *p++ = (unsigned char)c;
-    }
-    return s;
-}
-
-static void* vfs_memcpy(void *dest, const void *src, size_t n) {
-    unsigned char *d = dest;
-    const unsigned char *s = src;
-    while (n--) {
-        *d++ = *s++;
-    }
-    return dest;
-}
+#include "../../kernel/mm/slab.h"
+#include "../../kernel/mm/arena.h"
+#include "../../kernel/mm/reclaim.h"
+#include "../../kernel/proc/fdtable.h"
+#include "../../kernel/sched/rcu.h"
+#include "../../kernel/sched/spinlock.h"
+#include "../bcache/bcache.h"
+#include "../../lib/libc/string.h"
+
+/* Stack seed for per-call path arenas; typical paths never spill */
+#define VFS_ARENA_SEED      512
 
 /*============================================================================
  * Global VFS state
@@ -84,6 +33,11 @@ static uint32_t vfs_mount_count = 0;
 /* Array of open files */
 static vfs_file_t vfs_open_files[VFS_MAX_OPEN_FILES];
 
+/* Bit set for each open file slot in use; no clear bit below word hint */
+_Static_assert(VFS_MAX_OPEN_FILES % 64 == 0, "vfs_file_map covers whole words");
+static uint64_t vfs_file_map[VFS_MAX_OPEN_FILES / 64];
+static uint32_t vfs_file_hint = 0;
+
 /* Array of open directories */
 #define VFS_MAX_OPEN_DIRS 256
 static vfs_dir_t vfs_open_dirs[VFS_MAX_OPEN_DIRS];
@@ -143,29 +97,38 @@ const char* vfs_strerror(int error) {
 
 /**
  * Normalize a path by removing . and .. components
- * Returns static buffer - not thread-safe
+ * The result and its temporaries live in the caller's arena.
  */
-static char* vfs_normalize_path(const char *path) {
-    static char normalized[VFS_PATH_MAX];
-    char *components[VFS_PATH_MAX / 2];
+static char* vfs_normalize_path(karena_t *arena, const char *path) {
+    char *normalized;
+    char **components;
     int depth = 0;
     size_t len;
     size_t i, j;
 
     if (!path || !path[0]) {
+        normalized = karena_alloc(arena, 2);
+        if (!normalized) return NULL;
         normalized[0] = '/';
         normalized[1] = '\0';
         return normalized;
     }
 
-    len = vfs_strlen(path);
+    len = strlen(path);
     if (len >= VFS_PATH_MAX) {
         return NULL;
     }
 
+    /* A path of len bytes has at most len / 2 + 1 components */
+    normalized = karena_alloc(arena, len + 2);
+    components = karena_alloc(arena, (len / 2 + 1) * sizeof(char *));
+
     /* Copy path for tokenization */
-    static char temp[VFS_PATH_MAX];
-    vfs_strcpy(temp, path);
+    char *temp = karena_alloc(arena, len + 1);
+    if (!normalized || !components || !temp) {
+        return NULL;
+    }
+    strcpy(temp, path);
 
     /* Parse path components */
     char *token = temp;
@@ -175,17 +138,17 @@ static char* vfs_normalize_path(const char *path) {
         if (!*token) break;
 
         /* Find end of component */
-        char *end = token;
-        while (*end && *end != '/') end++;
+        char *end = strchr(token, '/');
+        if (!end) end = token + strlen(token);
 
         /* Null-terminate component */
         bool more = (*end != '\0');
         *end = '\0';
 
         /* Process component */
-        if (vfs_strcmp(token, ".") == 0) {
+        if (strcmp(token, ".") == 0) {
             /* Skip . */
-        } else if (vfs_strcmp(token, "..") == 0) {
+        } else if (strcmp(token, "..") == 0) {
             /* Go up one level */
             if (depth > 0) depth--;
         } else {
@@ -201,11 +164,11 @@ static char* vfs_normalize_path(const char *path) {
     normalized[0] = '/';
     j = 1;
     for (i = 0; i < (size_t)depth; i++) {
-        len = vfs_strlen(components[i]);
+        len = strlen(components[i]);
         if (j + len + 1 >= VFS_PATH_MAX) {
             return NULL;
         }
-        vfs_strcpy(&normalized[j], components[i]);
+        strcpy(&normalized[j], components[i]);
         j += len;
         if (i < (size_t)(depth - 1)) {
             normalized[j++] = '/';
@@ -218,22 +181,25 @@ static char* vfs_normalize_path(const char *path) {
 
 /**
  * Get parent directory path
- * Returns static buffer - not thread-safe
+ * The result lives in the caller's arena.
  */
-static char* vfs_parent_path(const char *path) {
-    static char parent[VFS_PATH_MAX];
+static char* vfs_parent_path(karena_t *arena, const char *path) {
+    char *parent;
     size_t len;
 
     if (!path) return NULL;
 
-    len = vfs_strlen(path);
+    len = strlen(path);
+    parent = karena_alloc(arena, len + 2);
+    if (!parent) return NULL;
+
     if (len == 0 || (len == 1 && path[0] == '/')) {
         parent[0] = '/';
         parent[1] = '\0';
         return parent;
     }
 
-    vfs_strcpy(parent, path);
+    strcpy(parent, path);
 
     /* Remove trailing slash */
     if (parent[len - 1] == '/') {
@@ -241,9 +207,8 @@ static char* vfs_parent_path(const char *path) {
     }
 
     /* Find last slash */
-    while (len > 0 && parent[len - 1] != '/') {
-        len--;
-    }
+    const char *slash = memrchr(parent, '/', len);
+    len = slash ? (size_t)(slash - parent) + 1 : 0;
 
     if (len == 0) {
         parent[0] = '/';
@@ -267,7 +232,7 @@ static const char* vfs_basename(const char *path) {
 
     if (!path) return NULL;
 
-    len = vfs_strlen(path);
+    len = strlen(path);
     if (len == 0) return path;
 
     base = path + len - 1;
@@ -276,9 +241,8 @@ static const char* vfs_basename(const char *path) {
     if (*base == '/' && base > path) base--;
 
     /* Find start of basename */
-    while (base > path && *(base - 1) != '/') {
-        base--;
-    }
+    const char *slash = memrchr(path, '/', (size_t)(base - path));
+    base = slash ? slash + 1 : path;
 
     return base;
 }
@@ -299,7 +263,7 @@ int vfs_register_fs(const char *name, vfs_ops_t *ops) {
     /* Check if already registered */
     current = vfs_fs_types;
     while (current) {
-        if (vfs_strcmp(current->name, name) == 0) {
+        if (strcmp(current->name, name) == 0) {
             kprintf("[VFS] register_fs: Filesystem '%s' already registered\n", name);
             return VFS_ERR_EXIST;
         }
@@ -317,8 +281,8 @@ int vfs_register_fs(const char *name, vfs_ops_t *ops) {
     }
 
     fstype = &fstype_pool[fstype_count++];
-    vfs_memset(fstype, 0, sizeof(*fstype));
-    vfs_strncpy(fstype->name, name, sizeof(fstype->name) - 1);
+    memset(fstype, 0, sizeof(*fstype));
+    strncpy(fstype->name, name, sizeof(fstype->name) - 1);
     fstype->ops = ops;
     fstype->next = vfs_fs_types;
     vfs_fs_types = fstype;
@@ -337,7 +301,7 @@ int vfs_unregister_fs(const char *name) {
 
     current = vfs_fs_types;
     while (current) {
-        if (vfs_strcmp(current->name, name) == 0) {
+        if (strcmp(current->name, name) == 0) {
             if (prev) {
                 prev->next = current->next;
             } else {
@@ -361,7 +325,7 @@ static vfs_fstype_t* vfs_find_fstype(const char *name) {
     vfs_fstype_t *current = vfs_fs_types;
 
     while (current) {
-        if (vfs_strcmp(current->name, name) == 0) {
+        if (strcmp(current->name, name) == 0) {
             return current;
         }
         current = current->next;
@@ -374,32 +338,23 @@ static vfs_fstype_t* vfs_find_fstype(const char *name) {
  *============================================================================*/
 
 /* Node pool for allocation */
-#define VFS_NODE_POOL_SIZE 1024
-static vfs_node_t vfs_node_pool[VFS_NODE_POOL_SIZE];
-static bool vfs_node_used[VFS_NODE_POOL_SIZE];
+/* Object cache for VFS nodes, created by vfs_init() */
+static kmem_cache_t *vfs_node_cache = NULL;
 
 vfs_node_t* vfs_alloc_node(void) {
-    for (int i = 0; i < VFS_NODE_POOL_SIZE; i++) {
-        if (!vfs_node_used[i]) {
-            vfs_node_used[i] = true;
-            vfs_memset(&vfs_node_pool[i], 0, sizeof(vfs_node_t));
-            vfs_node_pool[i].ref_count = 1;
-            return &vfs_node_pool[i];
-        }
+    vfs_node_t *node = kmem_cache_zalloc(vfs_node_cache);
+    if (!node) {
+        kprintf("[VFS] alloc_node: Out of nodes\n");
+        return NULL;
     }
-    kprintf("[VFS] alloc_node: Out of nodes\n");
-    return NULL;
+    node->ref_count = 1;
+    return node;
 }
 
 void vfs_free_node(vfs_node_t *node) {
     if (!node) return;
 
-    for (int i = 0; i < VFS_NODE_POOL_SIZE; i++) {
-        if (&vfs_node_pool[i] == node) {
-            vfs_node_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(vfs_node_cache, node);
 }
 
 void vfs_ref_node(vfs_node_t *node) {
@@ -416,45 +371,435 @@ void vfs_unref_node(vfs_node_t *node) {
     }
 
     if (node->ref_count == 0) {
+        vfs_mount_t *mount = node->mount;
+        if (mount && mount->ops && mount->ops->release) {
+            mount->ops->release(node);
+        }
         vfs_free_node(node);
     }
 }
 
+/*============================================================================
+ * Dentry cache
+ *============================================================================*/
+
+/*
+ * Maps (parent node, component name) to the node finddir returned, or to
+ * nothing for a name known not to exist. Each entry holds a reference on
+ * its parent and its node, so the same node is handed out for every
+ * lookup and the parent pointer stays a valid key. Entries are dropped
+ * oldest first once the cache is full or memory runs low, and purged
+ * whenever a directory's contents change underneath them.
+ */
+
+#define VFS_DCACHE_MAX          512     /* Cached entries */
+#define VFS_DCACHE_HASH_SIZE    256     /* Lookup buckets (power of two) */
+#define VFS_DCACHE_NAME_LEN     64      /* Longer names are not cached */
+
+typedef struct vfs_dentry {
+    vfs_node_t          *parent;
+    vfs_node_t          *node;          /* NULL for a negative entry */
+    uint32_t            hash;
+    struct vfs_dentry   *hash_next;
+    struct vfs_dentry   *lru_prev;      /* Most recently used at the head */
+    struct vfs_dentry   *lru_next;
+    char                name[VFS_DCACHE_NAME_LEN];
+} vfs_dentry_t;
+
+static kmem_cache_t *vfs_dentry_cache = NULL;
+static vfs_dentry_t *vfs_dcache_hash[VFS_DCACHE_HASH_SIZE];
+static vfs_dentry_t *vfs_dcache_lru_head = NULL;
+static vfs_dentry_t *vfs_dcache_lru_tail = NULL;
+static uint32_t vfs_dcache_count = 0;
+static volatile int vfs_dcache_lock = 0;
+
+static uint64_t vfs_dcache_hits = 0;
+static uint64_t vfs_dcache_negative_hits = 0;
+static uint64_t vfs_dcache_misses = 0;
+
+static inline void vfs_dcache_acquire(void) {
+    while (__sync_lock_test_and_set(&vfs_dcache_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void vfs_dcache_release(void) {
+    __sync_lock_release(&vfs_dcache_lock);
+}
+
+static uint32_t vfs_dcache_hash_of(vfs_node_t *parent, const char *name) {
+    /* FNV-1a over the name, mixed with the parent */
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash ^ (uint32_t)((uintptr_t)parent >> 4);
+}
+
+static void vfs_dcache_lru_unlink(vfs_dentry_t *d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else vfs_dcache_lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else vfs_dcache_lru_tail = d->lru_prev;
+    d->lru_prev = d->lru_next = NULL;
+}
+
+static void vfs_dcache_lru_push(vfs_dentry_t *d) {
+    d->lru_prev = NULL;
+    d->lru_next = vfs_dcache_lru_head;
+    if (vfs_dcache_lru_head) vfs_dcache_lru_head->lru_prev = d;
+    else vfs_dcache_lru_tail = d;
+    vfs_dcache_lru_head = d;
+}
+
+/**
+ * Unlink and free an entry, dropping its references (lock held)
+ */
+static void vfs_dcache_remove(vfs_dentry_t *d) {
+    vfs_dentry_t **link = &vfs_dcache_hash[d->hash & (VFS_DCACHE_HASH_SIZE - 1)];
+    while (*link && *link != d) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = d->hash_next;
+    }
+    vfs_dcache_lru_unlink(d);
+    vfs_dcache_count--;
+
+    if (d->node) {
+        vfs_unref_node(d->node);
+    }
+    vfs_unref_node(d->parent);
+    kmem_cache_free(vfs_dentry_cache, d);
+}
+
+/**
+ * Look up a component in the cache
+ * @param found Set when the cache knows the answer
+ * @return Referenced node, or NULL (negative entry or not cached)
+ */
+static vfs_node_t* vfs_dcache_lookup(vfs_node_t *parent, const char *name, bool *found) {
+    *found = false;
+    if (!vfs_dentry_cache || strlen(name) >= VFS_DCACHE_NAME_LEN) {
+        return NULL;
+    }
+
+    uint32_t hash = vfs_dcache_hash_of(parent, name);
+    vfs_node_t *node = NULL;
+
+    vfs_dcache_acquire();
+    vfs_dentry_t *d = vfs_dcache_hash[hash & (VFS_DCACHE_HASH_SIZE - 1)];
+    while (d && (d->hash != hash || d->parent != parent || strcmp(d->name, name) != 0)) {
+        d = d->hash_next;
+    }
+    if (d) {
+        *found = true;
+        node = d->node;
+        if (node) {
+            vfs_ref_node(node);
+            vfs_dcache_hits++;
+        } else {
+            vfs_dcache_negative_hits++;
+        }
+        vfs_dcache_lru_unlink(d);
+        vfs_dcache_lru_push(d);
+    } else {
+        vfs_dcache_misses++;
+    }
+    vfs_dcache_release();
+
+    return node;
+}
+
+/**
+ * Remember what finddir returned for a component
+ * @param node Node found, or NULL for one that does not exist
+ */
+static void vfs_dcache_insert(vfs_node_t *parent, const char *name, vfs_node_t *node) {
+    if (!vfs_dentry_cache || strlen(name) >= VFS_DCACHE_NAME_LEN) {
+        return;
+    }
+
+    uint32_t hash = vfs_dcache_hash_of(parent, name);
+
+    vfs_dcache_acquire();
+
+    /* Another lookup may have raced us here */
+    vfs_dentry_t *d = vfs_dcache_hash[hash & (VFS_DCACHE_HASH_SIZE - 1)];
+    while (d && (d->hash != hash || d->parent != parent || strcmp(d->name, name) != 0)) {
+        d = d->hash_next;
+    }
+    if (d) {
+        vfs_dcache_release();
+        return;
+    }
+
+    if (vfs_dcache_count >= VFS_DCACHE_MAX && vfs_dcache_lru_tail) {
+        vfs_dcache_remove(vfs_dcache_lru_tail);
+    }
+
+    d = kmem_cache_zalloc(vfs_dentry_cache);
+    if (!d) {
+        vfs_dcache_release();
+        return;
+    }
+
+    vfs_ref_node(parent);
+    if (node) {
+        vfs_ref_node(node);
+    }
+    d->parent = parent;
+    d->node = node;
+    d->hash = hash;
+    strcpy(d->name, name);
+
+    uint32_t bucket = hash & (VFS_DCACHE_HASH_SIZE - 1);
+    d->hash_next = vfs_dcache_hash[bucket];
+    vfs_dcache_hash[bucket] = d;
+    vfs_dcache_lru_push(d);
+    vfs_dcache_count++;
+
+    vfs_dcache_release();
+}
+
+/**
+ * Drop every entry of a directory whose contents changed
+ * Names are matched the way the filesystem matches them (FAT32 ignores
+ * case), so the whole directory goes rather than one spelling.
+ */
+static void vfs_dcache_purge_dir(vfs_node_t *dir) {
+    vfs_dcache_acquire();
+    vfs_dentry_t *d = vfs_dcache_lru_head;
+    while (d) {
+        vfs_dentry_t *next = d->lru_next;
+        if (d->parent == dir) {
+            vfs_dcache_remove(d);
+        }
+        d = next;
+    }
+    vfs_dcache_release();
+}
+
+/**
+ * Drop every entry on a mount (unmount, and renames or removals that can
+ * orphan a cached subtree)
+ */
+static void vfs_dcache_purge_mount(vfs_mount_t *mount) {
+    vfs_dcache_acquire();
+    vfs_dentry_t *d = vfs_dcache_lru_head;
+    while (d) {
+        vfs_dentry_t *next = d->lru_next;
+        if (d->parent->mount == mount) {
+            vfs_dcache_remove(d);
+        }
+        d = next;
+    }
+    vfs_dcache_release();
+}
+
+/**
+ * Entries the shrinker could drop
+ */
+static size_t vfs_dcache_shrink_count(void) {
+    return vfs_dcache_count;
+}
+
+/**
+ * Drop up to count of the least recently used entries
+ */
+static size_t vfs_dcache_shrink_scan(size_t count) {
+    size_t dropped = 0;
+
+    vfs_dcache_acquire();
+    while (dropped < count && vfs_dcache_lru_tail) {
+        vfs_dcache_remove(vfs_dcache_lru_tail);
+        dropped++;
+    }
+    vfs_dcache_release();
+
+    return dropped;
+}
+
+static shrinker_t vfs_dcache_shrinker = {
+    .name = "fs.vfs.dentry",
+    .count = vfs_dcache_shrink_count,
+    .scan = vfs_dcache_shrink_scan,
+};
+
+void vfs_dcache_dump_stats(void) {
+    vfs_dcache_acquire();
+    uint32_t count = vfs_dcache_count;
+    uint64_t hits = vfs_dcache_hits;
+    uint64_t negative = vfs_dcache_negative_hits;
+    uint64_t misses = vfs_dcache_misses;
+    vfs_dcache_release();
+
+    kprintf("[VFS] Dentry cache: %u/%u entries\n", count, VFS_DCACHE_MAX);
+    kprintf("[VFS]   Hits: %llu (%llu negative), misses: %llu\n", hits, negative, misses);
+}
+
 /*============================================================================
  * Mount management
  *============================================================================*/
 
-vfs_mount_t* vfs_get_mount(const char *path) {
-    char *normalized;
-    size_t best_len = 0;
-    vfs_mount_t *best_mount = NULL;
+/*
+ * Mount points form a trie of path components rooted at "/". Resolving a
+ * path walks it one component at a time and remembers the deepest node
+ * with a mount, so the cost is the path's depth, not the mount count.
+ *
+ * Resolving takes no lock: it walks the trie inside an RCU read-side
+ * section, and pruned nodes are freed only after a grace period. Changes
+ * to the trie take vfs_mount_lock. A node with a mount or unmount in
+ * progress is marked busy, which keeps it from being pruned and from a
+ * second mount or unmount while the filesystem's callback runs unlocked.
+ */
+typedef struct vfs_mount_node {
+    struct vfs_mount_node   *parent;
+    struct vfs_mount_node   *child;     /* First child */
+    struct vfs_mount_node   *sibling;   /* Next child of parent */
+    vfs_mount_t             *mount;     /* Mounted exactly here, or NULL */
+    bool                    busy;       /* Mount or unmount in progress */
+    size_t                  len;
+    char                    name[VFS_NAME_MAX + 1];
+    rcu_head_t              rcu;        /* Deferred free once pruned */
+} vfs_mount_node_t;
+
+static vfs_mount_node_t vfs_mount_trie = { 0 };
+static kmem_cache_t *vfs_mount_node_cache = NULL;
+SPINLOCK_DEFINE(vfs_mount_lock, "fs.vfs.mount");
+
+static vfs_mount_node_t* vfs_mount_child(vfs_mount_node_t *node, const char *name, size_t len) {
+    vfs_mount_node_t *child = rcu_dereference(node->child);
+    while (child && (child->len != len || strncmp(child->name, name, len) != 0)) {
+        child = rcu_dereference(child->sibling);
+    }
+    return child;
+}
 
-    if (!path) return NULL;
+/**
+ * Find the trie node of a normalized mount path (vfs_mount_lock held)
+ * @param create Add missing nodes on the way
+ * @return Node, or NULL if absent (or out of memory)
+ */
+static vfs_mount_node_t* vfs_mount_node_get(const char *normalized, bool create) {
+    vfs_mount_node_t *node = &vfs_mount_trie;
+    const char *p = normalized;
 
-    normalized = vfs_normalize_path(path);
-    if (!normalized) return NULL;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        const char *end = p;
+        while (*end && *end != '/') end++;
+        size_t len = end - p;
+        if (len > VFS_NAME_MAX) {
+            return NULL;
+        }
 
-    /* Find the longest matching mount point */
-    for (uint32_t i = 0; i < vfs_mount_count; i++) {
-        if (!vfs_mounts[i].active) continue;
-
-        size_t mount_len = vfs_strlen(vfs_mounts[i].path);
-
-        /* Check if this mount point is a prefix of the path */
-        if (vfs_strncmp(vfs_mounts[i].path, normalized, mount_len) == 0) {
-            /* Must be exact match or followed by slash */
-            if (normalized[mount_len] == '\0' ||
-                normalized[mount_len] == '/' ||
-                mount_len == 1) {  /* Root mount */
-                if (mount_len > best_len) {
-                    best_len = mount_len;
-                    best_mount = &vfs_mounts[i];
-                }
+        vfs_mount_node_t *child = vfs_mount_child(node, p, len);
+        if (!child) {
+            if (!create || !vfs_mount_node_cache) {
+                return NULL;
+            }
+            child = kmem_cache_zalloc(vfs_mount_node_cache);
+            if (!child) {
+                return NULL;
             }
+            memcpy(child->name, p, len);
+            child->name[len] = '\0';
+            child->len = len;
+            child->parent = node;
+            child->sibling = node->child;
+            rcu_assign_pointer(node->child, child);
+        }
+        node = child;
+        p = end;
+    }
+    return node;
+}
+
+static void vfs_mount_node_free(rcu_head_t *head) {
+    uint8_t *node = (uint8_t *)head - __builtin_offsetof(vfs_mount_node_t, rcu);
+    kmem_cache_free(vfs_mount_node_cache, node);
+}
+
+/**
+ * Free trie nodes left with neither a mount nor children (vfs_mount_lock held)
+ * Readers may still be on them; they go back to the cache after a grace period.
+ */
+static void vfs_mount_node_prune(vfs_mount_node_t *node) {
+    while (node != &vfs_mount_trie && !node->mount && !node->child && !node->busy) {
+        vfs_mount_node_t *parent = node->parent;
+        vfs_mount_node_t **link = &parent->child;
+        while (*link != node) {
+            link = &(*link)->sibling;
+        }
+        rcu_assign_pointer(*link, node->sibling);
+        call_rcu(&node->rcu, vfs_mount_node_free);
+        node = parent;
+    }
+}
+
+/**
+ * End a mount or unmount begun on a node: publish its mount (NULL once
+ * unmounted) and prune it if that leaves it unused
+ */
+static void vfs_mount_node_finish(vfs_mount_node_t *node, vfs_mount_t *mount) {
+    spinlock_acquire(&vfs_mount_lock);
+    rcu_assign_pointer(node->mount, mount);
+    node->busy = false;
+    vfs_mount_node_prune(node);
+    spinlock_release(&vfs_mount_lock);
+}
+
+/**
+ * Find the mount a normalized path lives on
+ * @param rest Set to the rest of the path below the mount (without a
+ *             leading slash, empty for the mount root itself)
+ * @return Deepest mount covering the path, or NULL
+ */
+static vfs_mount_t* vfs_mount_resolve(const char *normalized, const char **rest) {
+    vfs_mount_node_t *node = &vfs_mount_trie;
+    const char *p = normalized;
+    while (*p == '/') p++;
+
+    rcu_read_lock();
+
+    vfs_mount_t *best = rcu_dereference(node->mount);
+    *rest = p;
+
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != '/') end++;
+
+        node = vfs_mount_child(node, p, end - p);
+        if (!node) break;
+
+        p = end;
+        while (*p == '/') p++;
+        vfs_mount_t *mount = rcu_dereference(node->mount);
+        if (mount) {
+            best = mount;
+            *rest = p;
         }
     }
 
-    return best_mount;
+    rcu_read_unlock();
+    return best;
+}
+
+vfs_mount_t* vfs_get_mount(const char *path) {
+    char *normalized;
+    const char *rest;
+
+    if (!path) return NULL;
+
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    normalized = vfs_normalize_path(&arena, path);
+    if (!normalized) return NULL;
+
+    return vfs_mount_resolve(normalized, &rest);
 }
 
 int vfs_mount(const char *path, const char *type, void *device) {
@@ -472,7 +817,8 @@ int vfs_mount(const char *path, const char *type, void *device) {
     }
 
     /* Normalize the path */
-    normalized = vfs_normalize_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    normalized = vfs_normalize_path(&arena, path);
     if (!normalized) {
         kprintf("[VFS] mount: Path too long\n");
         vfs_set_error(VFS_ERR_NAMETOOLONG);
@@ -487,13 +833,24 @@ int vfs_mount(const char *path, const char *type, void *device) {
         return VFS_ERR_NOENT;
     }
 
-    /* Check if already mounted at this path */
-    for (uint32_t i = 0; i < vfs_mount_count; i++) {
-        if (vfs_mounts[i].active && vfs_strcmp(vfs_mounts[i].path, normalized) == 0) {
-            kprintf("[VFS] mount: Already mounted at %s\n", normalized);
-            vfs_set_error(VFS_ERR_BUSY);
-            return VFS_ERR_BUSY;
-        }
+    /* Check if already mounted at this path, and claim it */
+    spinlock_acquire(&vfs_mount_lock);
+    vfs_mount_node_t *mount_node = vfs_mount_node_get(normalized, true);
+    bool taken = mount_node && (mount_node->mount || mount_node->busy);
+    if (mount_node && !taken) {
+        mount_node->busy = true;
+    }
+    spinlock_release(&vfs_mount_lock);
+
+    if (!mount_node) {
+        kprintf("[VFS] mount: Out of memory for mount point\n");
+        vfs_set_error(VFS_ERR_NOMEM);
+        return VFS_ERR_NOMEM;
+    }
+    if (taken) {
+        kprintf("[VFS] mount: Already mounted at %s\n", normalized);
+        vfs_set_error(VFS_ERR_BUSY);
+        return VFS_ERR_BUSY;
     }
 
     /* Find a free mount slot */
@@ -506,15 +863,16 @@ int vfs_mount(const char *path, const char *type, void *device) {
     }
 
     if (!mount) {
+        vfs_mount_node_finish(mount_node, NULL);
         kprintf("[VFS] mount: Too many mounted filesystems\n");
         vfs_set_error(VFS_ERR_NOMEM);
         return VFS_ERR_NOMEM;
     }
 
     /* Initialize mount structure */
-    vfs_memset(mount, 0, sizeof(*mount));
-    vfs_strcpy(mount->path, normalized);
-    vfs_strncpy(mount->type, type, sizeof(mount->type) - 1);
+    memset(mount, 0, sizeof(*mount));
+    strcpy(mount->path, normalized);
+    strncpy(mount->type, type, sizeof(mount->type) - 1);
     mount->ops = fstype->ops;
     mount->device = device;
     mount->active = true;
@@ -525,15 +883,17 @@ int vfs_mount(const char *path, const char *type, void *device) {
         if (result != VFS_OK) {
             kprintf("[VFS] mount: Filesystem mount failed: %s\n", vfs_strerror(result));
             mount->active = false;
+            vfs_mount_node_finish(mount_node, NULL);
             vfs_set_error(result);
             return result;
         }
     }
 
+    vfs_mount_node_finish(mount_node, mount);
     vfs_mount_count++;
 
     /* If this is root mount, set it as the root */
-    if (vfs_strcmp(normalized, "/") == 0) {
+    if (strcmp(normalized, "/") == 0) {
         vfs_root_mount = mount;
         kprintf("[VFS] Root filesystem mounted\n");
     }
@@ -554,20 +914,21 @@ int vfs_unmount(const char *path) {
         return VFS_ERR_INVAL;
     }
 
-    normalized = vfs_normalize_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    normalized = vfs_normalize_path(&arena, path);
     if (!normalized) {
         vfs_set_error(VFS_ERR_NAMETOOLONG);
         return VFS_ERR_NAMETOOLONG;
     }
 
-    /* Find the mount */
-    mount = NULL;
-    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
-        if (vfs_mounts[i].active && vfs_strcmp(vfs_mounts[i].path, normalized) == 0) {
-            mount = &vfs_mounts[i];
-            break;
-        }
+    /* Find the mount, and claim it */
+    spinlock_acquire(&vfs_mount_lock);
+    vfs_mount_node_t *mount_node = vfs_mount_node_get(normalized, false);
+    mount = mount_node && !mount_node->busy ? mount_node->mount : NULL;
+    if (mount) {
+        mount_node->busy = true;
     }
+    spinlock_release(&vfs_mount_lock);
 
     if (!mount) {
         kprintf("[VFS] unmount: Not mounted at %s\n", normalized);
@@ -580,16 +941,21 @@ int vfs_unmount(const char *path) {
         if (vfs_open_files[i].in_use && vfs_open_files[i].node &&
             vfs_open_files[i].node->mount == mount) {
             kprintf("[VFS] unmount: Filesystem busy (open files)\n");
+            vfs_mount_node_finish(mount_node, mount);
             vfs_set_error(VFS_ERR_BUSY);
             return VFS_ERR_BUSY;
         }
     }
 
+    /* Cached entries hold references into the mount */
+    vfs_dcache_purge_mount(mount);
+
     /* Call filesystem-specific unmount */
     if (mount->ops && mount->ops->unmount) {
         result = mount->ops->unmount(mount);
         if (result != VFS_OK) {
             kprintf("[VFS] unmount: Filesystem unmount failed: %s\n", vfs_strerror(result));
+            vfs_mount_node_finish(mount_node, mount);
             vfs_set_error(result);
             return result;
         }
@@ -600,7 +966,9 @@ int vfs_unmount(const char *path) {
         vfs_root_mount = NULL;
     }
 
-    /* Mark mount as inactive */
+    /* Unpublish it; once lookups that found it are done, the slot is free */
+    vfs_mount_node_finish(mount_node, NULL);
+    synchronize_rcu();
     mount->active = false;
     vfs_mount_count--;
 
@@ -618,21 +986,23 @@ vfs_node_t* vfs_lookup(const char *path) {
     vfs_node_t *next;
     char *normalized;
     char *component;
-    char path_copy[VFS_PATH_MAX];
+    char *path_copy;
 
     if (!path) {
         vfs_set_error(VFS_ERR_INVAL);
         return NULL;
     }
 
-    normalized = vfs_normalize_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    normalized = vfs_normalize_path(&arena, path);
     if (!normalized) {
         vfs_set_error(VFS_ERR_NAMETOOLONG);
         return NULL;
     }
 
     /* Find the mount point for this path */
-    mount = vfs_get_mount(normalized);
+    const char *relative_path;
+    mount = vfs_mount_resolve(normalized, &relative_path);
     if (!mount) {
         vfs_set_error(VFS_ERR_NOENT);
         return NULL;
@@ -645,22 +1015,19 @@ vfs_node_t* vfs_lookup(const char *path) {
         return NULL;
     }
 
-    /* Handle root path */
-    if (vfs_strcmp(normalized, "/") == 0 || vfs_strcmp(normalized, mount->path) == 0) {
-        vfs_ref_node(node);
-        return node;
-    }
-
-    /* Skip the mount point path */
-    const char *relative_path = normalized + vfs_strlen(mount->path);
-    if (*relative_path == '/') relative_path++;
+    /* Handle the mount root itself */
     if (*relative_path == '\0') {
         vfs_ref_node(node);
         return node;
     }
 
     /* Copy for tokenization */
-    vfs_strcpy(path_copy, relative_path);
+    path_copy = karena_alloc(&arena, strlen(relative_path) + 1);
+    if (!path_copy) {
+        vfs_set_error(VFS_ERR_NOMEM);
+        return NULL;
+    }
+    strcpy(path_copy, relative_path);
 
     /* Walk the path */
     vfs_ref_node(node);
@@ -684,11 +1051,16 @@ vfs_node_t* vfs_lookup(const char *path) {
             return NULL;
         }
 
-        /* Look up the component */
-        if (mount->ops && mount->ops->finddir) {
-            next = mount->ops->finddir(node, component);
-        } else {
-            next = NULL;
+        /* Look up the component, asking the filesystem only on a miss */
+        bool cached;
+        next = vfs_dcache_lookup(node, component, &cached);
+        if (!cached) {
+            if (mount->ops && mount->ops->finddir) {
+                next = mount->ops->finddir(node, component);
+            } else {
+                next = NULL;
+            }
+            vfs_dcache_insert(node, component, next);
         }
 
         vfs_unref_node(node);
@@ -717,6 +1089,56 @@ vfs_node_t* vfs_lookup(const char *path) {
  * File operations
  *============================================================================*/
 
+/**
+ * Take the lowest free open file slot
+ */
+static vfs_file_t *vfs_file_alloc(void) {
+    for (uint32_t w = vfs_file_hint; w < VFS_MAX_OPEN_FILES / 64; w++) {
+        uint64_t free_bits = ~vfs_file_map[w];
+        if (free_bits != 0) {
+            vfs_file_map[w] |= free_bits & -free_bits;
+            vfs_file_hint = w;
+            return &vfs_open_files[w * 64 + __builtin_ctzll(free_bits)];
+        }
+    }
+    vfs_file_hint = VFS_MAX_OPEN_FILES / 64;
+    return NULL;
+}
+
+/**
+ * Return an open file slot
+ */
+static void vfs_file_free(vfs_file_t *file) {
+    uint32_t index = (uint32_t)(file - vfs_open_files);
+
+    file->in_use = false;
+    vfs_file_map[index / 64] &= ~(1ULL << (index % 64));
+    if (index / 64 < vfs_file_hint) {
+        vfs_file_hint = index / 64;
+    }
+}
+
+/**
+ * Another descriptor refers to an open file (a forked table)
+ */
+static void vfs_file_fd_ref(void *object, uint32_t aux) {
+    UNUSED(aux);
+    ((vfs_file_t *)object)->ref_count++;
+}
+
+/**
+ * A descriptor of an open file was closed
+ */
+static void vfs_file_fd_close(void *object, uint32_t aux) {
+    UNUSED(aux);
+    vfs_close((vfs_file_t *)object);
+}
+
+static const fd_ops_t vfs_file_fd_ops = {
+    .ref = vfs_file_fd_ref,
+    .close = vfs_file_fd_close,
+};
+
 vfs_file_t* vfs_open(const char *path, int flags) {
     vfs_node_t *node;
     vfs_file_t *file;
@@ -735,7 +1157,8 @@ vfs_file_t* vfs_open(const char *path, int flags) {
 
     /* Handle creation */
     if (!node && (flags & VFS_O_CREAT)) {
-        char *parent = vfs_parent_path(path);
+        KARENA_SCOPED(arena, VFS_ARENA_SEED);
+        char *parent = vfs_parent_path(&arena, path);
         const char *name = vfs_basename(path);
         vfs_node_t *parent_node;
 
@@ -749,6 +1172,9 @@ vfs_file_t* vfs_open(const char *path, int flags) {
         mount = parent_node->mount;
         if (mount && mount->ops && mount->ops->create) {
             result = mount->ops->create(parent_node, name, VFS_S_IRUSR | VFS_S_IWUSR);
+            if (result == VFS_OK) {
+                vfs_dcache_purge_dir(parent_node);
+            }
             vfs_unref_node(parent_node);
 
             if (result != VFS_OK) {
@@ -790,15 +1216,7 @@ vfs_file_t* vfs_open(const char *path, int flags) {
         return NULL;
     }
 
-    /* Find a free file slot */
-    file = NULL;
-    for (int i = 0; i < VFS_MAX_OPEN_FILES; i++) {
-        if (!vfs_open_files[i].in_use) {
-            file = &vfs_open_files[i];
-            break;
-        }
-    }
-
+    file = vfs_file_alloc();
     if (!file) {
         vfs_unref_node(node);
         kprintf("[VFS] open: Too many open files\n");
@@ -807,7 +1225,7 @@ vfs_file_t* vfs_open(const char *path, int flags) {
     }
 
     /* Initialize file structure */
-    vfs_memset(file, 0, sizeof(*file));
+    memset(file, 0, sizeof(*file));
     file->node = node;
     file->flags = flags;
     file->offset = 0;
@@ -819,7 +1237,7 @@ vfs_file_t* vfs_open(const char *path, int flags) {
     if (mount && mount->ops && mount->ops->open) {
         result = mount->ops->open(node, flags);
         if (result != VFS_OK) {
-            file->in_use = false;
+            vfs_file_free(file);
             vfs_unref_node(node);
             kprintf("[VFS] open: Filesystem open failed: %s\n", vfs_strerror(result));
             vfs_set_error(result);
@@ -871,12 +1289,45 @@ int vfs_close(vfs_file_t *file) {
     }
 
     /* Mark slot as free */
-    file->in_use = false;
     file->node = NULL;
+    vfs_file_free(file);
 
     return result;
 }
 
+/**
+ * Keep a window of a sequentially read file loading ahead of the reader
+ * The window doubles with each read that starts where the previous one
+ * ended, and more is requested once less than half of it is left.
+ */
+static void vfs_readahead(vfs_file_t *file, uint64_t offset, size_t size) {
+    vfs_mount_t *mount = file->node->mount;
+    if (!mount->ops->readahead) {
+        return;
+    }
+
+    if (offset != file->ra_next) {
+        file->ra_window = 0;
+        file->ra_end = 0;
+        return;
+    }
+
+    file->ra_window = file->ra_window ? MIN(file->ra_window * 2, (uint32_t)VFS_RA_MAX)
+                                      : VFS_RA_MIN;
+
+    uint64_t end = offset + size;
+    if (file->ra_end >= end + file->ra_window / 2) {
+        return;
+    }
+
+    uint64_t from = MAX(file->ra_end, end);
+    uint64_t to = MIN(end + file->ra_window, file->node->size);
+    if (to > from) {
+        mount->ops->readahead(file->node, from, (size_t)(to - from));
+        file->ra_end = to;
+    }
+}
+
 ssize_t vfs_read(vfs_file_t *file, void *buf, size_t size) {
     vfs_mount_t *mount;
     ssize_t bytes_read;
@@ -920,10 +1371,14 @@ ssize_t vfs_read(vfs_file_t *file, void *buf, size_t size) {
         return VFS_ERR_NOSYS;
     }
 
+    /* Start on what comes next before blocking on this read */
+    vfs_readahead(file, file->offset, size);
+
     bytes_read = mount->ops->read(file->node, buf, size, file->offset);
 
     if (bytes_read > 0) {
         file->offset += bytes_read;
+        file->ra_next = file->offset;
     }
 
     return bytes_read;
@@ -1070,6 +1525,74 @@ int vfs_sync(vfs_file_t *file) {
     return mount->ops->sync(file->node);
 }
 
+/*============================================================================
+ * Memory mapping
+ *============================================================================*/
+
+/**
+ * Fill mapped pages straight from the filesystem, clamped to the file size
+ */
+static ssize_t vfs_mmap_read(void *object, void *buf, size_t size, uint64_t offset) {
+    vfs_node_t *node = (vfs_node_t *)object;
+    vfs_mount_t *mount = node->mount;
+
+    if (offset >= node->size) {
+        return 0;
+    }
+    if (offset + size > node->size) {
+        size = node->size - offset;
+    }
+    if (!mount || !mount->ops || !mount->ops->read) {
+        return VFS_ERR_NOSYS;
+    }
+    return mount->ops->read(node, buf, size, offset);
+}
+
+static void vfs_mmap_ref(void *object) {
+    vfs_ref_node((vfs_node_t *)object);
+}
+
+static void vfs_mmap_unref(void *object) {
+    vfs_unref_node((vfs_node_t *)object);
+}
+
+static const vma_file_ops_t vfs_mmap_ops = {
+    .read = vfs_mmap_read,
+    .ref = vfs_mmap_ref,
+    .unref = vfs_mmap_unref,
+};
+
+int vfs_mmap(vfs_file_t *file, vma_tree_t *tree, virtaddr_t addr, size_t length,
+             uint64_t flags, uint64_t offset) {
+    if (!file || !file->in_use || !file->node) {
+        vfs_set_error(VFS_ERR_BADF);
+        return VFS_ERR_BADF;
+    }
+
+    if (!tree || length == 0 || !IS_ALIGNED(addr, PAGE_SIZE) || !IS_ALIGNED(offset, PAGE_SIZE)) {
+        vfs_set_error(VFS_ERR_INVAL);
+        return VFS_ERR_INVAL;
+    }
+
+    if ((file->flags & VFS_O_RDWR) == VFS_O_WRONLY) {
+        vfs_set_error(VFS_ERR_ACCES);
+        return VFS_ERR_ACCES;
+    }
+
+    if (file->node->type == VFS_NODE_DIRECTORY) {
+        vfs_set_error(VFS_ERR_ISDIR);
+        return VFS_ERR_ISDIR;
+    }
+
+    if (!vma_map_file(tree, addr, ALIGN_UP(length, PAGE_SIZE), flags,
+                      &vfs_mmap_ops, file->node, offset)) {
+        vfs_set_error(VFS_ERR_NOMEM);
+        return VFS_ERR_NOMEM;
+    }
+
+    return VFS_OK;
+}
+
 /*============================================================================
  * Directory operations
  *============================================================================*/
@@ -1142,7 +1665,7 @@ vfs_dirent_t* vfs_readdir(vfs_dir_t *dir) {
     entry = mount->ops->readdir(dir->node, dir->position);
     if (entry) {
         /* Copy to static buffer */
-        vfs_memcpy(&vfs_dirent_buf, entry, sizeof(vfs_dirent_t));
+        memcpy(&vfs_dirent_buf, entry, sizeof(vfs_dirent_t));
         dir->position++;
         return &vfs_dirent_buf;
     }
@@ -1190,7 +1713,8 @@ int vfs_mkdir(const char *path, uint32_t mode) {
     }
 
     /* Get parent directory */
-    parent_path = vfs_parent_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    parent_path = vfs_parent_path(&arena, path);
     name = vfs_basename(path);
 
     parent = vfs_lookup(parent_path);
@@ -1222,6 +1746,9 @@ int vfs_mkdir(const char *path, uint32_t mode) {
     }
 
     result = mount->ops->mkdir(parent, name, mode);
+    if (result == VFS_OK) {
+        vfs_dcache_purge_dir(parent);
+    }
     vfs_unref_node(parent);
 
     if (result == VFS_OK) {
@@ -1248,13 +1775,14 @@ int vfs_rmdir(const char *path) {
     }
 
     /* Cannot remove root */
-    if (vfs_strcmp(path, "/") == 0) {
+    if (strcmp(path, "/") == 0) {
         vfs_set_error(VFS_ERR_BUSY);
         return VFS_ERR_BUSY;
     }
 
     /* Get parent directory */
-    parent_path = vfs_parent_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    parent_path = vfs_parent_path(&arena, path);
     name = vfs_basename(path);
 
     parent = vfs_lookup(parent_path);
@@ -1277,6 +1805,9 @@ int vfs_rmdir(const char *path) {
     }
 
     result = mount->ops->rmdir(parent, name);
+    if (result == VFS_OK) {
+        vfs_dcache_purge_mount(mount);
+    }
     vfs_unref_node(parent);
 
     return result;
@@ -1307,7 +1838,8 @@ int vfs_create(const char *path, uint32_t mode) {
     }
 
     /* Get parent directory */
-    parent_path = vfs_parent_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    parent_path = vfs_parent_path(&arena, path);
     name = vfs_basename(path);
 
     parent = vfs_lookup(parent_path);
@@ -1336,6 +1868,9 @@ int vfs_create(const char *path, uint32_t mode) {
     }
 
     result = mount->ops->create(parent, name, mode);
+    if (result == VFS_OK) {
+        vfs_dcache_purge_dir(parent);
+    }
     vfs_unref_node(parent);
 
     return result;
@@ -1373,7 +1908,8 @@ int vfs_unlink(const char *path) {
     vfs_unref_node(node);
 
     /* Get parent directory */
-    parent_path = vfs_parent_path(path);
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    parent_path = vfs_parent_path(&arena, path);
     name = vfs_basename(path);
 
     parent = vfs_lookup(parent_path);
@@ -1396,6 +1932,9 @@ int vfs_unlink(const char *path) {
     }
 
     result = mount->ops->unlink(parent, name);
+    if (result == VFS_OK) {
+        vfs_dcache_purge_dir(parent);
+    }
     vfs_unref_node(parent);
 
     return result;
@@ -1418,15 +1957,16 @@ int vfs_rename(const char *oldpath, const char *newpath) {
         return VFS_ERR_INVAL;
     }
 
-    /* Get parent directories */
-    old_parent_path = vfs_parent_path(oldpath);
+    /* Get parent directories (both stay live, so they share one arena) */
+    KARENA_SCOPED(arena, VFS_ARENA_SEED);
+    old_parent_path = vfs_parent_path(&arena, oldpath);
     old_parent = vfs_lookup(old_parent_path);
     if (!old_parent) {
         vfs_set_error(VFS_ERR_NOENT);
         return VFS_ERR_NOENT;
     }
 
-    new_parent_path = vfs_parent_path(newpath);
+    new_parent_path = vfs_parent_path(&arena, newpath);
     new_parent = vfs_lookup(new_parent_path);
     if (!new_parent) {
         vfs_unref_node(old_parent);
@@ -1461,6 +2001,10 @@ int vfs_rename(const char *oldpath, const char *newpath) {
     }
 
     result = mount->ops->rename(old_parent, old_name, new_parent, new_name);
+    if (result == VFS_OK) {
+        /* A moved directory takes its cached children with it */
+        vfs_dcache_purge_mount(mount);
+    }
     vfs_unref_node(old_parent);
     vfs_unref_node(new_parent);
 
@@ -1487,7 +2031,7 @@ int vfs_stat(const char *path, vfs_stat_t *stat) {
         result = mount->ops->stat(node, stat);
     } else {
         /* Fill from node if no stat operation */
-        vfs_memset(stat, 0, sizeof(*stat));
+        memset(stat, 0, sizeof(*stat));
         stat->st_ino = node->inode;
         stat->st_mode = node->permissions;
         stat->st_nlink = node->nlink;
@@ -1526,7 +2070,7 @@ int vfs_fstat(vfs_file_t *file, vfs_stat_t *stat) {
     }
 
     /* Fill from node */
-    vfs_memset(stat, 0, sizeof(*stat));
+    memset(stat, 0, sizeof(*stat));
     stat->st_ino = node->inode;
     stat->st_mode = node->permissions;
     stat->st_nlink = node->nlink;
@@ -1578,19 +2122,51 @@ int vfs_init(void) {
     kprintf("[VFS] Initializing Virtual File System...\n");
 
     /* Initialize mount table */
-    vfs_memset(vfs_mounts, 0, sizeof(vfs_mounts));
+    memset(vfs_mounts, 0, sizeof(vfs_mounts));
     vfs_mount_count = 0;
     vfs_root_mount = NULL;
 
     /* Initialize open files table */
-    vfs_memset(vfs_open_files, 0, sizeof(vfs_open_files));
+    memset(vfs_open_files, 0, sizeof(vfs_open_files));
+    memset(vfs_file_map, 0, sizeof(vfs_file_map));
+    vfs_file_hint = 0;
+    fd_register_ops(FD_KIND_FILE, &vfs_file_fd_ops);
 
     /* Initialize open directories table */
-    vfs_memset(vfs_open_dirs, 0, sizeof(vfs_open_dirs));
+    memset(vfs_open_dirs, 0, sizeof(vfs_open_dirs));
+
+    /* Initialize node cache */
+    if (!vfs_node_cache) {
+        vfs_node_cache = kmem_cache_create("vfs_node", sizeof(vfs_node_t), 0, NULL);
+        if (!vfs_node_cache) {
+            kprintf("[VFS] Error: Failed to create node cache\n");
+            return VFS_ERR_NOMEM;
+        }
+    }
+
+    /* Initialize mount point trie */
+    memset(&vfs_mount_trie, 0, sizeof(vfs_mount_trie));
+    if (!vfs_mount_node_cache) {
+        vfs_mount_node_cache = kmem_cache_create("vfs_mount_node", sizeof(vfs_mount_node_t),
+                                                 0, NULL);
+        if (!vfs_mount_node_cache) {
+            kprintf("[VFS] Error: Failed to create mount point cache\n");
+            return VFS_ERR_NOMEM;
+        }
+    }
+
+    /* Initialize dentry cache */
+    if (!vfs_dentry_cache) {
+        vfs_dentry_cache = kmem_cache_create("vfs_dentry", sizeof(vfs_dentry_t), 0, NULL);
+        if (!vfs_dentry_cache) {
+            kprintf("[VFS] Warning: No dentry cache, lookups go to the filesystem\n");
+        } else {
+            shrinker_register(&vfs_dcache_shrinker);
+        }
+    }
 
-    /* Initialize node pool */
-    vfs_memset(vfs_node_pool, 0, sizeof(vfs_node_pool));
-    vfs_memset(vfs_node_used, 0, sizeof(vfs_node_used));
+    /* Block cache shared by every mounted device */
+    bcache_init();
 
     /* Initialize filesystem types list */
     vfs_fs_types = NULL;
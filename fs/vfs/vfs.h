@@ -4,12 +4,15 @@
  * This header defines the abstract file system interface that all
  * filesystem implementations (FAT32, ext4, NTFS, etc.) must implement.
  * The VFS provides a unified API for file and directory operations.
+ * Filesystems read and write device data through the shared block cache
+ * (bcache.h), which vfs_init() sets up.
  */
 
 #ifndef _AAAOS_VFS_H
 #define _AAAOS_VFS_H
 
 #include "../../kernel/include/types.h"
+#include "../../kernel/mm/vma.h"
 
 /* Maximum path length */
 #define VFS_PATH_MAX        4096
@@ -21,6 +24,10 @@
 /* Maximum number of mounted filesystems */
 #define VFS_MAX_MOUNTS      64
 
+/* Readahead window (doubles on each sequential read) */
+#define VFS_RA_MIN          (16 * 1024)
+#define VFS_RA_MAX          (128 * 1024)
+
 /* File types */
 typedef enum {
     VFS_NODE_FILE       = 0x01,     /* Regular file */
@@ -160,6 +167,7 @@ struct vfs_ops {
     ssize_t (*write)(vfs_node_t *node, const void *buf, size_t size, uint64_t offset);
     int     (*truncate)(vfs_node_t *node, uint64_t size);
     int     (*sync)(vfs_node_t *node);
+    int     (*readahead)(vfs_node_t *node, uint64_t offset, size_t size);  /* Optional hint */
 
     /* Directory operations */
     vfs_dirent_t* (*readdir)(vfs_node_t *dir, uint32_t index);
@@ -175,6 +183,7 @@ struct vfs_ops {
     int     (*stat)(vfs_node_t *node, vfs_stat_t *stat);
     int     (*chmod)(vfs_node_t *node, uint32_t mode);
     int     (*chown)(vfs_node_t *node, uint32_t uid, uint32_t gid);
+    void    (*release)(vfs_node_t *node);   /* Optional: last reference dropped */
 
     /* Filesystem operations */
     int     (*mount)(vfs_mount_t *mount, void *device);
@@ -208,6 +217,11 @@ struct vfs_file {
     int             flags;                      /* Open flags */
     uint32_t        ref_count;                  /* Reference count */
     bool            in_use;                     /* Slot is in use */
+
+    /* Sequential readahead state */
+    uint64_t        ra_next;                    /* Where a sequential read would start */
+    uint64_t        ra_end;                     /* End of the range already read ahead */
+    uint32_t        ra_window;                  /* Bytes kept ahead, 0 after a seek */
 };
 
 /**
@@ -333,6 +347,22 @@ int vfs_truncate(vfs_file_t *file, uint64_t size);
  */
 int vfs_sync(vfs_file_t *file);
 
+/**
+ * Map a file privately into an address space
+ * Pages are read from the file on first touch; bytes past the end of the
+ * file read as zero. The mapping keeps the node referenced and does not
+ * write changes back.
+ * @param file File handle (must be readable)
+ * @param tree VMA tree of the target address space
+ * @param addr Page-aligned start address
+ * @param length Length of the mapping
+ * @param flags Page flags (VMM_FLAG_*)
+ * @param offset Page-aligned file offset backing addr
+ * @return VFS_OK on success, error code on failure
+ */
+int vfs_mmap(vfs_file_t *file, vma_tree_t *tree, virtaddr_t addr, size_t length,
+             uint64_t flags, uint64_t offset);
+
 /**
  * Open a directory for reading
  * @param path Directory path
@@ -435,11 +465,18 @@ bool vfs_is_file(const char *path);
 
 /**
  * Resolve a path to a VFS node
+ * Components are looked up in the dentry cache first, so repeated
+ * lookups return the same node without calling the filesystem.
  * @param path Path to resolve
  * @return VFS node on success, NULL on failure
  */
 vfs_node_t* vfs_lookup(const char *path);
 
+/**
+ * Print dentry cache statistics (for debugging)
+ */
+void vfs_dcache_dump_stats(void);
+
 /**
  * Get the mount point for a path
  * @param path Path to check
@@ -467,6 +504,7 @@ void vfs_ref_node(vfs_node_t *node);
 
 /**
  * Decrement node reference count and free if zero
+ * The filesystem's release operation, if any, runs before the node is freed.
  * @param node Node to unreference
  */
 void vfs_unref_node(vfs_node_t *node);
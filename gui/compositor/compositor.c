@@ -7,23 +7,38 @@
 
 #include "compositor.h"
 #include "../../drivers/video/framebuffer.h"
+#include "../../drivers/video/pixops.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/init/bootprof.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/vma.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/syscall/syscall.h"
 #include "../../lib/libc/string.h"
 
 /* Global compositor state */
 static compositor_t g_compositor;
 
 /* Forward declarations for internal functions */
-static void compositor_draw_desktop_background(void);
-static void compositor_draw_window(window_t *win);
-static void compositor_draw_window_decorations(window_t *win);
-static void compositor_blit_window_buffer(window_t *win);
-static void compositor_swap_buffers(void);
+static void compositor_window_bounds(const window_t *win, dirty_rect_t *out);
+static void compositor_render_rect(const dirty_rect_t *rect);
+static void compositor_fill(const dirty_rect_t *clip, int x, int y, int w, int h, uint32_t color);
+static void compositor_fill_background(const dirty_rect_t *rect);
+static void compositor_draw_window(window_t *win, const dirty_rect_t *clip);
+static void compositor_draw_window_decorations(window_t *win, const dirty_rect_t *clip);
+static void compositor_blit_window_buffer(window_t *win, const dirty_rect_t *clip);
+static void compositor_swap_rect(const dirty_rect_t *rect);
 static void compositor_unlink_window(window_t *win);
 static void compositor_link_window(window_t *win);
 static void compositor_reorder_windows(void);
-static uint32_t alpha_blend(uint32_t fg, uint32_t bg);
+static uint32_t *compositor_alloc_buffer(int w, int h, size_t *pages);
+static void compositor_free_buffer(uint32_t *buffer, size_t pages);
+static void compositor_index_window(window_t *win);
+static void compositor_clear_tiles(window_t *win);
+static uint32_t compositor_windows_in(const dirty_rect_t *rect, window_t **out, uint32_t max);
 
 /**
  * Initialize the compositor
@@ -63,6 +78,19 @@ int compositor_init(uint32_t width, uint32_t height) {
     }
     g_compositor.front_buffer = fb->address;
 
+    /* Tile grid for hit testing and occlusion; without it, lists are walked */
+    uint32_t tile = 1U << COMPOSITOR_TILE_SHIFT;
+    g_compositor.tiles_x = (width + tile - 1) >> COMPOSITOR_TILE_SHIFT;
+    g_compositor.tiles_y = (height + tile - 1) >> COMPOSITOR_TILE_SHIFT;
+    size_t masks_size = (size_t)g_compositor.tiles_x * g_compositor.tiles_y *
+                        COMPOSITOR_TILE_WORDS * sizeof(uint64_t);
+    g_compositor.tile_masks = (uint64_t *)kmalloc(masks_size);
+    if (g_compositor.tile_masks) {
+        memset(g_compositor.tile_masks, 0, masks_size);
+    } else {
+        kprintf("[COMPOSITOR] Warning: No tile grid, hit tests walk the window list\n");
+    }
+
     /* Initialize state */
     g_compositor.window_list = NULL;
     g_compositor.window_tail = NULL;
@@ -73,8 +101,11 @@ int compositor_init(uint32_t width, uint32_t height) {
     g_compositor.needs_full_redraw = true;
     g_compositor.initialized = true;
 
-    /* Clear dirty region */
-    g_compositor.dirty_region.valid = false;
+    /* Nothing dirty yet; needs_full_redraw covers the first frame */
+    g_compositor.dirty_count = 0;
+
+    g_compositor.refresh_ns = NSEC_PER_SEC / COMPOSITOR_REFRESH_HZ;
+    g_compositor.next_frame_ns = 0;
 
     kprintf("[COMPOSITOR] Initialization complete\n");
     return 0;
@@ -94,9 +125,7 @@ void compositor_shutdown(void) {
     window_t *win = g_compositor.window_list;
     while (win) {
         window_t *next = win->next;
-        if (win->buffer) {
-            kfree(win->buffer);
-        }
+        compositor_free_buffer(win->buffer, win->buffer_pages);
         kfree(win);
         win = next;
     }
@@ -106,11 +135,51 @@ void compositor_shutdown(void) {
         kfree(g_compositor.back_buffer);
         g_compositor.back_buffer = NULL;
     }
+    if (g_compositor.tile_masks) {
+        kfree(g_compositor.tile_masks);
+        g_compositor.tile_masks = NULL;
+    }
 
     memset(&g_compositor, 0, sizeof(compositor_t));
     kprintf("[COMPOSITOR] Shutdown complete\n");
 }
 
+/**
+ * Allocate a white w x h buffer on whole, physically contiguous pages
+ */
+static uint32_t *compositor_alloc_buffer(int w, int h, size_t *pages) {
+    size_t size = (size_t)w * h * sizeof(uint32_t);
+    size_t count = ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE;
+
+    physaddr_t frames = pmm_alloc_pages(count);
+    if (frames == 0) {
+        return NULL;
+    }
+
+    uint32_t *buffer = (uint32_t *)(uintptr_t)frames;
+    for (size_t i = 0; i < count * PAGE_SIZE / sizeof(uint32_t); i++) {
+        buffer[i] = 0xFFFFFFFF;
+    }
+
+    *pages = count;
+    return buffer;
+}
+
+/**
+ * Drop the compositor's reference on each page of a buffer
+ * Pages a client still has mapped stay until it unmaps them.
+ */
+static void compositor_free_buffer(uint32_t *buffer, size_t pages) {
+    if (!buffer) {
+        return;
+    }
+
+    physaddr_t frames = (physaddr_t)(uintptr_t)buffer;
+    for (size_t i = 0; i < pages; i++) {
+        pmm_page_unref(frames + i * PAGE_SIZE);
+    }
+}
+
 /**
  * Create a new window
  */
@@ -138,21 +207,15 @@ window_t *compositor_create_window(int x, int y, int w, int h, const char *title
     }
     memset(win, 0, sizeof(window_t));
 
-    /* Allocate window buffer */
-    size_t buffer_size = (size_t)w * h * sizeof(uint32_t);
-    win->buffer = (uint32_t *)kmalloc(buffer_size);
+    /* Allocate window buffer, cleared to white */
+    win->buffer = compositor_alloc_buffer(w, h, &win->buffer_pages);
     if (!win->buffer) {
         kprintf("[COMPOSITOR] Error: Failed to allocate window buffer (%u bytes)\n",
-                (uint32_t)buffer_size);
+                (uint32_t)((size_t)w * h * sizeof(uint32_t)));
         kfree(win);
         return NULL;
     }
 
-    /* Clear buffer to white */
-    for (int i = 0; i < w * h; i++) {
-        win->buffer[i] = 0xFFFFFFFF;
-    }
-
     /* Initialize window properties */
     win->x = x;
     win->y = y;
@@ -179,11 +242,21 @@ window_t *compositor_create_window(int x, int y, int w, int h, const char *title
     /* Link window into list (at end = top of Z-order) */
     compositor_link_window(win);
 
+    /* Index it by ID and by the tiles it covers */
+    uint32_t bucket = win->id & (COMPOSITOR_ID_BUCKETS - 1);
+    win->hash_next = g_compositor.id_buckets[bucket];
+    g_compositor.id_buckets[bucket] = win;
+    for (win->slot = 0; g_compositor.slots[win->slot]; win->slot++) {
+        /* window_count < COMPOSITOR_MAX_WINDOWS, so a slot is free */
+    }
+    g_compositor.slots[win->slot] = win;
+    compositor_index_window(win);
+
     /* Set as active window */
     compositor_set_active_window(win);
 
-    /* Mark screen dirty */
-    compositor_invalidate_all();
+    /* Mark window area dirty */
+    compositor_invalidate_window(win);
 
     g_compositor.window_count++;
     g_compositor.windows_created++;
@@ -205,25 +278,33 @@ void compositor_destroy_window(window_t *win) {
     kprintf("[COMPOSITOR] Destroying window %u: \"%s\"\n", win->id, win->title);
 
     /* Mark dirty region where window was */
-    int total_w, total_h;
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 
     /* Unlink from list */
     compositor_unlink_window(win);
 
+    /* Drop it from the index */
+    compositor_clear_tiles(win);
+    g_compositor.slots[win->slot] = NULL;
+    window_t **link = &g_compositor.id_buckets[win->id & (COMPOSITOR_ID_BUCKETS - 1)];
+    while (*link && *link != win) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = win->hash_next;
+    }
+
     /* If this was the active window, activate the next one */
     if (g_compositor.active_window == win) {
         g_compositor.active_window = g_compositor.window_tail;
         if (g_compositor.active_window) {
             g_compositor.active_window->flags |= WINDOW_FLAG_ACTIVE;
+            compositor_invalidate_window(g_compositor.active_window);
         }
     }
 
     /* Free resources */
-    if (win->buffer) {
-        kfree(win->buffer);
-    }
+    compositor_free_buffer(win->buffer, win->buffer_pages);
     kfree(win);
 
     g_compositor.window_count--;
@@ -244,16 +325,15 @@ void compositor_move_window(window_t *win, int x, int y) {
     }
 
     /* Mark old position dirty */
-    int total_w, total_h;
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 
     /* Update position */
     win->x = x;
     win->y = y;
+    compositor_index_window(win);
 
     /* Mark new position dirty */
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 }
 
 /**
@@ -275,23 +355,16 @@ int compositor_resize_window(window_t *win, int w, int h) {
     }
 
     /* Mark old area dirty */
-    int total_w, total_h;
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 
-    /* Allocate new buffer */
-    size_t new_size = (size_t)w * h * sizeof(uint32_t);
-    uint32_t *new_buffer = (uint32_t *)kmalloc(new_size);
+    /* Allocate new buffer, cleared to white */
+    size_t new_pages;
+    uint32_t *new_buffer = compositor_alloc_buffer(w, h, &new_pages);
     if (!new_buffer) {
         kprintf("[COMPOSITOR] Error: Failed to allocate resize buffer\n");
         return -4;
     }
 
-    /* Clear new buffer */
-    for (int i = 0; i < w * h; i++) {
-        new_buffer[i] = 0xFFFFFFFF;
-    }
-
     /* Copy old content (as much as fits) */
     int copy_w = MIN(win->width, w);
     int copy_h = MIN(win->height, h);
@@ -302,14 +375,15 @@ int compositor_resize_window(window_t *win, int w, int h) {
     }
 
     /* Free old buffer and update */
-    kfree(win->buffer);
+    compositor_free_buffer(win->buffer, win->buffer_pages);
     win->buffer = new_buffer;
+    win->buffer_pages = new_pages;
     win->width = w;
     win->height = h;
+    compositor_index_window(win);
 
     /* Mark new area dirty */
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 
     kprintf("[COMPOSITOR] Resized window %u to %d x %d\n", win->id, w, h);
     return 0;
@@ -337,9 +411,7 @@ void compositor_raise_window(window_t *win) {
     compositor_set_active_window(win);
 
     /* Mark window area dirty */
-    int total_w, total_h;
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    compositor_invalidate(win->x, win->y, total_w, total_h);
+    compositor_invalidate_window(win);
 
     kprintf("[COMPOSITOR] Raised window %u to front (z=%d)\n", win->id, win->z_order);
 }
@@ -376,7 +448,7 @@ void compositor_lower_window(window_t *win) {
     }
 
     /* Mark dirty */
-    compositor_invalidate_all();
+    compositor_invalidate_window(win);
 
     kprintf("[COMPOSITOR] Lowered window %u to back (z=%d)\n", win->id, win->z_order);
 }
@@ -390,11 +462,7 @@ void compositor_set_active_window(window_t *win) {
         g_compositor.active_window->flags &= ~WINDOW_FLAG_ACTIVE;
 
         /* Mark old active window dirty (title bar changed) */
-        int total_w, total_h;
-        compositor_get_window_total_size(g_compositor.active_window, &total_w, &total_h);
-        compositor_invalidate(g_compositor.active_window->x,
-                             g_compositor.active_window->y,
-                             total_w, total_h);
+        compositor_invalidate_window(g_compositor.active_window);
     }
 
     /* Activate new window */
@@ -403,9 +471,7 @@ void compositor_set_active_window(window_t *win) {
         win->flags |= WINDOW_FLAG_ACTIVE;
 
         /* Mark new active window dirty */
-        int total_w, total_h;
-        compositor_get_window_total_size(win, &total_w, &total_h);
-        compositor_invalidate(win->x, win->y, total_w, total_h);
+        compositor_invalidate_window(win);
     }
 }
 
@@ -424,26 +490,132 @@ void compositor_render(void) {
         return;
     }
 
-    /* Draw desktop background */
-    compositor_draw_desktop_background();
-
-    /* Draw windows from back to front (lowest z_order first) */
-    window_t *win = g_compositor.window_list;
-    while (win) {
-        if (win->flags & WINDOW_FLAG_VISIBLE && !(win->flags & WINDOW_FLAG_MINIMIZED)) {
-            compositor_draw_window(win);
-        }
-        win = win->next;
+    if (g_compositor.needs_full_redraw) {
+        compositor_invalidate_all();
     }
+    if (g_compositor.dirty_count == 0) {
+        return;
+    }
+
+    uint64_t start = clock_monotonic_ns();
 
-    /* Swap buffers (copy back buffer to front buffer) */
-    compositor_swap_buffers();
+    /* Repaint and copy each damaged rectangle on its own */
+    for (uint32_t i = 0; i < g_compositor.dirty_count; i++) {
+        const dirty_rect_t *rect = &g_compositor.dirty_rects[i];
+        compositor_render_rect(rect);
+        compositor_swap_rect(rect);
+        g_compositor.pixels_composited += (uint64_t)rect->width * rect->height;
+    }
 
     /* Clear dirty region */
-    g_compositor.dirty_region.valid = false;
+    g_compositor.dirty_count = 0;
     g_compositor.needs_full_redraw = false;
 
+    /* Show the staged frame; without page flipping it is already on screen */
+    if (fb_present()) {
+        g_compositor.frames_flipped++;
+    }
+
+    uint64_t elapsed = clock_monotonic_ns() - start;
+    g_compositor.frame_time_last_ns = elapsed;
+    g_compositor.frame_time_max_ns = MAX(g_compositor.frame_time_max_ns, elapsed);
+    g_compositor.frame_time_total_ns += elapsed;
     g_compositor.frame_count++;
+    bootprof_mark(BOOTPROF_FIRST_FRAME);
+}
+
+/**
+ * Render a frame if one is due
+ */
+bool compositor_frame_tick(void) {
+    if (!g_compositor.initialized) {
+        return false;
+    }
+    if (g_compositor.dirty_count == 0 && !g_compositor.needs_full_redraw) {
+        return false;
+    }
+
+    uint64_t now = clock_monotonic_ns();
+    if (now < g_compositor.next_frame_ns) {
+        g_compositor.frames_deferred++;
+        return false;
+    }
+
+    compositor_render();
+
+    /* Stay on the refresh grid; after a stall, start over from now */
+    g_compositor.next_frame_ns += g_compositor.refresh_ns;
+    if (g_compositor.next_frame_ns <= now) {
+        g_compositor.next_frame_ns = now + g_compositor.refresh_ns;
+    }
+    return true;
+}
+
+/**
+ * Time the next frame may render
+ */
+uint64_t compositor_next_frame_ns(void) {
+    return g_compositor.next_frame_ns;
+}
+
+/**
+ * Area of a rectangle in pixels
+ */
+static uint64_t rect_area(const dirty_rect_t *r) {
+    return (uint64_t)r->width * (uint64_t)r->height;
+}
+
+/**
+ * Intersect two rectangles
+ * @return false if they do not overlap (out is then unset)
+ */
+static bool rect_intersect(const dirty_rect_t *a, const dirty_rect_t *b, dirty_rect_t *out) {
+    int x1 = MAX(a->x, b->x);
+    int y1 = MAX(a->y, b->y);
+    int x2 = MIN(a->x + a->width, b->x + b->width);
+    int y2 = MIN(a->y + a->height, b->y + b->height);
+
+    if (x2 <= x1 || y2 <= y1) {
+        return false;
+    }
+    out->x = x1;
+    out->y = y1;
+    out->width = x2 - x1;
+    out->height = y2 - y1;
+    out->valid = true;
+    return true;
+}
+
+/**
+ * Check if rectangle a contains rectangle b
+ */
+static bool rect_contains(const dirty_rect_t *a, const dirty_rect_t *b) {
+    return b->x >= a->x && b->y >= a->y &&
+           b->x + b->width <= a->x + a->width &&
+           b->y + b->height <= a->y + a->height;
+}
+
+/**
+ * Bounding box of two rectangles
+ */
+static void rect_union(const dirty_rect_t *a, const dirty_rect_t *b, dirty_rect_t *out) {
+    int x1 = MIN(a->x, b->x);
+    int y1 = MIN(a->y, b->y);
+    int x2 = MAX(a->x + a->width, b->x + b->width);
+    int y2 = MAX(a->y + a->height, b->y + b->height);
+
+    out->x = x1;
+    out->y = y1;
+    out->width = x2 - x1;
+    out->height = y2 - y1;
+    out->valid = true;
+}
+
+/**
+ * Remove entry i from the dirty list
+ */
+static void compositor_drop_dirty(uint32_t i) {
+    g_compositor.dirty_rects[i] = g_compositor.dirty_rects[--g_compositor.dirty_count];
 }
 
 /**
@@ -468,77 +640,204 @@ void compositor_invalidate(int x, int y, int w, int h) {
         return;
     }
 
-    /* Merge with existing dirty region */
-    if (g_compositor.dirty_region.valid) {
-        int x1 = MIN(g_compositor.dirty_region.x, x);
-        int y1 = MIN(g_compositor.dirty_region.y, y);
-        int x2 = MAX(g_compositor.dirty_region.x + g_compositor.dirty_region.width, x + w);
-        int y2 = MAX(g_compositor.dirty_region.y + g_compositor.dirty_region.height, y + h);
-        g_compositor.dirty_region.x = x1;
-        g_compositor.dirty_region.y = y1;
-        g_compositor.dirty_region.width = x2 - x1;
-        g_compositor.dirty_region.height = y2 - y1;
-    } else {
-        g_compositor.dirty_region.x = x;
-        g_compositor.dirty_region.y = y;
-        g_compositor.dirty_region.width = w;
-        g_compositor.dirty_region.height = h;
-        g_compositor.dirty_region.valid = true;
+    dirty_rect_t rect = { x, y, w, h, true };
+
+    /*
+     * Absorb entries rect covers and merge with any entry whose bounding
+     * box wastes little; a merged rectangle may now reach others, so start
+     * over until nothing changes.
+     */
+    uint32_t i = 0;
+    while (i < g_compositor.dirty_count) {
+        dirty_rect_t *cur = &g_compositor.dirty_rects[i];
+        dirty_rect_t merged;
+
+        if (rect_contains(cur, &rect)) {
+            return;
+        }
+        rect_union(cur, &rect, &merged);
+        if (rect_area(&merged) <= rect_area(cur) + rect_area(&rect) + COMPOSITOR_MERGE_SLACK) {
+            rect = merged;
+            compositor_drop_dirty(i);
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    /* List full: merge with the entry that grows least */
+    while (g_compositor.dirty_count >= COMPOSITOR_MAX_DIRTY_RECTS) {
+        uint32_t best = 0;
+        uint64_t best_growth = UINT64_MAX;
+        for (i = 0; i < g_compositor.dirty_count; i++) {
+            dirty_rect_t merged;
+            rect_union(&g_compositor.dirty_rects[i], &rect, &merged);
+            uint64_t growth = rect_area(&merged) - rect_area(&g_compositor.dirty_rects[i]);
+            if (growth < best_growth) {
+                best_growth = growth;
+                best = i;
+            }
+        }
+        rect_union(&g_compositor.dirty_rects[best], &rect, &rect);
+        compositor_drop_dirty(best);
     }
+
+    g_compositor.dirty_rects[g_compositor.dirty_count++] = rect;
 }
 
 /**
- * Mark entire screen dirty
+ * Mark a window's area dirty
  */
-void compositor_invalidate_all(void) {
-    g_compositor.needs_full_redraw = true;
-    g_compositor.dirty_region.x = 0;
-    g_compositor.dirty_region.y = 0;
-    g_compositor.dirty_region.width = g_compositor.screen_width;
-    g_compositor.dirty_region.height = g_compositor.screen_height;
-    g_compositor.dirty_region.valid = true;
+void compositor_invalidate_window(window_t *win) {
+    if (!win) {
+        return;
+    }
+
+    dirty_rect_t bounds;
+    compositor_window_bounds(win, &bounds);
+    compositor_invalidate(bounds.x, bounds.y, bounds.width, bounds.height);
 }
 
 /**
- * Find window at screen coordinates
+ * Mark part of a window's content dirty
  */
-window_t *compositor_find_window_at(int x, int y) {
-    /* Search from front to back (highest z_order first) */
-    window_t *win = g_compositor.window_tail;
-    while (win) {
-        if (!(win->flags & WINDOW_FLAG_VISIBLE) || (win->flags & WINDOW_FLAG_MINIMIZED)) {
-            win = win->prev;
-            continue;
-        }
+void compositor_invalidate_window_rect(window_t *win, int x, int y, int w, int h) {
+    if (!win) {
+        return;
+    }
 
-        int total_w, total_h;
-        compositor_get_window_total_size(win, &total_w, &total_h);
+    int content_x, content_y;
+    compositor_get_window_content_pos(win, &content_x, &content_y);
+    compositor_invalidate(content_x + x, content_y + y, w, h);
+}
 
-        int win_x = win->x;
-        int win_y = win->y;
-        if (win->flags & WINDOW_FLAG_DECORATED) {
-            win_y -= WINDOW_TITLE_BAR_HEIGHT;
-        }
+/**
+ * Submit a region a client has drawn
+ */
+void compositor_commit_window(window_t *win, int x, int y, int w, int h) {
+    if (!win || !win->buffer) {
+        return;
+    }
 
-        if (x >= win_x && x < win_x + total_w &&
-            y >= win_y && y < win_y + total_h) {
-            return win;
+    if (w <= 0 || h <= 0) {
+        x = 0;
+        y = 0;
+        w = win->width;
+        h = win->height;
+    }
+
+    int x_start = MAX(x, 0);
+    int y_start = MAX(y, 0);
+    int x_end = MIN(x + w, win->width);
+    int y_end = MIN(y + h, win->height);
+    if (x_start >= x_end || y_start >= y_end) {
+        return;
+    }
+
+    /* The client may have drawn on another CPU */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    compositor_invalidate_window_rect(win, x_start, y_start, x_end - x_start,
+                                      y_end - y_start);
+}
+
+/**
+ * Map a window's buffer into the calling process
+ */
+int64_t compositor_map_window_buffer(window_t *win) {
+    process_t *proc = process_get_current();
+    if (!win || !win->buffer || proc == NULL) {
+        return -EINVAL;
+    }
+
+    size_t size = win->buffer_pages * PAGE_SIZE;
+    physaddr_t pml4 = vmm_get_current_address_space();
+    physaddr_t frames = (physaddr_t)(uintptr_t)win->buffer;
+    uint64_t flags = VMM_FLAG_USER | VMM_FLAG_WRITE | VMM_FLAG_NX | VMM_FLAG_SHARED;
+
+    virtaddr_t start = vma_find_free(process_vmas(proc), 0, size);
+    if (start == 0 || !vma_map_anon(process_vmas(proc), start, size, flags)) {
+        return -ENOMEM;
+    }
+
+    /* Install the pages now; the fault handler never fills these */
+    for (size_t i = 0; i < win->buffer_pages; i++) {
+        physaddr_t frame = frames + i * PAGE_SIZE;
+        if (!pmm_page_ref(frame) ||
+            !vmm_map_user_page(pml4, start + i * PAGE_SIZE, frame, flags)) {
+            vma_unmap(process_vmas(proc), pml4, start, size);
+            return -ENOMEM;
         }
-        win = win->prev;
     }
-    return NULL;
+
+    return (int64_t)start;
+}
+
+/**
+ * Move the rows of part of a window buffer
+ */
+void compositor_scroll_window(window_t *win, int x, int y, int w, int h, int dy) {
+    if (!win || !win->buffer) {
+        return;
+    }
+
+    /* Clip to the buffer */
+    int x_start = MAX(x, 0);
+    int y_start = MAX(y, 0);
+    int x_end = MIN(x + w, win->width);
+    int y_end = MIN(y + h, win->height);
+    if (x_start >= x_end || y_start >= y_end) {
+        return;
+    }
+
+    w = x_end - x_start;
+    h = y_end - y_start;
+    if (dy != 0 && dy < h && -dy < h) {
+        pixops_scroll_rect(&win->buffer[y_start * win->width + x_start], win->width, w, h, dy);
+    }
+    compositor_invalidate_window_rect(win, x_start, y_start, w, h);
+}
+
+/**
+ * Set the background painter
+ */
+void compositor_set_background(compositor_background_fn paint) {
+    g_compositor.background = paint;
+    compositor_invalidate_all();
+}
+
+/**
+ * Mark entire screen dirty
+ */
+void compositor_invalidate_all(void) {
+    g_compositor.needs_full_redraw = true;
+    g_compositor.dirty_rects[0].x = 0;
+    g_compositor.dirty_rects[0].y = 0;
+    g_compositor.dirty_rects[0].width = g_compositor.screen_width;
+    g_compositor.dirty_rects[0].height = g_compositor.screen_height;
+    g_compositor.dirty_rects[0].valid = true;
+    g_compositor.dirty_count = 1;
+}
+
+/**
+ * Find window at screen coordinates
+ */
+window_t *compositor_find_window_at(int x, int y) {
+    /* The topmost shown window whose bounds hold the point */
+    dirty_rect_t point = { x, y, 1, 1, true };
+    window_t *win = NULL;
+    return compositor_windows_in(&point, &win, 1) ? win : NULL;
 }
 
 /**
  * Get window by ID
  */
 window_t *compositor_get_window_by_id(uint32_t id) {
-    window_t *win = g_compositor.window_list;
+    window_t *win = g_compositor.id_buckets[id & (COMPOSITOR_ID_BUCKETS - 1)];
     while (win) {
         if (win->id == id) {
             return win;
         }
-        win = win->next;
+        win = win->hash_next;
     }
     return NULL;
 }
@@ -561,15 +860,10 @@ void compositor_set_window_visible(window_t *win, bool visible) {
     } else {
         win->flags &= ~WINDOW_FLAG_VISIBLE;
     }
+    compositor_index_window(win);
 
     /* Mark window area dirty */
-    int total_w, total_h;
-    compositor_get_window_total_size(win, &total_w, &total_h);
-    int win_y = win->y;
-    if (win->flags & WINDOW_FLAG_DECORATED) {
-        win_y -= WINDOW_TITLE_BAR_HEIGHT;
-    }
-    compositor_invalidate(win->x, win_y, total_w, total_h);
+    compositor_invalidate_window(win);
 }
 
 /**
@@ -581,6 +875,7 @@ void compositor_minimize_window(window_t *win) {
     }
 
     win->flags |= WINDOW_FLAG_MINIMIZED;
+    compositor_index_window(win);
 
     /* If this was active, activate next window */
     if (g_compositor.active_window == win) {
@@ -593,7 +888,7 @@ void compositor_minimize_window(window_t *win) {
         compositor_set_active_window(next);
     }
 
-    compositor_invalidate_all();
+    compositor_invalidate_window(win);
     kprintf("[COMPOSITOR] Minimized window %u\n", win->id);
 }
 
@@ -626,6 +921,7 @@ void compositor_maximize_window(window_t *win) {
     win->y = (win->flags & WINDOW_FLAG_DECORATED) ? WINDOW_TITLE_BAR_HEIGHT : 0;
     compositor_resize_window(win, g_compositor.screen_width - 2 * WINDOW_BORDER_WIDTH,
                             new_height);
+    compositor_index_window(win);
 
     compositor_invalidate_all();
     kprintf("[COMPOSITOR] Maximized window %u\n", win->id);
@@ -650,6 +946,7 @@ void compositor_restore_window(window_t *win) {
         win->y = win->saved_y;
         compositor_resize_window(win, win->saved_width, win->saved_height);
     }
+    compositor_index_window(win);
 
     compositor_invalidate_all();
     kprintf("[COMPOSITOR] Restored window %u\n", win->id);
@@ -711,53 +1008,387 @@ void compositor_get_window_content_pos(window_t *win, int *content_x, int *conte
  * ============================================================================ */
 
 /**
- * Draw desktop background
+ * Screen area a window draws, decorations included
+ */
+static void compositor_window_bounds(const window_t *win, dirty_rect_t *out) {
+    out->x = win->x;
+    out->y = win->y;
+    out->width = win->width;
+    out->height = win->height;
+    out->valid = true;
+
+    if (win->flags & WINDOW_FLAG_DECORATED) {
+        out->x -= WINDOW_BORDER_WIDTH;
+        out->y -= WINDOW_TITLE_BAR_HEIGHT;
+        out->width += 2 * WINDOW_BORDER_WIDTH;
+        out->height += WINDOW_TITLE_BAR_HEIGHT + WINDOW_BORDER_WIDTH;
+    }
+}
+
+/**
+ * Check if a window is drawn at all
+ */
+static bool compositor_window_shown(const window_t *win) {
+    return (win->flags & WINDOW_FLAG_VISIBLE) && !(win->flags & WINDOW_FLAG_MINIMIZED);
+}
+
+/**
+ * Tiles a screen rectangle overlaps, clipped to the grid (x1, y1 exclusive)
+ * @return false if it overlaps none
+ */
+static bool compositor_tile_range(const dirty_rect_t *r, int32_t *x0, int32_t *y0,
+                                  int32_t *x1, int32_t *y1) {
+    int32_t left = MAX(r->x, 0);
+    int32_t top = MAX(r->y, 0);
+    int32_t right = MIN(r->x + r->width, (int32_t)g_compositor.screen_width);
+    int32_t bottom = MIN(r->y + r->height, (int32_t)g_compositor.screen_height);
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+
+    *x0 = left >> COMPOSITOR_TILE_SHIFT;
+    *y0 = top >> COMPOSITOR_TILE_SHIFT;
+    *x1 = ((right - 1) >> COMPOSITOR_TILE_SHIFT) + 1;
+    *y1 = ((bottom - 1) >> COMPOSITOR_TILE_SHIFT) + 1;
+    return true;
+}
+
+static inline uint64_t *compositor_tile_mask(int32_t tx, int32_t ty) {
+    size_t tile = (size_t)ty * g_compositor.tiles_x + (size_t)tx;
+    return &g_compositor.tile_masks[tile * COMPOSITOR_TILE_WORDS];
+}
+
+/**
+ * Remove a window from the tiles it is marked in
+ */
+static void compositor_clear_tiles(window_t *win) {
+    if (g_compositor.tile_masks) {
+        uint64_t bit = 1ULL << (win->slot % 64);
+        for (int32_t ty = win->tile_y0; ty < win->tile_y1; ty++) {
+            for (int32_t tx = win->tile_x0; tx < win->tile_x1; tx++) {
+                compositor_tile_mask(tx, ty)[win->slot / 64] &= ~bit;
+            }
+        }
+    }
+    win->tile_x0 = win->tile_x1 = 0;
+    win->tile_y0 = win->tile_y1 = 0;
+}
+
+/**
+ * Mark a window in the tiles its bounds overlap now
+ * Called whenever its bounds change or it is shown or hidden.
+ */
+static void compositor_index_window(window_t *win) {
+    compositor_clear_tiles(win);
+    if (!g_compositor.tile_masks || !compositor_window_shown(win)) {
+        return;
+    }
+
+    dirty_rect_t bounds;
+    int32_t x0, y0, x1, y1;
+    compositor_window_bounds(win, &bounds);
+    if (!compositor_tile_range(&bounds, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    uint64_t bit = 1ULL << (win->slot % 64);
+    for (int32_t ty = y0; ty < y1; ty++) {
+        for (int32_t tx = x0; tx < x1; tx++) {
+            compositor_tile_mask(tx, ty)[win->slot / 64] |= bit;
+        }
+    }
+    win->tile_x0 = x0;
+    win->tile_y0 = y0;
+    win->tile_x1 = x1;
+    win->tile_y1 = y1;
+}
+
+/**
+ * Shown windows overlapping a rectangle, topmost first
+ * Only windows marked in the tiles the rectangle overlaps are looked at,
+ * unless it reaches off screen.
+ * @param rect Screen rectangle
+ * @param out Receives up to max windows
+ * @param max Size of out; with fewer places than windows, the topmost are kept
+ * @return Number of windows stored
+ */
+static uint32_t compositor_windows_in(const dirty_rect_t *rect, window_t **out, uint32_t max) {
+    uint32_t n = 0;
+    dirty_rect_t bounds, in;
+    dirty_rect_t screen = { 0, 0, (int32_t)g_compositor.screen_width,
+                            (int32_t)g_compositor.screen_height, true };
+
+    /* Off the grid, windows can only be found by walking them all */
+    if (!g_compositor.tile_masks || !rect_contains(&screen, rect)) {
+        for (window_t *win = g_compositor.window_tail; win && n < max; win = win->prev) {
+            compositor_window_bounds(win, &bounds);
+            if (compositor_window_shown(win) && rect_intersect(&bounds, rect, &in)) {
+                out[n++] = win;
+            }
+        }
+        return n;
+    }
+
+    /* Every window in any of the tiles */
+    int32_t x0, y0, x1, y1;
+    uint64_t mask[COMPOSITOR_TILE_WORDS] = { 0 };
+    if (max == 0 || !compositor_tile_range(rect, &x0, &y0, &x1, &y1)) {
+        return 0;
+    }
+    for (int32_t ty = y0; ty < y1; ty++) {
+        for (int32_t tx = x0; tx < x1; tx++) {
+            const uint64_t *tile = compositor_tile_mask(tx, ty);
+            for (uint32_t w = 0; w < COMPOSITOR_TILE_WORDS; w++) {
+                mask[w] |= tile[w];
+            }
+        }
+    }
+
+    /* Keep those really overlapping, sorted by z_order as they come */
+    for (uint32_t w = 0; w < COMPOSITOR_TILE_WORDS; w++) {
+        for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+            window_t *win = g_compositor.slots[w * 64 + (uint32_t)__builtin_ctzll(bits)];
+            compositor_window_bounds(win, &bounds);
+            if (!rect_intersect(&bounds, rect, &in)) {
+                continue;
+            }
+
+            uint32_t i;
+            if (n < max) {
+                i = n++;
+            } else if (out[max - 1]->z_order < win->z_order) {
+                i = max - 1;
+            } else {
+                continue;
+            }
+            while (i > 0 && out[i - 1]->z_order < win->z_order) {
+                out[i] = out[i - 1];
+                i--;
+            }
+            out[i] = win;
+        }
+    }
+    return n;
+}
+
+/**
+ * Set of disjoint rectangles: the part of a dirty rectangle not yet painted
+ */
+typedef struct clip_region {
+    dirty_rect_t rects[COMPOSITOR_MAX_CLIP_RECTS];
+    uint32_t count;
+} clip_region_t;
+
+/* Used by compositor_render_rect; rendering is single-threaded */
+static clip_region_t g_uncovered;
+static clip_region_t g_scratch;
+static window_t *g_overlapping[COMPOSITOR_MAX_WINDOWS];
+
+/**
+ * Remove a rectangle from a region
+ * Each piece it overlaps splits into up to four around it.
+ * @return false if the pieces do not fit (region is then unchanged)
+ */
+static bool clip_region_subtract(clip_region_t *region, const dirty_rect_t *cut) {
+    g_scratch.count = 0;
+
+    for (uint32_t i = 0; i < region->count; i++) {
+        const dirty_rect_t *r = &region->rects[i];
+        dirty_rect_t in;
+        dirty_rect_t parts[4];
+        uint32_t n = 0;
+
+        if (!rect_intersect(r, cut, &in)) {
+            parts[n++] = *r;
+        } else {
+            /* Full-width bands above and below, then the sides */
+            if (in.y > r->y) {
+                parts[n++] = (dirty_rect_t){ r->x, r->y, r->width, in.y - r->y, true };
+            }
+            if (in.y + in.height < r->y + r->height) {
+                parts[n++] = (dirty_rect_t){ r->x, in.y + in.height, r->width,
+                                             r->y + r->height - in.y - in.height, true };
+            }
+            if (in.x > r->x) {
+                parts[n++] = (dirty_rect_t){ r->x, in.y, in.x - r->x, in.height, true };
+            }
+            if (in.x + in.width < r->x + r->width) {
+                parts[n++] = (dirty_rect_t){ in.x + in.width, in.y,
+                                             r->x + r->width - in.x - in.width, in.height, true };
+            }
+        }
+
+        if (g_scratch.count + n > COMPOSITOR_MAX_CLIP_RECTS) {
+            return false;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            g_scratch.rects[g_scratch.count++] = parts[j];
+        }
+    }
+
+    *region = g_scratch;
+    return true;
+}
+
+/**
+ * Repaint a dirty rectangle back to front
+ * Windows below the topmost opaque window covering all of it are skipped.
+ * Used when a transparent window is involved or the visible region gets
+ * too fragmented.
+ */
+static void compositor_render_rect_painter(const dirty_rect_t *rect, window_t *const *wins,
+                                           uint32_t count) {
+    uint32_t start = count;
+    for (uint32_t i = 0; i < count; i++) {
+        dirty_rect_t bounds;
+        if (wins[i]->flags & WINDOW_FLAG_TRANSPARENT) {
+            continue;
+        }
+        compositor_window_bounds(wins[i], &bounds);
+        if (rect_contains(&bounds, rect)) {
+            start = i + 1;
+            break;
+        }
+    }
+
+    if (start == count) {
+        compositor_fill_background(rect);
+    }
+
+    /* wins is topmost first */
+    while (start > 0) {
+        compositor_draw_window(wins[--start], rect);
+    }
+}
+
+/**
+ * Repaint a dirty rectangle in the back buffer
+ *
+ * Walks the windows front to back. Each is painted only in the pieces of
+ * the rectangle still uncovered, which its bounds are then cut out of; a
+ * window with no uncovered piece is culled. The desktop background fills
+ * whatever is left.
+ */
+static void compositor_render_rect(const dirty_rect_t *rect) {
+    window_t **wins = g_overlapping;
+    uint32_t count = compositor_windows_in(rect, wins, COMPOSITOR_MAX_WINDOWS);
+
+    /* Alpha blending needs what lies below drawn first */
+    for (uint32_t i = 0; i < count; i++) {
+        if (wins[i]->flags & WINDOW_FLAG_TRANSPARENT) {
+            compositor_render_rect_painter(rect, wins, count);
+            return;
+        }
+    }
+
+    g_uncovered.rects[0] = *rect;
+    g_uncovered.count = 1;
+
+    for (uint32_t w = 0; w < count && g_uncovered.count; w++) {
+        window_t *win = wins[w];
+        dirty_rect_t bounds;
+        compositor_window_bounds(win, &bounds);
+
+        bool drawn = false;
+        for (uint32_t i = 0; i < g_uncovered.count; i++) {
+            dirty_rect_t piece;
+            if (rect_intersect(&g_uncovered.rects[i], &bounds, &piece)) {
+                compositor_draw_window(win, &piece);
+                drawn = true;
+            }
+        }
+        if (!drawn) {
+            g_compositor.windows_culled++;
+            continue;
+        }
+
+        if (!clip_region_subtract(&g_uncovered, &bounds)) {
+            /* Too fragmented: paint the whole rectangle over again */
+            compositor_render_rect_painter(rect, wins, count);
+            return;
+        }
+    }
+
+    for (uint32_t i = 0; i < g_uncovered.count; i++) {
+        compositor_fill_background(&g_uncovered.rects[i]);
+    }
+}
+
+/**
+ * Paint the desktop background in a rectangle of the screen
+ */
+static void compositor_fill_background(const dirty_rect_t *rect) {
+    dirty_rect_t screen = { 0, 0, (int32_t)g_compositor.screen_width,
+                            (int32_t)g_compositor.screen_height, true };
+    dirty_rect_t in;
+
+    if (!g_compositor.background) {
+        compositor_fill(rect, rect->x, rect->y, rect->width, rect->height,
+                        DESKTOP_BACKGROUND_COLOR);
+        return;
+    }
+    if (!rect_intersect(rect, &screen, &in)) {
+        return;
+    }
+
+    int screen_w = (int)g_compositor.screen_width;
+    g_compositor.background(&g_compositor.back_buffer[in.y * screen_w + in.x], screen_w,
+                            in.x, in.y, in.width, in.height);
+}
+
+/**
+ * Fill the part of a rectangle inside clip with a solid color
  */
-static void compositor_draw_desktop_background(void) {
-    uint32_t *buffer = g_compositor.back_buffer;
-    uint32_t width = g_compositor.screen_width;
-    uint32_t height = g_compositor.screen_height;
+static void compositor_fill(const dirty_rect_t *clip, int x, int y, int w, int h, uint32_t color) {
+    dirty_rect_t area = { x, y, w, h, true };
+    dirty_rect_t in;
 
-    /* Fill with solid color for now */
-    for (uint32_t i = 0; i < width * height; i++) {
-        buffer[i] = DESKTOP_BACKGROUND_COLOR;
+    if (w <= 0 || h <= 0 || !rect_intersect(&area, clip, &in)) {
+        return;
     }
+
+    int screen_w = (int)g_compositor.screen_width;
+    pixops_fill_rect(&g_compositor.back_buffer[in.y * screen_w + in.x], screen_w,
+                     in.width, in.height, color);
 }
 
 /**
- * Draw a single window (decorations + content)
+ * Draw a single window (decorations + content) within clip
+ * Nothing is drawn outside the window's bounds.
  */
-static void compositor_draw_window(window_t *win) {
+static void compositor_draw_window(window_t *win, const dirty_rect_t *clip) {
+    dirty_rect_t bounds, in;
+
     if (!win) {
         return;
     }
+    compositor_window_bounds(win, &bounds);
+    if (!rect_intersect(&bounds, clip, &in)) {
+        return;
+    }
 
     /* Draw decorations first (below content) */
     if (win->flags & WINDOW_FLAG_DECORATED) {
-        compositor_draw_window_decorations(win);
+        compositor_draw_window_decorations(win, &in);
     }
 
     /* Then blit window buffer */
-    compositor_blit_window_buffer(win);
+    compositor_blit_window_buffer(win, &in);
 }
 
 /**
- * Draw window decorations (title bar, borders)
+ * Draw window decorations (title bar, borders) within clip
  */
-static void compositor_draw_window_decorations(window_t *win) {
+static void compositor_draw_window_decorations(window_t *win, const dirty_rect_t *clip) {
     if (!win || !(win->flags & WINDOW_FLAG_DECORATED)) {
         return;
     }
 
-    uint32_t *buffer = g_compositor.back_buffer;
-    int screen_w = (int)g_compositor.screen_width;
-    int screen_h = (int)g_compositor.screen_height;
-
     int total_w, total_h;
     compositor_get_window_total_size(win, &total_w, &total_h);
 
-    /* Calculate title bar position */
-    int title_x = win->x;
+    /* Title bar spans the borders too */
+    int title_x = win->x - WINDOW_BORDER_WIDTH;
     int title_y = win->y - WINDOW_TITLE_BAR_HEIGHT;
     int title_w = total_w;
     int title_h = WINDOW_TITLE_BAR_HEIGHT;
@@ -769,13 +1400,7 @@ static void compositor_draw_window_decorations(window_t *win) {
                             WINDOW_BORDER_ACTIVE : WINDOW_BORDER_COLOR;
 
     /* Draw title bar */
-    for (int y = title_y; y < title_y + title_h; y++) {
-        if (y < 0 || y >= screen_h) continue;
-        for (int x = title_x; x < title_x + title_w; x++) {
-            if (x < 0 || x >= screen_w) continue;
-            buffer[y * screen_w + x] = title_color;
-        }
-    }
+    compositor_fill(clip, title_x, title_y, title_w, title_h, title_color);
 
     /* Draw title text */
     if (win->title[0] != '\0') {
@@ -785,14 +1410,7 @@ static void compositor_draw_window_decorations(window_t *win) {
         /* Simple text rendering - each character is 8 pixels wide */
         for (int i = 0; win->title[i] && text_x < title_x + title_w - 60; i++) {
             /* Draw character placeholder (actual font rendering would go here) */
-            for (int cy = 0; cy < 12 && text_y + cy < screen_h; cy++) {
-                if (text_y + cy < 0) continue;
-                for (int cx = 0; cx < 7 && text_x + cx < screen_w; cx++) {
-                    if (text_x + cx < 0) continue;
-                    /* Simple character representation */
-                    buffer[(text_y + cy) * screen_w + (text_x + cx)] = WINDOW_TITLE_TEXT_COLOR;
-                }
-            }
+            compositor_fill(clip, text_x, text_y, 7, 12, WINDOW_TITLE_TEXT_COLOR);
             text_x += 8;
         }
     }
@@ -800,118 +1418,57 @@ static void compositor_draw_window_decorations(window_t *win) {
     /* Draw window close button (red X in top-right) */
     int btn_x = title_x + title_w - WINDOW_BUTTON_SIZE - WINDOW_BUTTON_PADDING;
     int btn_y = title_y + (WINDOW_TITLE_BAR_HEIGHT - WINDOW_BUTTON_SIZE) / 2;
-
-    for (int y = btn_y; y < btn_y + WINDOW_BUTTON_SIZE && y < screen_h; y++) {
-        if (y < 0) continue;
-        for (int x = btn_x; x < btn_x + WINDOW_BUTTON_SIZE && x < screen_w; x++) {
-            if (x < 0) continue;
-            buffer[y * screen_w + x] = 0xFFFF4444;  /* Red */
-        }
-    }
-
-    /* Draw left border */
-    for (int y = win->y; y < win->y + win->height + WINDOW_BORDER_WIDTH && y < screen_h; y++) {
-        if (y < 0) continue;
-        for (int x = win->x - WINDOW_BORDER_WIDTH; x < win->x && x < screen_w; x++) {
-            if (x < 0) continue;
-            buffer[y * screen_w + x] = border_color;
-        }
-    }
-
-    /* Draw right border */
-    for (int y = win->y; y < win->y + win->height + WINDOW_BORDER_WIDTH && y < screen_h; y++) {
-        if (y < 0) continue;
-        for (int x = win->x + win->width; x < win->x + win->width + WINDOW_BORDER_WIDTH && x < screen_w; x++) {
-            if (x < 0) continue;
-            buffer[y * screen_w + x] = border_color;
-        }
-    }
-
-    /* Draw bottom border */
-    for (int y = win->y + win->height; y < win->y + win->height + WINDOW_BORDER_WIDTH && y < screen_h; y++) {
-        if (y < 0) continue;
-        for (int x = win->x - WINDOW_BORDER_WIDTH; x < win->x + win->width + WINDOW_BORDER_WIDTH && x < screen_w; x++) {
-            if (x < 0) continue;
-            buffer[y * screen_w + x] = border_color;
-        }
-    }
+    compositor_fill(clip, btn_x, btn_y, WINDOW_BUTTON_SIZE, WINDOW_BUTTON_SIZE,
+                    0xFFFF4444);  /* Red */
+
+    /* Draw left, right and bottom borders */
+    compositor_fill(clip, win->x - WINDOW_BORDER_WIDTH, win->y,
+                    WINDOW_BORDER_WIDTH, win->height + WINDOW_BORDER_WIDTH, border_color);
+    compositor_fill(clip, win->x + win->width, win->y,
+                    WINDOW_BORDER_WIDTH, win->height + WINDOW_BORDER_WIDTH, border_color);
+    compositor_fill(clip, win->x - WINDOW_BORDER_WIDTH, win->y + win->height,
+                    total_w, WINDOW_BORDER_WIDTH, border_color);
 }
 
 /**
- * Blit window buffer to back buffer with optional alpha blending
+ * Blit the part of a window buffer inside clip, with optional alpha blending
  */
-static void compositor_blit_window_buffer(window_t *win) {
+static void compositor_blit_window_buffer(window_t *win, const dirty_rect_t *clip) {
     if (!win || !win->buffer) {
         return;
     }
 
-    uint32_t *dst = g_compositor.back_buffer;
-    uint32_t *src = win->buffer;
-    int screen_w = (int)g_compositor.screen_width;
-    int screen_h = (int)g_compositor.screen_height;
-
-    bool use_alpha = (win->flags & WINDOW_FLAG_TRANSPARENT) != 0;
-
-    for (int row = 0; row < win->height; row++) {
-        int dst_y = win->y + row;
-        if (dst_y < 0 || dst_y >= screen_h) continue;
-
-        for (int col = 0; col < win->width; col++) {
-            int dst_x = win->x + col;
-            if (dst_x < 0 || dst_x >= screen_w) continue;
+    dirty_rect_t content = { win->x, win->y, win->width, win->height, true };
+    dirty_rect_t in;
+    if (!rect_intersect(&content, clip, &in)) {
+        return;
+    }
 
-            uint32_t pixel = src[row * win->width + col];
-            int dst_idx = dst_y * screen_w + dst_x;
+    int screen_w = (int)g_compositor.screen_width;
+    uint32_t *dst = &g_compositor.back_buffer[in.y * screen_w + in.x];
+    const uint32_t *src = &win->buffer[(in.y - win->y) * win->width + (in.x - win->x)];
 
-            if (use_alpha) {
-                uint8_t alpha = FB_GET_ALPHA(pixel);
-                if (alpha == 255) {
-                    dst[dst_idx] = pixel;
-                } else if (alpha > 0) {
-                    dst[dst_idx] = alpha_blend(pixel, dst[dst_idx]);
-                }
-                /* alpha == 0: fully transparent, don't draw */
-            } else {
-                dst[dst_idx] = pixel;
-            }
-        }
+    if (win->flags & WINDOW_FLAG_TRANSPARENT) {
+        /* Alpha 0 leaves the pixel below as it is */
+        pixops_blend_rect(dst, screen_w, src, win->width, in.width, in.height);
+    } else {
+        pixops_copy_rect(dst, screen_w, src, win->width, in.width, in.height);
     }
 }
 
 /**
- * Swap back buffer to front buffer
+ * Copy a rectangle of the back buffer to the next frame on screen
  */
-static void compositor_swap_buffers(void) {
+static void compositor_swap_rect(const dirty_rect_t *rect) {
     if (!g_compositor.back_buffer || !g_compositor.front_buffer) {
         return;
     }
 
-    /* Copy entire back buffer to front buffer */
-    size_t buffer_size = g_compositor.screen_width * g_compositor.screen_height * sizeof(uint32_t);
-    memcpy(g_compositor.front_buffer, g_compositor.back_buffer, buffer_size);
-}
-
-/**
- * Alpha blend foreground over background
- * Returns blended color
- */
-static uint32_t alpha_blend(uint32_t fg, uint32_t bg) {
-    uint8_t fg_a = FB_GET_ALPHA(fg);
-    uint8_t fg_r = FB_GET_RED(fg);
-    uint8_t fg_g = FB_GET_GREEN(fg);
-    uint8_t fg_b = FB_GET_BLUE(fg);
-
-    uint8_t bg_r = FB_GET_RED(bg);
-    uint8_t bg_g = FB_GET_GREEN(bg);
-    uint8_t bg_b = FB_GET_BLUE(bg);
-
-    /* Standard alpha blending: out = fg * alpha + bg * (1 - alpha) */
-    uint8_t inv_a = 255 - fg_a;
-    uint8_t out_r = (fg_r * fg_a + bg_r * inv_a) / 255;
-    uint8_t out_g = (fg_g * fg_a + bg_g * inv_a) / 255;
-    uint8_t out_b = (fg_b * fg_a + bg_b * inv_a) / 255;
-
-    return FB_MAKE_COLOR(255, out_r, out_g, out_b);
+    /* Through the driver: it honours the pitch and keeps the VRAM shadow current */
+    int screen_w = (int)g_compositor.screen_width;
+    size_t offset = (size_t)rect->y * screen_w + rect->x;
+    fb_stage_rect(rect->x, rect->y, rect->width, rect->height,
+                  &g_compositor.back_buffer[offset], screen_w);
 }
 
 /**
@@ -3,6 +3,27 @@
  *
  * Manages multiple windows with Z-ordering, double buffering,
  * and compositing all windows to the framebuffer.
+ *
+ * Only damaged parts of the screen are redrawn. compositor_invalidate adds
+ * a rectangle to a short dirty list, merging it with an entry when their
+ * bounding box wastes no more than COMPOSITOR_MERGE_SLACK pixels.
+ * compositor_render repaints and copies each dirty rectangle alone. It
+ * walks the windows front to back and paints each only where no opaque
+ * window above covers it, so hidden windows are never drawn.
+ *
+ * Frames are paced by a frame clock: compositor_frame_tick renders at
+ * most once per COMPOSITOR_REFRESH_HZ period, so invalidations made
+ * between two refreshes are coalesced into one frame. Each frame is
+ * staged on the framebuffer's hidden page and flipped in at the next
+ * vertical retrace when the display supports page flipping.
+ *
+ * A window's buffer is whole physical pages, so it can be mapped into a
+ * client process as well: the client draws straight into the pages the
+ * compositor composites from and calls compositor_commit_window with the
+ * part it changed, much like a Wayland surface commit. Nothing is copied
+ * between the two. The compositor holds one reference on each page and
+ * every mapping its own, so a client mapping outlives a resize or destroy
+ * (showing stale pixels) until the client unmaps it.
  */
 
 #ifndef _AAAOS_COMPOSITOR_H
@@ -11,7 +32,28 @@
 #include "../../kernel/include/types.h"
 
 /* Maximum number of windows */
-#define COMPOSITOR_MAX_WINDOWS      64
+#define COMPOSITOR_MAX_WINDOWS      256
+
+/* Buckets in the window ID hash table (power of two) */
+#define COMPOSITOR_ID_BUCKETS       64
+
+/* Hit-testing tiles are (1 << COMPOSITOR_TILE_SHIFT) pixels square */
+#define COMPOSITOR_TILE_SHIFT       6
+
+/* Words in a tile's mask of the windows overlapping it */
+#define COMPOSITOR_TILE_WORDS       ((COMPOSITOR_MAX_WINDOWS + 63) / 64)
+
+/* Dirty rectangles kept between frames; a further one is merged in */
+#define COMPOSITOR_MAX_DIRTY_RECTS  16
+
+/* Pixels a merge may add beyond the area of the two rectangles */
+#define COMPOSITOR_MERGE_SLACK      4096
+
+/* Pieces the visible part of a dirty rectangle may split into */
+#define COMPOSITOR_MAX_CLIP_RECTS   32
+
+/* Display refresh rate the frame clock paces rendering to */
+#define COMPOSITOR_REFRESH_HZ       60
 
 /* Maximum window title length */
 #define WINDOW_TITLE_MAX_LEN        128
@@ -57,6 +99,7 @@ typedef struct window {
     int32_t width;                          /* Window content width */
     int32_t height;                         /* Window content height */
     uint32_t *buffer;                       /* Window pixel buffer (32-bit ARGB) */
+    size_t buffer_pages;                    /* Contiguous frames behind buffer */
     int32_t z_order;                        /* Z-order (higher = on top) */
     uint32_t flags;                         /* Window flags */
     char title[WINDOW_TITLE_MAX_LEN];       /* Window title */
@@ -71,6 +114,12 @@ typedef struct window {
     /* Linked list pointers for window management */
     struct window *next;
     struct window *prev;
+
+    /* Spatial index, kept by the compositor */
+    struct window *hash_next;               /* Next window in the same ID bucket */
+    uint32_t slot;                          /* Bit standing for the window in tile masks */
+    int32_t tile_x0, tile_y0;               /* First tile the window is marked in */
+    int32_t tile_x1, tile_y1;               /* Tile after the last (x0 == x1: none) */
 } window_t;
 
 /**
@@ -85,6 +134,18 @@ typedef struct dirty_rect {
     bool valid;
 } dirty_rect_t;
 
+/**
+ * Paints what lies under the windows into part of the back buffer
+ * @param dst Back buffer pixel at (x, y)
+ * @param stride Pixels from one back buffer row to the next
+ * @param x Screen X of the region
+ * @param y Screen Y of the region
+ * @param w Region width
+ * @param h Region height
+ */
+typedef void (*compositor_background_fn)(uint32_t *dst, ptrdiff_t stride,
+                                         int x, int y, int w, int h);
+
 /**
  * Compositor state structure
  * Global state for the window compositor
@@ -98,17 +159,42 @@ typedef struct compositor {
     window_t *window_list;                  /* Head of window linked list (back to front) */
     window_t *window_tail;                  /* Tail of window linked list (frontmost) */
     window_t *active_window;                /* Currently active/focused window */
+    compositor_background_fn background;    /* Paints the desktop (NULL: solid color) */
 
     uint32_t window_count;                  /* Number of active windows */
     uint32_t next_window_id;                /* Next available window ID */
     int32_t next_z_order;                   /* Next available Z-order value */
 
-    dirty_rect_t dirty_region;              /* Current dirty region */
+    /*
+     * Spatial index: windows by ID, and for each screen tile a mask of the
+     * shown windows whose bounds overlap it. Hit tests and occlusion look
+     * only at the windows in the tiles concerned, ordered by z_order. With
+     * no tile grid (allocation failed) the window list is walked instead.
+     */
+    window_t *id_buckets[COMPOSITOR_ID_BUCKETS];  /* Chained on hash_next */
+    window_t *slots[COMPOSITOR_MAX_WINDOWS];      /* Window owning each mask bit */
+    uint64_t *tile_masks;                   /* COMPOSITOR_TILE_WORDS per tile, row major */
+    uint32_t tiles_x;                       /* Tiles per row */
+    uint32_t tiles_y;                       /* Tile rows */
+
+    dirty_rect_t dirty_rects[COMPOSITOR_MAX_DIRTY_RECTS]; /* Damage since last frame */
+    uint32_t dirty_count;                   /* Entries in dirty_rects */
     bool needs_full_redraw;                 /* Flag for full screen redraw */
     bool initialized;                       /* Compositor initialization status */
 
+    /* Frame clock */
+    uint64_t refresh_ns;                    /* Time between two display refreshes */
+    uint64_t next_frame_ns;                 /* Earliest time the next frame may render */
+
     /* Statistics */
     uint64_t frame_count;                   /* Number of frames rendered */
+    uint64_t frames_flipped;                /* Frames shown by a page flip */
+    uint64_t frames_deferred;               /* Ticks with damage held for the next refresh */
+    uint64_t frame_time_last_ns;            /* Render and present time of the last frame */
+    uint64_t frame_time_max_ns;             /* Slowest frame */
+    uint64_t frame_time_total_ns;           /* Sum over all frames (average with frame_count) */
+    uint64_t pixels_composited;             /* Pixels repainted and copied to the screen */
+    uint64_t windows_culled;                /* Window draws skipped as fully covered */
     uint64_t windows_created;               /* Total windows created */
     uint64_t windows_destroyed;             /* Total windows destroyed */
 } compositor_t;
@@ -186,10 +272,26 @@ window_t *compositor_get_active_window(void);
 
 /**
  * Render all windows to the screen
- * Performs compositing and copies back buffer to front buffer
+ * Repaints the dirty rectangles in the back buffer and copies just
+ * those to the front buffer; does nothing if nothing is dirty. Renders
+ * at once, whatever the frame clock says.
  */
 void compositor_render(void);
 
+/**
+ * Render a frame if one is due
+ * Call this from the display loop as often as convenient: damage is
+ * rendered once the refresh period since the previous frame has passed,
+ * and held (coalescing further invalidations) until then.
+ * @return true if a frame was rendered
+ */
+bool compositor_frame_tick(void);
+
+/**
+ * Time the next frame may render (monotonic clock)
+ */
+uint64_t compositor_next_frame_ns(void);
+
 /**
  * Mark a rectangular region as dirty (needs redraw)
  * @param x Region X coordinate
@@ -199,11 +301,74 @@ void compositor_render(void);
  */
 void compositor_invalidate(int x, int y, int w, int h);
 
+/**
+ * Mark everything a window draws (decorations included) as dirty
+ * @param win Window whose area to invalidate
+ */
+void compositor_invalidate_window(window_t *win);
+
+/**
+ * Mark part of a window's content as dirty
+ * @param win Window drawn into
+ * @param x Region X in the window buffer
+ * @param y Region Y in the window buffer
+ * @param w Region width
+ * @param h Region height
+ */
+void compositor_invalidate_window_rect(window_t *win, int x, int y, int w, int h);
+
+/**
+ * Submit a region a client has finished drawing into a window buffer
+ * Orders the client's stores before the compositor's reads and marks the
+ * region, clipped to the buffer, dirty for the next frame. w or h of 0
+ * submits the whole buffer.
+ * @param win Window drawn into
+ * @param x Region X in the window buffer
+ * @param y Region Y in the window buffer
+ * @param w Region width
+ * @param h Region height
+ */
+void compositor_commit_window(window_t *win, int x, int y, int w, int h);
+
+/**
+ * Map a window's buffer into the calling process
+ * The mapping is shared and writable, rows are win->width pixels apart,
+ * and it keeps showing the pages it was made with: after a resize the
+ * client maps the buffer again.
+ * @param win Window whose buffer to map
+ * @return User address of the buffer, or negative error code
+ */
+int64_t compositor_map_window_buffer(window_t *win);
+
+/**
+ * Move the rows of part of a window buffer up or down
+ * The pixels already drawn are moved in place and the region marked
+ * dirty; the |dy| rows left behind keep their old contents for the caller
+ * to repaint. Scrolling content this way costs a copy rather than
+ * drawing every line again.
+ * @param win Window to scroll
+ * @param x Region X in the window buffer
+ * @param y Region Y in the window buffer
+ * @param w Region width
+ * @param h Region height
+ * @param dy Pixel rows to move by (negative moves them up)
+ */
+void compositor_scroll_window(window_t *win, int x, int y, int w, int h, int dy);
+
 /**
  * Mark entire screen as dirty
  */
 void compositor_invalidate_all(void);
 
+/**
+ * Set what is painted where no window covers the screen
+ * It is called only for the uncovered parts of dirty rectangles, so
+ * whoever owns the background invalidates what it changes and nothing
+ * else. NULL restores DESKTOP_BACKGROUND_COLOR.
+ * @param paint Background painter
+ */
+void compositor_set_background(compositor_background_fn paint);
+
 /**
  * Find window at screen coordinates
  * @param x Screen X coordinate
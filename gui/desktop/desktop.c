@@ -7,6 +7,9 @@
  * - Taskbar with start menu and running apps
  * - System tray with clock
  * - Application launcher/start menu
+ *
+ * Everything is drawn into the layers' buffers, never to the screen; the
+ * compositor composes them through desktop_paint_background.
  */
 
 #include "desktop.h"
@@ -17,6 +20,10 @@
 #include "../../kernel/mm/heap.h"
 #include "../../kernel/proc/process.h"
 #include "../../drivers/video/framebuffer.h"
+#include "../../drivers/video/pixops.h"
+#include "../../drivers/input/mouse.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/sched/timer.h"
 #include "../../drivers/timer/rtc.h"
 #include "../../lib/libc/string.h"
 
@@ -48,6 +55,9 @@ static start_menu_item_t g_start_menu_items[START_MENU_MAX_ITEMS];
 static uint32_t g_start_menu_item_count = 0;
 static int32_t g_start_menu_hover_index = -1;
 
+/* Longest string drawn into a layer (characters) */
+#define DESKTOP_TEXT_MAX            64
+
 /* Start menu colors */
 #define START_MENU_BG_COLOR         0xF0303030
 #define START_MENU_ITEM_HOVER       0xFF505050
@@ -74,6 +84,16 @@ static void desktop_update_taskbar(void);
 static void desktop_toggle_start_menu(void);
 static void desktop_setup_default_icons(void);
 static void desktop_setup_start_menu(void);
+static void desktop_set_start_menu_open(bool open);
+static bool desktop_layer_init(desktop_layer_id_t id, int32_t x, int32_t y,
+                               int32_t w, int32_t h, bool opaque);
+static void desktop_layer_show(desktop_layer_id_t id, bool visible);
+static void desktop_layer_place(desktop_layer_id_t id, int32_t x, int32_t y,
+                                int32_t w, int32_t h);
+static void desktop_layer_invalidate(desktop_layer_id_t id);
+static void desktop_paint_background(uint32_t *dst, ptrdiff_t stride, int x, int y, int w, int h);
+static void desktop_icon_changed(desktop_icon_t *icon);
+static void desktop_erase_icon(desktop_icon_t *icon);
 
 /* ============================================================================
  * Initialization and Shutdown
@@ -102,7 +122,6 @@ int desktop_init(void)
 
     /* Initialize wallpaper */
     g_desktop.wallpaper_color = DESKTOP_WALLPAPER_COLOR;
-    g_desktop.wallpaper_buffer = NULL;
     g_desktop.has_wallpaper_image = false;
 
     /* Initialize icons */
@@ -117,6 +136,23 @@ int desktop_init(void)
         return -1;
     }
 
+    /* Allocate the layers; the menus start hidden */
+    int32_t sw = (int32_t)g_desktop.screen_width;
+    int32_t sh = (int32_t)g_desktop.screen_height;
+    if (!desktop_layer_init(DESKTOP_LAYER_WALLPAPER, 0, 0, sw, sh, true) ||
+        !desktop_layer_init(DESKTOP_LAYER_ICONS, 0, 0, sw, sh - TASKBAR_HEIGHT, false) ||
+        !desktop_layer_init(DESKTOP_LAYER_TASKBAR, g_desktop.taskbar.x, g_desktop.taskbar.y,
+                            g_desktop.taskbar.width, g_desktop.taskbar.height, false) ||
+        !desktop_layer_init(DESKTOP_LAYER_START_MENU, 0, g_desktop.taskbar.y - START_MENU_HEIGHT,
+                            START_MENU_WIDTH, START_MENU_HEIGHT, false) ||
+        !desktop_layer_init(DESKTOP_LAYER_CONTEXT_MENU, 0, 0, DESKTOP_CONTEXT_MENU_MAX_W,
+                            DESKTOP_CONTEXT_MENU_MAX_H, false)) {
+        desktop_shutdown();
+        return -1;
+    }
+    g_desktop.layers[DESKTOP_LAYER_START_MENU].visible = false;
+    g_desktop.layers[DESKTOP_LAYER_CONTEXT_MENU].visible = false;
+
     /* Initialize context menu */
     memset(&g_desktop.context_menu, 0, sizeof(context_menu_t));
     g_desktop.context_menu.visible = false;
@@ -162,10 +198,18 @@ void desktop_shutdown(void)
 {
     kprintf("desktop: shutting down\n");
 
-    /* Free wallpaper buffer if allocated */
-    if (g_desktop.wallpaper_buffer) {
-        kfree(g_desktop.wallpaper_buffer);
-        g_desktop.wallpaper_buffer = NULL;
+    /* Stop the compositor from reading the layers */
+    if (g_desktop.compositor && g_desktop.compositor->initialized &&
+        g_desktop.compositor->background == desktop_paint_background) {
+        compositor_set_background(NULL);
+    }
+
+    /* Free the layers */
+    for (int i = 0; i < DESKTOP_LAYER_COUNT; i++) {
+        if (g_desktop.layers[i].buffer) {
+            kfree(g_desktop.layers[i].buffer);
+        }
+        memset(&g_desktop.layers[i], 0, sizeof(desktop_layer_t));
     }
 
     /* Shutdown taskbar */
@@ -212,13 +256,6 @@ int taskbar_init(void)
     taskbar->initialized = true;
     taskbar->needs_redraw = true;
 
-    /* Allocate taskbar buffer */
-    taskbar->buffer = kmalloc(taskbar->width * taskbar->height * sizeof(uint32_t));
-    if (!taskbar->buffer) {
-        kprintf("desktop: failed to allocate taskbar buffer\n");
-        return -1;
-    }
-
     kprintf("desktop: taskbar initialized at y=%d\n", taskbar->y);
 
     return 0;
@@ -229,14 +266,7 @@ int taskbar_init(void)
  */
 void taskbar_shutdown(void)
 {
-    taskbar_t *taskbar = &g_desktop.taskbar;
-
-    if (taskbar->buffer) {
-        kfree(taskbar->buffer);
-        taskbar->buffer = NULL;
-    }
-
-    taskbar->initialized = false;
+    g_desktop.taskbar.initialized = false;
 }
 
 /**
@@ -333,23 +363,15 @@ static void desktop_update_taskbar(void)
 
     if (!comp || !comp->initialized) return;
 
-    /* Mark all items as potentially inactive */
-    for (uint32_t i = 0; i < taskbar->item_count; i++) {
-        taskbar->items[i].active = false;
-    }
-
-    /* Update active window */
+    /* Only the active window's item is highlighted */
     window_t *active = comp->active_window;
-    if (active) {
-        for (uint32_t i = 0; i < taskbar->item_count; i++) {
-            if (taskbar->items[i].window == active) {
-                taskbar->items[i].active = true;
-                break;
-            }
+    for (uint32_t i = 0; i < taskbar->item_count; i++) {
+        bool is_active = active && taskbar->items[i].window == active;
+        if (taskbar->items[i].active != is_active) {
+            taskbar->items[i].active = is_active;
+            taskbar->needs_redraw = true;
         }
     }
-
-    taskbar->needs_redraw = true;
 }
 
 /**
@@ -360,20 +382,26 @@ void taskbar_update_clock(void)
     taskbar_t *taskbar = &g_desktop.taskbar;
     rtc_time_t time;
 
-    if (rtc_get_time(&time) == 0) {
-        taskbar->clock.hour = time.hour;
-        taskbar->clock.minute = time.minute;
-        taskbar->clock.second = time.second;
+    /* Wall clock from the TSC; the RTC is only read at boot */
+    rtc_unix_to_time(clock_realtime_ns() / NSEC_PER_SEC, &time);
 
-        /* Format time string */
-        taskbar->clock.display_string[0] = '0' + (time.hour / 10);
-        taskbar->clock.display_string[1] = '0' + (time.hour % 10);
-        taskbar->clock.display_string[2] = ':';
-        taskbar->clock.display_string[3] = '0' + (time.minute / 10);
-        taskbar->clock.display_string[4] = '0' + (time.minute % 10);
-        taskbar->clock.display_string[5] = '\0';
+    taskbar->clock.hour = time.hour;
+    taskbar->clock.minute = time.minute;
+    taskbar->clock.second = time.second;
 
-        taskbar->needs_redraw = true;
+    /* Format time string */
+    char display[6];
+    display[0] = '0' + (time.hour / 10);
+    display[1] = '0' + (time.hour % 10);
+    display[2] = ':';
+    display[3] = '0' + (time.minute / 10);
+    display[4] = '0' + (time.minute % 10);
+    display[5] = '\0';
+
+    /* The clock shows minutes, so it is redrawn once a minute */
+    if (strcmp(display, taskbar->clock.display_string) != 0) {
+        strcpy(taskbar->clock.display_string, display);
+        taskbar->clock_changed = true;
     }
 }
 
@@ -527,7 +555,7 @@ desktop_icon_t *desktop_add_icon(const char *name, int x, int y, const char *pat
 
     g_desktop.icon_count++;
     g_desktop.icons_created++;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_icon_changed(icon);
 
     kprintf("desktop: added icon '%s' at (%d, %d)\n", name, x, y);
 
@@ -560,6 +588,9 @@ int desktop_remove_icon(desktop_icon_t *icon)
         g_desktop.hovered_icon = NULL;
     }
 
+    /* Take it off the icon layer */
+    desktop_erase_icon(icon);
+
     /* Shift remaining icons */
     for (uint32_t i = index; i < g_desktop.icon_count - 1; i++) {
         g_desktop.icons[i] = g_desktop.icons[i + 1];
@@ -567,7 +598,6 @@ int desktop_remove_icon(desktop_icon_t *icon)
 
     g_desktop.icon_count--;
     g_desktop.icons_removed++;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
 
     return 0;
 }
@@ -600,18 +630,20 @@ desktop_icon_t *desktop_find_icon_at(int32_t x, int32_t y)
  */
 void desktop_select_icon(desktop_icon_t *icon)
 {
+    if (g_desktop.selected_icon == icon) return;
+
     /* Deselect previous */
     if (g_desktop.selected_icon) {
         g_desktop.selected_icon->flags &= ~ICON_FLAG_SELECTED;
+        desktop_icon_changed(g_desktop.selected_icon);
     }
 
     /* Select new */
     g_desktop.selected_icon = icon;
     if (icon) {
         icon->flags |= ICON_FLAG_SELECTED;
+        desktop_icon_changed(icon);
     }
-
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
 }
 
 /**
@@ -699,13 +731,27 @@ static void desktop_setup_start_menu(void)
  */
 static void desktop_toggle_start_menu(void)
 {
-    g_start_menu_open = !g_start_menu_open;
-    g_start_menu_hover_index = -1;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_set_start_menu_open(!g_start_menu_open);
 
     kprintf("desktop: start menu %s\n", g_start_menu_open ? "opened" : "closed");
 }
 
+/**
+ * Open or close the start menu
+ */
+static void desktop_set_start_menu_open(bool open)
+{
+    if (g_start_menu_open == open) return;
+
+    g_start_menu_open = open;
+    g_start_menu_hover_index = -1;
+    desktop_layer_show(DESKTOP_LAYER_START_MENU, open);
+
+    /* The start button is highlighted while the menu is open */
+    g_desktop.taskbar.needs_redraw = true;
+    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+}
+
 /**
  * Handle start menu click
  */
@@ -722,8 +768,7 @@ static bool desktop_handle_start_menu_click(int32_t x, int32_t y, uint8_t button
     if (x < menu_x || x >= menu_x + START_MENU_WIDTH ||
         y < menu_y || y >= menu_y + START_MENU_HEIGHT) {
         /* Click outside menu - close it */
-        g_start_menu_open = false;
-        g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+        desktop_set_start_menu_open(false);
         return false;
     }
 
@@ -738,8 +783,7 @@ static bool desktop_handle_start_menu_click(int32_t x, int32_t y, uint8_t button
         if (y >= item_y && y < item_y + START_MENU_ITEM_HEIGHT) {
             /* Launch the application */
             desktop_launch_app(g_start_menu_items[i].path);
-            g_start_menu_open = false;
-            g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+            desktop_set_start_menu_open(false);
             return true;
         }
 
@@ -749,6 +793,218 @@ static bool desktop_handle_start_menu_click(int32_t x, int32_t y, uint8_t button
     return true;
 }
 
+/* ============================================================================
+ * Layer Functions
+ * ============================================================================ */
+
+/**
+ * Allocate a layer's buffer and place it on screen
+ */
+static bool desktop_layer_init(desktop_layer_id_t id, int32_t x, int32_t y,
+                               int32_t w, int32_t h, bool opaque)
+{
+    desktop_layer_t *layer = &g_desktop.layers[id];
+
+    memset(layer, 0, sizeof(desktop_layer_t));
+    layer->buffer = kmalloc((size_t)w * h * sizeof(uint32_t));
+    if (!layer->buffer) {
+        kprintf("desktop: failed to allocate layer %d (%dx%d)\n", (int)id, w, h);
+        return false;
+    }
+    memset(layer->buffer, 0, (size_t)w * h * sizeof(uint32_t));
+
+    layer->x = x;
+    layer->y = y;
+    layer->width = w;
+    layer->height = h;
+    layer->capacity = w * h;
+    layer->visible = true;
+    layer->opaque = opaque;
+    layer->stale = true;
+
+    return true;
+}
+
+/**
+ * Record a changed screen area of a layer, clipped to the layer
+ */
+static void desktop_layer_damage(desktop_layer_t *layer, int32_t x, int32_t y,
+                                 int32_t w, int32_t h)
+{
+    int32_t x0 = MAX(x, layer->x);
+    int32_t y0 = MAX(y, layer->y);
+    int32_t x1 = MIN(x + w, layer->x + layer->width);
+    int32_t y1 = MIN(y + h, layer->y + layer->height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    if (layer->damage_w > 0) {
+        x0 = MIN(x0, layer->damage_x);
+        y0 = MIN(y0, layer->damage_y);
+        x1 = MAX(x1, layer->damage_x + layer->damage_w);
+        y1 = MAX(y1, layer->damage_y + layer->damage_h);
+    }
+
+    layer->damage_x = x0;
+    layer->damage_y = y0;
+    layer->damage_w = x1 - x0;
+    layer->damage_h = y1 - y0;
+    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+}
+
+/**
+ * Mark a layer's whole content for redrawing
+ */
+static void desktop_layer_invalidate(desktop_layer_id_t id)
+{
+    g_desktop.layers[id].stale = true;
+    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+}
+
+/**
+ * Show or hide a layer
+ */
+static void desktop_layer_show(desktop_layer_id_t id, bool visible)
+{
+    desktop_layer_t *layer = &g_desktop.layers[id];
+
+    if (layer->visible == visible) return;
+
+    /* What it covered shows through once it is gone */
+    desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+    layer->visible = visible;
+    if (visible) {
+        desktop_layer_invalidate(id);
+    }
+}
+
+/**
+ * Move and resize a layer within its buffer
+ */
+static void desktop_layer_place(desktop_layer_id_t id, int32_t x, int32_t y,
+                                int32_t w, int32_t h)
+{
+    desktop_layer_t *layer = &g_desktop.layers[id];
+
+    if (layer->visible) {
+        desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+    }
+
+    layer->x = x;
+    layer->y = y;
+    layer->width = MAX(w, 1);
+    layer->height = MAX(MIN(h, layer->capacity / layer->width), 1);
+    desktop_layer_invalidate(id);
+}
+
+/**
+ * Fill part of a layer (screen coordinates); the color replaces what is there
+ */
+static void desktop_layer_fill(desktop_layer_t *layer, int32_t x, int32_t y,
+                               int32_t w, int32_t h, uint32_t color)
+{
+    int32_t x0 = MAX(x, layer->x);
+    int32_t y0 = MAX(y, layer->y);
+    int32_t x1 = MIN(x + w, layer->x + layer->width);
+    int32_t y1 = MIN(y + h, layer->y + layer->height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    pixops_fill_rect(&layer->buffer[(y0 - layer->y) * layer->width + (x0 - layer->x)],
+                     layer->width, x1 - x0, y1 - y0, color);
+}
+
+/**
+ * Draw a one pixel rectangle outline into a layer
+ */
+static void desktop_layer_frame(desktop_layer_t *layer, int32_t x, int32_t y,
+                                int32_t w, int32_t h, uint32_t color)
+{
+    desktop_layer_fill(layer, x, y, w, 1, color);
+    desktop_layer_fill(layer, x, y + h - 1, w, 1, color);
+    desktop_layer_fill(layer, x, y, 1, h, color);
+    desktop_layer_fill(layer, x + w - 1, y, 1, h, color);
+}
+
+/**
+ * Copy an image into a layer
+ */
+static void desktop_layer_image(desktop_layer_t *layer, int32_t x, int32_t y,
+                                int32_t w, int32_t h, const uint32_t *src, ptrdiff_t stride)
+{
+    int32_t x0 = MAX(x, layer->x);
+    int32_t y0 = MAX(y, layer->y);
+    int32_t x1 = MIN(x + w, layer->x + layer->width);
+    int32_t y1 = MIN(y + h, layer->y + layer->height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    pixops_copy_rect(&layer->buffer[(y0 - layer->y) * layer->width + (x0 - layer->x)],
+                     layer->width, &src[(y0 - y) * stride + (x0 - x)], stride,
+                     x1 - x0, y1 - y0);
+}
+
+/**
+ * Draw a string into a layer, leaving the pixels around the glyphs alone
+ */
+static void desktop_layer_text(desktop_layer_t *layer, int32_t x, int32_t y,
+                               const char *str, uint32_t color)
+{
+    static uint32_t run[DESKTOP_TEXT_MAX * FB_FONT_WIDTH * FB_FONT_HEIGHT];
+
+    size_t len = MIN(strlen(str), (size_t)DESKTOP_TEXT_MAX);
+    int32_t w = (int32_t)len * FB_FONT_WIDTH;
+
+    int32_t x0 = MAX(x, layer->x);
+    int32_t y0 = MAX(y, layer->y);
+    int32_t x1 = MIN(x + w, layer->x + layer->width);
+    int32_t y1 = MIN(y + FB_FONT_HEIGHT, layer->y + layer->height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    /* Render on a transparent background, then blend just the glyphs in */
+    fb_render_text(run, w, w, FB_FONT_HEIGHT, 0, 0, str, len, color, 0x00000000);
+    pixops_blend_rect(&layer->buffer[(y0 - layer->y) * layer->width + (x0 - layer->x)],
+                      layer->width, &run[(y0 - y) * w + (x0 - x)], w, x1 - x0, y1 - y0);
+}
+
+/**
+ * Compose the layers under the windows (the compositor's background)
+ */
+static void desktop_paint_background(uint32_t *dst, ptrdiff_t stride, int x, int y, int w, int h)
+{
+    for (int i = 0; i < DESKTOP_LAYER_COUNT; i++) {
+        const desktop_layer_t *layer = &g_desktop.layers[i];
+        if (!layer->visible || !layer->buffer) continue;
+
+        int32_t x0 = MAX(x, layer->x);
+        int32_t y0 = MAX(y, layer->y);
+        int32_t x1 = MIN(x + w, layer->x + layer->width);
+        int32_t y1 = MIN(y + h, layer->y + layer->height);
+        if (x0 >= x1 || y0 >= y1) continue;
+
+        uint32_t *out = &dst[(y0 - y) * stride + (x0 - x)];
+        const uint32_t *src = &layer->buffer[(y0 - layer->y) * layer->width + (x0 - layer->x)];
+        if (layer->opaque) {
+            pixops_copy_rect(out, stride, src, layer->width, x1 - x0, y1 - y0);
+        } else {
+            pixops_blend_rect(out, stride, src, layer->width, x1 - x0, y1 - y0);
+        }
+    }
+}
+
+/**
+ * Hand each layer's damage to the compositor
+ */
+static void desktop_flush_damage(void)
+{
+    for (int i = 0; i < DESKTOP_LAYER_COUNT; i++) {
+        desktop_layer_t *layer = &g_desktop.layers[i];
+        if (layer->damage_w > 0) {
+            compositor_invalidate(layer->damage_x, layer->damage_y,
+                                  layer->damage_w, layer->damage_h);
+            layer->damage_w = 0;
+            layer->damage_h = 0;
+        }
+    }
+}
+
 /* ============================================================================
  * Drawing Functions
  * ============================================================================ */
@@ -760,25 +1016,20 @@ void desktop_draw(void)
 {
     if (!(g_desktop.flags & DESKTOP_FLAG_INITIALIZED)) return;
 
-    /* Draw wallpaper */
+    /* Each layer redraws only what changed in it */
     desktop_draw_wallpaper();
-
-    /* Draw desktop icons */
     desktop_draw_icons();
-
-    /* Draw taskbar */
     desktop_draw_taskbar();
 
-    /* Draw start menu if open */
-    if (g_start_menu_open) {
+    if (g_start_menu_open && g_desktop.layers[DESKTOP_LAYER_START_MENU].stale) {
         desktop_draw_start_menu();
     }
-
-    /* Draw context menu if visible */
-    if (g_desktop.context_menu.visible) {
+    if (g_desktop.context_menu.visible && g_desktop.layers[DESKTOP_LAYER_CONTEXT_MENU].stale) {
         desktop_draw_context_menu();
     }
 
+    desktop_flush_damage();
+
     /* Clear redraw flag */
     g_desktop.flags &= ~DESKTOP_FLAG_NEED_REDRAW;
 }
@@ -788,30 +1039,104 @@ void desktop_draw(void)
  */
 static void desktop_draw_wallpaper(void)
 {
-    if (g_desktop.has_wallpaper_image && g_desktop.wallpaper_buffer) {
-        /* Draw wallpaper image */
-        const framebuffer_t *fb = fb_get_info();
-        if (fb && fb->address) {
-            memcpy(fb->address, g_desktop.wallpaper_buffer,
-                   g_desktop.screen_width * g_desktop.screen_height * sizeof(uint32_t));
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_WALLPAPER];
+
+    if (!layer->stale) return;
+
+    /* An image was scaled into the layer when it was set */
+    if (!g_desktop.has_wallpaper_image) {
+        desktop_layer_fill(layer, 0, 0, layer->width, layer->height, g_desktop.wallpaper_color);
+    }
+
+    desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+    layer->stale = false;
+}
+
+/**
+ * Screen area a desktop icon draws in (highlight, image and label)
+ */
+static void desktop_icon_bounds(const desktop_icon_t *icon, dirty_rect_t *out)
+{
+    int32_t text_w = (int32_t)strlen(icon->name) * FB_FONT_WIDTH;
+    int32_t text_x = icon->x + (DESKTOP_ICON_SIZE - text_w) / 2;
+    int32_t x0 = MIN(icon->x - 2, text_x);
+    int32_t x1 = MAX(icon->x + DESKTOP_ICON_SIZE + 2, text_x + text_w + 1);
+
+    out->x = x0;
+    out->y = icon->y - 2;
+    out->width = x1 - x0;
+    out->height = DESKTOP_ICON_SIZE + DESKTOP_ICON_TEXT_HEIGHT + 4;
+    out->valid = true;
+}
+
+/**
+ * Note that an icon's look changed
+ */
+static void desktop_icon_changed(desktop_icon_t *icon)
+{
+    icon->flags |= ICON_FLAG_DIRTY;
+    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+}
+
+/**
+ * Clear an icon's area of the icon layer
+ * Other icons reaching into the area are marked for redrawing.
+ */
+static void desktop_erase_icon(desktop_icon_t *icon)
+{
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_ICONS];
+    dirty_rect_t area;
+
+    desktop_icon_bounds(icon, &area);
+    desktop_layer_fill(layer, area.x, area.y, area.width, area.height, 0x00000000);
+    desktop_layer_damage(layer, area.x, area.y, area.width, area.height);
+
+    for (uint32_t i = 0; i < g_desktop.icon_count; i++) {
+        desktop_icon_t *other = &g_desktop.icons[i];
+        dirty_rect_t bounds;
+        if (other == icon || !(other->flags & ICON_FLAG_VISIBLE)) continue;
+
+        desktop_icon_bounds(other, &bounds);
+        if (bounds.x < area.x + area.width && area.x < bounds.x + bounds.width &&
+            bounds.y < area.y + area.height && area.y < bounds.y + bounds.height) {
+            desktop_icon_changed(other);
         }
-    } else {
-        /* Draw solid color wallpaper */
-        fb_fill_rect(0, 0, g_desktop.screen_width,
-                     g_desktop.screen_height - TASKBAR_HEIGHT,
-                     g_desktop.wallpaper_color);
     }
 }
 
 /**
- * Draw all desktop icons
+ * Redraw the icons that changed
  */
 static void desktop_draw_icons(void)
 {
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_ICONS];
+
+    if (layer->stale) {
+        desktop_layer_fill(layer, layer->x, layer->y, layer->width, layer->height, 0x00000000);
+        desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+        for (uint32_t i = 0; i < g_desktop.icon_count; i++) {
+            g_desktop.icons[i].flags |= ICON_FLAG_DIRTY;
+        }
+        layer->stale = false;
+    }
+
+    /* Erase first, so a neighbour marked while erasing is drawn this pass */
+    for (uint32_t i = 0; i < g_desktop.icon_count; i++) {
+        if (g_desktop.icons[i].flags & ICON_FLAG_DIRTY) {
+            desktop_erase_icon(&g_desktop.icons[i]);
+        }
+    }
+
     for (uint32_t i = 0; i < g_desktop.icon_count; i++) {
         desktop_icon_t *icon = &g_desktop.icons[i];
+        if (!(icon->flags & ICON_FLAG_DIRTY)) continue;
+
+        icon->flags &= ~ICON_FLAG_DIRTY;
         if (icon->flags & ICON_FLAG_VISIBLE) {
+            dirty_rect_t bounds;
             desktop_draw_icon(icon);
+            desktop_icon_bounds(icon, &bounds);
+            desktop_layer_damage(layer, bounds.x, bounds.y, bounds.width, bounds.height);
         }
     }
 }
@@ -821,30 +1146,27 @@ static void desktop_draw_icons(void)
  */
 static void desktop_draw_icon(desktop_icon_t *icon)
 {
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_ICONS];
     int32_t x = icon->x;
     int32_t y = icon->y;
 
     /* Draw selection/hover background */
     if (icon->flags & ICON_FLAG_SELECTED) {
-        fb_fill_rect(x - 2, y - 2,
-                     DESKTOP_ICON_SIZE + 4, DESKTOP_ICON_SIZE + DESKTOP_ICON_TEXT_HEIGHT + 4,
-                     DESKTOP_ICON_SELECT_COLOR);
+        desktop_layer_fill(layer, x - 2, y - 2,
+                           DESKTOP_ICON_SIZE + 4, DESKTOP_ICON_SIZE + DESKTOP_ICON_TEXT_HEIGHT + 4,
+                           DESKTOP_ICON_SELECT_COLOR);
     } else if (icon->flags & ICON_FLAG_HOVERED) {
-        fb_fill_rect(x - 2, y - 2,
-                     DESKTOP_ICON_SIZE + 4, DESKTOP_ICON_SIZE + DESKTOP_ICON_TEXT_HEIGHT + 4,
-                     DESKTOP_ICON_HOVER_COLOR);
+        desktop_layer_fill(layer, x - 2, y - 2,
+                           DESKTOP_ICON_SIZE + 4, DESKTOP_ICON_SIZE + DESKTOP_ICON_TEXT_HEIGHT + 4,
+                           DESKTOP_ICON_HOVER_COLOR);
     }
 
     /* Draw icon image */
-    for (int32_t iy = 0; iy < DESKTOP_ICON_SIZE; iy++) {
-        for (int32_t ix = 0; ix < DESKTOP_ICON_SIZE; ix++) {
-            uint32_t color = icon->icon_data[iy * DESKTOP_ICON_SIZE + ix];
-            fb_put_pixel(x + ix, y + iy, color);
-        }
-    }
+    desktop_layer_image(layer, x, y, DESKTOP_ICON_SIZE, DESKTOP_ICON_SIZE,
+                        icon->icon_data, DESKTOP_ICON_SIZE);
 
     /* Draw icon border */
-    fb_draw_rect(x, y, DESKTOP_ICON_SIZE, DESKTOP_ICON_SIZE, 0xFF404040);
+    desktop_layer_frame(layer, x, y, DESKTOP_ICON_SIZE, DESKTOP_ICON_SIZE, 0xFF404040);
 
     /* Draw icon name (centered below icon) */
     size_t name_len = strlen(icon->name);
@@ -853,23 +1175,33 @@ static void desktop_draw_icon(desktop_icon_t *icon)
     int32_t text_y = y + DESKTOP_ICON_SIZE + 2;
 
     /* Draw text shadow */
-    fb_draw_string(text_x + 1, text_y + 1, icon->name, 0xFF000000, 0x00000000);
+    desktop_layer_text(layer, text_x + 1, text_y + 1, icon->name, 0xFF000000);
     /* Draw text */
-    fb_draw_string(text_x, text_y, icon->name, DESKTOP_ICON_TEXT_COLOR, 0x00000000);
+    desktop_layer_text(layer, text_x, text_y, icon->name, DESKTOP_ICON_TEXT_COLOR);
 }
 
 /**
  * Draw the taskbar
+ * Redraws the whole bar after a change to it, or just the clock.
  */
 static void desktop_draw_taskbar(void)
 {
     taskbar_t *taskbar = &g_desktop.taskbar;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_TASKBAR];
+
+    if (!taskbar->needs_redraw && !layer->stale) {
+        if (taskbar->clock_changed) {
+            desktop_draw_clock();
+        }
+        return;
+    }
 
     /* Draw taskbar background */
-    fb_fill_rect(taskbar->x, taskbar->y, taskbar->width, taskbar->height, TASKBAR_BG_COLOR);
+    desktop_layer_fill(layer, taskbar->x, taskbar->y, taskbar->width, taskbar->height,
+                       TASKBAR_BG_COLOR);
 
     /* Draw top border */
-    fb_draw_hline(taskbar->x, taskbar->y, taskbar->width, TASKBAR_BORDER_COLOR);
+    desktop_layer_fill(layer, taskbar->x, taskbar->y, taskbar->width, 1, TASKBAR_BORDER_COLOR);
 
     /* Draw start button */
     desktop_draw_start_button();
@@ -881,7 +1213,9 @@ static void desktop_draw_taskbar(void)
     desktop_draw_system_tray();
     desktop_draw_clock();
 
+    desktop_layer_damage(layer, taskbar->x, taskbar->y, taskbar->width, taskbar->height);
     taskbar->needs_redraw = false;
+    layer->stale = false;
 }
 
 /**
@@ -890,6 +1224,7 @@ static void desktop_draw_taskbar(void)
 static void desktop_draw_start_button(void)
 {
     taskbar_t *taskbar = &g_desktop.taskbar;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_TASKBAR];
 
     int32_t x = taskbar->x + 2;
     int32_t y = taskbar->y + 4;
@@ -901,17 +1236,17 @@ static void desktop_draw_start_button(void)
     if (g_start_menu_open) {
         bg_color = TASKBAR_ITEM_ACTIVE_COLOR;
     }
-    fb_fill_rect(x, y, w, h, bg_color);
+    desktop_layer_fill(layer, x, y, w, h, bg_color);
 
     /* Draw button border */
-    fb_draw_rect(x, y, w, h, TASKBAR_BORDER_COLOR);
+    desktop_layer_frame(layer, x, y, w, h, TASKBAR_BORDER_COLOR);
 
     /* Draw "Start" text */
     const char *text = "Start";
     size_t text_len = strlen(text);
     int32_t text_x = x + (w - text_len * FB_FONT_WIDTH) / 2;
     int32_t text_y = y + (h - FB_FONT_HEIGHT) / 2;
-    fb_draw_string(text_x, text_y, text, TASKBAR_TEXT_COLOR, 0x00000000);
+    desktop_layer_text(layer, text_x, text_y, text, TASKBAR_TEXT_COLOR);
 }
 
 /**
@@ -920,6 +1255,7 @@ static void desktop_draw_start_button(void)
 static void desktop_draw_taskbar_items(void)
 {
     taskbar_t *taskbar = &g_desktop.taskbar;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_TASKBAR];
 
     for (uint32_t i = 0; i < taskbar->item_count; i++) {
         taskbar_item_t *item = &taskbar->items[i];
@@ -935,10 +1271,10 @@ static void desktop_draw_taskbar_items(void)
         } else if (item->hovered) {
             bg_color = TASKBAR_ITEM_HOVER_COLOR;
         }
-        fb_fill_rect(x, y, item->width, h, bg_color);
+        desktop_layer_fill(layer, x, y, item->width, h, bg_color);
 
         /* Draw border */
-        fb_draw_rect(x, y, item->width, h, TASKBAR_BORDER_COLOR);
+        desktop_layer_frame(layer, x, y, item->width, h, TASKBAR_BORDER_COLOR);
 
         /* Draw title (truncated if necessary) */
         char truncated[16];
@@ -950,7 +1286,7 @@ static void desktop_draw_taskbar_items(void)
 
         int32_t text_x = x + 4;
         int32_t text_y = y + (h - FB_FONT_HEIGHT) / 2;
-        fb_draw_string(text_x, text_y, truncated, TASKBAR_TEXT_COLOR, 0x00000000);
+        desktop_layer_text(layer, text_x, text_y, truncated, TASKBAR_TEXT_COLOR);
     }
 }
 
@@ -960,43 +1296,48 @@ static void desktop_draw_taskbar_items(void)
 static void desktop_draw_system_tray(void)
 {
     taskbar_t *taskbar = &g_desktop.taskbar;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_TASKBAR];
 
     int32_t tray_x = taskbar->width - TASKBAR_CLOCK_WIDTH - TASKBAR_SYSTRAY_WIDTH;
     int32_t tray_y = taskbar->y + 4;
     int32_t tray_h = taskbar->height - 8;
 
     /* Draw tray background */
-    fb_fill_rect(tray_x, tray_y, TASKBAR_SYSTRAY_WIDTH, tray_h, TASKBAR_ITEM_COLOR);
+    desktop_layer_fill(layer, tray_x, tray_y, TASKBAR_SYSTRAY_WIDTH, tray_h, TASKBAR_ITEM_COLOR);
 
     /* Draw separator */
-    fb_draw_vline(tray_x, taskbar->y + 2, taskbar->height - 4, TASKBAR_BORDER_COLOR);
+    desktop_layer_fill(layer, tray_x, taskbar->y + 2, 1, taskbar->height - 4,
+                       TASKBAR_BORDER_COLOR);
 }
 
 /**
  * Draw the clock
+ * Touches only the clock's box, so a new minute damages nothing else.
  */
 static void desktop_draw_clock(void)
 {
     taskbar_t *taskbar = &g_desktop.taskbar;
-
-    /* Update clock time */
-    taskbar_update_clock();
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_TASKBAR];
 
     int32_t clock_x = taskbar->width - TASKBAR_CLOCK_WIDTH;
     int32_t clock_y = taskbar->y + 4;
     int32_t clock_h = taskbar->height - 8;
 
     /* Draw clock background */
-    fb_fill_rect(clock_x, clock_y, TASKBAR_CLOCK_WIDTH, clock_h, TASKBAR_ITEM_COLOR);
+    desktop_layer_fill(layer, clock_x, clock_y, TASKBAR_CLOCK_WIDTH, clock_h, TASKBAR_ITEM_COLOR);
 
     /* Draw separator */
-    fb_draw_vline(clock_x, taskbar->y + 2, taskbar->height - 4, TASKBAR_BORDER_COLOR);
+    desktop_layer_fill(layer, clock_x, taskbar->y + 2, 1, taskbar->height - 4,
+                       TASKBAR_BORDER_COLOR);
 
     /* Draw time string */
     size_t time_len = strlen(taskbar->clock.display_string);
     int32_t text_x = clock_x + (TASKBAR_CLOCK_WIDTH - time_len * FB_FONT_WIDTH) / 2;
     int32_t text_y = clock_y + (clock_h - FB_FONT_HEIGHT) / 2;
-    fb_draw_string(text_x, text_y, taskbar->clock.display_string, TASKBAR_CLOCK_COLOR, 0x00000000);
+    desktop_layer_text(layer, text_x, text_y, taskbar->clock.display_string, TASKBAR_CLOCK_COLOR);
+
+    desktop_layer_damage(layer, clock_x, taskbar->y + 2, TASKBAR_CLOCK_WIDTH, taskbar->height - 4);
+    taskbar->clock_changed = false;
 }
 
 /**
@@ -1004,14 +1345,17 @@ static void desktop_draw_clock(void)
  */
 static void desktop_draw_start_menu(void)
 {
-    int32_t menu_x = 0;
-    int32_t menu_y = g_desktop.taskbar.y - START_MENU_HEIGHT;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_START_MENU];
+    int32_t menu_x = layer->x;
+    int32_t menu_y = layer->y;
 
     /* Draw menu background */
-    fb_fill_rect(menu_x, menu_y, START_MENU_WIDTH, START_MENU_HEIGHT, START_MENU_BG_COLOR);
+    desktop_layer_fill(layer, menu_x, menu_y, START_MENU_WIDTH, START_MENU_HEIGHT,
+                       START_MENU_BG_COLOR);
 
     /* Draw border */
-    fb_draw_rect(menu_x, menu_y, START_MENU_WIDTH, START_MENU_HEIGHT, TASKBAR_BORDER_COLOR);
+    desktop_layer_frame(layer, menu_x, menu_y, START_MENU_WIDTH, START_MENU_HEIGHT,
+                        TASKBAR_BORDER_COLOR);
 
     /* Draw menu items */
     int32_t item_y = menu_y + TASKBAR_ITEM_PADDING;
@@ -1019,23 +1363,29 @@ static void desktop_draw_start_menu(void)
     for (uint32_t i = 0; i < g_start_menu_item_count; i++) {
         if (g_start_menu_items[i].is_separator) {
             /* Draw separator line */
-            fb_draw_hline(menu_x + 8, item_y + 4, START_MENU_WIDTH - 16, START_MENU_SEPARATOR_COLOR);
+            desktop_layer_fill(layer, menu_x + 8, item_y + 4, START_MENU_WIDTH - 16, 1,
+                               START_MENU_SEPARATOR_COLOR);
             item_y += 8;
             continue;
         }
 
         /* Draw item background if hovered */
         if ((int32_t)i == g_start_menu_hover_index) {
-            fb_fill_rect(menu_x + 2, item_y, START_MENU_WIDTH - 4, START_MENU_ITEM_HEIGHT, START_MENU_ITEM_HOVER);
+            desktop_layer_fill(layer, menu_x + 2, item_y, START_MENU_WIDTH - 4,
+                               START_MENU_ITEM_HEIGHT, START_MENU_ITEM_HOVER);
         }
 
         /* Draw item text */
         int32_t text_x = menu_x + 12;
         int32_t text_y = item_y + (START_MENU_ITEM_HEIGHT - FB_FONT_HEIGHT) / 2;
-        fb_draw_string(text_x, text_y, g_start_menu_items[i].name, START_MENU_TEXT_COLOR, 0x00000000);
+        desktop_layer_text(layer, text_x, text_y, g_start_menu_items[i].name,
+                           START_MENU_TEXT_COLOR);
 
         item_y += START_MENU_ITEM_HEIGHT;
     }
+
+    desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+    layer->stale = false;
 }
 
 /* ============================================================================
@@ -1103,7 +1453,8 @@ void desktop_show_context_menu(int32_t x, int32_t y)
 
     menu->hovered_item = -1;
     menu->visible = true;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_layer_place(DESKTOP_LAYER_CONTEXT_MENU, menu->x, menu->y, menu->width, menu->height);
+    desktop_layer_show(DESKTOP_LAYER_CONTEXT_MENU, true);
 }
 
 /**
@@ -1169,7 +1520,8 @@ void desktop_show_icon_context_menu(desktop_icon_t *icon, int32_t x, int32_t y)
 
     menu->hovered_item = -1;
     menu->visible = true;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_layer_place(DESKTOP_LAYER_CONTEXT_MENU, menu->x, menu->y, menu->width, menu->height);
+    desktop_layer_show(DESKTOP_LAYER_CONTEXT_MENU, true);
 }
 
 /**
@@ -1178,7 +1530,7 @@ void desktop_show_icon_context_menu(desktop_icon_t *icon, int32_t x, int32_t y)
 void desktop_hide_context_menu(void)
 {
     g_desktop.context_menu.visible = false;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_layer_show(DESKTOP_LAYER_CONTEXT_MENU, false);
 }
 
 /**
@@ -1187,36 +1539,43 @@ void desktop_hide_context_menu(void)
 void desktop_draw_context_menu(void)
 {
     context_menu_t *menu = &g_desktop.context_menu;
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_CONTEXT_MENU];
 
     if (!menu->visible) return;
 
     /* Draw background */
-    fb_fill_rect(menu->x, menu->y, menu->width, menu->height, START_MENU_BG_COLOR);
+    desktop_layer_fill(layer, menu->x, menu->y, menu->width, menu->height, START_MENU_BG_COLOR);
 
     /* Draw border */
-    fb_draw_rect(menu->x, menu->y, menu->width, menu->height, TASKBAR_BORDER_COLOR);
+    desktop_layer_frame(layer, menu->x, menu->y, menu->width, menu->height,
+                        TASKBAR_BORDER_COLOR);
 
     /* Draw items */
     int32_t item_y = menu->y + 4;
 
     for (uint32_t i = 0; i < menu->item_count; i++) {
         if (menu->items[i].separator) {
-            fb_draw_hline(menu->x + 4, item_y + 4, menu->width - 8, START_MENU_SEPARATOR_COLOR);
+            desktop_layer_fill(layer, menu->x + 4, item_y + 4, menu->width - 8, 1,
+                               START_MENU_SEPARATOR_COLOR);
             item_y += 8;
             continue;
         }
 
         /* Draw hover background */
         if ((int32_t)i == menu->hovered_item && menu->items[i].enabled) {
-            fb_fill_rect(menu->x + 2, item_y, menu->width - 4, 24, START_MENU_ITEM_HOVER);
+            desktop_layer_fill(layer, menu->x + 2, item_y, menu->width - 4, 24,
+                               START_MENU_ITEM_HOVER);
         }
 
         /* Draw text */
         uint32_t text_color = menu->items[i].enabled ? START_MENU_TEXT_COLOR : 0xFF808080;
-        fb_draw_string(menu->x + 8, item_y + 4, menu->items[i].label, text_color, 0x00000000);
+        desktop_layer_text(layer, menu->x + 8, item_y + 4, menu->items[i].label, text_color);
 
         item_y += 24;
     }
+
+    desktop_layer_damage(layer, layer->x, layer->y, layer->width, layer->height);
+    layer->stale = false;
 }
 
 /**
@@ -1278,15 +1637,21 @@ bool desktop_handle_event(event_t *event)
         case EVENT_MOUSE_MOVE: {
             int32_t x = event->mouse.global_x;
             int32_t y = event->mouse.global_y;
+            fb_cursor_move(x, y);
 
             /* Update icon hover state */
             desktop_icon_t *old_hover = g_desktop.hovered_icon;
             g_desktop.hovered_icon = desktop_find_icon_at(x, y);
 
             if (old_hover != g_desktop.hovered_icon) {
-                if (old_hover) old_hover->flags &= ~ICON_FLAG_HOVERED;
-                if (g_desktop.hovered_icon) g_desktop.hovered_icon->flags |= ICON_FLAG_HOVERED;
-                g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+                if (old_hover) {
+                    old_hover->flags &= ~ICON_FLAG_HOVERED;
+                    desktop_icon_changed(old_hover);
+                }
+                if (g_desktop.hovered_icon) {
+                    g_desktop.hovered_icon->flags |= ICON_FLAG_HOVERED;
+                    desktop_icon_changed(g_desktop.hovered_icon);
+                }
             }
 
             /* Update taskbar hover state */
@@ -1349,10 +1714,7 @@ static bool desktop_handle_click(int32_t x, int32_t y, uint8_t button)
         desktop_select_icon(NULL);
 
         /* Close start menu if open */
-        if (g_start_menu_open) {
-            g_start_menu_open = false;
-            g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
-        }
+        desktop_set_start_menu_open(false);
     }
 
     return false;
@@ -1372,9 +1734,9 @@ static bool desktop_handle_icon_click(int32_t x, int32_t y, uint8_t button)
         desktop_select_icon(icon);
 
         /* Check for double-click */
-        uint64_t current_time = rtc_get_unix_timestamp();
+        uint64_t current_time = clock_monotonic_ms();
         if (g_desktop.selected_icon == icon &&
-            (current_time - g_desktop.last_click_time) < 2 && /* ~2 seconds for double-click */
+            (current_time - g_desktop.last_click_time) < DESKTOP_DOUBLE_CLICK_TIME &&
             (x - g_desktop.last_click_x) < 5 && (x - g_desktop.last_click_x) > -5 &&
             (y - g_desktop.last_click_y) < 5 && (y - g_desktop.last_click_y) > -5) {
             /* Double-click - launch application */
@@ -1418,8 +1780,7 @@ bool desktop_handle_key(uint16_t key)
     /* Escape - close menus */
     if (key == 0x01) { /* Escape scancode */
         if (g_start_menu_open) {
-            g_start_menu_open = false;
-            g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+            desktop_set_start_menu_open(false);
             return true;
         }
         if (g_desktop.context_menu.visible) {
@@ -1483,7 +1844,7 @@ void desktop_set_wallpaper_color(uint32_t color)
 {
     g_desktop.wallpaper_color = color;
     g_desktop.has_wallpaper_image = false;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_layer_invalidate(DESKTOP_LAYER_WALLPAPER);
 
     kprintf("desktop: wallpaper color set to 0x%08X\n", color);
 }
@@ -1497,17 +1858,9 @@ int desktop_set_wallpaper_image(const uint32_t *image_data, uint32_t width, uint
         return -1;
     }
 
-    /* Free existing wallpaper buffer */
-    if (g_desktop.wallpaper_buffer) {
-        kfree(g_desktop.wallpaper_buffer);
-    }
-
-    /* Allocate new buffer */
-    size_t buffer_size = g_desktop.screen_width * g_desktop.screen_height * sizeof(uint32_t);
-    g_desktop.wallpaper_buffer = kmalloc(buffer_size);
-
-    if (!g_desktop.wallpaper_buffer) {
-        kprintf("desktop: failed to allocate wallpaper buffer\n");
+    /* The image is scaled straight into the wallpaper layer */
+    desktop_layer_t *layer = &g_desktop.layers[DESKTOP_LAYER_WALLPAPER];
+    if (!layer->buffer) {
         return -1;
     }
 
@@ -1519,17 +1872,17 @@ int desktop_set_wallpaper_image(const uint32_t *image_data, uint32_t width, uint
             uint32_t src_y = (y * height) / g_desktop.screen_height;
 
             if (src_x < width && src_y < height) {
-                g_desktop.wallpaper_buffer[y * g_desktop.screen_width + x] =
+                layer->buffer[y * g_desktop.screen_width + x] =
                     image_data[src_y * width + src_x];
             } else {
-                g_desktop.wallpaper_buffer[y * g_desktop.screen_width + x] =
+                layer->buffer[y * g_desktop.screen_width + x] =
                     g_desktop.wallpaper_color;
             }
         }
     }
 
     g_desktop.has_wallpaper_image = true;
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    desktop_layer_invalidate(DESKTOP_LAYER_WALLPAPER);
 
     kprintf("desktop: wallpaper image set (%ux%u)\n", width, height);
 
@@ -1545,7 +1898,9 @@ int desktop_set_wallpaper_image(const uint32_t *image_data, uint32_t width, uint
  */
 void desktop_invalidate(void)
 {
-    g_desktop.flags |= DESKTOP_FLAG_NEED_REDRAW;
+    for (int i = 0; i < DESKTOP_LAYER_COUNT; i++) {
+        desktop_layer_invalidate((desktop_layer_id_t)i);
+    }
 }
 
 /**
@@ -1574,25 +1929,47 @@ void desktop_run(void)
 
     g_desktop.flags |= DESKTOP_FLAG_RUNNING;
 
+    /* The compositor draws the layers wherever no window covers them */
+    compositor_set_background(desktop_paint_background);
+
     /* Initial draw */
     desktop_draw();
     compositor_render();
 
-    /* Main loop */
+    /* The pointer is a sprite over the composited frame */
+    const framebuffer_t *fb = fb_get_info();
+    mouse_set_bounds(0, 0, (int32_t)fb->width - 1, (int32_t)fb->height - 1);
+    fb_cursor_show(true);
+
+    /* Main loop, one pass per frame */
+    const uint64_t frame_ns = NSEC_PER_SEC / DESKTOP_FRAME_RATE;
+
     while (g_desktop.flags & DESKTOP_FLAG_RUNNING) {
+        /* Moving the pointer never waits for, or causes, a composite */
+        mouse_state_t mouse;
+        mouse_get_state(&mouse);
+        fb_cursor_move(mouse.x, mouse.y);
+
         /* Update taskbar (window list and clock) */
         desktop_update_taskbar();
         taskbar_update_clock();
 
-        /* Check if redraw is needed */
-        if (g_desktop.flags & DESKTOP_FLAG_NEED_REDRAW || g_desktop.taskbar.needs_redraw) {
+        /* Redraw only the layers that changed; idle, nothing is damaged */
+        if (g_desktop.flags & DESKTOP_FLAG_NEED_REDRAW || g_desktop.taskbar.needs_redraw ||
+            g_desktop.taskbar.clock_changed) {
             desktop_draw();
-            compositor_render();
         }
 
-        /* Small delay to prevent busy-waiting */
-        /* In a real implementation, this would yield to the scheduler */
-        for (volatile int i = 0; i < 100000; i++);
+        /* Damage from here and from other threads goes out once per refresh */
+        compositor_frame_tick();
+
+        /* Wake for the compositor's next refresh, or a frame from now when idle */
+        uint64_t now = clock_monotonic_ns();
+        uint64_t wake = compositor_next_frame_ns();
+        if (wake <= now) {
+            wake = now + frame_ns;
+        }
+        timer_sleep_ns(wake - now);
     }
 
     kprintf("desktop: main loop ended\n");
@@ -3,6 +3,13 @@
  *
  * Provides the desktop environment with wallpaper display, taskbar/dock,
  * window management, desktop icons, and application launching.
+ *
+ * The desktop is drawn in layers (wallpaper, icons, taskbar, start menu,
+ * context menu), each kept in its own buffer. A change redraws only the
+ * part of the layer it affects and records that as the layer's damage;
+ * desktop_draw hands the damage to the compositor, which blends the
+ * layers together as its background wherever no window covers them. An
+ * idle desktop draws nothing and invalidates nothing.
  */
 
 #ifndef _AAAOS_GUI_DESKTOP_H
@@ -58,10 +65,49 @@
 #define ICON_FLAG_VISIBLE           (1 << 0)    /* Icon is visible */
 #define ICON_FLAG_SELECTED          (1 << 1)    /* Icon is selected */
 #define ICON_FLAG_HOVERED           (1 << 2)    /* Mouse is over icon */
+#define ICON_FLAG_DIRTY             (1 << 3)    /* Needs redrawing in the icon layer */
 
 /* Double-click timing (in milliseconds) */
 #define DESKTOP_DOUBLE_CLICK_TIME   500
 
+/* Main loop pacing (frames per second) */
+#define DESKTOP_FRAME_RATE          60
+
+/* Largest context menu (pixels) */
+#define DESKTOP_CONTEXT_MENU_MAX_W  200
+#define DESKTOP_CONTEXT_MENU_MAX_H  400
+
+/**
+ * Desktop layers, bottom to top
+ */
+typedef enum {
+    DESKTOP_LAYER_WALLPAPER = 0,
+    DESKTOP_LAYER_ICONS,
+    DESKTOP_LAYER_TASKBAR,
+    DESKTOP_LAYER_START_MENU,
+    DESKTOP_LAYER_CONTEXT_MENU,
+    DESKTOP_LAYER_COUNT
+} desktop_layer_id_t;
+
+/**
+ * One cached layer of the desktop
+ */
+typedef struct desktop_layer {
+    uint32_t *buffer;                       /* ARGB pixels, width apart */
+    int32_t x;                              /* Screen position */
+    int32_t y;
+    int32_t width;                          /* Size in use */
+    int32_t height;
+    int32_t capacity;                       /* Pixels the buffer holds */
+    bool visible;                           /* Composited at all */
+    bool opaque;                            /* Copied rather than blended */
+    bool stale;                             /* Whole content needs redrawing */
+    int32_t damage_x;                       /* Screen area changed since the last */
+    int32_t damage_y;                       /* desktop_draw (width 0: none) */
+    int32_t damage_w;
+    int32_t damage_h;
+} desktop_layer_t;
+
 /**
  * Desktop icon structure
  * Represents a shortcut on the desktop
@@ -127,9 +173,9 @@ typedef struct taskbar {
     bool start_hovered;                     /* Start button hover state */
     bool start_clicked;                     /* Start button clicked */
 
-    uint32_t *buffer;                       /* Taskbar render buffer */
     bool initialized;                       /* Initialization status */
     bool needs_redraw;                      /* Needs to be redrawn */
+    bool clock_changed;                     /* Only the clock needs redrawing */
 } taskbar_t;
 
 /**
@@ -181,8 +227,10 @@ typedef struct desktop {
 
     /* Wallpaper */
     uint32_t wallpaper_color;               /* Solid wallpaper color */
-    uint32_t *wallpaper_buffer;             /* Custom wallpaper image (optional) */
-    bool has_wallpaper_image;               /* True if custom wallpaper is set */
+    bool has_wallpaper_image;               /* True if the wallpaper layer holds an image */
+
+    /* Cached layers, composited by the compositor as its background */
+    desktop_layer_t layers[DESKTOP_LAYER_COUNT];
 
     /* State flags */
     uint32_t flags;                         /* Desktop flags */
@@ -195,7 +243,7 @@ typedef struct desktop {
     desktop_icon_t *dragging_icon;          /* Icon being dragged */
 
     /* Double-click detection */
-    uint64_t last_click_time;               /* Time of last click */
+    uint64_t last_click_time;               /* Time of last click (ms) */
     int32_t last_click_x;                   /* X position of last click */
     int32_t last_click_y;                   /* Y position of last click */
 
@@ -249,7 +297,7 @@ int desktop_launch_app(const char *path);
 
 /**
  * Draw the desktop
- * Renders wallpaper, icons, and taskbar to the screen
+ * Redraws what changed in each layer and marks its damage on screen
  */
 void desktop_draw(void);
 
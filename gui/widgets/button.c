@@ -86,6 +86,7 @@ void button_init(button_t *btn, int32_t x, int32_t y, int32_t width, int32_t hei
 
     /* Initialize base widget */
     widget_init(&btn->base, x, y, width, height);
+    btn->base.flags |= WIDGET_FLAG_OPAQUE;
 
     /* Set button-specific properties */
     btn->state = BUTTON_STATE_NORMAL;
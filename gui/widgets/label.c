@@ -17,6 +17,7 @@
 /* Forward declarations for internal functions */
 static void label_draw_impl(widget_t *w, void *buffer);
 static void label_update_size(label_t *lbl);
+static void label_update_opaque(label_t *lbl);
 
 /**
  * Draw text at position (placeholder for graphics driver)
@@ -137,6 +138,7 @@ void label_init_sized(label_t *lbl, int32_t x, int32_t y, int32_t width, int32_t
 
     /* Labels typically don't accept input focus */
     lbl->base.flags &= ~WIDGET_FLAG_ENABLED;
+    label_update_opaque(lbl);
 
     kprintf("[LABEL] Initialized label (widget %u) with text '%s'\n",
             lbl->base.id, lbl->text);
@@ -157,6 +159,17 @@ static void label_update_size(label_t *lbl) {
     }
 }
 
+/**
+ * Only a fully opaque background hides what is behind the label
+ */
+static void label_update_opaque(label_t *lbl) {
+    if ((lbl->bg_color >> 24) == 0xFF) {
+        lbl->base.flags |= WIDGET_FLAG_OPAQUE;
+    } else {
+        lbl->base.flags &= ~WIDGET_FLAG_OPAQUE;
+    }
+}
+
 /**
  * Internal draw function for labels
  */
@@ -284,6 +297,7 @@ void label_set_background(label_t *lbl, uint32_t color) {
     if (!lbl) return;
 
     lbl->bg_color = color;
+    label_update_opaque(lbl);
     widget_invalidate(&lbl->base);
 
     kprintf("[LABEL] Label '%s' background set to 0x%08X\n", lbl->text, color);
@@ -18,6 +18,9 @@
 /* Cursor blink interval in milliseconds */
 #define CURSOR_BLINK_INTERVAL   500
 
+/* Characters handed to draw_text at a time */
+#define TEXTBOX_DRAW_CHUNK      64
+
 /* Forward declarations for internal functions */
 static void textbox_draw_impl(widget_t *w, void *buffer);
 static void textbox_key_handler(widget_t *w, event_t *event);
@@ -64,6 +67,154 @@ static void draw_text(void *buffer, int32_t x, int32_t y,
     UNUSED(color);
 }
 
+/**
+ * Move the gap to a text position
+ */
+static void textbox_gap_move(textbox_t *tb, size_t pos) {
+    if (pos < tb->gap_start) {
+        size_t n = tb->gap_start - pos;
+        memmove(&tb->buffer[tb->gap_end - n], &tb->buffer[pos], n);
+        tb->gap_start -= n;
+        tb->gap_end -= n;
+    } else if (pos > tb->gap_start) {
+        size_t n = pos - tb->gap_start;
+        memmove(&tb->buffer[tb->gap_start], &tb->buffer[tb->gap_end], n);
+        tb->gap_start += n;
+        tb->gap_end += n;
+    }
+}
+
+/**
+ * Make the gap at least len bytes, doubling the buffer as needed
+ * @return false if out of memory
+ */
+static bool textbox_gap_reserve(textbox_t *tb, size_t len) {
+    if (tb->gap_end - tb->gap_start >= len) {
+        return true;
+    }
+
+    size_t size = tb->buffer_size > 0 ? tb->buffer_size * 2 : TEXTBOX_GAP_MIN;
+    while (size - tb->text_length < len) {
+        size *= 2;
+    }
+
+    char *buf = (char *)kmalloc(size);
+    if (!buf) {
+        kprintf("[TEXTBOX] ERROR: Failed to grow text buffer to %zu bytes\n", size);
+        return false;
+    }
+
+    size_t tail = tb->buffer_size - tb->gap_end;
+    if (tb->buffer) {
+        memcpy(buf, tb->buffer, tb->gap_start);
+        memcpy(&buf[size - tail], &tb->buffer[tb->gap_end], tail);
+        kfree(tb->buffer);
+    }
+    tb->buffer = buf;
+    tb->buffer_size = size;
+    tb->gap_end = size - tail;
+    return true;
+}
+
+/**
+ * Remove text [start, end)
+ */
+static void textbox_gap_remove(textbox_t *tb, size_t start, size_t end) {
+    textbox_gap_move(tb, start);
+    tb->gap_end += end - start;
+    tb->text_length -= end - start;
+}
+
+/**
+ * Empty the text, keeping the buffer
+ */
+static void textbox_gap_reset(textbox_t *tb) {
+    tb->gap_start = 0;
+    tb->gap_end = tb->buffer_size;
+    tb->text_length = 0;
+}
+
+/**
+ * Copy text [pos, pos + len) out of the buffer (no terminator)
+ */
+static void textbox_copy_out(const textbox_t *tb, size_t pos, size_t len, char *dst) {
+    if (len == 0) return;
+
+    if (pos < tb->gap_start) {
+        size_t n = MIN(len, tb->gap_start - pos);
+        memcpy(dst, &tb->buffer[pos], n);
+        dst += n;
+        pos += n;
+        len -= n;
+    }
+    memcpy(dst, &tb->buffer[pos + (tb->gap_end - tb->gap_start)], len);
+}
+
+/**
+ * Characters that may still be added under max_length
+ */
+static size_t textbox_room(const textbox_t *tb) {
+    if (tb->max_length == 0) {
+        return SIZE_MAX - tb->text_length;
+    }
+    return tb->max_length > tb->text_length ? tb->max_length - tb->text_length : 0;
+}
+
+/**
+ * Whole characters that fit in the text area
+ */
+static size_t textbox_visible_chars(const textbox_t *tb) {
+    int32_t visible_chars = (tb->base.width - 2 * TEXTBOX_PADDING) / FONT_CHAR_WIDTH;
+    return visible_chars > 0 ? (size_t)visible_chars : 1;
+}
+
+/**
+ * Redraw text positions [pos, end) that are in view
+ * Only [pos, end) is redrawn while focused: unfocused the placeholder may
+ * be shown instead, and after scrolling every column has changed.
+ */
+static void textbox_invalidate_from(textbox_t *tb, size_t pos, size_t end) {
+    if (tb->scroll_offset != tb->drawn_offset || tb->has_selection ||
+        !(tb->base.flags & WIDGET_FLAG_FOCUSED)) {
+        widget_invalidate(&tb->base);
+        return;
+    }
+    if (end <= tb->scroll_offset) {
+        return;
+    }
+
+    size_t first = pos > tb->scroll_offset ? pos - tb->scroll_offset : 0;
+    size_t last = MIN(end - tb->scroll_offset, textbox_visible_chars(tb));
+    if (first >= last) {
+        return;
+    }
+
+    widget_invalidate_rect(&tb->base,
+                           TEXTBOX_PADDING + (int32_t)first * FONT_CHAR_WIDTH,
+                           (tb->base.height - FONT_CHAR_HEIGHT) / 2,
+                           (int32_t)(last - first) * FONT_CHAR_WIDTH, FONT_CHAR_HEIGHT);
+}
+
+/**
+ * Redraw after the text changed from position pos onwards
+ */
+static void textbox_text_changed(textbox_t *tb, size_t pos) {
+    textbox_invalidate_from(tb, pos, SIZE_MAX);
+}
+
+/**
+ * Redraw after the cursor moved from old_pos
+ * @param had_selection A selection was shown before the move
+ */
+static void textbox_cursor_moved(textbox_t *tb, size_t old_pos, bool had_selection) {
+    if (had_selection) {
+        widget_invalidate(&tb->base);
+        return;
+    }
+    textbox_invalidate_from(tb, old_pos, old_pos + 1);
+    textbox_invalidate_from(tb, tb->cursor_pos, tb->cursor_pos + 1);
+}
+
 /**
  * Create a new textbox widget
  */
@@ -99,8 +250,11 @@ void textbox_init(textbox_t *tb, int32_t x, int32_t y, int32_t width, int32_t he
     /* Initialize base widget */
     widget_init(&tb->base, x, y, width, height);
 
-    /* Initialize text buffer */
-    tb->text[0] = '\0';
+    /* The text buffer is allocated with the first text */
+    tb->buffer = NULL;
+    tb->buffer_size = 0;
+    tb->gap_start = 0;
+    tb->gap_end = 0;
     tb->placeholder[0] = '\0';
     tb->text_length = 0;
 
@@ -112,6 +266,7 @@ void textbox_init(textbox_t *tb, int32_t x, int32_t y, int32_t width, int32_t he
 
     /* Initialize scrolling */
     tb->scroll_offset = 0;
+    tb->drawn_offset = 0;
 
     /* Initialize cursor blink */
     tb->cursor_visible = true;
@@ -123,10 +278,13 @@ void textbox_init(textbox_t *tb, int32_t x, int32_t y, int32_t width, int32_t he
     tb->color_text = TEXTBOX_COLOR_TEXT;
     tb->color_cursor = TEXTBOX_COLOR_CURSOR;
 
+    /* The background is filled edge to edge */
+    tb->base.flags |= WIDGET_FLAG_OPAQUE;
+
     /* Set default flags */
     tb->read_only = false;
     tb->password_mode = false;
-    tb->max_length = 0;  /* Unlimited (up to buffer size) */
+    tb->max_length = 0;  /* Unlimited */
 
     /* Clear callbacks */
     tb->on_change = NULL;
@@ -148,15 +306,13 @@ void textbox_init(textbox_t *tb, int32_t x, int32_t y, int32_t width, int32_t he
 static void textbox_ensure_cursor_visible(textbox_t *tb) {
     if (!tb) return;
 
-    /* Calculate visible area in characters */
-    int32_t visible_chars = (tb->base.width - 2 * TEXTBOX_PADDING) / FONT_CHAR_WIDTH;
-    if (visible_chars <= 0) visible_chars = 1;
+    size_t visible_chars = textbox_visible_chars(tb);
 
     /* Adjust scroll offset if cursor is outside visible area */
     if (tb->cursor_pos < tb->scroll_offset) {
         tb->scroll_offset = tb->cursor_pos;
-    } else if (tb->cursor_pos >= tb->scroll_offset + (size_t)visible_chars) {
-        tb->scroll_offset = tb->cursor_pos - (size_t)visible_chars + 1;
+    } else if (tb->cursor_pos >= tb->scroll_offset + visible_chars) {
+        tb->scroll_offset = tb->cursor_pos - visible_chars + 1;
     }
 }
 
@@ -171,9 +327,7 @@ static void textbox_delete_selection(textbox_t *tb) {
     size_t end = tb->selection_start < tb->selection_end ?
                  tb->selection_end : tb->selection_start;
 
-    /* Move text after selection to start position */
-    memmove(&tb->text[start], &tb->text[end], tb->text_length - end + 1);
-    tb->text_length -= (end - start);
+    textbox_gap_remove(tb, start, end);
     tb->cursor_pos = start;
     tb->has_selection = false;
 
@@ -181,6 +335,48 @@ static void textbox_delete_selection(textbox_t *tb) {
     widget_invalidate(&tb->base);
 }
 
+/**
+ * Draw the text in visible columns [first, last)
+ */
+static void textbox_draw_columns(textbox_t *tb, void *buffer, int32_t text_x, int32_t text_y,
+                                 size_t first, size_t last, uint32_t color) {
+    char chunk[TEXTBOX_DRAW_CHUNK + 1];
+    size_t pos = tb->scroll_offset + first;
+    size_t end = MIN(tb->scroll_offset + last, tb->text_length);
+
+    while (pos < end) {
+        size_t n = MIN(end - pos, (size_t)TEXTBOX_DRAW_CHUNK);
+        if (tb->password_mode) {
+            memset(chunk, '*', n);
+        } else {
+            textbox_copy_out(tb, pos, n, chunk);
+        }
+        chunk[n] = '\0';
+
+        draw_text(buffer, text_x + (int32_t)(pos - tb->scroll_offset) * FONT_CHAR_WIDTH,
+                  text_y, chunk, color);
+        pos += n;
+    }
+}
+
+/**
+ * Draw the cursor if it is shown and in visible columns [first, last)
+ */
+static void textbox_draw_cursor(textbox_t *tb, void *buffer, int32_t text_x, int32_t text_y,
+                                size_t first, size_t last) {
+    widget_t *w = &tb->base;
+    if (!(w->flags & WIDGET_FLAG_FOCUSED) || !tb->cursor_visible ||
+        !(w->flags & WIDGET_FLAG_ENABLED) || tb->cursor_pos < tb->scroll_offset) {
+        return;
+    }
+
+    size_t column = tb->cursor_pos - tb->scroll_offset;
+    if (column >= first && column < last) {
+        draw_filled_rect(buffer, text_x + (int32_t)column * FONT_CHAR_WIDTH, text_y, 2,
+                         FONT_CHAR_HEIGHT, tb->color_cursor);
+    }
+}
+
 /**
  * Internal draw function for textboxes
  */
@@ -206,36 +402,31 @@ static void textbox_draw_impl(widget_t *w, void *buffer) {
         border_color = TEXTBOX_COLOR_BORDER_FOCUS;
     }
 
-    /* Draw background */
-    draw_filled_rect(buffer, abs_x, abs_y, w->width, w->height, bg_color);
-
-    /* Draw border */
-    draw_rect_border(buffer, abs_x, abs_y, w->width, w->height, border_color);
-
     /* Calculate text area */
     int32_t text_x = abs_x + TEXTBOX_PADDING;
     int32_t text_y = abs_y + (w->height - FONT_CHAR_HEIGHT) / 2;
     int32_t visible_width = w->width - 2 * TEXTBOX_PADDING;
+    size_t visible_chars = textbox_visible_chars(tb);
+    tb->drawn_offset = tb->scroll_offset;
+
+    /* Only some columns changed (textbox_invalidate_from) */
+    if (w->flags & WIDGET_FLAG_DAMAGED) {
+        size_t first = (size_t)(w->damage_x - TEXTBOX_PADDING) / FONT_CHAR_WIDTH;
+        size_t last = (size_t)(w->damage_x + w->damage_width - TEXTBOX_PADDING +
+                               FONT_CHAR_WIDTH - 1) / FONT_CHAR_WIDTH;
+
+        draw_filled_rect(buffer, abs_x + w->damage_x, abs_y + w->damage_y,
+                         w->damage_width, w->damage_height, bg_color);
+        textbox_draw_columns(tb, buffer, text_x, text_y, first, last, text_color);
+        textbox_draw_cursor(tb, buffer, text_x, text_y, first, last);
+        return;
+    }
 
-    /* Determine what text to display */
-    const char *display_text = tb->text;
-    char password_buf[TEXTBOX_MAX_TEXT];
+    /* Draw background */
+    draw_filled_rect(buffer, abs_x, abs_y, w->width, w->height, bg_color);
 
-    /* Handle placeholder */
-    if (tb->text_length == 0 && tb->placeholder[0] != '\0' &&
-        !(w->flags & WIDGET_FLAG_FOCUSED)) {
-        display_text = tb->placeholder;
-        text_color = TEXTBOX_COLOR_PLACEHOLDER;
-    }
-    /* Handle password mode */
-    else if (tb->password_mode && tb->text_length > 0) {
-        size_t i;
-        for (i = 0; i < tb->text_length && i < TEXTBOX_MAX_TEXT - 1; i++) {
-            password_buf[i] = '*';
-        }
-        password_buf[i] = '\0';
-        display_text = password_buf;
-    }
+    /* Draw border */
+    draw_rect_border(buffer, abs_x, abs_y, w->width, w->height, border_color);
 
     /* Draw selection highlight */
     if (tb->has_selection && (w->flags & WIDGET_FLAG_FOCUSED)) {
@@ -265,30 +456,16 @@ static void textbox_draw_impl(widget_t *w, void *buffer) {
         }
     }
 
-    /* Draw visible text */
-    if (display_text[0] != '\0') {
-        /* Get visible portion of text */
-        size_t display_len = strlen(display_text);
-        if (display_len > tb->scroll_offset) {
-            const char *visible_text = display_text + tb->scroll_offset;
-            draw_text(buffer, text_x, text_y, visible_text, text_color);
-        }
+    /* Draw the placeholder, or the visible part of the text */
+    if (tb->text_length == 0 && tb->placeholder[0] != '\0' &&
+        !(w->flags & WIDGET_FLAG_FOCUSED)) {
+        draw_text(buffer, text_x, text_y, tb->placeholder, TEXTBOX_COLOR_PLACEHOLDER);
+    } else {
+        textbox_draw_columns(tb, buffer, text_x, text_y, 0, visible_chars, text_color);
     }
 
     /* Draw cursor if focused and visible */
-    if ((w->flags & WIDGET_FLAG_FOCUSED) && tb->cursor_visible &&
-        (w->flags & WIDGET_FLAG_ENABLED)) {
-        int32_t cursor_x = text_x +
-            (int32_t)(tb->cursor_pos - tb->scroll_offset) * FONT_CHAR_WIDTH;
-
-        if (cursor_x >= text_x && cursor_x < text_x + visible_width) {
-            draw_filled_rect(buffer, cursor_x, text_y, 2,
-                           FONT_CHAR_HEIGHT, tb->color_cursor);
-        }
-    }
-
-    kprintf("[TEXTBOX] Drew textbox, cursor_pos=%zu, text='%s'\n",
-            tb->cursor_pos, tb->text);
+    textbox_draw_cursor(tb, buffer, text_x, text_y, 0, visible_chars);
 }
 
 /**
@@ -309,6 +486,8 @@ static void textbox_key_handler(widget_t *w, event_t *event) {
     }
 
     bool text_changed = false;
+    bool had_selection;
+    size_t old_pos;
     bool shift_held = (event->key.modifiers & (MOD_LSHIFT | MOD_RSHIFT)) != 0;
     bool ctrl_held = (event->key.modifiers & (MOD_LCTRL | MOD_RCTRL)) != 0;
 
@@ -325,6 +504,8 @@ static void textbox_key_handler(widget_t *w, event_t *event) {
             break;
 
         case KEY_HOME:
+            old_pos = tb->cursor_pos;
+            had_selection = tb->has_selection;
             if (shift_held && tb->cursor_pos > 0) {
                 if (!tb->has_selection) {
                     tb->selection_start = tb->cursor_pos;
@@ -336,11 +517,13 @@ static void textbox_key_handler(widget_t *w, event_t *event) {
             }
             tb->cursor_pos = 0;
             textbox_ensure_cursor_visible(tb);
-            widget_invalidate(w);
+            textbox_cursor_moved(tb, old_pos, had_selection || tb->has_selection);
             event->handled = true;
             break;
 
         case KEY_END:
+            old_pos = tb->cursor_pos;
+            had_selection = tb->has_selection;
             if (shift_held && tb->cursor_pos < tb->text_length) {
                 if (!tb->has_selection) {
                     tb->selection_start = tb->cursor_pos;
@@ -352,7 +535,7 @@ static void textbox_key_handler(widget_t *w, event_t *event) {
             }
             tb->cursor_pos = tb->text_length;
             textbox_ensure_cursor_visible(tb);
-            widget_invalidate(w);
+            textbox_cursor_moved(tb, old_pos, had_selection || tb->has_selection);
             event->handled = true;
             break;
 
@@ -439,12 +622,14 @@ static void textbox_mouse_handler(widget_t *w, event_t *event) {
             char_pos = tb->text_length;
         }
 
+        size_t old_pos = tb->cursor_pos;
+        bool had_selection = tb->has_selection;
         tb->cursor_pos = char_pos;
         tb->has_selection = false;
         tb->cursor_visible = true;
         tb->cursor_blink_time = 0;
 
-        widget_invalidate(w);
+        textbox_cursor_moved(tb, old_pos, had_selection);
         event->handled = true;
 
         kprintf("[TEXTBOX] Click set cursor to position %zu\n", char_pos);
@@ -485,7 +670,7 @@ size_t textbox_get_text(textbox_t *tb, char *buf, size_t max) {
         copy_len = max - 1;
     }
 
-    memcpy(buf, tb->text, copy_len);
+    textbox_copy_out(tb, 0, copy_len, buf);
     buf[copy_len] = '\0';
 
     return copy_len;
@@ -500,19 +685,14 @@ void textbox_set_text(textbox_t *tb, const char *text) {
         return;
     }
 
+    textbox_gap_reset(tb);
     if (text) {
-        size_t len = strlen(text);
-        size_t max_len = tb->max_length > 0 ? tb->max_length : TEXTBOX_MAX_TEXT - 1;
-        if (len > max_len) {
-            len = max_len;
+        size_t len = MIN(strlen(text), textbox_room(tb));
+        if (textbox_gap_reserve(tb, len)) {
+            memcpy(tb->buffer, text, len);
+            tb->gap_start = len;
+            tb->text_length = len;
         }
-
-        memcpy(tb->text, text, len);
-        tb->text[len] = '\0';
-        tb->text_length = len;
-    } else {
-        tb->text[0] = '\0';
-        tb->text_length = 0;
     }
 
     /* Reset cursor and selection */
@@ -523,7 +703,7 @@ void textbox_set_text(textbox_t *tb, const char *text) {
 
     widget_invalidate(&tb->base);
 
-    kprintf("[TEXTBOX] Text set to '%s'\n", tb->text);
+    kprintf("[TEXTBOX] Text set, length=%zu\n", tb->text_length);
 }
 
 /**
@@ -532,22 +712,22 @@ void textbox_set_text(textbox_t *tb, const char *text) {
 void textbox_append_text(textbox_t *tb, const char *text) {
     if (!tb || !text) return;
 
-    size_t add_len = strlen(text);
-    size_t max_len = tb->max_length > 0 ? tb->max_length : TEXTBOX_MAX_TEXT - 1;
-    size_t available = max_len - tb->text_length;
-
-    if (add_len > available) {
-        add_len = available;
-    }
+    size_t add_len = MIN(strlen(text), textbox_room(tb));
 
     if (add_len > 0) {
-        memcpy(&tb->text[tb->text_length], text, add_len);
+        textbox_gap_move(tb, tb->text_length);
+        if (!textbox_gap_reserve(tb, add_len)) {
+            return;
+        }
+
+        size_t old_length = tb->text_length;
+        memcpy(&tb->buffer[tb->gap_start], text, add_len);
+        tb->gap_start += add_len;
         tb->text_length += add_len;
-        tb->text[tb->text_length] = '\0';
         tb->cursor_pos = tb->text_length;
 
         textbox_ensure_cursor_visible(tb);
-        widget_invalidate(&tb->base);
+        textbox_text_changed(tb, old_length);
     }
 
     kprintf("[TEXTBOX] Appended text, total length=%zu\n", tb->text_length);
@@ -564,27 +744,22 @@ void textbox_insert_text(textbox_t *tb, const char *text) {
         textbox_delete_selection(tb);
     }
 
-    size_t insert_len = strlen(text);
-    size_t max_len = tb->max_length > 0 ? tb->max_length : TEXTBOX_MAX_TEXT - 1;
-    size_t available = max_len - tb->text_length;
-
-    if (insert_len > available) {
-        insert_len = available;
-    }
+    size_t insert_len = MIN(strlen(text), textbox_room(tb));
 
     if (insert_len > 0) {
-        /* Make room for inserted text */
-        memmove(&tb->text[tb->cursor_pos + insert_len],
-                &tb->text[tb->cursor_pos],
-                tb->text_length - tb->cursor_pos + 1);
+        /* Fill the gap at the cursor; it moves only if the last edit was elsewhere */
+        textbox_gap_move(tb, tb->cursor_pos);
+        if (!textbox_gap_reserve(tb, insert_len)) {
+            return;
+        }
 
-        /* Insert the text */
-        memcpy(&tb->text[tb->cursor_pos], text, insert_len);
+        memcpy(&tb->buffer[tb->gap_start], text, insert_len);
+        tb->gap_start += insert_len;
         tb->text_length += insert_len;
         tb->cursor_pos += insert_len;
 
         textbox_ensure_cursor_visible(tb);
-        widget_invalidate(&tb->base);
+        textbox_text_changed(tb, tb->cursor_pos - insert_len);
     }
 
     kprintf("[TEXTBOX] Inserted '%s' at position %zu\n", text, tb->cursor_pos - insert_len);
@@ -605,23 +780,17 @@ void textbox_delete(textbox_t *tb, bool forward) {
     if (forward) {
         /* Delete character after cursor (Delete key) */
         if (tb->cursor_pos < tb->text_length) {
-            memmove(&tb->text[tb->cursor_pos],
-                    &tb->text[tb->cursor_pos + 1],
-                    tb->text_length - tb->cursor_pos);
-            tb->text_length--;
-            widget_invalidate(&tb->base);
+            textbox_gap_remove(tb, tb->cursor_pos, tb->cursor_pos + 1);
+            textbox_text_changed(tb, tb->cursor_pos);
             kprintf("[TEXTBOX] Deleted character at position %zu\n", tb->cursor_pos);
         }
     } else {
         /* Delete character before cursor (Backspace) */
         if (tb->cursor_pos > 0) {
-            memmove(&tb->text[tb->cursor_pos - 1],
-                    &tb->text[tb->cursor_pos],
-                    tb->text_length - tb->cursor_pos + 1);
-            tb->text_length--;
+            textbox_gap_remove(tb, tb->cursor_pos - 1, tb->cursor_pos);
             tb->cursor_pos--;
             textbox_ensure_cursor_visible(tb);
-            widget_invalidate(&tb->base);
+            textbox_text_changed(tb, tb->cursor_pos);
             kprintf("[TEXTBOX] Backspaced at position %zu\n", tb->cursor_pos + 1);
         }
     }
@@ -633,8 +802,7 @@ void textbox_delete(textbox_t *tb, bool forward) {
 void textbox_clear(textbox_t *tb) {
     if (!tb) return;
 
-    tb->text[0] = '\0';
-    tb->text_length = 0;
+    textbox_gap_reset(tb);
     tb->cursor_pos = 0;
     tb->has_selection = false;
     tb->scroll_offset = 0;
@@ -654,10 +822,12 @@ void textbox_set_cursor(textbox_t *tb, size_t pos) {
         pos = tb->text_length;
     }
 
+    size_t old_pos = tb->cursor_pos;
+    bool had_selection = tb->has_selection;
     tb->cursor_pos = pos;
     tb->has_selection = false;
     textbox_ensure_cursor_visible(tb);
-    widget_invalidate(&tb->base);
+    textbox_cursor_moved(tb, old_pos, had_selection);
 }
 
 /**
@@ -674,6 +844,8 @@ size_t textbox_get_cursor(textbox_t *tb) {
 void textbox_move_cursor(textbox_t *tb, int32_t delta, bool extend_selection) {
     if (!tb) return;
 
+    size_t old_pos = tb->cursor_pos;
+    bool had_selection = tb->has_selection;
     size_t new_pos = tb->cursor_pos;
 
     if (delta < 0) {
@@ -701,7 +873,7 @@ void textbox_move_cursor(textbox_t *tb, int32_t delta, bool extend_selection) {
 
     tb->cursor_pos = new_pos;
     textbox_ensure_cursor_visible(tb);
-    widget_invalidate(&tb->base);
+    textbox_cursor_moved(tb, old_pos, had_selection || tb->has_selection);
 }
 
 /**
@@ -749,7 +921,7 @@ size_t textbox_get_selection(textbox_t *tb, char *buf, size_t max) {
         sel_len = max - 1;
     }
 
-    memcpy(buf, &tb->text[start], sel_len);
+    textbox_copy_out(tb, start, sel_len, buf);
     buf[sel_len] = '\0';
 
     return sel_len;
@@ -803,21 +975,16 @@ void textbox_set_password_mode(textbox_t *tb, bool password_mode) {
 void textbox_set_max_length(textbox_t *tb, size_t max_length) {
     if (!tb) return;
 
-    if (max_length == 0 || max_length >= TEXTBOX_MAX_TEXT) {
-        tb->max_length = 0;  /* Unlimited */
-    } else {
-        tb->max_length = max_length;
-
-        /* Truncate existing text if necessary */
-        if (tb->text_length > max_length) {
-            tb->text[max_length] = '\0';
-            tb->text_length = max_length;
-            if (tb->cursor_pos > max_length) {
-                tb->cursor_pos = max_length;
-            }
-            textbox_ensure_cursor_visible(tb);
-            widget_invalidate(&tb->base);
+    tb->max_length = max_length;  /* 0 = unlimited */
+
+    /* Truncate existing text if necessary */
+    if (max_length > 0 && tb->text_length > max_length) {
+        textbox_gap_remove(tb, max_length, tb->text_length);
+        if (tb->cursor_pos > max_length) {
+            tb->cursor_pos = max_length;
         }
+        textbox_ensure_cursor_visible(tb);
+        widget_invalidate(&tb->base);
     }
 
     kprintf("[TEXTBOX] Max length set to %zu\n", max_length);
@@ -859,7 +1026,7 @@ void textbox_update(textbox_t *tb, uint32_t delta_ms) {
     if (tb->cursor_blink_time >= CURSOR_BLINK_INTERVAL) {
         tb->cursor_blink_time = 0;
         tb->cursor_visible = !tb->cursor_visible;
-        widget_invalidate(&tb->base);
+        textbox_invalidate_from(tb, tb->cursor_pos, tb->cursor_pos + 1);
     }
 }
 
@@ -874,6 +1041,9 @@ void textbox_destroy(textbox_t *tb) {
     /* Destroy base widget */
     widget_destroy(&tb->base);
 
+    /* Free the text buffer */
+    kfree(tb->buffer);
+
     /* Free the textbox structure */
     kfree(tb);
 }
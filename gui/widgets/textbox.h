@@ -3,6 +3,12 @@
  *
  * Provides a text input widget for single-line text entry
  * with cursor support and basic editing capabilities.
+ *
+ * The text is kept in a gap buffer: the unused space sits at the last
+ * edit, so typing at the cursor moves no text and the buffer only grows
+ * (by doubling) when the gap runs out. Edits and cursor moves report just
+ * the columns they changed; the whole box is redrawn only when it scrolls
+ * or the selection, placeholder or state changes.
  */
 
 #ifndef _AAAOS_GUI_TEXTBOX_H
@@ -10,9 +16,12 @@
 
 #include "widget.h"
 
-/* Maximum textbox content length */
+/* Maximum placeholder length */
 #define TEXTBOX_MAX_TEXT        256
 
+/* Initial text buffer size */
+#define TEXTBOX_GAP_MIN         64
+
 /* Default textbox dimensions */
 #define TEXTBOX_DEFAULT_HEIGHT  24
 #define TEXTBOX_PADDING         4
@@ -36,7 +45,11 @@
 typedef struct textbox {
     widget_t base;                          /* Base widget (must be first) */
 
-    char text[TEXTBOX_MAX_TEXT];            /* Text content */
+    /* Text content: [0, gap_start) and [gap_end, buffer_size) */
+    char *buffer;                           /* Gap buffer (NULL until first text) */
+    size_t buffer_size;                     /* Allocated bytes */
+    size_t gap_start;                       /* First byte of the gap */
+    size_t gap_end;                         /* First byte after the gap */
     char placeholder[TEXTBOX_MAX_TEXT];     /* Placeholder text */
     size_t text_length;                     /* Current text length */
 
@@ -48,6 +61,7 @@ typedef struct textbox {
 
     /* Scrolling */
     size_t scroll_offset;                   /* Character offset for scrolling */
+    size_t drawn_offset;                    /* scroll_offset at the last draw */
 
     /* Cursor blink state */
     bool cursor_visible;                    /* Is cursor currently visible? */
@@ -200,7 +214,7 @@ void textbox_set_password_mode(textbox_t *tb, bool password_mode);
 /**
  * Set maximum text length
  * @param tb Textbox
- * @param max_length Maximum length (0 = unlimited up to TEXTBOX_MAX_TEXT)
+ * @param max_length Maximum length (0 = unlimited)
  */
 void textbox_set_max_length(textbox_t *tb, size_t max_length);
 
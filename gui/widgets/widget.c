@@ -6,6 +6,7 @@
  */
 
 #include "widget.h"
+#include "../window/window.h"
 #include "../../kernel/include/serial.h"
 #include "../../lib/libc/string.h"
 
@@ -15,6 +16,16 @@ static uint32_t g_widget_id_counter = 0;
 /* Currently focused widget */
 static widget_t *g_focused_widget = NULL;
 
+/**
+ * Mark the cached positions of a widget and its descendants as stale
+ */
+static void widget_mark_layout(widget_t *w) {
+    w->flags |= WIDGET_FLAG_LAYOUT;
+    for (uint32_t i = 0; i < w->child_count; i++) {
+        widget_mark_layout(w->children[i]);
+    }
+}
+
 /**
  * Initialize a widget with default values
  */
@@ -33,8 +44,8 @@ void widget_init(widget_t *w, int32_t x, int32_t y, int32_t width, int32_t heigh
     w->width = width;
     w->height = height;
 
-    /* Set default flags */
-    w->flags = WIDGET_FLAGS_DEFAULT;
+    /* Set default flags; the position is computed on first use */
+    w->flags = WIDGET_FLAGS_DEFAULT | WIDGET_FLAG_LAYOUT;
 
     /* Assign unique ID */
     w->id = ++g_widget_id_counter;
@@ -79,6 +90,7 @@ bool widget_add_child(widget_t *parent, widget_t *child) {
     /* Add to new parent */
     parent->children[parent->child_count++] = child;
     child->parent = parent;
+    widget_mark_layout(child);
 
     kprintf("[WIDGET] Added widget %u as child of widget %u (child count: %u)\n",
             child->id, parent->id, parent->child_count);
@@ -107,6 +119,7 @@ bool widget_remove_child(widget_t *parent, widget_t *child) {
             }
             parent->child_count--;
             child->parent = NULL;
+            widget_mark_layout(child);
 
             kprintf("[WIDGET] Removed widget %u from parent %u (child count: %u)\n",
                     child->id, parent->id, parent->child_count);
@@ -123,6 +136,13 @@ bool widget_remove_child(widget_t *parent, widget_t *child) {
     return false;
 }
 
+/**
+ * Check whether a widget's draw function alone covers a damaged part
+ */
+static bool widget_can_damage(const widget_t *w) {
+    return (w->flags & WIDGET_FLAG_OPAQUE) && w->draw && !w->on_paint && w->child_count == 0;
+}
+
 /**
  * Draw a widget and all its children
  */
@@ -133,9 +153,13 @@ void widget_draw(widget_t *w, void *buffer) {
 
     /* Don't draw if not visible */
     if (!(w->flags & WIDGET_FLAG_VISIBLE)) {
+        w->flags &= ~(WIDGET_FLAG_DIRTY | WIDGET_FLAG_CHILD_DIRTY | WIDGET_FLAG_DAMAGED);
         return;
     }
 
+    /* A full draw covers any pending damage */
+    w->flags &= ~WIDGET_FLAG_DAMAGED;
+
     /* Draw this widget first */
     if (w->draw) {
         w->draw(w, buffer);
@@ -160,8 +184,52 @@ void widget_draw(widget_t *w, void *buffer) {
         widget_draw(w->children[i], buffer);
     }
 
-    /* Clear dirty flag */
-    w->flags &= ~WIDGET_FLAG_DIRTY;
+    /* Clear dirty flags */
+    w->flags &= ~(WIDGET_FLAG_DIRTY | WIDGET_FLAG_CHILD_DIRTY);
+}
+
+/**
+ * Repaint the dirty parts of a widget tree
+ */
+void widget_draw_dirty(widget_t *w, void *buffer) {
+    if (!w || !buffer) {
+        return;
+    }
+
+    if (w->flags & WIDGET_FLAG_DIRTY || !(w->flags & WIDGET_FLAG_VISIBLE)) {
+        widget_draw(w, buffer);
+        return;
+    }
+
+    /* Damaged only: the draw function repaints the damage rectangle */
+    if (w->flags & WIDGET_FLAG_DAMAGED) {
+        if (widget_can_damage(w)) {
+            w->draw(w, buffer);
+            w->flags &= ~(WIDGET_FLAG_DAMAGED | WIDGET_FLAG_CHILD_DIRTY);
+        } else {
+            widget_draw(w, buffer);
+        }
+        return;
+    }
+
+    if (w->flags & WIDGET_FLAG_CHILD_DIRTY) {
+        for (uint32_t i = 0; i < w->child_count; i++) {
+            widget_draw_dirty(w->children[i], buffer);
+        }
+        w->flags &= ~WIDGET_FLAG_CHILD_DIRTY;
+    }
+}
+
+/**
+ * Attach a widget tree to the window it is drawn in
+ */
+void widget_attach_window(widget_t *root, struct window *win) {
+    if (!root) return;
+
+    /* The new window has seen none of the tree yet */
+    root->window = win;
+    root->flags &= ~WIDGET_FLAG_DIRTY;
+    widget_invalidate(root);
 }
 
 /**
@@ -300,14 +368,16 @@ void widget_set_visible(widget_t *w, bool visible) {
 
     if (visible) {
         w->flags |= WIDGET_FLAG_VISIBLE;
+        widget_invalidate(w);
     } else {
         w->flags &= ~WIDGET_FLAG_VISIBLE;
         /* Remove focus if hiding */
         if (w->flags & WIDGET_FLAG_FOCUSED) {
             widget_set_focus(NULL);
         }
+        /* Whatever is behind the widget shows through again */
+        widget_invalidate(w->parent ? w->parent : w);
     }
-    widget_invalidate(w);
 
     kprintf("[WIDGET] Widget %u visibility set to %s\n",
             w->id, visible ? "true" : "false");
@@ -356,11 +426,92 @@ bool widget_is_enabled(widget_t *w) {
 void widget_invalidate(widget_t *w) {
     if (!w) return;
 
-    w->flags |= WIDGET_FLAG_DIRTY;
+    /* A see-through widget needs what is behind it drawn first */
+    widget_t *target = w;
+    while (!(target->flags & WIDGET_FLAG_OPAQUE) && target->parent) {
+        target = target->parent;
+    }
 
-    /* Also invalidate parent */
-    if (w->parent) {
-        widget_invalidate(w->parent);
+    /* Nothing to do if the target or an ancestor is already dirty */
+    widget_t *root = target;
+    for (widget_t *p = target; p; p = p->parent) {
+        if (p->flags & WIDGET_FLAG_DIRTY) {
+            return;
+        }
+        root = p;
+    }
+
+    target->flags |= WIDGET_FLAG_DIRTY;
+    for (widget_t *p = target->parent; p; p = p->parent) {
+        p->flags |= WIDGET_FLAG_CHILD_DIRTY;
+    }
+
+    /* Report only this rectangle to the window */
+    if (root->window) {
+        int32_t abs_x, abs_y;
+        widget_get_absolute_pos(target, &abs_x, &abs_y);
+        window_invalidate_rect(root->window, abs_x, abs_y, target->width, target->height);
+    }
+}
+
+/**
+ * Mark part of a widget as needing redraw
+ */
+void widget_invalidate_rect(widget_t *w, int32_t x, int32_t y, int32_t width, int32_t height) {
+    if (!w) return;
+
+    if (!widget_can_damage(w)) {
+        widget_invalidate(w);
+        return;
+    }
+
+    /* Clip to the widget */
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    width = MIN(width, w->width - x);
+    height = MIN(height, w->height - y);
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    /* A full redraw is already pending */
+    widget_t *root = w;
+    for (widget_t *p = w; p; p = p->parent) {
+        if (p->flags & WIDGET_FLAG_DIRTY) {
+            return;
+        }
+        root = p;
+    }
+
+    /* Merge with the part already pending */
+    if (w->flags & WIDGET_FLAG_DAMAGED) {
+        int32_t right = MAX(x + width, w->damage_x + w->damage_width);
+        int32_t bottom = MAX(y + height, w->damage_y + w->damage_height);
+        x = MIN(x, w->damage_x);
+        y = MIN(y, w->damage_y);
+        width = right - x;
+        height = bottom - y;
+    }
+    w->damage_x = x;
+    w->damage_y = y;
+    w->damage_width = width;
+    w->damage_height = height;
+
+    w->flags |= WIDGET_FLAG_DAMAGED;
+    for (widget_t *p = w->parent; p; p = p->parent) {
+        p->flags |= WIDGET_FLAG_CHILD_DIRTY;
+    }
+
+    if (root->window) {
+        int32_t abs_x, abs_y;
+        widget_get_absolute_pos(w, &abs_x, &abs_y);
+        window_invalidate_rect(root->window, abs_x + x, abs_y + y, width, height);
     }
 }
 
@@ -370,16 +521,21 @@ void widget_invalidate(widget_t *w) {
 void widget_get_absolute_pos(widget_t *w, int32_t *abs_x, int32_t *abs_y) {
     if (!w || !abs_x || !abs_y) return;
 
-    *abs_x = w->x;
-    *abs_y = w->y;
-
-    /* Walk up the parent chain */
-    widget_t *parent = w->parent;
-    while (parent) {
-        *abs_x += parent->x;
-        *abs_y += parent->y;
-        parent = parent->parent;
+    /* Recompute from the parent's position only after a move */
+    if (w->flags & WIDGET_FLAG_LAYOUT) {
+        w->abs_x = w->x;
+        w->abs_y = w->y;
+        if (w->parent) {
+            int32_t parent_x, parent_y;
+            widget_get_absolute_pos(w->parent, &parent_x, &parent_y);
+            w->abs_x += parent_x;
+            w->abs_y += parent_y;
+        }
+        w->flags &= ~WIDGET_FLAG_LAYOUT;
     }
+
+    *abs_x = w->abs_x;
+    *abs_y = w->abs_y;
 }
 
 /**
@@ -388,7 +544,7 @@ void widget_get_absolute_pos(widget_t *w, int32_t *abs_x, int32_t *abs_y) {
 bool widget_contains_point(widget_t *w, int32_t x, int32_t y) {
     if (!w) return false;
 
-    int32_t abs_x, abs_y;
+    int32_t abs_x = 0, abs_y = 0;
     widget_get_absolute_pos(w, &abs_x, &abs_y);
 
     return (x >= abs_x && x < abs_x + w->width &&
@@ -431,11 +587,20 @@ void widget_set_bounds(widget_t *w, int32_t x, int32_t y, int32_t width, int32_t
 
     int32_t old_w = w->width;
     int32_t old_h = w->height;
+    bool moved = (x != w->x || y != w->y);
+
+    /* The old rectangle must be repainted as well as the new one */
+    if (moved || width < old_w || height < old_h) {
+        widget_invalidate(w->parent ? w->parent : w);
+    }
 
     w->x = x;
     w->y = y;
     w->width = width;
     w->height = height;
+    if (moved) {
+        widget_mark_layout(w);
+    }
 
     /* Send resize event if size changed */
     if (old_w != width || old_h != height) {
@@ -451,6 +616,10 @@ void widget_set_bounds(widget_t *w, int32_t x, int32_t y, int32_t width, int32_t
     }
 
     widget_invalidate(w);
+    if (!w->parent && w->window) {
+        /* Already dirty from the old rectangle, so report the new one */
+        window_invalidate_rect(w->window, x, y, width, height);
+    }
 
     kprintf("[WIDGET] Widget %u bounds set to (%d, %d) size %dx%d\n",
             w->id, x, y, width, height);
@@ -3,6 +3,17 @@
  *
  * Provides the foundational widget structure and common functions
  * for the AAAos graphical user interface toolkit.
+ *
+ * Widgets form a retained tree. widget_invalidate marks one widget dirty
+ * and its ancestors as having a dirty descendant, then reports the
+ * widget's rectangle to the window the tree is attached to.
+ * widget_draw_dirty repaints only dirty subtrees. A widget that does not
+ * cover its whole rectangle (not WIDGET_FLAG_OPAQUE) passes invalidation
+ * up to the nearest opaque ancestor, which must repaint what lies behind
+ * it. An opaque widget that changed only in part (WIDGET_FLAG_DAMAGED)
+ * can report just that rectangle with widget_invalidate_rect; its draw
+ * function then repaints only w->damage_*. Absolute positions are cached
+ * and recomputed only after a move.
  */
 
 #ifndef _AAAOS_GUI_WIDGET_H
@@ -19,6 +30,10 @@
 #define WIDGET_FLAG_FOCUSED     0x04    /* Widget has keyboard focus */
 #define WIDGET_FLAG_DIRTY       0x08    /* Widget needs redraw */
 #define WIDGET_FLAG_CONTAINER   0x10    /* Widget can contain children */
+#define WIDGET_FLAG_CHILD_DIRTY 0x20    /* A descendant needs redraw */
+#define WIDGET_FLAG_LAYOUT      0x40    /* Cached absolute position is stale */
+#define WIDGET_FLAG_OPAQUE      0x80    /* Drawing covers the whole rectangle */
+#define WIDGET_FLAG_DAMAGED     0x100   /* Only the damage rectangle needs redraw */
 
 /* Default widget flags */
 #define WIDGET_FLAGS_DEFAULT    (WIDGET_FLAG_VISIBLE | WIDGET_FLAG_ENABLED)
@@ -49,6 +64,7 @@ typedef enum {
 #define MOUSE_BUTTON_MIDDLE     0x04
 
 /* Forward declarations */
+struct window;
 typedef struct widget widget_t;
 typedef struct event event_t;
 
@@ -125,6 +141,19 @@ struct widget {
     uint32_t flags;             /* Widget flags */
     uint32_t id;                /* Unique widget ID */
 
+    /* Cached layout (valid unless WIDGET_FLAG_LAYOUT is set) */
+    int32_t abs_x;              /* Absolute X position */
+    int32_t abs_y;              /* Absolute Y position */
+
+    /* Part needing redraw, relative to the widget (with WIDGET_FLAG_DAMAGED) */
+    int32_t damage_x;
+    int32_t damage_y;
+    int32_t damage_width;
+    int32_t damage_height;
+
+    /* Window the tree is shown in (set on the root only) */
+    struct window *window;
+
     /* Event handlers */
     event_handler_t on_click;   /* Click event handler */
     event_handler_t on_key;     /* Key event handler */
@@ -172,6 +201,23 @@ bool widget_remove_child(widget_t *parent, widget_t *child);
  */
 void widget_draw(widget_t *w, void *buffer);
 
+/**
+ * Repaint the dirty parts of a widget tree
+ * Dirty widgets are drawn with all their children; clean widgets are
+ * skipped, apart from walking into children marked as dirty.
+ * @param w Root of the tree
+ * @param buffer Framebuffer to draw to
+ */
+void widget_draw_dirty(widget_t *w, void *buffer);
+
+/**
+ * Attach a widget tree to the window it is drawn in
+ * Invalidations are then reported with window_invalidate_rect.
+ * @param root Root widget
+ * @param win Window (NULL to detach)
+ */
+void widget_attach_window(widget_t *root, struct window *win);
+
 /**
  * Handle an event for a widget
  * @param w Widget to handle event for
@@ -222,10 +268,24 @@ bool widget_is_enabled(widget_t *w);
 
 /**
  * Mark widget as needing redraw
+ * Ancestors only learn that a descendant is dirty; the window learns the
+ * widget's rectangle.
  * @param w Widget to invalidate
  */
 void widget_invalidate(widget_t *w);
 
+/**
+ * Mark part of a widget as needing redraw
+ * Falls back to widget_invalidate unless the widget is opaque and paints
+ * all of itself (no children or paint handler). Pending parts are merged.
+ * @param w Widget
+ * @param x X of the part, relative to the widget
+ * @param y Y of the part, relative to the widget
+ * @param width Width of the part
+ * @param height Height of the part
+ */
+void widget_invalidate_rect(widget_t *w, int32_t x, int32_t y, int32_t width, int32_t height);
+
 /**
  * Get widget absolute screen position
  * @param w Widget
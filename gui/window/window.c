@@ -21,6 +21,8 @@ static void wm_draw_titlebar(window_t *win);
 static void wm_draw_borders(window_t *win);
 static void wm_draw_buttons(window_t *win);
 static void wm_blit_content(window_t *win);
+static void wm_blit_content_rect(window_t *win, int x, int y, int width, int height);
+static void wm_render_damage(window_t *win);
 static void wm_send_event(window_t *win, window_event_type_t type);
 static void wm_handle_drag(int x, int y);
 static void wm_handle_resize(int x, int y);
@@ -750,6 +752,8 @@ void window_draw(window_t *win) {
 
     /* Clear dirty flag */
     win->flags &= ~WINDOW_DIRTY;
+    win->damage_w = 0;
+    win->damage_h = 0;
 }
 
 void window_invalidate(window_t *win) {
@@ -760,13 +764,31 @@ void window_invalidate(window_t *win) {
 }
 
 void window_invalidate_rect(window_t *win, int x, int y, int width, int height) {
-    /* For now, just invalidate the whole window */
-    /* A more sophisticated implementation would track dirty rectangles */
-    UNUSED(x);
-    UNUSED(y);
-    UNUSED(width);
-    UNUSED(height);
-    window_invalidate(win);
+    if (!win) {
+        return;
+    }
+
+    /* Clip to the content area */
+    int x1 = MAX(x, 0);
+    int y1 = MAX(y, 0);
+    int x2 = MIN(x + width, win->width);
+    int y2 = MIN(y + height, win->height);
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+
+    /* Grow the damage to cover the region */
+    if (win->damage_w > 0 && win->damage_h > 0) {
+        x1 = MIN(x1, win->damage_x);
+        y1 = MIN(y1, win->damage_y);
+        x2 = MAX(x2, win->damage_x + win->damage_w);
+        y2 = MAX(y2, win->damage_y + win->damage_h);
+    }
+    win->damage_x = x1;
+    win->damage_y = y1;
+    win->damage_w = x2 - x1;
+    win->damage_h = y2 - y1;
+    g_wm.needs_redraw = true;
 }
 
 uint32_t *window_get_buffer(window_t *win) {
@@ -1075,11 +1097,26 @@ void window_render_all(void) {
         return;
     }
 
+    /* A wholly dirty window means drawing everything again */
+    bool full = false;
+    for (window_t *win = g_wm.window_list; win; win = win->next) {
+        if (window_is_visible(win) && (win->flags & WINDOW_DIRTY)) {
+            full = true;
+            break;
+        }
+    }
+
     /* Draw windows from back to front */
     window_t *win = g_wm.window_list;
     while (win) {
-        if (window_is_visible(win)) {
+        if (!window_is_visible(win)) {
+            /* Nothing shows, so nothing stays damaged */
+            win->damage_w = 0;
+            win->damage_h = 0;
+        } else if (full) {
             window_draw(win);
+        } else if (win->damage_w > 0 && win->damage_h > 0) {
+            wm_render_damage(win);
         }
         win = win->next;
     }
@@ -1259,19 +1296,29 @@ static void wm_draw_buttons(window_t *win) {
 }
 
 static void wm_blit_content(window_t *win) {
+    if (!win) {
+        return;
+    }
+    wm_blit_content_rect(win, 0, 0, win->width, win->height);
+}
+
+/**
+ * Blit part of the content buffer (content coordinates, already clipped)
+ */
+static void wm_blit_content_rect(window_t *win, int x, int y, int width, int height) {
     if (!win || !win->content_buffer) {
         return;
     }
 
     uint32_t *src = win->content_buffer;
 
-    for (int row = 0; row < win->height; row++) {
+    for (int row = y; row < y + height; row++) {
         int dst_y = win->y + row;
         if (dst_y < 0 || dst_y >= (int)g_wm.screen_height) {
             continue;
         }
 
-        for (int col = 0; col < win->width; col++) {
+        for (int col = x; col < x + width; col++) {
             int dst_x = win->x + col;
             if (dst_x < 0 || dst_x >= (int)g_wm.screen_width) {
                 continue;
@@ -1300,6 +1347,42 @@ static void wm_blit_content(window_t *win) {
     }
 }
 
+/**
+ * Blit a window's damaged rectangle, then redraw what overlaps it above
+ */
+static void wm_render_damage(window_t *win) {
+    int sx = win->x + win->damage_x;
+    int sy = win->y + win->damage_y;
+    int sw = win->damage_w;
+    int sh = win->damage_h;
+
+    wm_blit_content_rect(win, win->damage_x, win->damage_y, sw, sh);
+    win->damage_w = 0;
+    win->damage_h = 0;
+
+    /* Windows later in the list are stacked on top */
+    for (window_t *above = win->next; above; above = above->next) {
+        if (!window_is_visible(above)) {
+            continue;
+        }
+
+        int fx, fy, fw, fh;
+        window_get_frame_bounds(above, &fx, &fy, &fw, &fh);
+        if (fx >= sx + sw || fx + fw <= sx || fy >= sy + sh || fy + fh <= sy) {
+            continue;
+        }
+        wm_draw_decorations(above);
+
+        int x1 = MAX(sx, above->x) - above->x;
+        int y1 = MAX(sy, above->y) - above->y;
+        int x2 = MIN(sx + sw, above->x + above->width) - above->x;
+        int y2 = MIN(sy + sh, above->y + above->height) - above->y;
+        if (x1 < x2 && y1 < y2) {
+            wm_blit_content_rect(above, x1, y1, x2 - x1, y2 - y1);
+        }
+    }
+}
+
 static void wm_send_event(window_t *win, window_event_type_t type) {
     if (!win || !win->event_handler) {
         return;
@@ -189,6 +189,12 @@ typedef struct window {
     uint32_t *content_buffer;               /* Pixel buffer for content (ARGB) */
     size_t buffer_size;                     /* Size of content buffer in bytes */
 
+    /* Damaged part of the content area (damage_w == 0 when clean) */
+    int32_t damage_x;
+    int32_t damage_y;
+    int32_t damage_w;
+    int32_t damage_h;
+
     /* Saved position for restore from maximized/minimized */
     int32_t saved_x;
     int32_t saved_y;
@@ -508,6 +514,8 @@ void window_invalidate(window_t *win);
 
 /**
  * Mark a rectangular region of a window as needing redraw
+ * Regions accumulate into one bounding rectangle, which the next
+ * window_render_all blits on its own unless the whole window is dirty.
  * @param win Window containing the region
  * @param x Region X (relative to content area)
  * @param y Region Y (relative to content area)
@@ -573,7 +581,9 @@ window_hit_region_t window_hit_test(window_t *win, int x, int y);
 
 /**
  * Render all windows to the screen
- * Should be called each frame by the compositor
+ * Should be called each frame by the compositor. If no window is wholly
+ * dirty, only damaged content rectangles are blitted, then the parts of
+ * windows above them are drawn again.
  */
 void window_render_all(void);
 
@@ -18,6 +18,7 @@
 #define ACPI_XSDT_SIGNATURE     "XSDT"
 #define ACPI_MADT_SIGNATURE     "APIC"      /* Multiple APIC Description Table */
 #define ACPI_FADT_SIGNATURE     "FACP"      /* Fixed ACPI Description Table */
+#define ACPI_MCFG_SIGNATURE     "MCFG"      /* PCI Express memory-mapped configuration */
 
 /* ============================================================================
  * RSDP Search Locations
@@ -295,6 +296,28 @@ typedef struct PACKED {
     uint64_t    hypervisor_vendor_id;
 } fadt_t;
 
+/**
+ * MCFG allocation: one PCI segment's ECAM window
+ * Function f of device d on bus b has its 4 KB of configuration space
+ * at base + ((b - start_bus) << 20 | d << 15 | f << 12).
+ */
+typedef struct PACKED {
+    uint64_t    base;               /* Physical address of the window */
+    uint16_t    segment;            /* PCI segment group */
+    uint8_t     start_bus;          /* First bus decoded */
+    uint8_t     end_bus;            /* Last bus decoded */
+    uint32_t    reserved;
+} mcfg_allocation_t;
+
+/**
+ * MCFG (PCI Express Memory-mapped Configuration Space table)
+ */
+typedef struct PACKED {
+    acpi_sdt_header_t header;
+    uint64_t    reserved;
+    mcfg_allocation_t allocations[];
+} mcfg_t;
+
 /* ============================================================================
  * ACPI Parsed Information
  * ============================================================================ */
@@ -10,7 +10,10 @@
 
 #include "apic.h"
 #include "io.h"
+#include "irq.h"
+#include "include/percpu.h"
 #include "../../include/serial.h"
+#include "../../sched/clock.h"
 
 /* ============================================================================
  * Private Data
@@ -37,6 +40,12 @@ static volatile uint32_t *apic_base = NULL;
 static uint32_t apic_timer_initial_count = 0;
 static uint32_t apic_timer_ticks_per_ms = 0;
 
+/* Calibration window, timed with the TSC */
+#define APIC_TIMER_CALIBRATE_MS 2
+
+/* One-shot timers use TSC-deadline mode (same on every CPU) */
+static bool apic_timer_tsc_deadline = false;
+
 /* ============================================================================
  * Private Helper Functions
  * ============================================================================ */
@@ -139,7 +148,7 @@ static void pit_delay(uint32_t ms) {
  * Simple microsecond delay using a busy loop
  * Note: This is approximate and depends on CPU speed
  */
-static void busy_delay_us(uint32_t us) {
+void apic_delay_us(uint32_t us) {
     /* Approximate busy-wait (very rough estimate) */
     for (volatile uint32_t i = 0; i < us * 100; i++) {
         __asm__ __volatile__("pause");
@@ -187,6 +196,44 @@ bool apic_is_available(void) {
     return check_apic_cpuid();
 }
 
+/**
+ * Program this CPU's local APIC registers: accept all priorities,
+ * software-enable it, and mask every LVT entry except errors
+ */
+static void apic_setup_local(uint8_t id) {
+    /* Set Task Priority Register to 0 (accept all interrupts) */
+    apic_write(APIC_REG_TPR, 0);
+
+    /* Set up Destination Format Register for flat model */
+    apic_write(APIC_REG_DFR, 0xFFFFFFFF);
+
+    /* Set up Logical Destination Register */
+    apic_write(APIC_REG_LDR, (apic_read(APIC_REG_LDR) & 0x00FFFFFF) |
+               ((uint32_t)(1 << id) << 24));
+
+    /* Configure Spurious Interrupt Vector Register */
+    /* Enable APIC and set spurious vector */
+    uint32_t svr = apic_read(APIC_REG_SVR);
+    svr |= APIC_SVR_ENABLE;          /* Software enable */
+    svr |= APIC_SPURIOUS_VECTOR;     /* Set spurious vector */
+    apic_write(APIC_REG_SVR, svr);
+
+    /* Mask all LVT entries initially */
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_THERMAL, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_PERF, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_LINT0, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_LINT1, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_ERROR, APIC_ERROR_VECTOR);  /* Unmask error */
+
+    /* Clear any pending errors */
+    apic_write(APIC_REG_ESR, 0);
+    apic_write(APIC_REG_ESR, 0);  /* Write twice per spec */
+
+    /* Send EOI to clear any pending interrupts */
+    apic_eoi();
+}
+
 bool apic_init(void) {
     kprintf("[APIC] Initializing Local APIC...\n");
 
@@ -228,40 +275,11 @@ bool apic_init(void) {
     kprintf("[APIC] APIC ID: %d, Version: 0x%02x, Max LVT: %d\n",
             apic_info.id, apic_info.version, apic_info.max_lvt);
 
-    /* Disable legacy PIC */
+    /* Hand the open ISA lines to the I/O APIC, then disable the legacy PIC */
+    irq_route_ioapic();
     apic_disable_pic();
 
-    /* Set Task Priority Register to 0 (accept all interrupts) */
-    apic_write(APIC_REG_TPR, 0);
-
-    /* Set up Destination Format Register for flat model */
-    apic_write(APIC_REG_DFR, 0xFFFFFFFF);
-
-    /* Set up Logical Destination Register */
-    apic_write(APIC_REG_LDR, (apic_read(APIC_REG_LDR) & 0x00FFFFFF) |
-               ((uint32_t)(1 << apic_info.id) << 24));
-
-    /* Configure Spurious Interrupt Vector Register */
-    /* Enable APIC and set spurious vector */
-    uint32_t svr = apic_read(APIC_REG_SVR);
-    svr |= APIC_SVR_ENABLE;          /* Software enable */
-    svr |= APIC_SPURIOUS_VECTOR;     /* Set spurious vector */
-    apic_write(APIC_REG_SVR, svr);
-
-    /* Mask all LVT entries initially */
-    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_THERMAL, APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_PERF, APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_LINT0, APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_LINT1, APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_ERROR, APIC_ERROR_VECTOR);  /* Unmask error */
-
-    /* Clear any pending errors */
-    apic_write(APIC_REG_ESR, 0);
-    apic_write(APIC_REG_ESR, 0);  /* Write twice per spec */
-
-    /* Send EOI to clear any pending interrupts */
-    apic_eoi();
+    apic_setup_local(apic_info.id);
 
     apic_info.enabled = true;
 
@@ -270,6 +288,16 @@ bool apic_init(void) {
     return true;
 }
 
+bool apic_init_ap(void) {
+    if (!apic_info.enabled) {
+        return false;
+    }
+
+    enable_apic_msr();
+    apic_setup_local(apic_get_id());
+    return true;
+}
+
 void apic_enable(void) {
     uint32_t svr = apic_read(APIC_REG_SVR);
     svr |= APIC_SVR_ENABLE;
@@ -307,61 +335,36 @@ const apic_info_t* apic_get_info(void) {
  * ============================================================================ */
 
 /**
- * Calibrate the APIC timer using PIT
+ * Calibrate the APIC timer against the calibrated TSC
  * Returns the number of APIC timer ticks per millisecond
  */
 static uint32_t apic_timer_calibrate(void) {
     kprintf("[APIC] Calibrating APIC timer...\n");
 
-    /* Set up PIT channel 2 for one-shot mode */
-    /* We'll use it to measure a known time interval */
+    /* The clock has measured the TSC against the PIT once for everyone */
+    if (!clock_init()) {
+        return 0;
+    }
+    uint64_t window = clock_tsc_khz() * APIC_TIMER_CALIBRATE_MS;
 
     /* Set APIC timer divide value to 16 */
     apic_write(APIC_REG_TIMER_DCR, APIC_TIMER_DIV_16);
 
-    /* Set initial count to maximum */
+    /* Count down from the maximum across the window */
+    uint64_t start = rdtsc();
     apic_write(APIC_REG_TIMER_ICR, 0xFFFFFFFF);
-
-    /* Wait for approximately 10ms using PIT */
-    /* Configure PIT channel 2 for 10ms */
-    uint32_t pit_divisor = PIT_FREQUENCY / 100;  /* 10ms = 1/100 second */
-
-    /* Gate speaker (enable channel 2 counting) */
-    uint8_t speaker = inb(0x61);
-    speaker = (speaker & 0xFC) | 0x01;  /* Gate on, speaker off */
-    outb(0x61, speaker);
-
-    /* Configure PIT channel 2: one-shot mode */
-    outb(PIT_CMD, 0xB0);  /* Channel 2, lobyte/hibyte, one-shot */
-    io_wait();
-    outb(PIT_CHANNEL2_DATA, pit_divisor & 0xFF);
-    io_wait();
-    outb(PIT_CHANNEL2_DATA, (pit_divisor >> 8) & 0xFF);
-    io_wait();
-
-    /* Start counting by toggling gate */
-    speaker = inb(0x61);
-    outb(0x61, speaker & 0xFE);  /* Gate off */
-    outb(0x61, speaker | 0x01);  /* Gate on - starts counting */
-
-    /* Wait for PIT to count down (poll bit 5 of port 0x61) */
-    while (!(inb(0x61) & 0x20)) {
+    while (rdtsc() - start < window) {
         __asm__ __volatile__("pause");
     }
-
-    /* Read current APIC timer count */
     uint32_t final_count = apic_read(APIC_REG_TIMER_CCR);
 
-    /* Calculate ticks elapsed */
-    uint32_t ticks_10ms = 0xFFFFFFFF - final_count;
-
     /* Stop the timer */
     apic_write(APIC_REG_TIMER_ICR, 0);
 
-    /* Calculate ticks per ms (divide by 10 since we measured 10ms) */
-    uint32_t ticks_per_ms = ticks_10ms / 10;
+    uint32_t ticks = 0xFFFFFFFF - final_count;
+    uint32_t ticks_per_ms = ticks / APIC_TIMER_CALIBRATE_MS;
 
-    kprintf("[APIC] Timer calibration: %u ticks in 10ms\n", ticks_10ms);
+    kprintf("[APIC] Timer calibration: %u ticks in %u ms\n", ticks, APIC_TIMER_CALIBRATE_MS);
     kprintf("[APIC] Timer ticks per ms: %u\n", ticks_per_ms);
 
     /* Calculate approximate timer frequency (accounting for divide by 16) */
@@ -385,8 +388,10 @@ bool apic_timer_init(uint32_t frequency) {
         return false;
     }
 
-    /* Calibrate the timer */
-    apic_timer_ticks_per_ms = apic_timer_calibrate();
+    /* Calibrate the timer once; every CPU's timer runs at the same rate */
+    if (apic_timer_ticks_per_ms == 0) {
+        apic_timer_ticks_per_ms = apic_timer_calibrate();
+    }
 
     if (apic_timer_ticks_per_ms == 0) {
         kprintf("[APIC] ERROR: Timer calibration failed!\n");
@@ -414,13 +419,75 @@ bool apic_timer_init(uint32_t frequency) {
     /* Set initial count - this starts the timer */
     apic_write(APIC_REG_TIMER_ICR, apic_timer_initial_count);
 
-    apic_info.ticks = 0;
+    if (percpu_cpu_id() == 0) {
+        apic_info.ticks = 0;
+    }
 
     kprintf("[APIC] Timer started in periodic mode\n");
 
     return true;
 }
 
+bool apic_timer_init_oneshot(void) {
+    if (!apic_info.enabled) {
+        kprintf("[APIC] ERROR: APIC not enabled!\n");
+        return false;
+    }
+
+    if (apic_timer_ticks_per_ms == 0) {
+        apic_timer_ticks_per_ms = apic_timer_calibrate();
+        if (apic_timer_ticks_per_ms == 0) {
+            kprintf("[APIC] ERROR: Timer calibration failed!\n");
+            return false;
+        }
+
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        apic_timer_tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+    }
+
+    apic_write(APIC_REG_TIMER_DCR, APIC_TIMER_DIV_16);
+    apic_write(APIC_REG_TIMER_ICR, 0);
+
+    if (apic_timer_tsc_deadline) {
+        apic_write(APIC_REG_LVT_TIMER, APIC_TIMER_VECTOR | APIC_TIMER_MODE_TSC_DEADLINE);
+        wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    } else {
+        apic_write(APIC_REG_LVT_TIMER, APIC_TIMER_VECTOR | APIC_TIMER_MODE_ONESHOT);
+    }
+
+    if (percpu_cpu_id() == 0) {
+        apic_info.ticks = 0;
+        kprintf("[APIC] Timer in %s mode\n",
+                apic_timer_tsc_deadline ? "TSC-deadline" : "one-shot");
+    }
+
+    return true;
+}
+
+void apic_timer_arm(uint64_t delay_ns) {
+    delay_ns = MIN(delay_ns, APIC_TIMER_MAX_ARM_NS);
+
+    if (apic_timer_tsc_deadline) {
+        /* A deadline already in the past fires immediately */
+        uint64_t delta = delay_ns * clock_tsc_khz() / NSEC_PER_MSEC;
+        wrmsr(MSR_IA32_TSC_DEADLINE, rdtsc() + MAX(delta, 1ULL));
+        return;
+    }
+
+    uint64_t count = delay_ns * apic_timer_ticks_per_ms / NSEC_PER_MSEC;
+    count = MAX(count, 1ULL);
+    apic_write(APIC_REG_TIMER_ICR, (uint32_t)MIN(count, 0xFFFFFFFFULL));
+}
+
+void apic_timer_disarm(void) {
+    if (apic_timer_tsc_deadline) {
+        wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    } else {
+        apic_write(APIC_REG_TIMER_ICR, 0);
+    }
+}
+
 void apic_timer_stop(void) {
     /* Mask the timer LVT entry */
     uint32_t lvt_timer = apic_read(APIC_REG_LVT_TIMER);
@@ -448,11 +515,12 @@ uint64_t apic_timer_get_ticks(void) {
 void apic_timer_handler(interrupt_frame_t *frame) {
     UNUSED(frame);
 
-    /* Increment tick counter */
-    apic_info.ticks++;
+    /* Count ticks on the BSP only; every CPU runs its own timer */
+    if (percpu_cpu_id() == 0) {
+        apic_info.ticks++;
+    }
 
-    /* Acknowledge the interrupt */
-    apic_eoi();
+    /* The interrupt was acknowledged by the dispatcher */
 
     /* Here you would typically:
      * 1. Update system time
@@ -600,7 +668,7 @@ bool apic_send_init_ipi(uint8_t dest_apic) {
     apic_ipi_wait();
 
     /* Wait 10ms */
-    busy_delay_us(10000);
+    apic_delay_us(10000);
 
     /* Send INIT de-assert */
     icr_low = 0;
@@ -645,7 +713,7 @@ bool apic_send_startup_ipi(uint8_t dest_apic, uint8_t vector) {
     apic_ipi_wait();
 
     /* Wait 200us */
-    busy_delay_us(200);
+    apic_delay_us(200);
 
     return true;
 }
@@ -84,6 +84,13 @@
 #define APIC_TIMER_MODE_PERIODIC    (1 << 17)   /* Periodic mode */
 #define APIC_TIMER_MODE_TSC_DEADLINE (2 << 17)  /* TSC-Deadline mode */
 
+/* TSC-deadline timer */
+#define MSR_IA32_TSC_DEADLINE   0x6E0   /* Deadline for the local timer (TSC value) */
+#define CPUID_ECX_TSC_DEADLINE  (1 << 24)   /* CPUID.1:ECX TSC-deadline support */
+
+/* Longest delay apic_timer_arm programs at once; later deadlines re-arm */
+#define APIC_TIMER_MAX_ARM_NS   1000000000ULL
+
 /* Timer divide configuration values */
 #define APIC_TIMER_DIV_1        0x0B    /* Divide by 1 */
 #define APIC_TIMER_DIV_2        0x00    /* Divide by 2 */
@@ -128,12 +135,14 @@
 #define APIC_ERROR_VECTOR       0xFE    /* APIC error interrupt */
 #define APIC_LINT0_VECTOR       0xFD    /* LINT0 vector */
 #define APIC_LINT1_VECTOR       0xFC    /* LINT1 vector (NMI) */
+#define APIC_PERF_VECTOR        0xFB    /* Performance counter overflow */
 
 /* IPI vectors for SMP */
 #define IPI_VECTOR_RESCHEDULE   0xF0    /* Reschedule IPI */
 #define IPI_VECTOR_TLB_FLUSH    0xF1    /* TLB flush IPI */
 #define IPI_VECTOR_STOP         0xF2    /* Stop/halt IPI */
 #define IPI_VECTOR_CALL         0xF3    /* Function call IPI */
+#define IPI_VECTOR_PROFILE      0xF4    /* Start/stop the sampling profiler */
 
 /* ============================================================================
  * PIT Constants (for timer calibration)
@@ -182,6 +191,13 @@ bool apic_is_available(void);
  */
 bool apic_init(void);
 
+/**
+ * Initialize the Local APIC of an application processor
+ * Must run on the AP itself, after apic_init on the BSP.
+ * @return true on success, false if the APIC is not in use
+ */
+bool apic_init_ap(void);
+
 /**
  * Enable the Local APIC
  * Sets the software enable bit in the SVR register
@@ -233,6 +249,27 @@ void apic_write(uint32_t reg, uint32_t value);
  */
 bool apic_timer_init(uint32_t frequency);
 
+/**
+ * Put the APIC timer in one-shot mode for deadline timers
+ * Uses TSC-deadline mode when the CPU supports it. The timer stays idle
+ * until apic_timer_arm is called.
+ * @return true on success, false if the APIC is disabled or calibration failed
+ */
+bool apic_timer_init_oneshot(void);
+
+/**
+ * Fire the timer interrupt once after a delay (one-shot mode)
+ * Replaces any earlier deadline on this CPU. Delays above
+ * APIC_TIMER_MAX_ARM_NS fire early, at that limit.
+ * @param delay_ns Delay in nanoseconds
+ */
+void apic_timer_arm(uint64_t delay_ns);
+
+/**
+ * Cancel the pending one-shot deadline on this CPU
+ */
+void apic_timer_disarm(void);
+
 /**
  * Stop the APIC timer
  */
@@ -312,6 +349,12 @@ bool apic_send_startup_ipi(uint8_t dest_apic, uint8_t vector);
  */
 void apic_ipi_wait(void);
 
+/**
+ * Approximate busy-wait, usable before the timer is calibrated
+ * @param us Microseconds to wait
+ */
+void apic_delay_us(uint32_t us);
+
 /**
  * Get APIC information structure
  * @return Pointer to APIC info structure
@@ -350,6 +393,15 @@ static inline void wrmsr(uint32_t msr, uint64_t value) {
     __asm__ __volatile__("wrmsr" : : "c"(msr), "a"(low), "d"(high));
 }
 
+/**
+ * Read the time-stamp counter
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 /**
  * Execute CPUID instruction
  * @param leaf CPUID leaf (EAX input)
@@ -0,0 +1,416 @@
+/**
+ * AAAos Kernel - FPU/SSE/AVX State Management Implementation
+ *
+ * Each CPU remembers which process's state its registers hold. That
+ * owner stays valid after a switch-out save, so a process that runs
+ * again on the same CPU without anyone else using the FPU in between
+ * gets TS cleared without a restore. A process whose state was restored
+ * on another CPU since then records that CPU in fpu_cpu, which makes the
+ * stale owner entry miss.
+ *
+ * State areas use the standard (non-compacted) XSAVE layout, so they can
+ * be copied byte for byte. XSAVEOPT is used when available; it skips
+ * components that have not changed since the last XRSTOR from the same
+ * area.
+ */
+
+#include "fpu.h"
+#include "apic.h"
+#include "include/idt.h"
+#include "include/percpu.h"
+#include "../../include/serial.h"
+#include "../../mm/heap.h"
+#include "../../proc/process.h"
+
+/* CR0 bits */
+#define CR0_MP                  BIT(1)  /* WAIT honours TS */
+#define CR0_EM                  BIT(2)  /* No FPU: trap every FPU instruction */
+#define CR0_TS                  BIT(3)  /* Task switched: trap the next FPU instruction */
+#define CR0_NE                  BIT(5)  /* Native x87 error reporting */
+
+/* CR4 bits */
+#define CR4_OSFXSR              BIT(9)  /* FXSAVE/FXRSTOR and SSE */
+#define CR4_OSXMMEXCPT          BIT(10) /* SIMD exceptions raise #XM */
+#define CR4_OSXSAVE             BIT(18) /* XSAVE and XCR0 */
+
+/* CPUID 1 feature bits */
+#define CPUID_EDX_FPU           BIT(0)
+#define CPUID_EDX_FXSR          BIT(24)
+#define CPUID_ECX_XSAVE         BIT(26)
+
+/* CPUID 7.0 EBX: AVX2 */
+#define CPUID_7_EBX_AVX2        BIT(5)
+
+/* CPUID 0xD.1 EAX: XSAVEOPT */
+#define CPUID_XSAVE_XSAVEOPT    BIT(0)
+
+/* Legacy region offsets */
+#define FXSAVE_FCW_OFFSET       0
+#define FXSAVE_MXCSR_OFFSET     24
+
+/*
+ * Per-CPU FPU state
+ * owner is only written by its own CPU, except for fpu_release clearing
+ * an entry for a process that is going away.
+ */
+typedef struct fpu_cpu {
+    struct process *owner;              /* Process whose state is in the registers */
+    uint64_t kernel_flags;              /* RFLAGS saved by kernel_fpu_begin */
+} ALIGNED(64) fpu_cpu_t;
+
+static fpu_cpu_t fpu_cpus[PERCPU_MAX_CPUS];
+
+/* Chosen once by fpu_init */
+static bool fpu_ready = false;
+static bool fpu_use_xsave = false;
+static bool fpu_use_xsaveopt = false;
+static bool fpu_avx2 = false;
+static uint64_t fpu_xfeatures = 0;
+static uint32_t fpu_area_size = 0;
+
+/* ============================================================================
+ * Control Registers
+ * ============================================================================ */
+
+static inline uint64_t read_cr0(void) {
+    uint64_t value;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value) {
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+    __asm__ __volatile__("xsetbv"
+                         : : "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void fpu_clts(void) {
+    __asm__ __volatile__("clts" : : : "memory");
+}
+
+static inline void fpu_stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline bool fpu_ts_set(void) {
+    return (read_cr0() & CR0_TS) != 0;
+}
+
+/* ============================================================================
+ * Save and Restore (TS clear)
+ * ============================================================================ */
+
+static void fpu_save(void *area) {
+    uint32_t lo = (uint32_t)fpu_xfeatures;
+    uint32_t hi = (uint32_t)(fpu_xfeatures >> 32);
+
+    if (fpu_use_xsaveopt) {
+        __asm__ __volatile__("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else if (fpu_use_xsave) {
+        __asm__ __volatile__("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        __asm__ __volatile__("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static void fpu_restore(const void *area) {
+    uint32_t lo = (uint32_t)fpu_xfeatures;
+    uint32_t hi = (uint32_t)(fpu_xfeatures >> 32);
+
+    if (fpu_use_xsave) {
+        __asm__ __volatile__("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        __asm__ __volatile__("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/**
+ * Allocate a state area holding the initial FPU state
+ * An all-zero XSAVE header marks every component as in its initial
+ * state; MXCSR and the x87 control word are still loaded from the
+ * legacy region.
+ */
+static void *fpu_alloc_area(void) {
+    uint8_t *area = kmalloc_aligned(fpu_area_size, FPU_STATE_ALIGN);
+    if (!area) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < fpu_area_size; i++) {
+        area[i] = 0;
+    }
+    *(uint16_t*)(area + FXSAVE_FCW_OFFSET) = FPU_DEFAULT_FCW;
+    *(uint32_t*)(area + FXSAVE_MXCSR_OFFSET) = FPU_DEFAULT_MXCSR;
+    return area;
+}
+
+/**
+ * Save the current process's registers if they are live on this CPU
+ * (interrupts disabled)
+ */
+static void fpu_save_current(fpu_cpu_t *fc) {
+    process_t *current = process_get_current();
+
+    if (current && fc->owner == current && current->fpu_state && !fpu_ts_set()) {
+        fpu_save(current->fpu_state);
+    }
+}
+
+/* ============================================================================
+ * Device Not Available
+ * ============================================================================ */
+
+/**
+ * #NM: the running process used the FPU while TS was set
+ */
+static void fpu_nm_handler(interrupt_frame_t *frame) {
+    uint32_t cpu = percpu_cpu_id();
+    fpu_cpu_t *fc = &fpu_cpus[cpu];
+    process_t *proc = process_get_current();
+
+    fpu_clts();
+
+    if (!proc) {
+        kprintf("[FPU] Warning: FPU used with no current process (RIP 0x%llx)\n", frame->rip);
+        fc->owner = NULL;
+        return;
+    }
+
+    /* Still loaded from the last time it ran here */
+    if (fc->owner == proc && proc->fpu_cpu == cpu) {
+        return;
+    }
+
+    if (!proc->fpu_state) {
+        proc->fpu_state = fpu_alloc_area();
+        if (!proc->fpu_state) {
+            fpu_stts();
+            kprintf("[FPU] Error: No memory for the FPU state of '%s' (PID %u)\n",
+                    proc->name, proc->pid);
+            process_exit(-1);
+        }
+    }
+
+    fpu_restore(proc->fpu_state);
+    fc->owner = proc;
+    proc->fpu_cpu = cpu;
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================ */
+
+/**
+ * Program this CPU's control registers for the chosen format
+ */
+static void fpu_setup_cpu(void) {
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_use_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (fpu_use_xsave) {
+        xsetbv(0, fpu_xfeatures);
+    }
+
+    uint64_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    /* Start from a clean state, then trap the first user */
+    __asm__ __volatile__("fninit");
+    fpu_stts();
+
+    fpu_cpus[percpu_cpu_id()].owner = NULL;
+}
+
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    kprintf("[FPU] Initializing FPU state management...\n");
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_FPU) || !(edx & CPUID_EDX_FXSR)) {
+        kprintf("[FPU] ERROR: CPU lacks an FPU with FXSAVE, FPU disabled\n");
+        return;
+    }
+
+    fpu_use_xsave = (ecx & CPUID_ECX_XSAVE) != 0;
+    if (fpu_use_xsave) {
+        cpuid_ext(0xD, 0, &eax, &ebx, &ecx, &edx);
+        uint64_t supported = ((uint64_t)edx << 32) | eax;
+
+        fpu_xfeatures = supported & (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX);
+        if ((supported & XFEATURE_AVX512) == XFEATURE_AVX512 && (fpu_xfeatures & XFEATURE_AVX)) {
+            fpu_xfeatures |= XFEATURE_AVX512;
+        }
+
+        cpuid_ext(0xD, 1, &eax, &ebx, &ecx, &edx);
+        fpu_use_xsaveopt = (eax & CPUID_XSAVE_XSAVEOPT) != 0;
+    } else {
+        fpu_xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+    }
+
+    fpu_setup_cpu();
+
+    /* AVX2 also needs XCR0 to enable the YMM state */
+    uint64_t ymm = XFEATURE_SSE | XFEATURE_AVX;
+    if (max_leaf >= 7 && (fpu_xfeatures & ymm) == ymm) {
+        cpuid_ext(7, 0, &eax, &ebx, &ecx, &edx);
+        fpu_avx2 = (ebx & CPUID_7_EBX_AVX2) != 0;
+    }
+
+    /* EBX reports the size for the features now enabled in XCR0 */
+    if (fpu_use_xsave) {
+        cpuid_ext(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_area_size = ebx;
+    } else {
+        fpu_area_size = FPU_FXSAVE_SIZE;
+    }
+
+    idt_register_handler(EXCEPTION_NM, fpu_nm_handler);
+    fpu_ready = true;
+
+    kprintf("[FPU] %s, features 0x%llx, %u byte state%s\n",
+            fpu_use_xsave ? "XSAVE" : "FXSAVE", fpu_xfeatures, fpu_area_size,
+            fpu_use_xsaveopt ? ", XSAVEOPT" : "");
+}
+
+void fpu_init_cpu(void) {
+    if (fpu_ready) {
+        fpu_setup_cpu();
+    }
+}
+
+bool fpu_enabled(void) {
+    return fpu_ready;
+}
+
+bool fpu_has_avx2(void) {
+    return fpu_ready && fpu_avx2;
+}
+
+uint32_t fpu_state_size(void) {
+    return fpu_area_size;
+}
+
+/* ============================================================================
+ * Process State
+ * ============================================================================ */
+
+void fpu_switch(process_t *prev, process_t *next) {
+    if (!fpu_ready) {
+        return;
+    }
+
+    uint32_t cpu = percpu_cpu_id();
+    fpu_cpu_t *fc = &fpu_cpus[cpu];
+
+    /* Save now so the area is current wherever prev runs next */
+    if (prev && fc->owner == prev && !fpu_ts_set()) {
+        fpu_save(prev->fpu_state);
+    }
+
+    if (next && fc->owner == next && next->fpu_cpu == cpu) {
+        fpu_clts();
+    } else {
+        fpu_stts();
+    }
+}
+
+bool fpu_fork(process_t *child, process_t *parent) {
+    child->fpu_state = NULL;
+
+    if (!fpu_ready || !parent->fpu_state) {
+        return true;
+    }
+
+    uint8_t *area = kmalloc_aligned(fpu_area_size, FPU_STATE_ALIGN);
+    if (!area) {
+        return false;
+    }
+
+    uint64_t flags = interrupts_save();
+    fpu_save_current(&fpu_cpus[percpu_cpu_id()]);
+    interrupts_restore(flags);
+
+    const uint8_t *src = parent->fpu_state;
+    for (uint32_t i = 0; i < fpu_area_size; i++) {
+        area[i] = src[i];
+    }
+
+    child->fpu_state = area;
+    return true;
+}
+
+void fpu_release(process_t *proc) {
+    if (!proc) {
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+
+    /* The PCB slot will be reused; no CPU may still match it as owner */
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        __sync_bool_compare_and_swap(&fpu_cpus[cpu].owner, proc, NULL);
+    }
+    if (fpu_ready && process_get_current() == proc) {
+        fpu_stts();
+    }
+
+    interrupts_restore(flags);
+
+    if (proc->fpu_state) {
+        kfree_aligned(proc->fpu_state);
+        proc->fpu_state = NULL;
+    }
+}
+
+/* ============================================================================
+ * Kernel Use
+ * ============================================================================ */
+
+void kernel_fpu_begin(void) {
+    uint64_t flags = interrupts_save();
+    fpu_cpu_t *fc = &fpu_cpus[percpu_cpu_id()];
+
+    fc->kernel_flags = flags;
+    if (!fpu_ready) {
+        return;
+    }
+
+    fpu_save_current(fc);
+    fc->owner = NULL;
+    fpu_clts();
+
+    /* The registers may carry a process's control words */
+    uint32_t mxcsr = FPU_DEFAULT_MXCSR;
+    __asm__ __volatile__("fninit; ldmxcsr %0" : : "m"(mxcsr));
+}
+
+void kernel_fpu_end(void) {
+    fpu_cpu_t *fc = &fpu_cpus[percpu_cpu_id()];
+    uint64_t flags = fc->kernel_flags;
+
+    if (fpu_ready) {
+        fpu_stts();
+    }
+    interrupts_restore(flags);
+}
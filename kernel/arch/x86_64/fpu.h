@@ -0,0 +1,101 @@
+/**
+ * AAAos Kernel - FPU/SSE/AVX State Management
+ *
+ * Each process gets an XSAVE area (FXSAVE on CPUs without XSAVE) the
+ * first time it touches the FPU. CR0.TS is set whenever the registers do
+ * not hold the running process's state, so its first FPU instruction
+ * raises #NM and the handler restores the state. A process switched out
+ * with live state is saved right away, which keeps the area current if
+ * another CPU picks the process up; when it comes back to a CPU whose
+ * registers still hold its state, the restore is skipped.
+ *
+ * The kernel itself is built without SSE. Kernel code that uses SIMD
+ * registers (through asm or target attributes) must stay between
+ * kernel_fpu_begin and kernel_fpu_end.
+ */
+
+#ifndef _AAAOS_ARCH_FPU_H
+#define _AAAOS_ARCH_FPU_H
+
+#include "../../include/types.h"
+
+struct process;
+
+/* XSAVE requires a 64-byte aligned area */
+#define FPU_STATE_ALIGN         64
+
+/* FXSAVE area size; also the XSAVE legacy region */
+#define FPU_FXSAVE_SIZE         512
+
+/* XCR0 state components */
+#define XFEATURE_X87            BIT(0)
+#define XFEATURE_SSE            BIT(1)
+#define XFEATURE_AVX            BIT(2)
+#define XFEATURE_OPMASK         BIT(5)
+#define XFEATURE_ZMM_HI256      BIT(6)
+#define XFEATURE_HI16_ZMM       BIT(7)
+#define XFEATURE_AVX512         (XFEATURE_OPMASK | XFEATURE_ZMM_HI256 | XFEATURE_HI16_ZMM)
+
+/* Initial control words */
+#define FPU_DEFAULT_FCW         0x037F  /* All x87 exceptions masked */
+#define FPU_DEFAULT_MXCSR       0x1F80  /* All SSE exceptions masked */
+
+/**
+ * Enable the FPU on the BSP and choose the save format
+ * Registers the #NM handler. Call once, before processes run.
+ */
+void fpu_init(void);
+
+/**
+ * Enable the FPU on an application processor
+ */
+void fpu_init_cpu(void);
+
+/**
+ * Check if FPU state management is active
+ */
+bool fpu_enabled(void);
+
+/**
+ * Check if kernel code may use AVX2
+ * True when the CPU has AVX2 and fpu_init enabled the YMM state in XCR0.
+ */
+bool fpu_has_avx2(void);
+
+/**
+ * Size of a process's state area in bytes (0 before fpu_init)
+ */
+uint32_t fpu_state_size(void);
+
+/**
+ * Context switch hook (interrupts disabled)
+ * Saves prev's live registers and sets CR0.TS unless next's state is
+ * still loaded on this CPU.
+ */
+void fpu_switch(struct process *prev, struct process *next);
+
+/**
+ * Give a forked child a copy of the parent's state
+ * @return false if the child's area could not be allocated
+ */
+bool fpu_fork(struct process *child, struct process *parent);
+
+/**
+ * Free a process's state area and forget it on every CPU
+ */
+void fpu_release(struct process *proc);
+
+/**
+ * Let kernel code use the FPU and SIMD registers
+ * Saves the current process's live state and disables interrupts until
+ * kernel_fpu_end. The registers start out with default control words.
+ * Must not nest or sleep.
+ */
+void kernel_fpu_begin(void);
+
+/**
+ * End a kernel_fpu_begin section
+ */
+void kernel_fpu_end(void);
+
+#endif /* _AAAOS_ARCH_FPU_H */
@@ -1,18 +1,23 @@
 /**
  * AAAos Kernel - GDT Implementation
+ *
+ * Every CPU has its own GDT and TSS: a TSS descriptor is marked busy by
+ * ltr, and each CPU needs its own ring 0 stack for interrupts from user
+ * mode.
  */
 
 #include "include/gdt.h"
+#include "include/percpu.h"
 #include "../../include/serial.h"
 
 /* GDT entries */
-static gdt_entry_t gdt[GDT_ENTRIES] ALIGNED(16);
+static gdt_entry_t gdt[PERCPU_MAX_CPUS][GDT_ENTRIES] ALIGNED(16);
 
 /* TSS */
-static tss_t tss ALIGNED(16);
+static tss_t tss[PERCPU_MAX_CPUS] ALIGNED(16);
 
 /* GDT descriptor */
-static gdt_descriptor_t gdt_descriptor;
+static gdt_descriptor_t gdt_descriptor[PERCPU_MAX_CPUS];
 
 /* Access byte flags */
 #define GDT_PRESENT     (1 << 7)    /* Segment present */
@@ -39,22 +44,23 @@ extern void gdt_load(gdt_descriptor_t *descriptor, uint16_t code_seg, uint16_t d
 /**
  * Set a GDT entry
  */
-static void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
-    gdt[index].base_low = base & 0xFFFF;
-    gdt[index].base_mid = (base >> 16) & 0xFF;
-    gdt[index].base_high = (base >> 24) & 0xFF;
+static void gdt_set_entry(gdt_entry_t *table, int index, uint32_t base, uint32_t limit,
+                          uint8_t access, uint8_t flags) {
+    table[index].base_low = base & 0xFFFF;
+    table[index].base_mid = (base >> 16) & 0xFF;
+    table[index].base_high = (base >> 24) & 0xFF;
 
-    gdt[index].limit_low = limit & 0xFFFF;
-    gdt[index].flags_limit = ((limit >> 16) & 0x0F) | (flags & 0xF0);
+    table[index].limit_low = limit & 0xFFFF;
+    table[index].flags_limit = ((limit >> 16) & 0x0F) | (flags & 0xF0);
 
-    gdt[index].access = access;
+    table[index].access = access;
 }
 
 /**
  * Set TSS entry in GDT (16 bytes for 64-bit mode)
  */
-static void gdt_set_tss(int index, uint64_t base, uint32_t limit) {
-    gdt_system_entry_t *entry = (gdt_system_entry_t*)&gdt[index];
+static void gdt_set_tss(gdt_entry_t *table, int index, uint64_t base, uint32_t limit) {
+    gdt_system_entry_t *entry = (gdt_system_entry_t*)&table[index];
 
     entry->limit_low = limit & 0xFFFF;
     entry->base_low = base & 0xFFFF;
@@ -67,52 +73,57 @@ static void gdt_set_tss(int index, uint64_t base, uint32_t limit) {
 }
 
 /**
- * Initialize the GDT
+ * Build and load the GDT and TSS of one CPU
  */
-void gdt_init(void) {
-    kprintf("[GDT] Initializing Global Descriptor Table...\n");
+void gdt_init_cpu(uint32_t cpu_id) {
+    if (cpu_id >= PERCPU_MAX_CPUS) {
+        kprintf("[GDT] Error: CPU %u exceeds PERCPU_MAX_CPUS\n", cpu_id);
+        return;
+    }
+
+    gdt_entry_t *table = gdt[cpu_id];
 
     /* Clear GDT */
     for (int i = 0; i < GDT_ENTRIES; i++) {
-        gdt[i] = (gdt_entry_t){0};
+        table[i] = (gdt_entry_t){0};
     }
 
     /* Null segment (0x00) */
-    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(table, 0, 0, 0, 0, 0);
 
     /* Kernel code segment (0x08) - 64-bit */
-    gdt_set_entry(1, 0, 0xFFFFF,
+    gdt_set_entry(table, 1, 0, 0xFFFFF,
                   GDT_PRESENT | GDT_DPL_RING0 | GDT_CODE_DATA | GDT_EXECUTABLE | GDT_RW,
                   GDT_LONG_MODE | GDT_GRANULARITY);
 
     /* Kernel data segment (0x10) */
-    gdt_set_entry(2, 0, 0xFFFFF,
+    gdt_set_entry(table, 2, 0, 0xFFFFF,
                   GDT_PRESENT | GDT_DPL_RING0 | GDT_CODE_DATA | GDT_RW,
                   GDT_GRANULARITY);
 
     /* User code segment (0x18) - 64-bit */
-    gdt_set_entry(3, 0, 0xFFFFF,
+    gdt_set_entry(table, 3, 0, 0xFFFFF,
                   GDT_PRESENT | GDT_DPL_RING3 | GDT_CODE_DATA | GDT_EXECUTABLE | GDT_RW,
                   GDT_LONG_MODE | GDT_GRANULARITY);
 
     /* User data segment (0x20) */
-    gdt_set_entry(4, 0, 0xFFFFF,
+    gdt_set_entry(table, 4, 0, 0xFFFFF,
                   GDT_PRESENT | GDT_DPL_RING3 | GDT_CODE_DATA | GDT_RW,
                   GDT_GRANULARITY);
 
     /* Initialize TSS */
-    tss = (tss_t){0};
-    tss.iopb_offset = sizeof(tss_t);
+    tss[cpu_id] = (tss_t){0};
+    tss[cpu_id].iopb_offset = sizeof(tss_t);
 
     /* TSS segment (0x28) - takes two GDT slots in 64-bit mode */
-    gdt_set_tss(5, (uint64_t)&tss, sizeof(tss_t) - 1);
+    gdt_set_tss(table, 5, (uint64_t)&tss[cpu_id], sizeof(tss_t) - 1);
 
     /* Set up GDT descriptor */
-    gdt_descriptor.limit = sizeof(gdt) - 1;
-    gdt_descriptor.base = (uint64_t)&gdt;
+    gdt_descriptor[cpu_id].limit = sizeof(gdt[cpu_id]) - 1;
+    gdt_descriptor[cpu_id].base = (uint64_t)table;
 
-    /* Load GDT */
-    gdt_load(&gdt_descriptor, GDT_KERNEL_CODE, GDT_KERNEL_DATA);
+    /* Load GDT (this also reloads GS, clearing the GS base) */
+    gdt_load(&gdt_descriptor[cpu_id], GDT_KERNEL_CODE, GDT_KERNEL_DATA);
 
     /* Load TSS */
     __asm__ __volatile__(
@@ -120,21 +131,31 @@ void gdt_init(void) {
         "ltr %%ax\n"
         : : : "ax"
     );
+}
+
+/**
+ * Initialize the GDT
+ */
+void gdt_init(void) {
+    kprintf("[GDT] Initializing Global Descriptor Table...\n");
+
+    gdt_init_cpu(0);
 
-    kprintf("[GDT] GDT loaded at %p, %d bytes\n", (void*)gdt_descriptor.base, gdt_descriptor.limit + 1);
-    kprintf("[GDT] TSS loaded at %p\n", (void*)&tss);
+    kprintf("[GDT] GDT loaded at %p, %d bytes\n", (void*)gdt_descriptor[0].base, gdt_descriptor[0].limit + 1);
+    kprintf("[GDT] TSS loaded at %p\n", (void*)&tss[0]);
 }
 
 /**
- * Set the kernel stack pointer in TSS
+ * Set the kernel stack pointer in TSS and for SYSCALL
  */
 void gdt_set_kernel_stack(uint64_t rsp0) {
-    tss.rsp0 = rsp0;
+    tss[percpu_cpu_id()].rsp0 = rsp0;
+    percpu_self()->kernel_rsp = rsp0;
 }
 
 /**
  * Get the TSS structure
  */
 tss_t* gdt_get_tss(void) {
-    return &tss;
+    return &tss[percpu_cpu_id()];
 }
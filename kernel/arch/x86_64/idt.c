@@ -4,9 +4,17 @@
 
 #include "include/idt.h"
 #include "include/gdt.h"
+#include "include/percpu.h"
+#include "apic.h"
+#include "irq.h"
 #include "../../include/serial.h"
 #include "../../include/vga.h"
+#include "../../log/log.h"
 #include "io.h"
+#include "../../mm/vmm.h"
+#include "../../proc/process.h"
+#include "../../sched/clock.h"
+#include "../../sched/softirq.h"
 
 /* IDT entries */
 static idt_entry_t idt[IDT_ENTRIES] ALIGNED(16);
@@ -17,6 +25,10 @@ static idt_descriptor_t idt_descriptor;
 /* Registered interrupt handlers */
 static interrupt_handler_t handlers[IDT_ENTRIES];
 
+/* MSI vectors in use, one bit each (idt_alloc_vector) */
+static uint32_t msi_vectors_used = 0;
+static volatile int msi_vector_lock = 0;
+
 /* Exception messages */
 static const char *exception_messages[] = {
     "Division By Zero",
@@ -98,6 +110,50 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+/* MSI vector stubs */
+extern void isr48(void);
+extern void isr49(void);
+extern void isr50(void);
+extern void isr51(void);
+extern void isr52(void);
+extern void isr53(void);
+extern void isr54(void);
+extern void isr55(void);
+extern void isr56(void);
+extern void isr57(void);
+extern void isr58(void);
+extern void isr59(void);
+extern void isr60(void);
+extern void isr61(void);
+extern void isr62(void);
+extern void isr63(void);
+extern void isr64(void);
+extern void isr65(void);
+extern void isr66(void);
+extern void isr67(void);
+extern void isr68(void);
+extern void isr69(void);
+extern void isr70(void);
+extern void isr71(void);
+extern void isr72(void);
+extern void isr73(void);
+extern void isr74(void);
+extern void isr75(void);
+extern void isr76(void);
+extern void isr77(void);
+extern void isr78(void);
+extern void isr79(void);
+
+/* Inter-processor interrupt stubs */
+extern void isr240(void);
+
+static void (*const msi_stubs[IDT_MSI_COUNT])(void) = {
+    isr48, isr49, isr50, isr51, isr52, isr53, isr54, isr55,
+    isr56, isr57, isr58, isr59, isr60, isr61, isr62, isr63,
+    isr64, isr65, isr66, isr67, isr68, isr69, isr70, isr71,
+    isr72, isr73, isr74, isr75, isr76, isr77, isr78, isr79,
+};
+
 /**
  * Set an IDT entry
  */
@@ -213,6 +269,15 @@ void idt_init(void) {
     idt_set_gate(46, (uint64_t)irq14, GDT_KERNEL_CODE, IDT_GATE_INTERRUPT);
     idt_set_gate(47, (uint64_t)irq15, GDT_KERNEL_CODE, IDT_GATE_INTERRUPT);
 
+    /* Message-signalled interrupts (48-79) */
+    for (int i = 0; i < IDT_MSI_COUNT; i++) {
+        idt_set_gate(IDT_MSI_BASE + i, (uint64_t)msi_stubs[i], GDT_KERNEL_CODE,
+                     IDT_GATE_INTERRUPT);
+    }
+
+    /* Inter-processor interrupts */
+    idt_set_gate(IPI_VECTOR_RESCHEDULE, (uint64_t)isr240, GDT_KERNEL_CODE, IDT_GATE_INTERRUPT);
+
     /* Initialize PIC */
     pic_init();
 
@@ -227,6 +292,13 @@ void idt_init(void) {
     kprintf("[IDT] PIC remapped to vectors 32-47\n");
 }
 
+/**
+ * Load the shared IDT on an application processor
+ */
+void idt_init_cpu(void) {
+    __asm__ __volatile__("lidt %0" : : "m"(idt_descriptor));
+}
+
 /**
  * Register an interrupt handler
  */
@@ -234,17 +306,108 @@ void idt_register_handler(uint8_t vector, interrupt_handler_t handler) {
     handlers[vector] = handler;
 }
 
+/**
+ * Take a free MSI vector
+ */
+int idt_alloc_vector(interrupt_handler_t handler) {
+    while (__sync_lock_test_and_set(&msi_vector_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+
+    int vector = -1;
+    if (msi_vectors_used != UINT32_MAX) {
+        int index = __builtin_ctz(~msi_vectors_used);
+        msi_vectors_used |= 1u << index;
+        vector = IDT_MSI_BASE + index;
+        handlers[vector] = handler;
+    }
+
+    __sync_lock_release(&msi_vector_lock);
+    return vector;
+}
+
+/**
+ * Give back an MSI vector
+ */
+void idt_free_vector(int vector) {
+    if (vector < IDT_MSI_BASE || vector >= IDT_MSI_BASE + IDT_MSI_COUNT) {
+        return;
+    }
+
+    while (__sync_lock_test_and_set(&msi_vector_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+
+    handlers[vector] = NULL;
+    msi_vectors_used &= ~(1u << (vector - IDT_MSI_BASE));
+
+    __sync_lock_release(&msi_vector_lock);
+}
+
+/**
+ * Read CR2 (faulting address of the last page fault)
+ */
+static inline uint64_t read_cr2(void) {
+    uint64_t cr2;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(cr2));
+    return cr2;
+}
+
 /**
  * Common interrupt handler (called from assembly)
  */
 void interrupt_handler(interrupt_frame_t *frame) {
     uint64_t int_no = frame->int_no;
 
+    /* Page faults resolved by copy-on-write or a VMA fill just retry */
+    if (int_no == EXCEPTION_PF) {
+        virtaddr_t addr = read_cr2();
+        if (vmm_handle_page_fault(addr, frame->error_code) ||
+            process_handle_page_fault(addr, frame->error_code)) {
+            return;
+        }
+    }
+
+    /*
+     * Acknowledge hardware interrupts before the handler runs: the timer
+     * handler may switch to another process, and this CPU would get no
+     * further interrupts until the old one resumes and returns here.
+     * Only the BSP receives PIC interrupts, and none once the I/O APIC
+     * has taken over; the local APIC ignores an EOI with nothing in service.
+     */
+    if (int_no >= 32 && int_no < 48) {
+        if (percpu_cpu_id() == 0 && !irq_ioapic_enabled()) {
+            pic_eoi((uint8_t)(int_no - 32));
+        }
+        if (apic_get_info()->enabled) {
+            apic_eoi();
+        }
+    }
+
+    /* Local APIC vectors (MSIs, IPIs); spurious interrupts take no EOI */
+    if ((int_no >= IDT_MSI_BASE && int_no < IDT_MSI_BASE + IDT_MSI_COUNT) ||
+        (int_no >= IPI_VECTOR_RESCHEDULE && int_no < APIC_SPURIOUS_VECTOR)) {
+        apic_eoi();
+    }
+
     /* Call registered handler if present */
     if (handlers[int_no] != NULL) {
+        /* The timer handler may switch away, so its time is not counted */
+        bool account = int_no > IRQ_TIMER && int_no < IDT_MSI_BASE + IDT_MSI_COUNT;
+        uint64_t start = account ? clock_cycles() : 0;
+
         handlers[int_no](frame);
+
+        /* Deferred work raised by a device interrupt runs on the way out */
+        if (int_no >= 32) {
+            softirq_irq_exit();
+        }
+        if (account) {
+            irq_account(int_no, clock_cycles() - start);
+        }
     } else if (int_no < 32) {
         /* Unhandled CPU exception - panic */
+        vga_panic_mode();
         vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
         vga_printf("\n\n  KERNEL PANIC: %s (Exception %d)\n", exception_messages[int_no], (int)int_no);
         vga_printf("  Error Code: 0x%016llX\n", frame->error_code);
@@ -256,18 +419,18 @@ void interrupt_handler(interrupt_frame_t *frame) {
         vga_printf("  R9:  0x%016llX  R10: 0x%016llX\n", frame->r9, frame->r10);
         vga_printf("  CS: 0x%04llX  SS: 0x%04llX  RFLAGS: 0x%016llX\n", frame->cs, frame->ss, frame->rflags);
 
-        /* Also log to serial */
+        /* Also log to serial, without relying on interrupts */
+        log_flush();
+        serial_panic_mode();
         kprintf("\n[PANIC] %s (Exception %d)\n", exception_messages[int_no], (int)int_no);
         kprintf("Error Code: 0x%016llx\n", frame->error_code);
         kprintf("RIP: 0x%016llx\n", frame->rip);
+        if (int_no == EXCEPTION_PF) {
+            kprintf("CR2: 0x%016llx\n", read_cr2());
+        }
 
         /* Halt */
         __asm__ __volatile__("cli; hlt");
         for (;;);
     }
-
-    /* Send EOI for hardware interrupts */
-    if (int_no >= 32 && int_no < 48) {
-        pic_eoi((uint8_t)(int_no - 32));
-    }
 }
@@ -86,8 +86,51 @@ IRQ 13, 45          ; FPU
 IRQ 14, 46          ; Primary ATA
 IRQ 15, 47          ; Secondary ATA
 
+; Message-signalled interrupts (IDT_MSI_BASE, 48-79)
+ISR_NOERRCODE 48  ; MSI
+ISR_NOERRCODE 49  ; MSI
+ISR_NOERRCODE 50  ; MSI
+ISR_NOERRCODE 51  ; MSI
+ISR_NOERRCODE 52  ; MSI
+ISR_NOERRCODE 53  ; MSI
+ISR_NOERRCODE 54  ; MSI
+ISR_NOERRCODE 55  ; MSI
+ISR_NOERRCODE 56  ; MSI
+ISR_NOERRCODE 57  ; MSI
+ISR_NOERRCODE 58  ; MSI
+ISR_NOERRCODE 59  ; MSI
+ISR_NOERRCODE 60  ; MSI
+ISR_NOERRCODE 61  ; MSI
+ISR_NOERRCODE 62  ; MSI
+ISR_NOERRCODE 63  ; MSI
+ISR_NOERRCODE 64  ; MSI
+ISR_NOERRCODE 65  ; MSI
+ISR_NOERRCODE 66  ; MSI
+ISR_NOERRCODE 67  ; MSI
+ISR_NOERRCODE 68  ; MSI
+ISR_NOERRCODE 69  ; MSI
+ISR_NOERRCODE 70  ; MSI
+ISR_NOERRCODE 71  ; MSI
+ISR_NOERRCODE 72  ; MSI
+ISR_NOERRCODE 73  ; MSI
+ISR_NOERRCODE 74  ; MSI
+ISR_NOERRCODE 75  ; MSI
+ISR_NOERRCODE 76  ; MSI
+ISR_NOERRCODE 77  ; MSI
+ISR_NOERRCODE 78  ; MSI
+ISR_NOERRCODE 79  ; MSI
+
+; Inter-processor interrupts (local APIC)
+ISR_NOERRCODE 240   ; Reschedule (IPI_VECTOR_RESCHEDULE)
+
 ; Common ISR handler
 isr_common:
+    ; Coming from user mode: switch GS to the per-CPU block
+    test qword [rsp + 24], 3    ; CS of the interrupted code
+    jz .from_kernel
+    swapgs
+.from_kernel:
+
     ; Save all registers
     push rax
     push rcx
@@ -131,5 +174,11 @@ isr_common:
     ; Remove interrupt number and error code
     add rsp, 16
 
+    ; Returning to user mode: give it back its GS base
+    test qword [rsp + 8], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
+
     ; Return from interrupt
     iretq
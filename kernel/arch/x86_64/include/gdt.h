@@ -79,18 +79,28 @@ typedef struct PACKED {
 } tss_t;
 
 /**
- * Initialize the GDT with default segments
+ * Initialize the GDT with default segments (BSP)
  */
 void gdt_init(void);
 
 /**
- * Set the kernel stack pointer in TSS
+ * Build and load the GDT and TSS of a CPU
+ * Must run on that CPU, before its per-CPU data is set up (loading the
+ * GDT reloads GS).
+ * @param cpu_id Logical CPU index
+ */
+void gdt_init_cpu(uint32_t cpu_id);
+
+/**
+ * Set the stack the calling CPU enters ring 0 on
+ * Used by interrupts from user mode (TSS.rsp0) and by SYSCALL (the
+ * per-CPU kernel_rsp).
  * @param rsp0 Stack pointer for ring 0
  */
 void gdt_set_kernel_stack(uint64_t rsp0);
 
 /**
- * Get the TSS structure
+ * Get the calling CPU's TSS structure
  * @return Pointer to TSS
  */
 tss_t* gdt_get_tss(void);
@@ -50,6 +50,10 @@
 #define IRQ_ATA1        (IRQ_BASE + 14)
 #define IRQ_ATA2        (IRQ_BASE + 15)
 
+/* Vectors for message-signalled interrupts (MSI/MSI-X), via the local APIC */
+#define IDT_MSI_BASE    48
+#define IDT_MSI_COUNT   32      /* One bit each in a 32-bit mask */
+
 /* IDT gate types */
 #define IDT_GATE_INTERRUPT  0x8E    /* P=1, DPL=0, Interrupt gate */
 #define IDT_GATE_TRAP       0x8F    /* P=1, DPL=0, Trap gate */
@@ -106,6 +110,12 @@ typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
  */
 void idt_init(void);
 
+/**
+ * Load the IDT on an application processor
+ * All CPUs share one table and one set of handlers.
+ */
+void idt_init_cpu(void);
+
 /**
  * Register an interrupt handler
  * @param vector Interrupt vector number (0-255)
@@ -113,6 +123,21 @@ void idt_init(void);
  */
 void idt_register_handler(uint8_t vector, interrupt_handler_t handler);
 
+/**
+ * Take a free MSI vector and register its handler
+ * The dispatcher sends the local APIC EOI for these vectors.
+ * @param handler Function to call when the interrupt occurs
+ * @return The vector, or -1 if all IDT_MSI_COUNT are taken
+ */
+int idt_alloc_vector(interrupt_handler_t handler);
+
+/**
+ * Give back a vector from idt_alloc_vector
+ * The device must no longer raise it.
+ * @param vector Vector to release
+ */
+void idt_free_vector(int vector);
+
 /**
  * Enable/disable interrupts
  */
@@ -133,4 +158,28 @@ static inline bool interrupts_enabled(void) {
     return (flags & (1 << 9)) != 0;
 }
 
+/**
+ * Disable interrupts and return the previous RFLAGS for interrupts_restore()
+ */
+static inline uint64_t interrupts_save(void) {
+    uint64_t flags;
+#ifdef AAAOS_HOSTED
+    /* Host builds (tests/bench) run in user mode, where cli faults */
+    __asm__ __volatile__("pushfq; pop %0" : "=r"(flags) : : "memory");
+    flags &= ~(uint64_t)(1 << 9);
+#else
+    __asm__ __volatile__("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+#endif
+    return flags;
+}
+
+/**
+ * Re-enable interrupts if they were enabled when interrupts_save() ran
+ */
+static inline void interrupts_restore(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
 #endif /* _AAAOS_ARCH_IDT_H */
@@ -0,0 +1,98 @@
+/**
+ * AAAos Kernel - Per-CPU Data
+ *
+ * Each processor owns a percpu_t block reachable through the GS segment
+ * base (IA32_GS_BASE), so the current CPU's data can be found with a
+ * single GS-relative load and no locking.
+ *
+ * GS base holds the block only while the CPU runs kernel code. Entries
+ * from user mode (SYSCALL and interrupts with a ring 3 CS) execute
+ * swapgs to exchange it with IA32_KERNEL_GS_BASE, and every return to
+ * user mode swaps back.
+ */
+
+#ifndef _AAAOS_ARCH_PERCPU_H
+#define _AAAOS_ARCH_PERCPU_H
+
+#include "../../../include/types.h"
+
+/* Maximum number of processors supported */
+#define PERCPU_MAX_CPUS     16
+
+/* GS base MSRs */
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102  /* Swapped in by swapgs */
+
+/* Field offsets used from assembly (syscall_asm.asm) */
+#define PERCPU_KERNEL_RSP   16
+#define PERCPU_USER_RSP     24
+
+/**
+ * Per-CPU data block
+ * 'self' must remain the first field, 'cpu_id' the second; kernel_rsp
+ * and user_rsp sit at PERCPU_KERNEL_RSP and PERCPU_USER_RSP. Blocks are
+ * cache-line aligned so CPUs never share a line.
+ */
+typedef struct percpu {
+    struct percpu *self;        /* Linear address of this block */
+    uint32_t cpu_id;            /* Logical CPU index (0 = BSP) */
+    uint32_t apic_id;           /* Local APIC ID */
+    uint64_t kernel_rsp;        /* Stack SYSCALL switches to */
+    uint64_t user_rsp;          /* User RSP while a SYSCALL sets up its frame */
+    bool     online;            /* CPU has finished per-CPU setup */
+    uint32_t rcu_nesting;       /* rcu_read_lock depth (sched/rcu.h) */
+} ALIGNED(64) percpu_t;
+
+/* Set once the BSP has loaded its GS base */
+extern volatile bool percpu_ready;
+
+/**
+ * Set up the per-CPU block for the calling processor and load GS base
+ * @param cpu_id Logical CPU index
+ * @param apic_id Local APIC ID of this processor
+ */
+void percpu_init_cpu(uint32_t cpu_id, uint32_t apic_id);
+
+/**
+ * Get the per-CPU block of a given CPU
+ * @param cpu_id Logical CPU index
+ * @return Pointer to block, or NULL if out of range
+ */
+percpu_t *percpu_get(uint32_t cpu_id);
+
+/**
+ * Get number of CPUs that have completed per-CPU setup
+ * @return Online CPU count (at least 1)
+ */
+uint32_t percpu_online_count(void);
+
+/**
+ * Get the logical index of the calling CPU
+ * Returns 0 until per-CPU data has been set up on the BSP.
+ */
+static inline uint32_t percpu_cpu_id(void) {
+    uint32_t id;
+
+    if (!percpu_ready) {
+        return 0;
+    }
+
+    __asm__ __volatile__("movl %%gs:8, %0" : "=r"(id));
+    return id;
+}
+
+/**
+ * Get the per-CPU block of the calling CPU
+ */
+static inline percpu_t *percpu_self(void) {
+    percpu_t *self;
+
+    if (!percpu_ready) {
+        return percpu_get(0);
+    }
+
+    __asm__ __volatile__("movq %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+#endif /* _AAAOS_ARCH_PERCPU_H */
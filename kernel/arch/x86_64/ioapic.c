@@ -0,0 +1,190 @@
+/**
+ * AAAos Kernel - I/O APIC Driver Implementation
+ *
+ * Each I/O APIC is reached through an index/data register pair, so every
+ * access takes the lock. The ISA IRQ table is filled once by ioapic_init
+ * and read-only after; a redirection entry is rewritten masked and then
+ * given its final mask bit, so a change never fires a half-written entry.
+ */
+
+#include "ioapic.h"
+#include "acpi.h"
+#include "apic.h"
+#include "../../include/serial.h"
+#include "../../sched/spinlock.h"
+
+/* I/O APICs handled (as many as the MADT parser keeps) */
+#define IOAPIC_MAX              16
+
+/**
+ * One I/O APIC
+ */
+typedef struct ioapic {
+    volatile uint32_t *base;            /* MMIO, identity mapped */
+    uint32_t gsi_base;                  /* GSI of pin 0 */
+    uint32_t pins;                      /* Redirection entries */
+} ioapic_t;
+
+/**
+ * Where an ISA IRQ is wired
+ */
+typedef struct ioapic_isa {
+    ioapic_t *chip;                     /* NULL: no pin */
+    uint32_t pin;
+    uint32_t low;                       /* Vector, polarity and trigger mode */
+    uint8_t dest;                       /* Target APIC ID */
+    bool masked;
+} ioapic_isa_t;
+
+LOCK_CLASS(ioapic, "arch.ioapic");
+static spinlock_t ioapic_lock = SPINLOCK_INIT(LOCK_CLASS_OF(ioapic));
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static uint32_t ioapic_count = 0;
+static ioapic_isa_t ioapic_isa[IOAPIC_ISA_IRQS];
+static bool ioapic_on = false;
+
+static uint32_t ioapic_read(ioapic_t *chip, uint32_t reg) {
+    chip->base[IOAPIC_REGSEL / 4] = reg;
+    return chip->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t *chip, uint32_t reg, uint32_t value) {
+    chip->base[IOAPIC_REGSEL / 4] = reg;
+    chip->base[IOAPIC_WINDOW / 4] = value;
+}
+
+/**
+ * Program an ISA IRQ's redirection entry from its table entry (lock held)
+ */
+static void ioapic_program(const ioapic_isa_t *isa) {
+    uint32_t reg = IOAPIC_REG_REDTBL + isa->pin * 2;
+
+    ioapic_write(isa->chip, reg, isa->low | IOAPIC_REDIR_MASKED);
+    ioapic_write(isa->chip, reg + 1, (uint32_t)isa->dest << IOAPIC_REDIR_DEST_SHIFT);
+    if (!isa->masked) {
+        ioapic_write(isa->chip, reg, isa->low);
+    }
+}
+
+static ioapic_t *ioapic_for_gsi(uint32_t gsi, uint32_t *pin) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t *chip = &ioapics[i];
+        if (gsi >= chip->gsi_base && gsi < chip->gsi_base + chip->pins) {
+            *pin = gsi - chip->gsi_base;
+            return chip;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * GSI and MPS flags of an ISA IRQ
+ * @return false if another IRQ has been moved onto its default GSI
+ */
+static bool ioapic_isa_source(const acpi_madt_info_t *madt, uint8_t irq,
+                              uint32_t *gsi, uint16_t *flags) {
+    *gsi = irq;
+    *flags = 0;
+
+    bool taken = false;
+    for (uint32_t i = 0; i < madt->override_count; i++) {
+        if (madt->overrides[i].irq_source == irq) {
+            *gsi = madt->overrides[i].gsi;
+            *flags = madt->overrides[i].flags;
+            return true;
+        }
+        if (madt->overrides[i].gsi == irq) {
+            taken = true;
+        }
+    }
+    return !taken;
+}
+
+bool ioapic_init(void) {
+    const acpi_madt_info_t *madt = acpi_get_madt();
+    if (madt == NULL || madt->io_apic_count == 0) {
+        kprintf("[IOAPIC] No I/O APIC in the MADT\n");
+        return false;
+    }
+
+    uint64_t irq_flags = spinlock_acquire_irqsave(&ioapic_lock);
+
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < madt->io_apic_count && ioapic_count < IOAPIC_MAX; i++) {
+        ioapic_t *chip = &ioapics[ioapic_count++];
+        chip->base = (volatile uint32_t *)(uintptr_t)madt->io_apics[i].address;
+        chip->gsi_base = madt->io_apics[i].gsi_base;
+        chip->pins = ((ioapic_read(chip, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        for (uint32_t pin = 0; pin < chip->pins; pin++) {
+            ioapic_write(chip, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_REDIR_MASKED);
+        }
+        kprintf("[IOAPIC] I/O APIC %u at 0x%08x: GSIs %u-%u\n", madt->io_apics[i].id,
+                madt->io_apics[i].address, chip->gsi_base, chip->gsi_base + chip->pins - 1);
+    }
+
+    uint8_t dest = apic_get_id();
+    uint32_t routed = 0;
+    for (uint8_t irq = 0; irq < IOAPIC_ISA_IRQS; irq++) {
+        ioapic_isa_t *isa = &ioapic_isa[irq];
+        uint32_t gsi;
+        uint16_t mps;
+
+        isa->chip = NULL;
+        if (!ioapic_isa_source(madt, irq, &gsi, &mps)) {
+            continue;
+        }
+        isa->chip = ioapic_for_gsi(gsi, &isa->pin);
+        if (isa->chip == NULL) {
+            continue;
+        }
+
+        /* ISA defaults: edge-triggered, active high */
+        isa->low = IRQ_BASE + irq;
+        if ((mps & IOAPIC_MPS_POLARITY_MASK) == IOAPIC_MPS_POLARITY_LOW) {
+            isa->low |= IOAPIC_REDIR_ACTIVE_LOW;
+        }
+        if ((mps & IOAPIC_MPS_TRIGGER_MASK) == IOAPIC_MPS_TRIGGER_LEVEL) {
+            isa->low |= IOAPIC_REDIR_LEVEL;
+        }
+        isa->dest = dest;
+        isa->masked = true;
+        ioapic_program(isa);
+        routed++;
+    }
+
+    __atomic_store_n(&ioapic_on, true, __ATOMIC_RELEASE);
+    spinlock_release_irqrestore(&ioapic_lock, irq_flags);
+
+    kprintf("[IOAPIC] %u ISA IRQs routed to APIC %u\n", routed, dest);
+    return true;
+}
+
+bool ioapic_enabled(void) {
+    return __atomic_load_n(&ioapic_on, __ATOMIC_ACQUIRE);
+}
+
+bool ioapic_set_masked(uint8_t irq, bool masked) {
+    if (!ioapic_enabled() || irq >= IOAPIC_ISA_IRQS || ioapic_isa[irq].chip == NULL) {
+        return false;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&ioapic_lock);
+    ioapic_isa[irq].masked = masked;
+    ioapic_program(&ioapic_isa[irq]);
+    spinlock_release_irqrestore(&ioapic_lock, flags);
+    return true;
+}
+
+bool ioapic_set_target(uint8_t irq, uint8_t apic_id) {
+    if (!ioapic_enabled() || irq >= IOAPIC_ISA_IRQS || ioapic_isa[irq].chip == NULL) {
+        return false;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&ioapic_lock);
+    ioapic_isa[irq].dest = apic_id;
+    ioapic_program(&ioapic_isa[irq]);
+    spinlock_release_irqrestore(&ioapic_lock, flags);
+    return true;
+}
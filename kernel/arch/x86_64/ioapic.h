@@ -0,0 +1,70 @@
+/**
+ * AAAos Kernel - I/O APIC Driver
+ *
+ * Routes the legacy ISA IRQs through the I/O APICs listed in the MADT
+ * (acpi.h) instead of the 8259 PIC, so they can be delivered to any
+ * CPU's local APIC. The MADT's interrupt source overrides give the GSI
+ * and the polarity and trigger mode of each ISA IRQ that is not wired
+ * the default way (same-numbered GSI, edge-triggered, active high).
+ *
+ * ISA IRQ n keeps vector IRQ_BASE + n, as under the PIC. Devices on
+ * other GSIs (PCI INTx lines) are left masked: finding their GSI takes
+ * the _PRT routing methods, and such devices use MSI instead.
+ */
+
+#ifndef _AAAOS_ARCH_IOAPIC_H
+#define _AAAOS_ARCH_IOAPIC_H
+
+#include "../../include/types.h"
+
+/* Register select and data window (MMIO, relative to the I/O APIC base) */
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WINDOW           0x10
+
+/* Registers */
+#define IOAPIC_REG_ID           0x00
+#define IOAPIC_REG_VERSION      0x01        /* Bits 16-23: highest redirection entry */
+#define IOAPIC_REG_REDTBL       0x10        /* Two registers per pin */
+
+/* Redirection entry, low half */
+#define IOAPIC_REDIR_ACTIVE_LOW BIT(13)
+#define IOAPIC_REDIR_LEVEL      BIT(15)
+#define IOAPIC_REDIR_MASKED     BIT(16)
+
+/* Redirection entry, high half: destination APIC ID */
+#define IOAPIC_REDIR_DEST_SHIFT 24
+
+/* MADT override flags (MPS INTI flags) */
+#define IOAPIC_MPS_POLARITY_MASK    0x03
+#define IOAPIC_MPS_POLARITY_LOW     0x03
+#define IOAPIC_MPS_TRIGGER_MASK     0x0C
+#define IOAPIC_MPS_TRIGGER_LEVEL    0x0C
+
+/* Legacy IRQs routed */
+#define IOAPIC_ISA_IRQS         16
+
+/**
+ * Find the I/O APICs, mask every pin and set up the ISA IRQs
+ * The ISA IRQs start out masked and aimed at the calling CPU.
+ * @return false if the MADT lists no usable I/O APIC
+ */
+bool ioapic_init(void);
+
+/**
+ * Check whether ISA IRQs go through the I/O APICs
+ */
+bool ioapic_enabled(void);
+
+/**
+ * Mask or unmask an ISA IRQ
+ * @return false without the I/O APIC or for an IRQ it has no pin for
+ */
+bool ioapic_set_masked(uint8_t irq, bool masked);
+
+/**
+ * Deliver an ISA IRQ to another local APIC
+ * @return false without the I/O APIC or for an IRQ it has no pin for
+ */
+bool ioapic_set_target(uint8_t irq, uint8_t apic_id);
+
+#endif /* _AAAOS_ARCH_IOAPIC_H */
@@ -0,0 +1,344 @@
+/**
+ * AAAos Kernel - Device Interrupt Routing and Balancing
+ *
+ * The counters are per CPU and only written by their own CPU from
+ * interrupt context. Targets, pins and the balancer's last readings sit
+ * in one table under irq_lock; sources are moved with the lock dropped,
+ * since moving an MSI writes PCI configuration space. The balancer is a
+ * work item, queued by a soft timer.
+ */
+
+#include "irq.h"
+#include "io.h"
+#include "ioapic.h"
+#include "apic.h"
+#include "../../include/serial.h"
+#include "../../init/initcall.h"
+#include "../../sched/clock.h"
+#include "../../sched/scheduler.h"
+#include "../../sched/spinlock.h"
+#include "../../sched/timer.h"
+#include "../../sched/workqueue.h"
+#include "../../stats/kstat.h"
+
+/* 8259 mask registers */
+#define PIC_MASTER_DATA         0x21
+#define PIC_SLAVE_DATA          0xA1
+#define PIC_CASCADE_IRQ         2
+
+/* ISA IRQ of the PIT, replaced by the local APIC timer */
+#define PIT_IRQ                 0
+
+/**
+ * A device vector's target
+ */
+typedef struct irq_vector {
+    irq_retarget_fn_t retarget;         /* NULL: cannot be moved */
+    void *arg;
+    uint32_t cpu;
+    bool balance;
+    bool pinned;
+    uint64_t seen_cycles;               /* Total at the last balancer pass */
+} irq_vector_t;
+
+/**
+ * Per-CPU counters
+ */
+typedef struct irq_cpu {
+    uint64_t count[IRQ_VECTOR_COUNT];
+    uint64_t cycles[IRQ_VECTOR_COUNT];
+} ALIGNED(64) irq_cpu_t;
+
+LOCK_CLASS(irq, "arch.irq");
+static spinlock_t irq_lock = SPINLOCK_INIT(LOCK_CLASS_OF(irq));
+
+static irq_vector_t irq_vectors[IRQ_VECTOR_COUNT];
+static irq_cpu_t irq_cpus[PERCPU_MAX_CPUS];
+
+static ktimer_t irq_balance_timer;
+static work_t irq_balance_work;
+
+KSTAT_COUNTER(irq_moves, "arch.irq.balance_moves", "Device vectors moved by the IRQ balancer");
+
+static inline bool irq_is_device(int vector) {
+    return vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_VECTOR_COUNT;
+}
+
+static inline bool irq_cpu_online(uint32_t cpu) {
+    percpu_t *pc = percpu_get(cpu);
+    return pc != NULL && pc->online;
+}
+
+static uint64_t irq_total_cycles(uint32_t index) {
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        total += __atomic_load_n(&irq_cpus[cpu].cycles[index], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/* ============================================================================
+ * Legacy IRQ lines
+ * ============================================================================ */
+
+/**
+ * Set or clear an ISA IRQ's PIC mask bit (irq_lock held)
+ */
+static void irq_pic_set_masked(uint8_t irq, bool masked) {
+    uint16_t port = irq < 8 ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+    uint8_t bit = (uint8_t)(1u << (irq & 7));
+    uint8_t mask = inb(port);
+
+    outb(port, masked ? (mask | bit) : (mask & ~bit));
+    if (!masked && irq >= 8) {
+        outb(PIC_MASTER_DATA, inb(PIC_MASTER_DATA) & ~(1u << PIC_CASCADE_IRQ));
+    }
+}
+
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_ISA_COUNT) {
+        return;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    if (!ioapic_set_masked(irq, false) && !ioapic_enabled()) {
+        irq_pic_set_masked(irq, false);
+    }
+    spinlock_release_irqrestore(&irq_lock, flags);
+}
+
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_ISA_COUNT) {
+        return;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    if (!ioapic_set_masked(irq, true) && !ioapic_enabled()) {
+        irq_pic_set_masked(irq, true);
+    }
+    spinlock_release_irqrestore(&irq_lock, flags);
+}
+
+static bool irq_isa_retarget(void *arg, uint32_t cpu) {
+    return ioapic_set_target((uint8_t)(uintptr_t)arg, (uint8_t)percpu_get(cpu)->apic_id);
+}
+
+bool irq_route_ioapic(void) {
+    uint16_t open = (uint16_t)~(inb(PIC_MASTER_DATA) | ((uint16_t)inb(PIC_SLAVE_DATA) << 8));
+    open &= (uint16_t)~((1u << PIC_CASCADE_IRQ) | (1u << PIT_IRQ));
+
+    if (!ioapic_init()) {
+        return false;
+    }
+
+    for (uint8_t irq = 0; irq < IRQ_ISA_COUNT; irq++) {
+        irq_set_target(IRQ_BASE + irq, percpu_cpu_id(), irq_isa_retarget,
+                       (void *)(uintptr_t)irq, false);
+        if (open & (1u << irq)) {
+            ioapic_set_masked(irq, false);
+        }
+    }
+    return true;
+}
+
+bool irq_ioapic_enabled(void) {
+    return ioapic_enabled();
+}
+
+/* ============================================================================
+ * Targets and accounting
+ * ============================================================================ */
+
+void irq_set_target(int vector, uint32_t cpu, irq_retarget_fn_t fn, void *arg, bool balance) {
+    if (!irq_is_device(vector)) {
+        return;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    irq_vector_t *v = &irq_vectors[vector - IRQ_BASE];
+    v->retarget = fn;
+    v->arg = arg;
+    v->cpu = cpu;
+    v->balance = balance;
+    v->pinned = false;
+    v->seen_cycles = irq_total_cycles((uint32_t)(vector - IRQ_BASE));
+    spinlock_release_irqrestore(&irq_lock, flags);
+}
+
+void irq_clear_target(int vector) {
+    if (!irq_is_device(vector)) {
+        return;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    irq_vectors[vector - IRQ_BASE] = (irq_vector_t){0};
+    spinlock_release_irqrestore(&irq_lock, flags);
+}
+
+bool irq_set_affinity(int vector, uint32_t cpu) {
+    if (!irq_is_device(vector) || (cpu != IRQ_AFFINITY_ANY && !irq_cpu_online(cpu))) {
+        return false;
+    }
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    irq_vector_t *v = &irq_vectors[vector - IRQ_BASE];
+    irq_retarget_fn_t fn = v->retarget;
+    void *arg = v->arg;
+    if (fn != NULL) {
+        v->pinned = cpu != IRQ_AFFINITY_ANY;
+    }
+    spinlock_release_irqrestore(&irq_lock, flags);
+
+    if (fn == NULL) {
+        return false;
+    }
+    if (cpu == IRQ_AFFINITY_ANY) {
+        return true;
+    }
+    if (!fn(arg, cpu)) {
+        return false;
+    }
+
+    flags = spinlock_acquire_irqsave(&irq_lock);
+    v->cpu = cpu;
+    spinlock_release_irqrestore(&irq_lock, flags);
+    kprintf("[IRQ] Vector %d pinned to CPU %u\n", vector, cpu);
+    return true;
+}
+
+void irq_account(uint64_t vector, uint64_t cycles) {
+    if (!irq_is_device((int)vector)) {
+        return;
+    }
+
+    irq_cpu_t *c = &irq_cpus[percpu_cpu_id()];
+    uint32_t index = (uint32_t)vector - IRQ_BASE;
+    __atomic_store_n(&c->count[index], c->count[index] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->cycles[index], c->cycles[index] + cycles, __ATOMIC_RELAXED);
+}
+
+bool irq_get_stats(int vector, irq_stats_t *stats) {
+    if (!irq_is_device(vector) || stats == NULL) {
+        return false;
+    }
+    uint32_t index = (uint32_t)(vector - IRQ_BASE);
+
+    *stats = (irq_stats_t){0};
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        stats->cpu_count[cpu] = __atomic_load_n(&irq_cpus[cpu].count[index], __ATOMIC_RELAXED);
+        stats->count += stats->cpu_count[cpu];
+    }
+    stats->cycles = irq_total_cycles(index);
+
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    const irq_vector_t *v = &irq_vectors[index];
+    stats->cpu = v->cpu;
+    stats->movable = v->retarget != NULL;
+    stats->balanced = v->balance && !v->pinned;
+    stats->pinned = v->pinned;
+    spinlock_release_irqrestore(&irq_lock, flags);
+    return true;
+}
+
+/* ============================================================================
+ * Balancer
+ * ============================================================================ */
+
+/**
+ * Spread the balanced vectors over the online CPUs by last interval's load
+ */
+static void irq_balance(void *arg) {
+    UNUSED(arg);
+
+    uint64_t cpu_load[PERCPU_MAX_CPUS] = {0};
+    uint64_t load[IRQ_VECTOR_COUNT];
+    uint32_t order[IRQ_VECTOR_COUNT];
+    irq_vector_t snap[IRQ_VECTOR_COUNT];
+    uint32_t count = 0;
+    uint64_t movable = 0;
+
+    /*
+     * Fixed vectors count toward their CPU; the rest are sorted heaviest
+     * first. The sources are moved from a copy, taken under the lock.
+     */
+    uint64_t flags = spinlock_acquire_irqsave(&irq_lock);
+    for (uint32_t i = 0; i < IRQ_VECTOR_COUNT; i++) {
+        irq_vector_t *v = &irq_vectors[i];
+        uint64_t total = irq_total_cycles(i);
+        load[i] = total - v->seen_cycles;
+        v->seen_cycles = total;
+        snap[i] = *v;
+
+        if (v->retarget == NULL || v->cpu >= PERCPU_MAX_CPUS) {
+            continue;
+        }
+        if (!v->balance || v->pinned) {
+            cpu_load[v->cpu] += load[i];
+            continue;
+        }
+
+        uint32_t pos = count++;
+        while (pos > 0 && load[order[pos - 1]] < load[i]) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = i;
+        movable += load[i];
+    }
+    spinlock_release_irqrestore(&irq_lock, flags);
+
+    uint64_t floor = clock_tsc_khz() * IRQ_BALANCE_INTERVAL_MS * IRQ_BALANCE_MIN_PCT / 100;
+    if (count < 2 || movable < floor) {
+        return;
+    }
+
+    for (uint32_t n = 0; n < count; n++) {
+        uint32_t i = order[n];
+        irq_vector_t *v = &snap[i];
+
+        uint32_t best = v->cpu;
+        for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+            if (irq_cpu_online(cpu) && cpu_load[cpu] < cpu_load[best]) {
+                best = cpu;
+            }
+        }
+
+        /* Stay unless the move is worth the cache misses it causes */
+        if (best != v->cpu && cpu_load[best] + movable / IRQ_BALANCE_MARGIN < cpu_load[v->cpu] &&
+            v->retarget(v->arg, best)) {
+            kprintf("[IRQ] Vector %u: CPU %u -> CPU %u\n", i + IRQ_BASE, v->cpu, best);
+            v->cpu = best;
+            flags = spinlock_acquire_irqsave(&irq_lock);
+            if (irq_vectors[i].retarget == v->retarget && irq_vectors[i].arg == v->arg) {
+                irq_vectors[i].cpu = best;
+            }
+            spinlock_release_irqrestore(&irq_lock, flags);
+            kstat_inc(irq_moves);
+        }
+        cpu_load[v->cpu] += load[i];
+    }
+}
+
+static void irq_balance_tick(void *arg) {
+    UNUSED(arg);
+    queue_work(&irq_balance_work);
+}
+
+static bool irq_balance_initcall(void) {
+    work_init(&irq_balance_work, irq_balance, NULL);
+    ktimer_init_soft(&irq_balance_timer, irq_balance_tick, NULL);
+
+    /* Timers only fire once the scheduler is up */
+    if (!scheduler_is_running()) {
+        return true;
+    }
+
+    uint64_t interval = (uint64_t)IRQ_BALANCE_INTERVAL_MS * 1000000;
+    if (!ktimer_start(&irq_balance_timer, interval, interval)) {
+        kprintf("[IRQ] Error: Could not start the IRQ balancer\n");
+        return false;
+    }
+    return true;
+}
+
+INITCALL(irq_balance, irq_balance_initcall, 0, "workqueue");
@@ -0,0 +1,119 @@
+/**
+ * AAAos Kernel - Device Interrupt Routing and Balancing
+ *
+ * Legacy (ISA) IRQ n arrives on vector IRQ_BASE + n: through the 8259
+ * PIC until the local APIC comes up, and through the I/O APICs
+ * (ioapic.h) after that. irq_unmask and irq_mask work on whichever is
+ * in use. MSIs come straight from their device on vectors handed out
+ * by pci_irq_alloc.
+ *
+ * Interrupts and handler time, softirqs included, are counted per device
+ * vector and CPU. A vector that can be moved has a target CPU, and
+ * irq_set_affinity pins it to one. The network and storage MSIs are
+ * balanced: every IRQ_BALANCE_INTERVAL_MS the balancer takes the
+ * handler time each one used since the last pass and spreads them over
+ * the online CPUs, heaviest first, each to the least loaded CPU. A vector
+ * stays where it is unless moving it gains at least 1/IRQ_BALANCE_MARGIN
+ * of the total, so steady loads do not bounce between CPUs.
+ */
+
+#ifndef _AAAOS_ARCH_IRQ_H
+#define _AAAOS_ARCH_IRQ_H
+
+#include "../../include/types.h"
+#include "include/idt.h"
+#include "include/percpu.h"
+
+/* Legacy IRQ lines */
+#define IRQ_ISA_COUNT           16
+
+/* Device vectors: the legacy IRQs, then the MSIs */
+#define IRQ_VECTOR_COUNT        (IDT_MSI_BASE + IDT_MSI_COUNT - IRQ_BASE)
+
+/* Balancer */
+#define IRQ_BALANCE_INTERVAL_MS 1000
+#define IRQ_BALANCE_MARGIN      8
+#define IRQ_BALANCE_MIN_PCT     1           /* Skip passes below this share of one CPU */
+
+/* irq_set_affinity: unpin and hand the vector back to the balancer */
+#define IRQ_AFFINITY_ANY        0xFFFFFFFFu
+
+/**
+ * Move a vector's interrupts to another CPU
+ * @param arg Argument given to irq_set_target
+ * @param cpu Logical CPU index
+ * @return false if the source could not be moved
+ */
+typedef bool (*irq_retarget_fn_t)(void *arg, uint32_t cpu);
+
+/**
+ * Per-vector interrupt statistics
+ */
+typedef struct irq_stats {
+    uint64_t count;                     /* Interrupts, all CPUs */
+    uint64_t cycles;                    /* Cycles in the handler and softirqs */
+    uint64_t cpu_count[PERCPU_MAX_CPUS];
+    uint32_t cpu;                       /* Target CPU */
+    bool movable;                       /* Has a target that can change */
+    bool balanced;
+    bool pinned;
+} irq_stats_t;
+
+/**
+ * Let an ISA IRQ through (the PIC cascade line comes along for 8-15)
+ */
+void irq_unmask(uint8_t irq);
+
+/**
+ * Stop an ISA IRQ
+ */
+void irq_mask(uint8_t irq);
+
+/**
+ * Move the ISA IRQs from the PIC to the I/O APICs
+ * Lines open on the PIC stay open, except the PIT's: the local APIC
+ * timer replaces it. Called by apic_init before the PIC is masked.
+ * @return false if there is no I/O APIC (the PIC stays in charge)
+ */
+bool irq_route_ioapic(void);
+
+/**
+ * Check whether ISA IRQs are delivered by the I/O APICs
+ */
+bool irq_ioapic_enabled(void);
+
+/**
+ * Declare how a device vector is moved between CPUs
+ * @param vector Device vector
+ * @param cpu CPU its interrupts go to now
+ * @param fn How to move it
+ * @param arg Passed to fn
+ * @param balance Let the balancer move it
+ */
+void irq_set_target(int vector, uint32_t cpu, irq_retarget_fn_t fn, void *arg, bool balance);
+
+/**
+ * Forget a vector's target (its source is going away)
+ */
+void irq_clear_target(int vector);
+
+/**
+ * Send a vector's interrupts to one CPU and keep them there
+ * @param vector Device vector
+ * @param cpu Online CPU, or IRQ_AFFINITY_ANY to unpin
+ * @return false if the vector cannot be moved or the CPU is not online
+ */
+bool irq_set_affinity(int vector, uint32_t cpu);
+
+/**
+ * Count an interrupt and the cycles spent on it (interrupt_handler)
+ */
+void irq_account(uint64_t vector, uint64_t cycles);
+
+/**
+ * Get a device vector's statistics
+ * @return false if vector is not a device vector
+ */
+bool irq_get_stats(int vector, irq_stats_t *stats);
+
+#endif /* _AAAOS_ARCH_IRQ_H */
@@ -0,0 +1,65 @@
+/**
+ * AAAos Kernel - Per-CPU Data Implementation
+ */
+
+#include "include/percpu.h"
+#include "apic.h"
+#include "../../include/serial.h"
+
+_Static_assert(__builtin_offsetof(percpu_t, kernel_rsp) == PERCPU_KERNEL_RSP,
+               "PERCPU_KERNEL_RSP does not match percpu_t");
+_Static_assert(__builtin_offsetof(percpu_t, user_rsp) == PERCPU_USER_RSP,
+               "PERCPU_USER_RSP does not match percpu_t");
+
+/* Per-CPU blocks */
+static percpu_t percpu_blocks[PERCPU_MAX_CPUS];
+
+volatile bool percpu_ready = false;
+
+/**
+ * Set up the per-CPU block for the calling processor
+ */
+void percpu_init_cpu(uint32_t cpu_id, uint32_t apic_id) {
+    if (cpu_id >= PERCPU_MAX_CPUS) {
+        kprintf("[PERCPU] Error: CPU %u exceeds PERCPU_MAX_CPUS\n", cpu_id);
+        return;
+    }
+
+    percpu_t *cpu = &percpu_blocks[cpu_id];
+    cpu->self = cpu;
+    cpu->cpu_id = cpu_id;
+    cpu->apic_id = apic_id;
+
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+
+    /* User mode starts with a zero GS base */
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+
+    cpu->online = true;
+    percpu_ready = true;
+}
+
+/**
+ * Get the per-CPU block of a given CPU
+ */
+percpu_t *percpu_get(uint32_t cpu_id) {
+    if (cpu_id >= PERCPU_MAX_CPUS) {
+        return NULL;
+    }
+    return &percpu_blocks[cpu_id];
+}
+
+/**
+ * Get number of online CPUs
+ */
+uint32_t percpu_online_count(void) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        if (percpu_blocks[i].online) {
+            count++;
+        }
+    }
+
+    return count ? count : 1;
+}
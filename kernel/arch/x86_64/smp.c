@@ -0,0 +1,183 @@
+/**
+ * AAAos Kernel - SMP Application Processor Startup Implementation
+ *
+ * The BSP copies the trampoline (smp_trampoline.asm) to SMP_TRAMPOLINE_ADDR,
+ * fills its parameter block and wakes one AP at a time. The trampoline
+ * takes the AP from real mode to long mode on the kernel page tables and
+ * calls smp_ap_main on the kernel stack of the AP's idle process, so the
+ * AP's boot code becomes that idle process once the scheduler takes over.
+ *
+ * All CPUs share the IDT and the handlers behind it; the GDT and TSS,
+ * per-CPU area, local APIC, SYSCALL MSRs and run queue are per CPU.
+ */
+
+#include "smp.h"
+#include "apic.h"
+#include "acpi.h"
+#include "fpu.h"
+#include "include/gdt.h"
+#include "include/idt.h"
+#include "include/percpu.h"
+#include "../../include/serial.h"
+#include "../../mm/vmm.h"
+#include "../../proc/process.h"
+#include "../../sched/idle.h"
+#include "../../sched/rcu.h"
+#include "../../sched/scheduler.h"
+#include "../../sched/timer.h"
+#include "../../syscall/syscall.h"
+
+/* EFER bits the trampoline must not write back */
+#define EFER_LMA                (1 << 10)   /* Long mode active (read-only) */
+
+/* Trampoline image (smp_trampoline.asm) */
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+/**
+ * Parameter block inside the trampoline, filled before each AP starts
+ * Must match the layout at smp_trampoline_params.
+ */
+typedef struct PACKED {
+    uint64_t cr3;                       /* Kernel page tables */
+    uint64_t efer;                      /* EFER to load before paging */
+    uint64_t stack;                     /* Initial RSP */
+    uint64_t entry;                     /* 64-bit C entry point */
+    uint32_t cpu_id;                    /* Logical CPU index passed to entry */
+} smp_trampoline_params_t;
+
+/* Local APIC ID of each logical CPU */
+static uint8_t smp_apic_ids[PERCPU_MAX_CPUS];
+
+/* Idle process of each AP; its kernel stack is the AP's boot stack */
+static process_t *smp_idle[PERCPU_MAX_CPUS];
+
+/* Set by an AP once it has joined the scheduler */
+static volatile uint32_t smp_ap_started = 0;
+
+/**
+ * Idle loop of an AP
+ */
+static void smp_idle_loop(void) {
+    for (;;) {
+        rcu_check_qs();
+        idle_enter();
+    }
+}
+
+/**
+ * 64-bit entry of an AP, called by the trampoline
+ */
+static void smp_ap_main(uint32_t cpu_id) {
+    /* gdt_load resets GS, so the per-CPU area comes after the GDT */
+    gdt_init_cpu(cpu_id);
+    percpu_init_cpu(cpu_id, smp_apic_ids[cpu_id]);
+    idt_init_cpu();
+    vmm_init_cpu();
+    syscall_init_cpu();
+    fpu_init_cpu();
+
+    apic_init_ap();
+    timer_init_cpu();
+
+    scheduler_init_cpu(smp_idle[cpu_id]);
+
+    __atomic_store_n(&smp_ap_started, 1, __ATOMIC_RELEASE);
+
+    smp_idle_loop();
+}
+
+/**
+ * Wait for the AP being started to report in
+ */
+static bool smp_wait_started(uint32_t timeout_us) {
+    for (uint32_t waited = 0; waited < timeout_us; waited += 100) {
+        if (__atomic_load_n(&smp_ap_started, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+        apic_delay_us(100);
+    }
+    return __atomic_load_n(&smp_ap_started, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * Start one AP as logical CPU cpu_id
+ */
+static bool smp_start_ap(volatile smp_trampoline_params_t *params,
+                         uint32_t cpu_id, uint8_t apic_id) {
+    process_t *idle = process_create("idle", smp_idle_loop);
+    if (idle == NULL) {
+        kprintf("[SMP] Error: No idle process for CPU %u\n", cpu_id);
+        return false;
+    }
+    idle->priority = PRIORITY_IDLE;
+
+    smp_apic_ids[cpu_id] = apic_id;
+    smp_idle[cpu_id] = idle;
+
+    params->stack = idle->kernel_stack;
+    params->cpu_id = cpu_id;
+    __atomic_store_n(&smp_ap_started, 0, __ATOMIC_RELEASE);
+
+    /* INIT, then up to two SIPIs as the MP specification asks */
+    uint8_t vector = (uint8_t)(SMP_TRAMPOLINE_ADDR >> 12);
+    apic_send_init_ipi(apic_id);
+    apic_send_startup_ipi(apic_id, vector);
+    if (!smp_wait_started(1000)) {
+        apic_send_startup_ipi(apic_id, vector);
+    }
+
+    if (!smp_wait_started(SMP_AP_TIMEOUT_US)) {
+        /* The idle process is kept: the AP may still wake on its stack */
+        kprintf("[SMP] Error: CPU %u (APIC %u) did not start\n", cpu_id, apic_id);
+        return false;
+    }
+
+    kprintf("[SMP] CPU %u (APIC %u) online\n", cpu_id, apic_id);
+    return true;
+}
+
+/**
+ * Start every enabled AP
+ */
+uint32_t smp_init(void) {
+    const apic_info_t *apic = apic_get_info();
+    const acpi_madt_info_t *madt = acpi_get_madt();
+
+    if (!apic->enabled || madt == NULL) {
+        kprintf("[SMP] No local APIC or MADT, running on the BSP only\n");
+        return percpu_online_count();
+    }
+
+    kprintf("[SMP] Starting application processors...\n");
+
+    /* Copy the trampoline into low memory (identity mapped) */
+    size_t size = (size_t)(smp_trampoline_end - smp_trampoline_start);
+    uint8_t *dst = (uint8_t*)SMP_TRAMPOLINE_ADDR;
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = smp_trampoline_start[i];
+    }
+
+    volatile smp_trampoline_params_t *params = (volatile smp_trampoline_params_t*)
+        (dst + (smp_trampoline_params - smp_trampoline_start));
+    params->cr3 = vmm_get_kernel_pml4();
+    params->efer = rdmsr(MSR_EFER) & ~(uint64_t)EFER_LMA;
+    params->entry = (uint64_t)smp_ap_main;
+
+    uint8_t bsp_apic_id = apic_get_id();
+    uint32_t next_cpu = 1;
+
+    for (uint32_t i = 0; i < madt->local_apic_count && next_cpu < PERCPU_MAX_CPUS; i++) {
+        if (!madt->local_apics[i].enabled || madt->local_apics[i].apic_id == bsp_apic_id) {
+            continue;
+        }
+        if (smp_start_ap(params, next_cpu, madt->local_apics[i].apic_id)) {
+            next_cpu++;
+        }
+    }
+
+    uint32_t online = percpu_online_count();
+    kprintf("[SMP] %u CPU(s) online\n", online);
+    return online;
+}
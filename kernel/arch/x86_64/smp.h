@@ -0,0 +1,28 @@
+/**
+ * AAAos Kernel - SMP Application Processor Startup
+ *
+ * Wakes the application processors (APs) listed in the ACPI MADT with
+ * INIT-SIPI-SIPI and brings each one up to the point where it runs its
+ * own idle process and takes work from its own scheduler run queue.
+ */
+
+#ifndef _AAAOS_ARCH_SMP_H
+#define _AAAOS_ARCH_SMP_H
+
+#include "../../include/types.h"
+
+/* Physical page the real-mode trampoline is copied to (SIPI vector 0x08) */
+#define SMP_TRAMPOLINE_ADDR     0x8000
+
+/* How long to wait for an AP to report in after its SIPIs */
+#define SMP_AP_TIMEOUT_US       100000
+
+/**
+ * Start every enabled AP
+ * Call on the BSP after acpi_init, apic_init, vmm_init, syscall_init and
+ * scheduler_init (which starts the timers).
+ * @return Number of CPUs online, including the BSP
+ */
+uint32_t smp_init(void);
+
+#endif /* _AAAOS_ARCH_SMP_H */
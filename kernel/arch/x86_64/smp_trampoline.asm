@@ -0,0 +1,103 @@
+; AAAos Kernel - SMP AP Trampoline
+; Copied to SMP_TRAMPOLINE_ADDR by smp_init. An AP woken by a SIPI starts
+; here in real mode, switches to long mode on the kernel page tables and
+; calls the C entry with the parameters at smp_trampoline_params.
+
+%define SMP_TRAMPOLINE_ADDR 0x8000
+%define MSR_EFER            0xC0000080
+
+; Address of a trampoline label once copied to SMP_TRAMPOLINE_ADDR
+%define TRAMP(label)        (SMP_TRAMPOLINE_ADDR + ((label) - smp_trampoline_start))
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+[BITS 16]
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; Enter protected mode with the trampoline's own GDT
+    lgdt [TRAMP(tramp_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1                   ; CR0.PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(tramp_protected)
+
+[BITS 32]
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; PAE, kernel page tables, then EFER (LME, NXE, SCE) from the BSP
+    mov eax, cr4
+    or eax, (1 << 5)            ; CR4.PAE
+    mov cr4, eax
+
+    mov eax, [TRAMP(tramp_cr3)]
+    mov cr3, eax
+
+    mov ecx, MSR_EFER
+    mov eax, [TRAMP(tramp_efer)]
+    mov edx, [TRAMP(tramp_efer) + 4]
+    wrmsr
+
+    ; Enable paging; with EFER.LME set this activates long mode
+    mov eax, cr0
+    or eax, (1 << 31)           ; CR0.PG
+    mov cr0, eax
+    jmp 0x18:TRAMP(tramp_long)
+
+[BITS 64]
+tramp_long:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+
+    mov rsp, [TRAMP(tramp_stack)]
+    mov edi, [TRAMP(tramp_cpu_id)]
+    mov rax, [TRAMP(tramp_entry)]
+    call rax
+
+    ; The entry never returns
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; Null, 32-bit code (0x08), data (0x10), 64-bit code (0x18)
+align 8
+tramp_gdt:
+    dq 0x0000000000000000
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+    dq 0x00AF9A000000FFFF
+tramp_gdt_end:
+
+tramp_gdt_descriptor:
+    dw tramp_gdt_end - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+; Parameter block (smp_trampoline_params_t in smp.c)
+align 8
+smp_trampoline_params:
+tramp_cr3:      dq 0
+tramp_efer:     dq 0
+tramp_stack:    dq 0
+tramp_entry:    dq 0
+tramp_cpu_id:   dd 0
+
+smp_trampoline_end:
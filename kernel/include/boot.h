@@ -44,6 +44,10 @@ typedef struct PACKED {
     uint32_t fb_height;         /* Screen height */
     uint32_t fb_bpp;            /* Bits per pixel */
     uint32_t fb_pitch;          /* Bytes per line */
+    uint64_t initrd_addr;       /* Physical address of the initramfs, 0 if none */
+    uint64_t initrd_size;       /* Size of the initramfs in bytes */
+    uint64_t loader_start_tsc;  /* TSC when the loader began, 0 if unknown */
+    uint64_t loader_exit_tsc;   /* TSC just before jumping to the kernel */
 } boot_info_t;
 
 /**
@@ -3,6 +3,20 @@
  *
  * Provides serial output for kernel debugging.
  * Uses COM1 (0x3F8) by default.
+ *
+ * Output starts out synchronous: each byte waits for the UART. Once
+ * serial_enable_irq has run, console output is copied into a ring and
+ * the caller returns at once; the ring drains on the UART's transmit
+ * interrupt (and whenever a writer finds the UART idle). A whole
+ * serial_printf or serial_puts is queued in one piece, so lines from
+ * different CPUs do not interleave. When the ring is full the output is
+ * dropped and counted rather than waited for. serial_panic_mode drains
+ * the ring and goes back to synchronous output for good. Where IRQ 4
+ * cannot be delivered, queued bytes go out with the next write or on
+ * serial_flush.
+ *
+ * klog prints only messages at or above the configured log level, and
+ * skips formatting for the others, so debug logging can stay compiled in.
  */
 
 #ifndef _AAAOS_SERIAL_H
@@ -40,6 +54,35 @@
 #define SERIAL_LSR_TX_IDLE      0x40
 #define SERIAL_LSR_FIFO_ERR     0x80
 
+/* Interrupt enable register bits */
+#define SERIAL_IER_RX           0x01    /* Received data available */
+#define SERIAL_IER_THRE         0x02    /* Transmit holding register empty */
+
+/* Bytes the UART transmit FIFO holds (16550A) */
+#define SERIAL_FIFO_SIZE        16
+
+/* Console output ring size in bytes (power of 2) */
+#define SERIAL_TX_RING_SIZE     16384
+
+/* Log levels (klog), most severe first */
+#define SERIAL_LOG_ERROR        0
+#define SERIAL_LOG_WARN         1
+#define SERIAL_LOG_INFO         2
+#define SERIAL_LOG_DEBUG        3
+
+/**
+ * Console output statistics
+ */
+typedef struct {
+    uint64_t queued;            /* Bytes queued in the ring */
+    uint64_t written;           /* Bytes handed to the UART from the ring */
+    uint64_t dropped;           /* Bytes lost to a full ring */
+    uint64_t interrupts;        /* Transmit interrupts taken */
+} serial_stats_t;
+
+/* Current log level; read through klog */
+extern volatile int serial_log_level;
+
 /**
  * Initialize serial port for debugging output
  * @param port Base port address (e.g., COM1_PORT)
@@ -53,6 +96,14 @@ void serial_init(uint16_t port);
  */
 void serial_putc(uint16_t port, char c);
 
+/**
+ * Write bytes to serial port as they are (no newline translation)
+ * @param port Base port address
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void serial_write(uint16_t port, const char *data, size_t len);
+
 /**
  * Write a string to serial port
  * @param port Base port address
@@ -81,10 +132,52 @@ char serial_getc(uint16_t port);
  */
 bool serial_data_ready(uint16_t port);
 
+/**
+ * Switch a port to buffered output drained by its transmit interrupt
+ * Call once the IDT is set up. Only one port (the console) is buffered.
+ * @param port Base port address (COM1_PORT or COM3_PORT use IRQ 4)
+ * @return false if the port does not use IRQ 4 or already has a buffer
+ */
+bool serial_enable_irq(uint16_t port);
+
+/**
+ * Wait until all buffered output has been handed to the UART
+ */
+void serial_flush(void);
+
+/**
+ * Drain buffered output and write synchronously from now on
+ * For panic and shutdown paths; does not wait for locks other CPUs hold.
+ */
+void serial_panic_mode(void);
+
+/**
+ * Set the log level (SERIAL_LOG_*); klog messages above it are skipped
+ */
+void serial_set_log_level(int level);
+
+/**
+ * Name of a log level ("error", "warn", "info", "debug")
+ */
+const char *serial_log_level_name(int level);
+
+/**
+ * Get console output statistics
+ */
+void serial_get_stats(serial_stats_t *stats);
+
 /* Convenience macros for COM1 */
 #define serial_init_com1()      serial_init(COM1_PORT)
 #define kputc(c)                serial_putc(COM1_PORT, c)
 #define kputs(s)                serial_puts(COM1_PORT, s)
 #define kprintf(fmt, ...)       serial_printf(COM1_PORT, fmt, ##__VA_ARGS__)
 
+/* Print to COM1 if level (SERIAL_LOG_*) is enabled */
+#define klog(level, fmt, ...)                                               \
+    do {                                                                    \
+        if ((level) <= serial_log_level) {                                  \
+            serial_printf(COM1_PORT, fmt, ##__VA_ARGS__);                   \
+        }                                                                   \
+    } while (0)
+
 #endif /* _AAAOS_SERIAL_H */
@@ -3,6 +3,12 @@
  *
  * Provides text output to VGA display in text mode (80x25).
  * Used for early boot console before graphical framebuffer.
+ *
+ * Output goes to a shadow buffer in RAM and reaches the screen at the
+ * next vga_flush. vga_puts, vga_printf, vga_clear and vga_set_cursor flush
+ * when they return. Lone vga_putc calls are flushed every
+ * VGA_FLUSH_INTERVAL_MS once the flush timer runs, and at once before
+ * that.
  */
 
 #ifndef _AAAOS_VGA_H
@@ -17,6 +23,9 @@
 #define VGA_WIDTH       80
 #define VGA_HEIGHT      25
 
+/* Flush timer period for vga_putc output */
+#define VGA_FLUSH_INTERVAL_MS   20
+
 /* VGA color codes */
 typedef enum {
     VGA_COLOR_BLACK         = 0,
@@ -74,8 +83,21 @@ void vga_clear(void);
  */
 void vga_set_color(vga_color_t fg, vga_color_t bg);
 
+/**
+ * Output hook: takes a character before it is drawn
+ * @return true if the character was consumed and is not to be drawn
+ */
+typedef bool (*vga_output_hook_t)(char c);
+
+/**
+ * Install a hook that sees all console output first
+ * @param hook Hook, or NULL to remove it
+ */
+void vga_set_output_hook(vga_output_hook_t hook);
+
 /**
  * Write a character at current cursor position
+ * Shown by the next flush (see above).
  * @param c Character to write
  */
 void vga_putc(char c);
@@ -116,6 +138,17 @@ int vga_get_cursor_y(void);
  */
 void vga_scroll(void);
 
+/**
+ * Copy changed lines to VRAM and move the hardware cursor if needed
+ */
+void vga_flush(void);
+
+/**
+ * Show every write at once from now on
+ * For panic paths; does not wait for another CPU's flush.
+ */
+void vga_panic_mode(void);
+
 /**
  * Enable/disable hardware cursor
  * @param enable true to show cursor, false to hide
@@ -123,7 +156,7 @@ void vga_scroll(void);
 void vga_enable_cursor(bool enable);
 
 /**
- * Update hardware cursor position to match software cursor
+ * Update hardware cursor position to match software cursor now
  */
 void vga_update_cursor(void);
 
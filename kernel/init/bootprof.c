@@ -0,0 +1,105 @@
+/**
+ * AAAos Kernel - Boot Time Profile
+ */
+
+#include "bootprof.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../sched/clock.h"
+
+/* TSC count at which each stage was reached, 0 if not yet */
+static uint64_t bootprof_tsc[BOOTPROF_STAGE_COUNT];
+
+static const char *const bootprof_names[BOOTPROF_STAGE_COUNT] = {
+    [BOOTPROF_LOADER_START] = "loader-start",
+    [BOOTPROF_LOADER_EXIT]  = "loader-exit",
+    [BOOTPROF_KERNEL_ENTRY] = "kernel-entry",
+    [BOOTPROF_GDT]          = "gdt",
+    [BOOTPROF_IDT]          = "idt",
+    [BOOTPROF_PMM]          = "pmm",
+    [BOOTPROF_VMM]          = "vmm",
+    [BOOTPROF_HEAP]         = "heap",
+    [BOOTPROF_DRIVERS]      = "drivers",
+    [BOOTPROF_FIRST_FRAME]  = "first-frame",
+    [BOOTPROF_SHELL_PROMPT] = "shell-prompt",
+};
+
+/**
+ * Record a stamp unless the stage already has one
+ */
+static void bootprof_set(bootprof_stage_t stage, uint64_t tsc) {
+    uint64_t unset = 0;
+
+    if ((uint32_t)stage >= BOOTPROF_STAGE_COUNT || tsc == 0) {
+        return;
+    }
+    __atomic_compare_exchange_n(&bootprof_tsc[stage], &unset, tsc, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+void bootprof_init(const boot_info_t *boot_info) {
+    if (!boot_info_valid(boot_info)) {
+        return;
+    }
+    bootprof_set(BOOTPROF_LOADER_START, boot_info->loader_start_tsc);
+    bootprof_set(BOOTPROF_LOADER_EXIT, boot_info->loader_exit_tsc);
+}
+
+void bootprof_mark(bootprof_stage_t stage) {
+    if ((uint32_t)stage >= BOOTPROF_STAGE_COUNT ||
+        __atomic_load_n(&bootprof_tsc[stage], __ATOMIC_RELAXED) != 0) {
+        return;
+    }
+    bootprof_set(stage, rdtsc());
+}
+
+const char *bootprof_stage_name(bootprof_stage_t stage) {
+    if ((uint32_t)stage >= BOOTPROF_STAGE_COUNT) {
+        return "?";
+    }
+    return bootprof_names[stage];
+}
+
+/**
+ * Earliest stamp, the zero point of the profile
+ */
+static uint64_t bootprof_origin(void) {
+    uint64_t origin = 0;
+
+    for (uint32_t i = 0; i < BOOTPROF_STAGE_COUNT; i++) {
+        uint64_t tsc = __atomic_load_n(&bootprof_tsc[i], __ATOMIC_RELAXED);
+        if (tsc != 0 && (origin == 0 || tsc < origin)) {
+            origin = tsc;
+        }
+    }
+    return origin;
+}
+
+int64_t bootprof_stage_us(bootprof_stage_t stage) {
+    if ((uint32_t)stage >= BOOTPROF_STAGE_COUNT) {
+        return -1;
+    }
+    uint64_t tsc = __atomic_load_n(&bootprof_tsc[stage], __ATOMIC_RELAXED);
+    if (tsc == 0) {
+        return -1;
+    }
+    return (int64_t)(clock_cycles_to_ns(tsc - bootprof_origin()) / 1000);
+}
+
+void bootprof_dump(void) {
+    int64_t last = 0;
+
+    kprintf("[BOOTPROF] ========== Boot Profile ==========\n");
+    if (!clock_ready()) {
+        kprintf("[BOOTPROF] TSC not calibrated yet\n");
+        return;
+    }
+    for (uint32_t i = 0; i < BOOTPROF_STAGE_COUNT; i++) {
+        int64_t us = bootprof_stage_us((bootprof_stage_t)i);
+        if (us < 0) {
+            continue;
+        }
+        kprintf("[BOOTPROF] %s %lld +%lld\n", bootprof_names[i], us, us > last ? us - last : 0);
+        last = us;
+    }
+}
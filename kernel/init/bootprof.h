@@ -0,0 +1,65 @@
+/**
+ * AAAos Kernel - Boot Time Profile
+ *
+ * Each boot stage records the TSC count at which it was first reached,
+ * starting with the UEFI loader (its stamps come in boot_info) and ending
+ * with the first composited frame and the first shell prompt. Only the
+ * first mark of a stage counts, so the hooks can sit on paths that run
+ * again later. Cycles are converted to time only when the profile is
+ * read, as the TSC is calibrated well after the first stamps are taken.
+ *
+ * bootprof_dump prints one "[BOOTPROF] <stage> <us> +<us>" line per stage
+ * reached; scripts/bootprof-compare.py compares those lines from two
+ * serial logs to spot regressions.
+ */
+
+#ifndef _AAAOS_INIT_BOOTPROF_H
+#define _AAAOS_INIT_BOOTPROF_H
+
+#include "../include/types.h"
+#include "../include/boot.h"
+
+/* Boot stages, in the order they are normally reached */
+typedef enum {
+    BOOTPROF_LOADER_START = 0,  /* UEFI loader began (boot_info) */
+    BOOTPROF_LOADER_EXIT,       /* Loader left boot services (boot_info) */
+    BOOTPROF_KERNEL_ENTRY,      /* kernel_main entered */
+    BOOTPROF_GDT,               /* GDT loaded */
+    BOOTPROF_IDT,               /* IDT loaded */
+    BOOTPROF_PMM,               /* Physical memory manager ready */
+    BOOTPROF_VMM,               /* Kernel page tables ready */
+    BOOTPROF_HEAP,              /* Kernel heap ready */
+    BOOTPROF_DRIVERS,           /* Initcalls finished */
+    BOOTPROF_FIRST_FRAME,       /* First frame composited */
+    BOOTPROF_SHELL_PROMPT,      /* First shell prompt printed */
+    BOOTPROF_STAGE_COUNT
+} bootprof_stage_t;
+
+/**
+ * Take the loader's stamps from the boot information
+ * @param boot_info Boot information (ignored if not valid)
+ */
+void bootprof_init(const boot_info_t *boot_info);
+
+/**
+ * Record that a stage has been reached (later marks are ignored)
+ */
+void bootprof_mark(bootprof_stage_t stage);
+
+/**
+ * Name of a stage
+ */
+const char *bootprof_stage_name(bootprof_stage_t stage);
+
+/**
+ * Time at which a stage was reached
+ * @return Microseconds since the earliest stamp, or -1 if not reached
+ */
+int64_t bootprof_stage_us(bootprof_stage_t stage);
+
+/**
+ * Print the profile to serial console
+ */
+void bootprof_dump(void);
+
+#endif /* _AAAOS_INIT_BOOTPROF_H */
@@ -0,0 +1,307 @@
+/**
+ * AAAos Kernel - Dependency-Ordered Initcalls
+ *
+ * The declarations sit between _initcall_start and _initcall_end. Each
+ * call's requirements are resolved to a bit mask of call indices up
+ * front; a runner then repeatedly claims a pending call whose mask is
+ * covered by the finished ones. The caller of initcall_run_all and the
+ * worker threads all run that loop, sleeping on a progress word (bumped
+ * whenever a call finishes) while everything runnable is taken.
+ */
+
+#include "initcall.h"
+#include "bootprof.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../proc/process.h"
+#include "../sched/clock.h"
+#include "../sched/scheduler.h"
+#include "../sched/waitq.h"
+
+/* Declarations, gathered by the linker */
+extern const initcall_t _initcall_start[];
+extern const initcall_t _initcall_end[];
+
+_Static_assert(INITCALL_MAX <= 64, "requirement masks are 64 bits");
+
+static uint32_t initcall_count = 0;
+static const initcall_t *initcalls[INITCALL_MAX];
+static uint64_t initcall_requires[INITCALL_MAX];
+static initcall_trace_t initcall_trace[INITCALL_MAX];
+
+/* Calls that succeeded, and that failed or were skipped (one bit each) */
+static uint64_t initcall_done_mask = 0;
+static uint64_t initcall_failed_mask = 0;
+
+/* Calls not yet finished and calls running now */
+static uint32_t initcall_unfinished = 0;
+static uint32_t initcall_running = 0;
+
+/* Guards the state above */
+static volatile int initcall_lock = 0;
+
+/* Bumped when a call finishes; idle runners sleep on it */
+static volatile uint32_t initcall_progress = 0;
+
+/* Time initcall_run_all started */
+static uint64_t initcall_epoch_ns = 0;
+
+static bool initcall_started = false;
+
+static uint64_t initcall_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&initcall_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static void initcall_lock_release(uint64_t flags) {
+    __sync_lock_release(&initcall_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Compare two NUL-terminated names
+ */
+static bool initcall_name_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Index of the initcall with a given name, or -1
+ */
+static int initcall_find(const char *name) {
+    for (uint32_t i = 0; i < initcall_count; i++) {
+        if (initcall_name_equal(initcalls[i]->name, name)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Record that call i has finished (lock held)
+ */
+static void initcall_finish_locked(uint32_t i, initcall_state_t state) {
+    initcall_trace[i].state = state;
+    if (state == INITCALL_DONE) {
+        initcall_done_mask |= 1ULL << i;
+    } else {
+        initcall_failed_mask |= 1ULL << i;
+    }
+    initcall_unfinished--;
+}
+
+/**
+ * Load the declarations and resolve requirement names
+ */
+static void initcall_load(void) {
+    for (const initcall_t *call = _initcall_start; call < _initcall_end; call++) {
+        if (initcall_count >= INITCALL_MAX) {
+            kprintf("[INIT] Warning: more than %d initcalls, ignoring '%s'\n",
+                    INITCALL_MAX, call->name);
+            continue;
+        }
+        initcalls[initcall_count] = call;
+        initcall_trace[initcall_count].name = call->name;
+        initcall_trace[initcall_count].state = INITCALL_PENDING;
+        initcall_count++;
+    }
+    initcall_unfinished = initcall_count;
+
+    for (uint32_t i = 0; i < initcall_count; i++) {
+        for (int r = 0; r < INITCALL_MAX_REQUIRES && initcalls[i]->requires[r]; r++) {
+            int dep = initcall_find(initcalls[i]->requires[r]);
+            if (dep < 0) {
+                kprintf("[INIT] '%s' requires unknown '%s', skipping it\n",
+                        initcalls[i]->name, initcalls[i]->requires[r]);
+                initcall_finish_locked(i, INITCALL_SKIPPED);
+                break;
+            }
+            initcall_requires[i] |= 1ULL << dep;
+        }
+    }
+}
+
+/**
+ * Claim a call that can run now (lock held)
+ * Calls whose requirements failed are skipped on the way, until a pass
+ * skips nothing more.
+ * @return Index of the claimed call, or -1
+ */
+static int initcall_claim_locked(bool boot_cpu) {
+    bool skipped_any = false;
+    bool skipped;
+
+    do {
+        skipped = false;
+        for (uint32_t i = 0; i < initcall_count; i++) {
+            if (initcall_trace[i].state != INITCALL_PENDING) {
+                continue;
+            }
+            if (initcall_requires[i] & initcall_failed_mask) {
+                initcall_finish_locked(i, INITCALL_SKIPPED);
+                skipped = skipped_any = true;
+                continue;
+            }
+            if ((initcall_requires[i] & ~initcall_done_mask) != 0) {
+                continue;
+            }
+            if ((initcalls[i]->flags & INITCALL_BOOT_CPU) && !boot_cpu) {
+                continue;
+            }
+            initcall_trace[i].state = INITCALL_RUNNING;
+            initcall_running++;
+            return (int)i;
+        }
+    } while (skipped);
+
+    if (skipped_any) {
+        __atomic_add_fetch(&initcall_progress, 1, __ATOMIC_RELEASE);
+    }
+    return -1;
+}
+
+/**
+ * Run call i and record how it went
+ */
+static void initcall_run_one(uint32_t i) {
+    initcall_trace_t *t = &initcall_trace[i];
+    uint64_t start = clock_monotonic_ns();
+
+    t->cpu = percpu_cpu_id();
+    t->start_ns = start - initcall_epoch_ns;
+    bool ok = initcalls[i]->fn();
+    t->duration_ns = clock_monotonic_ns() - start;
+
+    if (!ok) {
+        kprintf("[INIT] '%s' failed\n", initcalls[i]->name);
+    }
+
+    uint64_t flags = initcall_lock_acquire();
+    initcall_running--;
+    initcall_finish_locked(i, ok ? INITCALL_DONE : INITCALL_FAILED);
+    initcall_lock_release(flags);
+
+    __atomic_add_fetch(&initcall_progress, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&initcall_progress, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Run calls until none are left
+ * The boot CPU's runner also breaks requirement cycles: if nothing
+ * runs and nothing can start, what is left waits on itself.
+ */
+static void initcall_work(bool boot_cpu) {
+    while (1) {
+        uint32_t seen = __atomic_load_n(&initcall_progress, __ATOMIC_ACQUIRE);
+
+        uint64_t flags = initcall_lock_acquire();
+        int i = initcall_claim_locked(boot_cpu);
+        uint32_t unfinished = initcall_unfinished;
+        uint32_t running = initcall_running;
+
+        if (i < 0 && unfinished > 0 && running == 0 && boot_cpu) {
+            for (uint32_t j = 0; j < initcall_count; j++) {
+                if (initcall_trace[j].state == INITCALL_PENDING) {
+                    kprintf("[INIT] '%s' is in a requirement cycle\n", initcalls[j]->name);
+                    initcall_finish_locked(j, INITCALL_FAILED);
+                }
+            }
+            unfinished = 0;
+        }
+        initcall_lock_release(flags);
+
+        if (i >= 0) {
+            initcall_run_one((uint32_t)i);
+            continue;
+        }
+        if (unfinished == 0) {
+            __atomic_add_fetch(&initcall_progress, 1, __ATOMIC_SEQ_CST);
+            waitq_wake(&initcall_progress, WAITQ_WAKE_ALL);
+            return;
+        }
+        waitq_wait(&initcall_progress, seen);
+    }
+}
+
+/**
+ * Body of a worker thread
+ */
+static void initcall_worker(void *arg) {
+    UNUSED(arg);
+    initcall_work(false);
+}
+
+bool initcall_run_all(void) {
+    if (initcall_started) {
+        return false;
+    }
+    initcall_started = true;
+    initcall_epoch_ns = clock_monotonic_ns();
+
+    initcall_load();
+
+    /* Workers only help once there is a scheduler to run them */
+    uint32_t workers = 0;
+    if (scheduler_is_running()) {
+        uint32_t wanted = percpu_online_count();
+        if (wanted > INITCALL_MAX_WORKERS) {
+            wanted = INITCALL_MAX_WORKERS;
+        }
+        if (wanted > initcall_count) {
+            wanted = initcall_count;
+        }
+        for (; workers < wanted; workers++) {
+            process_t *thread = thread_create(NULL, "init", initcall_worker, NULL);
+            if (!thread || !scheduler_add(thread)) {
+                break;
+            }
+        }
+    }
+
+    kprintf("[INIT] Running %u initcalls (%u worker threads)\n", initcall_count, workers);
+    initcall_work(true);
+
+    uint64_t total = clock_monotonic_ns() - initcall_epoch_ns;
+    kprintf("[INIT] Initcalls finished in %llu us\n", total / 1000);
+    bootprof_mark(BOOTPROF_DRIVERS);
+    return initcall_failed_mask == 0;
+}
+
+uint32_t initcall_get_trace(initcall_trace_t *trace, uint32_t max) {
+    for (uint32_t i = 0; i < initcall_count && i < max; i++) {
+        trace[i] = initcall_trace[i];
+    }
+    return initcall_count;
+}
+
+/**
+ * Name of an initcall state
+ */
+static const char *initcall_state_name(initcall_state_t state) {
+    switch (state) {
+        case INITCALL_PENDING:  return "pending";
+        case INITCALL_RUNNING:  return "running";
+        case INITCALL_DONE:     return "ok";
+        case INITCALL_FAILED:   return "FAILED";
+        case INITCALL_SKIPPED:  return "skipped";
+        default:                return "?";
+    }
+}
+
+void initcall_dump_trace(void) {
+    kprintf("[INIT] ========== Boot Trace ==========\n");
+    for (uint32_t i = 0; i < initcall_count; i++) {
+        const initcall_trace_t *t = &initcall_trace[i];
+        kprintf("[INIT]   %s: %s, CPU %u, start %llu us, took %llu us\n", t->name,
+                initcall_state_name(t->state), t->cpu,
+                t->start_ns / 1000, t->duration_ns / 1000);
+    }
+}
@@ -0,0 +1,101 @@
+/**
+ * AAAos Kernel - Dependency-Ordered Initcalls
+ *
+ * Subsystems declare their initialization with INITCALL, naming the
+ * initcalls that must have finished before theirs can start. The linker
+ * gathers the declarations into one table, and initcall_run_all runs
+ * them: once the scheduler is up, every call whose requirements are met
+ * runs at the same time as the others on worker threads spread over the
+ * CPUs, so a driver waiting on its hardware does not hold up unrelated
+ * ones. Before that, they run one after another in dependency order.
+ *
+ * A call that fails makes the calls needing it be skipped. Each call's
+ * start time, duration and CPU are kept for the boot trace.
+ */
+
+#ifndef _AAAOS_INIT_INITCALL_H
+#define _AAAOS_INIT_INITCALL_H
+
+#include "../include/types.h"
+
+/* Most initcalls in the kernel */
+#define INITCALL_MAX            64
+
+/* Most requirements one initcall can name */
+#define INITCALL_MAX_REQUIRES   4
+
+/* Most worker threads besides the caller of initcall_run_all */
+#define INITCALL_MAX_WORKERS    8
+
+/* Initcall flags */
+#define INITCALL_BOOT_CPU       (1u << 0)   /* Run on the caller of initcall_run_all */
+
+/**
+ * Initialization function
+ * @return false if the subsystem could not be brought up
+ */
+typedef bool (*initcall_fn_t)(void);
+
+/**
+ * Initcall declaration
+ */
+typedef struct initcall {
+    const char *name;                           /* Name other initcalls require it by */
+    initcall_fn_t fn;                           /* Initialization function */
+    uint32_t flags;                             /* INITCALL_* */
+    const char *requires[INITCALL_MAX_REQUIRES]; /* Names; unused entries NULL */
+} initcall_t;
+
+/**
+ * Declare an initcall
+ * @param id   Name (an identifier, also used as the initcall's name)
+ * @param fn   Initialization function (initcall_fn_t)
+ * @param flags INITCALL_* flags
+ * @param ...  Names of the initcalls it requires, as strings
+ */
+#define INITCALL(id, fn, flags, ...)                                        \
+    static const initcall_t initcall_##id                                   \
+        __attribute__((used, section(".initcall"), aligned(8))) =           \
+        { #id, fn, flags, { __VA_ARGS__ } }
+
+/* Initcall states */
+typedef enum {
+    INITCALL_PENDING = 0,       /* Not started */
+    INITCALL_RUNNING,           /* Running now */
+    INITCALL_DONE,              /* Succeeded */
+    INITCALL_FAILED,            /* Returned false (or in a requirement cycle) */
+    INITCALL_SKIPPED            /* A requirement failed or does not exist */
+} initcall_state_t;
+
+/**
+ * Boot trace entry of one initcall
+ */
+typedef struct initcall_trace {
+    const char *name;
+    initcall_state_t state;
+    uint32_t cpu;               /* CPU it ran on */
+    uint64_t start_ns;          /* Start, relative to initcall_run_all */
+    uint64_t duration_ns;       /* Time it took */
+} initcall_trace_t;
+
+/**
+ * Run every declared initcall, waiting until all have finished
+ * May be called once.
+ * @return true if none failed or was skipped
+ */
+bool initcall_run_all(void);
+
+/**
+ * Get the boot trace
+ * @param trace Output array
+ * @param max Entries it holds
+ * @return Number of initcalls (may exceed max)
+ */
+uint32_t initcall_get_trace(initcall_trace_t *trace, uint32_t max);
+
+/**
+ * Print the boot trace to serial console
+ */
+void initcall_dump_trace(void);
+
+#endif /* _AAAOS_INIT_INITCALL_H */
@@ -0,0 +1,542 @@
+/**
+ * AAAos Kernel - Shared-Memory Message Channels Implementation
+ *
+ * The region's frames are mapped VMM_FLAG_SHARED, so a fork shares them
+ * writable instead of making them copy-on-write. The kernel holds one
+ * reference on each frame for the life of the channel and reaches the
+ * header through it; every mapping holds its own, dropped when the
+ * mapping goes away.
+ *
+ * Sleepers key on a per-ring event word in the kernel channel rather
+ * than on the ring words user code writes: a wait reads the event first
+ * and then checks the ring word, and notify and close bump the event, so
+ * a close cannot slip in between the check and the sleep either.
+ *
+ * Lock order: channel table lock, then a channel's lock. A channel is
+ * freed under its own lock alone, so lookups re-check it once locked.
+ */
+
+#include "channel.h"
+#include "../include/serial.h"
+#include "../mm/heap.h"
+#include "../mm/pmm.h"
+#include "../mm/vma.h"
+#include "../mm/vmm.h"
+#include "../proc/process.h"
+#include "../sched/waitq.h"
+#include "../syscall/syscall.h"
+
+_Static_assert(sizeof(channel_ring_t) == 128, "tail and head get one cache line each");
+_Static_assert(sizeof(channel_header_t) <= PAGE_SIZE, "the kernel reaches the header through frames[0]");
+
+/* Channel table - statically allocated */
+static channel_t channel_table[CHANNEL_MAX_COUNT];
+
+/* Next channel ID */
+static uint32_t next_channel_id = 1;
+
+/* Statistics */
+static uint64_t total_channels_created = 0;
+static uint64_t total_grants = 0;
+static uint64_t total_takes = 0;
+
+/* Protects allocation in the table */
+static volatile int channel_table_lock = 0;
+
+static inline void chan_lock(volatile int *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void chan_unlock(volatile int *lock) {
+    __sync_lock_release(lock);
+}
+
+/**
+ * Byte layout of a channel region
+ */
+typedef struct channel_layout {
+    uint32_t desc_offset[2];
+    uint32_t data_offset[2];
+    size_t size;
+} channel_layout_t;
+
+static void channel_layout(uint32_t entries, uint32_t data_pages, channel_layout_t *l) {
+    uint32_t ring_bytes = entries * sizeof(channel_desc_t);
+
+    l->desc_offset[0] = sizeof(channel_header_t);
+    l->desc_offset[1] = l->desc_offset[0] + ring_bytes;
+    l->data_offset[0] = ALIGN_UP(l->desc_offset[1] + ring_bytes, PAGE_SIZE);
+    l->data_offset[1] = l->data_offset[0] + data_pages * PAGE_SIZE;
+    l->size = l->data_offset[1] + (size_t)data_pages * PAGE_SIZE;
+}
+
+/**
+ * Kernel view of a channel's header
+ */
+static inline channel_header_t *channel_header(channel_t *ch) {
+    return (channel_header_t *)(uintptr_t)ch->frames[0];
+}
+
+/**
+ * End of ch that proc's thread group holds open, or -1
+ */
+static int channel_end_of(channel_t *ch, process_t *proc) {
+    if (ch->tgids[CHANNEL_END_CREATOR] == proc->tgid &&
+        !(ch->flags & CHANNEL_FLAG_CLOSED(CHANNEL_END_CREATOR))) {
+        return CHANNEL_END_CREATOR;
+    }
+    if (ch->tgids[CHANNEL_END_PEER] == proc->tgid && (ch->flags & CHANNEL_FLAG_ATTACHED) &&
+        !(ch->flags & CHANNEL_FLAG_CLOSED(CHANNEL_END_PEER))) {
+        return CHANNEL_END_PEER;
+    }
+    return -1;
+}
+
+/**
+ * Find a channel by ID and lock it
+ */
+static channel_t *channel_lookup(uint32_t id) {
+    chan_lock(&channel_table_lock);
+
+    for (uint32_t i = 0; i < CHANNEL_MAX_COUNT; i++) {
+        channel_t *ch = &channel_table[i];
+        if ((ch->flags & CHANNEL_FLAG_VALID) && ch->id == id) {
+            chan_lock(&ch->lock);
+            chan_unlock(&channel_table_lock);
+            if (!(ch->flags & CHANNEL_FLAG_VALID) || ch->id != id) {
+                chan_unlock(&ch->lock);
+                return NULL;
+            }
+            return ch;
+        }
+    }
+
+    chan_unlock(&channel_table_lock);
+    return NULL;
+}
+
+/**
+ * Drop the kernel's references on a set of frames and free the array
+ */
+static void channel_free_frames(physaddr_t *frames, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (frames[i] != 0) {
+            pmm_page_unref(frames[i]);
+        }
+    }
+    kfree(frames);
+}
+
+/**
+ * Release everything a channel holds
+ * Called with the channel's lock held. The event
+ * words are left as they are: a waiter that saw them before the channel
+ * went away must not find the same value on a reused slot.
+ */
+static void channel_free(channel_t *ch) {
+    for (int e = 0; e < 2; e++) {
+        for (uint32_t s = 0; s < CHANNEL_GRANT_SLOTS; s++) {
+            if (ch->grants[e][s] != 0) {
+                pmm_page_unref(ch->grants[e][s]);
+                ch->grants[e][s] = 0;
+            }
+        }
+    }
+
+    channel_free_frames(ch->frames, ch->pages);
+    ch->frames = NULL;
+    ch->pages = 0;
+    __atomic_store_n(&ch->flags, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Map a channel's region into the calling process
+ * @return User address of the region, or negative error code
+ */
+static int64_t channel_map(channel_t *ch, process_t *proc) {
+    size_t size = ch->pages * PAGE_SIZE;
+    physaddr_t pml4 = vmm_get_current_address_space();
+    uint64_t flags = VMM_FLAG_USER | VMM_FLAG_WRITE | VMM_FLAG_NX | VMM_FLAG_SHARED;
+
+    virtaddr_t start = vma_find_free(process_vmas(proc), 0, size);
+    if (start == 0 || !vma_map_anon(process_vmas(proc), start, size, flags)) {
+        return -ENOMEM;
+    }
+
+    /* Install the frames now; the fault handler never fills these pages */
+    for (size_t i = 0; i < ch->pages; i++) {
+        if (!pmm_page_ref(ch->frames[i]) ||
+            !vmm_map_user_page(pml4, start + i * PAGE_SIZE, ch->frames[i], flags)) {
+            vma_unmap(process_vmas(proc), pml4, start, size);
+            return -ENOMEM;
+        }
+    }
+
+    return (int64_t)start;
+}
+
+/**
+ * Initialize the channel subsystem
+ */
+void channel_init(void) {
+    kprintf("[CHAN] Initializing Channel Subsystem...\n");
+
+    chan_lock(&channel_table_lock);
+    for (uint32_t i = 0; i < CHANNEL_MAX_COUNT; i++) {
+        channel_table[i].flags = 0;
+        channel_table[i].id = 0;
+        channel_table[i].lock = 0;
+    }
+    chan_unlock(&channel_table_lock);
+
+    kprintf("[CHAN] Channel table initialized (%u slots)\n", CHANNEL_MAX_COUNT);
+}
+
+/**
+ * Create a channel to another process
+ */
+int64_t channel_create(uint32_t peer_pid, uint32_t entries, uint32_t data_pages) {
+    process_t *proc = process_get_current();
+    process_t *peer = process_get_by_pid(peer_pid);
+
+    if (proc == NULL || peer == NULL || peer->tgid == proc->tgid) {
+        return -EINVAL;
+    }
+    if (entries == 0 || entries > CHANNEL_MAX_ENTRIES || data_pages > CHANNEL_MAX_DATA_PAGES) {
+        return -EINVAL;
+    }
+
+    uint32_t n = CHANNEL_MIN_ENTRIES;
+    while (n < entries) {
+        n <<= 1;
+    }
+
+    channel_layout_t layout;
+    channel_layout(n, data_pages, &layout);
+    size_t pages = layout.size / PAGE_SIZE;
+
+    physaddr_t *frames = (physaddr_t *)kcalloc(pages, sizeof(physaddr_t));
+    if (frames == NULL) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < pages; i++) {
+        frames[i] = pmm_alloc_page();
+        if (frames[i] == 0) {
+            channel_free_frames(frames, i);
+            return -ENOMEM;
+        }
+
+        uint64_t *words = (uint64_t *)(uintptr_t)frames[i];
+        for (size_t w = 0; w < PAGE_SIZE / sizeof(uint64_t); w++) {
+            words[w] = 0;
+        }
+    }
+
+    chan_lock(&channel_table_lock);
+
+    channel_t *ch = NULL;
+    for (uint32_t i = 0; i < CHANNEL_MAX_COUNT; i++) {
+        if (!(channel_table[i].flags & CHANNEL_FLAG_VALID)) {
+            ch = &channel_table[i];
+            break;
+        }
+    }
+
+    if (ch == NULL) {
+        chan_unlock(&channel_table_lock);
+        channel_free_frames(frames, pages);
+        kprintf("[CHAN] Error: No free channel slots (max %u)\n", CHANNEL_MAX_COUNT);
+        return -ENOMEM;
+    }
+
+    ch->id = next_channel_id++;
+    ch->tgids[CHANNEL_END_CREATOR] = proc->tgid;
+    ch->tgids[CHANNEL_END_PEER] = peer->tgid;
+    ch->entries = n;
+    ch->data_pages = data_pages;
+    ch->pages = pages;
+    ch->frames = frames;
+    for (uint32_t s = 0; s < CHANNEL_GRANT_SLOTS; s++) {
+        ch->grants[CHANNEL_END_CREATOR][s] = 0;
+        ch->grants[CHANNEL_END_PEER][s] = 0;
+    }
+
+    channel_header_t *hdr = channel_header(ch);
+    hdr->magic = CHANNEL_MAGIC;
+    hdr->id = ch->id;
+    hdr->entries = n;
+    hdr->grant_slots = CHANNEL_GRANT_SLOTS;
+    for (int r = 0; r < 2; r++) {
+        hdr->rings[r].desc_offset = layout.desc_offset[r];
+        hdr->rings[r].data_offset = layout.data_offset[r];
+        hdr->rings[r].data_size = data_pages * PAGE_SIZE;
+    }
+
+    /* Locked until mapped, so the peer cannot attach a half-made channel */
+    chan_lock(&ch->lock);
+    __atomic_store_n(&ch->flags, CHANNEL_FLAG_VALID, __ATOMIC_RELEASE);
+    total_channels_created++;
+
+    chan_unlock(&channel_table_lock);
+
+    int64_t base = channel_map(ch, proc);
+    if (base < 0) {
+        channel_free(ch);
+        chan_unlock(&ch->lock);
+        return base;
+    }
+    uint32_t id = ch->id;
+
+    chan_unlock(&ch->lock);
+
+    kprintf("[CHAN] PID %u: channel %u to PID %u at 0x%llx (%u entries, %u data pages)\n",
+            proc->pid, id, peer_pid, (uint64_t)base, n, data_pages);
+    return base;
+}
+
+/**
+ * Map the peer end of a channel
+ */
+int64_t channel_attach(uint32_t id) {
+    process_t *proc = process_get_current();
+    if (proc == NULL) {
+        return -EINVAL;
+    }
+
+    channel_t *ch = channel_lookup(id);
+    if (ch == NULL) {
+        return -EINVAL;
+    }
+
+    int64_t result;
+    if (ch->tgids[CHANNEL_END_PEER] != proc->tgid) {
+        result = -EPERM;
+    } else if (ch->flags & (CHANNEL_FLAG_ATTACHED | CHANNEL_FLAG_CLOSED(CHANNEL_END_PEER))) {
+        result = -EBUSY;
+    } else if (ch->flags & CHANNEL_FLAG_CLOSED(CHANNEL_END_CREATOR)) {
+        result = -EPIPE;
+    } else {
+        result = channel_map(ch, proc);
+        if (result >= 0) {
+            __atomic_fetch_or(&ch->flags, CHANNEL_FLAG_ATTACHED, __ATOMIC_RELEASE);
+        }
+    }
+
+    chan_unlock(&ch->lock);
+
+    if (result >= 0) {
+        kprintf("[CHAN] PID %u: attached channel %u at 0x%llx\n", proc->pid, id, (uint64_t)result);
+    }
+    return result;
+}
+
+/**
+ * Sleep until a ring word moves away from seen
+ * Called with the channel's lock held; drops it.
+ */
+static int64_t channel_wait(channel_t *ch, uint32_t ring, const volatile uint32_t *word,
+                            uint32_t seen) {
+    uint32_t event = __atomic_load_n(&ch->events[ring], __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != seen) {
+        chan_unlock(&ch->lock);
+        return 0;
+    }
+
+    chan_unlock(&ch->lock);
+
+    /* A notify or close since we read the event has bumped it already */
+    waitq_wait(&ch->events[ring], event);
+    return 0;
+}
+
+/**
+ * Wake everyone asleep on a ring
+ */
+static uint32_t channel_notify(channel_t *ch, uint32_t ring) {
+    __atomic_fetch_add(&ch->events[ring], 1, __ATOMIC_SEQ_CST);
+    return waitq_wake(&ch->events[ring], WAITQ_WAKE_ALL);
+}
+
+/**
+ * Pass a page of the caller's memory into one of its grant slots
+ */
+static int64_t channel_grant(channel_t *ch, int end, uint64_t slot, virtaddr_t addr) {
+    process_t *proc = process_get_current();
+
+    if (slot >= CHANNEL_GRANT_SLOTS || !IS_ALIGNED(addr, PAGE_SIZE) || addr >= VMA_USER_END) {
+        return -EINVAL;
+    }
+    if (ch->grants[end][slot] != 0) {
+        return -EBUSY;
+    }
+
+    vma_t *vma = vma_find(process_vmas(proc), addr);
+    if (vma == NULL || vma->start > addr) {
+        return -EFAULT;
+    }
+
+    /* Fault it in, then share it copy-on-write */
+    (void)*(const volatile uint8_t *)addr;
+    physaddr_t frame = vmm_share_user_page(vmm_get_current_address_space(), addr);
+    if (frame == 0) {
+        return -EFAULT;
+    }
+
+    ch->grants[end][slot] = frame;
+    total_grants++;
+    return 0;
+}
+
+/**
+ * Map a page the other end granted at an address of the caller
+ */
+static int64_t channel_take(channel_t *ch, int end, uint64_t slot, virtaddr_t addr) {
+    process_t *proc = process_get_current();
+    int from = 1 - end;
+
+    if (slot >= CHANNEL_GRANT_SLOTS || !IS_ALIGNED(addr, PAGE_SIZE) || addr >= VMA_USER_END) {
+        return -EINVAL;
+    }
+
+    physaddr_t frame = ch->grants[from][slot];
+    if (frame == 0) {
+        return -ENOENT;
+    }
+
+    vma_t *vma = vma_find(process_vmas(proc), addr);
+    if (vma == NULL || vma->start > addr || !(vma->flags & VMM_FLAG_WRITE)) {
+        return -EFAULT;
+    }
+
+    /* Read-only until the taker writes, if the granter still maps it */
+    uint64_t flags = vma->flags;
+    if (pmm_page_refcount(frame) > 1) {
+        flags = (flags & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+    }
+
+    /* The mapping takes a reference of its own; a failed map drops it */
+    if (!pmm_page_ref(frame) ||
+        !vmm_replace_user_page(vmm_get_current_address_space(), addr, frame, flags)) {
+        return -EFAULT;
+    }
+
+    ch->grants[from][slot] = 0;
+    pmm_page_unref(frame);
+    total_takes++;
+    return 0;
+}
+
+/**
+ * Sleep, wake, grant, take or close on a channel
+ */
+int64_t channel_op(uint32_t id, int op, uint64_t arg1, uint64_t arg2) {
+    process_t *proc = process_get_current();
+    if (proc == NULL) {
+        return -EINVAL;
+    }
+
+    channel_t *ch = channel_lookup(id);
+    if (ch == NULL) {
+        return -EINVAL;
+    }
+
+    int end = channel_end_of(ch, proc);
+    if (end < 0) {
+        chan_unlock(&ch->lock);
+        return -EPERM;
+    }
+
+    bool peer_closed = (ch->flags & CHANNEL_FLAG_CLOSED(1 - end)) != 0;
+    channel_header_t *hdr = channel_header(ch);
+    int64_t result;
+
+    switch (op) {
+        case CHANNEL_OP_WAIT_DATA:
+        case CHANNEL_OP_WAIT_ROOM:
+            if (arg1 > 1) {
+                result = -EINVAL;
+                break;
+            }
+            if (peer_closed) {
+                result = -EPIPE;
+                break;
+            }
+            return channel_wait(ch, (uint32_t)arg1,
+                                op == CHANNEL_OP_WAIT_DATA ? &hdr->rings[arg1].tail
+                                                           : &hdr->rings[arg1].head,
+                                (uint32_t)arg2);
+
+        case CHANNEL_OP_NOTIFY:
+            if (arg1 > 1) {
+                result = -EINVAL;
+                break;
+            }
+            chan_unlock(&ch->lock);
+            return channel_notify(ch, (uint32_t)arg1);
+
+        case CHANNEL_OP_GRANT:
+            result = peer_closed ? -EPIPE : channel_grant(ch, end, arg1, (virtaddr_t)arg2);
+            break;
+
+        case CHANNEL_OP_TAKE:
+            result = channel_take(ch, end, arg1, (virtaddr_t)arg2);
+            break;
+
+        case CHANNEL_OP_CLOSE: {
+            __atomic_fetch_or(&ch->flags, CHANNEL_FLAG_CLOSED(end), __ATOMIC_RELEASE);
+            __atomic_fetch_or(&hdr->closed, BIT(end), __ATOMIC_RELEASE);
+
+            /* Free it once no end can still reach it */
+            bool gone = peer_closed || !(ch->flags & CHANNEL_FLAG_ATTACHED);
+            if (gone) {
+                channel_free(ch);
+            }
+            chan_unlock(&ch->lock);
+
+            channel_notify(ch, 0);
+            channel_notify(ch, 1);
+
+            kprintf("[CHAN] PID %u: closed end %d of channel %u%s\n",
+                    proc->pid, end, id, gone ? " (freed)" : "");
+            return 0;
+        }
+
+        default:
+            result = -EINVAL;
+            break;
+    }
+
+    chan_unlock(&ch->lock);
+    return result;
+}
+
+/**
+ * Dump channel statistics
+ */
+void channel_dump_stats(void) {
+    kprintf("[CHAN] ========== Channel Statistics ==========\n");
+    kprintf("[CHAN] Total created:   %llu\n", total_channels_created);
+    kprintf("[CHAN] Pages granted:   %llu\n", total_grants);
+    kprintf("[CHAN] Pages taken:     %llu\n", total_takes);
+
+    uint32_t active = 0;
+    for (uint32_t i = 0; i < CHANNEL_MAX_COUNT; i++) {
+        channel_t *ch = &channel_table[i];
+        if (!(ch->flags & CHANNEL_FLAG_VALID)) {
+            continue;
+        }
+        active++;
+        kprintf("[CHAN] Channel %u: groups %u <-> %u, %u entries, %u data pages%s%s\n",
+                ch->id, ch->tgids[CHANNEL_END_CREATOR], ch->tgids[CHANNEL_END_PEER],
+                ch->entries, ch->data_pages,
+                (ch->flags & CHANNEL_FLAG_ATTACHED) ? "" : ", unattached",
+                (ch->flags & (CHANNEL_FLAG_CLOSED(0) | CHANNEL_FLAG_CLOSED(1))) ? ", half closed" : "");
+    }
+
+    kprintf("[CHAN] Active:          %u\n", active);
+    kprintf("[CHAN] ========================================\n");
+}
@@ -0,0 +1,168 @@
+/**
+ * AAAos Kernel - Shared-Memory Message Channels
+ *
+ * A channel is one region of memory mapped into two processes: the one
+ * that creates it (end 0) and the peer it names, once the peer attaches
+ * (end 1). The region holds two single-producer/single-consumer rings of
+ * descriptors, ring 0 carrying end 0 to end 1 and ring 1 the other way,
+ * and a data area for each direction. Payloads are written straight into
+ * the data area and described by a descriptor, so nothing is copied by
+ * the kernel and their size is bounded only by the area.
+ *
+ * The rings are lock-free: a producer fills the descriptor at tail and
+ * then advances tail with a release store; the consumer reads up to tail
+ * with an acquire load and advances head. tail and head live on their own
+ * cache lines. The kernel is only entered to sleep and to wake:
+ *
+ *   consumer (ring empty)                 producer
+ *   consumer_waiting = 1                  fill descriptor, advance tail
+ *   if tail is still the one seen:        if consumer_waiting:
+ *       SYS_CHANNEL_OP(WAIT_DATA, tail)       SYS_CHANNEL_OP(NOTIFY)
+ *   consumer_waiting = 0
+ *
+ * (with sequentially consistent stores and loads of tail and the waiting
+ * word), and the same with head and producer_waiting for a full ring.
+ * A wait returns at once if the word already differs from the value
+ * given, so a notify cannot be missed between the check and the sleep.
+ *
+ * Grants pass page-sized buffers by reference: the sender grants a page
+ * of its memory into one of its grant slots (copy-on-write, so it may
+ * keep using it) and posts a CHANNEL_DESC_GRANT naming the slot; the
+ * receiver takes the slot, which maps the page at an address of its own.
+ *
+ * msg_send (message.h) remains the way to pass small control messages,
+ * for example to tell a peer a channel's ID.
+ */
+
+#ifndef _AAAOS_IPC_CHANNEL_H
+#define _AAAOS_IPC_CHANNEL_H
+
+#include "../include/types.h"
+
+/* Channel configuration */
+#define CHANNEL_MAX_COUNT       32      /* Maximum number of channels */
+#define CHANNEL_MIN_ENTRIES     8       /* Ring size limits (rounded up to a power of two) */
+#define CHANNEL_MAX_ENTRIES     256
+#define CHANNEL_MAX_DATA_PAGES  256     /* Data area per direction (1MB) */
+#define CHANNEL_GRANT_SLOTS     16      /* Pages each end can have granted at once */
+
+#define CHANNEL_MAGIC           0x4E414843  /* "CHAN" */
+
+/* Ends (and the ring each end produces on) */
+#define CHANNEL_END_CREATOR     0
+#define CHANNEL_END_PEER        1
+
+/* Descriptor types (channel_desc_t.type) */
+#define CHANNEL_DESC_DATA       0       /* offset = byte offset in the data area */
+#define CHANNEL_DESC_GRANT      1       /* offset = sender's grant slot */
+
+/* SYS_CHANNEL_OP operations */
+#define CHANNEL_OP_WAIT_DATA    0       /* arg1 = ring, arg2 = tail seen: sleep while unchanged */
+#define CHANNEL_OP_WAIT_ROOM    1       /* arg1 = ring, arg2 = head seen: sleep while unchanged */
+#define CHANNEL_OP_NOTIFY       2       /* arg1 = ring: wake its sleepers */
+#define CHANNEL_OP_GRANT        3       /* arg1 = slot, arg2 = page-aligned address to grant */
+#define CHANNEL_OP_TAKE         4       /* arg1 = peer's slot, arg2 = page-aligned address to map at */
+#define CHANNEL_OP_CLOSE        5       /* Close the caller's end */
+
+/* channel_t.flags */
+#define CHANNEL_FLAG_VALID      BIT(0)
+#define CHANNEL_FLAG_ATTACHED   BIT(1)  /* The peer has mapped its end */
+#define CHANNEL_FLAG_CLOSED(e)  BIT(2 + (e))
+
+/**
+ * Descriptor (written by the producing end)
+ */
+typedef struct channel_desc {
+    uint32_t type;                      /* CHANNEL_DESC_* */
+    uint32_t length;                    /* Payload bytes */
+    uint64_t offset;                    /* Data area offset or grant slot */
+    uint64_t tag;                       /* Free for the protocol */
+    uint64_t reserved;
+} channel_desc_t;
+
+/**
+ * One direction of a channel
+ * The producer writes tail and the consumer head; each sets its waiting
+ * word before sleeping so the other side knows to notify.
+ */
+typedef struct channel_ring {
+    /* Producer's cache line */
+    volatile uint32_t tail;             /* Next descriptor the producer fills */
+    volatile uint32_t consumer_waiting; /* Consumer sleeps until tail moves */
+    uint32_t desc_offset;               /* Byte offset of the descriptor array */
+    uint32_t data_offset;               /* Byte offset of this direction's data area */
+    uint32_t data_size;                 /* Bytes in the data area */
+    uint8_t reserved0[44];
+
+    /* Consumer's cache line */
+    volatile uint32_t head;             /* Next descriptor the consumer reads */
+    volatile uint32_t producer_waiting; /* Producer sleeps until head moves */
+    uint8_t reserved1[56];
+} ALIGNED(64) channel_ring_t;
+
+/**
+ * Channel header at the start of the region
+ * The kernel keeps its own copy of the layout and ignores the one here.
+ */
+typedef struct channel_header {
+    uint32_t magic;                     /* CHANNEL_MAGIC */
+    uint32_t id;                        /* Channel ID */
+    uint32_t entries;                   /* Descriptors per ring */
+    uint32_t grant_slots;               /* CHANNEL_GRANT_SLOTS */
+    volatile uint32_t closed;           /* BIT(end) once that end has closed */
+    uint8_t reserved[44];
+    channel_ring_t rings[2];
+} ALIGNED(64) channel_header_t;
+
+/**
+ * Kernel state of a channel
+ */
+typedef struct channel {
+    uint32_t id;
+    volatile uint32_t flags;            /* CHANNEL_FLAG_* */
+    uint32_t tgids[2];                  /* Thread group of each end */
+    uint32_t entries;
+    uint32_t data_pages;
+    size_t pages;                       /* Pages in the region */
+    physaddr_t *frames;                 /* The region's frames (one reference each) */
+    physaddr_t grants[2][CHANNEL_GRANT_SLOTS];  /* Granted frames, by granting end */
+    volatile uint32_t events[2];        /* Wait queue words, bumped by notify and close */
+    volatile int lock;
+} channel_t;
+
+/**
+ * Initialize the channel subsystem
+ */
+void channel_init(void);
+
+/**
+ * Create a channel to another process and map it into the caller
+ * @param peer_pid Process allowed to attach the other end
+ * @param entries Requested descriptors per ring
+ * @param data_pages Pages of data area per direction (0 for descriptors only)
+ * @return User address of the header, or negative error code
+ */
+int64_t channel_create(uint32_t peer_pid, uint32_t entries, uint32_t data_pages);
+
+/**
+ * Map the peer end of a channel into the caller
+ * @param id Channel ID (channel_header_t.id)
+ * @return User address of the header, or negative error code
+ */
+int64_t channel_attach(uint32_t id);
+
+/**
+ * Sleep, wake, grant, take or close on a channel the caller is an end of
+ * @param id Channel ID
+ * @param op CHANNEL_OP_*
+ * @return 0 or a non-negative result, or negative error code
+ *         (-EPIPE once the other end has closed)
+ */
+int64_t channel_op(uint32_t id, int op, uint64_t arg1, uint64_t arg2);
+
+/**
+ * Dump channel statistics (for debugging)
+ */
+void channel_dump_stats(void);
+
+#endif /* _AAAOS_IPC_CHANNEL_H */
@@ -3,143 +3,218 @@
  *
  * Implements message-based IPC with per-process message queues.
  * Supports blocking and non-blocking receive operations.
+ *
+ * Nothing on the send and receive paths is shared between unrelated
+ * process pairs: free messages come from a per-CPU cache refilled in
+ * batches from the global pool, IDs and statistics are per CPU, and a
+ * queue's lock only covers linking a message in or out. Payloads are
+ * copied outside the lock, as a message belongs to one side at a time.
  */
 
 #include "message.h"
 #include "../include/serial.h"
+#include "../arch/x86_64/include/percpu.h"
 #include "../proc/process.h"
+#include "../sched/clock.h"
+#include "../sched/waitq.h"
+#include "../stats/kstat.h"
+#include "../../lib/libc/string.h"
+
+/* Per-CPU free message caches */
+#define MSG_PCP_BATCH           8       /* Messages moved per refill/drain */
+#define MSG_PCP_HIGH            32      /* Cache capacity */
+
+typedef struct {
+    volatile int lock;                  /* Owner/drain exclusion, never spun on */
+    message_t *free;
+    uint32_t count;
+    uint32_t next_seq;                  /* Source of this CPU's message IDs */
+    uint64_t sent;
+    uint64_t received;
+    uint64_t bytes_sent;
+} ALIGNED(64) msg_pcp_t;
+
+static msg_pcp_t msg_pcp[PERCPU_MAX_CPUS];
 
 /* Message pool - statically allocated */
 static message_t message_pool[MSG_POOL_SIZE];
 
-/* Free message list */
+/* Free message list (messages not in any CPU's cache) */
 static message_t *free_messages = NULL;
+static uint32_t free_message_count = 0;
 
 /* Per-process message queues */
 /* Index by PID (simple approach for now) */
 static msg_queue_t msg_queues[PROCESS_MAX_COUNT];
 
-/* Global message subsystem lock */
-static volatile int msg_subsystem_lock = 0;
-
-/* Next message ID */
-static uint32_t next_msg_id = 1;
+/* Global message subsystem lock (pool and initialization) */
+SPINLOCK_DEFINE(msg_subsystem_lock, "ipc.msg");
 
-/* Simple tick counter for timestamps (should come from timer in real implementation) */
-static uint64_t msg_tick_counter = 0;
+/* Broadcast subscribers, by PID */
+static uint32_t msg_subscribers[MSG_MAX_SUBSCRIBERS];
+static uint32_t msg_subscriber_count = 0;
+SPINLOCK_DEFINE(msg_subscriber_lock, "ipc.msg.subscribers");
 
-/* Statistics */
-static uint64_t total_messages_sent = 0;
-static uint64_t total_messages_received = 0;
-static uint64_t total_bytes_sent = 0;
+/* Class of the per-process queue locks */
+LOCK_CLASS(msg_queue, "ipc.msg.queue");
 
 /**
- * Acquire a spinlock
+ * Lock the calling CPU's cache
+ * A process preempted while holding it and resumed elsewhere makes the
+ * lock contended; callers then take the global path instead of spinning.
  */
-static inline void spinlock_acquire(volatile int *lock) {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        __asm__ __volatile__("pause");
+static msg_pcp_t *pcp_lock_local(void) {
+    uint32_t cpu = percpu_cpu_id();
+    if (cpu >= PERCPU_MAX_CPUS) {
+        return NULL;
     }
+
+    msg_pcp_t *pcp = &msg_pcp[cpu];
+    return __sync_lock_test_and_set(&pcp->lock, 1) == 0 ? pcp : NULL;
+}
+
+static inline void pcp_unlock(msg_pcp_t *pcp) {
+    __sync_lock_release(&pcp->lock);
 }
 
 /**
- * Release a spinlock
+ * Statistics of the calling CPU (counted atomically, as a process may
+ * move between reading the CPU and counting)
  */
-static inline void spinlock_release(volatile int *lock) {
-    __sync_lock_release(lock);
+static inline msg_pcp_t *pcp_stats(void) {
+    uint32_t cpu = percpu_cpu_id();
+    return &msg_pcp[cpu < PERCPU_MAX_CPUS ? cpu : 0];
 }
 
 /**
- * Simple memcpy implementation
+ * Take a message from the global pool
  */
-static void *kmemcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
+static message_t* pool_alloc(void) {
+    spinlock_acquire(&msg_subsystem_lock);
+
+    message_t *msg = free_messages;
+    if (msg) {
+        free_messages = msg->next;
+        free_message_count--;
     }
-    return dest;
+
+    spinlock_release(&msg_subsystem_lock);
+    return msg;
 }
 
 /**
- * Simple memset implementation
+ * Return a message to the global pool
  */
-static void *kmemset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-    while (n--) {
-        *p++ = (uint8_t)c;
-    }
-    return s;
+static void pool_free(message_t *msg) {
+    spinlock_acquire(&msg_subsystem_lock);
+
+    msg->next = free_messages;
+    free_messages = msg;
+    free_message_count++;
+
+    spinlock_release(&msg_subsystem_lock);
 }
 
 /**
- * Allocate a message from the pool
+ * Allocate a message, from the calling CPU's cache when possible
  */
 static message_t* msg_alloc(void) {
-    spinlock_acquire(&msg_subsystem_lock);
+    msg_pcp_t *pcp = pcp_lock_local();
+    if (!pcp) {
+        return pool_alloc();
+    }
 
-    message_t *msg = free_messages;
-    if (msg) {
-        free_messages = msg->next;
-        msg->next = NULL;
+    if (pcp->count == 0) {
+        /* Refill a batch under one hold of the global lock */
+        spinlock_acquire(&msg_subsystem_lock);
+        while (pcp->count < MSG_PCP_BATCH && free_messages) {
+            message_t *m = free_messages;
+            free_messages = m->next;
+            free_message_count--;
+            m->next = pcp->free;
+            pcp->free = m;
+            pcp->count++;
+        }
+        spinlock_release(&msg_subsystem_lock);
     }
 
-    spinlock_release(&msg_subsystem_lock);
+    message_t *msg = pcp->free;
+    if (msg) {
+        pcp->free = msg->next;
+        pcp->count--;
+    }
 
+    pcp_unlock(pcp);
     return msg;
 }
 
 /**
- * Return a message to the pool
+ * Free a message into the calling CPU's cache
  */
 static void msg_free(message_t *msg) {
     if (!msg) return;
 
-    spinlock_acquire(&msg_subsystem_lock);
+    msg_pcp_t *pcp = pcp_lock_local();
+    if (!pcp) {
+        pool_free(msg);
+        return;
+    }
 
-    /* Clear the message */
-    kmemset(msg, 0, sizeof(message_t));
+    msg->next = pcp->free;
+    pcp->free = msg;
+    pcp->count++;
+
+    if (pcp->count > MSG_PCP_HIGH) {
+        /* Hand a batch back so other CPUs' senders can have it */
+        spinlock_acquire(&msg_subsystem_lock);
+        for (uint32_t i = 0; i < MSG_PCP_BATCH; i++) {
+            message_t *m = pcp->free;
+            pcp->free = m->next;
+            pcp->count--;
+            m->next = free_messages;
+            free_messages = m;
+            free_message_count++;
+        }
+        spinlock_release(&msg_subsystem_lock);
+    }
 
-    /* Add to free list */
-    msg->next = free_messages;
-    free_messages = msg;
+    pcp_unlock(pcp);
+}
 
-    spinlock_release(&msg_subsystem_lock);
+/**
+ * Unique message ID (per-CPU sequence, CPU number in the low bits)
+ */
+static uint32_t msg_next_id(void) {
+    uint32_t cpu = percpu_cpu_id();
+    if (cpu >= PERCPU_MAX_CPUS) {
+        cpu = 0;
+    }
+    uint32_t seq = __atomic_add_fetch(&msg_pcp[cpu].next_seq, 1, __ATOMIC_RELAXED);
+    return seq * PERCPU_MAX_CPUS + cpu;
 }
 
 /**
  * Block current process waiting for message
+ * Called with the queue lock held; drops it while asleep. Sleeps on the
+ * message count, so a send after the lock is dropped is not missed.
  */
 static void msg_block_receiver(msg_queue_t *queue) {
-    process_t *current = process_get_current();
-    if (!current) return;
+    queue->waiter_count++;
+    spinlock_release(&queue->lock);
 
-    if (queue->waiter_count < 8) {
-        queue->waiters[queue->waiter_count++] = current;
-        process_set_state(current, PROCESS_STATE_BLOCKED);
-        kprintf("[MSG] Process '%s' (PID %u) blocked waiting for message\n",
-                current->name, current->pid);
-    }
+    waitq_wait(&queue->count, 0);
+
+    spinlock_acquire(&queue->lock);
+    queue->waiter_count--;
 }
 
 /**
  * Wake one process waiting for messages
+ * Called with the queue lock held, after count has gone up.
  */
 static void msg_wake_receiver(msg_queue_t *queue) {
     if (queue->waiter_count > 0) {
-        process_t *proc = queue->waiters[0];
-        /* Shift remaining waiters */
-        for (uint32_t i = 0; i < queue->waiter_count - 1; i++) {
-            queue->waiters[i] = queue->waiters[i + 1];
-        }
-        queue->waiter_count--;
-        queue->waiters[queue->waiter_count] = NULL;
-
-        if (proc) {
-            process_set_state(proc, PROCESS_STATE_READY);
-            kprintf("[MSG] Woke process '%s' (PID %u) - message available\n",
-                    proc->name, proc->pid);
-        }
+        waitq_wake(&queue->count, 1);
     }
 }
 
@@ -154,10 +229,16 @@ void msg_init(void) {
     /* Initialize message pool as free list */
     free_messages = NULL;
     for (int i = MSG_POOL_SIZE - 1; i >= 0; i--) {
-        kmemset(&message_pool[i], 0, sizeof(message_t));
         message_pool[i].next = free_messages;
         free_messages = &message_pool[i];
     }
+    free_message_count = MSG_POOL_SIZE;
+
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        msg_pcp[cpu].lock = 0;
+        msg_pcp[cpu].free = NULL;
+        msg_pcp[cpu].count = 0;
+    }
 
     kprintf("[MSG] Message pool initialized (%u messages, %u bytes each)\n",
             MSG_POOL_SIZE, (uint32_t)sizeof(message_t));
@@ -169,10 +250,8 @@ void msg_init(void) {
         msg_queues[i].count = 0;
         msg_queues[i].owner_pid = i;  /* Queue index == PID */
         msg_queues[i].waiter_count = 0;
-        msg_queues[i].lock = 0;
-        for (int j = 0; j < 8; j++) {
-            msg_queues[i].waiters[j] = NULL;
-        }
+        poll_source_init(&msg_queues[i].poll);
+        spinlock_init(&msg_queues[i].lock, LOCK_CLASS_OF(msg_queue));
     }
 
     kprintf("[MSG] Message queues initialized (%u queues)\n", PROCESS_MAX_COUNT);
@@ -190,6 +269,18 @@ msg_queue_t* msg_get_queue(uint32_t pid) {
     return &msg_queues[pid];
 }
 
+/**
+ * Readiness source of a process's message queue
+ */
+poll_source_t* msg_poll_source(uint32_t pid, uint32_t *ready) {
+    msg_queue_t *queue = msg_get_queue(pid);
+    if (!queue) return NULL;
+    if (ready) {
+        *ready = __atomic_load_n(&queue->count, __ATOMIC_ACQUIRE) > 0 ? POLL_IN : 0;
+    }
+    return &queue->poll;
+}
+
 /**
  * Send a message to a process
  */
@@ -230,11 +321,8 @@ int msg_send_flags(uint32_t dest_pid, const void *msg, size_t len, uint32_t flag
         return MSG_ERR_INVALID_PID;
     }
 
-    spinlock_acquire(&queue->lock);
-
-    /* Check if queue is full */
+    /* Fail early without touching the pool; re-checked under the lock */
     if (queue->count >= MSG_QUEUE_SIZE) {
-        spinlock_release(&queue->lock);
         kprintf("[MSG] Error: Queue full for PID %u (%u messages)\n",
                 dest_pid, queue->count);
         return MSG_ERR_QUEUE_FULL;
@@ -243,22 +331,33 @@ int msg_send_flags(uint32_t dest_pid, const void *msg, size_t len, uint32_t flag
     /* Allocate a message */
     message_t *new_msg = msg_alloc();
     if (!new_msg) {
-        spinlock_release(&queue->lock);
         kprintf("[MSG] Error: No free message slots\n");
         return MSG_ERR_NO_MEMORY;
     }
 
-    /* Fill in the message */
+    /* Fill in the message while no one else can see it */
+    uint32_t msg_id = msg_next_id();
     new_msg->src_pid = src_pid;
     new_msg->dest_pid = dest_pid;
     new_msg->flags = flags;
-    new_msg->msg_id = next_msg_id++;
+    new_msg->msg_id = msg_id;
     new_msg->length = len;
-    new_msg->timestamp = msg_tick_counter++;
+    new_msg->timestamp = clock_monotonic_ns();
     new_msg->next = NULL;
 
     /* Copy payload */
-    kmemcpy(new_msg->data, msg, len);
+    memcpy(new_msg->data, msg, len);
+
+    spinlock_acquire(&queue->lock);
+
+    /* Check if queue is full */
+    if (queue->count >= MSG_QUEUE_SIZE) {
+        spinlock_release(&queue->lock);
+        msg_free(new_msg);
+        kprintf("[MSG] Error: Queue full for PID %u (%u messages)\n",
+                dest_pid, (uint32_t)MSG_QUEUE_SIZE);
+        return MSG_ERR_QUEUE_FULL;
+    }
 
     /* Add to queue */
     if (queue->tail) {
@@ -269,16 +368,21 @@ int msg_send_flags(uint32_t dest_pid, const void *msg, size_t len, uint32_t flag
     queue->tail = new_msg;
     queue->count++;
 
-    total_messages_sent++;
-    total_bytes_sent += len;
-
     /* Wake a waiting receiver */
     msg_wake_receiver(queue);
 
     spinlock_release(&queue->lock);
 
+    poll_notify(&queue->poll, POLL_IN);
+
+    msg_pcp_t *stats = pcp_stats();
+    __atomic_fetch_add(&stats->sent, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes_sent, len, __ATOMIC_RELAXED);
+
+#ifdef MSG_DEBUG_TRACE
     kprintf("[MSG] Sent message %u from PID %u to PID %u (%llu bytes)\n",
-            new_msg->msg_id, src_pid, dest_pid, (uint64_t)len);
+            msg_id, src_pid, dest_pid, (uint64_t)len);
+#endif
 
     return MSG_SUCCESS;
 }
@@ -315,12 +419,6 @@ static ssize_t msg_receive_internal(void *buf, size_t max_len, uint32_t *src_pid
 
         /* Block the current process */
         msg_block_receiver(queue);
-        spinlock_release(&queue->lock);
-
-        /* Yield to scheduler */
-        __asm__ __volatile__("pause");
-
-        spinlock_acquire(&queue->lock);
     }
 
     /* Dequeue the message */
@@ -331,27 +429,26 @@ static ssize_t msg_receive_internal(void *buf, size_t max_len, uint32_t *src_pid
     }
     queue->count--;
 
-    /* Copy data to buffer */
+    spinlock_release(&queue->lock);
+
+    /* The message is ours alone now */
     size_t copy_len = MIN(msg->length, max_len);
-    kmemcpy(buf, msg->data, copy_len);
+    memcpy(buf, msg->data, copy_len);
 
     /* Return source PID if requested */
     if (src_pid) {
         *src_pid = msg->src_pid;
     }
 
-    uint32_t msg_id = msg->msg_id;
-    uint32_t sender = msg->src_pid;
+#ifdef MSG_DEBUG_TRACE
+    kprintf("[MSG] Received message %u from PID %u (%llu bytes)\n",
+            msg->msg_id, msg->src_pid, (uint64_t)copy_len);
+#endif
 
     /* Free the message */
     msg_free(msg);
 
-    total_messages_received++;
-
-    spinlock_release(&queue->lock);
-
-    kprintf("[MSG] Received message %u from PID %u (%llu bytes)\n",
-            msg_id, sender, (uint64_t)copy_len);
+    __atomic_fetch_add(&pcp_stats()->received, 1, __ATOMIC_RELAXED);
 
     return (ssize_t)copy_len;
 }
@@ -422,7 +519,7 @@ ssize_t msg_peek(void *buf, size_t max_len) {
 
     message_t *msg = queue->head;
     size_t copy_len = MIN(msg->length, max_len);
-    kmemcpy(buf, msg->data, copy_len);
+    memcpy(buf, msg->data, copy_len);
 
     spinlock_release(&queue->lock);
 
@@ -437,7 +534,62 @@ int msg_reply(uint32_t original_src_pid, const void *reply, size_t len) {
 }
 
 /**
- * Broadcast a message to all processes
+ * Subscribe the current process to broadcasts
+ */
+int msg_subscribe(void) {
+    process_t *current = process_get_current();
+    if (!current) return MSG_ERR_NO_PROCESS;
+
+    int result = MSG_SUCCESS;
+
+    spinlock_acquire(&msg_subscriber_lock);
+
+    for (uint32_t i = 0; i < msg_subscriber_count; i++) {
+        if (msg_subscribers[i] == current->pid) {
+            spinlock_release(&msg_subscriber_lock);
+            return MSG_SUCCESS;
+        }
+    }
+
+    if (msg_subscriber_count < MSG_MAX_SUBSCRIBERS) {
+        msg_subscribers[msg_subscriber_count++] = current->pid;
+    } else {
+        result = MSG_ERR_NO_MEMORY;
+    }
+
+    spinlock_release(&msg_subscriber_lock);
+    return result;
+}
+
+/**
+ * Remove a PID from the subscriber list
+ */
+static void msg_remove_subscriber(uint32_t pid) {
+    spinlock_acquire(&msg_subscriber_lock);
+
+    for (uint32_t i = 0; i < msg_subscriber_count; i++) {
+        if (msg_subscribers[i] == pid) {
+            msg_subscribers[i] = msg_subscribers[--msg_subscriber_count];
+            break;
+        }
+    }
+
+    spinlock_release(&msg_subscriber_lock);
+}
+
+/**
+ * Unsubscribe the current process from broadcasts
+ */
+int msg_unsubscribe(void) {
+    process_t *current = process_get_current();
+    if (!current) return MSG_ERR_NO_PROCESS;
+
+    msg_remove_subscriber(current->pid);
+    return MSG_SUCCESS;
+}
+
+/**
+ * Broadcast a message to all subscribers
  */
 int msg_broadcast(const void *msg, size_t len) {
     if (!msg || len > MSG_MAX_SIZE) {
@@ -447,52 +599,104 @@ int msg_broadcast(const void *msg, size_t len) {
     process_t *current = process_get_current();
     uint32_t src_pid = current ? current->pid : 0;
 
-    int recipients = 0;
+    /* Send from a snapshot, so subscribing is never held up by the sends */
+    uint32_t targets[MSG_MAX_SUBSCRIBERS];
+    uint32_t count;
 
-    kprintf("[MSG] Broadcasting message (%llu bytes) from PID %u\n",
-            (uint64_t)len, src_pid);
+    spinlock_acquire(&msg_subscriber_lock);
+    count = msg_subscriber_count;
+    for (uint32_t i = 0; i < count; i++) {
+        targets[i] = msg_subscribers[i];
+    }
+    spinlock_release(&msg_subscriber_lock);
 
-    for (uint32_t pid = 1; pid < PROCESS_MAX_COUNT; pid++) {
+    int recipients = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t pid = targets[i];
         if (pid == src_pid) continue;  /* Don't send to self */
 
         process_t *proc = process_get_by_pid(pid);
-        if (proc && proc->state != PROCESS_STATE_INVALID &&
-            proc->state != PROCESS_STATE_TERMINATED) {
-            int result = msg_send_flags(pid, msg, len, MSG_FLAG_BROADCAST);
-            if (result == MSG_SUCCESS) {
-                recipients++;
-            }
+        if (!proc || proc->state == PROCESS_STATE_INVALID ||
+            proc->state == PROCESS_STATE_TERMINATED) {
+            /* Gone without unsubscribing */
+            msg_remove_subscriber(pid);
+            continue;
+        }
+
+        if (msg_send_flags(pid, msg, len, MSG_FLAG_BROADCAST) == MSG_SUCCESS) {
+            recipients++;
         }
     }
 
-    kprintf("[MSG] Broadcast complete: %d recipients\n", recipients);
+#ifdef MSG_DEBUG_TRACE
+    kprintf("[MSG] Broadcast from PID %u (%llu bytes): %d recipients\n",
+            src_pid, (uint64_t)len, recipients);
+#endif
 
     return recipients;
 }
 
+/**
+ * Sum one per-CPU message counter
+ */
+static uint64_t msg_sum(size_t offset) {
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        const uint64_t *field = (const uint64_t *)((const uint8_t *)&msg_pcp[cpu] + offset);
+        total += __atomic_load_n(field, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+static uint64_t msg_sent(void) {
+    return msg_sum(__builtin_offsetof(msg_pcp_t, sent));
+}
+
+static uint64_t msg_received(void) {
+    return msg_sum(__builtin_offsetof(msg_pcp_t, received));
+}
+
+static uint64_t msg_bytes_sent(void) {
+    return msg_sum(__builtin_offsetof(msg_pcp_t, bytes_sent));
+}
+
+static uint64_t msg_pool_free(void) {
+    return free_message_count;
+}
+
+KSTAT_GAUGE(msg_sent, "ipc.msg.sent", "Messages sent", msg_sent);
+KSTAT_GAUGE(msg_received, "ipc.msg.received", "Messages received", msg_received);
+KSTAT_GAUGE(msg_bytes_sent, "ipc.msg.bytes_sent", "Message bytes sent", msg_bytes_sent);
+KSTAT_GAUGE(msg_pool_free, "ipc.msg.free", "Messages free in the pool (not in CPU caches)",
+            msg_pool_free);
+
 /**
  * Dump message statistics
  */
 void msg_dump_stats(void) {
+    uint64_t sent = msg_sent(), received = msg_received(), bytes_sent = msg_bytes_sent();
+    uint32_t cached = 0;
+
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        cached += msg_pcp[cpu].count;
+    }
+
     kprintf("[MSG] ========== Message Statistics ==========\n");
-    kprintf("[MSG] Total messages sent:     %llu\n", total_messages_sent);
-    kprintf("[MSG] Total messages received: %llu\n", total_messages_received);
-    kprintf("[MSG] Total bytes sent:        %llu\n", total_bytes_sent);
+    kprintf("[MSG] Total messages sent:     %llu\n", sent);
+    kprintf("[MSG] Total messages received: %llu\n", received);
+    kprintf("[MSG] Total bytes sent:        %llu\n", bytes_sent);
     kprintf("[MSG] Message pool size:       %u\n", MSG_POOL_SIZE);
     kprintf("[MSG] Max message size:        %u bytes\n", MSG_MAX_SIZE);
     kprintf("[MSG] Queue size per process:  %u messages\n", MSG_QUEUE_SIZE);
     kprintf("[MSG] ----------------------------------\n");
 
-    /* Count free messages */
-    uint32_t free_count = 0;
-    spinlock_acquire(&msg_subsystem_lock);
-    for (message_t *m = free_messages; m; m = m->next) {
-        free_count++;
-    }
-    spinlock_release(&msg_subsystem_lock);
+    /* Free messages (approximate while CPUs are active) */
+    uint32_t free_count = free_message_count;
 
-    kprintf("[MSG] Free messages:           %u\n", free_count);
-    kprintf("[MSG] Used messages:           %u\n", MSG_POOL_SIZE - free_count);
+    kprintf("[MSG] Free messages:           %u (+%u in CPU caches)\n", free_count, cached);
+    kprintf("[MSG] Used messages:           %u\n", MSG_POOL_SIZE - free_count - cached);
+    kprintf("[MSG] Broadcast subscribers:   %u\n", msg_subscriber_count);
 
     /* Show non-empty queues */
     kprintf("[MSG] ----------------------------------\n");
@@ -3,17 +3,22 @@
  *
  * Provides message-based inter-process communication.
  * Each process has a message queue for receiving messages.
+ * Messages are copied through a kernel pool and suit small control
+ * traffic; bulk data goes over a shared-memory channel (channel.h).
  */
 
 #ifndef _AAAOS_IPC_MESSAGE_H
 #define _AAAOS_IPC_MESSAGE_H
 
 #include "../include/types.h"
+#include "poll.h"
+#include "../sched/spinlock.h"
 
 /* Message configuration */
 #define MSG_MAX_SIZE            256     /* Maximum message payload size */
 #define MSG_QUEUE_SIZE          32      /* Messages per process queue */
 #define MSG_POOL_SIZE           512     /* Total message pool size */
+#define MSG_MAX_SUBSCRIBERS     64      /* Processes receiving broadcasts */
 
 /* Message flags */
 #define MSG_FLAG_URGENT         BIT(0)  /* High priority message */
@@ -52,11 +57,11 @@ typedef struct message {
 typedef struct msg_queue {
     message_t *head;                    /* First message in queue */
     message_t *tail;                    /* Last message in queue */
-    uint32_t count;                     /* Number of messages */
+    volatile uint32_t count;            /* Number of messages (receivers sleep on it) */
     uint32_t owner_pid;                 /* Process that owns this queue */
-    struct process *waiters[8];         /* Processes waiting for messages */
-    uint32_t waiter_count;              /* Number of waiting processes */
-    volatile int lock;                  /* Spinlock for queue access */
+    uint32_t waiter_count;              /* Receivers asleep on an empty queue */
+    poll_source_t poll;                 /* POLL_IN on each send (poll.h) */
+    spinlock_t lock;                    /* Spinlock for queue access */
 } msg_queue_t;
 
 /**
@@ -138,6 +143,14 @@ ssize_t msg_peek(void *buf, size_t max_len);
  */
 msg_queue_t* msg_get_queue(uint32_t pid);
 
+/**
+ * Readiness source of a process's message queue
+ * @param pid Process ID
+ * @param ready Set to POLL_IN if messages are queued, else 0
+ * @return The source, or NULL if invalid
+ */
+poll_source_t* msg_poll_source(uint32_t pid, uint32_t *ready);
+
 /**
  * Reply to a message
  * @param original_src_pid PID of original message sender
@@ -148,7 +161,20 @@ msg_queue_t* msg_get_queue(uint32_t pid);
 int msg_reply(uint32_t original_src_pid, const void *reply, size_t len);
 
 /**
- * Broadcast a message to all processes
+ * Subscribe the current process to broadcasts
+ * @return MSG_SUCCESS, or MSG_ERR_NO_MEMORY if the subscriber list is full
+ */
+int msg_subscribe(void);
+
+/**
+ * Unsubscribe the current process from broadcasts
+ * @return MSG_SUCCESS on success, negative error code on failure
+ */
+int msg_unsubscribe(void);
+
+/**
+ * Broadcast a message to every subscribed process but the sender
+ * Subscribers that have exited are dropped from the list.
  * @param msg Pointer to message data
  * @param len Length of message
  * @return Number of processes that received the message
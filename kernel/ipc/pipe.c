@@ -1,13 +1,27 @@
 /**
  * AAAos Kernel - Unix-style Pipes Implementation
  *
- * Implements unidirectional byte streams using circular buffers.
+ * Implements unidirectional byte streams over rings of page references.
  * Supports blocking I/O with process waiting.
+ *
+ * Slot pages are touched only under the pipe lock. A page shared in by
+ * pipe_vmsplice_write is never appended to, and one handed out by
+ * pipe_vmsplice_read leaves the ring before the lock is dropped, so the
+ * pipe never writes a page anyone else can see.
  */
 
 #include "pipe.h"
 #include "../include/serial.h"
+#include "../mm/pmm.h"
+#include "../mm/vma.h"
+#include "../mm/vmm.h"
 #include "../proc/process.h"
+#include "../proc/fdtable.h"
+#include "../sched/waitq.h"
+#include "../stats/kstat.h"
+
+_Static_assert((PIPE_MAX_PAGES & (PIPE_MAX_PAGES - 1)) == 0, "pipe_slot masks the ring index");
+_Static_assert(PAGE_SIZE <= UINT16_MAX + 1, "pipe_buf_t offsets are 16-bit");
 
 /* Pipe table - statically allocated */
 static pipe_t pipe_table[PIPE_MAX_COUNT];
@@ -15,139 +29,373 @@ static pipe_t pipe_table[PIPE_MAX_COUNT];
 /* Next available pipe ID */
 static uint32_t next_pipe_id = 1;
 
-/* File descriptor to pipe mapping */
-/* Even FDs are read ends, odd FDs are write ends */
-/* fd / 2 = pipe index, fd % 2 = 0 for read, 1 for write */
-#define FD_TO_PIPE_INDEX(fd)    ((fd) / 2)
-#define FD_IS_READ_END(fd)      (((fd) % 2) == 0)
-#define PIPE_TO_READ_FD(idx)    ((idx) * 2)
-#define PIPE_TO_WRITE_FD(idx)   ((idx) * 2 + 1)
-
 /* Global pipe subsystem lock */
-static volatile int pipe_subsystem_lock = 0;
+SPINLOCK_DEFINE(pipe_subsystem_lock, "ipc.pipe.table");
+
+/* Class of the per-pipe locks */
+LOCK_CLASS(pipe, "ipc.pipe");
 
 /* Statistics */
-static uint64_t total_pipes_created = 0;
-static uint64_t total_bytes_transferred = 0;
+KSTAT_COUNTER(pipe_created, "ipc.pipe.created", "Pipes created");
+KSTAT_COUNTER(pipe_bytes_read, "ipc.pipe.bytes_read", "Bytes read from pipes");
+KSTAT_COUNTER(pipe_bytes_written, "ipc.pipe.bytes_written", "Bytes written to pipes");
+KSTAT_COUNTER(pipe_spliced_in, "ipc.pipe.spliced_in", "Pages spliced into pipes");
+KSTAT_COUNTER(pipe_spliced_out, "ipc.pipe.spliced_out", "Pages spliced out of pipes");
+KSTAT_HISTOGRAM(pipe_write_size, "ipc.pipe.write_size", "Bytes per pipe write");
 
 /**
- * Acquire a spinlock
+ * Copy bytes, a word at a time when both ends are word-aligned
  */
-static inline void spinlock_acquire(volatile int *lock) {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        __asm__ __volatile__("pause");
+static void pipe_copy(void *dest, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if ((((uintptr_t)d | (uintptr_t)s) & (sizeof(uint64_t) - 1)) == 0) {
+        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t)) {
+            *(uint64_t *)d = *(const uint64_t *)s;
+            d += sizeof(uint64_t);
+            s += sizeof(uint64_t);
+        }
+    }
+    while (n--) {
+        *d++ = *s++;
     }
 }
 
 /**
- * Release a spinlock
+ * Slot i places after the head
  */
-static inline void spinlock_release(volatile int *lock) {
-    __sync_lock_release(lock);
+static inline pipe_buf_t *pipe_slot(pipe_t *pipe, uint32_t i) {
+    return &pipe->bufs[(pipe->head + i) & (PIPE_MAX_PAGES - 1)];
 }
 
 /**
- * Simple memcpy implementation
+ * Bytes that can still go into the newest slot's page
  */
-static void *kmemcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
+static size_t pipe_tail_room(pipe_t *pipe) {
+    if (pipe->used == 0) {
+        return 0;
     }
-    return dest;
+    pipe_buf_t *tail = pipe_slot(pipe, pipe->used - 1);
+    if (tail->flags & PIPE_BUF_SHARED) {
+        return 0;
+    }
+    return PAGE_SIZE - (tail->offset + tail->len);
 }
 
 /**
- * Block current process waiting for pipe
+ * Bytes a copying write can add without blocking
+ * Called with the pipe lock held.
  */
-static void pipe_block_reader(pipe_t *pipe) {
-    process_t *current = process_get_current();
-    if (!current) return;
+static size_t pipe_space(pipe_t *pipe) {
+    size_t free_slots = pipe->used < pipe->max_pages ? pipe->max_pages - pipe->used : 0;
+    return free_slots * PAGE_SIZE + pipe_tail_room(pipe);
+}
 
-    if (pipe->read_waiter_count < 8) {
-        pipe->read_waiters[pipe->read_waiter_count++] = current;
-        process_set_state(current, PROCESS_STATE_BLOCKED);
-        kprintf("[PIPE] Process '%s' (PID %u) blocked waiting to read from pipe %u\n",
-                current->name, current->pid, pipe->id);
-    }
+/**
+ * Append a slot for len bytes of frame at offset
+ */
+static void pipe_push(pipe_t *pipe, physaddr_t frame, uint16_t offset, uint16_t len,
+                      uint32_t flags) {
+    pipe_buf_t *b = pipe_slot(pipe, pipe->used);
+    b->frame = frame;
+    b->offset = offset;
+    b->len = len;
+    b->flags = flags;
+    pipe->used++;
+    pipe->count += len;
 }
 
 /**
- * Block current process waiting to write
+ * Drop the head slot's page, keeping one private page for reuse
  */
-static void pipe_block_writer(pipe_t *pipe) {
-    process_t *current = process_get_current();
-    if (!current) return;
+static void pipe_pop(pipe_t *pipe) {
+    pipe_buf_t *b = pipe_slot(pipe, 0);
 
-    if (pipe->write_waiter_count < 8) {
-        pipe->write_waiters[pipe->write_waiter_count++] = current;
-        process_set_state(current, PROCESS_STATE_BLOCKED);
-        kprintf("[PIPE] Process '%s' (PID %u) blocked waiting to write to pipe %u\n",
-                current->name, current->pid, pipe->id);
+    if (!(b->flags & PIPE_BUF_SHARED) && pipe->spare == 0) {
+        pipe->spare = b->frame;
+    } else {
+        pmm_page_unref(b->frame);
     }
+    b->frame = 0;
+
+    pipe->head = (pipe->head + 1) & (PIPE_MAX_PAGES - 1);
+    pipe->used--;
 }
 
 /**
- * Wake one reader waiting on pipe
+ * Free every page the pipe holds
+ * Called with the pipe lock held, once both ends are gone.
  */
-static void pipe_wake_reader(pipe_t *pipe) {
-    if (pipe->read_waiter_count > 0) {
-        process_t *proc = pipe->read_waiters[0];
-        /* Shift remaining waiters */
-        for (uint32_t i = 0; i < pipe->read_waiter_count - 1; i++) {
-            pipe->read_waiters[i] = pipe->read_waiters[i + 1];
-        }
-        pipe->read_waiter_count--;
-        pipe->read_waiters[pipe->read_waiter_count] = NULL;
+static void pipe_release_pages(pipe_t *pipe) {
+    while (pipe->used > 0) {
+        pipe_pop(pipe);
+    }
+    if (pipe->spare != 0) {
+        pmm_page_unref(pipe->spare);
+        pipe->spare = 0;
+    }
+    pipe->head = 0;
+    pipe->count = 0;
+}
+
+/**
+ * Copy up to n bytes into the pipe's pages
+ * @return Bytes copied (short if out of room or memory)
+ */
+static size_t pipe_copy_in(pipe_t *pipe, const uint8_t *src, size_t n) {
+    size_t done = 0;
+
+    while (done < n) {
+        size_t room = pipe_tail_room(pipe);
 
-        if (proc) {
-            process_set_state(proc, PROCESS_STATE_READY);
-            kprintf("[PIPE] Woke reader process '%s' (PID %u) for pipe %u\n",
-                    proc->name, proc->pid, pipe->id);
+        if (room == 0) {
+            if (pipe->used >= pipe->max_pages) {
+                break;
+            }
+            physaddr_t frame = pipe->spare;
+            if (frame != 0) {
+                pipe->spare = 0;
+            } else if ((frame = pmm_alloc_page()) == 0) {
+                break;
+            }
+            pipe_push(pipe, frame, 0, 0, 0);
+            room = PAGE_SIZE;
         }
+
+        pipe_buf_t *tail = pipe_slot(pipe, pipe->used - 1);
+        size_t len = MIN(n - done, room);
+
+        pipe_copy((uint8_t *)(uintptr_t)tail->frame + tail->offset + tail->len,
+                  src + done, len);
+        tail->len += (uint16_t)len;
+        pipe->count += len;
+        done += len;
     }
+
+    return done;
 }
 
 /**
- * Wake one writer waiting on pipe
+ * VMA of the calling process holding all of [addr, addr + size)
+ * Kernel buffers have none; user buffers are only passed by reference
+ * when they lie in one VMA.
  */
-static void pipe_wake_writer(pipe_t *pipe) {
-    if (pipe->write_waiter_count > 0) {
-        process_t *proc = pipe->write_waiters[0];
-        /* Shift remaining waiters */
-        for (uint32_t i = 0; i < pipe->write_waiter_count - 1; i++) {
-            pipe->write_waiters[i] = pipe->write_waiters[i + 1];
-        }
-        pipe->write_waiter_count--;
-        pipe->write_waiters[pipe->write_waiter_count] = NULL;
+static vma_t *pipe_user_vma(const void *addr, size_t size, bool write) {
+    process_t *proc = process_get_current();
+    if (!proc || proc->page_table == 0) {
+        return NULL;
+    }
 
-        if (proc) {
-            process_set_state(proc, PROCESS_STATE_READY);
-            kprintf("[PIPE] Woke writer process '%s' (PID %u) for pipe %u\n",
-                    proc->name, proc->pid, pipe->id);
-        }
+    virtaddr_t start = (virtaddr_t)(uintptr_t)addr;
+    vma_t *vma = vma_find(process_vmas(proc), start);
+    if (!vma || vma->start > start || vma->end < start + size) {
+        return NULL;
+    }
+    if (write && !(vma->flags & VMM_FLAG_WRITE)) {
+        return NULL;
+    }
+    return vma;
+}
+
+/**
+ * Move one whole user page into a new slot
+ * @return true if the page is now in the pipe
+ */
+static bool pipe_splice_in(pipe_t *pipe, const uint8_t *src) {
+    if (!pipe_user_vma(src, PAGE_SIZE, false)) {
+        return false;
+    }
+
+    /* Fault it in, then share it copy-on-write */
+    (void)*(const volatile uint8_t *)src;
+    physaddr_t frame = vmm_share_user_page(vmm_get_current_address_space(),
+                                           (virtaddr_t)(uintptr_t)src);
+    if (frame == 0) {
+        return false;
+    }
+
+    pipe_push(pipe, frame, 0, PAGE_SIZE, PIPE_BUF_SHARED);
+    kstat_inc(pipe_spliced_in);
+    return true;
+}
+
+/**
+ * Map the full head slot's page at a user page
+ * @return true if the page now belongs to the reader
+ */
+static bool pipe_splice_out(pipe_t *pipe, uint8_t *dest) {
+    pipe_buf_t *b = pipe_slot(pipe, 0);
+    if (b->offset != 0 || b->len != PAGE_SIZE) {
+        return false;
+    }
+
+    vma_t *vma = pipe_user_vma(dest, PAGE_SIZE, true);
+    if (!vma) {
+        return false;
+    }
+
+    /* A frame the writer still maps is read-only until the reader writes */
+    uint64_t flags = vma->flags;
+    if (pmm_page_refcount(b->frame) > 1) {
+        flags = (flags & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
     }
+
+    /* The mapping takes a reference of its own; a failed map drops it */
+    if (!pmm_page_ref(b->frame) ||
+        !vmm_replace_user_page(vmm_get_current_address_space(),
+                               (virtaddr_t)(uintptr_t)dest, b->frame, flags)) {
+        return false;
+    }
+
+    /* Never reuse it as the spare: the reader owns it now */
+    b->flags |= PIPE_BUF_SHARED;
+    b->len = 0;
+    pipe->count -= PAGE_SIZE;
+    pipe_pop(pipe);
+    kstat_inc(pipe_spliced_out);
+    return true;
+}
+
+/**
+ * Sleep until an event word moves on
+ * Called with the pipe lock held; drops it while asleep.
+ */
+static void pipe_wait_event(pipe_t *pipe, volatile uint32_t *event, uint32_t *waiters) {
+    uint32_t seen = *event;
+
+    (*waiters)++;
+    spinlock_release(&pipe->lock);
+
+    /* A wake after we dropped the lock has bumped the word already */
+    waitq_wait(event, seen);
+
+    spinlock_acquire(&pipe->lock);
+    (*waiters)--;
+}
+
+/**
+ * Bump an event word and wake up to count sleepers on it
+ * Called with the pipe lock held.
+ */
+static void pipe_signal_event(volatile uint32_t *event, uint32_t waiters, uint32_t count) {
+    (*event)++;
+    if (waiters > 0) {
+        waitq_wake(event, count);
+    }
+}
+
+/**
+ * Block current process waiting for pipe
+ */
+static void pipe_block_reader(pipe_t *pipe) {
+    pipe_wait_event(pipe, &pipe->read_event, &pipe->read_waiter_count);
+}
+
+/**
+ * Block current process waiting to write
+ */
+static void pipe_block_writer(pipe_t *pipe) {
+    pipe_wait_event(pipe, &pipe->write_event, &pipe->write_waiter_count);
+}
+
+/**
+ * Wake one reader waiting on pipe
+ */
+static void pipe_wake_reader(pipe_t *pipe) {
+    pipe_signal_event(&pipe->read_event, pipe->read_waiter_count, 1);
+    poll_notify(&pipe->read_poll, POLL_IN);
+}
+
+/**
+ * Wake one writer waiting on pipe
+ */
+static void pipe_wake_writer(pipe_t *pipe) {
+    pipe_signal_event(&pipe->write_event, pipe->write_waiter_count, 1);
+    poll_notify(&pipe->write_poll, POLL_OUT);
 }
 
 /**
  * Wake all readers (used when write end closes)
  */
 static void pipe_wake_all_readers(pipe_t *pipe) {
-    while (pipe->read_waiter_count > 0) {
-        pipe_wake_reader(pipe);
-    }
+    pipe_signal_event(&pipe->read_event, pipe->read_waiter_count, WAITQ_WAKE_ALL);
+    poll_notify(&pipe->read_poll, POLL_IN | POLL_HUP);
 }
 
 /**
  * Wake all writers (used when read end closes)
  */
 static void pipe_wake_all_writers(pipe_t *pipe) {
-    while (pipe->write_waiter_count > 0) {
-        pipe_wake_writer(pipe);
+    pipe_signal_event(&pipe->write_event, pipe->write_waiter_count, WAITQ_WAKE_ALL);
+    poll_notify(&pipe->write_poll, POLL_OUT | POLL_ERR);
+}
+
+/**
+ * Drop one reference to a pipe end, closing it with the last
+ * The pipe is freed once both ends are closed.
+ */
+static void pipe_close_end(pipe_t *pipe, bool is_read) {
+    spinlock_acquire(&pipe->lock);
+
+    if (is_read) {
+        if (pipe->readers > 0) pipe->readers--;
+        if (pipe->readers == 0 && (pipe->flags & PIPE_FLAG_READ_OPEN)) {
+            pipe->flags &= ~PIPE_FLAG_READ_OPEN;
+            kprintf("[PIPE] Closed read end of pipe %u\n", pipe->id);
+            /* Wake all writers - they'll get broken pipe error */
+            pipe_wake_all_writers(pipe);
+            poll_source_detach(&pipe->read_poll);
+        }
+    } else {
+        if (pipe->writers > 0) pipe->writers--;
+        if (pipe->writers == 0 && (pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
+            pipe->flags &= ~PIPE_FLAG_WRITE_OPEN;
+            kprintf("[PIPE] Closed write end of pipe %u\n", pipe->id);
+            /* Wake all readers - they'll get EOF */
+            pipe_wake_all_readers(pipe);
+            poll_source_detach(&pipe->write_poll);
+        }
+    }
+
+    /* If both ends are closed, free the pipe */
+    if (pipe->flags != 0 && !(pipe->flags & (PIPE_FLAG_READ_OPEN | PIPE_FLAG_WRITE_OPEN))) {
+        kprintf("[PIPE] Both ends closed, freeing pipe %u\n", pipe->id);
+        pipe_release_pages(pipe);
+        pipe->flags = 0;
+        pipe->id = 0;
     }
+
+    spinlock_release(&pipe->lock);
 }
 
+/**
+ * Another descriptor refers to a pipe end (a forked table)
+ */
+static void pipe_fd_ref(void *object, uint32_t end) {
+    pipe_t *pipe = (pipe_t *)object;
+
+    spinlock_acquire(&pipe->lock);
+    if (end == PIPE_END_READ) {
+        pipe->readers++;
+    } else {
+        pipe->writers++;
+    }
+    spinlock_release(&pipe->lock);
+}
+
+/**
+ * A descriptor of a pipe end was closed
+ */
+static void pipe_fd_close(void *object, uint32_t end) {
+    pipe_close_end((pipe_t *)object, end == PIPE_END_READ);
+}
+
+static const fd_ops_t pipe_fd_ops = {
+    .ref = pipe_fd_ref,
+    .close = pipe_fd_close,
+};
+
 /**
  * Initialize the pipe subsystem
  */
@@ -160,18 +408,26 @@ void pipe_init(void) {
     for (uint32_t i = 0; i < PIPE_MAX_COUNT; i++) {
         pipe_table[i].flags = 0;
         pipe_table[i].id = 0;
+        pipe_table[i].head = 0;
+        pipe_table[i].used = 0;
+        pipe_table[i].max_pages = PIPE_DEFAULT_PAGES;
         pipe_table[i].count = 0;
-        pipe_table[i].read_pos = 0;
-        pipe_table[i].write_pos = 0;
+        pipe_table[i].spare = 0;
         pipe_table[i].readers = 0;
         pipe_table[i].writers = 0;
+        pipe_table[i].read_event = 0;
+        pipe_table[i].write_event = 0;
         pipe_table[i].read_waiter_count = 0;
         pipe_table[i].write_waiter_count = 0;
-        pipe_table[i].lock = 0;
+        poll_source_init(&pipe_table[i].read_poll);
+        poll_source_init(&pipe_table[i].write_poll);
+        spinlock_init(&pipe_table[i].lock, LOCK_CLASS_OF(pipe));
     }
 
     spinlock_release(&pipe_subsystem_lock);
 
+    fd_register_ops(FD_KIND_PIPE, &pipe_fd_ops);
+
     kprintf("[PIPE] Pipe table initialized (%u slots, %u bytes each)\n",
             PIPE_MAX_COUNT, (uint32_t)sizeof(pipe_t));
     kprintf("[PIPE] Pipe Subsystem initialized successfully\n");
@@ -189,16 +445,6 @@ static pipe_t* pipe_alloc(void) {
     return NULL;
 }
 
-/**
- * Get pipe index from pointer
- */
-static int pipe_get_index(pipe_t *pipe) {
-    if (!pipe) return -1;
-    ptrdiff_t idx = pipe - pipe_table;
-    if (idx < 0 || idx >= PIPE_MAX_COUNT) return -1;
-    return (int)idx;
-}
-
 /**
  * Create a new pipe
  */
@@ -217,39 +463,41 @@ int pipe_create(int fds[2]) {
         return PIPE_ERR_MAX_PIPES;
     }
 
-    int idx = pipe_get_index(pipe);
-
     /* Initialize the pipe */
     pipe->id = next_pipe_id++;
     pipe->flags = PIPE_FLAG_READ_OPEN | PIPE_FLAG_WRITE_OPEN;
+    pipe->head = 0;
+    pipe->used = 0;
+    pipe->max_pages = PIPE_DEFAULT_PAGES;
     pipe->count = 0;
-    pipe->read_pos = 0;
-    pipe->write_pos = 0;
+    pipe->spare = 0;
     pipe->readers = 1;
     pipe->writers = 1;
     pipe->read_waiter_count = 0;
     pipe->write_waiter_count = 0;
-    pipe->lock = 0;
-
-    /* Clear buffer */
-    for (size_t i = 0; i < PIPE_BUFFER_SIZE; i++) {
-        pipe->buffer[i] = 0;
-    }
-
-    /* Clear waiter arrays */
-    for (int i = 0; i < 8; i++) {
-        pipe->read_waiters[i] = NULL;
-        pipe->write_waiters[i] = NULL;
-    }
-
-    /* Set file descriptors */
-    fds[0] = PIPE_TO_READ_FD(idx);   /* Read end */
-    fds[1] = PIPE_TO_WRITE_FD(idx);  /* Write end */
+    spinlock_init(&pipe->lock, LOCK_CLASS_OF(pipe));
 
-    total_pipes_created++;
+    kstat_inc(pipe_created);
 
     spinlock_release(&pipe_subsystem_lock);
 
+    /* Install both ends in the caller's descriptor table */
+    fd_table_t *table = fd_table_current();
+    int read_fd = fd_alloc(table, FD_KIND_PIPE, pipe, PIPE_END_READ);
+    int write_fd = read_fd >= 0 ? fd_alloc(table, FD_KIND_PIPE, pipe, PIPE_END_WRITE) : -1;
+    if (write_fd < 0) {
+        if (read_fd >= 0) {
+            fd_close(table, read_fd);
+        } else {
+            pipe_close_end(pipe, true);
+        }
+        pipe_close_end(pipe, false);
+        kprintf("[PIPE] Error: No free file descriptors for pipe\n");
+        return PIPE_ERR_MAX_FDS;
+    }
+    fds[0] = read_fd;
+    fds[1] = write_fd;
+
     kprintf("[PIPE] Created pipe %u (fds: read=%d, write=%d)\n",
             pipe->id, fds[0], fds[1]);
 
@@ -260,30 +508,24 @@ int pipe_create(int fds[2]) {
  * Get pipe structure by file descriptor
  */
 pipe_t* pipe_get(int fd) {
-    if (fd < 0) return NULL;
-    int idx = FD_TO_PIPE_INDEX(fd);
-    if (idx >= PIPE_MAX_COUNT) return NULL;
-    if (pipe_table[idx].flags == 0) return NULL;
-    return &pipe_table[idx];
+    return fd_lookup(fd_table_current(), fd, FD_KIND_PIPE, NULL);
 }
 
 /**
- * Read from pipe (blocking)
+ * Read from a pipe
+ * @param nonblock Fail with PIPE_ERR_WOULDBLOCK instead of sleeping
+ * @param splice Take whole pages by reference where possible
  */
-ssize_t pipe_read(pipe_t *pipe, void *buf, size_t count) {
-    if (!pipe || !buf) {
-        kprintf("[PIPE] Error: pipe_read called with NULL argument\n");
-        return PIPE_ERR_INVALID;
-    }
-
-    if (count == 0) return 0;
-
+static ssize_t pipe_do_read(pipe_t *pipe, uint8_t *dest, size_t count,
+                            bool nonblock, bool splice) {
     spinlock_acquire(&pipe->lock);
 
     /* Check if read end is open */
     if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
         spinlock_release(&pipe->lock);
-        kprintf("[PIPE] Error: Read end of pipe %u is closed\n", pipe->id);
+        if (!nonblock) {
+            kprintf("[PIPE] Error: Read end of pipe %u is closed\n", pipe->id);
+        }
         return PIPE_ERR_CLOSED;
     }
 
@@ -292,164 +534,185 @@ ssize_t pipe_read(pipe_t *pipe, void *buf, size_t count) {
         if (!(pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
             /* Write end closed, return EOF */
             spinlock_release(&pipe->lock);
-            kprintf("[PIPE] EOF on pipe %u (write end closed)\n", pipe->id);
+            if (!nonblock) {
+                kprintf("[PIPE] EOF on pipe %u (write end closed)\n", pipe->id);
+            }
             return 0;
         }
+        if (nonblock) {
+            spinlock_release(&pipe->lock);
+            return PIPE_ERR_WOULDBLOCK;
+        }
 
         /* Block the current process */
         pipe_block_reader(pipe);
-        spinlock_release(&pipe->lock);
-
-        /* Yield to scheduler - in a real implementation this would
-         * actually context switch. For now, we spin. */
-        __asm__ __volatile__("pause");
-
-        spinlock_acquire(&pipe->lock);
     }
 
-    /* Read data from circular buffer */
-    size_t to_read = MIN(count, pipe->count);
     size_t bytes_read = 0;
-    uint8_t *dest = (uint8_t *)buf;
 
-    while (bytes_read < to_read) {
-        dest[bytes_read++] = pipe->buffer[pipe->read_pos];
-        pipe->read_pos = (pipe->read_pos + 1) % PIPE_BUFFER_SIZE;
+    while (bytes_read < count && pipe->count > 0) {
+        pipe_buf_t *b = pipe_slot(pipe, 0);
+        size_t left = count - bytes_read;
+
+        if (splice && left >= PAGE_SIZE && IS_ALIGNED((uintptr_t)(dest + bytes_read), PAGE_SIZE) &&
+            pipe_splice_out(pipe, dest + bytes_read)) {
+            bytes_read += PAGE_SIZE;
+            continue;
+        }
+
+        size_t len = MIN(left, (size_t)b->len);
+        pipe_copy(dest + bytes_read, (const uint8_t *)(uintptr_t)b->frame + b->offset, len);
+        b->offset += (uint16_t)len;
+        b->len -= (uint16_t)len;
+        pipe->count -= len;
+        bytes_read += len;
+
+        if (b->len == 0) {
+            pipe_pop(pipe);
+        }
     }
 
-    pipe->count -= bytes_read;
-    total_bytes_transferred += bytes_read;
+    kstat_add(pipe_bytes_read, bytes_read);
 
     /* Wake a writer if any are waiting */
     pipe_wake_writer(pipe);
 
     spinlock_release(&pipe->lock);
 
+#ifdef PIPE_DEBUG_TRACE
     kprintf("[PIPE] Read %llu bytes from pipe %u (%llu bytes remaining)\n",
             (uint64_t)bytes_read, pipe->id, (uint64_t)pipe->count);
+#endif
 
     return (ssize_t)bytes_read;
 }
 
 /**
- * Write to pipe
+ * Write to a pipe
+ * @param nonblock Return what fit (or PIPE_ERR_WOULDBLOCK) instead of sleeping
+ * @param splice Pass whole pages by reference where possible
  */
-ssize_t pipe_write(pipe_t *pipe, const void *buf, size_t count) {
-    if (!pipe || !buf) {
-        kprintf("[PIPE] Error: pipe_write called with NULL argument\n");
-        return PIPE_ERR_INVALID;
-    }
-
-    if (count == 0) return 0;
-
+static ssize_t pipe_do_write(pipe_t *pipe, const uint8_t *src, size_t count,
+                             bool nonblock, bool splice) {
     spinlock_acquire(&pipe->lock);
 
     /* Check if write end is open */
     if (!(pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
         spinlock_release(&pipe->lock);
-        kprintf("[PIPE] Error: Write end of pipe %u is closed\n", pipe->id);
-        return PIPE_ERR_CLOSED;
-    }
-
-    /* Check if read end is open (broken pipe) */
-    if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
-        spinlock_release(&pipe->lock);
-        kprintf("[PIPE] Error: Broken pipe %u (read end closed)\n", pipe->id);
+        if (!nonblock) {
+            kprintf("[PIPE] Error: Write end of pipe %u is closed\n", pipe->id);
+        }
         return PIPE_ERR_CLOSED;
     }
 
-    const uint8_t *src = (const uint8_t *)buf;
     size_t bytes_written = 0;
 
     while (bytes_written < count) {
-        /* Block while full */
-        while (pipe->count == PIPE_BUFFER_SIZE) {
-            if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
-                /* Read end closed while we were waiting */
-                spinlock_release(&pipe->lock);
-                if (bytes_written > 0) {
-                    return (ssize_t)bytes_written;
-                }
-                return PIPE_ERR_CLOSED;
+        /* Check if read end is open (broken pipe) */
+        if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
+            spinlock_release(&pipe->lock);
+            if (bytes_written > 0) {
+                return (ssize_t)bytes_written;
             }
+            return PIPE_ERR_CLOSED;
+        }
 
-            /* Block the current process */
+        /* Block while full */
+        if (pipe_space(pipe) == 0) {
+            if (nonblock) {
+                break;
+            }
             pipe_block_writer(pipe);
-            spinlock_release(&pipe->lock);
-
-            /* Yield to scheduler */
-            __asm__ __volatile__("pause");
-
-            spinlock_acquire(&pipe->lock);
+            continue;
         }
 
-        /* Write as much as we can */
-        size_t space = PIPE_BUFFER_SIZE - pipe->count;
-        size_t to_write = MIN(count - bytes_written, space);
+        const uint8_t *from = src + bytes_written;
+        size_t left = count - bytes_written;
+        size_t len = left;
+
+        if (splice) {
+            if (left >= PAGE_SIZE && IS_ALIGNED((uintptr_t)from, PAGE_SIZE) &&
+                pipe->used < pipe->max_pages && pipe_splice_in(pipe, from)) {
+                bytes_written += PAGE_SIZE;
+                pipe_wake_reader(pipe);
+                continue;
+            }
 
-        for (size_t i = 0; i < to_write; i++) {
-            pipe->buffer[pipe->write_pos] = src[bytes_written++];
-            pipe->write_pos = (pipe->write_pos + 1) % PIPE_BUFFER_SIZE;
+            /* Copy up to the next page boundary, where splicing can resume */
+            len = MIN(left, PAGE_SIZE - ((uintptr_t)from & (PAGE_SIZE - 1)));
         }
 
-        pipe->count += to_write;
+        size_t copied = pipe_copy_in(pipe, from, len);
+        if (copied == 0) {
+            /* Room in the ring but no page to put there */
+            spinlock_release(&pipe->lock);
+            kprintf("[PIPE] Error: Out of memory writing to pipe %u\n", pipe->id);
+            if (bytes_written > 0) {
+                return (ssize_t)bytes_written;
+            }
+            return PIPE_ERR_NO_MEMORY;
+        }
+        bytes_written += copied;
 
         /* Wake a reader if any are waiting */
         pipe_wake_reader(pipe);
     }
 
-    total_bytes_transferred += bytes_written;
+    kstat_add(pipe_bytes_written, bytes_written);
+    kstat_observe(pipe_write_size, bytes_written);
 
     spinlock_release(&pipe->lock);
 
+#ifdef PIPE_DEBUG_TRACE
     kprintf("[PIPE] Wrote %llu bytes to pipe %u (%llu bytes buffered)\n",
             (uint64_t)bytes_written, pipe->id, (uint64_t)pipe->count);
+#endif
 
+    if (bytes_written == 0) {
+        return PIPE_ERR_WOULDBLOCK;
+    }
     return (ssize_t)bytes_written;
 }
 
 /**
- * Try to read (non-blocking)
+ * Read from pipe (blocking)
  */
-ssize_t pipe_try_read(pipe_t *pipe, void *buf, size_t count) {
+ssize_t pipe_read(pipe_t *pipe, void *buf, size_t count) {
     if (!pipe || !buf) {
+        kprintf("[PIPE] Error: pipe_read called with NULL argument\n");
         return PIPE_ERR_INVALID;
     }
 
     if (count == 0) return 0;
 
-    spinlock_acquire(&pipe->lock);
+    return pipe_do_read(pipe, (uint8_t *)buf, count, false, false);
+}
 
-    if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
-        spinlock_release(&pipe->lock);
-        return PIPE_ERR_CLOSED;
+/**
+ * Write to pipe
+ */
+ssize_t pipe_write(pipe_t *pipe, const void *buf, size_t count) {
+    if (!pipe || !buf) {
+        kprintf("[PIPE] Error: pipe_write called with NULL argument\n");
+        return PIPE_ERR_INVALID;
     }
 
-    if (pipe->count == 0) {
-        spinlock_release(&pipe->lock);
-        if (!(pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
-            return 0; /* EOF */
-        }
-        return PIPE_ERR_WOULDBLOCK;
-    }
+    if (count == 0) return 0;
 
-    /* Read available data */
-    size_t to_read = MIN(count, pipe->count);
-    uint8_t *dest = (uint8_t *)buf;
+    return pipe_do_write(pipe, (const uint8_t *)buf, count, false, false);
+}
 
-    for (size_t i = 0; i < to_read; i++) {
-        dest[i] = pipe->buffer[pipe->read_pos];
-        pipe->read_pos = (pipe->read_pos + 1) % PIPE_BUFFER_SIZE;
+/**
+ * Try to read (non-blocking)
+ */
+ssize_t pipe_try_read(pipe_t *pipe, void *buf, size_t count) {
+    if (!pipe || !buf) {
+        return PIPE_ERR_INVALID;
     }
 
-    pipe->count -= to_read;
-    total_bytes_transferred += to_read;
-
-    pipe_wake_writer(pipe);
-
-    spinlock_release(&pipe->lock);
+    if (count == 0) return 0;
 
-    return (ssize_t)to_read;
+    return pipe_do_read(pipe, (uint8_t *)buf, count, true, false);
 }
 
 /**
@@ -462,41 +725,70 @@ ssize_t pipe_try_write(pipe_t *pipe, const void *buf, size_t count) {
 
     if (count == 0) return 0;
 
-    spinlock_acquire(&pipe->lock);
+    return pipe_do_write(pipe, (const uint8_t *)buf, count, true, false);
+}
 
-    if (!(pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
-        spinlock_release(&pipe->lock);
-        return PIPE_ERR_CLOSED;
+/**
+ * Write to pipe, passing whole user pages by reference
+ */
+ssize_t pipe_vmsplice_write(pipe_t *pipe, const void *buf, size_t count) {
+    if (!pipe || !buf) {
+        kprintf("[PIPE] Error: pipe_vmsplice_write called with NULL argument\n");
+        return PIPE_ERR_INVALID;
     }
 
-    if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
-        spinlock_release(&pipe->lock);
-        return PIPE_ERR_CLOSED;
-    }
+    if (count == 0) return 0;
 
-    if (pipe->count == PIPE_BUFFER_SIZE) {
-        spinlock_release(&pipe->lock);
-        return PIPE_ERR_WOULDBLOCK;
+    return pipe_do_write(pipe, (const uint8_t *)buf, count, false, true);
+}
+
+/**
+ * Read from pipe, taking whole pages by reference
+ */
+ssize_t pipe_vmsplice_read(pipe_t *pipe, void *buf, size_t count) {
+    if (!pipe || !buf) {
+        kprintf("[PIPE] Error: pipe_vmsplice_read called with NULL argument\n");
+        return PIPE_ERR_INVALID;
     }
 
-    /* Write available space */
-    size_t space = PIPE_BUFFER_SIZE - pipe->count;
-    size_t to_write = MIN(count, space);
-    const uint8_t *src = (const uint8_t *)buf;
+    if (count == 0) return 0;
+
+    return pipe_do_read(pipe, (uint8_t *)buf, count, false, true);
+}
 
-    for (size_t i = 0; i < to_write; i++) {
-        pipe->buffer[pipe->write_pos] = src[i];
-        pipe->write_pos = (pipe->write_pos + 1) % PIPE_BUFFER_SIZE;
+/**
+ * Set the capacity of a pipe
+ */
+ssize_t pipe_set_capacity(pipe_t *pipe, size_t size) {
+    if (!pipe || size > (size_t)PIPE_MAX_PAGES * PAGE_SIZE) {
+        return PIPE_ERR_INVALID;
     }
 
-    pipe->count += to_write;
-    total_bytes_transferred += to_write;
+    uint32_t pages = (uint32_t)(ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE);
+    if (pages == 0) {
+        pages = 1;
+    }
 
-    pipe_wake_reader(pipe);
+    spinlock_acquire(&pipe->lock);
+
+    if (pipe->flags == 0) {
+        spinlock_release(&pipe->lock);
+        return PIPE_ERR_INVALID;
+    }
+    if (pages < pipe->used) {
+        spinlock_release(&pipe->lock);
+        return PIPE_ERR_BUSY;
+    }
+
+    bool grew = pages > pipe->max_pages;
+    pipe->max_pages = pages;
+    if (grew) {
+        pipe_wake_all_writers(pipe);
+    }
 
     spinlock_release(&pipe->lock);
 
-    return (ssize_t)to_write;
+    return (ssize_t)pages * PAGE_SIZE;
 }
 
 /**
@@ -519,6 +811,9 @@ int pipe_close(pipe_t *pipe) {
     pipe_wake_all_writers(pipe);
 
     /* Mark as closed */
+    poll_source_detach(&pipe->read_poll);
+    poll_source_detach(&pipe->write_poll);
+    pipe_release_pages(pipe);
     pipe->flags = 0;
     pipe->readers = 0;
     pipe->writers = 0;
@@ -534,44 +829,54 @@ int pipe_close(pipe_t *pipe) {
  * Close pipe by file descriptor
  */
 int pipe_close_fd(int fd) {
-    pipe_t *pipe = pipe_get(fd);
-    if (!pipe) {
+    fd_table_t *table = fd_table_current();
+    if (!fd_lookup(table, fd, FD_KIND_PIPE, NULL) || !fd_close(table, fd)) {
         kprintf("[PIPE] Error: Invalid fd %d for pipe_close_fd\n", fd);
         return PIPE_ERR_INVALID;
     }
+    return PIPE_SUCCESS;
+}
+
+/**
+ * Readiness source of a pipe end
+ */
+poll_source_t* pipe_poll_source(int fd, uint32_t *ready) {
+    uint32_t end;
+    pipe_t *pipe = fd_lookup(fd_table_current(), fd, FD_KIND_PIPE, &end);
+    if (!pipe) {
+        return NULL;
+    }
 
     spinlock_acquire(&pipe->lock);
 
-    bool is_read = FD_IS_READ_END(fd);
+    poll_source_t *src = NULL;
+    uint32_t events = 0;
 
-    if (is_read) {
-        if (pipe->readers > 0) pipe->readers--;
-        if (pipe->readers == 0) {
-            pipe->flags &= ~PIPE_FLAG_READ_OPEN;
-            kprintf("[PIPE] Closed read end of pipe %u\n", pipe->id);
-            /* Wake all writers - they'll get broken pipe error */
-            pipe_wake_all_writers(pipe);
+    if (end == PIPE_END_READ) {
+        if (pipe->flags & PIPE_FLAG_READ_OPEN) {
+            src = &pipe->read_poll;
+            if (pipe->count > 0) {
+                events |= POLL_IN;
+            }
+            if (!(pipe->flags & PIPE_FLAG_WRITE_OPEN)) {
+                events |= POLL_IN | POLL_HUP;
+            }
         }
-    } else {
-        if (pipe->writers > 0) pipe->writers--;
-        if (pipe->writers == 0) {
-            pipe->flags &= ~PIPE_FLAG_WRITE_OPEN;
-            kprintf("[PIPE] Closed write end of pipe %u\n", pipe->id);
-            /* Wake all readers - they'll get EOF */
-            pipe_wake_all_readers(pipe);
+    } else if (pipe->flags & PIPE_FLAG_WRITE_OPEN) {
+        src = &pipe->write_poll;
+        if (!(pipe->flags & PIPE_FLAG_READ_OPEN)) {
+            events |= POLL_OUT | POLL_ERR;
+        } else if (pipe_space(pipe) > 0) {
+            events |= POLL_OUT;
         }
     }
 
-    /* If both ends are closed, free the pipe */
-    if (!(pipe->flags & (PIPE_FLAG_READ_OPEN | PIPE_FLAG_WRITE_OPEN))) {
-        kprintf("[PIPE] Both ends closed, freeing pipe %u\n", pipe->id);
-        pipe->flags = 0;
-        pipe->id = 0;
-    }
-
     spinlock_release(&pipe->lock);
 
-    return PIPE_SUCCESS;
+    if (ready) {
+        *ready = events;
+    }
+    return src;
 }
 
 /**
@@ -594,7 +899,7 @@ size_t pipe_free_space(pipe_t *pipe) {
     if (!pipe) return 0;
 
     spinlock_acquire(&pipe->lock);
-    size_t free_space = PIPE_BUFFER_SIZE - pipe->count;
+    size_t free_space = pipe_space(pipe);
     spinlock_release(&pipe->lock);
 
     return free_space;
@@ -605,10 +910,14 @@ size_t pipe_free_space(pipe_t *pipe) {
  */
 void pipe_dump_stats(void) {
     kprintf("[PIPE] ========== Pipe Statistics ==========\n");
-    kprintf("[PIPE] Total pipes created:    %llu\n", total_pipes_created);
-    kprintf("[PIPE] Total bytes transferred: %llu\n", total_bytes_transferred);
+    kprintf("[PIPE] Total pipes created:    %llu\n", kstat_read(KSTAT(pipe_created)));
+    kprintf("[PIPE] Total bytes transferred: %llu\n",
+            kstat_read(KSTAT(pipe_bytes_read)) + kstat_read(KSTAT(pipe_bytes_written)));
+    kprintf("[PIPE] Pages spliced in/out:   %llu / %llu\n",
+            kstat_read(KSTAT(pipe_spliced_in)), kstat_read(KSTAT(pipe_spliced_out)));
     kprintf("[PIPE] Max pipe slots:         %u\n", PIPE_MAX_COUNT);
-    kprintf("[PIPE] Buffer size per pipe:   %u bytes\n", PIPE_BUFFER_SIZE);
+    kprintf("[PIPE] Default capacity:       %u pages (max %u)\n",
+            PIPE_DEFAULT_PAGES, PIPE_MAX_PAGES);
     kprintf("[PIPE] ----------------------------------\n");
 
     uint32_t active_count = 0;
@@ -616,8 +925,8 @@ void pipe_dump_stats(void) {
         if (pipe_table[i].flags != 0) {
             active_count++;
             pipe_t *p = &pipe_table[i];
-            kprintf("[PIPE] Pipe %u: %llu bytes buffered, R:%s W:%s, %u readers waiting, %u writers waiting\n",
-                    p->id, (uint64_t)p->count,
+            kprintf("[PIPE] Pipe %u: %llu bytes in %u/%u pages, R:%s W:%s, %u readers waiting, %u writers waiting\n",
+                    p->id, (uint64_t)p->count, p->used, p->max_pages,
                     (p->flags & PIPE_FLAG_READ_OPEN) ? "open" : "closed",
                     (p->flags & PIPE_FLAG_WRITE_OPEN) ? "open" : "closed",
                     p->read_waiter_count, p->write_waiter_count);
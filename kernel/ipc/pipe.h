@@ -2,18 +2,45 @@
  * AAAos Kernel - Unix-style Pipes
  *
  * Provides unidirectional byte streams for inter-process communication.
- * Pipes use a circular buffer internally and support blocking I/O.
+ * A pipe buffers its data in a ring of page references: each slot holds
+ * a physical page and the unread bytes in it. Capacity is counted in
+ * slots and can be raised to PIPE_MAX_PAGES (1MB) per pipe, with pages
+ * allocated only while they hold data.
+ *
+ * pipe_write/pipe_read copy into and out of slot pages. The vmsplice
+ * variants move whole page-aligned user pages instead: the writer's page
+ * is shared copy-on-write into a slot, and a full slot is mapped at the
+ * reader's page-aligned destination. Everything else is copied, so the
+ * byte stream is the same either way.
+ *
+ * Blocked readers and writers sleep on the pipe's event words in the
+ * address-keyed wait queues (waitq.h). Each end also has a readiness
+ * source (poll.h), raised where the sleepers are woken.
+ *
+ * The ends are descriptors in the creating process's table (fdtable.h).
+ * A forked child's copies count as readers and writers too, and an end
+ * closes when the last descriptor for it does.
  */
 
 #ifndef _AAAOS_IPC_PIPE_H
 #define _AAAOS_IPC_PIPE_H
 
 #include "../include/types.h"
+#include "poll.h"
+#include "../sched/spinlock.h"
 
 /* Pipe configuration */
-#define PIPE_BUFFER_SIZE        4096    /* 4KB circular buffer */
+#define PIPE_DEFAULT_PAGES      16      /* 64KB capacity of a new pipe */
+#define PIPE_MAX_PAGES          256     /* 1MB largest capacity (power of two) */
 #define PIPE_MAX_COUNT          128     /* Maximum number of pipes */
 
+/* Pipe end of a descriptor (its fd_entry_t aux value) */
+#define PIPE_END_READ           0
+#define PIPE_END_WRITE          1
+
+/* Slot flags */
+#define PIPE_BUF_SHARED         BIT(0)  /* Page also mapped elsewhere; never appended to */
+
 /* Pipe flags */
 #define PIPE_FLAG_READ_OPEN     BIT(0)  /* Read end is open */
 #define PIPE_FLAG_WRITE_OPEN    BIT(1)  /* Write end is open */
@@ -28,17 +55,31 @@
 #define PIPE_ERR_EMPTY          (-5)    /* Pipe buffer is empty (non-blocking) */
 #define PIPE_ERR_WOULDBLOCK     (-6)    /* Operation would block */
 #define PIPE_ERR_MAX_PIPES      (-7)    /* Maximum pipes reached */
+#define PIPE_ERR_BUSY           (-8)    /* More data buffered than the new capacity */
+#define PIPE_ERR_MAX_FDS        (-9)    /* Descriptor table full */
+
+/**
+ * Ring slot: a referenced page and the unread bytes in it
+ */
+typedef struct pipe_buf {
+    physaddr_t frame;                   /* Page holding the data */
+    uint16_t offset;                    /* First unread byte */
+    uint16_t len;                       /* Unread bytes */
+    uint32_t flags;                     /* PIPE_BUF_* */
+} pipe_buf_t;
 
 /**
  * Pipe structure
  * Represents a unidirectional byte stream
  */
 typedef struct pipe {
-    /* Circular buffer */
-    uint8_t buffer[PIPE_BUFFER_SIZE];
-    size_t read_pos;                    /* Read position in buffer */
-    size_t write_pos;                   /* Write position in buffer */
-    size_t count;                       /* Number of bytes in buffer */
+    /* Ring of page references */
+    pipe_buf_t bufs[PIPE_MAX_PAGES];
+    uint32_t head;                      /* Slot of the oldest data */
+    uint32_t used;                      /* Slots holding data */
+    uint32_t max_pages;                 /* Capacity in slots */
+    size_t count;                       /* Number of bytes buffered */
+    physaddr_t spare;                   /* Drained page kept for the next write */
 
     /* State */
     uint32_t flags;                     /* Pipe flags */
@@ -48,14 +89,18 @@ typedef struct pipe {
     uint32_t readers;                   /* Number of read references */
     uint32_t writers;                   /* Number of write references */
 
-    /* Process waiting */
-    struct process *read_waiters[8];    /* Processes waiting to read */
-    uint32_t read_waiter_count;
-    struct process *write_waiters[8];   /* Processes waiting to write */
-    uint32_t write_waiter_count;
+    /* Process waiting (wait queue words, bumped under lock) */
+    volatile uint32_t read_event;       /* Data arrived or the write end closed */
+    volatile uint32_t write_event;      /* Space freed or the read end closed */
+    uint32_t read_waiter_count;         /* Readers asleep on read_event */
+    uint32_t write_waiter_count;        /* Writers asleep on write_event */
+
+    /* Readiness of each end (poll.h) */
+    poll_source_t read_poll;            /* POLL_IN, POLL_HUP */
+    poll_source_t write_poll;           /* POLL_OUT, POLL_ERR */
 
     /* Synchronization */
-    volatile int lock;                  /* Spinlock for pipe access */
+    spinlock_t lock;                    /* Spinlock for pipe access */
 } pipe_t;
 
 /**
@@ -65,6 +110,7 @@ void pipe_init(void);
 
 /**
  * Create a new pipe
+ * Both ends go in the current descriptor table.
  * @param fds Array of two integers: fds[0] for read, fds[1] for write
  * @return PIPE_SUCCESS on success, negative error code on failure
  */
@@ -72,7 +118,7 @@ int pipe_create(int fds[2]);
 
 /**
  * Get pipe structure by file descriptor
- * @param fd File descriptor
+ * @param fd Descriptor in the current table
  * @return Pointer to pipe, or NULL if invalid
  */
 pipe_t* pipe_get(int fd);
@@ -96,16 +142,15 @@ ssize_t pipe_read(pipe_t *pipe, void *buf, size_t count);
 ssize_t pipe_write(pipe_t *pipe, const void *buf, size_t count);
 
 /**
- * Close a pipe end
+ * Close both ends of a pipe at once, whatever descriptors remain
  * @param pipe Pointer to pipe structure
- * @param is_read_end true to close read end, false for write end
  * @return PIPE_SUCCESS on success, negative error code on failure
  */
 int pipe_close(pipe_t *pipe);
 
 /**
  * Close pipe by file descriptor
- * @param fd File descriptor to close
+ * @param fd Descriptor in the current table
  * @return PIPE_SUCCESS on success, negative error code on failure
  */
 int pipe_close_fd(int fd);
@@ -128,6 +173,46 @@ ssize_t pipe_try_read(pipe_t *pipe, void *buf, size_t count);
  */
 ssize_t pipe_try_write(pipe_t *pipe, const void *buf, size_t count);
 
+/**
+ * Write to a pipe, passing whole user pages by reference
+ * Each page-aligned page of buf in the calling process's memory is
+ * shared into the pipe copy-on-write rather than copied; the rest is
+ * copied as by pipe_write. Blocks like pipe_write.
+ * @param pipe Pointer to pipe structure
+ * @param buf Buffer to write from
+ * @param count Number of bytes to write
+ * @return Number of bytes written, or negative error code
+ */
+ssize_t pipe_vmsplice_write(pipe_t *pipe, const void *buf, size_t count);
+
+/**
+ * Read from a pipe, taking whole pages by reference
+ * A full page at the head of the pipe is mapped in place of the page at
+ * a page-aligned destination in writable memory of the calling process;
+ * the rest is copied as by pipe_read. Blocks like pipe_read.
+ * @param pipe Pointer to pipe structure
+ * @param buf Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @return Number of bytes read, or negative error code
+ */
+ssize_t pipe_vmsplice_read(pipe_t *pipe, void *buf, size_t count);
+
+/**
+ * Set the capacity of a pipe
+ * @param pipe Pointer to pipe structure
+ * @param size Requested capacity in bytes (rounded up to whole pages)
+ * @return New capacity in bytes, or negative error code
+ */
+ssize_t pipe_set_capacity(pipe_t *pipe, size_t size);
+
+/**
+ * Readiness source of a pipe end
+ * @param fd Read or write end
+ * @param ready Set to the end's current POLL_* events
+ * @return The source, or NULL if fd is not an open pipe end
+ */
+poll_source_t* pipe_poll_source(int fd, uint32_t *ready);
+
 /**
  * Get number of bytes available to read
  * @param pipe Pointer to pipe structure
@@ -157,7 +242,7 @@ static inline bool pipe_is_empty(pipe_t *pipe) {
  * @return true if full
  */
 static inline bool pipe_is_full(pipe_t *pipe) {
-    return pipe ? pipe->count == PIPE_BUFFER_SIZE : true;
+    return pipe ? pipe_free_space(pipe) == 0 : true;
 }
 
 /**
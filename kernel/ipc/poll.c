@@ -0,0 +1,729 @@
+/**
+ * AAAos Kernel - Readiness Notification Implementation
+ *
+ * Each set keeps its watches in a small hash by key and a FIFO of the
+ * ones with events pending. A watch is on the ready FIFO at most once:
+ * raising more events on a queued watch only adds to its pending mask,
+ * and the set's event word is only bumped when a watch is newly queued.
+ * Sleepers wait on that word, with a timer bumping it for timeouts.
+ *
+ * Lock order: the registry lock, then a source's lock, then a set's lock.
+ * Linking a watch to or unlinking it from a source holds the registry
+ * lock, so a source going away and a watch being removed never race.
+ * All three are taken with interrupts off, as sources may be raised from
+ * interrupt handlers.
+ */
+
+#include "poll.h"
+#include "message.h"
+#include "pipe.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../mm/heap.h"
+#include "../proc/process.h"
+#include "../sched/timer.h"
+#include "../sched/waitq.h"
+#include "../syscall/syscall.h"
+
+/* poll_set_t.flags */
+#define POLL_SET_VALID          BIT(0)
+#define POLL_SET_DYING          BIT(1)  /* Destroyed, waiting for sleepers to leave */
+
+/**
+ * Interest in one source, owned by its set
+ */
+typedef struct poll_watch {
+    poll_source_t *source;              /* NULL once the source has gone away */
+    struct poll_set *set;
+    struct poll_watch *src_next;        /* On the source (source lock) */
+    struct poll_watch *src_prev;
+    struct poll_watch *hash_next;       /* In the set's hash (set lock) */
+    struct poll_watch *ready_next;      /* On the set's ready FIFO (set lock) */
+    struct poll_watch *ready_prev;
+    uint64_t key;
+    uint64_t data;
+    uint32_t mask;                      /* Events of interest, plus POLL_ALWAYS */
+    uint32_t pending;                   /* Raised since last reported */
+    bool queued;
+} poll_watch_t;
+
+/**
+ * Poll set
+ */
+typedef struct poll_set {
+    uint32_t id;
+    volatile uint32_t flags;            /* POLL_SET_* */
+    uint32_t owner_tgid;
+    uint32_t watch_count;
+    poll_watch_t *hash[POLL_HASH_SIZE];
+    poll_watch_t *ready_head;
+    poll_watch_t *ready_tail;
+    volatile uint32_t event;            /* Wait queue word, bumped as watches get queued */
+    uint32_t waiter_count;              /* Sleepers on event */
+    volatile int lock;
+} poll_set_t;
+
+/* Set table - statically allocated */
+static poll_set_t poll_table[POLL_MAX_SETS];
+
+/* Next set ID */
+static uint32_t next_poll_id = POLL_ID_BASE;
+
+/* Statistics */
+static uint64_t total_sets_created = 0;
+static uint64_t total_watches_queued = 0;
+static uint64_t total_events_reported = 0;
+
+/* Protects allocation in the table */
+static volatile int poll_table_lock = 0;
+
+/* Held while watches are linked to or unlinked from sources */
+static volatile int poll_registry_lock = 0;
+
+static inline uint64_t poll_lock(volatile int *lock) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void poll_unlock(volatile int *lock, uint64_t flags) {
+    __sync_lock_release(lock);
+    interrupts_restore(flags);
+}
+
+static inline poll_watch_t **poll_bucket(poll_set_t *set, uint64_t key) {
+    return &set->hash[(key * 0x9E3779B97F4A7C15ULL) >> (64 - 6)];
+}
+
+_Static_assert(POLL_HASH_SIZE == 64, "poll_bucket takes the top 6 bits");
+
+/**
+ * Initialize the poll subsystem
+ */
+void poll_init(void) {
+    kprintf("[POLL] Initializing Poll Subsystem...\n");
+
+    uint64_t flags = poll_lock(&poll_table_lock);
+    for (uint32_t i = 0; i < POLL_MAX_SETS; i++) {
+        poll_table[i].flags = 0;
+        poll_table[i].id = 0;
+    }
+    poll_unlock(&poll_table_lock, flags);
+
+    kprintf("[POLL] Poll set table initialized (%u slots)\n", POLL_MAX_SETS);
+}
+
+void poll_source_init(poll_source_t *src) {
+    src->watches = NULL;
+    src->lock = 0;
+}
+
+/**
+ * Find a set of the caller's and lock it
+ * @return The set, locked, or NULL
+ */
+static poll_set_t *poll_lookup(uint32_t id, uint64_t *irq) {
+    process_t *proc = process_get_current();
+    uint32_t tgid = proc ? proc->tgid : 0;
+
+    for (uint32_t i = 0; i < POLL_MAX_SETS; i++) {
+        poll_set_t *set = &poll_table[i];
+        if (!(set->flags & POLL_SET_VALID) || set->id != id) {
+            continue;
+        }
+
+        *irq = poll_lock(&set->lock);
+        if ((set->flags & POLL_SET_VALID) && set->id == id && set->owner_tgid == tgid) {
+            return set;
+        }
+        poll_unlock(&set->lock, *irq);
+        return NULL;
+    }
+    return NULL;
+}
+
+static poll_watch_t *poll_find(poll_set_t *set, uint64_t key) {
+    for (poll_watch_t *w = *poll_bucket(set, key); w; w = w->hash_next) {
+        if (w->key == key) {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static void poll_unqueue(poll_set_t *set, poll_watch_t *w) {
+    if (!w->queued) {
+        return;
+    }
+    if (w->ready_prev) {
+        w->ready_prev->ready_next = w->ready_next;
+    } else {
+        set->ready_head = w->ready_next;
+    }
+    if (w->ready_next) {
+        w->ready_next->ready_prev = w->ready_prev;
+    } else {
+        set->ready_tail = w->ready_prev;
+    }
+    w->ready_next = NULL;
+    w->ready_prev = NULL;
+    w->queued = false;
+}
+
+/**
+ * Record events on a watch, queueing it if it was not already
+ * Called with the set's lock held.
+ */
+static void poll_raise(poll_set_t *set, poll_watch_t *w, uint32_t events) {
+    events &= w->mask;
+    if (events == 0) {
+        return;
+    }
+
+    w->pending |= events;
+    if (w->queued) {
+        return;
+    }
+
+    w->ready_next = NULL;
+    w->ready_prev = set->ready_tail;
+    if (set->ready_tail) {
+        set->ready_tail->ready_next = w;
+    } else {
+        set->ready_head = w;
+    }
+    set->ready_tail = w;
+    w->queued = true;
+    total_watches_queued++;
+
+    __atomic_fetch_add(&set->event, 1, __ATOMIC_SEQ_CST);
+    if (set->waiter_count > 0) {
+        waitq_wake(&set->event, 1);
+    }
+}
+
+static void poll_source_link(poll_source_t *src, poll_watch_t *w) {
+    uint64_t flags = poll_lock(&src->lock);
+    w->source = src;
+    w->src_prev = NULL;
+    w->src_next = src->watches;
+    if (src->watches) {
+        src->watches->src_prev = w;
+    }
+    __atomic_store_n(&src->watches, w, __ATOMIC_RELEASE);
+    poll_unlock(&src->lock, flags);
+}
+
+static void poll_source_unlink(poll_watch_t *w) {
+    poll_source_t *src = w->source;
+    if (src == NULL) {
+        return;
+    }
+
+    uint64_t flags = poll_lock(&src->lock);
+    if (w->src_prev) {
+        w->src_prev->src_next = w->src_next;
+    } else {
+        src->watches = w->src_next;
+    }
+    if (w->src_next) {
+        w->src_next->src_prev = w->src_prev;
+    }
+    w->source = NULL;
+    poll_unlock(&src->lock, flags);
+}
+
+/**
+ * Raise events on a source
+ */
+void poll_notify(poll_source_t *src, uint32_t events) {
+    if (__atomic_load_n(&src->watches, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+
+    uint64_t flags = poll_lock(&src->lock);
+    for (poll_watch_t *w = src->watches; w; w = w->src_next) {
+        uint64_t set_flags = poll_lock(&w->set->lock);
+        poll_raise(w->set, w, events);
+        poll_unlock(&w->set->lock, set_flags);
+    }
+    poll_unlock(&src->lock, flags);
+}
+
+/**
+ * Disconnect all watches from a source
+ */
+void poll_source_detach(poll_source_t *src) {
+    if (__atomic_load_n(&src->watches, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+
+    uint64_t reg_flags = poll_lock(&poll_registry_lock);
+    uint64_t flags = poll_lock(&src->lock);
+
+    poll_watch_t *w = src->watches;
+    while (w) {
+        poll_watch_t *next = w->src_next;
+        uint64_t set_flags = poll_lock(&w->set->lock);
+        w->source = NULL;
+        w->src_next = NULL;
+        w->src_prev = NULL;
+        poll_raise(w->set, w, POLL_HUP);
+        poll_unlock(&w->set->lock, set_flags);
+        w = next;
+    }
+    src->watches = NULL;
+
+    poll_unlock(&src->lock, flags);
+    poll_unlock(&poll_registry_lock, reg_flags);
+}
+
+/**
+ * Create a poll set
+ */
+int64_t poll_create(void) {
+    process_t *proc = process_get_current();
+    if (proc == NULL) {
+        return -EINVAL;
+    }
+
+    uint64_t flags = poll_lock(&poll_table_lock);
+
+    poll_set_t *set = NULL;
+    for (uint32_t i = 0; i < POLL_MAX_SETS; i++) {
+        if (poll_table[i].flags == 0) {
+            set = &poll_table[i];
+            break;
+        }
+    }
+
+    if (set == NULL) {
+        poll_unlock(&poll_table_lock, flags);
+        kprintf("[POLL] Error: No free poll set slots (max %u)\n", POLL_MAX_SETS);
+        return -ENOMEM;
+    }
+
+    set->id = next_poll_id++;
+    set->owner_tgid = proc->tgid;
+    set->watch_count = 0;
+    for (uint32_t i = 0; i < POLL_HASH_SIZE; i++) {
+        set->hash[i] = NULL;
+    }
+    set->ready_head = NULL;
+    set->ready_tail = NULL;
+    set->waiter_count = 0;
+    set->lock = 0;
+    __atomic_store_n(&set->flags, POLL_SET_VALID, __ATOMIC_RELEASE);
+    total_sets_created++;
+
+    poll_unlock(&poll_table_lock, flags);
+
+#ifdef POLL_DEBUG_TRACE
+    kprintf("[POLL] PID %u: created poll set %u\n", proc->pid, set->id);
+#endif
+    return set->id;
+}
+
+/**
+ * Source and current readiness of a descriptor
+ * @param ready Set to the events the object has now
+ */
+static poll_source_t *poll_resolve(int fd, uint32_t *ready) {
+    if (fd == POLL_FD_MSG_QUEUE) {
+        process_t *proc = process_get_current();
+        return proc ? msg_poll_source(proc->pid, ready) : NULL;
+    }
+    return pipe_poll_source(fd, ready);
+}
+
+/**
+ * Report a watch's current state once, if it is still registered
+ */
+static void poll_prime(uint32_t id, uint64_t key, poll_watch_t *w, uint32_t ready) {
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        return;
+    }
+    if (poll_find(set, key) == w && w->source != NULL) {
+        poll_raise(set, w, ready);
+    }
+    poll_unlock(&set->lock, flags);
+}
+
+/**
+ * Add a watch on a source to a set
+ * @return The watch, or NULL with *err set
+ */
+static poll_watch_t *poll_set_link(uint32_t id, uint64_t key, poll_source_t *src,
+                                   uint32_t events, uint64_t data, int64_t *err) {
+    poll_watch_t *fresh = kmalloc(sizeof(poll_watch_t));
+    if (fresh == NULL) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    uint64_t reg_flags = poll_lock(&poll_registry_lock);
+
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        poll_unlock(&poll_registry_lock, reg_flags);
+        kfree(fresh);
+        *err = -EBADF;
+        return NULL;
+    }
+
+    /* A watch whose source went away is replaced, as the descriptor was closed */
+    poll_watch_t *w = poll_find(set, key);
+    if (w != NULL && w->source != NULL) {
+        poll_unlock(&set->lock, flags);
+        poll_unlock(&poll_registry_lock, reg_flags);
+        kfree(fresh);
+        *err = -EEXIST;
+        return NULL;
+    }
+
+    if (w != NULL) {
+        poll_unqueue(set, w);
+        kfree(fresh);
+    } else {
+        w = fresh;
+        w->key = key;
+        w->set = set;
+        w->queued = false;
+        w->ready_next = NULL;
+        w->ready_prev = NULL;
+        poll_watch_t **bucket = poll_bucket(set, key);
+        w->hash_next = *bucket;
+        *bucket = w;
+        set->watch_count++;
+    }
+    w->mask = events | POLL_ALWAYS;
+    w->data = data;
+    w->pending = 0;
+    w->source = NULL;
+
+    poll_unlock(&set->lock, flags);
+
+    poll_source_link(src, w);
+    poll_unlock(&poll_registry_lock, reg_flags);
+    return w;
+}
+
+int64_t poll_set_add_source(uint32_t id, uint64_t key, poll_source_t *src,
+                            uint32_t events, uint64_t data, uint32_t ready) {
+    if (src == NULL) {
+        return -EINVAL;
+    }
+
+    int64_t err;
+    poll_watch_t *w = poll_set_link(id, key, src, events, data, &err);
+    if (w == NULL) {
+        return err;
+    }
+    poll_prime(id, key, w, ready);
+    return 0;
+}
+
+/**
+ * Remove the watch with a key
+ */
+int64_t poll_set_remove(uint32_t id, uint64_t key) {
+    uint64_t reg_flags = poll_lock(&poll_registry_lock);
+
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        poll_unlock(&poll_registry_lock, reg_flags);
+        return -EBADF;
+    }
+    poll_watch_t *w = poll_find(set, key);
+    poll_unlock(&set->lock, flags);
+
+    if (w == NULL) {
+        poll_unlock(&poll_registry_lock, reg_flags);
+        return -ENOENT;
+    }
+
+    /* No notify reaches the watch once it is off the source */
+    poll_source_unlink(w);
+
+    set = poll_lookup(id, &flags);
+    if (set != NULL) {
+        poll_watch_t **link = poll_bucket(set, key);
+        while (*link != w) {
+            link = &(*link)->hash_next;
+        }
+        *link = w->hash_next;
+        poll_unqueue(set, w);
+        set->watch_count--;
+        poll_unlock(&set->lock, flags);
+    }
+
+    poll_unlock(&poll_registry_lock, reg_flags);
+    kfree(w);
+    return 0;
+}
+
+/**
+ * Change the events and data of a watch, reporting its state again
+ */
+static int64_t poll_modify(uint32_t id, int fd, uint32_t events, uint64_t data) {
+    uint64_t key = (uint64_t)(int64_t)fd;
+
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        return -EBADF;
+    }
+    poll_watch_t *w = poll_find(set, key);
+    if (w == NULL || w->source == NULL) {
+        poll_unlock(&set->lock, flags);
+        return -ENOENT;
+    }
+    w->mask = events | POLL_ALWAYS;
+    w->data = data;
+    w->pending &= w->mask;
+    if (w->pending == 0) {
+        poll_unqueue(set, w);
+    }
+    poll_unlock(&set->lock, flags);
+
+    uint32_t ready = 0;
+    if (poll_resolve(fd, &ready) != NULL) {
+        poll_prime(id, key, w, ready);
+    }
+    return 0;
+}
+
+/**
+ * Add, change or remove the watch on a descriptor
+ */
+int64_t poll_ctl(uint32_t id, int op, int fd, uint32_t events, uint64_t data) {
+    uint64_t key = (uint64_t)(int64_t)fd;
+    uint32_t ready = 0;
+
+    switch (op) {
+        case POLL_CTL_ADD: {
+            poll_source_t *src = poll_resolve(fd, &ready);
+            if (src == NULL) {
+                return -EBADF;
+            }
+
+            int64_t err;
+            poll_watch_t *w = poll_set_link(id, key, src, events, data, &err);
+            if (w == NULL) {
+                return err;
+            }
+
+            /* Read the state after linking, so a change in between is not missed */
+            if (poll_resolve(fd, &ready) == src) {
+                poll_prime(id, key, w, ready);
+            }
+            return 0;
+        }
+
+        case POLL_CTL_DEL:
+            return poll_set_remove(id, key);
+
+        case POLL_CTL_MOD:
+            return poll_modify(id, fd, events, data);
+
+        default:
+            return -EINVAL;
+    }
+}
+
+/**
+ * Timer callback for a wait's timeout
+ */
+static void poll_timer_expired(void *arg) {
+    poll_set_t *set = arg;
+
+    __atomic_fetch_add(&set->event, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&set->event, WAITQ_WAKE_ALL);
+}
+
+/**
+ * Take reported events off the ready FIFO
+ * Called with the set's lock held.
+ */
+static uint32_t poll_collect(poll_set_t *set, poll_event_t *events, uint32_t max) {
+    uint32_t n = 0;
+
+    while (n < max && set->ready_head) {
+        poll_watch_t *w = set->ready_head;
+        poll_unqueue(set, w);
+
+        uint32_t ev = w->pending & w->mask;
+        w->pending = 0;
+        if (ev) {
+            events[n].events = ev;
+            events[n].data = w->data;
+            n++;
+        }
+    }
+
+    total_events_reported += n;
+    return n;
+}
+
+/**
+ * Wait for ready watches
+ */
+int64_t poll_wait(uint32_t id, poll_event_t *events, uint32_t max, int64_t timeout_ms) {
+    if (events == NULL || max == 0) {
+        return -EINVAL;
+    }
+
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        return -EBADF;
+    }
+
+    uint64_t deadline = 0;
+    if (timeout_ms > 0) {
+        deadline = timer_now_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC;
+    }
+
+    ktimer_t timer;
+    bool armed = false;
+    int64_t result;
+
+    for (;;) {
+        result = poll_collect(set, events, max);
+        if (result > 0 || timeout_ms == 0) {
+            break;
+        }
+
+        if (timeout_ms > 0) {
+            uint64_t now = timer_now_ns();
+            if (now >= deadline) {
+                break;
+            }
+            if (!armed) {
+                ktimer_init(&timer, poll_timer_expired, set);
+                if (!ktimer_start(&timer, deadline - now, 0)) {
+                    /* No timer to end the sleep: report a timeout now */
+                    break;
+                }
+                armed = true;
+            }
+        }
+
+        uint32_t seen = __atomic_load_n(&set->event, __ATOMIC_SEQ_CST);
+        set->waiter_count++;
+        poll_unlock(&set->lock, flags);
+
+        /* A watch queued since we read the word has bumped it already */
+        waitq_wait(&set->event, seen);
+
+        flags = poll_lock(&set->lock);
+        set->waiter_count--;
+        if (!(set->flags & POLL_SET_VALID) || set->id != id) {
+            result = -EBADF;
+            break;
+        }
+    }
+
+    /* Hand what is left to the next sleeper */
+    if (result > 0 && set->ready_head && set->waiter_count > 0) {
+        waitq_wake(&set->event, 1);
+    }
+
+    poll_unlock(&set->lock, flags);
+
+    if (armed) {
+        ktimer_cancel(&timer);
+    }
+    return result;
+}
+
+/**
+ * Destroy a poll set
+ */
+int64_t poll_destroy(uint32_t id) {
+    uint64_t reg_flags = poll_lock(&poll_registry_lock);
+
+    uint64_t flags;
+    poll_set_t *set = poll_lookup(id, &flags);
+    if (set == NULL) {
+        poll_unlock(&poll_registry_lock, reg_flags);
+        return -EBADF;
+    }
+
+    /* Collect the watches; sleepers see the flag change and give up */
+    poll_watch_t *list = NULL;
+    for (uint32_t i = 0; i < POLL_HASH_SIZE; i++) {
+        while (set->hash[i]) {
+            poll_watch_t *w = set->hash[i];
+            set->hash[i] = w->hash_next;
+            w->hash_next = list;
+            list = w;
+        }
+    }
+    uint32_t watches = set->watch_count;
+    set->ready_head = NULL;
+    set->ready_tail = NULL;
+    set->watch_count = 0;
+
+    __atomic_store_n(&set->flags, POLL_SET_DYING, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&set->event, 1, __ATOMIC_SEQ_CST);
+    waitq_wake(&set->event, WAITQ_WAKE_ALL);
+    poll_unlock(&set->lock, flags);
+
+    /* Unlinked from its source, a watch can no longer reach the set */
+    for (poll_watch_t *w = list; w; w = w->hash_next) {
+        poll_source_unlink(w);
+    }
+    poll_unlock(&poll_registry_lock, reg_flags);
+
+    while (list) {
+        poll_watch_t *next = list->hash_next;
+        kfree(list);
+        list = next;
+    }
+
+    /* Keep the slot until the last sleeper has left it */
+    while (__atomic_load_n(&set->waiter_count, __ATOMIC_ACQUIRE) > 0) {
+        __asm__ __volatile__("pause");
+    }
+
+    flags = poll_lock(&poll_table_lock);
+    __atomic_store_n(&set->flags, 0, __ATOMIC_RELEASE);
+    poll_unlock(&poll_table_lock, flags);
+
+#ifdef POLL_DEBUG_TRACE
+    kprintf("[POLL] Destroyed poll set %u (%u watches)\n", id, watches);
+#else
+    UNUSED(watches);
+#endif
+    return 0;
+}
+
+/**
+ * Dump poll statistics
+ */
+void poll_dump_stats(void) {
+    uint32_t active = 0;
+    uint32_t watches = 0;
+    for (uint32_t i = 0; i < POLL_MAX_SETS; i++) {
+        if (poll_table[i].flags & POLL_SET_VALID) {
+            active++;
+            watches += poll_table[i].watch_count;
+        }
+    }
+
+    kprintf("[POLL] ========== Poll Statistics ==========\n");
+    kprintf("[POLL] Total slots:     %u\n", POLL_MAX_SETS);
+    kprintf("[POLL] Active sets:     %u\n", active);
+    kprintf("[POLL] Watches:         %u\n", watches);
+    kprintf("[POLL] Total created:   %llu\n", total_sets_created);
+    kprintf("[POLL] Watches queued:  %llu\n", total_watches_queued);
+    kprintf("[POLL] Events reported: %llu\n", total_events_reported);
+    kprintf("[POLL] =====================================\n");
+}
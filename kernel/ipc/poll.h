@@ -0,0 +1,147 @@
+/**
+ * AAAos Kernel - Readiness Notification (epoll-style)
+ *
+ * An object that can become readable or writable embeds a poll_source_t
+ * and raises events on it as they happen: new data, freed space, a closed
+ * end. A poll set is a list of interest registrations ("watches"), each
+ * naming one source and the events it cares about. Raising an event on a
+ * source queues the matching watches on their sets' ready lists, so a
+ * wait only looks at what is ready and one sleeper can watch any number
+ * of descriptors without scanning them.
+ *
+ * Notification is edge-triggered: a watch is reported once per batch of
+ * events raised since the previous report, and callers drain the object
+ * (until it would block) before waiting again. Adding a watch reports the
+ * object's current state once, so nothing that was already ready is lost.
+ *
+ * Descriptors are named the way the syscall layer names them: pipe fds
+ * (pipe.h) and POLL_FD_MSG_QUEUE for the caller's own message queue.
+ * Other kernel code can watch any source through poll_set_add_source.
+ */
+
+#ifndef _AAAOS_IPC_POLL_H
+#define _AAAOS_IPC_POLL_H
+
+#include "../include/types.h"
+
+/* Poll configuration */
+#define POLL_MAX_SETS           64      /* Maximum number of poll sets */
+#define POLL_HASH_SIZE          64      /* Watch lookup buckets per set (power of two) */
+#define POLL_WAIT_MAX_EVENTS    64      /* Events returned by one wait */
+
+/* Set IDs start above every pipe fd, so close() can tell them apart */
+#define POLL_ID_BASE            0x10000
+
+/* Events (same values as POLLIN/EPOLLIN and friends) */
+#define POLL_IN                 0x001   /* Data to read */
+#define POLL_OUT                0x004   /* Room to write */
+#define POLL_ERR                0x008   /* Error, e.g. the reading end closed */
+#define POLL_HUP                0x010   /* The other end closed */
+
+/* Reported whether asked for or not */
+#define POLL_ALWAYS             (POLL_ERR | POLL_HUP)
+
+/* SYS_EPOLL_CTL operations (same values as EPOLL_CTL_*) */
+#define POLL_CTL_ADD            1
+#define POLL_CTL_DEL            2
+#define POLL_CTL_MOD            3
+
+/* Descriptor naming the caller's message queue */
+#define POLL_FD_MSG_QUEUE       (-100)
+
+/**
+ * Event reported by a wait (layout of struct epoll_event)
+ */
+typedef struct poll_event {
+    uint32_t events;                    /* POLL_* */
+    uint64_t data;                      /* Registered with the watch */
+} PACKED poll_event_t;
+
+struct poll_watch;
+
+/**
+ * Readiness source, embedded in the object it describes
+ * Must outlive its watches: owners call poll_source_detach before the
+ * memory is reused or freed.
+ */
+typedef struct poll_source {
+    struct poll_watch *watches;         /* Registrations on this source */
+    volatile int lock;
+} poll_source_t;
+
+/**
+ * Initialize the poll subsystem
+ */
+void poll_init(void);
+
+/**
+ * Prepare an embedded source
+ */
+void poll_source_init(poll_source_t *src);
+
+/**
+ * Raise events on a source
+ * Queues every watch interested in them. Cheap when nothing watches the
+ * source. Safe from interrupt context.
+ * @param events POLL_* that just happened
+ */
+void poll_notify(poll_source_t *src, uint32_t events);
+
+/**
+ * Disconnect all watches from a source that is going away
+ * Each watch is reported POLL_HUP once and stays in its set until removed.
+ */
+void poll_source_detach(poll_source_t *src);
+
+/**
+ * Create a poll set owned by the caller's thread group
+ * @return Set ID, or negative error code
+ */
+int64_t poll_create(void);
+
+/**
+ * Add, change or remove the watch on a descriptor
+ * @param id Set ID
+ * @param op POLL_CTL_*
+ * @param fd Pipe fd or POLL_FD_MSG_QUEUE
+ * @param events POLL_* of interest (ignored for POLL_CTL_DEL)
+ * @param data Returned with the watch's events
+ * @return 0, or negative error code
+ */
+int64_t poll_ctl(uint32_t id, int op, int fd, uint32_t events, uint64_t data);
+
+/**
+ * Watch an arbitrary kernel source
+ * @param key Identifies the watch within the set (for poll_set_remove)
+ * @param ready Events the source has right now, reported once
+ * @return 0, or negative error code
+ */
+int64_t poll_set_add_source(uint32_t id, uint64_t key, poll_source_t *src,
+                            uint32_t events, uint64_t data, uint32_t ready);
+
+/**
+ * Remove the watch with a key
+ * @return 0, or negative error code
+ */
+int64_t poll_set_remove(uint32_t id, uint64_t key);
+
+/**
+ * Wait for ready watches
+ * @param events Filled with up to max events
+ * @param timeout_ms 0 to return at once, negative to wait forever
+ * @return Number of events (0 on timeout), or negative error code
+ */
+int64_t poll_wait(uint32_t id, poll_event_t *events, uint32_t max, int64_t timeout_ms);
+
+/**
+ * Destroy a poll set, failing its waiters
+ * @return 0, or negative error code
+ */
+int64_t poll_destroy(uint32_t id);
+
+/**
+ * Dump poll statistics (for debugging)
+ */
+void poll_dump_stats(void);
+
+#endif /* _AAAOS_IPC_POLL_H */
@@ -0,0 +1,281 @@
+/**
+ * AAAos Kernel - Semaphores Implementation
+ *
+ * The value word is both the count and the wait queue key. Waiters
+ * announce themselves in waiter_count before sleeping on a zero value,
+ * so a post only calls into the wait queue when someone may be asleep.
+ * Destroying a semaphore stores a negative value, which no waiter
+ * sleeps on.
+ */
+
+#include "semaphore.h"
+#include "../include/serial.h"
+#include "../proc/process.h"
+#include "../sched/waitq.h"
+#include "../stats/kstat.h"
+
+/* Value of a destroyed semaphore; waiters see it and give up */
+#define SEM_DESTROYED_VALUE     INT32_MIN
+
+/* Semaphore table - statically allocated */
+static semaphore_t sem_table[SEM_MAX_COUNT];
+
+/* Next semaphore ID */
+static uint32_t next_sem_id = 1;
+
+/* Statistics */
+KSTAT_COUNTER(sem_created, "ipc.sem.created", "Semaphores created");
+
+/* Protects allocation in the table */
+static volatile int sem_table_lock = 0;
+
+static inline void sem_acquire_lock(void) {
+    while (__sync_lock_test_and_set(&sem_table_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void sem_release_lock(void) {
+    __sync_lock_release(&sem_table_lock);
+}
+
+/**
+ * Initialize the semaphore subsystem
+ */
+void sem_init_subsystem(void) {
+    kprintf("[SEM] Initializing Semaphore Subsystem...\n");
+
+    sem_acquire_lock();
+    for (uint32_t i = 0; i < SEM_MAX_COUNT; i++) {
+        sem_table[i].flags = 0;
+        sem_table[i].id = 0;
+    }
+    sem_release_lock();
+
+    kprintf("[SEM] Semaphore table initialized (%u slots)\n", SEM_MAX_COUNT);
+}
+
+/**
+ * Allocate and initialize a semaphore
+ */
+static semaphore_t* sem_alloc(int initial_value, uint32_t flags) {
+    if (initial_value < 0) {
+        kprintf("[SEM] Error: Negative initial value %d\n", initial_value);
+        return NULL;
+    }
+
+    sem_acquire_lock();
+
+    semaphore_t *sem = NULL;
+    for (uint32_t i = 0; i < SEM_MAX_COUNT; i++) {
+        if (!(sem_table[i].flags & SEM_FLAG_VALID)) {
+            sem = &sem_table[i];
+            break;
+        }
+    }
+
+    if (!sem) {
+        sem_release_lock();
+        kprintf("[SEM] Error: No free semaphore slots (max %u)\n", SEM_MAX_COUNT);
+        return NULL;
+    }
+
+    process_t *current = process_get_current();
+
+    sem->value = initial_value;
+    sem->id = next_sem_id++;
+    sem->owner_pid = current ? current->pid : PID_INVALID;
+    sem->waiter_count = 0;
+    sem->wait_count = 0;
+    sem->post_count = 0;
+    __atomic_store_n(&sem->flags, SEM_FLAG_VALID | flags, __ATOMIC_RELEASE);
+    kstat_inc(sem_created);
+
+    sem_release_lock();
+
+    kprintf("[SEM] Created semaphore %u (value %d%s)\n",
+            sem->id, initial_value, (flags & SEM_FLAG_BINARY) ? ", binary" : "");
+    return sem;
+}
+
+/**
+ * Create a new semaphore
+ */
+semaphore_t* sem_create(int initial_value) {
+    return sem_alloc(initial_value, 0);
+}
+
+/**
+ * Create a binary semaphore
+ */
+semaphore_t* sem_create_binary(int initial_value) {
+    if (initial_value > 1) {
+        initial_value = 1;
+    }
+    return sem_alloc(initial_value, SEM_FLAG_BINARY);
+}
+
+/**
+ * Take the semaphore if it is available
+ * @return SEM_SUCCESS, SEM_ERR_WOULDBLOCK, or SEM_ERR_DESTROYED
+ */
+static int sem_take(semaphore_t *sem) {
+    int32_t value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+
+    while (value > 0) {
+        if (__atomic_compare_exchange_n(&sem->value, &value, value - 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&sem->wait_count, 1, __ATOMIC_RELAXED);
+            return SEM_SUCCESS;
+        }
+    }
+    return value < 0 ? SEM_ERR_DESTROYED : SEM_ERR_WOULDBLOCK;
+}
+
+/**
+ * Wait on a semaphore
+ */
+int sem_wait(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        return SEM_ERR_INVALID;
+    }
+
+    for (;;) {
+        int result = sem_take(sem);
+        if (result != SEM_ERR_WOULDBLOCK) {
+            return result;
+        }
+
+        /* Announce first: a post after this sees us and wakes the key */
+        __atomic_fetch_add(&sem->waiter_count, 1, __ATOMIC_SEQ_CST);
+        waitq_wait((const volatile uint32_t*)&sem->value, 0);
+        __atomic_fetch_sub(&sem->waiter_count, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * Post to a semaphore
+ */
+int sem_post(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        return SEM_ERR_INVALID;
+    }
+
+    int32_t value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    int32_t limit = (sem->flags & SEM_FLAG_BINARY) ? 1 : SEM_VALUE_MAX;
+
+    do {
+        if (value < 0) {
+            return SEM_ERR_DESTROYED;
+        }
+        if (value >= limit) {
+            return SEM_ERR_OVERFLOW;
+        }
+    } while (!__atomic_compare_exchange_n(&sem->value, &value, value + 1, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    __atomic_fetch_add(&sem->post_count, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&sem->waiter_count, __ATOMIC_SEQ_CST) > 0) {
+        waitq_wake((const volatile uint32_t*)&sem->value, 1);
+    }
+    return SEM_SUCCESS;
+}
+
+/**
+ * Try to wait on a semaphore (non-blocking)
+ */
+int sem_try_wait(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        return SEM_ERR_INVALID;
+    }
+    return sem_take(sem);
+}
+
+/**
+ * Destroy a semaphore, failing its waiters
+ */
+int sem_destroy(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        return SEM_ERR_INVALID;
+    }
+
+    /* No one sleeps on a negative value, and sleepers now are woken */
+    __atomic_store_n(&sem->value, SEM_DESTROYED_VALUE, __ATOMIC_SEQ_CST);
+    uint32_t woken = waitq_wake((const volatile uint32_t*)&sem->value, WAITQ_WAKE_ALL);
+
+    /* Keep the slot until the last waiter has left it */
+    while (__atomic_load_n(&sem->waiter_count, __ATOMIC_ACQUIRE) > 0) {
+        __asm__ __volatile__("pause");
+    }
+
+    kprintf("[SEM] Destroyed semaphore %u (%u waiters woken)\n", sem->id, woken);
+
+    sem_acquire_lock();
+    __atomic_store_n(&sem->flags, 0, __ATOMIC_RELEASE);
+    sem_release_lock();
+
+    return SEM_SUCCESS;
+}
+
+/**
+ * Get the current value of a semaphore
+ */
+int sem_get_value(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        return SEM_ERR_INVALID;
+    }
+
+    int32_t value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    return value < 0 ? SEM_ERR_DESTROYED : value;
+}
+
+/**
+ * Get a semaphore by ID
+ */
+semaphore_t* sem_get_by_id(uint32_t id) {
+    for (uint32_t i = 0; i < SEM_MAX_COUNT; i++) {
+        if ((sem_table[i].flags & SEM_FLAG_VALID) && sem_table[i].id == id) {
+            return &sem_table[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Dump semaphore statistics
+ */
+void sem_dump_stats(void) {
+    uint32_t active = 0;
+    for (uint32_t i = 0; i < SEM_MAX_COUNT; i++) {
+        if (sem_table[i].flags & SEM_FLAG_VALID) {
+            active++;
+        }
+    }
+
+    kprintf("[SEM] ========== Semaphore Statistics ==========\n");
+    kprintf("[SEM] Total slots:     %u\n", SEM_MAX_COUNT);
+    kprintf("[SEM] Active:          %u\n", active);
+    kprintf("[SEM] Total created:   %llu\n", kstat_read(KSTAT(sem_created)));
+    kprintf("[SEM] ==========================================\n");
+
+    waitq_dump_stats();
+}
+
+/**
+ * Dump info for a specific semaphore
+ */
+void sem_dump_info(semaphore_t *sem) {
+    if (!sem_is_valid(sem)) {
+        kprintf("[SEM] dump_info: invalid semaphore\n");
+        return;
+    }
+
+    kprintf("[SEM] === Semaphore %u ===\n", sem->id);
+    kprintf("[SEM]   Value:     %d%s\n", sem->value,
+            (sem->flags & SEM_FLAG_BINARY) ? " (binary)" : "");
+    kprintf("[SEM]   Owner:     PID %u\n", sem->owner_pid);
+    kprintf("[SEM]   Waiters:   %u\n", sem->waiter_count);
+    kprintf("[SEM]   Waits:     %llu\n", sem->wait_count);
+    kprintf("[SEM]   Posts:     %llu\n", sem->post_count);
+}
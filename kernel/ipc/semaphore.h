@@ -3,6 +3,10 @@
  *
  * Provides counting semaphores for process synchronization.
  * Supports blocking and non-blocking operations.
+ *
+ * Waiting is built on the address-keyed wait queues (waitq.h), keyed on
+ * the value word. Taking an available semaphore and posting one nobody
+ * waits for are a single atomic operation each.
  */
 
 #ifndef _AAAOS_IPC_SEMAPHORE_H
@@ -12,7 +16,6 @@
 
 /* Semaphore configuration */
 #define SEM_MAX_COUNT           128     /* Maximum number of semaphores */
-#define SEM_MAX_WAITERS         32      /* Maximum waiters per semaphore */
 #define SEM_VALUE_MAX           INT32_MAX /* Maximum semaphore value */
 
 /* Semaphore flags */
@@ -33,23 +36,17 @@
  * Semaphore structure
  */
 typedef struct semaphore {
-    int32_t value;                      /* Current value (can be negative) */
+    volatile int32_t value;             /* Current value (wait queue key); negative once destroyed */
     uint32_t id;                        /* Semaphore identifier */
-    uint32_t flags;                     /* Semaphore flags */
+    volatile uint32_t flags;            /* Semaphore flags */
     uint32_t owner_pid;                 /* Process that created the semaphore */
 
     /* Wait queue */
-    struct process *waiters[SEM_MAX_WAITERS]; /* Processes waiting on semaphore */
-    uint32_t waiter_count;              /* Number of waiting processes */
-    uint32_t waiter_head;               /* Head of waiter queue (FIFO) */
-    uint32_t waiter_tail;               /* Tail of waiter queue */
+    volatile uint32_t waiter_count;     /* Processes sleeping or about to sleep */
 
     /* Statistics */
     uint64_t wait_count;                /* Total number of wait operations */
     uint64_t post_count;                /* Total number of post operations */
-
-    /* Synchronization */
-    volatile int lock;                  /* Spinlock for semaphore access */
 } semaphore_t;
 
 /**
@@ -0,0 +1,230 @@
+/**
+ * AAAos Kernel - Structured Log Ring
+ *
+ * A record's seq is set to UINT64_MAX while it is filled and to its
+ * position in the ring last, so the consumer can tell a finished record
+ * from one being written or one already overwritten.
+ */
+
+#include "log.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../init/initcall.h"
+#include "../proc/process.h"
+#include "../sched/clock.h"
+#include "../sched/scheduler.h"
+#include "../sched/timer.h"
+
+#define LOG_RING_MASK       (LOG_RING_SIZE - 1)
+
+_Static_assert((LOG_RING_SIZE & LOG_RING_MASK) == 0, "LOG_RING_SIZE must be a power of 2");
+
+/**
+ * Log record
+ */
+typedef struct log_entry {
+    uint64_t seq;                       /* Position in its CPU's ring, written last */
+    uint64_t cycles;                    /* clock_cycles() when recorded */
+    log_site_t *site;
+    uint32_t nargs;
+    uint32_t suppressed;                /* Records the site dropped before this one */
+    uint64_t args[LOG_MAX_ARGS];
+} log_entry_t;
+
+/**
+ * Per-CPU ring
+ */
+typedef struct log_cpu {
+    uint64_t head;                      /* Slots claimed so far */
+    uint64_t tail;                      /* Next record to print (consumer) */
+    uint64_t records;
+    uint64_t lost;
+    uint64_t suppressed;
+    log_entry_t ring[LOG_RING_SIZE];
+} ALIGNED(64) log_cpu_t;
+
+static log_cpu_t log_cpus[PERCPU_MAX_CPUS];
+
+/* Serializes consumers (the thread and log_flush) */
+static volatile int log_drain_lock = 0;
+
+/* Set once the consumer thread runs; records are printed inline before */
+static volatile bool log_deferred = false;
+
+static uint64_t log_printed = 0;
+
+static inline log_cpu_t *log_this_cpu(void) {
+    uint32_t cpu = percpu_cpu_id();
+    return &log_cpus[cpu < PERCPU_MAX_CPUS ? cpu : 0];
+}
+
+/**
+ * Apply the call site's rate limit
+ * The window is reset racily; being off by a record or two is fine.
+ * @return false if the record is to be dropped
+ */
+static bool log_rate_ok(log_site_t *site, uint64_t now) {
+    uint64_t window = clock_tsc_khz() * LOG_RATE_WINDOW_MS;
+
+    /* Not calibrated yet: no limit */
+    if (window == 0 || site->unlimited) {
+        return true;
+    }
+    if (now - site->window_start >= window) {
+        site->window_start = now;
+        site->window_count = 0;
+    }
+    return __atomic_add_fetch(&site->window_count, 1, __ATOMIC_RELAXED) <= LOG_RATE_BURST;
+}
+
+/**
+ * Format a record onto the serial console
+ */
+static void log_print(const log_entry_t *e) {
+    uint64_t base, mult;
+    uint64_t ns = 0;
+
+    clock_get_scale(&base, &mult);
+    if (mult != 0 && e->cycles > base) {
+        ns = clock_cycles_to_ns(e->cycles - base);
+    }
+
+    kprintf("[%5llu.%06llu] [%s] ", ns / 1000000000ULL, (ns / 1000) % 1000000,
+            e->site->subsys);
+
+    /*
+     * Every argument is passed as a 64-bit value; a conversion that reads
+     * a narrower one takes its low bits, which is what was stored.
+     */
+    const uint64_t *a = e->args;
+    kprintf(e->site->fmt, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+
+    if (e->suppressed) {
+        kprintf("[%s] (%u similar messages suppressed)\n", e->site->subsys, e->suppressed);
+    }
+}
+
+void log_record(log_site_t *site, uint32_t nargs, const uint64_t *args) {
+    uint64_t now = clock_cycles();
+    log_cpu_t *c = log_this_cpu();
+
+    if (!log_rate_ok(site, now)) {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t seq = __atomic_fetch_add(&c->head, 1, __ATOMIC_RELAXED);
+    log_entry_t *e = &c->ring[seq & LOG_RING_MASK];
+    __atomic_store_n(&e->seq, UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    e->cycles = now;
+    e->site = site;
+    e->nargs = nargs;
+    e->suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < LOG_MAX_ARGS; i++) {
+        e->args[i] = i < nargs ? args[i] : 0;
+    }
+    __atomic_store_n(&e->seq, seq, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&c->records, 1, __ATOMIC_RELAXED);
+
+    if (!log_deferred) {
+        log_flush();
+    }
+}
+
+/**
+ * Print the finished records of one CPU (drain lock held)
+ */
+static void log_drain_cpu(log_cpu_t *c) {
+    uint64_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+
+    /* Skip what the writers lapped */
+    if (head - c->tail > LOG_RING_SIZE) {
+        c->lost += head - LOG_RING_SIZE - c->tail;
+        c->tail = head - LOG_RING_SIZE;
+    }
+
+    while (c->tail != head) {
+        log_entry_t *slot = &c->ring[c->tail & LOG_RING_MASK];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == UINT64_MAX || seq < c->tail) {
+            /* Still being written; pick it up next time */
+            return;
+        }
+
+        log_entry_t copy = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != c->tail || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            /* Overwritten while we looked */
+            c->lost++;
+            c->tail++;
+            continue;
+        }
+
+        log_print(&copy);
+        log_printed++;
+        c->tail++;
+    }
+}
+
+void log_flush(void) {
+    if (__sync_lock_test_and_set(&log_drain_lock, 1)) {
+        return;
+    }
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        log_drain_cpu(&log_cpus[cpu]);
+    }
+    __sync_lock_release(&log_drain_lock);
+}
+
+/**
+ * Body of the consumer thread
+ */
+static void log_thread(void *arg) {
+    UNUSED(arg);
+    while (1) {
+        log_flush();
+        timer_sleep_ms(LOG_DRAIN_MS);
+    }
+}
+
+bool log_start(void) {
+    if (log_deferred || !scheduler_is_running()) {
+        return false;
+    }
+
+    process_t *thread = thread_create(NULL, "logd", log_thread, NULL);
+    if (!thread || !scheduler_add(thread)) {
+        kprintf("[LOG] Cannot start the consumer thread, printing records inline\n");
+        return false;
+    }
+    log_deferred = true;
+    return true;
+}
+
+/**
+ * Start the consumer if threads can run yet; otherwise stay inline
+ */
+static bool log_initcall(void) {
+    return !scheduler_is_running() || log_start();
+}
+
+INITCALL(log, log_initcall, 0);
+
+void log_get_stats(log_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    /* A racy sum is fine for statistics */
+    stats->records = 0;
+    stats->lost = 0;
+    stats->suppressed = 0;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        stats->records += __atomic_load_n(&log_cpus[cpu].records, __ATOMIC_RELAXED);
+        stats->lost += __atomic_load_n(&log_cpus[cpu].lost, __ATOMIC_RELAXED);
+        stats->suppressed += __atomic_load_n(&log_cpus[cpu].suppressed, __ATOMIC_RELAXED);
+    }
+    stats->printed = __atomic_load_n(&log_printed, __ATOMIC_RELAXED);
+}
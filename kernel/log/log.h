@@ -0,0 +1,116 @@
+/**
+ * AAAos Kernel - Structured Log Ring
+ *
+ * log_event records a message without formatting it: the call site's
+ * static descriptor (format, subsystem, level), the TSC count and up to
+ * LOG_MAX_ARGS arguments go into a ring owned by the calling CPU. Slots
+ * are claimed with an atomic add, so writers never lock or wait and
+ * interrupt handlers may log; once a ring wraps, the oldest records are
+ * overwritten and counted as lost. A consumer thread formats the records
+ * onto the serial console every LOG_DRAIN_MS; until it runs (early boot)
+ * records are printed at once.
+ *
+ * Each call site allows LOG_RATE_BURST records per LOG_RATE_WINDOW_MS;
+ * the ones beyond are counted, and the next record printed from the
+ * site says how many were suppressed. Records above serial_log_level
+ * cost one load and branch.
+ *
+ * Since formatting is deferred, "%s" arguments must stay valid: string
+ * literals and names from static tables, not buffers on the stack. The
+ * arguments are stored as 64-bit integers; floating point is not
+ * supported.
+ */
+
+#ifndef _AAAOS_LOG_H
+#define _AAAOS_LOG_H
+
+#include "../include/types.h"
+#include "../include/serial.h"
+
+/* Limits */
+#define LOG_RING_SIZE           256     /* Records per CPU (power of two) */
+#define LOG_MAX_ARGS            8
+#define LOG_RATE_BURST          10      /* Records per call site and window */
+#define LOG_RATE_WINDOW_MS      1000
+#define LOG_DRAIN_MS            10      /* Consumer thread period */
+
+/**
+ * Call site descriptor (one static per log_event)
+ */
+typedef struct log_site {
+    const char *fmt;
+    const char *subsys;                 /* Printed as "[subsys] " */
+    int level;                          /* SERIAL_LOG_* */
+    volatile uint64_t window_start;     /* TSC count the rate window began */
+    volatile uint32_t window_count;     /* Records in the window */
+    volatile uint32_t suppressed;       /* Dropped since the last one recorded */
+    bool unlimited;                     /* Not rate limited (tracepoints) */
+} log_site_t;
+
+/**
+ * Log ring statistics, summed over all CPUs
+ */
+typedef struct log_stats {
+    uint64_t records;                   /* Records written */
+    uint64_t printed;                   /* Records formatted by the consumer */
+    uint64_t lost;                      /* Overwritten before they were printed */
+    uint64_t suppressed;                /* Dropped by rate limiting */
+} log_stats_t;
+
+/* Out-of-line half of log_event */
+void log_record(log_site_t *site, uint32_t nargs, const uint64_t *args);
+
+/* Argument count and conversion, for up to LOG_MAX_ARGS arguments */
+#define LOG_NARGS(...)      LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define LOG_CAT(a, b)       LOG_CAT_(a, b)
+#define LOG_CAT_(a, b)      a##b
+#define LOG_ARG(x)          ((uint64_t)(uintptr_t)(x))
+#define LOG_ARGS_0()
+#define LOG_ARGS_1(a)       LOG_ARG(a)
+#define LOG_ARGS_2(a, ...)  LOG_ARG(a), LOG_ARGS_1(__VA_ARGS__)
+#define LOG_ARGS_3(a, ...)  LOG_ARG(a), LOG_ARGS_2(__VA_ARGS__)
+#define LOG_ARGS_4(a, ...)  LOG_ARG(a), LOG_ARGS_3(__VA_ARGS__)
+#define LOG_ARGS_5(a, ...)  LOG_ARG(a), LOG_ARGS_4(__VA_ARGS__)
+#define LOG_ARGS_6(a, ...)  LOG_ARG(a), LOG_ARGS_5(__VA_ARGS__)
+#define LOG_ARGS_7(a, ...)  LOG_ARG(a), LOG_ARGS_6(__VA_ARGS__)
+#define LOG_ARGS_8(a, ...)  LOG_ARG(a), LOG_ARGS_7(__VA_ARGS__)
+
+/**
+ * Log a message from a hot path
+ * @param level_ SERIAL_LOG_* level
+ * @param subsys_ Subsystem name, e.g. "TCP"
+ * @param fmt_ serial_printf format (a string literal), without the prefix
+ * @param ... Up to LOG_MAX_ARGS integer or pointer arguments
+ */
+#define log_event(level_, subsys_, fmt_, ...)                               \
+    do {                                                                    \
+        static log_site_t log_site_ = {                                     \
+            .fmt = fmt_, .subsys = subsys_, .level = level_                 \
+        };                                                                  \
+        if ((level_) <= serial_log_level) {                                 \
+            const uint64_t log_args_[LOG_MAX_ARGS + 1] = {                  \
+                LOG_CAT(LOG_ARGS_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)     \
+            };                                                              \
+            log_record(&log_site_, LOG_NARGS(__VA_ARGS__), log_args_);      \
+        }                                                                   \
+    } while (0)
+
+/**
+ * Start the consumer thread (needs the scheduler)
+ * @return false if the thread could not be started
+ */
+bool log_start(void);
+
+/**
+ * Print every record queued so far
+ * Safe on panic paths: gives up rather than wait for another drainer.
+ */
+void log_flush(void);
+
+/**
+ * Get the log ring statistics
+ */
+void log_get_stats(log_stats_t *stats);
+
+#endif /* _AAAOS_LOG_H */
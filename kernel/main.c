@@ -11,6 +11,9 @@
 #include "include/vga.h"
 #include "arch/x86_64/include/gdt.h"
 #include "arch/x86_64/include/idt.h"
+#include "arch/x86_64/include/percpu.h"
+#include "init/bootprof.h"
+#include "init/initcall.h"
 
 /* Kernel version */
 #define KERNEL_VERSION_MAJOR    0
@@ -152,6 +155,9 @@ static void keyboard_handler(interrupt_frame_t *frame) {
  * @param boot_info Pointer to boot information structure (passed in RDI)
  */
 void kernel_main(boot_info_t *boot_info) {
+    bootprof_mark(BOOTPROF_KERNEL_ENTRY);
+    bootprof_init(boot_info);
+
     /* Initialize serial port for debugging */
     serial_init_com1();
     kprintf("\n");
@@ -178,13 +184,21 @@ void kernel_main(boot_info_t *boot_info) {
     /* Initialize GDT */
     vga_puts("Initializing GDT...");
     gdt_init();
+    bootprof_mark(BOOTPROF_GDT);
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts(" OK\n");
     vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
 
+    /* Per-CPU data for the BSP (after GDT, which reloads GS) */
+    percpu_init_cpu(0, 0);
+
     /* Initialize IDT */
     vga_puts("Initializing IDT...");
     idt_init();
+    bootprof_mark(BOOTPROF_IDT);
+
+    /* From here on logging no longer waits for the UART */
+    serial_enable_irq(COM1_PORT);
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts(" OK\n");
     vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
@@ -207,6 +221,15 @@ void kernel_main(boot_info_t *boot_info) {
     vga_puts(" OK\n");
     vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
 
+    /* Bring up the declared subsystems in dependency order */
+    vga_puts("Running initcalls...");
+    bool initcalls_ok = initcall_run_all();
+    vga_set_color(initcalls_ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+    vga_puts(initcalls_ok ? " OK\n" : " some failed\n");
+    vga_set_color(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+    initcall_dump_trace();
+    bootprof_dump();
+
     /* Print ready message */
     vga_puts("\n");
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -0,0 +1,86 @@
+/**
+ * AAAos Kernel - Arena (Bump) Allocator Implementation
+ *
+ * Allocation is a pointer bump within the current region. When a request
+ * does not fit, a new chunk of at least KARENA_CHUNK_PAGES pages is taken
+ * from the PMM and becomes the current region; whatever was left in the
+ * old region is abandoned until reset. Chunks are used through the
+ * identity map, like the heap's pages.
+ */
+
+#include "arena.h"
+#include "pmm.h"
+
+#define KARENA_CHUNK_HEADER     ALIGN_UP(sizeof(karena_chunk_t), KARENA_ALIGN)
+
+/**
+ * Initialize an arena
+ */
+void karena_init(karena_t *arena, void *seed, size_t seed_size) {
+    arena->chunks = NULL;
+
+    if (seed == NULL) {
+        seed_size = 0;
+    }
+
+    /* Trim the seed so every allocation starts aligned */
+    uint8_t *start = (uint8_t*)ALIGN_UP((uintptr_t)seed, KARENA_ALIGN);
+    size_t lost = (size_t)(start - (uint8_t*)seed);
+    arena->seed = start;
+    arena->seed_size = seed_size > lost ? seed_size - lost : 0;
+    arena->cur = arena->seed;
+    arena->end = arena->seed + arena->seed_size;
+}
+
+/**
+ * Allocate from an arena
+ */
+void *karena_alloc(karena_t *arena, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    size = ALIGN_UP(size, KARENA_ALIGN);
+
+    if (size <= (size_t)(arena->end - arena->cur)) {
+        void *ptr = arena->cur;
+        arena->cur += size;
+        return ptr;
+    }
+
+    /* Start a new chunk big enough for this request */
+    size_t pages = ALIGN_UP(size + KARENA_CHUNK_HEADER, PMM_PAGE_SIZE) / PMM_PAGE_SIZE;
+    pages = MAX(pages, (size_t)KARENA_CHUNK_PAGES);
+
+    physaddr_t phys = pmm_alloc_pages(pages);
+    if (phys == 0) {
+        return NULL;
+    }
+
+    karena_chunk_t *chunk = (karena_chunk_t*)phys;
+    chunk->pages = pages;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    uint8_t *base = (uint8_t*)chunk + KARENA_CHUNK_HEADER;
+    arena->cur = base + size;
+    arena->end = (uint8_t*)chunk + pages * PMM_PAGE_SIZE;
+    return base;
+}
+
+/**
+ * Free everything in an arena
+ */
+void karena_reset(karena_t *arena) {
+    karena_chunk_t *chunk = arena->chunks;
+
+    while (chunk != NULL) {
+        karena_chunk_t *next = chunk->next;
+        pmm_free_pages((physaddr_t)chunk, chunk->pages);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+    arena->cur = arena->seed;
+    arena->end = arena->seed + arena->seed_size;
+}
@@ -0,0 +1,72 @@
+/**
+ * AAAos Kernel - Arena (Bump) Allocator
+ *
+ * An arena hands out memory by bumping a pointer and frees everything at
+ * once with karena_reset(). It is meant for request-scoped work whose
+ * temporaries all die together, such as resolving one path.
+ *
+ * An arena can be seeded with a caller buffer (usually on the stack), so
+ * small requests never allocate. Once the seed is used up, the arena
+ * takes page-sized chunks from the PMM and returns them on reset.
+ */
+
+#ifndef _AAAOS_MM_ARENA_H
+#define _AAAOS_MM_ARENA_H
+
+#include "../include/types.h"
+
+/* Arena configuration */
+#define KARENA_ALIGN            16          /* Alignment of every allocation */
+#define KARENA_CHUNK_PAGES      1           /* Minimum pages per overflow chunk */
+
+/* Overflow chunk header, at the start of each PMM run */
+typedef struct karena_chunk {
+    struct karena_chunk *next;
+    size_t pages;
+} karena_chunk_t;
+
+/**
+ * Arena state
+ */
+typedef struct karena {
+    uint8_t *cur;                   /* Next free byte */
+    uint8_t *end;                   /* End of the current region */
+    karena_chunk_t *chunks;         /* Overflow chunks, newest first */
+    uint8_t *seed;                  /* Caller-provided initial region */
+    size_t seed_size;
+} karena_t;
+
+/**
+ * Declare an arena seeded by a stack buffer that resets at end of scope
+ * @param name Name of the karena_t variable
+ * @param bytes Size of the stack seed
+ */
+#define KARENA_SCOPED(name, bytes)                                      \
+    uint8_t name##_seed[bytes] ALIGNED(KARENA_ALIGN);                   \
+    karena_t name __attribute__((cleanup(karena_reset)));               \
+    karena_init(&name, name##_seed, sizeof(name##_seed))
+
+/**
+ * Initialize an arena
+ * @param arena Arena to initialize
+ * @param seed Initial buffer, or NULL to start with page chunks
+ * @param seed_size Size of the seed buffer in bytes
+ */
+void karena_init(karena_t *arena, void *seed, size_t seed_size);
+
+/**
+ * Allocate from an arena
+ * @param arena Arena to allocate from
+ * @param size Number of bytes
+ * @return KARENA_ALIGN-aligned pointer, or NULL on failure
+ */
+void *karena_alloc(karena_t *arena, size_t size);
+
+/**
+ * Free everything allocated from an arena and return its chunks to the
+ * PMM. The arena is left ready for reuse with its original seed.
+ * @param arena Arena to reset
+ */
+void karena_reset(karena_t *arena);
+
+#endif /* _AAAOS_MM_ARENA_H */
@@ -2,43 +2,110 @@
  * AAAos Kernel - Heap Memory Allocator Implementation
  *
  * Simple block allocator with:
- * - Free list for tracking available blocks
- * - First-fit allocation strategy
+ * - Segregated free lists, one per power-of-two size class
+ * - A bitmap of non-empty classes so picking a list is a single ctz
+ * - First-fit within the request's own class, any block from a larger one
  * - Block coalescing on free
  * - Automatic heap expansion via PMM
+ *
+ * Free blocks are doubly linked: 'next' lives in the header, the back link
+ * is stored in the (unused) payload of the free block.
+ *
+ * Requests up to HEAP_MAG_MAX_SIZE bytes go through a per-CPU magazine
+ * layer first. Each CPU keeps a loaded and a previous magazine per class
+ * and touches them only with interrupts disabled, so the hot path takes
+ * no lock at all. When both are exhausted (or both full on free) a whole
+ * magazine is swapped with the per-class depot under the depot lock.
+ * Objects parked in magazines stay marked used in the block list.
  */
 
 #include "heap.h"
 #include "pmm.h"
+#include "slab.h"
+#include "vmalloc.h"
 #include "../include/serial.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../init/bootprof.h"
+#include "../sched/spinlock.h"
+#include "../stats/kstat.h"
+#include "../../lib/libc/string.h"
 
 /* Heap state */
 static virtaddr_t heap_start = 0;
 static virtaddr_t heap_end = 0;
 static virtaddr_t heap_max = 0;
-static heap_block_t *free_list = NULL;
 static bool heap_initialized = false;
 
+/*
+ * Size classes: class c holds free blocks of size [2^(c+MIN_SHIFT), 2^(c+MIN_SHIFT+1)),
+ * the last class holds everything larger.
+ */
+#define HEAP_CLASS_MIN_SHIFT    6           /* Smallest block is 64 bytes */
+#define HEAP_NUM_CLASSES        24
+
+static heap_block_t *free_lists[HEAP_NUM_CLASSES];
+static uint32_t free_class_bitmap = 0;      /* Bit c set = free_lists[c] non-empty */
+
 /* Heap statistics */
 static heap_stats_t heap_stats = {0};
 
-/* Simple spinlock for thread safety */
-static volatile int heap_lock = 0;
+/* Lock of the block list, free lists and statistics */
+SPINLOCK_DEFINE(heap_lock, "mm.heap");
+
+/* A magazine: a fixed-size stack of free objects of one class */
+typedef struct heap_magazine {
+    struct heap_magazine *next;     /* Depot list link */
+    uint32_t rounds;                /* Objects currently held */
+    void *objs[HEAP_MAG_ROUNDS];
+} heap_magazine_t;
+
+/* Per-class depot of full and empty magazines */
+typedef struct heap_depot {
+    spinlock_t lock;
+    heap_magazine_t *full;
+    heap_magazine_t *empty;
+    uint32_t full_count;
+    uint32_t empty_count;
+} heap_depot_t;
+
+/* A CPU's pair of magazines for one class */
+typedef struct heap_mag_slot {
+    heap_magazine_t *loaded;
+    heap_magazine_t *previous;
+} heap_mag_slot_t;
+
+/* Per-CPU magazine state, touched only by its own CPU with interrupts off */
+typedef struct heap_mag_cpu {
+    heap_mag_slot_t slots[HEAP_MAG_NUM_CLASSES];
+    uint64_t hits;
+    uint64_t misses;
+    heap_latency_t lat[HEAP_LAT_NUM_OPS];
+} ALIGNED(64) heap_mag_cpu_t;
+
+/* Enough magazines for two per CPU plus some depot slack, per class */
+#define HEAP_MAG_POOL_PER_CLASS (PERCPU_MAX_CPUS * 2 + 8)
+
+static heap_magazine_t mag_pool[HEAP_MAG_NUM_CLASSES][HEAP_MAG_POOL_PER_CLASS];
+static heap_depot_t mag_depot[HEAP_MAG_NUM_CLASSES];
+LOCK_CLASS(heap_depot, "mm.heap.depot");
+static heap_mag_cpu_t mag_cpus[PERCPU_MAX_CPUS];
+
+/* Latency sampling switch */
+static volatile bool heap_lat_enabled = false;
 
 /**
  * Acquire heap lock
  */
 static inline void heap_acquire_lock(void) {
-    while (__sync_lock_test_and_set(&heap_lock, 1)) {
-        __asm__ __volatile__("pause");
-    }
+    spinlock_acquire(&heap_lock);
 }
 
 /**
  * Release heap lock
  */
 static inline void heap_release_lock(void) {
-    __sync_lock_release(&heap_lock);
+    spinlock_release(&heap_lock);
 }
 
 /**
@@ -92,6 +159,16 @@ static inline heap_block_t *data_to_block(void *ptr) {
     return (heap_block_t*)((virtaddr_t)ptr - sizeof(heap_block_t));
 }
 
+/**
+ * Check whether a pointer could be a heap allocation
+ * Tested on the pointer itself: a page-aligned area right after heap_end
+ * would otherwise have its "header" inside the heap.
+ */
+static inline bool heap_contains(const void *ptr) {
+    virtaddr_t addr = (virtaddr_t)ptr;
+    return addr >= heap_start + sizeof(heap_block_t) && addr < heap_end;
+}
+
 /**
  * Get next block in memory
  */
@@ -104,124 +181,124 @@ static inline heap_block_t *block_get_next_physical(heap_block_t *block) {
 }
 
 /**
- * Simple memset implementation
+ * Drop the magazine class tag from a block
  */
-static void heap_memset(void *dest, uint8_t val, size_t count) {
-    uint8_t *d = (uint8_t*)dest;
-    while (count--) {
-        *d++ = val;
-    }
+static inline void block_clear_magazine(heap_block_t *block) {
+    block->flags &= ~(BLOCK_FLAG_MAGAZINE | BLOCK_FLAG_CACHED |
+                      (0xFFu << BLOCK_MAG_CLASS_SHIFT));
 }
 
 /**
- * Simple memcpy implementation
+ * Get size class for a block size
  */
-static void heap_memcpy(void *dest, const void *src, size_t count) {
-    uint8_t *d = (uint8_t*)dest;
-    const uint8_t *s = (const uint8_t*)src;
-    while (count--) {
-        *d++ = *s++;
+static inline size_t size_to_class(size_t size) {
+    size_t shift = 63 - (size_t)__builtin_clzll(size | 1);
+    if (shift < HEAP_CLASS_MIN_SHIFT) {
+        return 0;
     }
+    return MIN(shift - HEAP_CLASS_MIN_SHIFT, HEAP_NUM_CLASSES - 1);
 }
 
 /**
- * Add block to free list (sorted by address for coalescing)
+ * Back link of a free block, kept in its payload
  */
-static void free_list_add(heap_block_t *block) {
-    block_set_free(block);
+static inline heap_block_t **block_free_prev(heap_block_t *block) {
+    return (heap_block_t**)block_to_data(block);
+}
 
-    /* Empty list case */
-    if (free_list == NULL) {
-        free_list = block;
-        block->next = NULL;
-        heap_stats.free_block_count++;
-        return;
-    }
+/**
+ * Add block to the free list of its size class
+ */
+static void free_list_add(heap_block_t *block) {
+    size_t cls = size_to_class(block_get_size(block));
 
-    /* Insert at head if block comes before current head */
-    if ((virtaddr_t)block < (virtaddr_t)free_list) {
-        block->next = free_list;
-        free_list = block;
-        heap_stats.free_block_count++;
-        return;
-    }
+    block_set_free(block);
 
-    /* Find insertion point (sorted by address) */
-    heap_block_t *current = free_list;
-    while (current->next != NULL && (virtaddr_t)current->next < (virtaddr_t)block) {
-        current = current->next;
+    block->next = free_lists[cls];
+    *block_free_prev(block) = NULL;
+    if (free_lists[cls] != NULL) {
+        *block_free_prev(free_lists[cls]) = block;
     }
+    free_lists[cls] = block;
 
-    /* Insert after current */
-    block->next = current->next;
-    current->next = block;
+    free_class_bitmap |= (uint32_t)BIT(cls);
     heap_stats.free_block_count++;
 }
 
 /**
- * Remove block from free list
+ * Remove block from the free list of its size class
+ * Must be called before the block's size changes.
  */
 static void free_list_remove(heap_block_t *block) {
-    if (free_list == NULL) {
-        return;
+    size_t cls = size_to_class(block_get_size(block));
+    heap_block_t *prev = *block_free_prev(block);
+
+    if (prev != NULL) {
+        prev->next = block->next;
+    } else if (free_lists[cls] == block) {
+        free_lists[cls] = block->next;
+    } else {
+        return;     /* Not on a free list */
     }
 
-    /* Remove from head */
-    if (free_list == block) {
-        free_list = block->next;
-        block->next = NULL;
-        heap_stats.free_block_count--;
-        return;
+    if (block->next != NULL) {
+        *block_free_prev(block->next) = prev;
     }
 
-    /* Find and remove */
-    heap_block_t *current = free_list;
-    while (current->next != NULL && current->next != block) {
-        current = current->next;
+    if (free_lists[cls] == NULL) {
+        free_class_bitmap &= ~(uint32_t)BIT(cls);
     }
 
-    if (current->next == block) {
-        current->next = block->next;
-        block->next = NULL;
-        heap_stats.free_block_count--;
-    }
+    block->next = NULL;
+    *block_free_prev(block) = NULL;
+    heap_stats.free_block_count--;
 }
 
 /**
  * Coalesce adjacent free blocks
+ * The block must be on a free list; the merged block is re-filed under
+ * its new size class.
  */
 static void coalesce_blocks(heap_block_t *block) {
     if (block == NULL || block_is_used(block)) {
         return;
     }
 
-    /* Try to coalesce with next block in memory */
     heap_block_t *next = block_get_next_physical(block);
-    if (next != NULL && !block_is_used(next)) {
+    heap_block_t *prev = block->prev;
+    bool merge_next = next != NULL && !block_is_used(next);
+    bool merge_prev = prev != NULL && !block_is_used(prev);
+
+    if (!merge_next && !merge_prev) {
+        return;
+    }
+
+    free_list_remove(block);
+
+    /* Try to coalesce with next block in memory */
+    if (merge_next) {
         /* Remove next from free list */
         free_list_remove(next);
 
         /* Merge sizes */
         block->size = block_get_size(block) + block_get_size(next);
+        heap_stats.block_count--;
 
         /* Update prev pointer of block after next */
         heap_block_t *after_next = block_get_next_physical(block);
         if (after_next != NULL) {
             after_next->prev = block;
         }
-
-        kprintf("[HEAP] Coalesced blocks at %p, new size: %llu\n",
-                (void*)block, (uint64_t)block_get_size(block));
     }
 
     /* Try to coalesce with previous block */
-    heap_block_t *prev = block->prev;
-    if (prev != NULL && !block_is_used(prev)) {
-        /* Remove current block from free list */
-        free_list_remove(block);
+    if (merge_prev) {
+        /* Remove previous block from its (old) size class */
+        free_list_remove(prev);
 
         /* Merge sizes */
         prev->size = block_get_size(prev) + block_get_size(block);
+        heap_stats.block_count--;
 
         /* Update prev pointer of block after current */
         heap_block_t *after_block = block_get_next_physical(prev);
@@ -229,22 +306,34 @@ static void coalesce_blocks(heap_block_t *block) {
             after_block->prev = prev;
         }
 
-        kprintf("[HEAP] Coalesced with previous at %p, new size: %llu\n",
-                (void*)prev, (uint64_t)block_get_size(prev));
+        block = prev;
     }
+
+    free_list_add(block);
 }
 
 /**
- * Find a free block using first-fit strategy
+ * Find a free block using the segregated lists
+ * First-fit within the request's class; any block in a higher class fits.
  */
 static heap_block_t *find_free_block(size_t size) {
-    heap_block_t *current = free_list;
+    size_t cls = size_to_class(size);
+    uint32_t candidates = free_class_bitmap & ~(uint32_t)MASK(cls);
 
-    while (current != NULL) {
-        if (block_get_size(current) >= size) {
-            return current;
+    while (candidates != 0) {
+        size_t c = (size_t)__builtin_ctz(candidates);
+
+        if (c != cls && c != HEAP_NUM_CLASSES - 1) {
+            return free_lists[c];
+        }
+
+        for (heap_block_t *current = free_lists[c]; current != NULL; current = current->next) {
+            if (block_get_size(current) >= size) {
+                return current;
+            }
         }
-        current = current->next;
+
+        candidates &= ~(uint32_t)BIT(c);
     }
 
     return NULL;
@@ -286,8 +375,10 @@ static void split_block(heap_block_t *block, size_t size) {
     free_list_add(new_block);
     heap_stats.block_count++;
 
+#ifdef HEAP_DEBUG_TRACE
     kprintf("[HEAP] Split block: %llu -> %llu + %llu\n",
             (uint64_t)block_size, (uint64_t)size, (uint64_t)remaining);
+#endif
 }
 
 /**
@@ -337,7 +428,6 @@ bool heap_expand(size_t min_size) {
     new_block->flags = 0;
 
     /* Find previous block */
-    virtaddr_t prev_addr = heap_end - sizeof(heap_block_t);
     heap_block_t *prev_block = NULL;
 
     /* Walk backwards to find the last block */
@@ -412,7 +502,7 @@ bool heap_init(virtaddr_t start, size_t initial_size) {
     heap_max = heap_start + HEAP_MAX_SIZE;
 
     /* Clear heap memory */
-    heap_memset((void*)heap_start, 0, initial_size);
+    memset((void*)heap_start, 0, initial_size);
 
     /* Create initial free block spanning entire heap */
     heap_block_t *initial_block = (heap_block_t*)heap_start;
@@ -422,19 +512,40 @@ bool heap_init(virtaddr_t start, size_t initial_size) {
     initial_block->flags = 0;
     block_set_free(initial_block);
 
-    /* Initialize free list */
-    free_list = initial_block;
+    /* Initialize free lists */
+    for (size_t i = 0; i < HEAP_NUM_CLASSES; i++) {
+        free_lists[i] = NULL;
+    }
+    free_class_bitmap = 0;
 
     /* Initialize statistics */
     heap_stats.total_size = initial_size;
     heap_stats.used_size = 0;
     heap_stats.free_size = initial_size - sizeof(heap_block_t);
     heap_stats.block_count = 1;
-    heap_stats.free_block_count = 1;
+    heap_stats.free_block_count = 0;
     heap_stats.alloc_count = 0;
     heap_stats.free_count = 0;
     heap_stats.expand_count = 0;
 
+    free_list_add(initial_block);
+
+    /* Hand every magazine to its class depot as an empty one */
+    for (size_t c = 0; c < HEAP_MAG_NUM_CLASSES; c++) {
+        spinlock_init(&mag_depot[c].lock, LOCK_CLASS_OF(heap_depot));
+        mag_depot[c].full = NULL;
+        mag_depot[c].empty = NULL;
+        mag_depot[c].full_count = 0;
+        mag_depot[c].empty_count = 0;
+        for (size_t i = 0; i < HEAP_MAG_POOL_PER_CLASS; i++) {
+            heap_magazine_t *mag = &mag_pool[c][i];
+            mag->rounds = 0;
+            mag->next = mag_depot[c].empty;
+            mag_depot[c].empty = mag;
+            mag_depot[c].empty_count++;
+        }
+    }
+
     heap_initialized = true;
 
     kprintf("[HEAP] Heap initialized successfully\n");
@@ -442,22 +553,203 @@ bool heap_init(virtaddr_t start, size_t initial_size) {
     kprintf("[HEAP]   End:          %p\n", (void*)heap_end);
     kprintf("[HEAP]   Max end:      %p\n", (void*)heap_max);
 
+    bootprof_mark(BOOTPROF_HEAP);
     return true;
 }
 
 /**
- * Allocate memory from the heap
+ * Read the time stamp counter
  */
-void *kmalloc(size_t size) {
-    if (!heap_initialized) {
-        kprintf("[HEAP] Error: Heap not initialized\n");
-        return NULL;
+static inline uint64_t heap_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Start a latency sample, 0 when sampling is off
+ */
+static inline uint64_t heap_lat_start(void) {
+    return heap_lat_enabled ? heap_rdtsc() : 0;
+}
+
+/**
+ * Record a latency sample in the current CPU's histogram
+ */
+static void heap_lat_record(heap_lat_op_t op, uint64_t start) {
+    if (start == 0) {
+        return;
     }
 
-    if (size == 0) {
-        return NULL;
+    uint64_t cycles = heap_rdtsc() - start;
+    uint32_t bucket = 0;
+    if (cycles >> HEAP_LAT_MIN_SHIFT) {
+        bucket = (63 - __builtin_clzll(cycles)) - HEAP_LAT_MIN_SHIFT;
+        if (bucket >= HEAP_LAT_BUCKETS) {
+            bucket = HEAP_LAT_BUCKETS - 1;
+        }
     }
 
+    /* May be preempted onto another CPU, so update with atomics */
+    heap_latency_t *lat = &mag_cpus[percpu_cpu_id()].lat[op];
+    __atomic_fetch_add(&lat->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->samples, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->total_cycles, cycles, __ATOMIC_RELAXED);
+    if (cycles > lat->max_cycles) {
+        lat->max_cycles = cycles;
+    }
+}
+
+/**
+ * Map a small request size to its magazine class
+ */
+static inline size_t mag_size_to_class(size_t size) {
+    if (size <= (1u << HEAP_MAG_MIN_SHIFT)) {
+        return 0;
+    }
+    return (64 - __builtin_clzll(size - 1)) - HEAP_MAG_MIN_SHIFT;
+}
+
+/**
+ * Payload size of a magazine class
+ */
+static inline size_t mag_class_size(size_t cls) {
+    return (size_t)1 << (cls + HEAP_MAG_MIN_SHIFT);
+}
+
+static inline void depot_acquire_lock(heap_depot_t *depot) {
+    spinlock_acquire(&depot->lock);
+}
+
+static inline void depot_release_lock(heap_depot_t *depot) {
+    spinlock_release(&depot->lock);
+}
+
+/**
+ * Trade the slot's empty magazines for a full one from the depot
+ * Called with interrupts disabled. On success slot->loaded is full.
+ */
+static bool depot_exchange_for_full(size_t cls, heap_mag_slot_t *slot) {
+    heap_depot_t *depot = &mag_depot[cls];
+
+    depot_acquire_lock(depot);
+
+    heap_magazine_t *full = depot->full;
+    if (full == NULL) {
+        depot_release_lock(depot);
+        return false;
+    }
+    depot->full = full->next;
+    depot->full_count--;
+
+    /* Both current magazines are empty (or absent); retire the older one */
+    if (slot->previous != NULL) {
+        slot->previous->next = depot->empty;
+        depot->empty = slot->previous;
+        depot->empty_count++;
+    }
+
+    depot_release_lock(depot);
+
+    slot->previous = slot->loaded;
+    slot->loaded = full;
+    return true;
+}
+
+/**
+ * Trade the slot's full magazines for an empty one from the depot
+ * Called with interrupts disabled. On success slot->loaded is empty.
+ */
+static bool depot_exchange_for_empty(size_t cls, heap_mag_slot_t *slot) {
+    heap_depot_t *depot = &mag_depot[cls];
+
+    depot_acquire_lock(depot);
+
+    heap_magazine_t *empty = depot->empty;
+    if (empty == NULL) {
+        depot_release_lock(depot);
+        return false;
+    }
+    depot->empty = empty->next;
+    depot->empty_count--;
+
+    /* Both current magazines are full (or absent); retire the older one */
+    if (slot->previous != NULL) {
+        slot->previous->next = depot->full;
+        depot->full = slot->previous;
+        depot->full_count++;
+    }
+
+    depot_release_lock(depot);
+
+    slot->previous = slot->loaded;
+    slot->loaded = empty;
+    return true;
+}
+
+/**
+ * Take an object from the current CPU's magazines
+ * @return Object, or NULL if neither the CPU nor the depot has one
+ */
+static void *mag_alloc(size_t cls) {
+    uint64_t irq = interrupts_save();
+    heap_mag_cpu_t *cpu = &mag_cpus[percpu_cpu_id()];
+    heap_mag_slot_t *slot = &cpu->slots[cls];
+    heap_magazine_t *mag = slot->loaded;
+
+    if (mag == NULL || mag->rounds == 0) {
+        if (slot->previous != NULL && slot->previous->rounds > 0) {
+            slot->loaded = slot->previous;
+            slot->previous = mag;
+        } else if (!depot_exchange_for_full(cls, slot)) {
+            cpu->misses++;
+            interrupts_restore(irq);
+            return NULL;
+        }
+        mag = slot->loaded;
+    }
+
+    void *obj = mag->objs[--mag->rounds];
+    data_to_block(obj)->flags &= ~BLOCK_FLAG_CACHED;
+    cpu->hits++;
+
+    interrupts_restore(irq);
+    return obj;
+}
+
+/**
+ * Park an object in the current CPU's magazines
+ * @return false if every magazine is full and the depot has no empty one
+ */
+static bool mag_free(size_t cls, void *obj) {
+    uint64_t irq = interrupts_save();
+    heap_mag_slot_t *slot = &mag_cpus[percpu_cpu_id()].slots[cls];
+    heap_magazine_t *mag = slot->loaded;
+
+    if (mag == NULL || mag->rounds == HEAP_MAG_ROUNDS) {
+        if (slot->previous != NULL && slot->previous->rounds < HEAP_MAG_ROUNDS) {
+            slot->loaded = slot->previous;
+            slot->previous = mag;
+        } else if (!depot_exchange_for_empty(cls, slot)) {
+            interrupts_restore(irq);
+            return false;
+        }
+        mag = slot->loaded;
+    }
+
+    data_to_block(obj)->flags |= BLOCK_FLAG_CACHED;
+    mag->objs[mag->rounds++] = obj;
+
+    interrupts_restore(irq);
+    return true;
+}
+
+/**
+ * Allocate a block under the heap lock
+ * @param size Payload size
+ * @param tag Extra block flags to set while the lock is held
+ */
+static void *heap_alloc_slow(size_t size, uint32_t tag) {
     heap_acquire_lock();
 
     /* Calculate actual size needed (header + data, aligned) */
@@ -493,6 +785,7 @@ void *kmalloc(size_t size) {
 
     /* Mark block as used */
     block_set_used(block);
+    block->flags |= tag;
 
     /* Update statistics */
     size_t block_size = block_get_size(block);
@@ -504,9 +797,131 @@ void *kmalloc(size_t size) {
 
     void *ptr = block_to_data(block);
 
+#ifdef HEAP_DEBUG_TRACE
     kprintf("[HEAP] Allocated %llu bytes at %p (block: %p, size: %llu)\n",
             (uint64_t)size, ptr, (void*)block, (uint64_t)block_size);
+#endif
+
+    return ptr;
+}
+
+/**
+ * Return a used block to the free lists under the heap lock
+ */
+static void heap_free_slow(heap_block_t *block) {
+    heap_acquire_lock();
+
+    size_t block_size = block_get_size(block);
+
+#ifdef HEAP_DEBUG_TRACE
+    kprintf("[HEAP] Freeing %p (block: %p, size: %llu)\n",
+            block_to_data(block), (void*)block, (uint64_t)block_size);
+#endif
+
+    /* Mark as free and add to free list */
+    block_clear_magazine(block);
+    block_set_free(block);
+    free_list_add(block);
+
+    /* Update statistics */
+    heap_stats.used_size -= block_size;
+    heap_stats.free_size += block_size;
+    heap_stats.free_count++;
+
+    /* Try to coalesce with adjacent blocks */
+    coalesce_blocks(block);
+
+    heap_release_lock();
+}
+
+/**
+ * Empty a magazine back into the heap
+ */
+static void mag_flush(heap_magazine_t *mag) {
+    while (mag->rounds > 0) {
+        heap_free_slow(data_to_block(mag->objs[--mag->rounds]));
+    }
+}
+
+/**
+ * Return parked objects to the heap
+ */
+void heap_magazine_drain(void) {
+    if (!heap_initialized) {
+        return;
+    }
+
+    for (size_t c = 0; c < HEAP_MAG_NUM_CLASSES; c++) {
+        heap_depot_t *depot = &mag_depot[c];
+
+        /* The calling CPU's own magazines */
+        uint64_t irq = interrupts_save();
+        heap_mag_slot_t *slot = &mag_cpus[percpu_cpu_id()].slots[c];
+        if (slot->loaded != NULL) {
+            mag_flush(slot->loaded);
+        }
+        if (slot->previous != NULL) {
+            mag_flush(slot->previous);
+        }
+        interrupts_restore(irq);
+
+        /* Every full magazine in the depot */
+        depot_acquire_lock(depot);
+        while (depot->full != NULL) {
+            heap_magazine_t *mag = depot->full;
+            depot->full = mag->next;
+            depot->full_count--;
+
+            mag_flush(mag);
+
+            mag->next = depot->empty;
+            depot->empty = mag;
+            depot->empty_count++;
+        }
+        depot_release_lock(depot);
+    }
+}
+
+/**
+ * Allocate memory from the heap
+ */
+void *kmalloc(size_t size) {
+    if (!heap_initialized) {
+        kprintf("[HEAP] Error: Heap not initialized\n");
+        return NULL;
+    }
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    uint64_t start = heap_lat_start();
+    void *ptr;
+
+    if (size >= HEAP_LARGE_THRESHOLD) {
+        /* Large buffers never enter the heap; the address is page aligned */
+        ptr = vmalloc(size);
+    } else if (size <= HEAP_MAG_MAX_SIZE) {
+        size_t cls = mag_size_to_class(size);
+        uint32_t tag = BLOCK_FLAG_MAGAZINE | ((uint32_t)cls << BLOCK_MAG_CLASS_SHIFT);
+
+        ptr = mag_alloc(cls);
+        if (ptr == NULL) {
+            ptr = heap_alloc_slow(mag_class_size(cls), tag);
+        }
+        if (ptr == NULL) {
+            heap_magazine_drain();
+            ptr = heap_alloc_slow(mag_class_size(cls), tag);
+        }
+    } else {
+        ptr = heap_alloc_slow(size, 0);
+        if (ptr == NULL) {
+            heap_magazine_drain();
+            ptr = heap_alloc_slow(size, 0);
+        }
+    }
 
+    heap_lat_record(HEAP_LAT_ALLOC, start);
     return ptr;
 }
 
@@ -567,50 +982,41 @@ void kfree(void *ptr) {
         return;
     }
 
-    heap_acquire_lock();
+    uint64_t start = heap_lat_start();
 
     /* Get block header */
     heap_block_t *block = data_to_block(ptr);
 
+    /* Anything outside the heap must be a large allocation */
+    if (!heap_contains(ptr)) {
+        if (vmalloc_owns(ptr)) {
+            vfree(ptr);
+            heap_lat_record(HEAP_LAT_FREE, start);
+            return;
+        }
+        kprintf("[HEAP] Error: Block at %p is outside heap bounds\n", (void*)block);
+        return;
+    }
+
     /* Validate block */
     if (block->magic != HEAP_BLOCK_MAGIC) {
-        heap_release_lock();
         kprintf("[HEAP] Error: Invalid block magic at %p (expected 0x%x, got 0x%x)\n",
                 ptr, HEAP_BLOCK_MAGIC, block->magic);
         return;
     }
 
-    if (!block_is_used(block)) {
-        heap_release_lock();
+    if (!block_is_used(block) || (block->flags & BLOCK_FLAG_CACHED)) {
         kprintf("[HEAP] Warning: Double free detected at %p\n", ptr);
         return;
     }
 
-    /* Validate block is within heap bounds */
-    if ((virtaddr_t)block < heap_start || (virtaddr_t)block >= heap_end) {
-        heap_release_lock();
-        kprintf("[HEAP] Error: Block at %p is outside heap bounds\n", (void*)block);
-        return;
+    /* Small blocks go back to this CPU's magazine when there is room */
+    if (!(block->flags & BLOCK_FLAG_MAGAZINE) ||
+        !mag_free((block->flags >> BLOCK_MAG_CLASS_SHIFT) & 0xFF, ptr)) {
+        heap_free_slow(block);
     }
 
-    size_t block_size = block_get_size(block);
-
-    kprintf("[HEAP] Freeing %p (block: %p, size: %llu)\n",
-            ptr, (void*)block, (uint64_t)block_size);
-
-    /* Mark as free and add to free list */
-    block_set_free(block);
-    free_list_add(block);
-
-    /* Update statistics */
-    heap_stats.used_size -= block_size;
-    heap_stats.free_size += block_size;
-    heap_stats.free_count++;
-
-    /* Try to coalesce with adjacent blocks */
-    coalesce_blocks(block);
-
-    heap_release_lock();
+    heap_lat_record(HEAP_LAT_FREE, start);
 }
 
 /**
@@ -627,7 +1033,7 @@ void *kcalloc(size_t count, size_t size) {
     void *ptr = kmalloc(total);
 
     if (ptr != NULL) {
-        heap_memset(ptr, 0, total);
+        memset(ptr, 0, total);
     }
 
     return ptr;
@@ -656,8 +1062,28 @@ void *krealloc(void *ptr, size_t new_size) {
     /* Get current block */
     heap_block_t *block = data_to_block(ptr);
 
+    /* Large allocations are resized by remapping their pages */
+    if (!heap_contains(ptr)) {
+        size_t old_size = vmalloc_size(ptr);
+        if (old_size == 0) {
+            kprintf("[HEAP] Error: Invalid block in krealloc\n");
+            return NULL;
+        }
+        if (new_size >= HEAP_LARGE_THRESHOLD) {
+            return vrealloc(ptr, new_size);
+        }
+
+        void *small = kmalloc(new_size);
+        if (small != NULL) {
+            memcpy(small, ptr, MIN(old_size, new_size));
+            vfree(ptr);
+        }
+        return small;
+    }
+
     /* Validate block */
-    if (block->magic != HEAP_BLOCK_MAGIC || !block_is_used(block)) {
+    if (block->magic != HEAP_BLOCK_MAGIC || !block_is_used(block) ||
+        (block->flags & BLOCK_FLAG_CACHED)) {
         kprintf("[HEAP] Error: Invalid block in krealloc\n");
         return NULL;
     }
@@ -668,7 +1094,9 @@ void *krealloc(void *ptr, size_t new_size) {
     /* If shrinking and current block is big enough, just return same ptr */
     if (new_size <= current_size) {
         /* Could split block here, but for simplicity just keep it */
+#ifdef HEAP_DEBUG_TRACE
         kprintf("[HEAP] krealloc: shrinking, keeping same block\n");
+#endif
         return ptr;
     }
 
@@ -676,13 +1104,16 @@ void *krealloc(void *ptr, size_t new_size) {
     heap_acquire_lock();
 
     heap_block_t *next = block_get_next_physical(block);
-    if (next != NULL && !block_is_used(next)) {
+    if (new_size < HEAP_LARGE_THRESHOLD && next != NULL && !block_is_used(next)) {
         size_t combined = block_get_size(block) + block_get_size(next);
         if (combined >= actual_new_size) {
             /* Remove next from free list and merge */
             free_list_remove(next);
             block->size = combined;
 
+            /* No longer a magazine-sized object */
+            block_clear_magazine(block);
+
             /* Update stats */
             heap_stats.free_size -= block_get_size(next);
             heap_stats.block_count--;
@@ -697,8 +1128,10 @@ void *krealloc(void *ptr, size_t new_size) {
             split_block(block, actual_new_size);
 
             heap_release_lock();
+#ifdef HEAP_DEBUG_TRACE
             kprintf("[HEAP] krealloc: expanded in place to %llu bytes\n",
                     (uint64_t)new_size);
+#endif
             return ptr;
         }
     }
@@ -712,12 +1145,14 @@ void *krealloc(void *ptr, size_t new_size) {
     }
 
     /* Copy old data */
-    heap_memcpy(new_ptr, ptr, current_size);
+    memcpy(new_ptr, ptr, current_size);
 
     /* Free old block */
     kfree(ptr);
 
+#ifdef HEAP_DEBUG_TRACE
     kprintf("[HEAP] krealloc: moved to new block at %p\n", new_ptr);
+#endif
     return new_ptr;
 }
 
@@ -732,8 +1167,51 @@ void heap_get_stats(heap_stats_t *stats) {
     heap_acquire_lock();
     *stats = heap_stats;
     heap_release_lock();
+
+    /* Magazine counters are per-CPU; a racy sum is fine for statistics */
+    stats->magazine_hits = 0;
+    stats->magazine_misses = 0;
+    stats->magazine_cached = 0;
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        stats->magazine_hits += mag_cpus[i].hits;
+        stats->magazine_misses += mag_cpus[i].misses;
+        for (size_t c = 0; c < HEAP_MAG_NUM_CLASSES; c++) {
+            heap_mag_slot_t *slot = &mag_cpus[i].slots[c];
+            if (slot->loaded != NULL) {
+                stats->magazine_cached += slot->loaded->rounds;
+            }
+            if (slot->previous != NULL) {
+                stats->magazine_cached += slot->previous->rounds;
+            }
+        }
+    }
+    for (size_t c = 0; c < HEAP_MAG_NUM_CLASSES; c++) {
+        stats->magazine_cached += (size_t)mag_depot[c].full_count * HEAP_MAG_ROUNDS;
+    }
 }
 
+static uint64_t heap_used_bytes(void) {
+    heap_stats_t stats;
+    heap_get_stats(&stats);
+    return stats.used_size;
+}
+
+static uint64_t heap_free_bytes(void) {
+    heap_stats_t stats;
+    heap_get_stats(&stats);
+    return stats.free_size;
+}
+
+static uint64_t heap_allocs(void) {
+    heap_stats_t stats;
+    heap_get_stats(&stats);
+    return stats.alloc_count;
+}
+
+KSTAT_GAUGE(heap_used, "mm.heap.used_bytes", "Heap bytes allocated", heap_used_bytes);
+KSTAT_GAUGE(heap_free, "mm.heap.free_bytes", "Heap bytes free", heap_free_bytes);
+KSTAT_GAUGE(heap_allocs, "mm.heap.allocs", "Heap allocations made", heap_allocs);
+
 /**
  * Print heap statistics
  */
@@ -751,7 +1229,75 @@ void heap_print_stats(void) {
     kprintf("[HEAP]   Allocations:      %llu\n", (uint64_t)stats.alloc_count);
     kprintf("[HEAP]   Frees:            %llu\n", (uint64_t)stats.free_count);
     kprintf("[HEAP]   Expansions:       %llu\n", (uint64_t)stats.expand_count);
+    kprintf("[HEAP]   Magazine hits:    %llu\n", (uint64_t)stats.magazine_hits);
+    kprintf("[HEAP]   Magazine misses:  %llu\n", (uint64_t)stats.magazine_misses);
+    kprintf("[HEAP]   Magazine cached:  %llu objects\n", (uint64_t)stats.magazine_cached);
     kprintf("[HEAP] ========================\n");
+
+    kmem_cache_print_stats();
+    vmalloc_print_stats();
+}
+
+/**
+ * Enable or disable latency sampling
+ */
+void heap_latency_enable(bool enable) {
+    heap_lat_enabled = enable;
+}
+
+/**
+ * Clear all latency histograms
+ */
+void heap_latency_reset(void) {
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        memset(mag_cpus[i].lat, 0, sizeof(mag_cpus[i].lat));
+    }
+}
+
+/**
+ * Sum one operation's histogram over all CPUs
+ */
+void heap_get_latency(heap_lat_op_t op, heap_latency_t *out) {
+    if (out == NULL || op >= HEAP_LAT_NUM_OPS) {
+        return;
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        heap_latency_t *lat = &mag_cpus[i].lat[op];
+        for (size_t b = 0; b < HEAP_LAT_BUCKETS; b++) {
+            out->buckets[b] += lat->buckets[b];
+        }
+        out->samples += lat->samples;
+        out->total_cycles += lat->total_cycles;
+        out->max_cycles = MAX(out->max_cycles, lat->max_cycles);
+    }
+}
+
+/**
+ * Print kmalloc/kfree latency histograms
+ */
+void heap_print_latency(void) {
+    static const char *op_names[HEAP_LAT_NUM_OPS] = { "kmalloc", "kfree" };
+
+    for (size_t op = 0; op < HEAP_LAT_NUM_OPS; op++) {
+        heap_latency_t lat;
+        heap_get_latency((heap_lat_op_t)op, &lat);
+
+        kprintf("[HEAP] %s latency: %llu samples, avg %llu cycles, max %llu cycles\n",
+                op_names[op], lat.samples,
+                lat.samples ? lat.total_cycles / lat.samples : 0ULL,
+                lat.max_cycles);
+
+        for (size_t b = 0; b < HEAP_LAT_BUCKETS; b++) {
+            if (lat.buckets[b] == 0) {
+                continue;
+            }
+            kprintf("[HEAP]   >= %llu cycles: %llu\n",
+                    b == 0 ? 0ULL : (1ULL << (b + HEAP_LAT_MIN_SHIFT)),
+                    lat.buckets[b]);
+        }
+    }
 }
 
 /**
@@ -792,12 +1338,14 @@ void heap_dump(void) {
         }
     }
 
-    kprintf("[HEAP] Free list:\n");
-    heap_block_t *free_block = free_list;
-    while (free_block != NULL) {
-        kprintf("[HEAP]   Free: %p size=%llu\n",
-                (void*)free_block, (uint64_t)block_get_size(free_block));
-        free_block = free_block->next;
+    kprintf("[HEAP] Free lists (class bitmap 0x%x):\n", free_class_bitmap);
+    for (size_t cls = 0; cls < HEAP_NUM_CLASSES; cls++) {
+        heap_block_t *free_block = free_lists[cls];
+        while (free_block != NULL) {
+            kprintf("[HEAP]   Class %u: %p size=%llu\n", (uint32_t)cls,
+                    (void*)free_block, (uint64_t)block_get_size(free_block));
+            free_block = free_block->next;
+        }
     }
 
     kprintf("[HEAP] ==================\n");
@@ -867,6 +1415,53 @@ bool heap_validate(void) {
         }
     }
 
+    /* Check every size class list */
+    size_t listed_free = 0;
+    for (size_t cls = 0; cls < HEAP_NUM_CLASSES; cls++) {
+        bool has_blocks = free_lists[cls] != NULL;
+        if (has_blocks != ((free_class_bitmap & BIT(cls)) != 0)) {
+            kprintf("[HEAP] Validation failed: Class %u bitmap bit out of sync\n",
+                    (uint32_t)cls);
+            valid = false;
+        }
+
+        heap_block_t *expected_prev = NULL;
+        for (heap_block_t *fb = free_lists[cls]; fb != NULL; fb = fb->next) {
+            if ((virtaddr_t)fb < heap_start || (virtaddr_t)fb >= heap_end) {
+                kprintf("[HEAP] Validation failed: Free block %p outside heap\n", (void*)fb);
+                valid = false;
+                break;
+            }
+            if (block_is_used(fb) || fb->magic != HEAP_BLOCK_FREE_MAGIC) {
+                kprintf("[HEAP] Validation failed: Used block %p on free list\n", (void*)fb);
+                valid = false;
+            }
+            if (size_to_class(block_get_size(fb)) != cls) {
+                kprintf("[HEAP] Validation failed: Block %p filed in wrong class %u\n",
+                        (void*)fb, (uint32_t)cls);
+                valid = false;
+            }
+            if (*block_free_prev(fb) != expected_prev) {
+                kprintf("[HEAP] Validation failed: Bad free back link at %p\n", (void*)fb);
+                valid = false;
+            }
+            expected_prev = fb;
+
+            if (++listed_free > block_count) {
+                kprintf("[HEAP] Validation failed: Free list cycle in class %u\n",
+                        (uint32_t)cls);
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    if (listed_free != heap_stats.free_block_count) {
+        kprintf("[HEAP] Validation failed: %llu blocks listed free, %llu counted\n",
+                (uint64_t)listed_free, (uint64_t)heap_stats.free_block_count);
+        valid = false;
+    }
+
     /* Check total size */
     if (total_size != (heap_end - heap_start)) {
         kprintf("[HEAP] Validation failed: Size mismatch (blocks: %llu, heap: %llu)\n",
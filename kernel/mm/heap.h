@@ -3,6 +3,10 @@
  *
  * Provides dynamic memory allocation for the kernel.
  * Uses a simple block allocator with a free list and first-fit strategy.
+ * Requests up to HEAP_MAG_MAX_SIZE bytes are served from per-CPU
+ * magazines first and only fall through to the locked allocator on a miss.
+ * Requests of HEAP_LARGE_THRESHOLD bytes or more bypass the heap entirely
+ * and are mapped page by page by vmalloc.
  */
 
 #ifndef _AAAOS_MM_HEAP_H
@@ -16,10 +20,20 @@
 #define HEAP_INITIAL_SIZE       (64 * KB)   /* Default initial heap size */
 #define HEAP_EXPAND_SIZE        (64 * KB)   /* Size to expand heap by */
 #define HEAP_MAX_SIZE           (16 * MB)   /* Maximum heap size */
+#define HEAP_LARGE_THRESHOLD    (16 * KB)   /* Larger requests go to vmalloc */
+
+/* Per-CPU magazine front-end */
+#define HEAP_MAG_NUM_CLASSES    5           /* 32, 64, 128, 256, 512 bytes */
+#define HEAP_MAG_MIN_SHIFT      5
+#define HEAP_MAG_MAX_SIZE       (1 << (HEAP_MAG_MIN_SHIFT + HEAP_MAG_NUM_CLASSES - 1))
+#define HEAP_MAG_ROUNDS         16          /* Objects per magazine */
 
 /* Block header flags */
 #define BLOCK_FLAG_USED         0x1         /* Block is allocated */
 #define BLOCK_FLAG_LAST         0x2         /* Last block in heap */
+#define BLOCK_FLAG_MAGAZINE     0x4         /* Block belongs to a magazine class */
+#define BLOCK_FLAG_CACHED       0x8         /* Block is parked in a magazine */
+#define BLOCK_MAG_CLASS_SHIFT   8           /* Magazine class index in flags */
 
 /**
  * Block header structure
@@ -49,8 +63,31 @@ typedef struct heap_stats {
     size_t alloc_count;             /* Total allocations made */
     size_t free_count;              /* Total frees made */
     size_t expand_count;            /* Number of heap expansions */
+    size_t magazine_hits;           /* Small requests served from a magazine */
+    size_t magazine_misses;         /* Small requests that fell through */
+    size_t magazine_cached;         /* Objects currently parked in magazines */
 } heap_stats_t;
 
+/*
+ * kmalloc/kfree latency histogram: bucket i counts [2^(i+5), 2^(i+6)) cycles,
+ * bucket 0 also takes anything faster and the last bucket anything slower.
+ */
+#define HEAP_LAT_BUCKETS        16
+#define HEAP_LAT_MIN_SHIFT      5
+
+typedef enum heap_lat_op {
+    HEAP_LAT_ALLOC = 0,
+    HEAP_LAT_FREE,
+    HEAP_LAT_NUM_OPS
+} heap_lat_op_t;
+
+typedef struct heap_latency {
+    uint64_t buckets[HEAP_LAT_BUCKETS];
+    uint64_t samples;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+} heap_latency_t;
+
 /**
  * Initialize the kernel heap
  * @param start Starting virtual address for heap
@@ -131,4 +168,33 @@ bool heap_validate(void);
  */
 bool heap_expand(size_t min_size);
 
+/**
+ * Return every object parked in the depot and the calling CPU's
+ * magazines to the heap free lists
+ */
+void heap_magazine_drain(void);
+
+/**
+ * Turn latency sampling of kmalloc/kfree on or off (off by default)
+ * @param enable true to start sampling
+ */
+void heap_latency_enable(bool enable);
+
+/**
+ * Clear all latency histograms
+ */
+void heap_latency_reset(void);
+
+/**
+ * Get a latency histogram summed over all CPUs
+ * @param op HEAP_LAT_ALLOC or HEAP_LAT_FREE
+ * @param out Histogram to fill
+ */
+void heap_get_latency(heap_lat_op_t op, heap_latency_t *out);
+
+/**
+ * Print kmalloc/kfree latency histograms to serial console
+ */
+void heap_print_latency(void);
+
 #endif /* _AAAOS_MM_HEAP_H */
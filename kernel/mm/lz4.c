@@ -0,0 +1,214 @@
+/**
+ * AAAos Kernel - LZ4 Block Compression
+ *
+ * The compressor hashes the four bytes at each position into a table of
+ * recent positions, and takes the candidate if its bytes match; a stale
+ * or unset table entry just fails that check, which is why the state
+ * needs no clearing. Each match is stretched backwards over pending
+ * literals and forwards as far as the format allows: the last
+ * LZ4_LAST_LITERALS bytes are always literals, and no match starts in
+ * the final LZ4_MATCH_LIMIT bytes.
+ */
+
+#include "lz4.h"
+
+#define LZ4_LAST_LITERALS       5
+#define LZ4_MATCH_LIMIT         12
+#define LZ4_MAX_OFFSET          65535
+
+/* Token nibble that says more length bytes follow */
+#define LZ4_RUN_MASK            15
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/**
+ * Write the length bytes that follow a saturated token nibble
+ */
+static uint8_t *lz4_put_length(uint8_t *op, size_t n) {
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/**
+ * Copy len bytes, eight at a time unless dst trails src by less than that
+ * (a match overlapping its own output repeats the bytes it has written)
+ */
+static void lz4_copy(uint8_t *dst, const uint8_t *src, size_t len) {
+    if ((uintptr_t)dst - (uintptr_t)src >= 8) {
+        for (; len >= 8; len -= 8, dst += 8, src += 8) {
+            __builtin_memcpy(dst, src, 8);
+        }
+    }
+    while (len--) {
+        *dst++ = *src++;
+    }
+}
+
+/**
+ * Emit one sequence: literals [anchor, ip), then a match (mlen 0: none)
+ * @return End of the output, or NULL if it does not fit before oend
+ */
+static uint8_t *lz4_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *anchor,
+                                 const uint8_t *ip, size_t offset, size_t mlen) {
+    size_t lit = (size_t)(ip - anchor);
+    size_t worst = 1 + lit / 255 + 1 + lit + (mlen ? 2 + mlen / 255 + 1 : 0);
+    if (worst > (size_t)(oend - op)) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    size_t code = mlen ? mlen - LZ4_MIN_MATCH : 0;
+    *token = (uint8_t)((MIN(lit, (size_t)LZ4_RUN_MASK) << 4) |
+                       MIN(code, (size_t)LZ4_RUN_MASK));
+
+    if (lit >= LZ4_RUN_MASK) {
+        op = lz4_put_length(op, lit - LZ4_RUN_MASK);
+    }
+    lz4_copy(op, anchor, lit);
+    op += lit;
+
+    if (mlen) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (code >= LZ4_RUN_MASK) {
+            op = lz4_put_length(op, code - LZ4_RUN_MASK);
+        }
+    }
+    return op;
+}
+
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t cap, void *state) {
+    if (len > LZ4_MAX_INPUT) {
+        return 0;
+    }
+
+    const uint8_t *in = src;
+    const uint8_t *end = in + len;
+    const uint8_t *anchor = in;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+    uint16_t *table = state;
+
+    if (len > LZ4_MATCH_LIMIT) {
+        const uint8_t *mflimit = end - LZ4_MATCH_LIMIT;
+        const uint8_t *matchlimit = end - LZ4_LAST_LITERALS;
+        const uint8_t *ip = in;
+
+        while (ip < mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = in + table[h];
+            table[h] = (uint16_t)(ip - in);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + LZ4_MIN_MATCH;
+            const uint8_t *rp = ref + LZ4_MIN_MATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            op = lz4_put_sequence(op, oend, anchor, ip, (size_t)(ip - ref), (size_t)(mp - ip));
+            if (!op) {
+                return 0;
+            }
+            ip = mp;
+            anchor = ip;
+
+            /* Positions skipped by the match still make good candidates */
+            if (ip < mflimit) {
+                table[lz4_hash(lz4_read32(ip - 2))] = (uint16_t)(ip - 2 - in);
+            }
+        }
+    }
+
+    op = lz4_put_sequence(op, oend, anchor, end, 0, 0);
+    return op ? (size_t)(op - (uint8_t*)dst) : 0;
+}
+
+/**
+ * Read the length bytes that follow a saturated token nibble
+ * @return false if the input ends first
+ */
+static bool lz4_get_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+size_t lz4_decompress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + len;
+    uint8_t *out = dst;
+    uint8_t *op = out;
+    uint8_t *oend = out + cap;
+
+    for (;;) {
+        if (ip >= iend) {
+            return 0;
+        }
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == LZ4_RUN_MASK && !lz4_get_length(&ip, iend, &lit)) {
+            return 0;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return 0;
+        }
+        lz4_copy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        /* The last sequence has literals only */
+        if (ip == iend) {
+            return (size_t)(op - out);
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) {
+            return 0;
+        }
+
+        size_t mlen = token & LZ4_RUN_MASK;
+        if (mlen == LZ4_RUN_MASK && !lz4_get_length(&ip, iend, &mlen)) {
+            return 0;
+        }
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > (size_t)(oend - op)) {
+            return 0;
+        }
+        lz4_copy(op, op - offset, mlen);
+        op += mlen;
+    }
+}
@@ -0,0 +1,50 @@
+/**
+ * AAAos Kernel - LZ4 Block Compression
+ *
+ * Byte-compatible with the LZ4 block format: sequences of a token, the
+ * literals and a match of at least LZ4_MIN_MATCH bytes at a 16-bit
+ * offset back. The compressor is the greedy single-hash kind, built for
+ * speed over ratio; one call handles at most LZ4_MAX_INPUT bytes, which
+ * covers any page. Neither side allocates, and the decompressor checks
+ * every length against both buffers, so corrupt input cannot overrun.
+ */
+
+#ifndef _AAAOS_MM_LZ4_H
+#define _AAAOS_MM_LZ4_H
+
+#include "../include/types.h"
+
+/* Largest input of one lz4_compress call (offsets are kept in 16 bits) */
+#define LZ4_MAX_INPUT           65535
+
+/* Shortest match the format codes */
+#define LZ4_MIN_MATCH           4
+
+/* Match finder: 2^LZ4_HASH_LOG recent positions */
+#define LZ4_HASH_LOG            12
+
+/* Scratch memory lz4_compress needs; it does not have to be cleared */
+#define LZ4_STATE_SIZE          (sizeof(uint16_t) << LZ4_HASH_LOG)
+
+/**
+ * Compress a buffer
+ * @param src Input
+ * @param len Input bytes (at most LZ4_MAX_INPUT)
+ * @param dst Output
+ * @param cap Output buffer size
+ * @param state LZ4_STATE_SIZE bytes of scratch, 2-byte aligned, one per caller
+ * @return Compressed bytes, or 0 if the result would not fit in cap
+ */
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t cap, void *state);
+
+/**
+ * Decompress a buffer produced by lz4_compress
+ * @param src Compressed input
+ * @param len Compressed bytes
+ * @param dst Output
+ * @param cap Output buffer size
+ * @return Decompressed bytes, or 0 if the input is malformed or does not fit
+ */
+size_t lz4_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+#endif /* _AAAOS_MM_LZ4_H */
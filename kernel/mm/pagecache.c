@@ -0,0 +1,277 @@
+/**
+ * AAAos Kernel - Shared Image Page Cache
+ *
+ * Cached pages sit in a hash table on (image, offset) and on an LRU list
+ * the shrinker walks from its cold end. A miss fills a frame with the
+ * lock dropped and then looks again, so two processes faulting the same
+ * page at once settle on one frame and the loser frees its copy. The
+ * lock is taken with interrupts off: faults take it, and a kernel thread
+ * holding it must not be interrupted into one.
+ */
+
+#include "pagecache.h"
+#include "pmm.h"
+#include "reclaim.h"
+#include "slab.h"
+#include "../include/serial.h"
+#include "../init/initcall.h"
+#include "../sched/spinlock.h"
+#include "../stats/kstat.h"
+
+#define PAGECACHE_HASH_BITS     10
+#define PAGECACHE_HASH_SIZE     (1u << PAGECACHE_HASH_BITS)
+
+/* The shrinker looks at most this many entries per page it is asked for */
+#define PAGECACHE_SCAN_FACTOR   4
+
+/**
+ * Cached page
+ */
+typedef struct pagecache_entry {
+    struct pagecache_entry *hash_next;
+    struct pagecache_entry *lru_prev;   /* Towards the most recently used */
+    struct pagecache_entry *lru_next;
+    const void *image;
+    uint64_t offset;
+    physaddr_t frame;
+} pagecache_entry_t;
+
+LOCK_CLASS(pagecache, "mm.pagecache");
+static spinlock_t pagecache_lock = SPINLOCK_INIT(LOCK_CLASS_OF(pagecache));
+
+static kmem_cache_t *pagecache_entries = NULL;
+static pagecache_entry_t *pagecache_hash[PAGECACHE_HASH_SIZE];
+static pagecache_entry_t *pagecache_lru_head = NULL;
+static pagecache_entry_t *pagecache_lru_tail = NULL;
+static uint64_t pagecache_pages = 0;
+
+static uint64_t pagecache_pages_gauge(void) {
+    return pagecache_pages;
+}
+
+KSTAT_GAUGE(pagecache_size, "mm.pagecache.pages", "Image pages cached", pagecache_pages_gauge);
+KSTAT_COUNTER(pagecache_hits, "mm.pagecache.hits", "Image page faults served by a cached page");
+KSTAT_COUNTER(pagecache_misses, "mm.pagecache.misses", "Image pages read into the cache");
+KSTAT_COUNTER(pagecache_evicted, "mm.pagecache.evicted", "Cached pages dropped");
+
+static inline uint32_t pagecache_bucket(const void *image, uint64_t offset) {
+    uint64_t key = (uint64_t)(uintptr_t)image;
+    key ^= (offset >> PAGE_SHIFT) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - PAGECACHE_HASH_BITS));
+}
+
+/* ============================================================================
+ * Table and LRU (pagecache_lock held)
+ * ============================================================================ */
+
+static pagecache_entry_t *pagecache_lookup(uint32_t bucket, const void *image, uint64_t offset) {
+    for (pagecache_entry_t *e = pagecache_hash[bucket]; e != NULL; e = e->hash_next) {
+        if (e->image == image && e->offset == offset) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void pagecache_lru_unlink(pagecache_entry_t *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        pagecache_lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        pagecache_lru_tail = e->lru_prev;
+    }
+}
+
+static void pagecache_lru_push(pagecache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = pagecache_lru_head;
+    if (pagecache_lru_head) {
+        pagecache_lru_head->lru_prev = e;
+    } else {
+        pagecache_lru_tail = e;
+    }
+    pagecache_lru_head = e;
+}
+
+/**
+ * Take an entry out of the table and LRU; the caller frees it unlocked
+ */
+static void pagecache_remove(pagecache_entry_t *e) {
+    pagecache_entry_t **link = &pagecache_hash[pagecache_bucket(e->image, e->offset)];
+    while (*link != e) {
+        link = &(*link)->hash_next;
+    }
+    *link = e->hash_next;
+    pagecache_lru_unlink(e);
+    pagecache_pages--;
+}
+
+/**
+ * Free entries removed from the table, chained through hash_next
+ */
+static size_t pagecache_release(pagecache_entry_t *list) {
+    size_t n = 0;
+    while (list != NULL) {
+        pagecache_entry_t *next = list->hash_next;
+        pmm_page_unref(list->frame);
+        kmem_cache_free(pagecache_entries, list);
+        list = next;
+        n++;
+    }
+    if (n) {
+        kstat_add(pagecache_evicted, n);
+    }
+    return n;
+}
+
+/* ============================================================================
+ * Interface
+ * ============================================================================ */
+
+physaddr_t pagecache_get(const void *image, uint64_t offset, size_t length) {
+    if (pagecache_entries == NULL || length == 0 || length > PAGE_SIZE) {
+        return 0;
+    }
+    uint32_t bucket = pagecache_bucket(image, offset);
+
+    uint64_t irq = spinlock_acquire_irqsave(&pagecache_lock);
+    pagecache_entry_t *e = pagecache_lookup(bucket, image, offset);
+    if (e != NULL && pmm_page_ref(e->frame)) {
+        pagecache_lru_unlink(e);
+        pagecache_lru_push(e);
+        spinlock_release_irqrestore(&pagecache_lock, irq);
+        kstat_inc(pagecache_hits);
+        return e->frame;
+    }
+    spinlock_release_irqrestore(&pagecache_lock, irq);
+    if (e != NULL) {
+        return 0;
+    }
+
+    pagecache_entry_t *fresh = kmem_cache_alloc(pagecache_entries);
+    if (fresh == NULL) {
+        return 0;
+    }
+    physaddr_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        kmem_cache_free(pagecache_entries, fresh);
+        return 0;
+    }
+
+    uint64_t *words = (uint64_t*)frame;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        words[i] = 0;
+    }
+    const uint8_t *src = (const uint8_t*)image + offset;
+    uint8_t *dst = (uint8_t*)frame;
+    for (size_t i = 0; i < length; i++) {
+        dst[i] = src[i];
+    }
+
+    fresh->image = image;
+    fresh->offset = offset;
+    fresh->frame = frame;
+
+    /* Someone else may have filled the page meanwhile */
+    irq = spinlock_acquire_irqsave(&pagecache_lock);
+    e = pagecache_lookup(bucket, image, offset);
+    if (e == NULL && pmm_page_ref(frame)) {
+        fresh->hash_next = pagecache_hash[bucket];
+        pagecache_hash[bucket] = fresh;
+        pagecache_lru_push(fresh);
+        pagecache_pages++;
+        spinlock_release_irqrestore(&pagecache_lock, irq);
+        kstat_inc(pagecache_misses);
+        return frame;
+    }
+
+    physaddr_t shared = 0;
+    if (e != NULL && pmm_page_ref(e->frame)) {
+        shared = e->frame;
+        pagecache_lru_unlink(e);
+        pagecache_lru_push(e);
+    }
+    spinlock_release_irqrestore(&pagecache_lock, irq);
+
+    pmm_free_page(frame);
+    kmem_cache_free(pagecache_entries, fresh);
+    if (shared) {
+        kstat_inc(pagecache_hits);
+    }
+    return shared;
+}
+
+size_t pagecache_forget(const void *image) {
+    pagecache_entry_t *dropped = NULL;
+
+    uint64_t irq = spinlock_acquire_irqsave(&pagecache_lock);
+    pagecache_entry_t *e = pagecache_lru_head;
+    while (e != NULL) {
+        pagecache_entry_t *next = e->lru_next;
+        if (e->image == image) {
+            pagecache_remove(e);
+            e->hash_next = dropped;
+            dropped = e;
+        }
+        e = next;
+    }
+    spinlock_release_irqrestore(&pagecache_lock, irq);
+
+    return pagecache_release(dropped);
+}
+
+/* ============================================================================
+ * Reclaim
+ * ============================================================================ */
+
+static size_t pagecache_shrink_count(void) {
+    return pagecache_pages;
+}
+
+/**
+ * Drop up to count of the least recently used pages no one maps
+ */
+static size_t pagecache_shrink_scan(size_t count) {
+    pagecache_entry_t *dropped = NULL;
+    size_t found = 0;
+    size_t budget = count * PAGECACHE_SCAN_FACTOR;
+
+    uint64_t irq = spinlock_acquire_irqsave(&pagecache_lock);
+    pagecache_entry_t *e = pagecache_lru_tail;
+    while (e != NULL && found < count && budget-- > 0) {
+        pagecache_entry_t *prev = e->lru_prev;
+        /* Mappings take their reference under this lock, so 1 stays 1 */
+        if (pmm_page_refcount(e->frame) == 1) {
+            pagecache_remove(e);
+            e->hash_next = dropped;
+            dropped = e;
+            found++;
+        }
+        e = prev;
+    }
+    spinlock_release_irqrestore(&pagecache_lock, irq);
+
+    return pagecache_release(dropped);
+}
+
+static shrinker_t pagecache_shrinker = {
+    .name = "mm.pagecache",
+    .count = pagecache_shrink_count,
+    .scan = pagecache_shrink_scan,
+};
+
+static bool pagecache_initcall(void) {
+    pagecache_entries = kmem_cache_create("pagecache", sizeof(pagecache_entry_t), 0, NULL);
+    if (pagecache_entries == NULL) {
+        kprintf("[PAGECACHE] Error: Failed to create entry cache\n");
+        return false;
+    }
+    shrinker_register(&pagecache_shrinker);
+    return true;
+}
+
+INITCALL(pagecache, pagecache_initcall, 0);
@@ -0,0 +1,40 @@
+/**
+ * AAAos Kernel - Shared Image Page Cache
+ *
+ * One physical copy of each read-only page of an in-memory image (the
+ * VMA_IMAGE backing of ELF segments), shared by every address space
+ * that maps it. A page is keyed by the image and its offset in it, so
+ * ten processes started from the same executable map the same text
+ * frames; a writable mapping gets the frame copy-on-write.
+ *
+ * The cache holds one reference on each frame and every mapping holds
+ * another. Under memory pressure the "mm.pagecache" shrinker drops the
+ * pages no address space maps any more.
+ */
+
+#ifndef _AAAOS_MM_PAGECACHE_H
+#define _AAAOS_MM_PAGECACHE_H
+
+#include "../include/types.h"
+
+/**
+ * Get the shared frame holding a page of an image
+ * The frame holds length bytes of the image from offset, then zeroes.
+ * The same (image, offset) must always be asked with the same length.
+ * @param image Image base
+ * @param offset Byte offset of the page in the image
+ * @param length Image bytes in the page (1 to PAGE_SIZE)
+ * @return Frame with a reference for the caller, or 0 if none is available
+ */
+physaddr_t pagecache_get(const void *image, uint64_t offset, size_t length);
+
+/**
+ * Drop every cached page of an image
+ * Must be called before the image is freed or changed; pages already
+ * mapped keep their contents until unmapped.
+ * @param image Image base
+ * @return Pages dropped
+ */
+size_t pagecache_forget(const void *image);
+
+#endif /* _AAAOS_MM_PAGECACHE_H */
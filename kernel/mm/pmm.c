@@ -3,73 +3,628 @@
  *
  * Uses a bitmap to track page allocation.
  * Each bit = 1 page (4KB), 0 = free, 1 = used.
+ *
+ * Allocation is served by a binary buddy allocator (orders 0..PMM_MAX_ORDER)
+ * layered on top of the bitmap. Every free page belongs to exactly one free
+ * buddy block; per-order bitmaps mark the first page of each free block and
+ * a per-order summary bitmap marks which words of those bitmaps are non-empty,
+ * so finding a block is a couple of ctz operations rather than a page scan.
+ *
+ * Single-page allocations and frees go through small per-CPU caches first.
+ * Cached frames stay marked used in the bitmap (so bitmap scans and the
+ * buddy allocator never see them) and are tracked in a separate bitmap so
+ * they still report as free. The global lock is only taken to refill or
+ * drain a cache in batches.
  */
 
 #include "pmm.h"
 #include "../include/serial.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../init/bootprof.h"
+#include "../sched/spinlock.h"
 
 /* Maximum supported physical memory (4GB for now) */
 #define PMM_MAX_MEMORY      (4ULL * GB)
 #define PMM_MAX_PAGES       (PMM_MAX_MEMORY / PMM_PAGE_SIZE)
-#define PMM_BITMAP_SIZE     (PMM_MAX_PAGES / 8)
+#define PMM_BITMAP_WORDS    (PMM_MAX_PAGES / 64)
+
+/* Bitmap storage - statically allocated, 64 pages per word */
+static uint64_t pmm_bitmap[PMM_BITMAP_WORDS];
+
+/*
+ * Buddy free-block bitmaps. Order k tracks PMM_MAX_PAGES >> k blocks; all
+ * orders are packed into one array and addressed through buddy_offset[].
+ * The summary bitmap has one bit per word of buddy_map.
+ */
+#define BUDDY_ORDERS            (PMM_MAX_ORDER + 1)
+#define BUDDY_WORDS(order)      ((PMM_MAX_PAGES >> (order)) / 64)
+#define BUDDY_TOTAL_WORDS       (2 * BUDDY_WORDS(0))
+#define BUDDY_SUMMARY_WORDS     (BUDDY_TOTAL_WORDS / 64)
+
+static uint64_t buddy_map[BUDDY_TOTAL_WORDS];
+static uint64_t buddy_summary[BUDDY_SUMMARY_WORDS];
+static size_t buddy_offset[BUDDY_ORDERS];
+static size_t buddy_free_count[BUDDY_ORDERS];
 
-/* Bitmap storage - statically allocated */
-static uint8_t pmm_bitmap[PMM_BITMAP_SIZE];
+/* Per-CPU order-0 frame caches */
+#define PMM_PCP_BATCH       16      /* Frames moved per refill/drain */
+#define PMM_PCP_HIGH        64      /* Cache capacity */
+
+typedef struct {
+    volatile int lock;              /* Owner/drain exclusion, never spun on */
+    size_t count;
+    size_t pfns[PMM_PCP_HIGH];
+    uint64_t hits;
+    uint64_t misses;
+} ALIGNED(64) pmm_pcp_t;
+
+static pmm_pcp_t pmm_pcp[PERCPU_MAX_CPUS];
+
+/* Pages currently sitting in a per-CPU cache (1 = cached) */
+static uint64_t pmm_pcp_bitmap[PMM_BITMAP_WORDS];
+
+/*
+ * Extra references on shared frames (copy-on-write). A frame with a count
+ * of 0 has a single owner; every additional mapping adds one.
+ */
+static uint16_t pmm_frame_refs[PMM_MAX_PAGES];
 
 /* Statistics */
 static size_t pmm_total_pages = 0;
 static size_t pmm_used_pages = 0;
 
-/* Simple spinlock for thread safety */
-static volatile int pmm_lock = 0;
+/* Lock of the bitmap and counters */
+SPINLOCK_DEFINE(pmm_lock, "mm.pmm");
+
+/* Caches to shrink before an allocation fails */
+static pmm_reclaim_fn_t pmm_reclaimers[PMM_MAX_RECLAIMERS];
+static volatile uint32_t pmm_reclaimer_count = 0;
+
+/* Free-frame watermarks and who hears when frames run low */
+static size_t pmm_wmark_low = 0;
+static size_t pmm_wmark_high = 0;
+static pmm_pressure_fn_t pmm_pressure_hook = NULL;
 
 static inline void pmm_acquire_lock(void) {
-    while (__sync_lock_test_and_set(&pmm_lock, 1)) {
-        __asm__ __volatile__("pause");
-    }
+    spinlock_acquire(&pmm_lock);
 }
 
 static inline void pmm_release_lock(void) {
-    __sync_lock_release(&pmm_lock);
+    spinlock_release(&pmm_lock);
 }
 
 /* Bitmap operations */
 static inline void bitmap_set(size_t bit) {
-    pmm_bitmap[bit / 8] |= (1 << (bit % 8));
+    pmm_bitmap[bit / 64] |= BIT(bit % 64);
 }
 
 static inline void bitmap_clear(size_t bit) {
-    pmm_bitmap[bit / 8] &= ~(1 << (bit % 8));
+    pmm_bitmap[bit / 64] &= ~BIT(bit % 64);
 }
 
 static inline bool bitmap_test(size_t bit) {
-    return (pmm_bitmap[bit / 8] & (1 << (bit % 8))) != 0;
+    return (pmm_bitmap[bit / 64] & BIT(bit % 64)) != 0;
+}
+
+/*
+ * Word-at-a-time range operations on [start, end). Each touches one word
+ * per 64 pages, with partial masks only at the two ends of the range.
+ */
+
+/* Set bits in a word (SWAR: the build has no POPCNT and links no libgcc) */
+static inline size_t bitmap_popcount(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (size_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
+/* Mask of the bits of word 'w' that fall inside [start, end), start < end */
+static inline uint64_t bitmap_range_mask(size_t w, size_t start, size_t end) {
+    size_t lo = (w == start / 64) ? start % 64 : 0;
+    size_t hi = (w == (end - 1) / 64) ? ((end - 1) % 64) + 1 : 64;
+    uint64_t upper = (hi == 64) ? ~0ULL : MASK(hi);
+
+    return upper & ~MASK(lo);
+}
+
+/**
+ * Set all bits in [start, end)
+ * @return Number of bits that were previously clear
+ */
+static size_t bitmap_set_range(size_t start, size_t end) {
+    size_t changed = 0;
+
+    if (start >= end) {
+        return 0;
+    }
+
+    for (size_t w = start / 64; w <= (end - 1) / 64; w++) {
+        uint64_t mask = bitmap_range_mask(w, start, end);
+        changed += bitmap_popcount(~pmm_bitmap[w] & mask);
+        pmm_bitmap[w] |= mask;
+    }
+
+    return changed;
+}
+
+/**
+ * Clear all bits in [start, end)
+ * @return Number of bits that were previously set
+ */
+static size_t bitmap_clear_range(size_t start, size_t end) {
+    size_t changed = 0;
+
+    if (start >= end) {
+        return 0;
+    }
+
+    for (size_t w = start / 64; w <= (end - 1) / 64; w++) {
+        uint64_t mask = bitmap_range_mask(w, start, end);
+        changed += bitmap_popcount(pmm_bitmap[w] & mask);
+        pmm_bitmap[w] &= ~mask;
+    }
+
+    return changed;
+}
+
+/**
+ * Count set bits in [start, end) of a bitmap
+ */
+static size_t bitmap_count_set(const uint64_t *map, size_t start, size_t end) {
+    size_t count = 0;
+
+    if (start >= end) {
+        return 0;
+    }
+
+    for (size_t w = start / 64; w <= (end - 1) / 64; w++) {
+        uint64_t mask = bitmap_range_mask(w, start, end);
+        count += bitmap_popcount(map[w] & mask);
+    }
+
+    return count;
+}
+
+/**
+ * Find the first clear (free) bit in [start, end)
+ * @return Bit index, or 'end' if none
+ */
+static size_t bitmap_find_zero(size_t start, size_t end) {
+    if (start >= end) {
+        return end;
+    }
+
+    for (size_t w = start / 64; w <= (end - 1) / 64; w++) {
+        uint64_t mask = bitmap_range_mask(w, start, end);
+        uint64_t bits = ~pmm_bitmap[w] & mask;
+        if (bits != 0) {
+            return w * 64 + (size_t)__builtin_ctzll(bits);
+        }
+    }
+
+    return end;
+}
+
+/**
+ * Find the first set (used) bit in [start, end)
+ * @return Bit index, or 'end' if none
+ */
+static size_t bitmap_find_set(size_t start, size_t end) {
+    if (start >= end) {
+        return end;
+    }
+
+    for (size_t w = start / 64; w <= (end - 1) / 64; w++) {
+        uint64_t mask = bitmap_range_mask(w, start, end);
+        uint64_t bits = pmm_bitmap[w] & mask;
+        if (bits != 0) {
+            return w * 64 + (size_t)__builtin_ctzll(bits);
+        }
+    }
+
+    return end;
+}
+
+/* Cached-page bitmap operations; atomic since CPUs share words */
+static inline bool pcp_bitmap_test_and_set(size_t bit) {
+    uint64_t old = __sync_fetch_and_or(&pmm_pcp_bitmap[bit / 64], BIT(bit % 64));
+    return (old & BIT(bit % 64)) != 0;
+}
+
+static inline void pcp_bitmap_clear(size_t bit) {
+    __sync_fetch_and_and(&pmm_pcp_bitmap[bit / 64], ~BIT(bit % 64));
+}
+
+static inline bool pcp_bitmap_test(size_t bit) {
+    return (pmm_pcp_bitmap[bit / 64] & BIT(bit % 64)) != 0;
+}
+
+/*
+ * Buddy bitmap operations. A set bit at (order, pfn) means the block of
+ * 2^order pages starting at pfn is free and is not part of a larger block.
+ */
+static void buddy_layout_init(void) {
+    size_t offset = 0;
+
+    for (size_t k = 0; k < BUDDY_ORDERS; k++) {
+        buddy_offset[k] = offset;
+        buddy_free_count[k] = 0;
+        offset += BUDDY_WORDS(k);
+    }
+
+    for (size_t i = 0; i < BUDDY_TOTAL_WORDS; i++) {
+        buddy_map[i] = 0;
+    }
+    for (size_t i = 0; i < BUDDY_SUMMARY_WORDS; i++) {
+        buddy_summary[i] = 0;
+    }
+}
+
+static inline bool buddy_test(size_t order, size_t pfn) {
+    size_t index = pfn >> order;
+    return (buddy_map[buddy_offset[order] + index / 64] & BIT(index % 64)) != 0;
+}
+
+static inline void buddy_mark(size_t order, size_t pfn) {
+    size_t index = pfn >> order;
+    size_t word = buddy_offset[order] + index / 64;
+
+    buddy_map[word] |= BIT(index % 64);
+    buddy_summary[word / 64] |= BIT(word % 64);
+    buddy_free_count[order]++;
+}
+
+static inline void buddy_unmark(size_t order, size_t pfn) {
+    size_t index = pfn >> order;
+    size_t word = buddy_offset[order] + index / 64;
+
+    buddy_map[word] &= ~BIT(index % 64);
+    if (buddy_map[word] == 0) {
+        buddy_summary[word / 64] &= ~BIT(word % 64);
+    }
+    buddy_free_count[order]--;
+}
+
+/**
+ * Find the first free block of exactly 'order'
+ * @return First page of the block, or SIZE_MAX if the order is empty
+ */
+static size_t buddy_find(size_t order) {
+    if (buddy_free_count[order] == 0) {
+        return SIZE_MAX;
+    }
+
+    size_t first = buddy_offset[order];
+    size_t last = first + BUDDY_WORDS(order);
+
+    for (size_t s = first / 64; s <= (last - 1) / 64; s++) {
+        uint64_t summary = buddy_summary[s];
+
+        /* Ignore summary bits belonging to neighbouring orders */
+        if (s == first / 64) {
+            summary &= ~MASK(first % 64);
+        }
+        if (s == (last - 1) / 64 && (last % 64) != 0) {
+            summary &= MASK(last % 64);
+        }
+
+        if (summary != 0) {
+            size_t word = s * 64 + (size_t)__builtin_ctzll(summary);
+            size_t bit = (size_t)__builtin_ctzll(buddy_map[word]);
+            return (((word - first) * 64) + bit) << order;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+/**
+ * Return a block to the free lists, merging with its buddy while possible
+ */
+static void buddy_free_block(size_t pfn, size_t order) {
+    while (order < PMM_MAX_ORDER) {
+        size_t buddy = pfn ^ BIT(order);
+        if (buddy + BIT(order) > pmm_total_pages || !buddy_test(order, buddy)) {
+            break;
+        }
+        buddy_unmark(order, buddy);
+        pfn = MIN(pfn, buddy);
+        order++;
+    }
+
+    buddy_mark(order, pfn);
+}
+
+/**
+ * Insert the free page range [start, end) as maximal aligned buddy blocks
+ */
+static void buddy_free_range(size_t start, size_t end) {
+    while (start < end) {
+        size_t order = PMM_MAX_ORDER;
+        while (order > 0 && (!IS_ALIGNED(start, BIT(order)) || start + BIT(order) > end)) {
+            order--;
+        }
+        buddy_free_block(start, order);
+        start += BIT(order);
+    }
+}
+
+/**
+ * Locate the free block that contains a free page
+ * @return Block order, with *head set to the block's first page
+ */
+static size_t buddy_find_containing(size_t pfn, size_t *head) {
+    for (size_t k = 0; k < BUDDY_ORDERS; k++) {
+        size_t base = ALIGN_DOWN(pfn, BIT(k));
+        if (buddy_test(k, base)) {
+            *head = base;
+            return k;
+        }
+    }
+
+    *head = SIZE_MAX;
+    return 0;
+}
+
+/**
+ * Remove the page range [start, end) from the buddy free lists.
+ * Pages that are already in use are skipped; free blocks that straddle the
+ * range are split and their remainders returned to the free lists.
+ */
+static void buddy_remove_range(size_t start, size_t end) {
+    size_t pfn = start;
+
+    while (pfn < end) {
+        /* Skip over pages that are already in use */
+        pfn = bitmap_find_zero(pfn, end);
+        if (pfn >= end) {
+            break;
+        }
+
+        size_t head;
+        size_t order = buddy_find_containing(pfn, &head);
+        if (head == SIZE_MAX) {
+            pfn++;
+            continue;
+        }
+
+        size_t block_end = head + BIT(order);
+        buddy_unmark(order, head);
+        buddy_free_range(head, MAX(head, start));
+        buddy_free_range(MIN(block_end, end), block_end);
+        pfn = MIN(block_end, end);
+    }
 }
 
 /**
- * Find first fit of 'count' contiguous free pages
+ * Allocate a naturally aligned block of 2^order pages
+ * @return First page of the block, or SIZE_MAX on failure
+ */
+static size_t buddy_alloc(size_t order) {
+    size_t k = order;
+    size_t pfn = SIZE_MAX;
+
+    for (; k < BUDDY_ORDERS; k++) {
+        pfn = buddy_find(k);
+        if (pfn != SIZE_MAX) {
+            break;
+        }
+    }
+
+    if (pfn == SIZE_MAX) {
+        return SIZE_MAX;
+    }
+
+    buddy_unmark(k, pfn);
+
+    /* Split down to the requested order, freeing the upper halves */
+    while (k > order) {
+        k--;
+        buddy_mark(k, pfn + BIT(k));
+    }
+
+    return pfn;
+}
+
+/**
+ * Smallest order whose block holds 'count' pages
+ */
+static inline size_t buddy_order_for(size_t count) {
+    size_t order = 0;
+    while (BIT(order) < count) {
+        order++;
+    }
+    return order;
+}
+
+/**
+ * Find first fit of 'count' contiguous free pages.
+ * Only used for requests larger than the biggest buddy block.
  */
 static size_t find_free_pages(size_t count) {
-    size_t consecutive = 0;
-    size_t start = 0;
+    size_t pfn = 0;
 
-    for (size_t i = 0; i < pmm_total_pages; i++) {
-        if (!bitmap_test(i)) {
-            if (consecutive == 0) {
-                start = i;
-            }
-            consecutive++;
-            if (consecutive >= count) {
-                return start;
-            }
-        } else {
-            consecutive = 0;
+    while (pfn < pmm_total_pages) {
+        size_t start = bitmap_find_zero(pfn, pmm_total_pages);
+        if (start >= pmm_total_pages) {
+            break;
         }
+
+        size_t end = bitmap_find_set(start, pmm_total_pages);
+        if (end - start >= count) {
+            return start;
+        }
+        pfn = end;
     }
 
     return SIZE_MAX;  /* Not found */
 }
 
+/*
+ * Per-CPU cache locks are only ever try-acquired: if the owner is
+ * interrupted mid-operation, or a drain is in progress, callers simply
+ * take the global path instead of spinning.
+ */
+static inline bool pcp_trylock(pmm_pcp_t *pcp) {
+    return __sync_lock_test_and_set(&pcp->lock, 1) == 0;
+}
+
+static inline void pcp_unlock(pmm_pcp_t *pcp) {
+    __sync_lock_release(&pcp->lock);
+}
+
+static inline pmm_pcp_t *pcp_local(void) {
+    uint32_t cpu = percpu_cpu_id();
+    return cpu < PERCPU_MAX_CPUS ? &pmm_pcp[cpu] : NULL;
+}
+
+/**
+ * Move up to 'count' frames from the global pool into a cache
+ * Called with the cache locked; takes the global lock.
+ */
+static void pcp_refill(pmm_pcp_t *pcp, size_t count) {
+    pmm_acquire_lock();
+
+    while (count-- > 0 && pcp->count < PMM_PCP_HIGH) {
+        size_t pfn = buddy_alloc(0);
+        if (pfn == SIZE_MAX) {
+            break;
+        }
+        bitmap_set(pfn);
+        pmm_used_pages++;
+        pcp_bitmap_test_and_set(pfn);
+        pcp->pfns[pcp->count++] = pfn;
+    }
+
+    pmm_release_lock();
+}
+
+/**
+ * Return up to 'count' frames from a cache to the global pool
+ * Called with the cache locked; takes the global lock.
+ */
+static void pcp_drain(pmm_pcp_t *pcp, size_t count) {
+    pmm_acquire_lock();
+
+    while (count-- > 0 && pcp->count > 0) {
+        size_t pfn = pcp->pfns[--pcp->count];
+        pcp_bitmap_clear(pfn);
+        bitmap_clear(pfn);
+        pmm_used_pages--;
+        buddy_free_block(pfn, 0);
+    }
+
+    pmm_release_lock();
+}
+
+/**
+ * Run the pressure callback if the global pool is below the low watermark
+ * Frames in per-CPU caches are not counted, which errs towards reclaiming.
+ */
+static void pmm_check_pressure(void) {
+    pmm_pressure_fn_t hook = __atomic_load_n(&pmm_pressure_hook, __ATOMIC_ACQUIRE);
+    if (hook && pmm_total_pages - pmm_used_pages < pmm_wmark_low) {
+        hook();
+    }
+}
+
+/**
+ * Set the default watermarks from the frames free at boot
+ */
+static void pmm_init_watermarks(void) {
+    size_t free = pmm_total_pages - pmm_used_pages;
+    pmm_wmark_low = MAX(free / PMM_WMARK_DIVISOR, (size_t)PMM_WMARK_MIN);
+    pmm_wmark_high = 2 * pmm_wmark_low;
+}
+
+/**
+ * Allocate one frame from the calling CPU's cache
+ * @return Page frame number, or SIZE_MAX to use the global path
+ */
+static size_t pcp_alloc(void) {
+    pmm_pcp_t *pcp = pcp_local();
+    size_t pfn = SIZE_MAX;
+    bool refilled = false;
+
+    if (!pcp || !pcp_trylock(pcp)) {
+        return SIZE_MAX;
+    }
+
+    if (pcp->count > 0) {
+        pcp->hits++;
+    } else {
+        pcp->misses++;
+        pcp_refill(pcp, PMM_PCP_BATCH);
+        refilled = true;
+    }
+
+    if (pcp->count > 0) {
+        pfn = pcp->pfns[--pcp->count];
+        pcp_bitmap_clear(pfn);
+    }
+
+    pcp_unlock(pcp);
+
+    if (refilled) {
+        pmm_check_pressure();
+    }
+    return pfn;
+}
+
+/**
+ * Free one frame into the calling CPU's cache
+ * @return true if the frame was consumed by the cache
+ */
+static bool pcp_free(size_t pfn) {
+    pmm_pcp_t *pcp = pcp_local();
+
+    if (!pcp || !pcp_trylock(pcp)) {
+        return false;
+    }
+
+    if (pcp->count >= PMM_PCP_HIGH) {
+        pcp_drain(pcp, PMM_PCP_BATCH);
+    }
+
+    pcp_bitmap_test_and_set(pfn);
+    pcp->pfns[pcp->count++] = pfn;
+
+    pcp_unlock(pcp);
+    return true;
+}
+
+/**
+ * Frames held in all per-CPU caches (approximate while CPUs are active)
+ */
+static size_t pcp_cached_pages(void) {
+    size_t total = 0;
+
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        total += pmm_pcp[i].count;
+    }
+
+    return total;
+}
+
+/**
+ * Populate the buddy free lists from the free pages in the bitmap
+ */
+static void buddy_build_from_bitmap(void) {
+    size_t pfn = 0;
+
+    while (pfn < pmm_total_pages) {
+        size_t start = bitmap_find_zero(pfn, pmm_total_pages);
+        if (start >= pmm_total_pages) {
+            break;
+        }
+
+        size_t end = bitmap_find_set(start, pmm_total_pages);
+        buddy_free_range(start, end);
+        pfn = end;
+    }
+}
+
 /**
  * Initialize the physical memory manager
  */
@@ -77,10 +632,18 @@ size_t pmm_init(boot_info_t *boot_info) {
     kprintf("[PMM] Initializing Physical Memory Manager...\n");
 
     /* Mark all memory as used initially */
-    for (size_t i = 0; i < PMM_BITMAP_SIZE; i++) {
-        pmm_bitmap[i] = 0xFF;
+    for (size_t i = 0; i < PMM_BITMAP_WORDS; i++) {
+        pmm_bitmap[i] = ~0ULL;
+        pmm_pcp_bitmap[i] = 0;
+    }
+    buddy_layout_init();
+
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        pmm_pcp[i].lock = 0;
+        pmm_pcp[i].count = 0;
+        pmm_pcp[i].hits = 0;
+        pmm_pcp[i].misses = 0;
     }
-    pmm_used_pages = PMM_MAX_PAGES;
 
     /* If no valid boot info, assume minimal memory */
     if (!boot_info_valid(boot_info) || boot_info->mem_map_count == 0) {
@@ -90,17 +653,17 @@ size_t pmm_init(boot_info_t *boot_info) {
         size_t start_page = PMM_ADDR_TO_PFN(0x100000);  /* 1MB */
         size_t end_page = PMM_ADDR_TO_PFN(0x1000000);   /* 16MB */
 
-        for (size_t i = start_page; i < end_page && i < PMM_MAX_PAGES; i++) {
-            bitmap_clear(i);
-            pmm_used_pages--;
-        }
+        bitmap_clear_range(start_page, MIN(end_page, PMM_MAX_PAGES));
 
         pmm_total_pages = end_page;
+        pmm_used_pages = bitmap_count_set(pmm_bitmap, 0, pmm_total_pages);
+        buddy_build_from_bitmap();
         kprintf("[PMM] Default: %llu pages (%llu MB) total, %llu pages free\n",
                 (uint64_t)pmm_total_pages,
                 (uint64_t)(pmm_total_pages * PMM_PAGE_SIZE / MB),
                 (uint64_t)(pmm_total_pages - pmm_used_pages));
 
+        pmm_init_watermarks();
         return pmm_total_pages - pmm_used_pages;
     }
 
@@ -149,19 +712,22 @@ size_t pmm_init(boot_info_t *boot_info) {
         size_t start_page = PMM_ADDR_TO_PFN(start_addr);
         size_t end_page = PMM_ADDR_TO_PFN(end_addr);
 
-        for (size_t page = start_page; page < end_page; page++) {
-            if (!bitmap_test(page)) {
-                continue;  /* Already free */
-            }
-            bitmap_clear(page);
-            pmm_used_pages--;
-            usable_count++;
-        }
+        usable_count += bitmap_clear_range(start_page, end_page);
     }
 
     /* Set total pages based on highest address */
     pmm_total_pages = PMM_ADDR_TO_PFN(MIN(highest_addr, PMM_MAX_MEMORY));
 
+    pmm_used_pages = bitmap_count_set(pmm_bitmap, 0, pmm_total_pages);
+    buddy_build_from_bitmap();
+
+    /* The initramfs sits in memory the map calls usable; it is read in place */
+    if (boot_info->initrd_size) {
+        pmm_reserve_range(boot_info->initrd_addr, boot_info->initrd_size);
+        kprintf("[PMM]   Initramfs:   0x%llx (%llu KB) reserved\n",
+                boot_info->initrd_addr, boot_info->initrd_size / KB);
+    }
+
     kprintf("[PMM] Memory map processed:\n");
     kprintf("[PMM]   Total pages: %llu (%llu MB)\n",
             (uint64_t)pmm_total_pages,
@@ -173,9 +739,114 @@ size_t pmm_init(boot_info_t *boot_info) {
             (uint64_t)pmm_used_pages,
             (uint64_t)(pmm_used_pages * PMM_PAGE_SIZE / MB));
 
+    pmm_init_watermarks();
+    kprintf("[PMM]   Watermarks:  low %llu, high %llu pages\n",
+            (uint64_t)pmm_wmark_low, (uint64_t)pmm_wmark_high);
+
+    bootprof_mark(BOOTPROF_PMM);
     return pmm_total_pages - pmm_used_pages;
 }
 
+/**
+ * Allocate 'count' contiguous pages from the global pool
+ * @return First page frame number, or SIZE_MAX on failure
+ */
+static size_t pmm_alloc_global(size_t count) {
+    pmm_acquire_lock();
+
+    size_t start;
+    size_t order = buddy_order_for(count);
+
+    if (order <= PMM_MAX_ORDER) {
+        start = buddy_alloc(order);
+        if (start != SIZE_MAX && count < BIT(order)) {
+            /* Give back the unused tail of the block */
+            buddy_free_range(start + count, start + BIT(order));
+        }
+    } else {
+        /* Larger than any buddy block: fall back to a bitmap scan */
+        start = find_free_pages(count);
+        if (start != SIZE_MAX) {
+            buddy_remove_range(start, start + count);
+        }
+    }
+
+    if (start != SIZE_MAX) {
+        pmm_used_pages += bitmap_set_range(start, start + count);
+    }
+
+    pmm_release_lock();
+    return start;
+}
+
+/**
+ * Ask registered caches for frames
+ * @return Frames freed
+ */
+static size_t pmm_reclaim(size_t count) {
+    uint32_t n = __atomic_load_n(&pmm_reclaimer_count, __ATOMIC_ACQUIRE);
+    size_t freed = 0;
+
+    for (uint32_t i = 0; i < n && freed < count; i++) {
+        freed += pmm_reclaimers[i](count - freed);
+    }
+    return freed;
+}
+
+/**
+ * Register a reclaim callback
+ */
+bool pmm_register_reclaimer(pmm_reclaim_fn_t fn) {
+    if (!fn) {
+        return false;
+    }
+
+    pmm_acquire_lock();
+    uint32_t n = pmm_reclaimer_count;
+    if (n >= PMM_MAX_RECLAIMERS) {
+        pmm_release_lock();
+        return false;
+    }
+    pmm_reclaimers[n] = fn;
+    __atomic_store_n(&pmm_reclaimer_count, n + 1, __ATOMIC_RELEASE);
+    pmm_release_lock();
+    return true;
+}
+
+/**
+ * Set the memory pressure callback
+ */
+void pmm_set_pressure_hook(pmm_pressure_fn_t fn) {
+    __atomic_store_n(&pmm_pressure_hook, fn, __ATOMIC_RELEASE);
+}
+
+/**
+ * Set the free-frame watermarks
+ */
+bool pmm_set_watermarks(size_t low, size_t high) {
+    if (low > high) {
+        return false;
+    }
+
+    pmm_acquire_lock();
+    pmm_wmark_low = low;
+    pmm_wmark_high = high;
+    pmm_release_lock();
+    return true;
+}
+
+/**
+ * Get the free-frame watermarks
+ */
+void pmm_get_watermarks(size_t *low, size_t *high) {
+    if (low) {
+        *low = pmm_wmark_low;
+    }
+    if (high) {
+        *high = pmm_wmark_high;
+    }
+}
+
 /**
  * Allocate physical page frames
  */
@@ -184,26 +855,35 @@ physaddr_t pmm_alloc_pages(size_t count) {
         return 0;
     }
 
-    pmm_acquire_lock();
+    if (count == 1) {
+        size_t pfn = pcp_alloc();
+        if (pfn != SIZE_MAX) {
+            return PMM_PFN_TO_ADDR(pfn);
+        }
+    }
 
-    size_t start = find_free_pages(count);
+    size_t start = pmm_alloc_global(count);
 
     if (start == SIZE_MAX) {
-        pmm_release_lock();
-        kprintf("[PMM] Warning: Failed to allocate %llu pages\n", (uint64_t)count);
-        return 0;
+        /* Frames parked in per-CPU caches may be what is missing */
+        pmm_drain_cpu_caches();
+        start = pmm_alloc_global(count);
     }
 
-    /* Mark pages as used */
-    for (size_t i = 0; i < count; i++) {
-        bitmap_set(start + i);
-        pmm_used_pages++;
+    if (start == SIZE_MAX && pmm_reclaim(count) > 0) {
+        /* Reclaimed frames may have gone to a per-CPU cache */
+        pmm_drain_cpu_caches();
+        start = pmm_alloc_global(count);
     }
 
-    pmm_release_lock();
+    pmm_check_pressure();
 
-    physaddr_t addr = PMM_PFN_TO_ADDR(start);
-    return addr;
+    if (start == SIZE_MAX) {
+        kprintf("[PMM] Warning: Failed to allocate %llu pages\n", (uint64_t)count);
+        return 0;
+    }
+
+    return PMM_PFN_TO_ADDR(start);
 }
 
 /**
@@ -222,21 +902,54 @@ void pmm_free_pages(physaddr_t addr, size_t count) {
 
     size_t start = PMM_ADDR_TO_PFN(addr);
 
+    if (count == 1 && start < pmm_total_pages) {
+        if (!bitmap_test(start) || pcp_bitmap_test(start)) {
+            kprintf("[PMM] Warning: Double free at page %llu\n", (uint64_t)start);
+            return;
+        }
+        if (pcp_free(start)) {
+            return;
+        }
+    }
+
+    size_t end = MIN(start + count, pmm_total_pages);
+    if (start >= end) {
+        return;
+    }
+
     pmm_acquire_lock();
 
-    for (size_t i = 0; i < count; i++) {
-        size_t page = start + i;
-        if (page >= pmm_total_pages) {
-            break;
-        }
+    /* Common case: every page is allocated and none is cached */
+    if (bitmap_count_set(pmm_bitmap, start, end) == end - start &&
+        bitmap_count_set(pmm_pcp_bitmap, start, end) == 0) {
+        pmm_used_pages -= bitmap_clear_range(start, end);
+        buddy_free_range(start, end);
+        pmm_release_lock();
+        return;
+    }
+
+    size_t run_start = SIZE_MAX;
+    size_t page = start;
 
-        if (!bitmap_test(page)) {
+    for (; page < end; page++) {
+        if (!bitmap_test(page) || pcp_bitmap_test(page)) {
             kprintf("[PMM] Warning: Double free at page %llu\n", (uint64_t)page);
+            if (run_start != SIZE_MAX) {
+                buddy_free_range(run_start, page);
+                run_start = SIZE_MAX;
+            }
             continue;
         }
 
         bitmap_clear(page);
         pmm_used_pages--;
+        if (run_start == SIZE_MAX) {
+            run_start = page;
+        }
+    }
+
+    if (run_start != SIZE_MAX) {
+        buddy_free_range(run_start, page);
     }
 
     pmm_release_lock();
@@ -253,14 +966,45 @@ size_t pmm_get_total_pages(void) {
  * Get number of free pages
  */
 size_t pmm_get_free_pages(void) {
-    return pmm_total_pages - pmm_used_pages;
+    return pmm_total_pages - pmm_used_pages + pcp_cached_pages();
+}
+
+/**
+ * Get per-CPU frame cache statistics
+ */
+bool pmm_get_cpu_stats(uint32_t cpu, pmm_cpu_stats_t *stats) {
+    if (cpu >= PERCPU_MAX_CPUS || !stats) {
+        return false;
+    }
+
+    stats->hits = pmm_pcp[cpu].hits;
+    stats->misses = pmm_pcp[cpu].misses;
+    stats->cached = pmm_pcp[cpu].count;
+    return true;
+}
+
+/**
+ * Return all per-CPU cached frames to the global pool
+ * Best effort: a cache whose lock is held (e.g. by the context this call
+ * interrupted) is skipped rather than waited on.
+ */
+void pmm_drain_cpu_caches(void) {
+    for (size_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        pmm_pcp_t *pcp = &pmm_pcp[i];
+
+        if (pcp->count == 0 || !pcp_trylock(pcp)) {
+            continue;
+        }
+        pcp_drain(pcp, pcp->count);
+        pcp_unlock(pcp);
+    }
 }
 
 /**
  * Get number of used pages
  */
 size_t pmm_get_used_pages(void) {
-    return pmm_used_pages;
+    return pmm_used_pages - pcp_cached_pages();
 }
 
 /**
@@ -274,19 +1018,16 @@ void pmm_reserve_range(physaddr_t addr, size_t size) {
     physaddr_t start_addr = ALIGN_DOWN(addr, PMM_PAGE_SIZE);
     physaddr_t end_addr = ALIGN_UP(addr + size, PMM_PAGE_SIZE);
 
+    /* Cached frames look used; flush them so none inside the range remain */
+    pmm_drain_cpu_caches();
+
     pmm_acquire_lock();
 
-    for (physaddr_t a = start_addr; a < end_addr; a += PMM_PAGE_SIZE) {
-        size_t page = PMM_ADDR_TO_PFN(a);
-        if (page >= pmm_total_pages) {
-            break;
-        }
+    size_t start = PMM_ADDR_TO_PFN(start_addr);
+    size_t end = MIN(PMM_ADDR_TO_PFN(end_addr), pmm_total_pages);
 
-        if (!bitmap_test(page)) {
-            bitmap_set(page);
-            pmm_used_pages++;
-        }
-    }
+    buddy_remove_range(start, end);
+    pmm_used_pages += bitmap_set_range(start, end);
 
     pmm_release_lock();
 }
@@ -304,5 +1045,59 @@ bool pmm_is_page_free(physaddr_t addr) {
         return false;
     }
 
-    return !bitmap_test(page);
+    return !bitmap_test(page) || pcp_bitmap_test(page);
+}
+
+/**
+ * Take an extra reference on an allocated frame
+ */
+bool pmm_page_ref(physaddr_t addr) {
+    size_t page = PMM_ADDR_TO_PFN(addr);
+    if (page >= pmm_total_pages || !bitmap_test(page) || pcp_bitmap_test(page)) {
+        kprintf("[PMM] Warning: Reference to unallocated page %p\n", (void*)addr);
+        return false;
+    }
+
+    uint16_t old = pmm_frame_refs[page];
+    do {
+        if (old == UINT16_MAX) {
+            kprintf("[PMM] Warning: Reference count overflow at page %llu\n",
+                    (uint64_t)page);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&pmm_frame_refs[page], &old, old + 1,
+                                          false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return true;
+}
+
+/**
+ * Drop a reference on a frame, freeing it with the last one
+ */
+bool pmm_page_unref(physaddr_t addr) {
+    size_t page = PMM_ADDR_TO_PFN(addr);
+    if (page >= pmm_total_pages) {
+        return false;
+    }
+
+    uint16_t old = pmm_frame_refs[page];
+    while (old != 0) {
+        if (__atomic_compare_exchange_n(&pmm_frame_refs[page], &old, old - 1,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return false;
+        }
+    }
+
+    pmm_free_page(PMM_PFN_TO_ADDR(page));
+    return true;
+}
+
+/**
+ * Get the number of owners of a frame
+ */
+uint32_t pmm_page_refcount(physaddr_t addr) {
+    size_t page = PMM_ADDR_TO_PFN(addr);
+    if (page >= pmm_total_pages || pmm_is_page_free(PMM_PFN_TO_ADDR(page))) {
+        return 0;
+    }
+    return (uint32_t)__atomic_load_n(&pmm_frame_refs[page], __ATOMIC_ACQUIRE) + 1;
 }
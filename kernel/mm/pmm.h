@@ -3,6 +3,8 @@
  *
  * Manages physical memory using a bitmap allocator.
  * Each bit represents one 4KB page frame.
+ * Allocations are served by a binary buddy allocator on top of the bitmap,
+ * with per-CPU caches in front of it for single pages.
  */
 
 #ifndef _AAAOS_MM_PMM_H
@@ -19,6 +21,9 @@
 #define PMM_ADDR_TO_PFN(addr)   ((addr) >> PMM_PAGE_SHIFT)
 #define PMM_PFN_TO_ADDR(pfn)    ((pfn) << PMM_PAGE_SHIFT)
 
+/* Largest buddy block is 2^PMM_MAX_ORDER pages (4MB) */
+#define PMM_MAX_ORDER       10
+
 /**
  * Initialize the physical memory manager
  * @param boot_info Boot information containing memory map
@@ -28,6 +33,8 @@ size_t pmm_init(boot_info_t *boot_info);
 
 /**
  * Allocate physical page frames
+ * Requests of up to 2^PMM_MAX_ORDER pages are aligned to the next power of
+ * two of 'count'; larger requests fall back to a first-fit bitmap scan.
  * @param count Number of contiguous pages needed
  * @return Physical address of first page, or 0 on failure
  * @thread_safety Safe to call from any context (uses spinlock internally)
@@ -69,6 +76,29 @@ size_t pmm_get_total_pages(void);
  */
 size_t pmm_get_free_pages(void);
 
+/**
+ * Per-CPU frame cache statistics
+ */
+typedef struct {
+    uint64_t hits;              /* Single-page allocations served from cache */
+    uint64_t misses;            /* Allocations that needed a refill */
+    size_t   cached;            /* Frames currently held in the cache */
+} pmm_cpu_stats_t;
+
+/**
+ * Get per-CPU frame cache statistics
+ * @param cpu Logical CPU index
+ * @param stats Output statistics
+ * @return true on success, false if cpu is out of range
+ */
+bool pmm_get_cpu_stats(uint32_t cpu, pmm_cpu_stats_t *stats);
+
+/**
+ * Return all frames held in per-CPU caches to the global pool
+ * Used before large contiguous allocations and range reservations.
+ */
+void pmm_drain_cpu_caches(void);
+
 /**
  * Get number of used pages
  * @return Used page count
@@ -90,4 +120,75 @@ void pmm_reserve_range(physaddr_t addr, size_t size);
  */
 bool pmm_is_page_free(physaddr_t addr);
 
+/**
+ * Take an extra reference on an allocated frame, for sharing it between
+ * address spaces (copy-on-write)
+ * @param addr Physical address of the frame
+ * @return true on success, false if the frame is free or the count is full
+ */
+bool pmm_page_ref(physaddr_t addr);
+
+/**
+ * Drop a reference on a frame; the last reference frees it
+ * @param addr Physical address of the frame
+ * @return true if the frame was freed
+ */
+bool pmm_page_unref(physaddr_t addr);
+
+/**
+ * Reclaim callback, run when an allocation finds no free frames
+ * Runs in the allocating context, possibly with the caller's locks held,
+ * so it must not allocate and must only try-lock its own state.
+ * @param pages Frames the allocation still needs
+ * @return Number of frames it freed
+ */
+typedef size_t (*pmm_reclaim_fn_t)(size_t pages);
+
+/* Reclaim callbacks that can be registered */
+#define PMM_MAX_RECLAIMERS  4
+
+/**
+ * Register a cache that gives frames back under memory pressure
+ * @param fn Reclaim callback
+ * @return false if PMM_MAX_RECLAIMERS are registered already
+ */
+bool pmm_register_reclaimer(pmm_reclaim_fn_t fn);
+
+/* Low watermark at boot: free pages / PMM_WMARK_DIVISOR, at least PMM_WMARK_MIN */
+#define PMM_WMARK_DIVISOR   64
+#define PMM_WMARK_MIN       32
+
+/**
+ * Memory pressure callback, run when an allocation from the global pool
+ * leaves fewer free frames than the low watermark
+ * Runs in the allocating context, with no PMM lock held; it should only
+ * wake whoever reclaims.
+ */
+typedef void (*pmm_pressure_fn_t)(void);
+
+/**
+ * Set the memory pressure callback (NULL to remove it)
+ */
+void pmm_set_pressure_hook(pmm_pressure_fn_t fn);
+
+/**
+ * Set the free-frame watermarks
+ * Below low the pressure callback runs; background reclaim goes on until
+ * high frames are free again.
+ * @return false unless low <= high
+ */
+bool pmm_set_watermarks(size_t low, size_t high);
+
+/**
+ * Get the free-frame watermarks
+ */
+void pmm_get_watermarks(size_t *low, size_t *high);
+
+/**
+ * Get the number of owners of a frame
+ * @param addr Physical address of the frame
+ * @return 0 if free, 1 if unshared, more if shared
+ */
+uint32_t pmm_page_refcount(physaddr_t addr);
+
 #endif /* _AAAOS_MM_PMM_H */
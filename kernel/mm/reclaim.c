@@ -0,0 +1,191 @@
+/**
+ * AAAos Kernel - Memory Reclaim
+ *
+ * Shrinkers sit on a list that only grows, so walking it takes no lock.
+ * Each round asks every shrinker for its share of what is still missing,
+ * in proportion to how much it holds; rounds stop once enough frames are
+ * free, or when a whole round freed nothing. Progress is measured in free
+ * frames, since freeing objects only frees a page once a slab empties.
+ */
+
+#include "reclaim.h"
+#include "pmm.h"
+#include "slab.h"
+#include "../include/serial.h"
+#include "../init/initcall.h"
+#include "../proc/process.h"
+#include "../sched/scheduler.h"
+#include "../sched/timer.h"
+#include "../sched/waitq.h"
+#include "../stats/kstat.h"
+
+/* Most rounds over the shrinkers per reclaim_pages call */
+#define RECLAIM_MAX_ROUNDS      16
+
+/* Pause after a run that freed nothing, before pressure can wake it again */
+#define RECLAIM_BACKOFF_MS      100
+
+/* Registered shrinkers, newest first */
+static shrinker_t *volatile shrinker_head = NULL;
+
+/* Set by reclaim_wake, cleared by the thread when done (wait queue word) */
+static volatile uint32_t reclaim_kicked = 0;
+
+static bool reclaim_started = false;
+
+KSTAT_COUNTER(reclaim_runs, "mm.reclaim.runs", "Times the reclaim thread was woken");
+KSTAT_COUNTER(reclaim_freed, "mm.reclaim.pages", "Frames freed by the reclaim thread");
+KSTAT_COUNTER(reclaim_direct, "mm.reclaim.direct_pages",
+              "Frames freed by allocations that found none");
+KSTAT_COUNTER(reclaim_slab, "mm.reclaim.slab_pages", "Empty slab pages returned");
+
+bool shrinker_register(shrinker_t *shrinker) {
+    if (!shrinker || !shrinker->count || !shrinker->scan) {
+        return false;
+    }
+
+    for (shrinker_t *s = shrinker_list(); s; s = s->next) {
+        if (s == shrinker) {
+            return false;
+        }
+    }
+
+    shrinker->scanned = 0;
+    shrinker->freed = 0;
+    shrinker_t *head = __atomic_load_n(&shrinker_head, __ATOMIC_ACQUIRE);
+    do {
+        shrinker->next = head;
+    } while (!__atomic_compare_exchange_n(&shrinker_head, &head, shrinker, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    return true;
+}
+
+shrinker_t *shrinker_list(void) {
+    return __atomic_load_n(&shrinker_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Objects the eligible shrinkers could free now
+ */
+static size_t reclaim_count(bool direct) {
+    size_t total = 0;
+    for (shrinker_t *s = shrinker_list(); s; s = s->next) {
+        if (!direct || (s->flags & SHRINKER_DIRECT)) {
+            total += s->count();
+        }
+    }
+    return total;
+}
+
+size_t reclaim_pages(size_t pages, bool direct) {
+    size_t start = pmm_get_free_pages();
+    size_t target = start + pages;
+
+    for (uint32_t round = 0; round < RECLAIM_MAX_ROUNDS; round++) {
+        size_t now = pmm_get_free_pages();
+        size_t total = reclaim_count(direct);
+        if (now >= target || total == 0) {
+            break;
+        }
+        size_t want = target - now;
+
+        size_t freed = 0;
+        for (shrinker_t *s = shrinker_list(); s; s = s->next) {
+            if (direct && !(s->flags & SHRINKER_DIRECT)) {
+                continue;
+            }
+            size_t n = s->count();
+            if (n == 0) {
+                continue;
+            }
+
+            size_t ask = MIN(MAX(want * n / total, (size_t)1), MIN(n, (size_t)RECLAIM_BATCH));
+            size_t got = s->scan(ask);
+            __atomic_fetch_add(&s->scanned, ask, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->freed, got, __ATOMIC_RELAXED);
+            freed += got;
+        }
+        if (freed == 0) {
+            break;
+        }
+    }
+
+    /* Slabs the shrinkers emptied; kmem_cache_free keeps one per cache */
+    if (!direct) {
+        kstat_add(reclaim_slab, kmem_cache_reap());
+    }
+
+    size_t end = pmm_get_free_pages();
+    return end > start ? end - start : 0;
+}
+
+void reclaim_wake(void) {
+    if (!__atomic_exchange_n(&reclaim_kicked, 1, __ATOMIC_ACQ_REL)) {
+        waitq_wake(&reclaim_kicked, 1);
+    }
+}
+
+/**
+ * PMM reclaimer: run by an allocation that found no free frames
+ */
+static size_t reclaim_direct_fn(size_t pages) {
+    reclaim_wake();
+    size_t freed = reclaim_pages(pages, true);
+    kstat_add(reclaim_direct, freed);
+    return freed;
+}
+
+/**
+ * Body of the reclaim thread
+ */
+static void reclaim_thread(void *arg) {
+    UNUSED(arg);
+
+    for (;;) {
+        waitq_wait(&reclaim_kicked, 0);
+        kstat_inc(reclaim_runs);
+
+        size_t low, high;
+        pmm_get_watermarks(&low, &high);
+        size_t free_pages = pmm_get_free_pages();
+        size_t freed = 0;
+        if (free_pages < high) {
+            freed = reclaim_pages(high - free_pages, false);
+            kstat_add(reclaim_freed, freed);
+        }
+
+        /* Nothing left to give: do not spin on every allocation below low */
+        if (freed == 0 && free_pages < low) {
+            timer_sleep_ms(RECLAIM_BACKOFF_MS);
+        }
+        __atomic_store_n(&reclaim_kicked, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Hook reclaim into the PMM and start the thread once threads can run
+ */
+static bool reclaim_initcall(void) {
+    static bool direct_registered = false;
+    if (!direct_registered) {
+        direct_registered = pmm_register_reclaimer(reclaim_direct_fn);
+        if (!direct_registered) {
+            kprintf("[RECLAIM] Cannot register with the PMM\n");
+        }
+    }
+
+    if (reclaim_started || !scheduler_is_running()) {
+        return direct_registered;
+    }
+
+    process_t *thread = thread_create(NULL, "kreclaimd", reclaim_thread, NULL);
+    if (!thread || !scheduler_add(thread)) {
+        kprintf("[RECLAIM] Cannot start the reclaim thread\n");
+        return false;
+    }
+    reclaim_started = true;
+    pmm_set_pressure_hook(reclaim_wake);
+    return direct_registered;
+}
+
+INITCALL(reclaim, reclaim_initcall, 0);
@@ -0,0 +1,67 @@
+/**
+ * AAAos Kernel - Memory Reclaim
+ *
+ * Caches that hold memory they could give back register a shrinker:
+ * count says how many objects it could free now, scan frees up to a
+ * number of them, least recently used first. When an allocation leaves
+ * fewer free frames than the PMM's low watermark, the "kreclaimd" thread
+ * is woken and shrinks the caches in proportion to their size until the
+ * high watermark is reached again, then returns the slab pages left
+ * without live objects (kmem_cache_reap).
+ *
+ * That normally happens before allocations start failing. An allocation
+ * that still finds no frames runs the SHRINKER_DIRECT shrinkers itself,
+ * from inside the PMM; those must not allocate or sleep and may only
+ * try-lock their own state. The "mm.reclaim.*" metrics (kstat.h) count
+ * the thread's runs and the frames it and direct reclaim freed.
+ */
+
+#ifndef _AAAOS_MM_RECLAIM_H
+#define _AAAOS_MM_RECLAIM_H
+
+#include "../include/types.h"
+
+/* Most objects asked of one shrinker per scan call */
+#define RECLAIM_BATCH           64
+
+/* Shrinker flags */
+#define SHRINKER_DIRECT         (1u << 0)   /* scan is safe inside an allocation */
+
+/**
+ * Cache shrinker, usually a static in the cache's own file
+ */
+typedef struct shrinker {
+    const char *name;                   /* "subsystem.cache" */
+    size_t (*count)(void);              /* Objects it could free now */
+    size_t (*scan)(size_t objects);     /* Free up to objects; returns how many were */
+    uint32_t flags;                     /* SHRINKER_* */
+    struct shrinker *next;              /* Registered shrinkers, newest first */
+    uint64_t scanned;                   /* Objects asked for */
+    uint64_t freed;                     /* Objects freed */
+} shrinker_t;
+
+/**
+ * Register a shrinker (registrations last for good)
+ * @return false if shrinker has no count or scan, or is registered already
+ */
+bool shrinker_register(shrinker_t *shrinker);
+
+/**
+ * Registered shrinkers, newest first (follow ->next)
+ */
+shrinker_t *shrinker_list(void);
+
+/**
+ * Shrink caches until pages frames are freed or nothing more gives
+ * @param pages Frames wanted
+ * @param direct Only run SHRINKER_DIRECT shrinkers, and skip the slab reap
+ * @return Frames freed
+ */
+size_t reclaim_pages(size_t pages, bool direct);
+
+/**
+ * Wake the reclaim thread (safe from any context)
+ */
+void reclaim_wake(void);
+
+#endif /* _AAAOS_MM_RECLAIM_H */
@@ -0,0 +1,469 @@
+/**
+ * AAAos Kernel - Slab Object Cache Allocator Implementation
+ *
+ * Each slab is a naturally aligned power-of-two run of PMM pages:
+ * - A kmem_slab_t header at the start of the run
+ * - Followed by equally sized object slots
+ * - Free slots are chained through a pointer stored in the slot itself
+ *
+ * Because the buddy allocator aligns power-of-two runs to their size, the
+ * slab owning an object is found by aligning the object address down.
+ * Slabs move between full, partial and free lists; at most one empty slab
+ * is kept per cache, the rest are returned to the PMM.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "../include/serial.h"
+#include "../../lib/libc/string.h"
+
+/**
+ * Slab header, located at the start of every slab
+ */
+typedef struct kmem_slab {
+    struct kmem_cache *cache;       /* Owning cache */
+    struct kmem_slab *next;         /* Next slab in list */
+    struct kmem_slab *prev;         /* Previous slab in list */
+    void *free_list;                /* First free object */
+    uint32_t inuse;                 /* Allocated objects */
+    uint32_t magic;                 /* KMEM_SLAB_MAGIC */
+} kmem_slab_t;
+
+/**
+ * Object cache descriptor
+ */
+struct kmem_cache {
+    char name[KMEM_NAME_LEN];       /* Cache name */
+    size_t obj_size;                /* Requested object size */
+    size_t slot_size;               /* Slot size including free pointer */
+    size_t align;                   /* Object alignment */
+    size_t free_offset;             /* Offset of free pointer in slot */
+    size_t slab_pages;              /* Pages per slab */
+    size_t first_offset;            /* Offset of first slot in slab */
+    uint32_t objs_per_slab;         /* Slots per slab */
+    kmem_ctor_t ctor;               /* Optional constructor */
+
+    kmem_slab_t *partial;           /* Slabs with free and used slots */
+    kmem_slab_t *full;              /* Slabs with no free slots */
+    kmem_slab_t *empty;             /* Slabs with no used slots */
+
+    size_t slab_count;              /* Slabs owned */
+    size_t active_objs;             /* Objects allocated */
+    size_t alloc_count;             /* Total allocations */
+    size_t free_count;              /* Total frees */
+
+    volatile int lock;              /* Per-cache spinlock */
+    bool in_use;                    /* Descriptor slot in use */
+};
+
+/* Cache descriptors - statically allocated so caches work before the heap */
+static kmem_cache_t kmem_caches[KMEM_MAX_CACHES];
+static volatile int kmem_caches_lock = 0;
+
+/**
+ * Acquire a slab spinlock
+ */
+static inline void kmem_acquire_lock(volatile int *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/**
+ * Release a slab spinlock
+ */
+static inline void kmem_release_lock(volatile int *lock) {
+    __sync_lock_release(lock);
+}
+
+/**
+ * Slab list helpers
+ */
+static void slab_list_push(kmem_slab_t **head, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(kmem_slab_t **head, kmem_slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/**
+ * Free pointer stored inside a free slot
+ */
+static inline void **slot_free_ptr(kmem_cache_t *cache, void *obj) {
+    return (void**)((virtaddr_t)obj + cache->free_offset);
+}
+
+/**
+ * Find the slab that owns an object
+ */
+static inline kmem_slab_t *obj_to_slab(kmem_cache_t *cache, void *obj) {
+    return (kmem_slab_t*)ALIGN_DOWN((virtaddr_t)obj, cache->slab_pages * PAGE_SIZE);
+}
+
+/**
+ * Allocate and carve a new slab
+ */
+static kmem_slab_t *slab_create(kmem_cache_t *cache) {
+    physaddr_t phys = pmm_alloc_pages(cache->slab_pages);
+    if (phys == 0) {
+        return NULL;
+    }
+
+    /*
+     * Note: Like the heap, this assumes physical memory is identity mapped.
+     */
+    kmem_slab_t *slab = (kmem_slab_t*)phys;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->inuse = 0;
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->free_list = NULL;
+
+    /* Chain slots in address order so allocation walks forward */
+    virtaddr_t base = (virtaddr_t)slab + cache->first_offset;
+    for (uint32_t i = cache->objs_per_slab; i-- > 0;) {
+        void *obj = (void*)(base + i * cache->slot_size);
+        if (cache->ctor != NULL) {
+            cache->ctor(obj);
+        }
+        *slot_free_ptr(cache, obj) = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+/**
+ * Return a slab's pages to the PMM
+ */
+static void slab_destroy(kmem_cache_t *cache, kmem_slab_t *slab) {
+    slab->magic = 0;
+    pmm_free_pages((physaddr_t)slab, cache->slab_pages);
+}
+
+/**
+ * Create an object cache
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor) {
+    if (size == 0) {
+        kprintf("[SLAB] Error: Zero object size\n");
+        return NULL;
+    }
+
+    if (align == 0) {
+        align = KMEM_MIN_ALIGN;
+    }
+    if ((align & (align - 1)) != 0) {
+        kprintf("[SLAB] Error: Alignment must be power of 2\n");
+        return NULL;
+    }
+    align = MAX(align, KMEM_MIN_ALIGN);
+
+    /*
+     * Without a constructor the free pointer can overlay the object. With
+     * one, it goes after the object so constructed state is preserved.
+     */
+    size_t free_offset = 0;
+    size_t slot_size = MAX(size, sizeof(void*));
+    if (ctor != NULL) {
+        free_offset = ALIGN_UP(size, sizeof(void*));
+        slot_size = free_offset + sizeof(void*);
+    }
+    slot_size = ALIGN_UP(slot_size, align);
+
+    /* Pick the smallest power-of-two slab holding enough objects */
+    size_t first_offset = ALIGN_UP(sizeof(kmem_slab_t), align);
+    size_t pages = 1;
+    while (pages < KMEM_MAX_SLAB_PAGES &&
+           (pages * PAGE_SIZE - first_offset) / slot_size < KMEM_MIN_OBJS_PER_SLAB) {
+        pages *= 2;
+    }
+
+    size_t objs = (pages * PAGE_SIZE - first_offset) / slot_size;
+    if (objs == 0) {
+        kprintf("[SLAB] Error: Object size %llu too large for a slab\n", (uint64_t)size);
+        return NULL;
+    }
+
+    kmem_acquire_lock(&kmem_caches_lock);
+
+    kmem_cache_t *cache = NULL;
+    for (size_t i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (!kmem_caches[i].in_use) {
+            cache = &kmem_caches[i];
+            break;
+        }
+    }
+
+    if (cache == NULL) {
+        kmem_release_lock(&kmem_caches_lock);
+        kprintf("[SLAB] Error: Too many caches (max %u)\n", KMEM_MAX_CACHES);
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->in_use = true;
+
+    kmem_release_lock(&kmem_caches_lock);
+
+    size_t n = 0;
+    if (name != NULL) {
+        while (name[n] && n < KMEM_NAME_LEN - 1) {
+            cache->name[n] = name[n];
+            n++;
+        }
+    }
+    cache->name[n] = '\0';
+
+    cache->obj_size = size;
+    cache->slot_size = slot_size;
+    cache->align = align;
+    cache->free_offset = free_offset;
+    cache->slab_pages = pages;
+    cache->first_offset = first_offset;
+    cache->objs_per_slab = (uint32_t)objs;
+    cache->ctor = ctor;
+
+    kprintf("[SLAB] Created cache '%s': %llu byte objects, %u per %llu-page slab\n",
+            cache->name, (uint64_t)slot_size, cache->objs_per_slab, (uint64_t)pages);
+
+    return cache;
+}
+
+/**
+ * Destroy an object cache
+ */
+bool kmem_cache_destroy(kmem_cache_t *cache) {
+    if (cache == NULL) {
+        return false;
+    }
+
+    kmem_acquire_lock(&cache->lock);
+
+    if (cache->active_objs != 0) {
+        kmem_release_lock(&cache->lock);
+        kprintf("[SLAB] Error: Cache '%s' still has %llu active objects\n",
+                cache->name, (uint64_t)cache->active_objs);
+        return false;
+    }
+
+    while (cache->empty != NULL) {
+        kmem_slab_t *slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_destroy(cache, slab);
+    }
+
+    kmem_release_lock(&cache->lock);
+
+    kmem_acquire_lock(&kmem_caches_lock);
+    cache->in_use = false;
+    kmem_release_lock(&kmem_caches_lock);
+
+    return true;
+}
+
+/**
+ * Allocate an object from a cache
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    kmem_acquire_lock(&cache->lock);
+
+    kmem_slab_t *slab = cache->partial;
+    if (slab == NULL) {
+        slab = cache->empty;
+        if (slab != NULL) {
+            slab_list_remove(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (slab == NULL) {
+                kmem_release_lock(&cache->lock);
+                kprintf("[SLAB] Error: Cache '%s' out of memory\n", cache->name);
+                return NULL;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    /* Pop the first free slot */
+    void *obj = slab->free_list;
+    slab->free_list = *slot_free_ptr(cache, obj);
+    slab->inuse++;
+
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->active_objs++;
+    cache->alloc_count++;
+
+    kmem_release_lock(&cache->lock);
+    return obj;
+}
+
+/**
+ * Allocate a zero-filled object from a cache
+ */
+void *kmem_cache_zalloc(kmem_cache_t *cache) {
+    void *obj = kmem_cache_alloc(cache);
+    if (obj != NULL) {
+        memset(obj, 0, cache->obj_size);
+    }
+    return obj;
+}
+
+/**
+ * Return an object to its cache
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (cache == NULL || obj == NULL) {
+        return;
+    }
+
+    kmem_slab_t *slab = obj_to_slab(cache, obj);
+    kmem_slab_t *release = NULL;
+
+    if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache) {
+        kprintf("[SLAB] Error: Object %p does not belong to cache '%s'\n",
+                obj, cache->name);
+        return;
+    }
+
+    kmem_acquire_lock(&cache->lock);
+
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    *slot_free_ptr(cache, obj) = slab->free_list;
+    slab->free_list = obj;
+    slab->inuse--;
+
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            slab_list_push(&cache->empty, slab);
+        } else {
+            release = slab;
+            cache->slab_count--;
+        }
+    }
+
+    cache->active_objs--;
+    cache->free_count++;
+
+    kmem_release_lock(&cache->lock);
+
+    if (release != NULL) {
+        slab_destroy(cache, release);
+    }
+}
+
+/**
+ * Release all empty slabs of a cache
+ */
+size_t kmem_cache_shrink(kmem_cache_t *cache) {
+    size_t released = 0;
+
+    if (cache == NULL) {
+        return 0;
+    }
+
+    kmem_acquire_lock(&cache->lock);
+
+    while (cache->empty != NULL) {
+        kmem_slab_t *slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        cache->slab_count--;
+        slab_destroy(cache, slab);
+        released += cache->slab_pages;
+    }
+
+    kmem_release_lock(&cache->lock);
+    return released;
+}
+
+/**
+ * Release the empty slabs of every cache
+ */
+size_t kmem_cache_reap(void) {
+    size_t released = 0;
+
+    kmem_acquire_lock(&kmem_caches_lock);
+    for (size_t i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (kmem_caches[i].in_use) {
+            released += kmem_cache_shrink(&kmem_caches[i]);
+        }
+    }
+    kmem_release_lock(&kmem_caches_lock);
+
+    return released;
+}
+
+/**
+ * Get statistics for one cache
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    if (cache == NULL || stats == NULL) {
+        return;
+    }
+
+    kmem_acquire_lock(&cache->lock);
+    stats->name = cache->name;
+    stats->obj_size = cache->slot_size;
+    stats->objs_per_slab = cache->objs_per_slab;
+    stats->slab_count = cache->slab_count;
+    stats->active_objs = cache->active_objs;
+    stats->total_objs = cache->slab_count * cache->objs_per_slab;
+    stats->alloc_count = cache->alloc_count;
+    stats->free_count = cache->free_count;
+    kmem_release_lock(&cache->lock);
+}
+
+/**
+ * Print statistics for all caches
+ */
+void kmem_cache_print_stats(void) {
+    kprintf("[SLAB] === Object Caches ===\n");
+
+    for (size_t i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (!kmem_caches[i].in_use) {
+            continue;
+        }
+
+        kmem_cache_stats_t stats;
+        kmem_cache_get_stats(&kmem_caches[i], &stats);
+        kprintf("[SLAB]   %s: size=%llu active=%llu total=%llu slabs=%llu allocs=%llu\n",
+                stats.name,
+                (uint64_t)stats.obj_size,
+                (uint64_t)stats.active_objs,
+                (uint64_t)stats.total_objs,
+                (uint64_t)stats.slab_count,
+                (uint64_t)stats.alloc_count);
+    }
+
+    kprintf("[SLAB] ======================\n");
+}
@@ -0,0 +1,111 @@
+/**
+ * AAAos Kernel - Slab Object Cache Allocator
+ *
+ * Provides fixed-size object caches for frequently allocated kernel
+ * objects. Each cache carves objects out of slabs of PMM pages, giving
+ * O(1) allocation and free with no per-object header. Objects may have
+ * a constructor that runs once when a slab is created; freed objects
+ * must be returned in their constructed state.
+ */
+
+#ifndef _AAAOS_MM_SLAB_H
+#define _AAAOS_MM_SLAB_H
+
+#include "../include/types.h"
+
+/* Slab configuration */
+#define KMEM_MAX_CACHES         32          /* Maximum number of caches */
+#define KMEM_NAME_LEN           24          /* Cache name length (incl. NUL) */
+#define KMEM_MIN_ALIGN          8           /* Minimum object alignment */
+#define KMEM_MIN_OBJS_PER_SLAB  8           /* Target objects per slab */
+#define KMEM_MAX_SLAB_PAGES     16          /* Largest slab (must be power of 2) */
+
+/* Magic number for slab validation */
+#define KMEM_SLAB_MAGIC         0x51AB51AB
+
+/* Object constructor */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/* Opaque cache handle */
+typedef struct kmem_cache kmem_cache_t;
+
+/**
+ * Per-cache statistics structure
+ */
+typedef struct kmem_cache_stats {
+    const char *name;               /* Cache name */
+    size_t obj_size;                /* Object slot size (after alignment) */
+    size_t objs_per_slab;           /* Objects per slab */
+    size_t slab_count;              /* Slabs currently owned */
+    size_t active_objs;             /* Objects currently allocated */
+    size_t total_objs;              /* Object capacity of all slabs */
+    size_t alloc_count;             /* Total allocations made */
+    size_t free_count;              /* Total frees made */
+} kmem_cache_stats_t;
+
+/**
+ * Create an object cache
+ * @param name Cache name (copied, used in statistics)
+ * @param size Object size in bytes
+ * @param align Object alignment (power of 2, 0 for default)
+ * @param ctor Optional constructor, run once per object at slab creation
+ * @return Cache handle, or NULL on failure
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor);
+
+/**
+ * Destroy an object cache and release its slabs
+ * @param cache Cache to destroy (must have no active objects)
+ * @return true on success, false if objects are still allocated
+ */
+bool kmem_cache_destroy(kmem_cache_t *cache);
+
+/**
+ * Allocate an object from a cache
+ * @param cache Cache to allocate from
+ * @return Pointer to object, or NULL on failure
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * Allocate a zero-filled object from a cache
+ * Only meaningful for caches without a constructor.
+ * @param cache Cache to allocate from
+ * @return Pointer to zeroed object, or NULL on failure
+ */
+void *kmem_cache_zalloc(kmem_cache_t *cache);
+
+/**
+ * Return an object to its cache
+ * @param cache Cache the object was allocated from
+ * @param obj Object to free (NULL is safe to pass)
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * Release all completely free slabs of a cache back to the PMM
+ * @param cache Cache to shrink
+ * @return Number of pages released
+ */
+size_t kmem_cache_shrink(kmem_cache_t *cache);
+
+/**
+ * Release the completely free slabs of every cache (memory reclaim)
+ * @return Number of pages released
+ */
+size_t kmem_cache_reap(void);
+
+/**
+ * Get statistics for one cache
+ * @param cache Cache to query
+ * @param stats Pointer to stats structure to fill
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+
+/**
+ * Print statistics for all caches to serial console
+ */
+void kmem_cache_print_stats(void);
+
+#endif /* _AAAOS_MM_SLAB_H */
@@ -0,0 +1,740 @@
+/**
+ * AAAos Kernel - Virtual Memory Areas Implementation
+ *
+ * VMAs live in a red-black tree keyed by start address. They never
+ * overlap, so the VMA containing an address is the one with the greatest
+ * start not above it. VMAs are byte ranges: ELF segments that share a
+ * page are separate VMAs, and a fault fills the page from all of them.
+ */
+
+#include "vma.h"
+#include "vmm.h"
+#include "pagecache.h"
+#include "pmm.h"
+#include "slab.h"
+#include "../include/serial.h"
+
+/* VMA objects */
+static kmem_cache_t *vma_cache = NULL;
+static volatile int vma_cache_lock = 0;
+
+/* Statistics, updated atomically */
+static vma_stats_t vma_stats;
+
+#define VMA_STAT_INC(field)     __atomic_fetch_add(&vma_stats.field, 1, __ATOMIC_RELAXED)
+#define VMA_STAT_DEC(field)     __atomic_fetch_sub(&vma_stats.field, 1, __ATOMIC_RELAXED)
+
+static inline void vma_lock(vma_tree_t *tree) {
+    while (__sync_lock_test_and_set(&tree->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void vma_unlock(vma_tree_t *tree) {
+    __sync_lock_release(&tree->lock);
+}
+
+/* ============================================================================
+ * VMA objects
+ * ============================================================================ */
+
+static vma_t *vma_alloc(void) {
+    if (vma_cache == NULL) {
+        while (__sync_lock_test_and_set(&vma_cache_lock, 1)) {
+            __asm__ __volatile__("pause");
+        }
+        if (vma_cache == NULL) {
+            vma_cache = kmem_cache_create("vma", sizeof(vma_t), 0, NULL);
+        }
+        __sync_lock_release(&vma_cache_lock);
+
+        if (vma_cache == NULL) {
+            kprintf("[VMA] Error: Failed to create VMA cache\n");
+            return NULL;
+        }
+    }
+
+    vma_t *vma = kmem_cache_zalloc(vma_cache);
+    if (vma != NULL) {
+        VMA_STAT_INC(vmas);
+    }
+    return vma;
+}
+
+static void vma_free(vma_t *vma) {
+    if (vma->type == VMA_FILE && vma->file_ops->unref) {
+        vma->file_ops->unref(vma->file);
+    }
+    kmem_cache_free(vma_cache, vma);
+    VMA_STAT_DEC(vmas);
+}
+
+/**
+ * Copy a VMA's description (not its tree links), taking a backing reference
+ */
+static void vma_copy(vma_t *vma, const vma_t *src) {
+    vma->start = src->start;
+    vma->end = src->end;
+    vma->flags = src->flags;
+    vma->type = src->type;
+    vma->image = src->image;
+    vma->image_size = src->image_size;
+    vma->file_ops = src->file_ops;
+    vma->file = src->file;
+    vma->offset = src->offset;
+
+    if (vma->type == VMA_FILE && vma->file_ops->ref) {
+        vma->file_ops->ref(vma->file);
+    }
+}
+
+/**
+ * Move the start of a VMA forward, keeping the backing aligned with it
+ */
+static void vma_advance(vma_t *vma, virtaddr_t new_start) {
+    size_t delta = new_start - vma->start;
+
+    if (vma->type == VMA_IMAGE) {
+        if (delta >= vma->image_size) {
+            vma->image_size = 0;
+        } else {
+            vma->image += delta;
+            vma->image_size -= delta;
+        }
+    } else if (vma->type == VMA_FILE) {
+        vma->offset += delta;
+    }
+    vma->start = new_start;
+}
+
+/**
+ * Move the end of a VMA back
+ */
+static void vma_truncate(vma_t *vma, virtaddr_t new_end) {
+    vma->end = new_end;
+    if (vma->type == VMA_IMAGE) {
+        vma->image_size = MIN(vma->image_size, (size_t)(new_end - vma->start));
+    }
+}
+
+/**
+ * Copy image bytes into a page being filled
+ * Segments are usually 8-byte congruent with their file offset, so the
+ * bulk goes in 64-bit words.
+ */
+static void vma_fill_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+    if ((((uintptr_t)dst ^ (uintptr_t)src) & 7) == 0) {
+        while (n > 0 && ((uintptr_t)dst & 7) != 0) {
+            *dst++ = *src++;
+            n--;
+        }
+        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t)) {
+            *(uint64_t*)dst = *(const uint64_t*)src;
+            dst += sizeof(uint64_t);
+            src += sizeof(uint64_t);
+        }
+    }
+    while (n-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+/* ============================================================================
+ * Red-black tree
+ * ============================================================================ */
+
+static void rb_replace(vma_tree_t *tree, vma_t *old, vma_t *node) {
+    vma_t *parent = old->parent;
+
+    if (parent == NULL) {
+        tree->root = node;
+    } else if (parent->left == old) {
+        parent->left = node;
+    } else {
+        parent->right = node;
+    }
+    if (node != NULL) {
+        node->parent = parent;
+    }
+}
+
+static void rb_rotate_left(vma_tree_t *tree, vma_t *x) {
+    vma_t *y = x->right;
+
+    x->right = y->left;
+    if (y->left != NULL) {
+        y->left->parent = x;
+    }
+    rb_replace(tree, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(vma_tree_t *tree, vma_t *x) {
+    vma_t *y = x->left;
+
+    x->left = y->right;
+    if (y->right != NULL) {
+        y->right->parent = x;
+    }
+    rb_replace(tree, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static inline bool rb_is_red(const vma_t *node) {
+    return node != NULL && node->red;
+}
+
+static void rb_insert(vma_tree_t *tree, vma_t *node) {
+    vma_t *parent = NULL;
+    vma_t **link = &tree->root;
+
+    while (*link != NULL) {
+        parent = *link;
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = true;
+    *link = node;
+    tree->count++;
+
+    /* Restore the red-black properties */
+    while (rb_is_red(node->parent)) {
+        vma_t *p = node->parent;
+        vma_t *g = p->parent;
+
+        if (p == g->left) {
+            vma_t *uncle = g->right;
+            if (rb_is_red(uncle)) {
+                p->red = false;
+                uncle->red = false;
+                g->red = true;
+                node = g;
+                continue;
+            }
+            if (node == p->right) {
+                rb_rotate_left(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_right(tree, g);
+        } else {
+            vma_t *uncle = g->left;
+            if (rb_is_red(uncle)) {
+                p->red = false;
+                uncle->red = false;
+                g->red = true;
+                node = g;
+                continue;
+            }
+            if (node == p->left) {
+                rb_rotate_right(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_left(tree, g);
+        }
+    }
+    tree->root->red = false;
+}
+
+static void rb_erase(vma_tree_t *tree, vma_t *node) {
+    vma_t *child;
+    vma_t *parent;
+    bool removed_red;
+
+    if (node->left != NULL && node->right != NULL) {
+        /* Splice out the successor and put it in node's place */
+        vma_t *next = node->right;
+        while (next->left != NULL) {
+            next = next->left;
+        }
+
+        removed_red = next->red;
+        child = next->right;
+
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            parent->left = child;
+            if (child != NULL) {
+                child->parent = parent;
+            }
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+        next->red = node->red;
+        rb_replace(tree, node, next);
+    } else {
+        child = node->left != NULL ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        rb_replace(tree, node, child);
+    }
+
+    tree->count--;
+
+    if (removed_red) {
+        return;
+    }
+
+    /* child carries an extra black; push it up or resolve it */
+    while (child != tree->root && !rb_is_red(child)) {
+        if (child == parent->left) {
+            vma_t *sibling = parent->right;
+            if (rb_is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rb_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)) {
+                sibling->red = true;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                rb_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rb_rotate_left(tree, parent);
+        } else {
+            vma_t *sibling = parent->left;
+            if (rb_is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rb_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)) {
+                sibling->red = true;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                rb_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rb_rotate_right(tree, parent);
+        }
+        child = tree->root;
+    }
+
+    if (child != NULL) {
+        child->red = false;
+    }
+}
+
+static vma_t *rb_first(vma_tree_t *tree) {
+    vma_t *node = tree->root;
+    while (node != NULL && node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+static vma_t *rb_next(vma_t *node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/**
+ * VMA with the greatest start not above addr
+ */
+static vma_t *vma_floor(vma_tree_t *tree, virtaddr_t addr) {
+    vma_t *node = tree->root;
+    vma_t *best = NULL;
+
+    while (node != NULL) {
+        if (node->start <= addr) {
+            best = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return best;
+}
+
+/**
+ * Lowest VMA overlapping [start, end), or NULL
+ */
+static vma_t *vma_first_overlap(vma_tree_t *tree, virtaddr_t start, virtaddr_t end) {
+    vma_t *vma = vma_floor(tree, start);
+
+    if (vma != NULL && vma->end > start) {
+        return vma;
+    }
+    vma = vma ? rb_next(vma) : rb_first(tree);
+    return (vma != NULL && vma->start < end) ? vma : NULL;
+}
+
+/* ============================================================================
+ * Public interface
+ * ============================================================================ */
+
+void vma_tree_init(vma_tree_t *tree) {
+    tree->root = NULL;
+    tree->count = 0;
+    tree->lock = 0;
+}
+
+static void vma_free_subtree(vma_t *node) {
+    while (node != NULL) {
+        vma_t *right = node->right;
+        vma_free_subtree(node->left);
+        vma_free(node);
+        node = right;
+    }
+}
+
+void vma_tree_destroy(vma_tree_t *tree) {
+    vma_lock(tree);
+    vma_free_subtree(tree->root);
+    tree->root = NULL;
+    tree->count = 0;
+    vma_unlock(tree);
+}
+
+bool vma_tree_clone(vma_tree_t *dst, vma_tree_t *src) {
+    bool ok = true;
+
+    vma_tree_init(dst);
+
+    vma_lock(src);
+    for (vma_t *vma = rb_first(src); vma != NULL; vma = rb_next(vma)) {
+        vma_t *copy = vma_alloc();
+        if (copy == NULL) {
+            ok = false;
+            break;
+        }
+        vma_copy(copy, vma);
+        rb_insert(dst, copy);
+    }
+    vma_unlock(src);
+
+    if (!ok) {
+        vma_tree_destroy(dst);
+    }
+    return ok;
+}
+
+vma_t *vma_find(vma_tree_t *tree, virtaddr_t addr) {
+    vma_lock(tree);
+    vma_t *vma = vma_floor(tree, addr);
+    if (vma != NULL && addr >= vma->end) {
+        vma = NULL;
+    }
+    vma_unlock(tree);
+    return vma;
+}
+
+/**
+ * Insert a described VMA if its range is free
+ */
+static bool vma_add(vma_tree_t *tree, vma_t *vma) {
+    if (vma->end <= vma->start || vma->end > VMA_USER_END) {
+        vma_free(vma);
+        return false;
+    }
+
+    vma_lock(tree);
+    if (vma_first_overlap(tree, vma->start, vma->end) != NULL) {
+        vma_unlock(tree);
+        vma_free(vma);
+        return false;
+    }
+    rb_insert(tree, vma);
+    vma_unlock(tree);
+    return true;
+}
+
+bool vma_map_anon(vma_tree_t *tree, virtaddr_t start, size_t size, uint64_t flags) {
+    vma_t *vma = vma_alloc();
+    if (vma == NULL) {
+        return false;
+    }
+
+    vma->start = start;
+    vma->end = start + size;
+    vma->flags = flags;
+    vma->type = VMA_ANON;
+    return vma_add(tree, vma);
+}
+
+bool vma_map_image(vma_tree_t *tree, virtaddr_t start, size_t size,
+                   const void *image, size_t image_size, uint64_t flags) {
+    if (image_size > size || (image_size > 0 && image == NULL)) {
+        return false;
+    }
+
+    vma_t *vma = vma_alloc();
+    if (vma == NULL) {
+        return false;
+    }
+
+    vma->start = start;
+    vma->end = start + size;
+    vma->flags = flags;
+    vma->type = image_size > 0 ? VMA_IMAGE : VMA_ANON;
+    vma->image = (const uint8_t*)image;
+    vma->image_size = image_size;
+    return vma_add(tree, vma);
+}
+
+bool vma_map_file(vma_tree_t *tree, virtaddr_t start, size_t size, uint64_t flags,
+                  const vma_file_ops_t *ops, void *object, uint64_t offset) {
+    if (ops == NULL || ops->read == NULL) {
+        return false;
+    }
+
+    vma_t *vma = vma_alloc();
+    if (vma == NULL) {
+        return false;
+    }
+
+    vma->start = start;
+    vma->end = start + size;
+    vma->flags = flags;
+    vma->type = VMA_FILE;
+    vma->file_ops = ops;
+    vma->file = object;
+    vma->offset = offset;
+    if (ops->ref) {
+        ops->ref(object);
+    }
+    return vma_add(tree, vma);
+}
+
+bool vma_unmap(vma_tree_t *tree, physaddr_t pml4, virtaddr_t start, size_t size) {
+    if (size == 0 || !IS_ALIGNED(start, PAGE_SIZE)) {
+        return false;
+    }
+
+    size = ALIGN_UP(size, PAGE_SIZE);
+    virtaddr_t end = start + size;
+
+    /* At most one VMA straddles both ends; its tail needs a new node */
+    vma_t *spare = vma_alloc();
+
+    vma_lock(tree);
+
+    vma_t *vma;
+    while ((vma = vma_first_overlap(tree, start, end)) != NULL) {
+        if (vma->start < start && vma->end > end) {
+            if (spare == NULL) {
+                vma_unlock(tree);
+                return false;
+            }
+            vma_t *tail = spare;
+            spare = NULL;
+
+            vma_copy(tail, vma);
+            vma_advance(tail, end);
+            vma_truncate(vma, start);
+            rb_insert(tree, tail);
+        } else if (vma->start < start) {
+            vma_truncate(vma, start);
+        } else if (vma->end > end) {
+            vma_advance(vma, end);      /* Order in the tree is unchanged */
+        } else {
+            rb_erase(tree, vma);
+            vma_free(vma);
+        }
+    }
+
+    vma_unlock(tree);
+
+    if (spare != NULL) {
+        vma_free(spare);
+    }
+
+    vmm_unmap_user_range(pml4, start, size / PAGE_SIZE);
+    return true;
+}
+
+virtaddr_t vma_find_free(vma_tree_t *tree, virtaddr_t hint, size_t size) {
+    size = ALIGN_UP(size, PAGE_SIZE);
+    virtaddr_t addr = hint >= VMA_MMAP_BASE ? ALIGN_UP(hint, PAGE_SIZE) : VMA_MMAP_BASE;
+
+    vma_lock(tree);
+    while (size != 0 && addr + size > addr && addr + size <= VMA_USER_END) {
+        vma_t *vma = vma_first_overlap(tree, addr, addr + size);
+        if (vma == NULL) {
+            vma_unlock(tree);
+            return addr;
+        }
+        addr = ALIGN_UP(vma->end, PAGE_SIZE);
+    }
+    vma_unlock(tree);
+    return 0;
+}
+
+bool vma_handle_fault(vma_tree_t *tree, physaddr_t pml4, virtaddr_t addr, bool write) {
+    virtaddr_t page = addr & ~((virtaddr_t)PAGE_SIZE - 1);
+    virtaddr_t page_end = page + PAGE_SIZE;
+
+    vma_lock(tree);
+
+    /* The faulting byte itself must be inside a VMA */
+    vma_t *hit = vma_floor(tree, addr);
+    if (hit == NULL || addr >= hit->end) {
+        vma_unlock(tree);
+        return false;
+    }
+    vma_t *first = vma_first_overlap(tree, page, page_end);
+
+    /* VMAs sharing the page give it the union of their rights */
+    uint64_t flags = VMM_FLAG_PRESENT | VMM_FLAG_USER;
+    bool exec = false;
+    bool has_data = false;
+
+    for (vma_t *vma = first; vma != NULL && vma->start < page_end; vma = rb_next(vma)) {
+        flags |= vma->flags & VMM_FLAG_WRITE;
+        if (!(vma->flags & VMM_FLAG_NX)) {
+            exec = true;
+        }
+        if (vma->type == VMA_FILE ||
+            (vma->type == VMA_IMAGE && vma->start + vma->image_size > page)) {
+            has_data = true;
+        }
+    }
+    if (!exec) {
+        flags |= VMM_FLAG_NX;
+    }
+
+    /* Untouched zero-fill memory that is only read: share the zero page */
+    if (!has_data && !write) {
+        physaddr_t zero = vmm_get_zero_page();
+        if (zero != 0) {
+            uint64_t zero_flags = flags;
+            if (zero_flags & VMM_FLAG_WRITE) {
+                zero_flags = (zero_flags & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+            }
+            bool ok = vmm_map_user_page(pml4, page, zero, zero_flags);
+            vma_unlock(tree);
+            if (ok) {
+                VMA_STAT_INC(faults);
+                VMA_STAT_INC(zero_pages);
+            }
+            return ok;
+        }
+    }
+
+    /*
+     * A page wholly inside one image VMA is the same in every address
+     * space mapping that image: map the cached copy, copy-on-write if the
+     * VMA is writable. Only a write fault gets a private copy straight away.
+     */
+    if (has_data && first->type == VMA_IMAGE && first->start <= page && first->end >= page_end &&
+        !(write && (flags & VMM_FLAG_WRITE))) {
+        size_t offset = page - first->start;
+        physaddr_t shared = pagecache_get(first->image, offset,
+                                          MIN((size_t)PAGE_SIZE, first->image_size - offset));
+        if (shared != 0) {
+            uint64_t shared_flags = flags;
+            if (shared_flags & VMM_FLAG_WRITE) {
+                shared_flags = (shared_flags & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+            }
+            bool ok = vmm_map_user_page(pml4, page, shared, shared_flags);
+            vma_unlock(tree);
+            if (ok) {
+                VMA_STAT_INC(faults);
+                VMA_STAT_INC(shared_pages);
+            }
+            return ok;
+        }
+    }
+
+    physaddr_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        vma_unlock(tree);
+        kprintf("[VMA] Error: Out of memory filling page 0x%llx\n", (uint64_t)page);
+        return false;
+    }
+
+    uint8_t *dst = (uint8_t*)frame;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        ((uint64_t*)dst)[i] = 0;
+    }
+
+    for (vma_t *vma = first; vma != NULL && vma->start < page_end; vma = rb_next(vma)) {
+        virtaddr_t lo = MAX(vma->start, page);
+        virtaddr_t hi = MIN(vma->end, page_end);
+
+        if (vma->type == VMA_IMAGE) {
+            virtaddr_t image_end = MIN(hi, vma->start + vma->image_size);
+            if (image_end > lo) {
+                vma_fill_copy(dst + (lo - page), vma->image + (lo - vma->start), image_end - lo);
+            }
+        } else if (vma->type == VMA_FILE) {
+            /* Short reads (end of file) leave the rest zero */
+            ssize_t n = vma->file_ops->read(vma->file, dst + (lo - page), hi - lo,
+                                            vma->offset + (lo - vma->start));
+            if (n < 0) {
+                vma_unlock(tree);
+                pmm_free_page(frame);
+                kprintf("[VMA] Error: Read failed filling page 0x%llx\n", (uint64_t)page);
+                return false;
+            }
+        }
+    }
+
+    bool ok = vmm_map_user_page(pml4, page, frame, flags);
+    vma_unlock(tree);
+
+    if (ok) {
+        VMA_STAT_INC(faults);
+        if (has_data) {
+            VMA_STAT_INC(filled_pages);
+        } else {
+            VMA_STAT_INC(anon_pages);
+        }
+    }
+    return ok;
+}
+
+void vma_get_stats(vma_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->vmas = __atomic_load_n(&vma_stats.vmas, __ATOMIC_RELAXED);
+    stats->faults = __atomic_load_n(&vma_stats.faults, __ATOMIC_RELAXED);
+    stats->filled_pages = __atomic_load_n(&vma_stats.filled_pages, __ATOMIC_RELAXED);
+    stats->zero_pages = __atomic_load_n(&vma_stats.zero_pages, __ATOMIC_RELAXED);
+    stats->anon_pages = __atomic_load_n(&vma_stats.anon_pages, __ATOMIC_RELAXED);
+    stats->shared_pages = __atomic_load_n(&vma_stats.shared_pages, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,173 @@
+/**
+ * AAAos Kernel - Virtual Memory Areas
+ *
+ * A VMA describes one range of a user address space and where its pages
+ * come from. Nothing is mapped when a VMA is created; the page-fault
+ * handler fills each page on first touch:
+ *
+ * - VMA_ANON:  zero-filled memory (mmap of anonymous memory, ELF BSS)
+ * - VMA_IMAGE: bytes of an in-memory image, zero past its end (ELF segments)
+ * - VMA_FILE:  bytes read through a backing object's read operation
+ *              (files from the VFS)
+ *
+ * Zero-fill pages that are only read map a shared zero page until the
+ * first write. Each process keeps its VMAs in a red-black tree ordered
+ * by start address, so the fault path finds a VMA in O(log n).
+ */
+
+#ifndef _AAAOS_MM_VMA_H
+#define _AAAOS_MM_VMA_H
+
+#include "../include/types.h"
+
+/* User address space layout for mappings */
+#define VMA_USER_END            0x0000800000000000ULL   /* End of the lower half */
+#define VMA_MMAP_BASE           0x0000200000000000ULL   /* Start of the search for free areas */
+
+/**
+ * Kind of backing for a VMA
+ */
+typedef enum {
+    VMA_ANON = 0,
+    VMA_IMAGE,
+    VMA_FILE
+} vma_type_t;
+
+/**
+ * Backing object operations for VMA_FILE
+ */
+typedef struct vma_file_ops {
+    /* Read size bytes at offset; returns bytes read or negative on error */
+    ssize_t (*read)(void *object, void *buf, size_t size, uint64_t offset);
+    void (*ref)(void *object);          /* Take a reference (VMA split/clone) */
+    void (*unref)(void *object);        /* Drop a reference (VMA removed) */
+} vma_file_ops_t;
+
+/**
+ * Virtual memory area
+ */
+typedef struct vma {
+    /* Red-black tree linkage */
+    struct vma *left;
+    struct vma *right;
+    struct vma *parent;
+    bool red;
+
+    virtaddr_t start;                   /* First byte */
+    virtaddr_t end;                     /* One past the last byte */
+    uint64_t flags;                     /* VMM_FLAG_* for the VMA's pages */
+    vma_type_t type;
+
+    /* VMA_IMAGE: contents of [start, start + image_size) */
+    const uint8_t *image;
+    size_t image_size;
+
+    /* VMA_FILE: object offset that backs start */
+    const vma_file_ops_t *file_ops;
+    void *file;
+    uint64_t offset;
+} vma_t;
+
+/**
+ * Per-address-space VMA tree
+ */
+typedef struct vma_tree {
+    vma_t *root;
+    size_t count;
+    volatile int lock;
+} vma_tree_t;
+
+/**
+ * VMA statistics (all trees)
+ */
+typedef struct vma_stats {
+    uint64_t vmas;                      /* Live VMAs */
+    uint64_t faults;                    /* Faults resolved from a VMA */
+    uint64_t filled_pages;              /* Pages filled from an image or file */
+    uint64_t zero_pages;                /* Read faults served by the zero page */
+    uint64_t anon_pages;                /* Private zeroed pages allocated */
+    uint64_t shared_pages;              /* Faults served by a shared image page */
+} vma_stats_t;
+
+/**
+ * Initialize an empty tree
+ */
+void vma_tree_init(vma_tree_t *tree);
+
+/**
+ * Remove every VMA of a tree (pages are left to the address space)
+ */
+void vma_tree_destroy(vma_tree_t *tree);
+
+/**
+ * Copy every VMA of src into an empty tree dst (for fork)
+ * @return true on success; on failure dst is left empty
+ */
+bool vma_tree_clone(vma_tree_t *dst, vma_tree_t *src);
+
+/**
+ * Find the VMA containing an address
+ * @return VMA, or NULL if addr is not in any VMA
+ */
+vma_t *vma_find(vma_tree_t *tree, virtaddr_t addr);
+
+/**
+ * Add an anonymous zero-fill VMA
+ * @param tree Tree to add to
+ * @param start First address
+ * @param size Size in bytes
+ * @param flags Page flags (VMM_FLAG_*)
+ * @return true on success, false if the range overlaps a VMA or no memory
+ */
+bool vma_map_anon(vma_tree_t *tree, virtaddr_t start, size_t size, uint64_t flags);
+
+/**
+ * Add a VMA filled from an in-memory image
+ * The image must stay valid as long as the VMA (or a clone) exists; its
+ * pages are shared through the page cache (pagecache.h), so an image that
+ * is freed or changed must be passed to pagecache_forget first.
+ * @param image Contents of the first image_size bytes; the rest is zero
+ * @return true on success, false on overlap, bad sizes or no memory
+ */
+bool vma_map_image(vma_tree_t *tree, virtaddr_t start, size_t size,
+                   const void *image, size_t image_size, uint64_t flags);
+
+/**
+ * Add a VMA backed by an object read through ops (a private file mapping)
+ * The VMA takes a reference on the object through ops->ref.
+ * @param offset Object offset backing start (page-aligned)
+ * @return true on success
+ */
+bool vma_map_file(vma_tree_t *tree, virtaddr_t start, size_t size, uint64_t flags,
+                  const vma_file_ops_t *ops, void *object, uint64_t offset);
+
+/**
+ * Remove a page-aligned range from a tree and unmap its pages
+ * VMAs that straddle the range are trimmed or split.
+ * @param pml4 Address space the tree describes
+ * @return false if a split needed memory that was not available
+ */
+bool vma_unmap(vma_tree_t *tree, physaddr_t pml4, virtaddr_t start, size_t size);
+
+/**
+ * Find a free page-aligned range of a given size
+ * @param hint Preferred start address (below VMA_MMAP_BASE means any)
+ * @return Start address, or 0 if the address space is full
+ */
+virtaddr_t vma_find_free(vma_tree_t *tree, virtaddr_t hint, size_t size);
+
+/**
+ * Resolve a not-present fault from the VMAs covering the page
+ * @param pml4 Address space the tree describes
+ * @param addr Faulting address
+ * @param write Faulting access was a write
+ * @return true if the page is now mapped
+ */
+bool vma_handle_fault(vma_tree_t *tree, physaddr_t pml4, virtaddr_t addr, bool write);
+
+/**
+ * Get VMA statistics
+ */
+void vma_get_stats(vma_stats_t *stats);
+
+#endif /* _AAAOS_MM_VMA_H */
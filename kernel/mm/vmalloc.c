@@ -0,0 +1,452 @@
+/**
+ * AAAos Kernel - Large Allocation (vmalloc) Region Implementation
+ *
+ * Live areas are kept in a small array sorted by address. Virtual space
+ * is handed out first-fit between existing areas, each followed by an
+ * unmapped guard page so overruns fault instead of corrupting a
+ * neighbour. Growing an area maps fresh pages after it when the space is
+ * free, otherwise the existing frames are aliased at a new address and
+ * the old mapping dropped, so no data is ever copied.
+ */
+
+#include "vmalloc.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "../include/serial.h"
+#include "../../lib/libc/string.h"
+
+/**
+ * A live vmalloc area
+ */
+typedef struct vmalloc_area {
+    virtaddr_t addr;                /* Start of the area */
+    size_t pages;                   /* Pages backing the area */
+    size_t size;                    /* Requested size in bytes */
+    bool mapped;                    /* In the vmalloc region (else identity run) */
+} vmalloc_area_t;
+
+static vmalloc_area_t areas[VMALLOC_MAX_AREAS];
+static size_t area_count = 0;
+static bool region_ready = false;
+static vmalloc_stats_t vmalloc_stats = {0};
+
+/* Simple spinlock for thread safety */
+static volatile int vmalloc_lock = 0;
+
+static inline void vmalloc_acquire_lock(void) {
+    while (__sync_lock_test_and_set(&vmalloc_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void vmalloc_release_lock(void) {
+    __sync_lock_release(&vmalloc_lock);
+}
+
+/**
+ * Find the area starting at addr
+ * @return Index into areas[], or -1 if none
+ */
+static int area_find(virtaddr_t addr) {
+    size_t lo = 0, hi = area_count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (areas[mid].addr == addr) {
+            return (int)mid;
+        }
+        if (areas[mid].addr < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Insert an area keeping the array sorted (caller checks capacity)
+ */
+static void area_insert(const vmalloc_area_t *area) {
+    size_t i = area_count;
+
+    while (i > 0 && areas[i - 1].addr > area->addr) {
+        areas[i] = areas[i - 1];
+        i--;
+    }
+    areas[i] = *area;
+    area_count++;
+}
+
+/**
+ * Remove the area at index idx
+ */
+static void area_remove(size_t idx) {
+    for (size_t i = idx; i + 1 < area_count; i++) {
+        areas[i] = areas[i + 1];
+    }
+    area_count--;
+}
+
+/**
+ * Make the vmalloc region usable once the kernel page tables exist
+ * @return true if areas can be mapped into the region
+ */
+static bool region_init(void) {
+    if (region_ready) {
+        return true;
+    }
+
+    if (vmm_get_kernel_pml4() == 0) {
+        return false;
+    }
+
+    /* The whole region sits under one PML4 entry shared by every address space */
+    if (!vmm_prepare_kernel_range(VMALLOC_BASE)) {
+        kprintf("[VMALLOC] Warning: Cannot set up region page tables\n");
+        return false;
+    }
+
+    region_ready = true;
+    kprintf("[VMALLOC] Region ready at %p (%llu MB)\n",
+            (void*)VMALLOC_BASE, (uint64_t)(VMALLOC_SIZE / MB));
+    return true;
+}
+
+/**
+ * Find free virtual space for an area plus its guard page
+ * @return Start address, or 0 if the region is full
+ */
+static virtaddr_t find_virt_gap(size_t pages) {
+    size_t span = (pages + 1) * VMM_PAGE_SIZE;
+    virtaddr_t cursor = VMALLOC_BASE;
+
+    for (size_t i = 0; i < area_count; i++) {
+        if (!areas[i].mapped) {
+            continue;
+        }
+        if (areas[i].addr - cursor >= span) {
+            return cursor;
+        }
+        cursor = areas[i].addr + (areas[i].pages + 1) * VMM_PAGE_SIZE;
+    }
+
+    if (VMALLOC_END - cursor >= span) {
+        return cursor;
+    }
+    return 0;
+}
+
+/**
+ * Unmap a run of pages and return their frames to the PMM
+ */
+static void unmap_free_pages(virtaddr_t virt, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        physaddr_t phys = vmm_unmap_page(virt + i * VMM_PAGE_SIZE);
+        if (phys != 0) {
+            pmm_free_page(phys);
+        }
+    }
+}
+
+/**
+ * Back a run of virtual pages with fresh frames
+ * @return true on success; on failure nothing stays mapped
+ */
+static bool map_new_pages(virtaddr_t virt, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        physaddr_t phys = pmm_alloc_page();
+        if (phys == 0 ||
+            !vmm_map_page(virt + i * VMM_PAGE_SIZE, phys, VMM_FLAGS_KERNEL)) {
+            if (phys != 0) {
+                pmm_free_page(phys);
+            }
+            unmap_free_pages(virt, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Allocate a page-granular area
+ */
+void *vmalloc(size_t size) {
+    if (size == 0 || size > VMALLOC_SIZE) {
+        return NULL;
+    }
+
+    vmalloc_area_t area;
+    area.pages = ALIGN_UP(size, VMM_PAGE_SIZE) / VMM_PAGE_SIZE;
+    area.size = size;
+
+    vmalloc_acquire_lock();
+
+    if (area_count >= VMALLOC_MAX_AREAS) {
+        vmalloc_release_lock();
+        kprintf("[VMALLOC] Error: Too many areas (max %u)\n", VMALLOC_MAX_AREAS);
+        return NULL;
+    }
+
+    if (region_init()) {
+        area.mapped = true;
+        area.addr = find_virt_gap(area.pages);
+        if (area.addr == 0 || !map_new_pages(area.addr, area.pages)) {
+            vmalloc_release_lock();
+            kprintf("[VMALLOC] Error: Failed to allocate %llu bytes\n", (uint64_t)size);
+            return NULL;
+        }
+    } else {
+        /* No kernel page tables yet: use a contiguous identity-mapped run */
+        area.mapped = false;
+        area.addr = (virtaddr_t)pmm_alloc_pages(area.pages);
+        if (area.addr == 0) {
+            vmalloc_release_lock();
+            kprintf("[VMALLOC] Error: Failed to allocate %llu bytes\n", (uint64_t)size);
+            return NULL;
+        }
+    }
+
+    area_insert(&area);
+
+    vmalloc_stats.area_count++;
+    vmalloc_stats.mapped_pages += area.pages;
+    vmalloc_stats.requested_bytes += size;
+    vmalloc_stats.alloc_count++;
+
+    vmalloc_release_lock();
+
+    return (void*)area.addr;
+}
+
+/**
+ * Free an area
+ */
+void vfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    vmalloc_acquire_lock();
+
+    int idx = area_find((virtaddr_t)ptr);
+    if (idx < 0) {
+        vmalloc_release_lock();
+        kprintf("[VMALLOC] Error: vfree of unknown area %p\n", ptr);
+        return;
+    }
+
+    vmalloc_area_t *area = &areas[idx];
+    if (area->mapped) {
+        unmap_free_pages(area->addr, area->pages);
+    } else {
+        pmm_free_pages((physaddr_t)area->addr, area->pages);
+    }
+
+    vmalloc_stats.area_count--;
+    vmalloc_stats.mapped_pages -= area->pages;
+    vmalloc_stats.requested_bytes -= area->size;
+    vmalloc_stats.free_count++;
+
+    area_remove((size_t)idx);
+
+    vmalloc_release_lock();
+}
+
+/**
+ * Move a mapped area to new_virt by aliasing its frames there
+ * Called with the vmalloc lock held.
+ * @return true on success; on failure the old mapping is untouched
+ */
+static bool remap_area(vmalloc_area_t *area, virtaddr_t new_virt) {
+    for (size_t i = 0; i < area->pages; i++) {
+        physaddr_t phys = vmm_get_physical(area->addr + i * VMM_PAGE_SIZE);
+        if (phys == 0 ||
+            !vmm_map_page(new_virt + i * VMM_PAGE_SIZE, phys, VMM_FLAGS_KERNEL)) {
+            for (size_t j = 0; j < i; j++) {
+                vmm_unmap_page(new_virt + j * VMM_PAGE_SIZE);
+            }
+            return false;
+        }
+    }
+
+    vmm_unmap_pages(area->addr, area->pages);
+    return true;
+}
+
+/**
+ * Resize an area
+ */
+void *vrealloc(void *ptr, size_t new_size) {
+    if (ptr == NULL) {
+        return vmalloc(new_size);
+    }
+
+    if (new_size == 0) {
+        vfree(ptr);
+        return NULL;
+    }
+
+    if (new_size > VMALLOC_SIZE) {
+        return NULL;
+    }
+
+    size_t new_pages = ALIGN_UP(new_size, VMM_PAGE_SIZE) / VMM_PAGE_SIZE;
+
+    vmalloc_acquire_lock();
+
+    int idx = area_find((virtaddr_t)ptr);
+    if (idx < 0) {
+        vmalloc_release_lock();
+        kprintf("[VMALLOC] Error: vrealloc of unknown area %p\n", ptr);
+        return NULL;
+    }
+
+    vmalloc_area_t *area = &areas[idx];
+
+    /* Shrinking: release the tail pages */
+    if (new_pages <= area->pages) {
+        size_t tail = area->pages - new_pages;
+        if (tail > 0) {
+            virtaddr_t tail_start = area->addr + new_pages * VMM_PAGE_SIZE;
+            if (area->mapped) {
+                unmap_free_pages(tail_start, tail);
+            } else {
+                pmm_free_pages((physaddr_t)tail_start, tail);
+            }
+        }
+        vmalloc_stats.mapped_pages -= tail;
+        vmalloc_stats.requested_bytes -= area->size - new_size;
+        area->pages = new_pages;
+        area->size = new_size;
+        vmalloc_release_lock();
+        return ptr;
+    }
+
+    size_t extra = new_pages - area->pages;
+
+    if (!area->mapped) {
+        /* Identity runs cannot be remapped, fall back to copying */
+        virtaddr_t new_addr = (virtaddr_t)pmm_alloc_pages(new_pages);
+        if (new_addr == 0) {
+            vmalloc_release_lock();
+            return NULL;
+        }
+        memcpy((void*)new_addr, ptr, area->size);
+        pmm_free_pages((physaddr_t)area->addr, area->pages);
+
+        vmalloc_stats.mapped_pages += extra;
+        vmalloc_stats.requested_bytes += new_size - area->size;
+
+        vmalloc_area_t moved = *area;
+        moved.addr = new_addr;
+        moved.pages = new_pages;
+        moved.size = new_size;
+        area_remove((size_t)idx);
+        area_insert(&moved);
+
+        vmalloc_release_lock();
+        return (void*)new_addr;
+    }
+
+    /* Grow in place when the following virtual space is free */
+    virtaddr_t limit = ((size_t)idx + 1 < area_count) ? areas[idx + 1].addr : VMALLOC_END;
+    if (area->addr + (new_pages + 1) * VMM_PAGE_SIZE <= limit) {
+        if (!map_new_pages(area->addr + area->pages * VMM_PAGE_SIZE, extra)) {
+            vmalloc_release_lock();
+            return NULL;
+        }
+    } else {
+        virtaddr_t new_virt = find_virt_gap(new_pages);
+        if (new_virt == 0) {
+            vmalloc_release_lock();
+            kprintf("[VMALLOC] Error: No virtual space to grow %p\n", ptr);
+            return NULL;
+        }
+
+        /* Fresh pages for the tail first, then move the existing frames */
+        if (!map_new_pages(new_virt + area->pages * VMM_PAGE_SIZE, extra)) {
+            vmalloc_release_lock();
+            return NULL;
+        }
+        if (!remap_area(area, new_virt)) {
+            unmap_free_pages(new_virt + area->pages * VMM_PAGE_SIZE, extra);
+            vmalloc_release_lock();
+            return NULL;
+        }
+
+        vmalloc_area_t moved = *area;
+        moved.addr = new_virt;
+        area_remove((size_t)idx);
+        area_insert(&moved);
+        idx = area_find(new_virt);
+        area = &areas[idx];
+    }
+
+    vmalloc_stats.mapped_pages += extra;
+    vmalloc_stats.requested_bytes += new_size;
+    vmalloc_stats.requested_bytes -= area->size;
+    vmalloc_stats.remap_count++;
+    area->pages = new_pages;
+    area->size = new_size;
+
+    vmalloc_release_lock();
+
+    return (void*)area->addr;
+}
+
+/**
+ * Check whether a pointer is a vmalloc area
+ */
+bool vmalloc_owns(const void *ptr) {
+    vmalloc_acquire_lock();
+    bool owned = area_find((virtaddr_t)ptr) >= 0;
+    vmalloc_release_lock();
+    return owned;
+}
+
+/**
+ * Get the requested size of an area
+ */
+size_t vmalloc_size(const void *ptr) {
+    size_t size = 0;
+
+    vmalloc_acquire_lock();
+    int idx = area_find((virtaddr_t)ptr);
+    if (idx >= 0) {
+        size = areas[idx].size;
+    }
+    vmalloc_release_lock();
+
+    return size;
+}
+
+/**
+ * Get vmalloc statistics
+ */
+void vmalloc_get_stats(vmalloc_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    vmalloc_acquire_lock();
+    *stats = vmalloc_stats;
+    vmalloc_release_lock();
+}
+
+/**
+ * Print vmalloc statistics
+ */
+void vmalloc_print_stats(void) {
+    vmalloc_stats_t stats;
+    vmalloc_get_stats(&stats);
+
+    kprintf("[VMALLOC] === vmalloc Statistics ===\n");
+    kprintf("[VMALLOC]   Live areas:       %llu\n", (uint64_t)stats.area_count);
+    kprintf("[VMALLOC]   Mapped pages:     %llu\n", (uint64_t)stats.mapped_pages);
+    kprintf("[VMALLOC]   Requested bytes:  %llu\n", (uint64_t)stats.requested_bytes);
+    kprintf("[VMALLOC]   Allocations:      %llu\n", (uint64_t)stats.alloc_count);
+    kprintf("[VMALLOC]   Frees:            %llu\n", (uint64_t)stats.free_count);
+    kprintf("[VMALLOC]   Remaps:           %llu\n", (uint64_t)stats.remap_count);
+    kprintf("[VMALLOC] ==========================\n");
+}
@@ -0,0 +1,79 @@
+/**
+ * AAAos Kernel - Large Allocation (vmalloc) Region
+ *
+ * Allocations too big for the block heap are built from individual PMM
+ * pages mapped back to back into a dedicated kernel virtual region.
+ * They never touch the heap's free lists, need no physically contiguous
+ * memory, and can grow by remapping pages instead of copying data.
+ *
+ * Before the VMM has built the kernel page tables, areas fall back to a
+ * physically contiguous PMM run that is used through the identity map.
+ */
+
+#ifndef _AAAOS_MM_VMALLOC_H
+#define _AAAOS_MM_VMALLOC_H
+
+#include "../include/types.h"
+
+/* Kernel virtual region reserved for vmalloc areas */
+#define VMALLOC_BASE            0xFFFFC90000000000ULL
+#define VMALLOC_SIZE            (256 * MB)
+#define VMALLOC_END             (VMALLOC_BASE + VMALLOC_SIZE)
+
+#define VMALLOC_MAX_AREAS       128         /* Live areas tracked at once */
+
+/**
+ * vmalloc statistics
+ */
+typedef struct vmalloc_stats {
+    size_t area_count;              /* Live areas */
+    size_t mapped_pages;            /* Pages backing live areas */
+    size_t requested_bytes;         /* Sum of requested sizes */
+    size_t alloc_count;             /* Total vmalloc calls that succeeded */
+    size_t free_count;              /* Total vfree calls */
+    size_t remap_count;             /* vrealloc calls satisfied without copying */
+} vmalloc_stats_t;
+
+/**
+ * Allocate a page-granular area
+ * @param size Number of bytes (rounded up to whole pages)
+ * @return Page-aligned pointer, or NULL on failure
+ */
+void *vmalloc(size_t size);
+
+/**
+ * Free an area returned by vmalloc or vrealloc
+ * @param ptr Start of the area (NULL is safe to pass)
+ */
+void vfree(void *ptr);
+
+/**
+ * Resize an area, moving pages rather than data where possible
+ * @param ptr Existing area (NULL acts like vmalloc)
+ * @param new_size New size in bytes
+ * @return Pointer to the resized area, or NULL on failure (ptr unchanged)
+ */
+void *vrealloc(void *ptr, size_t new_size);
+
+/**
+ * Check whether a pointer is the start of a live vmalloc area
+ */
+bool vmalloc_owns(const void *ptr);
+
+/**
+ * Get the requested size of a vmalloc area
+ * @return Size in bytes, or 0 if ptr is not a vmalloc area
+ */
+size_t vmalloc_size(const void *ptr);
+
+/**
+ * Get vmalloc statistics
+ */
+void vmalloc_get_stats(vmalloc_stats_t *stats);
+
+/**
+ * Print vmalloc statistics to serial console
+ */
+void vmalloc_print_stats(void);
+
+#endif /* _AAAOS_MM_VMALLOC_H */
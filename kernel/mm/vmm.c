@@ -5,15 +5,113 @@
  * - Kernel higher-half mapping
  * - User-space address spaces
  * - On-demand page table allocation via PMM
+ * - Range mapping that walks once per page table and defers TLB
+ *   invalidation to the end of the range
+ * - 2MB and (where the CPU supports them) 1GB pages for suitably aligned
+ *   ranges; huge mappings are split on demand when part of one changes
+ * - Copy-on-write address space clones, with user frames shared through
+ *   PMM reference counts until the first write
+ * - Primitives for demand paging (see vma.c): installing user pages on
+ *   fault and a shared zero page for untouched zero-fill memory
+ * - PCID-tagged CR3 switches (where supported), so a few busy address
+ *   spaces keep their TLB entries across context switches
+ * - Swapping cold private user pages out to a pluggable backend (see
+ *   zram.c) with a clock sweep over the accessed bits, and back in on
+ *   fault
  */
 
 #include "vmm.h"
 #include "pmm.h"
 #include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../init/bootprof.h"
 
 /* Kernel PML4 (root of kernel page tables) */
 static physaddr_t kernel_pml4_phys = 0;
 
+/* CPU supports 1GB pages (CPUID 0x80000001 EDX bit 26) */
+static bool vmm_gb_pages = false;
+
+/* IA32_PAT holds VMM_PAT_VALUE (CPUID.01H:EDX bit 16) */
+static bool vmm_pat = false;
+
+/*
+ * PCID cache, one per CPU since each TLB is private. Slot N owns PCID N;
+ * slot 0 is the kernel page tables. A slot must be switched to with a
+ * flush when it changes owner, or when a mapping shared by all address
+ * spaces changed since it was last loaded (invlpg only reaches the
+ * current PCID of the current CPU).
+ */
+typedef struct vmm_pcid_slot {
+    physaddr_t pml4;            /* Address space tagged with this PCID, 0 if free */
+    uint64_t last_used;         /* pcid_clock at the last switch, for LRU */
+    uint64_t generation;        /* pcid_generation when last flushed */
+} vmm_pcid_slot_t;
+
+static bool vmm_pcid = false;
+static vmm_pcid_slot_t pcid_slots[PERCPU_MAX_CPUS][VMM_PCID_SLOTS];
+static volatile int pcid_lock = 0;          /* Taken with interrupts off */
+static uint64_t pcid_clock = 0;
+static uint64_t pcid_generation = 0;
+static vmm_pcid_stats_t pcid_stats;
+
+/* Copy-on-write statistics (protected by vmm_lock) */
+static vmm_cow_stats_t cow_stats;
+
+/* Shared all-zero frame; the VMM keeps one reference so it is never freed */
+static physaddr_t zero_frame = 0;
+
+/* Destroyed PML4s kept for reuse, user half already zero (protected by vmm_lock) */
+#define VMM_PML4_CACHE_MAX      16
+static physaddr_t pml4_cache[VMM_PML4_CACHE_MAX];
+static uint32_t pml4_cache_count = 0;
+
+/* User address spaces the swap clock sweeps (protected by vmm_lock) */
+#define VMM_SPACES_MAX          256
+static physaddr_t vmm_spaces[VMM_SPACES_MAX];
+static uint32_t vmm_space_count = 0;
+
+/* PML4 each CPU has loaded; kernel threads keep the one before them */
+static physaddr_t vmm_loaded[PERCPU_MAX_CPUS];
+
+/* Swap backend, clock hand and statistics (protected by vmm_lock) */
+static const vmm_swap_ops_t *swap_ops = NULL;
+static uint32_t swap_space = 0;
+static virtaddr_t swap_virt = 0;
+static vmm_swap_stats_t swap_stats;
+
+/* Paging levels; a table at level L holds entries that point to level L+1 */
+#define VMM_LEVEL_PML4          0
+#define VMM_LEVEL_PDPT          1
+#define VMM_LEVEL_PD            2
+#define VMM_LEVEL_PT            3
+
+/* Page tables taken from the PMM at once when a range needs new tables */
+#define VMM_TABLE_BATCH         16
+
+/* Above this many pages one CR3 reload is cheaper than invlpg per page */
+#define VMM_INVLPG_MAX          32
+
+/* End of the user half of an address space */
+#define VMM_USER_TOP            0x0000800000000000ULL
+
+/* vmm_swap_out looks at up to this many entries per page it is asked for */
+#define VMM_SWAP_SCAN_FACTOR    32
+
+/* Evictions per hold of vmm_lock (each compresses a page with interrupts off) */
+#define VMM_SWAP_BATCH          8
+
+/**
+ * Run of pre-allocated pages used for new page tables during a range map
+ */
+typedef struct vmm_table_pool {
+    physaddr_t next;            /* Next unused page of the current run */
+    size_t left;                /* Pages left in the run */
+    size_t wanted;              /* Upper bound on tables still needed */
+} vmm_table_pool_t;
+
 /* Simple spinlock for VMM operations */
 static volatile int vmm_lock = 0;
 
@@ -27,6 +125,22 @@ static inline void vmm_release_lock(void) {
     __sync_lock_release(&vmm_lock);
 }
 
+#ifdef AAAOS_HOSTED
+/* Host builds (tests/bench) keep CR3 in memory and have no TLB to flush */
+static physaddr_t vmm_hosted_cr3;
+
+static inline physaddr_t read_cr3(void) {
+    return vmm_hosted_cr3;
+}
+
+static inline void write_cr3(physaddr_t cr3) {
+    vmm_hosted_cr3 = cr3;
+}
+
+static inline void invlpg(virtaddr_t addr) {
+    UNUSED(addr);
+}
+#else
 /**
  * Read CR3 register (current page table base)
  */
@@ -49,6 +163,65 @@ static inline void write_cr3(physaddr_t cr3) {
 static inline void invlpg(virtaddr_t addr) {
     __asm__ __volatile__("invlpg (%0)" :: "r"(addr) : "memory");
 }
+#endif
+
+/**
+ * Read/write CR0
+ */
+static inline uint64_t read_cr0(void) {
+    uint64_t cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint64_t cr0) {
+    __asm__ __volatile__("mov %0, %%cr0" :: "r"(cr0) : "memory");
+}
+
+/**
+ * Read/write CR4
+ */
+static inline uint64_t read_cr4(void) {
+    uint64_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint64_t cr4) {
+    __asm__ __volatile__("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+/**
+ * PCID lock; the scheduler switches address spaces from interrupt context
+ */
+static inline uint64_t pcid_acquire_lock(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&pcid_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void pcid_release_lock(uint64_t flags) {
+    __sync_lock_release(&pcid_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Note a change to mappings that other PCIDs may have cached
+ * Kernel PML4 entries without USER are shared by every address space, so
+ * their stale translations can survive under other PCIDs; make every
+ * slot flush on its next switch.
+ */
+static void pcid_note_change(virtaddr_t virt) {
+    if (!vmm_pcid) {
+        return;
+    }
+    const page_table_t *pml4 = (const page_table_t*)kernel_pml4_phys;
+    if (!(pml4->entries[VMM_PML4_INDEX(virt)] & VMM_FLAG_USER)) {
+        __atomic_fetch_add(&pcid_generation, 1, __ATOMIC_RELEASE);
+    }
+}
 
 /**
  * Convert physical address to virtual address (direct mapping)
@@ -91,19 +264,126 @@ static physaddr_t alloc_page_table(void) {
     return phys;
 }
 
+/**
+ * Allocate a PML4 for a new address space
+ * A recycled one has a zero user half; its kernel half is stale and is
+ * overwritten by the caller.
+ * @return Physical address of the PML4, or 0 on failure
+ */
+static physaddr_t alloc_pml4(void) {
+    physaddr_t phys = 0;
+
+    vmm_acquire_lock();
+    if (pml4_cache_count > 0) {
+        phys = pml4_cache[--pml4_cache_count];
+    }
+    vmm_release_lock();
+
+    return phys != 0 ? phys : alloc_page_table();
+}
+
+/**
+ * Take a zeroed page table from a pool, refilling it in one PMM call
+ * @return Physical address of new page table, or 0 on failure
+ */
+static physaddr_t pool_alloc_table(vmm_table_pool_t *pool) {
+    if (pool->left == 0) {
+        size_t n = MIN(MAX(pool->wanted, (size_t)1), (size_t)VMM_TABLE_BATCH);
+        physaddr_t run = pmm_alloc_pages(n);
+        if (run == 0 && n > 1) {
+            n = 1;
+            run = pmm_alloc_page();
+        }
+        if (run == 0) {
+            kprintf("[VMM] Error: Failed to allocate page table\n");
+            return 0;
+        }
+        pool->next = run;
+        pool->left = n;
+    }
+
+    physaddr_t phys = pool->next;
+    pool->next += VMM_PAGE_SIZE;
+    pool->left--;
+    if (pool->wanted > 0) {
+        pool->wanted--;
+    }
+
+    zero_page(phys);
+    return phys;
+}
+
+/**
+ * Give unused pool pages back to the PMM
+ */
+static void pool_release(vmm_table_pool_t *pool) {
+    if (pool->left > 0) {
+        pmm_free_pages(pool->next, pool->left);
+        pool->left = 0;
+    }
+}
+
+/**
+ * Split a huge entry into a table of the next smaller page size
+ * A 1GB entry becomes a PD of 2MB entries, a 2MB entry a PT of 4KB
+ * entries, all keeping the original attributes and translation.
+ * @param entry Huge PDPT or PD entry
+ * @param level Level of the table holding the entry
+ * @return Physical address of the new table, or 0 on failure
+ */
+static physaddr_t split_huge_entry(pte_t *entry, int level, vmm_table_pool_t *pool) {
+    physaddr_t new_table = pool ? pool_alloc_table(pool) : alloc_page_table();
+    if (new_table == 0) {
+        return 0;
+    }
+
+    uint64_t attrs = *entry & ~VMM_ADDR_MASK;
+    physaddr_t base;
+    uint64_t step;
+    uint64_t child_attrs;
+
+    if (level == VMM_LEVEL_PDPT) {
+        base = *entry & VMM_HUGE_1G_ADDR_MASK;
+        step = VMM_HUGE_2M_SIZE;
+        child_attrs = attrs;                        /* Children stay huge */
+    } else {
+        base = *entry & VMM_HUGE_2M_ADDR_MASK;
+        step = VMM_PAGE_SIZE;
+        child_attrs = attrs & ~VMM_FLAG_HUGE;
+    }
+
+    page_table_t *table = (page_table_t*)phys_to_virt(new_table);
+    for (size_t i = 0; i < VMM_ENTRIES_PER_TABLE; i++) {
+        table->entries[i] = (base + i * step) | child_attrs;
+    }
+
+    /* Same translation everywhere, so no TLB flush is needed yet */
+    *entry = new_table | (attrs & (VMM_FLAG_PRESENT | VMM_FLAG_WRITE |
+                                   VMM_FLAG_USER | VMM_FLAG_NX));
+    return new_table;
+}
+
 /**
  * Get or create a page table entry at the next level
  * @param table Current level page table
  * @param index Index in the table
- * @param create If true, create the entry if it doesn't exist
+ * @param level Level of 'table' (VMM_LEVEL_*)
+ * @param create If true, create the entry if it doesn't exist and split
+ *               a huge entry in the way
  * @param flags Flags to use when creating (only PRESENT, WRITE, USER propagate)
+ * @param pool Pool to take new tables from, or NULL to allocate one
  * @return Physical address of next level table, or 0 if not present/failed
  */
-static physaddr_t get_or_create_entry(page_table_t *table, size_t index,
-                                       bool create, uint64_t flags) {
+static physaddr_t get_or_create_entry(page_table_t *table, size_t index, int level,
+                                       bool create, uint64_t flags,
+                                       vmm_table_pool_t *pool) {
     pte_t *entry = &table->entries[index];
 
     if (*entry & VMM_FLAG_PRESENT) {
+        if (*entry & VMM_FLAG_HUGE) {
+            /* A huge page, not a table: split it only when asked to */
+            return create ? split_huge_entry(entry, level, pool) : 0;
+        }
         /* Entry exists, return its address */
         return *entry & VMM_ADDR_MASK;
     }
@@ -113,7 +393,7 @@ static physaddr_t get_or_create_entry(page_table_t *table, size_t index,
     }
 
     /* Allocate new page table */
-    physaddr_t new_table = alloc_page_table();
+    physaddr_t new_table = pool ? pool_alloc_table(pool) : alloc_page_table();
     if (new_table == 0) {
         return 0;
     }
@@ -131,43 +411,240 @@ static physaddr_t get_or_create_entry(page_table_t *table, size_t index,
 }
 
 /**
- * Walk page tables to find the page table entry for a virtual address
+ * Walk page tables down to the table at a given level
  * @param pml4_phys Physical address of PML4
  * @param virt Virtual address to look up
- * @param create If true, create missing page tables
+ * @param level Level of the table wanted (VMM_LEVEL_PDPT..VMM_LEVEL_PT)
+ * @param create If true, create missing tables and split huge pages
  * @param flags Flags to use when creating intermediate tables
- * @return Pointer to PTE, or NULL if not found/couldn't create
+ * @param pool Pool for new tables, or NULL to allocate them one by one
+ * @return Pointer to the table, or NULL if not found/couldn't create
+ */
+static page_table_t* vmm_walk_to(physaddr_t pml4_phys, virtaddr_t virt, int level,
+                                 bool create, uint64_t flags,
+                                 vmm_table_pool_t *pool) {
+    static const uint8_t shifts[] = { VMM_PML4_SHIFT, VMM_PDPT_SHIFT, VMM_PD_SHIFT };
+    page_table_t *table = (page_table_t*)phys_to_virt(pml4_phys);
+
+    for (int l = VMM_LEVEL_PML4; l < level; l++) {
+        size_t index = (virt >> shifts[l]) & VMM_INDEX_MASK;
+        physaddr_t next = get_or_create_entry(table, index, l, create, flags, pool);
+        if (next == 0) {
+            return NULL;
+        }
+        table = (page_table_t*)phys_to_virt(next);
+    }
+    return table;
+}
+
+/**
+ * Walk page tables to find the 4KB page table entry for a virtual address
+ * Huge pages on the way are split when create is set.
  */
 static pte_t* vmm_walk(physaddr_t pml4_phys, virtaddr_t virt,
                        bool create, uint64_t flags) {
-    page_table_t *pml4 = (page_table_t*)phys_to_virt(pml4_phys);
-
-    /* Get PDPT */
-    physaddr_t pdpt_phys = get_or_create_entry(pml4, VMM_PML4_INDEX(virt),
-                                                create, flags);
-    if (pdpt_phys == 0) {
+    page_table_t *pt = vmm_walk_to(pml4_phys, virt, VMM_LEVEL_PT, create, flags, NULL);
+    if (pt == NULL) {
         return NULL;
     }
-    page_table_t *pdpt = (page_table_t*)phys_to_virt(pdpt_phys);
 
-    /* Get PD */
-    physaddr_t pd_phys = get_or_create_entry(pdpt, VMM_PDPT_INDEX(virt),
-                                              create, flags);
-    if (pd_phys == 0) {
-        return NULL;
+    /* Return pointer to the final PTE */
+    return &pt->entries[VMM_PT_INDEX(virt)];
+}
+
+/**
+ * Find the entry that maps a virtual address, at whatever page size
+ * @param level Set to VMM_LEVEL_PDPT (1GB), VMM_LEVEL_PD (2MB) or VMM_LEVEL_PT
+ * @return The leaf entry (which may be non-present at PT level), or NULL
+ */
+static pte_t* vmm_lookup(physaddr_t pml4_phys, virtaddr_t virt, int *level) {
+    static const uint8_t shifts[] = { VMM_PML4_SHIFT, VMM_PDPT_SHIFT,
+                                      VMM_PD_SHIFT, VMM_PT_SHIFT };
+    page_table_t *table = (page_table_t*)phys_to_virt(pml4_phys);
+
+    for (int l = VMM_LEVEL_PML4; ; l++) {
+        pte_t *entry = &table->entries[(virt >> shifts[l]) & VMM_INDEX_MASK];
+
+        if (l == VMM_LEVEL_PT) {
+            *level = l;
+            return entry;
+        }
+        if (!(*entry & VMM_FLAG_PRESENT)) {
+            return NULL;
+        }
+        if (l != VMM_LEVEL_PML4 && (*entry & VMM_FLAG_HUGE)) {
+            *level = l;
+            return entry;
+        }
+        table = (page_table_t*)phys_to_virt(*entry & VMM_ADDR_MASK);
     }
-    page_table_t *pd = (page_table_t*)phys_to_virt(pd_phys);
+}
 
-    /* Get PT */
-    physaddr_t pt_phys = get_or_create_entry(pd, VMM_PD_INDEX(virt),
-                                              create, flags);
-    if (pt_phys == 0) {
-        return NULL;
+/**
+ * Physical address a leaf entry gives for virt
+ */
+static physaddr_t leaf_to_phys(pte_t entry, int level, virtaddr_t virt) {
+    if (level == VMM_LEVEL_PDPT) {
+        return (entry & VMM_HUGE_1G_ADDR_MASK) | (virt & (VMM_HUGE_1G_SIZE - 1));
+    }
+    if (level == VMM_LEVEL_PD) {
+        return (entry & VMM_HUGE_2M_ADDR_MASK) | (virt & (VMM_HUGE_2M_SIZE - 1));
     }
-    page_table_t *pt = (page_table_t*)phys_to_virt(pt_phys);
+    return (entry & VMM_ADDR_MASK) | VMM_PAGE_OFFSET(virt);
+}
 
-    /* Return pointer to the final PTE */
-    return &pt->entries[VMM_PT_INDEX(virt)];
+/**
+ * Upper bound on the page tables a range could need
+ * One PT per 2MB region touched, one PD per 1GB, one PDPT per 512GB.
+ */
+static size_t range_table_estimate(virtaddr_t virt, size_t count) {
+    virtaddr_t last = virt + (count - 1) * VMM_PAGE_SIZE;
+    return ((last >> VMM_PD_SHIFT) - (virt >> VMM_PD_SHIFT) + 1) +
+           ((last >> VMM_PDPT_SHIFT) - (virt >> VMM_PDPT_SHIFT) + 1) +
+           ((last >> VMM_PML4_SHIFT) - (virt >> VMM_PML4_SHIFT) + 1);
+}
+
+/**
+ * Map a physically contiguous range, one page-table walk per PT
+ * Called with the VMM lock held. Existing mappings are overwritten.
+ * @return Number of pages mapped (less than count only on failure)
+ */
+static size_t vmm_map_range_locked(physaddr_t pml4, virtaddr_t virt,
+                                   physaddr_t phys, size_t count,
+                                   uint64_t flags) {
+    vmm_table_pool_t pool = { 0, 0, range_table_estimate(virt, count) };
+    uint64_t bits = (flags & ~VMM_ADDR_MASK) | VMM_FLAG_PRESENT;
+    size_t done = 0;
+
+    while (done < count) {
+        virtaddr_t v = virt + done * VMM_PAGE_SIZE;
+        physaddr_t p = phys + done * VMM_PAGE_SIZE;
+        size_t left = count - done;
+
+        /* 1GB page: only into an empty PDPT slot, never over a live PD */
+        if (vmm_gb_pages && left >= VMM_PAGES_PER_1G &&
+            IS_ALIGNED(v, VMM_HUGE_1G_SIZE) && IS_ALIGNED(p, VMM_HUGE_1G_SIZE)) {
+            page_table_t *pdpt = vmm_walk_to(pml4, v, VMM_LEVEL_PDPT, true, flags, &pool);
+            if (pdpt == NULL) {
+                break;
+            }
+            pte_t *entry = &pdpt->entries[VMM_PDPT_INDEX(v)];
+            if (!(*entry & VMM_FLAG_PRESENT) || (*entry & VMM_FLAG_HUGE)) {
+                *entry = p | bits | VMM_FLAG_HUGE;
+                done += VMM_PAGES_PER_1G;
+                continue;
+            }
+        }
+
+        /* 2MB page: a PT already there is fully covered, so drop it */
+        if (left >= VMM_ENTRIES_PER_TABLE &&
+            IS_ALIGNED(v, VMM_HUGE_2M_SIZE) && IS_ALIGNED(p, VMM_HUGE_2M_SIZE)) {
+            page_table_t *pd = vmm_walk_to(pml4, v, VMM_LEVEL_PD, true, flags, &pool);
+            if (pd == NULL) {
+                break;
+            }
+            pte_t *entry = &pd->entries[VMM_PD_INDEX(v)];
+            if ((*entry & VMM_FLAG_PRESENT) && !(*entry & VMM_FLAG_HUGE)) {
+                pmm_free_page(*entry & VMM_ADDR_MASK);
+            }
+            *entry = p | bits | VMM_FLAG_HUGE;
+            done += VMM_ENTRIES_PER_TABLE;
+            continue;
+        }
+
+        page_table_t *pt = vmm_walk_to(pml4, v, VMM_LEVEL_PT, true, flags, &pool);
+        if (pt == NULL) {
+            break;
+        }
+
+        /* Fill the rest of this PT in one pass */
+        size_t index = VMM_PT_INDEX(v);
+        size_t n = MIN((size_t)VMM_ENTRIES_PER_TABLE - index, left);
+        pte_t *pte = &pt->entries[index];
+
+        for (size_t i = 0; i < n; i++) {
+            pte[i] = (p + i * VMM_PAGE_SIZE) | bits;
+        }
+        done += n;
+    }
+
+    pool_release(&pool);
+    return done;
+}
+
+/**
+ * Clear the mappings of a range, one page-table walk per PT
+ * Huge pages wholly inside the range are cleared directly, ones that
+ * straddle its edges are split first. Page tables themselves are kept.
+ * Called with the VMM lock held.
+ */
+static void vmm_unmap_range_locked(physaddr_t pml4, virtaddr_t virt, size_t count) {
+    size_t done = 0;
+
+    while (done < count) {
+        virtaddr_t v = virt + done * VMM_PAGE_SIZE;
+        size_t left = count - done;
+        int level;
+        pte_t *entry = vmm_lookup(pml4, v, &level);
+
+        if (entry != NULL && level != VMM_LEVEL_PT) {
+            size_t span = (level == VMM_LEVEL_PDPT) ? VMM_PAGES_PER_1G
+                                                    : VMM_ENTRIES_PER_TABLE;
+            uint64_t size = (uint64_t)span * VMM_PAGE_SIZE;
+            if (IS_ALIGNED(v, size) && left >= span) {
+                *entry = 0;
+                done += span;
+                continue;
+            }
+            /* Partial huge page: split down to 4KB and clear below */
+            if (vmm_walk_to(pml4, v, VMM_LEVEL_PT, true, 0, NULL) == NULL) {
+                kprintf("[VMM] Error: Cannot split huge page at 0x%llx\n", (uint64_t)v);
+                done += MIN(left, (size_t)(
+                    (ALIGN_UP(v + 1, size) - v) / VMM_PAGE_SIZE));
+                continue;
+            }
+        }
+
+        size_t index = VMM_PT_INDEX(v);
+        size_t n = MIN((size_t)VMM_ENTRIES_PER_TABLE - index, left);
+
+        page_table_t *pt = vmm_walk_to(pml4, v, VMM_LEVEL_PT, false, 0, NULL);
+        if (pt != NULL) {
+            for (size_t i = 0; i < n; i++) {
+                pt->entries[index + i] = 0;
+            }
+        }
+        done += n;
+    }
+}
+
+/**
+ * Invalidate the TLB for a range with one flush at the end
+ */
+static void vmm_flush_range(virtaddr_t virt, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    pcid_note_change(virt);
+    if (count > VMM_INVLPG_MAX) {
+        vmm_flush_tlb();
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        invlpg(virt + i * VMM_PAGE_SIZE);
+    }
+}
+
+/**
+ * Load VMM_PAT_VALUE into this CPU's IA32_PAT
+ * Every CPU must use the same layout. No mapping sets PWT alone before
+ * this runs, so no cached line or TLB entry has the old entry 1 type;
+ * the caches are written back anyway, and the CR3 load that follows in
+ * vmm_init and vmm_init_cpu flushes the TLB.
+ */
+static void vmm_load_pat(void) {
+    __asm__ __volatile__("wbinvd" ::: "memory");
+    wrmsr(VMM_MSR_PAT, VMM_PAT_VALUE);
 }
 
 /**
@@ -176,6 +653,26 @@ static pte_t* vmm_walk(physaddr_t pml4_phys, virtaddr_t virt,
 void vmm_init(void) {
     kprintf("[VMM] Initializing Virtual Memory Manager...\n");
 
+    /* 2MB pages are architectural on x86_64, 1GB pages are optional */
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001) {
+        cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        vmm_gb_pages = (edx & BIT(26)) != 0;
+    }
+    kprintf("[VMM] Huge pages: 2MB yes, 1GB %s\n", vmm_gb_pages ? "yes" : "no");
+
+    /* PCID: CPUID.01H:ECX bit 17 */
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool has_pcid = (ecx & BIT(17)) != 0;
+
+    /* PAT: CPUID.01H:EDX bit 16; without it VMM_FLAG_WRITECOMBINE is write-through */
+    vmm_pat = (edx & BIT(16)) != 0;
+    if (vmm_pat) {
+        vmm_load_pat();
+    }
+    kprintf("[VMM] PAT: %s\n", vmm_pat ? "write-combining enabled" : "not supported");
+
     /* Allocate kernel PML4 */
     kernel_pml4_phys = alloc_page_table();
     if (kernel_pml4_phys == 0) {
@@ -188,10 +685,8 @@ void vmm_init(void) {
 
     /* Create identity mapping for first 4MB (for early boot compatibility) */
     kprintf("[VMM] Creating identity mapping for first 4MB...\n");
-    for (physaddr_t addr = 0; addr < 4 * MB; addr += VMM_PAGE_SIZE) {
-        if (!vmm_map_page(addr, addr, VMM_FLAGS_KERNEL)) {
-            kprintf("[VMM] Warning: Failed to map 0x%llx\n", (uint64_t)addr);
-        }
+    if (!vmm_map_pages(0, 0, (4 * MB) / VMM_PAGE_SIZE, VMM_FLAGS_KERNEL)) {
+        kprintf("[VMM] Warning: Failed to map 0x0 - 0x%llx\n", (uint64_t)(4 * MB));
     }
 
     /* Map kernel higher-half (optional, depends on your kernel linking) */
@@ -199,18 +694,55 @@ void vmm_init(void) {
 
     /* Also identity-map more memory for kernel use (up to 16MB) */
     kprintf("[VMM] Extending identity mapping to 16MB...\n");
-    for (physaddr_t addr = 4 * MB; addr < 16 * MB; addr += VMM_PAGE_SIZE) {
-        if (!vmm_map_page(addr, addr, VMM_FLAGS_KERNEL)) {
-            kprintf("[VMM] Warning: Failed to map 0x%llx\n", (uint64_t)addr);
-        }
+    if (!vmm_map_pages(4 * MB, 4 * MB, (12 * MB) / VMM_PAGE_SIZE, VMM_FLAGS_KERNEL)) {
+        kprintf("[VMM] Warning: Failed to map 0x%llx - 0x%llx\n",
+                (uint64_t)(4 * MB), (uint64_t)(16 * MB));
     }
 
     /* Switch to our new page tables */
     kprintf("[VMM] Switching to kernel page tables...\n");
     vmm_switch_address_space(kernel_pml4_phys);
 
+    /* Kernel writes to user memory must fault on copy-on-write pages too */
+    write_cr0(read_cr0() | VMM_CR0_WP);
+
+    /* CR4.PCIDE may only be set while CR3 carries PCID 0 */
+    if (has_pcid) {
+        write_cr4(read_cr4() | VMM_CR4_PCIDE);
+        for (size_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+            pcid_slots[cpu][0].pml4 = kernel_pml4_phys;
+        }
+        vmm_pcid = true;
+    }
+    kprintf("[VMM] PCID: %s\n", vmm_pcid ? "enabled" : "not supported");
+
     kprintf("[VMM] Virtual Memory Manager initialized successfully\n");
     kprintf("[VMM] Identity mapped: 0x0 - 0x%llx\n", (uint64_t)(16 * MB));
+    bootprof_mark(BOOTPROF_VMM);
+}
+
+/**
+ * Bring an application processor onto the kernel page tables
+ */
+void vmm_init_cpu(void) {
+    if (vmm_pat) {
+        vmm_load_pat();
+    }
+    __atomic_store_n(&vmm_loaded[percpu_cpu_id()], kernel_pml4_phys, __ATOMIC_SEQ_CST);
+    write_cr3(kernel_pml4_phys);
+    write_cr0(read_cr0() | VMM_CR0_WP);
+
+    /* Same rule as on the BSP: CR3 carries PCID 0 here */
+    if (vmm_pcid) {
+        write_cr4(read_cr4() | VMM_CR4_PCIDE);
+    }
+}
+
+/**
+ * Check if VMM_FLAG_WRITECOMBINE maps write-combining
+ */
+bool vmm_write_combining(void) {
+    return vmm_pat;
 }
 
 /**
@@ -259,6 +791,7 @@ bool vmm_map_page(virtaddr_t virt, physaddr_t phys, uint64_t flags) {
 
     /* Invalidate TLB for this page */
     invlpg(virt);
+    pcid_note_change(virt);
 
     return true;
 }
@@ -267,21 +800,68 @@ bool vmm_map_page(virtaddr_t virt, physaddr_t phys, uint64_t flags) {
  * Map a range of pages
  */
 bool vmm_map_pages(virtaddr_t virt, physaddr_t phys, size_t count, uint64_t flags) {
-    for (size_t i = 0; i < count; i++) {
-        virtaddr_t v = virt + (i * VMM_PAGE_SIZE);
-        physaddr_t p = phys + (i * VMM_PAGE_SIZE);
+    if (count == 0) {
+        return true;
+    }
 
-        if (!vmm_map_page(v, p, flags)) {
-            /* Rollback previously mapped pages */
-            for (size_t j = 0; j < i; j++) {
-                vmm_unmap_page(virt + (j * VMM_PAGE_SIZE));
-            }
-            return false;
-        }
+    if (!IS_ALIGNED(virt, VMM_PAGE_SIZE) || !IS_ALIGNED(phys, VMM_PAGE_SIZE)) {
+        kprintf("[VMM] Error: Unaligned addresses in vmm_map_pages\n");
+        kprintf("[VMM]   virt=0x%llx, phys=0x%llx\n",
+                (uint64_t)virt, (uint64_t)phys);
+        return false;
+    }
+
+    physaddr_t pml4 = kernel_pml4_phys;
+    if (pml4 == 0) {
+        pml4 = read_cr3() & VMM_ADDR_MASK;
+    }
+
+    vmm_acquire_lock();
+
+    size_t mapped = vmm_map_range_locked(pml4, virt, phys, count, flags);
+    if (mapped < count) {
+        /* Roll back what was mapped */
+        vmm_unmap_range_locked(pml4, virt, mapped);
+    }
+
+    vmm_release_lock();
+
+    vmm_flush_range(virt, mapped);
+
+    if (mapped < count) {
+        kprintf("[VMM] Error: Failed to map range at 0x%llx (%llu pages)\n",
+                (uint64_t)virt, (uint64_t)count);
+        return false;
     }
     return true;
 }
 
+/**
+ * Unmap a range of pages
+ */
+void vmm_unmap_pages(virtaddr_t virt, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    if (!IS_ALIGNED(virt, VMM_PAGE_SIZE)) {
+        kprintf("[VMM] Error: Unaligned address in vmm_unmap_pages: 0x%llx\n",
+                (uint64_t)virt);
+        return;
+    }
+
+    physaddr_t pml4 = kernel_pml4_phys;
+    if (pml4 == 0) {
+        pml4 = read_cr3() & VMM_ADDR_MASK;
+    }
+
+    vmm_acquire_lock();
+    vmm_unmap_range_locked(pml4, virt, count);
+    vmm_release_lock();
+
+    vmm_flush_range(virt, count);
+}
+
 /**
  * Unmap a virtual page
  */
@@ -300,12 +880,23 @@ physaddr_t vmm_unmap_page(virtaddr_t virt) {
     vmm_acquire_lock();
 
     /* Walk page tables without creating */
-    pte_t *pte = vmm_walk(pml4, virt, false, 0);
+    int level;
+    pte_t *pte = vmm_lookup(pml4, virt, &level);
     if (pte == NULL || !(*pte & VMM_FLAG_PRESENT)) {
         vmm_release_lock();
         return 0;  /* Not mapped */
     }
 
+    /* Unmapping 4KB out of a huge page: split it first */
+    if (level != VMM_LEVEL_PT) {
+        pte = vmm_walk(pml4, virt, true, 0);
+        if (pte == NULL) {
+            vmm_release_lock();
+            kprintf("[VMM] Error: Cannot split huge page at 0x%llx\n", (uint64_t)virt);
+            return 0;
+        }
+    }
+
     /* Get physical address before clearing */
     physaddr_t phys = *pte & VMM_ADDR_MASK;
 
@@ -316,6 +907,7 @@ physaddr_t vmm_unmap_page(virtaddr_t virt) {
 
     /* Invalidate TLB */
     invlpg(virt);
+    pcid_note_change(virt);
 
     return phys;
 }
@@ -331,33 +923,101 @@ physaddr_t vmm_get_physical(virtaddr_t virt) {
 
     vmm_acquire_lock();
 
-    pte_t *pte = vmm_walk(pml4, virt, false, 0);
+    int level;
+    pte_t *pte = vmm_lookup(pml4, virt, &level);
+    pte_t entry = pte ? *pte : 0;
 
     vmm_release_lock();
 
-    if (pte == NULL || !(*pte & VMM_FLAG_PRESENT)) {
+    if (!(entry & VMM_FLAG_PRESENT)) {
         return 0;  /* Not mapped */
     }
 
-    /* Return physical address with page offset */
-    return (*pte & VMM_ADDR_MASK) | VMM_PAGE_OFFSET(virt);
+    /* Return physical address with offset into the (possibly huge) page */
+    return leaf_to_phys(entry, level, virt);
 }
 
 /**
- * Create a new address space (new PML4)
+ * Check for the entry of a swapped-out page
  */
-physaddr_t vmm_create_address_space(void) {
-    /* Allocate new PML4 */
-    physaddr_t new_pml4 = alloc_page_table();
-    if (new_pml4 == 0) {
-        kprintf("[VMM] Error: Failed to allocate new PML4\n");
-        return 0;
+static inline bool swap_entry(pte_t entry) {
+    return (entry & (VMM_FLAG_PRESENT | VMM_FLAG_SWAPPED)) == VMM_FLAG_SWAPPED;
+}
+
+/**
+ * Add a user address space to the swap clock's list (vmm_lock held)
+ * Past VMM_SPACES_MAX address spaces the rest are never swapped.
+ */
+static void space_add(physaddr_t pml4) {
+    if (vmm_space_count < VMM_SPACES_MAX) {
+        vmm_spaces[vmm_space_count++] = pml4;
     }
+}
 
-    /* Copy kernel mappings (upper half entries) to new address space */
-    /* This ensures kernel is always accessible in every address space */
-    if (kernel_pml4_phys != 0) {
-        page_table_t *src = (page_table_t*)phys_to_virt(kernel_pml4_phys);
+/**
+ * Remove an address space from the swap clock's list (vmm_lock held)
+ */
+static void space_remove(physaddr_t pml4) {
+    for (uint32_t i = 0; i < vmm_space_count; i++) {
+        if (vmm_spaces[i] == pml4) {
+            vmm_spaces[i] = vmm_spaces[--vmm_space_count];
+            return;
+        }
+    }
+}
+
+/**
+ * Check whether a CPU other than the caller has an address space loaded
+ * Interrupts must be off, so the caller stays on its CPU.
+ */
+static bool space_loaded_elsewhere(physaddr_t pml4) {
+    uint32_t self = percpu_cpu_id();
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        if (cpu != self && __atomic_load_n(&vmm_loaded[cpu], __ATOMIC_SEQ_CST) == pml4) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Bring a swapped-out page back into a fresh frame (vmm_lock held)
+ * @return true if the entry maps the page again
+ */
+static bool swap_in_locked(pte_t *pte, virtaddr_t page) {
+    pte_t entry = *pte;
+    physaddr_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        kprintf("[VMM] Error: Out of memory swapping in page 0x%llx\n", (uint64_t)page);
+        return false;
+    }
+
+    if (!swap_ops->load(VMM_SWAP_SLOT(entry), phys_to_virt(frame))) {
+        kprintf("[VMM] Error: Swap slot of page 0x%llx is unreadable\n", (uint64_t)page);
+        pmm_free_page(frame);
+        return false;
+    }
+
+    *pte = frame | (entry & ~(VMM_ADDR_MASK | VMM_FLAG_SWAPPED)) | VMM_FLAG_PRESENT;
+    swap_stats.swapped_in++;
+    return true;
+}
+
+/**
+ * Create a new address space (new PML4)
+ */
+physaddr_t vmm_create_address_space(void) {
+    /* Allocate new PML4 */
+    physaddr_t new_pml4 = alloc_pml4();
+    if (new_pml4 == 0) {
+        kprintf("[VMM] Error: Failed to allocate new PML4\n");
+        return 0;
+    }
+
+    /* Copy kernel mappings (upper half entries) to new address space */
+    /* This ensures kernel is always accessible in every address space */
+    if (kernel_pml4_phys != 0) {
+        page_table_t *src = (page_table_t*)phys_to_virt(kernel_pml4_phys);
         page_table_t *dst = (page_table_t*)phys_to_virt(new_pml4);
 
         /* Copy entries 256-511 (upper half, kernel space) */
@@ -378,47 +1038,696 @@ physaddr_t vmm_create_address_space(void) {
         }
     }
 
+    vmm_acquire_lock();
+    space_add(new_pml4);
+    vmm_release_lock();
+
     kprintf("[VMM] Created new address space at 0x%llx\n", (uint64_t)new_pml4);
     return new_pml4;
 }
 
 /**
- * Recursively free page tables
+ * Drop the PCIDs of an address space whose TLB entries may be stale
+ * The next switch to it on each CPU takes a fresh slot and flushes. If
+ * the address space is loaded here, this CPU's slot is kept and the
+ * caller flushes the changed pages itself.
  */
-static void free_page_table_recursive(physaddr_t table_phys, int level,
-                                       bool free_user_only) {
-    if (table_phys == 0) {
+static void pcid_forget(physaddr_t pml4) {
+    if (!vmm_pcid) {
         return;
     }
 
-    page_table_t *table = (page_table_t*)phys_to_virt(table_phys);
+    uint64_t flags = pcid_acquire_lock();
+    uint32_t self = percpu_cpu_id();
+    bool loaded = pml4 == (read_cr3() & VMM_ADDR_MASK);
+
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        if (loaded && cpu == self) {
+            continue;
+        }
+        for (size_t i = 1; i < VMM_PCID_SLOTS; i++) {
+            if (pcid_slots[cpu][i].pml4 == pml4) {
+                pcid_slots[cpu][i].pml4 = 0;
+            }
+        }
+    }
+    pcid_release_lock(flags);
+}
 
-    /* Determine range to process */
-    size_t start = free_user_only ? 0 : 0;
-    size_t end = free_user_only ? 256 : VMM_ENTRIES_PER_TABLE;
+/**
+ * Release a user page table and everything below it
+ * Tables under a user PML4 entry are private to the address space. 4KB
+ * user pages drop one frame reference, swapped-out ones their slot;
+ * other leaves are not owned.
+ * @param table_phys Table to release
+ * @param level Level of the table (VMM_LEVEL_PDPT..VMM_LEVEL_PT)
+ */
+static void free_user_tables(physaddr_t table_phys, int level) {
+    page_table_t *table = (page_table_t*)phys_to_virt(table_phys);
 
-    for (size_t i = start; i < end; i++) {
+    for (size_t i = 0; i < VMM_ENTRIES_PER_TABLE; i++) {
         pte_t entry = table->entries[i];
 
+        if (level == VMM_LEVEL_PT && swap_entry(entry)) {
+            swap_ops->unref(VMM_SWAP_SLOT(entry));
+            continue;
+        }
         if (!(entry & VMM_FLAG_PRESENT)) {
             continue;
         }
 
-        /* Don't free huge pages at intermediate levels */
+        if (level == VMM_LEVEL_PT) {
+            if (entry & VMM_FLAG_USER) {
+                pmm_page_unref(entry & VMM_ADDR_MASK);
+            }
+            continue;
+        }
+
+        /* Huge leaves map memory this address space doesn't own */
         if (entry & VMM_FLAG_HUGE) {
             continue;
         }
 
-        physaddr_t child = entry & VMM_ADDR_MASK;
+        free_user_tables(entry & VMM_ADDR_MASK, level + 1);
+    }
+
+    pmm_free_page(table_phys);
+}
+
+/**
+ * Release the user half of a PML4
+ * Entries without the USER flag are shared with the kernel and kept.
+ */
+static void free_user_half(physaddr_t pml4_phys) {
+    page_table_t *pml4 = (page_table_t*)phys_to_virt(pml4_phys);
+
+    for (size_t i = 0; i < VMM_ENTRIES_PER_TABLE / 2; i++) {
+        pte_t entry = pml4->entries[i];
+
+        if ((entry & (VMM_FLAG_PRESENT | VMM_FLAG_USER)) ==
+            (VMM_FLAG_PRESENT | VMM_FLAG_USER)) {
+            free_user_tables(entry & VMM_ADDR_MASK, VMM_LEVEL_PDPT);
+        }
+        pml4->entries[i] = 0;
+    }
+}
+
+/**
+ * Copy one level of user page tables for a copy-on-write clone
+ * Tables are duplicated. 4KB user pages are shared: writable ones become
+ * read-only + VMM_FLAG_COW in the source too, except VMM_FLAG_SHARED
+ * memory, which stays writable in both. Swapped-out pages share their
+ * slot, and whichever side faults first gets its own copy. Huge user
+ * pages are split first so that a later copy only costs 4KB.
+ * @param src_phys Source table
+ * @param level Level of the table (VMM_LEVEL_PDPT..VMM_LEVEL_PT)
+ * @return Physical address of the copy, or 0 on failure
+ */
+static physaddr_t cow_clone_table(physaddr_t src_phys, int level) {
+    physaddr_t dst_phys = alloc_page_table();
+    if (dst_phys == 0) {
+        return 0;
+    }
+
+    page_table_t *src = (page_table_t*)phys_to_virt(src_phys);
+    page_table_t *dst = (page_table_t*)phys_to_virt(dst_phys);
+
+    for (size_t i = 0; i < VMM_ENTRIES_PER_TABLE; i++) {
+        pte_t entry = src->entries[i];
+
+        if (level == VMM_LEVEL_PT && swap_entry(entry)) {
+            swap_ops->ref(VMM_SWAP_SLOT(entry));
+            dst->entries[i] = entry;
+            continue;
+        }
+        if (!(entry & VMM_FLAG_PRESENT)) {
+            continue;
+        }
+
+        if (level != VMM_LEVEL_PT && (entry & VMM_FLAG_HUGE)) {
+            if (!(entry & VMM_FLAG_USER)) {
+                dst->entries[i] = entry;        /* Kernel mapping, shared */
+                continue;
+            }
+            if (split_huge_entry(&src->entries[i], level, NULL) == 0) {
+                goto fail;
+            }
+            entry = src->entries[i];
+        }
+
+        if (level == VMM_LEVEL_PT) {
+            if (entry & VMM_FLAG_USER) {
+                if (!pmm_page_ref(entry & VMM_ADDR_MASK)) {
+                    goto fail;
+                }
+                if ((entry & (VMM_FLAG_WRITE | VMM_FLAG_SHARED)) == VMM_FLAG_WRITE) {
+                    entry = (entry & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+                    src->entries[i] = entry;
+                }
+                cow_stats.shared_pages++;
+            }
+            dst->entries[i] = entry;
+            continue;
+        }
+
+        physaddr_t child = cow_clone_table(entry & VMM_ADDR_MASK, level + 1);
+        if (child == 0) {
+            goto fail;
+        }
+        dst->entries[i] = child | (entry & ~VMM_ADDR_MASK);
+    }
+
+    return dst_phys;
+
+fail:
+    free_user_tables(dst_phys, level);
+    return 0;
+}
+
+/**
+ * Get a reference on the shared zero page
+ */
+physaddr_t vmm_get_zero_page(void) {
+    vmm_acquire_lock();
 
-        /* Recurse into child tables (but not at PT level) */
-        if (level < 3) {  /* 0=PML4, 1=PDPT, 2=PD, 3=PT */
-            free_page_table_recursive(child, level + 1, false);
+    if (zero_frame == 0) {
+        zero_frame = alloc_page_table();
+    }
+    physaddr_t frame = zero_frame;
+
+    vmm_release_lock();
+
+    if (frame == 0 || !pmm_page_ref(frame)) {
+        return 0;
+    }
+    return frame;
+}
+
+/**
+ * Install a 4KB user page in an address space
+ */
+bool vmm_map_user_page(physaddr_t pml4, virtaddr_t virt, physaddr_t frame, uint64_t flags) {
+    if (!IS_ALIGNED(virt, VMM_PAGE_SIZE) || !IS_ALIGNED(frame, VMM_PAGE_SIZE)) {
+        pmm_page_unref(frame);
+        return false;
+    }
+
+    vmm_acquire_lock();
+
+    pte_t *pte = vmm_walk(pml4, virt, true, flags | VMM_FLAG_USER);
+    if (pte == NULL) {
+        vmm_release_lock();
+        pmm_page_unref(frame);
+        return false;
+    }
+
+    if (*pte & (VMM_FLAG_PRESENT | VMM_FLAG_SWAPPED)) {
+        /* Someone else resolved the same fault first, or it went to swap since */
+        vmm_release_lock();
+        pmm_page_unref(frame);
+        return true;
+    }
+
+    *pte = frame | (flags & ~VMM_ADDR_MASK) | VMM_FLAG_PRESENT | VMM_FLAG_USER;
+
+    vmm_release_lock();
+
+    if (pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+        invlpg(virt);
+    }
+    return true;
+}
+
+/**
+ * Remove user pages from an address space
+ */
+void vmm_unmap_user_range(physaddr_t pml4, virtaddr_t virt, size_t count) {
+    if (count == 0 || !IS_ALIGNED(virt, VMM_PAGE_SIZE)) {
+        return;
+    }
+
+    vmm_acquire_lock();
+
+    for (size_t i = 0; i < count; i++) {
+        virtaddr_t page = virt + i * VMM_PAGE_SIZE;
+        int level;
+        pte_t *pte = vmm_lookup(pml4, page, &level);
+
+        if (pte != NULL && level == VMM_LEVEL_PT && swap_entry(*pte)) {
+            swap_ops->unref(VMM_SWAP_SLOT(*pte));
+            *pte = 0;
+            continue;
+        }
+        if (pte == NULL || !(*pte & VMM_FLAG_PRESENT) || !(*pte & VMM_FLAG_USER)) {
+            continue;
         }
+        if (level != VMM_LEVEL_PT) {
+            /* Only part of a huge page may be going away */
+            pte = vmm_walk(pml4, page, true, VMM_FLAG_USER);
+            if (pte == NULL) {
+                kprintf("[VMM] Error: Cannot split huge page at 0x%llx\n", (uint64_t)page);
+                continue;
+            }
+        }
+
+        pmm_page_unref(*pte & VMM_ADDR_MASK);
+        *pte = 0;
+    }
+
+    vmm_release_lock();
+
+    if (pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+        vmm_flush_range(virt, count);
+    }
+    pcid_forget(pml4);
+}
+
+/**
+ * Install a 4KB user page in place of whatever is mapped there
+ */
+bool vmm_replace_user_page(physaddr_t pml4, virtaddr_t virt, physaddr_t frame, uint64_t flags) {
+    if (!IS_ALIGNED(virt, VMM_PAGE_SIZE) || !IS_ALIGNED(frame, VMM_PAGE_SIZE)) {
+        pmm_page_unref(frame);
+        return false;
+    }
+
+    vmm_acquire_lock();
 
-        /* Free the child page table */
-        pmm_free_page(child);
+    pte_t *pte = vmm_walk(pml4, virt, true, flags | VMM_FLAG_USER);
+    if (pte == NULL) {
+        vmm_release_lock();
+        pmm_page_unref(frame);
+        return false;
+    }
+
+    if ((*pte & (VMM_FLAG_PRESENT | VMM_FLAG_SHARED)) == (VMM_FLAG_PRESENT | VMM_FLAG_SHARED)) {
+        vmm_release_lock();
+        pmm_page_unref(frame);
+        return false;
+    }
+
+    physaddr_t old = (*pte & VMM_FLAG_PRESENT) ? (*pte & VMM_ADDR_MASK) : 0;
+    if (swap_entry(*pte)) {
+        swap_ops->unref(VMM_SWAP_SLOT(*pte));
+    }
+    *pte = frame | (flags & ~VMM_ADDR_MASK) | VMM_FLAG_PRESENT | VMM_FLAG_USER;
+
+    vmm_release_lock();
+
+    if (old != 0) {
+        pmm_page_unref(old);
+    }
+    if (pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+        invlpg(virt);
+    }
+    pcid_forget(pml4);
+    return true;
+}
+
+/**
+ * Take a reference on a present user page, making it copy-on-write
+ */
+physaddr_t vmm_share_user_page(physaddr_t pml4, virtaddr_t virt) {
+    vmm_acquire_lock();
+
+    int level;
+    pte_t *pte = vmm_lookup(pml4, virt & VMM_PAGE_MASK, &level);
+    if (pte != NULL && level == VMM_LEVEL_PT && swap_entry(*pte)) {
+        swap_in_locked(pte, virt & VMM_PAGE_MASK);
+    }
+    if (pte == NULL || level != VMM_LEVEL_PT ||
+        (*pte & (VMM_FLAG_PRESENT | VMM_FLAG_USER | VMM_FLAG_SHARED)) !=
+            (VMM_FLAG_PRESENT | VMM_FLAG_USER)) {
+        vmm_release_lock();
+        return 0;
+    }
+
+    physaddr_t frame = *pte & VMM_ADDR_MASK;
+    if (!pmm_page_ref(frame)) {
+        vmm_release_lock();
+        return 0;
+    }
+
+    bool downgraded = false;
+    if (*pte & VMM_FLAG_WRITE) {
+        *pte = (*pte & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+        downgraded = true;
+    }
+    cow_stats.shared_pages++;
+
+    vmm_release_lock();
+
+    if (downgraded) {
+        if (pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+            invlpg(virt & VMM_PAGE_MASK);
+        }
+        pcid_forget(pml4);
     }
+    return frame;
+}
+
+/**
+ * Create a copy-on-write clone of an address space
+ */
+physaddr_t vmm_clone_address_space(physaddr_t src_pml4) {
+    if (src_pml4 == 0) {
+        return 0;
+    }
+
+    physaddr_t new_pml4 = alloc_pml4();
+    if (new_pml4 == 0) {
+        kprintf("[VMM] Error: Failed to allocate new PML4\n");
+        return 0;
+    }
+
+    vmm_acquire_lock();
+
+    page_table_t *src = (page_table_t*)phys_to_virt(src_pml4);
+    page_table_t *dst = (page_table_t*)phys_to_virt(new_pml4);
+    bool ok = true;
+
+    /* Kernel half is shared as-is */
+    for (size_t i = VMM_ENTRIES_PER_TABLE / 2; i < VMM_ENTRIES_PER_TABLE; i++) {
+        dst->entries[i] = src->entries[i];
+    }
+
+    for (size_t i = 0; i < VMM_ENTRIES_PER_TABLE / 2; i++) {
+        pte_t entry = src->entries[i];
+
+        if (!(entry & VMM_FLAG_PRESENT)) {
+            continue;
+        }
+        if (!(entry & VMM_FLAG_USER)) {
+            dst->entries[i] = entry;            /* Shared with the kernel */
+            continue;
+        }
+
+        physaddr_t copy = cow_clone_table(entry & VMM_ADDR_MASK, VMM_LEVEL_PDPT);
+        if (copy == 0) {
+            ok = false;
+            break;
+        }
+        dst->entries[i] = copy | (entry & ~VMM_ADDR_MASK);
+    }
+
+    if (ok) {
+        cow_stats.clones++;
+        space_add(new_pml4);
+    } else {
+        /* Pages already marked COW in the source fix themselves on write */
+        free_user_half(new_pml4);
+        pmm_free_page(new_pml4);
+    }
+
+    vmm_release_lock();
+
+    /* The source lost write access to its shared pages */
+    if (src_pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+        vmm_flush_tlb();
+    }
+    pcid_forget(src_pml4);
+
+    if (!ok) {
+        kprintf("[VMM] Error: Failed to clone address space 0x%llx\n", (uint64_t)src_pml4);
+        return 0;
+    }
+
+    kprintf("[VMM] Cloned address space 0x%llx -> 0x%llx (copy-on-write)\n",
+            (uint64_t)src_pml4, (uint64_t)new_pml4);
+    return new_pml4;
+}
+
+/**
+ * Give the writer of a copy-on-write page its own copy
+ * @return true if the page was copy-on-write and is now writable
+ */
+static bool cow_fault_locked(physaddr_t pml4, virtaddr_t page) {
+    int level;
+    pte_t *pte = vmm_lookup(pml4, page, &level);
+    if (pte == NULL || level != VMM_LEVEL_PT ||
+        (*pte & (VMM_FLAG_PRESENT | VMM_FLAG_COW)) != (VMM_FLAG_PRESENT | VMM_FLAG_COW)) {
+        return false;
+    }
+
+    physaddr_t frame = *pte & VMM_ADDR_MASK;
+    uint64_t attrs = (*pte & ~(VMM_ADDR_MASK | VMM_FLAG_COW)) | VMM_FLAG_WRITE;
+
+    if (pmm_page_refcount(frame) <= 1) {
+        /* Every other sharer has copied or exited: take the frame back */
+        *pte = frame | attrs;
+        cow_stats.reused_pages++;
+        return true;
+    }
+
+    physaddr_t copy = pmm_alloc_page();
+    if (copy == 0) {
+        kprintf("[VMM] Error: Out of memory copying page 0x%llx\n", (uint64_t)page);
+        return false;
+    }
+
+    if (frame == zero_frame) {
+        zero_page(copy);
+    } else {
+        const uint64_t *from = (const uint64_t*)phys_to_virt(frame);
+        uint64_t *to = (uint64_t*)phys_to_virt(copy);
+        for (size_t i = 0; i < VMM_PAGE_SIZE / sizeof(uint64_t); i++) {
+            to[i] = from[i];
+        }
+    }
+
+    *pte = copy | attrs;
+    pmm_page_unref(frame);
+    cow_stats.copied_pages++;
+    return true;
+}
+
+/**
+ * Bring back a swapped-out page on a not-present fault
+ * @return true if the page was swapped out and is mapped again
+ */
+static bool swap_fault_locked(physaddr_t pml4, virtaddr_t page) {
+    int level;
+    pte_t *pte = vmm_lookup(pml4, page, &level);
+    if (pte == NULL || level != VMM_LEVEL_PT || !swap_entry(*pte)) {
+        return false;
+    }
+    return swap_in_locked(pte, page);
+}
+
+/**
+ * Resolve a page fault in the current address space
+ */
+bool vmm_handle_page_fault(virtaddr_t fault_addr, uint64_t error_code) {
+    physaddr_t pml4 = read_cr3() & VMM_ADDR_MASK;
+    virtaddr_t page = fault_addr & VMM_PAGE_MASK;
+    bool write = (error_code & VMM_PF_WRITE) != 0;
+    bool handled;
+
+    vmm_acquire_lock();
+
+    /* Only a write to a present page can hit a copy-on-write mapping */
+    if (error_code & VMM_PF_PRESENT) {
+        handled = write && cow_fault_locked(pml4, page);
+    } else {
+        handled = swap_fault_locked(pml4, page);
+    }
+
+    vmm_release_lock();
+
+    if (handled) {
+        invlpg(page);
+        pcid_forget(pml4);          /* Other CPUs may still cache the read-only entry */
+    }
+    return handled;
+}
+
+/**
+ * Get copy-on-write statistics
+ */
+void vmm_get_cow_stats(vmm_cow_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    vmm_acquire_lock();
+    *stats = cow_stats;
+    vmm_release_lock();
+}
+
+/**
+ * Install the swap backend
+ */
+bool vmm_set_swap_ops(const vmm_swap_ops_t *ops) {
+    if (ops == NULL || !ops->store || !ops->load || !ops->ref || !ops->unref) {
+        return false;
+    }
+
+    vmm_acquire_lock();
+    bool ok = swap_ops == NULL;
+    if (ok) {
+        swap_ops = ops;
+    }
+    vmm_release_lock();
+    return ok;
+}
+
+/**
+ * Find the first 4KB user page table at or after *virt
+ * Moves *virt over holes and huge pages.
+ * @return The table, or NULL once the user half is done
+ */
+static page_table_t* swap_next_table(physaddr_t pml4_phys, virtaddr_t *virt) {
+    const page_table_t *pml4 = (const page_table_t*)phys_to_virt(pml4_phys);
+
+    while (*virt < VMM_USER_TOP) {
+        virtaddr_t v = *virt;
+
+        pte_t entry = pml4->entries[VMM_PML4_INDEX(v)];
+        if ((entry & (VMM_FLAG_PRESENT | VMM_FLAG_USER)) != (VMM_FLAG_PRESENT | VMM_FLAG_USER)) {
+            *virt = ALIGN_DOWN(v, 1ULL << VMM_PML4_SHIFT) + (1ULL << VMM_PML4_SHIFT);
+            continue;
+        }
+
+        const page_table_t *pdpt = (const page_table_t*)phys_to_virt(entry & VMM_ADDR_MASK);
+        entry = pdpt->entries[VMM_PDPT_INDEX(v)];
+        if (!(entry & VMM_FLAG_PRESENT) || (entry & VMM_FLAG_HUGE)) {
+            *virt = ALIGN_DOWN(v, VMM_HUGE_1G_SIZE) + VMM_HUGE_1G_SIZE;
+            continue;
+        }
+
+        const page_table_t *pd = (const page_table_t*)phys_to_virt(entry & VMM_ADDR_MASK);
+        entry = pd->entries[VMM_PD_INDEX(v)];
+        if (!(entry & VMM_FLAG_PRESENT) || (entry & VMM_FLAG_HUGE)) {
+            *virt = ALIGN_DOWN(v, VMM_HUGE_2M_SIZE) + VMM_HUGE_2M_SIZE;
+            continue;
+        }
+
+        return (page_table_t*)phys_to_virt(entry & VMM_ADDR_MASK);
+    }
+    return NULL;
+}
+
+/**
+ * Age one user page, or hand it to the swap backend if it is cold
+ * Runs with vmm_lock held and interrupts off.
+ * @return true if the page was swapped out
+ */
+static bool swap_out_locked(physaddr_t pml4, pte_t *pte, virtaddr_t page) {
+    pte_t entry = *pte;
+    uint64_t mask = VMM_FLAG_PRESENT | VMM_FLAG_USER | VMM_FLAG_SHARED |
+                    VMM_FLAG_NOCACHE | VMM_FLAG_WRITETHROUGH;
+    if ((entry & mask) != (VMM_FLAG_PRESENT | VMM_FLAG_USER)) {
+        return false;
+    }
+
+    physaddr_t frame = entry & VMM_ADDR_MASK;
+    if (frame == zero_frame || pmm_page_refcount(frame) != 1) {
+        return false;
+    }
+
+    /* Used since the hand last came by: keep it for another round */
+    if (entry & VMM_FLAG_ACCESSED) {
+        __atomic_fetch_and(pte, ~VMM_FLAG_ACCESSED, __ATOMIC_RELAXED);
+        swap_stats.aged++;
+        return false;
+    }
+
+    /*
+     * Unmap before reading it, so that no write can slip in unseen. A CPU
+     * with the address space loaded may still hold the old translation;
+     * the page is only safe if none other than this one does.
+     */
+    entry = __atomic_exchange_n(pte, entry & ~VMM_FLAG_PRESENT, __ATOMIC_SEQ_CST);
+    if (pml4 == (read_cr3() & VMM_ADDR_MASK)) {
+        invlpg(page);
+    }
+    pcid_forget(pml4);
+    if (space_loaded_elsewhere(pml4)) {
+        *pte = entry;
+        swap_stats.busy++;
+        return false;
+    }
+
+    uint64_t slot = swap_ops->store(phys_to_virt(frame));
+    if (slot == 0 || slot > VMM_SWAP_SLOT_MAX) {
+        *pte = entry;
+        return false;
+    }
+
+    *pte = (slot << VMM_PAGE_SHIFT) |
+           (entry & ~(VMM_ADDR_MASK | VMM_FLAG_PRESENT | VMM_FLAG_ACCESSED | VMM_FLAG_DIRTY)) |
+           VMM_FLAG_SWAPPED;
+    pmm_page_unref(frame);
+    swap_stats.swapped_out++;
+    return true;
+}
+
+/**
+ * Evict cold user pages to the swap backend
+ */
+size_t vmm_swap_out(size_t pages) {
+    size_t out = 0;
+    size_t budget = pages * VMM_SWAP_SCAN_FACTOR;
+    uint32_t wraps = 0;
+
+    /* Passing the start twice means every page had a chance to age and go */
+    while (out < pages && budget > 0 && wraps <= 2) {
+        uint64_t flags = interrupts_save();
+        vmm_acquire_lock();
+
+        if (swap_ops == NULL || vmm_space_count == 0) {
+            vmm_release_lock();
+            interrupts_restore(flags);
+            break;
+        }
+        if (swap_space >= vmm_space_count) {
+            swap_space = 0;
+            swap_virt = 0;
+            wraps++;
+        }
+
+        physaddr_t pml4 = vmm_spaces[swap_space];
+        page_table_t *pt = NULL;
+        if (!space_loaded_elsewhere(pml4)) {
+            pt = swap_next_table(pml4, &swap_virt);
+        }
+
+        if (pt == NULL) {
+            swap_space++;
+            swap_virt = 0;
+        } else {
+            size_t batch = 0;
+            for (size_t i = VMM_PT_INDEX(swap_virt);
+                 i < VMM_ENTRIES_PER_TABLE && out < pages && budget > 0 && batch < VMM_SWAP_BATCH;
+                 i++) {
+                budget--;
+                swap_stats.scanned++;
+                if (swap_out_locked(pml4, &pt->entries[i], swap_virt)) {
+                    out++;
+                    batch++;
+                }
+                swap_virt += VMM_PAGE_SIZE;
+            }
+        }
+
+        vmm_release_lock();
+        interrupts_restore(flags);
+    }
+
+    return out;
+}
+
+/**
+ * Get swap statistics
+ */
+void vmm_get_swap_stats(vmm_swap_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    vmm_acquire_lock();
+    *stats = swap_stats;
+    vmm_release_lock();
 }
 
 /**
@@ -440,12 +1749,18 @@ void vmm_destroy_address_space(physaddr_t pml4_phys) {
 
     vmm_acquire_lock();
 
-    /* Free user-space page tables (first 256 entries only) */
-    /* Don't free kernel mappings as they're shared */
-    free_page_table_recursive(pml4_phys, 0, true);
-
-    /* Free the PML4 itself */
-    pmm_free_page(pml4_phys);
+    /* Free user-space page tables and pages (first 256 entries only) */
+    /* Kernel mappings are shared and stay */
+    free_user_half(pml4_phys);
+    pcid_forget(pml4_phys);
+    space_remove(pml4_phys);
+
+    /* Keep the PML4 for the next address space, or free it */
+    if (pml4_cache_count < VMM_PML4_CACHE_MAX) {
+        pml4_cache[pml4_cache_count++] = pml4_phys;
+    } else {
+        pmm_free_page(pml4_phys);
+    }
 
     vmm_release_lock();
 }
@@ -461,9 +1776,76 @@ void vmm_switch_address_space(physaddr_t pml4_phys) {
 
     /* Only switch if different from current */
     physaddr_t current = read_cr3() & VMM_ADDR_MASK;
-    if (current != pml4_phys) {
+    if (current == pml4_phys) {
+        return;
+    }
+
+    /* Published before the load: vmm_swap_out checks it after unmapping */
+    __atomic_store_n(&vmm_loaded[percpu_cpu_id()], pml4_phys, __ATOMIC_SEQ_CST);
+
+    if (!vmm_pcid) {
         write_cr3(pml4_phys);
+        return;
+    }
+
+    uint64_t flags = pcid_acquire_lock();
+    vmm_pcid_slot_t *slots = pcid_slots[percpu_cpu_id()];
+
+    /* Find the address space's PCID, or the least recently used one */
+    size_t slot = 0;
+    if (pml4_phys != kernel_pml4_phys) {
+        size_t victim = 1;
+        for (slot = 1; slot < VMM_PCID_SLOTS; slot++) {
+            if (slots[slot].pml4 == pml4_phys) {
+                break;
+            }
+            if (slots[slot].last_used < slots[victim].last_used) {
+                victim = slot;
+            }
+        }
+
+        if (slot == VMM_PCID_SLOTS) {
+            slot = victim;
+            if (slots[slot].pml4 != 0) {
+                pcid_stats.evictions++;
+            }
+            slots[slot].pml4 = pml4_phys;
+            slots[slot].generation = UINT64_MAX;      /* Force a flush */
+            pcid_stats.misses++;
+        } else {
+            pcid_stats.hits++;
+        }
+    }
+
+    vmm_pcid_slot_t *s = &slots[slot];
+    uint64_t generation = __atomic_load_n(&pcid_generation, __ATOMIC_ACQUIRE);
+    uint64_t cr3 = pml4_phys | slot;
+
+    if (s->generation == generation) {
+        cr3 |= VMM_CR3_NOFLUSH;                 /* Entries under this PCID are valid */
+    } else {
+        s->generation = generation;
+        pcid_stats.flushes++;
+    }
+    s->last_used = ++pcid_clock;
+
+    write_cr3(cr3);
+
+    pcid_release_lock(flags);
+}
+
+/**
+ * Get PCID statistics
+ */
+void vmm_get_pcid_stats(vmm_pcid_stats_t *stats) {
+    if (stats == NULL) {
+        return;
     }
+
+    uint64_t flags = pcid_acquire_lock();
+    *stats = pcid_stats;
+    stats->enabled = vmm_pcid;
+    pcid_release_lock(flags);
 }
 
 /**
@@ -478,6 +1860,7 @@ physaddr_t vmm_get_current_address_space(void) {
  */
 void vmm_invalidate_page(virtaddr_t virt) {
     invlpg(virt);
+    pcid_note_change(virt);
 }
 
 /**
@@ -499,11 +1882,13 @@ bool vmm_is_mapped(virtaddr_t virt) {
 
     vmm_acquire_lock();
 
-    pte_t *pte = vmm_walk(pml4, virt, false, 0);
+    int level;
+    pte_t *pte = vmm_lookup(pml4, virt, &level);
+    bool mapped = (pte != NULL) && (*pte & VMM_FLAG_PRESENT);
 
     vmm_release_lock();
 
-    return (pte != NULL) && (*pte & VMM_FLAG_PRESENT);
+    return mapped;
 }
 
 /**
@@ -512,3 +1897,22 @@ bool vmm_is_mapped(virtaddr_t virt) {
 physaddr_t vmm_get_kernel_pml4(void) {
     return kernel_pml4_phys;
 }
+
+/**
+ * Pre-allocate the kernel PDPT covering an address
+ */
+bool vmm_prepare_kernel_range(virtaddr_t virt) {
+    if (kernel_pml4_phys == 0) {
+        return false;
+    }
+
+    vmm_acquire_lock();
+
+    page_table_t *pml4 = (page_table_t*)phys_to_virt(kernel_pml4_phys);
+    physaddr_t pdpt = get_or_create_entry(pml4, VMM_PML4_INDEX(virt), VMM_LEVEL_PML4,
+                                          true, VMM_FLAGS_KERNEL, NULL);
+
+    vmm_release_lock();
+
+    return pdpt != 0;
+}
@@ -24,12 +24,15 @@
 #define VMM_FLAG_PRESENT        BIT(0)   /* Page is present in memory */
 #define VMM_FLAG_WRITE          BIT(1)   /* Page is writable */
 #define VMM_FLAG_USER           BIT(2)   /* User-mode accessible */
-#define VMM_FLAG_WRITETHROUGH   BIT(3)   /* Write-through caching */
-#define VMM_FLAG_NOCACHE        BIT(4)   /* Disable caching */
+#define VMM_FLAG_WRITETHROUGH   BIT(3)   /* PWT: PAT index bit 0 (see VMM_PAT_VALUE) */
+#define VMM_FLAG_NOCACHE        BIT(4)   /* PCD: PAT index bit 1, uncached */
 #define VMM_FLAG_ACCESSED       BIT(5)   /* Page has been accessed */
 #define VMM_FLAG_DIRTY          BIT(6)   /* Page has been written to */
 #define VMM_FLAG_HUGE           BIT(7)   /* Huge page (2MB in PD, 1GB in PDPT) */
 #define VMM_FLAG_GLOBAL         BIT(8)   /* Global page (not flushed on CR3 switch) */
+#define VMM_FLAG_COW            BIT(9)   /* Software: shared read-only until first write */
+#define VMM_FLAG_SHARED         BIT(10)  /* Software: shared writable; clones share it too */
+#define VMM_FLAG_SWAPPED        BIT(11)  /* Software, not present: contents in the swap backend */
 #define VMM_FLAG_NX             BIT(63)  /* No-execute (requires NX bit enabled) */
 
 /* Common flag combinations */
@@ -38,6 +41,30 @@
 #define VMM_FLAGS_USER          (VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_USER)
 #define VMM_FLAGS_USER_RO       (VMM_FLAG_PRESENT | VMM_FLAG_USER)
 #define VMM_FLAGS_MMIO          (VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NOCACHE)
+#define VMM_FLAGS_FRAMEBUFFER   (VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_WRITECOMBINE)
+
+/*
+ * Page attribute table (IA32_PAT), one memory type per byte. The power-on
+ * layout is kept except for entry 1, which becomes write-combining, so PWT
+ * alone selects WC and PCD keeps meaning uncached. Entry 5 keeps
+ * write-through, and the PAT bit, whose position differs between 4KB and
+ * huge entries, is never needed.
+ */
+#define VMM_MSR_PAT             0x277
+#define VMM_PAT_UC              0x00    /* Uncacheable */
+#define VMM_PAT_WC              0x01    /* Write-combining */
+#define VMM_PAT_WT              0x04    /* Write-through */
+#define VMM_PAT_WB              0x06    /* Write-back */
+#define VMM_PAT_UC_MINUS        0x07    /* Uncached, MTRRs may override */
+#define VMM_PAT_ENTRY(i, type)  ((uint64_t)(type) << ((i) * 8))
+#define VMM_PAT_VALUE           (VMM_PAT_ENTRY(0, VMM_PAT_WB) | VMM_PAT_ENTRY(1, VMM_PAT_WC) | \
+                                 VMM_PAT_ENTRY(2, VMM_PAT_UC_MINUS) |                           \
+                                 VMM_PAT_ENTRY(3, VMM_PAT_UC) | VMM_PAT_ENTRY(4, VMM_PAT_WB) | \
+                                 VMM_PAT_ENTRY(5, VMM_PAT_WT) |                                 \
+                                 VMM_PAT_ENTRY(6, VMM_PAT_UC_MINUS) | VMM_PAT_ENTRY(7, VMM_PAT_UC))
+
+/* Write-combining: PAT entry 1 once vmm_init ran, write-through without PAT */
+#define VMM_FLAG_WRITECOMBINE   VMM_FLAG_WRITETHROUGH
 
 /* Page table constants */
 #define VMM_PAGE_SIZE           4096
@@ -59,6 +86,13 @@
 /* Physical address mask (bits 12-51) */
 #define VMM_ADDR_MASK           0x000FFFFFFFFFF000ULL
 
+/* Huge page sizes and the address bits of huge PD/PDPT entries */
+#define VMM_HUGE_2M_SIZE        (2ULL * 1024 * 1024)
+#define VMM_HUGE_1G_SIZE        (1024ULL * 1024 * 1024)
+#define VMM_HUGE_2M_ADDR_MASK   0x000FFFFFFFE00000ULL
+#define VMM_HUGE_1G_ADDR_MASK   0x000FFFFFC0000000ULL
+#define VMM_PAGES_PER_1G        (VMM_ENTRIES_PER_TABLE * VMM_ENTRIES_PER_TABLE)
+
 /* Extract indices from virtual address */
 #define VMM_PML4_INDEX(virt)    (((virt) >> VMM_PML4_SHIFT) & VMM_INDEX_MASK)
 #define VMM_PDPT_INDEX(virt)    (((virt) >> VMM_PDPT_SHIFT) & VMM_INDEX_MASK)
@@ -70,6 +104,26 @@
 #define VMM_KERNEL_BASE         0xFFFFFFFF80000000ULL  /* Higher half kernel */
 #define VMM_KERNEL_PHYS_MAP     0xFFFF800000000000ULL  /* Direct physical mapping */
 
+/* CR0.WP: ring 0 writes honour read-only pages (copy-on-write) */
+#define VMM_CR0_WP              BIT(16)
+
+/* CR3/CR4 bits for process-context identifiers (PCID) */
+#define VMM_CR3_NOFLUSH         BIT(63)  /* Keep TLB entries of the loaded PCID */
+#define VMM_CR4_PCIDE           BIT(17)  /* PCID enable */
+#define VMM_PCID_SLOTS          16       /* PCIDs in use, including 0 for the kernel */
+
+/* Page fault error code bits */
+#define VMM_PF_PRESENT          BIT(0)   /* Fault on a present page (protection) */
+#define VMM_PF_WRITE            BIT(1)   /* Faulting access was a write */
+#define VMM_PF_USER             BIT(2)   /* Fault happened in user mode */
+
+/*
+ * A swapped-out page keeps its entry not present, with VMM_FLAG_SWAPPED,
+ * its other flags, and the backend's slot number in the address bits.
+ */
+#define VMM_SWAP_SLOT(entry)    (((entry) & VMM_ADDR_MASK) >> VMM_PAGE_SHIFT)
+#define VMM_SWAP_SLOT_MAX       (VMM_ADDR_MASK >> VMM_PAGE_SHIFT)
+
 /* Page table entry type */
 typedef uint64_t pte_t;
 
@@ -85,6 +139,20 @@ typedef struct ALIGNED(VMM_PAGE_SIZE) {
  */
 void vmm_init(void);
 
+/**
+ * Set up paging on an application processor
+ * Loads the BSP's PAT layout and the kernel page tables, and turns on
+ * PCIDs if the BSP uses them.
+ */
+void vmm_init_cpu(void);
+
+/**
+ * Check if VMM_FLAG_WRITECOMBINE maps write-combining
+ * @return true once IA32_PAT is programmed, false if the CPU has no PAT
+ *         (the flag then gives write-through)
+ */
+bool vmm_write_combining(void);
+
 /**
  * Map a virtual page to a physical page
  * @param virt Virtual address (page-aligned)
@@ -96,6 +164,8 @@ bool vmm_map_page(virtaddr_t virt, physaddr_t phys, uint64_t flags);
 
 /**
  * Map a range of pages
+ * Runs whose virtual and physical addresses are both 2MB (or 1GB) aligned
+ * are mapped with huge pages.
  * @param virt Starting virtual address (page-aligned)
  * @param phys Starting physical address (page-aligned)
  * @param count Number of pages to map
@@ -104,6 +174,14 @@ bool vmm_map_page(virtaddr_t virt, physaddr_t phys, uint64_t flags);
  */
 bool vmm_map_pages(virtaddr_t virt, physaddr_t phys, size_t count, uint64_t flags);
 
+/**
+ * Unmap a range of pages
+ * Frames are not freed; the TLB is invalidated once for the whole range.
+ * @param virt Starting virtual address (must be page-aligned)
+ * @param count Number of pages to unmap
+ */
+void vmm_unmap_pages(virtaddr_t virt, size_t count);
+
 /**
  * Unmap a virtual page
  * @param virt Virtual address to unmap (page-aligned)
@@ -120,22 +198,137 @@ physaddr_t vmm_get_physical(virtaddr_t virt);
 
 /**
  * Create a new address space (new PML4)
+ * The kernel PML4 is the template: its kernel entries are copied, so the
+ * tables below them are shared by reference.
  * @return Physical address of new PML4, or 0 on failure
  */
 physaddr_t vmm_create_address_space(void);
 
+/**
+ * Create a copy-on-write clone of an address space (for fork)
+ * Kernel mappings are shared as in vmm_create_address_space(). User pages
+ * are shared with the source: writable ones are made read-only and marked
+ * VMM_FLAG_COW in both address spaces, and every shared frame takes a PMM
+ * reference. The first write to such a page faults into
+ * vmm_handle_page_fault(), which gives the writer its own copy.
+ * @param src_pml4 Physical address of the PML4 to clone
+ * @return Physical address of the new PML4, or 0 on failure
+ */
+physaddr_t vmm_clone_address_space(physaddr_t src_pml4);
+
+/**
+ * Resolve a page fault in the current address space
+ * Handles write faults on copy-on-write pages and brings swapped-out
+ * pages back. Other not-present faults are left to the owner of the
+ * address space's mappings (see vma.h).
+ * @param fault_addr Faulting address (CR2)
+ * @param error_code Page fault error code (VMM_PF_*)
+ * @return true if the fault was resolved and the access can be retried
+ */
+bool vmm_handle_page_fault(virtaddr_t fault_addr, uint64_t error_code);
+
+/**
+ * Get a reference on the shared zero page
+ * Map it read-only (with VMM_FLAG_COW if the mapping is writable) for
+ * zero-fill memory that has only been read.
+ * @return Physical address of the zero page, or 0 on failure
+ */
+physaddr_t vmm_get_zero_page(void);
+
+/**
+ * Install a 4KB user page in an address space
+ * The caller's reference on frame passes to the mapping. If the page is
+ * already mapped (a racing fault) or swapped out, the reference is
+ * dropped instead.
+ * @param pml4 Address space
+ * @param virt Page-aligned user address
+ * @param frame Frame to map
+ * @param flags Page flags (VMM_FLAG_*)
+ * @return true if virt is now mapped
+ */
+bool vmm_map_user_page(physaddr_t pml4, virtaddr_t virt, physaddr_t frame, uint64_t flags);
+
+/**
+ * Remove user pages from an address space, dropping their frame references
+ * @param pml4 Address space
+ * @param virt Page-aligned start address
+ * @param count Number of pages
+ */
+void vmm_unmap_user_range(physaddr_t pml4, virtaddr_t virt, size_t count);
+
+/**
+ * Install a 4KB user page in place of whatever is mapped there
+ * Like vmm_map_user_page, but a present page is replaced and its frame
+ * reference dropped, in one step with respect to faults on the page.
+ * A VMM_FLAG_SHARED page is never replaced.
+ * @param pml4 Address space
+ * @param virt Page-aligned user address
+ * @param frame Frame to map (the caller's reference passes to the mapping)
+ * @param flags Page flags (VMM_FLAG_*)
+ * @return true if virt now maps frame
+ */
+bool vmm_replace_user_page(physaddr_t pml4, virtaddr_t virt, physaddr_t frame, uint64_t flags);
+
+/**
+ * Take a reference on a present 4KB user page, to pass it on by reference
+ * A writable page is turned copy-on-write, so later writes through this
+ * mapping go to a private copy and the shared frame stays as it was.
+ * @param pml4 Address space
+ * @param virt User address within the page
+ * @return Referenced frame, or 0 if no 4KB user page is mapped there (or
+ *         it is VMM_FLAG_SHARED memory, which has no private copy to make)
+ */
+physaddr_t vmm_share_user_page(physaddr_t pml4, virtaddr_t virt);
+
+/**
+ * Copy-on-write statistics
+ */
+typedef struct vmm_cow_stats {
+    uint64_t clones;                /* Address spaces cloned */
+    uint64_t shared_pages;          /* User pages shared by clones */
+    uint64_t copied_pages;          /* Pages copied on first write */
+    uint64_t reused_pages;          /* Write faults that found the last owner */
+} vmm_cow_stats_t;
+
+/**
+ * Get copy-on-write statistics
+ */
+void vmm_get_cow_stats(vmm_cow_stats_t *stats);
+
 /**
  * Destroy an address space and free all page tables
+ * Tables and pages under user PML4 entries are released (shared frames
+ * drop one reference); entries shared with the kernel are left alone.
+ * The PML4 page is kept for the next create or clone while the cache
+ * has room.
  * @param pml4_phys Physical address of PML4 to destroy
  */
 void vmm_destroy_address_space(physaddr_t pml4_phys);
 
 /**
  * Switch to a different address space
+ * With PCIDs each recently used address space keeps its own tag, and the
+ * switch leaves its TLB entries in place unless they may be stale.
  * @param pml4_phys Physical address of new PML4
  */
 void vmm_switch_address_space(physaddr_t pml4_phys);
 
+/**
+ * PCID statistics
+ */
+typedef struct vmm_pcid_stats {
+    bool enabled;                   /* CPU supports PCIDs and they are on */
+    uint64_t hits;                  /* Switches to an address space that kept its PCID */
+    uint64_t misses;                /* Switches that had to assign a PCID */
+    uint64_t evictions;             /* Misses that took a PCID from another address space */
+    uint64_t flushes;               /* Switches that flushed the PCID's entries */
+} vmm_pcid_stats_t;
+
+/**
+ * Get PCID statistics
+ */
+void vmm_get_pcid_stats(vmm_pcid_stats_t *stats);
+
 /**
  * Get current address space (current CR3 value)
  * @return Physical address of current PML4
@@ -150,6 +343,7 @@ void vmm_invalidate_page(virtaddr_t virt);
 
 /**
  * Flush entire TLB (reload CR3)
+ * With PCIDs only the current address space's entries are flushed.
  */
 void vmm_flush_tlb(void);
 
@@ -167,4 +361,63 @@ bool vmm_is_mapped(virtaddr_t virt);
  */
 physaddr_t vmm_get_kernel_pml4(void);
 
+/**
+ * Swap backend: keeps the contents of user pages the VMM evicts
+ * Slots are numbered from 1 to at most VMM_SWAP_SLOT_MAX. Every call is
+ * made under the VMM lock, so none may touch page tables or sleep.
+ */
+typedef struct vmm_swap_ops {
+    /* Keep a copy of a page; returns its slot, or 0 to leave the page resident */
+    uint64_t (*store)(const void *page);
+    /* Fill page from a slot and drop one reference on it; false on failure */
+    bool (*load)(uint64_t slot, void *page);
+    void (*ref)(uint64_t slot);         /* A clone took another reference */
+    void (*unref)(uint64_t slot);       /* An entry holding the slot went away */
+} vmm_swap_ops_t;
+
+/**
+ * Swap statistics
+ */
+typedef struct vmm_swap_stats {
+    uint64_t scanned;               /* User entries looked at by vmm_swap_out */
+    uint64_t aged;                  /* Recently used pages given another pass */
+    uint64_t busy;                  /* Evictions undone: address space loaded elsewhere */
+    uint64_t swapped_out;           /* Pages handed to the backend */
+    uint64_t swapped_in;            /* Pages brought back on fault */
+} vmm_swap_stats_t;
+
+/**
+ * Install the swap backend (once)
+ * @return false if one is installed already
+ */
+bool vmm_set_swap_ops(const vmm_swap_ops_t *ops);
+
+/**
+ * Evict cold user pages to the swap backend
+ * A clock hand sweeps the 4KB pages of every user address space. Pages
+ * used since the hand last passed lose their accessed bit and stay; pages
+ * that are private (one frame reference, not VMM_FLAG_SHARED, ordinary
+ * memory type) and unused go to the backend, and their frames are freed.
+ * Address spaces loaded on another CPU are skipped, since that CPU's TLB
+ * can still reach their pages.
+ * @param pages Most pages to evict
+ * @return Pages evicted
+ */
+size_t vmm_swap_out(size_t pages);
+
+/**
+ * Get swap statistics
+ */
+void vmm_get_swap_stats(vmm_swap_stats_t *stats);
+
+/**
+ * Make sure the kernel PML4 entry covering virt has a PDPT
+ * Upper-half PML4 entries are copied into each new address space, so a
+ * kernel region that will be populated later must have its PDPT in place
+ * before any address space is created.
+ * @param virt Any address in the region
+ * @return true on success, false if a table could not be allocated
+ */
+bool vmm_prepare_kernel_range(virtaddr_t virt);
+
 #endif /* _AAAOS_MM_VMM_H */
@@ -0,0 +1,446 @@
+/**
+ * AAAos Kernel - Compressed RAM Swap
+ *
+ * Each stored page has a slot: where its compressed bytes are, their
+ * size, and how many page table entries refer to it (a fork shares the
+ * slot until one side faults the page back). Slots live in a table of
+ * PMM frames filled on demand and are recycled through a free list.
+ *
+ * Compressed bytes go in pool frames, each split into 64 chunks with a
+ * bitmap of the used ones in the first chunk. A page takes a run of
+ * chunks inside one frame, found first-fit among the few most recently
+ * freed-into frames; a frame whose chunks all come free goes back to the
+ * PMM at once. All of it sits under one lock, only ever taken from the
+ * VMM with its own lock held.
+ */
+
+#include "zram.h"
+#include "lz4.h"
+#include "pmm.h"
+#include "reclaim.h"
+#include "vmm.h"
+#include "../include/serial.h"
+#include "../init/initcall.h"
+#include "../sched/clock.h"
+#include "../sched/spinlock.h"
+#include "../stats/kstat.h"
+
+/* Slot table: frames of slots, enough for 1GB of swapped pages */
+#define ZRAM_SLOTS_PER_PAGE     (PAGE_SIZE / sizeof(zram_slot_t))
+#define ZRAM_TABLE_PAGES        1024
+#define ZRAM_MAX_SLOTS          (ZRAM_TABLE_PAGES * ZRAM_SLOTS_PER_PAGE)
+
+/* Partly used pool frames tried before taking a new one */
+#define ZRAM_FIT_TRIES          8
+
+/* After a scan that evicted nothing, the shrinker rests this long */
+#define ZRAM_IDLE_MS            1000
+
+/**
+ * Header in the first chunk of a pool frame
+ */
+typedef struct zram_page {
+    uint64_t used;                      /* Chunk bitmap; bit 0 is this header */
+    struct zram_page *prev;             /* Frames with free chunks */
+    struct zram_page *next;
+} zram_page_t;
+
+/**
+ * Stored page
+ */
+typedef struct zram_slot {
+    uint64_t where;                     /* First chunk; next free slot while free */
+    uint32_t refs;                      /* Entries holding it, 0 while free */
+    uint16_t size;                      /* Compressed bytes, 0 for an all-zero page */
+} zram_slot_t;
+
+LOCK_CLASS(zram, "mm.zram");
+static spinlock_t zram_lock = SPINLOCK_INIT(LOCK_CLASS_OF(zram));
+
+static zram_slot_t *zram_table[ZRAM_TABLE_PAGES];
+static uint64_t zram_free_slot = 0;         /* Head of the freed slots */
+static uint64_t zram_next_slot = 1;         /* First never used slot; 0 means none */
+static zram_page_t *zram_partial = NULL;    /* Pool frames with free chunks, freed-into first */
+static zram_stats_t zram_stats;
+
+/* Compression output and match finder (protected by zram_lock) */
+static uint8_t zram_buffer[ZRAM_MAX_STORED] ALIGNED(8);
+static uint16_t zram_lz4_state[LZ4_STATE_SIZE / sizeof(uint16_t)];
+
+/* Shrinker rest after a fruitless scan (clock_monotonic_ms) */
+static bool zram_resting = false;
+static uint64_t zram_rest_start = 0;
+
+static uint64_t zram_stored_gauge(void) {
+    return zram_stats.stored_pages;
+}
+
+static uint64_t zram_pool_gauge(void) {
+    return zram_stats.pool_pages;
+}
+
+/**
+ * Bytes of the pages held per byte of pool, in percent
+ */
+static uint64_t zram_ratio_gauge(void) {
+    uint64_t stored = zram_stats.stored_pages;
+    uint64_t pool = zram_stats.pool_pages;
+    return pool ? stored * 100 / pool : 0;
+}
+
+KSTAT_GAUGE(zram_stored, "mm.zram.stored_pages", "Pages held compressed", zram_stored_gauge);
+KSTAT_GAUGE(zram_pool, "mm.zram.pool_pages", "Frames holding compressed pages", zram_pool_gauge);
+KSTAT_GAUGE(zram_ratio, "mm.zram.ratio_pct",
+            "Pages held per pool frame, in percent", zram_ratio_gauge);
+KSTAT_COUNTER(zram_rejected, "mm.zram.rejected", "Pages that did not compress enough");
+KSTAT_HISTOGRAM(zram_store_ns, "mm.zram.store_ns", "Nanoseconds to compress and store a page");
+KSTAT_HISTOGRAM(zram_fault_ns, "mm.zram.fault_ns",
+                "Nanoseconds to bring a page back on fault");
+
+/**
+ * Find a run of free chunks in a pool frame
+ * @return First chunk of the run, or -1 if there is none
+ */
+static int zram_find_run(uint64_t used, uint32_t chunks) {
+    /* Bit k survives round i if chunks k..k+i are all free */
+    uint64_t runs = ~used;
+    for (uint32_t i = 1; i < chunks && runs; i++) {
+        runs &= runs >> 1;
+    }
+    return runs ? __builtin_ctzll(runs) : -1;
+}
+
+static inline uint64_t zram_chunk_mask(uint32_t first, uint32_t chunks) {
+    return ((1ULL << chunks) - 1) << first;
+}
+
+static void zram_unlink(zram_page_t *zp) {
+    if (zp->prev) {
+        zp->prev->next = zp->next;
+    } else {
+        zram_partial = zp->next;
+    }
+    if (zp->next) {
+        zp->next->prev = zp->prev;
+    }
+}
+
+static void zram_link(zram_page_t *zp) {
+    zp->prev = NULL;
+    zp->next = zram_partial;
+    if (zram_partial) {
+        zram_partial->prev = zp;
+    }
+    zram_partial = zp;
+}
+
+/**
+ * Take a run of chunks from a pool frame
+ */
+static void *zram_take(zram_page_t *zp, uint32_t first, uint32_t chunks) {
+    zp->used |= zram_chunk_mask(first, chunks);
+    if (zp->used == UINT64_MAX) {
+        zram_unlink(zp);
+    }
+    return (uint8_t*)zp + first * ZRAM_CHUNK_SIZE;
+}
+
+/**
+ * Allocate pool space for size compressed bytes
+ * @return The space, or NULL if the pool is at its limit or memory is out
+ */
+static void *zram_pool_alloc(size_t size) {
+    uint32_t chunks = (uint32_t)((size + ZRAM_CHUNK_SIZE - 1) / ZRAM_CHUNK_SIZE);
+
+    uint32_t tries = 0;
+    for (zram_page_t *zp = zram_partial; zp && tries < ZRAM_FIT_TRIES; zp = zp->next, tries++) {
+        int first = zram_find_run(zp->used, chunks);
+        if (first >= 0) {
+            return zram_take(zp, (uint32_t)first, chunks);
+        }
+    }
+
+    if (zram_stats.pool_pages >= zram_stats.limit_pages) {
+        return NULL;
+    }
+    physaddr_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return NULL;
+    }
+
+    /* Like the slab allocator, this assumes physical memory is identity mapped */
+    zram_page_t *zp = (zram_page_t*)phys;
+    zp->used = 1;
+    zram_link(zp);
+    zram_stats.pool_pages++;
+    return zram_take(zp, 1, chunks);
+}
+
+/**
+ * Return pool space, and its frame once nothing else is stored there
+ */
+static void zram_pool_free(void *obj, size_t size) {
+    zram_page_t *zp = (zram_page_t*)ALIGN_DOWN((uintptr_t)obj, PAGE_SIZE);
+    uint32_t first = (uint32_t)(((uintptr_t)obj % PAGE_SIZE) / ZRAM_CHUNK_SIZE);
+    uint32_t chunks = (uint32_t)((size + ZRAM_CHUNK_SIZE - 1) / ZRAM_CHUNK_SIZE);
+
+    bool was_full = zp->used == UINT64_MAX;
+    zp->used &= ~zram_chunk_mask(first, chunks);
+
+    if (zp->used == 1) {
+        if (!was_full) {
+            zram_unlink(zp);
+        }
+        pmm_free_page((physaddr_t)zp);
+        zram_stats.pool_pages--;
+        return;
+    }
+
+    /* Fresh space goes to the front, where allocations look first */
+    if (!was_full) {
+        zram_unlink(zp);
+    }
+    zram_link(zp);
+}
+
+/**
+ * Look up a slot that holds a page
+ */
+static zram_slot_t *zram_slot(uint64_t id) {
+    if (id == 0 || id >= zram_next_slot) {
+        return NULL;
+    }
+    zram_slot_t *slot = &zram_table[id / ZRAM_SLOTS_PER_PAGE][id % ZRAM_SLOTS_PER_PAGE];
+    return slot->refs ? slot : NULL;
+}
+
+/**
+ * Get a free slot, growing the table if needed
+ * @return Slot number, or 0 if there is none
+ */
+static uint64_t zram_slot_alloc(void) {
+    uint64_t id = zram_free_slot;
+    if (id != 0) {
+        zram_free_slot = zram_table[id / ZRAM_SLOTS_PER_PAGE][id % ZRAM_SLOTS_PER_PAGE].where;
+        return id;
+    }
+
+    id = zram_next_slot;
+    if (id >= ZRAM_MAX_SLOTS) {
+        return 0;
+    }
+    size_t page = id / ZRAM_SLOTS_PER_PAGE;
+    if (zram_table[page] == NULL) {
+        physaddr_t phys = pmm_alloc_page();
+        if (phys == 0) {
+            return 0;
+        }
+        uint64_t *words = (uint64_t*)phys;
+        for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+            words[i] = 0;
+        }
+        zram_table[page] = (zram_slot_t*)phys;
+        zram_stats.table_pages++;
+    }
+    zram_next_slot++;
+    return id;
+}
+
+/**
+ * Drop one reference on a slot, freeing its page when it was the last
+ */
+static void zram_put(uint64_t id, zram_slot_t *slot) {
+    if (--slot->refs > 0) {
+        return;
+    }
+
+    if (slot->size) {
+        zram_pool_free((void*)(uintptr_t)slot->where, slot->size);
+    } else {
+        zram_stats.zero_pages--;
+    }
+    zram_stats.stored_pages--;
+    zram_stats.compressed_bytes -= slot->size;
+
+    slot->where = zram_free_slot;
+    zram_free_slot = id;
+}
+
+static bool zram_page_is_zero(const uint64_t *words) {
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Swap backend store: compress a page into the pool
+ */
+static uint64_t zram_store(const void *page) {
+    uint64_t start = clock_cycles();
+    spinlock_acquire(&zram_lock);
+
+    uint64_t id = zram_slot_alloc();
+    if (id == 0) {
+        zram_stats.full++;
+        spinlock_release(&zram_lock);
+        return 0;
+    }
+    zram_slot_t *slot = &zram_table[id / ZRAM_SLOTS_PER_PAGE][id % ZRAM_SLOTS_PER_PAGE];
+
+    size_t size = 0;
+    uint64_t where = 0;
+    if (!zram_page_is_zero(page)) {
+        size = lz4_compress(page, PAGE_SIZE, zram_buffer, sizeof(zram_buffer), zram_lz4_state);
+        uint8_t *obj = size ? zram_pool_alloc(size) : NULL;
+        if (obj == NULL) {
+            if (size) {
+                zram_stats.full++;
+            } else {
+                zram_stats.rejected++;
+                kstat_inc(zram_rejected);
+            }
+            slot->where = zram_free_slot;
+            zram_free_slot = id;
+            spinlock_release(&zram_lock);
+            return 0;
+        }
+        for (size_t i = 0; i < size; i++) {
+            obj[i] = zram_buffer[i];
+        }
+        where = (uintptr_t)obj;
+    } else {
+        zram_stats.zero_pages++;
+    }
+
+    slot->where = where;
+    slot->size = (uint16_t)size;
+    slot->refs = 1;
+    zram_stats.stored_pages++;
+    zram_stats.compressed_bytes += size;
+    zram_stats.stores++;
+
+    spinlock_release(&zram_lock);
+    kstat_observe(zram_store_ns, clock_cycles_to_ns(clock_cycles() - start));
+    return id;
+}
+
+/**
+ * Swap backend load: decompress a page and drop the entry's reference
+ */
+static bool zram_load(uint64_t id, void *page) {
+    uint64_t start = clock_cycles();
+    spinlock_acquire(&zram_lock);
+
+    zram_slot_t *slot = zram_slot(id);
+    bool ok = slot != NULL;
+    if (ok && slot->size == 0) {
+        uint64_t *words = page;
+        for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+            words[i] = 0;
+        }
+    } else if (ok) {
+        ok = lz4_decompress((const void*)(uintptr_t)slot->where, slot->size,
+                            page, PAGE_SIZE) == PAGE_SIZE;
+    }
+    if (ok) {
+        zram_put(id, slot);
+        zram_stats.loads++;
+    }
+
+    spinlock_release(&zram_lock);
+    if (ok) {
+        kstat_observe(zram_fault_ns, clock_cycles_to_ns(clock_cycles() - start));
+    }
+    return ok;
+}
+
+static void zram_ref(uint64_t id) {
+    spinlock_acquire(&zram_lock);
+    zram_slot_t *slot = zram_slot(id);
+    if (slot) {
+        slot->refs++;
+    }
+    spinlock_release(&zram_lock);
+}
+
+static void zram_unref(uint64_t id) {
+    spinlock_acquire(&zram_lock);
+    zram_slot_t *slot = zram_slot(id);
+    if (slot) {
+        zram_put(id, slot);
+    }
+    spinlock_release(&zram_lock);
+}
+
+static const vmm_swap_ops_t zram_ops = {
+    .store = zram_store,
+    .load = zram_load,
+    .ref = zram_ref,
+    .unref = zram_unref,
+};
+
+/**
+ * Pages the shrinker offers to evict; the VMM finds out which
+ */
+static size_t zram_shrink_count(void) {
+    if (zram_stats.pool_pages >= zram_stats.limit_pages) {
+        return 0;
+    }
+    if (zram_resting && clock_monotonic_ms() - zram_rest_start < ZRAM_IDLE_MS) {
+        return 0;
+    }
+    return RECLAIM_BATCH;
+}
+
+static size_t zram_shrink_scan(size_t count) {
+    size_t evicted = vmm_swap_out(count);
+    zram_resting = evicted == 0;
+    if (zram_resting) {
+        zram_rest_start = clock_monotonic_ms();
+    }
+    return evicted;
+}
+
+static shrinker_t zram_shrinker = {
+    .name = "mm.zram",
+    .count = zram_shrink_count,
+    .scan = zram_shrink_scan,
+};
+
+void zram_set_limit(size_t pages) {
+    spinlock_acquire(&zram_lock);
+    zram_stats.limit_pages = pages;
+    spinlock_release(&zram_lock);
+}
+
+void zram_get_stats(zram_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    spinlock_acquire(&zram_lock);
+    *stats = zram_stats;
+    spinlock_release(&zram_lock);
+}
+
+/**
+ * Become the VMM's swap backend and offer evictions to reclaim
+ */
+static bool zram_initcall(void) {
+    zram_set_limit(pmm_get_total_pages() / ZRAM_LIMIT_DIVISOR);
+
+    if (!vmm_set_swap_ops(&zram_ops)) {
+        kprintf("[ZRAM] Error: The VMM has a swap backend already\n");
+        return false;
+    }
+    shrinker_register(&zram_shrinker);
+
+    kprintf("[ZRAM] Compressed swap ready, pool limit %llu pages\n",
+            (uint64_t)zram_stats.limit_pages);
+    return true;
+}
+
+INITCALL(zram, zram_initcall, 0);
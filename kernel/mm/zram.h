@@ -0,0 +1,60 @@
+/**
+ * AAAos Kernel - Compressed RAM Swap
+ *
+ * The VMM's swap backend (vmm_swap_ops_t), for machines with no swap
+ * device: evicted user pages are compressed with LZ4 and packed into a
+ * pool of PMM frames at ZRAM_CHUNK_SIZE granularity, so a cold page
+ * costs a fraction of a frame until it is touched again. All-zero pages
+ * take no pool space at all, and pages that do not compress to
+ * ZRAM_MAX_STORED bytes stay resident, since storing them would save too
+ * little. The pool grows to at most a ZRAM_LIMIT_DIVISOR-th of memory.
+ *
+ * Eviction is driven by memory pressure: the "mm.zram" shrinker has the
+ * reclaim thread (reclaim.h) run vmm_swap_out. The "mm.zram.*" metrics
+ * (kstat.h) give the compression ratio and the time to store a page and
+ * to bring one back on fault.
+ */
+
+#ifndef _AAAOS_MM_ZRAM_H
+#define _AAAOS_MM_ZRAM_H
+
+#include "../include/types.h"
+
+/* Pool allocation unit; a pool frame has 64 chunks, one of them its header */
+#define ZRAM_CHUNK_SIZE         64
+
+/* Largest compressed page worth keeping (3/4 of a page) */
+#define ZRAM_MAX_STORED         3072
+
+/* Default pool limit: total memory divided by this */
+#define ZRAM_LIMIT_DIVISOR      4
+
+/**
+ * Compressed swap statistics
+ */
+typedef struct zram_stats {
+    uint64_t stored_pages;          /* Pages held, including zero pages */
+    uint64_t zero_pages;            /* Held pages that were all zero */
+    uint64_t compressed_bytes;      /* Compressed size of the held pages */
+    uint64_t pool_pages;            /* Frames holding compressed data */
+    uint64_t table_pages;           /* Frames holding the slot table */
+    uint64_t limit_pages;           /* Most frames the pool may take */
+    uint64_t stores;                /* Pages stored */
+    uint64_t loads;                 /* Pages brought back */
+    uint64_t rejected;              /* Pages that did not compress enough */
+    uint64_t full;                  /* Stores refused for lack of pool or slots */
+} zram_stats_t;
+
+/**
+ * Set the most frames the pool may take
+ * Already stored pages are kept if the pool is above the new limit.
+ * @param pages Frame limit (0 stops new stores)
+ */
+void zram_set_limit(size_t pages);
+
+/**
+ * Get compressed swap statistics
+ */
+void zram_get_stats(zram_stats_t *stats);
+
+#endif /* _AAAOS_MM_ZRAM_H */
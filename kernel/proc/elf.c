@@ -10,34 +10,12 @@
 #include "../include/serial.h"
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
+#include "process.h"
 
 /* ============================================================================
  * Internal Helper Functions
  * ============================================================================ */
 
-/**
- * Simple memcpy implementation for ELF loading
- */
-static void* elf_memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
-    }
-    return dest;
-}
-
-/**
- * Simple memset implementation for BSS zeroing
- */
-static void* elf_memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-    while (n--) {
-        *p++ = (uint8_t)c;
-    }
-    return s;
-}
-
 /**
  * Simple strlen for interpreter path
  */
@@ -293,6 +271,218 @@ const elf64_shdr_t* elf_find_section(const void *data, const char *name) {
     return NULL;
 }
 
+/* ============================================================================
+ * Dynamic Section Functions
+ * ============================================================================ */
+
+/**
+ * Tables named by PT_DYNAMIC, as pointers into the file image
+ */
+typedef struct {
+    const elf64_sym_t *symtab;
+    const char *strtab;
+    const uint32_t *gnu_hash;
+    const uint32_t *sysv_hash;
+    const elf64_rela_t *rela;
+    size_t rela_size;
+    size_t rela_relative;               /* DT_RELACOUNT */
+    const elf64_rela_t *jmprel;
+    size_t jmprel_size;
+    const uint64_t *relr;
+    size_t relr_size;
+} elf_dynamic_t;
+
+/**
+ * Translate a link-time address to its bytes in the file image
+ * @return Pointer into the file, or NULL if the range is not file-backed
+ */
+static const void* elf_vaddr_to_file(const void *data, uint64_t vaddr, size_t size) {
+    const elf64_header_t *hdr = elf_get_header(data);
+
+    /* Absent tags read as 0, which is the ELF header in a PIE */
+    if (vaddr == 0) {
+        return NULL;
+    }
+
+    for (uint16_t i = 0; i < hdr->e_phnum; i++) {
+        const elf64_phdr_t *phdr = elf_get_phdr(data, i);
+        if (phdr->p_type == PT_LOAD && vaddr >= phdr->p_vaddr &&
+            vaddr - phdr->p_vaddr <= phdr->p_filesz &&
+            size <= phdr->p_filesz - (vaddr - phdr->p_vaddr)) {
+            return (const uint8_t *)data + phdr->p_offset + (vaddr - phdr->p_vaddr);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Collect the tables of the dynamic section
+ * @return false if there is no PT_DYNAMIC segment
+ */
+static bool elf_parse_dynamic(const void *data, elf_dynamic_t *dyn) {
+    const elf64_header_t *hdr = elf_get_header(data);
+    const elf64_phdr_t *dynamic_phdr = NULL;
+
+    for (uint16_t i = 0; i < hdr->e_phnum; i++) {
+        const elf64_phdr_t *phdr = elf_get_phdr(data, i);
+        if (phdr->p_type == PT_DYNAMIC) {
+            dynamic_phdr = phdr;
+            break;
+        }
+    }
+
+    uint8_t *p = (uint8_t *)dyn;
+    for (size_t i = 0; i < sizeof(*dyn); i++) {
+        p[i] = 0;
+    }
+
+    if (!dynamic_phdr) {
+        return false;
+    }
+
+    uint64_t symtab = 0, strtab = 0, gnu_hash = 0, sysv_hash = 0;
+    uint64_t rela = 0, jmprel = 0, relr = 0;
+    uint64_t rela_ent = sizeof(elf64_rela_t), relr_ent = sizeof(uint64_t);
+
+    const elf64_dyn_t *d = (const elf64_dyn_t *)((const uint8_t *)data +
+                                                  dynamic_phdr->p_offset);
+    size_t count = dynamic_phdr->p_filesz / sizeof(elf64_dyn_t);
+
+    for (size_t i = 0; i < count && d[i].d_tag != DT_NULL; i++) {
+        switch (d[i].d_tag) {
+            case DT_SYMTAB:     symtab = d[i].d_un.d_ptr; break;
+            case DT_STRTAB:     strtab = d[i].d_un.d_ptr; break;
+            case DT_GNU_HASH:   gnu_hash = d[i].d_un.d_ptr; break;
+            case DT_HASH:       sysv_hash = d[i].d_un.d_ptr; break;
+            case DT_RELA:       rela = d[i].d_un.d_ptr; break;
+            case DT_RELASZ:     dyn->rela_size = d[i].d_un.d_val; break;
+            case DT_RELAENT:    rela_ent = d[i].d_un.d_val; break;
+            case DT_RELACOUNT:  dyn->rela_relative = d[i].d_un.d_val; break;
+            case DT_JMPREL:     jmprel = d[i].d_un.d_ptr; break;
+            case DT_PLTRELSZ:   dyn->jmprel_size = d[i].d_un.d_val; break;
+            case DT_RELR:       relr = d[i].d_un.d_ptr; break;
+            case DT_RELRSZ:     dyn->relr_size = d[i].d_un.d_val; break;
+            case DT_RELRENT:    relr_ent = d[i].d_un.d_val; break;
+        }
+    }
+
+    if (rela_ent != sizeof(elf64_rela_t) || relr_ent != sizeof(uint64_t)) {
+        kprintf("[ELF] Warning: Unexpected relocation entry size, skipping relocations\n");
+        dyn->rela_size = dyn->jmprel_size = dyn->relr_size = 0;
+    }
+
+    /* Sizes of the symbol and hash tables are not recorded; check the start */
+    dyn->symtab = elf_vaddr_to_file(data, symtab, sizeof(elf64_sym_t));
+    dyn->strtab = elf_vaddr_to_file(data, strtab, 1);
+    dyn->gnu_hash = elf_vaddr_to_file(data, gnu_hash, 4 * sizeof(uint32_t));
+    dyn->sysv_hash = elf_vaddr_to_file(data, sysv_hash, 2 * sizeof(uint32_t));
+    dyn->rela = elf_vaddr_to_file(data, rela, dyn->rela_size);
+    dyn->jmprel = elf_vaddr_to_file(data, jmprel, dyn->jmprel_size);
+    dyn->relr = elf_vaddr_to_file(data, relr, dyn->relr_size);
+    return true;
+}
+
+/**
+ * Symbol lookup through a DT_GNU_HASH table
+ * Layout: nbuckets, symoffset, bloom_size, bloom_shift, the 64-bit bloom
+ * words, the buckets, then one chain word per hashed symbol whose low
+ * bit marks the end of a bucket's chain.
+ */
+static const elf64_sym_t* elf_gnu_lookup(const elf_dynamic_t *dyn, const char *name) {
+    const uint32_t *ht = dyn->gnu_hash;
+    uint32_t nbuckets = ht[0], symoffset = ht[1], bloom_size = ht[2], bloom_shift = ht[3];
+    const uint64_t *bloom = (const uint64_t *)&ht[4];
+    const uint32_t *buckets = (const uint32_t *)&bloom[bloom_size];
+    const uint32_t *chain = &buckets[nbuckets];
+
+    if (nbuckets == 0 || bloom_size == 0) {
+        return NULL;
+    }
+
+    uint32_t h = 5381;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+        h = h * 33 + *c;
+    }
+
+    /* The filter rejects most absent names without touching the chains */
+    uint64_t word = bloom[(h / 64) % bloom_size];
+    uint64_t mask = (1ULL << (h % 64)) | (1ULL << ((h >> bloom_shift) % 64));
+    if ((word & mask) != mask) {
+        return NULL;
+    }
+
+    uint32_t index = buckets[h % nbuckets];
+    if (index < symoffset) {
+        return NULL;
+    }
+
+    for (;; index++) {
+        uint32_t chain_hash = chain[index - symoffset];
+        if ((chain_hash | 1) == (h | 1) &&
+            elf_strcmp(name, dyn->strtab + dyn->symtab[index].st_name) == 0) {
+            return &dyn->symtab[index];
+        }
+        if (chain_hash & 1) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Symbol lookup through a SysV DT_HASH table
+ * Layout: nbucket, nchain, the buckets, then the chains.
+ */
+static const elf64_sym_t* elf_sysv_lookup(const elf_dynamic_t *dyn, const char *name) {
+    const uint32_t *ht = dyn->sysv_hash;
+    uint32_t nbucket = ht[0], nchain = ht[1];
+    const uint32_t *buckets = &ht[2];
+    const uint32_t *chain = &buckets[nbucket];
+
+    if (nbucket == 0) {
+        return NULL;
+    }
+
+    uint32_t h = 0;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+        h = (h << 4) + *c;
+        uint32_t g = h & 0xF0000000;
+        if (g) {
+            h ^= g >> 24;
+        }
+        h &= ~g;
+    }
+
+    for (uint32_t index = buckets[h % nbucket]; index != 0 && index < nchain;
+         index = chain[index]) {
+        if (elf_strcmp(name, dyn->strtab + dyn->symtab[index].st_name) == 0) {
+            return &dyn->symtab[index];
+        }
+    }
+    return NULL;
+}
+
+bool elf_find_symbol(const void *data, const char *name, uint64_t *value) {
+    elf_dynamic_t dyn;
+
+    if (!elf_get_header(data) || !name || !value ||
+        !elf_parse_dynamic(data, &dyn) || !dyn.symtab || !dyn.strtab) {
+        return false;
+    }
+
+    const elf64_sym_t *sym = NULL;
+    if (dyn.gnu_hash) {
+        sym = elf_gnu_lookup(&dyn, name);
+    } else if (dyn.sysv_hash) {
+        sym = elf_sysv_lookup(&dyn, name);
+    }
+
+    if (!sym || sym->st_shndx == SHN_UNDEF) {
+        return false;
+    }
+    *value = sym->st_value;
+    return true;
+}
+
 /* ============================================================================
  * Segment Loading Functions
  * ============================================================================ */
@@ -310,8 +500,6 @@ elf_error_t elf_load_segment(const elf64_phdr_t *phdr, const void *file_data,
 
     /* Calculate virtual address with base offset */
     virtaddr_t vaddr = phdr->p_vaddr + base_addr;
-    virtaddr_t vaddr_aligned = ALIGN_DOWN(vaddr, PAGE_SIZE);
-    size_t page_offset = vaddr - vaddr_aligned;
 
     /* Calculate memory size (must be at least file size) */
     size_t memsz = phdr->p_memsz;
@@ -322,12 +510,8 @@ elf_error_t elf_load_segment(const elf64_phdr_t *phdr, const void *file_data,
         return ELF_SUCCESS;
     }
 
-    /* Calculate number of pages needed */
-    size_t total_size = page_offset + memsz;
-    size_t num_pages = ALIGN_UP(total_size, PAGE_SIZE) / PAGE_SIZE;
-
-    kprintf("[ELF] Loading segment: vaddr=0x%llx, filesz=%llu, memsz=%llu, pages=%llu\n",
-            vaddr, (uint64_t)filesz, (uint64_t)memsz, (uint64_t)num_pages);
+    kprintf("[ELF] Mapping segment: vaddr=0x%llx, filesz=%llu, memsz=%llu (on demand)\n",
+            vaddr, (uint64_t)filesz, (uint64_t)memsz);
 
     /* Get VMM flags for this segment */
     uint64_t vmm_flags = elf_flags_to_vmm(phdr->p_flags);
@@ -338,47 +522,24 @@ elf_error_t elf_load_segment(const elf64_phdr_t *phdr, const void *file_data,
             (phdr->p_flags & PF_X) ? 'X' : '-',
             vmm_flags);
 
-    /* Allocate and map pages */
-    for (size_t i = 0; i < num_pages; i++) {
-        virtaddr_t page_vaddr = vaddr_aligned + (i * PAGE_SIZE);
-
-        /* Check if page is already mapped */
-        if (vmm_is_mapped(page_vaddr)) {
-            kprintf("[ELF]   Page 0x%llx already mapped, skipping allocation\n",
-                    page_vaddr);
-            continue;
-        }
-
-        /* Allocate a physical page */
-        physaddr_t page_phys = pmm_alloc_page();
-        if (page_phys == 0) {
-            kprintf("[ELF] ERROR: Failed to allocate physical page\n");
-            return ELF_ERR_OUT_OF_MEMORY;
-        }
-
-        /* Map the page */
-        if (!vmm_map_page(page_vaddr, page_phys, vmm_flags)) {
-            kprintf("[ELF] ERROR: Failed to map page 0x%llx -> 0x%llx\n",
-                    page_vaddr, page_phys);
-            pmm_free_page(page_phys);
-            return ELF_ERR_MAPPING_FAILED;
-        }
-
-        /* Zero the page initially */
-        elf_memset((void *)page_vaddr, 0, PAGE_SIZE);
+    /*
+     * Record the segment as a VMA of the current process instead of
+     * copying it. Pages are filled from the file image on first touch,
+     * and pages only read are shared with every other process running
+     * the same image (through the page cache; writable ones copy on
+     * write). The BSS part (memsz > filesz) reads as the shared zero page
+     * until written.
+     */
+    process_t *proc = process_get_current();
+    if (proc == NULL) {
+        kprintf("[ELF] ERROR: No current process to map segment into\n");
+        return ELF_ERR_MAPPING_FAILED;
     }
 
-    /* Copy segment data from file */
-    if (filesz > 0) {
-        const uint8_t *src = (const uint8_t *)file_data + phdr->p_offset;
-        elf_memcpy((void *)vaddr, src, filesz);
-        kprintf("[ELF]   Copied %llu bytes from file offset 0x%llx\n",
-                (uint64_t)filesz, phdr->p_offset);
-    }
-
-    /* BSS portion (memsz > filesz) is already zeroed from memset above */
-    if (memsz > filesz) {
-        kprintf("[ELF]   BSS: %llu bytes zeroed\n", (uint64_t)(memsz - filesz));
+    const uint8_t *src = (const uint8_t *)file_data + phdr->p_offset;
+    if (!vma_map_image(process_vmas(proc), vaddr, memsz, src, filesz, vmm_flags)) {
+        kprintf("[ELF] ERROR: Failed to map segment at 0x%llx\n", vaddr);
+        return ELF_ERR_MAPPING_FAILED;
     }
 
     return ELF_SUCCESS;
@@ -444,92 +605,121 @@ static void elf_process_interp(const void *data, elf_load_info_t *info) {
 }
 
 /**
- * Apply relocations for PIE executable
+ * Apply one table of RELA relocations
+ * The leading 'relative' entries are known to be R_X86_64_RELATIVE
+ * (DT_RELACOUNT) and take a loop without any type dispatch.
+ * @return Number of relocations that could not be applied
  */
-static elf_error_t elf_apply_relocations(const void *data, virtaddr_t base_addr) {
-    const elf64_header_t *hdr = elf_get_header(data);
+static size_t elf_apply_rela(const elf_dynamic_t *dyn, const elf64_rela_t *rela,
+                             size_t count, size_t relative, virtaddr_t base_addr) {
+    size_t i = 0;
+    size_t failed = 0;
 
-    /* Find PT_DYNAMIC segment */
-    const elf64_phdr_t *dynamic_phdr = NULL;
-    for (uint16_t i = 0; i < hdr->e_phnum; i++) {
-        const elf64_phdr_t *phdr = elf_get_phdr(data, i);
-        if (phdr->p_type == PT_DYNAMIC) {
-            dynamic_phdr = phdr;
-            break;
-        }
+    for (relative = MIN(relative, count); i < relative; i++) {
+        *(uint64_t *)(rela[i].r_offset + base_addr) = base_addr + rela[i].r_addend;
     }
 
-    if (!dynamic_phdr) {
-        /* No dynamic section - static executable or no relocations */
-        kprintf("[ELF] No PT_DYNAMIC segment, skipping relocations\n");
-        return ELF_SUCCESS;
-    }
+    for (; i < count; i++) {
+        uint32_t type = ELF64_R_TYPE(rela[i].r_info);
+        uint32_t sym_index = ELF64_R_SYM(rela[i].r_info);
+        uint64_t *ptr = (uint64_t *)(rela[i].r_offset + base_addr);
 
-    kprintf("[ELF] Processing dynamic section at offset 0x%llx\n",
-            dynamic_phdr->p_offset);
-
-    /* Parse dynamic section to find relocation tables */
-    const elf64_dyn_t *dyn = (const elf64_dyn_t *)((const uint8_t *)data +
-                                                    dynamic_phdr->p_offset);
-
-    virtaddr_t rela_addr = 0;
-    size_t rela_size = 0;
-    size_t rela_ent = 0;
+        switch (type) {
+            case R_X86_64_RELATIVE:
+                /* Adjust by base address: *target = base + addend */
+                *ptr = base_addr + rela[i].r_addend;
+                break;
 
-    while (dyn->d_tag != DT_NULL) {
-        switch (dyn->d_tag) {
-            case DT_RELA:
-                rela_addr = dyn->d_un.d_ptr;
+            case R_X86_64_64:
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT: {
+                /* Only symbols the executable defines itself can be bound */
+                const elf64_sym_t *sym = dyn->symtab ? &dyn->symtab[sym_index] : NULL;
+                if (!sym || sym->st_shndx == SHN_UNDEF) {
+                    kprintf("[ELF] Warning: Undefined symbol %u for relocation at 0x%llx\n",
+                            sym_index, (uint64_t)ptr);
+                    failed++;
+                    break;
+                }
+                *ptr = base_addr + sym->st_value +
+                       (type == R_X86_64_64 ? (uint64_t)rela[i].r_addend : 0);
                 break;
-            case DT_RELASZ:
-                rela_size = dyn->d_un.d_val;
+            }
+
+            case R_X86_64_NONE:
+                /* No action needed */
                 break;
-            case DT_RELAENT:
-                rela_ent = dyn->d_un.d_val;
+
+            default:
+                kprintf("[ELF] Warning: Unsupported relocation type %d at 0x%llx\n",
+                        type, (uint64_t)ptr);
+                failed++;
                 break;
         }
-        dyn++;
-    }
-
-    if (rela_addr == 0 || rela_size == 0 || rela_ent == 0) {
-        kprintf("[ELF] No RELA relocations found\n");
-        return ELF_SUCCESS;
     }
 
-    kprintf("[ELF] Found RELA: addr=0x%llx, size=%llu, entsize=%llu\n",
-            rela_addr, (uint64_t)rela_size, (uint64_t)rela_ent);
+    return failed;
+}
 
-    /* Process relocations */
-    size_t rela_count = rela_size / rela_ent;
-    virtaddr_t rela_vaddr = rela_addr + base_addr;
+/**
+ * Apply packed RELR relocations (each adds the base to a 64-bit word)
+ * An even entry is an address; an odd one is a bitmap of which of the
+ * next 63 words after the last address to relocate.
+ */
+static void elf_apply_relr(const uint64_t *relr, size_t count, virtaddr_t base_addr) {
+    uint64_t *where = NULL;
 
-    for (size_t i = 0; i < rela_count; i++) {
-        const elf64_rela_t *rela = (const elf64_rela_t *)(rela_vaddr + (i * rela_ent));
-        uint32_t type = ELF64_R_TYPE(rela->r_info);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t entry = relr[i];
 
-        virtaddr_t target = rela->r_offset + base_addr;
+        if ((entry & 1) == 0) {
+            where = (uint64_t *)(entry + base_addr);
+            *where++ += base_addr;
+            continue;
+        }
 
-        switch (type) {
-            case R_X86_64_RELATIVE: {
-                /* Adjust by base address: *target = base + addend */
-                uint64_t *ptr = (uint64_t *)target;
-                *ptr = base_addr + rela->r_addend;
-                break;
+        for (uint64_t *p = where, bits = entry >> 1; bits != 0; bits >>= 1, p++) {
+            if (bits & 1) {
+                *p += base_addr;
             }
+        }
+        where += 63;
+    }
+}
 
-            case R_X86_64_NONE:
-                /* No action needed */
-                break;
+/**
+ * Apply relocations for PIE executable
+ * The tables are read from the file image; only the relocated words are
+ * written through the new mappings.
+ */
+static elf_error_t elf_apply_relocations(const void *data, virtaddr_t base_addr) {
+    elf_dynamic_t dyn;
 
-            default:
-                kprintf("[ELF] Warning: Unsupported relocation type %d at 0x%llx\n",
-                        type, target);
-                break;
-        }
+    if (!elf_parse_dynamic(data, &dyn)) {
+        /* No dynamic section - static executable or no relocations */
+        kprintf("[ELF] No PT_DYNAMIC segment, skipping relocations\n");
+        return ELF_SUCCESS;
     }
 
-    kprintf("[ELF] Applied %llu relocations\n", (uint64_t)rela_count);
-    return ELF_SUCCESS;
+    size_t rela_count = dyn.rela ? dyn.rela_size / sizeof(elf64_rela_t) : 0;
+    size_t plt_count = dyn.jmprel ? dyn.jmprel_size / sizeof(elf64_rela_t) : 0;
+    size_t relr_count = dyn.relr ? dyn.relr_size / sizeof(uint64_t) : 0;
+    size_t failed = 0;
+
+    if (rela_count + plt_count + relr_count == 0) {
+        kprintf("[ELF] No relocations found\n");
+        return ELF_SUCCESS;
+    }
+
+    failed += elf_apply_rela(&dyn, dyn.rela, rela_count, dyn.rela_relative, base_addr);
+    failed += elf_apply_rela(&dyn, dyn.jmprel, plt_count, 0, base_addr);
+    elf_apply_relr(dyn.relr, relr_count, base_addr);
+
+    kprintf("[ELF] Applied %llu RELA (%llu relative), %llu PLT, %llu RELR relocations\n",
+            (uint64_t)rela_count, (uint64_t)MIN(dyn.rela_relative, rela_count),
+            (uint64_t)plt_count, (uint64_t)relr_count);
+
+    return failed == 0 ? ELF_SUCCESS : ELF_ERR_RELOCATION_FAILED;
 }
 
 elf_error_t elf_load_at(const void *data, size_t size, virtaddr_t base_addr,
@@ -125,6 +125,14 @@
 #define DT_PLTREL           20      /* Type of PLT relocation */
 #define DT_DEBUG            21      /* For debugging */
 #define DT_JMPREL           23      /* PLT relocations */
+#define DT_RELRSZ           35      /* Size of RELR relocations */
+#define DT_RELR             36      /* Packed relative relocations */
+#define DT_RELRENT          37      /* Size of RELR entry */
+#define DT_GNU_HASH         0x6FFFFEF5  /* GNU-style symbol hash table */
+#define DT_RELACOUNT        0x6FFFFFF9  /* Leading R_X86_64_RELATIVE entries in DT_RELA */
+
+/* Special section indices */
+#define SHN_UNDEF           0       /* Undefined symbol */
 
 /* Relocation Types for x86_64 */
 #define R_X86_64_NONE       0       /* No relocation */
@@ -335,6 +343,8 @@ bool elf_is_pie(const void *data);
 
 /**
  * Load a single program segment into memory
+ * The segment becomes a VMA of the current process: its pages are filled
+ * from file_data on first access, so file_data must outlive the process.
  * @param phdr Pointer to program header
  * @param file_data Pointer to beginning of ELF file
  * @param base_addr Base address offset (for PIE)
@@ -390,6 +400,16 @@ const elf64_shdr_t* elf_get_shdr(const void *data, uint16_t index);
  */
 const elf64_shdr_t* elf_find_section(const void *data, const char *name);
 
+/**
+ * Look up a dynamic symbol by name
+ * Uses DT_GNU_HASH, or DT_HASH if the file has no GNU hash table.
+ * @param data Pointer to ELF file data
+ * @param name Symbol name
+ * @param value Set to the symbol's link-time value (add the load base)
+ * @return true if the symbol is defined in the file
+ */
+bool elf_find_symbol(const void *data, const char *name, uint64_t *value);
+
 /**
  * Get the string table pointer for section names
  * @param data Pointer to ELF file data
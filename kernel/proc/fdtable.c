@@ -0,0 +1,243 @@
+/**
+ * AAAos Kernel - File Descriptor Table Implementation
+ *
+ * Entries and bitmap are heap arrays grown together with krealloc. The
+ * table lock only guards the arrays: objects are closed after their slot
+ * has been cleared and the lock dropped.
+ */
+
+#include "fdtable.h"
+#include "process.h"
+#include "../mm/heap.h"
+
+/* Callbacks of each kind (set once at subsystem init) */
+static const fd_ops_t *fd_kind_ops[FD_KIND_COUNT];
+
+/* Table of kernel code running outside any process */
+static fd_table_t fd_kernel_table;
+
+static inline void fd_lock(fd_table_t *table) {
+    while (__sync_lock_test_and_set(&table->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void fd_unlock(fd_table_t *table) {
+    __sync_lock_release(&table->lock);
+}
+
+static inline bool fd_in_use(fd_table_t *table, int fd) {
+    return fd >= 0 && (uint32_t)fd < table->capacity &&
+           (table->bitmap[fd / 64] & (1ULL << (fd % 64)));
+}
+
+/**
+ * Drop the reference a closed descriptor held
+ */
+static void fd_release(const fd_entry_t *entry) {
+    const fd_ops_t *ops = fd_kind_ops[entry->kind];
+    if (ops && ops->close) {
+        ops->close(entry->object, entry->aux);
+    }
+}
+
+/**
+ * Double the table, or set up an empty one
+ * Called with the table lock held.
+ */
+static bool fd_table_grow(fd_table_t *table) {
+    uint32_t old = table->capacity;
+    uint32_t capacity = old ? old * 2 : FD_TABLE_INITIAL;
+    if (capacity > FD_TABLE_MAX) {
+        return false;
+    }
+
+    fd_entry_t *entries = krealloc(table->entries, capacity * sizeof(fd_entry_t));
+    if (!entries) {
+        return false;
+    }
+    table->entries = entries;
+
+    /* A failure here leaves the larger entry array unused until next time */
+    uint64_t *bitmap = krealloc(table->bitmap, capacity / 64 * sizeof(uint64_t));
+    if (!bitmap) {
+        return false;
+    }
+    table->bitmap = bitmap;
+
+    for (uint32_t i = old; i < capacity; i++) {
+        entries[i] = (fd_entry_t){ 0 };
+    }
+    for (uint32_t w = old / 64; w < capacity / 64; w++) {
+        bitmap[w] = 0;
+    }
+    table->capacity = capacity;
+
+    if (old == 0) {
+        for (int fd = 0; fd < FD_STDIO_COUNT; fd++) {
+            entries[fd].kind = FD_KIND_CONSOLE;
+            bitmap[0] |= 1ULL << fd;
+        }
+        table->count = FD_STDIO_COUNT;
+    }
+    return true;
+}
+
+void fd_register_ops(fd_kind_t kind, const fd_ops_t *ops) {
+    if (kind > FD_KIND_NONE && kind < FD_KIND_COUNT) {
+        fd_kind_ops[kind] = ops;
+    }
+}
+
+fd_table_t* fd_table_current(void) {
+    process_t *proc = process_get_current();
+    return proc ? process_fds(proc) : &fd_kernel_table;
+}
+
+bool fd_table_clone(fd_table_t *dst, fd_table_t *src) {
+    *dst = (fd_table_t){ 0 };
+
+    fd_lock(src);
+
+    uint32_t capacity = src->capacity;
+    if (capacity == 0) {
+        fd_unlock(src);
+        return true;
+    }
+
+    dst->entries = kmalloc(capacity * sizeof(fd_entry_t));
+    dst->bitmap = kmalloc(capacity / 64 * sizeof(uint64_t));
+    if (!dst->entries || !dst->bitmap) {
+        fd_unlock(src);
+        kfree(dst->entries);
+        kfree(dst->bitmap);
+        *dst = (fd_table_t){ 0 };
+        return false;
+    }
+
+    for (uint32_t w = 0; w < capacity / 64; w++) {
+        uint64_t bits = src->bitmap[w];
+        dst->bitmap[w] = bits;
+        for (uint32_t i = w * 64; i < w * 64 + 64; i++) {
+            dst->entries[i] = src->entries[i];
+        }
+
+        /* The copy refers to each object as well */
+        while (bits) {
+            const fd_entry_t *entry = &src->entries[w * 64 + __builtin_ctzll(bits)];
+            const fd_ops_t *ops = fd_kind_ops[entry->kind];
+            if (ops && ops->ref) {
+                ops->ref(entry->object, entry->aux);
+            }
+            bits &= bits - 1;
+        }
+    }
+    dst->capacity = capacity;
+    dst->count = src->count;
+    dst->hint = src->hint;
+
+    fd_unlock(src);
+    return true;
+}
+
+void fd_table_destroy(fd_table_t *table) {
+    fd_lock(table);
+    fd_table_t old = *table;
+    table->entries = NULL;
+    table->bitmap = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->hint = 0;
+    fd_unlock(table);
+
+    for (uint32_t w = 0; w < old.capacity / 64; w++) {
+        for (uint64_t bits = old.bitmap[w]; bits; bits &= bits - 1) {
+            fd_release(&old.entries[w * 64 + __builtin_ctzll(bits)]);
+        }
+    }
+    kfree(old.entries);
+    kfree(old.bitmap);
+}
+
+int fd_alloc(fd_table_t *table, fd_kind_t kind, void *object, uint32_t aux) {
+    if (!table || kind <= FD_KIND_NONE || kind >= FD_KIND_COUNT) {
+        return -1;
+    }
+
+    fd_lock(table);
+
+    for (;;) {
+        uint32_t words = table->capacity / 64;
+        for (uint32_t w = table->hint; w < words; w++) {
+            uint64_t free_bits = ~table->bitmap[w];
+            if (free_bits == 0) {
+                continue;
+            }
+
+            int fd = (int)(w * 64 + (uint32_t)__builtin_ctzll(free_bits));
+            table->bitmap[w] |= free_bits & -free_bits;
+            table->entries[fd] = (fd_entry_t){
+                .object = object,
+                .aux = aux,
+                .kind = (uint16_t)kind,
+            };
+            table->count++;
+            table->hint = w;
+            fd_unlock(table);
+            return fd;
+        }
+
+        table->hint = words;
+        if (!fd_table_grow(table)) {
+            fd_unlock(table);
+            return -1;
+        }
+    }
+}
+
+void* fd_lookup(fd_table_t *table, int fd, fd_kind_t kind, uint32_t *aux) {
+    void *object = NULL;
+
+    fd_lock(table);
+    if (fd_in_use(table, fd) && table->entries[fd].kind == kind) {
+        object = table->entries[fd].object;
+        if (aux) {
+            *aux = table->entries[fd].aux;
+        }
+    }
+    fd_unlock(table);
+
+    return object;
+}
+
+bool fd_get(fd_table_t *table, int fd, fd_entry_t *entry) {
+    fd_lock(table);
+    bool open = fd_in_use(table, fd);
+    if (open) {
+        *entry = table->entries[fd];
+    }
+    fd_unlock(table);
+    return open;
+}
+
+bool fd_close(fd_table_t *table, int fd) {
+    fd_lock(table);
+
+    if (!fd_in_use(table, fd)) {
+        fd_unlock(table);
+        return false;
+    }
+
+    fd_entry_t entry = table->entries[fd];
+    table->entries[fd] = (fd_entry_t){ 0 };
+    table->bitmap[fd / 64] &= ~(1ULL << (fd % 64));
+    table->count--;
+    if ((uint32_t)fd / 64 < table->hint) {
+        table->hint = (uint32_t)fd / 64;
+    }
+
+    fd_unlock(table);
+
+    fd_release(&entry);
+    return true;
+}
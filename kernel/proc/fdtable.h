@@ -0,0 +1,128 @@
+/**
+ * AAAos Kernel - File Descriptor Tables
+ *
+ * Each thread group has one descriptor table, held by its leader and
+ * shared by its threads; fork gives the child a copy. A descriptor is an
+ * index into the table's entry array, so resolving one is a bounds check
+ * and a load. Pipes, sockets and open files all live in the same table,
+ * told apart by the entry's kind.
+ *
+ * A bitmap marks the descriptors in use. The lowest free one is found by
+ * a ctz on the first word with a clear bit, starting from a hint that
+ * never lies above it, and a full table doubles up to FD_TABLE_MAX.
+ *
+ * The table does not know the objects it holds. Each kind registers a
+ * reference and a close callback (fd_register_ops): clone takes a
+ * reference for the copy, and closing the last descriptor of an object
+ * releases it.
+ */
+
+#ifndef _AAAOS_PROC_FDTABLE_H
+#define _AAAOS_PROC_FDTABLE_H
+
+#include "../include/types.h"
+
+/* Table configuration */
+#define FD_TABLE_INITIAL        64      /* Slots of a new table (one bitmap word) */
+#define FD_TABLE_MAX            65536   /* Largest table; poll set IDs start above it */
+#define FD_STDIO_COUNT          3       /* 0-2 are the console in every table */
+
+/**
+ * What a descriptor refers to
+ */
+typedef enum fd_kind {
+    FD_KIND_NONE = 0,
+    FD_KIND_CONSOLE,                    /* Serial console (stdin, stdout, stderr) */
+    FD_KIND_PIPE,                       /* pipe_t; aux is 0 for the read end, 1 for write */
+    FD_KIND_SOCKET,                     /* socket_t */
+    FD_KIND_FILE,                       /* vfs_file_t */
+    FD_KIND_COUNT
+} fd_kind_t;
+
+/**
+ * Table slot
+ */
+typedef struct fd_entry {
+    void *object;                       /* Pipe, socket or file */
+    uint32_t aux;                       /* Kind-specific (which pipe end) */
+    uint16_t kind;                      /* fd_kind_t */
+    uint16_t flags;                     /* Reserved */
+} fd_entry_t;
+
+/**
+ * Callbacks of a descriptor kind
+ * ref is called with the source table locked, so it must not take a
+ * table lock itself; close is called with no table lock held.
+ */
+typedef struct fd_ops {
+    void (*ref)(void *object, uint32_t aux);    /* Another descriptor refers to it */
+    void (*close)(void *object, uint32_t aux);  /* A descriptor referring to it closed */
+} fd_ops_t;
+
+/**
+ * Descriptor table
+ * An all-zero table is valid and empty. The first allocation sets it up
+ * with the console at 0-2.
+ */
+typedef struct fd_table {
+    fd_entry_t *entries;                /* capacity slots */
+    uint64_t *bitmap;                   /* Bit set for each descriptor in use */
+    uint32_t capacity;                  /* Slots, a multiple of 64 */
+    uint32_t count;                     /* Descriptors in use */
+    uint32_t hint;                      /* No free descriptor below word hint */
+    volatile int lock;
+} fd_table_t;
+
+/**
+ * Set the callbacks of a descriptor kind
+ * @param ops Callbacks (kept by pointer), or NULL for none
+ */
+void fd_register_ops(fd_kind_t kind, const fd_ops_t *ops);
+
+/**
+ * Table of the current thread group
+ * Kernel code running without a process shares one table of its own.
+ */
+fd_table_t* fd_table_current(void);
+
+/**
+ * Copy a table for a forked child, referencing every object again
+ * @param dst Empty table to fill
+ * @return true on success, false if out of memory (dst left empty)
+ */
+bool fd_table_clone(fd_table_t *dst, fd_table_t *src);
+
+/**
+ * Close every descriptor and free the table's memory
+ * Leaves an empty table.
+ */
+void fd_table_destroy(fd_table_t *table);
+
+/**
+ * Install an object at the lowest free descriptor
+ * The table takes over the caller's reference.
+ * @return The descriptor, or -1 if the table is full or out of memory
+ */
+int fd_alloc(fd_table_t *table, fd_kind_t kind, void *object, uint32_t aux);
+
+/**
+ * Object behind a descriptor
+ * @param kind Kind the descriptor must have
+ * @param aux Set to the entry's aux value if not NULL
+ * @return The object, or NULL if fd is not open as kind
+ */
+void* fd_lookup(fd_table_t *table, int fd, fd_kind_t kind, uint32_t *aux);
+
+/**
+ * Copy of a descriptor's entry
+ * @return false if fd is not open
+ */
+bool fd_get(fd_table_t *table, int fd, fd_entry_t *entry);
+
+/**
+ * Close a descriptor, releasing its reference to the object
+ * @return false if fd is not open
+ */
+bool fd_close(fd_table_t *table, int fd);
+
+#endif /* _AAAOS_PROC_FDTABLE_H */
@@ -8,17 +8,51 @@
 #include "process.h"
 #include "../include/serial.h"
 #include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../syscall/ioring.h"
+#include "../syscall/vdso.h"
 #include "../arch/x86_64/include/gdt.h"
+#include "../arch/x86_64/fpu.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../sched/idle.h"
+#include "../sched/rcu.h"
 
 /* Process table - statically allocated */
 static process_t process_table[PROCESS_MAX_COUNT];
 
-/* Current running process */
-static process_t *current_process = NULL;
+/* Running process of each CPU */
+static process_t *current_processes[PERCPU_MAX_CPUS];
+#define current_process (current_processes[percpu_cpu_id()])
 
 /* Next available PID */
 static uint32_t next_pid = PID_IDLE;
 
+/* Fork statistics (protected by process_lock) */
+static process_fork_stats_t fork_stats;
+
+/* Free process table slots, used as a stack (protected by process_lock) */
+static uint16_t pcb_free_slots[PROCESS_MAX_COUNT];
+static uint32_t pcb_free_count = 0;
+
+/* Link stored at the base of a pooled kernel stack */
+typedef struct process_stack_link {
+    struct process_stack_link *next;
+} process_stack_link_t;
+
+/**
+ * Kernel stack pool (protected by process_lock)
+ * Freed stacks go on the dirty list; process_pool_refill zeroes them onto
+ * the clean list from the idle loop.
+ */
+static struct {
+    process_stack_link_t *clean;
+    process_stack_link_t *dirty;
+    uint32_t clean_count;
+    uint32_t dirty_count;
+    uint64_t hits;                          /* Allocations served from the pool */
+    uint64_t misses;                        /* Allocations that went to the PMM */
+} stack_pool;
+
 /* Process manager lock */
 static volatile int process_lock = 0;
 
@@ -27,6 +61,9 @@ static void idle_process_entry(void);
 static process_t* alloc_pcb(void);
 static void free_pcb(process_t *proc);
 
+/* Restores a full context with iretq (context_switch.asm) */
+extern void context_switch_first(cpu_context_t *context);
+
 /**
  * Acquire process manager lock
  */
@@ -63,21 +100,33 @@ static inline uint64_t read_cr3(void) {
     return cr3;
 }
 
+/**
+ * Read the time-stamp counter
+ */
+static inline uint64_t process_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
 /**
  * Allocate a PCB from the process table
+ * Free slots are kept on a stack, so this is O(1) and hands back the most
+ * recently freed (cache-warm) slot first.
  */
 static process_t* alloc_pcb(void) {
-    for (uint32_t i = 0; i < PROCESS_MAX_COUNT; i++) {
-        if (process_table[i].state == PROCESS_STATE_INVALID) {
-            /* Zero out the PCB */
-            uint8_t *p = (uint8_t*)&process_table[i];
-            for (size_t j = 0; j < sizeof(process_t); j++) {
-                p[j] = 0;
-            }
-            return &process_table[i];
-        }
+    if (pcb_free_count == 0) {
+        return NULL;
     }
-    return NULL;
+
+    process_t *proc = &process_table[pcb_free_slots[--pcb_free_count]];
+
+    /* Zero out the PCB (it is 8-byte aligned and sized) */
+    uint64_t *p = (uint64_t*)proc;
+    for (size_t j = 0; j < sizeof(process_t) / sizeof(uint64_t); j++) {
+        p[j] = 0;
+    }
+    return proc;
 }
 
 /**
@@ -85,8 +134,126 @@ static process_t* alloc_pcb(void) {
  */
 static void free_pcb(process_t *proc) {
     if (proc) {
+        fpu_release(proc);
         proc->state = PROCESS_STATE_INVALID;
         proc->pid = PID_INVALID;
+        pcb_free_slots[pcb_free_count++] = (uint16_t)(proc - process_table);
+    }
+}
+
+/**
+ * Take a kernel stack, preferring a pre-zeroed one from the pool
+ * Called with process_lock held.
+ * @return Stack base, or 0 if out of memory
+ */
+static virtaddr_t alloc_kernel_stack(void) {
+    process_stack_link_t *stack = stack_pool.clean;
+
+    if (stack) {
+        stack_pool.clean = stack->next;
+        stack_pool.clean_count--;
+    } else if ((stack = stack_pool.dirty) != NULL) {
+        stack_pool.dirty = stack->next;
+        stack_pool.dirty_count--;
+    } else {
+        stack_pool.misses++;
+        /* For now, we use identity mapping (phys == virt) */
+        return (virtaddr_t)pmm_alloc_pages(PROCESS_KERNEL_STACK_SIZE / PAGE_SIZE);
+    }
+
+    stack_pool.hits++;
+    stack->next = NULL;
+    return (virtaddr_t)stack;
+}
+
+/**
+ * Return a kernel stack to the pool, or to the PMM if the pool is full
+ * Called with process_lock held. The stack may be the one running this.
+ */
+static void free_kernel_stack(virtaddr_t base) {
+    if (stack_pool.clean_count + stack_pool.dirty_count >= PROCESS_STACK_POOL_MAX) {
+        pmm_free_pages((physaddr_t)base, PROCESS_KERNEL_STACK_SIZE / PAGE_SIZE);
+        return;
+    }
+
+    /* The link lives at the base, far below any frame still in use */
+    process_stack_link_t *stack = (process_stack_link_t*)base;
+    stack->next = stack_pool.dirty;
+    stack_pool.dirty = stack;
+    stack_pool.dirty_count++;
+}
+
+/**
+ * Zero a kernel stack with 64-bit stores
+ */
+static void zero_kernel_stack(virtaddr_t base) {
+    uint64_t *p = (uint64_t*)base;
+    for (size_t i = 0; i < PROCESS_KERNEL_STACK_SIZE / sizeof(uint64_t); i++) {
+        p[i] = 0;
+    }
+}
+
+/**
+ * Zero freed kernel stacks and top up the clean pool
+ */
+void process_pool_refill(void) {
+    /* Racy peek: nothing to do is the common case */
+    if (stack_pool.dirty_count == 0 && stack_pool.clean_count >= PROCESS_STACK_POOL_CLEAN) {
+        return;
+    }
+
+    for (;;) {
+        process_acquire_lock();
+        process_stack_link_t *stack = stack_pool.dirty;
+        if (stack) {
+            stack_pool.dirty = stack->next;
+            stack_pool.dirty_count--;
+        } else if (stack_pool.clean_count >= PROCESS_STACK_POOL_CLEAN) {
+            process_release_lock();
+            return;
+        }
+        process_release_lock();
+
+        virtaddr_t base = (virtaddr_t)stack;
+        if (base == 0) {
+            base = (virtaddr_t)pmm_alloc_pages(PROCESS_KERNEL_STACK_SIZE / PAGE_SIZE);
+            if (base == 0) {
+                return;
+            }
+        }
+
+        /* Zero outside the lock; the stack belongs to no one meanwhile */
+        zero_kernel_stack(base);
+
+        process_acquire_lock();
+        stack = (process_stack_link_t*)base;
+        stack->next = stack_pool.clean;
+        stack_pool.clean = stack;
+        stack_pool.clean_count++;
+        process_release_lock();
+    }
+}
+
+/**
+ * Remove a process from its parent's children list
+ * Called with process_lock held.
+ */
+static void unlink_from_parent(process_t *proc) {
+    process_t *parent = proc->parent;
+    if (!parent) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < parent->child_count; i++) {
+        if (parent->children[i] == proc) {
+            /* Shift remaining children down */
+            for (uint32_t j = i; j < parent->child_count - 1; j++) {
+                parent->children[j] = parent->children[j + 1];
+            }
+            parent->children[parent->child_count - 1] = NULL;
+            parent->child_count--;
+            break;
+        }
     }
 }
 
@@ -98,11 +265,11 @@ static void idle_process_entry(void) {
     kprintf("[PROC] Idle process running (PID %u)\n", current_process ? current_process->pid : 0);
 
     for (;;) {
-        /* Enable interrupts and halt until next interrupt */
-        __asm__ __volatile__(
-            "sti\n"
-            "hlt\n"
-        );
+        process_pool_refill();
+        rcu_check_qs();
+
+        /* Sleep until an interrupt or new work */
+        idle_enter();
     }
 }
 
@@ -126,11 +293,13 @@ const char* process_state_string(process_state_t state) {
 void process_init(void) {
     kprintf("[PROC] Initializing Process Manager...\n");
 
-    /* Initialize the process table */
+    /* Initialize the process table; low slots are handed out first */
     for (uint32_t i = 0; i < PROCESS_MAX_COUNT; i++) {
         process_table[i].state = PROCESS_STATE_INVALID;
         process_table[i].pid = PID_INVALID;
+        pcb_free_slots[i] = (uint16_t)(PROCESS_MAX_COUNT - 1 - i);
     }
+    pcb_free_count = PROCESS_MAX_COUNT;
 
     kprintf("[PROC] Process table initialized (%u slots)\n", PROCESS_MAX_COUNT);
 
@@ -172,8 +341,11 @@ process_t* process_create(const char *name, process_entry_t entry) {
         return NULL;
     }
 
-    /* Assign PID */
+    /* Assign PID; the process leads its own thread group */
     proc->pid = next_pid++;
+    proc->tgid = proc->pid;
+    proc->group_leader = proc;
+    proc->group_refs = 1;
 
     /* Copy name */
     kstrcpy(proc->name, name, PROCESS_NAME_MAX);
@@ -184,24 +356,25 @@ process_t* process_create(const char *name, process_entry_t entry) {
     proc->exit_status = 0;
     proc->time_slice = 0;
     proc->total_ticks = 0;
+    proc->switches = 0;
 
     /* Allocate kernel stack */
-    size_t stack_pages = PROCESS_KERNEL_STACK_SIZE / PAGE_SIZE;
-    physaddr_t stack_phys = pmm_alloc_pages(stack_pages);
+    virtaddr_t stack_base = alloc_kernel_stack();
 
-    if (stack_phys == 0) {
+    if (stack_base == 0) {
         free_pcb(proc);
         process_release_lock();
         kprintf("[PROC] Error: Failed to allocate kernel stack for '%s'\n", name);
         return NULL;
     }
 
-    /* For now, we use identity mapping (phys == virt) */
-    proc->kernel_stack_base = (virtaddr_t)stack_phys;
+    proc->kernel_stack_base = stack_base;
     proc->kernel_stack = proc->kernel_stack_base + PROCESS_KERNEL_STACK_SIZE;
 
+#ifdef PROCESS_DEBUG_TRACE
     kprintf("[PROC] Allocated kernel stack at 0x%llx (%llu KB)\n",
             (uint64_t)proc->kernel_stack_base, (uint64_t)(PROCESS_KERNEL_STACK_SIZE / KB));
+#endif
 
     /* Use current page table (kernel threads share address space) */
     proc->page_table = read_cr3();
@@ -248,12 +421,296 @@ process_t* process_create(const char *name, process_entry_t entry) {
 
     process_release_lock();
 
+#ifdef PROCESS_DEBUG_TRACE
     kprintf("[PROC] Created process '%s' (PID %u, entry=0x%llx)\n",
             proc->name, proc->pid, (uint64_t)entry);
+#endif
 
     return proc;
 }
 
+/**
+ * Where a thread's entry function returns to
+ */
+static void thread_return(void) {
+    process_exit(0);
+}
+
+/**
+ * Create a kernel-mode thread
+ */
+process_t* thread_create(process_t *owner, const char *name, thread_entry_t entry, void *arg) {
+    if (!name || !entry) {
+        kprintf("[PROC] Error: thread_create called with NULL arguments\n");
+        return NULL;
+    }
+
+    process_acquire_lock();
+
+    process_t *leader = owner ? owner->group_leader : NULL;
+    if (leader && leader->state == PROCESS_STATE_TERMINATED) {
+        process_release_lock();
+        kprintf("[PROC] Error: '%s' (PID %u) is exiting, no new threads\n",
+                leader->name, leader->pid);
+        return NULL;
+    }
+
+    process_t *thread = alloc_pcb();
+    virtaddr_t stack_base = thread ? alloc_kernel_stack() : 0;
+    if (stack_base == 0) {
+        free_pcb(thread);
+        process_release_lock();
+        kprintf("[PROC] Error: Failed to create thread '%s'\n", name);
+        return NULL;
+    }
+
+    thread->pid = next_pid++;
+    kstrcpy(thread->name, name, PROCESS_NAME_MAX);
+    thread->state = PROCESS_STATE_READY;
+    thread->kernel_stack_base = stack_base;
+    thread->kernel_stack = stack_base + PROCESS_KERNEL_STACK_SIZE;
+
+    if (leader) {
+        thread->tgid = leader->tgid;
+        thread->group_leader = leader;
+        leader->group_refs++;
+        thread->priority = leader->priority;
+        thread->nice = leader->nice;
+        thread->sched_class = leader->sched_class;
+        thread->page_table = leader->page_table;
+        thread->flags = PROCESS_FLAG_KERNEL | PROCESS_FLAG_THREAD;
+        thread->parent = leader;            /* Not a child: it exits with the group */
+    } else {
+        thread->tgid = thread->pid;
+        thread->group_leader = thread;
+        thread->group_refs = 1;
+        thread->priority = PRIORITY_DEFAULT;
+        thread->page_table = vmm_get_kernel_pml4() ? vmm_get_kernel_pml4() : read_cr3();
+        thread->flags = PROCESS_FLAG_KERNEL;
+    }
+
+    /* Enter entry(arg) with thread_return as the return address */
+    uint64_t *stack_top = (uint64_t*)(thread->kernel_stack - sizeof(uint64_t));
+    *stack_top = (uint64_t)thread_return;
+
+    thread->context.rip = (uint64_t)entry;
+    thread->context.cs = GDT_KERNEL_CODE;
+    thread->context.rflags = 0x202;
+    thread->context.rsp = (uint64_t)stack_top;
+    thread->context.ss = GDT_KERNEL_DATA;
+    thread->context.rdi = (uint64_t)arg;
+
+    process_release_lock();
+
+#ifdef PROCESS_DEBUG_TRACE
+    kprintf("[PROC] Created thread '%s' (TID %u) in group %u\n",
+            thread->name, thread->pid, thread->tgid);
+#endif
+
+    return thread;
+}
+
+/**
+ * First code a forked child runs, on its own kernel stack
+ * Drops to user mode with the registers saved at the fork.
+ */
+static void fork_child_entry(cpu_context_t *user_state) {
+    context_switch_first(user_state);
+}
+
+/**
+ * Fork a process
+ */
+process_t* process_fork(process_t *parent, const cpu_context_t *user_state) {
+    if (!parent || !user_state) {
+        kprintf("[PROC] Error: process_fork called with NULL arguments\n");
+        return NULL;
+    }
+
+    uint64_t start = process_rdtsc();
+
+    /* Share the parent's pages until either side writes to them */
+    physaddr_t pml4 = vmm_clone_address_space(parent->page_table & VMM_ADDR_MASK);
+    vma_tree_t vmas;
+    if (pml4 != 0 && !vma_tree_clone(&vmas, process_vmas(parent))) {
+        vmm_destroy_address_space(pml4);
+        pml4 = 0;
+    }
+
+    /* The child inherits every open descriptor */
+    fd_table_t fds;
+    if (pml4 != 0 && !fd_table_clone(&fds, process_fds(parent))) {
+        vma_tree_destroy(&vmas);
+        vmm_destroy_address_space(pml4);
+        pml4 = 0;
+    }
+    if (pml4 == 0) {
+        process_acquire_lock();
+        fork_stats.failures++;
+        process_release_lock();
+        return NULL;
+    }
+
+    process_acquire_lock();
+
+    process_t *child = alloc_pcb();
+    virtaddr_t stack_base = child ? alloc_kernel_stack() : 0;
+
+    /* The vDSO process page publishes the PID assigned below */
+    if (stack_base == 0 || !fpu_fork(child, parent) || !vdso_map(pml4, &vmas, next_pid)) {
+        if (stack_base != 0) {
+            free_kernel_stack(stack_base);
+        }
+        free_pcb(child);
+        fork_stats.failures++;
+        process_release_lock();
+        fd_table_destroy(&fds);
+        vma_tree_destroy(&vmas);
+        vmm_destroy_address_space(pml4);
+        kprintf("[PROC] Error: Failed to fork '%s' (PID %u)\n", parent->name, parent->pid);
+        return NULL;
+    }
+
+    child->pid = next_pid++;
+    child->tgid = child->pid;
+    child->group_leader = child;
+    child->group_refs = 1;
+    kstrcpy(child->name, parent->name, PROCESS_NAME_MAX);
+    child->state = PROCESS_STATE_READY;
+    child->priority = parent->priority;
+    child->nice = parent->nice;
+    child->sched_class = parent->sched_class;
+    child->page_table = pml4;
+    child->vmas = vmas;
+    child->fds = fds;
+    ioring_fork(child, parent);
+    child->kernel_stack_base = stack_base;
+    child->kernel_stack = child->kernel_stack_base + PROCESS_KERNEL_STACK_SIZE;
+
+    /* fork() returns 0 in the child */
+    child->user_context = *user_state;
+    child->user_context.rax = 0;
+
+    /* The kernel context enters fork_child_entry(&child->user_context) */
+    child->context.rip = (uint64_t)fork_child_entry;
+    child->context.cs = GDT_KERNEL_CODE;
+    child->context.rflags = 0x002;              /* IF=0 until iretq to user mode */
+    child->context.rsp = child->kernel_stack - sizeof(uint64_t);
+    child->context.ss = GDT_KERNEL_DATA;
+    child->context.rdi = (uint64_t)&child->user_context;
+
+    child->flags = (parent->flags & ~PROCESS_FLAG_THREAD) | PROCESS_FLAG_OWN_AS;
+    child->parent = parent;
+    if (parent->child_count < PROCESS_MAX_CHILDREN) {
+        parent->children[parent->child_count++] = child;
+    }
+
+    uint64_t cycles = process_rdtsc() - start;
+    fork_stats.forks++;
+    fork_stats.total_cycles += cycles;
+    if (cycles > fork_stats.max_cycles) {
+        fork_stats.max_cycles = cycles;
+    }
+
+    process_release_lock();
+
+    kprintf("[PROC] Forked '%s' PID %u -> PID %u in %llu cycles\n",
+            parent->name, parent->pid, child->pid, cycles);
+
+    return child;
+}
+
+/**
+ * Get fork statistics
+ */
+void process_get_fork_stats(process_fork_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    process_acquire_lock();
+    *stats = fork_stats;
+    process_release_lock();
+}
+
+/**
+ * Print fork latency and copy-on-write counters
+ */
+void process_print_fork_stats(void) {
+    process_fork_stats_t fs;
+    vmm_cow_stats_t cs;
+
+    process_get_fork_stats(&fs);
+    vmm_get_cow_stats(&cs);
+
+    kprintf("[PROC] ========== Fork Statistics ==========\n");
+    kprintf("[PROC] Forks:          %llu (%llu failed)\n", fs.forks, fs.failures);
+    kprintf("[PROC] Avg cycles:     %llu\n", fs.forks ? fs.total_cycles / fs.forks : 0);
+    kprintf("[PROC] Max cycles:     %llu\n", fs.max_cycles);
+    kprintf("[PROC] Shared pages:   %llu\n", cs.shared_pages);
+    kprintf("[PROC] Copied pages:   %llu\n", cs.copied_pages);
+    kprintf("[PROC] Reused pages:   %llu\n", cs.reused_pages);
+    kprintf("[PROC] =====================================\n");
+}
+
+/**
+ * Entry point of benchmark processes (they are destroyed before running)
+ */
+static void spawn_bench_entry(void) {
+    process_exit(0);
+}
+
+/**
+ * Destroy a kernel process that has never been scheduled
+ */
+static void process_destroy_unstarted(process_t *proc) {
+    process_acquire_lock();
+    unlink_from_parent(proc);
+    free_kernel_stack(proc->kernel_stack_base);
+    free_pcb(proc);
+    process_release_lock();
+}
+
+/**
+ * Spawn and destroy kernel processes back to back, reporting latency
+ */
+void process_benchmark_spawn(uint32_t count) {
+    uint64_t total = 0, max = 0, hits_before;
+    uint32_t done = 0;
+
+    process_acquire_lock();
+    hits_before = stack_pool.hits;
+    process_release_lock();
+
+    for (; done < count; done++) {
+        uint64_t start = process_rdtsc();
+        process_t *proc = process_create("spawn-bench", spawn_bench_entry);
+        uint64_t cycles = process_rdtsc() - start;
+
+        if (!proc) {
+            break;
+        }
+        total += cycles;
+        if (cycles > max) {
+            max = cycles;
+        }
+
+        /* Reap at once: the table only has PROCESS_MAX_COUNT slots */
+        process_destroy_unstarted(proc);
+    }
+
+    process_acquire_lock();
+    uint64_t hits = stack_pool.hits - hits_before;
+    process_release_lock();
+
+    kprintf("[PROC] ========== Spawn Benchmark ==========\n");
+    kprintf("[PROC] Spawned:        %u of %u\n", done, count);
+    kprintf("[PROC] Avg cycles:     %llu\n", done ? total / done : 0);
+    kprintf("[PROC] Max cycles:     %llu\n", max);
+    kprintf("[PROC] Pooled stacks:  %llu\n", hits);
+    kprintf("[PROC] =====================================\n");
+}
+
 /**
  * Terminate the current process
  */
@@ -295,39 +752,52 @@ NORETURN void process_exit(int status) {
     }
 
     /* Remove from parent's children list */
-    if (current_process->parent) {
-        process_t *parent = current_process->parent;
-        for (uint32_t i = 0; i < parent->child_count; i++) {
-            if (parent->children[i] == current_process) {
-                /* Shift remaining children down */
-                for (uint32_t j = i; j < parent->child_count - 1; j++) {
-                    parent->children[j] = parent->children[j + 1];
-                }
-                parent->children[parent->child_count - 1] = NULL;
-                parent->child_count--;
-                break;
-            }
+    unlink_from_parent(current_process);
+
+    /* The last thread of the group takes the address space with it */
+    process_t *leader = current_process->group_leader;
+    bool last = --leader->group_refs == 0;
+
+    if (last) {
+        fd_table_destroy(&leader->fds);
+        vma_tree_destroy(&leader->vmas);
+
+        /* Release a private (forked) address space from the kernel's tables */
+        if ((leader->flags & PROCESS_FLAG_OWN_AS) && vmm_get_kernel_pml4() != 0) {
+            vmm_switch_address_space(vmm_get_kernel_pml4());
+            vmm_destroy_address_space(leader->page_table);
+            leader->page_table = vmm_get_kernel_pml4();
+            current_process->page_table = vmm_get_kernel_pml4();
         }
     }
 
+    /* Log while the PCB and stack are still ours */
+    kprintf("[PROC] Process '%s' (PID %u) terminated\n",
+            current_process->name, current_process->pid);
+
     /* Free kernel stack */
     if (current_process->kernel_stack_base) {
-        size_t stack_pages = PROCESS_KERNEL_STACK_SIZE / PAGE_SIZE;
-        pmm_free_pages((physaddr_t)current_process->kernel_stack_base, stack_pages);
+        free_kernel_stack(current_process->kernel_stack_base);
         current_process->kernel_stack_base = 0;
         current_process->kernel_stack = 0;
     }
 
-    /* Free the PCB slot */
-    free_pcb(current_process);
-
-    process_t *old_process = current_process;
+    /*
+     * Free the PCB slot. A leader with threads left stays TERMINATED, as
+     * they still use its VMAs; the last of them frees it.
+     */
+    if (current_process != leader) {
+        free_pcb(current_process);
+        if (last) {
+            free_pcb(leader);
+        }
+    } else if (last) {
+        free_pcb(current_process);
+    }
     current_process = NULL;
 
     process_release_lock();
 
-    kprintf("[PROC] Process '%s' (PID %u) terminated\n", old_process->name, old_process->pid);
-
     /* TODO: Trigger scheduler to pick next process */
     /* For now, just halt */
     for (;;) {
@@ -342,6 +812,27 @@ process_t* process_get_current(void) {
     return current_process;
 }
 
+/**
+ * Record the process the scheduler switched to
+ */
+void process_set_current(process_t *proc) {
+    current_process = proc;
+}
+
+/**
+ * Resolve a not-present page fault from the current process's VMAs
+ */
+bool process_handle_page_fault(virtaddr_t addr, uint64_t error_code) {
+    process_t *proc = current_process;
+
+    if (proc == NULL || (error_code & VMM_PF_PRESENT)) {
+        return false;
+    }
+
+    return vma_handle_fault(process_vmas(proc), vmm_get_current_address_space(), addr,
+                            (error_code & VMM_PF_WRITE) != 0);
+}
+
 /**
  * Find a process by PID
  */
@@ -424,13 +915,14 @@ void process_dump_info(process_t *proc) {
     }
 
     kprintf("[PROC] === Process Info ===\n");
-    kprintf("[PROC]   PID:       %u\n", proc->pid);
+    kprintf("[PROC]   PID:       %u (group %u)\n", proc->pid, proc->tgid);
     kprintf("[PROC]   Name:      %s\n", proc->name);
     kprintf("[PROC]   State:     %s\n", process_state_string(proc->state));
     kprintf("[PROC]   Priority:  %u\n", proc->priority);
     kprintf("[PROC]   Flags:     0x%x", proc->flags);
     if (proc->flags & PROCESS_FLAG_KERNEL) kprintf(" [KERNEL]");
     if (proc->flags & PROCESS_FLAG_USER) kprintf(" [USER]");
+    if (proc->flags & PROCESS_FLAG_THREAD) kprintf(" [THREAD]");
     kprintf("\n");
     kprintf("[PROC]   Ticks:     %llu\n", proc->total_ticks);
     kprintf("[PROC]   K-Stack:   0x%llx (base: 0x%llx)\n",
@@ -476,4 +968,6 @@ void process_dump_all(void) {
 
     kprintf("[PROC] =====================================\n");
     kprintf("[PROC] (* = current process)\n");
+
+    process_print_fork_stats();
 }
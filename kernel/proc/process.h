@@ -2,19 +2,28 @@
  * AAAos Kernel - Process Management
  *
  * Defines the Process Control Block (PCB) and process management functions.
- * Initially supports kernel threads; user-space processes will be added later.
+ *
+ * Each PCB is one schedulable thread with its own registers and kernel
+ * stack. Threads made by thread_create join their owner's thread group:
+ * they run on the group leader's page tables and VMAs, so switching
+ * between them needs no CR3 reload. The leader's PCB outlives it until
+ * the last thread of the group exits.
  */
 
 #ifndef _AAAOS_PROC_PROCESS_H
 #define _AAAOS_PROC_PROCESS_H
 
 #include "../include/types.h"
+#include "../mm/vma.h"
+#include "fdtable.h"
 
 /* Process configuration constants */
 #define PROCESS_NAME_MAX        64      /* Maximum process name length */
 #define PROCESS_MAX_COUNT       256     /* Maximum number of processes */
 #define PROCESS_KERNEL_STACK_SIZE   (16 * KB)   /* 16KB kernel stack per process */
 #define PROCESS_MAX_CHILDREN    32      /* Maximum children per process */
+#define PROCESS_STACK_POOL_MAX  32      /* Freed kernel stacks kept for reuse */
+#define PROCESS_STACK_POOL_CLEAN 8      /* Pre-zeroed stacks the idle loop keeps ready */
 
 /* Special PIDs */
 #define PID_INVALID             0       /* Invalid/no process */
@@ -28,6 +37,21 @@
 #define PRIORITY_REALTIME       15      /* Highest priority */
 #define PRIORITY_DEFAULT        PRIORITY_NORMAL
 
+/* Nice values (normal class); lower is favoured */
+#define NICE_MIN                (-20)
+#define NICE_MAX                19
+#define NICE_DEFAULT            0
+
+/**
+ * Scheduling classes
+ * Realtime processes always run before normal ones and get no sleep
+ * bonus or nice adjustment; among themselves they round-robin by priority.
+ */
+typedef enum {
+    SCHED_CLASS_NORMAL = 0,
+    SCHED_CLASS_REALTIME
+} sched_class_t;
+
 /**
  * Process states
  */
@@ -75,7 +99,8 @@ typedef struct PACKED {
  */
 typedef struct process {
     /* Identity */
-    uint32_t pid;                           /* Process ID */
+    uint32_t pid;                           /* Process ID (thread ID for threads) */
+    uint32_t tgid;                          /* PID of the thread group leader */
     char name[PROCESS_NAME_MAX];            /* Process name */
 
     /* State */
@@ -83,17 +108,38 @@ typedef struct process {
     int exit_status;                        /* Exit status (valid when TERMINATED) */
 
     /* Scheduling */
-    uint8_t priority;                       /* Scheduling priority */
+    uint8_t priority;                       /* Static priority (PRIORITY_*) */
+    int8_t nice;                            /* Nice value, NICE_MIN to NICE_MAX */
+    uint8_t sched_class;                    /* sched_class_t */
+    uint8_t dynamic_priority;               /* Run queue level it was last queued at */
+    uint32_t sleep_avg;                     /* Sleep credit (ticks) for the interactive bonus */
+    uint64_t last_run;                      /* Scheduler clock when it last stopped running */
     uint64_t time_slice;                    /* Remaining time slice (ticks) */
     uint64_t total_ticks;                   /* Total CPU ticks used */
+    uint64_t switches;                      /* Times switched to */
+    uint32_t cpu;                           /* CPU whose run queue holds the process */
+    struct process *sched_next;             /* Run queue level linkage */
+    struct process *sched_prev;
+    struct sched_prio_array *sched_array;   /* Priority array holding it, NULL if not queued */
 
     /* CPU context */
     cpu_context_t context;                  /* Saved CPU registers */
+    cpu_context_t user_context;             /* User state a forked child resumes */
+    void *fpu_state;                        /* XSAVE area, NULL until the first FPU use */
+    uint32_t fpu_cpu;                       /* CPU the FPU state was last loaded on */
 
     /* Memory */
     uint64_t page_table;                    /* CR3 value (PML4 physical address) */
     virtaddr_t kernel_stack;                /* Top of kernel stack */
     virtaddr_t kernel_stack_base;           /* Base of kernel stack (for freeing) */
+    vma_tree_t vmas;                        /* User mappings, filled on fault */
+    virtaddr_t ioring;                      /* Batched syscall ring (ioring.h), 0 if none */
+    uint32_t ioring_entries;                /* Its submission queue size */
+    fd_table_t fds;                         /* Leader only: descriptor table (fdtable.h) */
+
+    /* Thread group */
+    struct process *group_leader;           /* Owner of the address space and VMAs (self if none) */
+    uint32_t group_refs;                    /* Leader only: live members, including itself */
 
     /* Process tree */
     struct process *parent;                 /* Parent process */
@@ -104,6 +150,9 @@ typedef struct process {
     uint32_t flags;                         /* Process flags */
     #define PROCESS_FLAG_KERNEL     BIT(0)  /* Kernel process (ring 0) */
     #define PROCESS_FLAG_USER       BIT(1)  /* User process (ring 3) */
+    #define PROCESS_FLAG_OWN_AS     BIT(2)  /* page_table is private, freed on exit */
+    #define PROCESS_FLAG_THREAD     BIT(3)  /* Member of another process's thread group */
+    #define PROCESS_FLAG_PINNED     BIT(4)  /* Stays on the CPU in cpu (scheduler_pin) */
 
 } process_t;
 
@@ -112,6 +161,21 @@ typedef struct process {
  */
 typedef void (*process_entry_t)(void);
 
+/**
+ * Thread entry point function type
+ */
+typedef void (*thread_entry_t)(void *arg);
+
+/**
+ * Fork statistics
+ */
+typedef struct process_fork_stats {
+    uint64_t forks;                         /* Successful forks */
+    uint64_t failures;                      /* Forks that failed */
+    uint64_t total_cycles;                  /* TSC cycles spent in successful forks */
+    uint64_t max_cycles;                    /* Slowest fork */
+} process_fork_stats_t;
+
 /**
  * Initialize the process management subsystem
  * Creates the idle process as PID 1
@@ -126,19 +190,96 @@ void process_init(void);
  */
 process_t* process_create(const char *name, process_entry_t entry);
 
+/**
+ * Create a kernel-mode thread
+ * The thread gets its own registers, kernel stack and FPU state, and
+ * shares the owner's address space and VMAs. Returning from entry exits
+ * the thread. The caller adds it to the scheduler.
+ * @param owner Process whose thread group to join, or NULL for a kernel
+ *              thread of its own on the kernel page tables
+ * @param name Thread name (max PROCESS_NAME_MAX-1 chars)
+ * @param entry Entry point
+ * @param arg Argument passed to entry
+ * @return New thread, or NULL on failure
+ */
+process_t* thread_create(process_t *owner, const char *name, thread_entry_t entry, void *arg);
+
+/**
+ * VMAs of a process's address space (the thread group leader's)
+ */
+static inline vma_tree_t* process_vmas(process_t *proc) {
+    return &proc->group_leader->vmas;
+}
+
+/**
+ * Descriptor table of a process (the thread group leader's)
+ */
+static inline fd_table_t* process_fds(process_t *proc) {
+    return &proc->group_leader->fds;
+}
+
 /**
  * Terminate the current process
+ * The address space, VMAs and descriptors go with the last thread of the group.
  * @param status Exit status code
  * @note This function does not return
  */
 NORETURN void process_exit(int status);
 
+/**
+ * Fork a process
+ * The child gets a copy-on-write clone of the parent's address space and
+ * a copy of its PCB, and starts by returning to user mode with the
+ * registers in user_state and RAX = 0. The caller adds it to the scheduler.
+ * @param parent Process to fork
+ * @param user_state User-mode registers at the fork system call
+ * @return Child process, or NULL on failure
+ */
+process_t* process_fork(process_t *parent, const cpu_context_t *user_state);
+
+/**
+ * Get fork statistics
+ */
+void process_get_fork_stats(process_fork_stats_t *stats);
+
+/**
+ * Print fork latency and copy-on-write counters to serial console
+ */
+void process_print_fork_stats(void);
+
+/**
+ * Zero freed kernel stacks and keep PROCESS_STACK_POOL_CLEAN ready
+ * Called from the idle loop, so creation rarely waits for the PMM.
+ */
+void process_pool_refill(void);
+
+/**
+ * Create and destroy kernel processes back to back and print the latency
+ * The processes are never scheduled.
+ * @param count Number of processes to spawn (e.g. 10000)
+ */
+void process_benchmark_spawn(uint32_t count);
+
 /**
  * Get the currently running process
  * @return Pointer to current process, or NULL if none
  */
 process_t* process_get_current(void);
 
+/**
+ * Record the process the scheduler has switched to
+ * @param proc Process now running
+ */
+void process_set_current(process_t *proc);
+
+/**
+ * Resolve a not-present page fault from the current process's VMAs
+ * @param addr Faulting address (CR2)
+ * @param error_code Page fault error code
+ * @return true if the page was mapped and the access can be retried
+ */
+bool process_handle_page_fault(virtaddr_t addr, uint64_t error_code);
+
 /**
  * Find a process by its PID
  * @param pid Process ID to find
@@ -0,0 +1,247 @@
+/**
+ * AAAos Kernel - Clock Source Implementation
+ *
+ * Calibration gates PIT channel 2 for CLOCK_CALIBRATE_MS and counts TSC
+ * ticks across the window, keeping the shortest of a few runs so an SMI
+ * or emulator stall during one run does not skew the rate. The rate is
+ * turned into a multiplier for (cycles * mult) >> CLOCK_SHIFT, which
+ * needs a 128-bit product but no division on the read path.
+ *
+ * The wall clock starts from the CMOS RTC, read here directly: the RTC
+ * driver under drivers/ is not part of the kernel image.
+ */
+
+#include "clock.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/io.h"
+#include "../syscall/vdso.h"
+
+/* Calibration runs; the shortest one wins */
+#define CLOCK_CALIBRATE_RUNS    3
+
+/* CPUID 0x80000007 EDX: TSC runs at a constant rate in every C/P-state */
+#define CPUID_EDX_INVARIANT_TSC (1 << 8)
+
+/* CMOS RTC ports and registers */
+#define CMOS_ADDRESS            0x70
+#define CMOS_DATA               0x71
+#define CMOS_SECONDS            0x00
+#define CMOS_MINUTES            0x02
+#define CMOS_HOURS              0x04
+#define CMOS_DAY                0x07
+#define CMOS_MONTH              0x08
+#define CMOS_YEAR               0x09
+#define CMOS_STATUS_A           0x0A
+#define CMOS_STATUS_B           0x0B
+#define CMOS_A_UPDATING         0x80        /* Update in progress */
+#define CMOS_B_BINARY           0x04        /* Binary, not BCD */
+#define CMOS_B_24H              0x02
+#define CMOS_HOURS_PM           0x80        /* 12-hour mode */
+
+/* Written once by clock_init, read locklessly afterwards */
+static uint64_t clock_tsc_base = 0;
+static uint64_t clock_tsc_per_ms = 0;
+static uint64_t clock_mult = 0;
+static volatile bool clock_calibrated = false;
+
+/* Wall-clock time at monotonic 0 (ns since the epoch) */
+static volatile uint64_t clock_wall_offset = 0;
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS, reg);
+    io_wait();
+    return inb(CMOS_DATA);
+}
+
+static uint32_t cmos_decode(uint8_t value, bool binary) {
+    return binary ? value : (uint32_t)(value >> 4) * 10 + (value & 0x0F);
+}
+
+/**
+ * Read the CMOS RTC as seconds since the epoch
+ * The time is read until two reads outside an update agree. The year
+ * register has no century: 70-99 are taken as 19xx, the rest as 20xx.
+ * @return 0 if the RTC holds no valid date
+ */
+static uint64_t clock_read_rtc(void) {
+    static const uint8_t regs[6] = {
+        CMOS_SECONDS, CMOS_MINUTES, CMOS_HOURS, CMOS_DAY, CMOS_MONTH, CMOS_YEAR
+    };
+    uint8_t now[6], last[6];
+    bool same;
+
+    do {
+        while (cmos_read(CMOS_STATUS_A) & CMOS_A_UPDATING) {
+        }
+        for (int i = 0; i < 6; i++) {
+            now[i] = cmos_read(regs[i]);
+        }
+        while (cmos_read(CMOS_STATUS_A) & CMOS_A_UPDATING) {
+        }
+        same = true;
+        for (int i = 0; i < 6; i++) {
+            last[i] = cmos_read(regs[i]);
+            same = same && last[i] == now[i];
+        }
+    } while (!same);
+
+    uint8_t status = cmos_read(CMOS_STATUS_B);
+    bool binary = (status & CMOS_B_BINARY) != 0;
+
+    uint32_t second = cmos_decode(now[0], binary);
+    uint32_t minute = cmos_decode(now[1], binary);
+    uint32_t hour = cmos_decode(now[2] & ~CMOS_HOURS_PM, binary);
+    uint32_t day = cmos_decode(now[3], binary);
+    uint32_t month = cmos_decode(now[4], binary);
+    uint32_t year = cmos_decode(now[5], binary);
+
+    if (!(status & CMOS_B_24H)) {
+        hour %= 12;
+        if (now[2] & CMOS_HOURS_PM) {
+            hour += 12;
+        }
+    }
+    year += year >= 70 ? 1900 : 2000;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23) {
+        return 0;
+    }
+
+    /* Days since 1970-01-01, counting years from March so leap days come last */
+    int64_t y = (int64_t)year - (month <= 2);
+    int64_t era = y / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+
+    return (uint64_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/**
+ * TSC ticks across one PIT channel 2 countdown of pit_count
+ */
+static uint64_t clock_measure(uint16_t pit_count) {
+    /* Gate on, speaker off */
+    uint8_t speaker = inb(0x61);
+    outb(0x61, (speaker & 0xFC) | 0x01);
+
+    /* Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+    outb(PIT_CMD, 0xB0);
+    io_wait();
+    outb(PIT_CHANNEL2_DATA, pit_count & 0xFF);
+    io_wait();
+    outb(PIT_CHANNEL2_DATA, (pit_count >> 8) & 0xFF);
+    io_wait();
+
+    /* Restart the count by toggling the gate */
+    speaker = inb(0x61);
+    outb(0x61, speaker & 0xFE);
+    outb(0x61, speaker | 0x01);
+    uint64_t start = rdtsc();
+
+    /* OUT goes high (bit 5) when the count reaches zero */
+    while (!(inb(0x61) & 0x20)) {
+        __asm__ __volatile__("pause");
+    }
+
+    return rdtsc() - start;
+}
+
+/**
+ * Check CPUID for an invariant TSC
+ */
+static bool clock_tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) {
+        return false;
+    }
+
+    cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+bool clock_init(void) {
+    if (clock_calibrated) {
+        return true;
+    }
+
+    kprintf("[CLOCK] Calibrating TSC against the PIT (%u ms)...\n", CLOCK_CALIBRATE_MS);
+
+    uint16_t pit_count = (uint16_t)((uint64_t)PIT_FREQUENCY * CLOCK_CALIBRATE_MS / 1000);
+    uint64_t best = 0;
+    for (int run = 0; run < CLOCK_CALIBRATE_RUNS; run++) {
+        uint64_t cycles = clock_measure(pit_count);
+        if (best == 0 || cycles < best) {
+            best = cycles;
+        }
+    }
+
+    /* ticks/ms = cycles / (pit_count / PIT_FREQUENCY s) / 1000 */
+    clock_tsc_per_ms = best * PIT_FREQUENCY / ((uint64_t)pit_count * 1000);
+    if (clock_tsc_per_ms == 0) {
+        kprintf("[CLOCK] ERROR: TSC calibration failed\n");
+        return false;
+    }
+
+    clock_mult = (NSEC_PER_MSEC << CLOCK_SHIFT) / clock_tsc_per_ms;
+    clock_tsc_base = rdtsc();
+    __atomic_store_n(&clock_calibrated, true, __ATOMIC_RELEASE);
+
+    kprintf("[CLOCK] TSC: %llu kHz%s\n", clock_tsc_per_ms,
+            clock_tsc_invariant() ? ", invariant" : " (not invariant, may drift)");
+
+    /* The RTC only counts whole seconds */
+    clock_set_realtime_ns(clock_read_rtc() * NSEC_PER_SEC);
+    kprintf("[CLOCK] Wall clock: %llu s since the epoch\n", clock_realtime_ns() / NSEC_PER_SEC);
+
+    return true;
+}
+
+bool clock_ready(void) {
+    return __atomic_load_n(&clock_calibrated, __ATOMIC_ACQUIRE);
+}
+
+uint64_t clock_cycles(void) {
+    return rdtsc();
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * clock_mult) >> CLOCK_SHIFT);
+}
+
+uint64_t clock_monotonic_ns(void) {
+    if (!clock_ready()) {
+        return 0;
+    }
+    return clock_cycles_to_ns(rdtsc() - clock_tsc_base);
+}
+
+uint64_t clock_monotonic_ms(void) {
+    return clock_monotonic_ns() / NSEC_PER_MSEC;
+}
+
+uint64_t clock_realtime_ns(void) {
+    return __atomic_load_n(&clock_wall_offset, __ATOMIC_RELAXED) + clock_monotonic_ns();
+}
+
+void clock_set_realtime_ns(uint64_t unix_ns) {
+    __atomic_store_n(&clock_wall_offset, unix_ns - clock_monotonic_ns(), __ATOMIC_RELAXED);
+    vdso_update_clock();
+}
+
+void clock_get_scale(uint64_t *tsc_base, uint64_t *mult) {
+    bool ready = clock_ready();
+    *tsc_base = ready ? clock_tsc_base : 0;
+    *mult = ready ? clock_mult : 0;
+}
+
+uint64_t clock_realtime_offset_ns(void) {
+    return __atomic_load_n(&clock_wall_offset, __ATOMIC_RELAXED);
+}
+
+uint64_t clock_tsc_khz(void) {
+    return clock_tsc_per_ms;
+}
@@ -0,0 +1,90 @@
+/**
+ * AAAos Kernel - Clock Source
+ *
+ * The monotonic clock is the TSC, calibrated once at boot against PIT
+ * channel 2 and scaled to nanoseconds with a fixed-point multiplier.
+ * Reading it takes no lock and touches no shared writable state, so it
+ * works from any context, including interrupt handlers and before the
+ * scheduler runs. The RTC is read once for the offset between the
+ * monotonic clock and wall-clock time.
+ *
+ * All CPUs read their own TSC, which assumes an invariant TSC that runs
+ * in step across packages (reported by CPUID 0x80000007).
+ */
+
+#ifndef _AAAOS_SCHED_CLOCK_H
+#define _AAAOS_SCHED_CLOCK_H
+
+#include "../include/types.h"
+
+/* PIT gate window used to calibrate the TSC */
+#define CLOCK_CALIBRATE_MS      50
+
+/* Fixed-point shift of the cycles-to-nanoseconds multiplier */
+#define CLOCK_SHIFT             32
+
+#define NSEC_PER_MSEC           1000000ULL
+#define NSEC_PER_SEC            1000000000ULL
+
+/**
+ * Calibrate the TSC and read the wall-clock offset from the RTC
+ * Safe to call more than once; later calls do nothing.
+ * @return true if the TSC was calibrated
+ */
+bool clock_init(void);
+
+/**
+ * Check if the clock has been calibrated
+ */
+bool clock_ready(void);
+
+/**
+ * Nanoseconds since clock_init (0 before it)
+ */
+uint64_t clock_monotonic_ns(void);
+
+/**
+ * Milliseconds since clock_init
+ */
+uint64_t clock_monotonic_ms(void);
+
+/**
+ * Wall-clock time in nanoseconds since the Unix epoch
+ */
+uint64_t clock_realtime_ns(void);
+
+/**
+ * Set the wall-clock time (the monotonic clock is not affected)
+ * @param unix_ns Nanoseconds since the Unix epoch
+ */
+void clock_set_realtime_ns(uint64_t unix_ns);
+
+/**
+ * Get the cycles-to-nanoseconds conversion, for readers outside the
+ * kernel: ns = ((tsc - tsc_base) * mult) >> CLOCK_SHIFT
+ * Both are 0 before clock_init.
+ */
+void clock_get_scale(uint64_t *tsc_base, uint64_t *mult);
+
+/**
+ * Wall-clock time at monotonic 0, in nanoseconds since the Unix epoch
+ */
+uint64_t clock_realtime_offset_ns(void);
+
+/**
+ * Raw cycle counter, for profiling
+ */
+uint64_t clock_cycles(void);
+
+/**
+ * Convert a cycle count (a clock_cycles difference) to nanoseconds
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/**
+ * Calibrated TSC frequency
+ * @return TSC ticks per millisecond, or 0 before clock_init
+ */
+uint64_t clock_tsc_khz(void);
+
+#endif /* _AAAOS_SCHED_CLOCK_H */
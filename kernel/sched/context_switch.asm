@@ -194,6 +194,12 @@ context_switch_first:
     push qword [rsi + 0x80]     ; CS
     push qword [rsi + 0x78]     ; RIP
 
+    ; Entering user mode: swap the per-CPU GS base out
+    test qword [rsi + 0x80], 3
+    jz .kernel_mode
+    swapgs
+.kernel_mode:
+
     ; Restore RDI and RSI last
     mov rdi, [rsi + 0x48]
     mov rsi, [rsi + 0x50]
@@ -0,0 +1,275 @@
+/**
+ * AAAos Kernel - CPU Idle
+ *
+ * The idle loop announces itself to the scheduler (scheduler_idle_watch)
+ * and keeps interrupts off while it arms the monitor, checks the flag and
+ * sleeps, so work queued at any point either shows in the check or
+ * breaks the MWAIT. MWAIT is issued with interrupts off and the
+ * interrupt-break extension, so the interrupt that ends it is taken
+ * after the loop has stopped watching. Polling runs with interrupts on;
+ * should a handler switch to another process meanwhile, the scheduler
+ * ends the watch itself.
+ *
+ * The idle period prediction is a running average of this CPU's past
+ * periods. The idle process of a CPU never leaves it, so the per-CPU
+ * state is only touched by its own CPU.
+ */
+
+#include "idle.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "../include/serial.h"
+#include "../init/initcall.h"
+#include "../arch/x86_64/acpi.h"
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../stats/kstat.h"
+
+/* CPUID feature bits */
+#define CPUID_1_ECX_MONITOR     BIT(3)
+#define CPUID_5_ECX_EMX         BIT(0)      /* MWAIT extensions enumerated */
+#define CPUID_5_ECX_IBE         BIT(1)      /* Interrupts break MWAIT with IF clear */
+#define CPUID_6_EAX_ARAT        BIT(2)      /* APIC timer keeps running in deep C-states */
+
+/* MWAIT ECX: wake on interrupts even with interrupts disabled */
+#define MWAIT_ECX_BREAK         1
+
+/* FADT worst-case latencies above these mean the state is not supported */
+#define FADT_C2_LATENCY_MAX     100
+#define FADT_C3_LATENCY_MAX     1000
+
+/* Target residency, in multiples of the exit latency */
+#define IDLE_RESIDENCY_FACTOR   3
+
+/* Weight of the newest period in the prediction: 1 / 2^IDLE_AVG_SHIFT */
+#define IDLE_AVG_SHIFT          3
+
+/* States assumed when the firmware gives no latencies */
+static const idle_state_t idle_defaults[IDLE_MAX_STATES] = {
+    { "C1", 0x00, 2, 2 },
+    { "C2", 0x10, 50, 50 * IDLE_RESIDENCY_FACTOR },
+    { "C3", 0x20, 100, 100 * IDLE_RESIDENCY_FACTOR },
+};
+
+/**
+ * Per-CPU idle state
+ */
+typedef struct idle_cpu {
+    uint64_t predicted_ns;              /* Expected length of the next idle period */
+    uint64_t entries;
+    uint64_t poll_wakes;
+    uint64_t usage[IDLE_MAX_STATES];
+    uint64_t residency_ns[IDLE_MAX_STATES];
+} ALIGNED(64) idle_cpu_t;
+
+static idle_cpu_t idle_cpus[PERCPU_MAX_CPUS];
+
+/* Filled by the initcall before idle_mwait is set, read-only after */
+static idle_state_t idle_states[IDLE_MAX_STATES];
+static uint32_t idle_state_count = 0;
+static bool idle_mwait = false;
+
+static uint32_t idle_latency_limit = IDLE_LATENCY_ANY;
+static uint32_t idle_poll_us = 0;
+
+static uint64_t idle_sum(size_t offset) {
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        total += *(const uint64_t*)((const uint8_t*)&idle_cpus[cpu] + offset);
+    }
+    return total;
+}
+
+static uint64_t idle_poll_wakes_gauge(void) {
+    return idle_sum(__builtin_offsetof(idle_cpu_t, poll_wakes));
+}
+
+KSTAT_GAUGE(idle_poll_wakes, "sched.idle.poll_wakes", "Idle polls that found work",
+            idle_poll_wakes_gauge);
+
+static inline void cpu_monitor(const volatile void *addr) {
+    __asm__ __volatile__("monitor" : : "a"(addr), "c"(0), "d"(0) : "memory");
+}
+
+static inline void cpu_mwait(uint32_t hint, uint32_t ext) {
+    __asm__ __volatile__("mwait" : : "a"(hint), "c"(ext) : "memory");
+}
+
+/**
+ * Deepest state the latency limit and the predicted idle time allow
+ * C1 is always allowed.
+ */
+static uint32_t idle_choose(const idle_cpu_t *c) {
+    uint32_t limit = __atomic_load_n(&idle_latency_limit, __ATOMIC_RELAXED);
+    uint32_t pick = 0;
+
+    for (uint32_t i = 1; i < idle_state_count; i++) {
+        const idle_state_t *s = &idle_states[i];
+        if (s->latency_us > limit || (uint64_t)s->residency_us * 1000 > c->predicted_ns) {
+            break;
+        }
+        pick = i;
+    }
+    return pick;
+}
+
+void idle_enter(void) {
+    uint64_t poll_ns = (uint64_t)__atomic_load_n(&idle_poll_us, __ATOMIC_RELAXED) * 1000;
+    if (!__atomic_load_n(&idle_mwait, __ATOMIC_ACQUIRE) && poll_ns == 0) {
+        __asm__ __volatile__("sti\n" "hlt\n");
+        return;
+    }
+
+    idle_cpu_t *c = &idle_cpus[percpu_cpu_id()];
+    c->entries++;
+
+    interrupts_disable();
+    volatile bool *wake = scheduler_idle_watch();
+    uint64_t start = clock_cycles();
+
+    /* Low-latency mode: spin briefly, with interrupts on, before sleeping */
+    if (poll_ns != 0) {
+        interrupts_enable();
+        while (!*wake && clock_cycles_to_ns(clock_cycles() - start) < poll_ns) {
+            __asm__ __volatile__("pause");
+        }
+        interrupts_disable();
+        if (*wake) {
+            c->poll_wakes++;
+        }
+    }
+
+    if (!*wake && idle_mwait) {
+        uint32_t i = idle_choose(c);
+        uint64_t slept = clock_cycles();
+
+        cpu_monitor(wake);
+        if (!*wake) {
+            cpu_mwait(idle_states[i].hint, MWAIT_ECX_BREAK);
+        }
+        c->usage[i]++;
+        c->residency_ns[i] += clock_cycles_to_ns(clock_cycles() - slept);
+    } else if (!*wake) {
+        /* HLT only wakes on interrupts: have wakeups send the IPI again */
+        scheduler_idle_unwatch();
+        if (!*wake) {
+            __asm__ __volatile__("sti\n" "hlt\n" "cli\n");
+        }
+    }
+    scheduler_idle_unwatch();
+
+    uint64_t ns = clock_cycles_to_ns(clock_cycles() - start);
+    c->predicted_ns += (ns >> IDLE_AVG_SHIFT) - (c->predicted_ns >> IDLE_AVG_SHIFT);
+
+    /* Woken by the flag alone: there was no IPI to switch for us */
+    scheduler_preempt();
+    interrupts_enable();
+}
+
+void idle_set_latency_limit(uint32_t us) {
+    __atomic_store_n(&idle_latency_limit, us, __ATOMIC_RELAXED);
+}
+
+bool idle_set_poll(uint32_t us) {
+    if (us > IDLE_POLL_MAX_US) {
+        return false;
+    }
+    __atomic_store_n(&idle_poll_us, us, __ATOMIC_RELAXED);
+    return true;
+}
+
+void idle_get_stats(idle_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    *stats = (idle_stats_t){0};
+    stats->mwait = __atomic_load_n(&idle_mwait, __ATOMIC_ACQUIRE);
+    if (stats->mwait) {
+        stats->state_count = idle_state_count;
+        for (uint32_t i = 0; i < idle_state_count; i++) {
+            stats->states[i] = idle_states[i];
+            stats->usage[i] = idle_sum(__builtin_offsetof(idle_cpu_t, usage) +
+                                       i * sizeof(uint64_t));
+            stats->residency_ns[i] = idle_sum(__builtin_offsetof(idle_cpu_t, residency_ns) +
+                                              i * sizeof(uint64_t));
+        }
+    }
+    stats->entries = idle_sum(__builtin_offsetof(idle_cpu_t, entries));
+    stats->poll_wakes = idle_sum(__builtin_offsetof(idle_cpu_t, poll_wakes));
+    stats->latency_limit_us = __atomic_load_n(&idle_latency_limit, __ATOMIC_RELAXED);
+    stats->poll_us = __atomic_load_n(&idle_poll_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * Build the state table from CPUID and the FADT
+ * @return Usable states, 0 if the CPU cannot idle in MWAIT
+ */
+static uint32_t idle_probe(void) {
+    uint32_t max_leaf, eax, ebx, ecx, edx;
+
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    if (max_leaf < 5) {
+        return 0;
+    }
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_1_ECX_MONITOR)) {
+        return 0;
+    }
+    cpuid(5, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_5_ECX_EMX) || !(ecx & CPUID_5_ECX_IBE)) {
+        return 0;
+    }
+    uint32_t substates = edx;
+
+    /* Without ARAT the APIC timer stops below C1 and timers would be missed */
+    uint32_t eax6 = 0;
+    if (max_leaf >= 6) {
+        cpuid(6, &eax6, &ebx, &ecx, &edx);
+    }
+    bool deep = (eax6 & CPUID_6_EAX_ARAT) != 0;
+
+    const fadt_t *fadt = acpi_get_fadt();
+    uint32_t count = 0;
+    idle_states[count++] = idle_defaults[0];
+
+    for (uint32_t i = 1; deep && i < IDLE_MAX_STATES; i++) {
+        /* EDX nibble n counts the MWAIT sub-states of Cn */
+        if (((substates >> ((i + 1) * 4)) & 0xF) == 0) {
+            break;
+        }
+
+        idle_state_t s = idle_defaults[i];
+        if (fadt != NULL) {
+            uint32_t lat = i == 1 ? fadt->worst_c2_latency : fadt->worst_c3_latency;
+            uint32_t max = i == 1 ? FADT_C2_LATENCY_MAX : FADT_C3_LATENCY_MAX;
+            if (lat > max) {
+                break;
+            }
+            if (lat != 0) {
+                s.latency_us = lat;
+                s.residency_us = lat * IDLE_RESIDENCY_FACTOR;
+            }
+        }
+        idle_states[count++] = s;
+    }
+    return count;
+}
+
+static bool idle_initcall(void) {
+    idle_state_count = idle_probe();
+    if (idle_state_count == 0) {
+        kprintf("[IDLE] No usable MWAIT, idling in HLT\n");
+        return true;
+    }
+    __atomic_store_n(&idle_mwait, true, __ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i < idle_state_count; i++) {
+        kprintf("[IDLE] %s: MWAIT hint 0x%02x, exit latency %u us\n",
+                idle_states[i].name, idle_states[i].hint, idle_states[i].latency_us);
+    }
+    return true;
+}
+
+INITCALL(idle, idle_initcall, 0);
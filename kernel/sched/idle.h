@@ -0,0 +1,82 @@
+/**
+ * AAAos Kernel - CPU Idle
+ *
+ * What an idle process does between runs. Where the CPU has
+ * MONITOR/MWAIT, the idle loop arms a monitor on its run queue's
+ * need_reschedule flag and sleeps in MWAIT: a CPU queueing work for it
+ * wakes it with that store alone, and sends no reschedule IPI. Without
+ * MWAIT it sleeps in HLT and wakeups send IPIs as before.
+ *
+ * The governor picks the deepest C-state whose exit latency fits the
+ * latency limit and whose target residency fits the idle time predicted
+ * from this CPU's recent idle periods. States come from CPUID leaf 5,
+ * with the FADT's worst-case C2/C3 latencies where the firmware gives
+ * them. For latency-sensitive nodes the idle loop can first spin on the
+ * flag for a while, so work that arrives soon finds the CPU awake.
+ */
+
+#ifndef _AAAOS_SCHED_IDLE_H
+#define _AAAOS_SCHED_IDLE_H
+
+#include "../include/types.h"
+
+/* C-states the governor chooses between (C1 to C3) */
+#define IDLE_MAX_STATES         3
+
+/* No latency limit */
+#define IDLE_LATENCY_ANY        0xFFFFFFFFu
+
+/* Longest polling period idle_set_poll accepts */
+#define IDLE_POLL_MAX_US        1000
+
+/**
+ * Idle state
+ */
+typedef struct idle_state {
+    const char *name;
+    uint32_t hint;                      /* MWAIT hint (EAX) */
+    uint32_t latency_us;                /* Exit latency */
+    uint32_t residency_us;              /* Shortest stay that pays off */
+} idle_state_t;
+
+/**
+ * Idle statistics (all CPUs)
+ */
+typedef struct idle_stats {
+    bool mwait;                         /* Sleeping in MWAIT rather than HLT */
+    uint32_t state_count;               /* Entries of states[] in use */
+    idle_state_t states[IDLE_MAX_STATES];
+    uint64_t usage[IDLE_MAX_STATES];    /* Times each state was entered */
+    uint64_t residency_ns[IDLE_MAX_STATES]; /* Time spent in each state */
+    uint64_t entries;                   /* Calls to idle_enter */
+    uint64_t poll_wakes;                /* Work found while polling */
+    uint64_t monitor_wakes;             /* MWAIT woken by the flag, not an interrupt */
+    uint32_t latency_limit_us;
+    uint32_t poll_us;
+} idle_stats_t;
+
+/**
+ * Idle once: sleep until an interrupt or new work, then run the work
+ * Called in a loop by the idle processes, with interrupts enabled.
+ */
+void idle_enter(void);
+
+/**
+ * Limit the exit latency of the states the governor may pick
+ * @param us Largest exit latency in microseconds (IDLE_LATENCY_ANY: none)
+ */
+void idle_set_latency_limit(uint32_t us);
+
+/**
+ * Spin on the wakeup flag before sleeping (low-latency mode)
+ * @param us Microseconds to poll, at most IDLE_POLL_MAX_US (0 turns it off)
+ * @return false if us is too large
+ */
+bool idle_set_poll(uint32_t us);
+
+/**
+ * Get idle statistics
+ */
+void idle_get_stats(idle_stats_t *stats);
+
+#endif /* _AAAOS_SCHED_IDLE_H */
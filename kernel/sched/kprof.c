@@ -0,0 +1,621 @@
+/**
+ * AAAos Kernel - Sampling Profiler
+ *
+ * Each CPU arms and disarms its own sample source: kprof_start and
+ * kprof_stop change the global state and send IPI_VECTOR_PROFILE to the
+ * other CPUs, whose handler brings them in line with it. A ring is only
+ * written by its CPU, from interrupt context, and only read once every
+ * CPU has disarmed.
+ */
+
+#include "kprof.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../mm/heap.h"
+#include "../mm/vmm.h"
+#include "../proc/elf.h"
+#include "../proc/process.h"
+#include "clock.h"
+#include "timer.h"
+
+#define KPROF_RING_MASK         (KPROF_RING_SIZE - 1)
+
+_Static_assert((KPROF_RING_SIZE & KPROF_RING_MASK) == 0, "KPROF_RING_SIZE must be a power of 2");
+
+/* Architectural performance monitoring MSRs */
+#define MSR_IA32_PMC0                   0x0C1
+#define MSR_IA32_PERFEVTSEL0            0x186
+#define MSR_IA32_PERF_GLOBAL_CTRL       0x38F
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+/* PERFEVTSEL bits; event 0x3C umask 0 is UnHalted Core Cycles */
+#define PERFEVTSEL_CORE_CYCLES  0x003C
+#define PERFEVTSEL_USR          (1 << 16)
+#define PERFEVTSEL_OS           (1 << 17)
+#define PERFEVTSEL_INT          (1 << 20)
+#define PERFEVTSEL_EN           (1 << 22)
+
+/* Legacy PMC writes sign-extend bit 31, so a period must fit below it */
+#define KPROF_MAX_PERIOD        0x7FFFFFFFULL
+
+/* Time kprof_stop waits for the other CPUs to disarm */
+#define KPROF_STOP_TIMEOUT_MS   100
+
+/* Folded stack line, names included */
+#define KPROF_LINE_MAX          512
+
+/* Frame keys: a symbol index with this bit set, or else the address */
+#define KPROF_KEY_SYM           (1ULL << 63)
+#define KPROF_KEY_USER          UINT64_MAX
+
+/**
+ * One sample
+ */
+typedef struct kprof_sample {
+    uint64_t pc[KPROF_MAX_DEPTH + 1];   /* Interrupted RIP, then return addresses */
+    uint8_t depth;                      /* Entries of pc in use */
+    bool user;                          /* Interrupted user mode (pc[0] only) */
+} kprof_sample_t;
+
+/**
+ * Per-CPU state
+ */
+typedef struct kprof_cpu {
+    kprof_sample_t *ring;               /* KPROF_RING_SIZE samples, NULL until first start */
+    uint64_t head;                      /* Samples taken in this run */
+    uint64_t user;
+    ktimer_t timer;                     /* Timer mode sample clock */
+    volatile bool due;                  /* Timer mode: sample at the end of this interrupt */
+    volatile bool armed;
+} ALIGNED(64) kprof_cpu_t;
+
+static kprof_cpu_t kprof_cpus[PERCPU_MAX_CPUS];
+static uint32_t kprof_ncpus = 0;        /* CPUs with a ring */
+
+static volatile bool kprof_on = false;
+static kprof_mode_t kprof_mode = KPROF_MODE_OFF;
+static uint32_t kprof_hz = 0;
+static uint64_t kprof_period = 0;       /* PMU mode: cycles between samples */
+
+static bool kprof_initialized = false;
+static uint32_t kprof_pmu_version = 0;  /* 0 if there is no usable PMU */
+
+/* ============================================================================
+ * Sampling (interrupt context)
+ * ============================================================================ */
+
+/**
+ * Follow the frame pointer chain of interrupted kernel code
+ * Frames must lie above the interrupted RSP, within one kernel stack,
+ * and each must be above the last.
+ * @return Number of return addresses stored
+ */
+static uint32_t kprof_walk(const interrupt_frame_t *frame, uint64_t *out) {
+    uint64_t lo = frame->rsp;
+    uint64_t hi = lo + PROCESS_KERNEL_STACK_SIZE;
+    uint64_t fp = frame->rbp;
+    uint32_t n = 0;
+
+    if (hi < lo) {
+        hi = UINT64_MAX;
+    }
+    while (n < KPROF_MAX_DEPTH && fp >= lo && fp < hi - 16 && (fp & 7) == 0) {
+        const uint64_t *f = (const uint64_t *)fp;
+        if (f[1] < VMM_KERNEL_BASE) {
+            break;
+        }
+        out[n++] = f[1];
+        lo = fp + 16;
+        fp = f[0];
+    }
+    return n;
+}
+
+static void kprof_sample(const interrupt_frame_t *frame) {
+    uint32_t cpu = percpu_cpu_id();
+
+    if (!kprof_on || cpu >= kprof_ncpus) {
+        return;
+    }
+
+    kprof_cpu_t *c = &kprof_cpus[cpu];
+    kprof_sample_t *s = &c->ring[c->head & KPROF_RING_MASK];
+
+    s->pc[0] = frame->rip;
+    s->user = (frame->cs & 3) != 0;
+    s->depth = (uint8_t)(1 + (s->user ? 0 : kprof_walk(frame, &s->pc[1])));
+    if (s->user) {
+        c->user++;
+    }
+    __atomic_store_n(&c->head, c->head + 1, __ATOMIC_RELEASE);
+}
+
+void kprof_timer_tick(const interrupt_frame_t *frame) {
+    kprof_cpu_t *c = &kprof_cpus[percpu_cpu_id()];
+
+    if (!c->due) {
+        return;
+    }
+    c->due = false;
+    kprof_sample(frame);
+}
+
+/**
+ * Timer mode: ask the interrupt that runs this to take a sample
+ * The callback has no interrupted context of its own.
+ */
+static void kprof_timer_fn(void *arg) {
+    ((kprof_cpu_t *)arg)->due = true;
+}
+
+static void kprof_pmu_reload(void) {
+    wrmsr(MSR_IA32_PMC0, (uint64_t)-(int64_t)kprof_period);
+}
+
+/**
+ * Counter overflow interrupt
+ */
+static void kprof_pmi(interrupt_frame_t *frame) {
+    if (kprof_pmu_version >= 2) {
+        wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    }
+    kprof_sample(frame);
+
+    if (kprof_cpus[percpu_cpu_id()].armed) {
+        kprof_pmu_reload();
+        /* Delivering the interrupt masked the LVT entry */
+        apic_write(APIC_REG_LVT_PERF, APIC_PERF_VECTOR);
+    }
+}
+
+/* ============================================================================
+ * Arming
+ * ============================================================================ */
+
+/**
+ * Check for architectural performance monitoring with a cycle event
+ * @return Its version, or 0 if it cannot be used
+ */
+static uint32_t kprof_pmu_probe(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0xA) {
+        return 0;
+    }
+    cpuid(0xA, &eax, &ebx, &ecx, &edx);
+
+    uint32_t version = eax & 0xFF;
+    uint32_t counters = (eax >> 8) & 0xFF;
+    uint32_t events = (eax >> 24) & 0xFF;
+
+    /* EBX bit 0 set means core cycles cannot be counted */
+    if (version == 0 || counters == 0 || events == 0 || (ebx & 1)) {
+        return 0;
+    }
+    return version;
+}
+
+static void kprof_pmu_arm(void) {
+    wrmsr(MSR_IA32_PERFEVTSEL0, 0);
+    kprof_pmu_reload();
+    apic_write(APIC_REG_LVT_PERF, APIC_PERF_VECTOR);
+    if (kprof_pmu_version >= 2) {
+        wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1);
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, rdmsr(MSR_IA32_PERF_GLOBAL_CTRL) | 1);
+    }
+    wrmsr(MSR_IA32_PERFEVTSEL0, PERFEVTSEL_CORE_CYCLES | PERFEVTSEL_USR | PERFEVTSEL_OS |
+                                PERFEVTSEL_INT | PERFEVTSEL_EN);
+}
+
+static void kprof_pmu_disarm(void) {
+    wrmsr(MSR_IA32_PERFEVTSEL0, 0);
+    apic_write(APIC_REG_LVT_PERF, APIC_PERF_VECTOR | APIC_LVT_MASKED);
+}
+
+/**
+ * Bring this CPU's sample source in line with kprof_on
+ * Runs with interrupts disabled.
+ */
+static void kprof_sync_cpu(void) {
+    uint32_t cpu = percpu_cpu_id();
+    bool on = kprof_on;
+
+    if (cpu >= kprof_ncpus || kprof_cpus[cpu].armed == on) {
+        return;
+    }
+
+    kprof_cpu_t *c = &kprof_cpus[cpu];
+    if (kprof_mode == KPROF_MODE_PMU) {
+        if (on) {
+            kprof_pmu_arm();
+        } else {
+            kprof_pmu_disarm();
+        }
+    } else if (on) {
+        uint64_t period_ns = 1000000000ULL / kprof_hz;
+        ktimer_start(&c->timer, period_ns, period_ns);
+    } else {
+        ktimer_cancel(&c->timer);
+        c->due = false;
+    }
+    c->armed = on;
+}
+
+static void kprof_ipi(interrupt_frame_t *frame) {
+    UNUSED(frame);
+    kprof_sync_cpu();
+}
+
+/**
+ * Sync this CPU and ask the others to follow
+ */
+static void kprof_broadcast(void) {
+    uint64_t flags = interrupts_save();
+    kprof_sync_cpu();
+    interrupts_restore(flags);
+
+    if (!apic_get_info()->enabled) {
+        return;
+    }
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        if (cpu != percpu_cpu_id()) {
+            apic_send_ipi((uint8_t)percpu_get(cpu)->apic_id, IPI_VECTOR_PROFILE);
+        }
+    }
+}
+
+/**
+ * Probe the PMU, hook the vectors and allocate the rings of online CPUs
+ */
+static bool kprof_setup(void) {
+    if (!kprof_initialized) {
+        kprof_pmu_version = apic_get_info()->enabled ? kprof_pmu_probe() : 0;
+        idt_register_handler(APIC_PERF_VECTOR, kprof_pmi);
+        idt_register_handler(IPI_VECTOR_PROFILE, kprof_ipi);
+        kprof_initialized = true;
+    }
+
+    uint32_t online = percpu_online_count();
+    if (online > PERCPU_MAX_CPUS) {
+        online = PERCPU_MAX_CPUS;
+    }
+    for (uint32_t cpu = kprof_ncpus; cpu < online; cpu++) {
+        kprof_cpus[cpu].ring = kmalloc(KPROF_RING_SIZE * sizeof(kprof_sample_t));
+        if (!kprof_cpus[cpu].ring) {
+            return false;
+        }
+        ktimer_init(&kprof_cpus[cpu].timer, kprof_timer_fn, &kprof_cpus[cpu]);
+        kprof_ncpus = cpu + 1;
+    }
+    return true;
+}
+
+bool kprof_start(uint32_t hz) {
+    if (hz == 0) {
+        hz = KPROF_HZ;
+    }
+    if (kprof_on || hz > KPROF_MAX_HZ) {
+        return false;
+    }
+    if (!kprof_setup()) {
+        kprintf("[PROF] Cannot allocate the sample rings\n");
+        return false;
+    }
+
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        kprof_cpus[cpu].head = 0;
+        kprof_cpus[cpu].user = 0;
+        kprof_cpus[cpu].due = false;
+    }
+
+    /* Core cycles tick at about the TSC rate */
+    uint64_t period = clock_tsc_khz() * 1000 / hz;
+    kprof_mode = (kprof_pmu_version != 0 && period != 0) ? KPROF_MODE_PMU : KPROF_MODE_TIMER;
+    kprof_period = period < KPROF_MAX_PERIOD ? period : KPROF_MAX_PERIOD;
+    kprof_hz = hz;
+
+    __atomic_store_n(&kprof_on, true, __ATOMIC_SEQ_CST);
+    kprof_broadcast();
+
+    kprintf("[PROF] Sampling at %u Hz on %u CPU(s), %s driven\n", hz, kprof_ncpus,
+            kprof_mode == KPROF_MODE_PMU ? "cycle counter" : "timer");
+    return true;
+}
+
+void kprof_stop(void) {
+    if (!kprof_on) {
+        return;
+    }
+
+    __atomic_store_n(&kprof_on, false, __ATOMIC_SEQ_CST);
+    kprof_broadcast();
+
+    /* The rings are read only once no CPU can write them */
+    uint64_t deadline = timer_now_ms() + KPROF_STOP_TIMEOUT_MS;
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        while (kprof_cpus[cpu].armed && timer_now_ms() < deadline) {
+            __asm__ __volatile__("pause");
+        }
+        if (kprof_cpus[cpu].armed) {
+            kprintf("[PROF] Warning: CPU %u did not stop sampling\n", cpu);
+        }
+    }
+}
+
+bool kprof_running(void) {
+    return kprof_on;
+}
+
+/* ============================================================================
+ * Folded Stacks
+ * ============================================================================ */
+
+/**
+ * Function symbols of the kernel image, by address
+ */
+typedef struct kprof_symtab {
+    const elf64_sym_t **funcs;
+    size_t count;
+    const char *strtab;
+    size_t strtab_size;
+} kprof_symtab_t;
+
+/**
+ * Check that a section lies within the image
+ */
+static bool kprof_section_ok(const elf64_shdr_t *shdr, size_t size) {
+    return shdr && shdr->sh_offset <= size && shdr->sh_size <= size - shdr->sh_offset;
+}
+
+/**
+ * Collect and sort the FUNC symbols of .symtab
+ * @return false if the image has no usable symbol table
+ */
+static bool kprof_load_symbols(const void *elf, size_t size, kprof_symtab_t *tab) {
+    tab->funcs = NULL;
+    tab->count = 0;
+
+    if (!elf || elf_validate(elf, size) != ELF_SUCCESS) {
+        return false;
+    }
+    const elf64_shdr_t *symtab = elf_find_section(elf, ".symtab");
+    const elf64_shdr_t *strtab = elf_find_section(elf, ".strtab");
+    if (!kprof_section_ok(symtab, size) || !kprof_section_ok(strtab, size)) {
+        return false;
+    }
+
+    const uint8_t *base = (const uint8_t *)elf;
+    const elf64_sym_t *syms = (const elf64_sym_t *)(base + symtab->sh_offset);
+    size_t nsyms = symtab->sh_size / sizeof(elf64_sym_t);
+
+    tab->funcs = kmalloc(nsyms * sizeof(*tab->funcs) + 1);
+    if (!tab->funcs) {
+        return false;
+    }
+    tab->strtab = (const char *)(base + strtab->sh_offset);
+    tab->strtab_size = strtab->sh_size;
+
+    for (size_t i = 0; i < nsyms; i++) {
+        if (ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC && syms[i].st_value != 0 &&
+            syms[i].st_name < tab->strtab_size) {
+            tab->funcs[tab->count++] = &syms[i];
+        }
+    }
+
+    /* Shell sort; a kernel has a few thousand functions */
+    for (size_t gap = tab->count / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < tab->count; i++) {
+            const elf64_sym_t *sym = tab->funcs[i];
+            size_t j = i;
+            while (j >= gap && tab->funcs[j - gap]->st_value > sym->st_value) {
+                tab->funcs[j] = tab->funcs[j - gap];
+                j -= gap;
+            }
+            tab->funcs[j] = sym;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find the function containing an address
+ * @return Index into tab->funcs, or -1
+ */
+static int64_t kprof_lookup(const kprof_symtab_t *tab, uint64_t pc) {
+    size_t lo = 0;
+    size_t hi = tab->count;
+
+    /* Last symbol at or below pc */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tab->funcs[mid]->st_value <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    const elf64_sym_t *sym = tab->funcs[lo - 1];
+    if (sym->st_size != 0 && pc - sym->st_value >= sym->st_size) {
+        return -1;
+    }
+    return (int64_t)(lo - 1);
+}
+
+/**
+ * Key of frame i of a sample: its function, or its address if unknown
+ * Return addresses are looked up one byte back, inside the call.
+ */
+static uint64_t kprof_key(const kprof_symtab_t *tab, const kprof_sample_t *s, uint32_t i) {
+    if (s->user) {
+        return KPROF_KEY_USER;
+    }
+
+    uint64_t pc = i > 0 ? s->pc[i] - 1 : s->pc[i];
+    int64_t sym = kprof_lookup(tab, pc);
+    return sym < 0 ? s->pc[i] : (KPROF_KEY_SYM | (uint64_t)sym);
+}
+
+static bool kprof_same_stack(const kprof_symtab_t *tab, const kprof_sample_t *a,
+                             const kprof_sample_t *b) {
+    if (a->depth != b->depth || a->user != b->user) {
+        return false;
+    }
+    for (uint32_t i = 0; i < a->depth; i++) {
+        if (kprof_key(tab, a, i) != kprof_key(tab, b, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t kprof_hash(const kprof_symtab_t *tab, const kprof_sample_t *s) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (uint32_t i = 0; i < s->depth; i++) {
+        h = (h ^ kprof_key(tab, s, i)) * 1099511628211ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static void kprof_append(char *line, size_t *len, const char *s, size_t max) {
+    for (size_t i = 0; i < max && s[i] && *len < KPROF_LINE_MAX - 1; i++) {
+        line[(*len)++] = s[i];
+    }
+}
+
+static void kprof_append_hex(char *line, size_t *len, uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[19] = "0x";
+    int shift = 60;
+
+    while (shift > 0 && ((value >> shift) & 0xF) == 0) {
+        shift -= 4;
+    }
+    size_t n = 2;
+    for (; shift >= 0; shift -= 4) {
+        buf[n++] = digits[(value >> shift) & 0xF];
+    }
+    buf[n] = '\0';
+    kprof_append(line, len, buf, sizeof(buf));
+}
+
+/**
+ * Print one folded stack, outermost caller first
+ */
+static void kprof_print_stack(const kprof_symtab_t *tab, const kprof_sample_t *s,
+                              uint32_t count) {
+    char line[KPROF_LINE_MAX];
+    size_t len = 0;
+
+    for (uint32_t i = s->depth; i-- > 0;) {
+        uint64_t key = kprof_key(tab, s, i);
+        if (key == KPROF_KEY_USER) {
+            kprof_append(line, &len, "[user]", 6);
+        } else if (key & KPROF_KEY_SYM) {
+            const elf64_sym_t *sym = tab->funcs[key & ~KPROF_KEY_SYM];
+            kprof_append(line, &len, tab->strtab + sym->st_name,
+                         tab->strtab_size - sym->st_name);
+        } else {
+            kprof_append_hex(line, &len, key);
+        }
+        if (i > 0) {
+            kprof_append(line, &len, ";", 1);
+        }
+    }
+    line[len] = '\0';
+    kprintf("[PROF-FOLDED] %s %u\n", line, count);
+}
+
+static const kprof_sample_t *kprof_ref_sample(uint32_t ref) {
+    uint32_t index = ref - 1;
+    return &kprof_cpus[index / KPROF_RING_SIZE].ring[index & KPROF_RING_MASK];
+}
+
+int kprof_dump(const void *elf, size_t size) {
+    /* Stack table entry: sample reference (CPU * ring size + slot + 1) and count */
+    typedef struct {
+        uint32_t ref;
+        uint32_t count;
+    } kprof_entry_t;
+
+    if (kprof_on) {
+        kprof_stop();
+    }
+
+    kprof_symtab_t tab;
+    if (!kprof_load_symbols(elf, size, &tab) && elf) {
+        kprintf("[PROF] No symbol table in the kernel image, printing addresses\n");
+    }
+
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        uint64_t head = __atomic_load_n(&kprof_cpus[cpu].head, __ATOMIC_ACQUIRE);
+        total += head < KPROF_RING_SIZE ? head : KPROF_RING_SIZE;
+    }
+
+    size_t capacity = 16;
+    while (capacity < total * 2) {
+        capacity *= 2;
+    }
+    kprof_entry_t *table = kcalloc(capacity, sizeof(kprof_entry_t));
+    if (!table) {
+        kfree(tab.funcs);
+        return -1;
+    }
+
+    int stacks = 0;
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        uint64_t head = kprof_cpus[cpu].head;
+        uint32_t n = head < KPROF_RING_SIZE ? (uint32_t)head : KPROF_RING_SIZE;
+
+        for (uint32_t slot = 0; slot < n; slot++) {
+            const kprof_sample_t *s = &kprof_cpus[cpu].ring[slot];
+            size_t i = kprof_hash(&tab, s) & (capacity - 1);
+
+            while (table[i].ref != 0 &&
+                   !kprof_same_stack(&tab, kprof_ref_sample(table[i].ref), s)) {
+                i = (i + 1) & (capacity - 1);
+            }
+            if (table[i].ref == 0) {
+                table[i].ref = cpu * KPROF_RING_SIZE + slot + 1;
+                stacks++;
+            }
+            table[i].count++;
+        }
+    }
+
+    kprintf("[PROF] %llu samples, %d distinct stacks\n", total, stacks);
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].ref != 0) {
+            kprof_print_stack(&tab, kprof_ref_sample(table[i].ref), table[i].count);
+        }
+    }
+
+    kfree(table);
+    kfree(tab.funcs);
+    return stacks;
+}
+
+void kprof_get_stats(kprof_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->mode = kprof_mode;
+    stats->hz = kprof_hz;
+    stats->samples = 0;
+    stats->kept = 0;
+    stats->user = 0;
+    for (uint32_t cpu = 0; cpu < kprof_ncpus; cpu++) {
+        uint64_t head = __atomic_load_n(&kprof_cpus[cpu].head, __ATOMIC_RELAXED);
+        stats->samples += head;
+        stats->kept += head < KPROF_RING_SIZE ? head : KPROF_RING_SIZE;
+        stats->user += kprof_cpus[cpu].user;
+    }
+}
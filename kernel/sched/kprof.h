@@ -0,0 +1,91 @@
+/**
+ * AAAos Kernel - Sampling Profiler
+ *
+ * While running, every CPU records where it was interrupted KPROF_HZ
+ * times a second: the interrupted RIP and, for kernel code, up to
+ * KPROF_MAX_DEPTH return addresses found by following the frame pointer
+ * chain (the kernel is built with -fno-omit-frame-pointer). Samples go
+ * into a ring per CPU; once it wraps the oldest are overwritten.
+ *
+ * With architectural performance monitoring (CPUID leaf 0xA) counter 0
+ * counts unhalted core cycles and samples on overflow, so time spent with
+ * interrupts disabled is attributed to the code that disabled them only
+ * after it enables them again. Without one, a periodic kernel timer on
+ * each CPU drives the samples from the local APIC timer interrupt.
+ *
+ * kprof_dump prints the samples as folded stacks, one
+ * "[PROF-FOLDED] outer;...;leaf <count>" line per distinct stack, which
+ * flamegraph.pl reads once the prefix is stripped:
+ *   grep -a '^\[PROF-FOLDED\]' serial.log | cut -d' ' -f2- | flamegraph.pl
+ */
+
+#ifndef _AAAOS_SCHED_KPROF_H
+#define _AAAOS_SCHED_KPROF_H
+
+#include "../include/types.h"
+#include "../arch/x86_64/include/idt.h"
+
+/* Limits */
+#define KPROF_RING_SIZE         4096    /* Samples per CPU (power of two) */
+#define KPROF_MAX_DEPTH         8       /* Return addresses per sample */
+#define KPROF_HZ                1000    /* Default sampling rate */
+#define KPROF_MAX_HZ            10000
+
+/* What drives the samples */
+typedef enum {
+    KPROF_MODE_OFF = 0,
+    KPROF_MODE_PMU,                     /* Core cycle counter overflow */
+    KPROF_MODE_TIMER                    /* Periodic kernel timer */
+} kprof_mode_t;
+
+/**
+ * Profiler statistics, summed over all CPUs
+ */
+typedef struct kprof_stats {
+    kprof_mode_t mode;                  /* Source of the last or current run */
+    uint32_t hz;
+    uint64_t samples;                   /* Samples taken */
+    uint64_t kept;                      /* Still in the rings */
+    uint64_t user;                      /* Samples that interrupted user mode */
+} kprof_stats_t;
+
+/**
+ * Start sampling on every online CPU
+ * Discards the samples of the previous run.
+ * @param hz Samples per second and CPU (0 for KPROF_HZ)
+ * @return false if already running, hz is out of range or the rings
+ *         cannot be allocated
+ */
+bool kprof_start(uint32_t hz);
+
+/**
+ * Stop sampling; the samples stay until the next start
+ */
+void kprof_stop(void);
+
+/**
+ * Check whether the profiler is running
+ */
+bool kprof_running(void);
+
+/**
+ * Take a timer-driven sample if this CPU has one due
+ * Called from the timer interrupt with the interrupted context.
+ */
+void kprof_timer_tick(const interrupt_frame_t *frame);
+
+/**
+ * Print the samples as folded stacks to serial console
+ * @param elf Kernel ELF image whose .symtab names the addresses, or NULL
+ *            to print raw addresses
+ * @param size Size of the image in bytes
+ * @return Number of distinct stacks printed, or -1 if out of memory
+ */
+int kprof_dump(const void *elf, size_t size);
+
+/**
+ * Get the profiler statistics
+ */
+void kprof_get_stats(kprof_stats_t *stats);
+
+#endif /* _AAAOS_SCHED_KPROF_H */
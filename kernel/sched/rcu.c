@@ -0,0 +1,181 @@
+/**
+ * AAAos Kernel - Read-Copy-Update
+ *
+ * Each CPU counts the quiescent states it passes through in a slot only
+ * it writes. synchronize_rcu snapshots the counters of the other online
+ * CPUs and waits for each to move. The caller's own CPU needs no wait:
+ * readers cannot be preempted, so none is in progress there while the
+ * caller runs.
+ *
+ * call_rcu queues callbacks for the "rcu" thread, which takes the whole
+ * queue, waits out one grace period for the batch and runs it. Callbacks
+ * queued before the scheduler runs wait for the thread to start.
+ */
+
+#include "rcu.h"
+#include "spinlock.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "waitq.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../init/initcall.h"
+#include "../proc/process.h"
+#include "../stats/kstat.h"
+
+/**
+ * Per-CPU quiescent state counter
+ */
+typedef struct rcu_cpu {
+    volatile uint64_t qs;
+} ALIGNED(64) rcu_cpu_t;
+
+static rcu_cpu_t rcu_cpus[PERCPU_MAX_CPUS];
+
+/* Callbacks waiting for the RCU thread, oldest first */
+SPINLOCK_DEFINE(rcu_cb_lock, "sched.rcu");
+static rcu_head_t *rcu_cb_head = NULL;
+static rcu_head_t **rcu_cb_tail = &rcu_cb_head;
+static volatile uint32_t rcu_cb_count = 0;     /* The thread sleeps on it */
+
+static bool rcu_started = false;
+
+static uint64_t rcu_pending(void) {
+    return rcu_cb_count;
+}
+
+/* Statistics */
+KSTAT_COUNTER(rcu_grace_periods, "sched.rcu.grace_periods",
+              "synchronize_rcu calls that had to wait");
+KSTAT_COUNTER(rcu_callbacks, "sched.rcu.callbacks", "call_rcu callbacks run");
+KSTAT_COUNTER(rcu_kicks, "sched.rcu.kicks", "IPIs sent to CPUs slow to pass a quiescent state");
+KSTAT_GAUGE(rcu_pending_cbs, "sched.rcu.pending", "call_rcu callbacks waiting", rcu_pending);
+
+void rcu_check_qs(void) {
+    if (*rcu_nesting_ptr() == 0) {
+        __atomic_add_fetch(&rcu_cpus[percpu_cpu_id()].qs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Make an idle CPU pass a quiescent state now (the IPI handler reports it)
+ */
+static void rcu_kick(uint32_t cpu) {
+    if (apic_get_info()->enabled &&
+        apic_send_ipi((uint8_t)percpu_get(cpu)->apic_id, IPI_VECTOR_RESCHEDULE)) {
+        kstat_inc(rcu_kicks);
+    }
+}
+
+void synchronize_rcu(void) {
+    uint64_t snap[PERCPU_MAX_CPUS];
+    bool kicked[PERCPU_MAX_CPUS] = { false };
+    uint32_t self = percpu_cpu_id();
+
+    /* Order the caller's unpublishing stores before the snapshot */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        snap[cpu] = __atomic_load_n(&rcu_cpus[cpu].qs, __ATOMIC_ACQUIRE);
+    }
+
+    bool waited = false;
+    bool reported = false;
+    uint64_t start = timer_now_ns();
+
+    for (;;) {
+        bool pending = false;
+
+        for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+            percpu_t *pc = percpu_get(cpu);
+            if (cpu == self || !pc || !pc->online ||
+                __atomic_load_n(&rcu_cpus[cpu].qs, __ATOMIC_ACQUIRE) != snap[cpu]) {
+                continue;
+            }
+            pending = true;
+
+            /* A busy CPU reports at its next tick; wake those that sleep */
+            if (waited && !kicked[cpu]) {
+                rcu_kick(cpu);
+                kicked[cpu] = true;
+            }
+        }
+        if (!pending) {
+            break;
+        }
+
+        if (!reported && timer_now_ns() - start > (uint64_t)RCU_STALL_MS * NSEC_PER_MSEC) {
+            kprintf("[RCU] Grace period stalled for %u ms\n", (uint32_t)RCU_STALL_MS);
+            reported = true;
+        }
+        timer_sleep_ms(RCU_POLL_MS);
+        waited = true;
+    }
+
+    if (waited) {
+        kstat_inc(rcu_grace_periods);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head)) {
+    head->next = NULL;
+    head->func = func;
+
+    uint64_t flags = spinlock_acquire_irqsave(&rcu_cb_lock);
+    *rcu_cb_tail = head;
+    rcu_cb_tail = &head->next;
+    rcu_cb_count++;
+    spinlock_release_irqrestore(&rcu_cb_lock, flags);
+
+    waitq_wake(&rcu_cb_count, 1);
+}
+
+/**
+ * Body of the RCU thread
+ */
+static void rcu_thread(void *arg) {
+    UNUSED(arg);
+
+    for (;;) {
+        waitq_wait(&rcu_cb_count, 0);
+
+        uint64_t flags = spinlock_acquire_irqsave(&rcu_cb_lock);
+        rcu_head_t *batch = rcu_cb_head;
+        rcu_cb_head = NULL;
+        rcu_cb_tail = &rcu_cb_head;
+        rcu_cb_count = 0;
+        spinlock_release_irqrestore(&rcu_cb_lock, flags);
+
+        if (!batch) {
+            continue;
+        }
+
+        synchronize_rcu();
+
+        while (batch) {
+            rcu_head_t *next = batch->next;
+            batch->func(batch);
+            kstat_inc(rcu_callbacks);
+            batch = next;
+        }
+    }
+}
+
+/**
+ * Start the RCU thread once threads can run
+ */
+static bool rcu_initcall(void) {
+    if (rcu_started || !scheduler_is_running()) {
+        return true;
+    }
+
+    process_t *thread = thread_create(NULL, "rcu", rcu_thread, NULL);
+    if (!thread || !scheduler_add(thread)) {
+        kprintf("[RCU] Cannot start the callback thread\n");
+        return false;
+    }
+    rcu_started = true;
+    return true;
+}
+
+INITCALL(rcu, rcu_initcall, 0);
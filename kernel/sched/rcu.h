@@ -0,0 +1,115 @@
+/**
+ * AAAos Kernel - Read-Copy-Update
+ *
+ * For read-mostly structures: readers take no lock and write no shared
+ * memory, writers publish a new version of what they change and free the
+ * old one only once every reader that could still see it has finished.
+ *
+ *   rcu_read_lock();
+ *   node = rcu_dereference(table->head);
+ *   ...
+ *   rcu_read_unlock();
+ *
+ *   spinlock_acquire(&table_lock);          (writers still exclude each other)
+ *   rcu_assign_pointer(*link, node->next);
+ *   spinlock_release(&table_lock);
+ *   call_rcu(&node->rcu, node_free);        (or synchronize_rcu(); kfree(node))
+ *
+ * A read-side section keeps the CPU from being preempted until the
+ * outermost rcu_read_unlock, and must not sleep. Every CPU outside one
+ * passes through quiescent states: in scheduler_schedule, at each timer
+ * tick and reschedule IPI that did not interrupt a reader, and in the
+ * idle loop. A grace period ends once every other online CPU has passed
+ * through one since it began. CPUs that sit idle with the tick stopped
+ * are sent a reschedule IPI rather than waited for.
+ *
+ * Sections nest, and may be entered from interrupt handlers. The
+ * "sched.rcu.*" metrics (kstat.h) count grace periods, callbacks and kicks.
+ */
+
+#ifndef _AAAOS_SCHED_RCU_H
+#define _AAAOS_SCHED_RCU_H
+
+#include "../include/types.h"
+#include "../arch/x86_64/include/percpu.h"
+
+/* How long synchronize_rcu sleeps between checks */
+#define RCU_POLL_MS             1
+
+/* Wait after which synchronize_rcu reports a stalled grace period */
+#define RCU_STALL_MS            10000
+
+/**
+ * Callback queued by call_rcu, usually embedded in the object it frees
+ */
+typedef struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+} rcu_head_t;
+
+/* Depth of the calling CPU's read-side sections */
+static inline volatile uint32_t *rcu_nesting_ptr(void) {
+    return &percpu_self()->rcu_nesting;
+}
+
+/**
+ * Enter a read-side section
+ * One increment of the CPU's own counter; an interrupt cannot split it
+ * and the increment itself stops preemption, so no migration follows.
+ */
+static inline void rcu_read_lock(void) {
+    if (percpu_ready) {
+        __asm__ __volatile__("incl %%gs:%c0"
+                             : : "i"(__builtin_offsetof(percpu_t, rcu_nesting)) : "memory");
+    } else {
+        (*rcu_nesting_ptr())++;
+    }
+}
+
+/**
+ * Leave a read-side section
+ */
+static inline void rcu_read_unlock(void) {
+    if (percpu_ready) {
+        __asm__ __volatile__("decl %%gs:%c0"
+                             : : "i"(__builtin_offsetof(percpu_t, rcu_nesting)) : "memory");
+    } else {
+        (*rcu_nesting_ptr())--;
+    }
+}
+
+/**
+ * Check whether the calling CPU is inside a read-side section
+ */
+static inline bool rcu_read_lock_held(void) {
+    return *rcu_nesting_ptr() != 0;
+}
+
+/* Load a pointer published with rcu_assign_pointer, inside a section */
+#define rcu_dereference(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+/* Publish a pointer once the object it points to is initialized */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/**
+ * Report a quiescent state unless the CPU is inside a read-side section
+ * Called from the scheduler, the timer tick, the reschedule IPI and the
+ * idle loop.
+ */
+void rcu_check_qs(void);
+
+/**
+ * Wait for a grace period: every read-side section running when it was
+ * called has finished on return
+ * Sleeps; must not be called from a read-side section or with interrupts
+ * disabled.
+ */
+void synchronize_rcu(void);
+
+/**
+ * Run func(head) after a grace period, on the RCU thread
+ * Safe from interrupt context and from read-side sections.
+ */
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head));
+
+#endif /* _AAAOS_SCHED_RCU_H */
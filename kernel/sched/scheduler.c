@@ -1,295 +1,620 @@
 /**
- * AAAos Kernel - Round-Robin Scheduler Implementation
+ * AAAos Kernel - Priority Scheduler Implementation
  *
- * Implements preemptive round-robin scheduling with configurable time slices.
+ * Implements preemptive O(1) priority scheduling with per-level time slices.
  * The scheduler is triggered by timer interrupts for preemption.
+ *
+ * Each CPU schedules from its own run queue under its own lock, so CPUs
+ * only touch each other's queues to move work: a CPU with nothing to run
+ * steals one process from the busiest sibling, and every
+ * SCHEDULER_BALANCE_TICKS ticks a CPU pulls half the difference from a
+ * queue that is longer than its own by more than one. Remote queues are
+ * only ever try-locked while holding the local lock, so two CPUs moving
+ * work toward each other cannot deadlock.
+ *
+ * A CPU that switches to its idle process with an empty queue stops its
+ * tick. Whoever queues work for it sets need_reschedule and sends it a
+ * reschedule IPI, and a busy CPU kicks an idle sibling when it balances,
+ * so the sibling wakes up and steals. An idle loop that watches its
+ * need_reschedule flag (idle.h) is woken by the store and gets no IPI.
  */
 
 #include "scheduler.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "rcu.h"
 #include "../include/serial.h"
+#include "../arch/x86_64/include/gdt.h"
 #include "../arch/x86_64/include/idt.h"
-#include "../arch/x86_64/io.h"
-
-/* PIT (Programmable Interval Timer) ports */
-#define PIT_CHANNEL0_DATA   0x40
-#define PIT_CHANNEL1_DATA   0x41
-#define PIT_CHANNEL2_DATA   0x42
-#define PIT_COMMAND         0x43
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/fpu.h"
+#include "../mm/vmm.h"
+#include "../stats/kstat.h"
 
-/* PIT command byte fields */
-#define PIT_CMD_CHANNEL0    0x00
-#define PIT_CMD_LOBYTE_HIBYTE 0x30
-#define PIT_CMD_SQUARE_WAVE 0x06    /* Mode 3 */
+/*
+ * Priority array: one FIFO of processes per level, linked through the
+ * processes themselves, and a bitmap with bit L set while level L is not
+ * empty.
+ */
+typedef struct sched_prio_array {
+    uint32_t bitmap;
+    uint32_t count;
+    process_t *head[SCHED_PRIO_LEVELS];
+    process_t *tail[SCHED_PRIO_LEVELS];
+} sched_prio_array_t;
 
 /*
- * Ready Queue Implementation
- * Using a circular buffer with head and tail indices for O(1) operations
+ * Per-CPU run queue
+ * Ready processes wait in the active array until they use up their time
+ * slice, then move to the expired array; when the active array empties
+ * the two swap, so a process that keeps running cannot starve lower
+ * levels. Realtime processes never expire. The running and idle
+ * processes are not queued.
  */
+typedef struct sched_rq {
+    /* Wakeup line: a CPU idling in MWAIT monitors it (idle.h) */
+    volatile bool need_reschedule;      /* Set in interrupt context, checked later */
+    volatile bool idle_watch;           /* Idle loop watches need_reschedule */
 
-/* Ready queue storage (circular buffer) */
-static process_t *ready_queue[SCHEDULER_MAX_QUEUE_SIZE];
-static uint32_t queue_head = 0;         /* Index of first element */
-static uint32_t queue_tail = 0;         /* Index of next free slot */
-static uint32_t queue_count = 0;        /* Number of elements in queue */
+    sched_prio_array_t arrays[2] ALIGNED(64);
+    sched_prio_array_t *active;
+    sched_prio_array_t *expired;
+    volatile uint32_t count;            /* Processes in both arrays */
 
-/* Current running process */
-static process_t *current_process = NULL;
+    process_t *current;                 /* Process running on this CPU */
+    process_t *idle;                    /* Runs when nothing else can */
+    spinlock_t lock;
+    bool online;                        /* CPU has joined the scheduler */
+    ktimer_t tick_timer;                /* Runs scheduler_tick while busy */
+
+    scheduler_cpu_stats_t stats;
+} ALIGNED(64) sched_rq_t;
+
+static sched_rq_t run_queues[PERCPU_MAX_CPUS];
+LOCK_CLASS(sched_rq, "sched.rq");
 
 /* Scheduler state */
 static bool scheduler_running = false;
-static volatile int scheduler_lock = 0;
 
-/* Scheduler statistics */
+
+/* Statistics snapshot returned by scheduler_get_stats() */
 static scheduler_stats_t stats = {0};
+static uint64_t processes_scheduled = 0;
 
-/* Need reschedule flag (set in interrupt context, checked later) */
-static volatile bool need_reschedule = false;
+KSTAT_COUNTER(sched_ipis_saved, "sched.ipis_saved",
+              "Wakeups of an idle CPU watching its flag, which needed no IPI");
+KSTAT_TRACEPOINT(sched_switch, "sched.switch", "Context switches, as they happen",
+                 "CPU %u: PID %u -> PID %u (switch #%llu)\n");
 
 /**
- * Acquire scheduler lock
+ * Run queue of the calling CPU
  */
-static inline void sched_lock(void) {
-    while (__sync_lock_test_and_set(&scheduler_lock, 1)) {
-        __asm__ __volatile__("pause");
-    }
+static inline sched_rq_t *this_rq(void) {
+    return &run_queues[percpu_cpu_id()];
+}
+
+static inline uint32_t rq_cpu(const sched_rq_t *rq) {
+    return (uint32_t)(rq - run_queues);
 }
 
 /**
- * Release scheduler lock
+ * Scheduler clock in ticks, for sleep credit
  */
-static inline void sched_unlock(void) {
-    __sync_lock_release(&scheduler_lock);
+static inline uint64_t sched_clock(void) {
+    return timer_now_ns() / SCHED_TICK_NS;
 }
 
 /**
- * Check if ready queue is empty
+ * Acquire a run queue lock with interrupts disabled
  */
-static inline bool queue_empty(void) {
-    return queue_count == 0;
+static inline uint64_t rq_lock(sched_rq_t *rq) {
+    return spinlock_acquire_irqsave(&rq->lock);
 }
 
 /**
- * Check if ready queue is full
+ * Release a run queue lock and restore the interrupt state
  */
-static inline bool queue_full(void) {
-    return queue_count >= SCHEDULER_MAX_QUEUE_SIZE;
+static inline void rq_unlock(sched_rq_t *rq, uint64_t flags) {
+    spinlock_release_irqrestore(&rq->lock, flags);
 }
 
 /**
- * Add process to back of ready queue
+ * Try to lock a remote run queue (caller has interrupts disabled)
  */
-static bool queue_enqueue(process_t *proc) {
-    if (queue_full() || !proc) {
-        return false;
+static inline bool rq_trylock(sched_rq_t *rq) {
+    return spinlock_try_acquire(&rq->lock);
+}
+
+/**
+ * Highest non-empty level of an array, or -1 if it is empty
+ */
+static inline int array_top(const sched_prio_array_t *array) {
+    return array->bitmap ? 31 - __builtin_clz(array->bitmap) : -1;
+}
+
+/**
+ * Run queue level of a process
+ */
+static uint8_t sched_level(const process_t *proc) {
+    if (proc->sched_class == SCHED_CLASS_REALTIME) {
+        return (uint8_t)(SCHED_RT_BASE + MIN(proc->priority, (uint8_t)PRIORITY_REALTIME));
     }
 
-    ready_queue[queue_tail] = proc;
-    queue_tail = (queue_tail + 1) % SCHEDULER_MAX_QUEUE_SIZE;
-    queue_count++;
+    /* Nice moves a process up to 4 levels up or down */
+    int level = (int)proc->priority - proc->nice / 5;
+    level += (int)(proc->sleep_avg * SCHED_MAX_BONUS / SCHED_SLEEP_AVG_MAX);
 
-    return true;
+    if (level < PRIORITY_LOW) {
+        level = PRIORITY_LOW;
+    }
+    if (level > SCHED_RT_BASE - 1) {
+        level = SCHED_RT_BASE - 1;
+    }
+    return (uint8_t)level;
+}
+
+/**
+ * Time slice of a process: longer for higher normal levels
+ */
+static uint64_t sched_slice(const process_t *proc) {
+    if (proc->sched_class == SCHED_CLASS_REALTIME) {
+        return SCHEDULER_TIME_SLICE;
+    }
+
+    uint64_t slice = (uint64_t)SCHEDULER_TIME_SLICE * (sched_level(proc) + 1) /
+                     (PRIORITY_NORMAL + 1);
+    return MAX(slice, (uint64_t)SCHEDULER_MIN_TIME_SLICE);
+}
+
+/**
+ * Append a process to its level of an array
+ */
+static void array_enqueue(sched_prio_array_t *array, process_t *proc) {
+    uint8_t level = proc->dynamic_priority;
+
+    proc->sched_next = NULL;
+    proc->sched_prev = array->tail[level];
+    if (array->tail[level]) {
+        array->tail[level]->sched_next = proc;
+    } else {
+        array->head[level] = proc;
+    }
+    array->tail[level] = proc;
+    array->bitmap |= 1U << level;
+    array->count++;
+    proc->sched_array = array;
+}
+
+/**
+ * Unlink a process from its array
+ */
+static void array_remove(sched_prio_array_t *array, process_t *proc) {
+    uint8_t level = proc->dynamic_priority;
+
+    if (proc->sched_prev) {
+        proc->sched_prev->sched_next = proc->sched_next;
+    } else {
+        array->head[level] = proc->sched_next;
+    }
+    if (proc->sched_next) {
+        proc->sched_next->sched_prev = proc->sched_prev;
+    } else {
+        array->tail[level] = proc->sched_prev;
+    }
+    if (!array->head[level]) {
+        array->bitmap &= ~(1U << level);
+    }
+    array->count--;
+
+    proc->sched_next = NULL;
+    proc->sched_prev = NULL;
+    proc->sched_array = NULL;
+}
+
+/**
+ * Check if ready queue is empty
+ */
+static inline bool queue_empty(sched_rq_t *rq) {
+    return rq->count == 0;
 }
 
 /**
- * Remove process from front of ready queue
+ * Queue a process at its current level (rq locked)
+ * @param expired Put it in the expired array (it used up its slice)
  */
-static process_t* queue_dequeue(void) {
-    if (queue_empty()) {
+static void queue_enqueue(sched_rq_t *rq, process_t *proc, bool expired) {
+    proc->dynamic_priority = sched_level(proc);
+    if (proc->sched_class == SCHED_CLASS_REALTIME) {
+        expired = false;
+    }
+
+    array_enqueue(expired ? rq->expired : rq->active, proc);
+    rq->count++;
+    proc->cpu = rq_cpu(rq);
+}
+
+/**
+ * Remove the first process of the highest level (rq locked)
+ */
+static process_t* queue_dequeue(sched_rq_t *rq) {
+    if (queue_empty(rq)) {
         return NULL;
     }
 
-    process_t *proc = ready_queue[queue_head];
-    ready_queue[queue_head] = NULL;
-    queue_head = (queue_head + 1) % SCHEDULER_MAX_QUEUE_SIZE;
-    queue_count--;
+    /* Everyone left has used their slice: start a new round */
+    if (rq->active->count == 0) {
+        sched_prio_array_t *tmp = rq->active;
+        rq->active = rq->expired;
+        rq->expired = tmp;
+        rq->stats.array_swaps++;
+    }
+
+    process_t *proc = rq->active->head[array_top(rq->active)];
+    array_remove(rq->active, proc);
+    rq->count--;
 
     return proc;
 }
 
 /**
- * Remove specific process from ready queue
- * This is O(n) but should be infrequent
+ * Remove a specific process if it is queued here (rq locked)
  */
-static bool queue_remove(process_t *proc) {
-    if (queue_empty() || !proc) {
+static bool queue_remove(sched_rq_t *rq, process_t *proc) {
+    if (!proc || (proc->sched_array != rq->active && proc->sched_array != rq->expired)) {
         return false;
     }
 
-    /* Search for the process in the queue */
-    uint32_t idx = queue_head;
-    bool found = false;
+    array_remove(proc->sched_array, proc);
+    rq->count--;
+    return true;
+}
+
+/**
+ * Highest level waiting in the active array, or -1
+ */
+static inline int queue_top(sched_rq_t *rq) {
+    return array_top(rq->active);
+}
 
-    for (uint32_t i = 0; i < queue_count; i++) {
-        if (ready_queue[idx] == proc) {
-            found = true;
+/**
+ * Make a CPU notice need_reschedule now rather than at its next tick
+ * Without a local APIC the PIT interrupts every CPU often enough.
+ */
+static void sched_kick(sched_rq_t *rq) {
+    if (!scheduler_running || !apic_get_info()->enabled) {
+        return;
+    }
 
-            /* Shift remaining elements */
-            uint32_t current = idx;
-            uint32_t next = (idx + 1) % SCHEDULER_MAX_QUEUE_SIZE;
+    uint32_t cpu = rq_cpu(rq);
+    if (cpu == percpu_cpu_id()) {
+        apic_send_ipi_self(IPI_VECTOR_RESCHEDULE);
+        return;
+    }
 
-            for (uint32_t j = i; j < queue_count - 1; j++) {
-                ready_queue[current] = ready_queue[next];
-                current = next;
-                next = (next + 1) % SCHEDULER_MAX_QUEUE_SIZE;
-            }
+    /* Pairs with scheduler_idle_watch: either it sees the flag or we see the watch */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (rq->idle_watch) {
+        kstat_inc(sched_ipis_saved);
+        return;
+    }
+    apic_send_ipi((uint8_t)percpu_get(cpu)->apic_id, IPI_VECTOR_RESCHEDULE);
+}
 
-            /* Update tail and count */
-            queue_tail = (queue_tail + SCHEDULER_MAX_QUEUE_SIZE - 1) % SCHEDULER_MAX_QUEUE_SIZE;
-            ready_queue[queue_tail] = NULL;
-            queue_count--;
-            break;
+/**
+ * Wake one sibling that sits idle with nothing queued
+ * Read without locks; a missed or extra kick only costs a steal attempt.
+ */
+static void sched_kick_idle(sched_rq_t *rq) {
+    for (uint32_t i = 1; i < PERCPU_MAX_CPUS; i++) {
+        sched_rq_t *other = &run_queues[(rq_cpu(rq) + i) % PERCPU_MAX_CPUS];
+        if (other->online && other->count == 0 && other->current == other->idle &&
+            !other->need_reschedule) {
+            other->need_reschedule = true;
+            sched_kick(other);
+            return;
         }
-        idx = (idx + 1) % SCHEDULER_MAX_QUEUE_SIZE;
     }
+}
 
-    return found;
+/**
+ * Run the tick while the CPU has work and stop it when it goes idle
+ * (rq locked, on the rq's own CPU)
+ */
+static void sched_update_tick(sched_rq_t *rq, process_t *next) {
+    bool idle = next == rq->idle && rq->count == 0;
+
+    if (idle && ktimer_pending(&rq->tick_timer)) {
+        ktimer_cancel(&rq->tick_timer);
+        rq->stats.tick_stops++;
+    } else if (!idle && !ktimer_pending(&rq->tick_timer)) {
+        ktimer_start(&rq->tick_timer, SCHED_TICK_NS, SCHED_TICK_NS);
+    }
 }
 
 /**
- * Peek at front of queue without removing
+ * Find the online sibling with the longest ready queue
+ * Counts are read without locks; they only guide the choice.
  */
-static process_t* queue_peek(void) {
-    if (queue_empty()) {
-        return NULL;
+static sched_rq_t* find_busiest(sched_rq_t *rq) {
+    sched_rq_t *busiest = NULL;
+    uint32_t most = 0;
+
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        sched_rq_t *other = &run_queues[i];
+        if (other == rq || !other->online) {
+            continue;
+        }
+        if (other->count > most) {
+            most = other->count;
+            busiest = other;
+        }
     }
-    return ready_queue[queue_head];
+
+    return busiest;
 }
 
 /**
- * Initialize the PIT (Programmable Interval Timer)
+ * Move up to max processes from src to rq (rq locked)
+ * Expired processes go first, since they are not due to run soon on src;
+ * each keeps its place in the active or expired array. Gives up without
+ * waiting if src is busy, and once both arrays start with a pinned process.
  */
-static void pit_init(void) {
-    kprintf("[SCHED] Initializing PIT timer at %d Hz...\n", SCHEDULER_TICK_FREQUENCY);
+static uint32_t queue_pull(sched_rq_t *rq, sched_rq_t *src, uint32_t max) {
+    uint32_t moved = 0;
 
-    /* Calculate divisor for desired frequency */
-    uint16_t divisor = PIT_DIVISOR;
+    if (!rq_trylock(src)) {
+        return 0;
+    }
 
-    /* Send command byte: Channel 0, lobyte/hibyte, mode 3 (square wave) */
-    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LOBYTE_HIBYTE | PIT_CMD_SQUARE_WAVE);
-    io_wait();
+    while (moved < max && src->count > 0) {
+        bool expired = src->expired->count > 0;
+        sched_prio_array_t *from = expired ? src->expired : src->active;
+        process_t *proc = from->head[array_top(from)];
+
+        if (proc->flags & PROCESS_FLAG_PINNED) {
+            expired = !expired;
+            from = expired ? src->expired : src->active;
+            proc = from->count > 0 ? from->head[array_top(from)] : NULL;
+            if (!proc || (proc->flags & PROCESS_FLAG_PINNED)) {
+                break;
+            }
+        }
 
-    /* Send divisor (low byte first, then high byte) */
-    outb(PIT_CHANNEL0_DATA, (uint8_t)(divisor & 0xFF));
-    io_wait();
-    outb(PIT_CHANNEL0_DATA, (uint8_t)((divisor >> 8) & 0xFF));
-    io_wait();
+        array_remove(from, proc);
+        src->count--;
+        queue_enqueue(rq, proc, expired);
+        moved++;
+    }
 
-    kprintf("[SCHED] PIT initialized with divisor %u\n", divisor);
+    spinlock_release(&src->lock);
+    return moved;
 }
 
 /**
- * Unmask the timer IRQ in the PIC
+ * Pull work from an overloaded sibling (called from the timer tick)
  */
-static void timer_irq_enable(void) {
-    /* Read current mask from master PIC */
-    uint8_t mask = inb(0x21);
+static void scheduler_balance(sched_rq_t *rq) {
+    uint64_t flags = rq_lock(rq);
+
+    sched_rq_t *busiest = find_busiest(rq);
+    if (busiest && busiest->count > rq->count + 1) {
+        uint32_t moved = queue_pull(rq, busiest, (busiest->count - rq->count) / 2);
+        rq->stats.pulls += moved;
+    }
 
-    /* Clear bit 0 to unmask IRQ0 (timer) */
-    mask &= ~0x01;
+    bool waiting = rq->count > 0;
 
-    /* Write back the mask */
-    outb(0x21, mask);
+    rq_unlock(rq, flags);
 
-    kprintf("[SCHED] Timer IRQ0 enabled\n");
+    /* Idle siblings have no tick to pull with: wake one to steal */
+    if (waiting) {
+        sched_kick_idle(rq);
+    }
 }
 
 /**
- * Timer interrupt handler
+ * Scheduler tick (timer callback)
  */
-void scheduler_tick(interrupt_frame_t *frame) {
-    UNUSED(frame);
+void scheduler_tick(void *arg) {
+    sched_rq_t *rq = arg;
 
     /* Update statistics */
-    stats.total_ticks++;
+    rq->stats.ticks++;
 
-    /* Check if scheduler is running */
-    if (!scheduler_running || !current_process) {
+    /* Check if scheduler is running on this CPU */
+    process_t *current = rq->current;
+    if (!scheduler_running || !rq->online || !current) {
         return;
     }
 
     /* Update current process tick count */
-    current_process->total_ticks++;
+    current->total_ticks++;
 
-    /* Track idle time */
-    if (current_process->pid == PID_IDLE) {
-        stats.idle_ticks++;
+    /* Unless the tick interrupted a reader, the CPU is quiescent */
+    rcu_check_qs();
+
+    /* Track idle time; running uses up sleep credit */
+    if (current == rq->idle) {
+        rq->stats.idle_ticks++;
+    } else if (current->sleep_avg > 0) {
+        current->sleep_avg--;
+    }
+
+    /* Even out queue lengths between CPUs */
+    if (rq->stats.ticks % SCHEDULER_BALANCE_TICKS == 0) {
+        scheduler_balance(rq);
     }
 
     /* Decrement time slice */
-    if (current_process->time_slice > 0) {
-        current_process->time_slice--;
+    if (current->time_slice > 0) {
+        current->time_slice--;
+    }
+
+    /* The idle process gives way as soon as there is work */
+    if (current == rq->idle && rq->count > 0) {
+        current->time_slice = 0;
+    }
+
+    /* A higher level became runnable */
+    if (current != rq->idle && queue_top(rq) > (int)current->dynamic_priority) {
+        rq->stats.preemptions++;
+        rq->need_reschedule = true;
     }
 
     /* Check if time slice expired */
-    if (current_process->time_slice == 0) {
+    if (current->time_slice == 0) {
         /* Only reschedule if there are other processes ready */
-        if (queue_count > 0) {
+        if (rq->count > 0) {
             kprintf("[SCHED] Time slice expired for '%s' (PID %u), rescheduling\n",
-                    current_process->name, current_process->pid);
-            need_reschedule = true;
+                    current->name, current->pid);
+            rq->need_reschedule = true;
         } else {
             /* No other processes, give current process another time slice */
-            current_process->time_slice = SCHEDULER_TIME_SLICE;
+            current->time_slice = sched_slice(current);
         }
     }
 
-    /* Perform context switch if needed
-     * Note: In a real system, we'd do this more carefully to avoid
-     * issues with interrupt nesting. For simplicity, we do it here.
-     */
-    if (need_reschedule) {
-        need_reschedule = false;
-        scheduler_schedule();
+    /* The switch itself happens in scheduler_preempt once all timers ran */
+}
+
+/**
+ * Switch away from the current process if a reschedule is pending
+ */
+void scheduler_preempt(void) {
+    sched_rq_t *rq = this_rq();
+
+    if (!scheduler_running || !rq->online || !rq->need_reschedule) {
+        return;
     }
+
+    /* RCU readers are not preempted; the next interrupt tries again */
+    if (rcu_read_lock_held()) {
+        return;
+    }
+
+    rq->need_reschedule = false;
+    scheduler_schedule();
+}
+
+volatile bool *scheduler_idle_watch(void) {
+    sched_rq_t *rq = this_rq();
+    __atomic_store_n(&rq->idle_watch, true, __ATOMIC_SEQ_CST);
+    return &rq->need_reschedule;
+}
+
+void scheduler_idle_unwatch(void) {
+    __atomic_store_n(&this_rq()->idle_watch, false, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Reschedule IPI: another CPU queued work for this one
+ */
+static void scheduler_ipi(interrupt_frame_t *frame) {
+    UNUSED(frame);
+    rcu_check_qs();
+    scheduler_preempt();
 }
 
 /**
  * Initialize the scheduler
  */
 void scheduler_init(void) {
-    kprintf("[SCHED] Initializing Round-Robin Scheduler...\n");
-
-    /* Clear the ready queue */
-    for (uint32_t i = 0; i < SCHEDULER_MAX_QUEUE_SIZE; i++) {
-        ready_queue[i] = NULL;
+    kprintf("[SCHED] Initializing Priority Scheduler...\n");
+
+    /* Clear every run queue */
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        sched_rq_t *rq = &run_queues[cpu];
+        rq->arrays[0] = (sched_prio_array_t){0};
+        rq->arrays[1] = (sched_prio_array_t){0};
+        rq->active = &rq->arrays[0];
+        rq->expired = &rq->arrays[1];
+        rq->count = 0;
+        rq->current = NULL;
+        rq->idle = NULL;
+        spinlock_init(&rq->lock, LOCK_CLASS_OF(sched_rq));
+        rq->online = false;
+        rq->need_reschedule = false;
+        rq->idle_watch = false;
+        ktimer_init(&rq->tick_timer, scheduler_tick, rq);
+        rq->stats = (scheduler_cpu_stats_t){0};
     }
-    queue_head = 0;
-    queue_tail = 0;
-    queue_count = 0;
-
-    /* Clear statistics */
-    stats.total_ticks = 0;
-    stats.context_switches = 0;
-    stats.idle_ticks = 0;
-    stats.processes_scheduled = 0;
+    processes_scheduled = 0;
 
-    /* Initialize PIT timer */
-    pit_init();
+    /* Timer interrupts drive the tick and every other kernel timer */
+    timer_init();
 
-    /* Register timer interrupt handler */
-    idt_register_handler(IRQ_TIMER, scheduler_tick);
-    kprintf("[SCHED] Timer interrupt handler registered (IRQ %d)\n", IRQ_TIMER - IRQ_BASE);
+    /* Processes get their FPU state on first use */
+    fpu_init();
 
-    /* Enable timer IRQ */
-    timer_irq_enable();
+    idt_register_handler(IPI_VECTOR_RESCHEDULE, scheduler_ipi);
+    kprintf("[SCHED] Reschedule IPI handler registered (vector 0x%x)\n", IPI_VECTOR_RESCHEDULE);
 
-    /* Get the idle process (should already exist from process_init) */
+    /* The BSP starts out running the idle process (created by process_init) */
     process_t *idle = process_get_by_pid(PID_IDLE);
     if (idle) {
-        current_process = idle;
-        current_process->time_slice = SCHEDULER_TIME_SLICE;
         process_set_state(idle, PROCESS_STATE_RUNNING);
+        scheduler_init_cpu(idle);
         kprintf("[SCHED] Idle process set as initial process\n");
     } else {
         kprintf("[SCHED] WARNING: No idle process found!\n");
+        this_rq()->online = true;
     }
 
     scheduler_running = true;
 
+    /* Work queued before the scheduler ran has no tick to start it */
+    if (this_rq()->count > 0) {
+        this_rq()->need_reschedule = true;
+        sched_kick(this_rq());
+    }
+
     kprintf("[SCHED] Scheduler initialized successfully\n");
-    kprintf("[SCHED] Time slice: %d ticks (%d ms)\n",
+    kprintf("[SCHED] Time slice: %d ticks (%d ms) at normal priority, %d levels\n",
             SCHEDULER_TIME_SLICE,
-            (SCHEDULER_TIME_SLICE * 1000) / SCHEDULER_TICK_FREQUENCY);
+            (SCHEDULER_TIME_SLICE * 1000) / SCHEDULER_TICK_FREQUENCY,
+            SCHED_PRIO_LEVELS);
+}
+
+/**
+ * Join the calling CPU to the scheduler
+ */
+void scheduler_init_cpu(process_t *idle) {
+    sched_rq_t *rq = this_rq();
+    uint64_t flags = rq_lock(rq);
+
+    rq->idle = idle;
+    rq->current = idle;
+    if (idle) {
+        idle->state = PROCESS_STATE_RUNNING;
+        idle->time_slice = SCHEDULER_TIME_SLICE;
+        idle->dynamic_priority = PRIORITY_IDLE;
+        idle->cpu = rq_cpu(rq);
+    }
+    rq->online = true;
+
+    rq_unlock(rq, flags);
+
+    kprintf("[SCHED] CPU %u joined the scheduler\n", rq_cpu(rq));
+}
+
+/**
+ * Pick the online CPU with the shortest ready queue, preferring this one
+ */
+static sched_rq_t* least_loaded_rq(void) {
+    sched_rq_t *best = this_rq();
+
+    if (!best->online) {
+        best = &run_queues[0];
+    }
+
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        sched_rq_t *rq = &run_queues[i];
+        if (rq->online && rq->count < best->count) {
+            best = rq;
+        }
+    }
+
+    return best;
 }
 
 /**
@@ -307,31 +632,50 @@ bool scheduler_add(process_t *proc) {
         return false;
     }
 
-    sched_lock();
-
-    if (queue_full()) {
-        sched_unlock();
-        kprintf("[SCHED] Error: Ready queue full, cannot add '%s' (PID %u)\n",
+    if (proc->sched_array) {
+        kprintf("[SCHED] Error: Process '%s' (PID %u) is already queued\n",
                 proc->name, proc->pid);
         return false;
     }
 
+    sched_rq_t *rq = (proc->flags & PROCESS_FLAG_PINNED) && proc->cpu < PERCPU_MAX_CPUS &&
+                     run_queues[proc->cpu].online ? &run_queues[proc->cpu] : least_loaded_rq();
+    uint64_t flags = rq_lock(rq);
+
     /* Set initial time slice */
     if (proc->time_slice == 0) {
-        proc->time_slice = SCHEDULER_TIME_SLICE;
+        proc->time_slice = sched_slice(proc);
     }
 
-    bool result = queue_enqueue(proc);
+    queue_enqueue(rq, proc, false);
+    uint32_t count = rq->count;
 
-    sched_unlock();
+    /* An idle CPU may have stopped its tick */
+    bool kick = rq->current == rq->idle;
+    if (kick) {
+        rq->need_reschedule = true;
+    }
 
-    if (result) {
-        kprintf("[SCHED] Added '%s' (PID %u) to ready queue (queue size: %u)\n",
-                proc->name, proc->pid, queue_count);
-        stats.processes_scheduled++;
+    rq_unlock(rq, flags);
+
+    if (kick) {
+        sched_kick(rq);
     }
 
-    return result;
+    kprintf("[SCHED] Added '%s' (PID %u) to CPU %u ready queue at level %u (queue size: %u)\n",
+            proc->name, proc->pid, rq_cpu(rq), proc->dynamic_priority, count);
+    __atomic_fetch_add(&processes_scheduled, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+bool scheduler_pin(process_t *proc, uint32_t cpu) {
+    if (!proc || proc->sched_array || cpu >= PERCPU_MAX_CPUS || !run_queues[cpu].online) {
+        return false;
+    }
+    proc->cpu = cpu;
+    proc->flags |= PROCESS_FLAG_PINNED;
+    return true;
 }
 
 /**
@@ -343,43 +687,200 @@ bool scheduler_remove(process_t *proc) {
         return false;
     }
 
-    sched_lock();
-
-    bool result = queue_remove(proc);
+    /* Look on the CPU it was queued on first; it may have moved since */
+    bool result = false;
+    uint32_t home = proc->cpu < PERCPU_MAX_CPUS ? proc->cpu : 0;
+    sched_rq_t *rq = NULL;
 
-    sched_unlock();
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS && !result; i++) {
+        rq = &run_queues[(home + i) % PERCPU_MAX_CPUS];
+        if (!rq->online) {
+            continue;
+        }
+        uint64_t flags = rq_lock(rq);
+        result = queue_remove(rq, proc);
+        rq_unlock(rq, flags);
+    }
 
     if (result) {
-        kprintf("[SCHED] Removed '%s' (PID %u) from ready queue (queue size: %u)\n",
-                proc->name, proc->pid, queue_count);
+        kprintf("[SCHED] Removed '%s' (PID %u) from CPU %u ready queue (queue size: %u)\n",
+                proc->name, proc->pid, rq_cpu(rq), rq->count);
     }
 
     return result;
 }
 
+/**
+ * Make a blocked process runnable
+ */
+bool scheduler_wake(process_t *proc, bool interactive) {
+    if (!proc) {
+        kprintf("[SCHED] Error: scheduler_wake called with NULL process\n");
+        return false;
+    }
+
+    if (proc->sched_array || proc->state == PROCESS_STATE_RUNNING ||
+        proc->state == PROCESS_STATE_TERMINATED || proc->state == PROCESS_STATE_INVALID) {
+        return false;
+    }
+
+    /* Go back to the CPU it last ran on while its cache may still be warm */
+    sched_rq_t *rq = proc->cpu < PERCPU_MAX_CPUS ? &run_queues[proc->cpu] : NULL;
+    if (!rq || !rq->online) {
+        rq = least_loaded_rq();
+    }
+
+    uint64_t flags = rq_lock(rq);
+
+    /* Marked blocked but not switched out yet: it simply keeps running */
+    if (rq->current == proc) {
+        proc->state = PROCESS_STATE_RUNNING;
+        rq_unlock(rq, flags);
+        return true;
+    }
+
+    /* Time asleep counts toward the interactive bonus */
+    uint64_t slept = sched_clock() - proc->last_run;
+    uint64_t credit = interactive ? SCHED_SLEEP_AVG_MAX : proc->sleep_avg + slept;
+    proc->sleep_avg = (uint32_t)MIN(credit, (uint64_t)SCHED_SLEEP_AVG_MAX);
+
+    proc->state = PROCESS_STATE_READY;
+    if (proc->time_slice == 0) {
+        proc->time_slice = sched_slice(proc);
+    }
+    queue_enqueue(rq, proc, false);
+
+    /*
+     * Preempt at the next tick if it outranks what is running; an idle
+     * CPU may have stopped its tick, so it gets an IPI
+     */
+    process_t *current = rq->current;
+    bool kick = !current || current == rq->idle;
+    if (kick || proc->dynamic_priority > current->dynamic_priority) {
+        rq->need_reschedule = true;
+    }
+
+    rq_unlock(rq, flags);
+
+    if (kick) {
+        sched_kick(rq);
+    }
+
+    kprintf("[SCHED] Woke '%s' (PID %u) on CPU %u at level %u\n",
+            proc->name, proc->pid, rq_cpu(rq), proc->dynamic_priority);
+    return true;
+}
+
+/**
+ * Requeue a process after its level inputs changed
+ */
+static void sched_requeue(process_t *proc) {
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        sched_rq_t *rq = &run_queues[i];
+        if (!rq->online) {
+            continue;
+        }
+
+        uint64_t flags = rq_lock(rq);
+        if (proc->sched_array == rq->active || proc->sched_array == rq->expired) {
+            bool expired = proc->sched_array == rq->expired;
+            queue_remove(rq, proc);
+            queue_enqueue(rq, proc, expired);
+            rq_unlock(rq, flags);
+            return;
+        }
+        rq_unlock(rq, flags);
+    }
+}
+
+/**
+ * Set a process's nice value
+ */
+void scheduler_set_nice(process_t *proc, int nice) {
+    if (!proc) {
+        return;
+    }
+
+    if (nice < NICE_MIN) {
+        nice = NICE_MIN;
+    }
+    if (nice > NICE_MAX) {
+        nice = NICE_MAX;
+    }
+
+    proc->nice = (int8_t)nice;
+    sched_requeue(proc);
+
+    kprintf("[SCHED] Set nice of '%s' (PID %u) to %d\n", proc->name, proc->pid, nice);
+}
+
+/**
+ * Set a process's scheduling class and static priority
+ */
+bool scheduler_set_class(process_t *proc, sched_class_t sched_class, uint8_t priority) {
+    if (!proc || priority < PRIORITY_LOW || priority > PRIORITY_REALTIME ||
+        (sched_class != SCHED_CLASS_NORMAL && sched_class != SCHED_CLASS_REALTIME)) {
+        return false;
+    }
+
+    proc->sched_class = (uint8_t)sched_class;
+    proc->priority = priority;
+    sched_requeue(proc);
+
+    kprintf("[SCHED] Set '%s' (PID %u) to %s class, priority %u\n", proc->name, proc->pid,
+            sched_class == SCHED_CLASS_REALTIME ? "realtime" : "normal", priority);
+    return true;
+}
+
 /**
  * Select and switch to the next runnable process
  */
 process_t* scheduler_schedule(void) {
-    sched_lock();
+    sched_rq_t *rq = this_rq();
+    uint64_t flags = rq_lock(rq);
+
+    rcu_check_qs();
 
-    process_t *old_process = current_process;
+    process_t *old_process = rq->current;
     process_t *new_process = NULL;
 
-    /* If current process is still runnable, put it back in queue */
+    if (old_process) {
+        old_process->last_run = sched_clock();
+    }
+
+    /*
+     * If current process is still runnable, put it back in queue: in the
+     * active array if it was preempted, in the expired one with a fresh
+     * slice if it used its slice up
+     */
     if (old_process && old_process->state == PROCESS_STATE_RUNNING) {
         old_process->state = PROCESS_STATE_READY;
-        queue_enqueue(old_process);
+        if (old_process != rq->idle) {
+            bool expired = old_process->time_slice == 0;
+            if (expired) {
+                old_process->time_slice = sched_slice(old_process);
+            }
+            queue_enqueue(rq, old_process, expired);
+        }
     }
 
     /* Get next process from ready queue */
-    new_process = queue_dequeue();
+    new_process = queue_dequeue(rq);
+
+    /* Nothing local: steal from the busiest sibling */
+    if (!new_process) {
+        sched_rq_t *busiest = find_busiest(rq);
+        if (busiest && queue_pull(rq, busiest, 1)) {
+            rq->stats.steals++;
+            new_process = queue_dequeue(rq);
+        }
+    }
 
     /* If no process available, use idle process */
     if (!new_process) {
-        new_process = process_get_by_pid(PID_IDLE);
+        new_process = rq->idle;
         if (!new_process) {
-            sched_unlock();
+            rq_unlock(rq, flags);
             kprintf("[SCHED] FATAL: No runnable process and no idle process!\n");
             /* Halt system */
             __asm__ __volatile__("cli; hlt");
@@ -387,29 +888,55 @@ process_t* scheduler_schedule(void) {
         }
     }
 
+    if (new_process->time_slice == 0) {
+        new_process->time_slice = new_process == rq->idle ? SCHEDULER_TIME_SLICE :
+                                                            sched_slice(new_process);
+    }
+
+    sched_update_tick(rq, new_process);
+
     /* If same process, just continue running */
     if (new_process == old_process) {
         new_process->state = PROCESS_STATE_RUNNING;
-        new_process->time_slice = SCHEDULER_TIME_SLICE;
-        sched_unlock();
+        rq_unlock(rq, flags);
         return new_process;
     }
 
+    /* Only the idle loop watches for work; wakeups go back to IPIs */
+    rq->idle_watch = false;
+
     /* Set up new process */
     new_process->state = PROCESS_STATE_RUNNING;
-    new_process->time_slice = SCHEDULER_TIME_SLICE;
-    current_process = new_process;
+    new_process->cpu = rq_cpu(rq);
+    rq->current = new_process;
+    process_set_current(new_process);
 
-    stats.context_switches++;
+    /* Entries from user mode land on the new process's kernel stack */
+    if (new_process->kernel_stack != 0) {
+        gdt_set_kernel_stack(new_process->kernel_stack);
+    }
 
-    kprintf("[SCHED] Context switch: '%s' (PID %u) -> '%s' (PID %u) [switch #%llu]\n",
-            old_process ? old_process->name : "(none)",
-            old_process ? old_process->pid : 0,
-            new_process->name,
-            new_process->pid,
-            stats.context_switches);
+    rq->stats.context_switches++;
+    new_process->switches++;
 
-    sched_unlock();
+    kstat_trace(sched_switch, rq_cpu(rq), old_process ? old_process->pid : 0, new_process->pid,
+                rq->stats.context_switches);
+
+    fpu_switch(old_process, new_process);
+
+    /* Threads of one group (and kernel processes) share the page tables */
+    bool same_as = new_process->page_table == 0 ||
+                   (new_process->page_table & VMM_ADDR_MASK) == vmm_get_current_address_space();
+    if (same_as) {
+        rq->stats.cr3_skips++;
+    }
+
+    rq_unlock(rq, flags);
+
+    /* Forked processes run in their own address space */
+    if (!same_as) {
+        vmm_switch_address_space(new_process->page_table & VMM_ADDR_MASK);
+    }
 
     /* Perform actual context switch */
     if (old_process) {
@@ -430,16 +957,18 @@ void scheduler_yield(void) {
         return;
     }
 
-    kprintf("[SCHED] Process '%s' (PID %u) yielding CPU\n",
-            current_process ? current_process->name : "(none)",
-            current_process ? current_process->pid : 0);
-
     /* Disable interrupts during yield */
     interrupts_disable();
 
+    process_t *current = this_rq()->current;
+
+    kprintf("[SCHED] Process '%s' (PID %u) yielding CPU\n",
+            current ? current->name : "(none)",
+            current ? current->pid : 0);
+
     /* Reset time slice and reschedule */
-    if (current_process) {
-        current_process->time_slice = 0;
+    if (current) {
+        current->time_slice = 0;
     }
 
     scheduler_schedule();
@@ -452,7 +981,7 @@ void scheduler_yield(void) {
  * Get the currently running process
  */
 process_t* scheduler_get_current(void) {
-    return current_process;
+    return this_rq()->current;
 }
 
 /**
@@ -470,9 +999,68 @@ void scheduler_set_time_slice(process_t *proc, uint64_t ticks) {
  * Get scheduler statistics
  */
 const scheduler_stats_t* scheduler_get_stats(void) {
+    stats.total_ticks = 0;
+    stats.context_switches = 0;
+    stats.idle_ticks = 0;
+    stats.cpu_count = 0;
+
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        sched_rq_t *rq = &run_queues[i];
+
+        stats.cpus[i] = rq->stats;
+        stats.cpus[i].queued = rq->count;
+        stats.cpus[i].online = rq->online;
+
+        stats.total_ticks += rq->stats.ticks;
+        stats.context_switches += rq->stats.context_switches;
+        stats.idle_ticks += rq->stats.idle_ticks;
+        if (rq->online) {
+            stats.cpu_count++;
+        }
+    }
+    stats.processes_scheduled = __atomic_load_n(&processes_scheduled, __ATOMIC_RELAXED);
+
     return &stats;
 }
 
+/**
+ * Sum one per-CPU scheduler counter
+ */
+static uint64_t sched_sum(size_t offset) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        total += *(const uint64_t *)((const uint8_t *)&run_queues[i].stats + offset);
+    }
+    return total;
+}
+
+static uint64_t sched_switches(void) {
+    return sched_sum(__builtin_offsetof(scheduler_cpu_stats_t, context_switches));
+}
+
+static uint64_t sched_ticks(void) {
+    return sched_sum(__builtin_offsetof(scheduler_cpu_stats_t, ticks));
+}
+
+static uint64_t sched_idle_ticks(void) {
+    return sched_sum(__builtin_offsetof(scheduler_cpu_stats_t, idle_ticks));
+}
+
+static uint64_t sched_steals(void) {
+    return sched_sum(__builtin_offsetof(scheduler_cpu_stats_t, steals));
+}
+
+static uint64_t sched_preemptions(void) {
+    return sched_sum(__builtin_offsetof(scheduler_cpu_stats_t, preemptions));
+}
+
+KSTAT_GAUGE(sched_switches, "sched.context_switches", "Context switches", sched_switches);
+KSTAT_GAUGE(sched_ticks, "sched.ticks", "Scheduler ticks", sched_ticks);
+KSTAT_GAUGE(sched_idle_ticks, "sched.idle_ticks", "Ticks spent idle", sched_idle_ticks);
+KSTAT_GAUGE(sched_steals, "sched.steals", "Processes stolen from a sibling", sched_steals);
+KSTAT_GAUGE(sched_preemptions, "sched.preemptions", "Switches forced by a wakeup",
+            sched_preemptions);
+
 /**
  * Check if scheduler is running
  */
@@ -484,40 +1072,57 @@ bool scheduler_is_running(void) {
  * Dump scheduler state for debugging
  */
 void scheduler_dump_state(void) {
+    const scheduler_stats_t *s = scheduler_get_stats();
+
     kprintf("[SCHED] ========== Scheduler State ==========\n");
-    kprintf("[SCHED] Running: %s\n", scheduler_running ? "YES" : "NO");
-    kprintf("[SCHED] Current process: %s (PID %u)\n",
-            current_process ? current_process->name : "(none)",
-            current_process ? current_process->pid : 0);
-    kprintf("[SCHED] Time slice remaining: %llu ticks\n",
-            current_process ? current_process->time_slice : 0);
-    kprintf("[SCHED] Ready queue size: %u / %u\n", queue_count, SCHEDULER_MAX_QUEUE_SIZE);
-
-    /* Dump ready queue contents */
-    if (queue_count > 0) {
-        kprintf("[SCHED] Ready queue contents:\n");
-        uint32_t idx = queue_head;
-        for (uint32_t i = 0; i < queue_count; i++) {
-            process_t *p = ready_queue[idx];
-            kprintf("[SCHED]   [%u] '%s' (PID %u, prio=%u)\n",
-                    i, p ? p->name : "(null)",
-                    p ? p->pid : 0,
-                    p ? p->priority : 0);
-            idx = (idx + 1) % SCHEDULER_MAX_QUEUE_SIZE;
+    kprintf("[SCHED] Running: %s (%u CPUs)\n", scheduler_running ? "YES" : "NO", s->cpu_count);
+
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        sched_rq_t *rq = &run_queues[cpu];
+        if (!rq->online) {
+            continue;
         }
+
+        kprintf("[SCHED] --- CPU %u ---\n", cpu);
+        kprintf("[SCHED] Current process: %s (PID %u)\n",
+                rq->current ? rq->current->name : "(none)",
+                rq->current ? rq->current->pid : 0);
+        kprintf("[SCHED] Time slice remaining: %llu ticks\n",
+                rq->current ? rq->current->time_slice : 0);
+        kprintf("[SCHED] Ready queue size: %u (%u active, %u expired)\n",
+                rq->count, rq->active->count, rq->expired->count);
+
+        /* Dump ready queue contents, highest level first */
+        for (int a = 0; a < 2; a++) {
+            sched_prio_array_t *array = a == 0 ? rq->active : rq->expired;
+            for (int level = SCHED_PRIO_LEVELS - 1; level >= 0; level--) {
+                for (process_t *p = array->head[level]; p; p = p->sched_next) {
+                    kprintf("[SCHED]   %s L%d '%s' (PID %u, prio=%u, nice=%d, sleep=%u)\n",
+                            a == 0 ? "A" : "E", level, p->name, p->pid,
+                            p->priority, p->nice, p->sleep_avg);
+                }
+            }
+        }
+
+        kprintf("[SCHED] Ticks %llu, switches %llu, idle %llu, steals %llu, pulls %llu\n",
+                rq->stats.ticks, rq->stats.context_switches, rq->stats.idle_ticks,
+                rq->stats.steals, rq->stats.pulls);
+        kprintf("[SCHED] Preemptions %llu, array swaps %llu, tick stops %llu, CR3 kept %llu\n",
+                rq->stats.preemptions, rq->stats.array_swaps, rq->stats.tick_stops,
+                rq->stats.cr3_skips);
     }
 
     /* Dump statistics */
     kprintf("[SCHED] --- Statistics ---\n");
-    kprintf("[SCHED] Total ticks:        %llu\n", stats.total_ticks);
-    kprintf("[SCHED] Context switches:   %llu\n", stats.context_switches);
+    kprintf("[SCHED] Total ticks:        %llu\n", s->total_ticks);
+    kprintf("[SCHED] Context switches:   %llu\n", s->context_switches);
     /* Calculate percentage using integer math (avoid FPU in kernel) */
     uint64_t idle_percent = 0;
-    if (stats.total_ticks > 0) {
-        idle_percent = (stats.idle_ticks * 100) / stats.total_ticks;
+    if (s->total_ticks > 0) {
+        idle_percent = (s->idle_ticks * 100) / s->total_ticks;
     }
     kprintf("[SCHED] Idle ticks:         %llu (%llu%%)\n",
-            stats.idle_ticks, idle_percent);
-    kprintf("[SCHED] Processes scheduled: %llu\n", stats.processes_scheduled);
+            s->idle_ticks, idle_percent);
+    kprintf("[SCHED] Processes scheduled: %llu\n", s->processes_scheduled);
     kprintf("[SCHED] =====================================\n");
 }
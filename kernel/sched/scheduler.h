@@ -1,9 +1,23 @@
 /**
- * AAAos Kernel - Round-Robin Scheduler
+ * AAAos Kernel - Priority Scheduler
  *
- * Implements preemptive round-robin scheduling with time slices.
- * The scheduler maintains a ready queue of runnable processes and
- * selects the next process to run when triggered by timer interrupt.
+ * Implements preemptive O(1) priority scheduling with time slices.
+ * Every CPU has its own ready queue and picks the next process from it
+ * when triggered by its timer interrupt. A CPU whose queue runs dry
+ * steals from the busiest sibling, and the timer tick periodically pulls
+ * work from overloaded queues.
+ *
+ * A queue holds one FIFO per priority level and a bitmap of the levels
+ * that are not empty, so picking the next process is a find-first-set.
+ * Realtime processes sit above every normal level. A normal process's
+ * level is its static priority adjusted by its nice value and by a bonus
+ * for the time it spends asleep, so interactive processes that wake
+ * briefly run ahead of batch work.
+ *
+ * The tick is a periodic kernel timer (timer.h) that only runs while a
+ * CPU has something other than its idle process to run; an idle CPU
+ * sleeps until an interrupt, and wakeups aimed at it send a reschedule
+ * IPI, unless its idle loop watches for them in MWAIT (idle.h).
  */
 
 #ifndef _AAAOS_SCHED_SCHEDULER_H
@@ -11,15 +25,23 @@
 
 #include "../include/types.h"
 #include "../proc/process.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../arch/x86_64/include/idt.h"
 
 /* Scheduler configuration */
-#define SCHEDULER_TIME_SLICE        10      /* Default time slice in ticks */
-#define SCHEDULER_MAX_QUEUE_SIZE    256     /* Maximum processes in ready queue */
+#define SCHEDULER_TIME_SLICE        10      /* Time slice at PRIORITY_NORMAL (ticks) */
+#define SCHEDULER_MIN_TIME_SLICE    2       /* Shortest time slice (ticks) */
+#define SCHEDULER_BALANCE_TICKS     10      /* Ticks between load balancing passes */
+
+/* Run queue levels: normal processes use 1-15, realtime ones 16-31 */
+#define SCHED_PRIO_LEVELS           32
+#define SCHED_RT_BASE               16
+#define SCHED_MAX_BONUS             3       /* Levels a sleeper can gain */
+#define SCHED_SLEEP_AVG_MAX         100     /* Sleep credit cap (ticks), full bonus */
 
-/* Timer frequency (PIT runs at ~1193182 Hz, we'll divide for ~100 Hz) */
+/* Scheduler tick while a CPU is busy */
 #define SCHEDULER_TICK_FREQUENCY    100     /* Ticks per second (Hz) */
-#define PIT_BASE_FREQUENCY          1193182 /* PIT base oscillator frequency */
-#define PIT_DIVISOR                 (PIT_BASE_FREQUENCY / SCHEDULER_TICK_FREQUENCY)
+#define SCHED_TICK_NS               (1000000000ULL / SCHEDULER_TICK_FREQUENCY)
 
 /**
  * Ready queue node for linked-list implementation
@@ -30,26 +52,55 @@ typedef struct sched_node {
     struct sched_node *next;        /* Next node in queue */
 } sched_node_t;
 
+/**
+ * Per-CPU scheduler statistics
+ */
+typedef struct {
+    uint64_t ticks;                 /* Timer ticks on this CPU */
+    uint64_t context_switches;      /* Context switches on this CPU */
+    uint64_t idle_ticks;            /* Ticks spent in the idle process */
+    uint64_t steals;                /* Processes stolen when the queue ran dry */
+    uint64_t pulls;                 /* Processes pulled by load balancing */
+    uint64_t preemptions;           /* Switches forced by a higher level waking */
+    uint64_t array_swaps;           /* Times every queued process had used its slice */
+    uint64_t tick_stops;            /* Times the tick stopped for idle */
+    uint64_t cr3_skips;             /* Switches that kept the address space loaded */
+    uint32_t queued;                /* Processes waiting in the ready queue */
+    bool online;                    /* CPU takes part in scheduling */
+} scheduler_cpu_stats_t;
+
 /**
  * Scheduler statistics
+ * The totals are sums over all CPUs.
  */
 typedef struct {
     uint64_t total_ticks;           /* Total timer ticks since boot */
     uint64_t context_switches;      /* Number of context switches */
     uint64_t idle_ticks;            /* Ticks spent in idle process */
     uint64_t processes_scheduled;   /* Total number of processes scheduled */
+    uint32_t cpu_count;             /* CPUs taking part in scheduling */
+    scheduler_cpu_stats_t cpus[PERCPU_MAX_CPUS];
 } scheduler_stats_t;
 
 /**
  * Initialize the scheduler subsystem
- * - Sets up the ready queue
- * - Configures the PIT timer for preemption
- * - Registers the timer interrupt handler
+ * - Sets up the ready queues
+ * - Starts the timer subsystem (local APIC timer, or the PIT without one)
+ * - Registers the reschedule IPI handler
  */
 void scheduler_init(void);
 
 /**
- * Add a process to the ready queue
+ * Join the calling CPU to the scheduler (application processors)
+ * The CPU starts out running its idle process and takes work from the
+ * other queues through stealing and load balancing.
+ *
+ * @param idle Idle process for this CPU
+ */
+void scheduler_init_cpu(process_t *idle);
+
+/**
+ * Add a process to the ready queue of the least loaded CPU
  * The process must be in PROCESS_STATE_READY state.
  *
  * @param proc Pointer to the process to add
@@ -57,6 +108,17 @@ void scheduler_init(void);
  */
 bool scheduler_add(process_t *proc);
 
+/**
+ * Keep a process on one CPU from now on
+ * Call before scheduler_add: the process is queued on that CPU, and
+ * stealing and load balancing leave it there.
+ *
+ * @param proc Process that is not queued yet
+ * @param cpu Online CPU to run it on
+ * @return false if proc is queued or cpu is not online
+ */
+bool scheduler_pin(process_t *proc, uint32_t cpu);
+
 /**
  * Remove a process from the ready queue
  * Used when a process blocks, terminates, or needs to be taken off the queue.
@@ -66,11 +128,38 @@ bool scheduler_add(process_t *proc);
  */
 bool scheduler_remove(process_t *proc);
 
+/**
+ * Make a blocked process runnable
+ * Credits the time it slept toward its interactive bonus and preempts
+ * the CPU it is queued on at the next tick if it now outranks the
+ * running process.
+ *
+ * @param proc Process to wake
+ * @param interactive Woken by user input: grant the full bonus
+ * @return true if the process was queued
+ */
+bool scheduler_wake(process_t *proc, bool interactive);
+
+/**
+ * Set a process's nice value (normal class)
+ * @param proc Process to modify
+ * @param nice NICE_MIN to NICE_MAX (clamped)
+ */
+void scheduler_set_nice(process_t *proc, int nice);
+
+/**
+ * Set a process's scheduling class and static priority
+ * @param proc Process to modify
+ * @param sched_class SCHED_CLASS_NORMAL or SCHED_CLASS_REALTIME
+ * @param priority Static priority, PRIORITY_LOW to PRIORITY_REALTIME
+ * @return false if an argument is out of range
+ */
+bool scheduler_set_class(process_t *proc, sched_class_t sched_class, uint8_t priority);
+
 /**
  * Select and switch to the next runnable process
- * Implements the round-robin scheduling algorithm:
- * 1. Save current process context (if any)
- * 2. Pick next process from ready queue
+ * 1. Requeue the current process if it is still runnable
+ * 2. Pick the first process of the highest non-empty level
  * 3. Restore new process context and switch
  *
  * @return Pointer to the newly scheduled process
@@ -79,23 +168,44 @@ process_t* scheduler_schedule(void);
 
 /**
  * Voluntarily yield the CPU to another process
- * The current process is moved to the back of the ready queue
- * and the scheduler picks the next process to run.
+ * The current process gives up the rest of its time slice and the
+ * scheduler picks the next process to run.
  */
 void scheduler_yield(void);
 
 /**
- * Timer interrupt handler - called on every timer tick
+ * Scheduler tick - timer callback, every SCHED_TICK_NS on a busy CPU
  * - Decrements the current process's time slice
- * - Triggers rescheduling when time slice expires
+ * - Flags a reschedule when the time slice expires
  * - Updates scheduler statistics
  *
- * @param frame Interrupt frame (from timer ISR)
+ * @param arg Run queue of the calling CPU
+ */
+void scheduler_tick(void *arg);
+
+/**
+ * Switch away from the current process if a reschedule is pending
+ * Called at the end of timer and IPI interrupts.
+ */
+void scheduler_preempt(void);
+
+/**
+ * Have work queued for the calling CPU announced without an IPI
+ * Called by the idle loop with interrupts disabled. Until it calls
+ * scheduler_idle_unwatch or the CPU switches process, CPUs queueing work
+ * for it only store to the returned flag, which the loop must watch
+ * (MWAIT or polling) and then act on with scheduler_preempt.
+ * @return The CPU's need_reschedule flag
+ */
+volatile bool *scheduler_idle_watch(void);
+
+/**
+ * Have wakeups of the calling CPU send reschedule IPIs again
  */
-void scheduler_tick(interrupt_frame_t *frame);
+void scheduler_idle_unwatch(void);
 
 /**
- * Get the currently running process
+ * Get the process running on the calling CPU
  * @return Pointer to current process, or NULL if none
  */
 process_t* scheduler_get_current(void);
@@ -108,8 +218,8 @@ process_t* scheduler_get_current(void);
 void scheduler_set_time_slice(process_t *proc, uint64_t ticks);
 
 /**
- * Get scheduler statistics
- * @return Pointer to scheduler statistics structure
+ * Get scheduler statistics, totals and per CPU
+ * @return Pointer to scheduler statistics structure (refreshed by each call)
  */
 const scheduler_stats_t* scheduler_get_stats(void);
 
@@ -0,0 +1,125 @@
+/**
+ * AAAos Kernel - Softirqs
+ *
+ * Each CPU keeps a mask of raised vectors and the cycle count at which
+ * each was first raised. Both are only touched by their own CPU with
+ * interrupts off, so they need no lock.
+ */
+
+#include "softirq.h"
+#include "clock.h"
+#include "rcu.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../stats/kstat.h"
+
+/**
+ * Per-CPU softirq state
+ */
+typedef struct softirq_cpu {
+    uint32_t pending;                   /* Raised vectors */
+    bool active;                        /* Running vectors now */
+    uint64_t raised_at[SOFTIRQ_COUNT];  /* clock_cycles() of each first raise */
+} ALIGNED(64) softirq_cpu_t;
+
+static softirq_cpu_t softirq_cpus[PERCPU_MAX_CPUS];
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT][SOFTIRQ_MAX_HANDLERS];
+
+static const char *const softirq_names[SOFTIRQ_COUNT] = {
+    [SOFTIRQ_TIMER]     = "timer",
+    [SOFTIRQ_NET_RX]    = "net_rx",
+    [SOFTIRQ_BLOCK]     = "block",
+};
+
+KSTAT_COUNTER(softirq_runs, "sched.softirq.runs", "Softirq handler calls");
+KSTAT_COUNTER(softirq_deferred, "sched.softirq.deferred",
+              "Interrupts that left vectors raised after SOFTIRQ_MAX_RESTART passes");
+KSTAT_HISTOGRAM(softirq_timer_lat, "sched.softirq.timer.latency_ns",
+                "Nanoseconds from raising the timer softirq to running it");
+KSTAT_HISTOGRAM(softirq_net_rx_lat, "sched.softirq.net_rx.latency_ns",
+                "Nanoseconds from raising the net_rx softirq to running it");
+KSTAT_HISTOGRAM(softirq_block_lat, "sched.softirq.block.latency_ns",
+                "Nanoseconds from raising the block softirq to running it");
+
+static void softirq_observe(uint32_t vector, uint64_t ns) {
+    switch (vector) {
+        case SOFTIRQ_TIMER:     kstat_observe(softirq_timer_lat, ns); break;
+        case SOFTIRQ_NET_RX:    kstat_observe(softirq_net_rx_lat, ns); break;
+        case SOFTIRQ_BLOCK:     kstat_observe(softirq_block_lat, ns); break;
+        default:                break;
+    }
+}
+
+bool softirq_register(softirq_vector_t vector, softirq_handler_t handler) {
+    if ((uint32_t)vector >= SOFTIRQ_COUNT || !handler) {
+        return false;
+    }
+    for (uint32_t i = 0; i < SOFTIRQ_MAX_HANDLERS; i++) {
+        softirq_handler_t expected = NULL;
+        if (__atomic_compare_exchange_n(&softirq_handlers[vector][i], &expected, handler, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void softirq_raise(softirq_vector_t vector) {
+    if ((uint32_t)vector >= SOFTIRQ_COUNT) {
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+    softirq_cpu_t *sc = &softirq_cpus[percpu_cpu_id()];
+    if (!(sc->pending & BIT(vector))) {
+        sc->pending |= BIT(vector);
+        sc->raised_at[vector] = clock_cycles();
+    }
+    interrupts_restore(flags);
+}
+
+void softirq_irq_exit(void) {
+    softirq_cpu_t *sc = &softirq_cpus[percpu_cpu_id()];
+    if (!sc->pending || sc->active) {
+        return;
+    }
+
+    /* No preemption from here on, so sc stays this CPU's */
+    sc->active = true;
+    rcu_read_lock();
+
+    for (uint32_t pass = 0; pass < SOFTIRQ_MAX_RESTART && sc->pending; pass++) {
+        uint32_t pending = sc->pending;
+        uint64_t raised_at[SOFTIRQ_COUNT];
+        for (uint32_t v = 0; v < SOFTIRQ_COUNT; v++) {
+            raised_at[v] = sc->raised_at[v];
+        }
+        sc->pending = 0;
+
+        interrupts_enable();
+        for (uint32_t bits = pending; bits; bits &= bits - 1) {
+            uint32_t v = (uint32_t)__builtin_ctz(bits);
+            softirq_observe(v, clock_cycles_to_ns(clock_cycles() - raised_at[v]));
+            for (uint32_t i = 0; i < SOFTIRQ_MAX_HANDLERS; i++) {
+                softirq_handler_t handler =
+                    __atomic_load_n(&softirq_handlers[v][i], __ATOMIC_ACQUIRE);
+                if (!handler) {
+                    break;
+                }
+                handler();
+                kstat_inc(softirq_runs);
+            }
+        }
+        interrupts_disable();
+    }
+
+    if (sc->pending) {
+        kstat_inc(softirq_deferred);
+    }
+    rcu_read_unlock();
+    sc->active = false;
+}
+
+const char *softirq_name(softirq_vector_t vector) {
+    return (uint32_t)vector < SOFTIRQ_COUNT ? softirq_names[vector] : "unknown";
+}
@@ -0,0 +1,72 @@
+/**
+ * AAAos Kernel - Softirqs
+ *
+ * A hardware interrupt handler does only what cannot wait, such as
+ * reading and acknowledging the device, and raises a softirq vector for
+ * the rest. Raised vectors run on the same CPU as the outermost hardware
+ * interrupt returns, with interrupts enabled, so other devices are not
+ * held off while the work is done.
+ *
+ * A vector may have several handlers, one per driver sharing it, which
+ * all run when it is raised and each check their own device's state.
+ *
+ * Vectors run in bit order. A vector raised while its handlers run is
+ * run again, up to SOFTIRQ_MAX_RESTART passes per interrupt; what is left
+ * after that waits for the next interrupt on the CPU. Handlers run as
+ * RCU read-side sections (rcu.h): they are not preempted, must not sleep
+ * and must take locks their hardware handler shares with interrupts off.
+ *
+ * The time from a vector's first raise to its handler is recorded in the
+ * "sched.softirq.<vector>.latency_ns" histograms (kstat.h).
+ */
+
+#ifndef _AAAOS_SCHED_SOFTIRQ_H
+#define _AAAOS_SCHED_SOFTIRQ_H
+
+#include "../include/types.h"
+
+/* Passes over the raised vectors per interrupt */
+#define SOFTIRQ_MAX_RESTART     8
+
+/* Most handlers on one vector */
+#define SOFTIRQ_MAX_HANDLERS    4
+
+/* Vectors, highest priority first */
+typedef enum {
+    SOFTIRQ_TIMER = 0,
+    SOFTIRQ_NET_RX,
+    SOFTIRQ_BLOCK,
+    SOFTIRQ_COUNT
+} softirq_vector_t;
+
+/**
+ * Softirq handler
+ */
+typedef void (*softirq_handler_t)(void);
+
+/**
+ * Add a handler to a vector
+ * @return false if the vector is out of range or has SOFTIRQ_MAX_HANDLERS
+ */
+bool softirq_register(softirq_vector_t vector, softirq_handler_t handler);
+
+/**
+ * Raise a vector on the calling CPU
+ * Safe from any context; from a thread, the vector runs at the CPU's
+ * next interrupt.
+ */
+void softirq_raise(softirq_vector_t vector);
+
+/**
+ * Run the raised vectors (called as a hardware interrupt returns, with
+ * interrupts disabled)
+ * Does nothing when nested inside a run already on this CPU.
+ */
+void softirq_irq_exit(void);
+
+/**
+ * Name of a vector ("timer", "net_rx", "block")
+ */
+const char *softirq_name(softirq_vector_t vector);
+
+#endif /* _AAAOS_SCHED_SOFTIRQ_H */
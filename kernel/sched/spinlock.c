@@ -0,0 +1,117 @@
+/**
+ * AAAos Kernel - Ticket Spinlocks with Lock Statistics
+ *
+ * The slow paths of spinlock.h. Slot updates use kstat's rule: a single
+ * add to the calling CPU's slot, which an interrupt on that CPU cannot
+ * split, so no update needs a lock of its own.
+ */
+
+#include "spinlock.h"
+
+/* Profiling switch */
+volatile bool lockstat_enabled = false;
+
+/* Profiled classes, newest first; entries are never removed */
+static lock_class_t *volatile lockstat_head = NULL;
+
+static inline uint64_t lockstat_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void lockstat_slot_add(uint64_t *slot, uint64_t n) {
+    __asm__ __volatile__("addq %1, %0" : "+m"(*slot) : "er"(n));
+}
+
+/**
+ * Put a class on the list the first time it is profiled
+ */
+static void lockstat_register(lock_class_t *cls) {
+    if (__atomic_exchange_n(&cls->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    lock_class_t *head = __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+    do {
+        cls->next = head;
+    } while (!__atomic_compare_exchange_n(&lockstat_head, &head, cls, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+void spinlock_wait(spinlock_t *lock, uint32_t ticket) {
+    bool profile = lockstat_enabled && lock->cls;
+    uint64_t start = profile ? lockstat_rdtsc() : 0;
+    uint64_t spins = 0;
+
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        __asm__ __volatile__("pause");
+        spins++;
+    }
+
+    if (profile) {
+        lockstat_cpu_t *slot = &lock->cls->cpu[percpu_cpu_id()];
+        lockstat_slot_add(&slot->contended, 1);
+        lockstat_slot_add(&slot->spins, spins);
+        lockstat_slot_add(&slot->wait_cycles, lockstat_rdtsc() - start);
+    }
+}
+
+void lockstat_acquired(spinlock_t *lock) {
+    lock_class_t *cls = lock->cls;
+    if (!cls) {
+        return;
+    }
+    if (!cls->registered) {
+        lockstat_register(cls);
+    }
+
+    lockstat_slot_add(&cls->cpu[percpu_cpu_id()].acquired, 1);
+    lock->acquired_at = lockstat_rdtsc();
+}
+
+void lockstat_released(spinlock_t *lock) {
+    uint64_t held = lockstat_rdtsc() - lock->acquired_at;
+    lockstat_cpu_t *slot = &lock->cls->cpu[percpu_cpu_id()];
+
+    lock->acquired_at = 0;
+    lockstat_slot_add(&slot->releases, 1);
+    lockstat_slot_add(&slot->hold_cycles, held);
+    if (held > slot->hold_max) {
+        slot->hold_max = held;
+    }
+}
+
+void lockstat_enable(bool on) {
+    lockstat_enabled = on;
+}
+
+void lockstat_reset(void) {
+    for (lock_class_t *cls = lockstat_classes(); cls; cls = cls->next) {
+        for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+            cls->cpu[cpu] = (lockstat_cpu_t){ 0 };
+        }
+    }
+}
+
+lock_class_t *lockstat_classes(void) {
+    return __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+}
+
+void lockstat_read(const lock_class_t *cls, lockstat_t *out) {
+    *out = (lockstat_t){ 0 };
+    if (!cls) {
+        return;
+    }
+
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        const lockstat_cpu_t *slot = &cls->cpu[cpu];
+        out->acquired += slot->acquired;
+        out->contended += slot->contended;
+        out->spins += slot->spins;
+        out->wait_cycles += slot->wait_cycles;
+        out->hold_cycles += slot->hold_cycles;
+        out->releases += slot->releases;
+        out->hold_max = MAX(out->hold_max, slot->hold_max);
+    }
+}
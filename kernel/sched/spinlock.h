@@ -0,0 +1,205 @@
+/**
+ * AAAos Kernel - Ticket Spinlocks with Lock Statistics
+ *
+ * A ticket lock hands out tickets from next and serves them in order
+ * from owner, so waiters on a contended lock get it first come, first
+ * served rather than whoever wins the cache line. An uncontended acquire
+ * is one locked add and a load; waiting is out of line.
+ *
+ * Each lock may name a lock class shared by all locks of one kind:
+ *
+ *   LOCK_CLASS(pipe, "ipc.pipe");
+ *   ...
+ *   spinlock_init(&pipe->lock, LOCK_CLASS_OF(pipe));
+ *
+ *   SPINLOCK_DEFINE(pmm_lock, "mm.pmm");
+ *
+ * Lock statistics are off by default and then cost one load and a branch
+ * predicted not taken per acquire. Once lockstat_enable(true) runs, each
+ * class counts acquisitions, contended acquisitions, spins and the TSC
+ * cycles spent waiting and holding, in cache-line aligned per-CPU slots.
+ * A class joins the list lockstat_classes() walks the first time it is
+ * profiled, so the list only holds classes taken since profiling began.
+ */
+
+#ifndef _AAAOS_SCHED_SPINLOCK_H
+#define _AAAOS_SCHED_SPINLOCK_H
+
+#include "../include/types.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../arch/x86_64/include/idt.h"
+
+/**
+ * Per-CPU slot of a lock class
+ */
+typedef struct lockstat_cpu {
+    uint64_t acquired;                  /* Acquisitions */
+    uint64_t contended;                 /* Acquisitions that had to wait */
+    uint64_t spins;                     /* Pause loops while waiting */
+    uint64_t wait_cycles;               /* TSC cycles spent waiting */
+    uint64_t hold_cycles;               /* TSC cycles held, over timed releases */
+    uint64_t hold_max;                  /* Longest hold in TSC cycles */
+    uint64_t releases;                  /* Timed releases */
+} ALIGNED(64) lockstat_cpu_t;
+
+/**
+ * Lock class statistics summed over all CPUs
+ */
+typedef struct lockstat {
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spins;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t hold_max;
+    uint64_t releases;
+} lockstat_t;
+
+/**
+ * Lock class (one per LOCK_CLASS declaration)
+ */
+typedef struct lock_class {
+    const char *name;                   /* "subsystem.lock" */
+    struct lock_class *next;            /* Profiled classes, see lockstat_classes() */
+    volatile uint32_t registered;
+    lockstat_cpu_t cpu[PERCPU_MAX_CPUS];
+} lock_class_t;
+
+/**
+ * Ticket spinlock
+ */
+typedef struct spinlock {
+    volatile uint32_t next;             /* Next ticket to hand out */
+    volatile uint32_t owner;            /* Ticket being served */
+    lock_class_t *cls;                  /* NULL for a lock that is never profiled */
+    uint64_t acquired_at;               /* TSC when taken while profiling, else 0 */
+} spinlock_t;
+
+/**
+ * Declare a lock class
+ * @param id   Identifier used with LOCK_CLASS_OF in this file
+ * @param name Name shown by lockstat, "subsystem.lock"
+ */
+#define LOCK_CLASS(id, name)                                                \
+    static lock_class_t lock_class_##id = { name, NULL, 0, { { 0 } } }
+
+/* Class declared in this file */
+#define LOCK_CLASS_OF(id)       (&lock_class_##id)
+
+/* Static initializer of a lock in class cls */
+#define SPINLOCK_INIT(cls)      { 0, 0, (cls), 0 }
+
+/**
+ * Define a file-scope lock with a class of its own, named name
+ */
+#define SPINLOCK_DEFINE(var, name)                                          \
+    LOCK_CLASS(var, name);                                                  \
+    static spinlock_t var = SPINLOCK_INIT(LOCK_CLASS_OF(var))
+
+/* Profiling switch, see lockstat_enable() */
+extern volatile bool lockstat_enabled;
+
+/**
+ * Wait for ticket to be served (out of line, counts the wait if profiling)
+ */
+void spinlock_wait(spinlock_t *lock, uint32_t ticket);
+
+/**
+ * Count an acquisition and start timing the hold
+ */
+void lockstat_acquired(spinlock_t *lock);
+
+/**
+ * Count the hold that ends now
+ */
+void lockstat_released(spinlock_t *lock);
+
+/**
+ * Initialize an unlocked lock
+ * @param cls Class to profile it under, or NULL
+ */
+static inline void spinlock_init(spinlock_t *lock, lock_class_t *cls) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock->cls = cls;
+    lock->acquired_at = 0;
+}
+
+static inline void spinlock_acquire(spinlock_t *lock) {
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        spinlock_wait(lock, ticket);
+    }
+    if (__builtin_expect(lockstat_enabled, 0)) {
+        lockstat_acquired(lock);
+    }
+}
+
+/**
+ * Take the lock only if it is free
+ * @return true if it was taken
+ */
+static inline bool spinlock_try_acquire(spinlock_t *lock) {
+    uint32_t ticket = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&lock->next, &ticket, ticket + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if (__builtin_expect(lockstat_enabled, 0)) {
+        lockstat_acquired(lock);
+    }
+    return true;
+}
+
+static inline void spinlock_release(spinlock_t *lock) {
+    if (__builtin_expect(lock->acquired_at != 0, 0)) {
+        lockstat_released(lock);
+    }
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Disable interrupts, then take the lock
+ * @return Flags for spinlock_release_irqrestore()
+ */
+static inline uint64_t spinlock_acquire_irqsave(spinlock_t *lock) {
+    uint64_t flags = interrupts_save();
+    spinlock_acquire(lock);
+    return flags;
+}
+
+static inline void spinlock_release_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spinlock_release(lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Check whether a lock is held by anyone
+ */
+static inline bool spinlock_is_locked(const spinlock_t *lock) {
+    return __atomic_load_n(&lock->owner, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&lock->next, __ATOMIC_RELAXED);
+}
+
+/**
+ * Turn lock statistics on or off
+ * Locks held across the switch are counted from their next acquisition.
+ */
+void lockstat_enable(bool on);
+
+/**
+ * Zero the statistics of every profiled class
+ */
+void lockstat_reset(void);
+
+/**
+ * First profiled class; the rest follow through next
+ */
+lock_class_t *lockstat_classes(void);
+
+/**
+ * Sum a class over all CPUs
+ */
+void lockstat_read(const lock_class_t *cls, lockstat_t *out);
+
+#endif /* _AAAOS_SCHED_SPINLOCK_H */
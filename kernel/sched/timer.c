@@ -0,0 +1,433 @@
+/**
+ * AAAos Kernel - High-Resolution Timers Implementation
+ *
+ * Each CPU keeps its pending timers in a binary min-heap ordered by
+ * deadline, under its own lock. Timers are always started on the calling
+ * CPU, so the local APIC timer only ever needs reprogramming on the CPU
+ * whose heap changed: whenever the earliest deadline changes it is armed
+ * for that deadline, and it is left idle while the heap is empty.
+ *
+ * In PIT fallback mode deadlines are only checked once per interrupt,
+ * which limits timers to TIMER_FALLBACK_HZ resolution.
+ */
+
+#include "timer.h"
+#include "scheduler.h"
+#include "kprof.h"
+#include "softirq.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/apic.h"
+#include "../arch/x86_64/io.h"
+#include "../arch/x86_64/irq.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+
+/* PIT (Programmable Interval Timer) ports */
+#define PIT_CH0_PORT        0x40
+#define PIT_CMD_PORT        0x43
+
+/* PIT command byte: channel 0, lobyte/hibyte, mode 2 (rate generator) */
+#define PIT_CMD_PERIODIC    0x34
+
+/* Expired timers handled per interrupt; the rest fire right after */
+#define TIMER_BATCH_MAX     16
+#define TIMER_SOFT_MAX      32      /* Expired soft timers waiting per CPU */
+
+/*
+ * Per-CPU timer heap
+ * heap[0] has the earliest deadline; each timer records its index so it
+ * can be removed without a search.
+ */
+typedef struct timer_base {
+    ktimer_t *heap[TIMER_HEAP_MAX];
+    uint32_t count;
+    volatile int lock;
+} ALIGNED(64) timer_base_t;
+
+static timer_base_t timer_bases[PERCPU_MAX_CPUS];
+
+/* Expired soft timers waiting for SOFTIRQ_TIMER (own CPU, interrupts off) */
+typedef struct timer_soft {
+    ktimer_fn_t fns[TIMER_SOFT_MAX];
+    void *args[TIMER_SOFT_MAX];
+    uint32_t count;
+} ALIGNED(64) timer_soft_t;
+
+static timer_soft_t timer_softs[PERCPU_MAX_CPUS];
+
+/* Mode */
+static bool timer_ready = false;
+static bool timer_tickless = false;
+
+/**
+ * Lock a timer heap (caller has interrupts disabled)
+ */
+static inline void base_lock(timer_base_t *base) {
+    while (__sync_lock_test_and_set(&base->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void base_unlock(timer_base_t *base) {
+    __sync_lock_release(&base->lock);
+}
+
+/* ============================================================================
+ * Heap Operations (heap locked)
+ * ============================================================================ */
+
+static inline void heap_set(timer_base_t *base, uint32_t index, ktimer_t *timer) {
+    base->heap[index] = timer;
+    timer->index = index;
+}
+
+static void heap_sift_up(timer_base_t *base, uint32_t index) {
+    ktimer_t *timer = base->heap[index];
+
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (base->heap[parent]->expires <= timer->expires) {
+            break;
+        }
+        heap_set(base, index, base->heap[parent]);
+        index = parent;
+    }
+    heap_set(base, index, timer);
+}
+
+static void heap_sift_down(timer_base_t *base, uint32_t index) {
+    ktimer_t *timer = base->heap[index];
+
+    for (;;) {
+        uint32_t child = index * 2 + 1;
+        if (child >= base->count) {
+            break;
+        }
+        if (child + 1 < base->count &&
+            base->heap[child + 1]->expires < base->heap[child]->expires) {
+            child++;
+        }
+        if (timer->expires <= base->heap[child]->expires) {
+            break;
+        }
+        heap_set(base, index, base->heap[child]);
+        index = child;
+    }
+    heap_set(base, index, timer);
+}
+
+static bool heap_insert(timer_base_t *base, ktimer_t *timer) {
+    if (base->count >= TIMER_HEAP_MAX) {
+        return false;
+    }
+
+    heap_set(base, base->count++, timer);
+    heap_sift_up(base, timer->index);
+    return true;
+}
+
+static void heap_remove(timer_base_t *base, uint32_t index) {
+    ktimer_t *last = base->heap[--base->count];
+
+    if (index != base->count) {
+        heap_set(base, index, last);
+        heap_sift_up(base, index);
+        heap_sift_down(base, last->index);
+    }
+}
+
+/* ============================================================================
+ * Hardware
+ * ============================================================================ */
+
+/**
+ * Arm this CPU's timer for the earliest deadline (heap locked)
+ */
+static void timer_program(timer_base_t *base) {
+    if (!timer_tickless) {
+        return;
+    }
+
+    if (base->count == 0) {
+        apic_timer_disarm();
+        return;
+    }
+
+    uint64_t now = timer_now_ns();
+    uint64_t expires = base->heap[0]->expires;
+    apic_timer_arm(expires > now ? expires - now : 0);
+}
+
+/**
+ * Start the PIT at TIMER_FALLBACK_HZ and unmask IRQ0
+ */
+static void timer_pit_init(void) {
+    uint16_t divisor = (uint16_t)(PIT_FREQUENCY / TIMER_FALLBACK_HZ);
+
+    outb(PIT_CMD_PORT, PIT_CMD_PERIODIC);
+    io_wait();
+    outb(PIT_CH0_PORT, (uint8_t)(divisor & 0xFF));
+    io_wait();
+    outb(PIT_CH0_PORT, (uint8_t)((divisor >> 8) & 0xFF));
+    io_wait();
+
+    irq_unmask(0);
+
+    kprintf("[TIMER] PIT at %u Hz (divisor %u)\n", TIMER_FALLBACK_HZ, divisor);
+}
+
+/**
+ * Timer interrupt: run every expired timer of this CPU
+ */
+static void timer_interrupt(interrupt_frame_t *frame) {
+    timer_base_t *base = &timer_bases[percpu_cpu_id()];
+
+    /*
+     * Collect the callbacks under the lock and run them after it is
+     * dropped, so they can start and cancel timers. The timers
+     * themselves are not touched again: a one-shot timer's owner may
+     * reuse it as soon as it is no longer pending.
+     */
+    ktimer_fn_t fns[TIMER_BATCH_MAX];
+    void *args[TIMER_BATCH_MAX];
+    bool softs[TIMER_BATCH_MAX];
+    uint32_t n = 0;
+
+    base_lock(base);
+
+    uint64_t now = timer_now_ns();
+    while (base->count > 0 && base->heap[0]->expires <= now && n < TIMER_BATCH_MAX) {
+        ktimer_t *timer = base->heap[0];
+        heap_remove(base, 0);
+
+        fns[n] = timer->fn;
+        args[n] = timer->arg;
+        softs[n] = timer->soft;
+        n++;
+
+        if (timer->period) {
+            /* Skip periods missed while interrupts were off */
+            timer->expires += timer->period;
+            if (timer->expires <= now) {
+                timer->expires = now + timer->period;
+            }
+            heap_insert(base, timer);
+        } else {
+            timer->pending = false;
+        }
+    }
+
+    timer_program(base);
+    base_unlock(base);
+
+    /* Soft callbacks wait for the softirq; if its list is full they run now */
+    timer_soft_t *soft = &timer_softs[percpu_cpu_id()];
+    for (uint32_t i = 0; i < n; i++) {
+        if (softs[i] && soft->count < TIMER_SOFT_MAX) {
+            soft->fns[soft->count] = fns[i];
+            soft->args[soft->count] = args[i];
+            soft->count++;
+            softirq_raise(SOFTIRQ_TIMER);
+        } else {
+            fns[i](args[i]);
+        }
+    }
+
+    kprof_timer_tick(frame);
+
+    /* Soft timers run before a switch could leave them for the next interrupt */
+    softirq_irq_exit();
+
+    /* A callback may have woken something that should run now */
+    scheduler_preempt();
+}
+
+/**
+ * Timer softirq: run the soft callbacks that expired on this CPU
+ */
+static void timer_softirq(void) {
+    timer_soft_t *soft = &timer_softs[percpu_cpu_id()];
+    ktimer_fn_t fns[TIMER_SOFT_MAX];
+    void *args[TIMER_SOFT_MAX];
+
+    uint64_t flags = interrupts_save();
+    uint32_t n = soft->count;
+    for (uint32_t i = 0; i < n; i++) {
+        fns[i] = soft->fns[i];
+        args[i] = soft->args[i];
+    }
+    soft->count = 0;
+    interrupts_restore(flags);
+
+    for (uint32_t i = 0; i < n; i++) {
+        fns[i](args[i]);
+    }
+}
+
+/* ============================================================================
+ * Public API
+ * ============================================================================ */
+
+void timer_init(void) {
+    kprintf("[TIMER] Initializing timers...\n");
+
+    clock_init();
+
+    if (apic_get_info()->enabled && apic_timer_init_oneshot()) {
+        timer_tickless = true;
+
+        /* The PIT stays silent */
+        irq_mask(0);
+        kprintf("[TIMER] Tickless mode, local APIC timer\n");
+    } else {
+        timer_tickless = false;
+        timer_pit_init();
+        kprintf("[TIMER] Periodic mode, %u us resolution\n", 1000000 / TIMER_FALLBACK_HZ);
+    }
+
+    softirq_register(SOFTIRQ_TIMER, timer_softirq);
+    idt_register_handler(IRQ_TIMER, timer_interrupt);
+    timer_ready = true;
+}
+
+void timer_init_cpu(void) {
+    if (timer_tickless) {
+        apic_timer_init_oneshot();
+    }
+}
+
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg) {
+    timer->expires = 0;
+    timer->period = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->cpu = 0;
+    timer->index = 0;
+    timer->pending = false;
+    timer->soft = false;
+}
+
+void ktimer_init_soft(ktimer_t *timer, ktimer_fn_t fn, void *arg) {
+    ktimer_init(timer, fn, arg);
+    timer->soft = true;
+}
+
+bool ktimer_start(ktimer_t *timer, uint64_t delay_ns, uint64_t period_ns) {
+    if (!timer || !timer->fn) {
+        return false;
+    }
+
+    ktimer_cancel(timer);
+
+    uint64_t flags = interrupts_save();
+    uint32_t cpu = percpu_cpu_id();
+    timer_base_t *base = &timer_bases[cpu];
+    base_lock(base);
+
+    timer->expires = timer_now_ns() + delay_ns;
+    timer->period = period_ns;
+    timer->cpu = cpu;
+
+    bool ok = heap_insert(base, timer);
+    if (ok) {
+        timer->pending = true;
+        if (timer->index == 0) {
+            timer_program(base);
+        }
+    }
+
+    base_unlock(base);
+    interrupts_restore(flags);
+
+    if (!ok) {
+        kprintf("[TIMER] Error: CPU %u has %u timers pending\n", cpu, TIMER_HEAP_MAX);
+    }
+    return ok;
+}
+
+bool ktimer_cancel(ktimer_t *timer) {
+    if (!timer || !timer->pending) {
+        return false;
+    }
+
+    uint64_t flags = interrupts_save();
+    uint32_t cpu = timer->cpu;
+    timer_base_t *base = &timer_bases[cpu];
+    base_lock(base);
+
+    /* It may have fired or moved while the lock was taken */
+    bool was_pending = timer->pending && timer->cpu == cpu;
+    if (was_pending) {
+        bool first = timer->index == 0;
+        heap_remove(base, timer->index);
+        timer->pending = false;
+
+        /* A remote CPU just takes one early interrupt */
+        if (first && cpu == percpu_cpu_id()) {
+            timer_program(base);
+        }
+    }
+
+    base_unlock(base);
+    interrupts_restore(flags);
+    return was_pending;
+}
+
+/**
+ * Busy-wait for ns nanoseconds
+ */
+static void timer_spin_ns(uint64_t ns) {
+    if (!clock_ready()) {
+        for (uint64_t us = (ns + 999) / 1000; us > 0; us -= MIN(us, 1000ULL)) {
+            apic_delay_us((uint32_t)MIN(us, 1000ULL));
+        }
+        return;
+    }
+
+    uint64_t end = timer_now_ns() + ns;
+    while (timer_now_ns() < end) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/**
+ * Sleep timer callback: make the sleeper runnable again
+ */
+static void timer_sleep_wake(void *arg) {
+    scheduler_wake((process_t*)arg, false);
+}
+
+void timer_sleep_ns(uint64_t ns) {
+    process_t *proc = scheduler_get_current();
+
+    if (!timer_ready || !scheduler_is_running() || !proc || proc->priority == PRIORITY_IDLE) {
+        timer_spin_ns(ns);
+        return;
+    }
+
+    uint64_t deadline = timer_now_ns() + ns;
+    ktimer_t timer;
+    ktimer_init(&timer, timer_sleep_wake, proc);
+
+    /* Another wakeup may come first; sleep again for what is left */
+    for (uint64_t now = timer_now_ns(); now < deadline; now = timer_now_ns()) {
+        uint64_t flags = interrupts_save();
+
+        /* Interrupts stay off until the switch, so the wakeup cannot be missed */
+        proc->state = PROCESS_STATE_BLOCKED;
+        if (!ktimer_start(&timer, deadline - now, 0)) {
+            proc->state = PROCESS_STATE_RUNNING;
+            interrupts_restore(flags);
+            timer_spin_ns(deadline - now);
+            return;
+        }
+        scheduler_yield();
+
+        interrupts_restore(flags);
+        ktimer_cancel(&timer);
+    }
+}
+
+void timer_sleep_ms(uint32_t ms) {
+    timer_sleep_ns((uint64_t)ms * NSEC_PER_MSEC);
+}
@@ -0,0 +1,120 @@
+/**
+ * AAAos Kernel - High-Resolution Timers
+ *
+ * Kernel timers are deadlines on the monotonic clock (clock.h), kept in a
+ * min-heap per CPU. The local APIC timer runs in one-shot (or
+ * TSC-deadline) mode and is programmed for the earliest deadline only,
+ * so a CPU with nothing due takes no timer interrupts. Without a local
+ * APIC the PIT runs periodically at TIMER_FALLBACK_HZ and every interrupt
+ * checks the heap.
+ *
+ * Callbacks run in interrupt context on the CPU that started the timer
+ * and must not sleep. A periodic timer is re-armed before its callback
+ * runs. Callbacks of timers set up with ktimer_init_soft run from the
+ * SOFTIRQ_TIMER softirq (softirq.h) instead, with interrupts enabled;
+ * housekeeping timers that need not be exact belong there.
+ */
+
+#ifndef _AAAOS_SCHED_TIMER_H
+#define _AAAOS_SCHED_TIMER_H
+
+#include "../include/types.h"
+#include "clock.h"
+
+/* Timers pending at once on one CPU */
+#define TIMER_HEAP_MAX          256
+
+/* PIT rate when there is no local APIC timer */
+#define TIMER_FALLBACK_HZ       1000
+
+/**
+ * Timer callback (interrupt context)
+ */
+typedef void (*ktimer_fn_t)(void *arg);
+
+/**
+ * Kernel timer, embedded in its owner
+ */
+typedef struct ktimer {
+    uint64_t expires;                   /* Deadline (timer_now_ns clock) */
+    uint64_t period;                    /* Re-arm interval, 0 for one-shot */
+    ktimer_fn_t fn;
+    void *arg;
+    uint32_t cpu;                       /* Heap the timer is pending on */
+    uint32_t index;                     /* Position in that heap */
+    volatile bool pending;
+    bool soft;                          /* Callback runs from SOFTIRQ_TIMER */
+} ktimer_t;
+
+/**
+ * Initialize the timer subsystem and the BSP's timer hardware
+ * Calibrates the clock if that has not happened yet. Uses the local APIC
+ * timer if apic_init succeeded, the PIT otherwise.
+ */
+void timer_init(void);
+
+/**
+ * Start the timer hardware of an application processor
+ */
+void timer_init_cpu(void);
+
+/**
+ * Current time on the timer clock (clock_monotonic_ns)
+ */
+static inline uint64_t timer_now_ns(void) {
+    return clock_monotonic_ns();
+}
+
+static inline uint64_t timer_now_ms(void) {
+    return clock_monotonic_ms();
+}
+
+/**
+ * Prepare a timer for use
+ * @param timer Timer to initialize
+ * @param fn Callback run when the timer expires
+ * @param arg Argument passed to fn
+ */
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg);
+
+/**
+ * Prepare a timer whose callback runs from the timer softirq
+ */
+void ktimer_init_soft(ktimer_t *timer, ktimer_fn_t fn, void *arg);
+
+/**
+ * Start (or restart) a timer on the calling CPU
+ * @param timer Initialized timer
+ * @param delay_ns Time until the first expiry
+ * @param period_ns Interval between later expiries, 0 for one-shot
+ * @return false if this CPU's heap is full
+ */
+bool ktimer_start(ktimer_t *timer, uint64_t delay_ns, uint64_t period_ns);
+
+/**
+ * Stop a pending timer
+ * A callback already running on another CPU is not waited for.
+ * @return true if the timer was pending
+ */
+bool ktimer_cancel(ktimer_t *timer);
+
+/**
+ * Check if a timer is pending
+ */
+static inline bool ktimer_pending(const ktimer_t *timer) {
+    return timer->pending;
+}
+
+/**
+ * Block the calling process for at least ns nanoseconds
+ * Busy-waits when called before the scheduler runs or from an idle
+ * process.
+ */
+void timer_sleep_ns(uint64_t ns);
+
+/**
+ * Block the calling process for at least ms milliseconds
+ */
+void timer_sleep_ms(uint32_t ms);
+
+#endif /* _AAAOS_SCHED_TIMER_H */
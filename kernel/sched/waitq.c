@@ -0,0 +1,195 @@
+/**
+ * AAAos Kernel - Address-Keyed Wait Queues Implementation
+ *
+ * Bucket locks are taken with interrupts off, as wakes may come from
+ * interrupt handlers. A waker may take run queue locks while holding a
+ * bucket lock; nothing takes them in the other order.
+ */
+
+#include "waitq.h"
+#include "scheduler.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../proc/process.h"
+
+/**
+ * A sleeping waiter, on its own stack
+ */
+typedef struct waitq_node {
+    const void *space;
+    const volatile uint32_t *addr;
+    process_t *proc;
+    struct waitq_node *next;
+    struct waitq_node *prev;
+    bool woken;                         /* Set by the waker, under the bucket lock */
+} waitq_node_t;
+
+/**
+ * Hash bucket, a FIFO of waiters
+ */
+typedef struct waitq_bucket {
+    volatile int lock;
+    waitq_node_t *head;
+    waitq_node_t *tail;
+} ALIGNED(64) waitq_bucket_t;
+
+static waitq_bucket_t waitq_buckets[WAITQ_BUCKETS];
+
+/* Statistics (updated atomically) */
+static waitq_stats_t waitq_stats;
+
+static inline void bucket_lock(waitq_bucket_t *b) {
+    while (__sync_lock_test_and_set(&b->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void bucket_unlock(waitq_bucket_t *b) {
+    __sync_lock_release(&b->lock);
+}
+
+/**
+ * Bucket of a key
+ */
+static waitq_bucket_t* waitq_hash(const void *space, const volatile uint32_t *addr) {
+    uint64_t key = ((uint64_t)(uintptr_t)addr >> 2) ^ (uint64_t)(uintptr_t)space;
+    key *= 0x9E3779B97F4A7C15ULL;
+    return &waitq_buckets[key >> (64 - 6)];
+}
+
+_Static_assert(WAITQ_BUCKETS == 64, "waitq_hash takes the top 6 bits");
+
+static void bucket_remove(waitq_bucket_t *b, waitq_node_t *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        b->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        b->tail = node->prev;
+    }
+}
+
+int waitq_wait_in(const void *space, const volatile uint32_t *addr, uint32_t expected) {
+    process_t *proc = scheduler_get_current();
+
+    /* Nothing to switch to: wait for the word to change */
+    if (!scheduler_is_running() || !proc || proc->priority == PRIORITY_IDLE) {
+        if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != expected) {
+            __atomic_fetch_add(&waitq_stats.mismatches, 1, __ATOMIC_RELAXED);
+            return WAITQ_AGAIN;
+        }
+        while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == expected) {
+            __asm__ __volatile__("pause");
+        }
+        return WAITQ_WOKEN;
+    }
+
+    waitq_bucket_t *b = waitq_hash(space, addr);
+    waitq_node_t node = { space, addr, proc, NULL, NULL, false };
+
+    uint64_t flags = interrupts_save();
+    bucket_lock(b);
+
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected) {
+        bucket_unlock(b);
+        interrupts_restore(flags);
+        __atomic_fetch_add(&waitq_stats.mismatches, 1, __ATOMIC_RELAXED);
+        return WAITQ_AGAIN;
+    }
+
+    node.prev = b->tail;
+    if (b->tail) {
+        b->tail->next = &node;
+    } else {
+        b->head = &node;
+    }
+    b->tail = &node;
+    proc->state = PROCESS_STATE_BLOCKED;
+
+    bucket_unlock(b);
+    __atomic_fetch_add(&waitq_stats.waits, 1, __ATOMIC_RELAXED);
+
+    for (;;) {
+        scheduler_yield();
+        interrupts_disable();
+
+        bucket_lock(b);
+        bool woken = node.woken;
+        if (!woken) {
+            /* Woken by someone else: keep waiting for our key */
+            proc->state = PROCESS_STATE_BLOCKED;
+        }
+        bucket_unlock(b);
+
+        if (woken) {
+            break;
+        }
+    }
+
+    interrupts_restore(flags);
+    return WAITQ_WOKEN;
+}
+
+uint32_t waitq_wake_in(const void *space, const volatile uint32_t *addr, uint32_t count) {
+    waitq_bucket_t *b = waitq_hash(space, addr);
+    uint32_t woken = 0;
+
+    uint64_t flags = interrupts_save();
+    bucket_lock(b);
+
+    waitq_node_t *node = b->head;
+    while (node && woken < count) {
+        waitq_node_t *next = node->next;
+
+        if (node->addr == addr && node->space == space) {
+            bucket_remove(b, node);
+            /* The waiter cannot see this and return before we unlock */
+            node->woken = true;
+            scheduler_wake(node->proc, false);
+            woken++;
+        }
+        node = next;
+    }
+
+    bucket_unlock(b);
+    interrupts_restore(flags);
+
+    if (woken > 0) {
+        __atomic_fetch_add(&waitq_stats.wakeups, woken, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&waitq_stats.empty_wakes, 1, __ATOMIC_RELAXED);
+    }
+    return woken;
+}
+
+/**
+ * Get wait queue statistics
+ */
+void waitq_get_stats(waitq_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    stats->waits = __atomic_load_n(&waitq_stats.waits, __ATOMIC_RELAXED);
+    stats->mismatches = __atomic_load_n(&waitq_stats.mismatches, __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&waitq_stats.wakeups, __ATOMIC_RELAXED);
+    stats->empty_wakes = __atomic_load_n(&waitq_stats.empty_wakes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Print wait queue statistics
+ */
+void waitq_dump_stats(void) {
+    waitq_stats_t s;
+    waitq_get_stats(&s);
+
+    kprintf("[WAITQ] ========== Wait Queue Statistics ==========\n");
+    kprintf("[WAITQ] Sleeps:         %llu\n", s.waits);
+    kprintf("[WAITQ] Value changed:  %llu\n", s.mismatches);
+    kprintf("[WAITQ] Wakeups:        %llu\n", s.wakeups);
+    kprintf("[WAITQ] Empty wakes:    %llu\n", s.empty_wakes);
+    kprintf("[WAITQ] ============================================\n");
+}
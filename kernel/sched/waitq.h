@@ -0,0 +1,96 @@
+/**
+ * AAAos Kernel - Address-Keyed Wait Queues
+ *
+ * Futex-style blocking: a waiter names a 32-bit word and the value it
+ * expects there, and sleeps only if the word still holds that value when
+ * its hash bucket is locked. A waker changes the word first, then wakes
+ * waiters keyed on it. Since both sides check under the bucket lock, a
+ * wakeup between the caller's own check and the sleep cannot be lost.
+ *
+ * Waiters hang off one of WAITQ_BUCKETS hashed buckets in FIFO order, on
+ * nodes that live on their own stacks. Wakes only take the one bucket,
+ * so no process list is scanned; distinct keys that share a bucket are
+ * skipped over.
+ *
+ * Keys are (space, address) pairs. Kernel objects use WAITQ_KERNEL; a
+ * user word is keyed by the address space it lives in, so equal virtual
+ * addresses in different processes do not collide. SYS_FUTEX exposes
+ * this to user code, which only enters the kernel when it has to sleep
+ * or has sleepers to wake.
+ */
+
+#ifndef _AAAOS_SCHED_WAITQ_H
+#define _AAAOS_SCHED_WAITQ_H
+
+#include "../include/types.h"
+
+/* Hash buckets (power of two) */
+#define WAITQ_BUCKETS           64
+
+/* Key space of kernel objects */
+#define WAITQ_KERNEL            NULL
+
+/* waitq_wake count that wakes every waiter */
+#define WAITQ_WAKE_ALL          UINT32_MAX
+
+/* waitq_wait results */
+#define WAITQ_WOKEN             0       /* Slept and was woken */
+#define WAITQ_AGAIN             (-1)    /* The word no longer held the expected value */
+
+/**
+ * Wait queue statistics
+ */
+typedef struct waitq_stats {
+    uint64_t waits;                     /* Times a caller went to sleep */
+    uint64_t mismatches;                /* Waits that found the word already changed */
+    uint64_t wakeups;                   /* Waiters woken */
+    uint64_t empty_wakes;               /* Wakes that found nobody to wake */
+} waitq_stats_t;
+
+/**
+ * Sleep while *addr == expected
+ * Returns at once if the value differs. Before the scheduler runs (or in
+ * the idle process) it spins on the word instead of sleeping. Callers
+ * re-check their condition after waking.
+ * @param space Key space (WAITQ_KERNEL or an address space)
+ * @param addr Word to wait on
+ * @param expected Value to sleep on
+ * @return WAITQ_WOKEN or WAITQ_AGAIN
+ */
+int waitq_wait_in(const void *space, const volatile uint32_t *addr, uint32_t expected);
+
+/**
+ * Wake up to count waiters on a word, oldest first
+ * Safe from interrupt context.
+ * @param space Key space given to waitq_wait_in
+ * @param addr Word the waiters wait on
+ * @param count Most waiters to wake (WAITQ_WAKE_ALL for all)
+ * @return Number of waiters woken
+ */
+uint32_t waitq_wake_in(const void *space, const volatile uint32_t *addr, uint32_t count);
+
+/**
+ * Sleep on a kernel word
+ */
+static inline int waitq_wait(const volatile uint32_t *addr, uint32_t expected) {
+    return waitq_wait_in(WAITQ_KERNEL, addr, expected);
+}
+
+/**
+ * Wake waiters on a kernel word
+ */
+static inline uint32_t waitq_wake(const volatile uint32_t *addr, uint32_t count) {
+    return waitq_wake_in(WAITQ_KERNEL, addr, count);
+}
+
+/**
+ * Get wait queue statistics
+ */
+void waitq_get_stats(waitq_stats_t *stats);
+
+/**
+ * Print wait queue statistics to serial console
+ */
+void waitq_dump_stats(void);
+
+#endif /* _AAAOS_SCHED_WAITQ_H */
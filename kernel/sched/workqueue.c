@@ -0,0 +1,162 @@
+/**
+ * AAAos Kernel - Per-CPU Workqueues
+ *
+ * Each CPU has a FIFO of items under its own lock, taken with interrupts
+ * off since interrupt handlers queue onto it, and a count its worker
+ * sleeps on. A worker takes one item at a time, so the latency of each
+ * is measured when it actually starts.
+ */
+
+#include "workqueue.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "waitq.h"
+#include "../include/serial.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../init/initcall.h"
+#include "../proc/process.h"
+#include "../stats/kstat.h"
+
+/**
+ * Per-CPU work queue
+ */
+typedef struct work_cpu {
+    spinlock_t lock;
+    work_t *head;                       /* Oldest item */
+    work_t *tail;                       /* Newest item, NULL when empty */
+    volatile uint32_t count;            /* Items queued; the worker sleeps on it */
+    volatile bool started;              /* Worker thread exists */
+} ALIGNED(64) work_cpu_t;
+
+LOCK_CLASS(work_queue, "sched.work");
+
+static work_cpu_t work_cpus[PERCPU_MAX_CPUS] = {
+    [0 ... PERCPU_MAX_CPUS - 1] = { .lock = SPINLOCK_INIT(LOCK_CLASS_OF(work_queue)) },
+};
+
+KSTAT_COUNTER(work_runs, "sched.work.runs", "Work items run by the workers");
+KSTAT_COUNTER(work_inline, "sched.work.inline",
+              "Work items run by the caller before the workers started");
+KSTAT_HISTOGRAM(work_latency, "sched.work.latency_ns",
+                "Nanoseconds from queueing a work item to running it");
+
+void work_init(work_t *work, work_fn_t fn, void *arg) {
+    work->next = NULL;
+    work->fn = fn;
+    work->arg = arg;
+    work->queued_at = 0;
+    work->pending = false;
+}
+
+bool queue_work_on(uint32_t cpu, work_t *work) {
+    if (__atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    if (cpu >= PERCPU_MAX_CPUS || !__atomic_load_n(&work_cpus[cpu].started, __ATOMIC_ACQUIRE)) {
+        cpu = 0;
+    }
+    work_cpu_t *wc = &work_cpus[cpu];
+
+    /* No worker yet: run it now */
+    if (!__atomic_load_n(&wc->started, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+        work->fn(work->arg);
+        kstat_inc(work_inline);
+        return true;
+    }
+
+    work->next = NULL;
+    work->queued_at = clock_cycles();
+
+    uint64_t flags = spinlock_acquire_irqsave(&wc->lock);
+    if (wc->tail) {
+        wc->tail->next = work;
+    } else {
+        wc->head = work;
+    }
+    wc->tail = work;
+    wc->count++;
+    spinlock_release_irqrestore(&wc->lock, flags);
+
+    waitq_wake(&wc->count, 1);
+    return true;
+}
+
+bool queue_work(work_t *work) {
+    return queue_work_on(percpu_cpu_id(), work);
+}
+
+/**
+ * Body of a CPU's worker thread
+ */
+static void work_thread(void *arg) {
+    work_cpu_t *wc = arg;
+
+    for (;;) {
+        waitq_wait(&wc->count, 0);
+
+        uint64_t flags = spinlock_acquire_irqsave(&wc->lock);
+        work_t *work = wc->head;
+        if (work) {
+            wc->head = work->next;
+            if (!wc->head) {
+                wc->tail = NULL;
+            }
+            wc->count--;
+            /* From here on the item may be queued again, even by itself */
+            __atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+        }
+        spinlock_release_irqrestore(&wc->lock, flags);
+
+        if (!work) {
+            continue;
+        }
+
+        kstat_observe(work_latency, clock_cycles_to_ns(clock_cycles() - work->queued_at));
+        work->fn(work->arg);
+        kstat_inc(work_runs);
+    }
+}
+
+/**
+ * Start one pinned worker per online CPU once threads can run
+ */
+static bool work_initcall(void) {
+    if (!scheduler_is_running()) {
+        return true;
+    }
+
+    bool ok = true;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        percpu_t *pc = percpu_get(cpu);
+        work_cpu_t *wc = &work_cpus[cpu];
+        if (!pc || !pc->online || wc->started) {
+            continue;
+        }
+
+        /* "kworker/<cpu>" */
+        char name[16] = "kworker/";
+        uint32_t len = 8;
+        if (cpu >= 100) {
+            name[len++] = (char)('0' + cpu / 100);
+        }
+        if (cpu >= 10) {
+            name[len++] = (char)('0' + cpu / 10 % 10);
+        }
+        name[len++] = (char)('0' + cpu % 10);
+        name[len] = '\0';
+
+        process_t *thread = thread_create(NULL, name, work_thread, wc);
+        if (!thread || !scheduler_pin(thread, cpu) || !scheduler_add(thread)) {
+            kprintf("[WORK] Cannot start the worker for CPU %u\n", cpu);
+            ok = false;
+            continue;
+        }
+        __atomic_store_n(&wc->started, true, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+INITCALL(workqueue, work_initcall, 0);
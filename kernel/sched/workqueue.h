@@ -0,0 +1,71 @@
+/**
+ * AAAos Kernel - Per-CPU Workqueues
+ *
+ * Work that may sleep or take long, handed off by an interrupt handler,
+ * softirq or thread to a kernel thread. Each online CPU runs one
+ * "kworker/<cpu>" thread pinned to it, which runs the items queued on
+ * that CPU in order:
+ *
+ *   static work_t kbd_work;
+ *   work_init(&kbd_work, kbd_process, NULL);
+ *   ...
+ *   queue_work(&kbd_work);              (from the interrupt handler)
+ *
+ * An item is queued at most once at a time; queueing it again while it
+ * waits does nothing, and it may be queued again once its function has
+ * started. Until the workers are running, queued items run at once in
+ * the caller. The time from queueing to running each item is recorded
+ * in the "sched.work.latency_ns" histogram (kstat.h).
+ */
+
+#ifndef _AAAOS_SCHED_WORKQUEUE_H
+#define _AAAOS_SCHED_WORKQUEUE_H
+
+#include "../include/types.h"
+
+/**
+ * Work function
+ */
+typedef void (*work_fn_t)(void *arg);
+
+/**
+ * Work item, usually embedded in or next to the data it works on
+ */
+typedef struct work {
+    struct work *next;                  /* Queue link */
+    work_fn_t fn;
+    void *arg;
+    uint64_t queued_at;                 /* clock_cycles() when queued */
+    volatile bool pending;              /* Waiting on a queue */
+} work_t;
+
+/* Static initializer of a work item */
+#define WORK_INIT(fn, arg)      { NULL, (fn), (arg), 0, false }
+
+/**
+ * Prepare a work item
+ */
+void work_init(work_t *work, work_fn_t fn, void *arg);
+
+/**
+ * Queue a work item on the calling CPU's worker
+ * Safe from any context.
+ * @return false if the item was already waiting
+ */
+bool queue_work(work_t *work);
+
+/**
+ * Queue a work item on the worker of a given CPU
+ * A CPU without a worker hands the item to the boot CPU's.
+ * @return false if the item was already waiting
+ */
+bool queue_work_on(uint32_t cpu, work_t *work);
+
+/**
+ * Check whether a work item is waiting to run
+ */
+static inline bool work_pending(const work_t *work) {
+    return work->pending;
+}
+
+#endif /* _AAAOS_SCHED_WORKQUEUE_H */
@@ -4,8 +4,39 @@
 
 #include "include/serial.h"
 #include "arch/x86_64/io.h"
+#include "arch/x86_64/irq.h"
+#include "arch/x86_64/include/idt.h"
 #include <stdarg.h>
 
+#define SERIAL_TX_RING_MASK     (SERIAL_TX_RING_SIZE - 1)
+
+/* Bytes serial_printf and serial_puts format before queueing them */
+#define SERIAL_CHUNK_SIZE       256
+
+_Static_assert((SERIAL_TX_RING_SIZE & SERIAL_TX_RING_MASK) == 0,
+               "SERIAL_TX_RING_SIZE must be a power of 2");
+
+volatile int serial_log_level = SERIAL_LOG_INFO;
+
+/*
+ * Console output ring. Writers reserve space by advancing tx_reserve,
+ * copy their bytes in, then advance tx_commit in reservation order (with
+ * interrupts off, so a writer is never waiting on one it interrupted).
+ * The drainer, serialized by tx_drain_lock, sends from tx_tail up to
+ * tx_commit. The counters only grow; positions are taken modulo the size.
+ */
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static volatile uint64_t tx_reserve = 0;
+static volatile uint64_t tx_commit = 0;
+static volatile uint64_t tx_tail = 0;
+static volatile int tx_drain_lock = 0;
+
+static uint16_t tx_port = 0;            /* Buffered port, 0 if none */
+static volatile bool tx_sync = false;   /* Set by serial_panic_mode */
+static volatile bool tx_irq_on = false; /* Transmit interrupt enabled */
+
+static serial_stats_t tx_stats;
+
 /**
  * Initialize serial port
  */
@@ -52,28 +83,246 @@ static inline bool serial_tx_empty(uint16_t port) {
 }
 
 /**
- * Write a character to serial port
+ * Write a byte, waiting for the UART
  */
-void serial_putc(uint16_t port, char c) {
+static void serial_putc_sync(uint16_t port, char c) {
     /* Wait for transmit buffer to be empty */
     while (!serial_tx_empty(port)) {
-        /* Spin */
+        __asm__ __volatile__("pause");
     }
     outb(port + SERIAL_DATA, (uint8_t)c);
 }
 
 /**
- * Write a string to serial port
+ * Check if writes to a port go through the ring
  */
-void serial_puts(uint16_t port, const char *str) {
+static inline bool serial_buffered(uint16_t port) {
+    return port == tx_port && !tx_sync;
+}
+
+/**
+ * Turn the transmit interrupt on or off (drain lock held)
+ */
+static void serial_set_tx_irq(bool on) {
+    if (tx_irq_on != on) {
+        tx_irq_on = on;
+        outb(tx_port + SERIAL_INT_ENABLE, on ? SERIAL_IER_THRE : 0);
+    }
+}
+
+/**
+ * Move queued bytes into the UART FIFO while it has room
+ * Whoever holds the drain lock does the work; others leave it to them.
+ * The interrupt stays on while bytes are left, so the rest goes out as
+ * the FIFO empties.
+ */
+static void serial_drain(void) {
+    do {
+        if (__sync_lock_test_and_set(&tx_drain_lock, 1)) {
+            return;
+        }
+
+        uint64_t tail = tx_tail;
+        uint64_t commit = __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE);
+
+        while (tail != commit && serial_tx_empty(tx_port)) {
+            for (int n = 0; n < SERIAL_FIFO_SIZE && tail != commit; n++) {
+                outb(tx_port + SERIAL_DATA, (uint8_t)tx_ring[tail & SERIAL_TX_RING_MASK]);
+                tail++;
+            }
+            tx_stats.written += tail - tx_tail;
+            __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+            commit = __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE);
+        }
+        serial_set_tx_irq(tail != commit);
+
+        __sync_lock_release(&tx_drain_lock);
+
+        /* A writer may have committed after our last look and found the lock taken */
+    } while (!tx_irq_on && __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) !=
+                           __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Queue bytes in the ring, or drop them all if they do not fit
+ */
+static void serial_queue(const char *data, size_t len) {
+    uint64_t flags = interrupts_save();
+    uint64_t start = __atomic_load_n(&tx_reserve, __ATOMIC_RELAXED);
+
+    do {
+        if (start + len - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) > SERIAL_TX_RING_SIZE) {
+            __atomic_add_fetch(&tx_stats.dropped, len, __ATOMIC_RELAXED);
+            interrupts_restore(flags);
+            serial_drain();
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&tx_reserve, &start, start + len, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    for (size_t i = 0; i < len; i++) {
+        tx_ring[(start + i) & SERIAL_TX_RING_MASK] = data[i];
+    }
+
+    /* Commit in reservation order; earlier writers are copying on other CPUs */
+    while (__atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE) != start) {
+        __asm__ __volatile__("pause");
+    }
+    __atomic_store_n(&tx_commit, start + len, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&tx_stats.queued, len, __ATOMIC_RELAXED);
+    interrupts_restore(flags);
+
+    serial_drain();
+}
+
+void serial_write(uint16_t port, const char *data, size_t len) {
+    if (!serial_buffered(port)) {
+        for (size_t i = 0; i < len; i++) {
+            serial_putc_sync(port, data[i]);
+        }
+        return;
+    }
+
+    /* Larger writes go in pieces so each can fit in the ring */
+    while (len > 0) {
+        size_t n = len < SERIAL_CHUNK_SIZE ? len : SERIAL_CHUNK_SIZE;
+        serial_queue(data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * Write a character to serial port
+ */
+void serial_putc(uint16_t port, char c) {
+    serial_write(port, &c, 1);
+}
+
+/**
+ * Formatted output collected before it is written
+ */
+typedef struct {
+    uint16_t port;
+    size_t len;
+    char buf[SERIAL_CHUNK_SIZE];
+} serial_sink_t;
+
+static void sink_flush(serial_sink_t *sink) {
+    serial_write(sink->port, sink->buf, sink->len);
+    sink->len = 0;
+}
+
+static void sink_putc(serial_sink_t *sink, char c) {
+    if (sink->len == SERIAL_CHUNK_SIZE) {
+        sink_flush(sink);
+    }
+    sink->buf[sink->len++] = c;
+}
+
+/**
+ * Add a string, turning "\n" into "\r\n"
+ */
+static void sink_puts(serial_sink_t *sink, const char *str) {
     while (*str) {
         if (*str == '\n') {
-            serial_putc(port, '\r');
+            sink_putc(sink, '\r');
         }
-        serial_putc(port, *str++);
+        sink_putc(sink, *str++);
     }
 }
 
+/**
+ * Write a string to serial port
+ */
+void serial_puts(uint16_t port, const char *str) {
+    serial_sink_t sink;
+
+    sink.port = port;
+    sink.len = 0;
+    sink_puts(&sink, str);
+    sink_flush(&sink);
+}
+
+/**
+ * Transmit interrupt: refill the FIFO
+ */
+static void serial_interrupt(interrupt_frame_t *frame) {
+    UNUSED(frame);
+
+    /* Reading the identification register acknowledges a THRE interrupt */
+    inb(tx_port + SERIAL_FIFO_CTRL);
+    tx_stats.interrupts++;
+    serial_drain();
+}
+
+bool serial_enable_irq(uint16_t port) {
+    if (tx_port != 0 || (port != COM1_PORT && port != COM3_PORT)) {
+        return false;
+    }
+
+    tx_port = port;
+    idt_register_handler(IRQ_COM1, serial_interrupt);
+
+    /* OUT2 gates the UART's interrupt line; Modem Control already sets it */
+    outb(port + SERIAL_INT_ENABLE, 0);
+    irq_unmask(4);
+    return true;
+}
+
+void serial_flush(void) {
+    while (__atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE)) {
+        serial_drain();
+        __asm__ __volatile__("pause");
+    }
+}
+
+void serial_panic_mode(void) {
+    if (tx_port == 0 || tx_sync) {
+        return;
+    }
+    tx_sync = true;
+
+    /* Whatever is committed goes out now, lock or not */
+    outb(tx_port + SERIAL_INT_ENABLE, 0);
+    uint64_t commit = __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE);
+    for (uint64_t pos = tx_tail; pos != commit; pos++) {
+        serial_putc_sync(tx_port, tx_ring[pos & SERIAL_TX_RING_MASK]);
+    }
+    tx_tail = commit;
+}
+
+void serial_set_log_level(int level) {
+    if (level < SERIAL_LOG_ERROR) {
+        level = SERIAL_LOG_ERROR;
+    }
+    if (level > SERIAL_LOG_DEBUG) {
+        level = SERIAL_LOG_DEBUG;
+    }
+    serial_log_level = level;
+}
+
+const char *serial_log_level_name(int level) {
+    switch (level) {
+        case SERIAL_LOG_ERROR:  return "error";
+        case SERIAL_LOG_WARN:   return "warn";
+        case SERIAL_LOG_INFO:   return "info";
+        case SERIAL_LOG_DEBUG:  return "debug";
+        default:                return "?";
+    }
+}
+
+void serial_get_stats(serial_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->queued = __atomic_load_n(&tx_stats.queued, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&tx_stats.written, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&tx_stats.dropped, __ATOMIC_RELAXED);
+    stats->interrupts = __atomic_load_n(&tx_stats.interrupts, __ATOMIC_RELAXED);
+}
+
 /**
  * Check if data is available to read
  */
@@ -92,7 +341,7 @@ char serial_getc(uint16_t port) {
 }
 
 /* Helper function to print an unsigned integer */
-static void print_uint(uint16_t port, uint64_t value, int base, int width, char pad) {
+static void print_uint(serial_sink_t *sink, uint64_t value, int base, int width, char pad) {
     char buffer[65];
     const char *digits = "0123456789abcdef";
     int i = 0;
@@ -113,33 +362,38 @@ static void print_uint(uint16_t port, uint64_t value, int base, int width, char
 
     /* Print in reverse */
     while (i > 0) {
-        serial_putc(port, buffer[--i]);
+        sink_putc(sink, buffer[--i]);
     }
 }
 
 /* Helper function to print a signed integer */
-static void print_int(uint16_t port, int64_t value, int width, char pad) {
+static void print_int(serial_sink_t *sink, int64_t value, int width, char pad) {
     if (value < 0) {
-        serial_putc(port, '-');
+        sink_putc(sink, '-');
         value = -value;
         if (width > 0) width--;
     }
-    print_uint(port, (uint64_t)value, 10, width, pad);
+    print_uint(sink, (uint64_t)value, 10, width, pad);
 }
 
 /**
  * Printf-like function for serial output
  */
 void serial_printf(uint16_t port, const char *fmt, ...) {
+    serial_sink_t out;
+    serial_sink_t *sink = &out;
     va_list args;
+
+    out.port = port;
+    out.len = 0;
     va_start(args, fmt);
 
     while (*fmt) {
         if (*fmt != '%') {
             if (*fmt == '\n') {
-                serial_putc(port, '\r');
+                sink_putc(sink, '\r');
             }
-            serial_putc(port, *fmt++);
+            sink_putc(sink, *fmt++);
             continue;
         }
 
@@ -172,62 +426,63 @@ void serial_printf(uint16_t port, const char *fmt, ...) {
             case 'd':
             case 'i':
                 if (is_long >= 2) {
-                    print_int(port, va_arg(args, int64_t), width, pad);
+                    print_int(sink, va_arg(args, int64_t), width, pad);
                 } else if (is_long == 1) {
-                    print_int(port, va_arg(args, long), width, pad);
+                    print_int(sink, va_arg(args, long), width, pad);
                 } else {
-                    print_int(port, va_arg(args, int), width, pad);
+                    print_int(sink, va_arg(args, int), width, pad);
                 }
                 break;
 
             case 'u':
                 if (is_long >= 2) {
-                    print_uint(port, va_arg(args, uint64_t), 10, width, pad);
+                    print_uint(sink, va_arg(args, uint64_t), 10, width, pad);
                 } else if (is_long == 1) {
-                    print_uint(port, va_arg(args, unsigned long), 10, width, pad);
+                    print_uint(sink, va_arg(args, unsigned long), 10, width, pad);
                 } else {
-                    print_uint(port, va_arg(args, unsigned int), 10, width, pad);
+                    print_uint(sink, va_arg(args, unsigned int), 10, width, pad);
                 }
                 break;
 
             case 'x':
             case 'X':
                 if (is_long >= 2) {
-                    print_uint(port, va_arg(args, uint64_t), 16, width, pad);
+                    print_uint(sink, va_arg(args, uint64_t), 16, width, pad);
                 } else if (is_long == 1) {
-                    print_uint(port, va_arg(args, unsigned long), 16, width, pad);
+                    print_uint(sink, va_arg(args, unsigned long), 16, width, pad);
                 } else {
-                    print_uint(port, va_arg(args, unsigned int), 16, width, pad);
+                    print_uint(sink, va_arg(args, unsigned int), 16, width, pad);
                 }
                 break;
 
             case 'p':
-                serial_puts(port, "0x");
-                print_uint(port, (uint64_t)va_arg(args, void*), 16, 16, '0');
+                sink_puts(sink, "0x");
+                print_uint(sink, (uint64_t)va_arg(args, void*), 16, 16, '0');
                 break;
 
             case 's': {
                 const char *s = va_arg(args, const char*);
                 if (s == NULL) s = "(null)";
-                serial_puts(port, s);
+                sink_puts(sink, s);
                 break;
             }
 
             case 'c':
-                serial_putc(port, (char)va_arg(args, int));
+                sink_putc(sink, (char)va_arg(args, int));
                 break;
 
             case '%':
-                serial_putc(port, '%');
+                sink_putc(sink, '%');
                 break;
 
             default:
-                serial_putc(port, '%');
-                serial_putc(port, *fmt);
+                sink_putc(sink, '%');
+                sink_putc(sink, *fmt);
                 break;
         }
         fmt++;
     }
 
     va_end(args);
+    sink_flush(sink);
 }
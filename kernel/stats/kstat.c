@@ -0,0 +1,186 @@
+/**
+ * AAAos Kernel - Named Counters, Histograms and Tracepoints
+ *
+ * The descriptors sit between _kstat_start and _kstat_end, in the order
+ * the linker placed them.
+ */
+
+#include "kstat.h"
+
+extern const kstat_t _kstat_start[];
+extern const kstat_t _kstat_end[];
+
+static bool kstat_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+size_t kstat_count(void) {
+    return (size_t)(_kstat_end - _kstat_start);
+}
+
+const kstat_t *kstat_get(size_t index) {
+    return index < kstat_count() ? &_kstat_start[index] : NULL;
+}
+
+const kstat_t *kstat_find(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+    for (const kstat_t *k = _kstat_start; k < _kstat_end; k++) {
+        if (kstat_streq(k->name, name)) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+uint64_t kstat_read_cpu(const kstat_t *k, uint32_t cpu) {
+    if (k == NULL || cpu >= PERCPU_MAX_CPUS) {
+        return 0;
+    }
+
+    switch (k->type) {
+        case KSTAT_COUNTER:
+        case KSTAT_TRACEPOINT:
+            return __atomic_load_n(&((kstat_cpu_t *)k->cpu)[cpu].value, __ATOMIC_RELAXED);
+        case KSTAT_HISTOGRAM:
+            return __atomic_load_n(&((kstat_hist_cpu_t *)k->cpu)[cpu].count, __ATOMIC_RELAXED);
+        default:
+            return 0;
+    }
+}
+
+uint64_t kstat_read(const kstat_t *k) {
+    if (k == NULL) {
+        return 0;
+    }
+    if (k->type == KSTAT_GAUGE) {
+        return k->gauge ? k->gauge() : 0;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        total += kstat_read_cpu(k, cpu);
+    }
+    return total;
+}
+
+bool kstat_read_hist(const kstat_t *k, kstat_hist_t *hist) {
+    if (k == NULL || hist == NULL || k->type != KSTAT_HISTOGRAM) {
+        return false;
+    }
+
+    *hist = (kstat_hist_t){ 0 };
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        const kstat_hist_cpu_t *slot = &((const kstat_hist_cpu_t *)k->cpu)[cpu];
+        hist->count += __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+        hist->sum += __atomic_load_n(&slot->sum, __ATOMIC_RELAXED);
+        for (uint32_t b = 0; b < KSTAT_HIST_BUCKETS; b++) {
+            hist->buckets[b] += __atomic_load_n(&slot->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+    return true;
+}
+
+bool kstat_trace_enable(const kstat_t *k, bool enable) {
+    if (k == NULL || k->type != KSTAT_TRACEPOINT || k->tp == NULL) {
+        return false;
+    }
+    __atomic_store_n(&k->tp->enabled, enable, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool kstat_trace_enabled(const kstat_t *k) {
+    return k && k->type == KSTAT_TRACEPOINT && k->tp && k->tp->enabled;
+}
+
+const char *kstat_type_name(kstat_type_t type) {
+    switch (type) {
+        case KSTAT_COUNTER:     return "counter";
+        case KSTAT_HISTOGRAM:   return "histogram";
+        case KSTAT_GAUGE:       return "gauge";
+        case KSTAT_TRACEPOINT:  return "tracepoint";
+        default:                return "?";
+    }
+}
+
+/* ============================================================================
+ * Text
+ * ============================================================================ */
+
+/**
+ * Output buffer; text beyond its size is dropped but still counted
+ */
+typedef struct kstat_text {
+    char *buf;
+    size_t size;
+    size_t len;
+} kstat_text_t;
+
+static void text_putc(kstat_text_t *t, char c) {
+    if (t->len + 1 < t->size) {
+        t->buf[t->len] = c;
+    }
+    t->len++;
+}
+
+static void text_puts(kstat_text_t *t, const char *s) {
+    while (*s) {
+        text_putc(t, *s++);
+    }
+}
+
+static void text_uint(kstat_text_t *t, uint64_t value) {
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n > 0) {
+        text_putc(t, digits[--n]);
+    }
+}
+
+size_t kstat_format(const kstat_t *k, char *buf, size_t size) {
+    kstat_text_t t = { buf, size, 0 };
+
+    if (k == NULL || buf == NULL || size == 0) {
+        return 0;
+    }
+
+    if (k->type == KSTAT_HISTOGRAM) {
+        kstat_hist_t hist;
+        kstat_read_hist(k, &hist);
+        text_puts(&t, "count ");
+        text_uint(&t, hist.count);
+        text_puts(&t, " sum ");
+        text_uint(&t, hist.sum);
+        text_puts(&t, " avg ");
+        text_uint(&t, hist.count ? hist.sum / hist.count : 0);
+        text_putc(&t, '\n');
+        for (uint32_t b = 0; b < KSTAT_HIST_BUCKETS; b++) {
+            if (hist.buckets[b] == 0) {
+                continue;
+            }
+            text_uint(&t, b == 0 ? 0 : 1ULL << (b - 1));
+            text_putc(&t, ' ');
+            text_uint(&t, hist.buckets[b]);
+            text_putc(&t, '\n');
+        }
+    } else {
+        text_uint(&t, kstat_read(k));
+        if (k->type == KSTAT_TRACEPOINT) {
+            text_puts(&t, kstat_trace_enabled(k) ? " on" : " off");
+        }
+        text_putc(&t, '\n');
+    }
+
+    buf[t.len < size ? t.len : size - 1] = '\0';
+    return t.len < size ? t.len : size - 1;
+}
@@ -0,0 +1,243 @@
+/**
+ * AAAos Kernel - Named Counters, Histograms and Tracepoints
+ *
+ * Each metric is declared once at file scope and lands in the ".kstat"
+ * linker table, so the registry needs no registration calls and the
+ * "stats" shell command and statsfs see every metric in the kernel:
+ *
+ *   KSTAT_COUNTER(pipe_created, "ipc.pipe.created", "Pipes created");
+ *   ...
+ *   kstat_inc(pipe_created);
+ *
+ * Counters and histograms keep one cache-line aligned slot per CPU. An
+ * update is a single add to memory on the calling CPU's slot, which an
+ * interrupt on that CPU cannot split; a thread migrated between reading
+ * its CPU number and the add may lose an update to another CPU, which is
+ * acceptable for statistics. Reads sum the slots without locking.
+ *
+ * Gauges have no storage of their own: reading one calls a function that
+ * returns a module's existing state, such as the heap's used size.
+ *
+ * A tracepoint is disabled by default and then costs one load and a
+ * branch predicted not taken. Once enabled, each hit is counted and
+ * recorded into the structured log ring (log.h) with its arguments, free
+ * of the ring's rate limit. The same rules as log_event apply to the
+ * arguments: integers, and "%s" only for static strings.
+ */
+
+#ifndef _AAAOS_STATS_KSTAT_H
+#define _AAAOS_STATS_KSTAT_H
+
+#include "../include/types.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../log/log.h"
+
+/* Histogram buckets: 0, then [2^(i-1), 2^i); the last one takes the rest */
+#define KSTAT_HIST_BUCKETS      32
+
+/* Longest text kstat_format produces */
+#define KSTAT_TEXT_MAX          1024
+
+/* Metric types */
+typedef enum {
+    KSTAT_COUNTER = 0,
+    KSTAT_HISTOGRAM,
+    KSTAT_GAUGE,
+    KSTAT_TRACEPOINT
+} kstat_type_t;
+
+/**
+ * Per-CPU slot of a counter or tracepoint
+ */
+typedef struct kstat_cpu {
+    uint64_t value;
+} ALIGNED(64) kstat_cpu_t;
+
+/**
+ * Per-CPU slot of a histogram
+ */
+typedef struct kstat_hist_cpu {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[KSTAT_HIST_BUCKETS];
+} ALIGNED(64) kstat_hist_cpu_t;
+
+/**
+ * Histogram summed over all CPUs
+ */
+typedef struct kstat_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[KSTAT_HIST_BUCKETS];
+} kstat_hist_t;
+
+/**
+ * Gauge read function
+ */
+typedef uint64_t (*kstat_gauge_fn_t)(void);
+
+/**
+ * Tracepoint state
+ */
+typedef struct kstat_tracepoint {
+    volatile bool enabled;
+    log_site_t site;                    /* Format and name of the records */
+} kstat_tracepoint_t;
+
+/**
+ * Metric descriptor (one per KSTAT_* declaration, in the ".kstat" table)
+ */
+typedef struct kstat {
+    const char *name;                   /* "subsystem.metric" */
+    const char *desc;
+    kstat_type_t type;
+    void *cpu;                          /* PERCPU_MAX_CPUS slots, NULL for gauges */
+    kstat_gauge_fn_t gauge;             /* Gauges only */
+    kstat_tracepoint_t *tp;             /* Tracepoints only */
+} kstat_t;
+
+#define KSTAT_ENTRY_(id, name, desc, type, cpu, gauge, tp)                  \
+    static const kstat_t kstat_##id                                         \
+        __attribute__((used, section(".kstat"), aligned(8))) =              \
+        { name, desc, type, cpu, gauge, tp }
+
+/**
+ * Declare a per-CPU counter
+ * @param id   Identifier used with kstat_inc/kstat_add in this file
+ * @param name Exported name, "subsystem.metric"
+ * @param desc One-line description
+ */
+#define KSTAT_COUNTER(id, name, desc)                                       \
+    static kstat_cpu_t kstat_cpu_##id[PERCPU_MAX_CPUS];                     \
+    KSTAT_ENTRY_(id, name, desc, KSTAT_COUNTER, kstat_cpu_##id, NULL, NULL)
+
+/**
+ * Declare a per-CPU power-of-two histogram
+ */
+#define KSTAT_HISTOGRAM(id, name, desc)                                     \
+    static kstat_hist_cpu_t kstat_cpu_##id[PERCPU_MAX_CPUS];                \
+    KSTAT_ENTRY_(id, name, desc, KSTAT_HISTOGRAM, kstat_cpu_##id, NULL, NULL)
+
+/**
+ * Declare a gauge read through fn (kstat_gauge_fn_t)
+ */
+#define KSTAT_GAUGE(id, name, desc, fn)                                     \
+    KSTAT_ENTRY_(id, name, desc, KSTAT_GAUGE, NULL, fn, NULL)
+
+/**
+ * Declare a tracepoint
+ * @param fmt Format of its records (a string literal ending in "\n")
+ */
+#define KSTAT_TRACEPOINT(id, name, desc, fmt)                               \
+    static kstat_cpu_t kstat_cpu_##id[PERCPU_MAX_CPUS];                     \
+    static kstat_tracepoint_t kstat_tp_##id =                               \
+        { false, { fmt, name, SERIAL_LOG_INFO, 0, 0, 0, true } };           \
+    KSTAT_ENTRY_(id, name, desc, KSTAT_TRACEPOINT, kstat_cpu_##id, NULL, &kstat_tp_##id)
+
+/**
+ * Add to a slot with one instruction, so an interrupt cannot split it
+ */
+static inline void kstat_slot_add(uint64_t *slot, uint64_t n) {
+    __asm__ __volatile__("addq %1, %0" : "+m"(*slot) : "er"(n));
+}
+
+/**
+ * Bucket of a histogram value
+ */
+static inline uint32_t kstat_bucket(uint64_t value) {
+    uint32_t bucket = value ? 64 - (uint32_t)__builtin_clzll(value) : 0;
+    return bucket < KSTAT_HIST_BUCKETS ? bucket : KSTAT_HIST_BUCKETS - 1;
+}
+
+static inline void kstat_hist_cpu_add(kstat_hist_cpu_t *slot, uint64_t value) {
+    kstat_slot_add(&slot->count, 1);
+    kstat_slot_add(&slot->sum, value);
+    kstat_slot_add(&slot->buckets[kstat_bucket(value)], 1);
+}
+
+/* Update a metric declared in this file */
+#define kstat_add(id, n)        kstat_slot_add(&kstat_cpu_##id[percpu_cpu_id()].value, (n))
+#define kstat_inc(id)           kstat_add(id, 1)
+#define kstat_observe(id, v)    kstat_hist_cpu_add(&kstat_cpu_##id[percpu_cpu_id()], (v))
+
+/* Descriptor of a metric declared in this file */
+#define KSTAT(id)               (&kstat_##id)
+
+/**
+ * Hit a tracepoint
+ * @param ... Up to LOG_MAX_ARGS integer or pointer arguments for its format
+ */
+#define kstat_trace(id, ...)                                                \
+    do {                                                                    \
+        if (__builtin_expect(kstat_tp_##id.enabled, 0)) {                   \
+            const uint64_t kstat_args_[LOG_MAX_ARGS + 1] = {                \
+                LOG_CAT(LOG_ARGS_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)     \
+            };                                                              \
+            kstat_inc(id);                                                  \
+            log_record(&kstat_tp_##id.site, LOG_NARGS(__VA_ARGS__), kstat_args_); \
+        }                                                                   \
+    } while (0)
+
+/**
+ * Number of metrics in the kernel
+ */
+size_t kstat_count(void);
+
+/**
+ * Get a metric by index (0 to kstat_count() - 1)
+ * @return The descriptor, or NULL if out of range
+ */
+const kstat_t *kstat_get(size_t index);
+
+/**
+ * Find a metric by name
+ * @return The descriptor, or NULL if there is none
+ */
+const kstat_t *kstat_find(const char *name);
+
+/**
+ * Read a metric: a counter's total, a gauge's value, a histogram's
+ * observation count or a tracepoint's hits
+ */
+uint64_t kstat_read(const kstat_t *k);
+
+/**
+ * Read one CPU's share of a counter, histogram (count) or tracepoint
+ * @return The value, 0 for gauges and CPUs out of range
+ */
+uint64_t kstat_read_cpu(const kstat_t *k, uint32_t cpu);
+
+/**
+ * Sum a histogram over all CPUs
+ * @return false if k is not a histogram
+ */
+bool kstat_read_hist(const kstat_t *k, kstat_hist_t *hist);
+
+/**
+ * Enable or disable a tracepoint
+ * @return false if k is not a tracepoint
+ */
+bool kstat_trace_enable(const kstat_t *k, bool enable);
+
+/**
+ * Check whether a tracepoint is enabled
+ */
+bool kstat_trace_enabled(const kstat_t *k);
+
+/**
+ * Name of a metric type
+ */
+const char *kstat_type_name(kstat_type_t type);
+
+/**
+ * Render a metric's current value as text
+ * Counters and gauges give "<value>\n", tracepoints "<hits> on|off\n",
+ * histograms a "count <n> sum <s> avg <a>" line followed by one
+ * "<lower bound> <count>" line per non-empty bucket.
+ * @param buf Output buffer (up to KSTAT_TEXT_MAX bytes are needed)
+ * @param size Size of buf
+ * @return Length of the text, without the terminating NUL
+ */
+size_t kstat_format(const kstat_t *k, char *buf, size_t size);
+
+#endif /* _AAAOS_STATS_KSTAT_H */
@@ -0,0 +1,189 @@
+/**
+ * AAAos Kernel - Batched System Call Ring Implementation
+ *
+ * The ring is an ordinary anonymous mapping of the process, which the
+ * kernel reads and writes through the process's own page tables while it
+ * runs a system call on its behalf. Each drain first checks that the
+ * mapping is still there and writable, since the process may have
+ * unmapped it. Every SQE is copied before it runs, so user code changing
+ * it mid-operation cannot confuse the kernel.
+ */
+
+#include "ioring.h"
+#include "syscall.h"
+#include "../include/serial.h"
+#include "../mm/vma.h"
+#include "../mm/vmm.h"
+#include "../proc/process.h"
+
+/* Offsets keep the arrays on their own cache lines */
+#define IORING_ALIGN            64
+
+/**
+ * Byte layout of a ring with a given submission queue size
+ */
+static void ioring_layout(uint32_t entries, uint32_t *sq_offset, uint32_t *cq_offset,
+                          size_t *size) {
+    *sq_offset = ALIGN_UP(sizeof(ioring_header_t), IORING_ALIGN);
+    *cq_offset = ALIGN_UP(*sq_offset + entries * sizeof(ioring_sqe_t), IORING_ALIGN);
+    *size = ALIGN_UP(*cq_offset + entries * IORING_CQ_FACTOR * sizeof(ioring_cqe_t), PAGE_SIZE);
+}
+
+/**
+ * Check that the ring is still mapped writable in the process
+ */
+static bool ioring_mapped(process_t *proc) {
+    uint32_t sq_offset, cq_offset;
+    size_t size;
+    ioring_layout(proc->ioring_entries, &sq_offset, &cq_offset, &size);
+
+    vma_t *vma = vma_find(process_vmas(proc), proc->ioring);
+    return vma != NULL && vma->start <= proc->ioring && vma->end >= proc->ioring + size &&
+           (vma->flags & VMM_FLAG_WRITE);
+}
+
+/**
+ * Run one submission
+ */
+static int64_t ioring_execute(const ioring_sqe_t *sqe) {
+    if (sqe->flags != 0) {
+        return -EINVAL;
+    }
+
+    switch (sqe->opcode) {
+        case RING_OP_NOP:
+            return 0;
+        case RING_OP_READ:
+            return sys_read(sqe->fd, (void*)sqe->addr, (size_t)sqe->len);
+        case RING_OP_WRITE:
+            return sys_write(sqe->fd, (const void*)sqe->addr, (size_t)sqe->len);
+        case RING_OP_OPEN:
+            return sys_open((const char*)sqe->addr, (int)sqe->len, (int)sqe->arg);
+        case RING_OP_CLOSE:
+            return sys_close(sqe->fd);
+        case RING_OP_SLEEP:
+            return sys_sleep(sqe->len);
+        default:
+            return -EINVAL;
+    }
+}
+
+/**
+ * Consume up to max submissions (0 for all) of proc's ring
+ */
+static int64_t ioring_run(process_t *proc, uint32_t max) {
+    if (!ioring_mapped(proc)) {
+        kprintf("[IORING] PID %u unmapped its ring, dropping it\n", proc->pid);
+        proc->ioring = 0;
+        proc->ioring_entries = 0;
+        return -EFAULT;
+    }
+
+    uint32_t sq_offset, cq_offset;
+    size_t size;
+    ioring_layout(proc->ioring_entries, &sq_offset, &cq_offset, &size);
+
+    ioring_header_t *hdr = (ioring_header_t*)proc->ioring;
+    ioring_sqe_t *sq = (ioring_sqe_t*)(proc->ioring + sq_offset);
+    ioring_cqe_t *cq = (ioring_cqe_t*)(proc->ioring + cq_offset);
+    uint32_t sq_mask = proc->ioring_entries - 1;
+    uint32_t cq_entries = proc->ioring_entries * IORING_CQ_FACTOR;
+
+    uint32_t head = hdr->sq_head;
+    uint32_t pending = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE) - head;
+
+    /* A tail more than a ring ahead is garbage; take one ring's worth */
+    pending = MIN(pending, proc->ioring_entries);
+    if (max != 0) {
+        pending = MIN(pending, max);
+    }
+
+    uint32_t done = 0;
+    while (done < pending) {
+        /* Leave the rest queued until user code makes room */
+        uint32_t cq_tail = hdr->cq_tail;
+        if (cq_tail - __atomic_load_n(&hdr->cq_head, __ATOMIC_ACQUIRE) >= cq_entries) {
+            break;
+        }
+
+        ioring_sqe_t sqe = sq[(head + done) & sq_mask];
+        int64_t res = ioring_execute(&sqe);
+
+        ioring_cqe_t *cqe = &cq[cq_tail & (cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        __atomic_store_n(&hdr->cq_tail, cq_tail + 1, __ATOMIC_RELEASE);
+
+        done++;
+        __atomic_store_n(&hdr->sq_head, head + done, __ATOMIC_RELEASE);
+    }
+
+    if (done > 0) {
+        hdr->submitted += done;
+    }
+    return done;
+}
+
+int64_t ioring_setup(uint32_t entries) {
+    process_t *proc = process_get_current();
+
+    if (proc == NULL || entries == 0 || entries > IORING_MAX_ENTRIES) {
+        return -EINVAL;
+    }
+    if (proc->ioring != 0) {
+        return -EBUSY;
+    }
+
+    uint32_t n = IORING_MIN_ENTRIES;
+    while (n < entries) {
+        n <<= 1;
+    }
+
+    uint32_t sq_offset, cq_offset;
+    size_t size;
+    ioring_layout(n, &sq_offset, &cq_offset, &size);
+
+    virtaddr_t start = vma_find_free(process_vmas(proc), 0, size);
+    if (start == 0 ||
+        !vma_map_anon(process_vmas(proc), start, size, VMM_FLAG_USER | VMM_FLAG_WRITE | VMM_FLAG_NX)) {
+        return -ENOMEM;
+    }
+
+    /* The fresh mapping is zero-filled; only the sizes need writing */
+    ioring_header_t *hdr = (ioring_header_t*)start;
+    hdr->sq_entries = n;
+    hdr->cq_entries = n * IORING_CQ_FACTOR;
+    hdr->sq_offset = sq_offset;
+    hdr->cq_offset = cq_offset;
+
+    proc->ioring = start;
+    proc->ioring_entries = n;
+
+    kprintf("[IORING] PID %u: %u-entry ring at 0x%llx (%u bytes)\n",
+            proc->pid, n, (uint64_t)start, (uint32_t)size);
+    return (int64_t)start;
+}
+
+int64_t ioring_enter(uint32_t max) {
+    process_t *proc = process_get_current();
+
+    if (proc == NULL || proc->ioring == 0) {
+        return -EINVAL;
+    }
+    return ioring_run(proc, max);
+}
+
+void ioring_drain(void) {
+    process_t *proc = process_get_current();
+
+    if (proc == NULL || proc->ioring == 0) {
+        return;
+    }
+
+    ioring_run(proc, 0);
+}
+
+void ioring_fork(process_t *child, process_t *parent) {
+    child->ioring = parent->ioring;
+    child->ioring_entries = parent->ioring_entries;
+}
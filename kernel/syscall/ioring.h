@@ -0,0 +1,106 @@
+/**
+ * AAAos Kernel - Batched System Call Ring
+ *
+ * A process can set up one submission/completion ring in its own memory
+ * (SYS_RING_SETUP). It queues operations by filling submission queue
+ * entries and advancing sq_tail, and a single SYS_RING_ENTER runs all of
+ * them. Every system call return also drains whatever is queued, so a
+ * process that traps anyway gets its ring serviced for free.
+ *
+ * Results are posted to the completion queue in submission order.
+ * cq_tail is advanced after each entry is written, so user code polls it
+ * without a system call and consumes entries by advancing cq_head.
+ *
+ * Operations run synchronously during the drain: a RING_OP_SLEEP delays
+ * the entries behind it.
+ */
+
+#ifndef _AAAOS_SYSCALL_IORING_H
+#define _AAAOS_SYSCALL_IORING_H
+
+#include "../include/types.h"
+
+struct process;
+
+/* Submission queue size limits (rounded up to a power of two) */
+#define IORING_MIN_ENTRIES      8
+#define IORING_MAX_ENTRIES      256
+
+/* The completion queue is this many times the submission queue */
+#define IORING_CQ_FACTOR        2
+
+/* Operations (ioring_sqe_t.opcode) */
+#define RING_OP_NOP             0       /* res = 0 */
+#define RING_OP_READ            1       /* fd, addr = buffer, len */
+#define RING_OP_WRITE           2       /* fd, addr = buffer, len */
+#define RING_OP_OPEN            3       /* addr = path, len = flags, arg = mode */
+#define RING_OP_CLOSE           4       /* fd */
+#define RING_OP_SLEEP           5       /* len = milliseconds */
+#define RING_OP_MAX             5
+
+/**
+ * Submission queue entry (written by user code)
+ */
+typedef struct ioring_sqe {
+    uint8_t opcode;                     /* RING_OP_* */
+    uint8_t flags;                      /* Must be 0 */
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t arg;
+    uint64_t user_data;                 /* Copied to the completion */
+} ioring_sqe_t;
+
+/**
+ * Completion queue entry (written by the kernel)
+ */
+typedef struct ioring_cqe {
+    uint64_t user_data;
+    int64_t res;                        /* Operation result or negative error code */
+} ioring_cqe_t;
+
+/**
+ * Ring header at the start of the mapping
+ * User code writes sq_tail and cq_head; the kernel writes the rest. The
+ * kernel keeps its own copy of the sizes and offsets and ignores the
+ * ones here.
+ */
+typedef struct ioring_header {
+    volatile uint32_t sq_head;          /* Next entry the kernel consumes */
+    volatile uint32_t sq_tail;          /* Next entry user code fills */
+    volatile uint32_t cq_head;          /* Next completion user code reads */
+    volatile uint32_t cq_tail;          /* Next completion the kernel posts */
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_offset;                 /* Byte offset of the SQE array */
+    uint32_t cq_offset;                 /* Byte offset of the CQE array */
+    uint64_t submitted;                 /* Entries consumed so far */
+} ioring_header_t;
+
+/**
+ * Map a ring into the calling process
+ * @param entries Requested submission queue size
+ * @return User address of the ring header, or negative error code
+ */
+int64_t ioring_setup(uint32_t entries);
+
+/**
+ * Run queued submissions of the calling process
+ * @param max Most entries to consume (0 for all)
+ * @return Entries consumed, or negative error code
+ */
+int64_t ioring_enter(uint32_t max);
+
+/**
+ * Drain the calling process's ring if anything is queued
+ * Called on every system call return.
+ */
+void ioring_drain(void);
+
+/**
+ * Give a forked child its parent's ring (the memory was cloned with it)
+ */
+void ioring_fork(struct process *child, struct process *parent);
+
+#endif /* _AAAOS_SYSCALL_IORING_H */
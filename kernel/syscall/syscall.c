@@ -6,8 +6,22 @@
  */
 
 #include "syscall.h"
+#include "ioring.h"
+#include "../ipc/channel.h"
+#include "../ipc/pipe.h"
+#include "../ipc/poll.h"
+#include "vdso.h"
 #include "../include/serial.h"
 #include "../arch/x86_64/include/gdt.h"
+#include "../arch/x86_64/include/idt.h"
+#include "../arch/x86_64/include/percpu.h"
+#include "../sched/scheduler.h"
+#include "../sched/timer.h"
+#include "../sched/waitq.h"
+#include "../proc/process.h"
+#include "../proc/fdtable.h"
+#include "../mm/vmm.h"
+#include "../mm/vma.h"
 
 /* ============================================================================
  * Forward declarations for assembly entry point
@@ -20,6 +34,9 @@ extern void syscall_entry(void);
  * Syscall Handler Table
  * ============================================================================ */
 
+/* Register state of the syscall being dispatched on each CPU (needed by fork) */
+static syscall_frame_t *current_frames[PERCPU_MAX_CPUS];
+
 /* Typedef for syscall handler function pointer */
 typedef int64_t (*syscall_handler_fn)(uint64_t, uint64_t, uint64_t,
                                        uint64_t, uint64_t, uint64_t);
@@ -49,38 +66,64 @@ static int64_t syscall_mmap_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
                                     uint64_t arg4, uint64_t arg5, uint64_t arg6);
 static int64_t syscall_munmap_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
                                       uint64_t arg4, uint64_t arg5, uint64_t arg6);
-
-/* Syscall dispatch table */
-static syscall_handler_fn syscall_table[SYSCALL_MAX + 1] = {
-    [SYS_EXIT]      = syscall_exit_wrapper,
-    [SYS_READ]      = syscall_read_wrapper,
-    [SYS_WRITE]     = syscall_write_wrapper,
-    [SYS_OPEN]      = syscall_open_wrapper,
-    [SYS_CLOSE]     = syscall_close_wrapper,
-    [SYS_FORK]      = syscall_fork_wrapper,
-    [SYS_EXEC]      = syscall_exec_wrapper,
-    [SYS_WAIT]      = syscall_wait_wrapper,
-    [SYS_GETPID]    = syscall_getpid_wrapper,
-    [SYS_SLEEP]     = syscall_sleep_wrapper,
-    [SYS_MMAP]      = syscall_mmap_wrapper,
-    [SYS_MUNMAP]    = syscall_munmap_wrapper,
+static int64_t syscall_clock_gettime_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                             uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_ring_setup_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_ring_enter_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_futex_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                     uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_channel_create_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                              uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_channel_attach_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                              uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_channel_op_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_epoll_create_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                            uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_epoll_ctl_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                         uint64_t arg4, uint64_t arg5, uint64_t arg6);
+static int64_t syscall_epoll_wait_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6);
+
+/* Syscall dispatch table entry */
+typedef struct syscall_desc {
+    syscall_handler_fn fn;
+    const char *name;
+} syscall_desc_t;
+
+/* Syscall dispatch table, indexed by number */
+static const syscall_desc_t syscall_table[SYSCALL_MAX + 1] = {
+    [SYS_EXIT]          = { syscall_exit_wrapper,     "exit" },
+    [SYS_READ]          = { syscall_read_wrapper,     "read" },
+    [SYS_WRITE]         = { syscall_write_wrapper,    "write" },
+    [SYS_OPEN]          = { syscall_open_wrapper,     "open" },
+    [SYS_CLOSE]         = { syscall_close_wrapper,    "close" },
+    [SYS_FORK]          = { syscall_fork_wrapper,     "fork" },
+    [SYS_EXEC]          = { syscall_exec_wrapper,     "exec" },
+    [SYS_WAIT]          = { syscall_wait_wrapper,     "wait" },
+    [SYS_GETPID]        = { syscall_getpid_wrapper,   "getpid" },
+    [SYS_SLEEP]         = { syscall_sleep_wrapper,    "sleep" },
+    [SYS_MMAP]          = { syscall_mmap_wrapper,     "mmap" },
+    [SYS_MUNMAP]        = { syscall_munmap_wrapper,   "munmap" },
+    [SYS_CLOCK_GETTIME] = { syscall_clock_gettime_wrapper, "clock_gettime" },
+    [SYS_RING_SETUP]    = { syscall_ring_setup_wrapper, "ring_setup" },
+    [SYS_RING_ENTER]    = { syscall_ring_enter_wrapper, "ring_enter" },
+    [SYS_FUTEX]         = { syscall_futex_wrapper,    "futex" },
+    [SYS_CHANNEL_CREATE] = { syscall_channel_create_wrapper, "channel_create" },
+    [SYS_CHANNEL_ATTACH] = { syscall_channel_attach_wrapper, "channel_attach" },
+    [SYS_CHANNEL_OP]    = { syscall_channel_op_wrapper, "channel_op" },
+    [SYS_EPOLL_CREATE]  = { syscall_epoll_create_wrapper, "epoll_create" },
+    [SYS_EPOLL_CTL]     = { syscall_epoll_ctl_wrapper, "epoll_ctl" },
+    [SYS_EPOLL_WAIT]    = { syscall_epoll_wait_wrapper, "epoll_wait" },
 };
 
-/* Syscall names for debugging */
-static const char *syscall_names[SYSCALL_MAX + 1] = {
-    [SYS_EXIT]      = "exit",
-    [SYS_READ]      = "read",
-    [SYS_WRITE]     = "write",
-    [SYS_OPEN]      = "open",
-    [SYS_CLOSE]     = "close",
-    [SYS_FORK]      = "fork",
-    [SYS_EXEC]      = "exec",
-    [SYS_WAIT]      = "wait",
-    [SYS_GETPID]    = "getpid",
-    [SYS_SLEEP]     = "sleep",
-    [SYS_MMAP]      = "mmap",
-    [SYS_MUNMAP]    = "munmap",
-};
+/* Latency counters per CPU, so the hot path takes no lock */
+static syscall_stats_t syscall_cpu_stats[PERCPU_MAX_CPUS][SYSCALL_MAX + 1];
+
+/* SYSCALL stacks for CPUs that are not running a process yet */
+static uint8_t syscall_boot_stacks[PERCPU_MAX_CPUS][SYSCALL_BOOT_STACK_SIZE] ALIGNED(16);
 
 /* ============================================================================
  * Syscall Initialization
@@ -223,10 +266,31 @@ void syscall_init(void) {
     /* Clear MSR_CSTAR (compatibility mode - not used) */
     wrmsr(MSR_CSTAR, 0);
 
+    /* SYSCALL stack until the scheduler installs a process's own */
+    percpu_self()->kernel_rsp = (uint64_t)&syscall_boot_stacks[0][SYSCALL_BOOT_STACK_SIZE];
+
+    /* Clock and PID pages for user address spaces */
+    vdso_init();
+
     kprintf("[SYSCALL] System call interface initialized successfully\n");
     kprintf("[SYSCALL] Registered %d system calls (0-%d)\n", SYSCALL_MAX + 1, SYSCALL_MAX);
 }
 
+/**
+ * Program the SYSCALL MSRs on an application processor
+ * Same values as syscall_init, which has already run on the BSP.
+ */
+void syscall_init_cpu(void) {
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)0x0010 << 48) | ((uint64_t)0x0008 << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
+    wrmsr(MSR_CSTAR, 0);
+
+    uint32_t cpu = percpu_cpu_id();
+    percpu_self()->kernel_rsp = (uint64_t)&syscall_boot_stacks[cpu][SYSCALL_BOOT_STACK_SIZE];
+}
+
 /* ============================================================================
  * Main Syscall Dispatcher
  * ============================================================================ */
@@ -240,47 +304,59 @@ void syscall_init(void) {
  *   RAX = syscall number
  *   RDI = arg1, RSI = arg2, RDX = arg3, R10 = arg4, R8 = arg5, R9 = arg6
  *
+ * Define SYSCALL_DEBUG_TRACE to log every call and its result.
+ *
  * @param frame Pointer to saved register state
  * @return Return value to be placed in RAX
  */
 int64_t syscall_handler(syscall_frame_t *frame) {
     uint64_t syscall_num = frame->rax;
+    uint32_t cpu = percpu_cpu_id();
     int64_t result;
 
-    /* Extract arguments from frame */
-    uint64_t arg1 = frame->rdi;
-    uint64_t arg2 = frame->rsi;
-    uint64_t arg3 = frame->rdx;
-    uint64_t arg4 = frame->r10;
-    uint64_t arg5 = frame->r8;
-    uint64_t arg6 = frame->r9;
-
-    /* Validate syscall number */
-    if (syscall_num > SYSCALL_MAX) {
+    if (syscall_num > SYSCALL_MAX || syscall_table[syscall_num].fn == NULL) {
         kprintf("[SYSCALL] Invalid syscall number: %lu\n", syscall_num);
-        return -ENOSYS;
-    }
+        result = -ENOSYS;
+    } else {
+        const syscall_desc_t *desc = &syscall_table[syscall_num];
+
+#ifdef SYSCALL_DEBUG_TRACE
+        kprintf("[SYSCALL] syscall=%lu (%s) args=[%lx, %lx, %lx, %lx, %lx, %lx]\n",
+                syscall_num, desc->name, frame->rdi, frame->rsi, frame->rdx,
+                frame->r10, frame->r8, frame->r9);
+#endif
+
+        uint64_t start = clock_cycles();
+
+        current_frames[cpu] = frame;
+        result = desc->fn(frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9);
+
+        /* A call that slept may have come back on another CPU */
+        cpu = percpu_cpu_id();
+        current_frames[cpu] = NULL;
+
+        uint64_t cycles = clock_cycles() - start;
+        syscall_stats_t *stats = &syscall_cpu_stats[cpu][syscall_num];
+        stats->calls++;
+        stats->total_cycles += cycles;
+        if (cycles > stats->max_cycles) {
+            stats->max_cycles = cycles;
+        }
 
-    /* Get handler */
-    syscall_handler_fn handler = syscall_table[syscall_num];
-    if (handler == NULL) {
-        kprintf("[SYSCALL] Unimplemented syscall: %lu (%s)\n",
-                syscall_num,
-                syscall_num <= SYSCALL_MAX ? syscall_names[syscall_num] : "unknown");
-        return -ENOSYS;
+#ifdef SYSCALL_DEBUG_TRACE
+        kprintf("[SYSCALL] syscall=%lu returned: %ld (0x%lx)\n",
+                syscall_num, result, (uint64_t)result);
+#endif
     }
 
-    /* Debug logging (can be disabled in production) */
-    kprintf("[SYSCALL] syscall=%lu (%s) args=[%lx, %lx, %lx, %lx, %lx, %lx]\n",
-            syscall_num, syscall_names[syscall_num],
-            arg1, arg2, arg3, arg4, arg5, arg6);
+    /* Every trap also services the process's submission ring */
+    ioring_drain();
 
-    /* Dispatch to handler */
-    result = handler(arg1, arg2, arg3, arg4, arg5, arg6);
-
-    /* Log result */
-    kprintf("[SYSCALL] syscall=%lu returned: %ld (0x%lx)\n",
-            syscall_num, result, (uint64_t)result);
+    /* SYSRET to a non-canonical RIP would fault in ring 0 on the user stack */
+    if (frame->rcx >= VMA_USER_END) {
+        kprintf("[SYSCALL] Error: Return address 0x%lx is not a user address\n", frame->rcx);
+        sys_exit(-EFAULT);
+    }
 
     /* Store result in frame (will be restored to RAX) */
     frame->rax = (uint64_t)result;
@@ -288,6 +364,42 @@ int64_t syscall_handler(syscall_frame_t *frame) {
     return result;
 }
 
+/**
+ * Get the latency counters of a system call
+ */
+bool syscall_get_stats(uint64_t num, syscall_stats_t *stats) {
+    if (num > SYSCALL_MAX || !stats) {
+        return false;
+    }
+
+    *stats = (syscall_stats_t){0};
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        const syscall_stats_t *s = &syscall_cpu_stats[cpu][num];
+        stats->calls += s->calls;
+        stats->total_cycles += s->total_cycles;
+        stats->max_cycles = MAX(stats->max_cycles, s->max_cycles);
+    }
+    return true;
+}
+
+/**
+ * Print call counts and latencies
+ */
+void syscall_print_stats(void) {
+    kprintf("[SYSCALL] ========== Syscall Statistics ==========\n");
+
+    for (uint64_t num = 0; num <= SYSCALL_MAX; num++) {
+        syscall_stats_t s;
+        if (!syscall_get_stats(num, &s) || s.calls == 0) {
+            continue;
+        }
+        kprintf("[SYSCALL] %s: %llu calls, avg %llu ns, max %llu ns\n", syscall_table[num].name, s.calls,
+                clock_cycles_to_ns(s.total_cycles / s.calls), clock_cycles_to_ns(s.max_cycles));
+    }
+
+    kprintf("[SYSCALL] ========================================\n");
+}
+
 /* ============================================================================
  * Syscall Wrapper Functions
  * ============================================================================ */
@@ -365,6 +477,66 @@ static int64_t syscall_munmap_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg
     return sys_munmap((void*)arg1, (size_t)arg2);
 }
 
+static int64_t syscall_clock_gettime_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                             uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg2); UNUSED(arg3); UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_clock_gettime((int)arg1);
+}
+
+static int64_t syscall_ring_setup_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg2); UNUSED(arg3); UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_ring_setup((uint32_t)arg1);
+}
+
+static int64_t syscall_ring_enter_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg2); UNUSED(arg3); UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_ring_enter((uint32_t)arg1);
+}
+
+static int64_t syscall_futex_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                     uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_futex((uint32_t*)arg1, (int)arg2, (uint32_t)arg3);
+}
+
+static int64_t syscall_channel_create_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                              uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_channel_create((uint32_t)arg1, (uint32_t)arg2, (uint32_t)arg3);
+}
+
+static int64_t syscall_channel_attach_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                              uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg2); UNUSED(arg3); UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_channel_attach((uint32_t)arg1);
+}
+
+static int64_t syscall_channel_op_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg5); UNUSED(arg6);
+    return sys_channel_op((uint32_t)arg1, (int)arg2, arg3, arg4);
+}
+
+static int64_t syscall_epoll_create_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                            uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg1); UNUSED(arg2); UNUSED(arg3); UNUSED(arg4); UNUSED(arg5); UNUSED(arg6);
+    return sys_epoll_create();
+}
+
+static int64_t syscall_epoll_ctl_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                         uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg5); UNUSED(arg6);
+    return sys_epoll_ctl((int)arg1, (int)arg2, (int)arg3, (const void*)arg4);
+}
+
+static int64_t syscall_epoll_wait_wrapper(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                          uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg5); UNUSED(arg6);
+    return sys_epoll_wait((int)arg1, (void*)arg2, (int)arg3, (int)arg4);
+}
+
 /* ============================================================================
  * Individual System Call Implementations
  * ============================================================================ */
@@ -392,20 +564,54 @@ void sys_exit(int status) {
     __builtin_unreachable();
 }
 
+_Static_assert(FD_TABLE_MAX <= POLL_ID_BASE, "descriptors and poll set IDs must not overlap");
+
+/**
+ * Pipe end open as a descriptor of the current process
+ */
+static pipe_t* syscall_pipe_end(int fd, uint32_t end) {
+    uint32_t fd_end;
+    pipe_t *pipe = fd_lookup(fd_table_current(), fd, FD_KIND_PIPE, &fd_end);
+    return pipe && fd_end == end ? pipe : NULL;
+}
+
+/**
+ * Convert a pipe transfer result to a syscall return value
+ */
+static int64_t syscall_pipe_result(ssize_t result) {
+    switch (result) {
+        case PIPE_ERR_CLOSED:
+            return -EPIPE;
+        case PIPE_ERR_WOULDBLOCK:
+        case PIPE_ERR_FULL:
+        case PIPE_ERR_EMPTY:
+            return -EAGAIN;
+        case PIPE_ERR_NO_MEMORY:
+            return -ENOMEM;
+        default:
+            return result < 0 ? -EINVAL : (int64_t)result;
+    }
+}
+
 /**
  * SYS_READ - Read from a file descriptor
  *
- * Currently a stub - file system not implemented.
+ * Reads the read end of a pipe; files are not implemented yet.
  * TODO: Implement when VFS is ready.
  */
 int64_t sys_read(int fd, void *buf, size_t count) {
-    kprintf("[SYSCALL] sys_read: fd=%d, buf=%p, count=%lu\n", fd, buf, count);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_read: fd=%d, buf=%p, count=%lu\n", fd, buf, count);
 
     /* Validate pointer */
     if (buf == NULL) {
         return -EINVAL;
     }
 
+    pipe_t *pipe = syscall_pipe_end(fd, PIPE_END_READ);
+    if (pipe) {
+        return syscall_pipe_result(pipe_read(pipe, buf, count));
+    }
+
     /* TODO: Implement file system read */
     /* For now, return "not implemented" */
     kprintf("[SYSCALL] sys_read: File system not implemented\n");
@@ -415,11 +621,12 @@ int64_t sys_read(int fd, void *buf, size_t count) {
 /**
  * SYS_WRITE - Write to a file descriptor
  *
- * Supports fd=1 (stdout) and fd=2 (stderr) which write to serial console.
+ * Supports fd=1 (stdout) and fd=2 (stderr) which write to serial console,
+ * and the write ends of pipes.
  * TODO: Implement full VFS support.
  */
 int64_t sys_write(int fd, const void *buf, size_t count) {
-    kprintf("[SYSCALL] sys_write: fd=%d, buf=%p, count=%lu\n", fd, buf, count);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_write: fd=%d, buf=%p, count=%lu\n", fd, buf, count);
 
     /* Validate pointer */
     if (buf == NULL) {
@@ -428,15 +635,17 @@ int64_t sys_write(int fd, const void *buf, size_t count) {
 
     /* Handle stdout (1) and stderr (2) - write to serial console */
     if (fd == 1 || fd == 2) {
-        const char *str = (const char *)buf;
-        for (size_t i = 0; i < count; i++) {
-            kputc(str[i]);
-        }
+        serial_write(COM1_PORT, (const char *)buf, count);
         return (int64_t)count;
     }
 
+    pipe_t *pipe = syscall_pipe_end(fd, PIPE_END_WRITE);
+    if (pipe) {
+        return syscall_pipe_result(pipe_write(pipe, buf, count));
+    }
+
     /* Other file descriptors not implemented */
-    kprintf("[SYSCALL] sys_write: Invalid fd %d (only stdout/stderr supported)\n", fd);
+    kprintf("[SYSCALL] sys_write: Invalid fd %d (only stdout/stderr and pipes)\n", fd);
     return -EBADF;
 }
 
@@ -447,8 +656,8 @@ int64_t sys_write(int fd, const void *buf, size_t count) {
  * TODO: Implement when VFS is ready.
  */
 int64_t sys_open(const char *pathname, int flags, int mode) {
-    kprintf("[SYSCALL] sys_open: pathname=%p, flags=0x%x, mode=0x%x\n",
-            pathname, flags, mode);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_open: pathname=%p, flags=0x%x, mode=0x%x\n",
+         pathname, flags, mode);
 
     if (pathname == NULL) {
         return -EINVAL;
@@ -465,11 +674,10 @@ int64_t sys_open(const char *pathname, int flags, int mode) {
 /**
  * SYS_CLOSE - Close a file descriptor
  *
- * Currently a stub - file system not implemented.
- * TODO: Implement when VFS is ready.
+ * Closes a descriptor of the current process's table, or a poll set.
  */
 int64_t sys_close(int fd) {
-    kprintf("[SYSCALL] sys_close: fd=%d\n", fd);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_close: fd=%d\n", fd);
 
     /* Don't allow closing stdin/stdout/stderr */
     if (fd >= 0 && fd <= 2) {
@@ -477,23 +685,57 @@ int64_t sys_close(int fd) {
         return -EBADF;
     }
 
-    /* TODO: Implement file descriptor management */
-    kprintf("[SYSCALL] sys_close: File system not implemented\n");
-    return -ENOSYS;
+    if (fd >= POLL_ID_BASE) {
+        return poll_destroy((uint32_t)fd);
+    }
+
+    if (!fd_close(fd_table_current(), fd)) {
+        return -EBADF;
+    }
+    return 0;
 }
 
 /**
  * SYS_FORK - Create a child process
  *
- * Currently a stub - process management not implemented.
- * TODO: Implement when scheduler is ready.
+ * The child shares the parent's pages copy-on-write and resumes at the
+ * instruction after the SYSCALL with RAX = 0.
  */
 int64_t sys_fork(void) {
-    kprintf("[SYSCALL] sys_fork: Attempting to fork\n");
+    process_t *parent = scheduler_get_current();
+    if (parent == NULL) {
+        parent = process_get_current();
+    }
 
-    /* TODO: Implement process creation */
-    kprintf("[SYSCALL] sys_fork: Process management not implemented\n");
-    return -ENOSYS;
+    syscall_frame_t *frame = current_frames[percpu_cpu_id()];
+    if (parent == NULL || frame == NULL) {
+        kprintf("[SYSCALL] sys_fork: No current process\n");
+        return -ENOSYS;
+    }
+
+    /* User state at the SYSCALL: RCX holds RIP, R11 holds RFLAGS */
+    cpu_context_t user_state = {
+        .r15 = frame->r15, .r14 = frame->r14, .r13 = frame->r13, .r12 = frame->r12,
+        .r11 = frame->r11, .r10 = frame->r10, .r9 = frame->r9, .r8 = frame->r8,
+        .rbp = frame->rbp, .rdi = frame->rdi, .rsi = frame->rsi, .rdx = frame->rdx,
+        .rcx = frame->rcx, .rbx = frame->rbx, .rax = 0,
+        .rip = frame->rcx,
+        .cs = GDT_USER_CODE | 3,
+        .rflags = frame->r11,
+        .rsp = frame->user_rsp,
+        .ss = GDT_USER_DATA | 3,
+    };
+
+    process_t *child = process_fork(parent, &user_state);
+    if (child == NULL) {
+        return -ENOMEM;
+    }
+
+    if (!scheduler_add(child)) {
+        kprintf("[SYSCALL] sys_fork: Failed to schedule PID %u\n", child->pid);
+    }
+
+    return child->pid;
 }
 
 /**
@@ -503,8 +745,8 @@ int64_t sys_fork(void) {
  * TODO: Implement when ELF loader is ready.
  */
 int64_t sys_exec(const char *pathname, char *const argv[], char *const envp[]) {
-    kprintf("[SYSCALL] sys_exec: pathname=%p, argv=%p, envp=%p\n",
-            pathname, (void*)argv, (void*)envp);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_exec: pathname=%p, argv=%p, envp=%p\n",
+         pathname, (void*)argv, (void*)envp);
 
     if (pathname == NULL) {
         return -EINVAL;
@@ -524,8 +766,8 @@ int64_t sys_exec(const char *pathname, char *const argv[], char *const envp[]) {
  * TODO: Implement when scheduler is ready.
  */
 int64_t sys_wait(int pid, int *status, int options) {
-    kprintf("[SYSCALL] sys_wait: pid=%d, status=%p, options=0x%x\n",
-            pid, status, options);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_wait: pid=%d, status=%p, options=0x%x\n",
+         pid, status, options);
 
     /* TODO: Implement process waiting */
     kprintf("[SYSCALL] sys_wait: Process management not implemented\n");
@@ -535,73 +777,242 @@ int64_t sys_wait(int pid, int *status, int options) {
 /**
  * SYS_GETPID - Get current process ID
  *
- * Returns a placeholder PID since process management is not implemented.
- * TODO: Return actual PID when scheduler is ready.
+ * User code can read the same value from the vDSO process page.
  */
 int64_t sys_getpid(void) {
-    kprintf("[SYSCALL] sys_getpid: Returning placeholder PID\n");
-
-    /* TODO: Return actual process ID */
-    /* For now, return 1 (init process) */
-    return 1;
+    process_t *proc = process_get_current();
+    return proc ? (int64_t)proc->tgid : -ENOSYS;
 }
 
 /**
  * SYS_SLEEP - Sleep for specified milliseconds
  *
- * Currently a stub - timer subsystem integration needed.
- * TODO: Implement proper sleep with timer.
+ * Blocks the caller on a one-shot kernel timer.
  */
 int64_t sys_sleep(uint64_t milliseconds) {
-    kprintf("[SYSCALL] sys_sleep: Sleeping for %lu ms\n", milliseconds);
-
-    /* TODO: Implement proper sleep using timer */
-    /* For now, do a busy-wait approximation (very inaccurate) */
-    /* This is just a placeholder - real implementation needs timer support */
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_sleep: Sleeping for %lu ms\n", milliseconds);
 
-    volatile uint64_t count = milliseconds * 100000;
-    while (count > 0) {
-        count--;
-        __asm__ __volatile__("pause");
-    }
+    /* Cap so that the deadline cannot overflow the clock */
+    timer_sleep_ns(MIN(milliseconds, UINT64_MAX / NSEC_PER_MSEC / 2) * NSEC_PER_MSEC);
 
-    kprintf("[SYSCALL] sys_sleep: Sleep completed\n");
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_sleep: Sleep completed\n");
     return 0;
 }
 
 /**
  * SYS_MMAP - Map memory into address space
  *
- * Currently a stub - virtual memory management not implemented.
- * TODO: Implement when VMM is ready.
+ * Adds a VMA to the current process; pages are filled on first touch.
+ * Only private anonymous mappings are available until processes have
+ * file descriptor tables (kernel code maps files with vfs_mmap).
  */
 int64_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, size_t offset) {
-    kprintf("[SYSCALL] sys_mmap: addr=%p, length=%lu, prot=0x%x, flags=0x%x, fd=%d, offset=%lu\n",
-            addr, length, prot, flags, fd, offset);
+    klog(SERIAL_LOG_DEBUG,
+         "[SYSCALL] sys_mmap: addr=%p, length=%lu, prot=0x%x, flags=0x%x, fd=%d, offset=%lu\n",
+         addr, length, prot, flags, fd, offset);
+
+    process_t *proc = process_get_current();
+    virtaddr_t start = (virtaddr_t)addr;
 
-    if (length == 0) {
+    if (length == 0 || length > VMA_USER_END || (flags & MAP_SHARED) || proc == NULL) {
         return -EINVAL;
     }
+    if (!(flags & MAP_ANONYMOUS)) {
+        return -EBADF;
+    }
+
+    length = ALIGN_UP(length, PAGE_SIZE);
+
+    uint64_t vmm_flags = VMM_FLAG_USER;
+    if (prot & PROT_WRITE) {
+        vmm_flags |= VMM_FLAG_WRITE;
+    }
+    if (!(prot & PROT_EXEC)) {
+        vmm_flags |= VMM_FLAG_NX;
+    }
+
+    if (flags & MAP_FIXED) {
+        if (!IS_ALIGNED(start, PAGE_SIZE) || start + length > VMA_USER_END || start + length < start) {
+            return -EINVAL;
+        }
+        /* A fixed mapping replaces whatever was there */
+        if (!vma_unmap(process_vmas(proc), vmm_get_current_address_space(), start, length)) {
+            return -ENOMEM;
+        }
+    } else {
+        start = vma_find_free(process_vmas(proc), start, length);
+        if (start == 0) {
+            return -ENOMEM;
+        }
+    }
+
+    if (!vma_map_anon(process_vmas(proc), start, length, vmm_flags)) {
+        return -ENOMEM;
+    }
 
-    /* TODO: Implement memory mapping */
-    kprintf("[SYSCALL] sys_mmap: Virtual memory management not implemented\n");
-    return -ENOMEM;
+    return (int64_t)start;
 }
 
 /**
  * SYS_MUNMAP - Unmap memory from address space
- *
- * Currently a stub - virtual memory management not implemented.
- * TODO: Implement when VMM is ready.
  */
 int64_t sys_munmap(void *addr, size_t length) {
-    kprintf("[SYSCALL] sys_munmap: addr=%p, length=%lu\n", addr, length);
+    klog(SERIAL_LOG_DEBUG, "[SYSCALL] sys_munmap: addr=%p, length=%lu\n", addr, length);
+
+    process_t *proc = process_get_current();
+    virtaddr_t start = (virtaddr_t)addr;
 
-    if (addr == NULL || length == 0) {
+    if (addr == NULL || length == 0 || !IS_ALIGNED(start, PAGE_SIZE) ||
+        length > VMA_USER_END || start + length > VMA_USER_END || proc == NULL) {
         return -EINVAL;
     }
 
-    /* TODO: Implement memory unmapping */
-    kprintf("[SYSCALL] sys_munmap: Virtual memory management not implemented\n");
-    return -ENOSYS;
+    if (!vma_unmap(process_vmas(proc), vmm_get_current_address_space(), start, length)) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * SYS_CLOCK_GETTIME - Read a clock
+ */
+int64_t sys_clock_gettime(int clock) {
+    switch (clock) {
+        case VDSO_CLOCK_REALTIME:
+            return (int64_t)clock_realtime_ns();
+        case VDSO_CLOCK_MONOTONIC:
+            return (int64_t)clock_monotonic_ns();
+        default:
+            return -EINVAL;
+    }
+}
+
+/**
+ * SYS_RING_SETUP - Map a batched syscall ring
+ */
+int64_t sys_ring_setup(uint32_t entries) {
+    return ioring_setup(entries);
+}
+
+/**
+ * SYS_RING_ENTER - Run queued ring submissions
+ */
+int64_t sys_ring_enter(uint32_t max) {
+    return ioring_enter(max);
+}
+
+/**
+ * SYS_FUTEX - Sleep on or wake a user word
+ */
+int64_t sys_futex(uint32_t *uaddr, int op, uint32_t val) {
+    process_t *proc = process_get_current();
+    virtaddr_t addr = (virtaddr_t)uaddr;
+
+    if (proc == NULL) {
+        return -ENOSYS;
+    }
+    if (!IS_ALIGNED(addr, sizeof(uint32_t)) || addr >= VMA_USER_END) {
+        return -EINVAL;
+    }
+
+    vma_t *vma = vma_find(process_vmas(proc), addr);
+    if (vma == NULL || vma->start > addr) {
+        return -EFAULT;
+    }
+
+    /* Key on the thread group: its threads share the address space */
+    const void *space = proc->group_leader;
+
+    switch (op) {
+        case FUTEX_WAIT:
+            /* Fault the word in now rather than under the bucket lock */
+            if (*(volatile uint32_t*)uaddr != val) {
+                return -EAGAIN;
+            }
+            return waitq_wait_in(space, uaddr, val) == WAITQ_WOKEN ? 0 : -EAGAIN;
+        case FUTEX_WAKE:
+            return waitq_wake_in(space, uaddr, val);
+        default:
+            return -EINVAL;
+    }
+}
+
+/**
+ * SYS_CHANNEL_CREATE - Create a shared-memory channel
+ */
+int64_t sys_channel_create(uint32_t peer_pid, uint32_t entries, uint32_t data_pages) {
+    return channel_create(peer_pid, entries, data_pages);
+}
+
+/**
+ * SYS_CHANNEL_ATTACH - Map the peer end of a channel
+ */
+int64_t sys_channel_attach(uint32_t id) {
+    return channel_attach(id);
+}
+
+/**
+ * SYS_CHANNEL_OP - Operate on a channel
+ */
+int64_t sys_channel_op(uint32_t id, int op, uint64_t arg1, uint64_t arg2) {
+    return channel_op(id, op, arg1, arg2);
+}
+
+/**
+ * Check that a user buffer lies below the kernel and is mapped
+ */
+static bool syscall_user_range(const void *buf, size_t size) {
+    process_t *proc = process_get_current();
+    virtaddr_t addr = (virtaddr_t)buf;
+
+    if (proc == NULL || buf == NULL || size > VMA_USER_END || addr > VMA_USER_END - size) {
+        return false;
+    }
+    vma_t *vma = vma_find(process_vmas(proc), addr);
+    return vma != NULL && vma->start <= addr && addr + size <= vma->end;
+}
+
+/**
+ * SYS_EPOLL_CREATE - Create a poll set
+ */
+int64_t sys_epoll_create(void) {
+    return poll_create();
+}
+
+/**
+ * SYS_EPOLL_CTL - Change the watches of a poll set
+ */
+int64_t sys_epoll_ctl(int epfd, int op, int fd, const void *event) {
+    poll_event_t ev = { 0, 0 };
+
+    if (op != POLL_CTL_DEL) {
+        if (!syscall_user_range(event, sizeof(ev))) {
+            return -EFAULT;
+        }
+        ev = *(const poll_event_t*)event;
+    }
+    return poll_ctl((uint32_t)epfd, op, fd, ev.events, ev.data);
+}
+
+/**
+ * SYS_EPOLL_WAIT - Wait for ready descriptors
+ * Events are gathered into a kernel buffer and copied out after the set
+ * is unlocked, so a fault on the user array happens with no lock held.
+ */
+int64_t sys_epoll_wait(int epfd, void *events, int maxevents, int timeout_ms) {
+    poll_event_t buf[POLL_WAIT_MAX_EVENTS];
+
+    if (maxevents <= 0) {
+        return -EINVAL;
+    }
+    uint32_t max = MIN((uint32_t)maxevents, (uint32_t)POLL_WAIT_MAX_EVENTS);
+    if (!syscall_user_range(events, max * sizeof(poll_event_t))) {
+        return -EFAULT;
+    }
+
+    int64_t n = poll_wait((uint32_t)epfd, buf, max, timeout_ms);
+    for (int64_t i = 0; i < n; i++) {
+        ((poll_event_t*)events)[i] = buf[i];
+    }
+    return n;
 }
@@ -8,12 +8,16 @@
  *   RAX = syscall number
  *   RDI = arg1, RSI = arg2, RDX = arg3, R10 = arg4, R8 = arg5, R9 = arg6
  *   Return value in RAX
+ *
+ * getpid and clock reads are also available without a system call from
+ * the read-only pages described in vdso.h.
  */
 
 #ifndef _AAAOS_SYSCALL_H
 #define _AAAOS_SYSCALL_H
 
 #include "../include/types.h"
+#include "../arch/x86_64/apic.h"        /* rdmsr/wrmsr */
 
 /* ============================================================================
  * System Call Numbers
@@ -31,8 +35,25 @@
 #define SYS_SLEEP       9       /* Sleep for milliseconds */
 #define SYS_MMAP        10      /* Map memory */
 #define SYS_MUNMAP      11      /* Unmap memory */
-
-#define SYSCALL_MAX     11      /* Maximum syscall number */
+#define SYS_CLOCK_GETTIME 12    /* Read a clock (VDSO_CLOCK_*) */
+#define SYS_RING_SETUP  13      /* Map a batched syscall ring (ioring.h) */
+#define SYS_RING_ENTER  14      /* Run queued ring submissions */
+#define SYS_FUTEX       15      /* Sleep on / wake a user word */
+#define SYS_CHANNEL_CREATE 16   /* Create a shared-memory channel (channel.h) */
+#define SYS_CHANNEL_ATTACH 17   /* Map the peer end of a channel */
+#define SYS_CHANNEL_OP  18      /* Wait, notify, grant, take or close on a channel */
+#define SYS_EPOLL_CREATE 19     /* Create a poll set (poll.h) */
+#define SYS_EPOLL_CTL   20      /* Add, change or remove a watched descriptor */
+#define SYS_EPOLL_WAIT  21      /* Wait for ready descriptors */
+
+#define SYSCALL_MAX     21      /* Maximum syscall number */
+
+/* SYS_FUTEX operations */
+#define FUTEX_WAIT      0       /* Sleep while *uaddr == val */
+#define FUTEX_WAKE      1       /* Wake up to val sleepers on uaddr */
+
+/* Stack SYSCALL uses on a CPU before the scheduler runs a process there */
+#define SYSCALL_BOOT_STACK_SIZE 8192
 
 /* ============================================================================
  * MSR Definitions for SYSCALL/SYSRET
@@ -69,6 +90,25 @@
 #define EPERM           1       /* Operation not permitted */
 #define ENOENT          2       /* No such file or directory */
 #define EIO             5       /* I/O error */
+#define EFAULT          14      /* Bad address */
+#define EBUSY           16      /* Resource busy */
+#define EEXIST          17      /* Already exists */
+#define EAGAIN          11      /* Try again */
+#define EPIPE           32      /* Other end closed */
+
+/* ============================================================================
+ * Memory Mapping Flags
+ * ============================================================================ */
+
+#define PROT_NONE       0x0     /* Pages may not be accessed */
+#define PROT_READ       0x1     /* Pages may be read */
+#define PROT_WRITE      0x2     /* Pages may be written */
+#define PROT_EXEC       0x4     /* Pages may be executed */
+
+#define MAP_SHARED      0x01    /* Share changes (not supported) */
+#define MAP_PRIVATE     0x02    /* Changes are private */
+#define MAP_FIXED       0x10    /* Place the mapping exactly at addr */
+#define MAP_ANONYMOUS   0x20    /* Zero-filled memory, no file */
 
 /* ============================================================================
  * Syscall Register Frame
@@ -102,6 +142,15 @@ typedef struct PACKED {
     uint64_t user_rsp;
 } syscall_frame_t;
 
+/**
+ * Latency counters of one system call (all CPUs)
+ */
+typedef struct syscall_stats {
+    uint64_t calls;
+    uint64_t total_cycles;          /* Handler time, for the average */
+    uint64_t max_cycles;
+} syscall_stats_t;
+
 /* ============================================================================
  * Function Prototypes
  * ============================================================================ */
@@ -112,6 +161,12 @@ typedef struct PACKED {
  */
 void syscall_init(void);
 
+/**
+ * Set up the SYSCALL MSRs on an application processor
+ * MSRs are per CPU, so every AP repeats what syscall_init did on the BSP.
+ */
+void syscall_init_cpu(void);
+
 /**
  * Main syscall dispatcher (called from assembly)
  * @param frame Pointer to saved register state
@@ -119,6 +174,19 @@ void syscall_init(void);
  */
 int64_t syscall_handler(syscall_frame_t *frame);
 
+/**
+ * Get the latency counters of a system call
+ * @param num Syscall number
+ * @param stats Receives the counters summed over all CPUs
+ * @return false if num is out of range
+ */
+bool syscall_get_stats(uint64_t num, syscall_stats_t *stats);
+
+/**
+ * Print call counts and latencies of every system call that has run
+ */
+void syscall_print_stats(void);
+
 /* ============================================================================
  * Individual System Call Handlers
  * ============================================================================ */
@@ -220,38 +288,89 @@ int64_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, size_t
  */
 int64_t sys_munmap(void *addr, size_t length);
 
-/* ============================================================================
- * Helper Functions
- * ============================================================================ */
+/**
+ * SYS_CLOCK_GETTIME - Read a clock
+ * User code can read the same clocks from the vDSO data page instead.
+ * @param clock VDSO_CLOCK_REALTIME or VDSO_CLOCK_MONOTONIC
+ * @return Nanoseconds (since the epoch for realtime), or negative error code
+ */
+int64_t sys_clock_gettime(int clock);
+
+/**
+ * SYS_RING_SETUP - Map a batched syscall ring into the process
+ * @param entries Submission queue size (rounded up to a power of two)
+ * @return User address of the ring header, or negative error code
+ */
+int64_t sys_ring_setup(uint32_t entries);
+
+/**
+ * SYS_RING_ENTER - Run queued ring submissions
+ * @param max Most submissions to run (0 for all queued)
+ * @return Submissions consumed, or negative error code
+ */
+int64_t sys_ring_enter(uint32_t max);
+
+/**
+ * SYS_FUTEX - Sleep on or wake a 32-bit word in user memory
+ * User locks take and release uncontended in user space with atomic
+ * instructions and only call this to sleep or to wake sleepers. Threads
+ * of a process share keys; other processes' words never match.
+ * @param uaddr 4-byte aligned word in a mapping of the process
+ * @param op FUTEX_WAIT or FUTEX_WAKE
+ * @param val Expected value (WAIT) or most sleepers to wake (WAKE)
+ * @return WAIT: 0 once woken, -EAGAIN if *uaddr != val;
+ *         WAKE: sleepers woken; or negative error code
+ */
+int64_t sys_futex(uint32_t *uaddr, int op, uint32_t val);
+
+/**
+ * SYS_CHANNEL_CREATE - Create a shared-memory channel to another process
+ * @param peer_pid Process allowed to attach the other end
+ * @param entries Descriptors per ring (rounded up to a power of two)
+ * @param data_pages Data area pages per direction
+ * @return User address of the channel header, or negative error code
+ */
+int64_t sys_channel_create(uint32_t peer_pid, uint32_t entries, uint32_t data_pages);
+
+/**
+ * SYS_CHANNEL_ATTACH - Map the peer end of a channel
+ * @param id Channel ID from the creator
+ * @return User address of the channel header, or negative error code
+ */
+int64_t sys_channel_attach(uint32_t id);
+
+/**
+ * SYS_CHANNEL_OP - Operate on a channel the process is an end of
+ * @param id Channel ID
+ * @param op CHANNEL_OP_*
+ * @return Operation result, or negative error code
+ */
+int64_t sys_channel_op(uint32_t id, int op, uint64_t arg1, uint64_t arg2);
+
+/**
+ * SYS_EPOLL_CREATE - Create a poll set, closed with SYS_CLOSE
+ * @return Poll set descriptor, or negative error code
+ */
+int64_t sys_epoll_create(void);
 
 /**
- * Read from Model-Specific Register
- * @param msr MSR number
- * @return Value of the MSR
+ * SYS_EPOLL_CTL - Add, change or remove the watch on a descriptor
+ * @param epfd Poll set descriptor
+ * @param op POLL_CTL_*
+ * @param fd Pipe fd or POLL_FD_MSG_QUEUE
+ * @param event Events of interest and user data (unused for POLL_CTL_DEL)
+ * @return 0, or negative error code
  */
-static inline uint64_t rdmsr(uint32_t msr) {
-    uint32_t low, high;
-    __asm__ __volatile__(
-        "rdmsr"
-        : "=a"(low), "=d"(high)
-        : "c"(msr)
-    );
-    return ((uint64_t)high << 32) | low;
-}
+int64_t sys_epoll_ctl(int epfd, int op, int fd, const void *event);
 
 /**
- * Write to Model-Specific Register
- * @param msr MSR number
- * @param value Value to write
+ * SYS_EPOLL_WAIT - Wait for ready descriptors (edge-triggered)
+ * @param epfd Poll set descriptor
+ * @param events Array of poll_event_t to fill
+ * @param maxevents Array length
+ * @param timeout_ms 0 to poll, negative to wait forever
+ * @return Number of events (0 on timeout), or negative error code
  */
-static inline void wrmsr(uint32_t msr, uint64_t value) {
-    uint32_t low = value & 0xFFFFFFFF;
-    uint32_t high = value >> 32;
-    __asm__ __volatile__(
-        "wrmsr"
-        : /* no outputs */
-        : "c"(msr), "a"(low), "d"(high)
-    );
-}
+int64_t sys_epoll_wait(int epfd, void *events, int maxevents, int timeout_ms);
 
 #endif /* _AAAOS_SYSCALL_H */
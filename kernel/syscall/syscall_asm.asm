@@ -26,13 +26,9 @@
 %define USER_CS     0x18
 %define USER_DS     0x20
 
-section .data
-
-; Kernel stack for syscall handling (temporary until per-process stacks)
-align 16
-syscall_stack_bottom:
-    times 8192 db 0         ; 8KB stack
-syscall_stack_top:
+; Per-CPU block offsets (must match percpu.h)
+%define PERCPU_KERNEL_RSP   16
+%define PERCPU_USER_RSP     24
 
 section .text
 
@@ -49,39 +45,28 @@ extern syscall_handler
 ;   RAX = syscall number
 ;   RDI, RSI, RDX, R10, R8, R9 = syscall arguments
 ;   RSP = user stack (still!)
+;   GS base = user value (the per-CPU block is in KERNEL_GS_BASE)
 ;
-; IMPORTANT: We are now in ring 0 but still using the user stack!
-; We must switch to a kernel stack before doing anything else.
+; Interrupts stay masked (MSR_SFMASK clears IF) until SYSRET.
 ; ============================================================================
 
 global syscall_entry
 syscall_entry:
     ; =========================================================================
-    ; CRITICAL: Switch to kernel stack
-    ; =========================================================================
-    ; The SYSCALL instruction does NOT switch stacks automatically.
-    ; We must save the user RSP and switch to a kernel stack immediately.
-    ;
-    ; For now, we use a static kernel stack. A proper implementation would
-    ; get the kernel stack from the TSS or per-CPU data structure.
+    ; Switch to the kernel stack of this CPU
     ; =========================================================================
-
-    ; Save user RSP in a scratch register temporarily
-    ; We'll use the swap technique with GS base in a full implementation
-    ; For now, use a simple approach with a global variable
-
-    ; Swap to kernel stack
-    ; Save user RSP, load kernel RSP
-    mov [rel user_rsp_save], rsp
-    mov rsp, [rel kernel_rsp]
+    ; swapgs makes GS point at the per-CPU block. kernel_rsp is the top of
+    ; the running process's kernel stack (set by the scheduler on every
+    ; switch), so a syscall that blocks keeps its frame while other
+    ; processes use the CPU.
+    swapgs
+    mov [gs:PERCPU_USER_RSP], rsp
+    mov rsp, [gs:PERCPU_KERNEL_RSP]
 
     ; =========================================================================
-    ; Save user context on kernel stack
+    ; Build a syscall_frame_t on the kernel stack
     ; =========================================================================
-    ; Build a syscall_frame_t structure on the stack
-
-    ; Push user RSP (was saved above)
-    push qword [rel user_rsp_save]
+    push qword [gs:PERCPU_USER_RSP]
 
     ; Save argument registers
     push rdi            ; arg1
@@ -105,18 +90,11 @@ syscall_entry:
     ; =========================================================================
     ; Call C handler
     ; =========================================================================
-    ; Pass pointer to the frame as first argument (RDI)
+    ; Pass pointer to the frame as first argument (RDI). The stack is
+    ; 16-byte aligned: kernel_rsp is, and the frame is 16 * 8 bytes.
     mov rdi, rsp
-
-    ; Ensure stack is 16-byte aligned for C calling convention
-    ; The stack should already be aligned after our pushes
-    ; (16 registers * 8 bytes = 128 bytes, which is 16-byte aligned)
-
-    ; Call the C syscall dispatcher
     call syscall_handler
 
-    ; Return value is in RAX, will be stored in frame by handler
-
     ; =========================================================================
     ; Restore context and return to user space
     ; =========================================================================
@@ -135,7 +113,7 @@ syscall_entry:
     pop r9
     pop r8
     pop rax             ; Return value (set by handler)
-    pop rcx             ; User RIP for SYSRET
+    pop rcx             ; User RIP for SYSRET (checked canonical by the handler)
     pop rdx
     pop rsi
     pop rdi
@@ -146,43 +124,17 @@ syscall_entry:
     ; =========================================================================
     ; Return to user space via SYSRET
     ; =========================================================================
-    ; SYSRET expects:
-    ; - RCX = RIP to return to
-    ; - R11 = RFLAGS to restore
-    ; - RAX = return value (already set)
-    ;
     ; SYSRET will:
     ; - RIP <- RCX
     ; - RFLAGS <- R11 (with RF and VM cleared, some bits fixed)
     ; - CS <- from MSR_STAR[63:48] + 16, with RPL=3
     ; - SS <- from MSR_STAR[63:48] + 8, with RPL=3
     ;
-    ; IMPORTANT: SYSRET has a security issue where if RCX contains a
-    ; non-canonical address, it will #GP in ring 3 with a ring 0 stack!
-    ; A production kernel should validate RCX before SYSRET.
+    ; A non-canonical RCX would make SYSRET fault in ring 0 on the user
+    ; stack; syscall_handler never returns with one.
     ; =========================================================================
-
-    ; Use sysretq for 64-bit return
-    ; o64 prefix ensures 64-bit operand size
-    db 0x48             ; REX.W prefix for 64-bit SYSRET
-    sysret
-
-
-; ============================================================================
-; Data section for stack management
-; ============================================================================
-
-section .data
-
-; Temporary storage for user RSP during stack switch
-align 8
-user_rsp_save:
-    dq 0
-
-; Kernel stack pointer for syscall handling
-align 8
-kernel_rsp:
-    dq syscall_stack_top
+    swapgs
+    o64 sysret
 
 
 ; ============================================================================
@@ -250,20 +202,3 @@ syscall_int_entry:
 
     ; Return from interrupt
     iretq
-
-
-; ============================================================================
-; Helper: Get/Set kernel stack for current CPU/process
-; ============================================================================
-; These would be used by the scheduler to set up per-process kernel stacks
-
-global syscall_set_kernel_stack
-syscall_set_kernel_stack:
-    ; RDI = new kernel stack pointer
-    mov [rel kernel_rsp], rdi
-    ret
-
-global syscall_get_kernel_stack
-syscall_get_kernel_stack:
-    mov rax, [rel kernel_rsp]
-    ret
@@ -0,0 +1,136 @@
+/**
+ * AAAos Kernel - User-Mapped Kernel Data Implementation
+ *
+ * The range is reserved with a read-only anonymous VMA so mmap does not
+ * hand it out, and both pages are mapped up front. Every mapping of the
+ * shared frame holds a PMM reference, so unmapping it or tearing down
+ * the address space drops it like any other shared page.
+ */
+
+#include "vdso.h"
+#include "../include/serial.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../sched/clock.h"
+
+/* Page flags of both pages and of the reserving VMA */
+#define VDSO_PAGE_FLAGS     (VMM_FLAG_USER | VMM_FLAG_NX)
+
+/* Shared page (identity mapped in the kernel), 0 before vdso_init */
+static physaddr_t vdso_data_frame = 0;
+
+/* Serializes writers of the shared page */
+static volatile int vdso_lock = 0;
+
+static inline void vdso_acquire_lock(void) {
+    while (__sync_lock_test_and_set(&vdso_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void vdso_release_lock(void) {
+    __sync_lock_release(&vdso_lock);
+}
+
+/**
+ * Zero a frame through the identity map
+ */
+static void vdso_clear_frame(physaddr_t frame) {
+    uint8_t *p = (uint8_t*)frame;
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        p[i] = 0;
+    }
+}
+
+bool vdso_init(void) {
+    if (vdso_data_frame != 0) {
+        return true;
+    }
+
+    physaddr_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        kprintf("[VDSO] Error: No frame for the shared data page\n");
+        return false;
+    }
+    vdso_clear_frame(frame);
+
+    __atomic_store_n(&vdso_data_frame, frame, __ATOMIC_RELEASE);
+    vdso_update_clock();
+
+    kprintf("[VDSO] Data page at 0x%llx, process page at 0x%llx\n",
+            (uint64_t)VDSO_DATA_ADDR, (uint64_t)VDSO_PROC_ADDR);
+    return true;
+}
+
+void vdso_update_clock(void) {
+    physaddr_t frame = __atomic_load_n(&vdso_data_frame, __ATOMIC_ACQUIRE);
+    if (frame == 0) {
+        return;
+    }
+
+    vdso_data_t *vd = (vdso_data_t*)frame;
+    uint64_t tsc_base, mult;
+    clock_get_scale(&tsc_base, &mult);
+
+    vdso_acquire_lock();
+
+    /* Odd sequence: readers retry until the update is complete */
+    __atomic_store_n(&vd->seq, vd->seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    vd->clock_shift = CLOCK_SHIFT;
+    vd->tsc_base = tsc_base;
+    vd->tsc_mult = mult;
+    vd->wall_offset_ns = clock_realtime_offset_ns();
+
+    __atomic_store_n(&vd->seq, vd->seq + 1, __ATOMIC_RELEASE);
+
+    vdso_release_lock();
+}
+
+/**
+ * Check for the reservation vdso_map makes (or a clone of it)
+ */
+static bool vdso_is_reservation(const vma_t *vma) {
+    return vma->start == VDSO_BASE && vma->end == VDSO_BASE + VDSO_SIZE &&
+           vma->type == VMA_ANON && vma->flags == VDSO_PAGE_FLAGS;
+}
+
+bool vdso_map(physaddr_t pml4, vma_tree_t *vmas, uint32_t pid) {
+    if (vdso_data_frame == 0) {
+        return true;
+    }
+
+    vma_t *data_vma = vma_find(vmas, VDSO_DATA_ADDR);
+    vma_t *proc_vma = vma_find(vmas, VDSO_PROC_ADDR);
+
+    if (data_vma == NULL && proc_vma == NULL) {
+        if (!vma_map_anon(vmas, VDSO_BASE, VDSO_SIZE, VDSO_PAGE_FLAGS)) {
+            return false;
+        }
+    } else if (data_vma == NULL || data_vma != proc_vma || !vdso_is_reservation(data_vma)) {
+        /* The process mapped something of its own here */
+        return true;
+    }
+
+    physaddr_t proc_frame = pmm_alloc_page();
+    if (proc_frame == 0 || !pmm_page_ref(vdso_data_frame)) {
+        if (proc_frame != 0) {
+            pmm_free_page(proc_frame);
+        }
+        return false;
+    }
+    vdso_clear_frame(proc_frame);
+    ((vdso_proc_t*)proc_frame)->pid = pid;
+
+    /* Drop whatever a fork copied from the parent */
+    vmm_unmap_user_range(pml4, VDSO_BASE, VDSO_SIZE / PAGE_SIZE);
+
+    /* Each call consumes the frame reference it is given */
+    bool ok = vmm_map_user_page(pml4, VDSO_DATA_ADDR, vdso_data_frame, VDSO_PAGE_FLAGS);
+    if (!ok) {
+        pmm_free_page(proc_frame);
+        return false;
+    }
+    return vmm_map_user_page(pml4, VDSO_PROC_ADDR, proc_frame, VDSO_PAGE_FLAGS);
+}
@@ -0,0 +1,113 @@
+/**
+ * AAAos Kernel - User-Mapped Kernel Data (vDSO-style pages)
+ *
+ * Two read-only pages sit at a fixed address in every user address space:
+ *
+ * - VDSO_DATA_ADDR: one frame shared by all processes with the clock
+ *   scale and wall-clock offset, so user code can read the time from the
+ *   TSC without a system call
+ * - VDSO_PROC_ADDR: a frame of the process's own, with its PID
+ *
+ * The kernel rewrites the shared page under a sequence counter; readers
+ * retry while it is odd or changes under them. The inline readers at the
+ * end of this file are what user code calls.
+ */
+
+#ifndef _AAAOS_SYSCALL_VDSO_H
+#define _AAAOS_SYSCALL_VDSO_H
+
+#include "../include/types.h"
+#include "../mm/vma.h"
+
+/* Fixed user addresses (just below the top of the lower half) */
+#define VDSO_BASE               (VMA_USER_END - 16 * PAGE_SIZE)
+#define VDSO_DATA_ADDR          VDSO_BASE
+#define VDSO_PROC_ADDR          (VDSO_BASE + PAGE_SIZE)
+#define VDSO_SIZE               (2 * PAGE_SIZE)
+
+/* Clocks */
+#define VDSO_CLOCK_REALTIME     0
+#define VDSO_CLOCK_MONOTONIC    1
+
+/**
+ * Shared page contents
+ */
+typedef struct vdso_data {
+    volatile uint32_t seq;              /* Odd while the kernel updates the page */
+    uint32_t clock_shift;               /* ns = ((tsc - tsc_base) * tsc_mult) >> clock_shift */
+    uint64_t tsc_base;
+    uint64_t tsc_mult;                  /* 0 until the clock is calibrated */
+    uint64_t wall_offset_ns;            /* Realtime = monotonic + wall_offset_ns */
+} vdso_data_t;
+
+/**
+ * Per-process page contents
+ */
+typedef struct vdso_proc {
+    uint32_t pid;
+} vdso_proc_t;
+
+/**
+ * Allocate the shared page and fill in the clock
+ * @return false if no frame was available
+ */
+bool vdso_init(void);
+
+/**
+ * Copy the current clock parameters into the shared page
+ * Called by the clock when they change; does nothing before vdso_init.
+ */
+void vdso_update_clock(void);
+
+/**
+ * Map both pages into a user address space
+ * Reserves [VDSO_BASE, VDSO_BASE + VDSO_SIZE) in vmas unless a cloned
+ * reservation is already there, and replaces any pages already mapped
+ * there (a forked child inherits its parent's). Skipped if the process
+ * has put a mapping of its own over the range.
+ * @param pml4 Address space
+ * @param vmas Its VMA tree
+ * @param pid PID to publish
+ * @return false if out of memory
+ */
+bool vdso_map(physaddr_t pml4, vma_tree_t *vmas, uint32_t pid);
+
+/* ============================================================================
+ * User-Side Readers
+ * ============================================================================ */
+
+/**
+ * PID of the calling process
+ */
+static inline uint32_t vdso_getpid(void) {
+    return ((const volatile vdso_proc_t*)VDSO_PROC_ADDR)->pid;
+}
+
+/**
+ * Read a clock in nanoseconds (VDSO_CLOCK_*)
+ */
+static inline uint64_t vdso_clock_ns(int clock) {
+    const volatile vdso_data_t *vd = (const volatile vdso_data_t*)VDSO_DATA_ADDR;
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        seq = vd->seq;
+        __asm__ __volatile__("" : : : "memory");
+
+        uint32_t lo, hi;
+        __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+        uint64_t tsc = ((uint64_t)hi << 32) | lo;
+
+        ns = (uint64_t)(((unsigned __int128)(tsc - vd->tsc_base) * vd->tsc_mult) >> vd->clock_shift);
+        if (clock == VDSO_CLOCK_REALTIME) {
+            ns += vd->wall_offset_ns;
+        }
+
+        __asm__ __volatile__("" : : : "memory");
+    } while ((seq & 1) || seq != vd->seq);
+
+    return ns;
+}
+
+#endif /* _AAAOS_SYSCALL_VDSO_H */
@@ -1,21 +1,86 @@
 /**
  * AAAos Kernel - VGA Text Mode Driver Implementation
+ *
+ * Text is written to a shadow copy of the screen in normal RAM. VRAM is
+ * uncached, so reading it back to scroll and writing one cell at a time
+ * are slow. The shadow's rows form a ring: scrolling moves the top row
+ * index instead of the text. Changed rows are flagged in a bitmap, and
+ * vga_flush copies those rows to VRAM and moves the hardware cursor only
+ * if it changed. Writers set the bit after the cell, and the flush takes
+ * the bitmap before copying. A row changed during a flush is therefore
+ * copied again by the next one.
  */
 
 #include "include/vga.h"
 #include "arch/x86_64/io.h"
+#include "arch/x86_64/include/idt.h"
+#include "init/initcall.h"
+#include "sched/scheduler.h"
+#include "sched/timer.h"
 #include <stdarg.h>
 
+/* Every row changed */
+#define VGA_ROWS_ALL    ((uint32_t)BIT(VGA_HEIGHT) - 1)
+
+/* VRAM is written 4 cells at a time */
+#define VGA_ROW_QWORDS  (VGA_WIDTH * sizeof(uint16_t) / sizeof(uint64_t))
+
+_Static_assert(VGA_HEIGHT <= 32, "Dirty row bitmap is 32 bits");
+_Static_assert(VGA_WIDTH % 4 == 0, "Rows are copied in 64-bit words");
+
 /* VGA state */
-static uint16_t *vga_buffer = (uint16_t*)VGA_MEMORY;
+static volatile uint64_t *vga_buffer = (volatile uint64_t*)VGA_MEMORY;
+static uint16_t vga_shadow[VGA_HEIGHT * VGA_WIDTH] ALIGNED(8);
+static int vga_top = 0;                     /* Shadow row shown on screen row 0 */
+static volatile uint32_t vga_dirty = 0;     /* Screen rows VRAM does not show yet */
+static int vga_hw_cursor = -1;              /* Cursor position last sent to the CRTC */
+static volatile int vga_flush_lock = 0;
+static volatile bool vga_ticking = false;   /* The flush timer is running */
+static volatile bool vga_sync = false;      /* Set by vga_panic_mode */
+static ktimer_t vga_flush_timer;
 static int cursor_x = 0;
 static int cursor_y = 0;
 static uint8_t current_color;
+static vga_output_hook_t output_hook;
 
 /* VGA ports */
 #define VGA_CTRL_PORT   0x3D4
 #define VGA_DATA_PORT   0x3D5
 
+/**
+ * Shadow cells of a screen row
+ */
+static inline uint16_t *vga_row(int y) {
+    int row = vga_top + y;
+    if (row >= VGA_HEIGHT) {
+        row -= VGA_HEIGHT;
+    }
+    return &vga_shadow[row * VGA_WIDTH];
+}
+
+static inline void vga_mark(uint32_t rows) {
+    __atomic_or_fetch(&vga_dirty, rows, __ATOMIC_RELEASE);
+}
+
+static void vga_blank_row(int y) {
+    uint16_t blank = vga_entry(' ', current_color);
+    uint16_t *row = vga_row(y);
+    for (int i = 0; i < VGA_WIDTH; i++) {
+        row[i] = blank;
+    }
+}
+
+/**
+ * Send a cursor position to the CRTC
+ */
+static void vga_write_cursor(int pos) {
+    outb(VGA_CTRL_PORT, 0x0F);
+    outb(VGA_DATA_PORT, (uint8_t)(pos & 0xFF));
+    outb(VGA_CTRL_PORT, 0x0E);
+    outb(VGA_DATA_PORT, (uint8_t)((pos >> 8) & 0xFF));
+    vga_hw_cursor = pos;
+}
+
 /**
  * Initialize VGA text mode console
  */
@@ -25,17 +90,53 @@ void vga_init(void) {
     vga_enable_cursor(true);
 }
 
+/**
+ * Copy the changed rows to VRAM and move the hardware cursor
+ */
+void vga_flush(void) {
+    uint64_t flags = interrupts_save();
+
+    /* Another CPU is flushing; rows it took too early wait for the next flush */
+    if (__sync_lock_test_and_set(&vga_flush_lock, 1) && !vga_sync) {
+        interrupts_restore(flags);
+        return;
+    }
+
+    uint32_t dirty = __atomic_exchange_n(&vga_dirty, 0, __ATOMIC_ACQUIRE);
+    for (int y = 0; dirty != 0; y++, dirty >>= 1) {
+        if (!(dirty & 1)) {
+            continue;
+        }
+        const uint64_t *src = (const uint64_t*)vga_row(y);
+        volatile uint64_t *dst = &vga_buffer[y * VGA_ROW_QWORDS];
+        for (size_t i = 0; i < VGA_ROW_QWORDS; i++) {
+            dst[i] = src[i];
+        }
+    }
+
+    int pos = cursor_y * VGA_WIDTH + cursor_x;
+    if (pos != vga_hw_cursor) {
+        vga_write_cursor(pos);
+    }
+
+    __sync_lock_release(&vga_flush_lock);
+    interrupts_restore(flags);
+}
+
 /**
  * Clear the screen
  */
 void vga_clear(void) {
-    uint16_t blank = vga_entry(' ', current_color);
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = blank;
+    vga_top = 0;
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        vga_blank_row(y);
     }
     cursor_x = 0;
     cursor_y = 0;
-    vga_update_cursor();
+    vga_mark(VGA_ROWS_ALL);
+
+    /* Now, so a direct VRAM writer is not overwritten by a later flush */
+    vga_flush();
 }
 
 /**
@@ -49,22 +150,27 @@ void vga_set_color(vga_color_t fg, vga_color_t bg) {
  * Scroll the screen up by one line
  */
 void vga_scroll(void) {
-    /* Move all lines up */
-    for (int i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
-        vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
-    }
+    /* The old top row becomes the new, blank, bottom row */
+    vga_top = vga_top + 1 < VGA_HEIGHT ? vga_top + 1 : 0;
+    vga_blank_row(VGA_HEIGHT - 1);
+    vga_mark(VGA_ROWS_ALL);
+}
 
-    /* Clear the last line */
-    uint16_t blank = vga_entry(' ', current_color);
-    for (int i = VGA_WIDTH * (VGA_HEIGHT - 1); i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = blank;
-    }
+/**
+ * Install a hook that sees all console output first
+ */
+void vga_set_output_hook(vga_output_hook_t hook) {
+    output_hook = hook;
 }
 
 /**
- * Write a character at current cursor position
+ * Write a character to the shadow buffer
  */
-void vga_putc(char c) {
+static void vga_emit(char c) {
+    if (output_hook && output_hook(c)) {
+        return;
+    }
+
     switch (c) {
         case '\n':
             cursor_x = 0;
@@ -87,13 +193,15 @@ void vga_putc(char c) {
         case '\b':
             if (cursor_x > 0) {
                 cursor_x--;
-                vga_buffer[cursor_y * VGA_WIDTH + cursor_x] = vga_entry(' ', current_color);
+                vga_row(cursor_y)[cursor_x] = vga_entry(' ', current_color);
+                vga_mark((uint32_t)BIT(cursor_y));
             }
             break;
 
         default:
             if (c >= ' ') {
-                vga_buffer[cursor_y * VGA_WIDTH + cursor_x] = vga_entry(c, current_color);
+                vga_row(cursor_y)[cursor_x] = vga_entry(c, current_color);
+                vga_mark((uint32_t)BIT(cursor_y));
                 cursor_x++;
             }
             break;
@@ -110,8 +218,18 @@ void vga_putc(char c) {
         vga_scroll();
         cursor_y = VGA_HEIGHT - 1;
     }
+}
+
+/**
+ * Write a character at current cursor position
+ */
+void vga_putc(char c) {
+    vga_emit(c);
 
-    vga_update_cursor();
+    /* Lone characters wait for the flush timer once it runs */
+    if (!vga_ticking || vga_sync) {
+        vga_flush();
+    }
 }
 
 /**
@@ -119,8 +237,9 @@ void vga_putc(char c) {
  */
 void vga_puts(const char *str) {
     while (*str) {
-        vga_putc(*str++);
+        vga_emit(*str++);
     }
+    vga_flush();
 }
 
 /**
@@ -130,7 +249,7 @@ void vga_set_cursor(int x, int y) {
     if (x >= 0 && x < VGA_WIDTH && y >= 0 && y < VGA_HEIGHT) {
         cursor_x = x;
         cursor_y = y;
-        vga_update_cursor();
+        vga_flush();
     }
 }
 
@@ -169,12 +288,15 @@ void vga_enable_cursor(bool enable) {
  * Update hardware cursor position
  */
 void vga_update_cursor(void) {
-    uint16_t pos = cursor_y * VGA_WIDTH + cursor_x;
+    vga_write_cursor(cursor_y * VGA_WIDTH + cursor_x);
+}
 
-    outb(VGA_CTRL_PORT, 0x0F);
-    outb(VGA_DATA_PORT, (uint8_t)(pos & 0xFF));
-    outb(VGA_CTRL_PORT, 0x0E);
-    outb(VGA_DATA_PORT, (uint8_t)((pos >> 8) & 0xFF));
+/**
+ * Write through from now on
+ */
+void vga_panic_mode(void) {
+    vga_sync = true;
+    vga_flush();
 }
 
 /* Helper function to print an unsigned integer */
@@ -199,14 +321,14 @@ static void vga_print_uint(uint64_t value, int base, int width, char pad) {
 
     /* Print in reverse */
     while (i > 0) {
-        vga_putc(buffer[--i]);
+        vga_emit(buffer[--i]);
     }
 }
 
 /* Helper function to print a signed integer */
 static void vga_print_int(int64_t value, int width, char pad) {
     if (value < 0) {
-        vga_putc('-');
+        vga_emit('-');
         value = -value;
         if (width > 0) width--;
     }
@@ -222,7 +344,7 @@ void vga_printf(const char *fmt, ...) {
 
     while (*fmt) {
         if (*fmt != '%') {
-            vga_putc(*fmt++);
+            vga_emit(*fmt++);
             continue;
         }
 
@@ -285,32 +407,59 @@ void vga_printf(const char *fmt, ...) {
                 break;
 
             case 'p':
-                vga_puts("0x");
+                vga_emit('0');
+                vga_emit('x');
                 vga_print_uint((uint64_t)va_arg(args, void*), 16, 16, '0');
                 break;
 
             case 's': {
                 const char *s = va_arg(args, const char*);
                 if (s == NULL) s = "(null)";
-                vga_puts(s);
+                while (*s) {
+                    vga_emit(*s++);
+                }
                 break;
             }
 
             case 'c':
-                vga_putc((char)va_arg(args, int));
+                vga_emit((char)va_arg(args, int));
                 break;
 
             case '%':
-                vga_putc('%');
+                vga_emit('%');
                 break;
 
             default:
-                vga_putc('%');
-                vga_putc(*fmt);
+                vga_emit('%');
+                vga_emit(*fmt);
                 break;
         }
         fmt++;
     }
 
     va_end(args);
+    vga_flush();
 }
+
+static void vga_flush_tick(void *arg) {
+    UNUSED(arg);
+    vga_flush();
+}
+
+static bool vga_initcall(void) {
+    uint64_t interval = (uint64_t)VGA_FLUSH_INTERVAL_MS * 1000000;
+
+    /* Timers only fire once the scheduler is up; until then vga_putc flushes */
+    if (!scheduler_is_running()) {
+        return true;
+    }
+
+    ktimer_init_soft(&vga_flush_timer, vga_flush_tick, NULL);
+    if (!ktimer_start(&vga_flush_timer, interval, interval)) {
+        return false;
+    }
+    vga_ticking = true;
+    return true;
+}
+
+INITCALL(vga, vga_initcall, 0);
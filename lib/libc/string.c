@@ -7,26 +7,130 @@
 
 #include "string.h"
 
+/*
+ * Word-at-a-time helpers
+ *
+ * String functions scan eight bytes per step. A word with a zero byte is
+ * found with the usual borrow trick: (v - 0x01..01) & ~v & 0x80..80 sets
+ * the top bit of every zero byte, and perhaps of bytes above the first
+ * zero (borrows) but never below it, so its lowest set bit is exact.
+ * Searching for a character is the same test on the word XORed with the
+ * character repeated. Strings of unknown length are read in aligned
+ * words, which never cross into the next page, and the bytes before the
+ * start in the first word are masked off.
+ */
+
+#define STRING_ONES         0x0101010101010101ULL
+#define STRING_HIGHS        0x8080808080808080ULL
+#define STRING_PAGE_SIZE    4096
+
+static inline uint64_t string_load64(const void *p)
+{
+    uint64_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void string_store64(void *p, uint64_t v)
+{
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t string_load32(const void *p)
+{
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void string_store32(void *p, uint32_t v)
+{
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+/**
+ * Mark the zero bytes of a word (exact only up to the first one)
+ */
+static inline uint64_t string_zeros(uint64_t v)
+{
+    return (v - STRING_ONES) & ~v & STRING_HIGHS;
+}
+
+/**
+ * Mark exactly the zero bytes of a word
+ */
+static inline uint64_t string_zeros_exact(uint64_t v)
+{
+    uint64_t t = (v & ~STRING_HIGHS) + ~STRING_HIGHS;
+    return ~(t | v | ~STRING_HIGHS);
+}
+
+/**
+ * Byte index of the lowest marked byte (mask must be non-zero)
+ */
+static inline size_t string_first(uint64_t mask)
+{
+    return (size_t)__builtin_ctzll(mask) / 8;
+}
+
+/**
+ * Bytes of the first aligned word that come before p, forced non-zero
+ */
+static inline uint64_t string_lead_mask(const void *p)
+{
+    size_t lead = (uintptr_t)p & 7;
+    return lead ? ~0ULL >> (64 - 8 * lead) : 0;
+}
+
+/**
+ * Check that 8 bytes can be read at p without touching the next page
+ */
+static inline bool string_word_fits(const void *p)
+{
+    return ((uintptr_t)p & (STRING_PAGE_SIZE - 1)) <= STRING_PAGE_SIZE - 8;
+}
+
 /*
  * String Functions
  */
 
 size_t strlen(const char *str)
 {
-    const char *s = str;
-    while (*s) {
-        s++;
+    const unsigned char *w = (const unsigned char *)((uintptr_t)str & ~(uintptr_t)7);
+    uint64_t zeros = string_zeros(string_load64(w) | string_lead_mask(str));
+
+    while (!zeros) {
+        w += 8;
+        zeros = string_zeros(string_load64(w));
     }
-    return (size_t)(s - str);
+    return (size_t)((const char *)w + string_first(zeros) - str);
 }
 
 int strcmp(const char *s1, const char *s2)
 {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
+    const unsigned char *a = (const unsigned char *)s1;
+    const unsigned char *b = (const unsigned char *)s2;
+
+    for (;;) {
+        if (string_word_fits(a) && string_word_fits(b)) {
+            uint64_t va = string_load64(a), vb = string_load64(b);
+            uint64_t stop = string_zeros(va) | (~string_zeros_exact(va ^ vb) & STRING_HIGHS);
+            if (stop) {
+                size_t i = string_first(stop);
+                return (int)a[i] - (int)b[i];
+            }
+            a += 8;
+            b += 8;
+            continue;
+        }
+
+        /* Close to the end of a page: a byte at a time until past it */
+        if (*a != *b || *a == '\0') {
+            return (int)*a - (int)*b;
+        }
+        a++;
+        b++;
     }
-    return (int)((unsigned char)*s1 - (unsigned char)*s2);
 }
 
 int strncmp(const char *s1, const char *s2, size_t n)
@@ -45,11 +149,7 @@ int strncmp(const char *s1, const char *s2, size_t n)
 
 char *strcpy(char *dest, const char *src)
 {
-    char *d = dest;
-    while ((*d++ = *src++)) {
-        /* Empty loop body - assignment in condition does the work */
-    }
-    return dest;
+    return memcpy(dest, src, strlen(src) + 1);
 }
 
 char *strncpy(char *dest, const char *src, size_t n)
@@ -73,102 +173,266 @@ char *strncpy(char *dest, const char *src, size_t n)
 
 char *strcat(char *dest, const char *src)
 {
-    char *d = dest;
-
-    /* Find the end of dest */
-    while (*d) {
-        d++;
-    }
-
-    /* Copy src to the end of dest */
-    while ((*d++ = *src++)) {
-        /* Empty loop body - assignment in condition does the work */
-    }
-
+    strcpy(dest + strlen(dest), src);
     return dest;
 }
 
 char *strchr(const char *str, int c)
 {
-    char ch = (char)c;
-
-    while (*str) {
-        if (*str == ch) {
-            return (char *)str;
-        }
-        str++;
-    }
-
-    /* Check for null terminator match */
-    if (ch == '\0') {
-        return (char *)str;
+    const unsigned char *w = (const unsigned char *)((uintptr_t)str & ~(uintptr_t)7);
+    uint64_t pattern = STRING_ONES * (unsigned char)c;
+    uint64_t lead = string_lead_mask(str);
+    uint64_t v = string_load64(w);
+    uint64_t stop = string_zeros(v | lead) | string_zeros((v ^ pattern) | lead);
+
+    while (!stop) {
+        w += 8;
+        v = string_load64(w);
+        stop = string_zeros(v) | string_zeros(v ^ pattern);
     }
 
-    return NULL;
+    /* The first byte that is either the character or the terminator */
+    w += string_first(stop);
+    return *w == (unsigned char)c ? (char *)w : NULL;
 }
 
 char *strrchr(const char *str, int c)
 {
-    char ch = (char)c;
-    const char *last = NULL;
+    size_t len = strlen(str);
 
-    while (*str) {
-        if (*str == ch) {
-            last = str;
-        }
-        str++;
-    }
-
-    /* Check for null terminator match */
-    if (ch == '\0') {
-        return (char *)str;
+    /* The terminator counts as part of the string */
+    if ((char)c == '\0') {
+        return (char *)str + len;
     }
-
-    return (char *)last;
+    return memrchr(str, c, len);
 }
 
+/* Needles from this length on are searched for with Horspool */
+#define STRING_HORSPOOL_MIN 4
+
 char *strstr(const char *haystack, const char *needle)
 {
-    const char *h, *n;
+    size_t nlen = strlen(needle);
 
     /* Empty needle matches at the start */
-    if (*needle == '\0') {
+    if (nlen == 0) {
         return (char *)haystack;
     }
+    if (nlen == 1) {
+        return strchr(haystack, needle[0]);
+    }
 
-    while (*haystack) {
-        /* Check if needle starts here */
-        h = haystack;
-        n = needle;
-
-        while (*h && *n && (*h == *n)) {
-            h++;
-            n++;
-        }
+    size_t hlen = strlen(haystack);
+    if (nlen > hlen) {
+        return NULL;
+    }
 
-        /* If we reached the end of needle, we found a match */
-        if (*n == '\0') {
-            return (char *)haystack;
+    const unsigned char *h = (const unsigned char *)haystack;
+    const unsigned char *n = (const unsigned char *)needle;
+    size_t last = hlen - nlen;
+
+    if (nlen < STRING_HORSPOOL_MIN) {
+        /* Short needles: jump between occurrences of the first character */
+        size_t pos = 0;
+        while (pos <= last) {
+            const unsigned char *p = memchr(h + pos, n[0], last - pos + 1);
+            if (!p) {
+                return NULL;
+            }
+            if (memcmp(p + 1, n + 1, nlen - 1) == 0) {
+                return (char *)p;
+            }
+            pos = (size_t)(p - h) + 1;
         }
+        return NULL;
+    }
 
-        haystack++;
+    /* Horspool: shift by how far the window's last byte is from the
+     * end of the needle. Shifts are capped to fit; shorter is still safe. */
+    uint16_t skip[256];
+    uint16_t limit = nlen < 0xFFFF ? (uint16_t)nlen : 0xFFFF;
+    for (size_t i = 0; i < 256; i++) {
+        skip[i] = limit;
+    }
+    for (size_t i = 0; i + 1 < nlen; i++) {
+        size_t shift = nlen - 1 - i;
+        skip[n[i]] = shift < 0xFFFF ? (uint16_t)shift : 0xFFFF;
     }
 
+    unsigned char tail = n[nlen - 1];
+    for (size_t pos = 0; pos <= last; ) {
+        unsigned char c = h[pos + nlen - 1];
+        if (c == tail && memcmp(h + pos, n, nlen - 1) == 0) {
+            return (char *)h + pos;
+        }
+        pos += skip[c];
+    }
     return NULL;
 }
 
 /*
  * Memory Functions
+ *
+ * Sizes from STRING_REP_MIN up go to the CPU's string instructions, which
+ * with ERMS (enhanced rep movsb/stosb) move whole cache lines at a time;
+ * without it rep movsq/stosq does the bulk. Smaller sizes are moved a
+ * word at a time, four words per iteration, and the last partial word is
+ * handled as one word overlapping the previous one instead of bytes.
+ * Only sizes below 8 go byte-wise.
+ */
+
+#define STRING_REP_MIN      256     /* Smallest size handed to rep movs/stos */
+
+#if defined(__x86_64__)
+
+/**
+ * Check for ERMS (CPUID leaf 7, EBX bit 9), once
+ */
+static bool string_erms(void)
+{
+    static int erms = -1;
+
+    if (erms < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                             : "a"(0), "c"(0));
+        erms = 0;
+        if (eax >= 7) {
+            __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                                 : "a"(7), "c"(0));
+            erms = (ebx >> 9) & 1;
+        }
+    }
+    return erms != 0;
+}
+
+/**
+ * Copy forwards with the string instructions (also right for dest < src)
+ */
+static void string_rep_copy(unsigned char *d, const unsigned char *s, size_t n)
+{
+    if (!string_erms()) {
+        size_t words = n / 8;
+        __asm__ __volatile__("rep movsq" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+        n &= 7;
+    }
+    __asm__ __volatile__("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static void string_rep_fill(unsigned char *d, uint64_t pattern, size_t n)
+{
+    if (!string_erms()) {
+        size_t words = n / 8;
+        __asm__ __volatile__("rep stosq" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+        n &= 7;
+    }
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(n) : "a"(pattern) : "memory");
+}
+
+#endif /* __x86_64__ */
+
+/**
+ * Copy forwards a word at a time
+ * Every load comes before the stores that could overlap it when
+ * d < s, so this is also memmove's forward copy.
  */
+static void string_copy_forward(unsigned char *d, const unsigned char *s, size_t n)
+{
+    if (n >= 8) {
+        uint64_t tail = string_load64(s + n - 8);
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            uint64_t w0 = string_load64(s + i);
+            uint64_t w1 = string_load64(s + i + 8);
+            uint64_t w2 = string_load64(s + i + 16);
+            uint64_t w3 = string_load64(s + i + 24);
+            string_store64(d + i, w0);
+            string_store64(d + i + 8, w1);
+            string_store64(d + i + 16, w2);
+            string_store64(d + i + 24, w3);
+        }
+        for (; i + 8 <= n; i += 8) {
+            string_store64(d + i, string_load64(s + i));
+        }
+        string_store64(d + n - 8, tail);
+    } else if (n >= 4) {
+        uint32_t head = string_load32(s);
+        uint32_t tail = string_load32(s + n - 4);
+        string_store32(d, head);
+        string_store32(d + n - 4, tail);
+    } else if (n > 0) {
+        /* 1 to 3 bytes: first, middle and last cover them all */
+        unsigned char first = s[0], middle = s[n / 2], last = s[n - 1];
+        d[0] = first;
+        d[n / 2] = middle;
+        d[n - 1] = last;
+    }
+}
+
+/**
+ * Copy backwards a word at a time, for d > s overlapping
+ */
+static void string_copy_backward(unsigned char *d, const unsigned char *s, size_t n)
+{
+    if (n < 8) {
+        /* The small cases load everything before storing */
+        string_copy_forward(d, s, n);
+        return;
+    }
+
+    uint64_t head = string_load64(s);
+    size_t i = n;
+
+    for (; i >= 32 + 8; i -= 32) {
+        uint64_t w0 = string_load64(s + i - 8);
+        uint64_t w1 = string_load64(s + i - 16);
+        uint64_t w2 = string_load64(s + i - 24);
+        uint64_t w3 = string_load64(s + i - 32);
+        string_store64(d + i - 8, w0);
+        string_store64(d + i - 16, w1);
+        string_store64(d + i - 24, w2);
+        string_store64(d + i - 32, w3);
+    }
+    for (; i >= 8 + 8; i -= 8) {
+        string_store64(d + i - 8, string_load64(s + i - 8));
+    }
+    /* Bytes [8, i) are left; i <= 15 so one word ending at i covers them */
+    string_store64(d + i - 8, string_load64(s + i - 8));
+    string_store64(d, head);
+}
 
 void *memset(void *dest, int c, size_t n)
 {
     unsigned char *d = (unsigned char *)dest;
-    unsigned char byte = (unsigned char)c;
+    uint64_t pattern = 0x0101010101010101ULL * (unsigned char)c;
 
-    while (n > 0) {
-        *d++ = byte;
-        n--;
+#if defined(__x86_64__)
+    if (n >= STRING_REP_MIN) {
+        string_rep_fill(d, pattern, n);
+        return dest;
+    }
+#endif
+
+    if (n >= 8) {
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            string_store64(d + i, pattern);
+            string_store64(d + i + 8, pattern);
+            string_store64(d + i + 16, pattern);
+            string_store64(d + i + 24, pattern);
+        }
+        for (; i + 8 <= n; i += 8) {
+            string_store64(d + i, pattern);
+        }
+        string_store64(d + n - 8, pattern);
+    } else if (n >= 4) {
+        string_store32(d, (uint32_t)pattern);
+        string_store32(d + n - 4, (uint32_t)pattern);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            d[i] = (unsigned char)c;
+        }
     }
 
     return dest;
@@ -179,11 +443,14 @@ void *memcpy(void *dest, const void *src, size_t n)
     unsigned char *d = (unsigned char *)dest;
     const unsigned char *s = (const unsigned char *)src;
 
-    while (n > 0) {
-        *d++ = *s++;
-        n--;
+#if defined(__x86_64__)
+    if (n >= STRING_REP_MIN) {
+        string_rep_copy(d, s, n);
+        return dest;
     }
+#endif
 
+    string_copy_forward(d, s, n);
     return dest;
 }
 
@@ -199,18 +466,16 @@ void *memmove(void *dest, const void *src, size_t n)
     /* Check for overlap and copy direction */
     if (d < s || d >= s + n) {
         /* No overlap or dest is before src, copy forward */
-        while (n > 0) {
-            *d++ = *s++;
-            n--;
+#if defined(__x86_64__)
+        if (n >= STRING_REP_MIN) {
+            string_rep_copy(d, s, n);
+            return dest;
         }
+#endif
+        string_copy_forward(d, s, n);
     } else {
         /* Overlap with dest after src, copy backward */
-        d += n;
-        s += n;
-        while (n > 0) {
-            *--d = *--s;
-            n--;
-        }
+        string_copy_backward(d, s, n);
     }
 
     return dest;
@@ -232,3 +497,42 @@ int memcmp(const void *s1, const void *s2, size_t n)
 
     return 0;
 }
+
+void *memchr(const void *str, int c, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    uint64_t pattern = STRING_ONES * (unsigned char)c;
+
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t hits = string_zeros(string_load64(p) ^ pattern);
+        if (hits) {
+            return (void *)(p + string_first(hits));
+        }
+    }
+    for (; n > 0; p++, n--) {
+        if (*p == (unsigned char)c) {
+            return (void *)p;
+        }
+    }
+    return NULL;
+}
+
+void *memrchr(const void *str, int c, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    uint64_t pattern = STRING_ONES * (unsigned char)c;
+
+    /* Scanning down needs the highest match, so use the exact mask */
+    for (; n >= 8; n -= 8) {
+        uint64_t hits = string_zeros_exact(string_load64(p + n - 8) ^ pattern);
+        if (hits) {
+            return (void *)(p + n - 8 + (size_t)(63 - __builtin_clzll(hits)) / 8);
+        }
+    }
+    while (n-- > 0) {
+        if (p[n] == (unsigned char)c) {
+            return (void *)(p + n);
+        }
+    }
+    return NULL;
+}
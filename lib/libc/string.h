@@ -158,4 +158,26 @@ void *memmove(void *dest, const void *src, size_t n);
  */
 int memcmp(const void *s1, const void *s2, size_t n);
 
+/**
+ * memchr - Find first occurrence of a byte in memory
+ * @str: Memory area to search
+ * @c: Byte to find (passed as int, but treated as unsigned char)
+ * @n: Number of bytes to search
+ *
+ * Returns a pointer to the first occurrence of @c in the first @n bytes
+ * of @str, or NULL if not found.
+ */
+void *memchr(const void *str, int c, size_t n);
+
+/**
+ * memrchr - Find last occurrence of a byte in memory
+ * @str: Memory area to search
+ * @c: Byte to find (passed as int, but treated as unsigned char)
+ * @n: Number of bytes to search
+ *
+ * Returns a pointer to the last occurrence of @c in the first @n bytes
+ * of @str, or NULL if not found.
+ */
+void *memrchr(const void *str, int c, size_t n);
+
 #endif /* _AAAOS_STRING_H */
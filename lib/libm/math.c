@@ -0,0 +1,1611 @@
+/**
+ * AAAos Math Library - Implementation
+ *
+ * Every function reduces its argument to a small interval and evaluates
+ * a short polynomial there, using a table where one lets the polynomial
+ * shrink:
+ *
+ *   exp    x = (128k + j) ln2/128 + r, |r| <= ln2/256:
+ *          e^x = 2^k * 2^(j/128) * e^r
+ *   log    x = 2^k * m and m * c = 1 + r, with c ~ 1/m from a 128 entry
+ *          table and |r| < 2^-7: log x = k ln2 - log c + log1p(r)
+ *   sin    x = n pi/2 + r, |r| <= pi/4, by Cody-Waite below 2^20 pi/2
+ *   cos    and Payne-Hanek above; fdlibm's minimax kernels on r
+ *   atan   |x| <= 1 (else pi/2 - atan(1/x)), c = k/16 nearest:
+ *          atan x = atan c + atan((x - c) / (1 + xc))
+ *
+ * Intermediate results that need more than double precision (the
+ * reduced arguments, log for pow, y * log x) are carried as unevaluated
+ * sums hi + lo of two doubles. The error bounds in math.h were measured
+ * against long double references over millions of arguments.
+ *
+ * The polynomials for e^r and log1p(r) are plain Taylor series: on the
+ * intervals the tables leave, their truncation error is already far
+ * below an ulp.
+ */
+
+#include "math.h"
+
+/*
+ * Bit Access
+ */
+
+static inline uint64_t math_bits(double x)
+{
+    uint64_t u;
+    __builtin_memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+static inline double math_double(uint64_t u)
+{
+    double x;
+    __builtin_memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+#define MATH_SIGN       0x8000000000000000ULL
+#define MATH_EXP_MASK   0x7FF0000000000000ULL
+#define MATH_MANT_MASK  0x000FFFFFFFFFFFFFULL
+
+/* Biased exponent field of a double */
+static inline int math_exponent(double x)
+{
+    return (int)((math_bits(x) >> 52) & 0x7FF);
+}
+
+/* 2^k for a normal result (-1022 <= k <= 1023) */
+static inline double math_pow2(int k)
+{
+    return math_double((uint64_t)(k + 1023) << 52);
+}
+
+/* Adding and subtracting this rounds a double below 2^51 to an integer */
+#define MATH_ROUND_SHIFT    0x1.8p52
+
+/*
+ * Double-double Arithmetic
+ *
+ * Exact sums and products as hi + lo (Dekker), without relying on a
+ * fused multiply-add.
+ */
+
+static inline void math_two_sum(double a, double b, double *s, double *e)
+{
+    double sum = a + b;
+    double bb = sum - a;
+    *e = (a - (sum - bb)) + (b - bb);
+    *s = sum;
+}
+
+/* Same for |a| >= |b| */
+static inline void math_fast_two_sum(double a, double b, double *s, double *e)
+{
+    double sum = a + b;
+    *e = b - (sum - a);
+    *s = sum;
+}
+
+static inline void math_split(double a, double *hi, double *lo)
+{
+    double t = 134217729.0 * a;         /* 2^27 + 1 */
+    *hi = t - (t - a);
+    *lo = a - *hi;
+}
+
+static inline void math_two_prod(double a, double b, double *p, double *e)
+{
+    double ah, al, bh, bl;
+    double prod = a * b;
+    math_split(a, &ah, &al);
+    math_split(b, &bh, &bl);
+    *e = ((ah * bh - prod) + ah * bl + al * bh) + al * bl;
+    *p = prod;
+}
+
+/*
+ * Constants
+ */
+
+static const double math_pi_hi = 0x1.921fb54442d18p+1;
+static const double math_pi_lo = 0x1.1a62633145c07p-53;
+static const double math_pio2_hi = 0x1.921fb54442d18p+0;
+static const double math_pio2_lo = 0x1.1a62633145c07p-54;
+
+/* ln 2 with the high part short enough that k * hi is exact for any
+ * exponent k */
+static const double math_ln2_hi = 0x1.62e42fefa3800p-1;
+static const double math_ln2_lo = 0x1.ef35793c76730p-45;
+
+static const double math_inv_ln2_hi = 0x1.71547652b82fep+0;
+static const double math_inv_ln2_lo = 0x1.777d0ffda0d24p-56;
+static const double math_inv_ln10_hi = 0x1.bcb7b1526e50ep-2;
+static const double math_inv_ln10_lo = 0x1.95355baaafad3p-57;
+
+/*
+ * Basic Operations
+ */
+
+double fabs(double x)
+{
+    return math_double(math_bits(x) & ~MATH_SIGN);
+}
+
+double copysign(double x, double y)
+{
+    return math_double((math_bits(x) & ~MATH_SIGN) | (math_bits(y) & MATH_SIGN));
+}
+
+int signbit(double x)
+{
+    return (int)(math_bits(x) >> 63);
+}
+
+int isnan(double x)
+{
+    return (math_bits(x) & ~MATH_SIGN) > MATH_EXP_MASK;
+}
+
+int isinf(double x)
+{
+    return (math_bits(x) & ~MATH_SIGN) == MATH_EXP_MASK;
+}
+
+int isfinite(double x)
+{
+    return (math_bits(x) & MATH_EXP_MASK) != MATH_EXP_MASK;
+}
+
+int fpclassify(double x)
+{
+    uint64_t u = math_bits(x);
+    int e = math_exponent(x);
+
+    if (e == 0x7FF) {
+        return (u & MATH_MANT_MASK) ? FP_NAN : FP_INFINITE;
+    }
+    if (e == 0) {
+        return (u & MATH_MANT_MASK) ? FP_SUBNORMAL : FP_ZERO;
+    }
+    return FP_NORMAL;
+}
+
+double trunc(double x)
+{
+    int e = math_exponent(x) - 1023;
+
+    if (e >= 52) {
+        return x;                       /* Integer, infinity or NaN */
+    }
+    if (e < 0) {
+        return copysign(0.0, x);
+    }
+    return math_double(math_bits(x) & ~(MATH_MANT_MASK >> e));
+}
+
+double floor(double x)
+{
+    double t = trunc(x);
+    return t > x ? t - 1.0 : t;
+}
+
+double ceil(double x)
+{
+    double t = trunc(x);
+    return t < x ? t + 1.0 : t;
+}
+
+double round(double x)
+{
+    double t = trunc(x);
+
+    /* x - t is exact: both have the same exponent or t is 0 */
+    if (fabs(x - t) >= 0.5) {
+        t += copysign(1.0, x);
+    }
+    return t;
+}
+
+double modf(double x, double *iptr)
+{
+    double t = trunc(x);
+
+    *iptr = t;
+    if (isinf(x)) {
+        return copysign(0.0, x);
+    }
+    return copysign(x - t, x);
+}
+
+double fmod(double x, double y)
+{
+    uint64_t ux = math_bits(x), uy = math_bits(y);
+    int ex = math_exponent(x), ey = math_exponent(y);
+    uint64_t sign = ux & MATH_SIGN;
+
+    if ((uy << 1) == 0 || isnan(y) || ex == 0x7FF) {
+        return (x * y) / (x * y);       /* NaN */
+    }
+    if ((ux << 1) <= (uy << 1)) {
+        return (ux << 1) == (uy << 1) ? 0.0 * x : x;
+    }
+
+    /* Integer significands, subnormals normalized */
+    if (ex == 0) {
+        for (uint64_t i = ux << 12; !(i >> 63); i <<= 1) {
+            ex--;
+        }
+        ux <<= 1 - ex;
+    } else {
+        ux = (ux & MATH_MANT_MASK) | (1ULL << 52);
+    }
+    if (ey == 0) {
+        for (uint64_t i = uy << 12; !(i >> 63); i <<= 1) {
+            ey--;
+        }
+        uy <<= 1 - ey;
+    } else {
+        uy = (uy & MATH_MANT_MASK) | (1ULL << 52);
+    }
+
+    /* Long division, one bit per step; the remainder stays exact */
+    for (; ex > ey; ex--) {
+        if (ux >= uy) {
+            ux -= uy;
+            if (ux == 0) {
+                return 0.0 * x;
+            }
+        }
+        ux <<= 1;
+    }
+    if (ux >= uy) {
+        ux -= uy;
+        if (ux == 0) {
+            return 0.0 * x;
+        }
+    }
+
+    for (; !(ux >> 52); ux <<= 1) {
+        ex--;
+    }
+    if (ex > 0) {
+        ux = (ux - (1ULL << 52)) | ((uint64_t)ex << 52);
+    } else {
+        ux >>= 1 - ex;
+    }
+    return math_double(ux | sign);
+}
+
+double ldexp(double x, int exp)
+{
+    double y = x;
+
+    /* Scale in steps that stay normal; the last multiply rounds once */
+    if (exp > 1023) {
+        y *= 0x1p1023;
+        exp -= 1023;
+        if (exp > 1023) {
+            y *= 0x1p1023;
+            exp -= 1023;
+            if (exp > 1023) {
+                exp = 1023;
+            }
+        }
+    } else if (exp < -1022) {
+        y *= 0x1p-1022 * 0x1p53;
+        exp += 1022 - 53;
+        if (exp < -1022) {
+            y *= 0x1p-1022 * 0x1p53;
+            exp += 1022 - 53;
+            if (exp < -1022) {
+                exp = -1022;
+            }
+        }
+    }
+    return y * math_pow2(exp);
+}
+
+double frexp(double x, int *exp)
+{
+    uint64_t u = math_bits(x);
+    int e = math_exponent(x);
+
+    if (e == 0) {
+        if (x == 0.0) {
+            *exp = 0;
+            return x;
+        }
+        x = frexp(x * 0x1p64, exp);
+        *exp -= 64;
+        return x;
+    }
+    if (e == 0x7FF) {
+        *exp = 0;
+        return x;
+    }
+
+    *exp = e - 1022;
+    return math_double((u & ~MATH_EXP_MASK) | 0x3FE0000000000000ULL);
+}
+
+double sqrt(double x)
+{
+#if defined(__x86_64__)
+    __asm__("sqrtsd %1, %0" : "=x"(x) : "x"(x));
+    return x;
+#else
+    if (!(x > 0.0) || isinf(x)) {
+        return x < 0.0 ? NAN : x;
+    }
+
+    /* Newton's method from a halved exponent, then round the last bit */
+    int e;
+    double m = frexp(x, &e);
+    double r = ldexp(0.5 + 0.5 * m, e / 2);
+    for (int i = 0; i < 6; i++) {
+        r = 0.5 * (r + x / r);
+    }
+    return r;
+#endif
+}
+
+/*
+ * Exponential
+ */
+
+#define MATH_EXP_BITS   7
+#define MATH_EXP_N      (1 << MATH_EXP_BITS)
+
+/* 2^(j/128) as hi + lo */
+static const struct {
+    double hi, lo;
+} math_exp_table[MATH_EXP_N] = {
+    { 0x1.0000000000000p+0, 0.0 },
+    { 0x1.0163da9fb3335p+0, 0x1.b61299ab8cdb7p-54 },
+    { 0x1.02c9a3e778061p+0, -0x1.19083535b085dp-56 },
+    { 0x1.04315e86e7f85p+0, -0x1.0a31c1977c96ep-54 },
+    { 0x1.059b0d3158574p+0, 0x1.d73e2a475b465p-55 },
+    { 0x1.0706b29ddf6dep+0, -0x1.c91dfe2b13c27p-55 },
+    { 0x1.0874518759bc8p+0, 0x1.186be4bb284ffp-57 },
+    { 0x1.09e3ecac6f383p+0, 0x1.1487818316136p-54 },
+    { 0x1.0b5586cf9890fp+0, 0x1.8a62e4adc610bp-54 },
+    { 0x1.0cc922b7247f7p+0, 0x1.01edc16e24f71p-54 },
+    { 0x1.0e3ec32d3d1a2p+0, 0x1.03a1727c57b53p-59 },
+    { 0x1.0fb66affed31bp+0, -0x1.b9bedc44ebd7bp-57 },
+    { 0x1.11301d0125b51p+0, -0x1.6c51039449b3ap-54 },
+    { 0x1.12abdc06c31ccp+0, -0x1.1b514b36ca5c7p-58 },
+    { 0x1.1429aaea92de0p+0, -0x1.32fbf9af1369ep-54 },
+    { 0x1.15a98c8a58e51p+0, 0x1.2406ab9eeab0ap-55 },
+    { 0x1.172b83c7d517bp+0, -0x1.19041b9d78a76p-55 },
+    { 0x1.18af9388c8deap+0, -0x1.11023d1970f6cp-54 },
+    { 0x1.1a35beb6fcb75p+0, 0x1.e5b4c7b4968e4p-55 },
+    { 0x1.1bbe084045cd4p+0, -0x1.95386352ef607p-54 },
+    { 0x1.1d4873168b9aap+0, 0x1.e016e00a2643cp-54 },
+    { 0x1.1ed5022fcd91dp+0, -0x1.1df98027bb78cp-54 },
+    { 0x1.2063b88628cd6p+0, 0x1.dc775814a8495p-55 },
+    { 0x1.21f49917ddc96p+0, 0x1.2a97e9494a5eep-55 },
+    { 0x1.2387a6e756238p+0, 0x1.9b07eb6c70573p-54 },
+    { 0x1.251ce4fb2a63fp+0, 0x1.ac155bef4f4a4p-55 },
+    { 0x1.26b4565e27cddp+0, 0x1.2bd339940e9d9p-55 },
+    { 0x1.284dfe1f56381p+0, -0x1.a4c3a8c3f0d7ep-54 },
+    { 0x1.29e9df51fdee1p+0, 0x1.612e8afad1255p-55 },
+    { 0x1.2b87fd0dad990p+0, -0x1.10adcd6381aa4p-59 },
+    { 0x1.2d285a6e4030bp+0, 0x1.0024754db41d5p-54 },
+    { 0x1.2ecafa93e2f56p+0, 0x1.1ca0f45d52383p-56 },
+    { 0x1.306fe0a31b715p+0, 0x1.6f46ad23182e4p-55 },
+    { 0x1.32170fc4cd831p+0, 0x1.a9ce78e18047cp-55 },
+    { 0x1.33c08b26416ffp+0, 0x1.32721843659a6p-54 },
+    { 0x1.356c55f929ff1p+0, -0x1.b5cee5c4e4628p-55 },
+    { 0x1.371a7373aa9cbp+0, -0x1.63aeabf42eae2p-54 },
+    { 0x1.38cae6d05d866p+0, -0x1.e958d3c9904bdp-54 },
+    { 0x1.3a7db34e59ff7p+0, -0x1.5e436d661f5e3p-56 },
+    { 0x1.3c32dc313a8e5p+0, -0x1.efff8375d29c3p-54 },
+    { 0x1.3dea64c123422p+0, 0x1.ada0911f09ebcp-55 },
+    { 0x1.3fa4504ac801cp+0, -0x1.7d023f956f9f3p-54 },
+    { 0x1.4160a21f72e2ap+0, -0x1.ef3691c309278p-58 },
+    { 0x1.431f5d950a897p+0, -0x1.1c7dde35f7999p-55 },
+    { 0x1.44e086061892dp+0, 0x1.89b7a04ef80d0p-59 },
+    { 0x1.46a41ed1d0057p+0, 0x1.c944bd1648a76p-54 },
+    { 0x1.486a2b5c13cd0p+0, 0x1.3c1a3b69062f0p-56 },
+    { 0x1.4a32af0d7d3dep+0, 0x1.9cb62f3d1be56p-54 },
+    { 0x1.4bfdad5362a27p+0, 0x1.d4397afec42e2p-56 },
+    { 0x1.4dcb299fddd0dp+0, 0x1.8ecdbbc6a7833p-54 },
+    { 0x1.4f9b2769d2ca7p+0, -0x1.4b309d25957e3p-54 },
+    { 0x1.516daa2cf6642p+0, -0x1.f768569bd93efp-55 },
+    { 0x1.5342b569d4f82p+0, -0x1.07abe1db13cadp-55 },
+    { 0x1.551a4ca5d920fp+0, -0x1.d689cefede59bp-55 },
+    { 0x1.56f4736b527dap+0, 0x1.9bb2c011d93adp-54 },
+    { 0x1.58d12d497c7fdp+0, 0x1.295e15b9a1de8p-55 },
+    { 0x1.5ab07dd485429p+0, 0x1.6324c054647adp-54 },
+    { 0x1.5c9268a5946b7p+0, 0x1.c4b1b816986a2p-60 },
+    { 0x1.5e76f15ad2148p+0, 0x1.ba6f93080e65ep-54 },
+    { 0x1.605e1b976dc09p+0, -0x1.3e2429b56de47p-54 },
+    { 0x1.6247eb03a5585p+0, -0x1.383c17e40b497p-54 },
+    { 0x1.6434634ccc320p+0, -0x1.c483c759d8933p-55 },
+    { 0x1.6623882552225p+0, -0x1.bb60987591c34p-54 },
+    { 0x1.68155d44ca973p+0, 0x1.038ae44f73e65p-57 },
+    { 0x1.6a09e667f3bcdp+0, -0x1.bdd3413b26456p-54 },
+    { 0x1.6c012750bdabfp+0, -0x1.2895667ff0b0dp-56 },
+    { 0x1.6dfb23c651a2fp+0, -0x1.bbe3a683c88abp-57 },
+    { 0x1.6ff7df9519484p+0, -0x1.83c0f25860ef6p-55 },
+    { 0x1.71f75e8ec5f74p+0, -0x1.16e4786887a99p-55 },
+    { 0x1.73f9a48a58174p+0, -0x1.0a8d96c65d53cp-54 },
+    { 0x1.75feb564267c9p+0, -0x1.0245957316dd3p-54 },
+    { 0x1.780694fde5d3fp+0, 0x1.866b80a02162dp-54 },
+    { 0x1.7a11473eb0187p+0, -0x1.41577ee04992fp-55 },
+    { 0x1.7c1ed0130c132p+0, 0x1.f124cd1164dd6p-54 },
+    { 0x1.7e2f336cf4e62p+0, 0x1.05d02ba15797ep-56 },
+    { 0x1.80427543e1a12p+0, -0x1.27c86626d972bp-54 },
+    { 0x1.82589994cce13p+0, -0x1.d4c1dd41532d8p-54 },
+    { 0x1.8471a4623c7adp+0, -0x1.8d684a341cdfbp-55 },
+    { 0x1.868d99b4492edp+0, -0x1.fc6f89bd4f6bap-54 },
+    { 0x1.88ac7d98a6699p+0, 0x1.994c2f37cb53ap-54 },
+    { 0x1.8ace5422aa0dbp+0, 0x1.6e9f156864b27p-54 },
+    { 0x1.8cf3216b5448cp+0, -0x1.0d55e32e9e3aap-56 },
+    { 0x1.8f1ae99157736p+0, 0x1.5cc13a2e3976cp-55 },
+    { 0x1.9145b0b91ffc6p+0, -0x1.dd6792e582524p-54 },
+    { 0x1.93737b0cdc5e5p+0, -0x1.75fc781b57ebcp-57 },
+    { 0x1.95a44cbc8520fp+0, -0x1.64b7c96a5f039p-56 },
+    { 0x1.97d829fde4e50p+0, -0x1.d185b7c1b85d1p-54 },
+    { 0x1.9a0f170ca07bap+0, -0x1.173bd91cee632p-54 },
+    { 0x1.9c49182a3f090p+0, 0x1.c7c46b071f2bep-56 },
+    { 0x1.9e86319e32323p+0, 0x1.824ca78e64c6ep-56 },
+    { 0x1.a0c667b5de565p+0, -0x1.359495d1cd533p-54 },
+    { 0x1.a309bec4a2d33p+0, 0x1.6305c7ddc36abp-54 },
+    { 0x1.a5503b23e255dp+0, -0x1.d2f6edb8d41e1p-54 },
+    { 0x1.a799e1330b358p+0, 0x1.bcb7ecac563c7p-54 },
+    { 0x1.a9e6b5579fdbfp+0, 0x1.0fac90ef7fd31p-54 },
+    { 0x1.ac36bbfd3f37ap+0, -0x1.f9234cae76cd0p-55 },
+    { 0x1.ae89f995ad3adp+0, 0x1.7a1cd345dcc81p-54 },
+    { 0x1.b0e07298db666p+0, -0x1.bdef54c80e425p-54 },
+    { 0x1.b33a2b84f15fbp+0, -0x1.2805e3084d708p-57 },
+    { 0x1.b59728de5593ap+0, -0x1.c71dfbbba6de3p-54 },
+    { 0x1.b7f76f2fb5e47p+0, -0x1.5584f7e54ac3bp-56 },
+    { 0x1.ba5b030a1064ap+0, -0x1.efcd30e54292ep-54 },
+    { 0x1.bcc1e904bc1d2p+0, 0x1.23dd07a2d9e84p-55 },
+    { 0x1.bf2c25bd71e09p+0, -0x1.efdca3f6b9c73p-54 },
+    { 0x1.c199bdd85529cp+0, 0x1.11065895048ddp-55 },
+    { 0x1.c40ab5fffd07ap+0, 0x1.b4537e083c60ap-54 },
+    { 0x1.c67f12e57d14bp+0, 0x1.2884dff483cadp-54 },
+    { 0x1.c8f6d9406e7b5p+0, 0x1.1acbc48805c44p-56 },
+    { 0x1.cb720dcef9069p+0, 0x1.503cbd1e949dbp-56 },
+    { 0x1.cdf0b555dc3fap+0, -0x1.dd83b53829d72p-55 },
+    { 0x1.d072d4a07897cp+0, -0x1.cbc3743797a9cp-54 },
+    { 0x1.d2f87080d89f2p+0, -0x1.d487b719d8578p-54 },
+    { 0x1.d5818dcfba487p+0, 0x1.2ed02d75b3707p-55 },
+    { 0x1.d80e316c98398p+0, -0x1.11ec18beddfe8p-54 },
+    { 0x1.da9e603db3285p+0, 0x1.c2300696db532p-54 },
+    { 0x1.dd321f301b460p+0, 0x1.2da5778f018c3p-54 },
+    { 0x1.dfc97337b9b5fp+0, -0x1.1a5cd4f184b5cp-54 },
+    { 0x1.e264614f5a129p+0, -0x1.7b627817a1496p-54 },
+    { 0x1.e502ee78b3ff6p+0, 0x1.39e8980a9cc8fp-55 },
+    { 0x1.e7a51fbc74c83p+0, 0x1.2d522ca0c8de2p-54 },
+    { 0x1.ea4afa2a490dap+0, -0x1.e9c23179c2893p-54 },
+    { 0x1.ecf482d8e67f1p+0, -0x1.c93f3b411ad8cp-54 },
+    { 0x1.efa1bee615a27p+0, 0x1.dc7f486a4b6b0p-54 },
+    { 0x1.f252b376bba97p+0, 0x1.3a1a5bf0d8e43p-54 },
+    { 0x1.f50765b6e4540p+0, 0x1.9d3e12dd8a18bp-54 },
+    { 0x1.f7bfdad9cbe14p+0, -0x1.dbb12d006350ap-54 },
+    { 0x1.fa7c1819e90d8p+0, 0x1.74853f3a5931ep-55 },
+    { 0x1.fd3c22b8f71f1p+0, 0x1.2eb74966579e7p-57 },
+};
+
+static const double math_inv_ln2_n = 0x1.71547652b82fep+7;         /* 128 / ln2 */
+static const double math_ln2_n_hi = 0x1.62e42fef80000p-8;          /* ln2 / 128 */
+static const double math_ln2_n_lo = 0x1.1cf79abc9e3b4p-43;
+
+/* Finite range of exp */
+#define MATH_EXP_MAX    0x1.62e42fefa39efp+9        /* ln(DBL_MAX) */
+#define MATH_EXP_MIN    (-0x1.74910d52d3051p+9)     /* ln of the least subnormal */
+
+/**
+ * Split e^(x + xl) into 2^k * (t + tail)
+ * x must be within the finite range; xl is a small correction.
+ */
+static inline void math_exp_parts(double x, double xl, int *k, double *t, double *tail)
+{
+    double kd = x * math_inv_ln2_n + MATH_ROUND_SHIFT;
+    kd -= MATH_ROUND_SHIFT;
+    int64_t n = (int64_t)kd;
+
+    /* kd * ln2_n_hi is exact, so r loses nothing to cancellation */
+    double r = (x - kd * math_ln2_n_hi) - kd * math_ln2_n_lo + xl;
+    double r2 = r * r;
+    double p = r + r2 * (0.5 + r * (1.0 / 6)) + r2 * r2 * (1.0 / 24 + r * (1.0 / 120));
+
+    *t = math_exp_table[n & (MATH_EXP_N - 1)].hi;
+    *tail = math_exp_table[n & (MATH_EXP_N - 1)].lo + *t * p;
+    *k = (int)(n >> MATH_EXP_BITS);
+}
+
+static inline double math_exp_core(double x, double xl)
+{
+    int k;
+    double t, tail;
+
+    math_exp_parts(x, xl, &k, &t, &tail);
+    if (k > -1022 && k < 1023) {
+        return (t + tail) * math_pow2(k);
+    }
+    return ldexp(t + tail, k);
+}
+
+double exp(double x)
+{
+    if (!(x <= MATH_EXP_MAX)) {
+        return x + INFINITY;            /* Overflow, or NaN */
+    }
+    if (x < MATH_EXP_MIN) {
+        return 0.0;
+    }
+    return math_exp_core(x, 0.0);
+}
+
+/**
+ * e^x - 1 for x <= 64, accurate near 0
+ * As exp, but carrying r and 2^(j/128) * r exactly: 2^(j/128) - 1 cancels
+ * most of the result when x is small.
+ */
+static double math_expm1(double x)
+{
+    if (x < -40.0) {
+        return -1.0;
+    }
+    if (fabs(x) < 0x1p-54) {
+        return x;
+    }
+
+    double kd = x * math_inv_ln2_n + MATH_ROUND_SHIFT;
+    kd -= MATH_ROUND_SHIFT;
+    int64_t n = (int64_t)kd;
+    double r, rl;
+    math_two_sum(x - kd * math_ln2_n_hi, -kd * math_ln2_n_lo, &r, &rl);
+
+    /* The result can be as small as r, so two more terms than exp */
+    double r2 = r * r;
+    double q = r2 * (0.5 + r * (1.0 / 6)) + r2 * r2 * ((1.0 / 24 + r * (1.0 / 120)) +
+                                                      r2 * (1.0 / 720 + r * (1.0 / 5040))) + rl;
+
+    /* e^x = 2^k * (t + t r + t q), with t = th + tl */
+    double th = math_exp_table[n & (MATH_EXP_N - 1)].hi;
+    double tl = math_exp_table[n & (MATH_EXP_N - 1)].lo;
+    double ph, pl;
+    math_two_prod(th, r, &ph, &pl);
+    double low = pl + th * q + tl * (1.0 + r);
+
+    double scale = math_pow2((int)(n >> MATH_EXP_BITS));
+    double s, e, s2, e2;
+    math_two_sum(scale * th, -1.0, &s, &e);
+    math_two_sum(s, scale * ph, &s2, &e2);
+    return s2 + (e + e2 + scale * low);
+}
+
+/*
+ * Logarithm
+ */
+
+#define MATH_LOG_BITS   7
+
+/*
+ * c ~ 1/m for the m selected by the top 7 significand bits, and -log c
+ * as hi + lo. Entries 0-63 cover m in [1, 1.5) and 64-127 cover m/2 in
+ * [0.75, 1); the two next to m = 1 use c = 1 so log stays accurate to
+ * the last bit near 1.
+ */
+static const struct {
+    double c, logc_hi, logc_lo;
+} math_log_table[1 << MATH_LOG_BITS] = {
+    { 0x1.0000000000000p+0, 0.0, 0.0 },
+    { 0x1.fa11caa01fa12p-1, 0x1.7dc475f810a69p-7, 0x1.74944bc161072p-61 },
+    { 0x1.f6310aca0dbb5p-1, 0x1.3cea44346a584p-6, -0x1.865ad48159d00p-61 },
+    { 0x1.f25f644230ab5p-1, 0x1.b9fc027af919ap-6, -0x1.90ae69229dc86p-60 },
+    { 0x1.ee9c7f8458e02p-1, 0x1.1b0d98923d97fp-5, -0x1.74d7444dd6241p-59 },
+    { 0x1.eae807aba01ebp-1, 0x1.58a5bafc8e4d3p-5, -0x1.cab8569c56e40p-64 },
+    { 0x1.e741aa59750e4p-1, 0x1.95c830ec8e3f2p-5, 0x1.eb41d00a417e9p-60 },
+    { 0x1.e3a9179dc1a73p-1, 0x1.d276b8adb0b56p-5, 0x1.078f14c95ff53p-59 },
+    { 0x1.e01e01e01e01ep-1, 0x1.075983598e471p-4, 0x1.006d2999e22dcp-58 },
+    { 0x1.dca01dca01dcap-1, 0x1.253f62f0a1417p-4, 0x1.1f6d34e01d981p-61 },
+    { 0x1.d92f2231e7f8ap-1, 0x1.42edcbea646eep-4, -0x1.511583653349bp-58 },
+    { 0x1.d5cac807572b2p-1, 0x1.60658a93750c4p-4, -0x1.f108b1d8436d3p-59 },
+    { 0x1.d272ca3fc5b1ap-1, 0x1.7da766d7b12d0p-4, 0x1.a2240644d7da2p-59 },
+    { 0x1.cf26e5c44bfc6p-1, 0x1.9ab42462033aep-4, -0x1.a099e1c184e8ep-59 },
+    { 0x1.cbe6d9601cbe7p-1, 0x1.b78c82bb0eda0p-4, -0x1.3ef0e61f9b03cp-58 },
+    { 0x1.c8b265afb8a42p-1, 0x1.d4313d66cb35dp-4, 0x1.b90dd951d90fap-58 },
+    { 0x1.c5894d10d4986p-1, 0x1.f0a30c01162a4p-4, 0x1.8be64b8b7759bp-59 },
+    { 0x1.c26b5392ea01cp-1, 0x1.0671512ca596fp-3, -0x1.2f39b81479b67p-58 },
+    { 0x1.bf583ee868d8bp-1, 0x1.14785846742acp-3, 0x1.94409f1d3f83ap-60 },
+    { 0x1.bc4fd65883e7bp-1, 0x1.2266f190a5acdp-3, -0x1.dab840e7f6177p-57 },
+    { 0x1.b951e2b18ff23p-1, 0x1.303d718e47fd5p-3, -0x1.b5ae71f658247p-57 },
+    { 0x1.b65e2e3beee05p-1, 0x1.3dfc2b0ecc62ap-3, 0x1.ba62b8c13f7f4p-57 },
+    { 0x1.b37484ad806cep-1, 0x1.4ba36f39a55e5p-3, -0x1.f767e433c98aap-57 },
+    { 0x1.b094b31d922a4p-1, 0x1.59338d9982085p-3, 0x1.8d16eaaba9419p-57 },
+    { 0x1.adbe87f94905ep-1, 0x1.66acd4272ad51p-3, -0x1.9201c9c3d5165p-59 },
+    { 0x1.aaf1d2f87ebfdp-1, 0x1.740f8f54037a3p-3, 0x1.6d9bf9d57b326p-58 },
+    { 0x1.a82e65130e159p-1, 0x1.815c0a14357e9p-3, 0x1.141b7f8c5fa9ep-58 },
+    { 0x1.a574107688a4ap-1, 0x1.8e928de886d41p-3, 0x1.2589eb96a6240p-59 },
+    { 0x1.a2c2a87c51ca0p-1, 0x1.9bb362e7dfb85p-3, -0x1.51439c1ff83e7p-58 },
+    { 0x1.a01a01a01a01ap-1, 0x1.a8becfc882f19p-3, -0x1.a8c37918c39ebp-58 },
+    { 0x1.9d79f176b682dp-1, 0x1.b5b519e8fb5a6p-3, -0x1.d5d8023e61e5fp-57 },
+    { 0x1.9ae24ea5510dap-1, 0x1.c2968558c18c2p-3, 0x1.6108e3ae024acp-60 },
+    { 0x1.9852f0d8ec0ffp-1, 0x1.cf6354e09c5ddp-3, 0x1.339a07d55b696p-57 },
+    { 0x1.95cbb0be377aep-1, 0x1.dc1bca0abec7bp-3, 0x1.c698a33316dfbp-58 },
+    { 0x1.934c67f9b2ce6p-1, 0x1.e8c0252aa5a60p-3, -0x1.dc074737f9135p-60 },
+    { 0x1.90d4f120190d5p-1, 0x1.f550a564b7b37p-3, -0x1.13a09202fe73dp-57 },
+    { 0x1.8e6527af1373fp-1, 0x1.00e6c45ad501dp-2, -0x1.3b9568ff6feadp-57 },
+    { 0x1.8bfce8062ff3ap-1, 0x1.071b85fcd590dp-2, 0x1.08b83fcbdef40p-57 },
+    { 0x1.899c0f601899cp-1, 0x1.0d46b579ab74bp-2, 0x1.21f640e1e5ec9p-56 },
+    { 0x1.87427bcc092b9p-1, 0x1.136870293a8b0p-2, 0x1.86cc531dba494p-57 },
+    { 0x1.84f00c2780614p-1, 0x1.1980d2dd4236fp-2, -0x1.02c2e4f1b2eb9p-56 },
+    { 0x1.82a4a0182a4a0p-1, 0x1.1f8ff9e48a2f3p-2, -0x1.93fbf3418960dp-57 },
+    { 0x1.8060180601806p-1, 0x1.2596010df763ap-2, -0x1.9eed8ae0ebd3cp-59 },
+    { 0x1.7e225515a4f1dp-1, 0x1.2b9303ab89d25p-2, -0x1.85ad7f614ab51p-58 },
+    { 0x1.7beb3922e017cp-1, 0x1.31871c9544185p-2, -0x1.ea3598981366fp-57 },
+    { 0x1.79baa6bb6398bp-1, 0x1.3772662bfd85cp-2, 0x1.02a7589fba088p-57 },
+    { 0x1.77908119ac60dp-1, 0x1.3d54fa5c1f710p-2, 0x1.53668e578d9cdp-58 },
+    { 0x1.756cac201756dp-1, 0x1.432ef2a04e813p-2, -0x1.83262e2b59206p-57 },
+    { 0x1.734f0c541fe8dp-1, 0x1.49006804009d0p-2, -0x1.bff0d07c5df6dp-59 },
+    { 0x1.713786d9c7c09p-1, 0x1.4ec9732600269p-2, -0x1.1aa87d977dc5ep-56 },
+    { 0x1.6f26016f26017p-1, 0x1.548a2c3add263p-2, -0x1.58ce7bf1846eep-56 },
+    { 0x1.6d1a62681c861p-1, 0x1.5a42ab0f4cfe2p-2, -0x1.c6bcb7dee9a3dp-56 },
+    { 0x1.6b1490aa31a3dp-1, 0x1.5ff3070a793d4p-2, -0x1.063077d7e37b7p-56 },
+    { 0x1.691473a88d0c0p-1, 0x1.659b57303e1f2p-2, 0x1.db0af8efb83c7p-62 },
+    { 0x1.6719f3601671ap-1, 0x1.6b3bb2235943dp-2, 0x1.957a93326784dp-56 },
+    { 0x1.6524f853b4aa3p-1, 0x1.70d42e2789236p-2, 0x1.ee99bf7143954p-56 },
+    { 0x1.63356b88ac0dep-1, 0x1.7664e1239dbcfp-2, -0x1.d6d5d64f5daf8p-57 },
+    { 0x1.614b36831ae94p-1, 0x1.7bede0a37afbfp-2, -0x1.6783cb9801a5bp-56 },
+    { 0x1.5f66434292dfcp-1, 0x1.816f41da0d495p-2, 0x1.76dc35fb48fe4p-56 },
+    { 0x1.5d867c3ece2a5p-1, 0x1.86e919a330ba1p-2, -0x1.700c9d2029045p-56 },
+    { 0x1.5babcc647fa91p-1, 0x1.8c5b7c858b48bp-2, 0x1.d754b0205fa6cp-56 },
+    { 0x1.59d61f123ccaap-1, 0x1.91c67eb45a83ep-2, 0x1.5e3ea3b96a3dfp-57 },
+    { 0x1.5805601580560p-1, 0x1.972a341135159p-2, -0x1.5a3f62db48f27p-56 },
+    { 0x1.56397ba7c52e2p-1, 0x1.9c86b02dc0862p-2, 0x1.7e81149622bdfp-56 },
+    { 0x1.54725e6bb82fep+0, -0x1.23ec5991eba49p-2, -0x1.76eba35bbf0dfp-61 },
+    { 0x1.52aff56a8054bp+0, -0x1.1e9e1678899f5p-2, -0x1.64b0dd2687939p-58 },
+    { 0x1.50f22e111c4c5p+0, -0x1.1956d3b9bc2f9p-2, -0x1.0e75a3542856fp-58 },
+    { 0x1.4f38f62dd4c9bp+0, -0x1.14167ef367784p-2, -0x1.ef824daaf53e9p-56 },
+    { 0x1.4d843bedc2c4cp+0, -0x1.0edd060b78082p-2, -0x1.2d4b610d7d4f5p-57 },
+    { 0x1.4bd3edda68fe1p+0, -0x1.09aa572e6c6d4p-2, -0x1.f9e17343426a9p-56 },
+    { 0x1.4a27fad76014ap+0, -0x1.047e60cde83b7p-2, -0x1.08869cbf9e344p-56 },
+    { 0x1.4880522014880p+0, -0x1.feb2233ea07cbp-3, -0x1.8de00938b4c30p-61 },
+    { 0x1.46dce34596066p+0, -0x1.f474b134df228p-3, 0x1.9f1df7b5daab7p-60 },
+    { 0x1.453d9e2c776cap+0, -0x1.ea4449f04aaf5p-3, 0x1.f33919ab94074p-57 },
+    { 0x1.43a2730abee4dp+0, -0x1.e020cc6235ab5p-3, 0x1.f0adb91423f18p-57 },
+    { 0x1.420b5265e5951p+0, -0x1.d60a17f903514p-3, 0x1.50df841a71b7ap-57 },
+    { 0x1.40782d10e6566p+0, -0x1.cc000c9db3c52p-3, -0x1.67a2a8500729ep-58 },
+    { 0x1.3ee8f42a5af07p+0, -0x1.c2028ab17f9b5p-3, -0x1.c11aa3853a5f0p-57 },
+    { 0x1.3d5d991aa75c6p+0, -0x1.b811730b823d4p-3, 0x1.d7c46328983c6p-58 },
+    { 0x1.3bd60d9232955p+0, -0x1.ae2ca6f672bd8p-3, 0x1.a4a356155f779p-57 },
+    { 0x1.3a524387ac822p+0, -0x1.a454082e6ab03p-3, 0x1.e0df823a3cb3dp-58 },
+    { 0x1.38d22d366088ep+0, -0x1.9a8778debaa3ap-3, -0x1.28fbfb0e3f0fcp-58 },
+    { 0x1.3755bd1c945eep+0, -0x1.90c6db9fcbcdbp-3, 0x1.357718d7ca4cfp-58 },
+    { 0x1.35dce5f9f2af8p+0, -0x1.871213750e994p-3, 0x1.a97a0ca115d60p-57 },
+    { 0x1.34679ace01346p+0, -0x1.7d6903caf5acdp-3, 0x1.0b17c301d6e14p-57 },
+    { 0x1.32f5ced6a1dfap+0, -0x1.73cb9074fd14dp-3, 0x1.721a000b4cf01p-57 },
+    { 0x1.3187758e9ebb6p+0, -0x1.6a399dabbd383p-3, -0x1.76332bd4b341fp-57 },
+    { 0x1.301c82ac40260p+0, -0x1.60b3100b09474p-3, -0x1.526cee0fd7f4ap-57 },
+    { 0x1.2eb4ea1fed14bp+0, -0x1.5737cc9018cddp-3, 0x1.00b28ef013c72p-57 },
+    { 0x1.2d50a012d50a0p+0, -0x1.4dc7b897bc1c7p-3, -0x1.b60ae1ff0e82ep-59 },
+    { 0x1.2bef98e5a3711p+0, -0x1.4462b9dc9b3dcp-3, 0x1.85388d830c709p-59 },
+    { 0x1.2a91c92f3c105p+0, -0x1.3b08b6757f2a7p-3, -0x1.5e1ad9be0a4cdp-57 },
+    { 0x1.293725bb804a5p+0, -0x1.31b994d3a4f86p-3, 0x1.1238b5efe0665p-57 },
+    { 0x1.27dfa38a1ce4dp+0, -0x1.28753bc11aba2p-3, 0x1.7394d9fa33313p-57 },
+    { 0x1.268b37cd60127p+0, -0x1.1f3b925f25d44p-3, -0x1.08b27be4e6b15p-57 },
+    { 0x1.2539d7e9177b2p+0, -0x1.160c8024b27b0p-3, 0x1.355bfd870afebp-59 },
+    { 0x1.23eb79717605bp+0, -0x1.0ce7ecdccc28bp-3, -0x1.1b57fea88da98p-59 },
+    { 0x1.22a0122a0122ap+0, -0x1.03cdc0a51ec0dp-3, -0x1.19e2d3f8b7d10p-57 },
+    { 0x1.21579804855e6p+0, -0x1.f57bc7d9005dbp-4, 0x1.d361574fb24e2p-58 },
+    { 0x1.2012012012012p+0, -0x1.e3707ee30487bp-4, -0x1.9399d9aaf3b33p-59 },
+    { 0x1.1ecf43c7fb84cp+0, -0x1.d179788219362p-4, 0x1.b12841044a96cp-58 },
+    { 0x1.1d8f5672e4abdp+0, -0x1.bf968769fca18p-4, 0x1.06e4fb7af9c69p-58 },
+    { 0x1.1c522fc1ce059p+0, -0x1.adc77ee5aea8ep-4, -0x1.d7d8f39bee658p-58 },
+    { 0x1.1b17c67f2bae3p+0, -0x1.9c0c32d4d254dp-4, 0x1.627a0e199f569p-58 },
+    { 0x1.19e0119e0119ep+0, -0x1.8a6477a91dc29p-4, 0x1.3d4190a482421p-58 },
+    { 0x1.18ab083902bdbp+0, -0x1.78d02263d82d7p-4, -0x1.cbca5b4fdb87ep-58 },
+    { 0x1.1778a191bd684p+0, -0x1.674f089365a78p-4, -0x1.ca64e9980e048p-59 },
+    { 0x1.1648d50fc3201p+0, -0x1.55e10050e0382p-4, -0x1.9a0629e3973e4p-58 },
+    { 0x1.151b9a3fdd5c9p+0, -0x1.4485e03dbdfb0p-4, -0x1.3ba349aadbc6dp-58 },
+    { 0x1.13f0e8d344724p+0, -0x1.333d7f8183f4ap-4, 0x1.adaa06e211e9ep-59 },
+    { 0x1.12c8b89edc0acp+0, -0x1.2207b5c7854a1p-4, -0x1.b3f0431efb154p-58 },
+    { 0x1.11a3019a74826p+0, -0x1.10e45b3cae829p-4, -0x1.9b5ed72e6d974p-58 },
+    { 0x1.107fbbe011080p+0, -0x1.ffa6911ab9309p-5, 0x1.cd9f1f95c2ef1p-59 },
+    { 0x1.0f5edfab325a2p+0, -0x1.dda8adc67ee59p-5, 0x1.31936790bb3b2p-59 },
+    { 0x1.0e40655826011p+0, -0x1.bbcebfc68f424p-5, 0x1.cd1862f854848p-59 },
+    { 0x1.0d24456359e3ap+0, -0x1.9a187b573de81p-5, -0x1.b13b26f298a6ap-64 },
+    { 0x1.0c0a7868b4171p+0, -0x1.788595a3577c8p-5, -0x1.2f7c4c5b3c8bdp-62 },
+    { 0x1.0af2f722eecb5p+0, -0x1.5715c4c03cee1p-5, -0x1.5101dc4ebf91fp-59 },
+    { 0x1.09ddba6af8360p+0, -0x1.35c8bfaa13069p-5, 0x1.50830a65543a8p-63 },
+    { 0x1.08cabb37565e2p+0, -0x1.149e3e4005a8dp-5, 0x1.a9a4168fcebebp-60 },
+    { 0x1.07b9f29b8eae2p+0, -0x1.e72bf2813ce6ap-6, 0x1.8a4bba6a354fap-60 },
+    { 0x1.06ab59c7912fbp+0, -0x1.a55f548c5c427p-6, -0x1.f60d2fc36a0d9p-61 },
+    { 0x1.059eea0727586p+0, -0x1.63d6178690bbep-6, 0x1.18ed4d357c9dcp-60 },
+    { 0x1.04949cc1664c5p+0, -0x1.228fb1fea2e0ap-6, -0x1.3284991fe3d5cp-61 },
+    { 0x1.038c6b78247fcp+0, -0x1.c317384c75f0dp-7, -0x1.806208c04c21fp-61 },
+    { 0x1.02864fc7729e9p+0, -0x1.41929f968330cp-7, -0x1.3aae809b43dd0p-61 },
+    { 0x1.0182436517a37p+0, -0x1.8121214586b02p-8, 0x1.c7d68c0d910f2p-62 },
+    { 0x1.0000000000000p+0, 0.0, 0.0 },
+};
+
+/**
+ * log(x) as hi + lo for finite x > 0
+ */
+static void math_log_dd(double x, double *hi, double *lo)
+{
+    uint64_t u = math_bits(x);
+    int k = 0;
+
+    if (u < 0x0010000000000000ULL) {
+        u = math_bits(x * 0x1p54);      /* Subnormal */
+        k = -54;
+    }
+
+    uint32_t i = (uint32_t)(u >> (52 - MATH_LOG_BITS)) & ((1u << MATH_LOG_BITS) - 1);
+    uint64_t mu = (u & MATH_MANT_MASK) | 0x3FF0000000000000ULL;
+    k += (int)(u >> 52) - 1023;
+    if (i >= (1u << (MATH_LOG_BITS - 1))) {
+        mu -= 1ULL << 52;               /* m >= 1.5: use m/2 */
+        k++;
+    }
+
+    /* r = m * c - 1 exactly as rh + rl (m * c - 1 rounds exactly) */
+    double m = math_double(mu), p, pe, rh, rl;
+    math_two_prod(m, math_log_table[i].c, &p, &pe);
+    math_fast_two_sum(p - 1.0, pe, &rh, &rl);
+
+    /* log1p(r) = r - r^2/2 + r^3 (1/3 - r/4 + ... + r^6/9) */
+    double q, qe;
+    math_two_prod(rh, rh, &q, &qe);
+    double qh = 0.5 * q;
+    double ql = 0.5 * qe + rh * rl;
+    double r2 = rh * rh;
+    double tail = rh * q * ((1.0 / 3 - rh * (1.0 / 4)) + r2 * (1.0 / 5 - rh * (1.0 / 6)) +
+                            r2 * r2 * ((1.0 / 7 - rh * (1.0 / 8)) + r2 * (1.0 / 9)));
+
+    double kd = (double)k, s, se, s2, e2, s3, e3;
+    math_two_sum(kd * math_ln2_hi, math_log_table[i].logc_hi, &s, &se);
+    math_two_sum(s, rh, &s2, &e2);
+    math_two_sum(s2, -qh, &s3, &e3);
+
+    double low = se + e2 + e3 + kd * math_ln2_lo + math_log_table[i].logc_lo + rl - ql + tail;
+    math_fast_two_sum(s3, low, hi, lo);
+}
+
+/**
+ * Handle log of zero, negatives, infinity and NaN
+ * @return true if x was one of those, with the result in *result
+ */
+static bool math_log_special(double x, double *result)
+{
+    if (x > 0.0 && x < INFINITY) {
+        return false;
+    }
+    if (x == 0.0) {
+        *result = -INFINITY;
+    } else if (x < 0.0) {
+        *result = NAN;
+    } else {
+        *result = x + x;                /* +infinity or NaN */
+    }
+    return true;
+}
+
+double log(double x)
+{
+    double hi, lo;
+
+    if (math_log_special(x, &hi)) {
+        return hi;
+    }
+    math_log_dd(x, &hi, &lo);
+    return hi;
+}
+
+/**
+ * log(x) times a double-double constant
+ */
+static double math_log_scaled(double x, double c_hi, double c_lo)
+{
+    double hi, lo, p, pe;
+
+    if (math_log_special(x, &hi)) {
+        return hi;
+    }
+    math_log_dd(x, &hi, &lo);
+    math_two_prod(hi, c_hi, &p, &pe);
+    return p + (pe + hi * c_lo + lo * c_hi);
+}
+
+double log2(double x)
+{
+    return math_log_scaled(x, math_inv_ln2_hi, math_inv_ln2_lo);
+}
+
+double log10(double x)
+{
+    return math_log_scaled(x, math_inv_ln10_hi, math_inv_ln10_lo);
+}
+
+/*
+ * Power
+ */
+
+/**
+ * Classify y as an integer
+ * @return 0 if not an integer, 1 if odd, 2 if even
+ */
+static int math_integer_kind(double y)
+{
+    if (!isfinite(y)) {
+        return 0;
+    }
+    if (fabs(y) >= 0x1p53) {
+        return 2;
+    }
+    if (trunc(y) != y) {
+        return 0;
+    }
+    return ((int64_t)y & 1) ? 1 : 2;
+}
+
+double pow(double x, double y)
+{
+    if (y == 0.0 || x == 1.0) {
+        return 1.0;
+    }
+    if (isnan(x) || isnan(y)) {
+        return x + y;
+    }
+
+    int kind = math_integer_kind(y);
+    double ax = fabs(x);
+
+    if (isinf(y)) {
+        if (ax == 1.0) {
+            return 1.0;
+        }
+        return (ax < 1.0) == (y > 0.0) ? 0.0 : INFINITY;
+    }
+    if (x == 0.0 || isinf(x)) {
+        /* y > 0 gives 0 for x = 0 and infinity for x infinite */
+        double r = ((y > 0.0) == (x == 0.0)) ? 0.0 : INFINITY;
+        return (kind == 1) ? copysign(r, x) : r;
+    }
+
+    double sign = 1.0;
+    if (x < 0.0) {
+        if (kind == 0) {
+            return NAN;
+        }
+        if (kind == 1) {
+            sign = -1.0;
+        }
+    }
+    if (ax == 1.0) {
+        return sign;
+    }
+
+    /* |log x| >= 2^-53, so |y log x| is past the finite range */
+    if (fabs(y) >= 0x1p64) {
+        return (ax < 1.0) == (y > 0.0) ? 0.0 : INFINITY;
+    }
+
+    double lh, ll, yh, yl;
+    math_log_dd(ax, &lh, &ll);
+    math_two_prod(y, lh, &yh, &yl);
+    yl += y * ll;
+    math_fast_two_sum(yh, yl, &yh, &yl);
+
+    if (yh > MATH_EXP_MAX) {
+        return sign * INFINITY;
+    }
+    if (yh < MATH_EXP_MIN) {
+        return sign * 0.0;
+    }
+    return sign * math_exp_core(yh, yl);
+}
+
+/*
+ * Trigonometric Functions
+ */
+
+/* pi/2 in three 33-bit parts and a tail, 2/pi */
+static const double math_pio2_1 = 0x1.921fb54400000p+0;
+static const double math_pio2_2 = 0x1.0b4611a600000p-34;
+static const double math_pio2_3 = 0x1.3198a2e000000p-69;
+static const double math_pio2_3t = 0x1.b839a252049c1p-104;
+static const double math_inv_pio2 = 0x1.45f306dc9c883p-1;
+
+/* Below this n * pio2_k is exact (n < 2^20) */
+#define MATH_PIO2_MEDIUM    0x1.921fb54442d18p+20
+
+/* 2/pi, 64 bits per word from the binary point on */
+static const uint64_t math_two_over_pi[] = {
+    0xa2f9836e4e441529ULL,
+    0xfc2757d1f534ddc0ULL,
+    0xdb6295993c439041ULL,
+    0xfe5163abdebbc561ULL,
+    0xb7246e3a424dd2e0ULL,
+    0x06492eea09d1921cULL,
+    0xfe1deb1cb129a73eULL,
+    0xe88235f52ebb4484ULL,
+    0xe99c7026b45f7e41ULL,
+    0x3991d639835339f4ULL,
+    0x9c845f8bbdf9283bULL,
+    0x1ff897ffde05980fULL,
+    0xef2f118b5a0a6d1fULL,
+    0x6d367ecf27cb09b7ULL,
+    0x4f463f669e5fea2dULL,
+    0x7527bac7ebe5f17bULL,
+    0x3d0739f78a5292eaULL,
+    0x6bfb5fb11f8d5d08ULL,
+    0x56033046fc7b6babULL,
+    0xf0cfbc209af4361dULL,
+};
+
+/* fdlibm sin and cos kernels on [-pi/4, pi/4] */
+static const double math_s1 = -1.66666666666666324348e-01;
+static const double math_s2 = 8.33333333332248946124e-03;
+static const double math_s3 = -1.98412698298579493134e-04;
+static const double math_s4 = 2.75573137070700676789e-06;
+static const double math_s5 = -2.50507602534068634195e-08;
+static const double math_s6 = 1.58969099521155010221e-10;
+
+static const double math_c1 = 4.16666666666666019037e-02;
+static const double math_c2 = -1.38888888888741095749e-03;
+static const double math_c3 = 2.48015872894767294178e-05;
+static const double math_c4 = -2.75573143513906633035e-07;
+static const double math_c5 = 2.08757232129817482790e-09;
+static const double math_c6 = -1.13596475577881948265e-11;
+
+/**
+ * sin(x + y) for |x + y| <= pi/4, y a small tail of x
+ */
+static inline double math_sin_kernel(double x, double y)
+{
+    double z = x * x;
+    double w = z * z;
+    double r = math_s2 + z * (math_s3 + z * math_s4) + z * w * (math_s5 + z * math_s6);
+    double v = z * x;
+    return x - ((z * (0.5 * y - v * r) - y) - v * math_s1);
+}
+
+/**
+ * cos(x + y) for |x + y| <= pi/4, y a small tail of x
+ */
+static inline double math_cos_kernel(double x, double y)
+{
+    double z = x * x;
+    double w = z * z;
+    double r = z * (math_c1 + z * (math_c2 + z * math_c3)) +
+               w * w * (math_c4 + z * (math_c5 + z * math_c6));
+    double hz = 0.5 * z;
+    double one_hz = 1.0 - hz;
+    return one_hz + (((1.0 - one_hz) - hz) + (z * r - x * y));
+}
+
+/**
+ * Reduce a large argument modulo pi/2 with bits of 2/pi (Payne-Hanek)
+ */
+static int math_rem_pio2_large(double x, double *hi, double *lo)
+{
+    uint64_t u = math_bits(x);
+    int e = math_exponent(x) - 1075;            /* x = m * 2^e */
+    uint64_t m = (u & MATH_MANT_MASK) | (1ULL << 52);
+
+    /* Bits of 2/pi at 2^-i with i <= e - 2 only add multiples of 4 to
+     * x * 2/pi: skip the words made of those */
+    int w = e > 2 ? (e - 2) / 64 : 0;
+
+    /* m times 256 bits of 2/pi, least significant limb first */
+    uint64_t p[6];
+    unsigned __int128 acc = 0;
+    for (int i = 0; i < 4; i++) {
+        acc += (unsigned __int128)m * math_two_over_pi[w + 3 - i];
+        p[i] = (uint64_t)acc;
+        acc >>= 64;
+    }
+    p[4] = (uint64_t)acc;
+    p[5] = 0;
+
+    /* x * 2/pi = p / 2^shift (mod 4) */
+    int shift = 256 + 64 * w - e;
+    uint64_t limbs[3];
+    for (int i = 0; i < 3; i++) {
+        int pos = shift - 128 + 64 * i;
+        int q = pos / 64, b = pos % 64;
+        limbs[i] = b ? (p[q] >> b) | (p[q + 1] << (64 - b)) : p[q];
+    }
+
+    /* Fraction to the nearest integer, in [-1/2, 1/2) * 2^128 */
+    __int128 f = (__int128)(((unsigned __int128)limbs[1] << 64) | limbs[0]);
+    int n = (int)(limbs[2] & 3) + (f < 0);
+
+    unsigned __int128 a = f < 0 ? -(unsigned __int128)f : (unsigned __int128)f;
+    double fh = 0.0, fl = 0.0;
+    if (a != 0) {
+        int lz = (a >> 64) ? __builtin_clzll((uint64_t)(a >> 64))
+                           : 64 + __builtin_clzll((uint64_t)a);
+        a <<= lz;
+        fh = (double)(uint64_t)(a >> 75) * math_pow2(-53 - lz);
+        fl = (double)(uint64_t)((a << 53) >> 64) * math_pow2(-117 - lz);
+    }
+
+    /* r = fraction * pi/2 */
+    double rh, re;
+    math_two_prod(fh, math_pio2_hi, &rh, &re);
+    math_fast_two_sum(rh, re + fh * math_pio2_lo + fl * math_pio2_hi, &rh, &re);
+
+    if (f < 0) {
+        rh = -rh;
+        re = -re;
+    }
+    if (u & MATH_SIGN) {
+        *hi = -rh;
+        *lo = -re;
+        return -n;
+    }
+    *hi = rh;
+    *lo = re;
+    return n;
+}
+
+/**
+ * Reduce x to r = x - n pi/2 (as hi + lo), |r| <= ~pi/4
+ * @return n; only its low two bits matter
+ */
+static inline int math_rem_pio2(double x, double *hi, double *lo)
+{
+    if (!(fabs(x) < MATH_PIO2_MEDIUM)) {
+        return math_rem_pio2_large(x, hi, lo);
+    }
+
+    double fn = x * math_inv_pio2 + MATH_ROUND_SHIFT;
+    fn -= MATH_ROUND_SHIFT;
+
+    /* Each fn * pio2_k is exact and x - fn * pio2_1 cancels exactly */
+    double a = x - fn * math_pio2_1;
+    double s, e, s2, e2;
+    math_two_sum(a, -fn * math_pio2_2, &s, &e);
+    math_two_sum(s, -fn * math_pio2_3, &s2, &e2);
+    math_fast_two_sum(s2, (e + e2) - fn * math_pio2_3t, hi, lo);
+    return (int)fn;
+}
+
+/**
+ * sin and cos of x (finite, |x| > pi/4)
+ */
+static inline void math_sincos_reduced(double x, double *s, double *c)
+{
+    double hi, lo;
+    int n = math_rem_pio2(x, &hi, &lo);
+    double sr = math_sin_kernel(hi, lo);
+    double cr = math_cos_kernel(hi, lo);
+
+    switch (n & 3) {
+    case 0:
+        *s = sr;
+        *c = cr;
+        break;
+    case 1:
+        *s = cr;
+        *c = -sr;
+        break;
+    case 2:
+        *s = -sr;
+        *c = -cr;
+        break;
+    default:
+        *s = -cr;
+        *c = sr;
+        break;
+    }
+}
+
+static inline double math_sin_inline(double x)
+{
+    double hi, lo;
+    double ax = fabs(x);
+
+    if (ax <= M_PI_4) {
+        return ax < 0x1p-26 ? x : math_sin_kernel(x, 0.0);
+    }
+    if (!isfinite(x)) {
+        return x - x;
+    }
+
+    int n = math_rem_pio2(x, &hi, &lo);
+    switch (n & 3) {
+    case 0:
+        return math_sin_kernel(hi, lo);
+    case 1:
+        return math_cos_kernel(hi, lo);
+    case 2:
+        return -math_sin_kernel(hi, lo);
+    default:
+        return -math_cos_kernel(hi, lo);
+    }
+}
+
+static inline double math_cos_inline(double x)
+{
+    double hi, lo;
+    double ax = fabs(x);
+
+    if (ax <= M_PI_4) {
+        return ax < 0x1p-27 ? 1.0 : math_cos_kernel(x, 0.0);
+    }
+    if (!isfinite(x)) {
+        return x - x;
+    }
+
+    int n = math_rem_pio2(x, &hi, &lo);
+    switch (n & 3) {
+    case 0:
+        return math_cos_kernel(hi, lo);
+    case 1:
+        return -math_sin_kernel(hi, lo);
+    case 2:
+        return -math_cos_kernel(hi, lo);
+    default:
+        return math_sin_kernel(hi, lo);
+    }
+}
+
+double sin(double x)
+{
+    return math_sin_inline(x);
+}
+
+double cos(double x)
+{
+    return math_cos_inline(x);
+}
+
+void sincos(double x, double *s, double *c)
+{
+    double ax = fabs(x);
+
+    if (ax <= M_PI_4) {
+        *s = ax < 0x1p-26 ? x : math_sin_kernel(x, 0.0);
+        *c = ax < 0x1p-27 ? 1.0 : math_cos_kernel(x, 0.0);
+    } else if (!isfinite(x)) {
+        *s = *c = x - x;
+    } else {
+        math_sincos_reduced(x, s, c);
+    }
+}
+
+double tan(double x)
+{
+    double s, c;
+
+    if (fabs(x) < 0x1p-27) {
+        return x;
+    }
+    sincos(x, &s, &c);
+    return s / c;
+}
+
+/* atan(k/16) as hi + lo */
+static const struct {
+    double hi, lo;
+} math_atan_table[17] = {
+    { 0.0, 0.0 },
+    { 0x1.ff55bb72cfdeap-5, -0x1.c934d86d23f1dp-60 },
+    { 0x1.fd5ba9aac2f6ep-4, -0x1.cd37686760c17p-59 },
+    { 0x1.7b97b4bce5b02p-3, 0x1.347b0b4f881cap-58 },
+    { 0x1.f5b75f92c80ddp-3, 0x1.8ab6e3cf7afbdp-57 },
+    { 0x1.362773707ebccp-2, -0x1.963a544b672d8p-57 },
+    { 0x1.6f61941e4def1p-2, -0x1.c63aae6f6e918p-56 },
+    { 0x1.a64eec3cc23fdp-2, -0x1.24dec1b50b7ffp-56 },
+    { 0x1.dac670561bb4fp-2, 0x1.a2b7f222f65e2p-56 },
+    { 0x1.0657e94db30d0p-1, -0x1.d5b495f6349e6p-56 },
+    { 0x1.1e00babdefeb4p-1, -0x1.928df287a668fp-58 },
+    { 0x1.345f01cce37bbp-1, 0x1.1021137c71102p-55 },
+    { 0x1.4978fa3269ee1p-1, 0x1.2419a87f2a458p-56 },
+    { 0x1.5d58987169b18p-1, 0x1.0028e4bc5e7cap-57 },
+    { 0x1.700a7c5784634p-1, -0x1.8c34d25aadef6p-56 },
+    { 0x1.819d0b7158a4dp-1, -0x1.bf76229d3b917p-56 },
+    { 0x1.921fb54442d18p-1, 0x1.1a62633145c07p-55 },
+};
+
+/**
+ * atan(a) as hi + lo for a = ah + al in [0, 1]
+ */
+static void math_atan_unit(double ah, double al, double *hi, double *lo)
+{
+    int k = (int)(ah * 16.0 + 0.5);
+    double c = k * (1.0 / 16);
+
+    /* t = (a - c) / (1 + a c), |t| <= 1/32; ah - c is exact */
+    double num = ah - c;
+    double dh, dl, p, pe;
+    math_two_prod(ah, c, &p, &pe);
+    math_fast_two_sum(1.0, p, &dh, &dl);
+    dl += pe + al * c;
+
+    double th = (num + al) / dh;
+    math_two_prod(th, dh, &p, &pe);
+    double tl = ((((num - p) - pe) + al) - th * dl) / dh;
+
+    /* atan t = t + t^3 (-1/3 + t^2/5 - ... + t^10/13) */
+    double t2 = th * th;
+    double t4 = t2 * t2;
+    double poly = th * t2 * ((-1.0 / 3 + t2 * (1.0 / 5)) + t4 * (-1.0 / 7 + t2 * (1.0 / 9)) +
+                             t4 * t4 * (-1.0 / 11 + t2 * (1.0 / 13)));
+
+    double s, e;
+    math_two_sum(math_atan_table[k].hi, th, &s, &e);
+    math_fast_two_sum(s, e + math_atan_table[k].lo + tl + poly, hi, lo);
+}
+
+/**
+ * atan(a) as hi + lo for a = ah + al >= 0
+ */
+static void math_atan_dd(double ah, double al, double *hi, double *lo)
+{
+    if (ah <= 1.0) {
+        math_atan_unit(ah, al, hi, lo);
+        return;
+    }
+    if (ah > 0x1p60) {
+        *hi = math_pio2_hi;
+        *lo = math_pio2_lo - 1.0 / ah;
+        return;
+    }
+
+    /* pi/2 - atan(1/a), with 1/a as hi + lo */
+    double ih = 1.0 / ah, p, pe;
+    math_two_prod(ih, ah, &p, &pe);
+    double il = (((1.0 - p) - pe) - ih * al) * ih;
+
+    double rh, rl, s, e;
+    math_atan_unit(ih, il, &rh, &rl);
+    math_two_sum(math_pio2_hi, -rh, &s, &e);
+    math_fast_two_sum(s, e + math_pio2_lo - rl, hi, lo);
+}
+
+double atan(double x)
+{
+    double hi, lo;
+    double ax = fabs(x);
+
+    if (isnan(x)) {
+        return x + x;
+    }
+    if (ax < 0x1p-27) {
+        return x;
+    }
+    math_atan_dd(ax, 0.0, &hi, &lo);
+    return copysign(hi, x);
+}
+
+double atan2(double y, double x)
+{
+    double hi, lo;
+
+    if (isnan(x) || isnan(y)) {
+        return x + y;
+    }
+    if (y == 0.0) {
+        return signbit(x) ? copysign(M_PI, y) : y;
+    }
+    if (x == 0.0) {
+        return copysign(M_PI_2, y);
+    }
+    if (isinf(x)) {
+        if (isinf(y)) {
+            return copysign(x > 0.0 ? M_PI_4 : 3 * M_PI_4, y);
+        }
+        return x > 0.0 ? copysign(0.0, y) : copysign(M_PI, y);
+    }
+    if (isinf(y)) {
+        return copysign(M_PI_2, y);
+    }
+
+    double ax = fabs(x), ay = fabs(y);
+    int ex = math_exponent(ax), ey = math_exponent(ay);
+
+    if (ey - ex > 60) {
+        hi = math_pio2_hi;
+        lo = math_pio2_lo;
+    } else if (ex - ey > 60) {
+        hi = (x > 0.0) ? ay / ax : 0.0;
+        lo = 0.0;
+    } else {
+        /* Scale far from the ends of the range so the products below
+         * neither overflow nor lose bits */
+        if (ex > 0x7FF - 200 || ey > 0x7FF - 200) {
+            ax *= 0x1p-600;
+            ay *= 0x1p-600;
+        } else if (ex < 200 || ey < 200) {
+            ax *= 0x1p600;
+            ay *= 0x1p600;
+        }
+
+        double qh = ay / ax, p, pe;
+        math_two_prod(qh, ax, &p, &pe);
+        double ql = ((ay - p) - pe) / ax;
+        math_atan_dd(qh, ql, &hi, &lo);
+    }
+
+    if (x < 0.0) {
+        double s, e;
+        math_two_sum(math_pi_hi, -hi, &s, &e);
+        hi = s + (e + math_pi_lo - lo);
+    }
+    return copysign(hi, y);
+}
+
+/**
+ * asin(a) as hi + lo for a = ah + al in [0, 1]
+ * asin a = atan(a / sqrt(1 - a^2)), everything carried as hi + lo.
+ */
+static void math_asin_dd(double ah, double al, double *hi, double *lo)
+{
+    double p, pe, u, ue;
+    math_two_prod(ah, ah, &p, &pe);
+    pe += 2.0 * ah * al;
+    math_two_sum(1.0, -p, &u, &ue);
+    ue -= pe;
+
+    double dh = sqrt(u + ue);
+    if (dh == 0.0) {
+        *hi = math_pio2_hi;
+        *lo = math_pio2_lo;
+        return;
+    }
+    math_two_prod(dh, dh, &p, &pe);
+    double dl = (((u - p) - pe) + ue) / (2.0 * dh);
+
+    double qh = ah / dh;
+    math_two_prod(qh, dh, &p, &pe);
+    double ql = ((((ah - p) - pe) + al) - qh * dl) / dh;
+    math_atan_dd(qh, ql, hi, lo);
+}
+
+double asin(double x)
+{
+    double ax = fabs(x), hi, lo;
+
+    if (!(ax <= 1.0)) {
+        return (x - x) / (x - x);       /* NaN */
+    }
+    if (ax < 0x1p-26) {
+        return x;
+    }
+    math_asin_dd(ax, 0.0, &hi, &lo);
+    return copysign(hi, x);
+}
+
+double acos(double x)
+{
+    double hi, lo, s, e;
+
+    if (!(fabs(x) <= 1.0)) {
+        return (x - x) / (x - x);
+    }
+
+    if (fabs(x) <= 0.5) {
+        /* pi/2 - asin x */
+        math_asin_dd(fabs(x), 0.0, &hi, &lo);
+        if (x < 0.0) {
+            hi = -hi;
+            lo = -lo;
+        }
+        math_two_sum(math_pio2_hi, -hi, &s, &e);
+        return s + (e + math_pio2_lo - lo);
+    }
+
+    /* 2 asin(sqrt((1 - |x|) / 2)); 1 - |x| is exact here */
+    double z = 0.5 * (1.0 - fabs(x));
+    double rh = sqrt(z), rl = 0.0, p, pe;
+    if (rh > 0.0) {
+        math_two_prod(rh, rh, &p, &pe);
+        rl = ((z - p) - pe) / (2.0 * rh);
+    }
+    math_asin_dd(rh, rl, &hi, &lo);
+    if (x > 0.0) {
+        return 2.0 * hi;
+    }
+
+    /* pi - 2 asin(...) */
+    math_two_sum(math_pi_hi, -2.0 * hi, &s, &e);
+    return s + (e + math_pi_lo - 2.0 * lo);
+}
+
+/*
+ * Hyperbolic Functions
+ */
+
+/**
+ * e^x / 2 for x >= 2
+ * x - ln2_hi is exact there, so this rounds once, up to the end of the range.
+ */
+static double math_exp_half(double x)
+{
+    double y = x - math_ln2_hi;
+
+    if (!(y <= MATH_EXP_MAX)) {
+        return x + INFINITY;
+    }
+    return math_exp_core(y, -math_ln2_lo);
+}
+
+double sinh(double x)
+{
+    double ax = fabs(x);
+    double h = copysign(0.5, x);
+
+    if (isnan(x)) {
+        return x + x;
+    }
+    if (ax >= 22.0) {
+        return copysign(math_exp_half(ax), x);
+    }
+    if (ax < 0x1p-26) {
+        return x;
+    }
+
+    double t = math_expm1(ax);
+    if (ax < 1.0) {
+        return h * (2.0 * t - t * t / (t + 1.0));
+    }
+    return h * (t + t / (t + 1.0));
+}
+
+double cosh(double x)
+{
+    double ax = fabs(x);
+
+    if (isnan(x)) {
+        return x * x;
+    }
+    if (ax < 0.5 * M_LN2) {
+        double t = math_expm1(ax);
+        double w = 1.0 + t;
+        return 1.0 + (t * t) / (w + w);
+    }
+    if (ax < 22.0) {
+        double t = exp(ax);
+        return 0.5 * t + 0.5 / t;
+    }
+    return math_exp_half(ax);
+}
+
+double tanh(double x)
+{
+    double ax = fabs(x), z;
+
+    if (isnan(x)) {
+        return x + x;
+    }
+    if (ax > 22.0) {
+        return copysign(1.0, x);
+    }
+    if (ax < 0x1p-55) {
+        return x;
+    }
+
+    if (ax >= 1.0) {
+        z = 1.0 - 2.0 / (math_expm1(2.0 * ax) + 2.0);
+    } else {
+        double t = math_expm1(-2.0 * ax);
+        z = -t / (t + 2.0);
+    }
+    return copysign(z, x);
+}
+
+/*
+ * Single Precision
+ *
+ * Evaluated with the double kernels and rounded once at the end.
+ */
+
+float sinf(float x)
+{
+    return (float)math_sin_inline(x);
+}
+
+float cosf(float x)
+{
+    return (float)math_cos_inline(x);
+}
+
+void sincosf(float x, float *s, float *c)
+{
+    double sd, cd;
+    sincos(x, &sd, &cd);
+    *s = (float)sd;
+    *c = (float)cd;
+}
+
+#define MATH_EXPF_MAX   0x1.62e42ep+6       /* Largest x with finite expf(x) */
+#define MATH_EXPF_MIN   (-0x1.9fe368p+6)    /* Below this expf(x) rounds to 0 */
+
+static inline float math_expf_inline(float x)
+{
+    if (!(x <= MATH_EXPF_MAX)) {
+        return x + (float)INFINITY;
+    }
+    if (x < MATH_EXPF_MIN) {
+        return 0.0f;
+    }
+
+    /* As exp, but 2^(j/128) to double precision and a cubic for e^r
+     * are plenty for float */
+    double xd = x;
+    double kd = xd * math_inv_ln2_n + MATH_ROUND_SHIFT;
+    kd -= MATH_ROUND_SHIFT;
+    int64_t n = (int64_t)kd;
+    double r = (xd - kd * math_ln2_n_hi) - kd * math_ln2_n_lo;
+    double p = r + r * r * (0.5 + r * (1.0 / 6));
+    double t = math_exp_table[n & (MATH_EXP_N - 1)].hi;
+    return (float)((t + t * p) * math_pow2((int)(n >> MATH_EXP_BITS)));
+}
+
+float expf(float x)
+{
+    return math_expf_inline(x);
+}
+
+float logf(float x)
+{
+    return (float)log(x);
+}
+
+/*
+ * Array Functions
+ */
+
+void sin_array(double *out, const double *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = math_sin_inline(in[i]);
+    }
+}
+
+void cos_array(double *out, const double *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = math_cos_inline(in[i]);
+    }
+}
+
+void exp_array(double *out, const double *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        double x = in[i];
+        if (x <= MATH_EXP_MAX && x >= -708.0) {
+            out[i] = math_exp_core(x, 0.0);
+        } else {
+            out[i] = exp(x);
+        }
+    }
+}
+
+void log_array(double *out, const double *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        double hi, lo;
+        if (math_log_special(in[i], &hi)) {
+            out[i] = hi;
+        } else {
+            math_log_dd(in[i], &hi, &lo);
+            out[i] = hi;
+        }
+    }
+}
+
+void sinf_array(float *out, const float *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (float)math_sin_inline(in[i]);
+    }
+}
+
+void expf_array(float *out, const float *in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = math_expf_inline(in[i]);
+    }
+}
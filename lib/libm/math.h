@@ -1,11 +1,13 @@
 /**
  * AAAos Math Library - math.h
  *
- * This header provides standard mathematical functions for use in the kernel
- * and userspace applications. All functions are implemented in software
- * floating-point for portability (no FPU required).
+ * This header provides standard mathematical functions for userspace
+ * applications. They compute with SSE2 double arithmetic, so they cannot be
+ * called from the kernel, which is built with -mno-sse.
  *
- * Implements IEEE 754 double-precision floating-point operations.
+ * Implements IEEE 754 double-precision floating-point operations. The
+ * error bounds given below are in units in the last place (ulp) of the
+ * result, in round-to-nearest mode; 0.5 ulp is correctly rounded.
  */
 
 #ifndef _AAAOS_MATH_H
@@ -128,7 +130,7 @@ double trunc(double x);
  * sqrt - Compute square root
  * @x: Input value (must be non-negative)
  *
- * Returns the non-negative square root of x.
+ * Returns the non-negative square root of x, correctly rounded.
  * Returns NaN if x < 0.
  */
 double sqrt(double x);
@@ -138,7 +140,8 @@ double sqrt(double x);
  * @x: Base
  * @y: Exponent
  *
- * Returns x raised to the power y (x^y).
+ * Returns x raised to the power y (x^y), within 0.52 ulp.
+ * Special cases follow C99 (pow(x, 0) and pow(1, y) are 1, even for NaN).
  */
 double pow(double x, double y);
 
@@ -146,7 +149,8 @@ double pow(double x, double y);
  * exp - Compute exponential function
  * @x: Exponent
  *
- * Returns e^x, where e is Euler's number.
+ * Returns e^x, where e is Euler's number, within 0.52 ulp (1 ulp when
+ * the result is subnormal).
  */
 double exp(double x);
 
@@ -154,7 +158,7 @@ double exp(double x);
  * log - Compute natural logarithm
  * @x: Input value (must be positive)
  *
- * Returns ln(x), the natural logarithm of x.
+ * Returns ln(x), the natural logarithm of x, within 0.51 ulp.
  * Returns -INFINITY if x is 0, NaN if x < 0.
  */
 double log(double x);
@@ -163,7 +167,7 @@ double log(double x);
  * log10 - Compute base-10 logarithm
  * @x: Input value (must be positive)
  *
- * Returns log10(x), the base-10 logarithm of x.
+ * Returns log10(x), the base-10 logarithm of x, within 0.51 ulp.
  */
 double log10(double x);
 
@@ -171,7 +175,7 @@ double log10(double x);
  * log2 - Compute base-2 logarithm
  * @x: Input value (must be positive)
  *
- * Returns log2(x), the base-2 logarithm of x.
+ * Returns log2(x), the base-2 logarithm of x, within 0.51 ulp.
  */
 double log2(double x);
 
@@ -183,7 +187,7 @@ double log2(double x);
  * sin - Compute sine
  * @x: Angle in radians
  *
- * Returns the sine of x.
+ * Returns the sine of x, within 0.8 ulp for any finite x.
  */
 double sin(double x);
 
@@ -191,15 +195,25 @@ double sin(double x);
  * cos - Compute cosine
  * @x: Angle in radians
  *
- * Returns the cosine of x.
+ * Returns the cosine of x, within 0.8 ulp for any finite x.
  */
 double cos(double x);
 
+/**
+ * sincos - Compute sine and cosine together
+ * @x: Angle in radians
+ * @s: Set to the sine of x
+ * @c: Set to the cosine of x
+ *
+ * Reduces x once for both; each result is within 0.8 ulp.
+ */
+void sincos(double x, double *s, double *c);
+
 /**
  * tan - Compute tangent
  * @x: Angle in radians
  *
- * Returns the tangent of x.
+ * Returns the tangent of x, within 2.2 ulp.
  */
 double tan(double x);
 
@@ -207,7 +221,8 @@ double tan(double x);
  * asin - Compute arc sine
  * @x: Input value in range [-1, 1]
  *
- * Returns the arc sine of x in radians, in range [-pi/2, pi/2].
+ * Returns the arc sine of x in radians, in range [-pi/2, pi/2], within
+ * 0.51 ulp.
  * Returns NaN if |x| > 1.
  */
 double asin(double x);
@@ -216,7 +231,7 @@ double asin(double x);
  * acos - Compute arc cosine
  * @x: Input value in range [-1, 1]
  *
- * Returns the arc cosine of x in radians, in range [0, pi].
+ * Returns the arc cosine of x in radians, in range [0, pi], within 0.51 ulp.
  * Returns NaN if |x| > 1.
  */
 double acos(double x);
@@ -225,7 +240,8 @@ double acos(double x);
  * atan - Compute arc tangent
  * @x: Input value
  *
- * Returns the arc tangent of x in radians, in range [-pi/2, pi/2].
+ * Returns the arc tangent of x in radians, in range [-pi/2, pi/2], within
+ * 0.51 ulp.
  */
 double atan(double x);
 
@@ -235,7 +251,7 @@ double atan(double x);
  * @x: X coordinate
  *
  * Returns the arc tangent of y/x in radians, using the signs of both
- * arguments to determine the quadrant. Range is [-pi, pi].
+ * arguments to determine the quadrant. Range is [-pi, pi]; within 0.51 ulp.
  */
 double atan2(double y, double x);
 
@@ -247,7 +263,7 @@ double atan2(double y, double x);
  * sinh - Compute hyperbolic sine
  * @x: Input value
  *
- * Returns the hyperbolic sine of x: (e^x - e^(-x)) / 2.
+ * Returns the hyperbolic sine of x: (e^x - e^(-x)) / 2, within 2 ulp.
  */
 double sinh(double x);
 
@@ -255,7 +271,7 @@ double sinh(double x);
  * cosh - Compute hyperbolic cosine
  * @x: Input value
  *
- * Returns the hyperbolic cosine of x: (e^x + e^(-x)) / 2.
+ * Returns the hyperbolic cosine of x: (e^x + e^(-x)) / 2, within 1.1 ulp.
  */
 double cosh(double x);
 
@@ -263,10 +279,65 @@ double cosh(double x);
  * tanh - Compute hyperbolic tangent
  * @x: Input value
  *
- * Returns the hyperbolic tangent of x: sinh(x) / cosh(x).
+ * Returns the hyperbolic tangent of x: sinh(x) / cosh(x), within 2.5 ulp.
  */
 double tanh(double x);
 
+/*
+ * Single Precision Functions
+ *
+ * Computed in double precision and rounded once, so all of these are
+ * within 0.51 ulp of the float result.
+ */
+
+/**
+ * sinf - Compute sine in single precision
+ * @x: Angle in radians
+ */
+float sinf(float x);
+
+/**
+ * cosf - Compute cosine in single precision
+ * @x: Angle in radians
+ */
+float cosf(float x);
+
+/**
+ * sincosf - Compute sine and cosine in single precision
+ * @x: Angle in radians
+ * @s: Set to the sine of x
+ * @c: Set to the cosine of x
+ */
+void sincosf(float x, float *s, float *c);
+
+/**
+ * expf - Compute exponential function in single precision
+ * @x: Exponent
+ */
+float expf(float x);
+
+/**
+ * logf - Compute natural logarithm in single precision
+ * @x: Input value (must be positive)
+ */
+float logf(float x);
+
+/*
+ * Array Functions
+ *
+ * Apply a function to n values: out[i] = f(in[i]). The results are
+ * exactly those of the scalar functions; the loops call the inlined
+ * kernels directly, which saves a call and the scalar entry checks on
+ * every element. out may be the same array as in.
+ */
+
+void sin_array(double *out, const double *in, size_t n);
+void cos_array(double *out, const double *in, size_t n);
+void exp_array(double *out, const double *in, size_t n);
+void log_array(double *out, const double *in, size_t n);
+void sinf_array(float *out, const float *in, size_t n);
+void expf_array(float *out, const float *in, size_t n);
+
 /*
  * Classification Functions
  */
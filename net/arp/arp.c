@@ -1,78 +1,148 @@
 /**
  * AAAos Network Stack - ARP Implementation
+ *
+ * arp_lock protects the cache and is taken with interrupts off, since the
+ * timer tick and received replies update it. Packets are sent (requests,
+ * and flushed pending packets) after dropping the lock where possible.
  */
 
 #include "arp.h"
 #include "../../kernel/include/serial.h"
 #include "../../lib/libc/string.h"
 #include "../ip/ip.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
 
-/* ARP cache */
+/* ARP cache: entries in use are on hash chains, the rest on a free list */
 static arp_entry_t arp_cache[ARP_CACHE_SIZE];
+static arp_entry_t *arp_hash[ARP_HASH_SIZE];
+static arp_entry_t *arp_free_list = NULL;
+static volatile int arp_lock = 0;
 static bool arp_initialized = false;
 
 /* Current time counter (incremented by timer) */
 static uint32_t arp_time = 0;
 
+/* Drives arp_timer_tick once per second */
+static ktimer_t arp_timer;
+
 /* Broadcast MAC address */
 static const uint8_t broadcast_mac[ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 static const uint8_t zero_mac[ETH_ALEN] = {0, 0, 0, 0, 0, 0};
 
 /* Forward declaration */
 static arp_entry_t *arp_cache_find(uint32_t ip);
-static arp_entry_t *arp_cache_alloc(void);
+static arp_entry_t *arp_cache_alloc(uint32_t ip);
+static void arp_cache_reset(void);
+
+static inline uint64_t arp_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&arp_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void arp_lock_release(uint64_t flags) {
+    __sync_lock_release(&arp_lock);
+    interrupts_restore(flags);
+}
+
+static inline uint32_t arp_bucket(uint32_t ip) {
+    uint32_t h = ip * 2654435761u;
+    return (h ^ (h >> 16)) & (ARP_HASH_SIZE - 1);
+}
+
+/**
+ * Free a chain of packets linked through next
+ */
+static void arp_free_chain(netbuf_t *buf) {
+    while (buf != NULL) {
+        netbuf_t *next = buf->next;
+        netbuf_free(buf);
+        buf = next;
+    }
+}
+
+/* Internal: timer callback */
+static void arp_timer_expired(void *arg) {
+    UNUSED(arg);
+    arp_timer_tick();
+}
 
 void arp_init(void) {
     /* Clear the cache */
-    memset(arp_cache, 0, sizeof(arp_cache));
+    arp_cache_reset();
     arp_time = 0;
     arp_initialized = true;
 
+    ktimer_init_soft(&arp_timer, arp_timer_expired, NULL);
+    ktimer_start(&arp_timer, NSEC_PER_SEC, NSEC_PER_SEC);
+
     kprintf("[ARP] Initialized with cache size %u\n", ARP_CACHE_SIZE);
 }
 
 int arp_lookup(uint32_t ip, uint8_t mac_out[ETH_ALEN]) {
+    return arp_resolve(ip, NULL, mac_out) == 0 ? 0 : -1;
+}
+
+int arp_resolve(uint32_t ip, netbuf_t *buf, uint8_t mac_out[ETH_ALEN]) {
     arp_entry_t *entry;
+    bool send_request = false;
+    int result = -1;
 
     if (!arp_initialized) {
         kprintf("[ARP] Error: Not initialized\n");
         return -1;
     }
 
+    uint64_t flags = arp_lock_acquire();
+
     /* Look for existing entry */
     entry = arp_cache_find(ip);
 
-    if (entry != NULL) {
-        if (entry->state == ARP_STATE_RESOLVED) {
-            /* Found it! */
-            eth_mac_copy(mac_out, entry->mac);
-            return 0;
-        } else if (entry->state == ARP_STATE_PENDING) {
-            /* Already waiting for this IP */
-            return -1;
-        }
+    if (entry != NULL && entry->state == ARP_STATE_RESOLVED) {
+        /* Found it! */
+        eth_mac_copy(mac_out, entry->mac);
+        entry->used = arp_time;
+        arp_lock_release(flags);
+        return 0;
     }
 
-    /* Not found - send ARP request */
-    kprintf("[ARP] Cache miss for %u.%u.%u.%u, sending request\n",
-            ip_octet(ip, 0), ip_octet(ip, 1),
-            ip_octet(ip, 2), ip_octet(ip, 3));
-
-    /* Create pending entry */
+    /* Missing or stale: start a request unless one is outstanding */
     if (entry == NULL) {
-        entry = arp_cache_alloc();
-        if (entry != NULL) {
-            entry->ip = ip;
-            entry->state = ARP_STATE_PENDING;
-            entry->timestamp = arp_time;
-            entry->retries = ARP_REQUEST_RETRIES;
+        entry = arp_cache_alloc(ip);
+    }
+    if (entry != NULL && entry->state != ARP_STATE_PENDING) {
+        entry->state = ARP_STATE_PENDING;
+        entry->timestamp = arp_time;
+        entry->retries = ARP_REQUEST_RETRIES;
+        send_request = true;
+    }
+
+    /* Park the packet on the entry until the reply */
+    if (entry != NULL && buf != NULL && entry->pending_count < ARP_PENDING_MAX) {
+        buf->next = NULL;
+        if (entry->pending_tail != NULL) {
+            entry->pending_tail->next = buf;
+        } else {
+            entry->pending = buf;
         }
+        entry->pending_tail = buf;
+        entry->pending_count++;
+        result = ARP_QUEUED;
     }
 
-    /* Send the request */
-    arp_request(ip);
+    arp_lock_release(flags);
 
-    return -1;  /* Not resolved yet */
+    if (send_request) {
+        kprintf("[ARP] Cache miss for %u.%u.%u.%u, sending request\n",
+                ip_octet(ip, 0), ip_octet(ip, 1),
+                ip_octet(ip, 2), ip_octet(ip, 3));
+        arp_request(ip);
+    }
+
+    return result;  /* Not resolved yet */
 }
 
 int arp_request(uint32_t ip) {
@@ -151,6 +221,71 @@ int arp_reply(uint32_t dest_ip, const uint8_t dest_mac[ETH_ALEN]) {
     return eth_send(dest_mac, ETH_TYPE_ARP, &pkt, sizeof(pkt));
 }
 
+/**
+ * Record ip -> mac and send the packets that were waiting for it
+ * @param create Add an entry if there is none
+ * @return 0 if the cache holds the mapping, negative otherwise
+ */
+static int arp_cache_update(uint32_t ip, const uint8_t mac[ETH_ALEN], bool create) {
+    arp_entry_t *entry;
+
+    if (!arp_initialized) {
+        return -1;
+    }
+
+    /* Don't cache zero MAC or broadcast */
+    if (memcmp(mac, zero_mac, ETH_ALEN) == 0 ||
+        memcmp(mac, broadcast_mac, ETH_ALEN) == 0) {
+        return -1;
+    }
+
+    uint64_t flags = arp_lock_acquire();
+
+    /* Look for existing entry, or allocate a new one */
+    entry = arp_cache_find(ip);
+    if (entry == NULL && create) {
+        entry = arp_cache_alloc(ip);
+    }
+    if (entry == NULL) {
+        arp_lock_release(flags);
+        if (create) {
+            kprintf("[ARP] Cache full, cannot add entry\n");
+        }
+        return -1;
+    }
+
+    /* Update entry */
+    eth_mac_copy(entry->mac, mac);
+    entry->state = ARP_STATE_RESOLVED;
+    entry->timestamp = arp_time;
+    entry->retries = 0;
+
+    /* Take the waiting packets */
+    netbuf_t *pending = entry->pending;
+    entry->pending = NULL;
+    entry->pending_tail = NULL;
+    entry->pending_count = 0;
+
+    arp_lock_release(flags);
+
+    kprintf("[ARP] Cache updated: %u.%u.%u.%u -> "
+            "%02x:%02x:%02x:%02x:%02x:%02x\n",
+            ip_octet(ip, 0), ip_octet(ip, 1),
+            ip_octet(ip, 2), ip_octet(ip, 3),
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    while (pending != NULL) {
+        netbuf_t *next = pending->next;
+        pending->next = NULL;
+        if (ip_output(pending, mac) != 0) {
+            netbuf_free(pending);
+        }
+        pending = next;
+    }
+
+    return 0;
+}
+
 int arp_receive(const void *packet, size_t len) {
     const arp_packet_t *pkt;
     uint16_t op;
@@ -190,12 +325,9 @@ int arp_receive(const void *packet, size_t len) {
             pkt->sha[0], pkt->sha[1], pkt->sha[2],
             pkt->sha[3], pkt->sha[4], pkt->sha[5]);
 
-    /* Update cache with sender's info (if we already have an entry) */
-    arp_entry_t *entry = arp_cache_find(spa);
-    if (entry != NULL || tpa == our_ip) {
-        /* Either we had an entry, or this is addressed to us */
-        arp_cache_add(spa, pkt->sha);
-    }
+    /* Update cache with sender's info (if we already have an entry, or
+     * this is addressed to us) */
+    arp_cache_update(spa, pkt->sha, tpa == our_ip);
 
     /* Handle based on operation */
     switch (op) {
@@ -226,58 +358,71 @@ int arp_receive(const void *packet, size_t len) {
 }
 
 int arp_cache_add(uint32_t ip, const uint8_t mac[ETH_ALEN]) {
-    arp_entry_t *entry;
-
-    if (!arp_initialized) {
-        return -1;
-    }
-
-    /* Don't cache zero MAC or broadcast */
-    if (memcmp(mac, zero_mac, ETH_ALEN) == 0 ||
-        memcmp(mac, broadcast_mac, ETH_ALEN) == 0) {
-        return -1;
-    }
-
-    /* Look for existing entry */
-    entry = arp_cache_find(ip);
+    return arp_cache_update(ip, mac, true);
+}
 
-    if (entry == NULL) {
-        /* Allocate new entry */
-        entry = arp_cache_alloc();
-        if (entry == NULL) {
-            kprintf("[ARP] Cache full, cannot add entry\n");
-            return -1;
+/**
+ * Unhash an entry and put it on the free list (arp_lock held)
+ * @return The packets that were waiting on it, for the caller to free
+ */
+static netbuf_t *arp_entry_release(arp_entry_t *e) {
+    for (arp_entry_t **pp = &arp_hash[arp_bucket(e->ip)]; *pp; pp = &(*pp)->hash_next) {
+        if (*pp == e) {
+            *pp = e->hash_next;
+            break;
         }
     }
 
-    /* Update entry */
-    entry->ip = ip;
-    eth_mac_copy(entry->mac, mac);
-    entry->state = ARP_STATE_RESOLVED;
-    entry->timestamp = arp_time;
-    entry->retries = 0;
-
-    kprintf("[ARP] Cache updated: %u.%u.%u.%u -> "
-            "%02x:%02x:%02x:%02x:%02x:%02x\n",
-            ip_octet(ip, 0), ip_octet(ip, 1),
-            ip_octet(ip, 2), ip_octet(ip, 3),
-            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-
-    return 0;
+    netbuf_t *pending = e->pending;
+    memset(e, 0, sizeof(*e));
+    e->hash_next = arp_free_list;
+    arp_free_list = e;
+    return pending;
 }
 
 void arp_cache_remove(uint32_t ip) {
+    uint64_t flags = arp_lock_acquire();
     arp_entry_t *entry = arp_cache_find(ip);
+    netbuf_t *pending = entry != NULL ? arp_entry_release(entry) : NULL;
+    arp_lock_release(flags);
+
     if (entry != NULL) {
-        entry->state = ARP_STATE_FREE;
+        arp_free_chain(pending);
         kprintf("[ARP] Removed cache entry for %u.%u.%u.%u\n",
                 ip_octet(ip, 0), ip_octet(ip, 1),
                 ip_octet(ip, 2), ip_octet(ip, 3));
     }
 }
 
-void arp_cache_clear(void) {
+/**
+ * Empty the cache: every entry on the free list, no packets held
+ */
+static void arp_cache_reset(void) {
+    uint64_t flags = arp_lock_acquire();
+
+    netbuf_t *pending = NULL;
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        netbuf_t *tail = arp_cache[i].pending_tail;
+        if (tail != NULL) {
+            tail->next = pending;
+            pending = arp_cache[i].pending;
+        }
+    }
+
     memset(arp_cache, 0, sizeof(arp_cache));
+    memset(arp_hash, 0, sizeof(arp_hash));
+    arp_free_list = NULL;
+    for (int i = ARP_CACHE_SIZE - 1; i >= 0; i--) {
+        arp_cache[i].hash_next = arp_free_list;
+        arp_free_list = &arp_cache[i];
+    }
+
+    arp_lock_release(flags);
+    arp_free_chain(pending);
+}
+
+void arp_cache_clear(void) {
+    arp_cache_reset();
     kprintf("[ARP] Cache cleared\n");
 }
 
@@ -293,51 +438,71 @@ void arp_cache_dump(void) {
                 case ARP_STATE_STALE:    state_str = "STALE"; break;
                 default:                 state_str = "UNKNOWN"; break;
             }
-            kprintf("  %u.%u.%u.%u -> %02x:%02x:%02x:%02x:%02x:%02x [%s]\n",
+            kprintf("  %u.%u.%u.%u -> %02x:%02x:%02x:%02x:%02x:%02x [%s]",
                     ip_octet(e->ip, 0), ip_octet(e->ip, 1),
                     ip_octet(e->ip, 2), ip_octet(e->ip, 3),
                     e->mac[0], e->mac[1], e->mac[2],
                     e->mac[3], e->mac[4], e->mac[5],
                     state_str);
+            if (e->pending_count > 0) {
+                kprintf(" %u queued", e->pending_count);
+            }
+            kprintf("\n");
         }
     }
 }
 
 void arp_timer_tick(void) {
+    netbuf_t *dropped = NULL;
+
+    uint64_t flags = arp_lock_acquire();
     arp_time++;
 
     for (int i = 0; i < ARP_CACHE_SIZE; i++) {
         arp_entry_t *e = &arp_cache[i];
+        uint32_t age = arp_time - e->timestamp;
 
         switch (e->state) {
             case ARP_STATE_PENDING:
                 /* Check for retry timeout */
-                if (arp_time - e->timestamp >= ARP_REQUEST_TIMEOUT) {
+                if (age >= ARP_REQUEST_TIMEOUT) {
                     if (e->retries > 0) {
                         e->retries--;
                         e->timestamp = arp_time;
                         arp_request(e->ip);
                     } else {
-                        /* Give up */
+                        /* Give up, dropping the packets that waited */
                         kprintf("[ARP] Request timeout for %u.%u.%u.%u\n",
                                 ip_octet(e->ip, 0), ip_octet(e->ip, 1),
                                 ip_octet(e->ip, 2), ip_octet(e->ip, 3));
-                        e->state = ARP_STATE_FREE;
+                        netbuf_t *pending = e->pending;
+                        netbuf_t *tail = e->pending_tail;
+                        arp_entry_release(e);
+                        if (tail != NULL) {
+                            tail->next = dropped;
+                            dropped = pending;
+                        }
                     }
                 }
                 break;
 
             case ARP_STATE_RESOLVED:
                 /* Check for expiration */
-                if (arp_time - e->timestamp >= ARP_CACHE_TIMEOUT) {
+                if (age >= ARP_CACHE_TIMEOUT) {
                     e->state = ARP_STATE_STALE;
+                } else if (age >= ARP_CACHE_TIMEOUT - ARP_REFRESH_AHEAD &&
+                           arp_time - e->used < ARP_REFRESH_AHEAD &&
+                           arp_time - e->probed >= ARP_REFRESH_INTERVAL) {
+                    /* Still in use: ask again while the entry is valid */
+                    e->probed = arp_time;
+                    arp_request(e->ip);
                 }
                 break;
 
             case ARP_STATE_STALE:
                 /* Will be refreshed on next lookup or eventually freed */
-                if (arp_time - e->timestamp >= ARP_CACHE_TIMEOUT * 2) {
-                    e->state = ARP_STATE_FREE;
+                if (age >= ARP_CACHE_TIMEOUT * 2) {
+                    arp_entry_release(e);
                 }
                 break;
 
@@ -345,54 +510,55 @@ void arp_timer_tick(void) {
                 break;
         }
     }
+
+    arp_lock_release(flags);
+    arp_free_chain(dropped);
 }
 
-/* Internal: Find entry in cache */
+/* Internal: Find entry in cache (arp_lock held) */
 static arp_entry_t *arp_cache_find(uint32_t ip) {
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].state != ARP_STATE_FREE &&
-            arp_cache[i].ip == ip) {
-            return &arp_cache[i];
-        }
+    arp_entry_t *e = arp_hash[arp_bucket(ip)];
+    while (e != NULL && e->ip != ip) {
+        e = e->hash_next;
     }
-    return NULL;
+    return e;
 }
 
-/* Internal: Allocate a new cache entry */
-static arp_entry_t *arp_cache_alloc(void) {
+/* Internal: Allocate a new cache entry for ip and hash it (arp_lock held) */
+static arp_entry_t *arp_cache_alloc(uint32_t ip) {
     arp_entry_t *oldest = NULL;
     uint32_t oldest_time = UINT32_MAX;
 
-    /* First, look for a free entry */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].state == ARP_STATE_FREE) {
-            return &arp_cache[i];
+    /* No free entry - evict the oldest stale entry, else the oldest resolved one */
+    if (arp_free_list == NULL) {
+        for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+            if (arp_cache[i].state == ARP_STATE_STALE &&
+                arp_cache[i].timestamp < oldest_time) {
+                oldest_time = arp_cache[i].timestamp;
+                oldest = &arp_cache[i];
+            }
         }
-    }
-
-    /* No free entry - find oldest stale entry */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].state == ARP_STATE_STALE) {
-            if (arp_cache[i].timestamp < oldest_time) {
+        for (int i = 0; oldest == NULL && i < ARP_CACHE_SIZE; i++) {
+            if (arp_cache[i].state == ARP_STATE_RESOLVED &&
+                arp_cache[i].timestamp < oldest_time) {
                 oldest_time = arp_cache[i].timestamp;
                 oldest = &arp_cache[i];
             }
         }
-    }
-
-    if (oldest != NULL) {
-        return oldest;
-    }
-
-    /* No stale entries - evict oldest resolved entry */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].timestamp < oldest_time) {
-            oldest_time = arp_cache[i].timestamp;
-            oldest = &arp_cache[i];
+        /* Every entry is pending: leave them be */
+        if (oldest == NULL) {
+            return NULL;
         }
+        arp_entry_release(oldest);
     }
 
-    return oldest;
+    arp_entry_t *e = arp_free_list;
+    arp_free_list = e->hash_next;
+
+    e->ip = ip;
+    e->hash_next = arp_hash[arp_bucket(ip)];
+    arp_hash[arp_bucket(ip)] = e;
+    return e;
 }
 
 /* Utility functions */
@@ -3,6 +3,12 @@
  *
  * Implements RFC 826 ARP for IPv4 over Ethernet.
  * Maintains a cache mapping IP addresses to MAC addresses.
+ *
+ * The cache is a fixed table of entries indexed by a hash of the address.
+ * A packet sent to an address being resolved waits on its entry
+ * (arp_resolve) and goes out when the reply arrives. An entry that is
+ * still in use is re-requested ARP_REFRESH_AHEAD seconds before it would
+ * expire, so a busy peer's entry never lapses.
  */
 
 #ifndef _AAAOS_NET_ARP_H
@@ -10,6 +16,7 @@
 
 #include "../../kernel/include/types.h"
 #include "../ethernet/ethernet.h"
+#include "../core/netbuf.h"
 
 /* ARP constants */
 #define ARP_HRD_ETHERNET    1           /* Hardware type: Ethernet */
@@ -22,10 +29,17 @@
 #define ARP_OP_REPLY        2           /* ARP reply */
 
 /* ARP cache constants */
-#define ARP_CACHE_SIZE      64          /* Maximum cache entries */
+#define ARP_CACHE_SIZE      512         /* Maximum cache entries */
+#define ARP_HASH_SIZE       256         /* Hash buckets (power of two) */
 #define ARP_CACHE_TIMEOUT   300         /* Entry timeout in seconds */
 #define ARP_REQUEST_RETRIES 3           /* Number of request retries */
 #define ARP_REQUEST_TIMEOUT 1           /* Timeout between retries (seconds) */
+#define ARP_PENDING_MAX     8           /* Packets an unresolved entry holds */
+#define ARP_REFRESH_AHEAD   30          /* Refresh entries this long before expiry (s) */
+#define ARP_REFRESH_INTERVAL 5          /* Between refresh requests (seconds) */
+
+/* arp_resolve: the packet waits for the reply */
+#define ARP_QUEUED          1
 
 /**
  * ARP packet header (Ethernet + IPv4)
@@ -59,6 +73,12 @@ typedef struct arp_entry {
     arp_state_t state;                  /* Entry state */
     uint32_t    timestamp;              /* Last update time */
     uint8_t     retries;                /* Remaining retries for pending */
+    uint8_t     pending_count;          /* Packets waiting for resolution */
+    uint32_t    used;                   /* Last lookup that found the MAC */
+    uint32_t    probed;                 /* Last refresh request */
+    netbuf_t    *pending;               /* Waiting IPv4 packets, oldest first */
+    netbuf_t    *pending_tail;
+    struct arp_entry *hash_next;        /* Hash chain, or free list */
 } arp_entry_t;
 
 /**
@@ -75,6 +95,19 @@ void arp_init(void);
  */
 int arp_lookup(uint32_t ip, uint8_t mac_out[ETH_ALEN]);
 
+/**
+ * Resolve the next hop of an IPv4 packet, queueing the packet on a miss
+ * On a miss the packet waits on the entry (at most ARP_PENDING_MAX) and is
+ * sent with eth_send_buf when the reply arrives, or freed if the request
+ * times out.
+ * @param ip Next hop address (host byte order)
+ * @param buf IP packet with headroom for the Ethernet header, or NULL
+ * @param mac_out Set to the MAC address if it is known
+ * @return 0 if resolved (the caller sends buf), ARP_QUEUED if buf now
+ *         belongs to ARP, or -1 if not resolved and buf not queued
+ */
+int arp_resolve(uint32_t ip, netbuf_t *buf, uint8_t mac_out[ETH_ALEN]);
+
 /**
  * Send an ARP request for an IP address
  * @param ip Target IP address (host byte order)
@@ -124,8 +157,8 @@ void arp_cache_dump(void);
 
 /**
  * Perform periodic ARP cache maintenance
- * Call this function periodically (e.g., once per second)
- * to expire old entries and retry pending requests
+ * Runs once per second from a kernel timer started by arp_init
+ * to expire old entries, refresh ones in use and retry pending requests
  */
 void arp_timer_tick(void);
 
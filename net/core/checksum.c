@@ -0,0 +1,205 @@
+/**
+ * AAAos Network Stack - Internet Checksum Implementation
+ *
+ * The scalar sum adds 64-bit words and adds each carry back in, which
+ * gives the same ones' complement sum as adding 16-bit words. The vector
+ * versions zero-extend 32-bit words into 64-bit lanes, so the lanes
+ * cannot overflow, and fold the lanes together at the end. They are
+ * written with GCC vector extensions under a target attribute, since the
+ * kernel is otherwise built without SSE.
+ */
+
+#include "checksum.h"
+#include "../../kernel/arch/x86_64/fpu.h"
+
+/* Unaligned, aliasing loads */
+typedef uint64_t __attribute__((may_alias, aligned(1))) csum_u64_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) csum_u32_t;
+typedef uint16_t __attribute__((may_alias, aligned(1))) csum_u16_t;
+
+/* Vector types for the SIMD sums */
+typedef uint32_t csum_v4si __attribute__((vector_size(16)));
+typedef uint64_t csum_v2di __attribute__((vector_size(16)));
+typedef uint32_t csum_v8si __attribute__((vector_size(32)));
+typedef uint64_t csum_v4di __attribute__((vector_size(32)));
+
+static inline uint64_t csum_add64(uint64_t sum, uint64_t value) {
+    sum += value;
+    return sum + (sum < value);
+}
+
+static inline uint32_t csum_fold64(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+/**
+ * Reference sum, one 16-bit word at a time
+ */
+static uint32_t csum_word16(const uint8_t *p, size_t len, uint32_t sum) {
+    uint64_t acc = sum;
+    while (len > 1) {
+        acc += *(const csum_u16_t *)p;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        acc += *p;
+    }
+    return csum_fold64(acc);
+}
+
+/**
+ * Sum the tail (under 8 bytes) into a 64-bit accumulator
+ */
+static inline uint64_t csum_tail(const uint8_t *p, size_t len, uint64_t acc) {
+    if (len & 4) {
+        acc = csum_add64(acc, *(const csum_u32_t *)p);
+        p += 4;
+    }
+    if (len & 2) {
+        acc = csum_add64(acc, *(const csum_u16_t *)p);
+        p += 2;
+    }
+    if (len & 1) {
+        acc = csum_add64(acc, *p);
+    }
+    return acc;
+}
+
+/**
+ * 64 bits per step, four words per loop iteration
+ */
+static uint32_t csum_word64(const uint8_t *p, size_t len, uint32_t sum) {
+    uint64_t acc = sum;
+
+    while (len >= 32) {
+        acc = csum_add64(acc, *(const csum_u64_t *)(p + 0));
+        acc = csum_add64(acc, *(const csum_u64_t *)(p + 8));
+        acc = csum_add64(acc, *(const csum_u64_t *)(p + 16));
+        acc = csum_add64(acc, *(const csum_u64_t *)(p + 24));
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        acc = csum_add64(acc, *(const csum_u64_t *)p);
+        p += 8;
+        len -= 8;
+    }
+
+    return csum_fold64(csum_tail(p, len, acc));
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse2")))
+static uint32_t csum_sse2(const uint8_t *p, size_t len, uint32_t sum) {
+    const csum_v4si zero = { 0, 0, 0, 0 };
+    csum_v2di acc0 = { 0, 0 };
+    csum_v2di acc1 = { 0, 0 };
+
+    while (len >= 32) {
+        csum_v4si a, b;
+        __builtin_memcpy(&a, p, sizeof(a));
+        __builtin_memcpy(&b, p + 16, sizeof(b));
+        acc0 += (csum_v2di)__builtin_shuffle(a, zero, (csum_v4si){ 0, 4, 1, 5 });
+        acc1 += (csum_v2di)__builtin_shuffle(a, zero, (csum_v4si){ 2, 6, 3, 7 });
+        acc0 += (csum_v2di)__builtin_shuffle(b, zero, (csum_v4si){ 0, 4, 1, 5 });
+        acc1 += (csum_v2di)__builtin_shuffle(b, zero, (csum_v4si){ 2, 6, 3, 7 });
+        p += 32;
+        len -= 32;
+    }
+
+    uint64_t acc = sum;
+    for (int i = 0; i < 2; i++) {
+        acc = csum_add64(acc, acc0[i]);
+        acc = csum_add64(acc, acc1[i]);
+    }
+    return csum_word64(p, len, csum_fold64(acc));
+}
+
+__attribute__((target("avx2")))
+static uint32_t csum_avx2(const uint8_t *p, size_t len, uint32_t sum) {
+    const csum_v8si zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    const csum_v8si lo = { 0, 8, 1, 9, 4, 12, 5, 13 };
+    const csum_v8si hi = { 2, 10, 3, 11, 6, 14, 7, 15 };
+    csum_v4di acc0 = { 0, 0, 0, 0 };
+    csum_v4di acc1 = { 0, 0, 0, 0 };
+
+    while (len >= 64) {
+        csum_v8si a, b;
+        __builtin_memcpy(&a, p, sizeof(a));
+        __builtin_memcpy(&b, p + 32, sizeof(b));
+        acc0 += (csum_v4di)__builtin_shuffle(a, zero, lo);
+        acc1 += (csum_v4di)__builtin_shuffle(a, zero, hi);
+        acc0 += (csum_v4di)__builtin_shuffle(b, zero, lo);
+        acc1 += (csum_v4di)__builtin_shuffle(b, zero, hi);
+        p += 64;
+        len -= 64;
+    }
+
+    uint64_t acc = sum;
+    for (int i = 0; i < 4; i++) {
+        acc = csum_add64(acc, acc0[i]);
+        acc = csum_add64(acc, acc1[i]);
+    }
+    return csum_word64(p, len, csum_fold64(acc));
+}
+
+#endif /* __x86_64__ */
+
+bool csum_impl_available(csum_impl_t impl) {
+    switch (impl) {
+        case CSUM_IMPL_WORD16:
+        case CSUM_IMPL_WORD64:
+            return true;
+#if defined(__x86_64__)
+        case CSUM_IMPL_SSE2:
+            return fpu_enabled();
+        case CSUM_IMPL_AVX2:
+            return fpu_has_avx2();
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *csum_impl_name(csum_impl_t impl) {
+    static const char *names[CSUM_IMPL_COUNT] = { "word16", "word64", "sse2", "avx2" };
+    return impl < CSUM_IMPL_COUNT ? names[impl] : "unknown";
+}
+
+uint32_t csum_partial_impl(csum_impl_t impl, const void *data, size_t len, uint32_t sum) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    switch (impl) {
+        case CSUM_IMPL_WORD16:
+            return csum_word16(p, len, sum);
+        case CSUM_IMPL_WORD64:
+            return csum_word64(p, len, sum);
+#if defined(__x86_64__)
+        case CSUM_IMPL_SSE2:
+        case CSUM_IMPL_AVX2:
+            if (!csum_impl_available(impl)) {
+                return sum;
+            }
+            kernel_fpu_begin();
+            sum = impl == CSUM_IMPL_AVX2 ? csum_avx2(p, len, sum) : csum_sse2(p, len, sum);
+            kernel_fpu_end();
+            return sum;
+#endif
+        default:
+            return sum;
+    }
+}
+
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum) {
+#if defined(__x86_64__)
+    if (len >= CSUM_SIMD_MIN && fpu_enabled()) {
+        csum_impl_t impl = csum_impl_available(CSUM_IMPL_AVX2) ? CSUM_IMPL_AVX2 : CSUM_IMPL_SSE2;
+        return csum_partial_impl(impl, data, len, sum);
+    }
+#endif
+    return csum_word64((const uint8_t *)data, len, sum);
+}
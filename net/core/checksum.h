@@ -0,0 +1,96 @@
+/**
+ * AAAos Network Stack - Internet Checksum
+ *
+ * Ones' complement sums (RFC 1071) for the IPv4, ICMP, TCP and UDP
+ * checksums. The sum is taken 64 bits at a time with the carries folded
+ * back in; large buffers use SSE2 or AVX2 inside kernel_fpu_begin when the
+ * FPU is managed. Because the ones' complement sum does not depend on byte
+ * order, sums are kept in the order the words sit in memory, so a checksum
+ * is stored into a header as is.
+ *
+ * csum_replace16/csum_replace32 update a checksum after a header field
+ * changes without summing the header again (RFC 1624).
+ */
+
+#ifndef _AAAOS_NET_CHECKSUM_H
+#define _AAAOS_NET_CHECKSUM_H
+
+#include "../../kernel/include/types.h"
+
+/* Smallest buffer worth saving the FPU state for */
+#define CSUM_SIMD_MIN           4096
+
+/**
+ * Checksum implementations (for benchmarking and cross-checking)
+ */
+typedef enum {
+    CSUM_IMPL_WORD16 = 0,       /* One 16-bit word per step */
+    CSUM_IMPL_WORD64,           /* 64 bits per step with carry folding */
+    CSUM_IMPL_SSE2,             /* 128-bit vectors */
+    CSUM_IMPL_AVX2,             /* 256-bit vectors */
+    CSUM_IMPL_COUNT
+} csum_impl_t;
+
+/**
+ * Add a buffer to a partial sum
+ * @param data Bytes to add (any alignment)
+ * @param len Length in bytes; an odd last byte is padded with zero
+ * @param sum Partial sum to continue (0 to start)
+ * @return New partial sum, not yet folded
+ */
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum);
+
+/**
+ * Fold a partial sum to 16 bits and complement it
+ * @return The checksum to store in a header
+ */
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/**
+ * Checksum of a buffer
+ */
+static inline uint16_t csum_buffer(const void *data, size_t len) {
+    return csum_fold(csum_partial(data, len, 0));
+}
+
+/**
+ * Update a checksum after a 16-bit field changed from old_word to new_word
+ * HC' = ~(~HC + ~m + m') (RFC 1624, eqn. 3). All values as stored.
+ */
+static inline uint16_t csum_replace16(uint16_t check, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = (uint16_t)~check;
+    sum += (uint16_t)~old_word;
+    sum += new_word;
+    return csum_fold(sum);
+}
+
+/**
+ * Update a checksum after a 32-bit field (such as an address) changed
+ */
+static inline uint16_t csum_replace32(uint16_t check, uint32_t old_value, uint32_t new_value) {
+    check = csum_replace16(check, (uint16_t)old_value, (uint16_t)new_value);
+    return csum_replace16(check, (uint16_t)(old_value >> 16), (uint16_t)(new_value >> 16));
+}
+
+/**
+ * Add a buffer to a partial sum with a given implementation
+ * @return New partial sum, or sum unchanged if the implementation is not
+ *         available (see csum_impl_available)
+ */
+uint32_t csum_partial_impl(csum_impl_t impl, const void *data, size_t len, uint32_t sum);
+
+/**
+ * Check if an implementation can run on this CPU
+ */
+bool csum_impl_available(csum_impl_t impl);
+
+/**
+ * Name of an implementation
+ */
+const char *csum_impl_name(csum_impl_t impl);
+
+#endif /* _AAAOS_NET_CHECKSUM_H */
@@ -6,32 +6,269 @@
 #include "../../kernel/include/serial.h"
 #include "../../lib/libc/string.h"
 #include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/slab.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
 
-/* Simple memory allocation for network buffers */
-/* In a full implementation, this would use a slab allocator */
+/**
+ * Data area: page-backed, so physically contiguous for DMA
+ */
+typedef struct netbuf_area {
+    struct netbuf_area *next;   /* Free list link */
+    volatile uint32_t refs;     /* Buffers using the area */
+    int      cls;               /* Size class, or -1 if not recycled */
+    size_t   pages;
+    physaddr_t phys;
+    uint8_t  *base;             /* Through the physical map */
+} netbuf_area_t;
+
+/* Free areas of one class shared by all CPUs */
+typedef struct netbuf_depot {
+    netbuf_area_t *free;
+    uint32_t count;
+    uint32_t max;
+    volatile int lock;          /* Taken with interrupts already off */
+} netbuf_depot_t;
+
+/* Per-CPU free lists and counters, touched only by their CPU with interrupts off */
+typedef struct netbuf_cpu {
+    netbuf_area_t *free[NETBUF_NUM_CLASSES];
+    uint32_t count[NETBUF_NUM_CLASSES];
+    uint64_t hits[NETBUF_NUM_CLASSES];
+    uint64_t misses[NETBUF_NUM_CLASSES];
+    uint64_t unpooled;
+    uint64_t clones;
+} ALIGNED(64) netbuf_cpu_t;
+
+static netbuf_cpu_t netbuf_cpus[PERCPU_MAX_CPUS];
+static netbuf_depot_t netbuf_depots[NETBUF_NUM_CLASSES] = {
+    { NULL, 0, NETBUF_DEPOT_MAX_SMALL, 0 },
+    { NULL, 0, NETBUF_DEPOT_MAX_LARGE, 0 },
+};
+static const size_t netbuf_class_size[NETBUF_NUM_CLASSES] = {
+    NETBUF_SMALL_SIZE, NETBUF_MAX_SIZE
+};
+
+/* Object caches for netbuf_t structures and data areas, created on first allocation */
+static kmem_cache_t *netbuf_cache = NULL;
+static kmem_cache_t *netbuf_area_cache = NULL;
+static volatile int netbuf_cache_lock = 0;
 
 /**
- * Simple aligned memory allocation for network buffers
- * Uses the physical memory manager for now
+ * Get the netbuf structure cache, creating it if needed
  */
-static void *net_malloc(size_t size) {
-    /* Align to page size for simplicity */
-    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    physaddr_t addr = pmm_alloc_pages(pages);
-    if (addr == 0) {
+static kmem_cache_t *netbuf_get_cache(void) {
+    if (netbuf_cache == NULL || netbuf_area_cache == NULL) {
+        while (__sync_lock_test_and_set(&netbuf_cache_lock, 1)) {
+            __asm__ __volatile__("pause");
+        }
+        if (netbuf_cache == NULL) {
+            netbuf_cache = kmem_cache_create("netbuf", sizeof(netbuf_t), 0, NULL);
+        }
+        if (netbuf_area_cache == NULL) {
+            netbuf_area_cache = kmem_cache_create("netbuf_area", sizeof(netbuf_area_t), 0, NULL);
+        }
+        __sync_lock_release(&netbuf_cache_lock);
+    }
+    return netbuf_cache;
+}
+
+/* ========== Data Areas ========== */
+
+/**
+ * Size class serving a request, or -1 for none
+ */
+static inline int netbuf_size_class(size_t size) {
+    if (size <= NETBUF_SMALL_SIZE) {
+        return 0;
+    }
+    if (size >= NETBUF_LARGE_MIN && size <= NETBUF_MAX_SIZE) {
+        return 1;
+    }
+    return -1;
+}
+
+static inline void netbuf_depot_lock(netbuf_depot_t *depot) {
+    while (__sync_lock_test_and_set(&depot->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void netbuf_depot_unlock(netbuf_depot_t *depot) {
+    __sync_lock_release(&depot->lock);
+}
+
+/**
+ * Allocate a new area from the page allocator
+ */
+static netbuf_area_t *netbuf_area_create(int cls, size_t size) {
+    netbuf_get_cache();
+    netbuf_area_t *area = (netbuf_area_t *)kmem_cache_alloc(netbuf_area_cache);
+    if (area == NULL) {
         return NULL;
     }
-    /* In a real system, we would map this to virtual address */
-    /* For now, assume identity mapping or higher-half kernel */
-    return (void *)addr;
+
+    size_t bytes = cls >= 0 ? netbuf_class_size[cls] : size;
+    area->pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    area->phys = pmm_alloc_pages(area->pages);
+    if (area->phys == 0) {
+        kmem_cache_free(netbuf_area_cache, area);
+        return NULL;
+    }
+    area->base = (uint8_t *)(VMM_KERNEL_PHYS_MAP + area->phys);
+    area->cls = cls;
+    area->refs = 1;
+    area->next = NULL;
+    return area;
+}
+
+static void netbuf_area_destroy(netbuf_area_t *area) {
+    pmm_free_pages(area->phys, area->pages);
+    kmem_cache_free(netbuf_area_cache, area);
+}
+
+/**
+ * Destroy a list of areas (called with interrupts on)
+ */
+static void netbuf_area_destroy_list(netbuf_area_t *area) {
+    while (area) {
+        netbuf_area_t *next = area->next;
+        netbuf_area_destroy(area);
+        area = next;
+    }
+}
+
+/**
+ * Get an area for size bytes: from this CPU's free list, then the depot,
+ * then the page allocator
+ */
+static netbuf_area_t *netbuf_area_get(size_t size) {
+    int cls = netbuf_size_class(size);
+    uint64_t flags = interrupts_save();
+    netbuf_cpu_t *cpu = &netbuf_cpus[percpu_cpu_id()];
+
+    if (cls < 0) {
+        cpu->unpooled++;
+        interrupts_restore(flags);
+        return netbuf_area_create(cls, size);
+    }
+
+    /* Refill from the depot in a batch */
+    if (cpu->count[cls] == 0) {
+        netbuf_depot_t *depot = &netbuf_depots[cls];
+        netbuf_depot_lock(depot);
+        while (depot->free && cpu->count[cls] < NETBUF_CPU_BATCH) {
+            netbuf_area_t *area = depot->free;
+            depot->free = area->next;
+            depot->count--;
+            area->next = cpu->free[cls];
+            cpu->free[cls] = area;
+            cpu->count[cls]++;
+        }
+        netbuf_depot_unlock(depot);
+    }
+
+    netbuf_area_t *area = cpu->free[cls];
+    if (area) {
+        cpu->free[cls] = area->next;
+        cpu->count[cls]--;
+        cpu->hits[cls]++;
+    } else {
+        cpu->misses[cls]++;
+    }
+    interrupts_restore(flags);
+
+    if (area == NULL) {
+        return netbuf_area_create(cls, size);
+    }
+    area->refs = 1;
+    area->next = NULL;
+    return area;
+}
+
+/**
+ * Drop a reference to an area, recycling it with the last one
+ */
+static void netbuf_area_put(netbuf_area_t *area) {
+    if (__sync_sub_and_fetch(&area->refs, 1) != 0) {
+        return;
+    }
+
+    int cls = area->cls;
+    if (cls < 0) {
+        netbuf_area_destroy(area);
+        return;
+    }
+
+    netbuf_area_t *excess = NULL;
+    uint64_t flags = interrupts_save();
+    netbuf_cpu_t *cpu = &netbuf_cpus[percpu_cpu_id()];
+
+    area->next = cpu->free[cls];
+    cpu->free[cls] = area;
+    cpu->count[cls]++;
+
+    /* Hand a batch to the depot; what the depot cannot hold is freed */
+    if (cpu->count[cls] > NETBUF_CPU_CACHE) {
+        netbuf_depot_t *depot = &netbuf_depots[cls];
+        netbuf_depot_lock(depot);
+        for (uint32_t i = 0; i < NETBUF_CPU_BATCH; i++) {
+            netbuf_area_t *moved = cpu->free[cls];
+            cpu->free[cls] = moved->next;
+            cpu->count[cls]--;
+            if (depot->count < depot->max) {
+                moved->next = depot->free;
+                depot->free = moved;
+                depot->count++;
+            } else {
+                moved->next = excess;
+                excess = moved;
+            }
+        }
+        netbuf_depot_unlock(depot);
+    }
+    interrupts_restore(flags);
+
+    netbuf_area_destroy_list(excess);
 }
 
-static void net_free(void *ptr, size_t size) {
-    if (ptr == NULL) return;
-    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    pmm_free_pages((physaddr_t)ptr, pages);
+bool netbuf_is_shared(const netbuf_t *buf) {
+    return buf != NULL && buf->area != NULL && buf->area->refs > 1;
 }
 
+void netbuf_get_stats(netbuf_stats_t *stats) {
+    memset(stats, 0, sizeof(netbuf_stats_t));
+    for (uint32_t c = 0; c < PERCPU_MAX_CPUS; c++) {
+        const netbuf_cpu_t *cpu = &netbuf_cpus[c];
+        for (int cls = 0; cls < NETBUF_NUM_CLASSES; cls++) {
+            stats->pool_hits[cls] += cpu->hits[cls];
+            stats->pool_misses[cls] += cpu->misses[cls];
+            stats->cached[cls] += cpu->count[cls];
+        }
+        stats->unpooled += cpu->unpooled;
+        stats->clones += cpu->clones;
+    }
+    for (int cls = 0; cls < NETBUF_NUM_CLASSES; cls++) {
+        stats->cached[cls] += netbuf_depots[cls].count;
+    }
+}
+
+void netbuf_dump_stats(void) {
+    netbuf_stats_t stats;
+    netbuf_get_stats(&stats);
+
+    for (int cls = 0; cls < NETBUF_NUM_CLASSES; cls++) {
+        kprintf("[NETBUF] %u-byte areas: %llu pool hits, %llu page allocations, %u cached\n",
+                (uint32_t)netbuf_class_size[cls], stats.pool_hits[cls], stats.pool_misses[cls],
+                stats.cached[cls]);
+    }
+    kprintf("[NETBUF] %llu unpooled allocations, %llu shared clones\n",
+            stats.unpooled, stats.clones);
+}
+
+/* ========== Buffers ========== */
+
 netbuf_t *netbuf_alloc(size_t size, size_t headroom) {
     netbuf_t *buf;
 
@@ -48,22 +285,21 @@ netbuf_t *netbuf_alloc(size_t size, size_t headroom) {
     }
 
     /* Allocate netbuf structure */
-    buf = (netbuf_t *)net_malloc(sizeof(netbuf_t));
+    buf = (netbuf_t *)kmem_cache_zalloc(netbuf_get_cache());
     if (buf == NULL) {
         kprintf("[NETBUF] alloc failed: out of memory for structure\n");
         return NULL;
     }
 
-    /* Initialize structure */
-    memset(buf, 0, sizeof(netbuf_t));
-
     /* Allocate data buffer */
-    buf->buffer_start = (uint8_t *)net_malloc(size);
-    if (buf->buffer_start == NULL) {
+    buf->area = netbuf_area_get(size);
+    if (buf->area == NULL) {
         kprintf("[NETBUF] alloc failed: out of memory for buffer\n");
-        net_free(buf, sizeof(netbuf_t));
+        kmem_cache_free(netbuf_cache, buf);
         return NULL;
     }
+    buf->buffer_start = buf->area->base;
+    buf->phys = buf->area->phys;
 
     /* Set up buffer pointers */
     buf->capacity = size;
@@ -74,18 +310,104 @@ netbuf_t *netbuf_alloc(size_t size, size_t headroom) {
     return buf;
 }
 
+static inline uint64_t netbuf_pool_lock(netbuf_pool_t *pool) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&pool->lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void netbuf_pool_unlock(netbuf_pool_t *pool, uint64_t flags) {
+    __sync_lock_release(&pool->lock);
+    interrupts_restore(flags);
+}
+
+int netbuf_pool_init(netbuf_pool_t *pool, uint32_t count, size_t size, size_t headroom) {
+    if (pool == NULL || size == 0 || size > PAGE_SIZE || headroom >= size) {
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(netbuf_pool_t));
+    pool->size = size;
+    pool->headroom = headroom;
+
+    for (uint32_t i = 0; i < count; i++) {
+        netbuf_t *buf = (netbuf_t *)kmem_cache_zalloc(netbuf_get_cache());
+        physaddr_t phys = buf ? pmm_alloc_page() : 0;
+        if (phys == 0) {
+            kprintf("[NETBUF] pool: out of memory after %u of %u buffers\n", i, count);
+            if (buf) {
+                kmem_cache_free(netbuf_cache, buf);
+            }
+            while (pool->free) {
+                netbuf_t *next = pool->free->next;
+                pmm_free_page(pool->free->phys);
+                kmem_cache_free(netbuf_cache, pool->free);
+                pool->free = next;
+            }
+            pool->count = 0;
+            pool->available = 0;
+            return -1;
+        }
+
+        /* Addressed through the physical map, so the device and CPU agree */
+        buf->phys = phys;
+        buf->buffer_start = (uint8_t *)(VMM_KERNEL_PHYS_MAP + phys);
+        buf->capacity = size;
+        buf->pool = pool;
+        buf->data = buf->buffer_start + headroom;
+        buf->next = pool->free;
+        pool->free = buf;
+        pool->count++;
+        pool->available++;
+    }
+
+    return 0;
+}
+
+netbuf_t *netbuf_pool_get(netbuf_pool_t *pool) {
+    uint64_t flags = netbuf_pool_lock(pool);
+    netbuf_t *buf = pool->free;
+    if (buf) {
+        pool->free = buf->next;
+        pool->available--;
+    } else {
+        pool->exhausted++;
+    }
+    netbuf_pool_unlock(pool, flags);
+
+    if (buf) {
+        netbuf_reset(buf, pool->headroom);
+    }
+    return buf;
+}
+
+static void netbuf_pool_put(netbuf_pool_t *pool, netbuf_t *buf) {
+    uint64_t flags = netbuf_pool_lock(pool);
+    buf->next = pool->free;
+    pool->free = buf;
+    pool->available++;
+    netbuf_pool_unlock(pool, flags);
+}
+
 void netbuf_free(netbuf_t *buf) {
     if (buf == NULL) {
         return;
     }
 
-    /* Free data buffer */
-    if (buf->buffer_start != NULL) {
-        net_free(buf->buffer_start, buf->capacity);
+    if (buf->pool != NULL) {
+        netbuf_pool_put(buf->pool, buf);
+        return;
+    }
+
+    /* Drop the data area; the last buffer using it recycles it */
+    if (buf->area != NULL) {
+        netbuf_area_put(buf->area);
     }
 
     /* Free structure */
-    net_free(buf, sizeof(netbuf_t));
+    kmem_cache_free(netbuf_cache, buf);
 }
 
 void *netbuf_push(netbuf_t *buf, size_t len) {
@@ -169,6 +491,31 @@ netbuf_t *netbuf_clone(const netbuf_t *buf) {
         return NULL;
     }
 
+    /* Pool buffers go back to their pool; they cannot be shared */
+    if (buf->area == NULL) {
+        return netbuf_copy(buf);
+    }
+
+    netbuf_t *clone = (netbuf_t *)kmem_cache_alloc(netbuf_get_cache());
+    if (clone == NULL) {
+        return NULL;
+    }
+    *clone = *buf;
+    clone->next = NULL;
+    __sync_add_and_fetch(&buf->area->refs, 1);
+
+    uint64_t flags = interrupts_save();
+    netbuf_cpus[percpu_cpu_id()].clones++;
+    interrupts_restore(flags);
+
+    return clone;
+}
+
+netbuf_t *netbuf_copy(const netbuf_t *buf) {
+    if (buf == NULL) {
+        return NULL;
+    }
+
     /* Calculate current headroom */
     size_t headroom = netbuf_headroom(buf);
 
@@ -185,10 +532,12 @@ netbuf_t *netbuf_clone(const netbuf_t *buf) {
     /* Copy metadata */
     clone->protocol = buf->protocol;
     clone->flags = buf->flags;
+    clone->mss = buf->mss;
     memcpy(clone->src_mac, buf->src_mac, 6);
     memcpy(clone->dst_mac, buf->dst_mac, 6);
     clone->src_ip = buf->src_ip;
     clone->dst_ip = buf->dst_ip;
+    clone->src_port = buf->src_port;
 
     return clone;
 }
@@ -206,6 +555,7 @@ void netbuf_reset(netbuf_t *buf, size_t headroom) {
     buf->len = 0;
     buf->protocol = 0;
     buf->flags = 0;
+    buf->mss = 0;
     buf->next = NULL;
     memset(buf->src_mac, 0, 6);
     memset(buf->dst_mac, 0, 6);
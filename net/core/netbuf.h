@@ -3,6 +3,14 @@
  *
  * Provides a unified buffer structure for network packet handling.
  * Supports headroom/tailroom for protocol headers without copying.
+ *
+ * The data of a netbuf_alloc buffer lives in a reference-counted data
+ * area. Areas of the common sizes (up to NETBUF_SMALL_SIZE, and from
+ * NETBUF_LARGE_MIN up to NETBUF_MAX_SIZE) are recycled: a freed area goes
+ * on a free list of the CPU that freed it, and batches move between the
+ * CPUs and a shared depot per size class, so most allocations take no
+ * lock and do not touch the page allocator. netbuf_clone shares the area
+ * instead of copying the data.
  */
 
 #ifndef _AAAOS_NET_NETBUF_H
@@ -15,6 +23,15 @@
 #define NETBUF_DEFAULT_HEADROOM 64      /* Space for headers (ETH + IP + etc) */
 #define NETBUF_MAX_SIZE         65536
 
+/* Data area size classes */
+#define NETBUF_SMALL_SIZE       NETBUF_DEFAULT_SIZE /* Frames; one page each */
+#define NETBUF_LARGE_MIN        16384               /* Smallest request served by a large area */
+#define NETBUF_NUM_CLASSES      2
+#define NETBUF_CPU_CACHE        32      /* Free areas a CPU keeps per class */
+#define NETBUF_CPU_BATCH        16      /* Areas moved between a CPU and the depot at once */
+#define NETBUF_DEPOT_MAX_SMALL  256     /* Free areas the depot keeps (1 MB) */
+#define NETBUF_DEPOT_MAX_LARGE  16      /* (1 MB) */
+
 /**
  * Network buffer structure
  *
@@ -34,17 +51,52 @@ typedef struct netbuf {
     /* Metadata */
     uint16_t protocol;          /* Protocol identifier (e.g., ETH_TYPE_IP) */
     uint32_t flags;             /* Buffer flags */
+    uint16_t mss;               /* Segment payload size (NETBUF_FLAG_TSO) */
 
     /* Network layer info (set during processing) */
     uint8_t  src_mac[6];        /* Source MAC address */
     uint8_t  dst_mac[6];        /* Destination MAC address */
     uint32_t src_ip;            /* Source IP address */
     uint32_t dst_ip;            /* Destination IP address */
+    uint16_t src_port;          /* Source port (UDP receive queues) */
 
     /* Linked list for buffer chains */
     struct netbuf *next;
+
+    /* DMA */
+    physaddr_t phys;            /* Physical address of buffer_start */
+    struct netbuf_pool *pool;   /* Pool netbuf_free returns it to, or NULL */
+    struct netbuf_area *area;   /* Data area, shared by clones (netbuf_alloc) */
 } netbuf_t;
 
+/**
+ * Buffer statistics (netbuf_get_stats)
+ */
+typedef struct netbuf_stats {
+    uint64_t pool_hits[NETBUF_NUM_CLASSES];     /* Areas reused from a free list */
+    uint64_t pool_misses[NETBUF_NUM_CLASSES];   /* Free lists empty: pages allocated */
+    uint64_t unpooled;          /* Sizes outside any class: pages allocated */
+    uint64_t clones;            /* Clones sharing a data area */
+    uint32_t cached[NETBUF_NUM_CLASSES];        /* Free areas held in the depots */
+} netbuf_stats_t;
+
+/**
+ * Pool of fixed-size, physically contiguous buffers
+ *
+ * Drivers fill their receive rings from a pool, so a received frame is
+ * handed up the stack in the buffer the device wrote it to. Whoever ends
+ * up with the buffer calls netbuf_free, which puts it back.
+ */
+typedef struct netbuf_pool {
+    netbuf_t *free;             /* Buffers available */
+    uint32_t count;             /* Buffers in the pool */
+    uint32_t available;         /* Buffers on the free list */
+    size_t   size;              /* Capacity of each buffer */
+    size_t   headroom;          /* Headroom of a buffer taken from the pool */
+    uint64_t exhausted;         /* Times netbuf_pool_get found it empty */
+    volatile int lock;          /* Taken with interrupts off */
+} netbuf_pool_t;
+
 /* Buffer flags */
 #define NETBUF_FLAG_BROADCAST   BIT(0)  /* Broadcast packet */
 #define NETBUF_FLAG_MULTICAST   BIT(1)  /* Multicast packet */
@@ -52,6 +104,18 @@ typedef struct netbuf {
 #define NETBUF_FLAG_TX          BIT(3)  /* Transmit packet */
 #define NETBUF_FLAG_RX          BIT(4)  /* Receive packet */
 
+/*
+ * Checksum offload. On transmit the stack sets these only when the driver
+ * reports the offload (eth_offloads) and leaves the checksum fields for
+ * the device to fill. On receive the driver sets the *_OK flags for
+ * checksums the device verified, and the stack skips checking them.
+ */
+#define NETBUF_FLAG_CSUM_IP     BIT(5)  /* TX: device fills the IPv4 header checksum */
+#define NETBUF_FLAG_CSUM_L4     BIT(6)  /* TX: device fills the TCP/UDP checksum */
+#define NETBUF_FLAG_TSO         BIT(7)  /* TX: device cuts the TCP payload into mss segments */
+#define NETBUF_FLAG_CSUM_IP_OK  BIT(8)  /* RX: IPv4 header checksum verified */
+#define NETBUF_FLAG_CSUM_L4_OK  BIT(9)  /* RX: TCP/UDP checksum verified */
+
 /**
  * Allocate a new network buffer
  * @param size Total buffer size (data + headroom)
@@ -68,8 +132,25 @@ static inline netbuf_t *netbuf_alloc_default(void) {
     return netbuf_alloc(NETBUF_DEFAULT_SIZE, NETBUF_DEFAULT_HEADROOM);
 }
 
+/**
+ * Fill a pool with buffers
+ * @param pool Pool to set up
+ * @param count Number of buffers
+ * @param size Capacity of each buffer (at most PAGE_SIZE)
+ * @param headroom Headroom of a buffer taken from the pool
+ * @return 0 on success, -1 if out of memory (pool left empty)
+ */
+int netbuf_pool_init(netbuf_pool_t *pool, uint32_t count, size_t size, size_t headroom);
+
+/**
+ * Take a buffer from a pool (any context)
+ * @return An empty buffer, or NULL if the pool has none left
+ */
+netbuf_t *netbuf_pool_get(netbuf_pool_t *pool);
+
 /**
  * Free a network buffer
+ * A pool buffer goes back to its pool.
  * @param buf Buffer to free
  */
 void netbuf_free(netbuf_t *buf);
@@ -124,6 +205,13 @@ static inline size_t netbuf_tailroom(const netbuf_t *buf) {
     return buf->capacity - netbuf_headroom(buf) - buf->len;
 }
 
+/**
+ * Physical address of the data (for DMA; buffers are physically contiguous)
+ */
+static inline physaddr_t netbuf_data_phys(const netbuf_t *buf) {
+    return buf->phys + netbuf_headroom(buf);
+}
+
 /**
  * Get pointer to data at offset
  * @param buf Buffer to read from
@@ -136,12 +224,38 @@ static inline void *netbuf_data_at(const netbuf_t *buf, size_t offset) {
 }
 
 /**
- * Clone a network buffer (deep copy)
+ * Clone a network buffer
+ * The clone shares the data (and its metadata is copied); the data is
+ * freed with the last buffer using it. Shared data must not be modified,
+ * headers included: use netbuf_copy for a buffer to write to. A pool
+ * buffer cannot be shared and is copied.
  * @param buf Buffer to clone
- * @return New buffer with copied data, or NULL on failure
+ * @return New buffer, or NULL on failure
  */
 netbuf_t *netbuf_clone(const netbuf_t *buf);
 
+/**
+ * Copy a network buffer (deep copy)
+ * @param buf Buffer to copy
+ * @return New buffer with copied data, or NULL on failure
+ */
+netbuf_t *netbuf_copy(const netbuf_t *buf);
+
+/**
+ * Check if other buffers share this buffer's data
+ */
+bool netbuf_is_shared(const netbuf_t *buf);
+
+/**
+ * Get buffer statistics, summed over all CPUs
+ */
+void netbuf_get_stats(netbuf_stats_t *stats);
+
+/**
+ * Print buffer statistics (for debugging)
+ */
+void netbuf_dump_stats(void);
+
 /**
  * Reset buffer to initial state (preserves capacity)
  * @param buf Buffer to reset
@@ -0,0 +1,286 @@
+/**
+ * AAAos Network Stack - Network Device Implementation
+ *
+ * Devices are only ever added, so lookups read the registry without the
+ * lock once netdev_count has been read.
+ */
+
+#include "netdev.h"
+#include "nettrace.h"
+#include "../../kernel/include/serial.h"
+#include "../../lib/libc/string.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../ethernet/ethernet.h"
+#include "../ip/ip.h"
+
+/* Default Toeplitz key, the one in the Microsoft RSS specification */
+static const uint8_t netdev_default_key[NETDEV_RSS_KEY_LEN] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+/* Registry */
+static netdev_t *netdev_list[NETDEV_MAX];
+static volatile uint16_t netdev_registered = 0;
+static volatile int netdev_lock = 0;
+
+static inline uint64_t netdev_lock_acquire(volatile int *lock) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void netdev_lock_release(volatile int *lock, uint64_t flags) {
+    __sync_lock_release(lock);
+    interrupts_restore(flags);
+}
+
+int netdev_register(netdev_t *dev) {
+    if (dev == NULL || dev->ops == NULL || dev->ops->xmit == NULL) {
+        return -1;
+    }
+
+    dev->num_tx_queues = (uint16_t)CLAMP(dev->num_tx_queues, 1, NETDEV_MAX_QUEUES);
+    dev->num_rx_queues = (uint16_t)CLAMP(dev->num_rx_queues, 1, NETDEV_MAX_QUEUES);
+    if (dev->mtu == 0) {
+        dev->mtu = ETH_DATA_MAX;
+    }
+
+    memcpy(dev->rss_key, netdev_default_key, NETDEV_RSS_KEY_LEN);
+    for (int i = 0; i < NETDEV_RSS_TABLE_SIZE; i++) {
+        dev->rss_table[i] = (uint8_t)(i % dev->num_rx_queues);
+    }
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->stats_lock = 0;
+
+    uint64_t flags = netdev_lock_acquire(&netdev_lock);
+    uint16_t index = netdev_registered;
+    if (index >= NETDEV_MAX) {
+        netdev_lock_release(&netdev_lock, flags);
+        kprintf("[NETDEV] Registry full\n");
+        return -1;
+    }
+    dev->ifindex = index;
+    dev->name[0] = 'e';
+    dev->name[1] = 't';
+    dev->name[2] = 'h';
+    dev->name[3] = (char)('0' + index);
+    dev->name[4] = '\0';
+    netdev_list[index] = dev;
+    __sync_synchronize();
+    netdev_registered = index + 1;
+    netdev_lock_release(&netdev_lock, flags);
+
+    kprintf("[NETDEV] %s: %02x:%02x:%02x:%02x:%02x:%02x mtu %u, %u TX / %u RX queues, "
+            "features 0x%x\n", dev->name,
+            dev->mac[0], dev->mac[1], dev->mac[2], dev->mac[3], dev->mac[4], dev->mac[5],
+            dev->mtu, dev->num_tx_queues, dev->num_rx_queues, dev->features);
+    return 0;
+}
+
+netdev_t *netdev_get(uint16_t ifindex) {
+    return ifindex < netdev_registered ? netdev_list[ifindex] : NULL;
+}
+
+netdev_t *netdev_find(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+    uint16_t count = netdev_registered;
+    for (uint16_t i = 0; i < count; i++) {
+        if (strcmp(netdev_list[i]->name, name) == 0) {
+            return netdev_list[i];
+        }
+    }
+    return NULL;
+}
+
+netdev_t *netdev_default(void) {
+    return netdev_get(0);
+}
+
+uint16_t netdev_count(void) {
+    return netdev_registered;
+}
+
+/**
+ * Toeplitz hash of input under key
+ * key must be at least len + 4 bytes long.
+ */
+static uint32_t netdev_toeplitz(const uint8_t *key, const uint8_t *input, size_t len) {
+    uint32_t result = 0;
+    uint32_t window = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16) |
+                      ((uint32_t)key[2] << 8) | key[3];
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t next = key[i + 4];
+        for (int bit = 7; bit >= 0; bit--) {
+            if (input[i] & (1u << bit)) {
+                result ^= window;
+            }
+            window = (window << 1) | ((next >> bit) & 1);
+        }
+    }
+    return result;
+}
+
+uint32_t netdev_rss_hash(const netdev_t *dev, const void *frame, size_t len) {
+    const uint8_t *p = (const uint8_t *)frame;
+
+    if (len < ETH_HLEN + sizeof(ip_header_t) ||
+        ((p[12] << 8) | p[13]) != ETH_TYPE_IPV4) {
+        return 0;
+    }
+
+    const ip_header_t *ip = (const ip_header_t *)(p + ETH_HLEN);
+    size_t ihl = ip_header_len(ip);
+    if (ihl < sizeof(ip_header_t) || len < ETH_HLEN + ihl) {
+        return 0;
+    }
+
+    /* Addresses and ports in network byte order, as the device sees them */
+    uint8_t input[12];
+    memcpy(input, &ip->src_addr, 4);
+    memcpy(input + 4, &ip->dst_addr, 4);
+    size_t input_len = 8;
+
+    bool fragment = (ntohs(ip->flags_fragment) & (IP_FLAG_MF | IP_FRAG_OFFSET_MASK)) != 0;
+    if (!fragment && (ip->protocol == IP_PROTO_TCP || ip->protocol == IP_PROTO_UDP) &&
+        len >= ETH_HLEN + ihl + 4) {
+        memcpy(input + 8, p + ETH_HLEN + ihl, 4);
+        input_len = 12;
+    }
+
+    return netdev_toeplitz(dev->rss_key, input, input_len);
+}
+
+/**
+ * Bytes in a buffer chain
+ */
+static size_t netdev_chain_len(const netbuf_t *buf) {
+    size_t len = 0;
+    for (; buf; buf = buf->next) {
+        len += buf->len;
+    }
+    return len;
+}
+
+int netdev_xmit(netdev_t *dev, netbuf_t *buf) {
+    if (dev == NULL || buf == NULL) {
+        return -1;
+    }
+
+    uint16_t queue = 0;
+    if (dev->num_tx_queues > 1) {
+        queue = netdev_rss_queue(dev, netdev_rss_hash(dev, buf->data, buf->len)) %
+                dev->num_tx_queues;
+    }
+
+    /* buf belongs to the driver once it is accepted */
+    size_t len = netdev_chain_len(buf);
+    nettrace_capture(buf);
+    int result = dev->ops->xmit(dev, buf, queue);
+
+    uint64_t flags = netdev_lock_acquire(&dev->stats_lock);
+    if (result == 0) {
+        dev->stats.tx_packets++;
+        dev->stats.tx_bytes += len;
+        dev->stats.txq[queue].packets++;
+        dev->stats.txq[queue].bytes += len;
+    } else {
+        dev->stats.tx_errors++;
+    }
+    netdev_lock_release(&dev->stats_lock, flags);
+
+    return result;
+}
+
+int netdev_rx(netdev_t *dev, uint16_t queue, netbuf_t *buf) {
+    if (dev == NULL || buf == NULL) {
+        netbuf_free(buf);
+        return -1;
+    }
+
+    if (queue >= NETDEV_MAX_QUEUES) {
+        queue = NETDEV_MAX_QUEUES - 1;
+    }
+    size_t len = buf->len;
+    nettrace_event(NETTRACE_DRV_RX, len);
+    nettrace_capture(buf);
+
+    uint64_t flags = netdev_lock_acquire(&dev->stats_lock);
+    dev->stats.rx_packets++;
+    dev->stats.rx_bytes += len;
+    dev->stats.rxq[queue].packets++;
+    dev->stats.rxq[queue].bytes += len;
+    netdev_lock_release(&dev->stats_lock, flags);
+
+    int result = eth_receive_buf(buf);
+    if (result < 0) {
+        flags = netdev_lock_acquire(&dev->stats_lock);
+        dev->stats.rx_errors++;
+        netdev_lock_release(&dev->stats_lock, flags);
+    }
+    return result;
+}
+
+uint32_t netdev_poll(netdev_t *dev, uint32_t budget) {
+    if (dev == NULL || dev->ops->poll == NULL) {
+        return 0;
+    }
+
+    uint32_t done = 0;
+    for (uint16_t q = 0; q < dev->num_rx_queues && done < budget; q++) {
+        done += dev->ops->poll(dev, q, budget - done);
+    }
+    return done;
+}
+
+int netdev_set_mtu(netdev_t *dev, uint32_t mtu) {
+    if (dev == NULL || mtu < NETDEV_MTU_MIN) {
+        return -1;
+    }
+    if (dev->ops->set_mtu == NULL) {
+        return mtu == dev->mtu ? 0 : -1;
+    }
+
+    int result = dev->ops->set_mtu(dev, mtu);
+    if (result == 0) {
+        dev->mtu = mtu;
+    }
+    return result;
+}
+
+void netdev_get_stats(netdev_t *dev, netdev_stats_t *stats) {
+    if (dev == NULL || stats == NULL) {
+        return;
+    }
+    uint64_t flags = netdev_lock_acquire(&dev->stats_lock);
+    *stats = dev->stats;
+    netdev_lock_release(&dev->stats_lock, flags);
+}
+
+void netdev_dump(void) {
+    uint16_t count = netdev_registered;
+
+    kprintf("[NETDEV] %u devices:\n", count);
+    for (uint16_t i = 0; i < count; i++) {
+        netdev_t *dev = netdev_list[i];
+        netdev_stats_t s = {0};
+        netdev_get_stats(dev, &s);
+
+        kprintf("  %s: mtu %u, TX %u packets %u bytes %u errors, "
+                "RX %u packets %u bytes %u errors\n", dev->name, dev->mtu,
+                (uint32_t)s.tx_packets, (uint32_t)s.tx_bytes, (uint32_t)s.tx_errors,
+                (uint32_t)s.rx_packets, (uint32_t)s.rx_bytes, (uint32_t)s.rx_errors);
+        for (uint16_t q = 0; q < dev->num_tx_queues || q < dev->num_rx_queues; q++) {
+            kprintf("    queue %u: TX %u packets, RX %u packets\n", q,
+                    (uint32_t)s.txq[q].packets, (uint32_t)s.rxq[q].packets);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+/**
+ * AAAos Network Stack - Network Devices
+ *
+ * A driver describes each interface it finds with a netdev_t: its MAC
+ * address, MTU, the offloads it performs (ETH_OFFLOAD_*), how many transmit
+ * and receive queues it has, and the operations the stack calls on it.
+ * netdev_register gives it an index and a name ("eth0", "eth1", ...); the
+ * first device registered is the default one the Ethernet layer sends on.
+ *
+ * Transmit goes through netdev_xmit, which picks a queue for the frame and
+ * counts it. Received frames are handed to netdev_rx by the driver. Both
+ * keep per-device and per-queue statistics.
+ *
+ * Flows are spread across queues with the Toeplitz hash of receive side
+ * scaling: the hash of a frame's IPv4 addresses and TCP/UDP ports indexes
+ * an indirection table naming the queue. The key and table live in the
+ * netdev_t, so a driver for a device with hardware RSS programs them into
+ * the device and its receive queues see the same flows as the transmit
+ * queues picked here.
+ */
+
+#ifndef _AAAOS_NET_NETDEV_H
+#define _AAAOS_NET_NETDEV_H
+
+#include "../../kernel/include/types.h"
+#include "netbuf.h"
+
+/* Limits */
+#define NETDEV_MAX              8           /* Registered devices */
+#define NETDEV_MAX_QUEUES       8           /* Transmit or receive queues per device */
+#define NETDEV_NAME_LEN         8           /* Name, NUL included */
+#define NETDEV_RSS_KEY_LEN      40          /* Toeplitz key bytes */
+#define NETDEV_RSS_TABLE_SIZE   128         /* Indirection table entries */
+#define NETDEV_MTU_MIN          68          /* Smallest MTU an IPv4 link may have */
+
+struct netdev;
+
+/**
+ * Driver operations
+ * xmit is required; the others may be NULL.
+ */
+typedef struct netdev_ops {
+    /**
+     * Send a frame, Ethernet header included, on a transmit queue
+     * @return 0 on success (buf consumed), negative on error (caller keeps buf)
+     */
+    int (*xmit)(struct netdev *dev, netbuf_t *buf, uint16_t queue);
+
+    /**
+     * Hand up to budget received frames of a queue to netdev_rx
+     * @return Frames handled
+     */
+    uint32_t (*poll)(struct netdev *dev, uint16_t queue, uint32_t budget);
+
+    /**
+     * Change the MTU
+     * @return 0 on success, negative if the device cannot use it
+     */
+    int (*set_mtu)(struct netdev *dev, uint32_t mtu);
+} netdev_ops_t;
+
+/**
+ * Per-queue counters
+ */
+typedef struct netdev_queue_stats {
+    uint64_t packets;
+    uint64_t bytes;
+} netdev_queue_stats_t;
+
+/**
+ * Device statistics
+ */
+typedef struct netdev_stats {
+    uint64_t tx_packets;        /* Frames accepted by the driver */
+    uint64_t tx_bytes;
+    uint64_t tx_errors;         /* Frames the driver refused */
+    uint64_t rx_packets;        /* Frames handed to the stack */
+    uint64_t rx_bytes;
+    uint64_t rx_errors;         /* Frames the stack rejected */
+    netdev_queue_stats_t txq[NETDEV_MAX_QUEUES];
+    netdev_queue_stats_t rxq[NETDEV_MAX_QUEUES];
+} netdev_stats_t;
+
+/**
+ * Network device
+ * The driver fills in mac, mtu, features, the queue counts, ops and priv
+ * before netdev_register; the rest belongs to the stack.
+ */
+typedef struct netdev {
+    char     name[NETDEV_NAME_LEN];     /* "eth0", ... */
+    uint16_t ifindex;                   /* Position in the registry */
+    uint8_t  mac[6];                    /* Hardware address */
+    uint32_t mtu;                       /* Largest IP packet */
+    uint32_t features;                  /* ETH_OFFLOAD_* */
+    uint16_t num_tx_queues;             /* 1..NETDEV_MAX_QUEUES */
+    uint16_t num_rx_queues;             /* 1..NETDEV_MAX_QUEUES */
+    const netdev_ops_t *ops;
+    void    *priv;                      /* Driver state */
+
+    /* Receive side scaling */
+    uint8_t  rss_key[NETDEV_RSS_KEY_LEN];
+    uint8_t  rss_table[NETDEV_RSS_TABLE_SIZE];  /* Hash -> queue */
+
+    netdev_stats_t stats;
+    volatile int stats_lock;            /* Taken with interrupts off */
+} netdev_t;
+
+/**
+ * Register a device
+ * Sets its name and index, clamps the queue counts, and fills the RSS key
+ * and indirection table, spreading entries over the receive queues.
+ * @return 0 on success, -1 if the device is incomplete or the registry is full
+ */
+int netdev_register(netdev_t *dev);
+
+/**
+ * Find a device by index
+ * @return The device, or NULL
+ */
+netdev_t *netdev_get(uint16_t ifindex);
+
+/**
+ * Find a device by name
+ * @return The device, or NULL
+ */
+netdev_t *netdev_find(const char *name);
+
+/**
+ * The device the Ethernet layer sends on (the first registered)
+ * @return The device, or NULL if none is registered
+ */
+netdev_t *netdev_default(void);
+
+/**
+ * Number of registered devices
+ */
+uint16_t netdev_count(void);
+
+/**
+ * Send a frame on the queue its flow hashes to
+ * @return 0 on success (buf consumed), negative on error (caller keeps buf)
+ */
+int netdev_xmit(netdev_t *dev, netbuf_t *buf);
+
+/**
+ * Pass a received frame up the stack (called by drivers)
+ * @param queue Receive queue it arrived on
+ * @param buf Frame, Ethernet header included (consumed)
+ * @return 0 on success, negative if the stack rejected it
+ */
+int netdev_rx(netdev_t *dev, uint16_t queue, netbuf_t *buf);
+
+/**
+ * Poll every receive queue of a device once
+ * @return Frames handled
+ */
+uint32_t netdev_poll(netdev_t *dev, uint32_t budget);
+
+/**
+ * Change a device's MTU
+ * @return 0 on success, negative if the device cannot use it
+ */
+int netdev_set_mtu(netdev_t *dev, uint32_t mtu);
+
+/**
+ * RSS hash of an Ethernet frame
+ * Covers the IPv4 addresses, plus the ports of an unfragmented TCP or UDP
+ * packet, as the device would hash them.
+ * @return The hash, or 0 for frames that are not IPv4
+ */
+uint32_t netdev_rss_hash(const netdev_t *dev, const void *frame, size_t len);
+
+/**
+ * Queue the indirection table maps a hash to
+ */
+static inline uint16_t netdev_rss_queue(const netdev_t *dev, uint32_t hash) {
+    return dev->rss_table[hash % NETDEV_RSS_TABLE_SIZE];
+}
+
+/**
+ * Copy a device's statistics
+ */
+void netdev_get_stats(netdev_t *dev, netdev_stats_t *stats);
+
+/**
+ * Print every device and its counters to the serial console
+ */
+void netdev_dump(void);
+
+#endif /* _AAAOS_NET_NETDEV_H */
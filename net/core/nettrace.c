@@ -0,0 +1,403 @@
+/**
+ * AAAos Network Stack - Receive Path Tracing Implementation
+ *
+ * A writer claims a ring slot by adding to its CPU's head, fills the slot,
+ * then stores its seq. Readers copy a slot and keep it only if seq still
+ * matches, so a slot being rewritten is skipped rather than read torn.
+ * Counters are updated with atomics, as a writer may be moved to another
+ * CPU partway through.
+ */
+
+#include "nettrace.h"
+#include "../../kernel/include/serial.h"
+#include "../../lib/libc/string.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+
+#define NETTRACE_RING_MASK  (NETTRACE_RING_SIZE - 1)
+
+/**
+ * Per-CPU trace state
+ */
+typedef struct nettrace_cpu {
+    uint64_t head;                      /* Slots claimed so far */
+    uint64_t chain_cycles;              /* Time of the latest stage recorded */
+    uint8_t  chain_stage;               /* Which stage that was */
+    nettrace_stage_stats_t stats[NETTRACE_NUM_STAGES];
+    nettrace_event_t ring[NETTRACE_RING_SIZE];
+} ALIGNED(64) nettrace_cpu_t;
+
+/**
+ * Captured frame
+ */
+typedef struct nettrace_frame {
+    uint64_t time_ns;                   /* Wall-clock time */
+    uint32_t orig_len;
+    uint32_t cap_len;
+    uint8_t  data[NETTRACE_SNAPLEN];
+} nettrace_frame_t;
+
+/* pcap file format */
+typedef struct PACKED pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_header_t;
+
+typedef struct PACKED pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_header_t;
+
+#define PCAP_MAGIC          0xA1B2C3D4
+#define PCAP_LINKTYPE_ETH   1
+
+volatile bool nettrace_enabled = false;
+volatile bool nettrace_capturing = false;
+
+static nettrace_cpu_t nettrace_cpus[PERCPU_MAX_CPUS];
+
+/* Time of the last device interrupt, for NETTRACE_DRV_RX */
+static volatile uint64_t nettrace_irq_cycles = 0;
+
+/* Capture ring, allocated by the first nettrace_capture_start */
+static nettrace_frame_t *capture_ring = NULL;
+static uint32_t capture_head = 0;       /* Frames captured since the start */
+static volatile int capture_lock = 0;
+
+static const char *nettrace_names[NETTRACE_NUM_STAGES] = {
+    "irq", "drv", "eth", "ip", "tcp", "sock", "recv",
+};
+
+static inline uint64_t capture_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&capture_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void capture_lock_release(uint64_t flags) {
+    __sync_lock_release(&capture_lock);
+    interrupts_restore(flags);
+}
+
+static inline nettrace_cpu_t *nettrace_this_cpu(uint32_t *cpu) {
+    *cpu = percpu_cpu_id();
+    if (*cpu >= PERCPU_MAX_CPUS) {
+        *cpu = 0;
+    }
+    return &nettrace_cpus[*cpu];
+}
+
+void nettrace_enable(bool enable) {
+    nettrace_enabled = enable;
+    kprintf("[NETTRACE] Tracing %s\n", enable ? "on" : "off");
+}
+
+void nettrace_reset(void) {
+    bool was = nettrace_enabled;
+    nettrace_enabled = false;
+    __sync_synchronize();
+    memset(nettrace_cpus, 0, sizeof(nettrace_cpus));
+    nettrace_irq_cycles = 0;
+    __sync_synchronize();
+    nettrace_enabled = was;
+}
+
+/**
+ * Add a latency to a stage's histogram
+ */
+static void nettrace_account(nettrace_stage_stats_t *st, uint64_t ns) {
+    uint32_t bucket = 0;
+    if (ns >> NETTRACE_LAT_MIN_SHIFT) {
+        bucket = (63 - __builtin_clzll(ns)) - NETTRACE_LAT_MIN_SHIFT;
+        if (bucket >= NETTRACE_LAT_BUCKETS) {
+            bucket = NETTRACE_LAT_BUCKETS - 1;
+        }
+    }
+    __atomic_fetch_add(&st->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->samples, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->total_ns, ns, __ATOMIC_RELAXED);
+    if (ns > st->max_ns) {
+        st->max_ns = ns;
+    }
+}
+
+/**
+ * Append an event to the calling CPU's ring and histogram
+ * @param since clock_cycles() the latency is measured from, 0 for none
+ */
+static void nettrace_push(nettrace_cpu_t *c, uint32_t cpu, nettrace_stage_t stage,
+                          size_t len, uint64_t now, uint64_t since) {
+    uint64_t ns = (since && now > since) ? clock_cycles_to_ns(now - since) : 0;
+
+    uint64_t seq = __atomic_fetch_add(&c->head, 1, __ATOMIC_RELAXED);
+    nettrace_event_t *ev = &c->ring[seq & NETTRACE_RING_MASK];
+    __atomic_store_n(&ev->seq, UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    ev->cycles = now;
+    ev->latency_ns = (uint32_t)MIN(ns, (uint64_t)UINT32_MAX);
+    ev->len = (uint16_t)MIN(len, (size_t)UINT16_MAX);
+    ev->stage = (uint8_t)stage;
+    ev->cpu = (uint8_t)cpu;
+    __atomic_store_n(&ev->seq, seq, __ATOMIC_RELEASE);
+
+    nettrace_stage_stats_t *st = &c->stats[stage];
+    __atomic_fetch_add(&st->events, 1, __ATOMIC_RELAXED);
+    if (since) {
+        nettrace_account(st, ns);
+    }
+}
+
+void nettrace_record(nettrace_stage_t stage, size_t len) {
+    if (stage >= NETTRACE_NUM_STAGES) {
+        return;
+    }
+
+    uint32_t cpu;
+    nettrace_cpu_t *c = nettrace_this_cpu(&cpu);
+    uint64_t now = clock_cycles();
+    uint64_t since = 0;
+
+    if (stage == NETTRACE_IRQ) {
+        nettrace_irq_cycles = now;
+    } else if (stage == NETTRACE_DRV_RX) {
+        since = nettrace_irq_cycles;
+        c->chain_cycles = now;
+        c->chain_stage = (uint8_t)stage;
+    } else if (stage < NETTRACE_RECV) {
+        /* Frames looped back locally start at eth with no earlier stage */
+        if (c->chain_cycles && c->chain_stage < stage) {
+            since = c->chain_cycles;
+        }
+        c->chain_cycles = now;
+        c->chain_stage = (uint8_t)stage;
+    }
+
+    nettrace_push(c, cpu, stage, len, now, since);
+}
+
+void nettrace_record_drop(nettrace_stage_t stage) {
+    if (stage >= NETTRACE_NUM_STAGES) {
+        return;
+    }
+    uint32_t cpu;
+    nettrace_cpu_t *c = nettrace_this_cpu(&cpu);
+    __atomic_fetch_add(&c->stats[stage].drops, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t nettrace_stamp(void) {
+    return nettrace_enabled ? clock_cycles() : 0;
+}
+
+void nettrace_recv(uint64_t deliver_cycles, size_t len) {
+    if (!nettrace_enabled) {
+        return;
+    }
+    uint32_t cpu;
+    nettrace_cpu_t *c = nettrace_this_cpu(&cpu);
+    nettrace_push(c, cpu, NETTRACE_RECV, len, clock_cycles(), deliver_cycles);
+}
+
+void nettrace_get_stats(nettrace_stage_t stage, nettrace_stage_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (stage >= NETTRACE_NUM_STAGES) {
+        return;
+    }
+
+    /* A racy sum is fine for statistics */
+    for (uint32_t cpu = 0; cpu < PERCPU_MAX_CPUS; cpu++) {
+        const nettrace_stage_stats_t *st = &nettrace_cpus[cpu].stats[stage];
+        stats->events += st->events;
+        stats->drops += st->drops;
+        stats->samples += st->samples;
+        stats->total_ns += st->total_ns;
+        stats->max_ns = MAX(stats->max_ns, st->max_ns);
+        for (int b = 0; b < NETTRACE_LAT_BUCKETS; b++) {
+            stats->buckets[b] += st->buckets[b];
+        }
+    }
+}
+
+uint32_t nettrace_read(uint32_t cpu, nettrace_event_t *out, uint32_t max) {
+    if (cpu >= PERCPU_MAX_CPUS || out == NULL) {
+        return 0;
+    }
+
+    nettrace_cpu_t *c = &nettrace_cpus[cpu];
+    uint64_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+    uint64_t count = MIN(head, (uint64_t)MIN(max, (uint32_t)NETTRACE_RING_SIZE));
+    uint32_t copied = 0;
+
+    for (uint64_t seq = head - count; seq < head; seq++) {
+        const nettrace_event_t *ev = &c->ring[seq & NETTRACE_RING_MASK];
+        if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != seq) {
+            continue;
+        }
+        out[copied] = *ev;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == seq) {
+            copied++;
+        }
+    }
+    return copied;
+}
+
+const char *nettrace_stage_name(nettrace_stage_t stage) {
+    return stage < NETTRACE_NUM_STAGES ? nettrace_names[stage] : "?";
+}
+
+/* ============================================================================
+ * Capture
+ * ============================================================================ */
+
+int nettrace_capture_start(void) {
+    if (capture_ring == NULL) {
+        nettrace_frame_t *ring =
+            (nettrace_frame_t *)kmalloc(NETTRACE_PCAP_SLOTS * sizeof(nettrace_frame_t));
+        if (ring == NULL) {
+            kprintf("[NETTRACE] Cannot allocate the capture ring\n");
+            return -1;
+        }
+        uint64_t flags = capture_lock_acquire();
+        if (capture_ring == NULL) {
+            capture_ring = ring;
+            ring = NULL;
+        }
+        capture_lock_release(flags);
+        if (ring) {
+            kfree(ring);
+        }
+    }
+
+    uint64_t flags = capture_lock_acquire();
+    capture_head = 0;
+    nettrace_capturing = true;
+    capture_lock_release(flags);
+
+    kprintf("[NETTRACE] Capture started\n");
+    return 0;
+}
+
+void nettrace_capture_stop(void) {
+    uint64_t flags = capture_lock_acquire();
+    nettrace_capturing = false;
+    capture_lock_release(flags);
+    kprintf("[NETTRACE] Capture stopped, %u frames\n", nettrace_capture_count());
+}
+
+void nettrace_capture_frame(const netbuf_t *buf) {
+    if (buf == NULL) {
+        return;
+    }
+    uint64_t now = clock_realtime_ns();
+
+    uint64_t flags = capture_lock_acquire();
+    if (!nettrace_capturing || capture_ring == NULL) {
+        capture_lock_release(flags);
+        return;
+    }
+
+    nettrace_frame_t *f = &capture_ring[capture_head % NETTRACE_PCAP_SLOTS];
+    capture_head++;
+    f->time_ns = now;
+    f->orig_len = 0;
+    f->cap_len = 0;
+    for (const netbuf_t *b = buf; b; b = b->next) {
+        size_t n = MIN(b->len, (size_t)(NETTRACE_SNAPLEN - f->cap_len));
+        memcpy(f->data + f->cap_len, b->data, n);
+        f->cap_len += (uint32_t)n;
+        f->orig_len += (uint32_t)b->len;
+    }
+    capture_lock_release(flags);
+}
+
+uint32_t nettrace_capture_count(void) {
+    return MIN(capture_head, (uint32_t)NETTRACE_PCAP_SLOTS);
+}
+
+size_t nettrace_pcap_size(void) {
+    size_t size = sizeof(pcap_file_header_t);
+
+    uint64_t flags = capture_lock_acquire();
+    uint32_t count = nettrace_capture_count();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t slot = (capture_head - count + i) % NETTRACE_PCAP_SLOTS;
+        size += sizeof(pcap_record_header_t) + capture_ring[slot].cap_len;
+    }
+    capture_lock_release(flags);
+    return size;
+}
+
+size_t nettrace_pcap_export(void *out, size_t size) {
+    if (out == NULL || size < sizeof(pcap_file_header_t)) {
+        return 0;
+    }
+
+    uint8_t *p = (uint8_t *)out;
+    pcap_file_header_t fh = {
+        .magic = PCAP_MAGIC, .version_major = 2, .version_minor = 4,
+        .thiszone = 0, .sigfigs = 0, .snaplen = NETTRACE_SNAPLEN,
+        .linktype = PCAP_LINKTYPE_ETH,
+    };
+    memcpy(p, &fh, sizeof(fh));
+    size_t pos = sizeof(fh);
+
+    uint64_t flags = capture_lock_acquire();
+    uint32_t count = nettrace_capture_count();
+    for (uint32_t i = 0; i < count; i++) {
+        const nettrace_frame_t *f = &capture_ring[(capture_head - count + i) %
+                                                  NETTRACE_PCAP_SLOTS];
+        if (pos + sizeof(pcap_record_header_t) + f->cap_len > size) {
+            break;
+        }
+        pcap_record_header_t rh = {
+            .ts_sec = (uint32_t)(f->time_ns / NSEC_PER_SEC),
+            .ts_usec = (uint32_t)((f->time_ns % NSEC_PER_SEC) / 1000),
+            .incl_len = f->cap_len,
+            .orig_len = f->orig_len,
+        };
+        memcpy(p + pos, &rh, sizeof(rh));
+        memcpy(p + pos + sizeof(rh), f->data, f->cap_len);
+        pos += sizeof(rh) + f->cap_len;
+    }
+    capture_lock_release(flags);
+    return pos;
+}
+
+void nettrace_dump(void) {
+    kprintf("[NETTRACE] Tracing %s, capture %s (%u frames)\n",
+            nettrace_enabled ? "on" : "off", nettrace_capturing ? "on" : "off",
+            nettrace_capture_count());
+
+    for (int s = 0; s < NETTRACE_NUM_STAGES; s++) {
+        nettrace_stage_stats_t st;
+        nettrace_get_stats((nettrace_stage_t)s, &st);
+        if (st.events == 0 && st.drops == 0) {
+            continue;
+        }
+
+        kprintf("[NETTRACE] %-5s %llu events, %llu drops, avg %llu ns, max %llu ns\n",
+                nettrace_names[s], st.events, st.drops,
+                st.samples ? st.total_ns / st.samples : 0ULL, st.max_ns);
+        for (int b = 0; b < NETTRACE_LAT_BUCKETS; b++) {
+            if (st.buckets[b] == 0) {
+                continue;
+            }
+            kprintf("[NETTRACE]   >= %llu ns: %llu\n",
+                    b == 0 ? 0ULL : (1ULL << (b + NETTRACE_LAT_MIN_SHIFT)), st.buckets[b]);
+        }
+    }
+}
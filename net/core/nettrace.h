@@ -0,0 +1,187 @@
+/**
+ * AAAos Network Stack - Receive Path Tracing and Packet Capture
+ *
+ * With tracing on, each stage a received packet passes records an event
+ * (timestamp, stage, length) in a ring owned by the CPU it runs on. Slots
+ * are claimed with an atomic add, so writers never lock or wait, interrupt
+ * handlers included; once a ring wraps, the oldest events are overwritten.
+ *
+ * Every event also feeds a per-stage latency histogram:
+ *   NETTRACE_IRQ       e1000_handler         none, starts a batch
+ *   NETTRACE_DRV_RX    netdev_rx             since the interrupt
+ *   NETTRACE_ETH_RX    eth_input             since the stage before
+ *   NETTRACE_IP_RX     ip_deliver            since the stage before
+ *   NETTRACE_TCP_RX    tcp_receive_offload   since the stage before
+ *   NETTRACE_SOCK_RX   socket_deliver        since the stage before
+ *   NETTRACE_RECV      recv returning data   since that socket's last delivery
+ * Stages from NETTRACE_DRV_RX to NETTRACE_SOCK_RX run in one call chain on
+ * one CPU, so each is timed from the latest earlier stage recorded on that
+ * CPU. A stage that rejects a packet counts a drop against itself.
+ *
+ * Capture keeps copies of the frames sent and received by network devices
+ * (the first NETTRACE_SNAPLEN bytes of each) in a ring, which
+ * nettrace_pcap_export writes out as a pcap file.
+ *
+ * When both are off, each hook costs one load and branch.
+ */
+
+#ifndef _AAAOS_NET_NETTRACE_H
+#define _AAAOS_NET_NETTRACE_H
+
+#include "../../kernel/include/types.h"
+#include "netbuf.h"
+
+/* Limits */
+#define NETTRACE_RING_SIZE      512         /* Events per CPU (power of two) */
+#define NETTRACE_LAT_BUCKETS    16
+#define NETTRACE_LAT_MIN_SHIFT  7           /* First bucket ends at 128 ns */
+#define NETTRACE_PCAP_SLOTS     256         /* Frames kept by capture */
+#define NETTRACE_SNAPLEN        256         /* Bytes kept per frame */
+
+/**
+ * Traced stages
+ */
+typedef enum nettrace_stage {
+    NETTRACE_IRQ = 0,
+    NETTRACE_DRV_RX,
+    NETTRACE_ETH_RX,
+    NETTRACE_IP_RX,
+    NETTRACE_TCP_RX,
+    NETTRACE_SOCK_RX,
+    NETTRACE_RECV,
+    NETTRACE_NUM_STAGES
+} nettrace_stage_t;
+
+/**
+ * Trace event
+ */
+typedef struct nettrace_event {
+    uint64_t seq;               /* Position in its CPU's ring, written last */
+    uint64_t cycles;            /* clock_cycles() when recorded */
+    uint32_t latency_ns;        /* Since the stage before, 0 if unknown */
+    uint16_t len;               /* Bytes seen at this stage */
+    uint8_t  stage;             /* nettrace_stage_t */
+    uint8_t  cpu;
+} nettrace_event_t;
+
+/**
+ * Per-stage statistics, summed over all CPUs
+ * Bucket i counts latencies in [2^(i+7), 2^(i+8)) ns; bucket 0 also
+ * counts shorter ones and the last bucket longer ones.
+ */
+typedef struct nettrace_stage_stats {
+    uint64_t events;
+    uint64_t drops;
+    uint64_t samples;           /* Events with a latency */
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NETTRACE_LAT_BUCKETS];
+} nettrace_stage_stats_t;
+
+/* Set by nettrace_enable and nettrace_capture_start; read by the hooks */
+extern volatile bool nettrace_enabled;
+extern volatile bool nettrace_capturing;
+
+/**
+ * Turn event tracing on or off (off by default)
+ */
+void nettrace_enable(bool enable);
+
+/**
+ * Clear every ring, histogram and drop counter
+ */
+void nettrace_reset(void);
+
+/* Out-of-line halves of the hooks below */
+void nettrace_record(nettrace_stage_t stage, size_t len);
+void nettrace_record_drop(nettrace_stage_t stage);
+void nettrace_capture_frame(const netbuf_t *buf);
+
+/**
+ * Record that a packet reached a stage
+ */
+static inline void nettrace_event(nettrace_stage_t stage, size_t len) {
+    if (nettrace_enabled) {
+        nettrace_record(stage, len);
+    }
+}
+
+/**
+ * Record that a stage dropped a packet
+ */
+static inline void nettrace_drop(nettrace_stage_t stage) {
+    if (nettrace_enabled) {
+        nettrace_record_drop(stage);
+    }
+}
+
+/**
+ * Capture a frame a device sent or received (chains are followed)
+ */
+static inline void nettrace_capture(const netbuf_t *buf) {
+    if (nettrace_capturing) {
+        nettrace_capture_frame(buf);
+    }
+}
+
+/**
+ * Record recv returning data that socket_deliver queued
+ * @param deliver_cycles clock_cycles() at the delivery, 0 if unknown
+ */
+void nettrace_recv(uint64_t deliver_cycles, size_t len);
+
+/**
+ * Current timestamp for nettrace_recv, 0 while tracing is off
+ */
+uint64_t nettrace_stamp(void);
+
+/**
+ * Get the statistics of a stage
+ */
+void nettrace_get_stats(nettrace_stage_t stage, nettrace_stage_stats_t *stats);
+
+/**
+ * Copy the most recent events of a CPU, oldest first
+ * @return Events copied (at most max)
+ */
+uint32_t nettrace_read(uint32_t cpu, nettrace_event_t *out, uint32_t max);
+
+/**
+ * Name of a stage ("eth", "ip", ...)
+ */
+const char *nettrace_stage_name(nettrace_stage_t stage);
+
+/**
+ * Start capturing frames, discarding any captured before
+ * @return 0 on success, -1 if the capture ring cannot be allocated
+ */
+int nettrace_capture_start(void);
+
+/**
+ * Stop capturing; captured frames stay until the next start
+ */
+void nettrace_capture_stop(void);
+
+/**
+ * Frames held by capture
+ */
+uint32_t nettrace_capture_count(void);
+
+/**
+ * Bytes nettrace_pcap_export needs for everything captured
+ */
+size_t nettrace_pcap_size(void);
+
+/**
+ * Write the captured frames as a pcap file (oldest first)
+ * Frames that do not fit whole in size bytes are left out.
+ * @return Bytes written, or 0 if size cannot hold the file header
+ */
+size_t nettrace_pcap_export(void *out, size_t size);
+
+/**
+ * Print the per-stage histograms and drop counters to the serial console
+ */
+void nettrace_dump(void);
+
+#endif /* _AAAOS_NET_NETTRACE_H */
@@ -9,14 +9,15 @@
 #include "../ip/ip.h"
 #include "../udp/udp.h"
 #include "../../kernel/include/types.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/proc/process.h"
+#include "../../fs/vfs/vfs.h"
+#include "../../security/crypto/crypto.h"
 
 /* Forward declaration for kernel logging */
 extern void kprintf(const char *fmt, ...);
 
-/* Forward declaration for time functions */
-extern uint64_t timer_get_ticks(void);
-extern void timer_sleep_ms(uint32_t ms);
-
 /* Forward declaration for memory functions */
 extern void *kmalloc(size_t size);
 extern void kfree(void *ptr);
@@ -27,27 +28,37 @@ extern int memcmp(const void *s1, const void *s2, size_t n);
 /* Global DHCP client state */
 static dhcp_client_t g_dhcp_client;
 
+/* Drives dhcp_timer_tick once per second */
+static ktimer_t g_dhcp_timer;
+
 /* UDP socket for DHCP communication */
 static udp_socket_t *g_dhcp_socket = NULL;
 
-/* Simple pseudo-random number generator for XID */
-static uint32_t g_rand_seed = 0x12345678;
+/* Magic number of DHCP_LEASE_FILE */
+#define DHCP_LEASE_MAGIC        0x4C434844  /* "DHCL" */
 
 /**
- * Simple PRNG for transaction ID generation
+ * Contents of DHCP_LEASE_FILE
  */
-static uint32_t dhcp_rand(void) {
-    g_rand_seed = g_rand_seed * 1103515245 + 12345;
-    return (g_rand_seed >> 16) & 0x7FFFFFFF;
-}
+typedef struct dhcp_lease_record {
+    uint32_t     magic;
+    uint8_t      mac[6];                    /* Interface the lease belongs to */
+    uint16_t     reserved;
+    uint64_t     expires;                   /* Wall-clock seconds */
+    dhcp_lease_t lease;
+} dhcp_lease_record_t;
+
+/* dhcp_configure_async's request, set while its thread runs */
+static volatile bool g_dhcp_async_running = false;
+static uint32_t g_dhcp_async_timeout;
+static dhcp_done_fn_t g_dhcp_async_done;
+static void *g_dhcp_async_arg;
 
 /**
  * Generate a random transaction ID
  */
 uint32_t dhcp_generate_xid(void) {
-    /* Mix in timer ticks for more entropy */
-    g_rand_seed ^= (uint32_t)timer_get_ticks();
-    return dhcp_rand();
+    return random_uint32();
 }
 
 /**
@@ -67,6 +78,14 @@ const char *dhcp_state_string(dhcp_state_t state) {
     }
 }
 
+/**
+ * Timer callback for timeouts and lease renewal
+ */
+static void dhcp_timer_expired(void *arg) {
+    (void)arg;
+    dhcp_timer_tick();
+}
+
 /**
  * Initialize the DHCP client
  */
@@ -92,6 +111,9 @@ int dhcp_init(void) {
     g_dhcp_client.state = DHCP_STATE_INIT;
     g_dhcp_client.initialized = true;
 
+    ktimer_init_soft(&g_dhcp_timer, dhcp_timer_expired, NULL);
+    ktimer_start(&g_dhcp_timer, NSEC_PER_SEC, NSEC_PER_SEC);
+
     kprintf("DHCP: Client initialized, MAC=%02x:%02x:%02x:%02x:%02x:%02x\n",
             g_dhcp_client.mac[0], g_dhcp_client.mac[1],
             g_dhcp_client.mac[2], g_dhcp_client.mac[3],
@@ -172,6 +194,9 @@ int dhcp_build_discover(dhcp_packet_t *packet) {
     /* DHCP Message Type: DISCOVER */
     opt = dhcp_add_option_byte(opt, DHCP_OPT_MSG_TYPE, DHCP_MSG_DISCOVER);
 
+    /* Rapid Commit: we take an ACK in place of an OFFER */
+    opt = dhcp_add_option(opt, DHCP_OPT_RAPID_COMMIT, 0, NULL);
+
     /* Client Identifier (Type 1 = Ethernet, followed by MAC) */
     {
         uint8_t client_id[7];
@@ -427,6 +452,29 @@ int dhcp_parse_options(const uint8_t *options, size_t len,
     return DHCP_OK;
 }
 
+/**
+ * Check if an options area (magic cookie first) carries an option
+ */
+static bool dhcp_has_option(const uint8_t *options, size_t len, uint8_t code) {
+    const uint8_t *ptr = options + 4;
+    const uint8_t *end = options + len;
+
+    while (ptr < end && *ptr != DHCP_OPT_END) {
+        if (*ptr == DHCP_OPT_PAD) {
+            ptr++;
+            continue;
+        }
+        if (*ptr == code) {
+            return true;
+        }
+        if (ptr + 1 >= end) {
+            break;
+        }
+        ptr += 2 + ptr[1];
+    }
+    return false;
+}
+
 /**
  * Send a DHCP packet
  */
@@ -483,7 +531,7 @@ int dhcp_discover(void) {
     /* Update state */
     g_dhcp_client.state = DHCP_STATE_SELECTING;
     g_dhcp_client.retries = 0;
-    g_dhcp_client.timeout_time = timer_get_ticks() +
+    g_dhcp_client.timeout_time = timer_now_ms() +
                                   (DHCP_DISCOVER_TIMEOUT * 1000);  /* Convert to ms/ticks */
 
     kprintf("DHCP: DISCOVER sent, xid=0x%08x\n", g_dhcp_client.xid);
@@ -540,13 +588,43 @@ int dhcp_request(uint32_t offered_ip, uint32_t server_ip) {
     if (g_dhcp_client.state == DHCP_STATE_SELECTING) {
         g_dhcp_client.state = DHCP_STATE_REQUESTING;
     }
-    g_dhcp_client.timeout_time = timer_get_ticks() +
+    g_dhcp_client.timeout_time = timer_now_ms() +
                                   (DHCP_REQUEST_TIMEOUT * 1000);
 
     kprintf("DHCP: REQUEST sent\n");
     return DHCP_OK;
 }
 
+/**
+ * Ask for a previously held address again (INIT-REBOOT)
+ */
+int dhcp_init_reboot(uint32_t ip) {
+    int ret;
+
+    if (!g_dhcp_client.initialized) {
+        return DHCP_ERR_NOT_INIT;
+    }
+
+    kprintf("DHCP: INIT-REBOOT with previous address\n");
+
+    g_dhcp_client.xid = dhcp_generate_xid();
+    memset(&g_dhcp_client.lease, 0, sizeof(g_dhcp_client.lease));
+    g_dhcp_client.lease.ip_addr = ip;
+
+    /* Requested IP, no server identifier, broadcast */
+    g_dhcp_client.state = DHCP_STATE_INIT_REBOOT;
+    ret = dhcp_request(ip, 0);
+    if (ret < 0) {
+        g_dhcp_client.state = DHCP_STATE_INIT;
+        return ret;
+    }
+
+    g_dhcp_client.state = DHCP_STATE_REBOOTING;
+    g_dhcp_client.retries = 0;
+    g_dhcp_client.timeout_time = timer_now_ms() + (DHCP_REBOOT_TIMEOUT * 1000);
+    return DHCP_OK;
+}
+
 /**
  * Release the current DHCP lease
  */
@@ -734,7 +812,14 @@ int dhcp_input(const void *packet, size_t len) {
             break;
 
         case DHCP_MSG_ACK:
-            if (g_dhcp_client.state == DHCP_STATE_REQUESTING ||
+            /* An ACK to DISCOVER counts only if the server did a rapid commit */
+            if (g_dhcp_client.state == DHCP_STATE_SELECTING &&
+                !dhcp_has_option(dhcp->options, opt_len, DHCP_OPT_RAPID_COMMIT)) {
+                kprintf("DHCP: Ignoring ACK without Rapid Commit\n");
+                break;
+            }
+            if (g_dhcp_client.state == DHCP_STATE_SELECTING ||
+                g_dhcp_client.state == DHCP_STATE_REQUESTING ||
                 g_dhcp_client.state == DHCP_STATE_RENEWING ||
                 g_dhcp_client.state == DHCP_STATE_REBINDING ||
                 g_dhcp_client.state == DHCP_STATE_REBOOTING) {
@@ -743,7 +828,7 @@ int dhcp_input(const void *packet, size_t len) {
 
                 /* Fill in lease information */
                 lease.ip_addr = dhcp->yiaddr;
-                lease.obtained_time = timer_get_ticks();
+                lease.obtained_time = timer_now_ms();
                 lease.valid = true;
 
                 /* Set default renewal/rebind times if not provided */
@@ -817,7 +902,7 @@ void dhcp_timer_tick(void) {
         return;
     }
 
-    now = timer_get_ticks();
+    now = timer_now_ms();
 
     switch (g_dhcp_client.state) {
         case DHCP_STATE_SELECTING:
@@ -850,6 +935,15 @@ void dhcp_timer_tick(void) {
             }
             break;
 
+        case DHCP_STATE_REBOOTING:
+            /* No answer to INIT-REBOOT: give up the old address */
+            if (now >= g_dhcp_client.timeout_time) {
+                kprintf("DHCP: No answer to INIT-REBOOT\n");
+                memset(&g_dhcp_client.lease, 0, sizeof(g_dhcp_client.lease));
+                g_dhcp_client.state = DHCP_STATE_INIT;
+            }
+            break;
+
         case DHCP_STATE_BOUND:
             /* Check if we need to renew or rebind */
             if (g_dhcp_client.lease.valid) {
@@ -883,6 +977,75 @@ void dhcp_timer_tick(void) {
     }
 }
 
+/**
+ * Save the current lease to DHCP_LEASE_FILE
+ */
+int dhcp_save_lease(void) {
+    dhcp_lease_record_t record;
+    vfs_file_t *file;
+    ssize_t written;
+
+    if (!g_dhcp_client.lease.valid) {
+        return DHCP_ERR_NO_LEASE;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.magic = DHCP_LEASE_MAGIC;
+    memcpy(record.mac, g_dhcp_client.mac, 6);
+    record.expires = clock_realtime_ns() / NSEC_PER_SEC + g_dhcp_client.lease.lease_time;
+    memcpy(&record.lease, &g_dhcp_client.lease, sizeof(record.lease));
+
+    /* Fails harmlessly if the directory is already there */
+    vfs_mkdir("/etc", 0755);
+
+    file = vfs_open(DHCP_LEASE_FILE, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    if (!file) {
+        kprintf("DHCP: Cannot save lease: %s\n", vfs_strerror(vfs_get_error()));
+        return DHCP_ERR_INVALID;
+    }
+    written = vfs_write(file, &record, sizeof(record));
+    vfs_close(file);
+
+    if (written != (ssize_t)sizeof(record)) {
+        kprintf("DHCP: Cannot save lease: write failed\n");
+        return DHCP_ERR_INVALID;
+    }
+    return DHCP_OK;
+}
+
+/**
+ * Load the lease saved by dhcp_save_lease
+ */
+int dhcp_load_lease(dhcp_lease_t *lease) {
+    dhcp_lease_record_t record;
+    vfs_file_t *file;
+    ssize_t got;
+
+    if (!lease) {
+        return DHCP_ERR_INVALID;
+    }
+
+    file = vfs_open(DHCP_LEASE_FILE, VFS_O_RDONLY);
+    if (!file) {
+        return DHCP_ERR_NO_LEASE;
+    }
+    got = vfs_read(file, &record, sizeof(record));
+    vfs_close(file);
+
+    if (got != (ssize_t)sizeof(record) || record.magic != DHCP_LEASE_MAGIC ||
+        memcmp(record.mac, g_dhcp_client.mac, 6) != 0 || record.lease.ip_addr == 0) {
+        return DHCP_ERR_NO_LEASE;
+    }
+    if (record.expires <= clock_realtime_ns() / NSEC_PER_SEC) {
+        kprintf("DHCP: Saved lease has expired\n");
+        return DHCP_ERR_NO_LEASE;
+    }
+
+    memcpy(lease, &record.lease, sizeof(*lease));
+    lease->valid = false;
+    return DHCP_OK;
+}
+
 /**
  * Perform full DHCP configuration (blocking)
  */
@@ -894,6 +1057,8 @@ int dhcp_configure(uint32_t timeout_ms) {
     ssize_t recv_len;
     uint32_t src_ip;
     uint16_t src_port;
+    dhcp_lease_t saved;
+    bool rebooting = false;
 
     if (!g_dhcp_client.initialized) {
         ret = dhcp_init();
@@ -904,50 +1069,89 @@ int dhcp_configure(uint32_t timeout_ms) {
 
     kprintf("DHCP: Starting configuration (timeout=%u ms)\n", timeout_ms);
 
-    start_time = timer_get_ticks();
+    start_time = timer_now_ms();
     deadline = start_time + timeout_ms;
 
-    /* Start discovery */
-    ret = dhcp_discover();
-    if (ret < 0) {
-        return ret;
+    /* Ask for the last address first, then fall back to discovery */
+    if (dhcp_load_lease(&saved) == DHCP_OK && dhcp_init_reboot(saved.ip_addr) == DHCP_OK) {
+        rebooting = true;
+    } else {
+        ret = dhcp_discover();
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     /* Wait for completion or timeout */
-    while (timer_get_ticks() < deadline) {
-        /* Check for incoming packets */
-        recv_len = udp_recvfrom(g_dhcp_socket, recv_buf, sizeof(recv_buf),
-                                &src_ip, &src_port);
-        if (recv_len > 0) {
-            /* Process the received packet */
+    while (timer_now_ms() < deadline) {
+        /* Process everything that has arrived */
+        while ((recv_len = udp_recvfrom(g_dhcp_socket, recv_buf, sizeof(recv_buf),
+                                        &src_ip, &src_port)) > 0) {
             dhcp_input(recv_buf, recv_len);
         }
 
         /* Check if we're done */
         if (g_dhcp_client.state == DHCP_STATE_BOUND) {
-            kprintf("DHCP: Configuration complete\n");
+            kprintf("DHCP: Configuration complete in %llu ms\n", timer_now_ms() - start_time);
+            dhcp_save_lease();
             return DHCP_OK;
         }
 
-        /* Handle timeouts and retries */
-        dhcp_timer_tick();
-
         /* If we went back to INIT state, restart discovery */
         if (g_dhcp_client.state == DHCP_STATE_INIT) {
+            if (rebooting) {
+                /* The saved address was refused or went unanswered */
+                vfs_unlink(DHCP_LEASE_FILE);
+                rebooting = false;
+            }
             ret = dhcp_discover();
             if (ret < 0) {
                 return ret;
             }
         }
 
-        /* Small delay to avoid busy-waiting */
-        timer_sleep_ms(100);
+        /* Short delay to avoid busy-waiting */
+        timer_sleep_ms(DHCP_POLL_MS);
     }
 
     kprintf("DHCP: Configuration timed out\n");
     return DHCP_ERR_TIMEOUT;
 }
 
+/**
+ * Body of the thread started by dhcp_configure_async
+ */
+static void dhcp_async_thread(void *arg) {
+    UNUSED(arg);
+
+    int ret = dhcp_configure(g_dhcp_async_timeout);
+    if (g_dhcp_async_done) {
+        g_dhcp_async_done(ret, g_dhcp_async_arg);
+    }
+    g_dhcp_async_running = false;
+}
+
+/**
+ * Run dhcp_configure on a kernel thread of its own
+ */
+int dhcp_configure_async(uint32_t timeout_ms, dhcp_done_fn_t done, void *arg) {
+    if (__sync_lock_test_and_set(&g_dhcp_async_running, true)) {
+        return DHCP_ERR_INVALID;
+    }
+
+    g_dhcp_async_timeout = timeout_ms;
+    g_dhcp_async_done = done;
+    g_dhcp_async_arg = arg;
+
+    process_t *thread = thread_create(NULL, "dhcp", dhcp_async_thread, NULL);
+    if (!thread || !scheduler_add(thread)) {
+        kprintf("DHCP: Failed to start configuration thread\n");
+        g_dhcp_async_running = false;
+        return DHCP_ERR_NOMEM;
+    }
+    return DHCP_OK;
+}
+
 /**
  * Debug: Dump DHCP packet contents
  */
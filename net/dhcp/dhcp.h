@@ -6,6 +6,10 @@
  *   - Automatic IP address configuration
  *   - Lease management and renewal
  *   - Network parameter discovery (gateway, DNS, etc.)
+ *   - Fast reconfiguration: the last lease is kept in DHCP_LEASE_FILE and
+ *     asked for again with INIT-REBOOT on the next boot; DISCOVER carries
+ *     Rapid Commit (RFC 4039) so a server that supports it answers with
+ *     an ACK straight away
  */
 
 #ifndef _AAAOS_NET_DHCP_H
@@ -68,6 +72,7 @@
 #define DHCP_OPT_RENEWAL_TIME   58          /* Renewal (T1) time */
 #define DHCP_OPT_REBINDING_TIME 59          /* Rebinding (T2) time */
 #define DHCP_OPT_CLIENT_ID      61          /* Client identifier */
+#define DHCP_OPT_RAPID_COMMIT   80          /* Rapid Commit, RFC 4039 (no data) */
 #define DHCP_OPT_END            255         /* End of options marker */
 
 /* DHCP Client States */
@@ -96,8 +101,15 @@ typedef enum dhcp_state {
 #define DHCP_DISCOVER_TIMEOUT   4           /* Initial DISCOVER timeout */
 #define DHCP_REQUEST_TIMEOUT    4           /* Initial REQUEST timeout */
 #define DHCP_MAX_RETRIES        4           /* Maximum retry count */
+#define DHCP_REBOOT_TIMEOUT     1           /* INIT-REBOOT wait before DISCOVER */
 #define DHCP_DEFAULT_LEASE      86400       /* Default lease time (24 hours) */
 
+/* dhcp_configure polls the socket this often (ms) */
+#define DHCP_POLL_MS            5
+
+/* Where the last lease is kept across boots */
+#define DHCP_LEASE_FILE         "/etc/dhcp.lease"
+
 /**
  * DHCP Packet Structure (236 bytes minimum)
  *
@@ -160,7 +172,7 @@ typedef struct dhcp_lease {
     uint32_t lease_time;        /* Lease duration in seconds */
     uint32_t renewal_time;      /* T1 renewal time (default: lease_time/2) */
     uint32_t rebind_time;       /* T2 rebinding time (default: lease_time*0.875) */
-    uint64_t obtained_time;     /* Timestamp when lease was obtained (ticks) */
+    uint64_t obtained_time;     /* Timestamp when lease was obtained (ms) */
     bool     valid;             /* Lease is valid */
 } dhcp_lease_t;
 
@@ -273,8 +285,8 @@ const char *dhcp_state_string(dhcp_state_t state);
 /**
  * DHCP timer tick handler
  *
- * Should be called periodically to handle timeouts, retransmissions,
- * and lease renewal. Call approximately once per second.
+ * Handles timeouts, retransmissions, and lease renewal. Runs once per
+ * second from a kernel timer started by dhcp_init.
  */
 void dhcp_timer_tick(void);
 
@@ -285,17 +297,65 @@ void dhcp_timer_tick(void);
  */
 bool dhcp_is_configured(void);
 
+/**
+ * Ask for a previously held address again (INIT-REBOOT)
+ *
+ * Broadcasts a REQUEST for ip with no server identifier. The server ACKs
+ * if the address is still ours and NAKs otherwise; with no answer within
+ * DHCP_REBOOT_TIMEOUT the client returns to INIT.
+ *
+ * @param ip Address to ask for (network byte order)
+ * @return DHCP_OK on success, negative error code on failure
+ */
+int dhcp_init_reboot(uint32_t ip);
+
 /**
  * Perform full DHCP configuration (blocking)
  *
- * Performs complete DHCP negotiation: DISCOVER -> OFFER -> REQUEST -> ACK
- * This is a blocking function that waits for the full exchange.
+ * With a saved lease that has not expired, first tries INIT-REBOOT for
+ * its address; otherwise, or if that is refused or unanswered, runs
+ * DISCOVER -> OFFER -> REQUEST -> ACK (DISCOVER -> ACK with Rapid
+ * Commit). The lease obtained is saved to DHCP_LEASE_FILE.
  *
  * @param timeout_ms Maximum time to wait in milliseconds
  * @return DHCP_OK on success, negative error code on failure
  */
 int dhcp_configure(uint32_t timeout_ms);
 
+/**
+ * Completion callback of dhcp_configure_async (runs on the DHCP thread)
+ * @param result Return value of dhcp_configure
+ * @param arg    Argument given to dhcp_configure_async
+ */
+typedef void (*dhcp_done_fn_t)(int result, void *arg);
+
+/**
+ * Run dhcp_configure on a kernel thread of its own
+ *
+ * Returns at once, so bring-up does not hold up the caller.
+ *
+ * @param timeout_ms Passed to dhcp_configure
+ * @param done       Called with the result when it finishes (can be NULL)
+ * @param arg        Passed to done
+ * @return DHCP_OK if the thread was started, DHCP_ERR_INVALID if a
+ *         configuration is already running, DHCP_ERR_NOMEM otherwise
+ */
+int dhcp_configure_async(uint32_t timeout_ms, dhcp_done_fn_t done, void *arg);
+
+/**
+ * Save the current lease to DHCP_LEASE_FILE
+ * @return DHCP_OK on success, negative error code on failure
+ */
+int dhcp_save_lease(void);
+
+/**
+ * Load the lease saved by dhcp_save_lease
+ * Fails for a lease saved by another interface or already expired.
+ * @param lease Filled in on success (valid is left false)
+ * @return DHCP_OK on success, DHCP_ERR_NO_LEASE otherwise
+ */
+int dhcp_load_lease(dhcp_lease_t *lease);
+
 /*
  * Internal/Helper Functions (used by implementation)
  */
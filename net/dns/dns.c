@@ -2,23 +2,44 @@
  * AAAos Network Stack - DNS Resolver Implementation
  *
  * Implements DNS resolution with caching support.
- * Uses UDP port 53 for queries.
+ * Uses UDP port 53 for queries, all sent from one socket bound on first use.
+ * A reply is accepted only from a configured server's port 53, with the
+ * ID and question of a query in flight.
  */
 
 #include "dns.h"
 #include "../../kernel/include/serial.h"
 #include "../../lib/libc/string.h"
 #include "../core/netbuf.h"
+#include "../udp/udp.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/waitq.h"
+#include "../../security/crypto/crypto.h"
 
 /* Global DNS resolver state */
 static dns_resolver_t dns_resolver;
 
-/* Simple tick counter for cache expiration (should be replaced with real timer) */
-static uint64_t dns_get_ticks(void) {
-    /* In a real implementation, this would return system ticks/time */
-    /* For now, we use a simple incrementing counter */
-    static uint64_t ticks = 0;
-    return ticks++;
+/* Covers the cache, the queries and the statistics */
+static volatile int dns_lock = 0;
+
+/* Set while dns_poll runs, so it never runs twice at once */
+static volatile int dns_polling = 0;
+
+/* Runs dns_poll */
+static ktimer_t dns_timer;
+
+static inline uint64_t dns_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&dns_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void dns_lock_release(uint64_t flags) {
+    __sync_lock_release(&dns_lock);
+    interrupts_restore(flags);
 }
 
 /*
@@ -33,13 +54,6 @@ static inline uint16_t ntohs(uint16_t n) {
     return ((n & 0xFF) << 8) | ((n >> 8) & 0xFF);
 }
 
-static inline uint32_t htonl(uint32_t h) {
-    return ((h & 0xFF) << 24) |
-           ((h & 0xFF00) << 8) |
-           ((h >> 8) & 0xFF00) |
-           ((h >> 24) & 0xFF);
-}
-
 static inline uint32_t ntohl(uint32_t n) {
     return ((n & 0xFF) << 24) |
            ((n & 0xFF00) << 8) |
@@ -47,18 +61,21 @@ static inline uint32_t ntohl(uint32_t n) {
            ((n >> 24) & 0xFF);
 }
 
+/* Big-endian fields at any alignment */
+static inline uint16_t dns_get16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t dns_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
 /**
- * Generate a random query ID
- * In a real implementation, this should use a proper PRNG
+ * Generate a query ID
+ * IDs come from the CSPRNG, so spoofed replies have to guess them.
  */
 static uint16_t dns_generate_id(void) {
-    dns_resolver.next_id++;
-    /* Simple LFSR-like mixing */
-    uint16_t id = dns_resolver.next_id;
-    id ^= (id << 7);
-    id ^= (id >> 9);
-    id ^= (id << 8);
-    return id;
+    return (uint16_t)random_uint32();
 }
 
 /**
@@ -80,6 +97,24 @@ static int dns_strcasecmp(const char *s1, const char *s2) {
     return (int)(unsigned char)*s1 - (int)(unsigned char)*s2;
 }
 
+/**
+ * Cache bucket of a hostname (FNV-1a over the lowercased name)
+ */
+static uint32_t dns_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        char c = *name++;
+        if (c >= 'A' && c <= 'Z') c += 32;
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash & (DNS_CACHE_HASH_SIZE - 1);
+}
+
+static void dns_timer_expired(void *arg) {
+    UNUSED(arg);
+    dns_poll();
+}
+
 int dns_init(void) {
     kprintf("[DNS] Initializing DNS resolver\n");
 
@@ -87,17 +122,18 @@ int dns_init(void) {
     memset(&dns_resolver, 0, sizeof(dns_resolver));
 
     /* Set default DNS server (Google DNS: 8.8.8.8) */
-    dns_resolver.server_ip = DNS_DEFAULT_SERVER;
-
-    /* Initialize query ID with some entropy */
-    dns_resolver.next_id = (uint16_t)(dns_get_ticks() & 0xFFFF);
+    dns_resolver.servers[0] = DNS_DEFAULT_SERVER;
+    dns_resolver.server_count = 1;
 
     /* Clear cache */
     dns_cache_clear();
 
     dns_resolver.initialized = true;
 
-    kprintf("[DNS] Resolver initialized, server: 8.8.8.8\n");
+    ktimer_init_soft(&dns_timer, dns_timer_expired, NULL);
+    ktimer_start(&dns_timer, DNS_POLL_MS * NSEC_PER_MSEC, DNS_POLL_MS * NSEC_PER_MSEC);
+
+    kprintf("[DNS] Resolver initialized, server: 8.8.8.8, %u cache entries\n", DNS_CACHE_SIZE);
     return DNS_OK;
 }
 
@@ -112,7 +148,10 @@ int dns_set_server(uint32_t server_ip) {
         return DNS_ERR_INVALID_NAME;
     }
 
-    dns_resolver.server_ip = server_ip;
+    uint64_t flags = dns_lock_acquire();
+    dns_resolver.servers[0] = server_ip;
+    dns_resolver.server_count = 1;
+    dns_lock_release(flags);
 
     char ip_str[16];
     dns_ip_to_string(server_ip, ip_str, sizeof(ip_str));
@@ -121,8 +160,40 @@ int dns_set_server(uint32_t server_ip) {
     return DNS_OK;
 }
 
+int dns_add_server(uint32_t server_ip) {
+    if (!dns_resolver.initialized) {
+        kprintf("[DNS] Error: resolver not initialized\n");
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    if (server_ip == 0) {
+        kprintf("[DNS] Error: invalid server IP address\n");
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    uint64_t flags = dns_lock_acquire();
+    for (uint32_t i = 0; i < dns_resolver.server_count; i++) {
+        if (dns_resolver.servers[i] == server_ip) {
+            dns_lock_release(flags);
+            return DNS_OK;
+        }
+    }
+    if (dns_resolver.server_count >= DNS_MAX_SERVERS) {
+        dns_lock_release(flags);
+        return DNS_ERR_NO_MEMORY;
+    }
+    dns_resolver.servers[dns_resolver.server_count++] = server_ip;
+    dns_lock_release(flags);
+
+    char ip_str[16];
+    dns_ip_to_string(server_ip, ip_str, sizeof(ip_str));
+    kprintf("[DNS] Server %s added\n", ip_str);
+
+    return DNS_OK;
+}
+
 uint32_t dns_get_server(void) {
-    return dns_resolver.server_ip;
+    return dns_resolver.servers[0];
 }
 
 bool dns_validate_hostname(const char *hostname) {
@@ -324,24 +395,16 @@ int dns_decode_name(const uint8_t *packet, size_t pkt_len, const uint8_t *data,
     return bytes_consumed;
 }
 
-int dns_build_query(const char *hostname, void *buf) {
-    if (!dns_resolver.initialized) {
-        kprintf("[DNS] Error: resolver not initialized\n");
-        return DNS_ERR_INVALID_NAME;
-    }
-
-    if (hostname == NULL || buf == NULL) {
-        return DNS_ERR_INVALID_NAME;
-    }
-
-    kprintf("[DNS] Building query for: %s\n", hostname);
-
+/**
+ * Build an A query for hostname with the given ID
+ */
+static int dns_build_packet(const char *hostname, uint16_t id, void *buf) {
     uint8_t *packet = (uint8_t *)buf;
     size_t offset = 0;
 
     /* Build DNS header */
     dns_header_t *header = (dns_header_t *)packet;
-    header->id = htons(dns_generate_id());
+    header->id = htons(id);
     header->flags = htons(DNS_FLAG_RD);  /* Recursion desired */
     header->qdcount = htons(1);          /* One question */
     header->ancount = htons(0);
@@ -364,31 +427,78 @@ int dns_build_query(const char *hostname, void *buf) {
     question->qclass = htons(DNS_CLASS_IN);
     offset += sizeof(dns_question_t);
 
-    kprintf("[DNS] Query built, size: %u bytes, ID: 0x%04x\n",
-            (uint32_t)offset, ntohs(header->id));
-
     return (int)offset;
 }
 
-int dns_parse_response(const void *response, size_t len, uint32_t *ip_out, uint32_t *ttl_out) {
-    if (response == NULL || ip_out == NULL) {
+int dns_build_query(const char *hostname, void *buf) {
+    if (!dns_resolver.initialized) {
+        kprintf("[DNS] Error: resolver not initialized\n");
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    if (hostname == NULL || buf == NULL) {
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    return dns_build_packet(hostname, dns_generate_id(), buf);
+}
+
+/**
+ * What a reply says
+ */
+typedef struct dns_reply {
+    uint16_t id;                        /* Query ID it answers */
+    uint32_t ip;                        /* Address, if there is one */
+    uint32_t ttl;                       /* How long the answer (or its absence) holds */
+    char     qname[DNS_MAX_NAME_LEN + 1];   /* Name asked about */
+} dns_reply_t;
+
+/**
+ * Read the name, type, class, TTL and RDATA length of a record
+ * @return DNS_OK with *offset at the RDATA, or DNS_ERR_FORMAT
+ */
+static int dns_read_rr(const uint8_t *packet, size_t len, size_t *offset, uint16_t *type,
+                       uint16_t *class, uint32_t *ttl, uint16_t *rdlength) {
+    char name[DNS_MAX_NAME_LEN + 1];
+    int name_bytes = dns_decode_name(packet, len, packet + *offset, name, sizeof(name));
+    if (name_bytes < 0) {
+        return DNS_ERR_FORMAT;
+    }
+    size_t pos = *offset + (size_t)name_bytes;
+    if (pos + sizeof(dns_answer_t) > len) {
+        return DNS_ERR_FORMAT;
+    }
+
+    *type = dns_get16(packet + pos);
+    *class = dns_get16(packet + pos + 2);
+    *ttl = dns_get32(packet + pos + 4);
+    *rdlength = dns_get16(packet + pos + 8);
+    pos += sizeof(dns_answer_t);
+
+    if (pos + *rdlength > len) {
         return DNS_ERR_FORMAT;
     }
+    *offset = pos;
+    return DNS_OK;
+}
 
+/**
+ * Parse a reply to an A query
+ * @return DNS_OK with the address, DNS_ERR_NOT_FOUND if the name has no
+ *         address (reply->ttl says for how long), or another error
+ */
+static int dns_parse(const uint8_t *packet, size_t len, dns_reply_t *reply) {
     if (len < DNS_HEADER_SIZE) {
         kprintf("[DNS] Response too short: %u bytes\n", (uint32_t)len);
         return DNS_ERR_FORMAT;
     }
 
-    const uint8_t *packet = (const uint8_t *)response;
-    const dns_header_t *header = (const dns_header_t *)packet;
-
-    uint16_t flags = ntohs(header->flags);
-    uint16_t id = ntohs(header->id);
-    uint16_t qdcount = ntohs(header->qdcount);
-    uint16_t ancount = ntohs(header->ancount);
-
-    kprintf("[DNS] Parsing response, ID: 0x%04x, flags: 0x%04x\n", id, flags);
+    uint16_t flags = dns_get16(packet + 2);
+    uint16_t qdcount = dns_get16(packet + 4);
+    uint16_t ancount = dns_get16(packet + 6);
+    uint16_t nscount = dns_get16(packet + 8);
+    reply->id = dns_get16(packet);
+    reply->qname[0] = '\0';
 
     /* Check QR bit (should be 1 for response) */
     if (!(flags & DNS_FLAG_QR)) {
@@ -396,128 +506,226 @@ int dns_parse_response(const void *response, size_t len, uint32_t *ip_out, uint3
         return DNS_ERR_FORMAT;
     }
 
-    /* Check for errors */
+    /* The question, to match the reply to what was asked */
+    size_t offset = DNS_HEADER_SIZE;
+    for (uint16_t i = 0; i < qdcount; i++) {
+        char name[DNS_MAX_NAME_LEN + 1];
+        int name_bytes = dns_decode_name(packet, len, packet + offset, name, sizeof(name));
+        if (name_bytes < 0 || offset + (size_t)name_bytes + sizeof(dns_question_t) > len) {
+            kprintf("[DNS] Malformed question section\n");
+            return DNS_ERR_FORMAT;
+        }
+        if (i == 0) {
+            memcpy(reply->qname, name, sizeof(name));
+        }
+        offset += (size_t)name_bytes + sizeof(dns_question_t);
+    }
+
     uint8_t rcode = flags & DNS_FLAG_RCODE_MASK;
-    if (rcode != DNS_RCODE_OK) {
+    if (rcode == DNS_RCODE_FORMAT_ERR) {
+        return DNS_ERR_FORMAT;
+    }
+    if (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NAME_ERR) {
         kprintf("[DNS] Server returned error: %u\n", rcode);
-        switch (rcode) {
-            case DNS_RCODE_FORMAT_ERR:
-                return DNS_ERR_FORMAT;
-            case DNS_RCODE_SERVER_FAIL:
-                return DNS_ERR_SERVER;
-            case DNS_RCODE_NAME_ERR:
-                kprintf("[DNS] Name not found (NXDOMAIN)\n");
-                return DNS_ERR_NOT_FOUND;
-            case DNS_RCODE_NOT_IMPL:
-            case DNS_RCODE_REFUSED:
-                return DNS_ERR_SERVER;
-            default:
-                return DNS_ERR_SERVER;
+        return DNS_ERR_SERVER;
+    }
+
+    /* An A record, possibly behind CNAMEs; the chain lasts as long as its shortest link */
+    uint32_t min_ttl = DNS_MAX_TTL;
+    for (uint16_t i = 0; i < ancount && rcode == DNS_RCODE_OK; i++) {
+        uint16_t type, class, rdlength;
+        uint32_t ttl;
+        if (dns_read_rr(packet, len, &offset, &type, &class, &ttl, &rdlength) != DNS_OK) {
+            kprintf("[DNS] Truncated answer section\n");
+            return DNS_ERR_FORMAT;
         }
+        min_ttl = MIN(min_ttl, ttl);
+
+        if (type == DNS_TYPE_A && class == DNS_CLASS_IN && rdlength == 4) {
+            memcpy(&reply->ip, packet + offset, 4);
+            reply->ttl = min_ttl;
+            return DNS_OK;
+        }
+        offset += rdlength;
     }
 
-    /* Check for truncation */
     if (flags & DNS_FLAG_TC) {
         kprintf("[DNS] Response was truncated\n");
-        /* Continue anyway, we might still get an answer */
+        return DNS_ERR_TRUNCATED;
     }
 
-    if (ancount == 0) {
-        kprintf("[DNS] No answers in response\n");
-        return DNS_ERR_NOT_FOUND;
+    /* No address: the SOA in the authority section says how long that holds */
+    reply->ttl = DNS_NEGATIVE_TTL;
+    for (uint16_t i = 0; i < nscount; i++) {
+        uint16_t type, class, rdlength;
+        uint32_t ttl;
+        if (dns_read_rr(packet, len, &offset, &type, &class, &ttl, &rdlength) != DNS_OK) {
+            break;
+        }
+        if (type == DNS_TYPE_SOA) {
+            /* MNAME and RNAME, then serial, refresh, retry, expire, minimum */
+            char name[DNS_MAX_NAME_LEN + 1];
+            size_t pos = offset;
+            for (int n = 0; n < 2; n++) {
+                int name_bytes = dns_decode_name(packet, len, packet + pos, name, sizeof(name));
+                if (name_bytes < 0) {
+                    break;
+                }
+                pos += (size_t)name_bytes;
+            }
+            if (pos + 20 <= offset + rdlength) {
+                reply->ttl = MIN(ttl, dns_get32(packet + pos + 16));
+            }
+            break;
+        }
+        offset += rdlength;
     }
 
-    kprintf("[DNS] Response contains %u questions, %u answers\n", qdcount, ancount);
+    if (rcode == DNS_RCODE_NAME_ERR) {
+        kprintf("[DNS] Name not found (NXDOMAIN)\n");
+    }
+    return DNS_ERR_NOT_FOUND;
+}
 
-    /* Skip the question section */
-    size_t offset = DNS_HEADER_SIZE;
+int dns_parse_response(const void *response, size_t len, uint32_t *ip_out, uint32_t *ttl_out) {
+    if (response == NULL || ip_out == NULL) {
+        return DNS_ERR_FORMAT;
+    }
 
-    for (uint16_t i = 0; i < qdcount; i++) {
-        /* Skip QNAME */
-        while (offset < len) {
-            uint8_t label_len = packet[offset];
-            if (label_len == 0) {
-                offset++;  /* Skip the null terminator */
-                break;
-            }
-            if ((label_len & 0xC0) == 0xC0) {
-                /* Compression pointer */
-                offset += 2;
-                break;
-            }
-            offset += label_len + 1;
-        }
-        /* Skip QTYPE and QCLASS */
-        offset += sizeof(dns_question_t);
+    dns_reply_t reply;
+    int result = dns_parse((const uint8_t *)response, len, &reply);
+    if (result != DNS_OK) {
+        return result;
+    }
 
-        if (offset > len) {
-            kprintf("[DNS] Malformed question section\n");
-            return DNS_ERR_FORMAT;
-        }
+    *ip_out = reply.ip;
+    if (ttl_out != NULL) {
+        *ttl_out = reply.ttl;
     }
 
-    /* Parse answer section */
-    for (uint16_t i = 0; i < ancount; i++) {
-        if (offset >= len) {
-            kprintf("[DNS] Truncated answer section\n");
-            return DNS_ERR_FORMAT;
-        }
+    char ip_str[16];
+    dns_ip_to_string(reply.ip, ip_str, sizeof(ip_str));
+    kprintf("[DNS] Resolved to %s (TTL: %u)\n", ip_str, reply.ttl);
+    return DNS_OK;
+}
 
-        /* Decode name (skip it) */
-        char name[DNS_MAX_NAME_LEN + 1];
-        int name_bytes = dns_decode_name(packet, len, packet + offset, name, sizeof(name));
-        if (name_bytes < 0) {
-            kprintf("[DNS] Failed to decode answer name\n");
-            return DNS_ERR_FORMAT;
-        }
-        offset += name_bytes;
+/* Cache */
 
-        /* Check bounds for answer header */
-        if (offset + sizeof(dns_answer_t) > len) {
-            kprintf("[DNS] Truncated answer record\n");
-            return DNS_ERR_FORMAT;
-        }
+/**
+ * Take an entry out of its bucket and put it on the free list (dns_lock held)
+ */
+static void dns_cache_remove(int16_t idx) {
+    dns_cache_entry_t *entry = &dns_resolver.cache[idx];
+    int16_t *link = &dns_resolver.cache_hash[dns_hash(entry->name)];
 
-        /* Read answer header */
-        uint16_t atype = ntohs(*(uint16_t *)(packet + offset));
-        offset += 2;
-        uint16_t aclass = ntohs(*(uint16_t *)(packet + offset));
-        offset += 2;
-        uint32_t attl = ntohl(*(uint32_t *)(packet + offset));
-        offset += 4;
-        uint16_t rdlength = ntohs(*(uint16_t *)(packet + offset));
-        offset += 2;
+    while (*link >= 0 && *link != idx) {
+        link = &dns_resolver.cache[*link].next;
+    }
+    if (*link == idx) {
+        *link = entry->next;
+    }
 
-        kprintf("[DNS] Answer %u: type=%u, class=%u, ttl=%u, rdlen=%u\n",
-                i, atype, aclass, (uint32_t)attl, rdlength);
+    entry->valid = false;
+    entry->name[0] = '\0';
+    entry->next = dns_resolver.cache_free;
+    dns_resolver.cache_free = idx;
+    dns_resolver.cache_count--;
+}
 
-        /* Check bounds for RDATA */
-        if (offset + rdlength > len) {
-            kprintf("[DNS] Truncated RDATA\n");
-            return DNS_ERR_FORMAT;
+/**
+ * Find the entry for a name, dropping it if it has expired (dns_lock held)
+ * @return Index of the entry, or -1
+ */
+static int16_t dns_cache_find(const char *hostname, uint64_t now) {
+    int16_t idx = dns_resolver.cache_hash[dns_hash(hostname)];
+    while (idx >= 0) {
+        dns_cache_entry_t *entry = &dns_resolver.cache[idx];
+        if (dns_strcasecmp(entry->name, hostname) == 0) {
+            if (entry->expires <= now) {
+                kprintf("[DNS] Cache entry expired: %s\n", entry->name);
+                dns_cache_remove(idx);
+                return -1;
+            }
+            return idx;
         }
+        idx = entry->next;
+    }
+    return -1;
+}
 
-        /* Check if this is an A record */
-        if (atype == DNS_TYPE_A && aclass == DNS_CLASS_IN && rdlength == 4) {
-            /* Found an A record! */
-            *ip_out = *(uint32_t *)(packet + offset);
-            if (ttl_out != NULL) {
-                *ttl_out = attl;
+/**
+ * Get an unused entry, evicting an expired one or else the least recently
+ * used (dns_lock held)
+ */
+static int16_t dns_cache_alloc(uint64_t now) {
+    if (dns_resolver.cache_free < 0) {
+        int16_t victim = 0;
+        for (int16_t i = 0; i < DNS_CACHE_SIZE; i++) {
+            dns_cache_entry_t *entry = &dns_resolver.cache[i];
+            if (entry->expires <= now) {
+                victim = i;
+                break;
+            }
+            if (entry->used < dns_resolver.cache[victim].used) {
+                victim = i;
             }
+        }
+        dns_cache_remove(victim);
+    }
 
-            char ip_str[16];
-            dns_ip_to_string(*ip_out, ip_str, sizeof(ip_str));
-            kprintf("[DNS] Resolved to %s (TTL: %u)\n", ip_str, (uint32_t)attl);
+    int16_t idx = dns_resolver.cache_free;
+    dns_resolver.cache_free = dns_resolver.cache[idx].next;
+    dns_resolver.cache_count++;
+    return idx;
+}
 
-            return DNS_OK;
-        }
+/**
+ * Add or update an entry (dns_lock held)
+ */
+static void dns_cache_store(const char *hostname, uint32_t ip, uint32_t ttl, bool negative) {
+    uint64_t now = timer_now_ms();
+
+    int16_t idx = dns_cache_find(hostname, now);
+    dns_cache_entry_t *entry;
+    if (idx >= 0) {
+        entry = &dns_resolver.cache[idx];
+    } else {
+        idx = dns_cache_alloc(now);
+        entry = &dns_resolver.cache[idx];
+        strncpy(entry->name, hostname, DNS_MAX_NAME_LEN);
+        entry->name[DNS_MAX_NAME_LEN] = '\0';
+        uint32_t bucket = dns_hash(entry->name);
+        entry->next = dns_resolver.cache_hash[bucket];
+        dns_resolver.cache_hash[bucket] = idx;
+        entry->valid = true;
+    }
 
-        /* Skip RDATA and continue to next record */
-        offset += rdlength;
+    entry->ip = negative ? 0 : ip;
+    entry->negative = negative;
+    entry->expires = now + (uint64_t)ttl * 1000;
+    entry->used = now;
+}
+
+/**
+ * Answer a lookup from the cache (dns_lock held)
+ * @return DNS_OK, DNS_ERR_NOT_FOUND for a negative entry, or DNS_ERR_NOT_CACHED
+ */
+static int dns_cache_get(const char *hostname, uint32_t *ip_out) {
+    uint64_t now = timer_now_ms();
+    int16_t idx = dns_cache_find(hostname, now);
+    if (idx < 0) {
+        return DNS_ERR_NOT_CACHED;
     }
 
-    kprintf("[DNS] No A record found in response\n");
-    return DNS_ERR_NOT_FOUND;
+    dns_cache_entry_t *entry = &dns_resolver.cache[idx];
+    entry->used = now;
+    if (entry->negative) {
+        dns_resolver.stats.negative_hits++;
+        return DNS_ERR_NOT_FOUND;
+    }
+    dns_resolver.stats.cache_hits++;
+    *ip_out = entry->ip;
+    return DNS_OK;
 }
 
 int dns_cache_lookup(const char *hostname, uint32_t *ip_out) {
@@ -529,146 +737,400 @@ int dns_cache_lookup(const char *hostname, uint32_t *ip_out) {
         return DNS_ERR_INVALID_NAME;
     }
 
-    uint64_t current_time = dns_get_ticks();
+    uint64_t flags = dns_lock_acquire();
+    int result = dns_cache_get(hostname, ip_out);
+    dns_lock_release(flags);
+
+    if (result == DNS_OK) {
+        char ip_str[16];
+        dns_ip_to_string(*ip_out, ip_str, sizeof(ip_str));
+        kprintf("[DNS] Cache hit: %s -> %s\n", hostname, ip_str);
+    } else if (result == DNS_ERR_NOT_FOUND) {
+        kprintf("[DNS] Cache hit: %s does not exist\n", hostname);
+    } else {
+        kprintf("[DNS] Cache miss: %s\n", hostname);
+    }
+    return result;
+}
+
+int dns_cache_add(const char *hostname, uint32_t ip, uint32_t ttl) {
+    if (!dns_resolver.initialized) {
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    if (hostname == NULL || strlen(hostname) > DNS_MAX_NAME_LEN) {
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    /* Clamp TTL to valid range */
+    ttl = CLAMP(ttl, DNS_MIN_TTL, DNS_MAX_TTL);
+
+    uint64_t flags = dns_lock_acquire();
+    dns_cache_store(hostname, ip, ttl, false);
+    dns_lock_release(flags);
+
+    char ip_str[16];
+    dns_ip_to_string(ip, ip_str, sizeof(ip_str));
+    kprintf("[DNS] Cache add: %s -> %s (TTL: %u)\n", hostname, ip_str, ttl);
+
+    return DNS_OK;
+}
+
+int dns_cache_add_negative(const char *hostname, uint32_t ttl) {
+    if (!dns_resolver.initialized) {
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    if (hostname == NULL || strlen(hostname) > DNS_MAX_NAME_LEN) {
+        return DNS_ERR_INVALID_NAME;
+    }
+
+    /* A TTL of 0 means the answer must not be kept */
+    ttl = MIN(ttl, DNS_NEGATIVE_MAX_TTL);
+    if (ttl == 0) {
+        return DNS_OK;
+    }
+
+    uint64_t flags = dns_lock_acquire();
+    dns_cache_store(hostname, 0, ttl, true);
+    dns_lock_release(flags);
+
+    kprintf("[DNS] Cache add: %s does not exist (TTL: %u)\n", hostname, ttl);
+    return DNS_OK;
+}
 
+void dns_cache_clear(void) {
+    kprintf("[DNS] Clearing cache\n");
+
+    uint64_t flags = dns_lock_acquire();
+    for (int i = 0; i < DNS_CACHE_HASH_SIZE; i++) {
+        dns_resolver.cache_hash[i] = -1;
+    }
     for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        dns_cache_entry_t *entry = &dns_resolver.cache[i];
+        dns_resolver.cache[i].valid = false;
+        dns_resolver.cache[i].name[0] = '\0';
+        dns_resolver.cache[i].next = (int16_t)(i + 1 < DNS_CACHE_SIZE ? i + 1 : -1);
+    }
+    dns_resolver.cache_free = 0;
+    dns_resolver.cache_count = 0;
+    dns_lock_release(flags);
+}
 
-        if (!entry->valid) {
-            continue;
-        }
+/* Queries */
 
-        /* Check if entry has expired */
-        uint64_t age = current_time - entry->timestamp;
-        if (age > entry->ttl) {
-            /* Entry expired, invalidate it */
-            entry->valid = false;
-            kprintf("[DNS] Cache entry expired: %s\n", entry->name);
-            continue;
-        }
+/**
+ * A finished query, handed to its waiters once dns_lock is dropped
+ */
+typedef struct dns_done {
+    char     name[DNS_MAX_NAME_LEN + 1];
+    dns_waiter_t waiters[DNS_MAX_WAITERS];
+    uint32_t waiter_count;
+    int      status;
+    uint32_t ip;
+} dns_done_t;
 
-        /* Case-insensitive comparison */
-        if (dns_strcasecmp(entry->name, hostname) == 0) {
-            *ip_out = entry->ip;
+/**
+ * Retire a query (dns_lock held)
+ */
+static void dns_query_finish(dns_query_t *q, int status, uint32_t ip, dns_done_t *done) {
+    memcpy(done->name, q->name, sizeof(done->name));
+    memcpy(done->waiters, q->waiters, sizeof(done->waiters));
+    done->waiter_count = q->waiter_count;
+    done->status = status;
+    done->ip = ip;
+    q->active = false;
+}
 
-            char ip_str[16];
-            dns_ip_to_string(*ip_out, ip_str, sizeof(ip_str));
-            kprintf("[DNS] Cache hit: %s -> %s\n", hostname, ip_str);
+static void dns_done_notify(const dns_done_t *done) {
+    for (uint32_t i = 0; i < done->waiter_count; i++) {
+        done->waiters[i].cb(done->name, done->status, done->ip, done->waiters[i].arg);
+    }
+}
 
-            return DNS_OK;
+/**
+ * Find the query in flight for a name (dns_lock held)
+ */
+static dns_query_t *dns_query_find(const char *hostname) {
+    for (int i = 0; i < DNS_MAX_PENDING; i++) {
+        dns_query_t *q = &dns_resolver.queries[i];
+        if (q->active && dns_strcasecmp(q->name, hostname) == 0) {
+            return q;
         }
     }
+    return NULL;
+}
 
-    kprintf("[DNS] Cache miss: %s\n", hostname);
-    return DNS_ERR_NOT_FOUND;
+/**
+ * The socket queries are sent from, bound on first use
+ */
+static udp_socket_t *dns_socket(void) {
+    udp_socket_t *sock = dns_resolver.socket;
+    if (sock != NULL) {
+        return sock;
+    }
+
+    sock = udp_bind(0);
+    if (sock == NULL) {
+        kprintf("[DNS] Error: cannot bind a UDP port\n");
+        return NULL;
+    }
+    udp_set_nonblock(sock, true);
+    if (!__sync_bool_compare_and_swap(&dns_resolver.socket, NULL, sock)) {
+        udp_close(sock);
+    }
+    return dns_resolver.socket;
 }
 
-int dns_cache_add(const char *hostname, uint32_t ip, uint32_t ttl) {
+/**
+ * Send a query to every server
+ */
+static void dns_transmit(const char *hostname, uint16_t id) {
+    uint8_t packet[DNS_MAX_PACKET_SIZE];
+    int len = dns_build_packet(hostname, id, packet);
+    udp_socket_t *sock = dns_socket();
+    if (len < 0 || sock == NULL) {
+        return;
+    }
+
+    uint32_t servers[DNS_MAX_SERVERS];
+    uint64_t flags = dns_lock_acquire();
+    uint32_t count = dns_resolver.server_count;
+    memcpy(servers, dns_resolver.servers, sizeof(servers));
+    dns_lock_release(flags);
+
+    kprintf("[DNS] Query for %s, ID 0x%04x, %u servers\n", hostname, id, count);
+    for (uint32_t i = 0; i < count; i++) {
+        udp_sendto(sock, ntohl(servers[i]), DNS_PORT, packet, (size_t)len);
+    }
+}
+
+int dns_resolve_async(const char *hostname, dns_callback_t cb, void *arg) {
     if (!dns_resolver.initialized) {
+        kprintf("[DNS] Error: resolver not initialized\n");
         return DNS_ERR_INVALID_NAME;
     }
 
-    if (hostname == NULL) {
+    if (hostname == NULL || cb == NULL) {
         return DNS_ERR_INVALID_NAME;
     }
 
-    size_t hostname_len = strlen(hostname);
-    if (hostname_len > DNS_MAX_NAME_LEN) {
+    /* First, check if it's already an IP address */
+    uint32_t ip = 0;
+    if (dns_string_to_ip(hostname, &ip) == DNS_OK) {
+        cb(hostname, DNS_OK, ip, arg);
+        return DNS_OK;
+    }
+
+    if (!dns_validate_hostname(hostname)) {
         return DNS_ERR_INVALID_NAME;
     }
 
-    /* Clamp TTL to valid range */
-    if (ttl < DNS_MIN_TTL) {
-        ttl = DNS_MIN_TTL;
+    uint64_t flags = dns_lock_acquire();
+    dns_resolver.stats.lookups++;
+
+    /* Check the cache */
+    int result = dns_cache_get(hostname, &ip);
+    if (result != DNS_ERR_NOT_CACHED) {
+        dns_lock_release(flags);
+        cb(hostname, result, ip, arg);
+        return DNS_OK;
+    }
+
+    /* Join a query already asking for this name */
+    dns_query_t *q = dns_query_find(hostname);
+    if (q != NULL) {
+        if (q->waiter_count >= DNS_MAX_WAITERS) {
+            dns_lock_release(flags);
+            return DNS_ERR_BUSY;
+        }
+        q->waiters[q->waiter_count].cb = cb;
+        q->waiters[q->waiter_count].arg = arg;
+        q->waiter_count++;
+        dns_resolver.stats.coalesced++;
+        dns_lock_release(flags);
+        return DNS_PENDING;
     }
-    if (ttl > DNS_MAX_TTL) {
-        ttl = DNS_MAX_TTL;
+
+    for (int i = 0; i < DNS_MAX_PENDING && q == NULL; i++) {
+        if (!dns_resolver.queries[i].active) {
+            q = &dns_resolver.queries[i];
+        }
+    }
+    if (q == NULL) {
+        dns_lock_release(flags);
+        kprintf("[DNS] Too many queries in flight\n");
+        return DNS_ERR_BUSY;
     }
 
-    uint64_t current_time = dns_get_ticks();
+    strncpy(q->name, hostname, DNS_MAX_NAME_LEN);
+    q->name[DNS_MAX_NAME_LEN] = '\0';
+    q->id = dns_generate_id();
+    q->tries = 1;
+    q->failed = 0;
+    q->sent = timer_now_ms();
+    q->waiters[0].cb = cb;
+    q->waiters[0].arg = arg;
+    q->waiter_count = 1;
+    q->active = true;
+    dns_resolver.stats.queries++;
+
+    char name[DNS_MAX_NAME_LEN + 1];
+    memcpy(name, q->name, sizeof(name));
+    uint16_t id = q->id;
+    dns_lock_release(flags);
+
+    dns_transmit(name, id);
+    return DNS_PENDING;
+}
 
-    /* First, check if entry already exists (update it) */
-    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        dns_cache_entry_t *entry = &dns_resolver.cache[i];
+/**
+ * Match a reply to its query and finish the query if it settles it
+ */
+static void dns_handle_reply(const uint8_t *packet, size_t len, uint32_t src_ip,
+                             uint16_t src_port) {
+    dns_reply_t reply;
+    int status = dns_parse(packet, len, &reply);
+    if (status == DNS_ERR_FORMAT && len < DNS_HEADER_SIZE) {
+        return;
+    }
 
-        if (entry->valid && dns_strcasecmp(entry->name, hostname) == 0) {
-            entry->ip = ip;
-            entry->ttl = ttl;
-            entry->timestamp = current_time;
+    dns_done_t done;
+    bool finished = false;
 
-            char ip_str[16];
-            dns_ip_to_string(ip, ip_str, sizeof(ip_str));
-            kprintf("[DNS] Cache updated: %s -> %s (TTL: %u)\n", hostname, ip_str, ttl);
+    uint64_t flags = dns_lock_acquire();
 
-            return DNS_OK;
+    /* Only the servers asked, replying from port 53, about the name asked */
+    int server = -1;
+    for (uint32_t i = 0; i < dns_resolver.server_count; i++) {
+        if (ntohl(dns_resolver.servers[i]) == src_ip) {
+            server = (int)i;
+        }
+    }
+    dns_query_t *q = NULL;
+    for (int i = 0; i < DNS_MAX_PENDING && server >= 0 && src_port == DNS_PORT; i++) {
+        dns_query_t *cand = &dns_resolver.queries[i];
+        if (cand->active && cand->id == reply.id &&
+            dns_strcasecmp(cand->name, reply.qname) == 0) {
+            q = cand;
+        }
+    }
+    if (q == NULL) {
+        dns_resolver.stats.bad_replies++;
+        dns_lock_release(flags);
+        return;
+    }
+    dns_resolver.stats.replies++;
+
+    if (status == DNS_OK) {
+        dns_cache_store(q->name, reply.ip, CLAMP(reply.ttl, DNS_MIN_TTL, DNS_MAX_TTL), false);
+        dns_query_finish(q, DNS_OK, reply.ip, &done);
+        finished = true;
+    } else if (status == DNS_ERR_NOT_FOUND) {
+        uint32_t ttl = MIN(reply.ttl, DNS_NEGATIVE_MAX_TTL);
+        if (ttl > 0) {
+            dns_cache_store(q->name, 0, ttl, true);
+        }
+        dns_query_finish(q, DNS_ERR_NOT_FOUND, 0, &done);
+        finished = true;
+    } else {
+        /* Wait for the other servers unless they have all failed */
+        q->failed |= (uint8_t)BIT(server);
+        if (q->failed == (uint8_t)(BIT(dns_resolver.server_count) - 1)) {
+            dns_query_finish(q, status, 0, &done);
+            finished = true;
         }
     }
 
-    /* Find an empty slot or the oldest entry */
-    int oldest_idx = 0;
-    uint64_t oldest_age = 0;
+    dns_lock_release(flags);
 
-    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        dns_cache_entry_t *entry = &dns_resolver.cache[i];
+    if (finished) {
+        dns_done_notify(&done);
+    }
+}
 
-        if (!entry->valid) {
-            /* Found empty slot */
-            oldest_idx = i;
-            break;
+/**
+ * Resend or give up on one query that has waited too long
+ * @return false once no query is overdue
+ */
+static bool dns_check_timeouts(uint64_t now) {
+    dns_done_t done;
+    char name[DNS_MAX_NAME_LEN + 1];
+    uint16_t id = 0;
+    bool finished = false;
+    bool resend = false;
+
+    uint64_t flags = dns_lock_acquire();
+    for (int i = 0; i < DNS_MAX_PENDING && !finished && !resend; i++) {
+        dns_query_t *q = &dns_resolver.queries[i];
+        if (!q->active || now - q->sent < DNS_QUERY_TIMEOUT_MS) {
+            continue;
         }
-
-        uint64_t age = current_time - entry->timestamp;
-        if (age > oldest_age) {
-            oldest_age = age;
-            oldest_idx = i;
+        if (q->tries > DNS_MAX_RETRIES) {
+            kprintf("[DNS] Query for %s timed out\n", q->name);
+            dns_resolver.stats.timeouts++;
+            dns_query_finish(q, DNS_ERR_TIMEOUT, 0, &done);
+            finished = true;
+        } else {
+            q->tries++;
+            q->sent = now;
+            q->failed = 0;
+            dns_resolver.stats.retries++;
+            memcpy(name, q->name, sizeof(name));
+            id = q->id;
+            resend = true;
         }
     }
+    dns_lock_release(flags);
 
-    /* Add entry */
-    dns_cache_entry_t *entry = &dns_resolver.cache[oldest_idx];
-    strncpy(entry->name, hostname, DNS_MAX_NAME_LEN);
-    entry->name[DNS_MAX_NAME_LEN] = '\0';
-    entry->ip = ip;
-    entry->ttl = ttl;
-    entry->timestamp = current_time;
-    entry->valid = true;
-
-    char ip_str[16];
-    dns_ip_to_string(ip, ip_str, sizeof(ip_str));
-    kprintf("[DNS] Cache add: %s -> %s (TTL: %u, slot: %d)\n",
-            hostname, ip_str, ttl, oldest_idx);
-
-    return DNS_OK;
+    if (finished) {
+        dns_done_notify(&done);
+    }
+    if (resend) {
+        dns_transmit(name, id);
+    }
+    return finished || resend;
 }
 
-void dns_cache_clear(void) {
-    kprintf("[DNS] Clearing cache\n");
+void dns_poll(void) {
+    if (!dns_resolver.initialized || __sync_lock_test_and_set(&dns_polling, 1)) {
+        return;
+    }
 
-    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        dns_resolver.cache[i].valid = false;
-        dns_resolver.cache[i].name[0] = '\0';
+    udp_socket_t *sock = dns_resolver.socket;
+    if (sock != NULL) {
+        uint8_t packet[DNS_MAX_PACKET_SIZE];
+        uint32_t src_ip;
+        uint16_t src_port;
+        ssize_t len;
+        while ((len = udp_recvfrom(sock, packet, sizeof(packet), &src_ip, &src_port)) > 0) {
+            dns_handle_reply(packet, (size_t)len, src_ip, src_port);
+        }
     }
-}
 
-/* Stub for actual UDP send/receive - to be implemented with UDP layer */
-static int dns_send_query(const void *query, size_t len, void *response, size_t *resp_len) {
-    UNUSED(query);
-    UNUSED(len);
-    UNUSED(response);
-    UNUSED(resp_len);
+    uint64_t now = timer_now_ms();
+    while (dns_check_timeouts(now)) {
+    }
 
-    /*
-     * This is a stub function that should be implemented once the UDP layer is available.
-     * The implementation should:
-     * 1. Create a UDP socket
-     * 2. Send the query to dns_resolver.server_ip on port 53
-     * 3. Wait for response (with timeout)
-     * 4. Copy response to buffer
-     * 5. Return the response length
-     */
+    __sync_lock_release(&dns_polling);
+}
 
-    kprintf("[DNS] UDP transport not yet implemented\n");
-    return DNS_ERR_NETWORK;
+/**
+ * Lets dns_resolve sleep until its answer arrives
+ */
+typedef struct dns_wait {
+    volatile uint32_t done;
+    int      status;
+    uint32_t ip;
+} dns_wait_t;
+
+static void dns_wait_done(const char *hostname, int status, uint32_t ip, void *arg) {
+    UNUSED(hostname);
+    dns_wait_t *wait = (dns_wait_t *)arg;
+    wait->status = status;
+    wait->ip = ip;
+    __sync_synchronize();
+    wait->done = 1;
+    waitq_wake(&wait->done, WAITQ_WAKE_ALL);
 }
 
 int dns_resolve(const char *hostname, uint32_t *ip_out) {
@@ -683,47 +1145,31 @@ int dns_resolve(const char *hostname, uint32_t *ip_out) {
 
     kprintf("[DNS] Resolving: %s\n", hostname);
 
-    /* First, check if it's already an IP address */
-    uint32_t ip;
-    if (dns_string_to_ip(hostname, &ip) == DNS_OK) {
-        *ip_out = ip;
-        kprintf("[DNS] Input is already an IP address\n");
-        return DNS_OK;
-    }
-
-    /* Check the cache */
-    if (dns_cache_lookup(hostname, ip_out) == DNS_OK) {
-        return DNS_OK;
+    dns_wait_t wait = {0};
+    int result = dns_resolve_async(hostname, dns_wait_done, &wait);
+    if (result < 0) {
+        return result;
     }
 
-    /* Build DNS query */
-    uint8_t query_buf[DNS_MAX_PACKET_SIZE];
-    int query_len = dns_build_query(hostname, query_buf);
-    if (query_len < 0) {
-        return query_len;
+    /* dns_poll runs from the timer and wakes us with the answer */
+    while (!wait.done) {
+        waitq_wait(&wait.done, 0);
     }
 
-    /* Send query and receive response */
-    uint8_t response_buf[DNS_MAX_PACKET_SIZE];
-    size_t response_len = sizeof(response_buf);
-
-    int result = dns_send_query(query_buf, query_len, response_buf, &response_len);
-    if (result != DNS_OK) {
-        kprintf("[DNS] Failed to send/receive query\n");
-        return result;
+    if (wait.status == DNS_OK) {
+        *ip_out = wait.ip;
     }
+    return wait.status;
+}
 
-    /* Parse response */
-    uint32_t ttl = DNS_DEFAULT_TTL;
-    result = dns_parse_response(response_buf, response_len, ip_out, &ttl);
-    if (result != DNS_OK) {
-        return result;
+void dns_get_stats(dns_stats_t *stats) {
+    if (stats == NULL) {
+        return;
     }
-
-    /* Add to cache */
-    dns_cache_add(hostname, *ip_out, ttl);
-
-    return DNS_OK;
+    uint64_t flags = dns_lock_acquire();
+    *stats = dns_resolver.stats;
+    stats->cached = dns_resolver.cache_count;
+    dns_lock_release(flags);
 }
 
 char *dns_ip_to_string(uint32_t ip, char *buf, size_t size) {
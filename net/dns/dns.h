@@ -3,6 +3,22 @@
  *
  * Provides DNS resolution services for the network stack.
  * Supports A record (IPv4) lookups with result caching.
+ *
+ * Answers are cached in a hash table keyed by the name (case-insensitive)
+ * until their TTL runs out. Names that do not exist, or have no A record,
+ * are cached too (negative caching, RFC 2308), for the SOA minimum of the
+ * reply or DNS_NEGATIVE_TTL. When the cache is full, expired entries are
+ * reused first, then the least recently used one.
+ *
+ * A query is in flight at most once per name: lookups of a name already
+ * being resolved wait on the same query. Each query goes to every
+ * configured server at once, and the first usable answer wins; a server
+ * failure only counts once every server has failed. Unanswered queries are
+ * resent after DNS_QUERY_TIMEOUT_MS, up to DNS_MAX_RETRIES times.
+ *
+ * dns_resolve_async starts a lookup and returns; its callback runs when
+ * the answer arrives. dns_resolve waits for it. Replies are collected by
+ * dns_poll, which a timer runs every DNS_POLL_MS.
  */
 
 #ifndef _AAAOS_NET_DNS_H
@@ -18,10 +34,21 @@
 #define DNS_MAX_PACKET_SIZE     512
 
 /* DNS cache settings */
-#define DNS_CACHE_SIZE          32
+#define DNS_CACHE_SIZE          256
+#define DNS_CACHE_HASH_SIZE     128     /* Buckets (power of two) */
 #define DNS_DEFAULT_TTL         300     /* 5 minutes default TTL */
 #define DNS_MIN_TTL             60      /* Minimum TTL (1 minute) */
 #define DNS_MAX_TTL             86400   /* Maximum TTL (24 hours) */
+#define DNS_NEGATIVE_TTL        60      /* Negative answers without an SOA */
+#define DNS_NEGATIVE_MAX_TTL    3600    /* Cap on negative answers (RFC 2308) */
+
+/* Queries */
+#define DNS_MAX_SERVERS         3       /* Servers asked in parallel */
+#define DNS_MAX_PENDING         16      /* Names being resolved at once */
+#define DNS_MAX_WAITERS         8       /* Lookups sharing one query */
+#define DNS_QUERY_TIMEOUT_MS    2000    /* Wait before resending */
+#define DNS_MAX_RETRIES         2       /* Resends before giving up */
+#define DNS_POLL_MS             50      /* Reply polling interval */
 
 /* Default DNS server (Google DNS: 8.8.8.8) */
 #define DNS_DEFAULT_SERVER      0x08080808
@@ -71,6 +98,11 @@
 #define DNS_ERR_SERVER          -6
 #define DNS_ERR_NOT_FOUND       -7
 #define DNS_ERR_TRUNCATED       -8
+#define DNS_ERR_NOT_CACHED      -9      /* dns_cache_lookup: nothing cached */
+#define DNS_ERR_BUSY            -10     /* Too many names being resolved */
+
+/* dns_resolve_async: the answer will be passed to the callback */
+#define DNS_PENDING             1
 
 /**
  * DNS header structure (12 bytes)
@@ -129,24 +161,82 @@ typedef struct dns_answer {
     /* RDATA follows (not included due to variable size) */
 } PACKED dns_answer_t;
 
+/**
+ * Called with the result of dns_resolve_async
+ * Runs from dns_poll (possibly in interrupt context) and must not sleep.
+ * @param hostname Name that was looked up
+ * @param status DNS_OK, or a negative error code
+ * @param ip Address (network byte order) if status is DNS_OK
+ * @param arg Argument given to dns_resolve_async
+ */
+typedef void (*dns_callback_t)(const char *hostname, int status, uint32_t ip, void *arg);
+
 /**
  * DNS cache entry structure
  */
 typedef struct dns_cache_entry {
     char     name[DNS_MAX_NAME_LEN + 1];    /* Hostname (null-terminated) */
     uint32_t ip;                             /* Resolved IPv4 address */
-    uint32_t ttl;                            /* Time to live (seconds) */
-    uint64_t timestamp;                      /* When entry was added (ticks) */
+    uint64_t expires;                        /* When the entry goes stale (ms) */
+    uint64_t used;                           /* Last lookup that hit it (ms) */
+    int16_t  next;                           /* Next entry in bucket or free list */
+    bool     negative;                       /* Name has no A record */
     bool     valid;                          /* Entry is valid */
 } dns_cache_entry_t;
 
+/**
+ * Lookup waiting for a query
+ */
+typedef struct dns_waiter {
+    dns_callback_t cb;
+    void    *arg;
+} dns_waiter_t;
+
+/**
+ * Query in flight
+ */
+typedef struct dns_query {
+    char     name[DNS_MAX_NAME_LEN + 1];    /* Name asked for */
+    uint16_t id;                             /* Query ID */
+    uint8_t  tries;                          /* Times sent */
+    uint8_t  failed;                         /* Servers that answered with an error */
+    uint64_t sent;                           /* Last send (ms) */
+    dns_waiter_t waiters[DNS_MAX_WAITERS];
+    uint32_t waiter_count;
+    bool     active;
+} dns_query_t;
+
+/**
+ * Resolver statistics
+ */
+typedef struct dns_stats {
+    uint64_t lookups;           /* Names looked up */
+    uint64_t cache_hits;        /* Answered from a positive entry */
+    uint64_t negative_hits;     /* Answered from a negative entry */
+    uint64_t queries;           /* Queries started */
+    uint64_t coalesced;         /* Lookups that joined a query in flight */
+    uint64_t retries;           /* Queries resent */
+    uint64_t timeouts;          /* Queries given up on */
+    uint64_t replies;           /* Replies matched to a query */
+    uint64_t bad_replies;       /* Replies ignored (wrong ID, server or name) */
+    uint32_t cached;            /* Entries in the cache now */
+} dns_stats_t;
+
+struct udp_socket;
+
 /**
  * DNS resolver state
  */
 typedef struct dns_resolver {
-    uint32_t server_ip;                      /* DNS server IP address */
-    uint16_t next_id;                        /* Next query ID */
+    uint32_t servers[DNS_MAX_SERVERS];       /* DNS server IP addresses */
+    uint32_t server_count;
     dns_cache_entry_t cache[DNS_CACHE_SIZE]; /* DNS cache */
+    int16_t  cache_hash[DNS_CACHE_HASH_SIZE];   /* First entry of each bucket */
+    int16_t  cache_free;                     /* First unused entry */
+    uint32_t cache_count;                    /* Entries in use */
+    dns_query_t queries[DNS_MAX_PENDING];    /* Queries in flight */
+    struct udp_socket *socket;               /* Queries are sent from here */
+    dns_stats_t stats;
     bool     initialized;                    /* Resolver initialized */
 } dns_resolver_t;
 
@@ -166,23 +256,33 @@ int dns_init(void);
 
 /**
  * Set the DNS server address
+ * Replaces every configured server with this one.
  *
  * @param server_ip DNS server IPv4 address (network byte order)
  * @return DNS_OK on success, negative error code on failure
  */
 int dns_set_server(uint32_t server_ip);
 
+/**
+ * Add a DNS server, asked in parallel with the others
+ *
+ * @param server_ip DNS server IPv4 address (network byte order)
+ * @return DNS_OK on success, negative error code if the list is full
+ */
+int dns_add_server(uint32_t server_ip);
+
 /**
  * Get the current DNS server address
  *
- * @return DNS server IPv4 address (network byte order)
+ * @return First DNS server IPv4 address (network byte order)
  */
 uint32_t dns_get_server(void);
 
 /**
  * Resolve a hostname to an IPv4 address
  *
- * First checks the cache, then sends a DNS query if needed.
+ * First checks the cache, then queries the servers and waits for the
+ * answer (sharing a query already in flight for the same name).
  *
  * @param hostname The hostname to resolve
  * @param ip_out   Pointer to store the resolved IP address
@@ -190,12 +290,31 @@ uint32_t dns_get_server(void);
  */
 int dns_resolve(const char *hostname, uint32_t *ip_out);
 
+/**
+ * Start resolving a hostname without waiting
+ *
+ * @param hostname The hostname to resolve
+ * @param cb       Called with the result, unless an error is returned
+ * @param arg      Passed to cb
+ * @return DNS_OK if the answer was known (cb has already run), DNS_PENDING
+ *         if it will be passed to cb later, or a negative error code
+ */
+int dns_resolve_async(const char *hostname, dns_callback_t cb, void *arg);
+
+/**
+ * Collect replies, resend unanswered queries and fail those that ran out
+ * of retries. Runs from a timer every DNS_POLL_MS; may also be called by
+ * anyone waiting for an answer.
+ */
+void dns_poll(void);
+
 /**
  * Look up a hostname in the DNS cache
  *
  * @param hostname The hostname to look up
  * @param ip_out   Pointer to store the cached IP address
- * @return DNS_OK if found in cache, DNS_ERR_NOT_FOUND if not cached
+ * @return DNS_OK if found in cache, DNS_ERR_NOT_FOUND if the name is cached
+ *         as having no address, DNS_ERR_NOT_CACHED if it is not cached
  */
 int dns_cache_lookup(const char *hostname, uint32_t *ip_out);
 
@@ -209,11 +328,25 @@ int dns_cache_lookup(const char *hostname, uint32_t *ip_out);
  */
 int dns_cache_add(const char *hostname, uint32_t ip, uint32_t ttl);
 
+/**
+ * Record that a hostname has no address
+ *
+ * @param hostname The hostname
+ * @param ttl      Time to live in seconds
+ * @return DNS_OK on success, negative error code on failure
+ */
+int dns_cache_add_negative(const char *hostname, uint32_t ttl);
+
 /**
  * Clear the DNS cache
  */
 void dns_cache_clear(void);
 
+/**
+ * Get resolver statistics
+ */
+void dns_get_stats(dns_stats_t *stats);
+
 /**
  * Build a DNS query packet
  *
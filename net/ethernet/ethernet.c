@@ -3,6 +3,8 @@
  */
 
 #include "ethernet.h"
+#include "../core/netdev.h"
+#include "../core/nettrace.h"
 #include "../../kernel/include/serial.h"
 #include "../../lib/libc/string.h"
 #include "../arp/arp.h"
@@ -21,6 +23,62 @@ int eth_hw_send(const void *frame, size_t len) {
     return -1;
 }
 
+/* Without a zero-copy driver the frame is copied by eth_hw_send */
+__attribute__((weak))
+int eth_hw_send_buf(netbuf_t *buf) {
+    int result;
+
+    if (buf->next == NULL) {
+        result = eth_hw_send(buf->data, buf->len);
+    } else {
+        /* Gather a chain into one frame */
+        uint8_t frame[ETH_FRAME_MAX];
+        size_t len = 0;
+        for (netbuf_t *frag = buf; frag; frag = frag->next) {
+            if (len + frag->len > sizeof(frame)) {
+                kprintf("[ETH] Error: Buffer chain longer than a frame\n");
+                return -1;
+            }
+            memcpy(frame + len, frag->data, frag->len);
+            len += frag->len;
+        }
+        result = eth_hw_send(frame, len);
+    }
+
+    if (result == 0) {
+        while (buf) {
+            netbuf_t *next = buf->next;
+            netbuf_free(buf);
+            buf = next;
+        }
+    }
+    return result;
+}
+
+__attribute__((weak))
+uint32_t eth_hw_offloads(void) {
+    return 0;
+}
+
+uint32_t eth_offloads(void) {
+    netdev_t *dev = netdev_default();
+    return dev ? dev->features : eth_hw_offloads();
+}
+
+size_t eth_mtu(void) {
+    netdev_t *dev = netdev_default();
+    return dev ? dev->mtu : ETH_DATA_MAX;
+}
+
+/**
+ * Send a finished frame on the default device, or the driver hooks
+ * Consumed on success; on error the caller still owns it.
+ */
+static int eth_xmit(netbuf_t *buf) {
+    netdev_t *dev = netdev_default();
+    return dev ? netdev_xmit(dev, buf) : eth_hw_send_buf(buf);
+}
+
 void eth_init(const uint8_t mac[ETH_ALEN]) {
     eth_mac_copy(local_mac, mac);
     eth_initialized = true;
@@ -89,7 +147,21 @@ int eth_send(const uint8_t dest_mac[ETH_ALEN], uint16_t ethertype,
             ethertype, (uint32_t)frame_len);
 
     /* Send via hardware driver */
-    return eth_hw_send(frame, frame_len);
+    netdev_t *dev = netdev_default();
+    if (dev == NULL) {
+        return eth_hw_send(frame, frame_len);
+    }
+
+    netbuf_t *buf = netbuf_alloc(frame_len, 0);
+    if (buf == NULL) {
+        return -1;
+    }
+    netbuf_copy_in(buf, frame, frame_len);
+    int result = netdev_xmit(dev, buf);
+    if (result != 0) {
+        netbuf_free(buf);
+    }
+    return result;
 }
 
 int eth_send_buf(netbuf_t *buf, const uint8_t dest_mac[ETH_ALEN],
@@ -106,9 +178,10 @@ int eth_send_buf(netbuf_t *buf, const uint8_t dest_mac[ETH_ALEN],
         return -1;
     }
 
-    if (buf->len > ETH_DATA_MAX) {
+    /* A TSO send is cut into MTU-sized frames by the device */
+    if (buf->len > eth_mtu() && !(buf->flags & NETBUF_FLAG_TSO)) {
         kprintf("[ETH] Error: Payload too large (%u > %u)\n",
-                (uint32_t)buf->len, ETH_DATA_MAX);
+                (uint32_t)buf->len, (uint32_t)eth_mtu());
         return -1;
     }
 
@@ -138,22 +211,30 @@ int eth_send_buf(netbuf_t *buf, const uint8_t dest_mac[ETH_ALEN],
             ethertype, (uint32_t)buf->len);
 
     /* Send via hardware driver */
-    return eth_hw_send(buf->data, buf->len);
+    return eth_xmit(buf);
 }
 
-int eth_receive(const void *packet, size_t len) {
+/**
+ * Process a received frame
+ * @param flags NETBUF_FLAG_CSUM_*_OK checks the device already made
+ */
+static int eth_input(const void *packet, size_t len, uint32_t flags) {
     const eth_header_t *hdr;
     uint16_t ethertype;
     const uint8_t *payload;
     size_t payload_len;
 
+    nettrace_event(NETTRACE_ETH_RX, len);
+
     if (!eth_initialized) {
         kprintf("[ETH] Error: Not initialized\n");
+        nettrace_drop(NETTRACE_ETH_RX);
         return -1;
     }
 
     if (packet == NULL || len < ETH_HLEN) {
         kprintf("[ETH] Error: Invalid packet (len=%u)\n", (uint32_t)len);
+        nettrace_drop(NETTRACE_ETH_RX);
         return -1;
     }
 
@@ -175,6 +256,7 @@ int eth_receive(const void *packet, size_t len) {
         !eth_mac_equal(hdr->dest_mac, local_mac)) {
         /* Not for us - in promiscuous mode we might still process it */
         kprintf("[ETH] Frame not for us, dropping\n");
+        nettrace_drop(NETTRACE_ETH_RX);
         return 0;
     }
 
@@ -184,14 +266,39 @@ int eth_receive(const void *packet, size_t len) {
             return arp_receive(payload, payload_len);
 
         case ETH_TYPE_IPV4:
-            return ip_receive(payload, payload_len);
+            return ip_receive_offload(payload, payload_len, flags);
 
         case ETH_TYPE_IPV6:
             kprintf("[ETH] IPv6 not supported\n");
+            nettrace_drop(NETTRACE_ETH_RX);
             return -1;
 
         default:
             kprintf("[ETH] Unknown EtherType 0x%04x\n", ethertype);
+            nettrace_drop(NETTRACE_ETH_RX);
             return -1;
     }
 }
+
+int eth_receive(const void *packet, size_t len) {
+    return eth_input(packet, len, 0);
+}
+
+int eth_receive_buf(netbuf_t *buf) {
+    if (buf == NULL) {
+        kprintf("[ETH] Error: NULL buffer\n");
+        return -1;
+    }
+
+    if (buf->len >= ETH_HLEN) {
+        const eth_header_t *hdr = (const eth_header_t *)buf->data;
+        eth_mac_copy(buf->src_mac, hdr->src_mac);
+        eth_mac_copy(buf->dst_mac, hdr->dest_mac);
+        buf->protocol = ntohs(hdr->ethertype);
+    }
+
+    /* Upper layers parse the payload in place and copy what they keep */
+    int result = eth_input(buf->data, buf->len, buf->flags);
+    netbuf_free(buf);
+    return result;
+}
@@ -25,6 +25,11 @@
 #define ETH_TYPE_VLAN       0x8100      /* 802.1Q VLAN tag */
 #define ETH_TYPE_IPV6       0x86DD      /* Internet Protocol v6 */
 
+/* Offloads a driver can report (eth_offloads) */
+#define ETH_OFFLOAD_TX_CSUM BIT(0)      /* Fills IPv4 and TCP/UDP checksums */
+#define ETH_OFFLOAD_RX_CSUM BIT(1)      /* Verifies received checksums */
+#define ETH_OFFLOAD_TSO     BIT(2)      /* Segments large TCP sends */
+
 /* Special MAC addresses */
 #define ETH_BROADCAST_MAC   {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}
 
@@ -69,7 +74,9 @@ int eth_send(const uint8_t dest_mac[ETH_ALEN], uint16_t ethertype,
 
 /**
  * Send an Ethernet frame using a netbuf
- * The netbuf must have room for the Ethernet header (14 bytes headroom)
+ * The netbuf must have room for the Ethernet header (14 bytes headroom).
+ * The driver sends the buffer where it is, so on success it is consumed;
+ * on error the caller still owns it.
  * @param buf Network buffer with payload
  * @param dest_mac Destination MAC address
  * @param ethertype Protocol type
@@ -86,6 +93,26 @@ int eth_send_buf(netbuf_t *buf, const uint8_t dest_mac[ETH_ALEN],
  */
 int eth_receive(const void *packet, size_t len);
 
+/**
+ * Process a received Ethernet frame held in a netbuf
+ * The frame is parsed where the driver received it, then freed.
+ * @param buf Buffer holding the frame (consumed)
+ * @return 0 on success, negative on error
+ */
+int eth_receive_buf(netbuf_t *buf);
+
+/**
+ * Offloads the default device performs
+ * @return ETH_OFFLOAD_* flags, 0 without a driver
+ */
+uint32_t eth_offloads(void);
+
+/**
+ * MTU of the device frames are sent on
+ * @return Largest payload, ETH_DATA_MAX without a device
+ */
+size_t eth_mtu(void);
+
 /**
  * Check if a MAC address is broadcast
  * @param mac MAC address to check
@@ -159,7 +186,14 @@ static inline uint32_t ntohl(uint32_t netlong) {
     return htonl(netlong);  /* Same operation */
 }
 
-/* Hardware driver callback - must be implemented by NIC driver */
+/*
+ * Driver hooks, used while no device is registered (netdev.h); drivers
+ * register a netdev_t instead
+ */
 extern int eth_hw_send(const void *frame, size_t len);
 
+/* Send a netbuf in place (consumed on success), report offloads */
+extern int eth_hw_send_buf(netbuf_t *buf);
+extern uint32_t eth_hw_offloads(void);
+
 #endif /* _AAAOS_NET_ETHERNET_H */
@@ -0,0 +1,1147 @@
+/**
+ * AAAos Network Stack - HTTP/1.1 Client Implementation
+ *
+ * Responses are read through an http_reader_t: a window over a buffer,
+ * refilled from the connection as it is consumed. A pooled connection
+ * owns its buffer, so bytes read past the end of one response are still
+ * there for the next. http_parse_response runs the same parser over a
+ * response already in memory.
+ *
+ * Sockets are non-blocking; waiting for data or the connection yields to
+ * the scheduler until the request's deadline.
+ */
+
+#include "http.h"
+#include "../../kernel/include/serial.h"
+#include "../../lib/libc/string.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../ethernet/ethernet.h"
+#include "../dns/dns.h"
+#include "../tcp/tcp.h"
+
+/**
+ * Pooled connection
+ */
+typedef struct http_conn {
+    char     host[HTTP_MAX_HOST_LEN];   /* Host and port it is connected to */
+    uint16_t port;
+    tcp_socket_t *sock;                 /* NULL if the slot is free */
+    bool     in_use;                    /* Carrying a request */
+    uint32_t requests;                  /* Requests sent on it so far */
+    uint64_t last_used;                 /* End of its last response (ms) */
+    size_t   start;                     /* Unread bytes are buf[start..end) */
+    size_t   end;
+    uint8_t  buf[HTTP_BUFFER_SIZE];
+} http_conn_t;
+
+/**
+ * Window over response bytes
+ */
+typedef struct http_reader {
+    tcp_socket_t *sock;                 /* Refilled from here, or NULL for memory */
+    uint8_t  *buf;
+    size_t   cap;
+    size_t   start;
+    size_t   end;
+    uint64_t deadline;                  /* timer_now_ms value to give up at */
+    bool     got_data;                  /* Anything has been received */
+} http_reader_t;
+
+static http_conn_t http_pool[HTTP_POOL_SIZE];
+static http_pool_stats_t http_stats;
+static volatile int http_lock = 0;
+static bool http_initialized = false;
+
+static inline uint64_t http_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&http_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void http_lock_release(uint64_t flags) {
+    __sync_lock_release(&http_lock);
+    interrupts_restore(flags);
+}
+
+static inline char http_tolower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+static int http_strcasecmp(const char *s1, const char *s2) {
+    while (*s1 && http_tolower(*s1) == http_tolower(*s2)) {
+        s1++;
+        s2++;
+    }
+    return (int)(unsigned char)http_tolower(*s1) - (int)(unsigned char)http_tolower(*s2);
+}
+
+/**
+ * Check for a token in a comma-separated header value (case-insensitive)
+ */
+static bool http_has_token(const char *value, const char *token) {
+    size_t token_len = strlen(token);
+    const char *p = value;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        size_t i = 0;
+        while (i < token_len && p[i] && http_tolower(p[i]) == http_tolower(token[i])) {
+            i++;
+        }
+        if (i == token_len && (p[i] == '\0' || p[i] == ',' || p[i] == ' ' || p[i] == ';')) {
+            return true;
+        }
+        while (*p && *p != ',') {
+            p++;
+        }
+    }
+    return false;
+}
+
+static void http_copy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* ============================================================================
+ * Connection pool
+ * ============================================================================ */
+
+int http_init(void) {
+    uint64_t flags = http_lock_acquire();
+    memset(http_pool, 0, sizeof(http_pool));
+    memset(&http_stats, 0, sizeof(http_stats));
+    http_initialized = true;
+    http_lock_release(flags);
+
+    kprintf("[HTTP] Client initialized, %d pooled connections\n", HTTP_POOL_SIZE);
+    return HTTP_OK;
+}
+
+/**
+ * Check that a kept connection is still open at the other end
+ */
+static bool http_conn_alive(const http_conn_t *conn) {
+    return tcp_is_connected(conn->sock) && !(tcp_poll_events(conn->sock) & POLL_HUP);
+}
+
+/**
+ * Close a connection and free its slot (http_lock held, or slot owned)
+ * @param abort Reset it rather than closing gracefully
+ */
+static void http_conn_close(http_conn_t *conn, bool abort) {
+    if (conn->sock) {
+        if (abort) {
+            tcp_abort(conn->sock);
+        } else {
+            tcp_close(conn->sock);
+        }
+        http_stats.closes++;
+    }
+    conn->sock = NULL;
+    conn->in_use = false;
+    conn->start = 0;
+    conn->end = 0;
+}
+
+/**
+ * Take a kept connection to host:port, or a free slot for a new one
+ * Closes idle connections that expired or that the server closed.
+ * @return The slot, now in use, or NULL if every slot is busy
+ */
+static http_conn_t *http_pool_get(const char *host, uint16_t port) {
+    uint64_t now = timer_now_ms();
+    http_conn_t *found = NULL;
+    http_conn_t *spare = NULL;
+
+    uint64_t flags = http_lock_acquire();
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_conn_t *conn = &http_pool[i];
+        if (conn->in_use) {
+            continue;
+        }
+        if (conn->sock && (now - conn->last_used >= HTTP_POOL_IDLE_MS || !http_conn_alive(conn))) {
+            http_conn_close(conn, false);
+        }
+        if (conn->sock == NULL) {
+            if (spare == NULL) {
+                spare = conn;
+            }
+        } else if (found == NULL && conn->port == port && http_strcasecmp(conn->host, host) == 0) {
+            found = conn;
+        }
+    }
+
+    /* With no free slot, the least recently used idle connection makes room */
+    if (found == NULL && spare == NULL) {
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            http_conn_t *conn = &http_pool[i];
+            if (!conn->in_use && (spare == NULL || conn->last_used < spare->last_used)) {
+                spare = conn;
+            }
+        }
+        if (spare) {
+            http_conn_close(spare, false);
+        }
+    }
+
+    http_conn_t *conn = found ? found : spare;
+    if (conn) {
+        conn->in_use = true;
+        if (conn == spare) {
+            http_copy(conn->host, host, sizeof(conn->host));
+            conn->port = port;
+            conn->requests = 0;
+        }
+    }
+    http_lock_release(flags);
+    return conn;
+}
+
+/**
+ * Give a connection back after a request
+ * @param keep Whether it may carry another request
+ */
+static void http_pool_put(http_conn_t *conn, bool keep) {
+    uint64_t flags = http_lock_acquire();
+    if (keep && conn->sock) {
+        conn->last_used = timer_now_ms();
+        conn->in_use = false;
+    } else {
+        http_conn_close(conn, !keep && conn->sock && conn->start != conn->end);
+    }
+    http_lock_release(flags);
+}
+
+void http_pool_flush(void) {
+    uint64_t flags = http_lock_acquire();
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (!http_pool[i].in_use && http_pool[i].sock) {
+            http_conn_close(&http_pool[i], false);
+        }
+    }
+    http_lock_release(flags);
+}
+
+void http_get_pool_stats(http_pool_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    uint64_t flags = http_lock_acquire();
+    *stats = http_stats;
+    stats->idle = 0;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (!http_pool[i].in_use && http_pool[i].sock) {
+            stats->idle++;
+        }
+    }
+    http_lock_release(flags);
+}
+
+/**
+ * Open a connection for a slot and wait until it is established
+ */
+static int http_conn_open(http_conn_t *conn, uint64_t deadline) {
+    uint32_t ip;
+    if (dns_resolve(conn->host, &ip) != DNS_OK) {
+        kprintf("[HTTP] Cannot resolve %s\n", conn->host);
+        return HTTP_ERR_DNS_FAILED;
+    }
+
+    tcp_socket_t *sock = tcp_socket_create();
+    if (sock == NULL) {
+        return HTTP_ERR_NO_MEMORY;
+    }
+    tcp_set_nonblock(sock, true);
+    if (tcp_bind(sock, 0) != TCP_OK || tcp_connect(sock, ntohl(ip), conn->port) != TCP_OK) {
+        tcp_abort(sock);
+        return HTTP_ERR_CONNECT_FAILED;
+    }
+
+    while (!tcp_is_connected(sock)) {
+        bool refused = sock->state == TCP_STATE_CLOSED;
+        if (refused || timer_now_ms() >= deadline) {
+            kprintf("[HTTP] Connection to %s:%u %s\n", conn->host, conn->port,
+                    refused ? "refused" : "timed out");
+            tcp_abort(sock);
+            return refused ? HTTP_ERR_CONNECT_FAILED : HTTP_ERR_TIMEOUT;
+        }
+        scheduler_yield();
+    }
+
+    conn->sock = sock;
+    conn->start = 0;
+    conn->end = 0;
+    uint64_t flags = http_lock_acquire();
+    http_stats.connects++;
+    http_lock_release(flags);
+    return HTTP_OK;
+}
+
+/**
+ * Send all of data, waiting for room in the send buffer
+ */
+static int http_send_all(tcp_socket_t *sock, const void *data, size_t len, uint64_t deadline) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len > 0) {
+        if (!tcp_can_send(sock)) {
+            return HTTP_ERR_SEND_FAILED;
+        }
+        ssize_t sent = tcp_send(sock, p, len);
+        if (sent < 0 && sent != TCP_ERR_WOULDBLOCK) {
+            return HTTP_ERR_SEND_FAILED;
+        }
+        if (sent > 0) {
+            p += sent;
+            len -= (size_t)sent;
+        } else if (timer_now_ms() >= deadline) {
+            return HTTP_ERR_TIMEOUT;
+        } else {
+            scheduler_yield();
+        }
+    }
+    return HTTP_OK;
+}
+
+/* ============================================================================
+ * Response reader
+ * ============================================================================ */
+
+/**
+ * Read more bytes into the window
+ * @return Bytes added, 0 at the end of the data, or negative error code
+ */
+static int http_fill(http_reader_t *r) {
+    if (r->start == r->end) {
+        r->start = r->end = 0;
+    } else if (r->end == r->cap && r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->sock == NULL) {
+        return 0;
+    }
+    if (r->end == r->cap) {
+        return HTTP_ERR_BUFFER_OVERFLOW;
+    }
+
+    for (;;) {
+        ssize_t got = tcp_recv(r->sock, r->buf + r->end, r->cap - r->end);
+        if (got > 0) {
+            r->end += (size_t)got;
+            r->got_data = true;
+            return (int)got;
+        }
+        if (got == 0 || got == TCP_ERR_NOTCONN || got == TCP_ERR_CLOSED) {
+            return 0;
+        }
+        if (got != TCP_ERR_WOULDBLOCK) {
+            return HTTP_ERR_RECV_FAILED;
+        }
+        if (timer_now_ms() >= r->deadline) {
+            return HTTP_ERR_TIMEOUT;
+        }
+        scheduler_yield();
+    }
+}
+
+/**
+ * Read one line, without its CRLF
+ * @return Line length, or negative error code (HTTP_ERR_RECV_FAILED at the
+ *         end of the data)
+ */
+static int http_read_line(http_reader_t *r, char *line, size_t size) {
+    for (;;) {
+        for (size_t i = r->start; i < r->end; i++) {
+            if (r->buf[i] != '\n') {
+                continue;
+            }
+            size_t len = i - r->start;
+            if (len > 0 && r->buf[i - 1] == '\r') {
+                len--;
+            }
+            if (len >= size) {
+                return HTTP_ERR_BUFFER_OVERFLOW;
+            }
+            memcpy(line, r->buf + r->start, len);
+            line[len] = '\0';
+            r->start = i + 1;
+            return (int)len;
+        }
+
+        int got = http_fill(r);
+        if (got < 0) {
+            return got;
+        }
+        if (got == 0) {
+            return HTTP_ERR_RECV_FAILED;
+        }
+    }
+}
+
+/**
+ * Parse the status line and headers into response
+ * Skips interim (1xx) responses.
+ */
+static int http_read_head(http_reader_t *r, http_response_t *response) {
+    char line[HTTP_MAX_HEADER_NAME + HTTP_MAX_HEADER_VALUE + 4];
+    bool http10;
+
+    do {
+        int len = http_read_line(r, line, sizeof(line));
+        if (len < 0) {
+            return len;
+        }
+
+        /* HTTP/1.x SP code SP text */
+        if (len < 12 || memcmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ') {
+            kprintf("[HTTP] Bad status line\n");
+            return HTTP_ERR_INVALID_RESPONSE;
+        }
+        http10 = line[7] == '0';
+        int code = 0;
+        for (int i = 9; i < 12; i++) {
+            if (line[i] < '0' || line[i] > '9') {
+                return HTTP_ERR_INVALID_RESPONSE;
+            }
+            code = code * 10 + (line[i] - '0');
+        }
+        response->status_code = code;
+        http_copy(response->status_text, line[12] == ' ' ? line + 13 : "",
+                  sizeof(response->status_text));
+
+        response->header_count = 0;
+        for (;;) {
+            len = http_read_line(r, line, sizeof(line));
+            if (len < 0) {
+                return len;
+            }
+            if (len == 0) {
+                break;
+            }
+            char *colon = strchr(line, ':');
+            if (colon == NULL || response->header_count >= HTTP_MAX_HEADERS) {
+                continue;
+            }
+            *colon = '\0';
+            char *value = colon + 1;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            http_header_t *h = &response->headers[response->header_count++];
+            http_copy(h->name, line, sizeof(h->name));
+            http_copy(h->value, value, sizeof(h->value));
+        }
+    } while (response->status_code >= 100 && response->status_code < 200);
+
+    const char *te = http_get_header(response, "Transfer-Encoding");
+    const char *cl = http_get_header(response, "Content-Length");
+    const char *connection = http_get_header(response, "Connection");
+
+    response->chunked = te != NULL && http_has_token(te, "chunked");
+    response->content_length = (size_t)-1;
+    if (cl != NULL && !response->chunked) {
+        size_t n = 0;
+        for (const char *p = cl; *p >= '0' && *p <= '9'; p++) {
+            n = n * 10 + (size_t)(*p - '0');
+        }
+        response->content_length = n;
+    }
+
+    if (connection != NULL && http_has_token(connection, "close")) {
+        response->keep_alive = false;
+    } else if (http10) {
+        response->keep_alive = connection != NULL && http_has_token(connection, "keep-alive");
+    } else {
+        response->keep_alive = true;
+    }
+    return HTTP_OK;
+}
+
+/**
+ * Pass up to len body bytes to the callback
+ * @return Bytes passed, or negative error code
+ */
+static int http_deliver(http_reader_t *r, size_t len, http_body_fn_t on_body, void *ctx) {
+    if (r->start == r->end) {
+        int got = http_fill(r);
+        if (got <= 0) {
+            return got == 0 ? HTTP_ERR_RECV_FAILED : got;
+        }
+    }
+    size_t n = MIN(len, r->end - r->start);
+    if (on_body && on_body(ctx, r->buf + r->start, n) < 0) {
+        return HTTP_ERR_ABORTED;
+    }
+    r->start += n;
+    return (int)n;
+}
+
+static int http_parse_hex(const char *s, size_t *out) {
+    size_t n = 0;
+    int digits = 0;
+    for (; *s; s++) {
+        char c = http_tolower(*s);
+        int d;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            d = c - 'a' + 10;
+        } else {
+            break;      /* Chunk extensions and whitespace */
+        }
+        if (++digits > 15) {
+            return HTTP_ERR_PARSE_FAILED;
+        }
+        n = n * 16 + (size_t)d;
+    }
+    if (digits == 0) {
+        return HTTP_ERR_PARSE_FAILED;
+    }
+    *out = n;
+    return HTTP_OK;
+}
+
+/**
+ * Read the body of a response and pass it on
+ * @param has_body false for HEAD requests
+ */
+static int http_read_body(http_reader_t *r, http_response_t *response, bool has_body,
+                          http_body_fn_t on_body, void *ctx) {
+    int code = response->status_code;
+    if (!has_body || code == 204 || code == 304) {
+        return HTTP_OK;
+    }
+
+    if (response->chunked) {
+        char line[HTTP_MAX_HEADER_VALUE];
+        for (;;) {
+            size_t size;
+            int len = http_read_line(r, line, sizeof(line));
+            if (len < 0) {
+                return len;
+            }
+            if (http_parse_hex(line, &size) != HTTP_OK) {
+                kprintf("[HTTP] Bad chunk size\n");
+                return HTTP_ERR_PARSE_FAILED;
+            }
+            if (size == 0) {
+                break;
+            }
+            while (size > 0) {
+                int n = http_deliver(r, size, on_body, ctx);
+                if (n < 0) {
+                    return n;
+                }
+                size -= (size_t)n;
+            }
+            len = http_read_line(r, line, sizeof(line));
+            if (len != 0) {
+                return len < 0 ? len : HTTP_ERR_PARSE_FAILED;
+            }
+        }
+        /* Trailers, up to the empty line */
+        for (;;) {
+            int len = http_read_line(r, line, sizeof(line));
+            if (len <= 0) {
+                return len;
+            }
+        }
+    }
+
+    if (response->content_length != (size_t)-1) {
+        size_t left = response->content_length;
+        while (left > 0) {
+            int n = http_deliver(r, left, on_body, ctx);
+            if (n < 0) {
+                return n;
+            }
+            left -= (size_t)n;
+        }
+        return HTTP_OK;
+    }
+
+    /* Neither: the body runs to the end of the connection */
+    response->keep_alive = false;
+    for (;;) {
+        if (r->start == r->end) {
+            int got = http_fill(r);
+            if (got < 0) {
+                return got;
+            }
+            if (got == 0) {
+                return HTTP_OK;
+            }
+        }
+        size_t n = r->end - r->start;
+        if (on_body && on_body(ctx, r->buf + r->start, n) < 0) {
+            return HTTP_ERR_ABORTED;
+        }
+        r->start += n;
+    }
+}
+
+/* ============================================================================
+ * Requests
+ * ============================================================================ */
+
+static void http_response_reset(http_response_t *response) {
+    memset(response, 0, sizeof(*response));
+    response->content_length = (size_t)-1;
+}
+
+/**
+ * Send a request on a connection and read its response
+ */
+static int http_exchange(http_conn_t *conn, const http_request_t *request,
+                         const char *head, size_t head_len, http_response_t *response,
+                         http_body_fn_t on_body, void *ctx, uint64_t deadline,
+                         bool *got_data) {
+    int result = http_send_all(conn->sock, head, head_len, deadline);
+    if (result == HTTP_OK && request->body_len > 0) {
+        result = http_send_all(conn->sock, request->body, request->body_len, deadline);
+    }
+
+    http_reader_t r = {
+        .sock = conn->sock, .buf = conn->buf, .cap = sizeof(conn->buf),
+        .start = conn->start, .end = conn->end, .deadline = deadline,
+        .got_data = conn->start != conn->end,
+    };
+    if (result == HTTP_OK) {
+        result = http_read_head(&r, response);
+    }
+    if (result == HTTP_OK) {
+        result = http_read_body(&r, response, request->method != HTTP_METHOD_HEAD,
+                                on_body, ctx);
+    }
+
+    conn->start = r.start;
+    conn->end = r.end;
+    *got_data = r.got_data;
+    return result;
+}
+
+int http_request_stream(http_request_t *request, http_response_t *response,
+                        http_body_fn_t on_body, void *ctx) {
+    if (!http_initialized) {
+        return HTTP_ERR_NOT_INITIALIZED;
+    }
+    if (request == NULL || response == NULL) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    char *head = (char *)kmalloc(HTTP_BUFFER_SIZE);
+    if (head == NULL) {
+        return HTTP_ERR_NO_MEMORY;
+    }
+    int head_len = http_build_request(request, head, HTTP_BUFFER_SIZE);
+    if (head_len < 0) {
+        kfree(head);
+        return head_len;
+    }
+
+    uint32_t timeout = request->timeout_ms ? request->timeout_ms : HTTP_TIMEOUT_MS;
+    uint64_t deadline = timer_now_ms() + timeout;
+    int result = HTTP_ERR_BUSY;
+
+    /* A kept connection may have been closed by the server meanwhile: retry once */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        http_conn_t *conn = http_pool_get(request->host, request->port);
+        if (conn == NULL) {
+            result = HTTP_ERR_BUSY;
+            break;
+        }
+
+        bool reused = conn->sock != NULL;
+        result = reused ? HTTP_OK : http_conn_open(conn, deadline);
+        if (result != HTTP_OK) {
+            http_pool_put(conn, false);
+            break;
+        }
+
+        uint64_t flags = http_lock_acquire();
+        if (reused) {
+            http_stats.reuses++;
+        }
+        http_lock_release(flags);
+        conn->requests++;
+
+        http_response_reset(response);
+        bool got_data = false;
+        result = http_exchange(conn, request, head, (size_t)head_len, response,
+                               on_body, ctx, deadline, &got_data);
+
+        bool keep = result == HTTP_OK && response->keep_alive;
+        http_pool_put(conn, keep);
+
+        if (result == HTTP_OK || !reused || got_data || result == HTTP_ERR_TIMEOUT) {
+            break;
+        }
+        flags = http_lock_acquire();
+        http_stats.retries++;
+        http_lock_release(flags);
+        kprintf("[HTTP] Kept connection to %s:%u failed, reconnecting\n",
+                request->host, request->port);
+    }
+
+    kfree(head);
+    if (result == HTTP_OK) {
+        kprintf("[HTTP] %s %s%s -> %d %s\n", http_method_string(request->method),
+                request->host, request->path, response->status_code, response->status_text);
+    }
+    return result;
+}
+
+/**
+ * Body gathered by http_request and http_parse_response
+ * Kept apart from the response, which is cleared again if a request is retried.
+ */
+typedef struct http_collector {
+    void   *body;
+    size_t  len;
+    size_t  capacity;
+} http_collector_t;
+
+static int http_collect_body(void *ctx, const void *data, size_t len) {
+    http_collector_t *c = (http_collector_t *)ctx;
+
+    if (c->len + len > HTTP_MAX_BODY_SIZE) {
+        kprintf("[HTTP] Body larger than %u bytes\n", HTTP_MAX_BODY_SIZE);
+        return -1;
+    }
+    if (c->len + len > c->capacity) {
+        size_t capacity = c->capacity ? c->capacity : HTTP_BUFFER_SIZE;
+        while (capacity < c->len + len) {
+            capacity *= 2;
+        }
+        capacity = MIN(capacity, (size_t)HTTP_MAX_BODY_SIZE);
+        void *body = kmalloc(capacity);
+        if (body == NULL) {
+            return -1;
+        }
+        if (c->body) {
+            memcpy(body, c->body, c->len);
+            kfree(c->body);
+        }
+        c->body = body;
+        c->capacity = capacity;
+    }
+    memcpy((uint8_t *)c->body + c->len, data, len);
+    c->len += len;
+    return 0;
+}
+
+int http_request(http_request_t *request, http_response_t *response) {
+    if (response == NULL) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    http_collector_t c = { 0 };
+    int result = http_request_stream(request, response, http_collect_body, &c);
+    if (result != HTTP_OK) {
+        if (c.body) {
+            kfree(c.body);
+        }
+        if (result == HTTP_ERR_ABORTED) {
+            result = HTTP_ERR_BUFFER_OVERFLOW;
+        }
+        return result;
+    }
+
+    response->body = c.body;
+    response->body_len = c.len;
+    response->body_capacity = c.capacity;
+    return HTTP_OK;
+}
+
+static int http_simple(http_method_t method, const char *url, const void *body,
+                       size_t body_len, http_response_t *response) {
+    http_request_t *request = (http_request_t *)kmalloc(sizeof(http_request_t));
+    if (request == NULL) {
+        return HTTP_ERR_NO_MEMORY;
+    }
+
+    int result = http_init_request(request, method, url);
+    if (result == HTTP_OK) {
+        request->body = body;
+        request->body_len = body_len;
+        result = http_request(request, response);
+    }
+    kfree(request);
+    return result;
+}
+
+int http_get(const char *url, http_response_t *response) {
+    return http_simple(HTTP_METHOD_GET, url, NULL, 0, response);
+}
+
+int http_post(const char *url, const void *body, size_t body_len, http_response_t *response) {
+    return http_simple(HTTP_METHOD_POST, url, body, body_len, response);
+}
+
+int http_head(const char *url, http_response_t *response) {
+    return http_simple(HTTP_METHOD_HEAD, url, NULL, 0, response);
+}
+
+void http_free_response(http_response_t *response) {
+    if (response == NULL) {
+        return;
+    }
+    if (response->body) {
+        kfree(response->body);
+    }
+    response->body = NULL;
+    response->body_len = 0;
+    response->body_capacity = 0;
+}
+
+/* ============================================================================
+ * Request building
+ * ============================================================================ */
+
+int http_init_request(http_request_t *request, http_method_t method, const char *url) {
+    if (request == NULL || url == NULL || strlen(url) >= HTTP_MAX_URL_LEN) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->method = method;
+    http_copy(request->url, url, sizeof(request->url));
+    request->timeout_ms = HTTP_TIMEOUT_MS;
+    return http_parse_url(url, request->host, &request->port, request->path);
+}
+
+int http_set_header(http_request_t *request, const char *name, const char *value) {
+    if (request == NULL || name == NULL || value == NULL) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    /* Replace a header already set */
+    http_header_t *h = NULL;
+    for (int i = 0; i < request->header_count; i++) {
+        if (http_strcasecmp(request->headers[i].name, name) == 0) {
+            h = &request->headers[i];
+        }
+    }
+    if (h == NULL) {
+        if (request->header_count >= HTTP_MAX_HEADERS) {
+            return HTTP_ERR_BUFFER_OVERFLOW;
+        }
+        h = &request->headers[request->header_count++];
+    }
+    http_copy(h->name, name, sizeof(h->name));
+    http_copy(h->value, value, sizeof(h->value));
+    return HTTP_OK;
+}
+
+/**
+ * Append a string to the request being built
+ */
+static bool http_append(char *buffer, size_t size, size_t *pos, const char *s) {
+    size_t len = strlen(s);
+    if (*pos + len >= size) {
+        return false;
+    }
+    memcpy(buffer + *pos, s, len);
+    *pos += len;
+    buffer[*pos] = '\0';
+    return true;
+}
+
+static bool http_request_has_header(const http_request_t *request, const char *name) {
+    for (int i = 0; i < request->header_count; i++) {
+        if (http_strcasecmp(request->headers[i].name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int http_build_request(const http_request_t *request, char *buffer, size_t buffer_size) {
+    if (request == NULL || buffer == NULL || buffer_size == 0) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    size_t pos = 0;
+    bool ok = http_append(buffer, buffer_size, &pos, http_method_string(request->method)) &&
+              http_append(buffer, buffer_size, &pos, " ") &&
+              http_append(buffer, buffer_size, &pos, request->path[0] ? request->path : "/") &&
+              http_append(buffer, buffer_size, &pos, " " HTTP_VERSION "\r\n");
+
+    if (ok && !http_request_has_header(request, "Host")) {
+        ok = http_append(buffer, buffer_size, &pos, "Host: ") &&
+             http_append(buffer, buffer_size, &pos, request->host);
+        if (ok && request->port != HTTP_DEFAULT_PORT) {
+            char port[8];
+            int n = 0;
+            char digits[6];
+            uint16_t p = request->port;
+            do {
+                digits[n++] = (char)('0' + p % 10);
+                p /= 10;
+            } while (p);
+            port[0] = ':';
+            for (int i = 0; i < n; i++) {
+                port[1 + i] = digits[n - 1 - i];
+            }
+            port[1 + n] = '\0';
+            ok = http_append(buffer, buffer_size, &pos, port);
+        }
+        ok = ok && http_append(buffer, buffer_size, &pos, "\r\n");
+    }
+    if (ok && !http_request_has_header(request, "User-Agent")) {
+        ok = http_append(buffer, buffer_size, &pos, "User-Agent: " HTTP_USER_AGENT "\r\n");
+    }
+    if (ok && !http_request_has_header(request, "Connection")) {
+        ok = http_append(buffer, buffer_size, &pos, "Connection: keep-alive\r\n");
+    }
+    if (ok && (request->body_len > 0 || request->method == HTTP_METHOD_POST ||
+               request->method == HTTP_METHOD_PUT) &&
+        !http_request_has_header(request, "Content-Length")) {
+        char len[24];
+        int n = 0;
+        char digits[20];
+        size_t v = request->body_len;
+        do {
+            digits[n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        for (int i = 0; i < n; i++) {
+            len[i] = digits[n - 1 - i];
+        }
+        len[n] = '\0';
+        ok = http_append(buffer, buffer_size, &pos, "Content-Length: ") &&
+             http_append(buffer, buffer_size, &pos, len) &&
+             http_append(buffer, buffer_size, &pos, "\r\n");
+    }
+    for (int i = 0; ok && i < request->header_count; i++) {
+        ok = http_append(buffer, buffer_size, &pos, request->headers[i].name) &&
+             http_append(buffer, buffer_size, &pos, ": ") &&
+             http_append(buffer, buffer_size, &pos, request->headers[i].value) &&
+             http_append(buffer, buffer_size, &pos, "\r\n");
+    }
+    ok = ok && http_append(buffer, buffer_size, &pos, "\r\n");
+
+    return ok ? (int)pos : HTTP_ERR_BUFFER_OVERFLOW;
+}
+
+/* ============================================================================
+ * URL parsing
+ * ============================================================================ */
+
+int http_parse_url(const char *url, char *host, uint16_t *port, char *path) {
+    if (url == NULL || host == NULL || port == NULL || path == NULL) {
+        return HTTP_ERR_INVALID_URL;
+    }
+
+    const char *p = url;
+    if (memcmp(p, "http://", 7) == 0) {
+        p += 7;
+    } else if (strstr(p, "://") != NULL) {
+        return HTTP_ERR_INVALID_URL;    /* Only plain HTTP */
+    }
+
+    size_t host_len = 0;
+    while (p[host_len] && p[host_len] != ':' && p[host_len] != '/' && p[host_len] != '?') {
+        host_len++;
+    }
+    if (host_len == 0 || host_len >= HTTP_MAX_HOST_LEN) {
+        return HTTP_ERR_INVALID_URL;
+    }
+    memcpy(host, p, host_len);
+    host[host_len] = '\0';
+    p += host_len;
+
+    *port = HTTP_DEFAULT_PORT;
+    if (*p == ':') {
+        uint32_t value = 0;
+        p++;
+        if (*p < '0' || *p > '9') {
+            return HTTP_ERR_INVALID_URL;
+        }
+        while (*p >= '0' && *p <= '9') {
+            value = value * 10 + (uint32_t)(*p++ - '0');
+            if (value > 65535) {
+                return HTTP_ERR_INVALID_URL;
+            }
+        }
+        if (value == 0) {
+            return HTTP_ERR_INVALID_URL;
+        }
+        *port = (uint16_t)value;
+    }
+
+    if (*p == '\0') {
+        http_copy(path, "/", HTTP_MAX_PATH_LEN);
+    } else if (*p == '/') {
+        if (strlen(p) >= HTTP_MAX_PATH_LEN) {
+            return HTTP_ERR_INVALID_URL;
+        }
+        http_copy(path, p, HTTP_MAX_PATH_LEN);
+    } else if (*p == '?') {
+        if (strlen(p) + 1 >= HTTP_MAX_PATH_LEN) {
+            return HTTP_ERR_INVALID_URL;
+        }
+        path[0] = '/';
+        http_copy(path + 1, p, HTTP_MAX_PATH_LEN - 1);
+    } else {
+        return HTTP_ERR_INVALID_URL;
+    }
+    return HTTP_OK;
+}
+
+/* ============================================================================
+ * Response parsing
+ * ============================================================================ */
+
+int http_parse_response(const void *data, size_t len, http_response_t *response) {
+    if (data == NULL || response == NULL) {
+        return HTTP_ERR_PARSE_FAILED;
+    }
+
+    /* The reader never writes to a buffer it cannot refill */
+    http_reader_t r = {
+        .sock = NULL, .buf = (uint8_t *)(uintptr_t)data, .cap = len,
+        .start = 0, .end = len, .got_data = true,
+    };
+
+    http_response_reset(response);
+    http_collector_t c = { 0 };
+    int result = http_read_head(&r, response);
+    if (result == HTTP_OK) {
+        result = http_read_body(&r, response, true, http_collect_body, &c);
+    }
+    if (result != HTTP_OK) {
+        if (c.body) {
+            kfree(c.body);
+        }
+        return result == HTTP_ERR_RECV_FAILED ? HTTP_ERR_PARSE_FAILED : result;
+    }
+
+    response->body = c.body;
+    response->body_len = c.len;
+    response->body_capacity = c.capacity;
+    return HTTP_OK;
+}
+
+const char *http_get_header(const http_response_t *response, const char *name) {
+    if (response == NULL || name == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < response->header_count; i++) {
+        if (http_strcasecmp(response->headers[i].name, name) == 0) {
+            return response->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* ============================================================================
+ * Utility functions
+ * ============================================================================ */
+
+const char *http_method_string(http_method_t method) {
+    switch (method) {
+        case HTTP_METHOD_GET:    return "GET";
+        case HTTP_METHOD_POST:   return "POST";
+        case HTTP_METHOD_HEAD:   return "HEAD";
+        case HTTP_METHOD_PUT:    return "PUT";
+        case HTTP_METHOD_DELETE: return "DELETE";
+        default:                 return "GET";
+    }
+}
+
+const char *http_error_string(int error) {
+    switch (error) {
+        case HTTP_OK:                   return "Success";
+        case HTTP_ERR_INVALID_URL:      return "Invalid URL";
+        case HTTP_ERR_DNS_FAILED:       return "DNS lookup failed";
+        case HTTP_ERR_CONNECT_FAILED:   return "Connection failed";
+        case HTTP_ERR_SEND_FAILED:      return "Send failed";
+        case HTTP_ERR_RECV_FAILED:      return "Receive failed";
+        case HTTP_ERR_TIMEOUT:          return "Timed out";
+        case HTTP_ERR_NO_MEMORY:        return "Out of memory";
+        case HTTP_ERR_PARSE_FAILED:     return "Parse failed";
+        case HTTP_ERR_BUFFER_OVERFLOW:  return "Buffer overflow";
+        case HTTP_ERR_INVALID_RESPONSE: return "Invalid response";
+        case HTTP_ERR_NOT_INITIALIZED:  return "Not initialized";
+        case HTTP_ERR_ABORTED:          return "Transfer aborted";
+        case HTTP_ERR_BUSY:             return "No free connection";
+        default:                        return "Unknown error";
+    }
+}
+
+int http_url_encode(const char *input, char *output, size_t output_size) {
+    static const char hex[] = "0123456789ABCDEF";
+
+    if (input == NULL || output == NULL || output_size == 0) {
+        return HTTP_ERR_BUFFER_OVERFLOW;
+    }
+
+    size_t pos = 0;
+    for (const uint8_t *p = (const uint8_t *)input; *p; p++) {
+        uint8_t c = *p;
+        bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == '~';
+        size_t need = plain ? 1 : 3;
+        if (pos + need >= output_size) {
+            return HTTP_ERR_BUFFER_OVERFLOW;
+        }
+        if (plain) {
+            output[pos++] = (char)c;
+        } else {
+            output[pos++] = '%';
+            output[pos++] = hex[c >> 4];
+            output[pos++] = hex[c & 0x0F];
+        }
+    }
+    output[pos] = '\0';
+    return (int)pos;
+}
+
+static int http_hex_value(char c) {
+    c = http_tolower(c);
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int http_url_decode(const char *input, char *output, size_t output_size) {
+    if (input == NULL || output == NULL || output_size == 0) {
+        return HTTP_ERR_BUFFER_OVERFLOW;
+    }
+
+    size_t pos = 0;
+    for (const char *p = input; *p; p++) {
+        if (pos + 1 >= output_size) {
+            return HTTP_ERR_BUFFER_OVERFLOW;
+        }
+        if (*p == '%' && http_hex_value(p[1]) >= 0 && http_hex_value(p[2]) >= 0) {
+            output[pos++] = (char)((http_hex_value(p[1]) << 4) | http_hex_value(p[2]));
+            p += 2;
+        } else if (*p == '+') {
+            output[pos++] = ' ';
+        } else {
+            output[pos++] = *p;
+        }
+    }
+    output[pos] = '\0';
+    return (int)pos;
+}
@@ -6,6 +6,19 @@
  *   - HTTP headers parsing
  *   - Chunked transfer encoding
  *   - Basic response handling
+ *   - Keep-alive connections, pooled per host and port
+ *   - Streaming response bodies
+ *
+ * Connections are kept open after a response whose end is known (by
+ * Content-Length or the last chunk) unless either side asked to close,
+ * and the next request to the same host and port reuses one. A request
+ * on a reused connection that fails before any response arrives is sent
+ * again on a new connection, since the server may have just closed it.
+ * Idle connections are closed after HTTP_POOL_IDLE_MS.
+ *
+ * http_request_stream hands the body to a callback as it arrives, so a
+ * download of any size runs in the connection's HTTP_BUFFER_SIZE buffer.
+ * http_request collects the body into response->body instead.
  */
 
 #ifndef _AAAOS_NET_HTTP_H
@@ -25,6 +38,9 @@
 #define HTTP_BUFFER_SIZE            8192
 #define HTTP_MAX_BODY_SIZE          (1 * 1024 * 1024)  /* 1MB max body */
 #define HTTP_TIMEOUT_MS             30000              /* 30 second timeout */
+#define HTTP_POOL_SIZE              8                  /* Connections kept */
+#define HTTP_POOL_IDLE_MS           60000              /* Idle time before closing */
+#define HTTP_USER_AGENT             "AAAos/1.0"
 
 /* HTTP Version string */
 #define HTTP_VERSION                "HTTP/1.1"
@@ -51,6 +67,8 @@ typedef enum http_method {
 #define HTTP_ERR_BUFFER_OVERFLOW    -9
 #define HTTP_ERR_INVALID_RESPONSE   -10
 #define HTTP_ERR_NOT_INITIALIZED    -11
+#define HTTP_ERR_ABORTED            -12     /* Body callback stopped the transfer */
+#define HTTP_ERR_BUSY               -13     /* Every pooled connection is in use */
 
 /**
  * HTTP Header structure
@@ -98,8 +116,29 @@ typedef struct http_response {
 
     bool chunked;                                   /* True if chunked transfer encoding */
     size_t content_length;                          /* Content-Length header value (-1 if not present) */
+    bool keep_alive;                                /* Connection may carry another request */
 } http_response_t;
 
+/**
+ * Receives a response body piece by piece (http_request_stream)
+ * @param ctx Argument given to http_request_stream
+ * @param data Next bytes of the body, already de-chunked
+ * @param len Number of bytes
+ * @return 0 to go on, negative to stop the transfer
+ */
+typedef int (*http_body_fn_t)(void *ctx, const void *data, size_t len);
+
+/**
+ * Connection pool statistics
+ */
+typedef struct http_pool_stats {
+    uint64_t connects;          /* New connections opened */
+    uint64_t reuses;            /* Requests sent on a kept connection */
+    uint64_t retries;           /* Requests resent after a kept connection failed */
+    uint64_t closes;            /* Connections closed */
+    uint32_t idle;              /* Connections waiting for a request now */
+} http_pool_stats_t;
+
 /* ============================================================================
  * HTTP Client API Functions
  * ============================================================================ */
@@ -150,6 +189,29 @@ int http_head(const char *url, http_response_t *response);
  */
 int http_request(http_request_t *request, http_response_t *response);
 
+/**
+ * Perform an HTTP request, passing the body to a callback as it arrives
+ * response gets the status and headers; its body stays empty.
+ *
+ * @param request Pointer to fully populated request structure
+ * @param response Pointer to response structure to fill
+ * @param on_body Called with each piece of the body (may be NULL to discard it)
+ * @param ctx Passed to on_body
+ * @return HTTP_OK on success, negative error code on failure
+ */
+int http_request_stream(http_request_t *request, http_response_t *response,
+                        http_body_fn_t on_body, void *ctx);
+
+/**
+ * Close every idle pooled connection
+ */
+void http_pool_flush(void);
+
+/**
+ * Get connection pool statistics
+ */
+void http_get_pool_stats(http_pool_stats_t *stats);
+
 /**
  * Free resources associated with an HTTP response
  *
@@ -8,6 +8,12 @@
 #include "../ethernet/ethernet.h"
 #include "../arp/arp.h"
 #include "../icmp/icmp.h"
+#include "route.h"
+#include "ipfrag.h"
+#include "../core/nettrace.h"
+#include "../loopback/loopback.h"
+#include "../tcp/tcp.h"
+#include "../udp/udp.h"
 
 /* Local IP configuration */
 static uint32_t local_ip = 0;
@@ -18,12 +24,37 @@ static bool ip_initialized = false;
 /* IP identification counter */
 static uint16_t ip_id_counter = 0;
 
+/* Most fragments one datagram is cut into (65535 / 1440, rounded up) */
+#define IP_MAX_FRAGMENTS    48
+
+/**
+ * Replace the routes derived from the address, netmask and gateway
+ */
+static void ip_update_routes(void) {
+    /* Host-order contiguous mask: the prefix ends at its lowest set bit */
+    uint8_t prefix_len = local_netmask ? (uint8_t)(32 - __builtin_ctz(local_netmask)) : 0;
+
+    route_del_flags(ROUTE_FLAG_IFCONF);
+
+    /* Our own network is on-link */
+    route_add(local_ip, prefix_len, 0, ROUTE_IF_ETH0, ROUTE_FLAG_IFCONF);
+
+    /* Everything else through the gateway */
+    if (local_gateway != 0 && prefix_len > 0) {
+        route_add(0, 0, local_gateway, ROUTE_IF_ETH0, ROUTE_FLAG_IFCONF);
+    }
+}
+
 void ip_init(uint32_t ip, uint32_t netmask, uint32_t gateway) {
     local_ip = ip;
     local_netmask = netmask;
     local_gateway = gateway;
     ip_initialized = true;
 
+    route_init();
+    ip_update_routes();
+    ipfrag_init();
+
     kprintf("[IP] Initialized: addr=%u.%u.%u.%u mask=%u.%u.%u.%u gw=%u.%u.%u.%u\n",
             ip_octet(ip, 0), ip_octet(ip, 1),
             ip_octet(ip, 2), ip_octet(ip, 3),
@@ -39,6 +70,7 @@ uint32_t ip_get_addr(void) {
 
 void ip_set_addr(uint32_t ip) {
     local_ip = ip;
+    ip_update_routes();
     kprintf("[IP] Address changed to %u.%u.%u.%u\n",
             ip_octet(ip, 0), ip_octet(ip, 1),
             ip_octet(ip, 2), ip_octet(ip, 3));
@@ -50,6 +82,7 @@ uint32_t ip_get_netmask(void) {
 
 void ip_set_netmask(uint32_t netmask) {
     local_netmask = netmask;
+    ip_update_routes();
 }
 
 uint32_t ip_get_gateway(void) {
@@ -58,30 +91,11 @@ uint32_t ip_get_gateway(void) {
 
 void ip_set_gateway(uint32_t gateway) {
     local_gateway = gateway;
+    ip_update_routes();
 }
 
 uint16_t ip_checksum(const void *header, size_t len) {
-    const uint16_t *data = (const uint16_t *)header;
-    uint32_t sum = 0;
-
-    /* Sum all 16-bit words */
-    while (len > 1) {
-        sum += *data++;
-        len -= 2;
-    }
-
-    /* Add odd byte if present */
-    if (len > 0) {
-        sum += *(const uint8_t *)data;
-    }
-
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    /* Return one's complement */
-    return (uint16_t)~sum;
+    return csum_buffer(header, len);
 }
 
 uint16_t ip_checksum_data(const void *data, size_t len) {
@@ -89,8 +103,20 @@ uint16_t ip_checksum_data(const void *data, size_t len) {
 }
 
 bool ip_is_local(uint32_t ip) {
-    /* Check if in same network */
-    return (ip & local_netmask) == (local_ip & local_netmask);
+    /* Reached without a gateway */
+    route_t route;
+    return route_lookup(ip, &route) && !(route.flags & ROUTE_FLAG_GATEWAY);
+}
+
+bool ip_is_loopback(uint32_t ip) {
+    return (ip >> 24) == 127 || (ip == local_ip && ip != 0);
+}
+
+uint32_t ip_offloads(uint32_t dest_ip) {
+    if (ip_is_loopback(dest_ip)) {
+        return ETH_OFFLOAD_TX_CSUM | ETH_OFFLOAD_RX_CSUM | ETH_OFFLOAD_TSO;
+    }
+    return eth_offloads();
 }
 
 bool ip_is_broadcast(uint32_t ip) {
@@ -122,6 +148,21 @@ int ip_send(uint32_t dest_ip, uint8_t protocol, const void *data, size_t len) {
         return -1;
     }
 
+    /* Loopback takes a netbuf it can hand straight back */
+    if (ip_is_loopback(dest_ip)) {
+        netbuf_t *buf = netbuf_alloc(NETBUF_DEFAULT_HEADROOM + MAX(len, (size_t)1),
+                                     NETBUF_DEFAULT_HEADROOM);
+        if (buf == NULL || (len > 0 && netbuf_copy_in(buf, data, len) != 0)) {
+            netbuf_free(buf);
+            return -1;
+        }
+        int ret = ip_send_buf(buf, dest_ip, protocol);
+        if (ret != 0) {
+            netbuf_free(buf);
+        }
+        return ret;
+    }
+
     /* Build IP header */
     hdr = (ip_header_t *)packet;
     memset(hdr, 0, IP_HEADER_MIN);
@@ -158,25 +199,34 @@ int ip_send(uint32_t dest_ip, uint8_t protocol, const void *data, size_t len) {
         /* Broadcast - use broadcast MAC */
         uint8_t bcast_mac[ETH_ALEN] = ETH_BROADCAST_MAC;
         return eth_send(bcast_mac, ETH_TYPE_IPV4, packet, total_len);
-    } else if (ip_is_local(dest_ip)) {
-        /* Local network - send directly */
-        next_hop = dest_ip;
-    } else {
-        /* Remote network - use gateway */
-        next_hop = local_gateway;
-        if (next_hop == 0) {
-            kprintf("[IP] Error: No gateway configured for remote address\n");
-            return -1;
-        }
+    } else if (!route_next_hop(dest_ip, NULL, &next_hop)) {
+        kprintf("[IP] Error: No route to %u.%u.%u.%u\n",
+                ip_octet(dest_ip, 0), ip_octet(dest_ip, 1),
+                ip_octet(dest_ip, 2), ip_octet(dest_ip, 3));
+        return -1;
     }
 
     /* Look up MAC address */
     if (arp_lookup(next_hop, dest_mac) != 0) {
-        /* ARP not resolved yet - packet will need to be retried */
-        kprintf("[IP] Waiting for ARP resolution of %u.%u.%u.%u\n",
-                ip_octet(next_hop, 0), ip_octet(next_hop, 1),
-                ip_octet(next_hop, 2), ip_octet(next_hop, 3));
-        return -1;
+        /* ARP not resolved yet - park a copy on the neighbor entry */
+        netbuf_t *buf = netbuf_alloc(NETBUF_DEFAULT_HEADROOM + total_len,
+                                     NETBUF_DEFAULT_HEADROOM);
+        if (buf == NULL) {
+            return -1;
+        }
+        netbuf_copy_in(buf, packet, total_len);
+
+        int ret = arp_resolve(next_hop, buf, dest_mac);
+        if (ret == ARP_QUEUED) {
+            return 0;
+        }
+        netbuf_free(buf);
+        if (ret != 0) {
+            kprintf("[IP] Dropped, no ARP resolution for %u.%u.%u.%u\n",
+                    ip_octet(next_hop, 0), ip_octet(next_hop, 1),
+                    ip_octet(next_hop, 2), ip_octet(next_hop, 3));
+            return -1;
+        }
     }
 
     /* Send via Ethernet */
@@ -184,6 +234,11 @@ int ip_send(uint32_t dest_ip, uint8_t protocol, const void *data, size_t len) {
 }
 
 int ip_send_buf(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol) {
+    return ip_send_buf_cached(buf, dest_ip, protocol, NULL);
+}
+
+int ip_send_buf_cached(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol,
+                       route_cache_t *cache) {
     ip_header_t *hdr;
     size_t total_len;
     uint32_t next_hop;
@@ -214,55 +269,179 @@ int ip_send_buf(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol) {
     hdr->tos = 0;
     hdr->total_length = htons(total_len);
     hdr->identification = htons(ip_id_counter++);
-    hdr->flags_fragment = htons(IP_FLAG_DF);
+    /* Datagrams over the MTU may be fragmented; TSO sends are cut by the device */
+    bool loop = ip_is_loopback(dest_ip);
+    bool fits = total_len <= eth_mtu() || (buf->flags & NETBUF_FLAG_TSO) || loop;
+    uint32_t src_ip = (dest_ip >> 24) == 127 ? IP_ADDR_LOOPBACK : local_ip;
+    hdr->flags_fragment = fits ? htons(IP_FLAG_DF) : 0;
     hdr->ttl = IP_TTL_DEFAULT;
     hdr->protocol = protocol;
     hdr->checksum = 0;
-    hdr->src_addr = htonl(local_ip);
+    hdr->src_addr = htonl(src_ip);
     hdr->dst_addr = htonl(dest_ip);
 
-    /* Calculate header checksum */
-    hdr->checksum = ip_checksum(hdr, IP_HEADER_MIN);
+    /* Calculate header checksum, or leave it to the device */
+    if ((ip_offloads(dest_ip) & ETH_OFFLOAD_TX_CSUM) && fits) {
+        buf->flags |= NETBUF_FLAG_CSUM_IP;
+    } else {
+        hdr->checksum = ip_checksum(hdr, IP_HEADER_MIN);
+    }
 
     /* Store in buffer metadata */
-    buf->src_ip = local_ip;
+    buf->src_ip = src_ip;
     buf->dst_ip = dest_ip;
     buf->protocol = protocol;
 
     kprintf("[IP] TX: %u.%u.%u.%u -> %u.%u.%u.%u proto=%u len=%u\n",
-            ip_octet(local_ip, 0), ip_octet(local_ip, 1),
-            ip_octet(local_ip, 2), ip_octet(local_ip, 3),
+            ip_octet(src_ip, 0), ip_octet(src_ip, 1),
+            ip_octet(src_ip, 2), ip_octet(src_ip, 3),
             ip_octet(dest_ip, 0), ip_octet(dest_ip, 1),
             ip_octet(dest_ip, 2), ip_octet(dest_ip, 3),
             protocol, (uint32_t)total_len);
 
+    if (loop) {
+        return loopback_xmit(buf);
+    }
+
     /* Determine next hop */
     if (ip_is_broadcast(dest_ip)) {
         uint8_t bcast_mac[ETH_ALEN] = ETH_BROADCAST_MAC;
-        return eth_send_buf(buf, bcast_mac, ETH_TYPE_IPV4);
-    } else if (ip_is_local(dest_ip)) {
-        next_hop = dest_ip;
-    } else {
-        next_hop = local_gateway;
-        if (next_hop == 0) {
-            kprintf("[IP] Error: No gateway configured for remote address\n");
-            return -1;
-        }
+        return ip_output(buf, bcast_mac);
+    } else if (!route_next_hop(dest_ip, cache, &next_hop)) {
+        kprintf("[IP] Error: No route to %u.%u.%u.%u\n",
+                ip_octet(dest_ip, 0), ip_octet(dest_ip, 1),
+                ip_octet(dest_ip, 2), ip_octet(dest_ip, 3));
+        return -1;
     }
 
     /* Look up MAC address */
-    if (arp_lookup(next_hop, dest_mac) != 0) {
-        kprintf("[IP] Waiting for ARP resolution of %u.%u.%u.%u\n",
+    int ret = arp_resolve(next_hop, buf, dest_mac);
+    if (ret == ARP_QUEUED) {
+        /* Sent when the reply arrives */
+        return 0;
+    }
+    if (ret != 0) {
+        kprintf("[IP] Dropped, no ARP resolution for %u.%u.%u.%u\n",
                 ip_octet(next_hop, 0), ip_octet(next_hop, 1),
                 ip_octet(next_hop, 2), ip_octet(next_hop, 3));
         return -1;
     }
 
     /* Send via Ethernet */
-    return eth_send_buf(buf, dest_mac, ETH_TYPE_IPV4);
+    return ip_output(buf, dest_mac);
+}
+
+/**
+ * Send a packet over the MTU as fragments
+ * Each fragment is a new header buffer chained to a clone of buf that
+ * views its share of the payload, so the payload is not copied.
+ */
+static int ip_fragment(netbuf_t *buf, const uint8_t *dest_mac) {
+    netbuf_t *frags[IP_MAX_FRAGMENTS];
+    int count = 0;
+
+    const ip_header_t *hdr = (const ip_header_t *)buf->data;
+    size_t hdr_len = ip_header_len(hdr);
+    size_t payload_len = buf->len - hdr_len;
+    size_t step = (eth_mtu() - hdr_len) & ~(size_t)7;
+
+    if (ntohs(hdr->flags_fragment) & IP_FLAG_DF) {
+        kprintf("[IP] Error: Packet too large (%u) and DF set\n", (uint32_t)buf->len);
+        return -1;
+    }
+
+    /* The device would checksum each fragment as a whole segment */
+    if (buf->flags & (NETBUF_FLAG_CSUM_L4 | NETBUF_FLAG_TSO)) {
+        kprintf("[IP] Error: Cannot fragment a checksum offload packet\n");
+        return -1;
+    }
+
+    for (size_t off = 0; off < payload_len; off += step) {
+        size_t n = MIN(step, payload_len - off);
+        netbuf_t *head = netbuf_alloc(NETBUF_DEFAULT_HEADROOM + hdr_len,
+                                      NETBUF_DEFAULT_HEADROOM);
+        netbuf_t *view = head ? netbuf_clone(buf) : NULL;
+        if (view == NULL || count == IP_MAX_FRAGMENTS) {
+            netbuf_free(head);
+            netbuf_free(view);
+            while (count > 0) {
+                netbuf_t *frag = frags[--count];
+                netbuf_free(frag->next);
+                netbuf_free(frag);
+            }
+            return -1;
+        }
+
+        ip_header_t *fhdr = (ip_header_t *)netbuf_put(head, hdr_len);
+        memcpy(fhdr, hdr, hdr_len);
+        fhdr->total_length = htons((uint16_t)(hdr_len + n));
+        fhdr->flags_fragment = htons((uint16_t)(off / 8) |
+                                     (off + n < payload_len ? IP_FLAG_MF : 0));
+        fhdr->checksum = 0;
+        fhdr->checksum = ip_checksum(fhdr, hdr_len);
+
+        view->data = buf->data + hdr_len + off;
+        view->len = n;
+        view->flags = 0;
+        head->next = view;
+        frags[count++] = head;
+    }
+
+    /* A fragment the device refuses is lost like any other */
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        netbuf_t *view = frags[i]->next;
+        if (eth_send_buf(frags[i], dest_mac, ETH_TYPE_IPV4) != 0) {
+            netbuf_free(view);
+            frags[i]->next = NULL;
+            netbuf_free(frags[i]);
+            failed++;
+        }
+    }
+    if (failed > 0) {
+        kprintf("[IP] %d of %d fragments not sent\n", failed, count);
+    }
+
+    netbuf_free(buf);
+    return 0;
+}
+
+int ip_output(netbuf_t *buf, const uint8_t *dest_mac) {
+    if (buf->len <= eth_mtu() || (buf->flags & NETBUF_FLAG_TSO)) {
+        return eth_send_buf(buf, dest_mac, ETH_TYPE_IPV4);
+    }
+    return ip_fragment(buf, dest_mac);
 }
 
 int ip_receive(const void *packet, size_t len) {
+    return ip_receive_offload(packet, len, 0);
+}
+
+static int ip_deliver(const void *packet, size_t len, uint32_t flags, netbuf_t **bufp);
+
+int ip_receive_offload(const void *packet, size_t len, uint32_t flags) {
+    netbuf_t *buf = NULL;
+    int result = ip_deliver(packet, len, flags, &buf);
+    netbuf_free(buf);
+    return result;
+}
+
+int ip_receive_buf(netbuf_t *buf) {
+    if (buf == NULL) {
+        return -1;
+    }
+    int result = ip_deliver(buf->data, buf->len, buf->flags, &buf);
+    netbuf_free(buf);
+    return result;
+}
+
+/**
+ * Validate a received packet and pass it up
+ * @param bufp Buffer holding the packet, or NULL if the packet is only
+ *             borrowed and upper layers copy what they keep. Left set to
+ *             whatever buffer the caller must free.
+ */
+static int ip_deliver(const void *packet, size_t len, uint32_t flags, netbuf_t **bufp) {
     const ip_header_t *hdr;
     uint8_t header_len;
     uint16_t total_len;
@@ -270,13 +449,17 @@ int ip_receive(const void *packet, size_t len) {
     const uint8_t *payload;
     size_t payload_len;
 
+    nettrace_event(NETTRACE_IP_RX, len);
+
     if (!ip_initialized) {
         kprintf("[IP] Error: Not initialized\n");
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
     if (packet == NULL || len < IP_HEADER_MIN) {
         kprintf("[IP] Error: Packet too small (%u bytes)\n", (uint32_t)len);
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
@@ -285,6 +468,7 @@ int ip_receive(const void *packet, size_t len) {
     /* Validate IP version */
     if (ip_version(hdr) != IP_VERSION) {
         kprintf("[IP] Error: Invalid version %u\n", ip_version(hdr));
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
@@ -292,6 +476,7 @@ int ip_receive(const void *packet, size_t len) {
     header_len = ip_header_len(hdr);
     if (header_len < IP_HEADER_MIN || header_len > len) {
         kprintf("[IP] Error: Invalid header length %u\n", header_len);
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
@@ -299,12 +484,14 @@ int ip_receive(const void *packet, size_t len) {
     total_len = ntohs(hdr->total_length);
     if (total_len < header_len || total_len > len) {
         kprintf("[IP] Error: Invalid total length %u\n", total_len);
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
-    /* Verify checksum */
-    if (ip_checksum(hdr, header_len) != 0) {
+    /* Verify checksum, unless the device did */
+    if (!(flags & NETBUF_FLAG_CSUM_IP_OK) && ip_checksum(hdr, header_len) != 0) {
         kprintf("[IP] Error: Invalid header checksum\n");
+        nettrace_drop(NETTRACE_IP_RX);
         return -1;
     }
 
@@ -322,18 +509,36 @@ int ip_receive(const void *packet, size_t len) {
     /* Check if packet is for us */
     if (dst_ip != local_ip &&
         !ip_is_broadcast(dst_ip) &&
-        !ip_is_multicast(dst_ip)) {
+        !ip_is_multicast(dst_ip) &&
+        !((flags & NETBUF_FLAG_LOOPBACK) && ip_is_loopback(dst_ip))) {
         kprintf("[IP] Packet not for us, dropping\n");
+        nettrace_drop(NETTRACE_IP_RX);
         return 0;
     }
 
     /* Check TTL */
     if (hdr->ttl == 0) {
         kprintf("[IP] TTL expired\n");
+        nettrace_drop(NETTRACE_IP_RX);
         /* Should send ICMP Time Exceeded */
         return -1;
     }
 
+    /* Fragments wait until the whole datagram is in */
+    if (ntohs(hdr->flags_fragment) & (IP_FLAG_MF | IP_FRAG_OFFSET_MASK)) {
+        netbuf_t *whole = ipfrag_input(hdr, total_len);
+        if (whole == NULL) {
+            return 0;
+        }
+        netbuf_free(*bufp);
+        *bufp = whole;
+        flags &= ~NETBUF_FLAG_CSUM_L4_OK;
+        hdr = (const ip_header_t *)whole->data;
+        packet = whole->data;
+        header_len = ip_header_len(hdr);
+        total_len = (uint16_t)whole->len;
+    }
+
     /* Get payload */
     payload = (const uint8_t *)packet + header_len;
     payload_len = total_len - header_len;
@@ -343,16 +548,32 @@ int ip_receive(const void *packet, size_t len) {
         case IP_PROTO_ICMP:
             return icmp_receive(src_ip, payload, payload_len);
 
-        case IP_PROTO_TCP:
-            kprintf("[IP] TCP not yet implemented\n");
-            return -1;
+        case IP_PROTO_TCP: {
+            int result = tcp_receive_offload(payload, payload_len, src_ip, dst_ip, flags);
+            if (result < 0) {
+                nettrace_drop(NETTRACE_TCP_RX);
+            }
+            return result;
+        }
 
         case IP_PROTO_UDP:
-            kprintf("[IP] UDP not yet implemented\n");
-            return -1;
+            if (*bufp == NULL) {
+                return udp_input(src_ip, payload, payload_len);
+            }
+            /* The socket queues this very buffer */
+            netbuf_pull(*bufp, header_len);
+            netbuf_trim(*bufp, (*bufp)->len - payload_len);
+            (*bufp)->src_ip = src_ip;
+            (*bufp)->dst_ip = dst_ip;
+            if (udp_input_buf(*bufp) != UDP_OK) {
+                return -1;
+            }
+            *bufp = NULL;
+            return 0;
 
         default:
             kprintf("[IP] Unknown protocol %u\n", hdr->protocol);
+            nettrace_drop(NETTRACE_IP_RX);
             return -1;
     }
 }
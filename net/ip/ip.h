@@ -1,7 +1,11 @@
 /**
  * AAAos Network Stack - Internet Protocol Version 4 (IPv4)
  *
- * Implements RFC 791 IPv4 packet handling.
+ * Implements RFC 791 IPv4 packet handling. The next hop comes from the
+ * routing table (route.h); ip_init and the ip_set_* calls keep the routes
+ * for our own network and the default gateway in step with the address.
+ * Datagrams over the MTU are fragmented on send and reassembled on
+ * receive (ipfrag.h). Packets for ourselves go over loopback (loopback.h).
  */
 
 #ifndef _AAAOS_NET_IP_H
@@ -9,6 +13,8 @@
 
 #include "../../kernel/include/types.h"
 #include "../core/netbuf.h"
+#include "../core/checksum.h"
+#include "route.h"
 
 /* IP constants */
 #define IP_VERSION          4           /* IPv4 */
@@ -105,7 +111,8 @@ int ip_send(uint32_t dest_ip, uint8_t protocol, const void *data, size_t len);
 
 /**
  * Send an IP packet using a netbuf
- * The netbuf should have room for IP + Ethernet headers
+ * The netbuf should have room for IP + Ethernet headers. It is consumed
+ * on success (see eth_send_buf); on error the caller still owns it.
  * @param buf Network buffer with payload
  * @param dest_ip Destination IP address (host byte order)
  * @param protocol Upper layer protocol
@@ -113,6 +120,26 @@ int ip_send(uint32_t dest_ip, uint8_t protocol, const void *data, size_t len);
  */
 int ip_send_buf(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol);
 
+/**
+ * Send an IP packet using a netbuf and a connection's next hop cache
+ * As ip_send_buf, but the route to dest_ip is taken from cache while the
+ * routing table is unchanged.
+ * @param cache Next hop cache owned by the caller, or NULL
+ * @return 0 on success, negative on error
+ */
+int ip_send_buf_cached(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol,
+                       route_cache_t *cache);
+
+/**
+ * Send a finished IP packet to a resolved neighbor
+ * Packets over the MTU are sent as fragments (unless DF is set). The
+ * buffer is consumed on success; on error the caller still owns it.
+ * @param buf IP packet, header included
+ * @param dest_mac Link address of the next hop (ETH_ALEN bytes)
+ * @return 0 on success, negative on error
+ */
+int ip_output(netbuf_t *buf, const uint8_t *dest_mac);
+
 /**
  * Process a received IP packet
  * @param packet IP packet data (without Ethernet header)
@@ -121,6 +148,21 @@ int ip_send_buf(netbuf_t *buf, uint32_t dest_ip, uint8_t protocol);
  */
 int ip_receive(const void *packet, size_t len);
 
+/**
+ * Process a received IP packet, skipping checks the device already made
+ * @param flags NETBUF_FLAG_CSUM_*_OK flags of the received frame
+ * @return 0 on success, negative on error
+ */
+int ip_receive_offload(const void *packet, size_t len, uint32_t flags);
+
+/**
+ * Process a received IP packet held in a netbuf (loopback)
+ * The buffer is always consumed; a UDP datagram is queued to its socket
+ * in this same buffer.
+ * @return 0 on success, negative on error
+ */
+int ip_receive_buf(netbuf_t *buf);
+
 /**
  * Calculate IP header checksum
  * @param header Pointer to IP header
@@ -138,12 +180,25 @@ uint16_t ip_checksum(const void *header, size_t len);
 uint16_t ip_checksum_data(const void *data, size_t len);
 
 /**
- * Check if an IP address is in our local network
+ * Check if an IP address is on-link (its route has no gateway)
  * @param ip IP address to check (host byte order)
  * @return true if local, false if needs routing
  */
 bool ip_is_local(uint32_t ip);
 
+/**
+ * Check if an IP address is ours or in 127.0.0.0/8 (sent over loopback)
+ */
+bool ip_is_loopback(uint32_t ip);
+
+/**
+ * Offloads available on the way to a destination
+ * Loopback needs no checksums and takes any size, so it reports every
+ * offload; otherwise this is eth_offloads().
+ * @return ETH_OFFLOAD_* flags
+ */
+uint32_t ip_offloads(uint32_t dest_ip);
+
 /**
  * Check if an IP address is a broadcast address
  * @param ip IP address to check (host byte order)
@@ -181,4 +236,24 @@ static inline uint8_t ip_make_version_ihl(uint8_t version, uint8_t ihl) {
     return ((version & 0x0F) << 4) | ((ihl / 4) & 0x0F);
 }
 
+/**
+ * Decrement the TTL of a header being forwarded
+ * The checksum is updated incrementally (RFC 1624) rather than recomputed.
+ * @return false if the TTL has run out and the packet must be dropped
+ */
+static inline bool ip_decrease_ttl(ip_header_t *hdr) {
+    uint16_t old_word, new_word;
+
+    if (hdr->ttl <= 1) {
+        return false;
+    }
+
+    /* TTL shares a 16-bit checksum word with the protocol */
+    __builtin_memcpy(&old_word, &hdr->ttl, sizeof(old_word));
+    hdr->ttl--;
+    __builtin_memcpy(&new_word, &hdr->ttl, sizeof(new_word));
+    hdr->checksum = csum_replace16(hdr->checksum, old_word, new_word);
+    return true;
+}
+
 #endif /* _AAAOS_NET_IP_H */
@@ -0,0 +1,386 @@
+/**
+ * AAAos Network Stack - IPv4 Fragment Reassembly Implementation
+ *
+ * ipfrag_lock covers the queues and is taken with interrupts off. Buffers
+ * are allocated, copied and freed outside it: a fragment is copied out of
+ * the receive buffer before the lock is taken, buffers of dropped queues
+ * are chained and freed after it is released, and a completed datagram is
+ * joined after its queue has been taken off the table.
+ */
+
+#include "ipfrag.h"
+#include "../../kernel/include/serial.h"
+#include "../../lib/libc/string.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../ethernet/ethernet.h"
+
+/**
+ * One fragment: payload bytes [start, end) of the datagram
+ */
+typedef struct ipfrag_piece {
+    uint16_t start;
+    uint16_t end;
+    netbuf_t *buf;              /* Payload only */
+} ipfrag_piece_t;
+
+/**
+ * Datagram being reassembled
+ */
+typedef struct ipfrag_queue {
+    /* Key */
+    uint32_t src;
+    uint32_t dst;
+    uint16_t id;
+    uint8_t  protocol;
+
+    bool     in_use;
+    bool     have_last;         /* Fragment without MF seen: total is known */
+    uint8_t  count;             /* Entries in pieces */
+    uint8_t  hdr_len;           /* Length of hdr, 0 until offset 0 arrives */
+    uint32_t total;             /* Payload length of the whole datagram */
+    uint32_t received;          /* Payload bytes held */
+    uint32_t mem;               /* Bytes charged to IPFRAG_MEM_MAX */
+    uint32_t created;           /* ipfrag_time when the first fragment arrived */
+    uint64_t seq;               /* Age order, for eviction */
+
+    uint8_t  hdr[IP_HEADER_MAX];    /* Header of the first fragment */
+    ipfrag_piece_t pieces[IPFRAG_MAX_PIECES];   /* Sorted by start */
+
+    struct ipfrag_queue *hash_next;
+} ipfrag_queue_t;
+
+static ipfrag_queue_t ipfrag_queues[IPFRAG_MAX_QUEUES];
+static ipfrag_queue_t *ipfrag_hash[IPFRAG_HASH_SIZE];
+static uint32_t ipfrag_mem = 0;
+static uint32_t ipfrag_time = 0;
+static uint64_t ipfrag_seq = 0;
+static ipfrag_stats_t ipfrag_stats;
+static volatile int ipfrag_lock = 0;
+
+/* Drives ipfrag_timer_tick once per second */
+static ktimer_t ipfrag_timer;
+
+static inline uint64_t ipfrag_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&ipfrag_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void ipfrag_lock_release(uint64_t flags) {
+    __sync_lock_release(&ipfrag_lock);
+    interrupts_restore(flags);
+}
+
+static inline uint32_t ipfrag_bucket(uint32_t src, uint32_t dst, uint16_t id, uint8_t proto) {
+    uint32_t h = (src ^ dst ^ ((uint32_t)id << 16) ^ proto) * 2654435761u;
+    return (h ^ (h >> 16)) & (IPFRAG_HASH_SIZE - 1);
+}
+
+static inline uint32_t ipfrag_truesize(const netbuf_t *buf) {
+    return (uint32_t)(buf->capacity + sizeof(netbuf_t));
+}
+
+/**
+ * Free a chain of buffers linked through next
+ */
+static void ipfrag_free_chain(netbuf_t *buf) {
+    while (buf != NULL) {
+        netbuf_t *next = buf->next;
+        netbuf_free(buf);
+        buf = next;
+    }
+}
+
+/**
+ * Take a queue off the table (ipfrag_lock held)
+ * Its buffers are added to *garbage unless garbage is NULL, in which
+ * case the caller has taken them.
+ */
+static void ipfrag_queue_release(ipfrag_queue_t *q, netbuf_t **garbage) {
+    ipfrag_queue_t **pp = &ipfrag_hash[ipfrag_bucket(q->src, q->dst, q->id, q->protocol)];
+    while (*pp != NULL && *pp != q) {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp == q) {
+        *pp = q->hash_next;
+    }
+
+    if (garbage != NULL) {
+        for (int i = 0; i < q->count; i++) {
+            q->pieces[i].buf->next = *garbage;
+            *garbage = q->pieces[i].buf;
+        }
+    }
+
+    ipfrag_mem -= q->mem;
+    ipfrag_stats.queues--;
+    q->in_use = false;
+    q->hash_next = NULL;
+}
+
+/**
+ * Find the queue for a fragment, or start one (ipfrag_lock held)
+ */
+static ipfrag_queue_t *ipfrag_queue_get(uint32_t src, uint32_t dst, uint16_t id,
+                                        uint8_t proto) {
+    uint32_t bucket = ipfrag_bucket(src, dst, id, proto);
+    for (ipfrag_queue_t *q = ipfrag_hash[bucket]; q != NULL; q = q->hash_next) {
+        if (q->src == src && q->dst == dst && q->id == id && q->protocol == proto) {
+            return q;
+        }
+    }
+
+    ipfrag_queue_t *q = NULL;
+    for (int i = 0; i < IPFRAG_MAX_QUEUES; i++) {
+        if (!ipfrag_queues[i].in_use) {
+            q = &ipfrag_queues[i];
+            break;
+        }
+    }
+    if (q == NULL) {
+        return NULL;
+    }
+
+    q->src = src;
+    q->dst = dst;
+    q->id = id;
+    q->protocol = proto;
+    q->in_use = true;
+    q->have_last = false;
+    q->count = 0;
+    q->hdr_len = 0;
+    q->total = 0;
+    q->received = 0;
+    q->mem = 0;
+    q->created = ipfrag_time;
+    q->seq = ipfrag_seq++;
+
+    q->hash_next = ipfrag_hash[bucket];
+    ipfrag_hash[bucket] = q;
+    ipfrag_stats.queues++;
+    return q;
+}
+
+/**
+ * Drop the oldest queues other than keep until size more bytes fit
+ * (ipfrag_lock held)
+ * @return true if there is room
+ */
+static bool ipfrag_make_room(uint32_t size, const ipfrag_queue_t *keep, netbuf_t **garbage) {
+    while (ipfrag_mem + size > IPFRAG_MEM_MAX) {
+        ipfrag_queue_t *oldest = NULL;
+        for (int i = 0; i < IPFRAG_MAX_QUEUES; i++) {
+            ipfrag_queue_t *q = &ipfrag_queues[i];
+            if (q->in_use && q != keep && (oldest == NULL || q->seq < oldest->seq)) {
+                oldest = q;
+            }
+        }
+        if (oldest == NULL) {
+            return false;
+        }
+        ipfrag_queue_release(oldest, garbage);
+        ipfrag_stats.evicted++;
+    }
+    return true;
+}
+
+/**
+ * Join the fragments of a complete queue into one datagram
+ * @param hdr Header of the first fragment
+ * @param pieces Fragments in order, covering [0, total)
+ */
+static netbuf_t *ipfrag_join(const uint8_t *hdr, uint8_t hdr_len, const ipfrag_piece_t *pieces,
+                             int count, uint32_t total) {
+    netbuf_t *whole = netbuf_alloc(hdr_len + total, 0);
+    if (whole == NULL) {
+        return NULL;
+    }
+
+    netbuf_copy_in(whole, hdr, hdr_len);
+    for (int i = 0; i < count; i++) {
+        netbuf_copy_in(whole, pieces[i].buf->data, pieces[i].buf->len);
+    }
+
+    /* Now a datagram that was never fragmented */
+    ip_header_t *ip = (ip_header_t *)whole->data;
+    ip->total_length = htons((uint16_t)(hdr_len + total));
+    ip->flags_fragment &= htons(IP_FLAG_DF);
+    ip->checksum = 0;
+    ip->checksum = ip_checksum(ip, hdr_len);
+    return whole;
+}
+
+/* Internal: timer callback */
+static void ipfrag_timer_expired(void *arg) {
+    UNUSED(arg);
+    ipfrag_timer_tick();
+}
+
+void ipfrag_init(void) {
+    uint64_t flags = ipfrag_lock_acquire();
+    memset(ipfrag_queues, 0, sizeof(ipfrag_queues));
+    memset(ipfrag_hash, 0, sizeof(ipfrag_hash));
+    memset(&ipfrag_stats, 0, sizeof(ipfrag_stats));
+    ipfrag_mem = 0;
+    ipfrag_lock_release(flags);
+
+    ktimer_init_soft(&ipfrag_timer, ipfrag_timer_expired, NULL);
+    ktimer_start(&ipfrag_timer, NSEC_PER_SEC, NSEC_PER_SEC);
+
+    kprintf("[IPFRAG] Initialized: %u queues, %u KB max\n",
+            IPFRAG_MAX_QUEUES, IPFRAG_MEM_MAX / 1024);
+}
+
+netbuf_t *ipfrag_input(const ip_header_t *hdr, size_t len) {
+    uint8_t hdr_len = ip_header_len(hdr);
+    uint16_t frag = ntohs(hdr->flags_fragment);
+    bool more = (frag & IP_FLAG_MF) != 0;
+    uint32_t start = (uint32_t)(frag & IP_FRAG_OFFSET_MASK) * 8;
+    uint32_t plen = (uint32_t)len - hdr_len;
+    uint32_t end = start + plen;
+
+    /* Every fragment but the last carries a multiple of 8 bytes */
+    if (plen == 0 || (more && (plen & 7)) || end + IP_HEADER_MIN > 0xFFFF) {
+        __sync_fetch_and_add(&ipfrag_stats.dropped, 1);
+        return NULL;
+    }
+
+    /* Copy the payload out of the receive buffer */
+    netbuf_t *buf = netbuf_alloc(plen, 0);
+    if (buf == NULL) {
+        __sync_fetch_and_add(&ipfrag_stats.dropped, 1);
+        return NULL;
+    }
+    netbuf_copy_in(buf, (const uint8_t *)hdr + hdr_len, plen);
+
+    netbuf_t *garbage = NULL;
+    uint32_t src = ntohl(hdr->src_addr);
+    uint32_t dst = ntohl(hdr->dst_addr);
+    uint16_t id = ntohs(hdr->identification);
+    bool overlap = false;
+
+    uint64_t flags = ipfrag_lock_acquire();
+    ipfrag_stats.fragments++;
+
+    ipfrag_queue_t *q = ipfrag_queue_get(src, dst, id, hdr->protocol);
+    if (q == NULL || !ipfrag_make_room(ipfrag_truesize(buf), q, &garbage)) {
+        goto drop;
+    }
+
+    /* The last fragment fixes the length; nothing may lie beyond it */
+    if (!more) {
+        if ((q->have_last && end != q->total) ||
+            (q->count > 0 && q->pieces[q->count - 1].end > end)) {
+            goto drop_queue;
+        }
+        q->have_last = true;
+        q->total = end;
+    } else if (q->have_last && end > q->total) {
+        goto drop_queue;
+    }
+
+    /* Find where it goes */
+    int pos = 0;
+    while (pos < q->count && q->pieces[pos].start < start) {
+        pos++;
+    }
+    if (pos < q->count && q->pieces[pos].start == start && q->pieces[pos].end == end) {
+        /* Duplicate */
+        goto drop;
+    }
+    if ((pos > 0 && q->pieces[pos - 1].end > start) ||
+        (pos < q->count && q->pieces[pos].start < end)) {
+        overlap = true;
+        goto drop_queue;
+    }
+    if (q->count >= IPFRAG_MAX_PIECES) {
+        goto drop_queue;
+    }
+
+    memmove(&q->pieces[pos + 1], &q->pieces[pos], (q->count - pos) * sizeof(ipfrag_piece_t));
+    q->pieces[pos].start = (uint16_t)start;
+    q->pieces[pos].end = (uint16_t)end;
+    q->pieces[pos].buf = buf;
+    q->count++;
+    q->received += plen;
+    q->mem += ipfrag_truesize(buf);
+    ipfrag_mem += ipfrag_truesize(buf);
+
+    if (start == 0) {
+        memcpy(q->hdr, hdr, hdr_len);
+        q->hdr_len = hdr_len;
+    }
+
+    /* Complete: no overlaps, so the bytes held add up to the datagram */
+    if (!q->have_last || q->received != q->total || q->hdr_len == 0) {
+        ipfrag_lock_release(flags);
+        return NULL;
+    }
+    if (q->hdr_len + q->total > 0xFFFF) {
+        goto drop_queue;
+    }
+
+    uint8_t first_hdr[IP_HEADER_MAX];
+    ipfrag_piece_t pieces[IPFRAG_MAX_PIECES];
+    uint8_t first_len = q->hdr_len;
+    int count = q->count;
+    uint32_t total = q->total;
+    memcpy(first_hdr, q->hdr, first_len);
+    memcpy(pieces, q->pieces, count * sizeof(ipfrag_piece_t));
+    ipfrag_queue_release(q, NULL);
+    ipfrag_stats.reassembled++;
+    ipfrag_lock_release(flags);
+
+    netbuf_t *whole = ipfrag_join(first_hdr, first_len, pieces, count, total);
+    for (int i = 0; i < count; i++) {
+        netbuf_free(pieces[i].buf);
+    }
+    return whole;
+
+drop_queue:
+    ipfrag_queue_release(q, &garbage);
+    if (overlap) {
+        ipfrag_stats.overlaps++;
+    }
+drop:
+    if (q != NULL && q->in_use && q->count == 0) {
+        ipfrag_queue_release(q, &garbage);
+    }
+    ipfrag_stats.dropped++;
+    ipfrag_lock_release(flags);
+    netbuf_free(buf);
+    ipfrag_free_chain(garbage);
+    return NULL;
+}
+
+void ipfrag_timer_tick(void) {
+    netbuf_t *garbage = NULL;
+
+    uint64_t flags = ipfrag_lock_acquire();
+    ipfrag_time++;
+
+    for (int i = 0; i < IPFRAG_MAX_QUEUES; i++) {
+        ipfrag_queue_t *q = &ipfrag_queues[i];
+        if (q->in_use && ipfrag_time - q->created >= IPFRAG_TIMEOUT) {
+            ipfrag_queue_release(q, &garbage);
+            ipfrag_stats.timeouts++;
+        }
+    }
+
+    ipfrag_lock_release(flags);
+    ipfrag_free_chain(garbage);
+}
+
+void ipfrag_get_stats(ipfrag_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    uint64_t flags = ipfrag_lock_acquire();
+    *stats = ipfrag_stats;
+    stats->mem = ipfrag_mem;
+    ipfrag_lock_release(flags);
+}
@@ -0,0 +1,71 @@
+/**
+ * AAAos Network Stack - IPv4 Fragment Reassembly
+ *
+ * Fragments of a datagram wait in a queue found by hashing (source,
+ * destination, identification, protocol). Each queue keeps the fragments
+ * it has received as separate buffers, sorted by offset, and only joins
+ * them into one buffer when the last gap is filled. Fragments that
+ * overlap, other than exact duplicates, drop the whole datagram
+ * (RFC 5722 applied to IPv4), since overlaps are only ever seen in
+ * attacks.
+ *
+ * Queues expire after IPFRAG_TIMEOUT seconds. The memory held by all
+ * queues is capped at IPFRAG_MEM_MAX; when a fragment would go over, the
+ * oldest queues are dropped to make room.
+ */
+
+#ifndef _AAAOS_NET_IPFRAG_H
+#define _AAAOS_NET_IPFRAG_H
+
+#include "../../kernel/include/types.h"
+#include "../core/netbuf.h"
+#include "ip.h"
+
+/* Limits */
+#define IPFRAG_HASH_SIZE    64          /* Hash buckets (power of two) */
+#define IPFRAG_MAX_QUEUES   64          /* Datagrams being reassembled */
+#define IPFRAG_MAX_PIECES   64          /* Fragments held per datagram */
+#define IPFRAG_MEM_MAX      (512 * 1024)    /* Bytes held by all queues */
+#define IPFRAG_TIMEOUT      30          /* Seconds to wait for missing fragments */
+
+/**
+ * Reassembly statistics
+ */
+typedef struct ipfrag_stats {
+    uint64_t fragments;         /* Fragments received */
+    uint64_t reassembled;       /* Datagrams completed */
+    uint64_t timeouts;          /* Datagrams dropped for missing fragments */
+    uint64_t overlaps;          /* Datagrams dropped for overlapping fragments */
+    uint64_t evicted;           /* Datagrams dropped to stay under IPFRAG_MEM_MAX */
+    uint64_t dropped;           /* Fragments dropped as invalid or for lack of room */
+    uint32_t queues;            /* Datagrams waiting now */
+    uint32_t mem;               /* Bytes held now */
+} ipfrag_stats_t;
+
+/**
+ * Initialize reassembly and start its expiry timer
+ */
+void ipfrag_init(void);
+
+/**
+ * Add a received fragment
+ * @param hdr Header of the fragment, followed by its payload
+ * @param len Total length of the fragment (from its header)
+ * @return The whole datagram (header and payload) once every fragment has
+ *         arrived, for the caller to free; NULL while it is incomplete or
+ *         if the fragment was dropped
+ */
+netbuf_t *ipfrag_input(const ip_header_t *hdr, size_t len);
+
+/**
+ * Drop queues that have waited longer than IPFRAG_TIMEOUT
+ * Called once a second.
+ */
+void ipfrag_timer_tick(void);
+
+/**
+ * Get reassembly statistics
+ */
+void ipfrag_get_stats(ipfrag_stats_t *stats);
+
+#endif /* _AAAOS_NET_IPFRAG_H */
@@ -0,0 +1,312 @@
+/**
+ * AAAos Network Stack - IPv4 Routing Table Implementation
+ *
+ * Table entries are 16 bits: 0 for no route, 1..ROUTE_MAX for route_list
+ * index + 1, or ROUTE_TBL_EXT with the index of the next level table. The
+ * table is repainted from route_list in order of increasing prefix length,
+ * so a longer prefix always overwrites the shorter ones it lies inside.
+ * route_lock covers the list and the table.
+ */
+
+#include "route.h"
+#include "../../kernel/include/serial.h"
+#include "../../lib/libc/string.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../arp/arp.h"
+
+/* Entry points to a next level table */
+#define ROUTE_TBL_EXT       0x8000
+
+/* Route list */
+static route_t route_list[ROUTE_MAX];
+static int route_count = 0;
+
+/* Lookup table */
+static uint16_t route_tbl16[65536];
+static uint16_t route_tbl8[ROUTE_TBL8_MAX][256];
+static int route_tbl8_used = 0;
+
+/* Bumped on every change, invalidating every route_cache_t */
+static volatile uint32_t route_gen = 1;
+
+static volatile int route_lock = 0;
+
+static inline uint64_t route_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&route_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void route_lock_release(uint64_t flags) {
+    __sync_lock_release(&route_lock);
+    interrupts_restore(flags);
+}
+
+static inline uint32_t route_mask(uint8_t prefix_len) {
+    return prefix_len == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix_len);
+}
+
+static int route_find(uint32_t prefix, uint8_t prefix_len) {
+    for (int i = 0; i < route_count; i++) {
+        if (route_list[i].prefix == prefix && route_list[i].prefix_len == prefix_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Make a table slot point to a next level table, seeded with its old value
+ * @return Index of the table, or -1 if none is left
+ */
+static int route_extend(uint16_t *slot) {
+    if (*slot & ROUTE_TBL_EXT) {
+        return *slot & ~ROUTE_TBL_EXT;
+    }
+    if (route_tbl8_used >= ROUTE_TBL8_MAX) {
+        return -1;
+    }
+
+    int t = route_tbl8_used++;
+    for (int i = 0; i < 256; i++) {
+        route_tbl8[t][i] = *slot;
+    }
+    *slot = (uint16_t)(ROUTE_TBL_EXT | t);
+    return t;
+}
+
+static void route_fill(uint16_t *tbl, uint32_t start, uint32_t count, uint16_t value) {
+    for (uint32_t i = 0; i < count; i++) {
+        tbl[start + i] = value;
+    }
+}
+
+/**
+ * Add route_list[idx] to the lookup table (route_lock held)
+ * @return 0 on success, -1 if out of next level tables
+ */
+static int route_paint(int idx) {
+    const route_t *r = &route_list[idx];
+    uint16_t value = (uint16_t)(idx + 1);
+
+    if (r->prefix_len <= 16) {
+        route_fill(route_tbl16, r->prefix >> 16, 1u << (16 - r->prefix_len), value);
+        return 0;
+    }
+
+    int t = route_extend(&route_tbl16[r->prefix >> 16]);
+    if (t < 0) {
+        return -1;
+    }
+    if (r->prefix_len <= 24) {
+        route_fill(route_tbl8[t], (r->prefix >> 8) & 0xFF, 1u << (24 - r->prefix_len), value);
+        return 0;
+    }
+
+    t = route_extend(&route_tbl8[t][(r->prefix >> 8) & 0xFF]);
+    if (t < 0) {
+        return -1;
+    }
+    route_fill(route_tbl8[t], r->prefix & 0xFF, 1u << (32 - r->prefix_len), value);
+    return 0;
+}
+
+/**
+ * Rebuild the lookup table from route_list (route_lock held)
+ * @return 0 on success, -1 if the routes need too many tables
+ */
+static int route_rebuild(void) {
+    memset(route_tbl16, 0, sizeof(route_tbl16));
+    route_tbl8_used = 0;
+
+    int result = 0;
+    for (int len = 0; len <= 32 && result == 0; len++) {
+        for (int i = 0; i < route_count && result == 0; i++) {
+            if (route_list[i].prefix_len == len) {
+                result = route_paint(i);
+            }
+        }
+    }
+
+    route_gen++;
+    return result;
+}
+
+/**
+ * Longest prefix match (route_lock held)
+ * @return Index in route_list, or -1
+ */
+static int route_match(uint32_t dest) {
+    uint16_t e = route_tbl16[dest >> 16];
+    if (e & ROUTE_TBL_EXT) {
+        e = route_tbl8[e & ~ROUTE_TBL_EXT][(dest >> 8) & 0xFF];
+        if (e & ROUTE_TBL_EXT) {
+            e = route_tbl8[e & ~ROUTE_TBL_EXT][dest & 0xFF];
+        }
+    }
+    return (int)e - 1;
+}
+
+void route_init(void) {
+    uint64_t flags = route_lock_acquire();
+    route_count = 0;
+    route_rebuild();
+    route_lock_release(flags);
+
+    kprintf("[ROUTE] Initialized, %u routes max\n", ROUTE_MAX);
+}
+
+int route_add(uint32_t prefix, uint8_t prefix_len, uint32_t gateway, uint16_t ifindex,
+              uint8_t flags) {
+    if (prefix_len > 32) {
+        return -1;
+    }
+
+    route_t r;
+    r.prefix = prefix & route_mask(prefix_len);
+    r.prefix_len = prefix_len;
+    r.flags = (uint8_t)((flags & ~ROUTE_FLAG_GATEWAY) | (gateway ? ROUTE_FLAG_GATEWAY : 0));
+    r.ifindex = ifindex;
+    r.gateway = gateway;
+
+    uint64_t irq = route_lock_acquire();
+
+    int idx = route_find(r.prefix, prefix_len);
+    bool replaced = idx >= 0;
+    route_t old = r;
+    if (replaced) {
+        old = route_list[idx];
+    } else if (route_count < ROUTE_MAX) {
+        idx = route_count++;
+    } else {
+        route_lock_release(irq);
+        kprintf("[ROUTE] Table full\n");
+        return -1;
+    }
+    route_list[idx] = r;
+
+    if (route_rebuild() != 0) {
+        /* Put the table back the way it was */
+        if (replaced) {
+            route_list[idx] = old;
+        } else {
+            route_count--;
+        }
+        route_rebuild();
+        route_lock_release(irq);
+        kprintf("[ROUTE] Out of lookup tables for /%u route\n", prefix_len);
+        return -1;
+    }
+
+    route_lock_release(irq);
+    return 0;
+}
+
+int route_del(uint32_t prefix, uint8_t prefix_len) {
+    if (prefix_len > 32) {
+        return -1;
+    }
+
+    uint64_t flags = route_lock_acquire();
+
+    int idx = route_find(prefix & route_mask(prefix_len), prefix_len);
+    if (idx < 0) {
+        route_lock_release(flags);
+        return -1;
+    }
+    route_list[idx] = route_list[--route_count];
+    route_rebuild();
+
+    route_lock_release(flags);
+    return 0;
+}
+
+void route_del_flags(uint8_t flags) {
+    uint64_t irq = route_lock_acquire();
+
+    int i = 0;
+    while (i < route_count) {
+        if (route_list[i].flags & flags) {
+            route_list[i] = route_list[--route_count];
+        } else {
+            i++;
+        }
+    }
+    route_rebuild();
+
+    route_lock_release(irq);
+}
+
+bool route_lookup(uint32_t dest, route_t *route) {
+    uint64_t flags = route_lock_acquire();
+
+    int idx = route_match(dest);
+    if (idx >= 0 && route) {
+        *route = route_list[idx];
+    }
+
+    route_lock_release(flags);
+    return idx >= 0;
+}
+
+bool route_next_hop(uint32_t dest, route_cache_t *cache, uint32_t *next_hop) {
+    /* Established flows: same peer and nothing changed since */
+    if (cache && cache->gen == route_gen && cache->dest == dest) {
+        *next_hop = cache->next_hop;
+        return true;
+    }
+
+    uint64_t flags = route_lock_acquire();
+
+    int idx = route_match(dest);
+    uint32_t gen = route_gen;
+    uint32_t hop = 0;
+    if (idx >= 0) {
+        hop = (route_list[idx].flags & ROUTE_FLAG_GATEWAY) ? route_list[idx].gateway : dest;
+    }
+
+    route_lock_release(flags);
+
+    if (idx < 0) {
+        return false;
+    }
+    if (cache) {
+        cache->dest = dest;
+        cache->next_hop = hop;
+        cache->gen = gen;
+    }
+    *next_hop = hop;
+    return true;
+}
+
+void route_dump(void) {
+    uint64_t flags = route_lock_acquire();
+    int count = route_count;
+    int tables = route_tbl8_used;
+    route_lock_release(flags);
+
+    kprintf("[ROUTE] %d routes, %d of %d lookup tables:\n", count, tables, ROUTE_TBL8_MAX);
+    for (int i = 0; i < count; i++) {
+        route_t r;
+        flags = route_lock_acquire();
+        if (i >= route_count) {
+            route_lock_release(flags);
+            break;
+        }
+        r = route_list[i];
+        route_lock_release(flags);
+
+        kprintf("  %u.%u.%u.%u/%u",
+                ip_octet(r.prefix, 0), ip_octet(r.prefix, 1),
+                ip_octet(r.prefix, 2), ip_octet(r.prefix, 3), r.prefix_len);
+        if (r.flags & ROUTE_FLAG_GATEWAY) {
+            kprintf(" via %u.%u.%u.%u",
+                    ip_octet(r.gateway, 0), ip_octet(r.gateway, 1),
+                    ip_octet(r.gateway, 2), ip_octet(r.gateway, 3));
+        }
+        kprintf(" dev eth%u%s\n", r.ifindex,
+                (r.flags & ROUTE_FLAG_IFCONF) ? " (ifconfig)" : "");
+    }
+}
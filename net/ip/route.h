@@ -0,0 +1,101 @@
+/**
+ * AAAos Network Stack - IPv4 Routing Table
+ *
+ * Routes are looked up by longest prefix match in a DIR-16-8-8 table: a
+ * 65536-entry first level indexed by the top 16 address bits, whose entries
+ * either name a route or point to a 256-entry table for the next 8 bits,
+ * and so on once more for the last 8. A lookup is at most three reads,
+ * whatever the number of routes. The table is rebuilt from the route list
+ * on every change, which is rare next to lookups.
+ *
+ * A route_cache_t held by a connection remembers the next hop for its peer
+ * and is reused until the table changes, so established flows skip the
+ * lookup altogether.
+ */
+
+#ifndef _AAAOS_NET_ROUTE_H
+#define _AAAOS_NET_ROUTE_H
+
+#include "../../kernel/include/types.h"
+
+/* Table limits */
+#define ROUTE_MAX           255         /* Routes in the table */
+#define ROUTE_TBL8_MAX      128         /* Second and third level tables */
+
+/* Route flags */
+#define ROUTE_FLAG_GATEWAY  BIT(0)      /* Reached through gateway, else on-link */
+#define ROUTE_FLAG_IFCONF   BIT(1)      /* Installed from the interface address */
+
+/* Interfaces */
+#define ROUTE_IF_ETH0       0           /* The Ethernet device */
+
+/**
+ * Route
+ */
+typedef struct route {
+    uint32_t prefix;            /* Destination network (host byte order) */
+    uint8_t  prefix_len;        /* Prefix length in bits (0-32) */
+    uint8_t  flags;             /* ROUTE_FLAG_* */
+    uint16_t ifindex;           /* Outgoing interface (ROUTE_IF_*) */
+    uint32_t gateway;           /* Next hop if ROUTE_FLAG_GATEWAY */
+} route_t;
+
+/**
+ * Next hop remembered for one destination
+ * Zero-initialize; it is filled in by the first route_next_hop call.
+ */
+typedef struct route_cache {
+    uint32_t dest;              /* Destination it was looked up for */
+    uint32_t next_hop;          /* Where to send packets for dest */
+    uint32_t gen;               /* Table generation it is valid for */
+} route_cache_t;
+
+/**
+ * Initialize an empty routing table
+ */
+void route_init(void);
+
+/**
+ * Add a route, replacing one with the same prefix
+ * @param prefix Destination network (host byte order), host bits ignored
+ * @param prefix_len Prefix length in bits
+ * @param gateway Next hop, or 0 for an on-link route
+ * @param ifindex Outgoing interface
+ * @param flags ROUTE_FLAG_IFCONF or 0 (ROUTE_FLAG_GATEWAY follows gateway)
+ * @return 0 on success, -1 if the prefix is invalid or the table is full
+ */
+int route_add(uint32_t prefix, uint8_t prefix_len, uint32_t gateway, uint16_t ifindex,
+              uint8_t flags);
+
+/**
+ * Remove the route for a prefix
+ * @return 0 on success, -1 if there is no such route
+ */
+int route_del(uint32_t prefix, uint8_t prefix_len);
+
+/**
+ * Remove every route carrying any of the given flags
+ */
+void route_del_flags(uint8_t flags);
+
+/**
+ * Find the most specific route for a destination
+ * @param route Set to a copy of the route found
+ * @return true if a route matches
+ */
+bool route_lookup(uint32_t dest, route_t *route);
+
+/**
+ * Find where to send a packet for dest
+ * @param cache Next hop cache for dest, or NULL to always look up
+ * @param next_hop Set to the gateway, or dest itself if it is on-link
+ * @return true if dest is reachable
+ */
+bool route_next_hop(uint32_t dest, route_cache_t *cache, uint32_t *next_hop);
+
+/**
+ * Print the routing table to the serial console
+ */
+void route_dump(void);
+
+#endif /* _AAAOS_NET_ROUTE_H */
@@ -0,0 +1,47 @@
+/**
+ * AAAos Network Stack - Loopback Interface
+ *
+ * Packets for 127.0.0.0/8 or for our own address never reach a driver:
+ * ip_send_buf hands the netbuf to loopback_xmit, which passes the same
+ * buffer back up through ip_receive_buf. Nothing is copied, and checksums
+ * are neither filled in nor checked: ip_offloads reports checksum offload
+ * and TSO for loopback destinations, and the buffers come back marked as
+ * verified.
+ *
+ * A packet sent while a loopback packet is being delivered (a reply, say)
+ * is queued and delivered once the current one is done, so an exchange
+ * between two local sockets does not recurse.
+ */
+
+#ifndef _AAAOS_NET_LOOPBACK_H
+#define _AAAOS_NET_LOOPBACK_H
+
+#include "../../kernel/include/types.h"
+#include "../core/netbuf.h"
+
+#define LOOPBACK_MTU        65535       /* Largest packet */
+#define LOOPBACK_QUEUE_MAX  256         /* Packets waiting for delivery */
+
+/**
+ * Loopback statistics
+ */
+typedef struct loopback_stats {
+    uint64_t packets;           /* Packets looped back */
+    uint64_t bytes;             /* Bytes looped back */
+    uint64_t dropped;           /* Packets dropped with the queue full */
+} loopback_stats_t;
+
+/**
+ * Send a packet to ourselves
+ * @param buf IP packet, header included. It is consumed on success; on
+ *            error the caller still owns it.
+ * @return 0 on success, -1 if the packet is too large or the queue is full
+ */
+int loopback_xmit(netbuf_t *buf);
+
+/**
+ * Get loopback statistics
+ */
+void loopback_get_stats(loopback_stats_t *stats);
+
+#endif /* _AAAOS_NET_LOOPBACK_H */
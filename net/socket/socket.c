@@ -7,10 +7,15 @@
 
 #include "socket.h"
 #include "../tcp/tcp.h"
+#include "../udp/udp.h"
 #include "../ip/ip.h"
 #include "../core/netbuf.h"
+#include "../core/nettrace.h"
 #include "../../kernel/include/serial.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/proc/fdtable.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../fs/vfs/vfs.h"
 #include "../../lib/libc/string.h"
 
 /* ============================================================================
@@ -20,30 +25,23 @@
 /* Socket table - array of all sockets */
 static socket_t socket_table[SOCKET_MAX_COUNT];
 
-/* Next file descriptor to assign */
-static int next_socket_fd = SOCKET_FD_BASE;
-
 /* Global socket errno */
 int socket_errno = 0;
 
 /* Initialization flag */
 static bool socket_initialized = false;
 
+/* Protects the datagram receive queues; taken with interrupts off */
+static volatile int socket_dgram_lock = 0;
+
+/* Bound sockets by local port, under socket_port_lock (interrupts off) */
+static socket_t *socket_port_hash[SOCKET_PORT_HASH_SIZE];
+static volatile int socket_port_lock = 0;
+
 /* ============================================================================
  * Internal Helper Functions
  * ============================================================================ */
 
-/**
- * Convert socket fd to table index
- */
-static int fd_to_index(int sockfd) {
-    int index = sockfd - SOCKET_FD_BASE;
-    if (index < 0 || index >= SOCKET_MAX_COUNT) {
-        return -1;
-    }
-    return index;
-}
-
 /**
  * Allocate a socket buffer
  */
@@ -126,19 +124,209 @@ static ssize_t socket_buffer_read(socket_buffer_t *buf, void *data, size_t len,
     return (ssize_t)read_count;
 }
 
+static inline uint64_t dgram_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&socket_dgram_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void dgram_lock_release(uint64_t flags) {
+    __sync_lock_release(&socket_dgram_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Queue a received datagram (payload in buf, source in src_ip/src_port)
+ * @return true if queued, false if the queue is over its limit
+ */
+static bool dgram_enqueue(socket_t *sock, netbuf_t *buf) {
+    uint64_t flags = dgram_lock_acquire();
+
+    bool queued = sock->dgram_queued + buf->len <= sock->dgram_limit;
+    if (queued) {
+        buf->next = NULL;
+        if (sock->dgram_tail) {
+            sock->dgram_tail->next = buf;
+        } else {
+            sock->dgram_head = buf;
+        }
+        sock->dgram_tail = buf;
+        sock->dgram_queued += buf->len;
+    }
+
+    dgram_lock_release(flags);
+    return queued;
+}
+
+/**
+ * Take up to max datagrams off the front of the queue
+ * With peek, returns a clone of the first and leaves the queue alone.
+ * @return Chain of datagrams (linked through next), or NULL if none
+ */
+static netbuf_t *dgram_take(socket_t *sock, unsigned int max, bool peek) {
+    uint64_t flags = dgram_lock_acquire();
+
+    netbuf_t *head = sock->dgram_head;
+    if (!head || max == 0) {
+        head = NULL;
+    } else if (peek) {
+        head = netbuf_clone(head);
+    } else {
+        netbuf_t *last = head;
+        sock->dgram_queued -= last->len;
+        while (--max > 0 && last->next) {
+            last = last->next;
+            sock->dgram_queued -= last->len;
+        }
+        sock->dgram_head = last->next;
+        if (!sock->dgram_head) {
+            sock->dgram_tail = NULL;
+        }
+        last->next = NULL;
+    }
+
+    dgram_lock_release(flags);
+    return head;
+}
+
+/**
+ * Free every queued datagram
+ */
+static void dgram_purge(socket_t *sock) {
+    netbuf_t *buf = dgram_take(sock, UINT32_MAX, false);
+    while (buf) {
+        netbuf_t *next = buf->next;
+        netbuf_free(buf);
+        buf = next;
+    }
+}
+
+/**
+ * Copy a datagram into a message's buffers and fill in its source
+ * @return Bytes stored (less than the datagram if MSG_TRUNC is set)
+ */
+static size_t dgram_fill_msg(const netbuf_t *buf, struct msghdr *msg) {
+    size_t copied = 0;
+    for (size_t i = 0; i < msg->msg_iovlen && copied < buf->len; i++) {
+        size_t n = MIN(msg->msg_iov[i].iov_len, buf->len - copied);
+        if (msg->msg_iov[i].iov_base && n > 0) {
+            memcpy(msg->msg_iov[i].iov_base, buf->data + copied, n);
+            copied += n;
+        }
+    }
+
+    msg->msg_flags = copied < buf->len ? MSG_TRUNC : 0;
+    msg->msg_controllen = 0;
+
+    if (msg->msg_name && msg->msg_namelen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in *src = (struct sockaddr_in *)msg->msg_name;
+        memset(src, 0, sizeof(*src));
+        src->sin_family = AF_INET;
+        src->sin_port = htons(buf->src_port);
+        src->sin_addr = htonl(buf->src_ip);
+        msg->msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    return copied;
+}
+
+static inline uint64_t port_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&socket_port_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void port_lock_release(uint64_t flags) {
+    __sync_lock_release(&socket_port_lock);
+    interrupts_restore(flags);
+}
+
+static inline socket_t **port_bucket(uint16_t port) {
+    return &socket_port_hash[(port ^ (port >> 8)) & (SOCKET_PORT_HASH_SIZE - 1)];
+}
+
+static inline uint16_t local_port(const socket_t *sock) {
+    return ntohs(sock->local_addr.sin_port);
+}
+
+/**
+ * Enter a socket into the bound sockets table (socket_port_lock held)
+ */
+static void port_link(socket_t *sock) {
+    socket_t **head = port_bucket(local_port(sock));
+    sock->port_next = *head;
+    *head = sock;
+    sock->port_hashed = true;
+}
+
+/**
+ * Enter a socket into the bound sockets table without checking the port
+ * (accepted connections share their listener's port)
+ */
+static void port_hash(socket_t *sock) {
+    uint64_t flags = port_lock_acquire();
+    port_link(sock);
+    port_lock_release(flags);
+}
+
+/**
+ * Take a socket out of the bound sockets table
+ */
+static void port_unhash(socket_t *sock) {
+    uint64_t flags = port_lock_acquire();
+    if (sock->port_hashed) {
+        for (socket_t **pp = port_bucket(local_port(sock)); *pp; pp = &(*pp)->port_next) {
+            if (*pp == sock) {
+                *pp = sock->port_next;
+                break;
+            }
+        }
+        sock->port_next = NULL;
+        sock->port_hashed = false;
+    }
+    port_lock_release(flags);
+}
+
 /**
  * Check if port is already in use
  */
 static bool port_in_use(uint16_t port, int type) {
-    for (int i = 0; i < SOCKET_MAX_COUNT; i++) {
-        if (socket_table[i].in_use &&
-            socket_table[i].bound &&
-            socket_table[i].type == type &&
-            ntohs(socket_table[i].local_addr.sin_port) == port) {
-            return true;
+    uint64_t flags = port_lock_acquire();
+    socket_t *s = *port_bucket(port);
+    while (s && !(s->type == type && local_port(s) == port)) {
+        s = s->port_next;
+    }
+    port_lock_release(flags);
+    return s != NULL;
+}
+
+/**
+ * Claim the port in sock->local_addr and enter sock into the table
+ * The port must be free, unless sock has SO_REUSEADDR, or it and every
+ * socket already on the port have SO_REUSEPORT.
+ * @return false if the port is taken
+ */
+static bool port_claim(socket_t *sock) {
+    uint16_t port = local_port(sock);
+    bool ok = true;
+
+    uint64_t flags = port_lock_acquire();
+    if (!sock->reuse_addr) {
+        for (socket_t *s = *port_bucket(port); s && ok; s = s->port_next) {
+            if (s->type == sock->type && local_port(s) == port) {
+                ok = sock->reuse_port && s->reuse_port;
+            }
         }
     }
-    return false;
+    if (ok) {
+        port_link(sock);
+    }
+    port_lock_release(flags);
+    return ok;
 }
 
 /**
@@ -160,20 +348,95 @@ static uint16_t allocate_ephemeral_port(int type) {
 }
 
 /**
- * Find socket by local address (for incoming packets)
+ * Bind an unbound socket to an ephemeral port
+ * @return false with errno set if no port is free
  */
-static socket_t *find_socket_by_local(uint16_t port, int type) {
-    for (int i = 0; i < SOCKET_MAX_COUNT; i++) {
-        if (socket_table[i].in_use &&
-            socket_table[i].type == type &&
-            socket_table[i].bound &&
-            socket_table[i].local_addr.sin_port == htons(port)) {
-            return &socket_table[i];
+static bool socket_autobind(socket_t *sock) {
+    if (sock->bound) {
+        return true;
+    }
+
+    uint16_t ephemeral = allocate_ephemeral_port(sock->type);
+    sock->local_addr.sin_family = AF_INET;
+    sock->local_addr.sin_port = htons(ephemeral);
+    sock->local_addr.sin_addr = htonl(ip_get_addr());
+    if (ephemeral == 0 || !port_claim(sock)) {
+        socket_set_errno(EADDRINUSE);
+        return false;
+    }
+    sock->bound = true;
+    sock->state = SOCKET_STATE_BOUND;
+    return true;
+}
+
+socket_t *socket_lookup(int type, uint16_t port, uint32_t src_ip, uint16_t src_port) {
+    uint64_t flags = port_lock_acquire();
+
+    socket_t *found = NULL;
+    uint32_t count = 0;
+    for (socket_t *s = *port_bucket(port); s; s = s->port_next) {
+        if (s->type == type && local_port(s) == port) {
+            found = found ? found : s;
+            count++;
         }
     }
-    return NULL;
+
+    /* Several sockets share the port: the flow's hash picks one */
+    if (count > 1) {
+        uint32_t h = (src_ip ^ ((uint32_t)src_port << 16 | port)) * 2654435761u;
+        uint32_t pick = (h ^ (h >> 16)) % count;
+        for (socket_t *s = found; s; s = s->port_next) {
+            if (s->type == type && local_port(s) == port && pick-- == 0) {
+                found = s;
+                break;
+            }
+        }
+    }
+
+    port_lock_release(flags);
+    return found;
 }
 
+/* ============================================================================
+ * Descriptor Callbacks
+ * ============================================================================ */
+
+/**
+ * Another descriptor refers to a socket (a forked table)
+ */
+static void socket_fd_ref(void *object, uint32_t aux) {
+    UNUSED(aux);
+    __atomic_add_fetch(&((socket_t *)object)->fd_refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * A descriptor of a socket was closed; the last one closes the socket
+ */
+static void socket_fd_close(void *object, uint32_t aux) {
+    socket_t *sock = (socket_t *)object;
+    UNUSED(aux);
+
+    if (__atomic_sub_fetch(&sock->fd_refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    kprintf("[SOCKET] Closing socket fd=%d\n", sock->fd);
+
+    /* Close protocol-specific resources */
+    if (sock->type == SOCK_STREAM && sock->proto_data) {
+        tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+        tcp_close(tcp_sock);
+    }
+
+    sock->state = SOCKET_STATE_CLOSED;
+    socket_free(sock);
+}
+
+static const fd_ops_t socket_fd_ops = {
+    .ref = socket_fd_ref,
+    .close = socket_fd_close,
+};
+
 /* ============================================================================
  * Socket Initialization
  * ============================================================================ */
@@ -194,10 +457,11 @@ void socket_init(void) {
         socket_table[i].fd = -1;
     }
 
-    next_socket_fd = SOCKET_FD_BASE;
     socket_errno = 0;
     socket_initialized = true;
 
+    fd_register_ops(FD_KIND_SOCKET, &socket_fd_ops);
+
     kprintf("[SOCKET] Socket layer initialized (max %d sockets)\n", SOCKET_MAX_COUNT);
 }
 
@@ -211,7 +475,7 @@ socket_t *socket_alloc(void) {
             socket_t *sock = &socket_table[i];
             memset(sock, 0, sizeof(socket_t));
             sock->in_use = true;
-            sock->fd = next_socket_fd++;
+            sock->fd = -1;
             sock->state = SOCKET_STATE_UNBOUND;
             return sock;
         }
@@ -227,6 +491,8 @@ void socket_free(socket_t *sock) {
     /* Free buffers */
     socket_buffer_free(&sock->send_buffer);
     socket_buffer_free(&sock->recv_buffer);
+    dgram_purge(sock);
+    port_unhash(sock);
 
     /* Free accept queue if present */
     if (sock->accept_queue) {
@@ -243,22 +509,23 @@ void socket_free(socket_t *sock) {
     }
 
     /* Mark as free */
+    poll_source_detach(&sock->poll);
     sock->in_use = false;
     sock->fd = -1;
 }
 
 socket_t *socket_get(int sockfd) {
-    int index = fd_to_index(sockfd);
-    if (index < 0) {
-        return NULL;
-    }
-
-    socket_t *sock = &socket_table[index];
-    if (!sock->in_use) {
-        return NULL;
-    }
+    return fd_lookup(fd_table_current(), sockfd, FD_KIND_SOCKET, NULL);
+}
 
-    return sock;
+/**
+ * Give a new socket a descriptor in the current process's table
+ * @return The descriptor, or -1 if the table is full
+ */
+static int socket_install(socket_t *sock) {
+    sock->fd_refs = 1;
+    sock->fd = fd_alloc(fd_table_current(), FD_KIND_SOCKET, sock, 0);
+    return sock->fd;
 }
 
 /* ============================================================================
@@ -324,7 +591,10 @@ int socket(int domain, int type, int protocol) {
         socket_set_errno(ENOMEM);
         return -1;
     }
-    if (socket_buffer_init(&sock->recv_buffer, SOCKET_BUFFER_SIZE) < 0) {
+    /* Datagrams queue as netbufs instead */
+    if (type == SOCK_DGRAM) {
+        sock->dgram_limit = SOCKET_BUFFER_SIZE;
+    } else if (socket_buffer_init(&sock->recv_buffer, SOCKET_BUFFER_SIZE) < 0) {
         socket_free(sock);
         socket_set_errno(ENOMEM);
         return -1;
@@ -342,6 +612,12 @@ int socket(int domain, int type, int protocol) {
     }
     /* UDP doesn't need a separate control block for this simple implementation */
 
+    if (socket_install(sock) < 0) {
+        socket_free(sock);
+        socket_set_errno(EMFILE);
+        return -1;
+    }
+
     kprintf("[SOCKET] Created socket fd=%d type=%d protocol=%d\n",
             sock->fd, type, protocol);
 
@@ -374,13 +650,6 @@ int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
         return -1;
     }
 
-    /* Check if port is in use (unless SO_REUSEADDR is set) */
-    if (port != 0 && !sock->reuse_addr && port_in_use(port, sock->type)) {
-        kprintf("[SOCKET] bind: port %d already in use\n", port);
-        socket_set_errno(EADDRINUSE);
-        return -1;
-    }
-
     /* If port is 0, allocate ephemeral port */
     if (port == 0) {
         port = allocate_ephemeral_port(sock->type);
@@ -390,17 +659,24 @@ int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
         }
     }
 
-    /* Store local address */
+    /* Store local address and claim the port (SO_REUSEADDR/SO_REUSEPORT may share it) */
     memcpy(&sock->local_addr, sin, sizeof(struct sockaddr_in));
     sock->local_addr.sin_port = htons(port);
+    if (!port_claim(sock)) {
+        kprintf("[SOCKET] bind: port %d already in use\n", port);
+        socket_set_errno(EADDRINUSE);
+        return -1;
+    }
     sock->bound = true;
     sock->state = SOCKET_STATE_BOUND;
 
     /* Bind TCP socket if applicable */
     if (sock->type == SOCK_STREAM && sock->proto_data) {
         tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+        tcp_set_reuseport(tcp_sock, sock->reuse_port);
         int ret = tcp_bind(tcp_sock, port);
         if (ret != TCP_OK) {
+            port_unhash(sock);
             sock->bound = false;
             sock->state = SOCKET_STATE_UNBOUND;
             socket_set_errno(EADDRINUSE);
@@ -516,6 +792,7 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
     new_sock->local_addr.sin_family = AF_INET;
     new_sock->local_addr.sin_port = htons(tcp_client->local_port);
     new_sock->local_addr.sin_addr = htonl(tcp_client->local_ip);
+    port_hash(new_sock);
 
     new_sock->remote_addr.sin_family = AF_INET;
     new_sock->remote_addr.sin_port = htons(tcp_client->remote_port);
@@ -529,6 +806,12 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
         return -1;
     }
 
+    if (socket_install(new_sock) < 0) {
+        socket_free(new_sock);
+        socket_set_errno(EMFILE);
+        return -1;
+    }
+
     /* Return client address if requested */
     if (addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
         memcpy(addr, &new_sock->remote_addr, sizeof(struct sockaddr_in));
@@ -564,16 +847,8 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     }
 
     /* Auto-bind if not bound */
-    if (!sock->bound) {
-        uint16_t ephemeral = allocate_ephemeral_port(sock->type);
-        if (ephemeral == 0) {
-            socket_set_errno(EADDRINUSE);
-            return -1;
-        }
-        sock->local_addr.sin_family = AF_INET;
-        sock->local_addr.sin_port = htons(ephemeral);
-        sock->local_addr.sin_addr = htonl(ip_get_addr());
-        sock->bound = true;
+    if (!socket_autobind(sock)) {
+        return -1;
     }
 
     /* Store remote address */
@@ -672,6 +947,83 @@ ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
     return sent;
 }
 
+/**
+ * tcp_send_fill producer for sendfile: read the file into the send buffer
+ */
+static ssize_t sendfile_fill(void *ctx, void *dst, size_t len) {
+    return vfs_read((vfs_file_t *)ctx, dst, len);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, int64_t *offset, size_t count) {
+    socket_t *sock = socket_get(out_fd);
+    vfs_file_t *file = fd_lookup(fd_table_current(), in_fd, FD_KIND_FILE, NULL);
+    if (!sock || !file) {
+        socket_set_errno(EBADF);
+        return -1;
+    }
+
+    if (sock->type != SOCK_STREAM) {
+        socket_set_errno(EINVAL);
+        return -1;
+    }
+
+    tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+    if (sock->state != SOCKET_STATE_CONNECTED || !tcp_sock) {
+        socket_set_errno(ENOTCONN);
+        return -1;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    /* With an explicit offset the file position is left as it was */
+    int64_t saved_pos = 0;
+    if (offset) {
+        saved_pos = vfs_tell(file);
+        if (saved_pos < 0 || vfs_seek(file, *offset, VFS_SEEK_SET) < 0) {
+            socket_set_errno(EINVAL);
+            return -1;
+        }
+    }
+
+    ssize_t sent = tcp_send_fill(tcp_sock, sendfile_fill, file, count);
+
+    if (offset) {
+        if (sent > 0) {
+            *offset += sent;
+        }
+        vfs_seek(file, saved_pos, VFS_SEEK_SET);
+    }
+
+    if (sent < 0) {
+        if (sent == TCP_ERR_WOULDBLOCK) {
+            socket_set_errno(EWOULDBLOCK);
+        } else if (sent == TCP_ERR_NOTCONN) {
+            socket_set_errno(ENOTCONN);
+        } else if (sent == TCP_ERR_IO) {
+            socket_set_errno(EIO);
+        } else {
+            socket_set_errno(ECONNRESET);
+        }
+        return -1;
+    }
+
+    sock->bytes_sent += sent;
+    sock->packets_sent++;
+    return sent;
+}
+
+/**
+ * Trace data leaving the socket, timed from its last delivery
+ */
+static void socket_trace_recv(socket_t *sock, ssize_t received) {
+    if (nettrace_enabled) {
+        nettrace_recv(sock->deliver_cycles, (size_t)received);
+        sock->deliver_cycles = 0;
+    }
+}
+
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
     socket_t *sock = socket_get(sockfd);
     if (!sock) {
@@ -726,10 +1078,74 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
     if (received > 0) {
         sock->bytes_recv += received;
         sock->packets_recv++;
+        socket_trace_recv(sock, received);
     }
     return received;
 }
 
+/**
+ * Destination of a datagram: the given address, or the connected peer
+ * @return The address, or NULL with errno set
+ */
+static const struct sockaddr_in *dgram_dest(socket_t *sock, const void *addr,
+                                            socklen_t addrlen) {
+    if (addr) {
+        if (addrlen < sizeof(struct sockaddr_in)) {
+            socket_set_errno(EINVAL);
+            return NULL;
+        }
+        return (const struct sockaddr_in *)addr;
+    }
+    if (sock->state == SOCKET_STATE_CONNECTED) {
+        return &sock->remote_addr;
+    }
+    socket_set_errno(EDESTADDRREQ);
+    return NULL;
+}
+
+/**
+ * Send one datagram gathered from iov
+ * The payload is copied once, into a netbuf the UDP, IP and Ethernet
+ * headers are pushed in front of.
+ * @return Bytes sent, or -1 with errno set
+ */
+static ssize_t dgram_send(socket_t *sock, const struct sockaddr_in *dest,
+                          const struct iovec *iov, size_t iovlen) {
+    size_t len = 0;
+    for (size_t i = 0; i < iovlen; i++) {
+        len += iov[i].iov_len;
+    }
+    if (len > UDP_MAX_PAYLOAD) {
+        socket_set_errno(EMSGSIZE);
+        return -1;
+    }
+
+    /* A netbuf is never empty; an empty datagram still gets one byte */
+    netbuf_t *buf = netbuf_alloc(NETBUF_DEFAULT_HEADROOM + MAX(len, (size_t)1),
+                                 NETBUF_DEFAULT_HEADROOM);
+    if (!buf) {
+        socket_set_errno(ENOMEM);
+        return -1;
+    }
+    for (size_t i = 0; i < iovlen; i++) {
+        if (iov[i].iov_len > 0) {
+            memcpy(netbuf_put(buf, iov[i].iov_len), iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+
+    int ret = udp_send_buf(buf, ntohl(dest->sin_addr), ntohs(dest->sin_port),
+                           ntohs(sock->local_addr.sin_port));
+    if (ret < 0) {
+        netbuf_free(buf);
+        socket_set_errno(ENETUNREACH);
+        return -1;
+    }
+
+    sock->bytes_sent += len;
+    sock->packets_sent++;
+    return (ssize_t)len;
+}
+
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                const struct sockaddr *dest_addr, socklen_t addrlen) {
     socket_t *sock = socket_get(sockfd);
@@ -744,68 +1160,14 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
         return 0;
     }
 
-    const struct sockaddr_in *dest;
-
-    if (dest_addr) {
-        if (addrlen < sizeof(struct sockaddr_in)) {
-            socket_set_errno(EINVAL);
-            return -1;
-        }
-        dest = (const struct sockaddr_in *)dest_addr;
-    } else if (sock->state == SOCKET_STATE_CONNECTED) {
-        dest = &sock->remote_addr;
-    } else {
-        socket_set_errno(EDESTADDRREQ);
+    const struct sockaddr_in *dest = dgram_dest(sock, dest_addr, addrlen);
+    if (!dest || !socket_autobind(sock)) {
         return -1;
     }
 
-    /* Auto-bind if not bound */
-    if (!sock->bound) {
-        uint16_t ephemeral = allocate_ephemeral_port(sock->type);
-        if (ephemeral == 0) {
-            socket_set_errno(EADDRINUSE);
-            return -1;
-        }
-        sock->local_addr.sin_family = AF_INET;
-        sock->local_addr.sin_port = htons(ephemeral);
-        sock->local_addr.sin_addr = htonl(ip_get_addr());
-        sock->bound = true;
-        sock->state = SOCKET_STATE_BOUND;
-    }
-
     if (sock->type == SOCK_DGRAM) {
-        /* Build and send UDP packet */
-        /* UDP header: src_port(2) + dst_port(2) + length(2) + checksum(2) = 8 bytes */
-        size_t udp_len = 8 + len;
-        uint8_t *packet = (uint8_t *)kmalloc(udp_len);
-        if (!packet) {
-            socket_set_errno(ENOMEM);
-            return -1;
-        }
-
-        /* UDP header */
-        uint16_t *hdr = (uint16_t *)packet;
-        hdr[0] = sock->local_addr.sin_port;           /* Source port (already network order) */
-        hdr[1] = dest->sin_port;                       /* Dest port (already network order) */
-        hdr[2] = htons((uint16_t)udp_len);            /* Length */
-        hdr[3] = 0;                                    /* Checksum (optional for IPv4) */
-
-        /* Copy payload */
-        memcpy(packet + 8, buf, len);
-
-        /* Send via IP layer */
-        uint32_t dest_ip = ntohl(dest->sin_addr);
-        int ret = ip_send(dest_ip, IP_PROTO_UDP, packet, udp_len);
-        kfree(packet);
-
-        if (ret < 0) {
-            socket_set_errno(ENETUNREACH);
-            return -1;
-        }
-
-        sock->bytes_sent += len;
-        sock->packets_sent++;
-        return (ssize_t)len;
+        struct iovec iov = { (void *)buf, len };
+        return dgram_send(sock, dest, &iov, 1);
     } else if (sock->type == SOCK_STREAM) {
         /* TCP doesn't use sendto, redirect to send */
         return send(sockfd, buf, len, flags);
@@ -831,10 +1193,10 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
     ssize_t received = 0;
 
     if (sock->type == SOCK_DGRAM) {
-        /* Read from receive buffer */
-        received = socket_buffer_read(&sock->recv_buffer, buf, len, peek);
+        /* Take the next datagram */
+        netbuf_t *dgram = dgram_take(sock, 1, peek);
 
-        if (received == 0) {
+        if (!dgram) {
             /* No data available */
             if (sock->flags & SOCKET_FLAG_NONBLOCK) {
                 socket_set_errno(EWOULDBLOCK);
@@ -845,12 +1207,19 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
             return -1;
         }
 
-        /* Return source address if requested */
-        if (src_addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
-            /* Note: For a full implementation, we'd store per-packet source info */
-            memcpy(src_addr, &sock->remote_addr, sizeof(struct sockaddr_in));
-            *addrlen = sizeof(struct sockaddr_in);
+        /* Copy it out, with its source address if requested */
+        struct iovec iov = { buf, len };
+        struct msghdr msg = {
+            .msg_name = addrlen ? src_addr : NULL,
+            .msg_namelen = addrlen ? *addrlen : 0,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+        };
+        received = (ssize_t)dgram_fill_msg(dgram, &msg);
+        if (msg.msg_name) {
+            *addrlen = msg.msg_namelen;
         }
+        netbuf_free(dgram);
     } else if (sock->type == SOCK_STREAM) {
         /* TCP doesn't really use recvfrom, redirect to recv */
         received = recv(sockfd, buf, len, flags);
@@ -864,27 +1233,98 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
     if (received > 0) {
         sock->bytes_recv += received;
         sock->packets_recv++;
+        socket_trace_recv(sock, received);
     }
     return received;
 }
 
-int socket_close(int sockfd) {
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
     socket_t *sock = socket_get(sockfd);
     if (!sock) {
         socket_set_errno(EBADF);
         return -1;
     }
 
-    kprintf("[SOCKET] Closing socket fd=%d\n", sockfd);
+    UNUSED(flags);
 
-    /* Close protocol-specific resources */
-    if (sock->type == SOCK_STREAM && sock->proto_data) {
-        tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
-        tcp_close(tcp_sock);
+    if (sock->type != SOCK_DGRAM) {
+        socket_set_errno(EOPNOTSUPP);
+        return -1;
+    }
+    if (vlen == 0) {
+        return 0;
+    }
+    if (!msgvec) {
+        socket_set_errno(EINVAL);
+        return -1;
+    }
+    if (!socket_autobind(sock)) {
+        return -1;
     }
 
-    sock->state = SOCKET_STATE_CLOSED;
-    socket_free(sock);
+    /* Errors after the first message only cut the batch short */
+    unsigned int sent = 0;
+    while (sent < vlen) {
+        struct msghdr *msg = &msgvec[sent].msg_hdr;
+        const struct sockaddr_in *dest = dgram_dest(sock, msg->msg_name, msg->msg_namelen);
+        ssize_t n = dest ? dgram_send(sock, dest, msg->msg_iov, msg->msg_iovlen) : -1;
+        if (n < 0) {
+            break;
+        }
+        msgvec[sent].msg_len = (unsigned int)n;
+        sent++;
+    }
+
+    return sent > 0 ? (int)sent : -1;
+}
+
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    socket_t *sock = socket_get(sockfd);
+    if (!sock) {
+        socket_set_errno(EBADF);
+        return -1;
+    }
+
+    if (sock->type != SOCK_DGRAM) {
+        socket_set_errno(EOPNOTSUPP);
+        return -1;
+    }
+    if (vlen == 0) {
+        return 0;
+    }
+    if (!msgvec) {
+        socket_set_errno(EINVAL);
+        return -1;
+    }
+
+    /* Take the whole batch under one lock hold */
+    netbuf_t *batch = dgram_take(sock, vlen, (flags & MSG_PEEK) != 0);
+    if (!batch) {
+        socket_set_errno(EWOULDBLOCK);
+        return -1;
+    }
+
+    unsigned int received = 0;
+    while (batch) {
+        netbuf_t *next = batch->next;
+        size_t n = dgram_fill_msg(batch, &msgvec[received].msg_hdr);
+        msgvec[received].msg_len = (unsigned int)n;
+        sock->bytes_recv += n;
+        sock->packets_recv++;
+        received++;
+        netbuf_free(batch);
+        batch = next;
+    }
+
+    return (int)received;
+}
+
+int socket_close(int sockfd) {
+    fd_table_t *table = fd_table_current();
+    if (!socket_get(sockfd) || !fd_close(table, sockfd)) {
+        socket_set_errno(EBADF);
+        return -1;
+    }
     return 0;
 }
 
@@ -943,6 +1383,13 @@ int setsockopt(int sockfd, int level, int optname,
                 }
                 break;
 
+            case SO_REUSEPORT:
+                if (optlen >= sizeof(int)) {
+                    sock->reuse_port = (*(const int *)optval != 0);
+                    return 0;
+                }
+                break;
+
             case SO_BROADCAST:
                 if (optlen >= sizeof(int)) {
                     sock->broadcast = (*(const int *)optval != 0);
@@ -974,12 +1421,26 @@ int setsockopt(int sockfd, int level, int optname,
                 break;
 
             case SO_SNDBUF:
-                /* Buffer size changes not supported after creation */
-                return 0;
-
             case SO_RCVBUF:
-                /* Buffer size changes not supported after creation */
-                return 0;
+                /* TCP buffers grow up to the limit; others keep their size */
+                if (optlen >= sizeof(int)) {
+                    int size = *(const int *)optval;
+                    tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+                    if (size <= 0) {
+                        break;
+                    }
+                    if (sock->type == SOCK_STREAM && tcp_sock) {
+                        if (optname == SO_SNDBUF) {
+                            tcp_set_sndbuf(tcp_sock, (size_t)size);
+                        } else {
+                            tcp_set_rcvbuf(tcp_sock, (size_t)size);
+                        }
+                    } else if (sock->type == SOCK_DGRAM && optname == SO_RCVBUF) {
+                        sock->dgram_limit = (size_t)size;
+                    }
+                    return 0;
+                }
+                break;
 
             default:
                 kprintf("[SOCKET] setsockopt: unknown option %d\n", optname);
@@ -987,9 +1448,28 @@ int setsockopt(int sockfd, int level, int optname,
                 return -1;
         }
     } else if (level == SOL_TCP && sock->type == SOCK_STREAM) {
-        /* TCP-specific options could go here */
-        socket_set_errno(ENOPROTOOPT);
-        return -1;
+        tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+        switch (optname) {
+            case TCP_NODELAY:
+            case TCP_CORK:
+            case TCP_LOOPBACK_SPLICE:
+                if (tcp_sock && optlen >= sizeof(int)) {
+                    bool on = *(const int *)optval != 0;
+                    if (optname == TCP_NODELAY) {
+                        tcp_set_nodelay(tcp_sock, on);
+                    } else if (optname == TCP_CORK) {
+                        tcp_set_cork(tcp_sock, on);
+                    } else {
+                        tcp_set_splice(tcp_sock, on);
+                    }
+                    return 0;
+                }
+                break;
+
+            default:
+                socket_set_errno(ENOPROTOOPT);
+                return -1;
+        }
     }
 
     socket_set_errno(EINVAL);
@@ -1036,6 +1516,14 @@ int getsockopt(int sockfd, int level, int optname,
                 }
                 break;
 
+            case SO_REUSEPORT:
+                if (*optlen >= sizeof(int)) {
+                    *(int *)optval = sock->reuse_port ? 1 : 0;
+                    *optlen = sizeof(int);
+                    return 0;
+                }
+                break;
+
             case SO_BROADCAST:
                 if (*optlen >= sizeof(int)) {
                     *(int *)optval = sock->broadcast ? 1 : 0;
@@ -1054,7 +1542,10 @@ int getsockopt(int sockfd, int level, int optname,
 
             case SO_SNDBUF:
                 if (*optlen >= sizeof(int)) {
-                    *(int *)optval = (int)sock->send_buffer.capacity;
+                    tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+                    *(int *)optval = (sock->type == SOCK_STREAM && tcp_sock)
+                                         ? (int)tcp_sock->sndbuf_max
+                                         : (int)sock->send_buffer.capacity;
                     *optlen = sizeof(int);
                     return 0;
                 }
@@ -1062,7 +1553,33 @@ int getsockopt(int sockfd, int level, int optname,
 
             case SO_RCVBUF:
                 if (*optlen >= sizeof(int)) {
-                    *(int *)optval = (int)sock->recv_buffer.capacity;
+                    tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+                    if (sock->type == SOCK_STREAM && tcp_sock) {
+                        *(int *)optval = (int)tcp_sock->rcvbuf_max;
+                    } else if (sock->type == SOCK_DGRAM) {
+                        *(int *)optval = (int)sock->dgram_limit;
+                    } else {
+                        *(int *)optval = (int)sock->recv_buffer.capacity;
+                    }
+                    *optlen = sizeof(int);
+                    return 0;
+                }
+                break;
+
+            default:
+                socket_set_errno(ENOPROTOOPT);
+                return -1;
+        }
+    } else if (level == SOL_TCP && sock->type == SOCK_STREAM) {
+        tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+        switch (optname) {
+            case TCP_NODELAY:
+            case TCP_CORK:
+            case TCP_LOOPBACK_SPLICE:
+                if (tcp_sock && *optlen >= sizeof(int)) {
+                    *(int *)optval = optname == TCP_NODELAY ? tcp_sock->options.no_delay :
+                                     optname == TCP_CORK ? tcp_sock->options.cork :
+                                     tcp_sock->options.splice;
                     *optlen = sizeof(int);
                     return 0;
                 }
@@ -1133,13 +1650,33 @@ int getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 
 ssize_t socket_deliver(socket_t *sock, const void *data, size_t len,
                        const struct sockaddr_in *src_addr) {
+    nettrace_event(NETTRACE_SOCK_RX, len);
+
     if (!sock || !data || len == 0) {
+        nettrace_drop(NETTRACE_SOCK_RX);
         return -1;
     }
 
-    /* Store source address for UDP */
-    if (src_addr && sock->type == SOCK_DGRAM) {
-        memcpy(&sock->remote_addr, src_addr, sizeof(struct sockaddr_in));
+    /* A datagram is queued whole, with its source */
+    if (sock->type == SOCK_DGRAM) {
+        netbuf_t *buf = netbuf_alloc(len, 0);
+        if (!buf || netbuf_copy_in(buf, data, len) != 0) {
+            netbuf_free(buf);
+            nettrace_drop(NETTRACE_SOCK_RX);
+            return -1;
+        }
+        buf->src_ip = src_addr ? ntohl(src_addr->sin_addr) : 0;
+        buf->src_port = src_addr ? ntohs(src_addr->sin_port) : 0;
+        if (!dgram_enqueue(sock, buf)) {
+            netbuf_free(buf);
+            nettrace_drop(NETTRACE_SOCK_RX);
+            return -1;
+        }
+        sock->bytes_recv += len;
+        sock->packets_recv++;
+        sock->deliver_cycles = nettrace_stamp();
+        poll_notify(&sock->poll, POLL_IN);
+        return (ssize_t)len;
     }
 
     /* Write to receive buffer */
@@ -1147,11 +1684,42 @@ ssize_t socket_deliver(socket_t *sock, const void *data, size_t len,
     if (written > 0) {
         sock->bytes_recv += written;
         sock->packets_recv++;
+        sock->deliver_cycles = nettrace_stamp();
+        poll_notify(&sock->poll, POLL_IN);
+    }
+    if (written < (ssize_t)len) {
+        nettrace_drop(NETTRACE_SOCK_RX);
     }
 
     return written;
 }
 
+poll_source_t *socket_poll_source(int sockfd, uint32_t *ready) {
+    socket_t *sock = socket_get(sockfd);
+    if (!sock) {
+        return NULL;
+    }
+
+    if (sock->type == SOCK_STREAM && sock->proto_data) {
+        tcp_socket_t *tcp_sock = (tcp_socket_t *)sock->proto_data;
+        if (ready) {
+            *ready = tcp_poll_events(tcp_sock);
+        }
+        return &tcp_sock->poll;
+    }
+
+    if (ready) {
+        *ready = POLL_OUT;
+        if (sock->recv_buffer.count > 0 || sock->dgram_head) {
+            *ready |= POLL_IN;
+        }
+        if (sock->state == SOCKET_STATE_CLOSED) {
+            *ready |= POLL_HUP;
+        }
+    }
+    return &sock->poll;
+}
+
 /* ============================================================================
  * Error Handling
  * ============================================================================ */
@@ -1168,6 +1736,7 @@ const char *socket_strerror(int err) {
     switch (err) {
         case 0:              return "Success";
         case EBADF:          return "Bad file descriptor";
+        case EMFILE:         return "Too many open files";
         case EINVAL:         return "Invalid argument";
         case ENOMEM:         return "Out of memory";
         case EAGAIN:         return "Resource temporarily unavailable";
@@ -1239,7 +1808,12 @@ void socket_dump(const socket_t *sock) {
     kprintf("  Remote: %s:%d\n", remote_ip, ntohs(sock->remote_addr.sin_port));
     kprintf("  Bytes sent: %llu, recv: %llu\n", sock->bytes_sent, sock->bytes_recv);
     kprintf("  Send buffer: %zu/%zu bytes\n", sock->send_buffer.count, sock->send_buffer.capacity);
-    kprintf("  Recv buffer: %zu/%zu bytes\n", sock->recv_buffer.count, sock->recv_buffer.capacity);
+    if (sock->type == SOCK_DGRAM) {
+        kprintf("  Recv queue: %zu/%zu bytes\n", sock->dgram_queued, sock->dgram_limit);
+    } else {
+        kprintf("  Recv buffer: %zu/%zu bytes\n", sock->recv_buffer.count,
+                sock->recv_buffer.capacity);
+    }
 }
 
 void socket_dump_all(void) {
@@ -9,6 +9,7 @@
 #define _AAAOS_NET_SOCKET_H
 
 #include "../../kernel/include/types.h"
+#include "../../kernel/ipc/poll.h"
 
 /* ============================================================================
  * Socket Types and Constants
@@ -53,13 +54,20 @@
 #define SO_RCVBUF       8       /* Receive buffer size */
 #define SO_KEEPALIVE    9       /* Keep connections alive */
 #define SO_LINGER       13      /* Linger on close */
+#define SO_REUSEPORT    15      /* Share the port with other SO_REUSEPORT sockets */
 #define SO_RCVTIMEO     20      /* Receive timeout */
 #define SO_SNDTIMEO     21      /* Send timeout */
 
+/* Socket options (SOL_TCP level) */
+#define TCP_NODELAY     1       /* Send short segments without waiting (no Nagle) */
+#define TCP_CORK        3       /* Send only full segments until cleared */
+#define TCP_LOOPBACK_SPLICE 64  /* Copy sends straight to a peer socket on this host */
+
 /* Flags for send/recv */
 #define MSG_OOB         0x01    /* Out-of-band data */
 #define MSG_PEEK        0x02    /* Peek at incoming data */
 #define MSG_DONTROUTE   0x04    /* Don't route */
+#define MSG_TRUNC       0x20    /* (msg_flags) Datagram longer than the buffer */
 #define MSG_DONTWAIT    0x40    /* Non-blocking operation */
 #define MSG_WAITALL     0x100   /* Wait for full request */
 
@@ -78,9 +86,9 @@
 #define SOCKET_MAX_COUNT        256         /* Maximum number of sockets */
 #define SOCKET_BACKLOG_MAX      128         /* Maximum listen backlog */
 #define SOCKET_BUFFER_SIZE      65536       /* Default socket buffer size */
+#define SOCKET_PORT_HASH_SIZE   64          /* Bound sockets table buckets (power of two) */
 
-/* Socket file descriptor base (to distinguish from VFS file descriptors) */
-#define SOCKET_FD_BASE          1000
+/* Sockets are descriptors in the process's table (kernel/proc/fdtable.h) */
 
 /* ============================================================================
  * Socket Address Structures
@@ -103,6 +111,33 @@ struct sockaddr_in {
     uint8_t     sin_zero[8];    /* Padding to match sizeof(struct sockaddr) */
 } PACKED;
 
+/* ============================================================================
+ * Message Structures (sendmmsg/recvmmsg)
+ * ============================================================================ */
+
+/* One piece of a scattered buffer */
+struct iovec {
+    void        *iov_base;      /* Start of the piece */
+    size_t      iov_len;        /* Length in bytes */
+};
+
+/* One message: address and data */
+struct msghdr {
+    void            *msg_name;      /* Peer address (struct sockaddr_in), or NULL */
+    socklen_t       msg_namelen;    /* Size of msg_name (updated on receive) */
+    struct iovec    *msg_iov;       /* Data buffers */
+    size_t          msg_iovlen;     /* Number of buffers */
+    void            *msg_control;   /* Ancillary data (unused) */
+    size_t          msg_controllen; /* Set to 0 on receive */
+    int             msg_flags;      /* Set on receive (MSG_TRUNC) */
+};
+
+/* One message of a batch, with the bytes it moved */
+struct mmsghdr {
+    struct msghdr   msg_hdr;
+    unsigned int    msg_len;        /* Bytes sent or received */
+};
+
 /* ============================================================================
  * Socket States
  * ============================================================================ */
@@ -141,7 +176,7 @@ typedef struct socket_buffer {
  */
 typedef struct socket {
     /* Socket identity */
-    int             fd;             /* Socket file descriptor */
+    int             fd;             /* Descriptor it was created as */
     int             domain;         /* Address family (AF_INET, etc.) */
     int             type;           /* Socket type (SOCK_STREAM, etc.) */
     int             protocol;       /* Protocol (IPPROTO_TCP, etc.) */
@@ -155,10 +190,18 @@ typedef struct socket {
     struct sockaddr_in  local_addr;     /* Local address */
     struct sockaddr_in  remote_addr;    /* Remote address (for connected sockets) */
     bool            bound;              /* Socket is bound to local address */
+    bool            port_hashed;        /* In the bound sockets table */
+    struct socket   *port_next;         /* Bound sockets table chain */
 
     /* Data buffers */
     socket_buffer_t send_buffer;    /* Outgoing data buffer */
-    socket_buffer_t recv_buffer;    /* Incoming data buffer */
+    socket_buffer_t recv_buffer;    /* Incoming data buffer (not datagram sockets) */
+
+    /* Received datagrams (SOCK_DGRAM), one netbuf each */
+    struct netbuf   *dgram_head;
+    struct netbuf   *dgram_tail;
+    size_t          dgram_queued;   /* Payload bytes queued */
+    size_t          dgram_limit;    /* Bytes that may be queued (SO_RCVBUF) */
 
     /* TCP-specific fields */
     int             backlog;        /* Listen backlog size */
@@ -168,6 +211,7 @@ typedef struct socket {
 
     /* Options */
     bool            reuse_addr;     /* SO_REUSEADDR */
+    bool            reuse_port;     /* SO_REUSEPORT (set before bind) */
     bool            broadcast;      /* SO_BROADCAST */
     bool            keepalive;      /* SO_KEEPALIVE */
     uint32_t        send_timeout;   /* Send timeout (ms) */
@@ -178,9 +222,14 @@ typedef struct socket {
     uint64_t        bytes_recv;     /* Total bytes received */
     uint64_t        packets_sent;   /* Total packets sent */
     uint64_t        packets_recv;   /* Total packets received */
+    uint64_t        deliver_cycles; /* nettrace_stamp() of the last delivery */
 
     /* Ownership */
     uint32_t        owner_pid;      /* Owning process PID */
+    uint32_t        fd_refs;        /* Descriptors referring to it (forked copies too) */
+
+    /* Readiness of datagram sockets (poll.h); TCP raises its own */
+    poll_source_t   poll;
 
     /* Protocol-specific data (TCP control block, etc.) */
     void            *proto_data;
@@ -257,6 +306,19 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
  */
 ssize_t send(int sockfd, const void *buf, size_t len, int flags);
 
+/**
+ * Send part of a file on a connected stream socket
+ * The file is read straight into the TCP send buffer, without passing
+ * through a caller's buffer.
+ * @param out_fd Connected SOCK_STREAM socket
+ * @param in_fd File descriptor of an open file
+ * @param offset Where to read from, advanced by the bytes sent; NULL to read
+ *               from the file position and advance it instead
+ * @param count Most bytes to send
+ * @return Number of bytes sent (may be fewer than count), or -1 on error
+ */
+ssize_t sendfile(int out_fd, int in_fd, int64_t *offset, size_t count);
+
 /**
  * Receive data from a connected socket
  * @param sockfd Socket file descriptor
@@ -293,6 +355,30 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen);
 
+/**
+ * Send several datagrams in one call (UDP)
+ * Each message goes to its msg_name, or to the connected peer. Sending
+ * stops at the first message that fails.
+ * @param sockfd Socket file descriptor
+ * @param msgvec Messages; msg_len is set for each one sent
+ * @param vlen Number of messages
+ * @param flags Send flags (MSG_*)
+ * @return Number of messages sent, or -1 on error if none was
+ */
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+/**
+ * Receive several queued datagrams in one call (UDP)
+ * Does not wait: returns what is queued, up to vlen. A datagram longer
+ * than its buffers is truncated and MSG_TRUNC set in its msg_flags.
+ * @param sockfd Socket file descriptor
+ * @param msgvec Messages to fill; msg_len is set to the bytes stored
+ * @param vlen Number of messages
+ * @param flags Receive flags (MSG_PEEK reads the first without taking it)
+ * @return Number of messages received, or -1 on error
+ */
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /**
  * Close a socket
  * @param sockfd Socket file descriptor
@@ -356,7 +442,7 @@ int getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 
 /**
  * Get socket structure by file descriptor
- * @param sockfd Socket file descriptor
+ * @param sockfd Descriptor in the current process's table
  * @return Socket pointer or NULL if invalid
  */
 socket_t *socket_get(int sockfd);
@@ -373,6 +459,18 @@ socket_t *socket_alloc(void);
  */
 void socket_free(socket_t *sock);
 
+/**
+ * Find the socket that receives a packet for a local port
+ * When sockets share the port (SO_REUSEPORT), the source picks one of
+ * them by hash, so a flow always reaches the same socket.
+ * @param type Socket type (SOCK_DGRAM, etc.)
+ * @param port Local port (host byte order)
+ * @param src_ip Source address (host byte order)
+ * @param src_port Source port (host byte order)
+ * @return Socket, or NULL if none is bound to the port
+ */
+socket_t *socket_lookup(int type, uint16_t port, uint32_t src_ip, uint16_t src_port);
+
 /**
  * Deliver received data to socket
  * @param sock Socket to deliver to
@@ -384,6 +482,15 @@ void socket_free(socket_t *sock);
 ssize_t socket_deliver(socket_t *sock, const void *data, size_t len,
                        const struct sockaddr_in *src_addr);
 
+/**
+ * Readiness source of a socket
+ * Stream sockets report through their TCP socket's source.
+ * @param sockfd Socket file descriptor
+ * @param ready Set to the socket's current POLL_* events
+ * @return The source, or NULL if sockfd is not a socket
+ */
+poll_source_t *socket_poll_source(int sockfd, uint32_t *ready);
+
 /**
  * Get socket state as string
  * @param state Socket state
@@ -499,6 +606,8 @@ uint32_t inet_addr(const char *cp);
 #define EINVAL          22      /* Invalid argument */
 #define ENOMEM          12      /* Out of memory */
 #define EBADF           9       /* Bad file descriptor */
+#define EIO             5       /* I/O error */
+#define EMFILE          24      /* Too many open files */
 #define EAGAIN          11      /* Try again */
 #define EWOULDBLOCK     EAGAIN  /* Operation would block */
 
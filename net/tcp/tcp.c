@@ -8,15 +8,26 @@
  *   - Sequence/acknowledgment number management
  *   - Basic flow control with sliding window
  *   - Connection termination (graceful and abortive)
+ *   - Hashed connection, listener and port lookup (lockless on receive)
+ *   - Retransmission queue, NewReno congestion control and SACK recovery
+ *   - SYN and accept queues, SYN cookies and per-CPU SO_REUSEPORT listeners
  */
 
 #include "tcp.h"
 #include "../ip/ip.h"
 #include "../ethernet/ethernet.h"
+#include "../core/checksum.h"
+#include "../core/nettrace.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/log/log.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/slab.h"
 #include "../../lib/libc/string.h"
-#include "../../drivers/timer/pit.h"
+#include "../../kernel/sched/clock.h"
+#include "../../security/crypto/crypto.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
 
 /* ============================================================================
  * Global State
@@ -25,9 +36,50 @@
 /* Socket management */
 static tcp_socket_t *tcp_socket_list = NULL;    /* List of all sockets */
 static uint16_t tcp_next_ephemeral_port = 49152; /* Ephemeral port range start */
+static kmem_cache_t *tcp_socket_cache = NULL;    /* Socket object cache */
+static uint32_t tcp_socket_count = 0;            /* Sockets on tcp_socket_list */
 
-/* ISN (Initial Sequence Number) counter - simple increment */
-static uint32_t tcp_isn_counter = 0;
+/*
+ * Lookup tables. Receive walks them without taking a lock: writers hold
+ * tcp_hash_lock and publish links with release stores, and a removed
+ * socket is only freed once no lookup is in flight (tcp_lookups_active).
+ */
+static tcp_socket_t *tcp_ehash[TCP_EHASH_SIZE];  /* Connections by 4-tuple */
+static tcp_socket_t *tcp_lhash[TCP_LHASH_SIZE];  /* Listeners by local port */
+static tcp_socket_t *tcp_bhash[TCP_BHASH_SIZE];  /* All sockets by local port */
+static volatile int tcp_hash_lock = 0;
+static volatile uint32_t tcp_lookups_active = 0;
+
+/*
+ * Timer wheel. A socket with a deadline sits in the slot of the tick it is
+ * due, so a tick only walks the slots that came due; a deadline more than
+ * one turn away stays in its slot through the earlier turns. tcp_timer
+ * fires at the next occupied slot and runs tcp_timer_tick.
+ */
+static tcp_timer_node_t *tcp_wheel[TCP_WHEEL_SLOTS];
+static uint64_t tcp_wheel_clock = 0;   /* Last tick processed (ms / TCP_WHEEL_TICK) */
+static uint32_t tcp_wheel_count = 0;   /* Nodes in the wheel */
+static volatile int tcp_wheel_lock = 0;
+static ktimer_t tcp_timer;
+
+/* TIME_WAIT minisocks by 4-tuple, published like tcp_ehash */
+static tcp_timewait_t *tcp_twhash[TCP_EHASH_SIZE];
+static kmem_cache_t *tcp_timewait_cache = NULL;
+
+/* Secret key of the ISN hash (RFC 6528), drawn in tcp_init */
+static uint8_t tcp_isn_secret[32];
+
+/*
+ * SYN cookies: the ISN of a SYN-ACK sent without keeping state is a 5-bit
+ * time slot, a 3-bit index into tcp_cookie_mss and a 24-bit keyed hash of
+ * the 4-tuple, the peer's ISN and the slot. The ACK returns it plus one.
+ */
+#define TCP_COOKIE_SLOT_SHIFT   16          /* Slot length: 2^16 ms, about a minute */
+#define TCP_COOKIE_SLOTS_VALID  2           /* Slots a cookie is accepted in */
+#define TCP_COOKIE_HASH_MASK    0x00FFFFFFu
+
+static const uint16_t tcp_cookie_mss[8] = { 88, 216, 536, 960, 1200, 1380, 1440, 1460 };
+static uint8_t tcp_cookie_secret[32];
 
 /* TCP statistics */
 static struct {
@@ -38,12 +90,19 @@ static struct {
     uint64_t connections_established;
     uint64_t connections_closed;
     uint64_t retransmissions;
+    uint64_t fast_retransmits;
+    uint64_t timeouts;
+    uint64_t delayed_acks;
     uint64_t checksum_errors;
+    uint64_t syn_cookies_sent;
+    uint64_t syn_cookies_ok;
+    uint64_t listen_drops;
 } tcp_stats;
 
 /* Forward declarations */
 static int tcp_send_segment(tcp_socket_t *sock, uint8_t flags,
                             const void *data, size_t data_len);
+static void tcp_timer_update(tcp_socket_t *sock);
 void tcp_output(tcp_socket_t *sock);
 
 /* ============================================================================
@@ -126,53 +185,107 @@ static size_t ring_buffer_write(tcp_ring_buffer_t *rb, const void *data, size_t
     const uint8_t *src = (const uint8_t *)data;
     size_t space = ring_buffer_space(rb);
     size_t to_write = (len < space) ? len : space;
-    size_t written = 0;
-
-    while (written < to_write) {
-        rb->buffer[rb->head] = src[written];
-        rb->head = (rb->head + 1) % rb->size;
-        written++;
+    if (to_write == 0) {
+        return 0;
     }
-    rb->used += written;
+    size_t first = MIN(to_write, rb->size - rb->head);
 
-    return written;
+    memcpy(rb->buffer + rb->head, src, first);
+    memcpy(rb->buffer, src + first, to_write - first);
+    rb->head = (rb->head + to_write) % rb->size;
+    rb->used += to_write;
+
+    return to_write;
 }
 
 /**
- * Read data from ring buffer
- * Returns number of bytes read
+ * Let a producer write into the free space of a ring buffer
+ * The space is handed out as up to two contiguous spans.
+ * @return Bytes added, or the producer's error if it failed before adding any
  */
-static size_t ring_buffer_read(tcp_ring_buffer_t *rb, void *data, size_t len) {
-    uint8_t *dst = (uint8_t *)data;
-    size_t available = ring_buffer_used(rb);
-    size_t to_read = (len < available) ? len : available;
-    size_t bytes_read = 0;
+static ssize_t ring_buffer_fill(tcp_ring_buffer_t *rb, tcp_fill_fn_t fill, void *ctx,
+                                size_t len) {
+    size_t added = 0;
+    len = MIN(len, ring_buffer_space(rb));
+
+    while (added < len) {
+        size_t span = MIN(len - added, rb->size - rb->head);
+        ssize_t n = fill(ctx, rb->buffer + rb->head, span);
+        if (n < 0) {
+            return added > 0 ? (ssize_t)added : n;
+        }
+        n = MIN(n, (ssize_t)span);
+        rb->head = (rb->head + (size_t)n) % rb->size;
+        rb->used += (size_t)n;
+        added += (size_t)n;
+        if ((size_t)n < span) {
+            break;
+        }
+    }
+    return (ssize_t)added;
+}
 
-    while (bytes_read < to_read) {
-        dst[bytes_read] = rb->buffer[rb->tail];
-        rb->tail = (rb->tail + 1) % rb->size;
-        bytes_read++;
+/**
+ * Copy len bytes starting offset bytes past the read position, without
+ * removing them
+ */
+static size_t ring_buffer_peek_at(const tcp_ring_buffer_t *rb, size_t offset,
+                                  void *data, size_t len) {
+    if (offset >= rb->used) {
+        return 0;
     }
-    rb->used -= bytes_read;
+    len = MIN(len, rb->used - offset);
 
-    return bytes_read;
+    size_t pos = (rb->tail + offset) % rb->size;
+    size_t first = MIN(len, rb->size - pos);
+    memcpy(data, rb->buffer + pos, first);
+    memcpy((uint8_t *)data + first, rb->buffer, len - first);
+    return len;
+}
+
+/**
+ * Drop len bytes from the read position
+ */
+static void ring_buffer_discard(tcp_ring_buffer_t *rb, size_t len) {
+    len = MIN(len, rb->used);
+    if (len == 0) {
+        return;                     /* Also covers a freed buffer */
+    }
+    rb->tail = (rb->tail + len) % rb->size;
+    rb->used -= len;
 }
 
 /**
- * Peek data from ring buffer without removing
+ * Move the contents to a new buffer of size bytes
+ * @return false if they do not fit or memory ran out
  */
-static size_t ring_buffer_peek(const tcp_ring_buffer_t *rb, void *data, size_t len) {
-    uint8_t *dst = (uint8_t *)data;
-    size_t available = ring_buffer_used(rb);
-    size_t to_read = (len < available) ? len : available;
-    size_t tail = rb->tail;
+static bool ring_buffer_resize(tcp_ring_buffer_t *rb, size_t size) {
+    if (size < rb->used) {
+        return false;
+    }
 
-    for (size_t i = 0; i < to_read; i++) {
-        dst[i] = rb->buffer[tail];
-        tail = (tail + 1) % rb->size;
+    uint8_t *buffer = kmalloc(size);
+    if (!buffer) {
+        return false;
     }
+    ring_buffer_peek_at(rb, 0, buffer, rb->used);
+    kfree(rb->buffer);
+
+    rb->buffer = buffer;
+    rb->size = size;
+    rb->tail = 0;
+    rb->head = rb->used % size;
+    return true;
+}
 
-    return to_read;
+/**
+ * Read data from ring buffer
+ * Returns number of bytes read
+ */
+static size_t ring_buffer_read(tcp_ring_buffer_t *rb, void *data, size_t len) {
+    size_t bytes_read = ring_buffer_peek_at(rb, 0, data, len);
+    ring_buffer_discard(rb, bytes_read);
+    return bytes_read;
 }
 
 /* ============================================================================
@@ -181,13 +294,31 @@ static size_t ring_buffer_peek(const tcp_ring_buffer_t *rb, void *data, size_t l
 
 /**
  * Generate initial sequence number
- * Uses a simple counter + time-based value for uniqueness
+ * RFC 6528: a 4 us clock plus a keyed hash of the connection's 4-tuple,
+ * so ISNs of one connection keep increasing while those of others
+ * cannot be predicted from it.
  */
-uint32_t tcp_generate_isn(void) {
-    /* Combine counter with time for better randomness */
-    uint32_t time_component = (uint32_t)pit_get_uptime_ms();
-    tcp_isn_counter += 64000;  /* Increment by a large value */
-    return tcp_isn_counter ^ (time_component * 1103515245);
+uint32_t tcp_generate_isn(uint32_t local_ip, uint16_t local_port,
+                          uint32_t remote_ip, uint16_t remote_port) {
+    struct {
+        uint8_t secret[sizeof(tcp_isn_secret)];
+        uint32_t local_ip;
+        uint32_t remote_ip;
+        uint16_t local_port;
+        uint16_t remote_port;
+    } PACKED input;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint32_t offset;
+
+    memcpy(input.secret, tcp_isn_secret, sizeof(input.secret));
+    input.local_ip = local_ip;
+    input.remote_ip = remote_ip;
+    input.local_port = local_port;
+    input.remote_port = remote_port;
+    sha256_hash(&input, sizeof(input), hash);
+    memcpy(&offset, hash, sizeof(offset));
+
+    return (uint32_t)(clock_monotonic_ns() / 4000) + offset;
 }
 
 /**
@@ -195,9 +326,6 @@ uint32_t tcp_generate_isn(void) {
  */
 uint16_t tcp_checksum(uint32_t src_ip, uint32_t dst_ip,
                       const void *tcp_data, size_t tcp_len) {
-    uint32_t sum = 0;
-    const uint16_t *ptr;
-
     /* Create pseudo-header and add to sum */
     tcp_pseudo_header_t pseudo;
     pseudo.src_ip = htonl(src_ip);
@@ -206,32 +334,8 @@ uint16_t tcp_checksum(uint32_t src_ip, uint32_t dst_ip,
     pseudo.protocol = TCP_PROTOCOL;
     pseudo.tcp_length = htons((uint16_t)tcp_len);
 
-    /* Sum pseudo-header */
-    ptr = (const uint16_t *)&pseudo;
-    for (size_t i = 0; i < sizeof(pseudo) / 2; i++) {
-        sum += ptr[i];
-    }
-
-    /* Sum TCP segment */
-    ptr = (const uint16_t *)tcp_data;
-    size_t count = tcp_len;
-
-    while (count > 1) {
-        sum += *ptr++;
-        count -= 2;
-    }
-
-    /* Add odd byte if present */
-    if (count > 0) {
-        sum += *(const uint8_t *)ptr;
-    }
-
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    return (uint16_t)~sum;
+    uint32_t sum = csum_partial(&pseudo, sizeof(pseudo), 0);
+    return csum_fold(csum_partial(tcp_data, tcp_len, sum));
 }
 
 /**
@@ -254,8 +358,135 @@ static inline bool seq_ge(uint32_t a, uint32_t b) {
     return (int32_t)(a - b) >= 0;
 }
 
+/* ============================================================================
+ * Socket Management
+ * ============================================================================ */
+
+static inline uint64_t tcp_hash_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&tcp_hash_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void tcp_hash_lock_release(uint64_t flags) {
+    __sync_lock_release(&tcp_hash_lock);
+    interrupts_restore(flags);
+}
+
+static inline uint32_t tcp_ehash_bucket(uint16_t local_port, uint32_t remote_ip,
+                                        uint16_t remote_port) {
+    uint32_t h = (remote_ip ^ ((uint32_t)local_port << 16 | remote_port)) * 2654435761u;
+    return (h ^ (h >> 16)) & (TCP_EHASH_SIZE - 1);
+}
+
+static inline uint32_t tcp_port_bucket(uint16_t port, uint32_t size) {
+    return (port ^ (port >> 8)) & (size - 1);
+}
+
+/**
+ * Wait until no lookup is in flight
+ * Lookups run with interrupts off, so none on this CPU can be. After this
+ * no lookup still holds a socket unlinked before the call.
+ */
+static void tcp_lookup_sync(void) {
+    while (__atomic_load_n(&tcp_lookups_active, __ATOMIC_SEQ_CST) != 0) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/**
+ * Publish sock at the head of a chain (tcp_hash_lock held)
+ * The link is written before the head, so a lookup walking the chain
+ * sees either the old head or a fully linked sock.
+ */
+static void tcp_hash_link(tcp_socket_t **head, tcp_socket_t *sock) {
+    sock->hash_next = *head;
+    __atomic_store_n(head, sock, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unlink sock from a chain (tcp_hash_lock held)
+ * sock->hash_next is left alone so a lookup standing on sock can go on.
+ */
+static void tcp_hash_unlink(tcp_socket_t **head, tcp_socket_t *sock) {
+    for (tcp_socket_t **pp = head; *pp; pp = &(*pp)->hash_next) {
+        if (*pp == sock) {
+            __atomic_store_n(pp, sock->hash_next, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/**
+ * Enter a socket with a remote endpoint into the connection table
+ */
+static void tcp_ehash_add(tcp_socket_t *sock) {
+    uint64_t flags = tcp_hash_lock_acquire();
+    if (!(sock->flags & TCP_SOCK_FLAG_EHASHED)) {
+        tcp_hash_link(&tcp_ehash[tcp_ehash_bucket(sock->local_port, sock->remote_ip,
+                                                  sock->remote_port)], sock);
+        sock->flags |= TCP_SOCK_FLAG_EHASHED;
+    }
+    tcp_hash_lock_release(flags);
+}
+
+/**
+ * Take a socket out of the connection table, waiting for lookups in flight
+ */
+static void tcp_ehash_del(tcp_socket_t *sock) {
+    uint64_t flags = tcp_hash_lock_acquire();
+    if (sock->flags & TCP_SOCK_FLAG_EHASHED) {
+        tcp_hash_unlink(&tcp_ehash[tcp_ehash_bucket(sock->local_port, sock->remote_ip,
+                                                    sock->remote_port)], sock);
+        sock->flags &= ~TCP_SOCK_FLAG_EHASHED;
+    }
+    tcp_hash_lock_release(flags);
+    tcp_lookup_sync();
+}
+
+/**
+ * Enter a listening socket into the listener table
+ */
+static void tcp_lhash_add(tcp_socket_t *sock) {
+    uint64_t flags = tcp_hash_lock_acquire();
+    if (!(sock->flags & TCP_SOCK_FLAG_LHASHED)) {
+        tcp_hash_link(&tcp_lhash[tcp_port_bucket(sock->local_port, TCP_LHASH_SIZE)], sock);
+        sock->flags |= TCP_SOCK_FLAG_LHASHED;
+    }
+    tcp_hash_lock_release(flags);
+}
+
+/**
+ * Enter a socket into the bound port table (tcp_hash_lock held)
+ */
+static void tcp_bhash_add(tcp_socket_t *sock) {
+    tcp_socket_t **head = &tcp_bhash[tcp_port_bucket(sock->local_port, TCP_BHASH_SIZE)];
+    sock->bind_next = *head;
+    *head = sock;
+    sock->flags |= TCP_SOCK_FLAG_BHASHED;
+}
+
+/**
+ * Check if a local port is taken (tcp_hash_lock held)
+ * @param bound_only Only count bound and listening sockets
+ */
+static bool tcp_port_in_use(uint16_t port, const tcp_socket_t *except, bool bound_only) {
+    uint32_t shared = except ? except->flags & TCP_SOCK_FLAG_REUSEPORT : 0;
+    tcp_socket_t *s = tcp_bhash[tcp_port_bucket(port, TCP_BHASH_SIZE)];
+    for (; s != NULL; s = s->bind_next) {
+        if (s != except && s->local_port == port && !(s->flags & shared) &&
+            (!bound_only || s->state == TCP_STATE_LISTEN ||
+             (s->flags & TCP_SOCK_FLAG_BOUND))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
- * Allocate an ephemeral port
+ * Allocate an ephemeral port (tcp_hash_lock held)
  */
 static uint16_t tcp_alloc_ephemeral_port(void) {
     uint16_t start = tcp_next_ephemeral_port;
@@ -267,16 +498,7 @@ static uint16_t tcp_alloc_ephemeral_port(void) {
             tcp_next_ephemeral_port = 49152;
         }
 
-        /* Check if port is in use */
-        bool in_use = false;
-        for (tcp_socket_t *s = tcp_socket_list; s != NULL; s = s->next) {
-            if (s->local_port == port) {
-                in_use = true;
-                break;
-            }
-        }
-
-        if (!in_use) {
+        if (!tcp_port_in_use(port, NULL, false)) {
             return port;
         }
     } while (tcp_next_ephemeral_port != start);
@@ -284,26 +506,33 @@ static uint16_t tcp_alloc_ephemeral_port(void) {
     return 0;  /* No ports available */
 }
 
-/* ============================================================================
- * Socket Management
- * ============================================================================ */
-
 /**
  * Add socket to global list
  */
-static void tcp_socket_list_add(tcp_socket_t *sock) {
+static bool tcp_socket_list_add(tcp_socket_t *sock) {
+    uint64_t flags = tcp_hash_lock_acquire();
+    if (tcp_socket_count >= TCP_MAX_SOCKETS) {
+        tcp_hash_lock_release(flags);
+        return false;
+    }
+    tcp_socket_count++;
+
     sock->next = tcp_socket_list;
     sock->prev = NULL;
     if (tcp_socket_list) {
         tcp_socket_list->prev = sock;
     }
     tcp_socket_list = sock;
+    tcp_hash_lock_release(flags);
+    return true;
 }
 
 /**
- * Remove socket from global list
+ * Remove socket from global list and the lookup tables
+ * Waits for lookups in flight, so the socket can be freed on return.
  */
 static void tcp_socket_list_remove(tcp_socket_t *sock) {
+    uint64_t flags = tcp_hash_lock_acquire();
     if (sock->prev) {
         sock->prev->next = sock->next;
     } else {
@@ -314,6 +543,44 @@ static void tcp_socket_list_remove(tcp_socket_t *sock) {
     }
     sock->next = NULL;
     sock->prev = NULL;
+    tcp_socket_count--;
+
+    if (sock->flags & TCP_SOCK_FLAG_EHASHED) {
+        tcp_hash_unlink(&tcp_ehash[tcp_ehash_bucket(sock->local_port, sock->remote_ip,
+                                                    sock->remote_port)], sock);
+    }
+    if (sock->flags & TCP_SOCK_FLAG_LHASHED) {
+        tcp_hash_unlink(&tcp_lhash[tcp_port_bucket(sock->local_port, TCP_LHASH_SIZE)], sock);
+    }
+    if (sock->flags & TCP_SOCK_FLAG_BHASHED) {
+        tcp_socket_t **pp = &tcp_bhash[tcp_port_bucket(sock->local_port, TCP_BHASH_SIZE)];
+        while (*pp && *pp != sock) {
+            pp = &(*pp)->bind_next;
+        }
+        if (*pp) {
+            *pp = sock->bind_next;
+        }
+    }
+    sock->flags &= ~(TCP_SOCK_FLAG_EHASHED | TCP_SOCK_FLAG_LHASHED | TCP_SOCK_FLAG_BHASHED);
+    tcp_hash_lock_release(flags);
+    tcp_lookup_sync();
+}
+
+/**
+ * Start a lockless lookup
+ * Interrupts stay off until tcp_lookup_end, which keeps the walk short
+ * and lets tcp_lookup_sync (also reached from the timer interrupt) wait
+ * for it.
+ */
+static inline uint64_t tcp_lookup_begin(void) {
+    uint64_t flags = interrupts_save();
+    __atomic_add_fetch(&tcp_lookups_active, 1, __ATOMIC_SEQ_CST);
+    return flags;
+}
+
+static inline void tcp_lookup_end(uint64_t flags) {
+    __atomic_sub_fetch(&tcp_lookups_active, 1, __ATOMIC_RELEASE);
+    interrupts_restore(flags);
 }
 
 /**
@@ -321,43 +588,288 @@ static void tcp_socket_list_remove(tcp_socket_t *sock) {
  */
 static tcp_socket_t *tcp_find_socket(uint32_t local_ip, uint16_t local_port,
                                       uint32_t remote_ip, uint16_t remote_port) {
-    for (tcp_socket_t *s = tcp_socket_list; s != NULL; s = s->next) {
+    uint64_t flags = tcp_lookup_begin();
+    tcp_socket_t *s = __atomic_load_n(&tcp_ehash[tcp_ehash_bucket(local_port, remote_ip,
+                                                                  remote_port)],
+                                      __ATOMIC_ACQUIRE);
+    for (; s != NULL; s = __atomic_load_n(&s->hash_next, __ATOMIC_ACQUIRE)) {
         /* Exact match */
         if (s->local_port == local_port && s->remote_port == remote_port &&
             (s->local_ip == local_ip || s->local_ip == 0) &&
             s->remote_ip == remote_ip) {
-            return s;
+            break;
         }
     }
-    return NULL;
+    tcp_lookup_end(flags);
+    return s;
+}
+
+static inline bool tcp_listens_on(const tcp_socket_t *s, uint16_t port) {
+    return s->state == TCP_STATE_LISTEN && s->local_port == port;
 }
 
 /**
  * Find listening socket for port
+ * When SO_REUSEPORT listeners share the port, the receiving CPU picks
+ * one, so each listener's queues hold the connections of its CPUs.
  */
 static tcp_socket_t *tcp_find_listener(uint16_t port) {
-    for (tcp_socket_t *s = tcp_socket_list; s != NULL; s = s->next) {
-        if (s->state == TCP_STATE_LISTEN && s->local_port == port) {
-            return s;
+    uint64_t flags = tcp_lookup_begin();
+    tcp_socket_t *s = __atomic_load_n(&tcp_lhash[tcp_port_bucket(port, TCP_LHASH_SIZE)],
+                                      __ATOMIC_ACQUIRE);
+    for (; s != NULL; s = __atomic_load_n(&s->hash_next, __ATOMIC_ACQUIRE)) {
+        if (tcp_listens_on(s, port)) {
+            break;
+        }
+    }
+
+    tcp_socket_t *first = s;
+    uint32_t count = 0;
+    for (; s != NULL; s = __atomic_load_n(&s->hash_next, __ATOMIC_ACQUIRE)) {
+        count += tcp_listens_on(s, port);
+    }
+
+    tcp_socket_t *pick = first;
+    if (count > 1 && (first->flags & TCP_SOCK_FLAG_REUSEPORT)) {
+        /* The chain may change under us: fall back to the first listener */
+        uint32_t n = percpu_cpu_id() % count;
+        for (s = first; s != NULL; s = __atomic_load_n(&s->hash_next, __ATOMIC_ACQUIRE)) {
+            if (tcp_listens_on(s, port) && n-- == 0) {
+                pick = s;
+                break;
+            }
+        }
+    }
+    tcp_lookup_end(flags);
+    return pick;
+}
+
+/* ============================================================================
+ * Listen Queues
+ * ============================================================================ */
+
+static inline uint64_t tcp_queue_lock_acquire(tcp_socket_t *listener) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&listener->queue_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void tcp_queue_lock_release(tcp_socket_t *listener, uint64_t flags) {
+    __sync_lock_release(&listener->queue_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Append a connection to one of listener's queues (queue_lock held)
+ */
+static void tcp_queue_push(tcp_socket_t *listener, tcp_conn_queue_t *q, tcp_socket_t *sock) {
+    sock->parent = listener;
+    sock->queue = q;
+    sock->queue_next = NULL;
+    sock->queue_prev = q->tail;
+    if (q->tail) {
+        q->tail->queue_next = sock;
+    } else {
+        q->head = sock;
+    }
+    q->tail = sock;
+    q->count++;
+}
+
+/**
+ * Take a connection off its listener's queue (queue_lock held)
+ */
+static void tcp_queue_unlink(tcp_socket_t *sock) {
+    tcp_conn_queue_t *q = sock->queue;
+    if (sock->queue_prev) {
+        sock->queue_prev->queue_next = sock->queue_next;
+    } else {
+        q->head = sock->queue_next;
+    }
+    if (sock->queue_next) {
+        sock->queue_next->queue_prev = sock->queue_prev;
+    } else {
+        q->tail = sock->queue_prev;
+    }
+    q->count--;
+    sock->parent = NULL;
+    sock->queue = NULL;
+    sock->queue_next = NULL;
+    sock->queue_prev = NULL;
+}
+
+/**
+ * Check if an unaccepted connection is still in its handshake
+ * Nobody owns it yet but its listener, so it is freed when it fails.
+ */
+static inline bool tcp_in_syn_queue(const tcp_socket_t *sock) {
+    tcp_socket_t *listener = sock->parent;
+    return listener != NULL && sock->queue == &listener->syn_queue;
+}
+
+/**
+ * Check if the accept queue has room for one more connection
+ */
+static bool tcp_accept_room(tcp_socket_t *listener) {
+    uint64_t flags = tcp_queue_lock_acquire(listener);
+    bool room = listener->accept_queue.count < listener->backlog;
+    tcp_queue_lock_release(listener, flags);
+
+    if (!room) {
+        tcp_stats.listen_drops++;
+        log_event(SERIAL_LOG_WARN, "TCP", "Accept queue full on port %d\n",
+                  listener->local_port);
+    }
+    return room;
+}
+
+/**
+ * Move a connection whose handshake completed to the accept queue
+ */
+static void tcp_child_established(tcp_socket_t *sock) {
+    tcp_socket_t *listener = sock->parent;
+    if (!listener) {
+        return;
+    }
+
+    uint64_t flags = tcp_queue_lock_acquire(listener);
+    bool moved = sock->parent == listener;
+    if (moved) {
+        tcp_queue_unlink(sock);
+        tcp_queue_push(listener, &listener->accept_queue, sock);
+    }
+    tcp_queue_lock_release(listener, flags);
+
+    if (moved) {
+        poll_notify(&listener->poll, POLL_IN);
+    }
+}
+
+/**
+ * Take a connection off its listener's queue, if it is on one
+ */
+static void tcp_child_detach(tcp_socket_t *sock) {
+    tcp_socket_t *listener = sock->parent;
+    if (!listener) {
+        return;
+    }
+
+    uint64_t flags = tcp_queue_lock_acquire(listener);
+    if (sock->parent == listener) {
+        tcp_queue_unlink(sock);
+    }
+    tcp_queue_lock_release(listener, flags);
+}
+
+/**
+ * Reset every connection a closing listener has not handed out
+ */
+static void tcp_listen_flush(tcp_socket_t *sock) {
+    for (;;) {
+        uint64_t flags = tcp_queue_lock_acquire(sock);
+        tcp_socket_t *child = sock->syn_queue.head ? sock->syn_queue.head
+                                                   : sock->accept_queue.head;
+        if (child) {
+            tcp_queue_unlink(child);
         }
+        tcp_queue_lock_release(sock, flags);
+
+        if (!child) {
+            return;
+        }
+        tcp_abort(child);
     }
-    return NULL;
 }
 
 /* ============================================================================
  * TCP Segment Transmission
  * ============================================================================ */
 
+/* Largest option block tcp_write_options produces */
+#define TCP_OPTIONS_MAX         20
+
+static inline void tcp_opt_put32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
 /**
- * Send a TCP segment
+ * Write the options of an outgoing segment
+ * A SYN offers MSS, window scale, SACK permitted and timestamps; a
+ * SYN-ACK only returns what the peer's SYN offered. Later segments carry
+ * timestamps if both sides agreed to them.
+ * @return Bytes written (a multiple of 4, at most TCP_OPTIONS_MAX)
  */
-static int tcp_send_segment(tcp_socket_t *sock, uint8_t flags,
-                            const void *data, size_t data_len) {
-    /* Allocate buffer for TCP header + data */
-    size_t total_len = TCP_HEADER_MIN_LEN + data_len;
-    uint8_t *segment = kmalloc(total_len);
+static size_t tcp_write_options(const tcp_socket_t *sock, uint8_t flags, uint8_t *opt) {
+    bool syn = (flags & TCP_FLAG_SYN) != 0;
+    bool offer = syn && !(flags & TCP_FLAG_ACK);
+    bool sack = syn && (offer || (sock->flags & TCP_SOCK_FLAG_SACK_OK));
+    bool ts = offer || sock->options.ts_ok;
+    size_t n = 0;
+
+    if (syn) {
+        opt[n++] = TCP_OPT_MSS;
+        opt[n++] = 4;
+        opt[n++] = TCP_MSS_DEFAULT >> 8;
+        opt[n++] = TCP_MSS_DEFAULT & 0xFF;
+        if (offer || sock->options.wscale_ok) {
+            opt[n++] = TCP_OPT_NOP;
+            opt[n++] = TCP_OPT_WSCALE;
+            opt[n++] = 3;
+            opt[n++] = sock->options.rcv_wscale;
+        }
+    }
+
+    /* SACK permitted takes the place of the NOPs in front of the timestamps */
+    if (sack || ts) {
+        opt[n++] = sack ? TCP_OPT_SACK_PERM : TCP_OPT_NOP;
+        opt[n++] = sack ? 2 : TCP_OPT_NOP;
+    }
+    if (ts) {
+        opt[n++] = TCP_OPT_TIMESTAMP;
+        opt[n++] = 10;
+        tcp_opt_put32(opt + n, (uint32_t)clock_monotonic_ms());
+        tcp_opt_put32(opt + n + 4, sock->options.ts_recent);
+        n += 8;
+    } else if (sack) {
+        opt[n++] = TCP_OPT_NOP;
+        opt[n++] = TCP_OPT_NOP;
+    }
+    return n;
+}
+
+/**
+ * Payload bytes that fit in one segment after the options
+ */
+static inline size_t tcp_seg_size(const tcp_socket_t *sock) {
+    return sock->options.mss - (sock->options.ts_ok ? TCP_OPT_TIMESTAMP_LEN : 0);
+}
+
+/**
+ * Build and send one segment starting at seq, without moving snd_nxt
+ * With data NULL, data_len bytes are taken from the send buffer at seq.
+ */
+static int tcp_xmit(tcp_socket_t *sock, uint32_t seq, uint8_t flags,
+                    const void *data, size_t data_len) {
+    uint8_t options[TCP_OPTIONS_MAX];
+    size_t opt_len = tcp_write_options(sock, flags, options);
+    size_t header_len = TCP_HEADER_MIN_LEN + opt_len;
+
+    /*
+     * Build the segment in a netbuf, which the IP and Ethernet layers push
+     * their headers in front of and the device sends in place. The data is
+     * copied once, from the send buffer into the netbuf.
+     */
+    size_t total_len = header_len + data_len;
+    netbuf_t *buf = netbuf_alloc(NETBUF_DEFAULT_HEADROOM + total_len, NETBUF_DEFAULT_HEADROOM);
+    uint8_t *segment = buf ? netbuf_put(buf, total_len) : NULL;
     if (!segment) {
         kprintf("[TCP] Failed to allocate segment buffer\n");
+        netbuf_free(buf);
         return TCP_ERR_NOMEM;
     }
 
@@ -367,32 +879,67 @@ static int tcp_send_segment(tcp_socket_t *sock, uint8_t flags,
 
     hdr->src_port = htons(sock->local_port);
     hdr->dst_port = htons(sock->remote_port);
-    hdr->seq_num = htonl(sock->snd_nxt);
+    hdr->seq_num = htonl(seq);
     hdr->ack_num = htonl(sock->rcv_nxt);
-    hdr->data_offset = (TCP_HEADER_MIN_LEN / 4) << 4;  /* 5 words = 20 bytes */
+    hdr->data_offset = (uint8_t)((header_len / 4) << 4);
     hdr->flags = flags;
-    hdr->window = htons((uint16_t)sock->rcv_wnd);
+    /* The window in a SYN is never scaled (RFC 7323, section 2.2) */
+    uint32_t window = sock->rcv_wnd;
+    if (!(flags & TCP_FLAG_SYN)) {
+        window >>= sock->options.rcv_wscale;
+    }
+    hdr->window = htons((uint16_t)MIN(window, (uint32_t)TCP_MAX_WINDOW));
     hdr->checksum = 0;
     hdr->urgent_ptr = 0;
+    memcpy(segment + TCP_HEADER_MIN_LEN, options, opt_len);
 
     /* Copy data if present */
     if (data && data_len > 0) {
-        memcpy(segment + TCP_HEADER_MIN_LEN, data, data_len);
+        memcpy(segment + header_len, data, data_len);
+    } else if (data_len > 0) {
+        ring_buffer_peek_at(&sock->send_buf, seq - sock->snd_una, segment + header_len,
+                            data_len);
+    }
+
+    if (ip_offloads(sock->remote_ip) & ETH_OFFLOAD_TX_CSUM) {
+        /* The device fills the checksum and cuts sends over one MSS */
+        buf->flags |= NETBUF_FLAG_CSUM_L4;
+        if (data_len > tcp_seg_size(sock)) {
+            buf->flags |= NETBUF_FLAG_TSO;
+            buf->mss = (uint16_t)tcp_seg_size(sock);
+        }
+    } else {
+        uint32_t local_ip = sock->local_ip ? sock->local_ip : ip_get_addr();
+        hdr->checksum = tcp_checksum(local_ip, sock->remote_ip, segment, total_len);
     }
 
-    /* Calculate checksum */
-    uint32_t local_ip = sock->local_ip ? sock->local_ip : ip_get_addr();
-    hdr->checksum = tcp_checksum(local_ip, sock->remote_ip, segment, total_len);
-
-    /* Send via IP layer */
-    int result = ip_send(sock->remote_ip, IP_PROTO_TCP, segment, total_len);
-
-    kfree(segment);
+    int result = ip_send_buf_cached(buf, sock->remote_ip, IP_PROTO_TCP, &sock->route);
+    if (result != 0) {
+        netbuf_free(buf);
+    }
 
     if (result == 0) {
         tcp_stats.packets_sent++;
         tcp_stats.bytes_sent += data_len;
 
+        /* Any ACK we send covers the held one */
+        if (flags & TCP_FLAG_ACK) {
+            sock->flags &= ~TCP_SOCK_FLAG_ACK_DELAYED;
+            sock->delack_segs = 0;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Send a TCP segment at snd_nxt
+ */
+static int tcp_send_segment(tcp_socket_t *sock, uint8_t flags,
+                            const void *data, size_t data_len) {
+    int result = tcp_xmit(sock, sock->snd_nxt, flags, data, data_len);
+
+    if (result == 0) {
         /* Update sequence number for data and SYN/FIN (they consume sequence space) */
         if (data_len > 0) {
             sock->snd_nxt += data_len;
@@ -403,6 +950,9 @@ static int tcp_send_segment(tcp_socket_t *sock, uint8_t flags,
         if (flags & TCP_FLAG_FIN) {
             sock->snd_nxt++;
         }
+        if (seq_gt(sock->snd_nxt, sock->snd_max)) {
+            sock->snd_max = sock->snd_nxt;
+        }
     }
 
     return result;
@@ -431,7 +981,7 @@ static void tcp_send_rst(uint32_t src_ip, uint32_t dst_ip,
     hdr->checksum = tcp_checksum(local_ip, dst_ip, segment, TCP_HEADER_MIN_LEN);
 
     ip_send(dst_ip, IP_PROTO_TCP, segment, TCP_HEADER_MIN_LEN);
-    kprintf("[TCP] Sent RST to %08X:%d\n", dst_ip, dst_port);
+    log_event(SERIAL_LOG_DEBUG, "TCP", "Sent RST to %08X:%d\n", dst_ip, dst_port);
 }
 
 /* ============================================================================
@@ -439,47 +989,1116 @@ static void tcp_send_rst(uint32_t src_ip, uint32_t dst_ip,
  * ============================================================================ */
 
 /**
- * Change TCP state with logging
+ * Check if a state runs the retransmission queue (the handshake is done)
  */
-static void tcp_set_state(tcp_socket_t *sock, tcp_state_t new_state) {
-    if (sock->state != new_state) {
-        kprintf("[TCP] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d: %s -> %s\n",
-                (sock->local_ip >> 24) & 0xFF, (sock->local_ip >> 16) & 0xFF,
-                (sock->local_ip >> 8) & 0xFF, sock->local_ip & 0xFF,
-                sock->local_port,
-                (sock->remote_ip >> 24) & 0xFF, (sock->remote_ip >> 16) & 0xFF,
-                (sock->remote_ip >> 8) & 0xFF, sock->remote_ip & 0xFF,
-                sock->remote_port,
-                tcp_state_name(sock->state), tcp_state_name(new_state));
-        sock->state = new_state;
-        sock->last_activity = (uint32_t)pit_get_uptime_ms();
+static bool tcp_state_sending(tcp_state_t state) {
+    return state == TCP_STATE_ESTABLISHED || state == TCP_STATE_CLOSE_WAIT ||
+           state == TCP_STATE_FIN_WAIT_1 || state == TCP_STATE_FIN_WAIT_2 ||
+           state == TCP_STATE_CLOSING || state == TCP_STATE_LAST_ACK;
+}
+
+/**
+ * Check if a socket waits on the retransmission timer: data or a FIN in
+ * flight, or queued data held back by a zero window
+ */
+static bool tcp_socket_timed(const tcp_socket_t *sock) {
+    if (!tcp_state_sending(sock->state)) {
+        return false;
     }
+    return sock->snd_max != sock->snd_una ||
+           (sock->snd_wnd == 0 && ring_buffer_used(&sock->send_buf) > 0);
+}
+
+/**
+ * Check if the peer has acknowledged our FIN
+ */
+static bool tcp_fin_acked(const tcp_socket_t *sock) {
+    return (sock->flags & TCP_SOCK_FLAG_FIN_SENT) && sock->snd_una == sock->snd_max;
 }
 
 /* ============================================================================
- * API Implementation
+ * Timer Wheel
  * ============================================================================ */
 
-/**
+static inline uint64_t tcp_wheel_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&tcp_wheel_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
+}
+
+static inline void tcp_wheel_lock_release(uint64_t flags) {
+    __sync_lock_release(&tcp_wheel_lock);
+    interrupts_restore(flags);
+}
+
+/**
+ * Wheel tick at which a node is due (its deadline rounded up)
+ */
+static inline uint64_t tcp_wheel_tick_of(const tcp_timer_node_t *node) {
+    return (node->expires + TCP_WHEEL_TICK - 1) / TCP_WHEEL_TICK;
+}
+
+/**
+ * Make the TCP timer fire within ms milliseconds
+ * A pending timer is only restarted if it would fire later than that.
+ */
+static void tcp_timer_arm_in(uint32_t ms) {
+    uint64_t delay = (uint64_t)MAX(ms, 1U) * NSEC_PER_MSEC;
+    if (!ktimer_pending(&tcp_timer) || tcp_timer.expires > timer_now_ns() + delay) {
+        ktimer_start(&tcp_timer, delay, 0);
+    }
+}
+
+/**
+ * Take a node out of its slot (tcp_wheel_lock held)
+ */
+static void tcp_wheel_unlink(tcp_timer_node_t *node) {
+    *node->pprev = node->next;
+    if (node->next) {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+    tcp_wheel_count--;
+}
+
+/**
+ * Queue a node to expire delay ms from now, moving it if already queued
+ */
+static void tcp_wheel_add(tcp_timer_node_t *node, uint32_t delay) {
+    uint64_t now = clock_monotonic_ms();
+
+    uint64_t flags = tcp_wheel_lock_acquire();
+    if (node->pprev) {
+        tcp_wheel_unlink(node);
+    }
+    node->expires = now + delay;
+
+    /* A deadline in a tick already processed goes in the next one */
+    uint64_t tick = MAX(tcp_wheel_tick_of(node), tcp_wheel_clock + 1);
+    tcp_timer_node_t **head = &tcp_wheel[tick & (TCP_WHEEL_SLOTS - 1)];
+    node->next = *head;
+    node->pprev = head;
+    if (*head) {
+        (*head)->pprev = &node->next;
+    }
+    *head = node;
+    tcp_wheel_count++;
+    tcp_wheel_lock_release(flags);
+
+    tcp_timer_arm_in((uint32_t)(tick * TCP_WHEEL_TICK - now));
+}
+
+/**
+ * Take a node out of the wheel
+ * @return true if it was queued, false if it was idle or is being run
+ */
+static bool tcp_wheel_del(tcp_timer_node_t *node) {
+    uint64_t flags = tcp_wheel_lock_acquire();
+    bool queued = node->pprev != NULL;
+    if (queued) {
+        tcp_wheel_unlink(node);
+    }
+    tcp_wheel_lock_release(flags);
+    return queued;
+}
+
+/**
+ * Queue the socket's timer for its earliest deadline, or take it out of
+ * the wheel when nothing is pending
+ */
+static void tcp_timer_update(tcp_socket_t *sock) {
+    uint32_t due = 0;
+    bool pending = true;
+
+    switch (sock->state) {
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            due = sock->last_activity + sock->rto * (sock->retries + 1);
+            break;
+
+        case TCP_STATE_TIME_WAIT:
+            /* Unless a minisock took over */
+            due = sock->time_wait_start + TCP_TIME_WAIT_TIMEOUT;
+            pending = !(sock->flags & TCP_SOCK_FLAG_TIMEWAIT_MINI);
+            break;
+
+        default:
+            pending = tcp_socket_timed(sock);
+            if (pending) {
+                due = sock->rtx_start + sock->rto;
+            }
+            if ((sock->flags & TCP_SOCK_FLAG_ACK_DELAYED) && tcp_state_sending(sock->state) &&
+                (!pending || seq_lt(sock->delack_due, due))) {
+                due = sock->delack_due;
+                pending = true;
+            }
+            break;
+    }
+
+    if (!pending) {
+        tcp_wheel_del(&sock->timer);
+        return;
+    }
+    int32_t left = (int32_t)(due - (uint32_t)clock_monotonic_ms());
+    tcp_wheel_add(&sock->timer, left > 0 ? (uint32_t)left : 0);
+}
+
+/**
+ * Acknowledge in-order data: every TCP_DELACK_SEGS segments at once,
+ * otherwise within TCP_DELACK_TIMEOUT (RFC 1122, 4.2.3.2). A reply sent
+ * in the meantime carries the ACK instead.
+ */
+static void tcp_delack(tcp_socket_t *sock) {
+    if (++sock->delack_segs >= TCP_DELACK_SEGS) {
+        tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+        return;
+    }
+    if (!(sock->flags & TCP_SOCK_FLAG_ACK_DELAYED)) {
+        sock->flags |= TCP_SOCK_FLAG_ACK_DELAYED;
+        sock->delack_due = (uint32_t)clock_monotonic_ms() + TCP_DELACK_TIMEOUT;
+        tcp_timer_update(sock);
+    }
+}
+
+/**
+ * TCP timer callback
+ */
+static void tcp_timer_expired(void *arg) {
+    UNUSED(arg);
+    tcp_timer_tick();
+}
+
+/**
+ * Update the RTT estimate and RTO from one measurement (RFC 6298)
+ * Only segments that were not retransmitted are measured (Karn).
+ */
+static void tcp_rtt_sample(tcp_socket_t *sock, uint32_t rtt) {
+    if (sock->srtt == 0) {
+        sock->srtt = MAX(rtt, 1U);
+        sock->rttvar = rtt / 2;
+    } else {
+        uint32_t err = sock->srtt > rtt ? sock->srtt - rtt : rtt - sock->srtt;
+        sock->rttvar = (3 * sock->rttvar + err) / 4;
+        sock->srtt = (7 * sock->srtt + rtt) / 8;
+    }
+
+    uint32_t rto = sock->srtt + MAX((uint32_t)TCP_WHEEL_TICK, 4 * sock->rttvar);
+    sock->rto = CLAMP(rto, (uint32_t)TCP_RTO_MIN, (uint32_t)TCP_RTO_MAX);
+}
+
+/**
+ * Change TCP state with logging
+ */
+static void tcp_set_state(tcp_socket_t *sock, tcp_state_t new_state) {
+    if (sock->state != new_state) {
+        kprintf("[TCP] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d: %s -> %s\n",
+                (sock->local_ip >> 24) & 0xFF, (sock->local_ip >> 16) & 0xFF,
+                (sock->local_ip >> 8) & 0xFF, sock->local_ip & 0xFF,
+                sock->local_port,
+                (sock->remote_ip >> 24) & 0xFF, (sock->remote_ip >> 16) & 0xFF,
+                (sock->remote_ip >> 8) & 0xFF, sock->remote_ip & 0xFF,
+                sock->remote_port,
+                tcp_state_name(sock->state), tcp_state_name(new_state));
+        sock->state = new_state;
+        sock->last_activity = (uint32_t)clock_monotonic_ms();
+        tcp_timer_update(sock);
+    }
+}
+
+/* ============================================================================
+ * Retransmission and Congestion Control
+ * ============================================================================ */
+
+/**
+ * Options of a received segment
+ */
+typedef struct tcp_parsed_opts {
+    tcp_syn_options_t syn;      /* SYN options and the TSval */
+    uint32_t ts_ecr;            /* TSecr, valid if syn.ts_ok */
+    uint8_t sack_count;         /* SACK blocks */
+    tcp_sack_block_t sack[TCP_SACK_MAX_BLOCKS];
+} tcp_parsed_opts_t;
+
+static inline uint32_t tcp_opt_get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * Parse the options of a segment; malformed options end the list
+ */
+static void tcp_parse_options(const tcp_header_t *hdr, size_t header_len,
+                              tcp_parsed_opts_t *opts) {
+    const uint8_t *p = (const uint8_t *)hdr + TCP_HEADER_MIN_LEN;
+    const uint8_t *end = (const uint8_t *)hdr + header_len;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->syn.wscale = -1;
+    while (p < end && p[0] != TCP_OPT_END) {
+        if (p[0] == TCP_OPT_NOP) {
+            p++;
+            continue;
+        }
+        if (end - p < 2 || p[1] < 2 || p[1] > end - p) {
+            break;
+        }
+
+        uint8_t len = p[1];
+        if (p[0] == TCP_OPT_MSS && len == 4) {
+            opts->syn.mss = (uint16_t)(p[2] << 8 | p[3]);
+        } else if (p[0] == TCP_OPT_WSCALE && len == 3) {
+            opts->syn.wscale = (int8_t)MIN(p[2], (uint8_t)TCP_MAX_WSCALE);
+        } else if (p[0] == TCP_OPT_SACK_PERM && len == 2) {
+            opts->syn.sack_ok = true;
+        } else if (p[0] == TCP_OPT_TIMESTAMP && len == 10) {
+            opts->syn.ts_ok = true;
+            opts->syn.ts_val = tcp_opt_get32(p + 2);
+            opts->ts_ecr = tcp_opt_get32(p + 6);
+        } else if (p[0] == TCP_OPT_SACK) {
+            for (uint8_t off = 2; off + 8 <= len && opts->sack_count < TCP_SACK_MAX_BLOCKS;
+                 off += 8) {
+                opts->sack[opts->sack_count].start = tcp_opt_get32(p + off);
+                opts->sack[opts->sack_count].end = tcp_opt_get32(p + off + 4);
+                opts->sack_count++;
+            }
+        }
+        p += len;
+    }
+}
+
+/**
+ * Window scale shift that lets the window field cover a buffer of size bytes
+ */
+static uint8_t tcp_wscale_for(size_t size) {
+    uint8_t shift = 0;
+    while (shift < TCP_MAX_WSCALE && (size >> shift) > TCP_MAX_WINDOW) {
+        shift++;
+    }
+    return shift;
+}
+
+/**
+ * Take the options of the peer's SYN
+ * Window scaling and timestamps are used only if both SYNs carry them;
+ * our SYN always offers them, a SYN-ACK only answers what was offered.
+ */
+static void tcp_apply_syn_options(tcp_socket_t *sock, const tcp_syn_options_t *syn) {
+    if (syn->mss != 0) {
+        sock->options.mss = CLAMP(syn->mss, (uint16_t)TCP_MSS_MIN, (uint16_t)TCP_MSS_DEFAULT);
+    }
+    if (syn->sack_ok) {
+        sock->flags |= TCP_SOCK_FLAG_SACK_OK;
+    }
+
+    sock->options.wscale_ok = syn->wscale >= 0;
+    sock->options.snd_wscale = sock->options.wscale_ok ? (uint8_t)syn->wscale : 0;
+    if (!sock->options.wscale_ok) {
+        sock->options.rcv_wscale = 0;
+    }
+
+    sock->options.ts_ok = syn->ts_ok;
+    sock->options.ts_recent = syn->ts_ok ? syn->ts_val : 0;
+}
+
+/**
+ * Set up congestion control once the handshake completes
+ * The initial window is RFC 6928's, or one segment if the SYN had to be
+ * sent again (RFC 5681, section 3.1).
+ */
+static void tcp_cc_init(tcp_socket_t *sock) {
+    uint32_t mss = sock->options.mss;
+
+    sock->cwnd = sock->retries ? mss : MIN(TCP_INIT_CWND_SEGS * mss, MAX(2 * mss, 14600U));
+    sock->ssthresh = UINT32_MAX;
+    sock->recover = sock->snd_una;
+    sock->retries = 0;
+    sock->rtx_start = (uint32_t)clock_monotonic_ms();
+}
+
+/**
+ * Size a buffer should grow to for target bytes: at least double, in
+ * whole pages, at most limit
+ */
+static size_t tcp_buffer_grow_size(const tcp_ring_buffer_t *rb, size_t target, size_t limit) {
+    return MIN(ALIGN_UP(MAX(target, rb->size * 2), (size_t)PAGE_SIZE), limit);
+}
+
+/**
+ * Grow the receive buffer to twice what arrives in one round trip, so
+ * the advertised window does not hold the sender back
+ * @param rtt Round trip measured from this segment's timestamp, 0 if none
+ */
+static void tcp_rcvbuf_tune(tcp_socket_t *sock, size_t bytes, uint32_t rtt) {
+    uint32_t now = (uint32_t)clock_monotonic_ms();
+
+    if (rtt != 0) {
+        sock->rcv_rtt = sock->rcv_rtt ? (7 * sock->rcv_rtt + rtt) / 8 : rtt;
+    }
+    uint32_t period = sock->rcv_rtt ? sock->rcv_rtt : sock->srtt;
+    if (period == 0) {
+        period = TCP_RTO_MIN;
+    }
+
+    sock->rcv_space += (uint32_t)bytes;
+    if (now - sock->rcv_space_start < period) {
+        return;
+    }
+
+    /* The window field cannot describe more than this */
+    size_t limit = MIN((size_t)sock->rcvbuf_max,
+                       (size_t)TCP_MAX_WINDOW << sock->options.rcv_wscale);
+    size_t target = (size_t)sock->rcv_space * 2;
+    if (target > sock->recv_buf.size && sock->recv_buf.size < limit &&
+        ring_buffer_resize(&sock->recv_buf, tcp_buffer_grow_size(&sock->recv_buf, target, limit))) {
+        sock->rcv_wnd = (uint32_t)ring_buffer_space(&sock->recv_buf);
+    }
+    sock->rcv_space = 0;
+    sock->rcv_space_start = now;
+}
+
+/**
+ * Grow the send buffer to hold two windows of data, so the application
+ * keeps the window full
+ */
+static void tcp_sndbuf_tune(tcp_socket_t *sock) {
+    size_t target = (size_t)MIN(sock->cwnd, sock->snd_wnd) * 2;
+    size_t limit = sock->sndbuf_max;
+
+    if (target > sock->send_buf.size && sock->send_buf.size < limit) {
+        ring_buffer_resize(&sock->send_buf, tcp_buffer_grow_size(&sock->send_buf, target, limit));
+    }
+}
+
+static void tcp_sack_remove(tcp_socket_t *sock, uint8_t i) {
+    for (; i + 1 < sock->sack_count; i++) {
+        sock->sacked[i] = sock->sacked[i + 1];
+    }
+    sock->sack_count--;
+}
+
+/**
+ * Merge reported SACK blocks into the scoreboard, kept sorted
+ * Overlapping ranges are joined. When the scoreboard is full the highest
+ * range is dropped, which at worst resends data the peer already holds.
+ */
+static void tcp_sack_update(tcp_socket_t *sock, const tcp_parsed_opts_t *opts) {
+    for (uint8_t n = 0; n < opts->sack_count; n++) {
+        uint32_t start = opts->sack[n].start;
+        uint32_t end = opts->sack[n].end;
+
+        if (!seq_lt(start, end) || seq_le(end, sock->snd_una) || seq_gt(end, sock->snd_max)) {
+            continue;
+        }
+        if (seq_lt(start, sock->snd_una)) {
+            start = sock->snd_una;
+        }
+
+        /* Absorb every range this one overlaps or touches */
+        uint8_t i = 0;
+        while (i < sock->sack_count) {
+            tcp_sack_block_t *b = &sock->sacked[i];
+            if (seq_le(b->start, end) && seq_ge(b->end, start)) {
+                start = seq_lt(b->start, start) ? b->start : start;
+                end = seq_gt(b->end, end) ? b->end : end;
+                tcp_sack_remove(sock, i);
+            } else {
+                i++;
+            }
+        }
+
+        if (sock->sack_count == TCP_SACK_MAX_BLOCKS) {
+            if (seq_gt(start, sock->sacked[TCP_SACK_MAX_BLOCKS - 1].start)) {
+                continue;
+            }
+            sock->sack_count--;
+        }
+        i = sock->sack_count;
+        while (i > 0 && seq_gt(sock->sacked[i - 1].start, start)) {
+            sock->sacked[i] = sock->sacked[i - 1];
+            i--;
+        }
+        sock->sacked[i].start = start;
+        sock->sacked[i].end = end;
+        sock->sack_count++;
+    }
+}
+
+/**
+ * Drop scoreboard ranges the cumulative ACK has passed
+ */
+static void tcp_sack_prune(tcp_socket_t *sock) {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < sock->sack_count; i++) {
+        tcp_sack_block_t b = sock->sacked[i];
+        if (seq_le(b.end, sock->snd_una)) {
+            continue;
+        }
+        if (seq_lt(b.start, sock->snd_una)) {
+            b.start = sock->snd_una;
+        }
+        sock->sacked[n++] = b;
+    }
+    sock->sack_count = n;
+}
+
+/**
+ * Bytes sent and still in the network: below snd_nxt, not acknowledged
+ * and not SACKed
+ */
+static uint32_t tcp_pipe(const tcp_socket_t *sock) {
+    uint32_t pipe = sock->snd_nxt - sock->snd_una;
+    for (uint8_t i = 0; i < sock->sack_count; i++) {
+        const tcp_sack_block_t *b = &sock->sacked[i];
+        if (seq_lt(b->start, sock->snd_nxt)) {
+            pipe -= (seq_lt(b->end, sock->snd_nxt) ? b->end : sock->snd_nxt) - b->start;
+        }
+    }
+    return pipe;
+}
+
+/**
+ * Resend the first range at or after rtx_next that the peer lacks, up to
+ * one MSS
+ * Without SACK that is only ever the segment at snd_una (NewReno); with
+ * SACK it is the next hole below the highest SACKed byte (RFC 6675).
+ * @return false if there was nothing to resend
+ */
+static bool tcp_retransmit_hole(tcp_socket_t *sock) {
+    uint32_t seq = sock->snd_una;
+    uint32_t limit = sock->snd_max;
+
+    if (sock->sack_count > 0 && seq_gt(sock->rtx_next, seq)) {
+        seq = sock->rtx_next;
+    }
+
+    for (uint8_t i = 0; i < sock->sack_count; i++) {
+        const tcp_sack_block_t *b = &sock->sacked[i];
+        if (seq_ge(seq, b->start) && seq_lt(seq, b->end)) {
+            seq = b->end;
+        } else if (seq_lt(seq, b->start)) {
+            limit = b->start;
+            break;
+        }
+    }
+    if (sock->sack_count > 0 && seq_ge(seq, sock->sacked[sock->sack_count - 1].end)) {
+        return false;
+    }
+    if (!seq_lt(seq, limit)) {
+        return false;
+    }
+
+    size_t queued = ring_buffer_used(&sock->send_buf);
+    size_t offset = seq - sock->snd_una;
+    size_t len = 0;
+    uint8_t flags = TCP_FLAG_ACK;
+    if (offset < queued) {
+        len = MIN(MIN((size_t)(limit - seq), queued - offset), tcp_seg_size(sock));
+    } else if (sock->flags & TCP_SOCK_FLAG_FIN_SENT) {
+        flags |= TCP_FLAG_FIN;      /* Only the FIN is left */
+    } else {
+        return false;
+    }
+
+    if (tcp_xmit(sock, seq, flags, NULL, len) != 0) {
+        return false;
+    }
+    sock->rtx_next = seq + (len ? (uint32_t)len : 1);
+    sock->rtt_timing = false;       /* Karn: no samples across a retransmission */
+    tcp_stats.retransmissions++;
+    return true;
+}
+
+/**
+ * Fast retransmit on the third duplicate ACK (RFC 5681, section 3.2)
+ */
+static void tcp_enter_recovery(tcp_socket_t *sock) {
+    uint32_t mss = sock->options.mss;
+
+    sock->ssthresh = MAX(tcp_pipe(sock) / 2, 2 * mss);
+    sock->recover = sock->snd_max;
+    sock->in_recovery = true;
+    sock->rtx_next = sock->snd_una;
+    tcp_retransmit_hole(sock);
+    tcp_stats.fast_retransmits++;
+
+    /*
+     * NewReno inflates the window by the segments that have left the
+     * network; with SACK the pipe estimate already leaves them out.
+     */
+    sock->cwnd = sock->ssthresh;
+    if (!(sock->flags & TCP_SOCK_FLAG_SACK_OK)) {
+        sock->cwnd += TCP_DUPACK_THRESH * mss;
+    }
+    sock->rtx_start = (uint32_t)clock_monotonic_ms();
+}
+
+/**
+ * Send one byte past a zero window so the peer says when it opens
+ */
+static void tcp_send_probe(tcp_socket_t *sock) {
+    if (sock->snd_nxt - sock->snd_una < ring_buffer_used(&sock->send_buf)) {
+        tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 1);
+    }
+}
+
+/**
+ * Retransmission timeout: back off, collapse the window to one segment
+ * and resend from snd_una (RFC 6298, section 5; RFC 5681, section 3.1)
+ */
+static void tcp_retransmit_timeout(tcp_socket_t *sock) {
+    uint32_t mss = sock->options.mss;
+
+    tcp_stats.timeouts++;
+    sock->rto = MIN(sock->rto * 2, (uint32_t)TCP_RTO_MAX);
+    sock->rtx_start = (uint32_t)clock_monotonic_ms();
+
+    /* Closed before the handshake finished: only the FIN follows the SYN */
+    if (sock->snd_una == sock->iss) {
+        tcp_xmit(sock, sock->snd_max - 1, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0);
+        return;
+    }
+
+    sock->ssthresh = MAX((sock->snd_max - sock->snd_una) / 2, 2 * mss);
+    sock->cwnd = mss;
+    sock->in_recovery = false;
+    sock->dupacks = 0;
+    sock->recover = sock->snd_max;
+    sock->rtt_timing = false;
+    sock->sack_count = 0;           /* The peer may drop what it SACKed (RFC 2018) */
+
+    sock->snd_nxt = sock->snd_una;
+    tcp_output(sock);
+    if (sock->snd_nxt == sock->snd_una) {
+        tcp_send_probe(sock);       /* The window is closed */
+    }
+    tcp_stats.retransmissions++;
+}
+
+/**
+ * Process the acknowledgment field of a segment
+ * Frees acknowledged data, takes RTT samples, grows the congestion window
+ * and runs fast retransmit and recovery (NewReno, or by SACK holes when
+ * the peer sends SACK blocks), then sends what the windows allow.
+ * @param dup_candidate The segment carries no data, SYN or FIN, so it
+ *        counts as a duplicate ACK if it acknowledges nothing new
+ */
+static void tcp_ack_process(tcp_socket_t *sock, uint32_t ack, uint32_t window,
+                            const tcp_parsed_opts_t *opts, bool dup_candidate) {
+    uint32_t mss = sock->options.mss;
+    uint32_t now = (uint32_t)clock_monotonic_ms();
+
+    if (seq_gt(ack, sock->snd_max)) {
+        /* Acknowledges something not yet sent */
+        tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+        return;
+    }
+    if (seq_lt(ack, sock->snd_una)) {
+        return;                     /* Old duplicate */
+    }
+
+    if (sock->flags & TCP_SOCK_FLAG_SACK_OK) {
+        tcp_sack_update(sock, opts);
+    }
+
+    if (seq_gt(ack, sock->snd_una)) {
+        uint32_t acked = ack - sock->snd_una;
+
+        ring_buffer_discard(&sock->send_buf, acked);
+        sock->snd_una = ack;
+        if (seq_lt(sock->snd_nxt, ack)) {
+            sock->snd_nxt = ack;
+        }
+        sock->retries = 0;
+        tcp_sack_prune(sock);
+
+        /* The echoed timestamp dates the segment even if it was resent (RFC 7323) */
+        if (sock->options.ts_ok && opts->syn.ts_ok && opts->ts_ecr != 0) {
+            tcp_rtt_sample(sock, now - opts->ts_ecr);
+            sock->rtt_timing = false;
+        } else if (sock->rtt_timing && seq_ge(ack, sock->rtt_seq)) {
+            tcp_rtt_sample(sock, now - sock->rtt_start);
+            sock->rtt_timing = false;
+        }
+
+        if (sock->in_recovery) {
+            if (seq_ge(ack, sock->recover)) {
+                /* Full acknowledgment ends recovery (RFC 6582, section 3.2) */
+                uint32_t flight = sock->snd_nxt - sock->snd_una;
+                sock->cwnd = MIN(sock->ssthresh, MAX(flight, mss) + mss);
+                sock->in_recovery = false;
+            } else {
+                /* Partial acknowledgment: the next hole was lost as well */
+                tcp_retransmit_hole(sock);
+                if (!(sock->flags & TCP_SOCK_FLAG_SACK_OK)) {
+                    sock->cwnd = sock->cwnd > acked ? sock->cwnd - acked : 0;
+                    sock->cwnd = MAX(sock->cwnd + (acked >= mss ? mss : 0), mss);
+                }
+            }
+        } else if (sock->cwnd < sock->ssthresh) {
+            sock->cwnd += MIN(acked, mss);                  /* Slow start */
+        } else {
+            sock->cwnd += MAX(mss * mss / sock->cwnd, 1U);  /* Congestion avoidance */
+        }
+
+        sock->dupacks = 0;
+        sock->rtx_start = now;
+        tcp_sndbuf_tune(sock);
+        if (tcp_can_send(sock)) {
+            poll_notify(&sock->poll, POLL_OUT);
+        }
+    } else if (dup_candidate && window == sock->snd_wnd && sock->snd_max != sock->snd_una) {
+        /* Duplicate ACK (RFC 5681, section 2) */
+        sock->dupacks++;
+        if (sock->in_recovery) {
+            if (!(sock->flags & TCP_SOCK_FLAG_SACK_OK)) {
+                sock->cwnd += mss;
+            } else if (tcp_pipe(sock) < sock->cwnd) {
+                tcp_retransmit_hole(sock);
+            }
+        } else if (sock->dupacks == TCP_DUPACK_THRESH && seq_ge(ack, sock->recover)) {
+            tcp_enter_recovery(sock);
+        }
+    }
+
+    if (window == 0 && sock->snd_wnd != 0) {
+        sock->rtx_start = now;      /* Start probing the closed window */
+    }
+    sock->snd_wnd = window;
+
+    tcp_output(sock);
+}
+
+/* ============================================================================
+ * TIME_WAIT Minisocks
+ * ============================================================================ */
+
+/**
+ * Find the minisock of a connection in TIME_WAIT
+ */
+static tcp_timewait_t *tcp_find_timewait(uint32_t local_ip, uint16_t local_port,
+                                         uint32_t remote_ip, uint16_t remote_port) {
+    uint64_t flags = tcp_lookup_begin();
+    tcp_timewait_t *tw = __atomic_load_n(&tcp_twhash[tcp_ehash_bucket(local_port, remote_ip,
+                                                                      remote_port)],
+                                         __ATOMIC_ACQUIRE);
+    for (; tw != NULL; tw = __atomic_load_n(&tw->hash_next, __ATOMIC_ACQUIRE)) {
+        if (tw->local_port == local_port && tw->remote_port == remote_port &&
+            (tw->local_ip == local_ip || tw->local_ip == 0) && tw->remote_ip == remote_ip) {
+            break;
+        }
+    }
+    tcp_lookup_end(flags);
+    return tw;
+}
+
+/**
+ * Unhash and free a minisock that is no longer in the timer wheel
+ */
+static void tcp_timewait_free(tcp_timewait_t *tw) {
+    uint64_t flags = tcp_hash_lock_acquire();
+    tcp_timewait_t **pp = &tcp_twhash[tcp_ehash_bucket(tw->local_port, tw->remote_ip,
+                                                       tw->remote_port)];
+    while (*pp && *pp != tw) {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp) {
+        __atomic_store_n(pp, tw->hash_next, __ATOMIC_RELEASE);
+    }
+    tcp_hash_lock_release(flags);
+
+    tcp_lookup_sync();
+    kmem_cache_free(tcp_timewait_cache, tw);
+}
+
+/**
+ * End of TIME_WAIT (timer wheel)
+ */
+static void tcp_timewait_expire(tcp_timewait_t *tw) {
+    kprintf("[TCP] TIME_WAIT expired\n");
+    tcp_timewait_free(tw);
+}
+
+/**
+ * ACK the peer's FIN again from a minisock
+ */
+static void tcp_timewait_ack(const tcp_timewait_t *tw) {
+    uint8_t segment[TCP_HEADER_MIN_LEN + TCP_OPT_TIMESTAMP_LEN];
+    tcp_header_t *hdr = (tcp_header_t *)segment;
+    size_t len = TCP_HEADER_MIN_LEN;
+
+    memset(hdr, 0, TCP_HEADER_MIN_LEN);
+    hdr->src_port = htons(tw->local_port);
+    hdr->dst_port = htons(tw->remote_port);
+    hdr->seq_num = htonl(tw->snd_nxt);
+    hdr->ack_num = htonl(tw->rcv_nxt);
+    hdr->flags = TCP_FLAG_ACK;
+    hdr->window = htons(tw->window);
+
+    if (tw->ts_ok) {
+        uint8_t *opt = segment + TCP_HEADER_MIN_LEN;
+        opt[0] = TCP_OPT_NOP;
+        opt[1] = TCP_OPT_NOP;
+        opt[2] = TCP_OPT_TIMESTAMP;
+        opt[3] = 10;
+        tcp_opt_put32(opt + 4, (uint32_t)clock_monotonic_ms());
+        tcp_opt_put32(opt + 8, tw->ts_recent);
+        len += TCP_OPT_TIMESTAMP_LEN;
+    }
+    hdr->data_offset = (uint8_t)((len / 4) << 4);
+
+    uint32_t local_ip = tw->local_ip ? tw->local_ip : ip_get_addr();
+    hdr->checksum = tcp_checksum(local_ip, tw->remote_ip, segment, len);
+
+    if (ip_send(tw->remote_ip, IP_PROTO_TCP, segment, len) == 0) {
+        tcp_stats.packets_sent++;
+    }
+}
+
+/**
+ * Handle a segment for a connection in TIME_WAIT
+ * A retransmitted FIN is ACKed again and restarts the timeout. A SYN with
+ * a higher sequence number ends TIME_WAIT early so a listener can take the
+ * new connection (RFC 1122, 4.2.2.13). An RST is ignored (RFC 1337).
+ * @return false if the segment should go on to a listener
+ */
+static bool tcp_timewait_segment(tcp_timewait_t *tw, uint8_t flags, uint32_t seq) {
+    if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST)) == TCP_FLAG_SYN &&
+        seq_gt(seq, tw->rcv_nxt)) {
+        /* If the timer is running right now, it frees the minisock */
+        if (tcp_wheel_del(&tw->timer)) {
+            tcp_timewait_free(tw);
+        }
+        return false;
+    }
+
+    if ((flags & TCP_FLAG_FIN) && !(flags & TCP_FLAG_RST)) {
+        tcp_timewait_ack(tw);
+        tcp_wheel_add(&tw->timer, TCP_TIME_WAIT_TIMEOUT);
+    }
+    return true;
+}
+
+/**
+ * Move a connection into TIME_WAIT
+ * A minisock takes over the 4-tuple and the timeout. The socket leaves the
+ * connection table and frees its buffers (the receive buffer only once it
+ * has been read); its owner frees it as before. Without memory for a
+ * minisock the socket waits out TIME_WAIT itself.
+ */
+static void tcp_enter_time_wait(tcp_socket_t *sock) {
+    tcp_timewait_t *tw = kmem_cache_zalloc(tcp_timewait_cache);
+
+    sock->time_wait_start = (uint32_t)clock_monotonic_ms();
+    if (tw) {
+        sock->flags |= TCP_SOCK_FLAG_TIMEWAIT_MINI;
+    }
+    tcp_set_state(sock, TCP_STATE_TIME_WAIT);
+    if (!tw) {
+        return;
+    }
+
+    tw->local_ip = sock->local_ip;
+    tw->remote_ip = sock->remote_ip;
+    tw->local_port = sock->local_port;
+    tw->remote_port = sock->remote_port;
+    tw->snd_nxt = sock->snd_max;
+    tw->rcv_nxt = sock->rcv_nxt;
+    tw->window = (uint16_t)MIN(sock->rcv_wnd >> sock->options.rcv_wscale,
+                               (uint32_t)TCP_MAX_WINDOW);
+    tw->ts_ok = sock->options.ts_ok;
+    tw->ts_recent = sock->options.ts_recent;
+    tw->timer.minisock = true;
+
+    uint64_t flags = tcp_hash_lock_acquire();
+    tcp_timewait_t **head = &tcp_twhash[tcp_ehash_bucket(tw->local_port, tw->remote_ip,
+                                                         tw->remote_port)];
+    tw->hash_next = *head;
+    __atomic_store_n(head, tw, __ATOMIC_RELEASE);
+    tcp_hash_lock_release(flags);
+    tcp_wheel_add(&tw->timer, TCP_TIME_WAIT_TIMEOUT);
+
+    tcp_ehash_del(sock);
+    ring_buffer_free(&sock->send_buf);
+    if (ring_buffer_used(&sock->recv_buf) == 0) {
+        ring_buffer_free(&sock->recv_buf);
+    }
+}
+
+/* ============================================================================
+ * Passive Open
+ * ============================================================================ */
+
+/**
+ * Keyed hash of a SYN for its cookie (24 bits)
+ */
+static uint32_t tcp_cookie_hash(uint32_t local_ip, uint16_t local_port, uint32_t remote_ip,
+                                uint16_t remote_port, uint32_t peer_isn, uint32_t slot) {
+    struct {
+        uint8_t secret[sizeof(tcp_cookie_secret)];
+        uint32_t local_ip;
+        uint32_t remote_ip;
+        uint16_t local_port;
+        uint16_t remote_port;
+        uint32_t peer_isn;
+        uint32_t slot;
+    } PACKED input;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint32_t value;
+
+    memcpy(input.secret, tcp_cookie_secret, sizeof(input.secret));
+    input.local_ip = local_ip;
+    input.remote_ip = remote_ip;
+    input.local_port = local_port;
+    input.remote_port = remote_port;
+    input.peer_isn = peer_isn;
+    input.slot = slot;
+    sha256_hash(&input, sizeof(input), hash);
+    memcpy(&value, hash, sizeof(value));
+    return value & TCP_COOKIE_HASH_MASK;
+}
+
+static inline uint32_t tcp_cookie_slot(void) {
+    return (uint32_t)(clock_monotonic_ms() >> TCP_COOKIE_SLOT_SHIFT) & 0x1F;
+}
+
+/**
+ * ISN that encodes a SYN for a SYN-ACK sent without keeping state
+ * @param mss Peer's MSS option (0 if none), rounded down to a table entry
+ */
+static uint32_t tcp_cookie_make(uint32_t local_ip, uint16_t local_port, uint32_t remote_ip,
+                                uint16_t remote_port, uint32_t peer_isn, uint16_t mss) {
+    uint16_t want = mss != 0 ? mss : TCP_MSS_DEFAULT;
+    uint32_t index = 0;
+    while (index + 1 < ARRAY_SIZE(tcp_cookie_mss) && tcp_cookie_mss[index + 1] <= want) {
+        index++;
+    }
+
+    uint32_t slot = tcp_cookie_slot();
+    return slot << 27 | index << 24 |
+           tcp_cookie_hash(local_ip, local_port, remote_ip, remote_port, peer_isn, slot);
+}
+
+/**
+ * Check the cookie an ACK returns
+ * @return MSS the cookie carries, or 0 if it is not one of ours or too old
+ */
+static uint16_t tcp_cookie_check(uint32_t local_ip, uint16_t local_port, uint32_t remote_ip,
+                                 uint16_t remote_port, uint32_t peer_isn, uint32_t cookie) {
+    uint32_t slot = cookie >> 27;
+    if (((tcp_cookie_slot() - slot) & 0x1F) >= TCP_COOKIE_SLOTS_VALID) {
+        return 0;
+    }
+    if ((cookie & TCP_COOKIE_HASH_MASK) !=
+        tcp_cookie_hash(local_ip, local_port, remote_ip, remote_port, peer_isn, slot)) {
+        return 0;
+    }
+    return tcp_cookie_mss[(cookie >> 24) & 0x7];
+}
+
+/**
+ * Send a SYN-ACK carrying a cookie (stateless, like tcp_send_rst)
+ * Only the MSS fits in the cookie, so no other option is answered.
+ */
+static void tcp_send_cookie_synack(uint32_t src_ip, uint32_t dst_ip,
+                                   uint16_t src_port, uint16_t dst_port,
+                                   uint32_t seq, uint32_t ack) {
+    uint8_t segment[TCP_HEADER_MIN_LEN + 4];
+    tcp_header_t *hdr = (tcp_header_t *)segment;
+
+    memset(hdr, 0, TCP_HEADER_MIN_LEN);
+    hdr->src_port = htons(src_port);
+    hdr->dst_port = htons(dst_port);
+    hdr->seq_num = htonl(seq);
+    hdr->ack_num = htonl(ack);
+    hdr->data_offset = (sizeof(segment) / 4) << 4;
+    hdr->flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+    hdr->window = htons(TCP_DEFAULT_WINDOW);
+
+    uint8_t *opt = segment + TCP_HEADER_MIN_LEN;
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    opt[2] = TCP_MSS_DEFAULT >> 8;
+    opt[3] = TCP_MSS_DEFAULT & 0xFF;
+
+    uint32_t local_ip = src_ip ? src_ip : ip_get_addr();
+    hdr->checksum = tcp_checksum(local_ip, dst_ip, segment, sizeof(segment));
+
+    if (ip_send(dst_ip, IP_PROTO_TCP, segment, sizeof(segment)) == 0) {
+        tcp_stats.packets_sent++;
+        tcp_stats.syn_cookies_sent++;
+    }
+}
+
+/**
+ * Create the socket of a passive connection, not yet in any table but
+ * the bound port table
+ */
+static tcp_socket_t *tcp_child_create(tcp_socket_t *listener, uint32_t local_ip,
+                                      uint32_t remote_ip, uint16_t remote_port,
+                                      uint32_t irs, uint32_t iss,
+                                      const tcp_syn_options_t *syn) {
+    tcp_socket_t *sock = tcp_socket_create();
+    if (!sock) {
+        return NULL;
+    }
+
+    sock->local_ip = local_ip ? local_ip : listener->local_ip;
+    sock->local_port = listener->local_port;
+    sock->remote_ip = remote_ip;
+    sock->remote_port = remote_port;
+
+    sock->iss = iss;
+    sock->snd_una = iss;
+    sock->snd_nxt = iss;
+    sock->snd_max = iss;
+    sock->irs = irs;
+    sock->rcv_nxt = irs + 1;  /* SYN consumes one sequence */
+    sock->sndbuf_max = listener->sndbuf_max;
+    sock->rcvbuf_max = listener->rcvbuf_max;
+    sock->options.rcv_wscale = tcp_wscale_for(sock->rcvbuf_max);
+    sock->options.no_delay = listener->options.no_delay;
+    sock->options.cork = listener->options.cork;
+    tcp_apply_syn_options(sock, syn);
+
+    uint64_t flags = tcp_hash_lock_acquire();
+    sock->flags |= TCP_SOCK_FLAG_BOUND | (listener->flags & TCP_SOCK_FLAG_REUSEPORT);
+    tcp_bhash_add(sock);
+    tcp_hash_lock_release(flags);
+    return sock;
+}
+
+/**
+ * Answer a SYN on a listener
+ * The connection waits out the handshake on the SYN queue. With that
+ * queue full, or no memory for the socket, the SYN-ACK carries a cookie
+ * and nothing is kept; a full accept queue drops the SYN instead.
+ */
+static void tcp_listen_syn(tcp_socket_t *sock, uint32_t dst_ip, uint32_t src_ip,
+                           uint16_t src_port, uint32_t seq, const tcp_syn_options_t *syn) {
+    if (!tcp_accept_room(sock)) {
+        return;
+    }
+
+    uint64_t flags = tcp_queue_lock_acquire(sock);
+    bool cookie = sock->syn_queue.count >= sock->syn_backlog;
+    tcp_queue_lock_release(sock, flags);
+
+    tcp_socket_t *child = NULL;
+    if (!cookie) {
+        uint32_t iss = tcp_generate_isn(dst_ip, sock->local_port, src_ip, src_port);
+        child = tcp_child_create(sock, dst_ip, src_ip, src_port, seq, iss, syn);
+    }
+
+    if (!child) {
+        sock->cookie_until = (uint32_t)clock_monotonic_ms() +
+                             (TCP_COOKIE_SLOTS_VALID << TCP_COOKIE_SLOT_SHIFT);
+        uint32_t iss = tcp_cookie_make(dst_ip, sock->local_port, src_ip, src_port, seq,
+                                       syn->mss);
+        tcp_send_cookie_synack(dst_ip, src_ip, sock->local_port, src_port, iss, seq + 1);
+        log_event(SERIAL_LOG_DEBUG, "TCP", "SYN queue full on port %d, sent cookie\n",
+                  sock->local_port);
+        return;
+    }
+
+    /* Queued and findable before the SYN-ACK can draw the ACK */
+    tcp_set_state(child, TCP_STATE_SYN_RECEIVED);
+    flags = tcp_queue_lock_acquire(sock);
+    tcp_queue_push(sock, &sock->syn_queue, child);
+    tcp_queue_lock_release(sock, flags);
+    tcp_ehash_add(child);
+    tcp_send_segment(child, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
+
+    kprintf("[TCP] Connection request queued from %d.%d.%d.%d:%d\n",
+            (src_ip >> 24) & 0xFF, (src_ip >> 16) & 0xFF,
+            (src_ip >> 8) & 0xFF, src_ip & 0xFF, src_port);
+}
+
+/**
+ * Complete a handshake from a cookie an ACK returns to a listener
+ * Only while the listener has been sending cookies recently; any other
+ * stray ACK is ignored.
+ */
+static void tcp_listen_ack(tcp_socket_t *sock, uint32_t dst_ip, uint32_t src_ip,
+                           uint16_t src_port, uint32_t seq, uint32_t ack, uint32_t window) {
+    if ((int32_t)(sock->cookie_until - (uint32_t)clock_monotonic_ms()) <= 0) {
+        return;
+    }
+
+    tcp_syn_options_t syn = { .wscale = -1 };
+    syn.mss = tcp_cookie_check(dst_ip, sock->local_port, src_ip, src_port, seq - 1, ack - 1);
+    if (syn.mss == 0 || !tcp_accept_room(sock)) {
+        return;
+    }
+
+    tcp_socket_t *child = tcp_child_create(sock, dst_ip, src_ip, src_port, seq - 1, ack - 1,
+                                           &syn);
+    if (!child) {
+        return;
+    }
+    child->snd_una = ack;
+    child->snd_nxt = ack;
+    child->snd_max = ack;
+    child->snd_wnd = window;
+
+    tcp_cc_init(child);
+    tcp_set_state(child, TCP_STATE_ESTABLISHED);
+    child->flags |= TCP_SOCK_FLAG_CONNECTED;
+    tcp_ehash_add(child);
+
+    uint64_t flags = tcp_queue_lock_acquire(sock);
+    tcp_queue_push(sock, &sock->accept_queue, child);
+    tcp_queue_lock_release(sock, flags);
+
+    tcp_stats.syn_cookies_ok++;
+    tcp_stats.connections_established++;
+    poll_notify(&sock->poll, POLL_IN);
+    kprintf("[TCP] Connection established from SYN cookie (MSS %u)\n", syn.mss);
+}
+
+/* ============================================================================
+ * API Implementation
+ * ============================================================================ */
+
+/**
  * Initialize the TCP layer
  */
 void tcp_init(void) {
     kprintf("[TCP] Initializing TCP subsystem\n");
 
     tcp_socket_list = NULL;
+    tcp_socket_count = 0;
     tcp_next_ephemeral_port = 49152;
-    tcp_isn_counter = tcp_generate_isn();
+    memset(tcp_ehash, 0, sizeof(tcp_ehash));
+    memset(tcp_lhash, 0, sizeof(tcp_lhash));
+    memset(tcp_bhash, 0, sizeof(tcp_bhash));
+    memset(tcp_twhash, 0, sizeof(tcp_twhash));
+    memset(tcp_wheel, 0, sizeof(tcp_wheel));
+    tcp_wheel_count = 0;
+    tcp_wheel_clock = clock_monotonic_ms() / TCP_WHEEL_TICK;
+
+    if (!tcp_socket_cache) {
+        tcp_socket_cache = kmem_cache_create("tcp_socket", sizeof(tcp_socket_t), 0, NULL);
+    }
+    if (!tcp_timewait_cache) {
+        tcp_timewait_cache = kmem_cache_create("tcp_timewait", sizeof(tcp_timewait_t), 0,
+                                               NULL);
+    }
+    random_get_bytes(tcp_isn_secret, sizeof(tcp_isn_secret));
+    random_get_bytes(tcp_cookie_secret, sizeof(tcp_cookie_secret));
 
     memset(&tcp_stats, 0, sizeof(tcp_stats));
+    ktimer_init_soft(&tcp_timer, tcp_timer_expired, NULL);
 
-    kprintf("[TCP] TCP initialized, ISN base: %u\n", tcp_isn_counter);
+    kprintf("[TCP] TCP initialized\n");
 }
 
 /**
  * Create a new TCP socket
  */
 tcp_socket_t *tcp_socket_create(void) {
-    tcp_socket_t *sock = kcalloc(1, sizeof(tcp_socket_t));
+    tcp_socket_t *sock = kmem_cache_zalloc(tcp_socket_cache);
     if (!sock) {
         kprintf("[TCP] Failed to allocate socket\n");
         return NULL;
@@ -487,14 +2106,14 @@ tcp_socket_t *tcp_socket_create(void) {
 
     /* Initialize buffers */
     if (!ring_buffer_init(&sock->send_buf, TCP_SEND_BUF_SIZE)) {
-        kfree(sock);
+        kmem_cache_free(tcp_socket_cache, sock);
         kprintf("[TCP] Failed to allocate send buffer\n");
         return NULL;
     }
 
     if (!ring_buffer_init(&sock->recv_buf, TCP_RECV_BUF_SIZE)) {
         ring_buffer_free(&sock->send_buf);
-        kfree(sock);
+        kmem_cache_free(tcp_socket_cache, sock);
         kprintf("[TCP] Failed to allocate receive buffer\n");
         return NULL;
     }
@@ -504,10 +2123,18 @@ tcp_socket_t *tcp_socket_create(void) {
     sock->rcv_wnd = TCP_DEFAULT_WINDOW;
     sock->rto = TCP_RETRANSMIT_TIMEOUT;
     sock->options.mss = TCP_MSS_DEFAULT;
-    sock->last_activity = (uint32_t)pit_get_uptime_ms();
+    sock->sndbuf_max = TCP_SEND_BUF_MAX;
+    sock->rcvbuf_max = TCP_RECV_BUF_MAX;
+    sock->last_activity = (uint32_t)clock_monotonic_ms();
 
     /* Add to socket list */
-    tcp_socket_list_add(sock);
+    if (!tcp_socket_list_add(sock)) {
+        ring_buffer_free(&sock->recv_buf);
+        ring_buffer_free(&sock->send_buf);
+        kmem_cache_free(tcp_socket_cache, sock);
+        kprintf("[TCP] Socket limit (%d) reached\n", TCP_MAX_SOCKETS);
+        return NULL;
+    }
 
     kprintf("[TCP] Created new socket\n");
     return sock;
@@ -523,23 +2150,21 @@ void tcp_socket_destroy(tcp_socket_t *sock) {
 
     kprintf("[TCP] Destroying socket (state: %s)\n", tcp_state_name(sock->state));
 
-    /* Remove from socket list */
+    /* Remove from socket list, the timer wheel and the listener's queue */
     tcp_socket_list_remove(sock);
+    tcp_wheel_del(&sock->timer);
+    tcp_child_detach(sock);
+    poll_source_detach(&sock->poll);
 
-    /* Free pending connections if listening socket */
-    tcp_pending_conn_t *pending = sock->pending_head;
-    while (pending) {
-        tcp_pending_conn_t *next = pending->next;
-        kfree(pending);
-        pending = next;
-    }
+    /* Reset the connections a listener leaves unaccepted */
+    tcp_listen_flush(sock);
 
     /* Free buffers */
     ring_buffer_free(&sock->send_buf);
     ring_buffer_free(&sock->recv_buf);
 
     /* Free socket */
-    kfree(sock);
+    kmem_cache_free(tcp_socket_cache, sock);
 }
 
 /**
@@ -555,33 +2180,46 @@ int tcp_bind(tcp_socket_t *sock, uint16_t port) {
         return TCP_ERR_INVALID;
     }
 
+    uint64_t flags = tcp_hash_lock_acquire();
+
     /* Allocate ephemeral port if 0 */
     if (port == 0) {
         port = tcp_alloc_ephemeral_port();
         if (port == 0) {
+            tcp_hash_lock_release(flags);
             kprintf("[TCP] No ephemeral ports available\n");
             return TCP_ERR_INUSE;
         }
-    } else {
-        /* Check if port is already in use */
-        for (tcp_socket_t *s = tcp_socket_list; s != NULL; s = s->next) {
-            if (s != sock && s->local_port == port &&
-                (s->state == TCP_STATE_LISTEN ||
-                 (s->flags & TCP_SOCK_FLAG_BOUND))) {
-                kprintf("[TCP] Port %d already in use\n", port);
-                return TCP_ERR_INUSE;
-            }
-        }
+    } else if (tcp_port_in_use(port, sock, true)) {
+        tcp_hash_lock_release(flags);
+        kprintf("[TCP] Port %d already in use\n", port);
+        return TCP_ERR_INUSE;
     }
 
     sock->local_port = port;
     sock->local_ip = ip_get_addr();  /* Bind to our IP */
     sock->flags |= TCP_SOCK_FLAG_BOUND;
+    tcp_bhash_add(sock);
+    tcp_hash_lock_release(flags);
 
     kprintf("[TCP] Bound to port %d\n", port);
     return TCP_OK;
 }
 
+/**
+ * Let the socket share its port with other SO_REUSEPORT sockets
+ */
+void tcp_set_reuseport(tcp_socket_t *sock, bool reuse) {
+    if (!sock || (sock->flags & TCP_SOCK_FLAG_BOUND)) {
+        return;
+    }
+    if (reuse) {
+        sock->flags |= TCP_SOCK_FLAG_REUSEPORT;
+    } else {
+        sock->flags &= ~TCP_SOCK_FLAG_REUSEPORT;
+    }
+}
+
 /**
  * Start listening for connections
  */
@@ -608,11 +2246,14 @@ int tcp_listen(tcp_socket_t *sock, int backlog) {
     }
 
     sock->backlog = backlog;
-    sock->pending_count = 0;
-    sock->pending_head = NULL;
+    sock->syn_backlog = backlog * TCP_SYN_BACKLOG_FACTOR;
+    sock->syn_queue = (tcp_conn_queue_t){0};
+    sock->accept_queue = (tcp_conn_queue_t){0};
+    sock->cookie_until = 0;
     sock->flags |= TCP_SOCK_FLAG_LISTENING;
 
     tcp_set_state(sock, TCP_STATE_LISTEN);
+    tcp_lhash_add(sock);
 
     kprintf("[TCP] Listening on port %d (backlog: %d)\n", sock->local_port, backlog);
     return TCP_OK;
@@ -626,42 +2267,17 @@ tcp_socket_t *tcp_accept(tcp_socket_t *sock) {
         return NULL;
     }
 
-    /* Check for pending connections */
-    tcp_pending_conn_t *pending = sock->pending_head;
-    if (!pending) {
-        return NULL;  /* No pending connections */
+    uint64_t flags = tcp_queue_lock_acquire(sock);
+    tcp_socket_t *new_sock = sock->accept_queue.head;
+    if (new_sock) {
+        tcp_queue_unlink(new_sock);
     }
+    tcp_queue_lock_release(sock, flags);
 
-    /* Create new socket for the connection */
-    tcp_socket_t *new_sock = tcp_socket_create();
     if (!new_sock) {
-        return NULL;
+        return NULL;  /* No pending connections */
     }
 
-    /* Setup the new socket */
-    new_sock->local_ip = sock->local_ip;
-    new_sock->local_port = sock->local_port;
-    new_sock->remote_ip = pending->remote_ip;
-    new_sock->remote_port = pending->remote_port;
-
-    /* Initialize sequence numbers */
-    new_sock->iss = tcp_generate_isn();
-    new_sock->snd_una = new_sock->iss;
-    new_sock->snd_nxt = new_sock->iss;
-    new_sock->irs = pending->seq_num;
-    new_sock->rcv_nxt = pending->seq_num + 1;  /* SYN consumes one sequence */
-
-    new_sock->flags |= TCP_SOCK_FLAG_BOUND;
-
-    /* Send SYN-ACK */
-    tcp_set_state(new_sock, TCP_STATE_SYN_RECEIVED);
-    tcp_send_segment(new_sock, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
-
-    /* Remove from pending list */
-    sock->pending_head = pending->next;
-    sock->pending_count--;
-    kfree(pending);
-
     kprintf("[TCP] Accepted connection from %d.%d.%d.%d:%d\n",
             (new_sock->remote_ip >> 24) & 0xFF, (new_sock->remote_ip >> 16) & 0xFF,
             (new_sock->remote_ip >> 8) & 0xFF, new_sock->remote_ip & 0xFF,
@@ -692,13 +2308,26 @@ int tcp_connect(tcp_socket_t *sock, uint32_t remote_ip, uint16_t remote_port) {
     }
 
     /* Set remote endpoint */
+    /* A socket connecting again moves to the bucket of its new endpoint */
+    tcp_ehash_del(sock);
+    if ((remote_ip >> 24) == 127) {
+        sock->local_ip = IP_ADDR_LOOPBACK;  /* The source loopback packets carry */
+    }
     sock->remote_ip = remote_ip;
     sock->remote_port = remote_port;
+    tcp_ehash_add(sock);
 
     /* Initialize sequence numbers */
-    sock->iss = tcp_generate_isn();
+    sock->iss = tcp_generate_isn(sock->local_ip, sock->local_port,
+                                 sock->remote_ip, sock->remote_port);
     sock->snd_una = sock->iss;
     sock->snd_nxt = sock->iss;
+    sock->snd_max = sock->iss;
+    sock->options.mss = TCP_MSS_DEFAULT;
+    sock->options.rcv_wscale = tcp_wscale_for(sock->rcvbuf_max);
+    sock->options.wscale_ok = false;
+    sock->options.ts_ok = false;
+    sock->flags &= ~(TCP_SOCK_FLAG_SACK_OK | TCP_SOCK_FLAG_FIN_PENDING | TCP_SOCK_FLAG_FIN_SENT);
 
     /* Transition to SYN_SENT and send SYN */
     tcp_set_state(sock, TCP_STATE_SYN_SENT);
@@ -716,6 +2345,45 @@ int tcp_connect(tcp_socket_t *sock, uint32_t remote_ip, uint16_t remote_port) {
     return TCP_OK;
 }
 
+/**
+ * Copy data straight into the receive buffer of a peer on this host
+ * Only while nothing is queued or in flight either way, so the bytes are
+ * next in both sequence spaces and leave them consistent.
+ * @return Bytes copied, 0 to use the normal path
+ */
+static ssize_t tcp_splice(tcp_socket_t *sock, const void *data, size_t len) {
+    if (sock->state != TCP_STATE_ESTABLISHED || !ip_is_loopback(sock->remote_ip) ||
+        ring_buffer_used(&sock->send_buf) > 0 || sock->snd_nxt != sock->snd_una) {
+        return 0;
+    }
+
+    tcp_socket_t *peer = tcp_find_socket(sock->remote_ip, sock->remote_port,
+                                         sock->local_ip ? sock->local_ip : ip_get_addr(),
+                                         sock->local_port);
+    if (!peer || peer == sock || peer->state != TCP_STATE_ESTABLISHED ||
+        peer->rcv_nxt != sock->snd_nxt) {
+        return 0;
+    }
+
+    size_t written = ring_buffer_write(&peer->recv_buf, data, len);
+    if (written == 0) {
+        return 0;
+    }
+
+    sock->snd_nxt += written;
+    sock->snd_una = sock->snd_nxt;
+    sock->snd_max = sock->snd_nxt;
+    sock->last_activity = (uint32_t)clock_monotonic_ms();
+    peer->rcv_nxt += written;
+    peer->rcv_wnd = (uint32_t)ring_buffer_space(&peer->recv_buf);
+    peer->last_activity = sock->last_activity;
+
+    tcp_stats.bytes_sent += written;
+    tcp_stats.bytes_received += written;
+    poll_notify(&peer->poll, POLL_IN);
+    return (ssize_t)written;
+}
+
 /**
  * Send data over TCP connection
  */
@@ -733,6 +2401,13 @@ ssize_t tcp_send(tcp_socket_t *sock, const void *data, size_t len) {
         return 0;
     }
 
+    if (sock->options.splice) {
+        ssize_t spliced = tcp_splice(sock, data, len);
+        if (spliced > 0) {
+            return spliced;
+        }
+    }
+
     /* Write to send buffer */
     size_t written = ring_buffer_write(&sock->send_buf, data, len);
     if (written == 0) {
@@ -748,6 +2423,39 @@ ssize_t tcp_send(tcp_socket_t *sock, const void *data, size_t len) {
     return (ssize_t)written;
 }
 
+/**
+ * Queue data a producer writes straight into the send buffer
+ */
+ssize_t tcp_send_fill(tcp_socket_t *sock, tcp_fill_fn_t fill, void *ctx, size_t len) {
+    if (!sock || !fill) {
+        return TCP_ERR_INVALID;
+    }
+
+    if (!tcp_can_send(sock)) {
+        kprintf("[TCP] Cannot send in state %s\n", tcp_state_name(sock->state));
+        return TCP_ERR_NOTCONN;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (ring_buffer_space(&sock->send_buf) == 0) {
+        if (sock->flags & TCP_SOCK_FLAG_NONBLOCK) {
+            return TCP_ERR_WOULDBLOCK;
+        }
+        return TCP_ERR_NOBUFS;
+    }
+
+    ssize_t written = ring_buffer_fill(&sock->send_buf, fill, ctx, len);
+    if (written < 0) {
+        return TCP_ERR_IO;
+    }
+
+    tcp_output(sock);
+    return written;
+}
+
 /**
  * Receive data from TCP connection
  */
@@ -808,17 +2516,28 @@ int tcp_close(tcp_socket_t *sock) {
             return TCP_OK;
 
         case TCP_STATE_SYN_RECEIVED:
+            /* Nothing can be queued yet: send FIN, wait for ACK and FIN from remote */
+            tcp_set_state(sock, TCP_STATE_FIN_WAIT_1);
+            if (tcp_send_segment(sock, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0) == 0) {
+                sock->flags |= TCP_SOCK_FLAG_FIN_SENT;
+            }
+            sock->flags |= TCP_SOCK_FLAG_FIN_PENDING;
+            tcp_stats.connections_closed++;
+            return TCP_OK;
+
         case TCP_STATE_ESTABLISHED:
-            /* Send FIN, wait for ACK and FIN from remote */
+            /* FIN follows the queued data, then wait for ACK and FIN from remote */
             tcp_set_state(sock, TCP_STATE_FIN_WAIT_1);
-            tcp_send_segment(sock, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0);
+            sock->flags |= TCP_SOCK_FLAG_FIN_PENDING;
+            tcp_output(sock);
             tcp_stats.connections_closed++;
             return TCP_OK;
 
         case TCP_STATE_CLOSE_WAIT:
-            /* Remote already sent FIN, send our FIN */
+            /* Remote already sent FIN, send our FIN after the queued data */
             tcp_set_state(sock, TCP_STATE_LAST_ACK);
-            tcp_send_segment(sock, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0);
+            sock->flags |= TCP_SOCK_FLAG_FIN_PENDING;
+            tcp_output(sock);
             tcp_stats.connections_closed++;
             return TCP_OK;
 
@@ -861,56 +2580,99 @@ void tcp_abort(tcp_socket_t *sock) {
  * ============================================================================ */
 
 /**
- * Send pending data from send buffer
+ * Check if a segment shorter than the MSS may go out now
+ * A short piece of a longer queue never goes while data is in flight
+ * (sender silly window avoidance). The short tail of the queue waits for
+ * the data in flight to be acknowledged (Nagle, RFC 896) unless TCP_NODELAY
+ * is set, and always waits while TCP_CORK is set. A pending FIN flushes it.
  */
-void tcp_output(tcp_socket_t *sock) {
-    if (!sock || !tcp_can_send(sock)) {
-        return;
+static bool tcp_short_segment_ok(const tcp_socket_t *sock, bool tail, bool in_flight) {
+    if (!tail) {
+        return !in_flight;
     }
+    if (sock->flags & TCP_SOCK_FLAG_FIN_PENDING) {
+        return true;
+    }
+    if (sock->options.cork) {
+        return false;
+    }
+    return sock->options.no_delay || !in_flight;
+}
 
-    /* Check if there's data to send */
-    size_t pending = ring_buffer_used(&sock->send_buf);
-    if (pending == 0) {
+/**
+ * Send queued data while the congestion and receive windows allow it,
+ * then the FIN once everything queued has gone out
+ * Data stays in the send buffer until it is acknowledged.
+ */
+void tcp_output(tcp_socket_t *sock) {
+    if (!sock || !tcp_state_sending(sock->state)) {
         return;
     }
 
-    /* Calculate how much we can send (limited by window and MSS) */
-    size_t window = sock->snd_wnd;
-    size_t mss = sock->options.mss;
-    size_t to_send = pending;
-
-    if (to_send > window) {
-        to_send = window;
-    }
-    if (to_send > mss) {
-        to_send = mss;
+    /*
+     * A device with TSO takes up to TCP_TSO_MAX_LEN at once and cuts it
+     * into MSS sized segments itself.
+     */
+    size_t mss = tcp_seg_size(sock);
+    size_t seg_max = mss;
+    if ((ip_offloads(sock->remote_ip) & (ETH_OFFLOAD_TSO | ETH_OFFLOAD_TX_CSUM)) ==
+        (ETH_OFFLOAD_TSO | ETH_OFFLOAD_TX_CSUM)) {
+        seg_max = TCP_TSO_MAX_LEN;
     }
+    uint32_t window = MIN(sock->cwnd, sock->snd_wnd);
 
-    if (to_send == 0) {
-        return;  /* Window is closed */
-    }
+    for (;;) {
+        size_t queued = ring_buffer_used(&sock->send_buf);
+        size_t sent = sock->snd_nxt - sock->snd_una;
+        if (sent > queued) {
+            break;                  /* The FIN is out */
+        }
 
-    /* Read data from send buffer */
-    uint8_t *data = kmalloc(to_send);
-    if (!data) {
-        return;
-    }
+        size_t unsent = queued - sent;
+        if (unsent == 0) {
+            if ((sock->flags & TCP_SOCK_FLAG_FIN_PENDING) &&
+                tcp_send_segment(sock, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0) == 0) {
+                sock->flags |= TCP_SOCK_FLAG_FIN_SENT;
+                if (sent == 0) {
+                    sock->rtx_start = (uint32_t)clock_monotonic_ms();
+                }
+            }
+            break;
+        }
 
-    /* Peek data (don't remove until ACKed) */
-    size_t actual = ring_buffer_peek(&sock->send_buf, data, to_send);
+        uint32_t pipe = tcp_pipe(sock);
+        if (pipe >= window) {
+            break;
+        }
+        size_t len = MIN(MIN(unsent, (size_t)(window - pipe)), seg_max);
 
-    /* Send segment with PSH flag if this is the end of data */
-    uint8_t flags = TCP_FLAG_ACK;
-    if (actual == pending) {
-        flags |= TCP_FLAG_PSH;  /* Push - no more data buffered */
-    }
+        if (len < mss && !tcp_short_segment_ok(sock, len == unsent, sent > 0)) {
+            break;
+        }
+
+        uint8_t flags = TCP_FLAG_ACK;
+        if (len == unsent) {
+            flags |= TCP_FLAG_PSH;  /* Push - no more data buffered */
+        }
 
-    tcp_send_segment(sock, flags, data, actual);
+        uint32_t seq = sock->snd_nxt;
+        bool fresh = !seq_lt(seq, sock->snd_max);
+        if (tcp_send_segment(sock, flags, NULL, len) != 0) {
+            break;
+        }
 
-    /* Actually consume data from buffer (simplified - real impl would wait for ACK) */
-    ring_buffer_read(&sock->send_buf, data, actual);
+        uint32_t now = (uint32_t)clock_monotonic_ms();
+        if (sent == 0) {
+            sock->rtx_start = now;  /* The timer runs from the oldest byte in flight */
+        }
+        if (fresh && !sock->rtt_timing) {
+            sock->rtt_seq = seq + (uint32_t)len;
+            sock->rtt_start = now;
+            sock->rtt_timing = true;
+        }
+    }
 
-    kfree(data);
+    tcp_timer_update(sock);
 }
 
 /* ============================================================================
@@ -921,8 +2683,18 @@ void tcp_output(tcp_socket_t *sock) {
  * Process incoming TCP packet
  */
 int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip) {
+    return tcp_receive_offload(packet, len, src_ip, dst_ip, 0);
+}
+
+/**
+ * Process incoming TCP packet, trusting a checksum the device verified
+ */
+int tcp_receive_offload(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip,
+                        uint32_t offload) {
+    nettrace_event(NETTRACE_TCP_RX, len);
+
     if (!packet || len < TCP_HEADER_MIN_LEN) {
-        kprintf("[TCP] Invalid packet (too short)\n");
+        log_event(SERIAL_LOG_WARN, "TCP", "Invalid packet (too short)\n");
         return -1;
     }
 
@@ -931,27 +2703,30 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
     /* Validate header length */
     uint8_t header_len = tcp_get_header_len(hdr);
     if (header_len < TCP_HEADER_MIN_LEN || header_len > len) {
-        kprintf("[TCP] Invalid header length: %d\n", header_len);
-        return -1;
-    }
-
-    /* Verify checksum */
-    uint16_t received_checksum = hdr->checksum;
-    tcp_header_t *hdr_copy = (tcp_header_t *)kmalloc(len);
-    if (!hdr_copy) {
+        log_event(SERIAL_LOG_WARN, "TCP", "Invalid header length: %d\n", header_len);
         return -1;
     }
-    memcpy(hdr_copy, packet, len);
-    hdr_copy->checksum = 0;
 
-    uint16_t calc_checksum = tcp_checksum(src_ip, dst_ip, hdr_copy, len);
-    kfree(hdr_copy);
-
-    if (received_checksum != calc_checksum) {
-        kprintf("[TCP] Checksum mismatch (received: %04X, calculated: %04X)\n",
-                received_checksum, calc_checksum);
-        tcp_stats.checksum_errors++;
-        return -1;
+    /* Verify checksum, unless the device did */
+    if (!(offload & NETBUF_FLAG_CSUM_L4_OK)) {
+        uint16_t received_checksum = hdr->checksum;
+        tcp_header_t *hdr_copy = (tcp_header_t *)kmalloc(len);
+        if (!hdr_copy) {
+            return -1;
+        }
+        memcpy(hdr_copy, packet, len);
+        hdr_copy->checksum = 0;
+
+        uint16_t calc_checksum = tcp_checksum(src_ip, dst_ip, hdr_copy, len);
+        kfree(hdr_copy);
+
+        if (received_checksum != calc_checksum) {
+            log_event(SERIAL_LOG_WARN, "TCP",
+                      "Checksum mismatch (received: %04X, calculated: %04X)\n",
+                      received_checksum, calc_checksum);
+            tcp_stats.checksum_errors++;
+            return -1;
+        }
     }
 
     /* Extract header fields */
@@ -964,23 +2739,26 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
 
     tcp_stats.packets_received++;
 
-    kprintf("[TCP] Received: %d.%d.%d.%d:%d -> port %d, seq=%u, ack=%u, flags=%02X\n",
-            (src_ip >> 24) & 0xFF, (src_ip >> 16) & 0xFF,
-            (src_ip >> 8) & 0xFF, src_ip & 0xFF,
-            src_port, dst_port, seq, ack, flags);
+    log_event(SERIAL_LOG_DEBUG, "TCP",
+              "Received: %08X:%d -> port %d, seq=%u, ack=%u, flags=%02X\n",
+              src_ip, src_port, dst_port, seq, ack, flags);
 
     /* Find matching socket */
     tcp_socket_t *sock = tcp_find_socket(dst_ip, dst_port, src_ip, src_port);
 
-    /* Check for listening socket if no exact match */
+    /* Then for a connection in TIME_WAIT, then for a listening socket */
     if (!sock) {
+        tcp_timewait_t *tw = tcp_find_timewait(dst_ip, dst_port, src_ip, src_port);
+        if (tw && tcp_timewait_segment(tw, flags, seq)) {
+            return 0;
+        }
         sock = tcp_find_listener(dst_port);
     }
 
     /* No socket found - send RST */
     if (!sock) {
         if (!(flags & TCP_FLAG_RST)) {
-            kprintf("[TCP] No socket for port %d, sending RST\n", dst_port);
+            log_event(SERIAL_LOG_DEBUG, "TCP", "No socket for port %d, sending RST\n", dst_port);
             if (flags & TCP_FLAG_ACK) {
                 tcp_send_rst(dst_ip, src_ip, dst_port, src_port, ack, 0);
             } else {
@@ -992,10 +2770,13 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
 
     /* Process RST */
     if (flags & TCP_FLAG_RST) {
-        kprintf("[TCP] Received RST\n");
+        log_event(SERIAL_LOG_DEBUG, "TCP", "Received RST\n");
         if (sock->state != TCP_STATE_LISTEN) {
             tcp_set_state(sock, TCP_STATE_CLOSED);
         }
+        if (tcp_in_syn_queue(sock)) {
+            tcp_socket_destroy(sock);
+        }
         return 0;
     }
 
@@ -1003,6 +2784,34 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
     const uint8_t *data = (const uint8_t *)packet + header_len;
     size_t data_len = len - header_len;
 
+    tcp_parsed_opts_t opts;
+    tcp_parse_options(hdr, header_len, &opts);
+
+    /* Timestamps: drop old duplicates (PAWS) and track the TSval to echo */
+    if (sock->options.ts_ok && opts.syn.ts_ok && tcp_state_sending(sock->state)) {
+        if (seq_lt(opts.syn.ts_val, sock->options.ts_recent)) {
+            if (data_len > 0) {
+                tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+            }
+            return 0;
+        }
+        if (seq_le(seq, sock->rcv_nxt)) {
+            sock->options.ts_recent = opts.syn.ts_val;
+        }
+    }
+
+    /* The window in a SYN is never scaled */
+    uint32_t snd_window = window;
+    if (!(flags & TCP_FLAG_SYN)) {
+        snd_window <<= sock->options.snd_wscale;
+    }
+
+    /* Acknowledgments drive the retransmission queue once the handshake is done */
+    if ((flags & TCP_FLAG_ACK) && tcp_state_sending(sock->state)) {
+        bool dup_candidate = data_len == 0 && !(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN));
+        tcp_ack_process(sock, ack, snd_window, &opts, dup_candidate);
+    }
+
     /* State machine processing */
     switch (sock->state) {
         case TCP_STATE_CLOSED:
@@ -1013,30 +2822,10 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
             break;
 
         case TCP_STATE_LISTEN:
-            if (flags & TCP_FLAG_SYN) {
-                /* SYN received - add to pending queue */
-                if (sock->pending_count >= sock->backlog) {
-                    kprintf("[TCP] Listen backlog full\n");
-                    break;
-                }
-
-                tcp_pending_conn_t *pending = kmalloc(sizeof(tcp_pending_conn_t));
-                if (!pending) {
-                    kprintf("[TCP] Failed to allocate pending connection\n");
-                    break;
-                }
-
-                pending->remote_ip = src_ip;
-                pending->remote_port = src_port;
-                pending->seq_num = seq;
-                pending->timestamp = (uint32_t)pit_get_uptime_ms();
-                pending->next = sock->pending_head;
-                sock->pending_head = pending;
-                sock->pending_count++;
-
-                kprintf("[TCP] Connection request queued from %d.%d.%d.%d:%d\n",
-                        (src_ip >> 24) & 0xFF, (src_ip >> 16) & 0xFF,
-                        (src_ip >> 8) & 0xFF, src_ip & 0xFF, src_port);
+            if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+                tcp_listen_syn(sock, dst_ip, src_ip, src_port, seq, &opts.syn);
+            } else if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_ACK) {
+                tcp_listen_ack(sock, dst_ip, src_ip, src_port, seq, ack, snd_window);
             }
             break;
 
@@ -1044,7 +2833,7 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
             if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == (TCP_FLAG_SYN | TCP_FLAG_ACK)) {
                 /* SYN-ACK received - complete three-way handshake */
                 if (ack != sock->snd_nxt) {
-                    kprintf("[TCP] Invalid ACK in SYN_SENT\n");
+                    log_event(SERIAL_LOG_WARN, "TCP", "Invalid ACK in SYN_SENT\n");
                     tcp_send_rst(dst_ip, src_ip, dst_port, src_port, ack, 0);
                     break;
                 }
@@ -1053,18 +2842,27 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
                 sock->irs = seq;
                 sock->rcv_nxt = seq + 1;
                 sock->snd_wnd = window;
+                tcp_apply_syn_options(sock, &opts.syn);
+
+                /* The SYN went out when the socket entered SYN_SENT */
+                if (sock->retries == 0) {
+                    tcp_rtt_sample(sock, (uint32_t)clock_monotonic_ms() - sock->last_activity);
+                }
 
                 /* Send ACK */
+                tcp_cc_init(sock);
                 tcp_set_state(sock, TCP_STATE_ESTABLISHED);
                 tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
                 sock->flags |= TCP_SOCK_FLAG_CONNECTED;
                 tcp_stats.connections_established++;
+                poll_notify(&sock->poll, POLL_OUT);
 
                 kprintf("[TCP] Connection established!\n");
             } else if (flags & TCP_FLAG_SYN) {
                 /* Simultaneous open - SYN without ACK */
                 sock->irs = seq;
                 sock->rcv_nxt = seq + 1;
+                tcp_apply_syn_options(sock, &opts.syn);
 
                 tcp_set_state(sock, TCP_STATE_SYN_RECEIVED);
                 tcp_send_segment(sock, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
@@ -1074,13 +2872,25 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
         case TCP_STATE_SYN_RECEIVED:
             if (flags & TCP_FLAG_ACK) {
                 if (ack == sock->snd_nxt) {
+                    /* Past a full accept queue the peer's next segment retries */
+                    if (sock->parent && !tcp_accept_room(sock->parent)) {
+                        break;
+                    }
+
                     /* ACK for our SYN-ACK - connection established */
                     sock->snd_una = ack;
-                    sock->snd_wnd = window;
+                    sock->snd_wnd = snd_window;
 
+                    if (sock->retries == 0) {
+                        tcp_rtt_sample(sock, (uint32_t)clock_monotonic_ms() - sock->last_activity);
+                    }
+
+                    tcp_cc_init(sock);
                     tcp_set_state(sock, TCP_STATE_ESTABLISHED);
                     sock->flags |= TCP_SOCK_FLAG_CONNECTED;
                     tcp_stats.connections_established++;
+                    poll_notify(&sock->poll, POLL_OUT);
+                    tcp_child_established(sock);
 
                     kprintf("[TCP] Connection established (passive)!\n");
                 }
@@ -1088,27 +2898,33 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
             break;
 
         case TCP_STATE_ESTABLISHED:
-            /* Process ACK */
-            if (flags & TCP_FLAG_ACK) {
-                if (seq_gt(ack, sock->snd_una) && seq_le(ack, sock->snd_nxt)) {
-                    sock->snd_una = ack;
-                }
-                sock->snd_wnd = window;
-            }
-
             /* Process data */
             if (data_len > 0) {
                 if (seq == sock->rcv_nxt) {
                     /* In-order data */
                     size_t written = ring_buffer_write(&sock->recv_buf, data, data_len);
                     sock->rcv_nxt += written;
-                    sock->rcv_wnd = (uint32_t)ring_buffer_space(&sock->recv_buf);
                     tcp_stats.bytes_received += written;
 
-                    /* Send ACK */
-                    tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+                    uint32_t rtt = 0;
+                    if (sock->options.ts_ok && opts.syn.ts_ok && opts.ts_ecr != 0) {
+                        rtt = (uint32_t)clock_monotonic_ms() - opts.ts_ecr;
+                    }
+                    tcp_rcvbuf_tune(sock, written, rtt);
+                    sock->rcv_wnd = (uint32_t)ring_buffer_space(&sock->recv_buf);
+                    if (written > 0) {
+                        poll_notify(&sock->poll, POLL_IN);
+                    }
+
+                    /* A full buffer is reported at once, other ACKs may wait */
+                    if (written < data_len) {
+                        tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+                    } else {
+                        tcp_delack(sock);
+                    }
 
-                    kprintf("[TCP] Received %zu bytes of data\n", written);
+                    log_event(SERIAL_LOG_DEBUG, "TCP", "Received %llu bytes of data\n",
+                              (uint64_t)written);
                 } else {
                     /* Out of order - send duplicate ACK */
                     tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
@@ -1120,16 +2936,15 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
                 sock->rcv_nxt++;
                 tcp_set_state(sock, TCP_STATE_CLOSE_WAIT);
                 tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+                poll_notify(&sock->poll, POLL_IN | POLL_HUP);
                 kprintf("[TCP] Received FIN, entering CLOSE_WAIT\n");
             }
             break;
 
         case TCP_STATE_FIN_WAIT_1:
             /* Process ACK of our FIN */
-            if (flags & TCP_FLAG_ACK) {
-                if (ack == sock->snd_nxt) {
-                    tcp_set_state(sock, TCP_STATE_FIN_WAIT_2);
-                }
+            if (tcp_fin_acked(sock)) {
+                tcp_set_state(sock, TCP_STATE_FIN_WAIT_2);
             }
 
             /* Process FIN (possibly simultaneous) */
@@ -1139,8 +2954,7 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
 
                 if (sock->state == TCP_STATE_FIN_WAIT_2) {
                     /* FIN already ACKed, go to TIME_WAIT */
-                    tcp_set_state(sock, TCP_STATE_TIME_WAIT);
-                    sock->time_wait_start = (uint32_t)pit_get_uptime_ms();
+                    tcp_enter_time_wait(sock);
                 } else {
                     /* Simultaneous close */
                     tcp_set_state(sock, TCP_STATE_CLOSING);
@@ -1152,36 +2966,28 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
             /* Waiting for FIN from remote */
             if (flags & TCP_FLAG_FIN) {
                 sock->rcv_nxt++;
-                tcp_set_state(sock, TCP_STATE_TIME_WAIT);
-                sock->time_wait_start = (uint32_t)pit_get_uptime_ms();
                 tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+                tcp_enter_time_wait(sock);
             }
             break;
 
         case TCP_STATE_CLOSE_WAIT:
             /* Waiting for application to close */
-            if (flags & TCP_FLAG_ACK) {
-                sock->snd_una = ack;
-            }
             break;
 
         case TCP_STATE_CLOSING:
             /* Waiting for ACK of our FIN */
-            if (flags & TCP_FLAG_ACK) {
-                if (ack == sock->snd_nxt) {
-                    tcp_set_state(sock, TCP_STATE_TIME_WAIT);
-                    sock->time_wait_start = (uint32_t)pit_get_uptime_ms();
-                }
+            if (tcp_fin_acked(sock)) {
+                tcp_enter_time_wait(sock);
             }
             break;
 
         case TCP_STATE_LAST_ACK:
             /* Waiting for final ACK */
-            if (flags & TCP_FLAG_ACK) {
-                if (ack == sock->snd_nxt) {
-                    tcp_set_state(sock, TCP_STATE_CLOSED);
-                    tcp_socket_destroy(sock);
-                }
+            if (tcp_fin_acked(sock)) {
+                tcp_set_state(sock, TCP_STATE_CLOSED);
+                tcp_socket_destroy(sock);
+                return 0;
             }
             break;
 
@@ -1197,6 +3003,8 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
             break;
     }
 
+    /* The ACK may have ended or moved the retransmission and delayed ACK deadlines */
+    tcp_timer_update(sock);
     return 0;
 }
 
@@ -1205,53 +3013,143 @@ int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip
  * ============================================================================ */
 
 /**
- * Process TCP timers (called periodically)
+ * Run the deadlines of a socket whose timer came due, then queue the
+ * timer for the next one
  */
-void tcp_timer_tick(void) {
-    uint32_t now = (uint32_t)pit_get_uptime_ms();
-
-    tcp_socket_t *sock = tcp_socket_list;
-    while (sock) {
-        tcp_socket_t *next = sock->next;  /* Save next in case we destroy sock */
-
-        switch (sock->state) {
-            case TCP_STATE_TIME_WAIT:
-                /* Check if TIME_WAIT has expired */
-                if ((now - sock->time_wait_start) >= TCP_TIME_WAIT_TIMEOUT) {
-                    kprintf("[TCP] TIME_WAIT expired\n");
-                    tcp_set_state(sock, TCP_STATE_CLOSED);
-                    tcp_socket_destroy(sock);
-                }
+static void tcp_socket_timeout(tcp_socket_t *sock) {
+    uint32_t now = (uint32_t)clock_monotonic_ms();
+
+    if ((sock->flags & TCP_SOCK_FLAG_ACK_DELAYED) && tcp_state_sending(sock->state) &&
+        (int32_t)(now - sock->delack_due) >= 0) {
+        tcp_stats.delayed_acks++;
+        tcp_send_segment(sock, TCP_FLAG_ACK, NULL, 0);
+    }
+
+    switch (sock->state) {
+        case TCP_STATE_TIME_WAIT:
+            /* Only without a minisock; the owner frees the socket */
+            if ((now - sock->time_wait_start) >= TCP_TIME_WAIT_TIMEOUT) {
+                kprintf("[TCP] TIME_WAIT expired\n");
+                tcp_ehash_del(sock);
+                tcp_set_state(sock, TCP_STATE_CLOSED);
+                return;
+            }
+            break;
+
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            /* Check for connection timeout */
+            if ((now - sock->last_activity) < (sock->rto * (sock->retries + 1))) {
                 break;
+            }
+            if (sock->retries >= TCP_MAX_RETRIES) {
+                kprintf("[TCP] Connection timeout\n");
+                tcp_abort(sock);
+                return;
+            }
 
-            case TCP_STATE_SYN_SENT:
-            case TCP_STATE_SYN_RECEIVED:
-                /* Check for connection timeout */
-                if ((now - sock->last_activity) >= (sock->rto * (sock->retries + 1))) {
-                    if (sock->retries >= TCP_MAX_RETRIES) {
-                        kprintf("[TCP] Connection timeout\n");
-                        tcp_abort(sock);
-                    } else {
-                        /* Retransmit SYN or SYN-ACK */
-                        sock->retries++;
-                        tcp_stats.retransmissions++;
-                        if (sock->state == TCP_STATE_SYN_SENT) {
-                            sock->snd_nxt = sock->iss;  /* Reset seq for retransmit */
-                            tcp_send_segment(sock, TCP_FLAG_SYN, NULL, 0);
-                        } else {
-                            sock->snd_nxt = sock->iss;
-                            tcp_send_segment(sock, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
-                        }
-                        kprintf("[TCP] Retransmit #%d\n", sock->retries);
-                    }
-                }
+            /* Retransmit SYN or SYN-ACK */
+            sock->retries++;
+            tcp_stats.retransmissions++;
+            sock->snd_nxt = sock->iss;  /* Reset seq for retransmit */
+            if (sock->state == TCP_STATE_SYN_SENT) {
+                tcp_send_segment(sock, TCP_FLAG_SYN, NULL, 0);
+            } else {
+                tcp_send_segment(sock, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
+            }
+            kprintf("[TCP] Retransmit #%d\n", sock->retries);
+            break;
+
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_CLOSE_WAIT:
+        case TCP_STATE_FIN_WAIT_1:
+        case TCP_STATE_CLOSING:
+        case TCP_STATE_LAST_ACK:
+            if ((now - sock->rtx_start) < sock->rto) {
                 break;
+            }
+            if (sock->snd_max != sock->snd_una) {
+                if (sock->retries >= TCP_MAX_DATA_RETRIES) {
+                    kprintf("[TCP] Retransmission limit reached\n");
+                    tcp_abort(sock);
+                    return;
+                }
+                sock->retries++;
+                tcp_retransmit_timeout(sock);
+            } else if (sock->snd_wnd == 0 && ring_buffer_used(&sock->send_buf) > 0) {
+                tcp_send_probe(sock);
+                sock->rtx_start = now;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    tcp_timer_update(sock);
+}
+
+/**
+ * Process TCP timers
+ * Walks the slots from the last tick processed up to now, taking out and
+ * running each node that is due. The lock is dropped around each handler,
+ * which may queue the node again; the slot is then rescanned from its head.
+ */
+void tcp_timer_tick(void) {
+    uint64_t now = clock_monotonic_ms();
+    uint64_t now_tick = now / TCP_WHEEL_TICK;
+
+    uint64_t flags = tcp_wheel_lock_acquire();
+
+    /* After a long gap one turn covers every slot */
+    uint64_t tick = tcp_wheel_clock + 1;
+    if (now_tick - tcp_wheel_clock > TCP_WHEEL_SLOTS) {
+        tick = now_tick - TCP_WHEEL_SLOTS + 1;
+    }
+
+    for (; tick <= now_tick; tick++) {
+        /* Nodes queued from here on land in later ticks */
+        tcp_wheel_clock = tick;
+        tcp_timer_node_t **head = &tcp_wheel[tick & (TCP_WHEEL_SLOTS - 1)];
+        tcp_timer_node_t *node = *head;
+        while (node) {
+            if (tcp_wheel_tick_of(node) > now_tick) {
+                node = node->next;      /* Due in a later turn */
+                continue;
+            }
+            tcp_wheel_unlink(node);
+            tcp_wheel_lock_release(flags);
+
+            if (node->minisock) {
+                tcp_timewait_expire((tcp_timewait_t *)((uint8_t *)node -
+                                    __builtin_offsetof(tcp_timewait_t, timer)));
+            } else {
+                tcp_socket_timeout((tcp_socket_t *)((uint8_t *)node -
+                                   __builtin_offsetof(tcp_socket_t, timer)));
+            }
+
+            flags = tcp_wheel_lock_acquire();
+            node = *head;
+        }
+    }
+    if (tcp_wheel_clock < now_tick) {
+        tcp_wheel_clock = now_tick;
+    }
 
-            default:
+    /* Fire again at the next occupied slot */
+    uint32_t delay = 0;
+    if (tcp_wheel_count > 0) {
+        for (uint32_t i = 1; i <= TCP_WHEEL_SLOTS; i++) {
+            if (tcp_wheel[(now_tick + i) & (TCP_WHEEL_SLOTS - 1)]) {
+                delay = (uint32_t)((now_tick + i) * TCP_WHEEL_TICK - now);
                 break;
+            }
         }
+    }
+    tcp_wheel_lock_release(flags);
 
-        sock = next;
+    if (delay > 0) {
+        tcp_timer_arm_in(delay);
     }
 }
 
@@ -1273,6 +3171,76 @@ void tcp_set_nonblock(tcp_socket_t *sock, bool nonblock) {
     }
 }
 
+/**
+ * Turn Nagle's algorithm off or on
+ */
+void tcp_set_nodelay(tcp_socket_t *sock, bool no_delay) {
+    if (!sock) {
+        return;
+    }
+    sock->options.no_delay = no_delay;
+    if (no_delay) {
+        tcp_output(sock);           /* Send what Nagle held back */
+    }
+}
+
+/**
+ * Hold or release partial segments
+ */
+void tcp_set_cork(tcp_socket_t *sock, bool cork) {
+    if (!sock) {
+        return;
+    }
+    sock->options.cork = cork;
+    if (!cork) {
+        tcp_output(sock);
+    }
+}
+
+/**
+ * Splice sends to local peers, or stop
+ */
+void tcp_set_splice(tcp_socket_t *sock, bool splice) {
+    if (!sock) {
+        return;
+    }
+    sock->options.splice = splice;
+}
+
+/**
+ * Apply a new limit to one of the buffers, shrinking it if its contents fit
+ */
+static void tcp_buffer_limit(tcp_ring_buffer_t *rb, uint32_t *limit, size_t size) {
+    size = CLAMP(size, (size_t)TCP_BUF_MIN, (size_t)TCP_BUF_LIMIT);
+    *limit = (uint32_t)size;
+    if (rb->size > size && rb->used <= size) {
+        ring_buffer_resize(rb, size);
+    }
+}
+
+/**
+ * Set the receive buffer limit
+ */
+int tcp_set_rcvbuf(tcp_socket_t *sock, size_t size) {
+    if (!sock) {
+        return TCP_ERR_INVALID;
+    }
+    tcp_buffer_limit(&sock->recv_buf, &sock->rcvbuf_max, size);
+    sock->rcv_wnd = (uint32_t)ring_buffer_space(&sock->recv_buf);
+    return TCP_OK;
+}
+
+/**
+ * Set the send buffer limit
+ */
+int tcp_set_sndbuf(tcp_socket_t *sock, size_t size) {
+    if (!sock) {
+        return TCP_ERR_INVALID;
+    }
+    tcp_buffer_limit(&sock->send_buf, &sock->sndbuf_max, size);
+    return TCP_OK;
+}
+
 /**
  * Get socket error (placeholder - returns 0)
  */
@@ -1281,6 +3249,31 @@ int tcp_get_error(tcp_socket_t *sock) {
     return 0;
 }
 
+/**
+ * Current readiness of a socket
+ */
+uint32_t tcp_poll_events(const tcp_socket_t *sock) {
+    uint32_t events = 0;
+
+    if (!sock) {
+        return POLL_ERR;
+    }
+
+    if (sock->state == TCP_STATE_LISTEN) {
+        return sock->accept_queue.count > 0 ? POLL_IN : 0;
+    }
+    if (ring_buffer_used(&sock->recv_buf) > 0) {
+        events |= POLL_IN;
+    }
+    if (tcp_can_send(sock) && ring_buffer_space(&sock->send_buf) > 0) {
+        events |= POLL_OUT;
+    }
+    if (sock->state == TCP_STATE_CLOSE_WAIT || sock->state == TCP_STATE_CLOSED) {
+        events |= POLL_IN | POLL_HUP;
+    }
+    return events;
+}
+
 /**
  * Print TCP socket information for debugging
  */
@@ -1300,8 +3293,11 @@ void tcp_debug_print_socket(const tcp_socket_t *sock) {
             (sock->remote_ip >> 8) & 0xFF, sock->remote_ip & 0xFF,
             sock->remote_port);
     kprintf("  State:  %s\n", tcp_state_name(sock->state));
-    kprintf("  Send:   UNA=%u NXT=%u WND=%u\n",
-            sock->snd_una, sock->snd_nxt, sock->snd_wnd);
+    kprintf("  Send:   UNA=%u NXT=%u MAX=%u WND=%u\n",
+            sock->snd_una, sock->snd_nxt, sock->snd_max, sock->snd_wnd);
+    kprintf("  Cong:   CWND=%u SSTHRESH=%u RTO=%u SRTT=%u%s SACKED=%u\n",
+            sock->cwnd, sock->ssthresh, sock->rto, sock->srtt,
+            sock->in_recovery ? " (recovery)" : "", sock->sack_count);
     kprintf("  Recv:   NXT=%u WND=%u\n",
             sock->rcv_nxt, sock->rcv_wnd);
     kprintf("  Buffers: send=%zu/%zu recv=%zu/%zu\n",
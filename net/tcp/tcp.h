@@ -8,6 +8,8 @@
  *   - Sequence/acknowledgment number management
  *   - Basic flow control with sliding window
  *   - Connection termination
+ *   - SYN and accept queues per listener, SYN cookies once the SYN queue
+ *     is full, per-CPU listeners on SO_REUSEPORT ports
  */
 
 #ifndef _AAAOS_NET_TCP_H
@@ -15,25 +17,64 @@
 
 #include "../../kernel/include/types.h"
 #include "../core/netbuf.h"
+#include "../ip/route.h"
+#include "../../kernel/ipc/poll.h"
 
 /* TCP Protocol Constants */
 #define TCP_PROTOCOL            6           /* IP protocol number for TCP */
 #define TCP_HEADER_MIN_LEN      20          /* Minimum TCP header size */
 #define TCP_HEADER_MAX_LEN      60          /* Maximum TCP header size (with options) */
-#define TCP_MAX_WINDOW          65535       /* Maximum window size (16-bit) */
+#define TCP_MAX_WINDOW          65535       /* Largest value of the window field */
+#define TCP_MAX_WSCALE          14          /* Largest window scale shift (RFC 7323) */
 #define TCP_DEFAULT_WINDOW      32768       /* Default window size */
 #define TCP_MSS_DEFAULT         1460        /* Default MSS for Ethernet */
-#define TCP_MAX_SOCKETS         256         /* Maximum concurrent TCP sockets */
+#define TCP_MSS_MIN             88          /* Smallest MSS accepted from a peer */
+#define TCP_TSO_MAX_LEN         32768       /* Most data handed to the device per TSO send */
+#define TCP_MAX_SOCKETS         65536       /* Maximum concurrent TCP sockets */
+#define TCP_EHASH_SIZE          16384       /* Connection lookup buckets (power of two) */
+#define TCP_LHASH_SIZE          64          /* Listener lookup buckets (power of two) */
+#define TCP_BHASH_SIZE          1024        /* Bound port buckets (power of two) */
 #define TCP_LISTEN_BACKLOG_MAX  128         /* Maximum listen queue size */
+#define TCP_SYN_BACKLOG_FACTOR  2           /* SYN queue size, in multiples of the backlog */
 
 /* Retransmission constants */
 #define TCP_RETRANSMIT_TIMEOUT  1000        /* Initial retransmit timeout (ms) */
+#define TCP_RTO_MIN             200         /* Smallest RTO from RTT estimates (ms) */
+#define TCP_RTO_MAX             60000       /* Largest RTO (ms) */
 #define TCP_MAX_RETRIES         5           /* Maximum retransmission attempts */
+#define TCP_MAX_DATA_RETRIES    15          /* Data retransmissions before aborting */
 #define TCP_TIME_WAIT_TIMEOUT   60000       /* TIME_WAIT duration (ms) */
+#define TCP_WHEEL_TICK          10          /* Timer wheel resolution (ms) */
+#define TCP_WHEEL_SLOTS         512         /* Timer wheel slots (power of two) */
+#define TCP_DELACK_TIMEOUT      40          /* Longest an ACK of in-order data is held (ms) */
+#define TCP_DELACK_SEGS         2           /* Segments that get an ACK at once */
+
+/* Congestion control (RFC 5681, RFC 6582) and SACK (RFC 2018) */
+#define TCP_INIT_CWND_SEGS      10          /* Initial window in segments (RFC 6928) */
+#define TCP_DUPACK_THRESH       3           /* Duplicate ACKs that start fast retransmit */
+#define TCP_SACK_MAX_BLOCKS     4           /* SACKed ranges remembered per socket */
+
+/* TCP option kinds */
+#define TCP_OPT_END             0           /* End of option list */
+#define TCP_OPT_NOP             1           /* Padding */
+#define TCP_OPT_MSS             2           /* Maximum segment size (SYN only) */
+#define TCP_OPT_WSCALE          3           /* Window scale (SYN only) */
+#define TCP_OPT_SACK_PERM       4           /* SACK permitted (SYN only) */
+#define TCP_OPT_SACK            5           /* SACK blocks */
+#define TCP_OPT_TIMESTAMP       8           /* Timestamps */
+#define TCP_OPT_TIMESTAMP_LEN   12          /* Timestamp option with its two NOPs */
 
-/* TCP Buffer sizes */
-#define TCP_RECV_BUF_SIZE       65536       /* Receive buffer size */
-#define TCP_SEND_BUF_SIZE       65536       /* Send buffer size */
+/*
+ * TCP Buffer sizes. Buffers start at the initial size and grow with the
+ * measured bandwidth-delay product up to a per-socket limit, which
+ * SO_RCVBUF/SO_SNDBUF set (between TCP_BUF_MIN and TCP_BUF_LIMIT).
+ */
+#define TCP_RECV_BUF_SIZE       65536       /* Initial receive buffer size */
+#define TCP_SEND_BUF_SIZE       65536       /* Initial send buffer size */
+#define TCP_RECV_BUF_MAX        (4 * MB)    /* Default receive buffer limit */
+#define TCP_SEND_BUF_MAX        (4 * MB)    /* Default send buffer limit */
+#define TCP_BUF_MIN             4096        /* Smallest buffer limit */
+#define TCP_BUF_LIMIT           (16 * MB)   /* Largest buffer limit */
 
 /**
  * TCP Header Flags
@@ -126,21 +167,61 @@ typedef struct tcp_ring_buffer {
  */
 typedef struct tcp_options {
     uint16_t mss;               /* Maximum Segment Size */
-    bool     no_delay;          /* Disable Nagle's algorithm */
+    bool     no_delay;          /* Disable Nagle's algorithm (TCP_NODELAY) */
+    bool     cork;              /* Hold partial segments until uncorked (TCP_CORK) */
+    bool     splice;            /* Copy sends straight to a local peer (tcp_set_splice) */
     bool     keep_alive;        /* Enable keep-alive probes */
     uint32_t keep_alive_time;   /* Keep-alive timeout (ms) */
+
+    /* Negotiated on the SYNs (RFC 7323) */
+    bool     wscale_ok;         /* Both sides sent the window scale option */
+    uint8_t  snd_wscale;        /* Shift applied to the peer's window */
+    uint8_t  rcv_wscale;        /* Shift applied to the window we advertise */
+    bool     ts_ok;             /* Both sides send timestamps */
+    uint32_t ts_recent;         /* Latest in-order TSval, echoed back in TSecr */
 } tcp_options_t;
 
 /**
- * TCP Connection block for pending connections
+ * Options carried by a peer's SYN
  */
-typedef struct tcp_pending_conn {
-    uint32_t remote_ip;         /* Remote IP address */
-    uint16_t remote_port;       /* Remote port */
-    uint32_t seq_num;           /* Initial sequence number from remote */
-    uint32_t timestamp;         /* Connection request timestamp */
-    struct tcp_pending_conn *next;
-} tcp_pending_conn_t;
+typedef struct tcp_syn_options {
+    uint16_t mss;               /* MSS option (0 if none) */
+    int8_t   wscale;            /* Window scale shift (-1 if none) */
+    bool     sack_ok;           /* SACK permitted */
+    bool     ts_ok;             /* Timestamps present */
+    uint32_t ts_val;            /* TSval of the SYN */
+} tcp_syn_options_t;
+
+struct tcp_socket;
+
+/**
+ * FIFO of a listener's connections, linked through their queue_next
+ */
+typedef struct tcp_conn_queue {
+    struct tcp_socket *head;
+    struct tcp_socket *tail;
+    int count;
+} tcp_conn_queue_t;
+
+/**
+ * Range of sequence space the peer reported holding (SACK block)
+ */
+typedef struct tcp_sack_block {
+    uint32_t start;             /* First sequence number */
+    uint32_t end;               /* Sequence number after the last */
+} tcp_sack_block_t;
+
+/**
+ * Entry in the TCP timer wheel
+ * Each socket and TIME_WAIT minisock has one, queued for its earliest
+ * deadline.
+ */
+typedef struct tcp_timer_node {
+    struct tcp_timer_node *next;
+    struct tcp_timer_node **pprev;  /* Link pointing here, NULL when not queued */
+    uint64_t expires;               /* Deadline (ms, clock_monotonic_ms) */
+    bool     minisock;              /* Owner is a tcp_timewait_t */
+} tcp_timer_node_t;
 
 /**
  * TCP Socket Structure
@@ -152,6 +233,7 @@ typedef struct tcp_socket {
     uint16_t remote_port;       /* Remote port number */
     uint32_t local_ip;          /* Local IP address */
     uint32_t remote_ip;         /* Remote IP address */
+    route_cache_t route;        /* Next hop for remote_ip */
 
     /* State machine */
     tcp_state_t state;          /* Current TCP state */
@@ -160,6 +242,7 @@ typedef struct tcp_socket {
     uint32_t snd_una;           /* Send unacknowledged (oldest unacked seq) */
     uint32_t snd_nxt;           /* Send next (next seq to send) */
     uint32_t snd_wnd;           /* Send window (advertised by remote) */
+    uint32_t snd_max;           /* Highest sequence sent (snd_nxt goes back on timeout) */
     uint32_t iss;               /* Initial send sequence number */
 
     /* Sequence numbers - Receive side */
@@ -170,21 +253,61 @@ typedef struct tcp_socket {
     /* Buffers */
     tcp_ring_buffer_t send_buf; /* Send buffer */
     tcp_ring_buffer_t recv_buf; /* Receive buffer */
+    uint32_t sndbuf_max;        /* Send buffer limit (SO_SNDBUF) */
+    uint32_t rcvbuf_max;        /* Receive buffer limit (SO_RCVBUF) */
+    uint32_t rcv_space;         /* In-order bytes received since rcv_space_start */
+    uint32_t rcv_space_start;   /* Start of the receive rate measurement (ms) */
+    uint32_t rcv_rtt;           /* Round trip seen from received timestamps (ms) */
 
     /* Retransmission */
     uint32_t rto;               /* Retransmission timeout (ms) */
-    uint32_t srtt;              /* Smoothed round-trip time */
-    uint32_t rttvar;            /* RTT variance */
+    uint32_t srtt;              /* Smoothed round-trip time (ms, 0 = no sample yet) */
+    uint32_t rttvar;            /* RTT variance (ms) */
     uint8_t  retries;           /* Current retry count */
+    uint32_t rtx_start;         /* When the retransmission timer last started (ms) */
+    uint32_t rtt_seq;           /* Sequence whose ACK ends the RTT measurement */
+    uint32_t rtt_start;         /* When the measured segment was sent (ms) */
+    bool     rtt_timing;        /* An RTT measurement is running */
+
+    /* Congestion control */
+    uint32_t cwnd;              /* Congestion window (bytes) */
+    uint32_t ssthresh;          /* Slow start threshold (bytes) */
+    uint32_t recover;           /* snd_max when loss recovery started */
+    uint32_t rtx_next;          /* Next sequence to retransmit in recovery */
+    uint8_t  dupacks;           /* Duplicate ACKs in a row */
+    bool     in_recovery;       /* In fast recovery */
+
+    /* SACK scoreboard: ranges above snd_una the peer already holds */
+    uint8_t  sack_count;
+    tcp_sack_block_t sacked[TCP_SACK_MAX_BLOCKS];
+
+    /* Delayed ACK */
+    uint8_t  delack_segs;       /* In-order segments received since our last ACK */
+    uint32_t delack_due;        /* When the held ACK must go out (ms) */
 
     /* Timing */
     uint32_t time_wait_start;   /* TIME_WAIT start timestamp */
     uint32_t last_activity;     /* Last activity timestamp */
-
-    /* Listen queue (for listening sockets) */
-    int backlog;                /* Maximum pending connections */
-    int pending_count;          /* Current pending connections */
-    tcp_pending_conn_t *pending_head; /* Pending connection queue */
+    tcp_timer_node_t timer;     /* Next retransmit, delayed ACK or state timeout */
+
+    /*
+     * Listen queues (for listening sockets). A SYN makes a connection in
+     * SYN_RECEIVED on syn_queue; the ACK completing the handshake moves
+     * it to accept_queue, which tcp_accept takes from the head. Both are
+     * under queue_lock.
+     */
+    int backlog;                /* Maximum connections on accept_queue */
+    int syn_backlog;            /* Maximum on syn_queue; SYN cookies past it */
+    tcp_conn_queue_t syn_queue;
+    tcp_conn_queue_t accept_queue;
+    uint32_t cookie_until;      /* ACKs are checked for cookies until then (ms) */
+    volatile int queue_lock;
+
+    /* Passive connection not yet accepted: its listener and queue */
+    struct tcp_socket *parent;
+    tcp_conn_queue_t *queue;
+    struct tcp_socket *queue_next;
+    struct tcp_socket *queue_prev;
 
     /* Options */
     tcp_options_t options;      /* Socket options */
@@ -192,16 +315,52 @@ typedef struct tcp_socket {
     /* Socket flags */
     uint32_t flags;             /* Internal flags */
 
+    /* Readiness (poll.h), raised as data, connections and FINs arrive */
+    poll_source_t poll;
+
     /* Linked list for socket management */
     struct tcp_socket *next;
     struct tcp_socket *prev;
+
+    /* Lookup chains: connection or listener table, and bound port table */
+    struct tcp_socket *hash_next;
+    struct tcp_socket *bind_next;
 } tcp_socket_t;
 
+/**
+ * TIME_WAIT minisock
+ * What is left of a connection once both FINs are acknowledged: enough to
+ * ACK a retransmitted FIN and to keep the 4-tuple from being reused for
+ * TCP_TIME_WAIT_TIMEOUT. The full socket and its buffers are released.
+ */
+typedef struct tcp_timewait {
+    uint32_t local_ip;
+    uint32_t remote_ip;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint32_t snd_nxt;           /* Sequence number after our FIN */
+    uint32_t rcv_nxt;           /* Sequence number after the peer's FIN */
+    uint16_t window;            /* Window field to send, already scaled */
+    bool     ts_ok;             /* Timestamps in use */
+    uint32_t ts_recent;         /* TSval to echo */
+    tcp_timer_node_t timer;     /* End of TIME_WAIT */
+    struct tcp_timewait *hash_next;
+} tcp_timewait_t;
+
 /* Socket flags */
 #define TCP_SOCK_FLAG_BOUND         BIT(0)  /* Socket is bound to port */
 #define TCP_SOCK_FLAG_LISTENING     BIT(1)  /* Socket is listening */
 #define TCP_SOCK_FLAG_CONNECTED     BIT(2)  /* Socket is connected */
 #define TCP_SOCK_FLAG_NONBLOCK      BIT(3)  /* Non-blocking mode */
+#define TCP_SOCK_FLAG_EHASHED       BIT(4)  /* In the connection table */
+#define TCP_SOCK_FLAG_LHASHED       BIT(5)  /* In the listener table */
+#define TCP_SOCK_FLAG_BHASHED       BIT(6)  /* In the bound port table */
+#define TCP_SOCK_FLAG_SACK_OK       BIT(7)  /* Peer sends SACK blocks */
+#define TCP_SOCK_FLAG_FIN_PENDING   BIT(8)  /* Send FIN after the queued data */
+#define TCP_SOCK_FLAG_FIN_SENT      BIT(9)  /* FIN has been sent (sits at snd_max - 1) */
+#define TCP_SOCK_FLAG_ACK_DELAYED   BIT(10) /* An ACK is held for delack_due */
+#define TCP_SOCK_FLAG_TIMEWAIT_MINI BIT(11) /* A minisock keeps this socket's TIME_WAIT */
+#define TCP_SOCK_FLAG_REUSEPORT     BIT(12) /* Share the port (set before bind) */
 
 /**
  * Error codes
@@ -217,6 +376,7 @@ typedef struct tcp_socket {
 #define TCP_ERR_RESET          -8       /* Connection reset */
 #define TCP_ERR_CLOSED         -9       /* Socket closed */
 #define TCP_ERR_NOBUFS         -10      /* No buffer space */
+#define TCP_ERR_IO             -11      /* tcp_send_fill producer failed */
 
 /*
  * API Functions
@@ -248,16 +408,26 @@ void tcp_socket_destroy(tcp_socket_t *sock);
  */
 int tcp_bind(tcp_socket_t *sock, uint16_t port);
 
+/**
+ * Let the socket share its port with other SO_REUSEPORT sockets
+ * Listeners on a shared port each take the connections arriving on some
+ * of the CPUs, so their accept queues are per CPU. Set before tcp_bind.
+ */
+void tcp_set_reuseport(tcp_socket_t *sock, bool reuse);
+
 /**
  * Start listening for incoming connections
+ * Up to TCP_SYN_BACKLOG_FACTOR * backlog handshakes are kept in progress;
+ * further SYNs are answered with SYN cookies, which hold no state.
  * @param sock Socket to listen on (must be bound)
- * @param backlog Maximum pending connections
+ * @param backlog Maximum established connections waiting for tcp_accept
  * @return TCP_OK on success, negative error code on failure
  */
 int tcp_listen(tcp_socket_t *sock, int backlog);
 
 /**
  * Accept an incoming connection
+ * Connections come out established, in the order they completed.
  * @param sock Listening socket
  * @return New connected socket, or NULL if no pending connections
  */
@@ -281,6 +451,24 @@ int tcp_connect(tcp_socket_t *sock, uint32_t remote_ip, uint16_t remote_port);
  */
 ssize_t tcp_send(tcp_socket_t *sock, const void *data, size_t len);
 
+/**
+ * Producer for tcp_send_fill
+ * @param dst Free space in the send buffer
+ * @return Bytes written to dst (fewer than len ends the fill), or negative on error
+ */
+typedef ssize_t (*tcp_fill_fn_t)(void *ctx, void *dst, size_t len);
+
+/**
+ * Queue data that a producer writes straight into the send buffer
+ * Like tcp_send, but without a source buffer: sendfile reads the file
+ * into the send buffer, so the data is copied once on its way to the
+ * device.
+ * @param len Most bytes to queue
+ * @return Number of bytes queued, or negative error code (TCP_ERR_IO if
+ *         the producer failed before queuing anything)
+ */
+ssize_t tcp_send_fill(tcp_socket_t *sock, tcp_fill_fn_t fill, void *ctx, size_t len);
+
 /**
  * Receive data from TCP connection
  * @param sock Connected socket
@@ -314,8 +502,18 @@ void tcp_abort(tcp_socket_t *sock);
 int tcp_receive(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip);
 
 /**
- * Process TCP timers (should be called periodically)
- * Handles retransmission, TIME_WAIT cleanup, etc.
+ * Handle incoming TCP packet, skipping checks the device already made
+ * @param flags NETBUF_FLAG_CSUM_L4_OK if the checksum was verified
+ * @return 0 on success, negative on error
+ */
+int tcp_receive_offload(const void *packet, size_t len, uint32_t src_ip, uint32_t dst_ip,
+                        uint32_t flags);
+
+/**
+ * Process TCP timers
+ * Runs the timeouts (retransmission, delayed ACK, handshake, TIME_WAIT)
+ * whose timer wheel slots have come due. Called from a kernel timer set
+ * for the next occupied slot, so sockets without a deadline cost nothing.
  */
 void tcp_timer_tick(void);
 
@@ -348,10 +546,15 @@ uint16_t tcp_checksum(uint32_t src_ip, uint32_t dst_ip,
                       const void *tcp_data, size_t tcp_len);
 
 /**
- * Generate initial sequence number
- * @return Random initial sequence number
+ * Generate initial sequence number (RFC 6528)
+ * @param local_ip Local IP address
+ * @param local_port Local port
+ * @param remote_ip Remote IP address
+ * @param remote_port Remote port
+ * @return Initial sequence number for the connection
  */
-uint32_t tcp_generate_isn(void);
+uint32_t tcp_generate_isn(uint32_t local_ip, uint16_t local_port,
+                          uint32_t remote_ip, uint16_t remote_port);
 
 /**
  * Set socket to non-blocking mode
@@ -360,6 +563,46 @@ uint32_t tcp_generate_isn(void);
  */
 void tcp_set_nonblock(tcp_socket_t *sock, bool nonblock);
 
+/**
+ * Turn Nagle's algorithm off or on (TCP_NODELAY)
+ * With no_delay set, a short segment is sent even while data is in flight.
+ */
+void tcp_set_nodelay(tcp_socket_t *sock, bool no_delay);
+
+/**
+ * Hold or release partial segments (TCP_CORK)
+ * While corked only full segments are sent; uncorking sends the rest.
+ */
+void tcp_set_cork(tcp_socket_t *sock, bool cork);
+
+/**
+ * Copy sends straight into the receive buffer of a local peer
+ * (TCP_LOOPBACK_SPLICE). When the peer socket is on this host and nothing
+ * is in flight, tcp_send writes into its receive buffer and moves both
+ * sequence spaces forward, with no segments built. Anything else (a full
+ * peer buffer, unacknowledged data, a remote peer) takes the normal path.
+ */
+void tcp_set_splice(tcp_socket_t *sock, bool splice);
+
+/**
+ * Set the receive buffer limit (SO_RCVBUF)
+ * The buffer grows up to the limit as the connection needs it. The
+ * limit also sets the window scale offered on the SYN, so it takes full
+ * effect only when set before connecting or listening. A buffer already
+ * larger than the limit shrinks if its contents fit.
+ * @param size Limit in bytes, clamped to TCP_BUF_MIN..TCP_BUF_LIMIT
+ * @return TCP_OK or negative error code
+ */
+int tcp_set_rcvbuf(tcp_socket_t *sock, size_t size);
+
+/**
+ * Set the send buffer limit (SO_SNDBUF)
+ * A buffer already larger than the limit shrinks if its contents fit.
+ * @param size Limit in bytes, clamped to TCP_BUF_MIN..TCP_BUF_LIMIT
+ * @return TCP_OK or negative error code
+ */
+int tcp_set_sndbuf(tcp_socket_t *sock, size_t size);
+
 /**
  * Get socket error (clears error after reading)
  * @param sock Socket to query
@@ -367,6 +610,13 @@ void tcp_set_nonblock(tcp_socket_t *sock, bool nonblock);
  */
 int tcp_get_error(tcp_socket_t *sock);
 
+/**
+ * Current readiness of a socket
+ * @param sock Socket to query
+ * @return POLL_* events the socket has now
+ */
+uint32_t tcp_poll_events(const tcp_socket_t *sock);
+
 /**
  * Check if socket is connected
  * @param sock Socket to check
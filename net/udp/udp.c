@@ -6,7 +6,11 @@
 
 #include "udp.h"
 #include "../ip/ip.h"
+#include "../ethernet/ethernet.h"
+#include "../core/checksum.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/stats/kstat.h"
 
 /* Forward declarations for memory functions */
 extern void *kmalloc(size_t size);
@@ -17,51 +21,57 @@ extern void *memset(void *s, int c, size_t n);
 /*
  * UDP Statistics
  */
-static struct {
-    uint64_t packets_sent;      /* Total packets sent */
-    uint64_t packets_recv;      /* Total packets received */
-    uint64_t bytes_sent;        /* Total bytes sent */
-    uint64_t bytes_recv;        /* Total bytes received */
-    uint64_t checksum_errors;   /* Checksum validation failures */
-    uint64_t port_unreachable;  /* No socket for destination port */
-    uint64_t queue_full;        /* Receive queue full drops */
-    uint64_t invalid_packets;   /* Malformed packets dropped */
-} udp_stats;
+KSTAT_COUNTER(udp_packets_sent, "net.udp.packets_sent", "UDP datagrams sent");
+KSTAT_COUNTER(udp_packets_recv, "net.udp.packets_recv", "UDP datagrams received");
+KSTAT_COUNTER(udp_bytes_sent, "net.udp.bytes_sent", "UDP payload bytes sent");
+KSTAT_COUNTER(udp_bytes_recv, "net.udp.bytes_recv", "UDP payload bytes received");
+KSTAT_COUNTER(udp_checksum_errors, "net.udp.checksum_errors", "Checksum validation failures");
+KSTAT_COUNTER(udp_port_unreachable, "net.udp.port_unreachable", "No socket for the port");
+KSTAT_COUNTER(udp_queue_full, "net.udp.queue_full", "Receive queue full drops");
+KSTAT_COUNTER(udp_invalid_packets, "net.udp.invalid_packets", "Malformed datagrams dropped");
 
 /*
- * Socket Management
+ * Socket Management. Bound sockets sit in a hash table by local port.
+ * udp_lock protects the table and every receive queue, and is taken with
+ * interrupts off; receive looks up the socket and queues to it under one
+ * hold, so a socket is never freed under it.
  */
-static udp_socket_t *socket_list_head = NULL;
-static udp_socket_t *socket_list_tail = NULL;
+static udp_socket_t *udp_port_hash[UDP_HASH_SIZE];
 static uint32_t socket_count = 0;
 static uint16_t next_ephemeral_port = UDP_PORT_EPHEMERAL_MIN;
 static bool udp_initialized = false;
+static volatile int udp_lock = 0;
 
 /*
- * Byte Order Conversion (Network byte order is big-endian)
+ * Internal Helper Functions
  */
-static inline uint16_t htons(uint16_t hostshort) {
-    return ((hostshort & 0xFF) << 8) | ((hostshort >> 8) & 0xFF);
-}
 
-static inline uint16_t ntohs(uint16_t netshort) {
-    return htons(netshort);  /* Same operation */
+static inline uint64_t udp_lock_acquire(void) {
+    uint64_t flags = interrupts_save();
+    while (__sync_lock_test_and_set(&udp_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+    return flags;
 }
 
-static inline uint32_t htonl(uint32_t hostlong) {
-    return ((hostlong & 0xFF) << 24) |
-           ((hostlong & 0xFF00) << 8) |
-           ((hostlong >> 8) & 0xFF00) |
-           ((hostlong >> 24) & 0xFF);
+static inline void udp_lock_release(uint64_t flags) {
+    __sync_lock_release(&udp_lock);
+    interrupts_restore(flags);
 }
 
-static inline uint32_t ntohl(uint32_t netlong) {
-    return htonl(netlong);  /* Same operation */
+static inline uint32_t udp_port_bucket(uint16_t port) {
+    return (port ^ (port >> 8)) & (UDP_HASH_SIZE - 1);
 }
 
-/*
- * Internal Helper Functions
+/**
+ * Hash of a flow, for spreading a port's flows over its sockets
  */
+static inline uint32_t udp_flow_hash(uint32_t src_ip, uint16_t src_port,
+                                     uint32_t dst_ip, uint16_t dst_port) {
+    uint32_t h = (src_ip ^ ((uint32_t)src_port << 16 | dst_port)) * 2654435761u;
+    h ^= dst_ip * 2246822519u;
+    return h ^ (h >> 16);
+}
 
 /**
  * Allocate and initialize a new UDP socket
@@ -97,49 +107,43 @@ static void socket_free(udp_socket_t *sock) {
     if (!sock) return;
 
     /* Free all queued datagrams */
-    udp_datagram_t *dgram = sock->recv_head;
-    while (dgram) {
-        udp_datagram_t *next = dgram->next;
-        if (dgram->data) {
-            kfree(dgram->data);
-        }
-        kfree(dgram);
-        dgram = next;
+    netbuf_t *buf = sock->recv_head;
+    while (buf) {
+        netbuf_t *next = buf->next;
+        netbuf_free(buf);
+        buf = next;
     }
 
     kfree(sock);
 }
 
 /**
- * Add socket to the global list
+ * Enter a socket into the port table (udp_lock held)
  */
-static void socket_list_add(udp_socket_t *sock) {
-    sock->next = NULL;
-    sock->prev = socket_list_tail;
+static void udp_hash_add(udp_socket_t *sock) {
+    udp_socket_t **head = &udp_port_hash[udp_port_bucket(sock->local_port)];
 
-    if (socket_list_tail) {
-        socket_list_tail->next = sock;
-    } else {
-        socket_list_head = sock;
+    sock->prev = NULL;
+    sock->next = *head;
+    if (*head) {
+        (*head)->prev = sock;
     }
-    socket_list_tail = sock;
+    *head = sock;
     socket_count++;
 }
 
 /**
- * Remove socket from the global list
+ * Take a socket out of the port table (udp_lock held)
  */
-static void socket_list_remove(udp_socket_t *sock) {
+static void udp_hash_del(udp_socket_t *sock) {
     if (sock->prev) {
         sock->prev->next = sock->next;
     } else {
-        socket_list_head = sock->next;
+        udp_port_hash[udp_port_bucket(sock->local_port)] = sock->next;
     }
 
     if (sock->next) {
         sock->next->prev = sock->prev;
-    } else {
-        socket_list_tail = sock->prev;
     }
 
     sock->next = NULL;
@@ -148,13 +152,65 @@ static void socket_list_remove(udp_socket_t *sock) {
 }
 
 /**
- * Allocate an ephemeral port
+ * First socket bound to a port (udp_lock held)
+ */
+static udp_socket_t *udp_hash_find(uint16_t port) {
+    udp_socket_t *sock = udp_port_hash[udp_port_bucket(port)];
+    while (sock && sock->local_port != port) {
+        sock = sock->next;
+    }
+    return sock;
+}
+
+/**
+ * Check that every socket on a port lets it be shared (udp_lock held)
+ */
+static bool udp_port_shareable(uint16_t port) {
+    for (udp_socket_t *s = udp_hash_find(port); s; s = s->next) {
+        if (s->local_port == port && !(s->flags & UDP_SOCK_FLAG_REUSEPORT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Socket that receives a datagram (udp_lock held)
+ * When several sockets share the port, the flow's hash picks one, so all
+ * datagrams of a flow go to the same socket.
+ */
+static udp_socket_t *udp_lookup(uint32_t src_ip, uint16_t src_port,
+                                uint32_t dst_ip, uint16_t dst_port) {
+    udp_socket_t *first = udp_hash_find(dst_port);
+    if (!first || !(first->flags & UDP_SOCK_FLAG_REUSEPORT)) {
+        return first;
+    }
+
+    uint32_t count = 0;
+    for (udp_socket_t *s = first; s; s = s->next) {
+        if (s->local_port == dst_port) {
+            count++;
+        }
+    }
+
+    uint32_t pick = udp_flow_hash(src_ip, src_port, dst_ip, dst_port) % count;
+    udp_socket_t *s = first;
+    for (;; s = s->next) {
+        if (s->local_port == dst_port && pick-- == 0) {
+            break;
+        }
+    }
+    return s;
+}
+
+/**
+ * Allocate an ephemeral port (udp_lock held)
  */
 static uint16_t allocate_ephemeral_port(void) {
     uint16_t start = next_ephemeral_port;
 
     do {
-        if (!udp_port_in_use(next_ephemeral_port)) {
+        if (!udp_hash_find(next_ephemeral_port)) {
             uint16_t port = next_ephemeral_port;
             next_ephemeral_port++;
             if (next_ephemeral_port > UDP_PORT_EPHEMERAL_MAX) {
@@ -173,65 +229,85 @@ static uint16_t allocate_ephemeral_port(void) {
 }
 
 /**
- * Queue a received datagram for a socket
+ * Queue a received datagram for a socket (udp_lock held)
+ * buf holds the payload, with the source in src_ip and src_port.
  */
-static int queue_datagram(udp_socket_t *sock, const void *data, size_t len,
-                          uint32_t src_ip, uint16_t src_port) {
+static int queue_datagram(udp_socket_t *sock, netbuf_t *buf) {
     if (sock->recv_count >= UDP_RECV_QUEUE_SIZE) {
-        udp_stats.queue_full++;
-        kprintf("[UDP] Receive queue full for port %u, dropping packet\n",
-                sock->local_port);
+        kstat_inc(udp_queue_full);
         return UDP_ERR_NOBUFS;
     }
 
-    udp_datagram_t *dgram = kmalloc(sizeof(udp_datagram_t));
-    if (!dgram) {
-        return UDP_ERR_NOMEM;
-    }
-
-    dgram->data = kmalloc(len);
-    if (!dgram->data) {
-        kfree(dgram);
-        return UDP_ERR_NOMEM;
-    }
-
-    memcpy(dgram->data, data, len);
-    dgram->len = len;
-    dgram->src_ip = src_ip;
-    dgram->src_port = src_port;
-    dgram->next = NULL;
-
     /* Add to tail of queue */
+    buf->next = NULL;
     if (sock->recv_tail) {
-        sock->recv_tail->next = dgram;
+        sock->recv_tail->next = buf;
     } else {
-        sock->recv_head = dgram;
+        sock->recv_head = buf;
     }
-    sock->recv_tail = dgram;
+    sock->recv_tail = buf;
     sock->recv_count++;
 
     return UDP_OK;
 }
 
 /**
- * Dequeue a datagram from a socket
+ * Take up to max datagrams off the front of a socket's queue
+ * @return Chain of datagrams (linked through next), or NULL if empty
  */
-static udp_datagram_t *dequeue_datagram(udp_socket_t *sock) {
-    if (!sock->recv_head) {
-        return NULL;
+static netbuf_t *dequeue_datagrams(udp_socket_t *sock, uint32_t max) {
+    uint64_t flags = udp_lock_acquire();
+
+    netbuf_t *head = sock->recv_head;
+    netbuf_t *last = NULL;
+    uint32_t taken = 0;
+    for (netbuf_t *buf = head; buf && taken < max; buf = buf->next) {
+        last = buf;
+        taken++;
     }
 
-    udp_datagram_t *dgram = sock->recv_head;
-    sock->recv_head = dgram->next;
+    if (last) {
+        sock->recv_head = last->next;
+        if (!sock->recv_head) {
+            sock->recv_tail = NULL;
+        }
+        last->next = NULL;
+        sock->recv_count -= taken;
+    }
+
+    udp_lock_release(flags);
+    return last ? head : NULL;
+}
 
-    if (!sock->recv_head) {
-        sock->recv_tail = NULL;
+/**
+ * Copy a payload into a netbuf and send it
+ */
+static ssize_t udp_xmit(uint32_t dest_ip, uint16_t dest_port, uint16_t src_port,
+                        const void *data, size_t len) {
+    if (!data && len > 0) {
+        return UDP_ERR_INVALID;
     }
 
-    dgram->next = NULL;
-    sock->recv_count--;
+    if (len > UDP_MAX_PAYLOAD) {
+        kprintf("[UDP] Datagram too large: %zu bytes (max %d)\n",
+                len, UDP_MAX_PAYLOAD);
+        return UDP_ERR_TOOLARGE;
+    }
 
-    return dgram;
+    /* A netbuf is never empty; an empty payload still gets one byte */
+    size_t size = NETBUF_DEFAULT_HEADROOM + MAX(len, (size_t)1);
+    netbuf_t *buf = size <= NETBUF_MAX_SIZE ? netbuf_alloc(size, NETBUF_DEFAULT_HEADROOM) : NULL;
+    if (!buf || (len > 0 && netbuf_copy_in(buf, data, len) != 0)) {
+        netbuf_free(buf);
+        return UDP_ERR_NOMEM;
+    }
+
+    int result = udp_send_buf(buf, dest_ip, dest_port, src_port);
+    if (result < 0) {
+        netbuf_free(buf);
+        return result;
+    }
+    return (ssize_t)len;
 }
 
 /*
@@ -247,12 +323,8 @@ void udp_init(void) {
         return;
     }
 
-    /* Clear statistics */
-    memset(&udp_stats, 0, sizeof(udp_stats));
-
-    /* Initialize socket list */
-    socket_list_head = NULL;
-    socket_list_tail = NULL;
+    /* Initialize port table */
+    memset(udp_port_hash, 0, sizeof(udp_port_hash));
     socket_count = 0;
     next_ephemeral_port = UDP_PORT_EPHEMERAL_MIN;
 
@@ -264,16 +336,10 @@ void udp_init(void) {
  * Find socket bound to a port
  */
 udp_socket_t *udp_find_socket(uint16_t port) {
-    udp_socket_t *sock = socket_list_head;
-
-    while (sock) {
-        if (sock->bound && sock->local_port == port) {
-            return sock;
-        }
-        sock = sock->next;
-    }
-
-    return NULL;
+    uint64_t flags = udp_lock_acquire();
+    udp_socket_t *sock = udp_hash_find(port);
+    udp_lock_release(flags);
+    return sock;
 }
 
 /**
@@ -287,40 +353,58 @@ bool udp_port_in_use(uint16_t port) {
  * Bind to a local port
  */
 udp_socket_t *udp_bind(uint16_t port) {
+    return udp_bind_flags(port, 0);
+}
+
+/**
+ * Bind to a local port with initial socket flags
+ */
+udp_socket_t *udp_bind_flags(uint16_t port, uint32_t sock_flags) {
     if (!udp_initialized) {
         kprintf("[UDP] Error: UDP not initialized\n");
         return NULL;
     }
 
-    /* Allocate ephemeral port if requested */
-    if (port == 0) {
-        port = allocate_ephemeral_port();
-        if (port == 0) {
-            kprintf("[UDP] No ephemeral ports available\n");
-            return NULL;
-        }
-    }
-
-    /* Check if port is already in use */
-    if (udp_port_in_use(port)) {
-        kprintf("[UDP] Port %u already in use\n", port);
-        return NULL;
-    }
-
     /* Create and initialize socket */
     udp_socket_t *sock = socket_alloc();
     if (!sock) {
         return NULL;
     }
+    sock->flags = sock_flags;
 
-    sock->local_port = port;
-    sock->local_ip = 0;  /* Bind to any address */
-    sock->bound = true;
+    uint64_t flags = udp_lock_acquire();
 
-    /* Add to socket list */
-    socket_list_add(sock);
+    /* Allocate ephemeral port if requested, else check the port is free */
+    bool ok;
+    uint16_t bound_port = port;
+    if (port == 0) {
+        bound_port = allocate_ephemeral_port();
+        ok = bound_port != 0;
+    } else {
+        ok = !udp_hash_find(port) ||
+             ((sock_flags & UDP_SOCK_FLAG_REUSEPORT) && udp_port_shareable(port));
+    }
 
-    kprintf("[UDP] Bound to port %u\n", port);
+    if (ok) {
+        sock->local_port = bound_port;
+        sock->local_ip = 0;  /* Bind to any address */
+        sock->bound = true;
+        udp_hash_add(sock);
+    }
+
+    udp_lock_release(flags);
+
+    if (!ok) {
+        if (port == 0) {
+            kprintf("[UDP] No ephemeral ports available\n");
+        } else {
+            kprintf("[UDP] Port %u already in use\n", port);
+        }
+        socket_free(sock);
+        return NULL;
+    }
+
+    kprintf("[UDP] Bound to port %u\n", bound_port);
     return sock;
 }
 
@@ -332,14 +416,18 @@ int udp_unbind(uint16_t port) {
         return UDP_ERR_INVALID;
     }
 
-    udp_socket_t *sock = udp_find_socket(port);
+    uint64_t flags = udp_lock_acquire();
+    udp_socket_t *sock = udp_hash_find(port);
+    if (sock) {
+        udp_hash_del(sock);
+    }
+    udp_lock_release(flags);
+
     if (!sock) {
         kprintf("[UDP] Port %u not bound\n", port);
         return UDP_ERR_NOTBOUND;
     }
 
-    /* Remove from list and free */
-    socket_list_remove(sock);
     socket_free(sock);
 
     kprintf("[UDP] Unbound port %u\n", port);
@@ -353,7 +441,9 @@ void udp_close(udp_socket_t *sock) {
     if (!sock) return;
 
     if (sock->bound) {
-        socket_list_remove(sock);
+        uint64_t flags = udp_lock_acquire();
+        udp_hash_del(sock);
+        udp_lock_release(flags);
     }
     socket_free(sock);
 }
@@ -363,9 +453,6 @@ void udp_close(udp_socket_t *sock) {
  */
 uint16_t udp_checksum(uint32_t src_ip, uint32_t dst_ip,
                       const void *udp_data, size_t udp_len) {
-    uint32_t sum = 0;
-    const uint16_t *ptr;
-
     /* Pseudo-header */
     udp_pseudo_header_t pseudo;
     pseudo.src_ip = htonl(src_ip);
@@ -374,32 +461,8 @@ uint16_t udp_checksum(uint32_t src_ip, uint32_t dst_ip,
     pseudo.protocol = UDP_PROTOCOL;
     pseudo.udp_length = htons((uint16_t)udp_len);
 
-    /* Sum pseudo-header */
-    ptr = (const uint16_t *)&pseudo;
-    for (size_t i = 0; i < sizeof(pseudo) / 2; i++) {
-        sum += ptr[i];
-    }
-
-    /* Sum UDP header and data */
-    ptr = (const uint16_t *)udp_data;
-    size_t len = udp_len;
-
-    while (len > 1) {
-        sum += *ptr++;
-        len -= 2;
-    }
-
-    /* Handle odd byte */
-    if (len == 1) {
-        sum += *((const uint8_t *)ptr);
-    }
-
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    return (uint16_t)~sum;
+    uint32_t sum = csum_partial(&pseudo, sizeof(pseudo), 0);
+    return csum_fold(csum_partial(udp_data, udp_len, sum));
 }
 
 /**
@@ -412,67 +475,64 @@ ssize_t udp_send(uint32_t dest_ip, uint16_t dest_port, uint16_t src_port,
         return UDP_ERR_INVALID;
     }
 
-    if (!data && len > 0) {
+    kprintf("[UDP] Sending %zu bytes to %u.%u.%u.%u:%u from port %u\n",
+            len,
+            (dest_ip >> 24) & 0xFF, (dest_ip >> 16) & 0xFF,
+            (dest_ip >> 8) & 0xFF, dest_ip & 0xFF,
+            dest_port, src_port);
+
+    return udp_xmit(dest_ip, dest_port, src_port, data, len);
+}
+
+/**
+ * Send a UDP datagram held in a netbuf
+ */
+int udp_send_buf(netbuf_t *buf, uint32_t dest_ip, uint16_t dest_port, uint16_t src_port) {
+    if (!buf) {
         return UDP_ERR_INVALID;
     }
 
+    size_t len = buf->len;
     if (len > UDP_MAX_PAYLOAD) {
-        kprintf("[UDP] Datagram too large: %zu bytes (max %d)\n",
-                len, UDP_MAX_PAYLOAD);
         return UDP_ERR_TOOLARGE;
     }
 
-    /* Calculate total UDP packet size */
     size_t udp_len = UDP_HEADER_LEN + len;
-
-    /* Allocate buffer for UDP packet */
-    uint8_t *packet = kmalloc(udp_len);
-    if (!packet) {
-        return UDP_ERR_NOMEM;
+    udp_header_t *hdr = (udp_header_t *)netbuf_push(buf, UDP_HEADER_LEN);
+    if (!hdr) {
+        return UDP_ERR_NOBUFS;
     }
 
     /* Build UDP header */
-    udp_header_t *hdr = (udp_header_t *)packet;
     hdr->src_port = htons(src_port);
     hdr->dst_port = htons(dest_port);
     hdr->length = htons((uint16_t)udp_len);
-    hdr->checksum = 0;  /* Will calculate below */
+    hdr->checksum = 0;
 
-    /* Copy payload */
-    if (len > 0) {
-        memcpy(packet + UDP_HEADER_LEN, data, len);
-    }
-
-    /* Calculate checksum */
-    uint32_t local_ip = ip_get_addr();
-    hdr->checksum = udp_checksum(local_ip, dest_ip, packet, udp_len);
+    /* A datagram that will be fragmented is checksummed here */
+    if ((ip_offloads(dest_ip) & ETH_OFFLOAD_TX_CSUM) &&
+        (IP_HEADER_MIN + udp_len <= eth_mtu() || ip_is_loopback(dest_ip))) {
+        buf->flags |= NETBUF_FLAG_CSUM_L4;
+    } else {
+        hdr->checksum = udp_checksum(ip_get_addr(), dest_ip, hdr, udp_len);
 
-    /* If checksum is 0, set to 0xFFFF (per RFC 768) */
-    if (hdr->checksum == 0) {
-        hdr->checksum = 0xFFFF;
+        /* If checksum is 0, set to 0xFFFF (per RFC 768) */
+        if (hdr->checksum == 0) {
+            hdr->checksum = 0xFFFF;
+        }
     }
 
-    kprintf("[UDP] Sending %zu bytes to %u.%u.%u.%u:%u from port %u\n",
-            len,
-            (dest_ip >> 24) & 0xFF, (dest_ip >> 16) & 0xFF,
-            (dest_ip >> 8) & 0xFF, dest_ip & 0xFF,
-            dest_port, src_port);
-
-    /* Send via IP layer */
-    int result = ip_send(dest_ip, IP_PROTO_UDP, packet, udp_len);
-
-    kfree(packet);
-
+    int result = ip_send_buf(buf, dest_ip, IP_PROTO_UDP);
     if (result < 0) {
         kprintf("[UDP] Failed to send packet: %d\n", result);
         return result;
     }
 
     /* Update statistics */
-    udp_stats.packets_sent++;
-    udp_stats.bytes_sent += len;
+    kstat_inc(udp_packets_sent);
+    kstat_add(udp_bytes_sent, len);
 
-    return (ssize_t)len;
+    return UDP_OK;
 }
 
 /**
@@ -517,32 +577,85 @@ ssize_t udp_recvfrom(udp_socket_t *sock, void *buf, size_t max_len,
         return UDP_ERR_INVALID;
     }
 
-    /* Get next datagram from queue */
-    udp_datagram_t *dgram = dequeue_datagram(sock);
-    if (!dgram) {
+    udp_mmsg_t msg = { .buf = buf, .len = max_len };
+    if (udp_recvmmsg(sock, &msg, 1) == 0) {
         /* No data available */
         return 0;
     }
 
-    /* Copy data to user buffer */
-    size_t copy_len = (dgram->len < max_len) ? dgram->len : max_len;
-    memcpy(buf, dgram->data, copy_len);
-
     /* Return source information if requested */
     if (src_ip) {
-        *src_ip = dgram->src_ip;
+        *src_ip = msg.ip;
     }
     if (src_port) {
-        *src_port = dgram->src_port;
+        *src_port = msg.port;
     }
 
-    ssize_t result = (ssize_t)dgram->len;
+    return (ssize_t)msg.result;
+}
+
+/**
+ * Send a batch of datagrams from a socket
+ */
+int udp_sendmmsg(udp_socket_t *sock, udp_mmsg_t *msgs, uint32_t count) {
+    if (!sock || !sock->bound) {
+        return UDP_ERR_NOTBOUND;
+    }
 
-    /* Free datagram */
-    kfree(dgram->data);
-    kfree(dgram);
+    if (!msgs) {
+        return UDP_ERR_INVALID;
+    }
 
-    return result;
+    uint32_t sent = 0;
+    while (sent < count) {
+        udp_mmsg_t *msg = &msgs[sent];
+        ssize_t result = udp_xmit(msg->ip, msg->port, sock->local_port, msg->buf, msg->len);
+        if (result < 0) {
+            if (sent == 0) {
+                return (int)result;
+            }
+            break;
+        }
+        msg->result = (size_t)result;
+        sent++;
+    }
+
+    return (int)sent;
+}
+
+/**
+ * Receive up to count queued datagrams (non-blocking)
+ */
+int udp_recvmmsg(udp_socket_t *sock, udp_mmsg_t *msgs, uint32_t count) {
+    if (!sock || !sock->bound) {
+        return UDP_ERR_NOTBOUND;
+    }
+
+    if (!msgs || count == 0) {
+        return UDP_ERR_INVALID;
+    }
+
+    /* Take the whole batch with one pass over the queue */
+    netbuf_t *buf = dequeue_datagrams(sock, count);
+    uint32_t received = 0;
+
+    while (buf) {
+        netbuf_t *next = buf->next;
+        udp_mmsg_t *msg = &msgs[received++];
+
+        size_t copy_len = MIN(buf->len, msg->len);
+        if (msg->buf && copy_len > 0) {
+            memcpy(msg->buf, buf->data, copy_len);
+        }
+        msg->result = buf->len;
+        msg->ip = buf->src_ip;
+        msg->port = buf->src_port;
+
+        netbuf_free(buf);
+        buf = next;
+    }
+
+    return (int)received;
 }
 
 /**
@@ -556,11 +669,42 @@ int udp_input(uint32_t src_ip, const void *packet, size_t len) {
 
     if (!packet || len < UDP_HEADER_LEN) {
         kprintf("[UDP] Invalid packet: too short (%zu bytes)\n", len);
-        udp_stats.invalid_packets++;
+        kstat_inc(udp_invalid_packets);
+        return UDP_ERR_INVALID;
+    }
+
+    /* Copy into a netbuf, which the socket queues */
+    netbuf_t *buf = netbuf_alloc(len, 0);
+    if (!buf || netbuf_copy_in(buf, packet, len) != 0) {
+        netbuf_free(buf);
+        return UDP_ERR_NOMEM;
+    }
+    buf->src_ip = src_ip;
+
+    int result = udp_input_buf(buf);
+    if (result != UDP_OK) {
+        netbuf_free(buf);
+    }
+    return result;
+}
+
+/**
+ * Process an incoming UDP packet held in a netbuf
+ */
+int udp_input_buf(netbuf_t *buf) {
+    if (!udp_initialized) {
+        kprintf("[UDP] Error: UDP not initialized\n");
+        return UDP_ERR_INVALID;
+    }
+
+    if (!buf || buf->len < UDP_HEADER_LEN) {
+        kprintf("[UDP] Invalid packet: too short (%zu bytes)\n", buf ? buf->len : 0);
+        kstat_inc(udp_invalid_packets);
         return UDP_ERR_INVALID;
     }
 
-    const udp_header_t *hdr = (const udp_header_t *)packet;
+    const udp_header_t *hdr = (const udp_header_t *)buf->data;
+    uint32_t src_ip = buf->src_ip;
 
     /* Extract header fields (convert from network byte order) */
     uint16_t src_port = ntohs(hdr->src_port);
@@ -569,21 +713,21 @@ int udp_input(uint32_t src_ip, const void *packet, size_t len) {
     uint16_t checksum = hdr->checksum;
 
     /* Validate length */
-    if (udp_len < UDP_HEADER_LEN || udp_len > len) {
-        kprintf("[UDP] Invalid length: header says %u, got %zu\n", udp_len, len);
-        udp_stats.invalid_packets++;
+    if (udp_len < UDP_HEADER_LEN || udp_len > buf->len) {
+        kprintf("[UDP] Invalid length: header says %u, got %zu\n", udp_len, buf->len);
+        kstat_inc(udp_invalid_packets);
         return UDP_ERR_INVALID;
     }
 
-    /* Validate checksum if present (0 means no checksum) */
-    if (checksum != 0) {
+    /* Validate checksum if present (0 means no checksum), unless the device did */
+    if (checksum != 0 && !(buf->flags & NETBUF_FLAG_CSUM_L4_OK)) {
         uint32_t local_ip = ip_get_addr();
-        uint16_t calc_checksum = udp_checksum(src_ip, local_ip, packet, udp_len);
+        uint16_t calc_checksum = udp_checksum(src_ip, local_ip, buf->data, udp_len);
 
         /* Checksum should be 0 or 0xFFFF if correct */
         if (calc_checksum != 0 && calc_checksum != 0xFFFF) {
             kprintf("[UDP] Checksum error: expected 0, got 0x%04x\n", calc_checksum);
-            udp_stats.checksum_errors++;
+            kstat_inc(udp_checksum_errors);
             return UDP_ERR_INVALID;
         }
     }
@@ -594,27 +738,32 @@ int udp_input(uint32_t src_ip, const void *packet, size_t len) {
             (src_ip >> 8) & 0xFF, src_ip & 0xFF,
             src_port, dst_port);
 
-    /* Find socket for destination port */
-    udp_socket_t *sock = udp_find_socket(dst_port);
+    /* Keep just the payload: strip the header and any link-layer padding */
+    size_t payload_len = udp_len - UDP_HEADER_LEN;
+    netbuf_trim(buf, buf->len - udp_len);
+    netbuf_pull(buf, UDP_HEADER_LEN);
+    buf->src_port = src_port;
+
+    /* Find the socket for the destination port and queue to it */
+    uint64_t flags = udp_lock_acquire();
+    udp_socket_t *sock = udp_lookup(src_ip, src_port, buf->dst_ip, dst_port);
+    int result = sock ? queue_datagram(sock, buf) : UDP_ERR_NOTBOUND;
+    udp_lock_release(flags);
+
     if (!sock) {
         kprintf("[UDP] No socket bound to port %u\n", dst_port);
-        udp_stats.port_unreachable++;
+        kstat_inc(udp_port_unreachable);
         /* Could send ICMP Port Unreachable here */
-        return UDP_ERR_NOTBOUND;
+        return result;
     }
-
-    /* Queue the datagram payload */
-    const uint8_t *payload = (const uint8_t *)packet + UDP_HEADER_LEN;
-    size_t payload_len = udp_len - UDP_HEADER_LEN;
-
-    int result = queue_datagram(sock, payload, payload_len, src_ip, src_port);
     if (result != UDP_OK) {
+        kprintf("[UDP] Receive queue full for port %u, dropping packet\n", dst_port);
         return result;
     }
 
     /* Update statistics */
-    udp_stats.packets_recv++;
-    udp_stats.bytes_recv += payload_len;
+    kstat_inc(udp_packets_recv);
+    kstat_add(udp_bytes_recv, payload_len);
 
     return UDP_OK;
 }
@@ -623,11 +772,11 @@ int udp_input(uint32_t src_ip, const void *packet, size_t len) {
  * Get number of queued datagrams for a port
  */
 uint32_t udp_recv_queue_count(uint16_t port) {
-    udp_socket_t *sock = udp_find_socket(port);
-    if (!sock) {
-        return 0;
-    }
-    return sock->recv_count;
+    uint64_t flags = udp_lock_acquire();
+    udp_socket_t *sock = udp_hash_find(port);
+    uint32_t count = sock ? sock->recv_count : 0;
+    udp_lock_release(flags);
+    return count;
 }
 
 /**
@@ -661,13 +810,13 @@ void udp_set_broadcast(udp_socket_t *sock, bool enable) {
  */
 void udp_debug_stats(void) {
     kprintf("[UDP] Statistics:\n");
-    kprintf("  Packets sent:      %llu\n", udp_stats.packets_sent);
-    kprintf("  Packets received:  %llu\n", udp_stats.packets_recv);
-    kprintf("  Bytes sent:        %llu\n", udp_stats.bytes_sent);
-    kprintf("  Bytes received:    %llu\n", udp_stats.bytes_recv);
-    kprintf("  Checksum errors:   %llu\n", udp_stats.checksum_errors);
-    kprintf("  Port unreachable:  %llu\n", udp_stats.port_unreachable);
-    kprintf("  Queue full drops:  %llu\n", udp_stats.queue_full);
-    kprintf("  Invalid packets:   %llu\n", udp_stats.invalid_packets);
+    kprintf("  Packets sent:      %llu\n", kstat_read(KSTAT(udp_packets_sent)));
+    kprintf("  Packets received:  %llu\n", kstat_read(KSTAT(udp_packets_recv)));
+    kprintf("  Bytes sent:        %llu\n", kstat_read(KSTAT(udp_bytes_sent)));
+    kprintf("  Bytes received:    %llu\n", kstat_read(KSTAT(udp_bytes_recv)));
+    kprintf("  Checksum errors:   %llu\n", kstat_read(KSTAT(udp_checksum_errors)));
+    kprintf("  Port unreachable:  %llu\n", kstat_read(KSTAT(udp_port_unreachable)));
+    kprintf("  Queue full drops:  %llu\n", kstat_read(KSTAT(udp_queue_full)));
+    kprintf("  Invalid packets:   %llu\n", kstat_read(KSTAT(udp_invalid_packets)));
     kprintf("  Active sockets:    %u\n", socket_count);
 }
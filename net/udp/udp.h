@@ -4,15 +4,22 @@
  * Implements the User Datagram Protocol (RFC 768).
  * Features:
  *   - Connectionless datagram transmission
- *   - Port binding and management
+ *   - Port binding, with bound sockets hashed by port
+ *   - Shared ports (UDP_SOCK_FLAG_REUSEPORT), flows spread by hash
  *   - Non-blocking receive with queue
+ *   - Batched send and receive (udp_sendmmsg/udp_recvmmsg)
  *   - Integration with IP layer
+ *
+ * A socket's receive queue is a chain of netbufs, one per datagram, with
+ * the source address in the netbuf metadata. udp_input_buf queues the
+ * buffer it is given without copying it.
  */
 
 #ifndef _AAAOS_NET_UDP_H
 #define _AAAOS_NET_UDP_H
 
 #include "../../kernel/include/types.h"
+#include "../core/netbuf.h"
 
 /* UDP Protocol Constants */
 #define UDP_PROTOCOL            17          /* IP protocol number for UDP */
@@ -21,6 +28,7 @@
 #define UDP_MAX_PAYLOAD         (UDP_MAX_DATAGRAM - UDP_HEADER_LEN)
 #define UDP_MAX_SOCKETS         256         /* Maximum bound UDP sockets */
 #define UDP_RECV_QUEUE_SIZE     16          /* Max queued datagrams per socket */
+#define UDP_HASH_SIZE           256         /* Port table buckets (power of two) */
 
 /* Port ranges */
 #define UDP_PORT_EPHEMERAL_MIN  49152       /* Start of ephemeral port range */
@@ -58,15 +66,15 @@ typedef struct PACKED udp_pseudo_header {
 } udp_pseudo_header_t;
 
 /**
- * Queued datagram structure for receive queue
+ * One datagram of a batch (udp_sendmmsg, udp_recvmmsg)
  */
-typedef struct udp_datagram {
-    uint8_t  *data;             /* Datagram payload */
-    size_t   len;               /* Payload length */
-    uint32_t src_ip;            /* Source IP address */
-    uint16_t src_port;          /* Source port number */
-    struct udp_datagram *next;  /* Next in queue */
-} udp_datagram_t;
+typedef struct udp_mmsg {
+    void     *buf;              /* Payload to send, or buffer to receive into */
+    size_t   len;               /* Payload length, or buffer size */
+    uint32_t ip;                /* Destination (send) or source (receive) address */
+    uint16_t port;              /* Destination or source port */
+    size_t   result;            /* Bytes sent, or full length of the datagram received */
+} udp_mmsg_t;
 
 /**
  * UDP Socket Structure
@@ -78,14 +86,14 @@ typedef struct udp_socket {
     bool     bound;             /* Whether socket is bound */
 
     /* Receive queue */
-    udp_datagram_t *recv_head;  /* Head of receive queue */
-    udp_datagram_t *recv_tail;  /* Tail of receive queue */
+    netbuf_t *recv_head;        /* Head of receive queue (payload only) */
+    netbuf_t *recv_tail;        /* Tail of receive queue */
     uint32_t recv_count;        /* Number of queued datagrams */
 
     /* Socket flags */
     uint32_t flags;             /* Socket options/flags */
 
-    /* Linked list for socket management */
+    /* Port table chain */
     struct udp_socket *next;
     struct udp_socket *prev;
 } udp_socket_t;
@@ -93,6 +101,7 @@ typedef struct udp_socket {
 /* Socket flags */
 #define UDP_SOCK_FLAG_BROADCAST     BIT(0)  /* Allow broadcast */
 #define UDP_SOCK_FLAG_NONBLOCK      BIT(1)  /* Non-blocking mode */
+#define UDP_SOCK_FLAG_REUSEPORT     BIT(2)  /* Share the port (set at bind) */
 
 /**
  * Error codes
@@ -124,8 +133,20 @@ void udp_init(void);
  */
 udp_socket_t *udp_bind(uint16_t port);
 
+/**
+ * Bind to a local port with initial socket flags
+ * With UDP_SOCK_FLAG_REUSEPORT, the port may already be bound by sockets
+ * that all set it too. Each incoming flow (source and destination address
+ * and port) then goes to one of them, chosen by hash.
+ * @param port Port number to bind to (0 for ephemeral port)
+ * @param sock_flags UDP_SOCK_FLAG_* flags
+ * @return UDP socket on success, NULL on failure
+ */
+udp_socket_t *udp_bind_flags(uint16_t port, uint32_t sock_flags);
+
 /**
  * Unbind and release a port
+ * On a shared port this closes one of its sockets.
  * @param port Port number to release
  * @return UDP_OK on success, negative error code on failure
  */
@@ -149,6 +170,19 @@ void udp_close(udp_socket_t *sock);
 ssize_t udp_send(uint32_t dest_ip, uint16_t dest_port, uint16_t src_port,
                  const void *data, size_t len);
 
+/**
+ * Send a UDP datagram held in a netbuf
+ * buf holds the payload, with headroom for the UDP, IP and Ethernet
+ * headers (NETBUF_DEFAULT_HEADROOM). It is consumed on success; on error
+ * the caller still owns it and frees it.
+ * @param buf Payload
+ * @param dest_ip Destination IP address (host byte order)
+ * @param dest_port Destination port number
+ * @param src_port Source port number
+ * @return UDP_OK on success, or negative error code
+ */
+int udp_send_buf(netbuf_t *buf, uint32_t dest_ip, uint16_t dest_port, uint16_t src_port);
+
 /**
  * Send a UDP datagram using a socket
  * @param sock UDP socket to send from
@@ -185,6 +219,27 @@ ssize_t udp_recv(uint16_t port, void *buf, size_t max_len,
 ssize_t udp_recvfrom(udp_socket_t *sock, void *buf, size_t max_len,
                      uint32_t *src_ip, uint16_t *src_port);
 
+/**
+ * Send a batch of datagrams from a socket
+ * Stops at the first datagram that cannot be sent.
+ * @param sock UDP socket to send from
+ * @param msgs Datagrams; result is set for each one sent
+ * @param count Number of datagrams
+ * @return Number of datagrams sent, or negative error code if none was
+ */
+int udp_sendmmsg(udp_socket_t *sock, udp_mmsg_t *msgs, uint32_t count);
+
+/**
+ * Receive up to count queued datagrams (non-blocking)
+ * The datagrams are taken off the queue together. One longer than its
+ * buffer is truncated; result holds its full length.
+ * @param sock UDP socket to receive from
+ * @param msgs Buffers to fill
+ * @param count Number of buffers
+ * @return Number of datagrams received (0 if none), or negative error code
+ */
+int udp_recvmmsg(udp_socket_t *sock, udp_mmsg_t *msgs, uint32_t count);
+
 /**
  * Process incoming UDP packet from IP layer
  * @param src_ip Source IP address (host byte order)
@@ -194,6 +249,15 @@ ssize_t udp_recvfrom(udp_socket_t *sock, void *buf, size_t max_len,
  */
 int udp_input(uint32_t src_ip, const void *packet, size_t len);
 
+/**
+ * Process an incoming UDP packet held in a netbuf
+ * buf->data is the UDP header and buf->src_ip the sender. On success the
+ * buffer is queued as is (header pulled) and belongs to the socket; on
+ * error the caller still owns it.
+ * @return 0 on success, negative error code on failure
+ */
+int udp_input_buf(netbuf_t *buf);
+
 /**
  * Find socket bound to a port
  * @param port Port number to search for
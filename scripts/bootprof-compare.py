@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# AAAos boot profile comparison
+# Reads the "[BOOTPROF] <stage> <us> +<us>" lines the kernel prints to the
+# serial console (at the end of kernel_main and from the shell's "bootprof"
+# command) and compares two boots stage by stage. A stage whose own time
+# (the +<us> figure) grew by more than the threshold, both in percent and
+# in microseconds, is reported as a regression and makes the exit status 1.
+#
+# Usage: scripts/bootprof-compare.py BASELINE_LOG NEW_LOG
+#            [--percent N] [--min-us N]
+# With one log it just prints that boot's profile.
+# A log that holds several dumps (e.g. kernel_main's and a later
+# "bootprof") uses the last value seen for each stage.
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"\[BOOTPROF\] (\S+) (\d+) \+(\d+)")
+
+
+def read_profile(path):
+    stages = {}
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = LINE.search(line)
+            if match:
+                stages[match.group(1)] = (int(match.group(2)), int(match.group(3)))
+    return stages
+
+
+def print_profile(stages):
+    for name, (at, took) in stages.items():
+        print(f"{name:<14} {at / 1000:10.3f} ms  +{took} us")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare AAAos boot profiles")
+    parser.add_argument("baseline", help="serial log of the reference boot")
+    parser.add_argument("new", nargs="?", help="serial log of the boot to check")
+    parser.add_argument("--percent", type=float, default=10.0,
+                        help="slowdown of a stage, in percent, that counts (default 10)")
+    parser.add_argument("--min-us", type=int, default=500,
+                        help="slowdown of a stage, in us, that counts (default 500)")
+    args = parser.parse_args()
+
+    baseline = read_profile(args.baseline)
+    if not baseline:
+        sys.exit(f"{args.baseline}: no [BOOTPROF] lines")
+    if args.new is None:
+        print_profile(baseline)
+        return 0
+
+    new = read_profile(args.new)
+    if not new:
+        sys.exit(f"{args.new}: no [BOOTPROF] lines")
+
+    regressions = 0
+    print(f"{'stage':<14} {'baseline us':>12} {'new us':>12} {'change':>9}")
+    for name in list(baseline) + [n for n in new if n not in baseline]:
+        if name not in new or name not in baseline:
+            where = args.new if name not in new else args.baseline
+            print(f"{name:<14} missing from {where}")
+            continue
+        old_took = baseline[name][1]
+        new_took = new[name][1]
+        delta = new_took - old_took
+        percent = 100.0 * delta / old_took if old_took else 0.0
+        flag = ""
+        if delta > args.min_us and (old_took == 0 or percent > args.percent):
+            flag = "  REGRESSION"
+            regressions += 1
+        print(f"{name:<14} {old_took:>12} {new_took:>12} {percent:>+8.1f}%{flag}")
+
+    old_total = max(at for at, _ in baseline.values())
+    new_total = max(at for at, _ in new.values())
+    print(f"total: {old_total / 1000:.3f} ms -> {new_total / 1000:.3f} ms")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# AAAos netbench peer
+# Runs on the host at the far end of the guest's e1000 link and serves the
+# shell's "netbench" command:
+#   PORT      TCP stream sink (discards what it reads)
+#   PORT + 1  TCP echo (request/response and connection setup tests)
+#   PORT + 2  UDP sink (prints datagrams and bytes per second)
+#
+# Usage: scripts/netbench-peer.py [--bind ADDR] [--port PORT]
+# Then in the guest: netbench all <host address> (10.0.2.2 under QEMU user
+# networking)
+
+import argparse
+import socket
+import socketserver
+import threading
+import time
+
+BUFFER_SIZE = 1 << 20
+
+
+class StreamSink(socketserver.BaseRequestHandler):
+    def handle(self):
+        total = 0
+        start = time.monotonic()
+        while True:
+            data = self.request.recv(BUFFER_SIZE)
+            if not data:
+                break
+            total += len(data)
+        elapsed = max(time.monotonic() - start, 1e-9)
+        print(f"stream from {self.client_address[0]}: {total} bytes, "
+              f"{total * 8 / elapsed / 1e9:.2f} Gbps")
+
+
+class Echo(socketserver.BaseRequestHandler):
+    def handle(self):
+        self.request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        while True:
+            data = self.request.recv(BUFFER_SIZE)
+            if not data:
+                break
+            self.request.sendall(data)
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def udp_sink(bind, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8 << 20)
+    sock.bind((bind, port))
+    sock.settimeout(1.0)
+    packets = octets = 0
+    last = time.monotonic()
+    while True:
+        try:
+            data = sock.recv(65536)
+            packets += 1
+            octets += len(data)
+        except socket.timeout:
+            pass
+        now = time.monotonic()
+        if now - last >= 1.0 and packets:
+            print(f"udp: {packets / (now - last):.0f} pps, "
+                  f"{octets * 8 / (now - last) / 1e9:.2f} Gbps")
+            packets = octets = 0
+        if now - last >= 1.0:
+            last = now
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Peer for the AAAos netbench command")
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--port", type=int, default=5201, help="base port (default 5201)")
+    args = parser.parse_args()
+
+    servers = [Server((args.bind, args.port), StreamSink),
+               Server((args.bind, args.port + 1), Echo)]
+    for server in servers:
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    threading.Thread(target=udp_sink, args=(args.bind, args.port + 2), daemon=True).start()
+
+    print(f"netbench peer on {args.bind}: stream {args.port}, echo {args.port + 1}, "
+          f"udp {args.port + 2}")
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
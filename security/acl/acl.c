@@ -4,10 +4,23 @@
  * This module implements Unix-style file permissions and access control
  * for the AAAos kernel. It provides functions for checking and modifying
  * file access rights based on user/group ownership.
+ *
+ * Decisions go through an access vector cache (AVC). A decision depends
+ * only on the credential (uid, gid) and the object's label (owner uid,
+ * owner gid, mode), so the cache is keyed by those five values and
+ * stores all three rwx bits at once. chmod and chown change the label,
+ * and with it the key, so they need no flush. Group membership changes
+ * (auth) flush the cache by bumping a generation number.
+ *
+ * Each CPU has its own direct-mapped table, used with interrupts
+ * disabled, so lookups take no lock and entries are never torn.
  */
 
 #include "acl.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../auth/auth.h"
 
 /*============================================================================
  * Private State
@@ -15,6 +28,34 @@
 
 static bool acl_initialized = false;
 
+/* AVC entries per CPU (power of two) */
+#define ACL_AVC_ENTRIES     128
+
+/**
+ * Cached access decision
+ */
+typedef struct {
+    uint32_t uid;               /* Credential */
+    uint32_t gid;
+    uint32_t owner_uid;         /* Object label */
+    uint32_t owner_gid;
+    uint32_t generation;        /* acl_avc_generation when computed; 0 = empty */
+    uint16_t mode;
+    uint8_t allowed;            /* ACL_READ | ACL_WRITE | ACL_EXEC granted */
+} acl_avc_entry_t;
+
+typedef struct {
+    acl_avc_entry_t entries[ACL_AVC_ENTRIES];
+    uint64_t hits;
+    uint64_t misses;
+} ALIGNED(64) acl_avc_cpu_t;
+
+static acl_avc_cpu_t acl_avc[PERCPU_MAX_CPUS];
+
+/* Entries of older generations are stale */
+static volatile uint32_t acl_avc_generation = 1;
+static volatile uint64_t acl_avc_flushes = 0;
+
 /*============================================================================
  * Private Helper Functions
  *============================================================================*/
@@ -43,6 +84,67 @@ static inline bool acl_perms_allow(uint8_t perms, int access)
     return (perms & access) == access;
 }
 
+/**
+ * Compute the rwx bits a credential is granted on an object
+ */
+static uint8_t acl_compute_allowed(uint32_t uid, uint32_t gid, uint32_t owner_uid,
+                                   uint32_t owner_gid, uint32_t mode)
+{
+    if (uid == owner_uid) {
+        return acl_extract_perms(mode, ACL_OWNER_SHIFT);
+    }
+    if (gid == owner_gid || auth_is_member(uid, owner_gid)) {
+        return acl_extract_perms(mode, ACL_GROUP_SHIFT);
+    }
+    return acl_extract_perms(mode, ACL_OTHER_SHIFT);
+}
+
+static inline uint32_t acl_avc_slot(uint32_t uid, uint32_t gid, uint32_t owner_uid,
+                                    uint32_t owner_gid, uint32_t mode)
+{
+    uint32_t h = uid * 2654435761u;
+    h = (h ^ gid) * 2654435761u;
+    h = (h ^ owner_uid) * 2654435761u;
+    h = (h ^ owner_gid) * 2654435761u;
+    h = (h ^ mode) * 2654435761u;
+    return h >> (32 - 7);       /* log2(ACL_AVC_ENTRIES) */
+}
+
+/**
+ * Get the rwx bits granted on a node, through the calling CPU's AVC
+ */
+static uint8_t acl_avc_lookup(vfs_node_t *node, uint32_t uid, uint32_t gid)
+{
+    uint16_t mode = (uint16_t)(node->permissions & 0xFFF);
+    uint32_t slot = acl_avc_slot(uid, gid, node->uid, node->gid, mode);
+    uint64_t flags = interrupts_save();
+    acl_avc_cpu_t *cpu = &acl_avc[percpu_cpu_id()];
+    acl_avc_entry_t *e = &cpu->entries[slot];
+    uint32_t generation = __atomic_load_n(&acl_avc_generation, __ATOMIC_ACQUIRE);
+
+    if (e->generation == generation && e->uid == uid && e->gid == gid &&
+        e->owner_uid == node->uid && e->owner_gid == node->gid && e->mode == mode) {
+        uint8_t allowed = e->allowed;
+        cpu->hits++;
+        interrupts_restore(flags);
+        return allowed;
+    }
+
+    /* The generation was read first, so a flush during the computation
+     * leaves this entry stale rather than wrong */
+    cpu->misses++;
+    e->uid = uid;
+    e->gid = gid;
+    e->owner_uid = node->uid;
+    e->owner_gid = node->gid;
+    e->mode = mode;
+    e->allowed = acl_compute_allowed(uid, gid, node->uid, node->gid, mode);
+    e->generation = generation;
+    uint8_t allowed = e->allowed;
+    interrupts_restore(flags);
+    return allowed;
+}
+
 /*============================================================================
  * Public API Implementation
  *============================================================================*/
@@ -71,8 +173,6 @@ int acl_init(void)
  */
 int acl_check_access(vfs_node_t *node, uint32_t uid, uint32_t gid, int access)
 {
-    uint8_t perms;
-
     /* Validate input */
     if (node == NULL) {
         kprintf("[ACL] Error: NULL node in acl_check_access\n");
@@ -90,29 +190,18 @@ int acl_check_access(vfs_node_t *node, uint32_t uid, uint32_t gid, int access)
         return ACL_OK;
     }
 
-    /* Get the file's permission mode */
-    uint32_t mode = node->permissions;
-
-    /* Determine which permission class applies */
-    if (uid == node->uid) {
-        /* User is the owner - use owner permissions */
-        perms = acl_extract_perms(mode, ACL_OWNER_SHIFT);
-    } else if (gid == node->gid) {
-        /* User is in the file's group - use group permissions */
-        perms = acl_extract_perms(mode, ACL_GROUP_SHIFT);
-    } else {
-        /* User is neither owner nor in group - use other permissions */
-        perms = acl_extract_perms(mode, ACL_OTHER_SHIFT);
-    }
-
-    /* Check if the requested access is granted */
-    if (acl_perms_allow(perms, access)) {
+    /*
+     * The owner class applies to the owner, the group class to members
+     * of the file's group (primary or secondary), the other class to
+     * everyone else
+     */
+    if (acl_perms_allow(acl_avc_lookup(node, uid, gid), access)) {
         return ACL_OK;
     }
 
     kprintf("[ACL] Access denied: uid=%u, gid=%u, node_uid=%u, node_gid=%u, "
             "mode=0%o, requested=0x%x\n",
-            uid, gid, node->uid, node->gid, mode, access);
+            uid, gid, node->uid, node->gid, node->permissions, access);
 
     return ACL_ERR_DENIED;
 }
@@ -206,6 +295,38 @@ bool acl_can_exec(vfs_node_t *node, uint32_t uid, uint32_t gid)
     return acl_check_access(node, uid, gid, ACL_EXEC) == ACL_OK;
 }
 
+/**
+ * Drop every cached access decision
+ */
+void acl_avc_flush(void)
+{
+    __atomic_add_fetch(&acl_avc_generation, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&acl_avc_flushes, 1, __ATOMIC_RELAXED);
+
+    /* Generation 0 marks empty entries; skip it on wrap-around */
+    uint32_t expected = 0;
+    __atomic_compare_exchange_n(&acl_avc_generation, &expected, 1, false,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get access vector cache statistics
+ */
+void acl_avc_get_stats(acl_avc_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->hits = 0;
+    stats->misses = 0;
+    for (uint32_t i = 0; i < PERCPU_MAX_CPUS; i++) {
+        stats->hits += acl_avc[i].hits;
+        stats->misses += acl_avc[i].misses;
+    }
+    stats->flushes = acl_avc_flushes;
+}
+
 /*============================================================================
  * Utility Functions Implementation
  *============================================================================*/
@@ -118,6 +118,15 @@ typedef struct file_acl {
     file_perm_t permissions; /* Permission bits */
 } file_acl_t;
 
+/**
+ * Access vector cache statistics
+ */
+typedef struct acl_avc_stats {
+    uint64_t hits;          /* Decisions answered from the cache */
+    uint64_t misses;        /* Decisions computed */
+    uint64_t flushes;       /* acl_avc_flush calls */
+} acl_avc_stats_t;
+
 /*============================================================================
  * Public API Functions
  *============================================================================*/
@@ -133,7 +142,9 @@ int acl_init(void);
 /**
  * Check if a user has the specified access rights to a file
  * This is the main access control function that should be called
- * before any file operation.
+ * before any file operation. Members of the file's group get the group
+ * permissions whether it is their primary group or a secondary one.
+ * Decisions are cached (see acl_avc_flush).
  *
  * @param node   VFS node to check access for
  * @param uid    User ID of the requesting process
@@ -202,6 +213,20 @@ bool acl_can_write(vfs_node_t *node, uint32_t uid, uint32_t gid);
  */
 bool acl_can_exec(vfs_node_t *node, uint32_t uid, uint32_t gid);
 
+/**
+ * Drop every cached access decision
+ * Must be called whenever group membership changes; auth does this.
+ * Mode and ownership changes need no flush.
+ */
+void acl_avc_flush(void);
+
+/**
+ * Get access vector cache statistics
+ *
+ * @param stats Receives hit, miss and flush counts (summed over CPUs)
+ */
+void acl_avc_get_stats(acl_avc_stats_t *stats);
+
 /*============================================================================
  * Utility Functions
  *============================================================================*/
@@ -1,14 +1,28 @@
 /**
  * AAAos User Authentication System - Implementation
  *
- * Implements user account management, password hashing with SHA-256,
- * login/logout session handling, and multi-user support.
+ * Implements user account management, password hashing with
+ * PBKDF2-HMAC-SHA256, login/logout session handling, and multi-user
+ * support.
+ *
+ * The KDF is deliberately slow, so auth_login_async runs logins on a
+ * worker thread. After a good password the user keeps a verifier (an
+ * HMAC of stored hash and password under a key drawn at boot), which lets
+ * auth_verify_password re-check the same password cheaply while the
+ * user's sessions stay active.
  */
 
 #include "auth.h"
 #include "../../kernel/include/serial.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/sched/scheduler.h"
+#include "../../kernel/sched/timer.h"
+#include "../../kernel/sched/waitq.h"
 #include "../../lib/libc/string.h"
+#include "../crypto/crypto.h"
+#include "../acl/acl.h"
 
 /*============================================================================
  * Internal Data Structures
@@ -29,6 +43,29 @@ static user_group_t groups[AUTH_MAX_GROUPS];
 static uint32_t group_count = 0;
 static uint32_t next_gid = 101;  /* Start auto-assigned GIDs after users group */
 
+/*
+ * Lookup indexes: chained hash tables of slot numbers (-1 ends a chain),
+ * keyed by uid and username, gid and group name, and sid, plus bitmaps
+ * of used slots. member_bits[u] has bit g set when the user in slot u is
+ * a secondary member of the group in slot g.
+ */
+#define AUTH_USER_BUCKETS       (AUTH_MAX_USERS * 2)        /* Powers of two */
+#define AUTH_GROUP_BUCKETS      (AUTH_MAX_GROUPS * 2)
+#define AUTH_SESSION_BUCKETS    (AUTH_MAX_SESSIONS * 2)
+#define AUTH_SLOT_WORDS(n)      (((n) + 63) / 64)
+
+static int16_t uid_buckets[AUTH_USER_BUCKETS], uid_next[AUTH_MAX_USERS];
+static int16_t uname_buckets[AUTH_USER_BUCKETS], uname_next[AUTH_MAX_USERS];
+static int16_t gid_buckets[AUTH_GROUP_BUCKETS], gid_next[AUTH_MAX_GROUPS];
+static int16_t gname_buckets[AUTH_GROUP_BUCKETS], gname_next[AUTH_MAX_GROUPS];
+static int16_t sid_buckets[AUTH_SESSION_BUCKETS], sid_next[AUTH_MAX_SESSIONS];
+
+static uint64_t users_used[AUTH_SLOT_WORDS(AUTH_MAX_USERS)];
+static uint64_t groups_used[AUTH_SLOT_WORDS(AUTH_MAX_GROUPS)];
+static uint64_t sessions_used[AUTH_SLOT_WORDS(AUTH_MAX_SESSIONS)];
+
+static uint64_t member_bits[AUTH_MAX_USERS][AUTH_SLOT_WORDS(AUTH_MAX_GROUPS)];
+
 /* Current session (per-context, simplified for single-core) */
 static session_t *current_session = NULL;
 
@@ -38,219 +75,33 @@ static auth_stats_t stats = {0};
 /* Auth system initialized flag */
 static bool auth_initialized = false;
 
-/* Simple pseudo-random state for salt generation */
-static uint64_t random_state = 0x123456789ABCDEF0ULL;
+/* PBKDF2 iterations of new hashes */
+static uint32_t kdf_iterations = AUTH_KDF_ITERATIONS;
 
-/*============================================================================
- * SHA-256 Implementation
- *============================================================================*/
+/* Key of the cached verifiers, drawn in auth_init */
+static uint8_t verifier_key[32];
 
-/* SHA-256 constants (first 32 bits of fractional parts of cube roots of first 64 primes) */
-static const uint32_t sha256_k[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
-
-/* SHA-256 context */
+/**
+ * Login waiting for the worker thread
+ */
 typedef struct {
-    uint32_t state[8];
-    uint64_t bitlen;
-    uint8_t data[64];
-    uint32_t datalen;
-} sha256_ctx_t;
-
-/* Rotate right */
-static inline uint32_t rotr(uint32_t x, uint32_t n) {
-    return (x >> n) | (x << (32 - n));
-}
-
-/* SHA-256 choice function */
-static inline uint32_t ch(uint32_t x, uint32_t y, uint32_t z) {
-    return (x & y) ^ (~x & z);
-}
-
-/* SHA-256 majority function */
-static inline uint32_t maj(uint32_t x, uint32_t y, uint32_t z) {
-    return (x & y) ^ (x & z) ^ (y & z);
-}
-
-/* SHA-256 sigma0 */
-static inline uint32_t sig0(uint32_t x) {
-    return rotr(x, 2) ^ rotr(x, 13) ^ rotr(x, 22);
-}
-
-/* SHA-256 sigma1 */
-static inline uint32_t sig1(uint32_t x) {
-    return rotr(x, 6) ^ rotr(x, 11) ^ rotr(x, 25);
-}
-
-/* SHA-256 gamma0 */
-static inline uint32_t gam0(uint32_t x) {
-    return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3);
-}
-
-/* SHA-256 gamma1 */
-static inline uint32_t gam1(uint32_t x) {
-    return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10);
-}
-
-/* Process a 512-bit block */
-static void sha256_transform(sha256_ctx_t *ctx, const uint8_t *data) {
-    uint32_t a, b, c, d, e, f, g, h, t1, t2;
-    uint32_t w[64];
-    int i;
-
-    /* Prepare message schedule */
-    for (i = 0; i < 16; i++) {
-        w[i] = ((uint32_t)data[i * 4] << 24) |
-               ((uint32_t)data[i * 4 + 1] << 16) |
-               ((uint32_t)data[i * 4 + 2] << 8) |
-               ((uint32_t)data[i * 4 + 3]);
-    }
-    for (i = 16; i < 64; i++) {
-        w[i] = gam1(w[i - 2]) + w[i - 7] + gam0(w[i - 15]) + w[i - 16];
-    }
-
-    /* Initialize working variables */
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
-
-    /* Main loop */
-    for (i = 0; i < 64; i++) {
-        t1 = h + sig1(e) + ch(e, f, g) + sha256_k[i] + w[i];
-        t2 = sig0(a) + maj(a, b, c);
-        h = g;
-        g = f;
-        f = e;
-        e = d + t1;
-        d = c;
-        c = b;
-        b = a;
-        a = t1 + t2;
-    }
-
-    /* Update state */
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
-}
-
-/* Initialize SHA-256 context */
-static void sha256_init(sha256_ctx_t *ctx) {
-    ctx->datalen = 0;
-    ctx->bitlen = 0;
-    ctx->state[0] = 0x6a09e667;
-    ctx->state[1] = 0xbb67ae85;
-    ctx->state[2] = 0x3c6ef372;
-    ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f;
-    ctx->state[5] = 0x9b05688c;
-    ctx->state[6] = 0x1f83d9ab;
-    ctx->state[7] = 0x5be0cd19;
-}
-
-/* Update SHA-256 context with data */
-static void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
-    size_t i;
-
-    for (i = 0; i < len; i++) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
-    }
-}
-
-/* Finalize SHA-256 and output hash */
-static void sha256_final(sha256_ctx_t *ctx, uint8_t *hash) {
-    uint32_t i = ctx->datalen;
-
-    /* Pad message */
-    if (ctx->datalen < 56) {
-        ctx->data[i++] = 0x80;
-        while (i < 56) {
-            ctx->data[i++] = 0x00;
-        }
-    } else {
-        ctx->data[i++] = 0x80;
-        while (i < 64) {
-            ctx->data[i++] = 0x00;
-        }
-        sha256_transform(ctx, ctx->data);
-        memset(ctx->data, 0, 56);
-    }
-
-    /* Append message length */
-    ctx->bitlen += ctx->datalen * 8;
-    ctx->data[63] = (uint8_t)(ctx->bitlen);
-    ctx->data[62] = (uint8_t)(ctx->bitlen >> 8);
-    ctx->data[61] = (uint8_t)(ctx->bitlen >> 16);
-    ctx->data[60] = (uint8_t)(ctx->bitlen >> 24);
-    ctx->data[59] = (uint8_t)(ctx->bitlen >> 32);
-    ctx->data[58] = (uint8_t)(ctx->bitlen >> 40);
-    ctx->data[57] = (uint8_t)(ctx->bitlen >> 48);
-    ctx->data[56] = (uint8_t)(ctx->bitlen >> 56);
-    sha256_transform(ctx, ctx->data);
-
-    /* Output hash (big-endian) */
-    for (i = 0; i < 8; i++) {
-        hash[i * 4] = (ctx->state[i] >> 24) & 0xff;
-        hash[i * 4 + 1] = (ctx->state[i] >> 16) & 0xff;
-        hash[i * 4 + 2] = (ctx->state[i] >> 8) & 0xff;
-        hash[i * 4 + 3] = ctx->state[i] & 0xff;
-    }
-}
+    char username[AUTH_USERNAME_MAX];
+    char password[AUTH_PASSWORD_MAX];
+    auth_login_done_fn_t done;
+    void *arg;
+} auth_login_request_t;
+
+/* auth_login_async queue; head and tail only grow */
+static auth_login_request_t login_queue[AUTH_LOGIN_QUEUE];
+static uint32_t login_queue_head = 0;
+static volatile uint32_t login_queue_tail = 0;
+static volatile int login_queue_lock = 0;
+static volatile int login_worker_running = 0;
 
 /*============================================================================
  * Internal Helper Functions
  *============================================================================*/
 
-/**
- * Simple pseudo-random number generator (xorshift64)
- * Not cryptographically secure, but adequate for salt generation
- */
-static uint64_t random_next(void) {
-    random_state ^= random_state << 13;
-    random_state ^= random_state >> 7;
-    random_state ^= random_state << 17;
-    return random_state;
-}
-
-/**
- * Seed the random number generator
- */
-static void random_seed(uint64_t seed) {
-    random_state = seed ? seed : 0x123456789ABCDEF0ULL;
-}
-
 /**
  * Convert a byte to two hex characters
  */
@@ -284,90 +135,196 @@ static int hex_to_byte(const char *hex) {
  * Generate random salt
  */
 static void generate_salt(uint8_t *salt, size_t len) {
-    size_t i;
-    for (i = 0; i < len; i++) {
-        salt[i] = (uint8_t)(random_next() & 0xff);
-    }
+    random_get_bytes(salt, len);
 }
 
 /**
- * Get a simple timestamp (tick count for now)
- * In a real system, this would use RTC or system time
+ * Get a timestamp (milliseconds since boot)
  */
 static uint64_t get_timestamp(void) {
-    /* Use random state as a simple incrementing counter */
-    static uint64_t tick = 0;
-    return ++tick;
+    return timer_now_ms();
+}
+
+/*============================================================================
+ * Lookup Indexes
+ *============================================================================*/
+
+static inline uint32_t hash_id(uint32_t id) {
+    return id * 2654435761u;
 }
 
 /**
- * Find a free user slot
+ * FNV-1a hash of a name
  */
-static user_t* find_free_user_slot(void) {
-    for (uint32_t i = 0; i < AUTH_MAX_USERS; i++) {
-        if (!users[i].in_use) {
-            return &users[i];
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return h;
+}
+
+static void chain_insert(int16_t *buckets, int16_t *next, uint32_t bucket, uint32_t slot) {
+    next[slot] = buckets[bucket];
+    buckets[bucket] = (int16_t)slot;
+}
+
+static void chain_remove(int16_t *buckets, int16_t *next, uint32_t bucket, uint32_t slot) {
+    int16_t *link = &buckets[bucket];
+    while (*link >= 0) {
+        if ((uint32_t)*link == slot) {
+            *link = next[slot];
+            return;
         }
+        link = &next[*link];
     }
-    return NULL;
 }
 
 /**
- * Find a free session slot
+ * Find the first clear bit of a slot bitmap
+ * @return Slot number, or -1 if all max slots are used
  */
-static session_t* find_free_session_slot(void) {
-    for (uint32_t i = 0; i < AUTH_MAX_SESSIONS; i++) {
-        if (!sessions[i].in_use) {
-            return &sessions[i];
+static int find_free_slot(const uint64_t *used, uint32_t max) {
+    for (uint32_t w = 0; w < AUTH_SLOT_WORDS(max); w++) {
+        if (~used[w]) {
+            uint32_t slot = w * 64 + (uint32_t)__builtin_ctzll(~used[w]);
+            return slot < max ? (int)slot : -1;
         }
     }
-    return NULL;
+    return -1;
+}
+
+static inline void slot_set(uint64_t *bits, uint32_t slot) {
+    bits[slot / 64] |= 1ULL << (slot % 64);
+}
+
+static inline void slot_clear(uint64_t *bits, uint32_t slot) {
+    bits[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+static inline bool slot_test(const uint64_t *bits, uint32_t slot) {
+    return (bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+/**
+ * Empty every index
+ */
+static void index_reset(void) {
+    memset(uid_buckets, 0xff, sizeof(uid_buckets));
+    memset(uname_buckets, 0xff, sizeof(uname_buckets));
+    memset(gid_buckets, 0xff, sizeof(gid_buckets));
+    memset(gname_buckets, 0xff, sizeof(gname_buckets));
+    memset(sid_buckets, 0xff, sizeof(sid_buckets));
+    memset(users_used, 0, sizeof(users_used));
+    memset(groups_used, 0, sizeof(groups_used));
+    memset(sessions_used, 0, sizeof(sessions_used));
+    memset(member_bits, 0, sizeof(member_bits));
+}
+
+/**
+ * Add a user (uid and username set) to the indexes
+ */
+static void user_link(user_t *user) {
+    uint32_t slot = (uint32_t)(user - users);
+    chain_insert(uid_buckets, uid_next, hash_id(user->uid) & (AUTH_USER_BUCKETS - 1), slot);
+    chain_insert(uname_buckets, uname_next,
+                 hash_name(user->username) & (AUTH_USER_BUCKETS - 1), slot);
+    slot_set(users_used, slot);
+}
+
+static void user_unlink(user_t *user) {
+    uint32_t slot = (uint32_t)(user - users);
+    chain_remove(uid_buckets, uid_next, hash_id(user->uid) & (AUTH_USER_BUCKETS - 1), slot);
+    chain_remove(uname_buckets, uname_next,
+                 hash_name(user->username) & (AUTH_USER_BUCKETS - 1), slot);
+    slot_clear(users_used, slot);
+    memset(member_bits[slot], 0, sizeof(member_bits[slot]));
+}
+
+static void group_link(user_group_t *group) {
+    uint32_t slot = (uint32_t)(group - groups);
+    chain_insert(gid_buckets, gid_next, hash_id(group->gid) & (AUTH_GROUP_BUCKETS - 1), slot);
+    chain_insert(gname_buckets, gname_next,
+                 hash_name(group->name) & (AUTH_GROUP_BUCKETS - 1), slot);
+    slot_set(groups_used, slot);
+}
+
+static void group_unlink(user_group_t *group) {
+    uint32_t slot = (uint32_t)(group - groups);
+    chain_remove(gid_buckets, gid_next, hash_id(group->gid) & (AUTH_GROUP_BUCKETS - 1), slot);
+    chain_remove(gname_buckets, gname_next,
+                 hash_name(group->name) & (AUTH_GROUP_BUCKETS - 1), slot);
+    slot_clear(groups_used, slot);
+}
+
+static void session_link(session_t *session) {
+    uint32_t slot = (uint32_t)(session - sessions);
+    chain_insert(sid_buckets, sid_next, hash_id(session->sid) & (AUTH_SESSION_BUCKETS - 1),
+                 slot);
+    slot_set(sessions_used, slot);
+}
+
+static void session_unlink(session_t *session) {
+    uint32_t slot = (uint32_t)(session - sessions);
+    chain_remove(sid_buckets, sid_next, hash_id(session->sid) & (AUTH_SESSION_BUCKETS - 1),
+                 slot);
+    slot_clear(sessions_used, slot);
+}
+
+/**
+ * Find a free user slot
+ */
+static user_t* find_free_user_slot(void) {
+    int slot = find_free_slot(users_used, AUTH_MAX_USERS);
+    return slot >= 0 ? &users[slot] : NULL;
+}
+
+/**
+ * Find a free session slot
+ */
+static session_t* find_free_session_slot(void) {
+    int slot = find_free_slot(sessions_used, AUTH_MAX_SESSIONS);
+    return slot >= 0 ? &sessions[slot] : NULL;
 }
 
 /**
  * Find a free group slot
  */
 static user_group_t* find_free_group_slot(void) {
-    for (uint32_t i = 0; i < AUTH_MAX_GROUPS; i++) {
-        if (!groups[i].in_use) {
-            return &groups[i];
-        }
-    }
-    return NULL;
+    int slot = find_free_slot(groups_used, AUTH_MAX_GROUPS);
+    return slot >= 0 ? &groups[slot] : NULL;
 }
 
 /*============================================================================
  * Password Hashing
  *============================================================================*/
 
-int auth_hash_password(const char *password, char *hash_out) {
-    if (!password || !hash_out) {
-        return AUTH_ERR_INVAL;
-    }
-
-    uint8_t salt[AUTH_SALT_SIZE];
-    uint8_t hash[AUTH_HASH_SIZE];
-    uint8_t salted_password[AUTH_PASSWORD_MAX + AUTH_SALT_SIZE];
-    sha256_ctx_t ctx;
-
-    /* Generate random salt */
-    generate_salt(salt, AUTH_SALT_SIZE);
+/**
+ * Length of a password as hashed (longer ones are cut)
+ */
+static size_t password_length(const char *password) {
+    size_t len = strlen(password);
+    return len < AUTH_PASSWORD_MAX - 1 ? len : AUTH_PASSWORD_MAX - 1;
+}
 
-    /* Combine salt and password */
-    memcpy(salted_password, salt, AUTH_SALT_SIZE);
-    size_t pwd_len = strlen(password);
-    if (pwd_len > AUTH_PASSWORD_MAX - 1) {
-        pwd_len = AUTH_PASSWORD_MAX - 1;
+/**
+ * Format a stored hash
+ */
+static void format_hash(uint32_t iterations, const uint8_t *salt, const uint8_t *hash,
+                        char *out) {
+    char digits[10];
+    int n = 0;
+
+    strcpy(out, AUTH_HASH_PREFIX);
+    char *p = out + strlen(AUTH_HASH_PREFIX);
+    do {
+        digits[n++] = (char)('0' + iterations % 10);
+        iterations /= 10;
+    } while (iterations > 0);
+    while (n > 0) {
+        *p++ = digits[--n];
     }
-    memcpy(salted_password + AUTH_SALT_SIZE, password, pwd_len);
-
-    /* Compute SHA-256 */
-    sha256_init(&ctx);
-    sha256_update(&ctx, salted_password, AUTH_SALT_SIZE + pwd_len);
-    sha256_final(&ctx, hash);
-
-    /* Format as salt$hash in hex */
-    char *p = hash_out;
+    *p++ = '$';
     for (size_t i = 0; i < AUTH_SALT_SIZE; i++) {
         byte_to_hex(salt[i], p);
         p += 2;
@@ -378,10 +335,86 @@ int auth_hash_password(const char *password, char *hash_out) {
         p += 2;
     }
     *p = '\0';
+}
+
+/**
+ * Parse hex bytes
+ * @return Pointer past them, or NULL if malformed
+ */
+static const char* parse_hex(const char *p, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int byte = hex_to_byte(p);
+        if (byte < 0) {
+            return NULL;
+        }
+        out[i] = (uint8_t)byte;
+        p += 2;
+    }
+    return p;
+}
+
+/**
+ * Parse a stored hash
+ * @return false if it is malformed or its iteration count is out of range
+ */
+static bool parse_hash(const char *stored, uint32_t *iterations, uint8_t *salt,
+                       uint8_t *hash) {
+    size_t prefix_len = strlen(AUTH_HASH_PREFIX);
+    const char *p = stored;
+    uint64_t count = 0;
+
+    if (strncmp(p, AUTH_HASH_PREFIX, prefix_len) != 0) {
+        return false;
+    }
+    p += prefix_len;
+    while (*p >= '0' && *p <= '9') {
+        count = count * 10 + (uint64_t)(*p++ - '0');
+        if (count > AUTH_KDF_ITERATIONS_MAX) {
+            return false;
+        }
+    }
+    if (count == 0 || *p++ != '$') {
+        return false;
+    }
+
+    p = parse_hex(p, salt, AUTH_SALT_SIZE);
+    if (!p || *p++ != '$') {
+        return false;
+    }
+    p = parse_hex(p, hash, AUTH_HASH_SIZE);
+    if (!p || *p != '\0') {
+        return false;
+    }
+    *iterations = (uint32_t)count;
+    return true;
+}
+
+/**
+ * Compare two hashes in constant time
+ */
+static bool hash_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < AUTH_HASH_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+int auth_hash_password(const char *password, char *hash_out) {
+    if (!password || !hash_out) {
+        return AUTH_ERR_INVAL;
+    }
+
+    uint8_t salt[AUTH_SALT_SIZE];
+    uint8_t hash[AUTH_HASH_SIZE];
+
+    generate_salt(salt, AUTH_SALT_SIZE);
+    pbkdf2_sha256(password, password_length(password), salt, AUTH_SALT_SIZE,
+                  kdf_iterations, hash, AUTH_HASH_SIZE);
+    format_hash(kdf_iterations, salt, hash, hash_out);
 
     /* Clear sensitive data */
-    memset(salted_password, 0, sizeof(salted_password));
-    memset(&ctx, 0, sizeof(ctx));
+    memset(hash, 0, sizeof(hash));
 
     return AUTH_OK;
 }
@@ -391,64 +424,96 @@ int auth_check_hash(const char *password, const char *stored_hash) {
         return AUTH_ERR_INVAL;
     }
 
-    /* Parse stored hash: extract salt */
+    uint32_t iterations;
     uint8_t salt[AUTH_SALT_SIZE];
     uint8_t stored_hash_bytes[AUTH_HASH_SIZE];
-    const char *p = stored_hash;
-
-    /* Extract salt (hex encoded) */
-    for (size_t i = 0; i < AUTH_SALT_SIZE; i++) {
-        int byte = hex_to_byte(p);
-        if (byte < 0) {
-            return AUTH_ERR_INVAL;
-        }
-        salt[i] = (uint8_t)byte;
-        p += 2;
-    }
+    uint8_t computed_hash[AUTH_HASH_SIZE];
 
-    /* Skip separator */
-    if (*p != '$') {
+    if (!parse_hash(stored_hash, &iterations, salt, stored_hash_bytes)) {
         return AUTH_ERR_INVAL;
     }
-    p++;
 
-    /* Extract stored hash (hex encoded) */
-    for (size_t i = 0; i < AUTH_HASH_SIZE; i++) {
-        int byte = hex_to_byte(p);
-        if (byte < 0) {
-            return AUTH_ERR_INVAL;
-        }
-        stored_hash_bytes[i] = (uint8_t)byte;
-        p += 2;
-    }
+    pbkdf2_sha256(password, password_length(password), salt, AUTH_SALT_SIZE,
+                  iterations, computed_hash, AUTH_HASH_SIZE);
+    bool match = hash_equal(computed_hash, stored_hash_bytes);
 
-    /* Compute hash with extracted salt */
-    uint8_t computed_hash[AUTH_HASH_SIZE];
-    uint8_t salted_password[AUTH_PASSWORD_MAX + AUTH_SALT_SIZE];
-    sha256_ctx_t ctx;
+    /* Clear sensitive data */
+    memset(computed_hash, 0, sizeof(computed_hash));
+
+    return match ? AUTH_OK : AUTH_ERR_BADPASS;
+}
 
-    memcpy(salted_password, salt, AUTH_SALT_SIZE);
-    size_t pwd_len = strlen(password);
-    if (pwd_len > AUTH_PASSWORD_MAX - 1) {
-        pwd_len = AUTH_PASSWORD_MAX - 1;
+void auth_set_kdf_iterations(uint32_t iterations) {
+    if (iterations < AUTH_KDF_ITERATIONS_MIN) {
+        iterations = AUTH_KDF_ITERATIONS_MIN;
+    }
+    if (iterations > AUTH_KDF_ITERATIONS_MAX) {
+        iterations = AUTH_KDF_ITERATIONS_MAX;
     }
-    memcpy(salted_password + AUTH_SALT_SIZE, password, pwd_len);
+    kdf_iterations = iterations;
+}
 
-    sha256_init(&ctx);
-    sha256_update(&ctx, salted_password, AUTH_SALT_SIZE + pwd_len);
-    sha256_final(&ctx, computed_hash);
+uint32_t auth_get_kdf_iterations(void) {
+    return kdf_iterations;
+}
 
-    /* Compare hashes (constant time) */
-    int result = 0;
-    for (size_t i = 0; i < AUTH_HASH_SIZE; i++) {
-        result |= computed_hash[i] ^ stored_hash_bytes[i];
+/**
+ * Compute a user's verifier for a password
+ * The message starts with the stored hash, so after a new password (or
+ * a rehash) an old verifier can never match.
+ */
+static void compute_verifier(const user_t *user, const char *password, uint8_t *out) {
+    uint8_t message[AUTH_HASH_STRING_SIZE + AUTH_PASSWORD_MAX];
+    size_t hash_len = strlen(user->password_hash);
+    size_t pwd_len = password_length(password);
+
+    memcpy(message, user->password_hash, hash_len);
+    memcpy(message + hash_len, password, pwd_len);
+    hmac_sha256(verifier_key, sizeof(verifier_key), message, hash_len + pwd_len, out);
+    memset(message, 0, sizeof(message));
+}
+
+static void clear_verifier(user_t *user) {
+    memset(user->verifier, 0, sizeof(user->verifier));
+    user->verifier_valid = false;
+}
+
+/**
+ * Check a user's password, through the verifier if it is still fresh
+ */
+static int check_user_password(user_t *user, const char *password) {
+    uint8_t verifier[AUTH_HASH_SIZE];
+
+    if (user->verifier_valid && get_timestamp() < user->verifier_expires) {
+        compute_verifier(user, password, verifier);
+        bool match = hash_equal(verifier, user->verifier);
+        memset(verifier, 0, sizeof(verifier));
+        if (match) {
+            return AUTH_OK;
+        }
+        /* A mismatch still pays for the KDF, so guessing is no cheaper */
     }
 
-    /* Clear sensitive data */
-    memset(salted_password, 0, sizeof(salted_password));
-    memset(&ctx, 0, sizeof(ctx));
+    int result = auth_check_hash(password, user->password_hash);
+    if (result != AUTH_OK) {
+        return result;
+    }
 
-    return (result == 0) ? AUTH_OK : AUTH_ERR_BADPASS;
+    /* Bring the hash up to the current cost while the password is at hand */
+    uint32_t iterations;
+    uint8_t salt[AUTH_SALT_SIZE];
+    uint8_t hash[AUTH_HASH_SIZE];
+    if (parse_hash(user->password_hash, &iterations, salt, hash) &&
+        iterations != kdf_iterations) {
+        auth_hash_password(password, user->password_hash);
+        kprintf("[AUTH] Rehashed password of '%s' with %u iterations\n",
+                user->username, kdf_iterations);
+    }
+
+    compute_verifier(user, password, user->verifier);
+    user->verifier_valid = true;
+    user->verifier_expires = get_timestamp() + AUTH_VERIFIER_TTL_MS;
+    return AUTH_OK;
 }
 
 int auth_verify_password(const char *username, const char *password) {
@@ -467,7 +532,7 @@ int auth_verify_password(const char *username, const char *password) {
         return AUTH_ERR_LOCKED;
     }
 
-    int result = auth_check_hash(password, user->password_hash);
+    int result = check_user_password(user, password);
     if (result != AUTH_OK) {
         user->failed_logins++;
         stats.failed_logins++;
@@ -531,6 +596,7 @@ int auth_create_user(const char *username, const char *password, uint32_t uid) {
         kprintf("[AUTH] create_user: failed to hash password\n");
         return result;
     }
+    user_link(user);
 
     /* Set defaults */
     user->flags = AUTH_USER_ACTIVE;
@@ -552,6 +618,7 @@ int auth_create_user(const char *username, const char *password, uint32_t uid) {
 
     user_count++;
     stats.total_users++;
+    acl_avc_flush();            /* The uid may have been someone else's */
 
     kprintf("[AUTH] create_user: created user '%s' (uid=%u, gid=%u)\n",
             username, user->uid, user->gid);
@@ -577,25 +644,25 @@ int auth_delete_user(uint32_t uid) {
     }
 
     /* Terminate all sessions for this user */
-    for (uint32_t i = 0; i < AUTH_MAX_SESSIONS; i++) {
+    for (uint32_t i = 0; i < AUTH_MAX_SESSIONS && user->session_count > 0; i++) {
         if (sessions[i].in_use && sessions[i].uid == uid) {
             auth_logout(&sessions[i]);
         }
     }
 
     /* Remove from all groups */
-    for (uint32_t i = 0; i < AUTH_MAX_GROUPS; i++) {
-        if (groups[i].in_use) {
-            auth_remove_from_group(uid, groups[i].gid);
-        }
+    while (user->group_count > 0) {
+        auth_remove_from_group(uid, user->groups[user->group_count - 1]);
     }
 
     kprintf("[AUTH] delete_user: deleted user '%s' (uid=%u)\n",
             user->username, uid);
 
     /* Clear user data */
+    user_unlink(user);
     memset(user, 0, sizeof(user_t));
     user_count--;
+    acl_avc_flush();
 
     return AUTH_OK;
 }
@@ -611,6 +678,7 @@ int auth_set_password(uint32_t uid, const char *password) {
         return AUTH_ERR_NOENT;
     }
 
+    clear_verifier(user);
     int result = auth_hash_password(password, user->password_hash);
     if (result == AUTH_OK) {
         kprintf("[AUTH] set_password: password changed for user '%s' (uid=%u)\n",
@@ -621,8 +689,9 @@ int auth_set_password(uint32_t uid, const char *password) {
 }
 
 user_t* auth_get_user(uint32_t uid) {
-    for (uint32_t i = 0; i < AUTH_MAX_USERS; i++) {
-        if (users[i].in_use && users[i].uid == uid) {
+    for (int16_t i = uid_buckets[hash_id(uid) & (AUTH_USER_BUCKETS - 1)]; i >= 0;
+         i = uid_next[i]) {
+        if (users[i].uid == uid) {
             return &users[i];
         }
     }
@@ -634,8 +703,9 @@ user_t* auth_get_user_by_name(const char *username) {
         return NULL;
     }
 
-    for (uint32_t i = 0; i < AUTH_MAX_USERS; i++) {
-        if (users[i].in_use && strcmp(users[i].username, username) == 0) {
+    for (int16_t i = uname_buckets[hash_name(username) & (AUTH_USER_BUCKETS - 1)]; i >= 0;
+         i = uname_next[i]) {
+        if (strcmp(users[i].username, username) == 0) {
             return &users[i];
         }
     }
@@ -698,6 +768,7 @@ int auth_lock_user(uint32_t uid) {
     }
 
     user->flags |= AUTH_USER_LOCKED;
+    clear_verifier(user);
     kprintf("[AUTH] lock_user: locked user '%s' (uid=%u)\n",
             user->username, uid);
     return AUTH_OK;
@@ -760,14 +831,17 @@ int auth_login(const char *username, const char *password, session_t **session_o
     session->in_use = true;
     session->sid = next_sid++;
     session->uid = user->uid;
+    session->user = user;
     session->start_time = get_timestamp();
     session->last_activity = session->start_time;
     session->flags = SESSION_FLAG_ACTIVE;
     strncpy(session->terminal, "tty0", sizeof(session->terminal) - 1);
+    session_link(session);
 
     /* Update user info */
     user->last_login = session->start_time;
     user->failed_logins = 0;
+    user->session_count++;
 
     session_count++;
     stats.active_sessions++;
@@ -798,18 +872,23 @@ int auth_logout(session_t *session) {
     }
 
     /* Clear session data */
-    uint32_t sid = session->sid;
+    session_unlink(session);
     memset(session, 0, sizeof(session_t));
     session_count--;
     stats.active_sessions--;
-    UNUSED(sid);
+
+    /* The verifier lives only while the user is logged in somewhere */
+    if (user && user->session_count > 0 && --user->session_count == 0) {
+        clear_verifier(user);
+    }
 
     return AUTH_OK;
 }
 
 session_t* auth_get_session(uint32_t sid) {
-    for (uint32_t i = 0; i < AUTH_MAX_SESSIONS; i++) {
-        if (sessions[i].in_use && sessions[i].sid == sid) {
+    for (int16_t i = sid_buckets[hash_id(sid) & (AUTH_SESSION_BUCKETS - 1)]; i >= 0;
+         i = sid_next[i]) {
+        if (sessions[i].sid == sid) {
             return &sessions[i];
         }
     }
@@ -833,6 +912,9 @@ uint32_t auth_get_user_sessions(uint32_t uid, session_t **sessions_out, uint32_t
 void auth_touch_session(session_t *session) {
     if (session && session->in_use) {
         session->last_activity = get_timestamp();
+        if (session->user && session->user->verifier_valid) {
+            session->user->verifier_expires = session->last_activity + AUTH_VERIFIER_TTL_MS;
+        }
     }
 }
 
@@ -844,6 +926,89 @@ session_t* auth_get_current_session(void) {
     return current_session;
 }
 
+static inline void login_queue_acquire(void) {
+    while (__sync_lock_test_and_set(&login_queue_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline void login_queue_release(void) {
+    __sync_lock_release(&login_queue_lock);
+}
+
+/**
+ * Body of the auth worker thread: run queued logins one at a time
+ */
+static void login_worker(void *arg) {
+    UNUSED(arg);
+    auth_login_request_t req;
+
+    for (;;) {
+        uint64_t flags = interrupts_save();
+        login_queue_acquire();
+        uint32_t tail = login_queue_tail;
+        if (login_queue_head == tail) {
+            login_queue_release();
+            interrupts_restore(flags);
+            waitq_wait(&login_queue_tail, tail);
+            continue;
+        }
+        auth_login_request_t *slot = &login_queue[login_queue_head % AUTH_LOGIN_QUEUE];
+        req = *slot;
+        memset(slot, 0, sizeof(*slot));
+        login_queue_head++;
+        login_queue_release();
+        interrupts_restore(flags);
+
+        session_t *session = NULL;
+        int result = auth_login(req.username, req.password, &session);
+        memset(req.password, 0, sizeof(req.password));
+        if (req.done) {
+            req.done(result, session, req.arg);
+        }
+    }
+}
+
+int auth_login_async(const char *username, const char *password,
+                     auth_login_done_fn_t done, void *arg) {
+    if (!auth_initialized || !username || !password) {
+        return AUTH_ERR_INVAL;
+    }
+    if (strlen(username) >= AUTH_USERNAME_MAX) {
+        return AUTH_ERR_INVAL;
+    }
+
+    /* The first call starts the worker; it then runs for good */
+    if (!__sync_lock_test_and_set(&login_worker_running, 1)) {
+        process_t *thread = thread_create(NULL, "auth", login_worker, NULL);
+        if (!thread || !scheduler_add(thread)) {
+            kprintf("[AUTH] Failed to start login thread\n");
+            login_worker_running = 0;
+            return AUTH_ERR_NOMEM;
+        }
+    }
+
+    uint64_t flags = interrupts_save();
+    login_queue_acquire();
+    if (login_queue_tail - login_queue_head == AUTH_LOGIN_QUEUE) {
+        login_queue_release();
+        interrupts_restore(flags);
+        return AUTH_ERR_BUSY;
+    }
+    auth_login_request_t *slot = &login_queue[login_queue_tail % AUTH_LOGIN_QUEUE];
+    strcpy(slot->username, username);
+    strncpy(slot->password, password, AUTH_PASSWORD_MAX - 1);
+    slot->password[AUTH_PASSWORD_MAX - 1] = '\0';
+    slot->done = done;
+    slot->arg = arg;
+    login_queue_tail++;
+    login_queue_release();
+    interrupts_restore(flags);
+
+    waitq_wake(&login_queue_tail, 1);
+    return AUTH_OK;
+}
+
 /*============================================================================
  * Group Management
  *============================================================================*/
@@ -883,6 +1048,7 @@ int auth_create_group(const char *name, uint32_t gid) {
     group->gid = (gid != AUTH_GID_INVALID) ? gid : next_gid++;
     strncpy(group->name, name, AUTH_GROUP_NAME_MAX - 1);
     group->name[AUTH_GROUP_NAME_MAX - 1] = '\0';
+    group_link(group);
 
     group_count++;
     stats.total_groups++;
@@ -912,7 +1078,16 @@ int auth_delete_group(uint32_t gid) {
     kprintf("[AUTH] delete_group: deleted group '%s' (gid=%u)\n",
             group->name, gid);
 
+    /* Drop the group from its members' lists */
+    while (group->member_count > 0) {
+        uint32_t uid = group->members[group->member_count - 1];
+        if (auth_remove_from_group(uid, gid) != AUTH_OK) {
+            group->member_count--;      /* Member no longer exists */
+        }
+    }
+
     /* Clear group data */
+    group_unlink(group);
     memset(group, 0, sizeof(user_group_t));
     group_count--;
 
@@ -949,6 +1124,8 @@ int auth_add_to_group(uint32_t uid, uint32_t gid) {
         return AUTH_ERR_MAXGROUPS;
     }
     user->groups[user->group_count++] = gid;
+    slot_set(member_bits[user - users], (uint32_t)(group - groups));
+    acl_avc_flush();
 
     kprintf("[AUTH] add_to_group: added user '%s' to group '%s'\n",
             user->username, group->name);
@@ -977,6 +1154,8 @@ int auth_remove_from_group(uint32_t uid, uint32_t gid) {
     }
 
     /* Remove from user's group list */
+    slot_clear(member_bits[user - users], (uint32_t)(group - groups));
+    acl_avc_flush();
     for (uint32_t i = 0; i < user->group_count; i++) {
         if (user->groups[i] == gid) {
             /* Shift remaining groups */
@@ -1003,18 +1182,14 @@ bool auth_is_member(uint32_t uid, uint32_t gid) {
     }
 
     /* Check secondary groups */
-    for (uint32_t i = 0; i < user->group_count; i++) {
-        if (user->groups[i] == gid) {
-            return true;
-        }
-    }
-
-    return false;
+    user_group_t *group = auth_get_group(gid);
+    return group && slot_test(member_bits[user - users], (uint32_t)(group - groups));
 }
 
 user_group_t* auth_get_group(uint32_t gid) {
-    for (uint32_t i = 0; i < AUTH_MAX_GROUPS; i++) {
-        if (groups[i].in_use && groups[i].gid == gid) {
+    for (int16_t i = gid_buckets[hash_id(gid) & (AUTH_GROUP_BUCKETS - 1)]; i >= 0;
+         i = gid_next[i]) {
+        if (groups[i].gid == gid) {
             return &groups[i];
         }
     }
@@ -1026,8 +1201,9 @@ user_group_t* auth_get_group_by_name(const char *name) {
         return NULL;
     }
 
-    for (uint32_t i = 0; i < AUTH_MAX_GROUPS; i++) {
-        if (groups[i].in_use && strcmp(groups[i].name, name) == 0) {
+    for (int16_t i = gname_buckets[hash_name(name) & (AUTH_GROUP_BUCKETS - 1)]; i >= 0;
+         i = gname_next[i]) {
+        if (strcmp(groups[i].name, name) == 0) {
             return &groups[i];
         }
     }
@@ -1079,6 +1255,7 @@ const char* auth_strerror(int error) {
         case AUTH_ERR_MAXGROUPS: return "Maximum groups reached";
         case AUTH_ERR_LOCKED:   return "Account locked";
         case AUTH_ERR_EXPIRED:  return "Password/account expired";
+        case AUTH_ERR_BUSY:     return "Too many logins in progress";
         default:                return "Unknown error";
     }
 }
@@ -1145,14 +1322,13 @@ int auth_init(void) {
     memset(sessions, 0, sizeof(sessions));
     memset(groups, 0, sizeof(groups));
     memset(&stats, 0, sizeof(stats));
+    index_reset();
 
     user_count = 0;
     session_count = 0;
     group_count = 0;
     current_session = NULL;
-
-    /* Seed random generator (in real system, use hardware RNG or RTC) */
-    random_seed(0x1234567890ABCDEFULL);
+    random_get_bytes(verifier_key, sizeof(verifier_key));
 
     auth_initialized = true;
 
@@ -1219,6 +1395,8 @@ void auth_shutdown(void) {
     memset(users, 0, sizeof(users));
     memset(sessions, 0, sizeof(sessions));
     memset(groups, 0, sizeof(groups));
+    memset(verifier_key, 0, sizeof(verifier_key));
+    index_reset();
 
     auth_initialized = false;
     kprintf("[AUTH] Authentication subsystem shut down\n");
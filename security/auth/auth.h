@@ -2,8 +2,9 @@
  * AAAos User Authentication System
  *
  * This header defines the user authentication interface for AAAos.
- * It provides user account management, password hashing with SHA-256,
- * login/logout session handling, and multi-user support.
+ * It provides user account management, password hashing with
+ * PBKDF2-HMAC-SHA256, login/logout session handling, and multi-user
+ * support.
  */
 
 #ifndef _AAAOS_AUTH_H
@@ -27,8 +28,23 @@
 #define AUTH_GROUP_NAME_MAX     32          /* Maximum group name length */
 
 #define AUTH_SALT_SIZE          16          /* Salt size in bytes */
-#define AUTH_HASH_SIZE          32          /* SHA-256 hash size (256 bits) */
-#define AUTH_HASH_STRING_SIZE   (AUTH_SALT_SIZE * 2 + 1 + AUTH_HASH_SIZE * 2 + 1)
+#define AUTH_HASH_SIZE          32          /* Derived key size (256 bits) */
+
+/* Stored hashes read "pbkdf2-sha256$<iterations>$<salt>$<hash>" in hex */
+#define AUTH_HASH_PREFIX        "pbkdf2-sha256$"
+#define AUTH_HASH_STRING_SIZE   (sizeof(AUTH_HASH_PREFIX) - 1 + 10 + 1 + \
+                                 AUTH_SALT_SIZE * 2 + 1 + AUTH_HASH_SIZE * 2 + 1)
+
+/* PBKDF2 iteration counts (auth_set_kdf_iterations) */
+#define AUTH_KDF_ITERATIONS     100000      /* Default; about 10 ms with SHA-NI */
+#define AUTH_KDF_ITERATIONS_MIN 1000
+#define AUTH_KDF_ITERATIONS_MAX 10000000    /* Stored hashes above this are rejected */
+
+/* Cached verifiers last this long after the user's last session activity */
+#define AUTH_VERIFIER_TTL_MS    (15 * 60 * 1000)
+
+/* Logins waiting for the auth worker thread */
+#define AUTH_LOGIN_QUEUE        8
 
 /* Special UIDs */
 #define AUTH_UID_ROOT           0           /* Root/administrator UID */
@@ -56,6 +72,7 @@
 #define AUTH_ERR_MAXGROUPS      (-9)        /* Maximum groups reached */
 #define AUTH_ERR_LOCKED         (-10)       /* Account is locked */
 #define AUTH_ERR_EXPIRED        (-11)       /* Password/account expired */
+#define AUTH_ERR_BUSY           (-12)       /* Login queue is full */
 
 /* User flags */
 #define AUTH_USER_ACTIVE        BIT(0)      /* Account is active */
@@ -75,7 +92,7 @@ typedef struct user {
     uint32_t uid;                           /* User ID */
     uint32_t gid;                           /* Primary group ID */
     char username[AUTH_USERNAME_MAX];       /* Username */
-    char password_hash[AUTH_HASH_STRING_SIZE]; /* Password hash (salt$hash format) */
+    char password_hash[AUTH_HASH_STRING_SIZE]; /* Password hash (AUTH_HASH_PREFIX format) */
     char home_dir[AUTH_HOME_DIR_MAX];       /* Home directory path */
     char shell[AUTH_SHELL_MAX];             /* Default shell */
     uint32_t flags;                         /* User flags */
@@ -84,6 +101,10 @@ typedef struct user {
     uint32_t failed_logins;                 /* Failed login attempt counter */
     uint32_t groups[AUTH_MAX_GROUPS];       /* Secondary group memberships (GIDs) */
     uint32_t group_count;                   /* Number of secondary groups */
+    uint32_t session_count;                 /* Open sessions */
+    uint8_t verifier[AUTH_HASH_SIZE];       /* Keyed hash of the last good password */
+    uint64_t verifier_expires;              /* Verifier is ignored after this (ms) */
+    bool verifier_valid;
     bool in_use;                            /* Slot is in use */
 } user_t;
 
@@ -94,6 +115,7 @@ typedef struct user {
 typedef struct session {
     uint32_t sid;                           /* Session ID */
     uint32_t uid;                           /* User ID of logged-in user */
+    struct user *user;                      /* Account of uid */
     uint64_t start_time;                    /* Session start time */
     uint64_t last_activity;                 /* Last activity timestamp */
     char terminal[32];                      /* Terminal identifier (e.g., "tty1") */
@@ -256,6 +278,30 @@ int auth_unlock_user(uint32_t uid);
  */
 int auth_login(const char *username, const char *password, session_t **session_out);
 
+/**
+ * Completion callback of auth_login_async (runs on the auth thread)
+ * @param result  Return value of auth_login
+ * @param session New session, or NULL on failure
+ * @param arg     Argument given to auth_login_async
+ */
+typedef void (*auth_login_done_fn_t)(int result, session_t *session, void *arg);
+
+/**
+ * Run auth_login on the auth worker thread
+ *
+ * Returns at once, so a login screen or terminal does not stall while
+ * the password is hashed. The credentials are copied.
+ *
+ * @param username Username
+ * @param password Password
+ * @param done     Called with the result (can be NULL)
+ * @param arg      Passed to done
+ * @return AUTH_OK if queued, AUTH_ERR_BUSY if the queue is full,
+ *         AUTH_ERR_NOMEM if the worker could not be started
+ */
+int auth_login_async(const char *username, const char *password,
+                     auth_login_done_fn_t done, void *arg);
+
 /**
  * Terminate a login session (logout)
  *
@@ -285,6 +331,8 @@ uint32_t auth_get_user_sessions(uint32_t uid, session_t **sessions, uint32_t max
 /**
  * Update session's last activity timestamp
  *
+ * Also keeps the owner's cached verifier alive. Never hashes.
+ *
  * @param session Session to update
  */
 void auth_touch_session(session_t *session);
@@ -310,6 +358,10 @@ session_t* auth_get_current_session(void);
 /**
  * Verify a user's password without creating a session
  *
+ * While the user has recent session activity, a password that matches
+ * the cached verifier is accepted with one HMAC instead of the KDF. A
+ * hash with an outdated iteration count is redone on success.
+ *
  * @param username Username
  * @param password Password to verify
  * @return AUTH_OK if password matches, AUTH_ERR_BADPASS if not
@@ -317,7 +369,9 @@ session_t* auth_get_current_session(void);
 int auth_verify_password(const char *username, const char *password);
 
 /**
- * Hash a password using SHA-256 with a random salt
+ * Hash a password with PBKDF2-HMAC-SHA256 and a random salt
+ *
+ * Uses the iteration count set by auth_set_kdf_iterations.
  *
  * @param password   Plain text password
  * @param hash_out   Buffer to store result (must be AUTH_HASH_STRING_SIZE bytes)
@@ -329,11 +383,26 @@ int auth_hash_password(const char *password, char *hash_out);
  * Verify a password against a stored hash
  *
  * @param password Plain text password to check
- * @param hash     Stored hash (salt$hash format)
- * @return AUTH_OK if match, AUTH_ERR_BADPASS if not
+ * @param hash     Stored hash (AUTH_HASH_PREFIX format)
+ * @return AUTH_OK if match, AUTH_ERR_BADPASS if not, AUTH_ERR_INVAL if
+ *         the hash is malformed
  */
 int auth_check_hash(const char *password, const char *hash);
 
+/**
+ * Set the PBKDF2 iteration count of new password hashes
+ *
+ * Existing hashes keep their own count until the user next logs in.
+ *
+ * @param iterations Count, clamped to [AUTH_KDF_ITERATIONS_MIN, AUTH_KDF_ITERATIONS_MAX]
+ */
+void auth_set_kdf_iterations(uint32_t iterations);
+
+/**
+ * Get the PBKDF2 iteration count of new password hashes
+ */
+uint32_t auth_get_kdf_iterations(void);
+
 /*============================================================================
  * Group Management
  *============================================================================*/
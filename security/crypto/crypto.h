@@ -2,8 +2,9 @@
  * AAAos Security - Cryptographic Functions
  *
  * This header provides cryptographic primitives for the AAAos kernel:
- * - SHA-256 hash function
- * - Pseudo-random number generator (xorshift128+)
+ * - SHA-256 hash function (SHA-NI accelerated where available)
+ * - HMAC-SHA256 and PBKDF2-HMAC-SHA256
+ * - Random number generator (ChaCha20, seeded from RDSEED/RDRAND/TSC jitter)
  */
 
 #ifndef _AAAOS_CRYPTO_H
@@ -19,6 +20,19 @@
 #define SHA256_DIGEST_SIZE      32
 #define SHA256_BLOCK_SIZE       64
 
+/* Smallest run of data worth saving the FPU state for */
+#define SHA256_SIMD_MIN         256
+
+/**
+ * SHA-256 implementations (for benchmarking and cross-checking)
+ */
+typedef enum {
+    SHA256_IMPL_SCALAR = 0,     /* Portable C */
+    SHA256_IMPL_SHANI,          /* SHA extensions */
+    SHA256_IMPL_AVX2_X8,        /* Eight messages at a time in AVX2 lanes */
+    SHA256_IMPL_COUNT
+} sha256_impl_t;
+
 /**
  * SHA-256 context structure
  *
@@ -72,41 +86,122 @@ void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32]);
  */
 void sha256_hash(const void *data, size_t len, uint8_t hash[32]);
 
+/**
+ * Compute SHA-256 hashes of many messages
+ *
+ * Faster than hashing them one by one when they are short: they share
+ * FPU sections, and without SHA-NI they are hashed eight at a time in
+ * AVX2 lanes. The messages may have different lengths.
+ *
+ * @param data Messages
+ * @param len Length of each message in bytes
+ * @param count Number of messages
+ * @param hashes Output, one 32-byte hash per message
+ */
+void sha256_hash_many(const void *const data[], const size_t len[], size_t count,
+                      uint8_t hashes[][SHA256_DIGEST_SIZE]);
+
+/**
+ * Compute the SHA-256 hash of a file
+ *
+ * The file is read in large chunks that are hashed straight from the
+ * read buffer.
+ *
+ * @param path Path of the file
+ * @param hash Output buffer for 32-byte hash result
+ * @return true on success, false if the file could not be opened or read
+ */
+bool sha256_file(const char *path, uint8_t hash[32]);
+
+/**
+ * Check if a SHA-256 implementation can run on this CPU
+ */
+bool sha256_impl_available(sha256_impl_t impl);
+
+/**
+ * Name of a SHA-256 implementation
+ */
+const char *sha256_impl_name(sha256_impl_t impl);
+
+/**
+ * Compute SHA-256 hash in one shot with a given implementation
+ *
+ * Falls back to the portable code if impl is not available.
+ */
+void sha256_hash_impl(sha256_impl_t impl, const void *data, size_t len, uint8_t hash[32]);
+
 /*============================================================================
- * Pseudo-Random Number Generator (xorshift128+)
+ * HMAC-SHA256 and PBKDF2
  *============================================================================*/
 
 /**
- * PRNG state structure
+ * Compute HMAC-SHA256 (RFC 2104)
  *
- * Contains the internal state for the xorshift128+ algorithm.
+ * @param key Key
+ * @param key_len Key length in bytes
+ * @param data Message
+ * @param len Message length in bytes
+ * @param mac Output buffer for the 32-byte MAC
  */
-typedef struct {
-    uint64_t s[2];          /* Two 64-bit state values */
-} prng_state_t;
+void hmac_sha256(const void *key, size_t key_len, const void *data, size_t len,
+                 uint8_t mac[32]);
+
+/**
+ * Derive a key with PBKDF2-HMAC-SHA256 (RFC 8018)
+ *
+ * Costs two SHA-256 blocks per iteration and output block; runs on
+ * SHA-NI when the CPU has it.
+ *
+ * @param password Password
+ * @param password_len Password length in bytes
+ * @param salt Salt
+ * @param salt_len Salt length in bytes
+ * @param iterations Iteration count (at least 1)
+ * @param out Output buffer for the derived key
+ * @param out_len Length of the derived key in bytes
+ */
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt,
+                   size_t salt_len, uint32_t iterations, uint8_t *out, size_t out_len);
+
+/*============================================================================
+ * Random Number Generator (ChaCha20)
+ *============================================================================*/
+
+/* Entropy sources that went into the current seed (random_sources) */
+#define RANDOM_SOURCE_RDSEED    (1u << 0)
+#define RANDOM_SOURCE_RDRAND    (1u << 1)
+#define RANDOM_SOURCE_JITTER    (1u << 2)   /* TSC timing jitter */
 
 /**
- * Initialize PRNG with a seed
+ * Mix a value into the generator's seed
  *
- * Seeds the random number generator with the provided value.
- * The seed is expanded to fill the internal state.
+ * Adds to the seed rather than replacing it, so a predictable value
+ * does no harm. The generator seeds itself on first use; this is for
+ * extra material such as device serial numbers or boot timings.
  *
- * @param seed 64-bit seed value
+ * @param seed 64-bit value to mix in
  */
 void random_init(uint64_t seed);
 
 /**
- * Seed PRNG from system time
+ * Reseed from RDSEED, RDRAND and TSC jitter now
+ *
+ * The generator also reseeds on its own every few minutes.
+ */
+void random_reseed(void);
+
+/**
+ * Get the entropy sources of the current seed
  *
- * Uses the current system uptime to seed the PRNG.
- * Should be called after the timer is initialized.
+ * @return RANDOM_SOURCE_* bits, 0 if not seeded yet
  */
-void random_seed_from_time(void);
+uint32_t random_sources(void);
 
 /**
  * Fill buffer with random bytes
  *
- * Generates cryptographically unpredictable random bytes.
+ * Generates cryptographically secure random bytes. Safe to call from
+ * interrupt handlers; the common path takes no lock.
  *
  * @param buf Pointer to output buffer
  * @param len Number of bytes to generate
@@ -138,11 +233,4 @@ uint64_t random_uint64(void);
  */
 uint32_t random_range(uint32_t min, uint32_t max);
 
-/**
- * Get the current PRNG state (for debugging/testing)
- *
- * @return Pointer to current PRNG state
- */
-const prng_state_t *random_get_state(void);
-
 #endif /* _AAAOS_CRYPTO_H */
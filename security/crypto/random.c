@@ -1,220 +1,439 @@
 /**
- * AAAos Security - Pseudo-Random Number Generator
+ * AAAos Security - Random Number Generator
  *
- * Implements a fast, high-quality PRNG using the xorshift128+ algorithm.
+ * A ChaCha20 CSPRNG shared by the whole system.
  *
- * xorshift128+ features:
- * - Period: 2^128 - 1
- * - Fast: only 3 XOR and 3 shift operations per 64-bit output
- * - Passes BigCrush statistical tests
- * - Simple state: two 64-bit values
+ * Seeding: RDSEED and RDRAND output and TSC jitter samples are condensed
+ * with SHA-256 into a 256-bit seed key. The seed is refreshed every
+ * RANDOM_RESEED_NS, and random_init() folds extra material into it.
  *
- * Note: This is NOT cryptographically secure for security-critical
- * applications. For cryptographic randomness, use a dedicated CSPRNG.
+ * Output: each CPU has its own ChaCha20 key (derived from the seed key
+ * and the CPU number) and a buffer of keystream. Requests are served
+ * from that buffer with interrupts disabled for a moment, so the fast
+ * path takes no lock and touches no shared cache line. Every refill
+ * replaces the key with the first 32 bytes of the new keystream, and
+ * bytes are wiped from the buffer as they are handed out ("fast key
+ * erasure"), so a later compromise of the state does not reveal earlier
+ * output.
  */
 
 #include "crypto.h"
 #include "../../kernel/include/serial.h"
-#include "../../drivers/timer/pit.h"
+#include "../../kernel/sched/clock.h"
+#include "../../kernel/arch/x86_64/apic.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+#include "../../lib/libc/string.h"
 
-/*============================================================================
- * PRNG State
- *============================================================================*/
+/* Keystream blocks made per refill; the first 32 bytes become the next key */
+#define RANDOM_BUFFER_BLOCKS    4
+#define RANDOM_BUFFER_SIZE      (RANDOM_BUFFER_BLOCKS * 64)
+#define RANDOM_KEY_SIZE         32
 
-/* Global PRNG state */
-static prng_state_t prng_state = {
-    .s = { 0x0123456789abcdef, 0xfedcba9876543210 }  /* Default seed */
-};
+/* Large requests are generated straight into the caller's buffer, this
+ * many bytes per interrupts-off section */
+#define RANDOM_DIRECT_CHUNK     4096
 
-/* Flag to track initialization */
-static bool prng_initialized = false;
+/* Seed refresh interval (5 minutes) */
+#define RANDOM_RESEED_NS        (300ULL * 1000000000ULL)
 
-/*============================================================================
- * xorshift128+ Algorithm
- *============================================================================*/
+/* Samples gathered per seeding */
+#define RANDOM_HW_WORDS         8
+#define RANDOM_JITTER_SAMPLES   256
 
 /**
- * Generate next 64-bit random value using xorshift128+
- *
- * The algorithm:
- * 1. s1 ^= s1 << 23
- * 2. s1 ^= s1 >> 17
- * 3. s1 ^= s0 ^ (s0 >> 26)
- * 4. swap s0 and s1
- * 5. return s0 + s1
- *
- * @return 64-bit pseudo-random value
+ * Per-CPU generator
  */
-static uint64_t xorshift128plus(void)
-{
-    uint64_t s0 = prng_state.s[0];
-    uint64_t s1 = prng_state.s[1];
-    uint64_t result = s0 + s1;
+typedef struct {
+    uint32_t key[8];                    /* Current ChaCha20 key */
+    uint32_t generation;                /* Seed generation the key comes from */
+    uint32_t pos;                       /* Next unused byte of buf */
+    uint8_t buf[RANDOM_BUFFER_SIZE];    /* Keystream; bytes before pos are zero */
+} ALIGNED(64) random_cpu_t;
 
-    /* Compute new s1 */
-    s1 ^= s1 << 23;
-    s1 ^= s1 >> 17;
-    s1 ^= s0 ^ (s0 >> 26);
+static random_cpu_t random_cpus[PERCPU_MAX_CPUS];
 
-    /* Update state */
-    prng_state.s[0] = prng_state.s[1];
-    prng_state.s[1] = s1;
+/* Seed key; written under random_lock */
+static uint32_t random_seed_key[8];
+static volatile uint32_t random_generation = 0;     /* 0 until first seeded */
+static uint64_t random_seed_ns;
+static uint32_t random_source_mask;
+
+/* Serializes updates of the seed key */
+static volatile int random_lock = 0;
+
+static inline void random_acquire_lock(void)
+{
+    while (__sync_lock_test_and_set(&random_lock, 1)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static inline bool random_try_lock(void)
+{
+    return !__sync_lock_test_and_set(&random_lock, 1);
+}
 
-    return result;
+static inline void random_release_lock(void)
+{
+    __sync_lock_release(&random_lock);
 }
 
 /**
- * Mix seed using splitmix64 algorithm
- *
- * This provides good initial state distribution from a single 64-bit seed.
- * Used to expand the seed into the two-part xorshift128+ state.
- *
- * @param x Current state value (modified in place)
- * @return Next value in sequence
+ * Start a new seed generation (0 is reserved for "never seeded")
+ * Caller holds random_lock.
  */
-static uint64_t splitmix64(uint64_t *x)
+static void random_next_generation(void)
 {
-    uint64_t z = (*x += 0x9e3779b97f4a7c15);
-    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
-    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
-    return z ^ (z >> 31);
+    uint32_t next = random_generation + 1;
+    __atomic_store_n(&random_generation, next ? next : 1, __ATOMIC_RELEASE);
 }
 
 /*============================================================================
- * PRNG Public API
+ * ChaCha20
  *============================================================================*/
 
+static inline uint32_t rotl32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+#define CHACHA_QR(a, b, c, d) do {                  \
+        a += b; d ^= a; d = rotl32(d, 16);          \
+        c += d; b ^= c; b = rotl32(b, 12);          \
+        a += b; d ^= a; d = rotl32(d, 8);           \
+        c += d; b ^= c; b = rotl32(b, 7);           \
+    } while (0)
+
 /**
- * Initialize PRNG with a seed
+ * Compute one ChaCha20 block (64-bit counter, 64-bit nonce layout)
  */
-void random_init(uint64_t seed)
+static void chacha20_block(const uint32_t key[8], uint64_t counter, uint64_t nonce,
+                           uint32_t out[16])
 {
-    kprintf("[RANDOM] Initializing PRNG with seed: 0x%016llx\n", seed);
-
-    /* Use splitmix64 to expand single seed into two-part state */
-    /* This ensures good state distribution even from poor seeds */
-    prng_state.s[0] = splitmix64(&seed);
-    prng_state.s[1] = splitmix64(&seed);
-
-    /* Ensure state is not all zeros (would produce all zeros output) */
-    if (prng_state.s[0] == 0 && prng_state.s[1] == 0) {
-        prng_state.s[0] = 0x0123456789abcdef;
-        prng_state.s[1] = 0xfedcba9876543210;
-        kprintf("[RANDOM] Warning: Zero state detected, using default\n");
+    uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        (uint32_t)counter, (uint32_t)(counter >> 32), (uint32_t)nonce, (uint32_t)(nonce >> 32)
+    };
+    uint32_t x[16];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        x[i] = in[i];
+    }
+    for (i = 0; i < 10; i++) {
+        CHACHA_QR(x[0], x[4], x[8],  x[12]);
+        CHACHA_QR(x[1], x[5], x[9],  x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8],  x[13]);
+        CHACHA_QR(x[3], x[4], x[9],  x[14]);
+    }
+    for (i = 0; i < 16; i++) {
+        out[i] = x[i] + in[i];
     }
+}
 
-    prng_initialized = true;
+/*============================================================================
+ * Entropy Sources
+ *============================================================================*/
 
-    /* Warm up the generator by discarding first few values */
-    /* This helps mix the state if the seed had low entropy */
-    for (int i = 0; i < 16; i++) {
-        xorshift128plus();
+static bool rdrand64(uint64_t *out)
+{
+    /* Intel recommends ten attempts before treating RDRAND as broken */
+    for (int i = 0; i < 10; i++) {
+        uint8_t ok;
+        __asm__ __volatile__("rdrand %0; setc %1" : "=r"(*out), "=qm"(ok) : : "cc");
+        if (ok) {
+            return true;
+        }
     }
+    return false;
+}
 
-    kprintf("[RANDOM] PRNG initialized successfully\n");
-    kprintf("[RANDOM] State: s0=0x%016llx, s1=0x%016llx\n",
-            prng_state.s[0], prng_state.s[1]);
+static bool rdseed64(uint64_t *out)
+{
+    /* RDSEED runs dry under load; back off briefly between attempts */
+    for (int i = 0; i < 64; i++) {
+        uint8_t ok;
+        __asm__ __volatile__("rdseed %0; setc %1" : "=r"(*out), "=qm"(ok) : : "cc");
+        if (ok) {
+            return true;
+        }
+        __asm__ __volatile__("pause");
+    }
+    return false;
 }
 
 /**
- * Seed PRNG from system time
+ * Find out which of RDRAND and RDSEED the CPU has
  */
-void random_seed_from_time(void)
+static void random_probe(bool *has_rdrand, bool *has_rdseed)
 {
-    uint64_t seed;
-    uint64_t ticks;
-    uint64_t uptime;
-
-    kprintf("[RANDOM] Seeding from system time...\n");
-
-    /* Get timing information */
-    ticks = pit_get_ticks();
-    uptime = pit_get_uptime_ms();
-
-    /* Combine timing sources for entropy */
-    /* Mix ticks and uptime to create seed */
-    seed = ticks;
-    seed ^= uptime << 17;
-    seed ^= ticks >> 7;
-    seed ^= uptime << 43;
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t max_leaf;
+
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    *has_rdrand = (ecx & (1u << 30)) != 0;
+    *has_rdseed = false;
+    if (max_leaf >= 7) {
+        cpuid_ext(7, 0, &eax, &ebx, &ecx, &edx);
+        *has_rdseed = (ebx & (1u << 18)) != 0;
+    }
+}
 
-    /* Add some additional mixing */
-    seed = (seed ^ (seed >> 33)) * 0xff51afd7ed558ccd;
-    seed = (seed ^ (seed >> 33)) * 0xc4ceb9fe1a85ec53;
-    seed ^= seed >> 33;
+/**
+ * Feed timing jitter into a hash
+ * The TSC is read around a data-dependent walk over a small table; the
+ * low bits of the differences vary with cache, pipeline and interrupt
+ * state.
+ */
+static void random_gather_jitter(sha256_ctx_t *ctx)
+{
+    uint8_t table[256];
+    uint64_t prev = clock_cycles();
+    uint32_t idx = (uint32_t)prev;
 
-    kprintf("[RANDOM] Time-based seed: ticks=%llu, uptime=%llu ms\n",
-            ticks, uptime);
+    for (int i = 0; i < 256; i++) {
+        table[i] = (uint8_t)(i * 167 + prev);
+    }
+    for (int i = 0; i < RANDOM_JITTER_SAMPLES; i++) {
+        for (int j = 0; j < 16; j++) {
+            idx = idx * 33 + table[idx & 0xff];
+            table[(idx >> 8) & 0xff] ^= (uint8_t)idx;
+        }
+        uint64_t now = clock_cycles();
+        uint32_t delta = (uint32_t)(now - prev) ^ idx;
+        sha256_update(ctx, &delta, sizeof(delta));
+        prev = now;
+    }
+}
 
-    random_init(seed);
+/**
+ * Replace the seed key with a hash of it and fresh entropy
+ * Caller holds random_lock.
+ */
+static void random_reseed_locked(void)
+{
+    bool has_rdrand, has_rdseed;
+    uint32_t sources = RANDOM_SOURCE_JITTER;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    uint64_t word;
+
+    random_probe(&has_rdrand, &has_rdseed);
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, random_seed_key, sizeof(random_seed_key));
+    for (int i = 0; i < RANDOM_HW_WORDS; i++) {
+        if (has_rdseed && rdseed64(&word)) {
+            sha256_update(&ctx, &word, sizeof(word));
+            sources |= RANDOM_SOURCE_RDSEED;
+        }
+        if (has_rdrand && rdrand64(&word)) {
+            sha256_update(&ctx, &word, sizeof(word));
+            sources |= RANDOM_SOURCE_RDRAND;
+        }
+    }
+    random_gather_jitter(&ctx);
+    random_seed_ns = clock_monotonic_ns();
+    sha256_update(&ctx, &random_seed_ns, sizeof(random_seed_ns));
+    sha256_final(&ctx, digest);
+
+    memcpy(random_seed_key, digest, sizeof(random_seed_key));
+    memset(digest, 0, sizeof(digest));
+    memset(&ctx, 0, sizeof(ctx));
+    random_source_mask = sources;
+
+    /* Per-CPU keys notice the new generation at their next refill */
+    random_next_generation();
 }
 
+/*============================================================================
+ * Per-CPU Keystream
+ *============================================================================*/
+
 /**
- * Fill buffer with random bytes
+ * Derive a CPU's key from the current seed key
  */
-void random_get_bytes(void *buf, size_t len)
+static void random_cpu_rekey(random_cpu_t *cpu, uint32_t id)
 {
-    uint8_t *p = (uint8_t *)buf;
-    uint64_t value;
-    size_t i;
+    uint32_t block[16];
 
-    if (!buf || len == 0) {
-        kprintf("[RANDOM] Error: Invalid parameters to random_get_bytes\n");
-        return;
+    random_acquire_lock();
+    if (random_generation == 0) {
+        random_reseed_locked();
     }
+    cpu->generation = random_generation;
+    chacha20_block(random_seed_key, 0, ((uint64_t)cpu->generation << 32) | id, block);
+    random_release_lock();
 
-    if (!prng_initialized) {
-        kprintf("[RANDOM] Warning: PRNG not seeded, using default state\n");
+    for (int i = 0; i < 8; i++) {
+        cpu->key[i] ^= block[i];
     }
+    memset(block, 0, sizeof(block));
+}
 
-    /* Generate random bytes */
-    while (len >= 8) {
-        value = xorshift128plus();
-        for (i = 0; i < 8; i++) {
-            *p++ = (uint8_t)(value >> (i * 8));
+/**
+ * Replace a CPU's keystream buffer and key
+ * Called with interrupts disabled.
+ */
+static void random_cpu_refill(random_cpu_t *cpu, uint32_t id)
+{
+    uint32_t block[16];
+    uint32_t generation = __atomic_load_n(&random_generation, __ATOMIC_ACQUIRE);
+
+    if (generation == 0 || cpu->generation != generation) {
+        random_cpu_rekey(cpu, id);
+    } else if (clock_monotonic_ns() - random_seed_ns > RANDOM_RESEED_NS && random_try_lock()) {
+        /* Whoever gets the lock first refreshes the seed; the others carry on */
+        if (clock_monotonic_ns() - random_seed_ns > RANDOM_RESEED_NS) {
+            random_reseed_locked();
         }
-        len -= 8;
+        random_release_lock();
+        random_cpu_rekey(cpu, id);
     }
 
-    /* Handle remaining bytes */
-    if (len > 0) {
-        value = xorshift128plus();
-        for (i = 0; i < len; i++) {
-            *p++ = (uint8_t)(value >> (i * 8));
-        }
+    for (int i = 0; i < RANDOM_BUFFER_BLOCKS; i++) {
+        chacha20_block(cpu->key, (uint64_t)i, 0, block);
+        memcpy(cpu->buf + i * 64, block, 64);
     }
+    memset(block, 0, sizeof(block));
+    memcpy(cpu->key, cpu->buf, RANDOM_KEY_SIZE);
+    memset(cpu->buf, 0, RANDOM_KEY_SIZE);
+    cpu->pos = RANDOM_KEY_SIZE;
 }
 
 /**
- * Get a random 32-bit unsigned integer
+ * Generate keystream straight into a buffer
+ * Uses counters past those of the buffer, then rekeys, so no block is
+ * ever produced twice. Called with interrupts disabled.
  */
-uint32_t random_uint32(void)
+static void random_cpu_direct(random_cpu_t *cpu, uint32_t id, uint8_t *out, size_t len)
 {
-    if (!prng_initialized) {
-        kprintf("[RANDOM] Warning: PRNG not seeded, using default state\n");
+    uint64_t counter = RANDOM_BUFFER_BLOCKS;
+    uint32_t block[16];
+
+    if (cpu->generation != __atomic_load_n(&random_generation, __ATOMIC_ACQUIRE) ||
+        cpu->pos == 0) {
+        random_cpu_refill(cpu, id);
+    }
+    while (len > 0) {
+        size_t n = len < 64 ? len : 64;
+        chacha20_block(cpu->key, counter++, 0, block);
+        memcpy(out, block, n);
+        out += n;
+        len -= n;
     }
+    memset(block, 0, sizeof(block));
+    random_cpu_refill(cpu, id);
+}
 
-    /* Return lower 32 bits of 64-bit output */
-    return (uint32_t)xorshift128plus();
+/*============================================================================
+ * Public API
+ *============================================================================*/
+
+void random_init(uint64_t seed)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    uint64_t flags = interrupts_save();
+
+    random_acquire_lock();
+    sha256_init(&ctx);
+    sha256_update(&ctx, random_seed_key, sizeof(random_seed_key));
+    sha256_update(&ctx, &seed, sizeof(seed));
+    sha256_final(&ctx, digest);
+    memcpy(random_seed_key, digest, sizeof(random_seed_key));
+    memset(digest, 0, sizeof(digest));
+    memset(&ctx, 0, sizeof(ctx));
+
+    /* Before the first seeding the value simply waits in the seed key */
+    if (random_generation != 0) {
+        random_next_generation();
+    }
+    random_release_lock();
+    interrupts_restore(flags);
 }
 
-/**
- * Get a random 64-bit unsigned integer
- */
-uint64_t random_uint64(void)
+void random_reseed(void)
+{
+    uint64_t flags = interrupts_save();
+
+    random_acquire_lock();
+    random_reseed_locked();
+    random_release_lock();
+    interrupts_restore(flags);
+
+    kprintf("[RANDOM] Seeded from%s%s jitter\n",
+            (random_source_mask & RANDOM_SOURCE_RDSEED) ? " RDSEED" : "",
+            (random_source_mask & RANDOM_SOURCE_RDRAND) ? " RDRAND" : "");
+}
+
+uint32_t random_sources(void)
+{
+    return random_generation ? random_source_mask : 0;
+}
+
+void random_get_bytes(void *buf, size_t len)
 {
-    if (!prng_initialized) {
-        kprintf("[RANDOM] Warning: PRNG not seeded, using default state\n");
+    uint8_t *p = (uint8_t*)buf;
+
+    if (!buf) {
+        return;
+    }
+
+    while (len > 0) {
+        uint64_t flags = interrupts_save();
+        uint32_t id = percpu_cpu_id();
+        random_cpu_t *cpu = &random_cpus[id];
+        size_t n;
+
+        if (len >= RANDOM_BUFFER_SIZE) {
+            n = len < RANDOM_DIRECT_CHUNK ? len : RANDOM_DIRECT_CHUNK;
+            random_cpu_direct(cpu, id, p, n);
+        } else {
+            if (cpu->pos == 0 || cpu->pos == RANDOM_BUFFER_SIZE) {
+                random_cpu_refill(cpu, id);
+            }
+            n = RANDOM_BUFFER_SIZE - cpu->pos;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(p, cpu->buf + cpu->pos, n);
+            memset(cpu->buf + cpu->pos, 0, n);
+            cpu->pos += n;
+        }
+        interrupts_restore(flags);
+
+        p += n;
+        len -= n;
     }
+}
 
-    return xorshift128plus();
+uint32_t random_uint32(void)
+{
+    uint32_t value;
+    random_get_bytes(&value, sizeof(value));
+    return value;
+}
+
+uint64_t random_uint64(void)
+{
+    uint64_t value;
+    random_get_bytes(&value, sizeof(value));
+    return value;
 }
 
 /**
  * Get a random number in a specified range
  *
- * Uses rejection sampling to ensure uniform distribution.
- * This avoids bias that would occur with simple modulo.
+ * Uses rejection sampling to ensure uniform distribution: values in the
+ * partial bucket at the top of the 32-bit range are drawn again.
  */
 uint32_t random_range(uint32_t min, uint32_t max)
 {
@@ -222,48 +441,19 @@ uint32_t random_range(uint32_t min, uint32_t max)
     uint32_t limit;
     uint32_t value;
 
-    if (!prng_initialized) {
-        kprintf("[RANDOM] Warning: PRNG not seeded, using default state\n");
-    }
-
-    /* Handle edge cases */
     if (min >= max) {
         return min;
     }
 
-    /* Calculate range size */
     range = max - min + 1;
-
-    /* Handle full range case */
     if (range == 0) {
-        /* Overflow: range is 2^32 */
-        return random_uint32();
+        return random_uint32();     /* Full 32-bit range */
     }
 
-    /*
-     * Rejection sampling for uniform distribution:
-     *
-     * Simple modulo (random % range) produces biased results when
-     * UINT32_MAX+1 is not evenly divisible by range.
-     *
-     * Example: range=3, values 0-4 give 0,1,2,0,1 - uneven!
-     *
-     * Solution: reject values >= (UINT32_MAX - UINT32_MAX % range)
-     * This discards the "partial bucket" at the end.
-     */
     limit = UINT32_MAX - (UINT32_MAX % range);
-
     do {
         value = random_uint32();
     } while (value >= limit);
 
     return min + (value % range);
 }
-
-/**
- * Get the current PRNG state (for debugging/testing)
- */
-const prng_state_t *random_get_state(void)
-{
-    return &prng_state;
-}
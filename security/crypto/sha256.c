@@ -7,10 +7,21 @@
  * SHA-256 produces a 256-bit (32-byte) message digest and is widely
  * used for data integrity verification, digital signatures, and
  * password hashing.
+ *
+ * Blocks are compressed by the SHA extensions (SHA-NI) when the CPU has
+ * them, and by portable code otherwise. Hashing many messages at once can
+ * also run eight of them side by side in AVX2 lanes. The SIMD versions
+ * are written with GCC vector extensions under target attributes, since
+ * the kernel is otherwise built without SSE, and run between
+ * kernel_fpu_begin and kernel_fpu_end.
  */
 
 #include "crypto.h"
 #include "../../kernel/include/serial.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/arch/x86_64/fpu.h"
+#include "../../kernel/arch/x86_64/apic.h"
+#include "../../fs/vfs/vfs.h"
 #include "../../lib/libc/string.h"
 
 /*============================================================================
@@ -63,7 +74,7 @@ static const uint32_t sha256_k[64] = {
  * SHA-256 Helper Macros
  *============================================================================*/
 
-/* Right rotate (circular right shift) */
+/* Right rotate (circular right shift); also used on vectors */
 #define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
 
 /* Right shift */
@@ -83,46 +94,203 @@ static const uint32_t sha256_k[64] = {
  * SHA-256 Internal Functions
  *============================================================================*/
 
+/* Blocks compressed per kernel_fpu_begin section (interrupts are off) */
+#define SHA256_FPU_BLOCKS       256
+
+/* Read size for hashing files; a multiple of the block size */
+#define SHA256_FILE_CHUNK       (64 * 1024)
+
+/* Messages hashed side by side on the multi-buffer path */
+#define SHA256_LANES            8
+
+/* Vector types for the SIMD versions */
+typedef int sha256_v4si __attribute__((vector_size(16)));
+typedef uint8_t sha256_v16qu __attribute__((vector_size(16)));
+typedef uint32_t sha256_v8su __attribute__((vector_size(32)));
+
+/* Compresses whole blocks into a state */
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *p, size_t blocks);
+
+/* CPU support, probed on first use */
+static volatile int sha256_probed = 0;
+static bool sha256_has_shani = false;
+
+static inline uint32_t sha256_load_be32(const uint8_t *p)
+{
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+static inline void sha256_store_be32(uint8_t *p, uint32_t v)
+{
+    v = __builtin_bswap32(v);
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
 /**
- * Process a single 512-bit (64-byte) block
+ * Process 512-bit (64-byte) blocks with portable code
  *
- * @param ctx SHA-256 context
- * @param block Pointer to 64-byte block to process
+ * @param state Hash state to update
+ * @param p First block
+ * @param blocks Number of blocks
  */
-static void sha256_transform(sha256_ctx_t *ctx, const uint8_t block[64])
+static void sha256_blocks_scalar(uint32_t state[8], const uint8_t *p, size_t blocks)
 {
     uint32_t w[64];     /* Message schedule */
     uint32_t a, b, c, d, e, f, g, h;
     uint32_t t1, t2;
     int i;
 
-    /* Prepare message schedule */
-    /* First 16 words are directly from the input block (big-endian) */
-    for (i = 0; i < 16; i++) {
-        w[i] = ((uint32_t)block[i * 4 + 0] << 24) |
-               ((uint32_t)block[i * 4 + 1] << 16) |
-               ((uint32_t)block[i * 4 + 2] << 8) |
-               ((uint32_t)block[i * 4 + 3]);
+    for (; blocks > 0; blocks--, p += SHA256_BLOCK_SIZE) {
+        /* First 16 words are directly from the input block (big-endian) */
+        for (i = 0; i < 16; i++) {
+            w[i] = sha256_load_be32(p + i * 4);
+        }
+
+        /* Remaining 48 words are derived from earlier words */
+        for (i = 16; i < 64; i++) {
+            w[i] = sigma1(w[i - 2]) + w[i - 7] + sigma0(w[i - 15]) + w[i - 16];
+        }
+
+        /* Initialize working variables with current hash value */
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        /* Main compression loop - 64 rounds */
+        for (i = 0; i < 64; i++) {
+            t1 = h + SIGMA1(e) + CH(e, f, g) + sha256_k[i] + w[i];
+            t2 = SIGMA0(a) + MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        /* Add compressed chunk to current hash value */
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
     }
+}
 
-    /* Remaining 48 words are derived from earlier words */
-    for (i = 16; i < 64; i++) {
-        w[i] = sigma1(w[i - 2]) + w[i - 7] + sigma0(w[i - 15]) + w[i - 16];
+#if defined(__x86_64__)
+
+/* { y1, y2, y3, x0 }, as palignr by four bytes */
+#define SHA256_ALIGNR4(x, y)    __builtin_shuffle((y), (x), (sha256_v4si){ 1, 2, 3, 4 })
+
+/**
+ * Process blocks with the SHA extensions
+ *
+ * sha256rnds2 does two rounds on the state split as ABEF and CDGH;
+ * sha256msg1 and sha256msg2 extend the message schedule four words at a
+ * time, overlapped with the rounds using the previous four.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *p, size_t blocks)
+{
+    const sha256_v16qu bswap = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+    sha256_v4si lo, hi, abef, cdgh;
+
+    __builtin_memcpy(&lo, &state[0], sizeof(lo));       /* DCBA */
+    __builtin_memcpy(&hi, &state[4], sizeof(hi));       /* HGFE */
+    abef = __builtin_shuffle(hi, lo, (sha256_v4si){ 1, 0, 5, 4 });
+    cdgh = __builtin_shuffle(hi, lo, (sha256_v4si){ 3, 2, 7, 6 });
+
+    for (; blocks > 0; blocks--, p += SHA256_BLOCK_SIZE) {
+        sha256_v4si abef_save = abef, cdgh_save = cdgh;
+        sha256_v4si m[4];
+
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                sha256_v16qu bytes;
+                __builtin_memcpy(&bytes, p + g * 16, sizeof(bytes));
+                m[g] = (sha256_v4si)__builtin_shuffle(bytes, bswap);
+            }
+
+            sha256_v4si k, x;
+            __builtin_memcpy(&k, &sha256_k[g * 4], sizeof(k));
+            x = m[g & 3] + k;
+            cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, x);
+
+            /* Words 4g+4..4g+7, from msg1 of the group three back */
+            if (g >= 3 && g < 15) {
+                sha256_v4si t = m[(g + 1) & 3] + SHA256_ALIGNR4(m[g & 3], m[(g - 1) & 3]);
+                m[(g + 1) & 3] = __builtin_ia32_sha256msg2(t, m[g & 3]);
+            }
+
+            x = __builtin_shuffle(x, (sha256_v4si){ 2, 3, 0, 0 });
+            abef = __builtin_ia32_sha256rnds2(abef, cdgh, x);
+
+            if (g >= 1 && g < 13) {
+                m[(g - 1) & 3] = __builtin_ia32_sha256msg1(m[(g - 1) & 3], m[g & 3]);
+            }
+        }
+
+        abef += abef_save;
+        cdgh += cdgh_save;
     }
 
-    /* Initialize working variables with current hash value */
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
+    lo = __builtin_shuffle(abef, cdgh, (sha256_v4si){ 3, 2, 7, 6 });
+    hi = __builtin_shuffle(abef, cdgh, (sha256_v4si){ 1, 0, 5, 4 });
+    __builtin_memcpy(&state[0], &lo, sizeof(lo));
+    __builtin_memcpy(&state[4], &hi, sizeof(hi));
+}
+
+/**
+ * Process one block of each of eight messages, one per AVX2 lane
+ *
+ * @param state Hash states, state[i][lane] being word i of a lane
+ * @param blocks Block to add for each lane
+ */
+__attribute__((target("avx2")))
+static void sha256_blocks_x8_avx2(uint32_t state[8][SHA256_LANES],
+                                  const uint8_t *const blocks[SHA256_LANES])
+{
+    uint32_t words[16][SHA256_LANES];
+    sha256_v8su w[16], s[8];
+    sha256_v8su a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    /* Transpose the blocks so each vector holds one word of every lane */
+    for (i = 0; i < 16; i++) {
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            words[i][lane] = sha256_load_be32(blocks[lane] + i * 4);
+        }
+    }
+    __builtin_memcpy(w, words, sizeof(w));
+    __builtin_memcpy(s, state, sizeof(s));
+
+    a = s[0];
+    b = s[1];
+    c = s[2];
+    d = s[3];
+    e = s[4];
+    f = s[5];
+    g = s[6];
+    h = s[7];
 
-    /* Main compression loop - 64 rounds */
     for (i = 0; i < 64; i++) {
-        t1 = h + SIGMA1(e) + CH(e, f, g) + sha256_k[i] + w[i];
+        if (i >= 16) {
+            w[i & 15] += sigma1(w[(i - 2) & 15]) + w[(i - 7) & 15] + sigma0(w[(i - 15) & 15]);
+        }
+        t1 = h + SIGMA1(e) + CH(e, f, g) + sha256_k[i] + w[i & 15];
         t2 = SIGMA0(a) + MAJ(a, b, c);
         h = g;
         g = f;
@@ -134,21 +302,246 @@ static void sha256_transform(sha256_ctx_t *ctx, const uint8_t block[64])
         a = t1 + t2;
     }
 
-    /* Add compressed chunk to current hash value */
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+    __builtin_memcpy(state, s, sizeof(s));
+}
+
+static void sha256_probe(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool sse41 = (ecx & BIT(19)) != 0;
+
+    if (max_leaf >= 7) {
+        cpuid_ext(7, 0, &eax, &ebx, &ecx, &edx);
+        sha256_has_shani = sse41 && (ebx & BIT(29));
+    }
+
+    __sync_synchronize();
+    sha256_probed = 1;
+}
+
+#endif /* __x86_64__ */
+
+/**
+ * Compress blocks with the given implementation
+ * SIMD versions run in bounded kernel_fpu_begin sections.
+ */
+static void sha256_blocks_impl(sha256_impl_t impl, uint32_t state[8], const uint8_t *p,
+                               size_t blocks)
+{
+#if defined(__x86_64__)
+    if (impl == SHA256_IMPL_SHANI && sha256_impl_available(impl)) {
+        while (blocks > 0) {
+            size_t n = blocks < SHA256_FPU_BLOCKS ? blocks : SHA256_FPU_BLOCKS;
+            kernel_fpu_begin();
+            sha256_blocks_shani(state, p, n);
+            kernel_fpu_end();
+            p += n * SHA256_BLOCK_SIZE;
+            blocks -= n;
+        }
+        return;
+    }
+#endif
+    (void)impl;
+    sha256_blocks_scalar(state, p, blocks);
+}
+
+/**
+ * Best implementation for a run of blocks
+ */
+static sha256_impl_t sha256_pick(size_t blocks)
+{
+    if (blocks * SHA256_BLOCK_SIZE >= SHA256_SIMD_MIN &&
+        sha256_impl_available(SHA256_IMPL_SHANI)) {
+        return SHA256_IMPL_SHANI;
+    }
+    return SHA256_IMPL_SCALAR;
+}
+
+/**
+ * Build the final block(s) of a message
+ *
+ * @param out Receives the padded tail (up to two blocks)
+ * @param rest Bytes after the last whole block
+ * @param rest_len Number of those bytes (under 64)
+ * @param total Length of the whole message in bytes
+ * @return Number of blocks written (1 or 2)
+ */
+static size_t sha256_pad(uint8_t out[2 * SHA256_BLOCK_SIZE], const uint8_t *rest,
+                         size_t rest_len, uint64_t total)
+{
+    /* 1 bit, zeros, then the 64-bit length in bits, to a block boundary */
+    size_t blocks = rest_len < 56 ? 1 : 2;
+    size_t end = blocks * SHA256_BLOCK_SIZE;
+    uint64_t total_bits = total * 8;
+
+    memcpy(out, rest, rest_len);
+    out[rest_len] = 0x80;
+    memset(out + rest_len + 1, 0, end - 8 - rest_len - 1);
+    sha256_store_be32(out + end - 8, (uint32_t)(total_bits >> 32));
+    sha256_store_be32(out + end - 4, (uint32_t)total_bits);
+    return blocks;
+}
+
+static void sha256_output(const uint32_t state[8], uint8_t hash[32])
+{
+    for (int i = 0; i < 8; i++) {
+        sha256_store_be32(hash + i * 4, state[i]);
+    }
+}
+
+/**
+ * Hash a whole message with a block function (in an FPU section if needed)
+ */
+static void sha256_digest(sha256_blocks_fn blocks_fn, const uint8_t *p, size_t len,
+                          uint8_t hash[32])
+{
+    uint32_t state[8];
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+    size_t full = len / SHA256_BLOCK_SIZE;
+
+    memcpy(state, sha256_h0, sizeof(state));
+    blocks_fn(state, p, full);
+    size_t n = sha256_pad(tail, p + full * SHA256_BLOCK_SIZE, len % SHA256_BLOCK_SIZE, len);
+    blocks_fn(state, tail, n);
+    sha256_output(state, hash);
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Message being hashed in a multi-buffer lane
+ */
+typedef struct {
+    const uint8_t *next;                /* Next whole block of the message */
+    size_t full;                        /* Whole blocks left */
+    size_t tail_blocks;                 /* Padding blocks left after them */
+    size_t tail_pos;                    /* Next padding block */
+    size_t message;                     /* Index of the message */
+    bool busy;
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+} sha256_lane_t;
+
+/**
+ * Hash messages eight at a time in AVX2 lanes
+ * A lane that finishes its message takes the next one, so lengths need
+ * not match; idle lanes hash a dummy block.
+ */
+static void sha256_hash_many_avx2(const void *const data[], const size_t len[], size_t count,
+                                  uint8_t hashes[][SHA256_DIGEST_SIZE])
+{
+    static const uint8_t idle_block[SHA256_BLOCK_SIZE];
+    sha256_lane_t lanes[SHA256_LANES];
+    uint32_t state[8][SHA256_LANES];
+    const uint8_t *blocks[SHA256_LANES];
+    size_t next_message = 0, busy = 0, steps = 0;
+
+    for (int lane = 0; lane < SHA256_LANES; lane++) {
+        lanes[lane].busy = false;
+    }
+
+    kernel_fpu_begin();
+    do {
+        /* Give idle lanes the next messages, then pick each lane's block */
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            sha256_lane_t *l = &lanes[lane];
+            if (!l->busy && next_message < count) {
+                const uint8_t *p = (const uint8_t *)data[next_message];
+                l->message = next_message++;
+                l->next = p;
+                l->full = len[l->message] / SHA256_BLOCK_SIZE;
+                l->tail_blocks = sha256_pad(l->tail, p + l->full * SHA256_BLOCK_SIZE,
+                                            len[l->message] % SHA256_BLOCK_SIZE,
+                                            len[l->message]);
+                l->tail_pos = 0;
+                l->busy = true;
+                busy++;
+                for (int i = 0; i < 8; i++) {
+                    state[i][lane] = sha256_h0[i];
+                }
+            }
+
+            if (!l->busy) {
+                blocks[lane] = idle_block;
+            } else if (l->full > 0) {
+                blocks[lane] = l->next;
+                l->next += SHA256_BLOCK_SIZE;
+                l->full--;
+            } else {
+                blocks[lane] = l->tail + l->tail_pos * SHA256_BLOCK_SIZE;
+                l->tail_pos++;
+            }
+        }
+
+        sha256_blocks_x8_avx2(state, blocks);
+
+        for (int lane = 0; lane < SHA256_LANES; lane++) {
+            sha256_lane_t *l = &lanes[lane];
+            if (l->busy && l->full == 0 && l->tail_pos == l->tail_blocks) {
+                uint32_t words[8];
+                for (int i = 0; i < 8; i++) {
+                    words[i] = state[i][lane];
+                }
+                sha256_output(words, hashes[l->message]);
+                l->busy = false;
+                busy--;
+            }
+        }
+
+        /* Let interrupts in now and then */
+        if (++steps % (SHA256_FPU_BLOCKS / SHA256_LANES) == 0) {
+            kernel_fpu_end();
+            kernel_fpu_begin();
+        }
+    } while (busy > 0 || next_message < count);
+    kernel_fpu_end();
+
+    memset(lanes, 0, sizeof(lanes));
+    memset(state, 0, sizeof(state));
 }
 
+#endif /* __x86_64__ */
+
 /*============================================================================
  * SHA-256 Public API
  *============================================================================*/
 
+bool sha256_impl_available(sha256_impl_t impl)
+{
+    switch (impl) {
+        case SHA256_IMPL_SCALAR:
+            return true;
+#if defined(__x86_64__)
+        case SHA256_IMPL_SHANI:
+            if (!sha256_probed) {
+                sha256_probe();
+            }
+            return fpu_enabled() && sha256_has_shani;
+        case SHA256_IMPL_AVX2_X8:
+            return fpu_has_avx2();
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *sha256_impl_name(sha256_impl_t impl)
+{
+    static const char *names[SHA256_IMPL_COUNT] = { "scalar", "sha-ni", "avx2-x8" };
+    return impl < SHA256_IMPL_COUNT ? names[impl] : "unknown";
+}
+
 /**
  * Initialize SHA-256 context
  */
@@ -160,20 +553,11 @@ void sha256_init(sha256_ctx_t *ctx)
     }
 
     /* Set initial hash values */
-    ctx->state[0] = sha256_h0[0];
-    ctx->state[1] = sha256_h0[1];
-    ctx->state[2] = sha256_h0[2];
-    ctx->state[3] = sha256_h0[3];
-    ctx->state[4] = sha256_h0[4];
-    ctx->state[5] = sha256_h0[5];
-    ctx->state[6] = sha256_h0[6];
-    ctx->state[7] = sha256_h0[7];
+    memcpy(ctx->state, sha256_h0, sizeof(ctx->state));
 
     /* Reset byte count and buffer */
     ctx->count = 0;
     memset(ctx->buffer, 0, SHA256_BLOCK_SIZE);
-
-    kprintf("[SHA256] Context initialized\n");
 }
 
 /**
@@ -196,25 +580,31 @@ void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len)
     /* Update total byte count */
     ctx->count += len;
 
-    /* If we have buffered data and new data fills the buffer, process it */
-    if (buffer_used > 0 && len >= buffer_free) {
+    /* Not enough to complete a block: just buffer it */
+    if (len < buffer_free) {
+        memcpy(ctx->buffer + buffer_used, p, len);
+        return;
+    }
+
+    /* Complete the buffered block */
+    if (buffer_used > 0) {
         memcpy(ctx->buffer + buffer_used, p, buffer_free);
-        sha256_transform(ctx, ctx->buffer);
+        sha256_blocks_scalar(ctx->state, ctx->buffer, 1);
         p += buffer_free;
         len -= buffer_free;
-        buffer_used = 0;
     }
 
     /* Process complete blocks directly from input */
-    while (len >= SHA256_BLOCK_SIZE) {
-        sha256_transform(ctx, p);
-        p += SHA256_BLOCK_SIZE;
-        len -= SHA256_BLOCK_SIZE;
+    size_t blocks = len / SHA256_BLOCK_SIZE;
+    if (blocks > 0) {
+        sha256_blocks_impl(sha256_pick(blocks), ctx->state, p, blocks);
+        p += blocks * SHA256_BLOCK_SIZE;
+        len -= blocks * SHA256_BLOCK_SIZE;
     }
 
     /* Buffer remaining data */
     if (len > 0) {
-        memcpy(ctx->buffer + buffer_used, p, len);
+        memcpy(ctx->buffer, p, len);
     }
 }
 
@@ -223,65 +613,20 @@ void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len)
  */
 void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32])
 {
-    uint64_t total_bits;
-    size_t buffer_used;
-    size_t padding_len;
-    uint8_t padding[128];
-    int i;
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
 
     if (!ctx || !hash) {
         kprintf("[SHA256] Error: NULL parameter in final\n");
         return;
     }
 
-    /* Calculate total message length in bits */
-    total_bits = ctx->count * 8;
-
-    /* Determine padding length */
-    buffer_used = ctx->count % SHA256_BLOCK_SIZE;
-
-    /*
-     * Padding: append 1 bit (0x80), then zeros, then 64-bit length
-     * Total padded message must be multiple of 512 bits (64 bytes)
-     *
-     * If buffer_used < 56: pad to 56 bytes, then add 8-byte length
-     * If buffer_used >= 56: pad to 120 bytes (64 + 56), then add 8-byte length
-     */
-    if (buffer_used < 56) {
-        padding_len = 56 - buffer_used;
-    } else {
-        padding_len = 120 - buffer_used;
-    }
-
-    /* Build padding block */
-    memset(padding, 0, sizeof(padding));
-    padding[0] = 0x80;  /* Append 1 bit */
-
-    /* Append message length in bits as big-endian 64-bit value */
-    padding[padding_len + 0] = (uint8_t)(total_bits >> 56);
-    padding[padding_len + 1] = (uint8_t)(total_bits >> 48);
-    padding[padding_len + 2] = (uint8_t)(total_bits >> 40);
-    padding[padding_len + 3] = (uint8_t)(total_bits >> 32);
-    padding[padding_len + 4] = (uint8_t)(total_bits >> 24);
-    padding[padding_len + 5] = (uint8_t)(total_bits >> 16);
-    padding[padding_len + 6] = (uint8_t)(total_bits >> 8);
-    padding[padding_len + 7] = (uint8_t)(total_bits);
-
-    /* Process padding (one or two blocks) */
-    sha256_update(ctx, padding, padding_len + 8);
-
-    /* Output hash in big-endian format */
-    for (i = 0; i < 8; i++) {
-        hash[i * 4 + 0] = (uint8_t)(ctx->state[i] >> 24);
-        hash[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
-        hash[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
-        hash[i * 4 + 3] = (uint8_t)(ctx->state[i]);
-    }
+    size_t blocks = sha256_pad(tail, ctx->buffer, ctx->count % SHA256_BLOCK_SIZE, ctx->count);
+    sha256_blocks_scalar(ctx->state, tail, blocks);
+    sha256_output(ctx->state, hash);
 
     /* Clear sensitive data */
     memset(ctx, 0, sizeof(sha256_ctx_t));
-
-    kprintf("[SHA256] Hash finalized\n");
+    memset(tail, 0, sizeof(tail));
 }
 
 /**
@@ -289,16 +634,282 @@ void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32])
  */
 void sha256_hash(const void *data, size_t len, uint8_t hash[32])
 {
-    sha256_ctx_t ctx;
-
     if (!data || !hash) {
         kprintf("[SHA256] Error: NULL parameter in one-shot hash\n");
         return;
     }
 
-    kprintf("[SHA256] Computing hash of %u bytes\n", (uint32_t)len);
+    sha256_hash_impl(sha256_pick(len / SHA256_BLOCK_SIZE), data, len, hash);
+}
+
+void sha256_hash_impl(sha256_impl_t impl, const void *data, size_t len, uint8_t hash[32])
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t full = len / SHA256_BLOCK_SIZE;
+    uint32_t state[8];
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+
+#if defined(__x86_64__)
+    if (impl == SHA256_IMPL_AVX2_X8 && sha256_impl_available(impl)) {
+        sha256_hash_many_avx2(&data, &len, 1, (uint8_t (*)[SHA256_DIGEST_SIZE])hash);
+        return;
+    }
+#endif
+    if (impl != SHA256_IMPL_SHANI) {
+        impl = SHA256_IMPL_SCALAR;
+    }
+
+    memcpy(state, sha256_h0, sizeof(state));
+    sha256_blocks_impl(impl, state, p, full);
+    size_t n = sha256_pad(tail, p + full * SHA256_BLOCK_SIZE, len % SHA256_BLOCK_SIZE, len);
+    sha256_blocks_impl(impl, state, tail, n);
+    sha256_output(state, hash);
+
+    memset(tail, 0, sizeof(tail));
+}
+
+void sha256_hash_many(const void *const data[], const size_t len[], size_t count,
+                      uint8_t hashes[][SHA256_DIGEST_SIZE])
+{
+    if (!data || !len || !hashes) {
+        kprintf("[SHA256] Error: NULL parameter in batch hash\n");
+        return;
+    }
+
+#if defined(__x86_64__)
+    /* One SHA-NI core beats eight AVX2 lanes; short messages share
+     * FPU sections, long ones get their own */
+    if (sha256_impl_available(SHA256_IMPL_SHANI)) {
+        size_t i = 0;
+        while (i < count) {
+            if (len[i] >= SHA256_FPU_BLOCKS * SHA256_BLOCK_SIZE) {
+                sha256_hash(data[i], len[i], hashes[i]);
+                i++;
+                continue;
+            }
+            size_t section = 0;
+            kernel_fpu_begin();
+            while (i < count && len[i] < SHA256_FPU_BLOCKS * SHA256_BLOCK_SIZE &&
+                   section < SHA256_FPU_BLOCKS) {
+                sha256_digest(sha256_blocks_shani, (const uint8_t *)data[i], len[i],
+                              hashes[i]);
+                section += len[i] / SHA256_BLOCK_SIZE + 1;
+                i++;
+            }
+            kernel_fpu_end();
+        }
+        return;
+    }
+    if (count > 1 && sha256_impl_available(SHA256_IMPL_AVX2_X8)) {
+        sha256_hash_many_avx2(data, len, count, hashes);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        sha256_digest(sha256_blocks_scalar, (const uint8_t *)data[i], len[i], hashes[i]);
+    }
+}
+
+bool sha256_file(const char *path, uint8_t hash[32])
+{
+    if (!path || !hash) {
+        return false;
+    }
 
+    vfs_file_t *file = vfs_open(path, VFS_O_RDONLY);
+    if (!file) {
+        return false;
+    }
+    uint8_t *buf = (uint8_t *)kmalloc(SHA256_FILE_CHUNK);
+    if (!buf) {
+        vfs_close(file);
+        return false;
+    }
+
+    /* Whole chunks are hashed straight from the read buffer */
+    sha256_ctx_t ctx;
+    ssize_t n;
     sha256_init(&ctx);
-    sha256_update(&ctx, data, len);
+    while ((n = vfs_read(file, buf, SHA256_FILE_CHUNK)) > 0) {
+        sha256_update(&ctx, buf, (size_t)n);
+    }
+
+    kfree(buf);
+    vfs_close(file);
+    if (n < 0) {
+        kprintf("[SHA256] Failed to read %s\n", path);
+        memset(&ctx, 0, sizeof(ctx));
+        return false;
+    }
     sha256_final(&ctx, hash);
+    return true;
+}
+
+/*============================================================================
+ * HMAC-SHA256 and PBKDF2
+ *============================================================================*/
+
+/* Iterations per FPU section (two blocks each) */
+#define PBKDF2_FPU_ITERATIONS   (SHA256_FPU_BLOCKS / 2)
+
+/**
+ * Compute the HMAC inner and outer states of a key (RFC 2104)
+ * Each is the state after compressing one block of the padded key.
+ */
+static void hmac_sha256_states(const void *key, size_t key_len, uint32_t inner[8],
+                               uint32_t outer[8])
+{
+    uint8_t block[SHA256_BLOCK_SIZE];
+    uint8_t key_hash[SHA256_DIGEST_SIZE];
+
+    /* Keys longer than a block are hashed first */
+    if (key_len > SHA256_BLOCK_SIZE) {
+        sha256_hash(key, key_len, key_hash);
+        key = key_hash;
+        key_len = SHA256_DIGEST_SIZE;
+    }
+
+    memset(block, 0x36, sizeof(block));
+    for (size_t i = 0; i < key_len; i++) {
+        block[i] ^= ((const uint8_t *)key)[i];
+    }
+    memcpy(inner, sha256_h0, 8 * sizeof(uint32_t));
+    sha256_blocks_scalar(inner, block, 1);
+
+    for (size_t i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        block[i] ^= 0x36 ^ 0x5c;
+    }
+    memcpy(outer, sha256_h0, 8 * sizeof(uint32_t));
+    sha256_blocks_scalar(outer, block, 1);
+
+    memset(block, 0, sizeof(block));
+    memset(key_hash, 0, sizeof(key_hash));
+}
+
+/**
+ * Finish an HMAC from its states
+ * @param data1 First part of the message
+ * @param data2 Second part of the message (can be NULL)
+ */
+static void hmac_sha256_finish(const uint32_t inner[8], const uint32_t outer[8],
+                               const void *data1, size_t len1, const void *data2, size_t len2,
+                               uint8_t mac[32])
+{
+    sha256_ctx_t ctx;
+    uint8_t inner_hash[SHA256_DIGEST_SIZE];
+
+    memcpy(ctx.state, inner, sizeof(ctx.state));
+    ctx.count = SHA256_BLOCK_SIZE;
+    sha256_update(&ctx, data1, len1);
+    if (data2) {
+        sha256_update(&ctx, data2, len2);
+    }
+    sha256_final(&ctx, inner_hash);
+
+    memcpy(ctx.state, outer, sizeof(ctx.state));
+    ctx.count = SHA256_BLOCK_SIZE;
+    sha256_update(&ctx, inner_hash, sizeof(inner_hash));
+    sha256_final(&ctx, mac);
+
+    memset(inner_hash, 0, sizeof(inner_hash));
+}
+
+void hmac_sha256(const void *key, size_t key_len, const void *data, size_t len,
+                 uint8_t mac[32])
+{
+    uint32_t inner[8], outer[8];
+
+    if (!key || !data || !mac) {
+        return;
+    }
+
+    hmac_sha256_states(key, key_len, inner, outer);
+    hmac_sha256_finish(inner, outer, data, len, NULL, 0, mac);
+    memset(inner, 0, sizeof(inner));
+    memset(outer, 0, sizeof(outer));
+}
+
+/**
+ * Run PBKDF2 iterations on one output block
+ *
+ * Every iteration is HMAC of the previous 32-byte value: one block
+ * through the inner state, one through the outer. The block is padded
+ * once; only its first 32 bytes change.
+ *
+ * @param block Padded block whose first 32 bytes hold U_i, advanced in place
+ * @param t Running XOR of the U_i
+ * @param count Iterations to run
+ */
+static void pbkdf2_sha256_iterate(sha256_blocks_fn blocks_fn, const uint32_t inner[8],
+                                  const uint32_t outer[8], uint8_t block[SHA256_BLOCK_SIZE],
+                                  uint8_t t[32], uint32_t count)
+{
+    uint32_t state[8];
+
+    for (uint32_t n = 0; n < count; n++) {
+        memcpy(state, inner, sizeof(state));
+        blocks_fn(state, block, 1);
+        sha256_output(state, block);
+        memcpy(state, outer, sizeof(state));
+        blocks_fn(state, block, 1);
+        sha256_output(state, block);
+        for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+            t[i] ^= block[i];
+        }
+    }
+    memset(state, 0, sizeof(state));
+}
+
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt,
+                   size_t salt_len, uint32_t iterations, uint8_t *out, size_t out_len)
+{
+    uint32_t inner[8], outer[8];
+    uint8_t block[SHA256_BLOCK_SIZE];
+    uint8_t t[SHA256_DIGEST_SIZE];
+
+    if (!password || !salt || !out || iterations == 0) {
+        return;
+    }
+
+    hmac_sha256_states(password, password_len, inner, outer);
+
+    /* U_i is 32 bytes of a 96-byte inner (and outer) message */
+    memset(block, 0, sizeof(block));
+    block[SHA256_DIGEST_SIZE] = 0x80;
+    sha256_store_be32(block + SHA256_BLOCK_SIZE - 4,
+                      (SHA256_BLOCK_SIZE + SHA256_DIGEST_SIZE) * 8);
+
+    for (uint32_t index = 1; out_len > 0; index++) {
+        uint8_t be_index[4];
+        sha256_store_be32(be_index, index);
+
+        /* U_1 = HMAC(password, salt || INT(index)) */
+        hmac_sha256_finish(inner, outer, salt, salt_len, be_index, sizeof(be_index), t);
+        memcpy(block, t, SHA256_DIGEST_SIZE);
+
+        uint32_t left = iterations - 1;
+#if defined(__x86_64__)
+        if (sha256_impl_available(SHA256_IMPL_SHANI)) {
+            while (left > 0) {
+                uint32_t n = left < PBKDF2_FPU_ITERATIONS ? left : PBKDF2_FPU_ITERATIONS;
+                kernel_fpu_begin();
+                pbkdf2_sha256_iterate(sha256_blocks_shani, inner, outer, block, t, n);
+                kernel_fpu_end();
+                left -= n;
+            }
+        }
+#endif
+        pbkdf2_sha256_iterate(sha256_blocks_scalar, inner, outer, block, t, left);
+
+        size_t n = out_len < SHA256_DIGEST_SIZE ? out_len : SHA256_DIGEST_SIZE;
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+
+    memset(inner, 0, sizeof(inner));
+    memset(outer, 0, sizeof(outer));
+    memset(block, 0, sizeof(block));
+    memset(t, 0, sizeof(t));
 }
@@ -0,0 +1,350 @@
+/**
+ * AAAos Kernel - Micro-benchmark Runner
+ *
+ * Runs on the host and times the registered cases. Usage:
+ *   bench [-f filter] [-n samples] [-o results] [-b baseline] [-t percent]
+ *
+ * The results file holds one line per case:
+ *   <name> <median ns> <min ns> <mean ns> <stddev ns> <iterations> <bytes>
+ * after a "#" header line. Given a baseline in the same format, a case
+ * whose median grew by more than the threshold, and by more than twice
+ * the larger of the two standard deviations, is a regression and makes
+ * the exit status 1.
+ */
+
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define BENCH_NAME_MAX          64
+
+typedef struct bench_case {
+    const char *name;
+    bench_func_t func;
+} bench_case_t;
+
+/**
+ * Statistics of one case, in nanoseconds per operation
+ */
+typedef struct bench_result {
+    char name[BENCH_NAME_MAX];
+    double median;
+    double min;
+    double mean;
+    double stddev;
+    unsigned long long iterations;
+    unsigned long long bytes;
+} bench_result_t;
+
+static bench_case_t bench_cases[BENCH_MAX_CASES];
+static size_t bench_count;
+
+static bench_result_t bench_results[BENCH_MAX_CASES];
+static size_t bench_result_count;
+
+static bench_result_t bench_baseline[BENCH_MAX_CASES];
+static size_t bench_baseline_count;
+
+void bench_register(const char *name, bench_func_t func) {
+    if (bench_count < BENCH_MAX_CASES) {
+        bench_cases[bench_count].name = name;
+        bench_cases[bench_count].func = func;
+        bench_count++;
+    }
+}
+
+static unsigned long long bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void bench_pause(bench_state_t *b) {
+    b->pause_start = bench_now();
+}
+
+void bench_resume(bench_state_t *b) {
+    b->paused_ns += bench_now() - b->pause_start;
+}
+
+int bench_host_map(unsigned long long addr, unsigned long long size) {
+    void *p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    if (p != (void *)addr) {
+        munmap(p, size);
+        return -1;
+    }
+    return 0;
+}
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static int bench_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static int bench_contains(const char *s, const char *sub) {
+    for (; *s; s++) {
+        const char *p = s;
+        const char *q = sub;
+        while (*p && *q && *p == *q) {
+            p++;
+            q++;
+        }
+        if (*q == '\0') {
+            return 1;
+        }
+    }
+    return *sub == '\0';
+}
+
+static void bench_copy_name(char *dest, const char *src) {
+    size_t i = 0;
+    while (src[i] && i < BENCH_NAME_MAX - 1) {
+        dest[i] = src[i];
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time one call of a case
+ * @return Nanoseconds spent outside bench_pause/bench_resume
+ */
+static unsigned long long bench_call(const bench_case_t *c, unsigned long long iterations,
+                                     unsigned long long *bytes, const char **skip) {
+    bench_state_t b = { iterations, 0, 0, 0, NULL };
+    unsigned long long start = bench_now();
+    c->func(&b);
+    unsigned long long elapsed = bench_now() - start - b.paused_ns;
+    *bytes = b.bytes;
+    *skip = b.skip;
+    return elapsed;
+}
+
+/*============================================================================
+ * Running
+ *============================================================================*/
+
+/**
+ * Run a case
+ * @return The reason it was skipped, or NULL once r holds its results
+ */
+static const char *bench_run(const bench_case_t *c, int samples, bench_result_t *r) {
+    double ns[BENCH_MAX_SAMPLES];
+    unsigned long long bytes = 0;
+    unsigned long long iterations = 1;
+    const char *skip = NULL;
+
+    /* Grow the iteration count until one call is long enough to time */
+    while (bench_call(c, iterations, &bytes, &skip) < BENCH_MIN_RUN_NS && !skip &&
+           iterations < (1ULL << 40)) {
+        iterations *= 2;
+    }
+    if (skip) {
+        return skip;
+    }
+
+    for (int i = 0; i < BENCH_WARMUP_RUNS; i++) {
+        bench_call(c, iterations, &bytes, &skip);
+    }
+
+    double sum = 0;
+    for (int i = 0; i < samples; i++) {
+        ns[i] = (double)bench_call(c, iterations, &bytes, &skip) / (double)iterations;
+        sum += ns[i];
+    }
+    qsort(ns, (size_t)samples, sizeof(ns[0]), bench_cmp_double);
+
+    double mean = sum / samples;
+    double var = 0;
+    for (int i = 0; i < samples; i++) {
+        var += (ns[i] - mean) * (ns[i] - mean);
+    }
+
+    bench_copy_name(r->name, c->name);
+    r->median = samples % 2 ? ns[samples / 2] : (ns[samples / 2 - 1] + ns[samples / 2]) / 2;
+    r->min = ns[0];
+    r->mean = mean;
+    r->stddev = samples > 1 ? sqrt(var / (samples - 1)) : 0;
+    r->iterations = iterations;
+    r->bytes = bytes;
+    return NULL;
+}
+
+static void bench_print_result(const bench_result_t *r) {
+    printf("%-24s %12llu %10.2f %10.2f %10.2f %9.2f", r->name, r->iterations,
+           r->min, r->median, r->mean, r->stddev);
+    if (r->bytes && r->median > 0) {
+        printf(" %9.1f MB/s", (double)r->bytes * 1000.0 / r->median);
+    }
+    printf("\n");
+}
+
+/*============================================================================
+ * Results Files
+ *============================================================================*/
+
+static int bench_write_results(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "bench: cannot write %s\n", path);
+        return -1;
+    }
+
+    fprintf(f, "# name median_ns min_ns mean_ns stddev_ns iterations bytes\n");
+    for (size_t i = 0; i < bench_result_count; i++) {
+        const bench_result_t *r = &bench_results[i];
+        fprintf(f, "%s %.3f %.3f %.3f %.3f %llu %llu\n", r->name, r->median, r->min,
+                r->mean, r->stddev, r->iterations, r->bytes);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int bench_read_baseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "bench: cannot read %s\n", path);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) && bench_baseline_count < BENCH_MAX_CASES) {
+        bench_result_t *r = &bench_baseline[bench_baseline_count];
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%63s %lf %lf %lf %lf %llu %llu", r->name, &r->median, &r->min,
+                   &r->mean, &r->stddev, &r->iterations, &r->bytes) == 7) {
+            bench_baseline_count++;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static const bench_result_t *bench_find_baseline(const char *name) {
+    for (size_t i = 0; i < bench_baseline_count; i++) {
+        if (bench_streq(bench_baseline[i].name, name)) {
+            return &bench_baseline[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Compare the results with the baseline
+ * @return Number of regressions
+ */
+static int bench_compare(double threshold) {
+    int regressions = 0;
+
+    printf("\n%-24s %12s %12s %9s\n", "case", "baseline ns", "new ns", "change");
+    for (size_t i = 0; i < bench_result_count; i++) {
+        const bench_result_t *r = &bench_results[i];
+        const bench_result_t *base = bench_find_baseline(r->name);
+        if (base == NULL || base->median <= 0) {
+            printf("%-24s %12s %12.2f %9s\n", r->name, "-", r->median, "new");
+            continue;
+        }
+
+        double change = (r->median - base->median) * 100.0 / base->median;
+        double noise = 2 * (r->stddev > base->stddev ? r->stddev : base->stddev);
+        int regressed = change > threshold && r->median - base->median > noise;
+        printf("%-24s %12.2f %12.2f %+8.1f%%%s\n", r->name, base->median, r->median,
+               change, regressed ? "  REGRESSION" : "");
+        regressions += regressed;
+    }
+
+    printf("\n%d regression(s) above %.0f%%\n", regressions, threshold);
+    return regressions;
+}
+
+/*============================================================================
+ * Main
+ *============================================================================*/
+
+static void bench_usage(void) {
+    fprintf(stderr, "usage: bench [-f filter] [-n samples] [-o results] [-b baseline] "
+                    "[-t percent]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *filter = "";
+    const char *out = NULL;
+    const char *baseline = NULL;
+    double threshold = BENCH_THRESHOLD;
+    int samples = BENCH_SAMPLES;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (val == NULL || arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0') {
+            bench_usage();
+            return 2;
+        }
+        switch (arg[1]) {
+            case 'f': filter = val; break;
+            case 'n': samples = atoi(val); break;
+            case 'o': out = val; break;
+            case 'b': baseline = val; break;
+            case 't': threshold = atof(val); break;
+            default:
+                bench_usage();
+                return 2;
+        }
+        i++;
+    }
+    if (samples < 1 || samples > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "bench: samples must be 1 to %d\n", BENCH_MAX_SAMPLES);
+        return 2;
+    }
+    if (baseline && bench_read_baseline(baseline) < 0) {
+        return 2;
+    }
+
+    printf("%-24s %12s %10s %10s %10s %9s  (ns/op, %d samples)\n", "case", "iterations",
+           "min", "median", "mean", "stddev", samples);
+    for (size_t i = 0; i < bench_count; i++) {
+        if (!bench_contains(bench_cases[i].name, filter)) {
+            continue;
+        }
+        bench_result_t *r = &bench_results[bench_result_count];
+        const char *skip = bench_run(&bench_cases[i], samples, r);
+        if (skip) {
+            printf("%-24s skipped: %s\n", bench_cases[i].name, skip);
+        } else {
+            bench_print_result(r);
+            bench_result_count++;
+        }
+        fflush(stdout);
+    }
+
+    if (out && bench_write_results(out) < 0) {
+        return 2;
+    }
+    if (baseline) {
+        return bench_compare(threshold) ? 1 : 0;
+    }
+    return 0;
+}
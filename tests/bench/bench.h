@@ -0,0 +1,98 @@
+/**
+ * AAAos Kernel - Micro-benchmark Framework
+ *
+ * Benchmarks run kernel sources compiled for the host, like the unit
+ * tests, with AAAOS_HOSTED defined so the few privileged instructions on
+ * their paths (cli, CR3 loads, invlpg) are left out. A case performs
+ * b->iterations operations per call:
+ *
+ *   BENCH_CASE(memcpy_4k) {
+ *       for (uint64_t i = 0; i < b->iterations; i++) {
+ *           memcpy(dst, src, 4096);
+ *           bench_keep(dst);
+ *       }
+ *       b->bytes = 4096;
+ *   }
+ *
+ * The runner grows the iteration count until one call takes at least
+ * BENCH_MIN_RUN_NS, makes BENCH_WARMUP_RUNS calls it does not count and
+ * then times BENCH_SAMPLES calls, reporting the minimum, median, mean and
+ * standard deviation of the time per operation.
+ *
+ * This header uses no kernel types so the runner can include it next to
+ * the host's own headers.
+ */
+
+#ifndef _AAAOS_BENCH_H
+#define _AAAOS_BENCH_H
+
+/* Maximum number of benchmark cases */
+#define BENCH_MAX_CASES         128
+
+/* Run parameters */
+#define BENCH_MIN_RUN_NS        5000000ULL  /* Shortest timed call */
+#define BENCH_WARMUP_RUNS       3
+#define BENCH_SAMPLES           15
+#define BENCH_MAX_SAMPLES       101
+
+/* Default slowdown of the median, in percent, reported as a regression */
+#define BENCH_THRESHOLD         10
+
+/**
+ * State handed to a case on each call
+ */
+typedef struct bench_state {
+    unsigned long long iterations;      /* Operations to perform */
+    unsigned long long bytes;           /* Bytes per operation, set by throughput cases */
+    unsigned long long paused_ns;       /* Time spent between bench_pause and bench_resume */
+    unsigned long long pause_start;
+    const char *skip;                   /* Set by a case that cannot run, with the reason */
+} bench_state_t;
+
+/* Skip the case the calling function runs in */
+#define BENCH_SKIP(b, reason)   do { (b)->skip = (reason); return; } while (0)
+
+/* Benchmark function pointer type */
+typedef void (*bench_func_t)(bench_state_t *b);
+
+/**
+ * Register a benchmark case
+ */
+void bench_register(const char *name, bench_func_t func);
+
+/**
+ * Stop counting time, e.g. while a case undoes its operations
+ */
+void bench_pause(bench_state_t *b);
+
+/**
+ * Count time again after bench_pause
+ */
+void bench_resume(bench_state_t *b);
+
+/**
+ * Map anonymous host memory at a fixed address
+ * The kernel's allocators use physical addresses as pointers, so the PMM's
+ * default range must exist in the benchmark process.
+ * @return 0 on success, -1 if the range cannot be mapped
+ */
+int bench_host_map(unsigned long long addr, unsigned long long size);
+
+/**
+ * Keep the compiler from discarding the computation behind a pointer
+ */
+static inline void bench_keep(const void *p) {
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+/**
+ * Define a benchmark case; the body sees its state as b
+ */
+#define BENCH_CASE(name)                                                    \
+    static void bench_##name(bench_state_t *b);                             \
+    static void __attribute__((constructor)) _bench_register_##name(void) { \
+        bench_register(#name, bench_##name);                                \
+    }                                                                       \
+    static void bench_##name(bench_state_t *b)
+
+#endif /* _AAAOS_BENCH_H */
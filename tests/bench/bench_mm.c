@@ -0,0 +1,144 @@
+/**
+ * AAAos Kernel - Memory Manager Benchmarks
+ *
+ * The PMM's default layout (no boot memory map) hands out 1MB - 16MB, and
+ * the heap and page tables use those physical addresses as pointers, so
+ * the range is mapped into the benchmark process first. The page tables
+ * are a private PML4 loaded through the hosted CR3 in vmm.c.
+ */
+
+#include "bench.h"
+#include "../../kernel/mm/pmm.h"
+#include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/slab.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../lib/libc/string.h"
+
+#define BENCH_PHYS_START        0x100000ULL
+#define BENCH_PHYS_END          0x1000000ULL
+
+/* Unused kernel virtual range for the mapping cases */
+#define BENCH_MAP_BASE          0xFFFFC00000000000ULL
+
+static int bench_mm_state;              /* 0 not set up, 1 ready, -1 failed */
+
+/**
+ * Set up the PMM, heap and an address space once
+ * @return false if the physical range cannot be mapped
+ */
+static bool bench_mm_ready(void) {
+    if (bench_mm_state != 0) {
+        return bench_mm_state > 0;
+    }
+    bench_mm_state = -1;
+
+    if (bench_host_map(BENCH_PHYS_START, BENCH_PHYS_END - BENCH_PHYS_START) < 0) {
+        return false;
+    }
+    pmm_init(NULL);
+    if (!heap_init(0, HEAP_INITIAL_SIZE)) {
+        return false;
+    }
+
+    physaddr_t pml4 = pmm_alloc_page();
+    if (pml4 == 0) {
+        return false;
+    }
+    memset((void *)pml4, 0, PMM_PAGE_SIZE);
+    vmm_switch_address_space(pml4);
+
+    bench_mm_state = 1;
+    return true;
+}
+
+#define BENCH_MM_SETUP(b)                                                   \
+    do {                                                                    \
+        if (!bench_mm_ready()) {                                            \
+            BENCH_SKIP(b, "cannot map the PMM's range");                    \
+        }                                                                   \
+    } while (0)
+
+/* Single pages come from the calling CPU's page cache */
+BENCH_CASE(pmm_alloc_free_page) {
+    BENCH_MM_SETUP(b);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        physaddr_t page = pmm_alloc_page();
+        pmm_free_page(page);
+    }
+}
+
+/* Multi-page runs go to the buddy allocator */
+BENCH_CASE(pmm_alloc_free_16) {
+    BENCH_MM_SETUP(b);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        physaddr_t pages = pmm_alloc_pages(16);
+        pmm_free_pages(pages, 16);
+    }
+}
+
+/* Magazine sizes stay on the per-CPU fast path */
+BENCH_CASE(kmalloc_free_64) {
+    BENCH_MM_SETUP(b);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        void *p = kmalloc(64);
+        bench_keep(p);
+        kfree(p);
+    }
+}
+
+/* Above HEAP_MAG_MAX_SIZE every call takes the heap lock and free lists */
+BENCH_CASE(kmalloc_free_2k) {
+    BENCH_MM_SETUP(b);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        void *p = kmalloc(2048);
+        bench_keep(p);
+        kfree(p);
+    }
+}
+
+/* A burst of allocations freed in reverse, overflowing the magazines */
+BENCH_CASE(kmalloc_burst_64x64) {
+    void *ptrs[64];
+
+    BENCH_MM_SETUP(b);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        for (size_t j = 0; j < 64; j++) {
+            ptrs[j] = kmalloc(64);
+        }
+        for (size_t j = 64; j > 0; j--) {
+            kfree(ptrs[j - 1]);
+        }
+    }
+}
+
+BENCH_CASE(slab_alloc_free_128) {
+    static kmem_cache_t *cache;
+
+    BENCH_MM_SETUP(b);
+    if (cache == NULL) {
+        cache = kmem_cache_create("bench-128", 128, 0, NULL);
+        if (cache == NULL) {
+            BENCH_SKIP(b, "kmem_cache_create failed");
+        }
+    }
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        void *p = kmem_cache_alloc(cache);
+        bench_keep(p);
+        kmem_cache_free(cache, p);
+    }
+}
+
+/* Map 16 pages and unmap them; the page tables stay after the first pass */
+BENCH_CASE(vmm_map_unmap_16) {
+    BENCH_MM_SETUP(b);
+
+    physaddr_t frames = pmm_alloc_pages(16);
+    if (frames == 0) {
+        BENCH_SKIP(b, "pmm_alloc_pages failed");
+    }
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        vmm_map_pages(BENCH_MAP_BASE, frames, 16, VMM_FLAGS_KERNEL);
+        vmm_unmap_pages(BENCH_MAP_BASE, 16);
+    }
+    pmm_free_pages(frames, 16);
+}
@@ -0,0 +1,75 @@
+/**
+ * AAAos Kernel - String Function Benchmarks
+ *
+ * Times the kernel's libc routines (lib/libc/string.c), the same code
+ * the kernel links; -fno-builtin keeps the compiler's own out of the way.
+ */
+
+#include "bench.h"
+#include "../../lib/libc/string.h"
+
+#define BENCH_BUF_SIZE          8192
+
+static uint8_t bench_src[BENCH_BUF_SIZE] ALIGNED(64);
+static uint8_t bench_dst[BENCH_BUF_SIZE] ALIGNED(64);
+
+static void bench_memcpy(bench_state_t *b, size_t size) {
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        memcpy(bench_dst, bench_src, size);
+        bench_keep(bench_dst);
+    }
+    b->bytes = size;
+}
+
+BENCH_CASE(memcpy_64) {
+    bench_memcpy(b, 64);
+}
+
+BENCH_CASE(memcpy_4k) {
+    bench_memcpy(b, 4096);
+}
+
+/* Source and destination 1 byte apart, as in a ring buffer compaction */
+BENCH_CASE(memcpy_4k_unaligned) {
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        memcpy(bench_dst + 1, bench_src, 4096);
+        bench_keep(bench_dst);
+    }
+    b->bytes = 4096;
+}
+
+BENCH_CASE(memmove_4k_overlap) {
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        memmove(bench_dst + 64, bench_dst, 4096);
+        bench_keep(bench_dst);
+    }
+    b->bytes = 4096;
+}
+
+BENCH_CASE(memset_4k) {
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        memset(bench_dst, (int)i, 4096);
+        bench_keep(bench_dst);
+    }
+    b->bytes = 4096;
+}
+
+BENCH_CASE(memcmp_4k) {
+    memset(bench_src, 0x5A, 4096);
+    memset(bench_dst, 0x5A, 4096);
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        int r = memcmp(bench_dst, bench_src, 4096);
+        bench_keep(&r);
+    }
+    b->bytes = 4096;
+}
+
+BENCH_CASE(strlen_256) {
+    memset(bench_src, 'a', 255);
+    bench_src[255] = '\0';
+    for (uint64_t i = 0; i < b->iterations; i++) {
+        size_t n = strlen((const char *)bench_src);
+        bench_keep(&n);
+    }
+    b->bytes = 256;
+}
@@ -33,3 +33,12 @@ bool serial_data_ready(unsigned short port) {
     (void)port;
     return false;
 }
+
+/* Boot profile conversions; the host has no calibrated TSC */
+bool clock_ready(void) {
+    return false;
+}
+
+unsigned long long clock_cycles_to_ns(unsigned long long cycles) {
+    return cycles;
+}
@@ -0,0 +1,77 @@
+/**
+ * AAAos Kernel - Arena Allocator Tests
+ *
+ * Unit tests for karena_t bump allocation.
+ */
+
+#include "../framework/test.h"
+#include "../../kernel/mm/arena.h"
+#include "../../kernel/mm/pmm.h"
+
+/**
+ * Test: Small allocations are served from the seed buffer
+ */
+TEST_CASE(test_arena_seed) {
+    uint8_t seed[256] ALIGNED(KARENA_ALIGN);
+    karena_t arena;
+    void *a, *b;
+
+    karena_init(&arena, seed, sizeof(seed));
+
+    a = karena_alloc(&arena, 10);
+    b = karena_alloc(&arena, 10);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_EQ((uint8_t*)a, seed);
+    TEST_ASSERT_EQ((uint8_t*)b, seed + KARENA_ALIGN);
+    TEST_ASSERT_NULL(arena.chunks);
+
+    /* Reset rewinds to the start of the seed */
+    karena_reset(&arena);
+    TEST_ASSERT_EQ((uint8_t*)karena_alloc(&arena, 1), seed);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Overflow takes PMM chunks and reset gives them back
+ */
+TEST_CASE(test_arena_overflow) {
+    uint8_t seed[64] ALIGNED(KARENA_ALIGN);
+    karena_t arena;
+    size_t free_before = pmm_get_free_pages();
+    uint8_t *big;
+    int i;
+
+    karena_init(&arena, seed, sizeof(seed));
+
+    /* Many small allocations, then one larger than a page */
+    for (i = 0; i < 100; i++) {
+        TEST_ASSERT_NOT_NULL(karena_alloc(&arena, 48));
+    }
+    big = karena_alloc(&arena, 3 * PMM_PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(big);
+    TEST_ASSERT_EQ((uint64_t)big % KARENA_ALIGN, 0);
+    TEST_ASSERT_NOT_NULL(arena.chunks);
+    TEST_ASSERT_LT(pmm_get_free_pages(), free_before);
+
+    karena_reset(&arena);
+    TEST_ASSERT_NULL(arena.chunks);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: An unseeded arena works and zero-size requests fail
+ */
+TEST_CASE(test_arena_unseeded) {
+    karena_t arena;
+
+    karena_init(&arena, NULL, 0);
+    TEST_ASSERT_NULL(karena_alloc(&arena, 0));
+    TEST_ASSERT_NOT_NULL(karena_alloc(&arena, 32));
+    karena_reset(&arena);
+
+    TEST_PASS();
+}
@@ -6,6 +6,10 @@
 
 #include "../framework/test.h"
 #include "../../kernel/mm/heap.h"
+#include "../../kernel/mm/vmalloc.h"
+#include "../../kernel/proc/process.h"
+#include "../../kernel/arch/x86_64/include/idt.h"
+#include "../../kernel/sched/scheduler.h"
 #include "../../lib/libc/string.h"
 
 /**
@@ -358,3 +362,185 @@ TEST_CASE(test_heap_large_alloc) {
 
     TEST_PASS();
 }
+
+/**
+ * Test: Large requests bypass the heap and grow without losing data
+ */
+TEST_CASE(test_heap_large_bypass) {
+    heap_stats_t before, after;
+    vmalloc_stats_t vstats;
+    uint8_t *buf;
+    size_t i;
+
+    heap_get_stats(&before);
+
+    buf = kmalloc(64 * KB);
+    TEST_ASSERT_NOT_NULL(buf);
+    TEST_ASSERT_EQ((uint64_t)buf & (PAGE_SIZE - 1), 0);
+    TEST_ASSERT_EQ(vmalloc_owns(buf), true);
+
+    /* The heap itself did not move */
+    heap_get_stats(&after);
+    TEST_ASSERT_EQ(after.used_size, before.used_size);
+    TEST_ASSERT_EQ(after.expand_count, before.expand_count);
+
+    for (i = 0; i < 64 * KB; i++) {
+        buf[i] = (uint8_t)(i * 7);
+    }
+
+    buf = krealloc(buf, 256 * KB);
+    TEST_ASSERT_NOT_NULL(buf);
+    TEST_ASSERT_EQ(vmalloc_size(buf), 256 * KB);
+    for (i = 0; i < 64 * KB; i++) {
+        TEST_ASSERT_EQ(buf[i], (uint8_t)(i * 7));
+    }
+
+    vmalloc_get_stats(&vstats);
+    TEST_ASSERT_GT(vstats.area_count, 0);
+
+    kfree(buf);
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Mixed-size churn keeps every size class consistent
+ */
+TEST_CASE(test_heap_size_classes) {
+    void *ptrs[64];
+    size_t sizes[] = {16, 40, 100, 250, 600, 1500, 3000, 7000};
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        ptrs[i] = kmalloc(sizes[i % 8]);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+    }
+
+    /* Free every third block so holes of many sizes exist */
+    for (i = 0; i < 64; i += 3) {
+        kfree(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    /* Refill the holes with different sizes than they held */
+    for (i = 0; i < 64; i += 3) {
+        ptrs[i] = kmalloc(sizes[(i + 5) % 8]);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+    }
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    for (i = 0; i < 64; i++) {
+        kfree(ptrs[i]);
+    }
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Magazine-sized objects are recycled and checked for double free
+ */
+TEST_CASE(test_heap_magazine_reuse) {
+    heap_stats_t before, after;
+    void *ptr, *again;
+
+    heap_get_stats(&before);
+
+    ptr = kmalloc(100);
+    TEST_ASSERT_NOT_NULL(ptr);
+    kfree(ptr);
+
+    /* Same class on the same CPU comes straight back out of the magazine */
+    again = kmalloc(120);
+    TEST_ASSERT_EQ(again, ptr);
+
+    heap_get_stats(&after);
+    TEST_ASSERT_GT(after.magazine_hits, before.magazine_hits);
+
+    kfree(again);
+    kfree(again);   /* Must be rejected, not parked twice */
+
+    heap_get_stats(&after);
+    TEST_ASSERT_EQ(after.magazine_cached, before.magazine_cached + 1);
+
+    heap_magazine_drain();
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    TEST_PASS();
+}
+
+#define HEAP_STRESS_WORKERS     4
+#define HEAP_STRESS_ROUNDS      2000
+#define HEAP_STRESS_LIVE        32
+
+static volatile uint32_t heap_stress_done = 0;
+
+/**
+ * One worker's allocation churn: random small sizes, out-of-order frees
+ */
+static void heap_stress_body(uint32_t seed) {
+    void *live[HEAP_STRESS_LIVE] = {0};
+
+    for (uint32_t i = 0; i < HEAP_STRESS_ROUNDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t slot = (seed >> 8) % HEAP_STRESS_LIVE;
+
+        if (live[slot] != NULL) {
+            kfree(live[slot]);
+        }
+        live[slot] = kmalloc(8 + (seed >> 16) % 1024);
+    }
+
+    for (uint32_t i = 0; i < HEAP_STRESS_LIVE; i++) {
+        kfree(live[i]);
+    }
+}
+
+static void heap_stress_entry(void) {
+    process_t *self = process_get_current();
+    heap_stress_body(self ? self->pid : 1);
+    __sync_fetch_and_add(&heap_stress_done, 1);
+    process_exit(0);
+}
+
+/**
+ * Test: Multi-process kmalloc/kfree stress with latency histograms
+ */
+TEST_CASE(test_heap_stress_latency) {
+    heap_latency_t alloc_lat, free_lat;
+
+    heap_latency_reset();
+    heap_latency_enable(true);
+    heap_stress_done = 0;
+
+    if (scheduler_is_running()) {
+        for (uint32_t i = 0; i < HEAP_STRESS_WORKERS; i++) {
+            process_t *proc = process_create("heapstress", heap_stress_entry);
+            TEST_ASSERT_NOT_NULL(proc);
+            TEST_ASSERT_EQ(scheduler_add(proc), true);
+        }
+        while (heap_stress_done < HEAP_STRESS_WORKERS) {
+            scheduler_yield();
+        }
+    } else {
+        /* No scheduler yet: run the workers back to back */
+        for (uint32_t i = 0; i < HEAP_STRESS_WORKERS; i++) {
+            heap_stress_body(i + 1);
+        }
+    }
+
+    heap_latency_enable(false);
+
+    heap_get_latency(HEAP_LAT_ALLOC, &alloc_lat);
+    heap_get_latency(HEAP_LAT_FREE, &free_lat);
+    TEST_ASSERT_GE(alloc_lat.samples, HEAP_STRESS_WORKERS * HEAP_STRESS_ROUNDS);
+    TEST_ASSERT_GE(free_lat.samples, HEAP_STRESS_WORKERS * HEAP_STRESS_ROUNDS);
+    heap_print_latency();
+
+    heap_magazine_drain();
+    TEST_ASSERT_EQ(heap_validate(), true);
+
+    TEST_PASS();
+}
@@ -0,0 +1,159 @@
+/**
+ * AAAos Kernel - LZ4 Compression Tests
+ *
+ * Unit tests for the LZ4 block compressor used by compressed swap.
+ */
+
+#include "../framework/test.h"
+#include "../../kernel/mm/lz4.h"
+
+#define TEST_PAGE       4096
+
+static uint16_t lz4_state[LZ4_STATE_SIZE / sizeof(uint16_t)];
+static uint8_t page_in[TEST_PAGE];
+static uint8_t page_out[TEST_PAGE];
+static uint8_t packed[TEST_PAGE + TEST_PAGE / 255 + 16];
+
+/**
+ * Compress and decompress len bytes of page_in, checking the round trip
+ * @return Compressed size, or 0 if anything went wrong
+ */
+static size_t round_trip(size_t len) {
+    size_t size = lz4_compress(page_in, len, packed, sizeof(packed), lz4_state);
+    if (size == 0) {
+        return 0;
+    }
+    if (lz4_decompress(packed, size, page_out, sizeof(page_out)) != len) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (page_out[i] != page_in[i]) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+static uint32_t rand_state = 12345;
+
+static uint8_t next_rand(void) {
+    rand_state = rand_state * 1103515245u + 12345u;
+    return (uint8_t)(rand_state >> 16);
+}
+
+/**
+ * Test: A zero-filled page shrinks to a few bytes and comes back intact
+ */
+TEST_CASE(test_lz4_zero_page) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = 0;
+    }
+
+    size_t size = round_trip(TEST_PAGE);
+    TEST_ASSERT_GT(size, 0);
+    TEST_ASSERT_LT(size, 64);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Structured data (repeated records) compresses well
+ */
+TEST_CASE(test_lz4_structured) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = (i % 48) < 8 ? (uint8_t)(i / 48) : (uint8_t)"record-field"[i % 12];
+    }
+
+    size_t size = round_trip(TEST_PAGE);
+    TEST_ASSERT_GT(size, 0);
+    TEST_ASSERT_LT(size, TEST_PAGE / 2);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Random bytes survive, costing only the format's small overhead
+ */
+TEST_CASE(test_lz4_random) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = next_rand();
+    }
+
+    size_t size = round_trip(TEST_PAGE);
+    TEST_ASSERT_GT(size, 0);
+    TEST_ASSERT_LE(size, TEST_PAGE + TEST_PAGE / 255 + 16);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Inputs too short to hold a match, including empty ones
+ */
+TEST_CASE(test_lz4_short) {
+    for (size_t i = 0; i < 16; i++) {
+        page_in[i] = 'a';
+    }
+
+    for (size_t len = 1; len <= 16; len++) {
+        TEST_ASSERT_GT(round_trip(len), 0);
+    }
+    TEST_ASSERT_EQ(lz4_compress(page_in, 0, packed, sizeof(packed), lz4_state), 1);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Mixed runs and noise, at lengths around the sequence limits
+ */
+TEST_CASE(test_lz4_mixed) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = (i / 300) % 2 ? next_rand() : (uint8_t)(i % 7);
+    }
+
+    size_t lens[] = { 13, 17, 255, 270, 1000, 4095, TEST_PAGE };
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        TEST_ASSERT_GT(round_trip(lens[i]), 0);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Output that does not fit is refused rather than truncated
+ */
+TEST_CASE(test_lz4_capacity) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = next_rand();
+    }
+
+    TEST_ASSERT_EQ(lz4_compress(page_in, TEST_PAGE, packed, TEST_PAGE / 2, lz4_state), 0);
+    TEST_ASSERT_EQ(lz4_compress(page_in, LZ4_MAX_INPUT + 1, packed, sizeof(packed),
+                                lz4_state), 0);
+
+    /* The decompressor checks its output buffer too */
+    size_t size = round_trip(TEST_PAGE);
+    TEST_ASSERT_GT(size, 0);
+    TEST_ASSERT_EQ(lz4_decompress(packed, size, page_out, TEST_PAGE - 1), 0);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Truncated and corrupt input is rejected
+ */
+TEST_CASE(test_lz4_malformed) {
+    for (size_t i = 0; i < TEST_PAGE; i++) {
+        page_in[i] = (uint8_t)(i % 5);
+    }
+    size_t size = round_trip(TEST_PAGE);
+    TEST_ASSERT_GT(size, 3);
+
+    TEST_ASSERT_EQ(lz4_decompress(packed, size - 1, page_out, sizeof(page_out)), 0);
+    TEST_ASSERT_EQ(lz4_decompress(packed, 0, page_out, sizeof(page_out)), 0);
+
+    /* A match reaching back before the start of the output */
+    const uint8_t bad[] = { 0x10, 'x', 0x05, 0x00, 0x00 };
+    TEST_ASSERT_EQ(lz4_decompress(bad, sizeof(bad), page_out, sizeof(page_out)), 0);
+
+    TEST_PASS();
+}
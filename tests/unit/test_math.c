@@ -0,0 +1,523 @@
+/**
+ * AAAos Math Library Tests
+ *
+ * Unit tests for libm. Expected values are correctly rounded results
+ * computed in higher precision.
+ */
+
+#include "../framework/test.h"
+#include "../../lib/libm/math.h"
+#include "../../lib/libc/string.h"
+
+static uint64_t math_test_bits(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+/**
+ * Distance in ulps between two finite doubles of the same sign
+ */
+static uint64_t ulps(double a, double b) {
+    uint64_t ua = math_test_bits(a), ub = math_test_bits(b);
+    if ((ua ^ ub) >> 63) {
+        return (a == b) ? 0 : UINT64_MAX;
+    }
+    return ua > ub ? ua - ub : ub - ua;
+}
+
+static bool same_bits(double a, double b) {
+    return math_test_bits(a) == math_test_bits(b);
+}
+
+typedef struct {
+    double x;
+    double expected;
+} math_case_t;
+
+/* Every case must be within max_ulps */
+static bool check_cases(double (*fn)(double), const math_case_t *cases, size_t count,
+                        uint64_t max_ulps) {
+    for (size_t i = 0; i < count; i++) {
+        if (ulps(fn(cases[i].x), cases[i].expected) > max_ulps) {
+            kprintf("  f(%a) = %a, expected %a\n", cases[i].x, fn(cases[i].x),
+                    cases[i].expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+#define CHECK_CASES(fn, cases, max_ulps) \
+    check_cases(fn, cases, sizeof(cases) / sizeof(cases[0]), max_ulps)
+
+/**
+ * Test: exp, including the ends of its range
+ */
+TEST_CASE(test_math_exp) {
+    static const math_case_t cases[] = {
+        { 0x1p-30, 0x1.00000004p+0 },
+        { 0.5, 0x1.a61298e1e069cp+0 },
+        { -0.5, 0x1.368b2fc6f960ap-1 },
+        { 1.0, 0x1.5bf0a8b145769p+1 },
+        { 10.0, 0x1.5829dcf95056p+14 },
+        { -10.0, 0x1.7cd79b5647c9bp-15 },
+        { 700.0, 0x1.d945df4f8ec8ep+1009 },
+        { -700.0, 0x1.14f2b0fb9307fp-1010 },
+        { -740.0, 0x0.0000000000055p-1022 },
+        { 0x1.62e42fefa39efp+9, 0x1.fffffffffff2ap+1023 },
+    };
+
+    TEST_ASSERT(CHECK_CASES(exp, cases, 1));
+    TEST_ASSERT(same_bits(exp(0.0), 1.0));
+    TEST_ASSERT(isinf(exp(710.0)));
+    TEST_ASSERT(same_bits(exp(-750.0), 0.0));
+    TEST_ASSERT(same_bits(exp(-INFINITY), 0.0));
+    TEST_ASSERT(isinf(exp(INFINITY)));
+    TEST_ASSERT(isnan(exp(NAN)));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: log, log2 and log10, including subnormals and values next to 1
+ */
+TEST_CASE(test_math_log) {
+    static const math_case_t log_cases[] = {
+        { 0x1p-1074, -0x1.74385446d71c3p+9 },
+        { 1e-300, -0x1.5963447f87fb5p+9 },
+        { 0.999999, -0x1.0c6f82d74d23p-20 },
+        { 1.000001, 0x1.0c6f713f33a1dp-20 },
+        { 2.0, 0x1.62e42fefa39efp-1 },
+        { 10.0, 0x1.26bb1bbb55516p+1 },
+        { 1e300, 0x1.5963447f87fb5p+9 },
+    };
+    static const math_case_t log2_cases[] = {
+        { 0x1p-1074, -1074.0 },
+        { 0.999999, -0x1.83454c4167fe4p-20 },
+        { 1.000001, 0x1.834532df5d30ep-20 },
+        { 10.0, 0x1.a934f0979a371p+1 },
+        { 1e300, 0x1.f24a09f1a8b89p+9 },
+    };
+    static const math_case_t log10_cases[] = {
+        { 0x1p-1074, -0x1.434e6420f4374p+8 },
+        { 0.999999, -0x1.d25204937a8c5p-22 },
+        { 2.0, 0x1.34413509f79ffp-2 },
+        { 10.0, 1.0 },
+        { 1e300, 300.0 },
+    };
+
+    TEST_ASSERT(CHECK_CASES(log, log_cases, 1));
+    TEST_ASSERT(CHECK_CASES(log2, log2_cases, 1));
+    TEST_ASSERT(CHECK_CASES(log10, log10_cases, 1));
+    TEST_ASSERT(same_bits(log(1.0), 0.0));
+    TEST_ASSERT(same_bits(log2(0x1p-1000), -1000.0));
+    TEST_ASSERT(isinf(log(0.0)) && log(0.0) < 0.0);
+    TEST_ASSERT(isnan(log(-1.0)));
+    TEST_ASSERT(isinf(log(INFINITY)));
+    TEST_ASSERT(isnan(log(NAN)));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: sin, cos and tan, from tiny arguments to the largest double
+ */
+TEST_CASE(test_math_trig) {
+    static const math_case_t sin_cases[] = {
+        { 0x1p-20, 0x1.ffffffffffaabp-21 },
+        { 0.5, 0x1.eaee8744b05fp-2 },
+        { M_PI_4, 0x1.6a09e667f3bccp-1 },
+        { 1.0, 0x1.aed548f090ceep-1 },
+        { 3.0, 0x1.210386db6d55bp-3 },
+        { 100.0, -0x1.03425b78c4db8p-1 },
+        { 1e6, -0x1.6664b2568d867p-2 },
+        { 0x1.5fdbbe9bba775p+22, -0x1.ee2c2d963a10cp-33 },   /* Close to 7 pi/4 * 2^20 */
+        { 1e22, -0x1.b453ab76bf397p-1 },
+        { 0x1.fffffffffffffp+1023, 0x1.452fc98b34e97p-8 },
+    };
+    static const math_case_t cos_cases[] = {
+        { 0x1p-20, 0x1.ffffffffffp-1 },
+        { M_PI_4, 0x1.6a09e667f3bcdp-1 },
+        { 1.0, 0x1.14a280fb5068cp-1 },
+        { 3.0, -0x1.fae04be85e5d2p-1 },
+        { 1e6, 0x1.df9df9906d32cp-1 },
+        { 1e22, 0x1.0be2cef01c8f4p-1 },
+        { 0x1.fffffffffffffp+1023, -0x1.fffe62ecfab75p-1 },
+    };
+    static const math_case_t tan_cases[] = {
+        { 0.5, 0x1.17b4f5bf3474ap-1 },
+        { 1.0, 0x1.8eb245cbee3a6p+0 },
+        { 100.0, -0x1.2ca74d62b5d38p-1 },
+        { 1e22, -0x1.a0f79c1b6b257p+0 },
+    };
+
+    TEST_ASSERT(CHECK_CASES(sin, sin_cases, 1));
+    TEST_ASSERT(CHECK_CASES(cos, cos_cases, 1));
+    TEST_ASSERT(CHECK_CASES(tan, tan_cases, 3));
+    TEST_ASSERT(same_bits(sin(-0.0), -0.0));
+    TEST_ASSERT(same_bits(cos(0.0), 1.0));
+    TEST_ASSERT(isnan(sin(INFINITY)));
+    TEST_ASSERT(isnan(cos(-INFINITY)));
+    TEST_ASSERT(isnan(tan(NAN)));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: sincos gives the same results as sin and cos
+ */
+TEST_CASE(test_math_sincos) {
+    double x = 0x1p-30;
+
+    while (x < 1e300) {
+        double s, c;
+        sincos(x, &s, &c);
+        TEST_ASSERT(same_bits(s, sin(x)));
+        TEST_ASSERT(same_bits(c, cos(x)));
+        sincos(-x, &s, &c);
+        TEST_ASSERT(same_bits(s, sin(-x)));
+        TEST_ASSERT(same_bits(c, cos(-x)));
+        x *= 1.37;
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: atan, asin, acos and atan2
+ */
+TEST_CASE(test_math_inverse_trig) {
+    static const math_case_t atan_cases[] = {
+        { 0x1p-20, 0x1.ffffffffff555p-21 },
+        { 0.1, 0x1.983e282e2cc4dp-4 },
+        { 0.5, 0x1.dac670561bb4fp-2 },
+        { 1.0, 0x1.921fb54442d18p-1 },
+        { 2.0, 0x1.1b6e192ebbe44p+0 },
+        { 1e10, 0x1.921fb543d4dep+0 },
+    };
+    static const math_case_t asin_cases[] = {
+        { 0.1, 0x1.9a49276037884p-4 },
+        { 0.5, 0x1.0c152382d7366p-1 },
+        { 0.9, 0x1.1ea93705fa172p+0 },
+        { 0.999999, 0x1.91c306b2c13adp+0 },
+    };
+    static const math_case_t acos_cases[] = {
+        { 0.1, 0x1.787b22ce3f59p+0 },
+        { 0.5, 0x1.0c152382d7366p+0 },
+        { 0.9, 0x1.cdd9f8f922e98p-2 },
+        { 0.999999, 0x1.72ba46065af16p-10 },
+    };
+
+    TEST_ASSERT(CHECK_CASES(atan, atan_cases, 1));
+    TEST_ASSERT(CHECK_CASES(asin, asin_cases, 1));
+    TEST_ASSERT(CHECK_CASES(acos, acos_cases, 1));
+    TEST_ASSERT(same_bits(atan(INFINITY), M_PI_2));
+    TEST_ASSERT(same_bits(asin(-1.0), -M_PI_2));
+    TEST_ASSERT(same_bits(acos(1.0), 0.0));
+    TEST_ASSERT(same_bits(acos(-1.0), M_PI));
+    TEST_ASSERT(isnan(asin(1.5)));
+
+    TEST_ASSERT_LE(ulps(atan2(1.0, -1.0), 0x1.2d97c7f3321d2p+1), 1);
+    TEST_ASSERT_LE(ulps(atan2(-1.0, -1.0), -0x1.2d97c7f3321d2p+1), 1);
+    TEST_ASSERT_LE(ulps(atan2(3.0, -4.0), 0x1.3fc176b7a856p+1), 1);
+    TEST_ASSERT(same_bits(atan2(1e-300, 1e300), 0.0));
+    TEST_ASSERT(same_bits(atan2(-0.0, -1.0), -M_PI));
+    TEST_ASSERT(same_bits(atan2(0.0, 0.0), 0.0));
+    TEST_ASSERT(same_bits(atan2(1.0, 0.0), M_PI_2));
+    TEST_ASSERT(same_bits(atan2(INFINITY, -INFINITY), 3 * M_PI_4));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: pow, including its special cases
+ */
+TEST_CASE(test_math_pow) {
+    TEST_ASSERT_LE(ulps(pow(2.0, 0.5), M_SQRT2), 1);
+    TEST_ASSERT(same_bits(pow(2.0, -1074.0), 0x1p-1074));
+    TEST_ASSERT_LE(ulps(pow(10.0, -5.0), 0x1.4f8b588e368f1p-17), 1);
+    TEST_ASSERT_LE(ulps(pow(0x1.000001ad7f29bp+0, 1e9), 0x1.349445c228792p+144), 1);
+    TEST_ASSERT_LE(ulps(pow(0.5, 1023.5), 0x0.5a827999fcef3p-1022), 1);
+    TEST_ASSERT_LE(ulps(pow(3.0, 40.0), 0x1.517168a4523fdp+63), 1);
+    TEST_ASSERT_LE(ulps(pow(7.5, -3.25), 0x1.777bc44e42a56p-10), 1);
+    TEST_ASSERT(same_bits(pow(-2.0, 3.0), -8.0));
+    TEST_ASSERT(same_bits(pow(-2.0, 4.0), 16.0));
+
+    TEST_ASSERT(same_bits(pow(NAN, 0.0), 1.0));
+    TEST_ASSERT(same_bits(pow(1.0, NAN), 1.0));
+    TEST_ASSERT(same_bits(pow(-1.0, INFINITY), 1.0));
+    TEST_ASSERT(isnan(pow(-2.0, 0.5)));
+    TEST_ASSERT(same_bits(pow(-0.0, 3.0), -0.0));
+    TEST_ASSERT(same_bits(pow(-0.0, -3.0), -INFINITY));
+    TEST_ASSERT(same_bits(pow(-INFINITY, 3.0), -INFINITY));
+    TEST_ASSERT(same_bits(pow(-INFINITY, -2.0), 0.0));
+    TEST_ASSERT(same_bits(pow(0.5, INFINITY), 0.0));
+    TEST_ASSERT(same_bits(pow(0.5, -INFINITY), INFINITY));
+    TEST_ASSERT(isinf(pow(10.0, 400.0)));
+    TEST_ASSERT(same_bits(pow(10.0, -400.0), 0.0));
+    TEST_ASSERT(same_bits(pow(-10.0, -401.0), -0.0));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: sinh, cosh and tanh
+ */
+TEST_CASE(test_math_hyperbolic) {
+    static const math_case_t sinh_cases[] = {
+        { 0x1p-20, 0x1.00000000002abp-20 },
+        { 0.3, 0x1.37d42af54b926p-2 },
+        { 1.0, 0x1.2cd9fc44eb982p+0 },
+        { 5.0, 0x1.28d0166f07374p+6 },
+        { 30.0, 0x1.370470aec28edp+42 },
+        { 710.0, 0x1.3e21a464507f9p+1023 },
+    };
+    static const math_case_t cosh_cases[] = {
+        { 0x1p-20, 0x1.00000000008p+0 },
+        { 0.3, 0x1.0b9b4e0b6ec4cp+0 },
+        { 1.0, 0x1.8b07551d9f55p+0 },
+        { 5.0, 0x1.28d6fcbeff3aap+6 },
+        { 710.0, 0x1.3e21a464507f9p+1023 },
+    };
+    static const math_case_t tanh_cases[] = {
+        { 0x1p-20, 0x1.ffffffffff555p-21 },
+        { 0.3, 0x1.2a4dda7d914fap-2 },
+        { 1.0, 0x1.85efab514f394p-1 },
+        { 5.0, 0x1.fff419668df11p-1 },
+        { 30.0, 1.0 },
+    };
+
+    TEST_ASSERT(CHECK_CASES(sinh, sinh_cases, 2));
+    TEST_ASSERT(CHECK_CASES(cosh, cosh_cases, 2));
+    TEST_ASSERT(CHECK_CASES(tanh, tanh_cases, 3));
+    TEST_ASSERT(same_bits(sinh(-0.0), -0.0));
+    TEST_ASSERT(isinf(sinh(711.0)) && sinh(-711.0) < 0.0);
+    TEST_ASSERT(isinf(cosh(-711.0)));
+    TEST_ASSERT(same_bits(tanh(-INFINITY), -1.0));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Exact operations (rounding, fmod, ldexp, frexp, sqrt)
+ */
+TEST_CASE(test_math_exact) {
+    TEST_ASSERT(same_bits(floor(-2.5), -3.0));
+    TEST_ASSERT(same_bits(ceil(-2.5), -2.0));
+    TEST_ASSERT(same_bits(ceil(-0.5), -0.0));
+    TEST_ASSERT(same_bits(round(2.5), 3.0));
+    TEST_ASSERT(same_bits(round(-2.5), -3.0));
+    TEST_ASSERT(same_bits(round(0.49999999999999994), 0.0));
+    TEST_ASSERT(same_bits(trunc(-0x1.fffffffffffffp+51), -0x1.ffffffffffffep+51));
+
+    double ip;
+    TEST_ASSERT(same_bits(modf(-3.25, &ip), -0.25) && same_bits(ip, -3.0));
+
+    TEST_ASSERT(same_bits(fmod(5.5, 2.0), 1.5));
+    TEST_ASSERT(same_bits(fmod(-5.5, 2.0), -1.5));
+    TEST_ASSERT(same_bits(fmod(1e300, 3.0), 0.0));
+    TEST_ASSERT(same_bits(fmod(0x1p-1070, 0x1p-1073), 0.0));
+    TEST_ASSERT(same_bits(fmod(0x1.8p-1073, 0x1p-1074), 0.0));
+    TEST_ASSERT(isnan(fmod(1.0, 0.0)));
+    TEST_ASSERT(isnan(fmod(INFINITY, 1.0)));
+
+    int e;
+    TEST_ASSERT(same_bits(ldexp(1.0, -1074), 0x1p-1074));
+    TEST_ASSERT(same_bits(ldexp(0x1p-1074, 2097), 0x1p+1023));
+    TEST_ASSERT(isinf(ldexp(1.0, 1024)));
+    TEST_ASSERT(same_bits(frexp(0x1p-1074, &e), 0.5) && e == -1073);
+    TEST_ASSERT(same_bits(frexp(-12.0, &e), -0.75) && e == 4);
+
+    TEST_ASSERT(same_bits(sqrt(2.0), M_SQRT2));
+    TEST_ASSERT(same_bits(sqrt(0x1p-1074), 0x1p-537));
+    TEST_ASSERT(isnan(sqrt(-1.0)));
+
+    TEST_ASSERT_EQ(fpclassify(0x1p-1074), FP_SUBNORMAL);
+    TEST_ASSERT_EQ(fpclassify(-0.0), FP_ZERO);
+    TEST_ASSERT_EQ(fpclassify(NAN), FP_NAN);
+    TEST_ASSERT(signbit(-0.0) && !signbit(0.0));
+    TEST_ASSERT(same_bits(copysign(3.0, -0.0), -3.0));
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Single precision functions
+ */
+TEST_CASE(test_math_float) {
+    TEST_ASSERT_EQ(sinf(1.0f), 0x1.aed548p-1f);
+    TEST_ASSERT_EQ(cosf(1.0f), 0x1.14a28p-1f);
+    TEST_ASSERT_EQ(expf(1.0f), 0x1.5bf0a8p+1f);
+    TEST_ASSERT_EQ(expf(-100.0f), 0x1.bp-145f);
+    TEST_ASSERT_EQ(expf(88.72f), 0x1.fe8c9p+127f);
+    TEST_ASSERT(isinf(expf(89.0f)));
+    TEST_ASSERT_EQ(expf(-110.0f), 0.0f);
+    TEST_ASSERT_EQ(logf(10.0f), 0x1.26bb1cp+1f);
+
+    float s, c;
+    sincosf(2.0f, &s, &c);
+    TEST_ASSERT_EQ(s, sinf(2.0f));
+    TEST_ASSERT_EQ(c, cosf(2.0f));
+
+    TEST_PASS();
+}
+
+/*
+ * Array functions
+ */
+
+#define ARRAY_COUNT     4096
+
+static double array_in[ARRAY_COUNT];
+static double array_out[ARRAY_COUNT];
+static float array_in_f[ARRAY_COUNT];
+static float array_out_f[ARRAY_COUNT];
+
+/* Deterministic arguments spread over [lo, hi) */
+static void array_fill(double lo, double hi) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        array_in[i] = lo + (hi - lo) * (double)(state >> 11) * 0x1p-53;
+        array_in_f[i] = (float)array_in[i];
+    }
+}
+
+/**
+ * Test: Array functions match the scalar ones exactly
+ */
+TEST_CASE(test_math_arrays) {
+    array_fill(-1e6, 1e6);
+    sin_array(array_out, array_in, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT(same_bits(array_out[i], sin(array_in[i])));
+    }
+    cos_array(array_out, array_in, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT(same_bits(array_out[i], cos(array_in[i])));
+    }
+
+    array_fill(-800.0, 800.0);
+    exp_array(array_out, array_in, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT(same_bits(array_out[i], exp(array_in[i])));
+    }
+    expf_array(array_out_f, array_in_f, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT_EQ(math_test_bits(array_out_f[i]), math_test_bits(expf(array_in_f[i])));
+    }
+    sinf_array(array_out_f, array_in_f, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT_EQ(math_test_bits(array_out_f[i]), math_test_bits(sinf(array_in_f[i])));
+    }
+
+    /* Includes negatives and zero */
+    array_fill(-1.0, 1e3);
+    array_in[0] = 0.0;
+    array_in[1] = 0x1p-1074;
+    log_array(array_out, array_in, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        double expected = log(array_in[i]);
+        TEST_ASSERT(same_bits(array_out[i], expected) ||
+                    (isnan(array_out[i]) && isnan(expected)));
+    }
+
+    /* In place */
+    array_fill(-10.0, 10.0);
+    memcpy(array_out, array_in, sizeof(array_in));
+    exp_array(array_out, array_out, ARRAY_COUNT);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        TEST_ASSERT(same_bits(array_out[i], exp(array_in[i])));
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Identities over a sweep of arguments
+ */
+TEST_CASE(test_math_identities) {
+    array_fill(-100.0, 100.0);
+    for (size_t i = 0; i < ARRAY_COUNT; i++) {
+        double x = array_in[i];
+        double s = sin(x), c = cos(x);
+        TEST_ASSERT(fabs(s * s + c * c - 1.0) <= 0x1p-51);
+        TEST_ASSERT_LE(ulps(sin(-x), -s), 0);
+        TEST_ASSERT(fabs(log(exp(x * 0.1)) - x * 0.1) <= 0x1p-48);
+        TEST_ASSERT(fabs(atan2(s, c) - (x - 2 * M_PI * round(x / (2 * M_PI)))) <= 0x1p-45);
+    }
+
+    TEST_PASS();
+}
+
+/*
+ * Throughput benchmarks
+ *
+ * These print cycles per value for the scalar and array functions; they
+ * do not fail on slow results.
+ */
+
+#define MATH_BENCH_ROUNDS   64
+
+static inline uint64_t math_bench_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void math_bench_report(const char *name, uint64_t cycles) {
+    uint64_t hundredths = cycles * 100 / ((uint64_t)MATH_BENCH_ROUNDS * ARRAY_COUNT);
+    kprintf("  %s %u.%02u cycles/value\n", name, (uint32_t)(hundredths / 100),
+            (uint32_t)(hundredths % 100));
+}
+
+/**
+ * Benchmark: sin, exp and log, one value at a time and as arrays
+ */
+TEST_CASE(test_math_bench) {
+    uint64_t start;
+
+    array_fill(-10.0, 10.0);
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        for (size_t i = 0; i < ARRAY_COUNT; i++) {
+            array_out[i] = sin(array_in[i]);
+        }
+    }
+    math_bench_report("sin      ", math_bench_rdtsc() - start);
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        sin_array(array_out, array_in, ARRAY_COUNT);
+    }
+    math_bench_report("sin_array", math_bench_rdtsc() - start);
+
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        for (size_t i = 0; i < ARRAY_COUNT; i++) {
+            array_out[i] = exp(array_in[i]);
+        }
+    }
+    math_bench_report("exp      ", math_bench_rdtsc() - start);
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        exp_array(array_out, array_in, ARRAY_COUNT);
+    }
+    math_bench_report("exp_array", math_bench_rdtsc() - start);
+
+    array_fill(1e-10, 1e10);
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        for (size_t i = 0; i < ARRAY_COUNT; i++) {
+            array_out[i] = log(array_in[i]);
+        }
+    }
+    math_bench_report("log      ", math_bench_rdtsc() - start);
+    start = math_bench_rdtsc();
+    for (int r = 0; r < MATH_BENCH_ROUNDS; r++) {
+        log_array(array_out, array_in, ARRAY_COUNT);
+    }
+    math_bench_report("log_array", math_bench_rdtsc() - start);
+
+    TEST_PASS();
+}
@@ -6,6 +6,20 @@
 
 #include "../framework/test.h"
 #include "../../kernel/mm/pmm.h"
+#include "../../kernel/arch/x86_64/include/percpu.h"
+
+/**
+ * Test: Initialize with the default memory layout (1MB - 16MB usable)
+ * Must stay the first test in this file; the others depend on it.
+ */
+TEST_CASE(test_pmm_init) {
+    size_t free_pages = pmm_init(NULL);
+
+    TEST_ASSERT_GT(free_pages, 0);
+    TEST_ASSERT_EQ(free_pages, pmm_get_free_pages());
+
+    TEST_PASS();
+}
 
 /**
  * Test: Allocate and free a single page
@@ -260,3 +274,303 @@ TEST_CASE(test_pmm_alternating) {
 
     TEST_PASS();
 }
+
+/**
+ * Test: Buddy blocks are naturally aligned to their size
+ */
+TEST_CASE(test_pmm_buddy_alignment) {
+    physaddr_t a, b;
+
+    a = pmm_alloc_pages(8);
+    TEST_ASSERT_NE(a, 0);
+    TEST_ASSERT_EQ(PMM_ADDR_TO_PFN(a) % 8, 0);
+
+    /* Non power-of-two counts round up for alignment only */
+    b = pmm_alloc_pages(5);
+    TEST_ASSERT_NE(b, 0);
+    TEST_ASSERT_EQ(PMM_ADDR_TO_PFN(b) % 8, 0);
+
+    pmm_free_pages(a, 8);
+    pmm_free_pages(b, 5);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Freed single pages coalesce back into a maximal block
+ */
+TEST_CASE(test_pmm_buddy_coalesce) {
+    size_t block = 1ULL << PMM_MAX_ORDER;
+    physaddr_t big;
+    size_t free_before = pmm_get_free_pages();
+
+    big = pmm_alloc_pages(block);
+    TEST_ASSERT_NE(big, 0);
+    TEST_ASSERT_EQ(PMM_ADDR_TO_PFN(big) % block, 0);
+
+    /* Free page by page, odd pages first, so merges happen late */
+    for (size_t i = 1; i < block; i += 2) {
+        pmm_free_page(big + i * PMM_PAGE_SIZE);
+    }
+    for (size_t i = 0; i < block; i += 2) {
+        pmm_free_page(big + i * PMM_PAGE_SIZE);
+    }
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    /* The whole block must be available again as one allocation */
+    pmm_drain_cpu_caches();
+    physaddr_t again = pmm_alloc_pages(block);
+    TEST_ASSERT_EQ(again, big);
+    pmm_free_pages(again, block);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Allocations larger than the biggest buddy block
+ */
+TEST_CASE(test_pmm_alloc_beyond_max_order) {
+    size_t count = (1ULL << PMM_MAX_ORDER) + 3;
+    size_t free_before = pmm_get_free_pages();
+    physaddr_t block;
+
+    block = pmm_alloc_pages(count);
+    TEST_ASSERT_NE(block, 0);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before - count);
+
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQ(pmm_is_page_free(block + i * PMM_PAGE_SIZE), false);
+    }
+
+    pmm_free_pages(block, count);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Reserving a range inside a free block splits it
+ */
+TEST_CASE(test_pmm_reserve_splits_block) {
+    size_t block = 1ULL << PMM_MAX_ORDER;
+    size_t free_before = pmm_get_free_pages();
+    physaddr_t big, page;
+
+    /* Find a free max-order block, then hand it back */
+    big = pmm_alloc_pages(block);
+    TEST_ASSERT_NE(big, 0);
+    pmm_free_pages(big, block);
+
+    /* Reserve three pages in the middle of it */
+    pmm_reserve_range(big + 100 * PMM_PAGE_SIZE, 3 * PMM_PAGE_SIZE);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before - 3);
+    TEST_ASSERT_EQ(pmm_is_page_free(big + 101 * PMM_PAGE_SIZE), false);
+
+    /* Single-page allocations must never return a reserved page */
+    for (size_t i = 0; i < block; i++) {
+        page = pmm_alloc_page();
+        TEST_ASSERT_NE(page, 0);
+        TEST_ASSERT(page < big + 100 * PMM_PAGE_SIZE ||
+                    page >= big + 103 * PMM_PAGE_SIZE);
+        pmm_free_page(page);
+    }
+
+    pmm_free_pages(big + 100 * PMM_PAGE_SIZE, 3);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Single-page traffic is served from the per-CPU cache
+ */
+TEST_CASE(test_pmm_cpu_cache) {
+    pmm_cpu_stats_t before, after;
+    physaddr_t page;
+    size_t free_before = pmm_get_free_pages();
+
+    TEST_ASSERT(pmm_get_cpu_stats(0, &before));
+
+    page = pmm_alloc_page();
+    TEST_ASSERT_NE(page, 0);
+    pmm_free_page(page);
+
+    /* The freed frame is cached but still counts and reports as free */
+    TEST_ASSERT_EQ(pmm_is_page_free(page), true);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    /* Reallocating it is a hit and returns the hot frame */
+    TEST_ASSERT_EQ(pmm_alloc_page(), page);
+    TEST_ASSERT(pmm_get_cpu_stats(0, &after));
+    TEST_ASSERT_GT(after.hits + after.misses, before.hits + before.misses);
+    TEST_ASSERT_GT(after.hits, before.hits);
+
+    /* Double free of a cached frame is refused */
+    pmm_free_page(page);
+    pmm_free_page(page);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    /* Draining empties the cache without changing the free count */
+    pmm_drain_cpu_caches();
+    TEST_ASSERT(pmm_get_cpu_stats(0, &after));
+    TEST_ASSERT_EQ(after.cached, 0);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_ASSERT_EQ(pmm_get_cpu_stats(PERCPU_MAX_CPUS, &after), false);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Range reservation and free across bitmap word boundaries
+ */
+TEST_CASE(test_pmm_reserve_unaligned_range) {
+    size_t free_before = pmm_get_free_pages();
+    physaddr_t base, start;
+
+    /* Borrow a region so the range is known to be free */
+    base = pmm_alloc_pages(512);
+    TEST_ASSERT_NE(base, 0);
+    pmm_free_pages(base, 512);
+
+    /* 200 pages starting 37 pages in: partial words at both ends */
+    start = base + 37 * PMM_PAGE_SIZE;
+    pmm_reserve_range(start, 200 * PMM_PAGE_SIZE);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before - 200);
+    TEST_ASSERT_EQ(pmm_is_page_free(start - PMM_PAGE_SIZE), true);
+    TEST_ASSERT_EQ(pmm_is_page_free(start), false);
+    TEST_ASSERT_EQ(pmm_is_page_free(start + 199 * PMM_PAGE_SIZE), false);
+    TEST_ASSERT_EQ(pmm_is_page_free(start + 200 * PMM_PAGE_SIZE), true);
+
+    /* Reserving an overlapping range only counts the new pages */
+    pmm_reserve_range(start + 150 * PMM_PAGE_SIZE, 100 * PMM_PAGE_SIZE);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before - 250);
+
+    pmm_free_pages(start, 250);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Shared frames are freed by the last reference only
+ */
+TEST_CASE(test_pmm_page_refcount) {
+    size_t free_before = pmm_get_free_pages();
+    physaddr_t page;
+
+    page = pmm_alloc_page();
+    TEST_ASSERT_NE(page, 0);
+    TEST_ASSERT_EQ(pmm_page_refcount(page), 1);
+
+    TEST_ASSERT(pmm_page_ref(page));
+    TEST_ASSERT(pmm_page_ref(page));
+    TEST_ASSERT_EQ(pmm_page_refcount(page), 3);
+
+    TEST_ASSERT_EQ(pmm_page_unref(page), false);
+    TEST_ASSERT_EQ(pmm_page_unref(page), false);
+    TEST_ASSERT_EQ(pmm_is_page_free(page), false);
+    TEST_ASSERT_EQ(pmm_page_refcount(page), 1);
+
+    TEST_ASSERT_EQ(pmm_page_unref(page), true);
+    TEST_ASSERT_EQ(pmm_page_refcount(page), 0);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    /* Free frames cannot be shared */
+    TEST_ASSERT_EQ(pmm_page_ref(page), false);
+
+    TEST_PASS();
+}
+
+/* More than the default layout's 16MB of frames */
+#define RECLAIM_MAX_PAGES 8192
+
+/* Frame the test reclaimer gives back */
+static physaddr_t reclaim_held = 0;
+static uint32_t reclaim_calls = 0;
+
+static size_t test_reclaimer(size_t pages) {
+    UNUSED(pages);
+    reclaim_calls++;
+    if (reclaim_held == 0) {
+        return 0;
+    }
+    pmm_free_page(reclaim_held);
+    reclaim_held = 0;
+    return 1;
+}
+
+/**
+ * Test: An exhausted allocator shrinks registered caches before failing
+ */
+TEST_CASE(test_pmm_reclaim) {
+    static physaddr_t pages[RECLAIM_MAX_PAGES];
+    size_t free_before = pmm_get_free_pages();
+    size_t count = 0;
+
+    TEST_ASSERT(pmm_register_reclaimer(test_reclaimer));
+
+    reclaim_held = pmm_alloc_page();
+    TEST_ASSERT_NE(reclaim_held, 0);
+
+    /* Take everything else; the last allocation is served by the reclaimer */
+    while (count < RECLAIM_MAX_PAGES) {
+        physaddr_t page = pmm_alloc_page();
+        if (page == 0) {
+            break;
+        }
+        pages[count++] = page;
+    }
+
+    TEST_ASSERT_EQ(reclaim_held, 0);
+    TEST_ASSERT_GT(reclaim_calls, 0);
+    TEST_ASSERT_EQ(count, free_before);
+
+    for (size_t i = 0; i < count; i++) {
+        pmm_free_page(pages[i]);
+    }
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_PASS();
+}
+
+static uint32_t pressure_calls = 0;
+
+static void test_pressure_hook(void) {
+    pressure_calls++;
+}
+
+/**
+ * Test: Allocations that leave the pool below the low watermark report pressure
+ */
+TEST_CASE(test_pmm_watermarks) {
+    size_t low, high;
+    pmm_get_watermarks(&low, &high);
+    TEST_ASSERT_GE(low, PMM_WMARK_MIN);
+    TEST_ASSERT_LE(low, high);
+    TEST_ASSERT(!pmm_set_watermarks(10, 5));
+
+    pmm_drain_cpu_caches();
+    size_t free_pages = pmm_get_free_pages();
+    pmm_set_pressure_hook(test_pressure_hook);
+
+    /* Plenty free: nothing to report */
+    TEST_ASSERT(pmm_set_watermarks(free_pages / 2, free_pages));
+    physaddr_t pages = pmm_alloc_pages(4);
+    TEST_ASSERT_NE(pages, 0);
+    TEST_ASSERT_EQ(pressure_calls, 0);
+    pmm_free_pages(pages, 4);
+
+    /* Low watermark above what is free: the allocation reports it */
+    TEST_ASSERT(pmm_set_watermarks(free_pages + 1, free_pages + 1));
+    pages = pmm_alloc_pages(4);
+    TEST_ASSERT_NE(pages, 0);
+    TEST_ASSERT_GT(pressure_calls, 0);
+    pmm_free_pages(pages, 4);
+
+    pmm_set_pressure_hook(NULL);
+    TEST_ASSERT(pmm_set_watermarks(low, high));
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_pages);
+
+    TEST_PASS();
+}
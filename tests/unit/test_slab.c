@@ -0,0 +1,142 @@
+/**
+ * AAAos Kernel - Slab Allocator Tests
+ *
+ * Unit tests for the kmem_cache object caches.
+ */
+
+#include "../framework/test.h"
+#include "../../kernel/mm/slab.h"
+#include "../../kernel/mm/pmm.h"
+
+typedef struct test_obj {
+    uint64_t a;
+    uint32_t b;
+    uint32_t state;
+} test_obj_t;
+
+#define TEST_OBJ_CONSTRUCTED    0xC0FFEE
+
+static void test_obj_ctor(void *obj) {
+    ((test_obj_t *)obj)->state = TEST_OBJ_CONSTRUCTED;
+}
+
+/**
+ * Test: Basic cache allocation and free
+ */
+TEST_CASE(test_slab_alloc_free) {
+    kmem_cache_t *cache;
+    kmem_cache_stats_t stats;
+    void *obj;
+
+    cache = kmem_cache_create("test_basic", sizeof(test_obj_t), 0, NULL);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    obj = kmem_cache_alloc(cache);
+    TEST_ASSERT_NOT_NULL(obj);
+
+    kmem_cache_get_stats(cache, &stats);
+    TEST_ASSERT_EQ(stats.active_objs, 1);
+    TEST_ASSERT_EQ(stats.slab_count, 1);
+
+    kmem_cache_free(cache, obj);
+
+    kmem_cache_get_stats(cache, &stats);
+    TEST_ASSERT_EQ(stats.active_objs, 0);
+
+    TEST_ASSERT_EQ(kmem_cache_destroy(cache), true);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Objects are unique, aligned and span multiple slabs
+ */
+TEST_CASE(test_slab_many_objects) {
+    kmem_cache_t *cache;
+    kmem_cache_stats_t stats;
+    void *objs[200];
+    int i, j;
+
+    cache = kmem_cache_create("test_many", 48, 64, NULL);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    for (i = 0; i < 200; i++) {
+        objs[i] = kmem_cache_alloc(cache);
+        TEST_ASSERT_NOT_NULL(objs[i]);
+        TEST_ASSERT_EQ((uint64_t)objs[i] % 64, 0);
+    }
+
+    for (i = 0; i < 200; i++) {
+        for (j = i + 1; j < 200; j++) {
+            TEST_ASSERT_NE(objs[i], objs[j]);
+        }
+    }
+
+    kmem_cache_get_stats(cache, &stats);
+    TEST_ASSERT_EQ(stats.active_objs, 200);
+    TEST_ASSERT_GT(stats.slab_count, 1);
+
+    for (i = 0; i < 200; i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+
+    /* Only one empty slab is retained */
+    kmem_cache_get_stats(cache, &stats);
+    TEST_ASSERT_EQ(stats.active_objs, 0);
+    TEST_ASSERT_EQ(stats.slab_count, 1);
+
+    TEST_ASSERT_EQ(kmem_cache_destroy(cache), true);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Constructed state survives free and reallocation
+ */
+TEST_CASE(test_slab_ctor) {
+    kmem_cache_t *cache;
+    test_obj_t *obj;
+
+    cache = kmem_cache_create("test_ctor", sizeof(test_obj_t), 0, test_obj_ctor);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    obj = kmem_cache_alloc(cache);
+    TEST_ASSERT_NOT_NULL(obj);
+    TEST_ASSERT_EQ(obj->state, TEST_OBJ_CONSTRUCTED);
+
+    kmem_cache_free(cache, obj);
+
+    obj = kmem_cache_alloc(cache);
+    TEST_ASSERT_NOT_NULL(obj);
+    TEST_ASSERT_EQ(obj->state, TEST_OBJ_CONSTRUCTED);
+    kmem_cache_free(cache, obj);
+
+    TEST_ASSERT_EQ(kmem_cache_destroy(cache), true);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Destroy refuses caches with live objects; shrink frees pages
+ */
+TEST_CASE(test_slab_destroy_and_shrink) {
+    kmem_cache_t *cache;
+    void *obj;
+    size_t free_before = pmm_get_free_pages();
+
+    cache = kmem_cache_create("test_shrink", 128, 0, NULL);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    obj = kmem_cache_zalloc(cache);
+    TEST_ASSERT_NOT_NULL(obj);
+    TEST_ASSERT_EQ(((uint8_t *)obj)[127], 0);
+    TEST_ASSERT_EQ(kmem_cache_destroy(cache), false);
+
+    kmem_cache_free(cache, obj);
+    TEST_ASSERT_GT(kmem_cache_shrink(cache), 0);
+    TEST_ASSERT_EQ(pmm_get_free_pages(), free_before);
+
+    TEST_ASSERT_EQ(kmem_cache_destroy(cache), true);
+
+    TEST_PASS();
+}
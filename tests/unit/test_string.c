@@ -243,6 +243,206 @@ TEST_CASE(test_strstr) {
     TEST_PASS();
 }
 
+/*
+ * Word-at-a-time sweeps
+ *
+ * Each function is checked against a plain byte loop at every start
+ * alignment, with the interesting byte at every position of a word.
+ */
+
+#define STR_SWEEP_MAX   160
+static char str_sweep_a[STR_SWEEP_MAX + 32];
+static char str_sweep_b[STR_SWEEP_MAX + 32];
+
+/**
+ * Fill with letters that never hit c or the terminator, then terminate
+ */
+static char *str_sweep_fill(char *buf, size_t off, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[off + i] = (char)('a' + (i * 7 + off) % 23);
+    }
+    buf[off + len] = '\0';
+    /* Garbage after the terminator must not be looked at */
+    for (size_t i = off + len + 1; i < sizeof(str_sweep_a); i++) {
+        buf[i] = 'z';
+    }
+    return buf + off;
+}
+
+/**
+ * Test: strlen at every alignment and length
+ */
+TEST_CASE(test_strlen_sweep) {
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len <= STR_SWEEP_MAX; len++) {
+            char *str = str_sweep_fill(str_sweep_a, off, len);
+            TEST_ASSERT_EQ(strlen(str), len);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: strchr and strrchr with the character at every position
+ */
+TEST_CASE(test_strchr_sweep) {
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 1; len <= 64; len++) {
+            char *str = str_sweep_fill(str_sweep_a, off, len);
+            TEST_ASSERT_NULL(strchr(str, 'z'));
+            TEST_ASSERT_NULL(strrchr(str, 'z'));
+            TEST_ASSERT_EQ(strchr(str, '\0'), str + len);
+            TEST_ASSERT_EQ(strrchr(str, '\0'), str + len);
+
+            for (size_t pos = 0; pos < len; pos++) {
+                str[pos] = '#';
+                TEST_ASSERT_EQ(strchr(str, '#'), str + pos);
+                TEST_ASSERT_EQ(strrchr(str, '#'), str + pos);
+                str[0] = '#';
+                TEST_ASSERT_EQ(strchr(str, '#'), str);
+                TEST_ASSERT_EQ(strrchr(str, '#'), str + pos);
+                str_sweep_fill(str_sweep_a, off, len);
+            }
+        }
+    }
+
+    /* Bytes above 0x7F */
+    const char *high = "abc\x80\xff";
+    TEST_ASSERT_EQ(strchr(high, 0xff), high + 4);
+    TEST_ASSERT_EQ(strrchr(high, 0x80), high + 3);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: strcmp with the difference at every position and alignment pair
+ */
+TEST_CASE(test_strcmp_sweep) {
+    for (size_t off_a = 0; off_a < 8; off_a++) {
+        for (size_t off_b = 0; off_b < 8; off_b++) {
+            for (size_t len = 0; len <= 40; len++) {
+                char *a = str_sweep_fill(str_sweep_a, off_a, len);
+                char *b = str_sweep_b + off_b;
+                for (size_t i = 0; i <= len; i++) {
+                    b[i] = a[i];
+                }
+                TEST_ASSERT_EQ(strcmp(a, b), 0);
+
+                for (size_t pos = 0; pos < len; pos++) {
+                    char saved = b[pos];
+                    b[pos] = (char)0xC0;
+                    TEST_ASSERT_LT(strcmp(a, b), 0);
+                    TEST_ASSERT_GT(strcmp(b, a), 0);
+                    b[pos] = saved;
+                }
+                if (len > 0) {
+                    /* b is a prefix of a */
+                    b[len - 1] = '\0';
+                    TEST_ASSERT_GT(strcmp(a, b), 0);
+                    TEST_ASSERT_LT(strcmp(b, a), 0);
+                }
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Plain strstr to check against
+ */
+static const char *str_sweep_find(const char *h, const char *n) {
+    for (; ; h++) {
+        size_t i = 0;
+        while (n[i] && h[i] == n[i]) {
+            i++;
+        }
+        if (!n[i]) {
+            return h;
+        }
+        if (!*h) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Test: strstr against a plain search, both short and Horspool needles
+ */
+TEST_CASE(test_strstr_sweep) {
+    static const char *haystacks[] = {
+        "", "a", "aaaaaaaaaaaaaaaaaaaaaaab", "abababababababababcabab",
+        "the quick brown fox jumps over the lazy dog",
+        "/usr/local/share/doc/../lib/./x", "mississippi", "abcabcabdabcabcabcabd",
+    };
+    static const char *needles[] = {
+        "a", "b", "ab", "aab", "aaab", "aaaaab", "abc", "abcab", "abcabd",
+        "lazy", "dog", "the", "fox jumps", "issip", "ssi", "/./", "..",
+        "zzzz", "aaaaaaaaaaaaaaaaaaaaaaaab", "mississippii",
+    };
+
+    for (size_t h = 0; h < sizeof(haystacks) / sizeof(haystacks[0]); h++) {
+        for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); n++) {
+            TEST_ASSERT_EQ(strstr(haystacks[h], needles[n]),
+                           str_sweep_find(haystacks[h], needles[n]));
+        }
+    }
+
+    /* Long haystack at every alignment, match near the end */
+    for (size_t off = 0; off < 8; off++) {
+        char *str = str_sweep_fill(str_sweep_a, off, STR_SWEEP_MAX);
+        char needle[8] = { str[150], str[151], str[152], str[153], str[154], 0 };
+        TEST_ASSERT_EQ(strstr(str, needle), str_sweep_find(str, needle));
+        needle[2] = 0;
+        TEST_ASSERT_EQ(strstr(str, needle), str_sweep_find(str, needle));
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: memchr and memrchr at every alignment and position
+ */
+TEST_CASE(test_memchr_sweep) {
+    uint8_t buf[96];
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)(i | 1);
+    }
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t n = 0; n <= 80; n++) {
+            TEST_ASSERT_NULL(memchr(buf + off, 0, n));
+            TEST_ASSERT_NULL(memrchr(buf + off, 0, n));
+            for (size_t pos = 0; pos < n; pos++) {
+                buf[off + pos] = 0;
+                TEST_ASSERT_EQ(memchr(buf + off, 0, n), buf + off + pos);
+                TEST_ASSERT_EQ(memrchr(buf + off, 0, n), buf + off + pos);
+                if (pos + 1 < n) {
+                    buf[off + n - 1] = 0;
+                    TEST_ASSERT_EQ(memchr(buf + off, 0, n), buf + off + pos);
+                    TEST_ASSERT_EQ(memrchr(buf + off, 0, n), buf + off + n - 1);
+                    buf[off + n - 1] = (uint8_t)((off + n - 1) | 1);
+                }
+                buf[off + pos] = (uint8_t)((off + pos) | 1);
+            }
+            /* Matches just outside the range are not reported */
+            buf[off + n] = 0;
+            if (off > 0) {
+                buf[off - 1] = 0;
+            }
+            TEST_ASSERT_NULL(memchr(buf + off, 0, n));
+            TEST_ASSERT_NULL(memrchr(buf + off, 0, n));
+            buf[off + n] = (uint8_t)((off + n) | 1);
+            if (off > 0) {
+                buf[off - 1] = (uint8_t)((off - 1) | 1);
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
 /*
  * memcpy tests
  */
@@ -343,6 +543,126 @@ TEST_CASE(test_memmove_backward) {
     TEST_PASS();
 }
 
+/* Buffers for the size and alignment sweeps, with room for guard bytes */
+#define SWEEP_MAX       4200
+static uint8_t sweep_src[SWEEP_MAX + 64];
+static uint8_t sweep_dst[SWEEP_MAX + 64];
+static uint8_t sweep_ref[SWEEP_MAX + 64];
+
+static const size_t sweep_large[] = { 511, 512, 1000, 4095, 4096, 4099, SWEEP_MAX };
+
+static void sweep_fill(uint8_t *buf, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+/**
+ * Copy n bytes at the given alignments and check them and their neighbours
+ */
+static int sweep_copy(size_t n, size_t src_off, size_t dst_off) {
+    sweep_fill(sweep_src, sizeof(sweep_src), (uint32_t)(n * 64 + src_off));
+    for (size_t i = 0; i < sizeof(sweep_dst); i++) {
+        sweep_dst[i] = 0xEE;
+    }
+
+    if (memcpy(sweep_dst + 16 + dst_off, sweep_src + src_off, n) != sweep_dst + 16 + dst_off) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(sweep_dst); i++) {
+        uint8_t want = 0xEE;
+        if (i >= 16 + dst_off && i < 16 + dst_off + n) {
+            want = sweep_src[src_off + i - 16 - dst_off];
+        }
+        if (sweep_dst[i] != want) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Test: memcpy across sizes and alignments (word, tail and rep paths)
+ */
+TEST_CASE(test_memcpy_sweep) {
+    for (size_t n = 0; n <= 300; n++) {
+        for (size_t src_off = 0; src_off < 8; src_off++) {
+            for (size_t dst_off = 0; dst_off < 8; dst_off++) {
+                TEST_ASSERT_EQ(sweep_copy(n, src_off, dst_off), 0);
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(sweep_large) / sizeof(sweep_large[0]); i++) {
+        for (size_t off = 0; off < 8; off++) {
+            TEST_ASSERT_EQ(sweep_copy(sweep_large[i], off, 7 - off), 0);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Test: memset across sizes and alignments
+ */
+TEST_CASE(test_memset_sweep) {
+    for (size_t n = 0; n <= SWEEP_MAX; n += (n < 300) ? 1 : 97) {
+        for (size_t off = 0; off < 8; off++) {
+            for (size_t i = 0; i < sizeof(sweep_dst); i++) {
+                sweep_dst[i] = 0xEE;
+            }
+            TEST_ASSERT_EQ(memset(sweep_dst + 16 + off, 0x5A, n), sweep_dst + 16 + off);
+            for (size_t i = 0; i < sizeof(sweep_dst); i++) {
+                uint8_t want = (i >= 16 + off && i < 16 + off + n) ? 0x5A : 0xEE;
+                TEST_ASSERT_EQ(sweep_dst[i], want);
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Move n bytes by delta within one buffer and check against a plain copy
+ */
+static int sweep_move(size_t n, int delta) {
+    size_t src = 64;
+    size_t dst = (size_t)((int)src + delta);
+
+    /* sweep_src keeps the original contents to build the expected result */
+    sweep_fill(sweep_src, sizeof(sweep_src), (uint32_t)(n * 131 + (size_t)(delta + 64)));
+    for (size_t i = 0; i < sizeof(sweep_ref); i++) {
+        sweep_dst[i] = sweep_src[i];
+        sweep_ref[i] = sweep_src[i];
+    }
+    for (size_t i = 0; i < n; i++) {
+        sweep_ref[dst + i] = sweep_src[src + i];
+    }
+
+    if (memmove(sweep_dst + dst, sweep_dst + src, n) != sweep_dst + dst) {
+        return 1;
+    }
+    return memcmp(sweep_dst, sweep_ref, sizeof(sweep_ref)) != 0;
+}
+
+/**
+ * Test: overlapping memmove in both directions across sizes
+ */
+TEST_CASE(test_memmove_sweep) {
+    for (size_t n = 0; n <= 300; n++) {
+        for (int delta = -40; delta <= 40; delta++) {
+            TEST_ASSERT_EQ(sweep_move(n, delta), 0);
+        }
+    }
+    for (size_t n = 512; n <= SWEEP_MAX - 128; n += 509) {
+        for (int delta = -64; delta <= 64; delta += 3) {
+            TEST_ASSERT_EQ(sweep_move(n, delta), 0);
+        }
+    }
+
+    TEST_PASS();
+}
+
 /*
  * memset tests
  */
@@ -448,3 +768,77 @@ TEST_CASE(test_memcmp_different) {
 
     TEST_PASS();
 }
+
+/*
+ * Throughput benchmarks
+ *
+ * These print bytes per cycle at a few sizes to compare implementations;
+ * they do not fail on slow results.
+ */
+
+#define BENCH_BYTES     (32u * 1024 * 1024)    /* Bytes moved per size */
+#define BENCH_MAX       (64u * 1024)
+
+static uint8_t bench_src[BENCH_MAX];
+static uint8_t bench_dst[BENCH_MAX];
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096, BENCH_MAX };
+
+static inline uint64_t bench_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void bench_report(const char *name, size_t size, uint64_t cycles) {
+    uint64_t hundredths = cycles ? (uint64_t)BENCH_BYTES * 100 / cycles : 0;
+    kprintf("  %s %6u bytes: %u.%02u bytes/cycle\n", name, (uint32_t)size,
+            (uint32_t)(hundredths / 100), (uint32_t)(hundredths % 100));
+}
+
+/**
+ * Benchmark: memcpy throughput
+ */
+TEST_CASE(test_memcpy_bench) {
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        size_t size = bench_sizes[i];
+        uint64_t start = bench_rdtsc();
+        for (size_t done = 0; done < BENCH_BYTES; done += size) {
+            memcpy(bench_dst, bench_src, size);
+        }
+        bench_report("memcpy ", size, bench_rdtsc() - start);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Benchmark: memset throughput
+ */
+TEST_CASE(test_memset_bench) {
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        size_t size = bench_sizes[i];
+        uint64_t start = bench_rdtsc();
+        for (size_t done = 0; done < BENCH_BYTES; done += size) {
+            memset(bench_dst, (int)done, size);
+        }
+        bench_report("memset ", size, bench_rdtsc() - start);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * Benchmark: overlapping memmove throughput (the backward path)
+ */
+TEST_CASE(test_memmove_bench) {
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        size_t size = bench_sizes[i] - 8;
+        uint64_t start = bench_rdtsc();
+        for (size_t done = 0; done < BENCH_BYTES; done += size) {
+            memmove(bench_dst + 8, bench_dst, size);
+        }
+        bench_report("memmove", size, bench_rdtsc() - start);
+    }
+
+    TEST_PASS();
+}
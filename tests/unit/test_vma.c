@@ -0,0 +1,159 @@
+/**
+ * AAAos Kernel - VMA Tests
+ *
+ * Unit tests for VMA trees and fault-time page filling.
+ */
+
+#include "../framework/test.h"
+#include "../../kernel/mm/vma.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/mm/pmm.h"
+
+/* User range used by these tests (away from the VMM tests' range) */
+#define TEST_VMA_BASE   0x0000010001000000ULL
+
+/* Backing image for the image fill test (1.5 pages) */
+static uint8_t vma_image[VMM_PAGE_SIZE + VMM_PAGE_SIZE / 2];
+
+/**
+ * Test: Image VMAs fill pages on first touch, BSS reads the zero page
+ */
+TEST_CASE(test_vma_image_fault) {
+    physaddr_t pml4 = vmm_get_kernel_pml4();
+    virtaddr_t virt = TEST_VMA_BASE;
+    vma_stats_t before, after;
+    vma_tree_t tree;
+    physaddr_t zero, phys;
+    size_t i;
+
+    if (vmm_get_current_address_space() != pml4) {
+        TEST_SKIP("not running on the kernel page tables");
+    }
+
+    for (i = 0; i < sizeof(vma_image); i++) {
+        vma_image[i] = (uint8_t)(i * 7);
+    }
+
+    vma_tree_init(&tree);
+    vma_get_stats(&before);
+    TEST_ASSERT(vma_map_image(&tree, virt, 4 * VMM_PAGE_SIZE, vma_image,
+                              sizeof(vma_image), VMM_FLAGS_USER));
+    TEST_ASSERT_EQ(vmm_is_mapped(virt), false);
+
+    /* Page 1 holds the tail of the image followed by zeroes */
+    TEST_ASSERT(vma_handle_fault(&tree, pml4, virt + VMM_PAGE_SIZE + 10, false));
+    phys = vmm_get_physical(virt + VMM_PAGE_SIZE);
+    TEST_ASSERT_EQ(((uint8_t*)phys)[10], (uint8_t)((VMM_PAGE_SIZE + 10) * 7));
+    TEST_ASSERT_EQ(((uint8_t*)phys)[VMM_PAGE_SIZE - 1], 0);
+
+    /* Reading page 2 maps the shared zero page; writing it copies */
+    TEST_ASSERT(vma_handle_fault(&tree, pml4, virt + 2 * VMM_PAGE_SIZE, false));
+    zero = vmm_get_physical(virt + 2 * VMM_PAGE_SIZE);
+    TEST_ASSERT_GE(pmm_page_refcount(zero), 2);
+    TEST_ASSERT(vmm_handle_page_fault(virt + 2 * VMM_PAGE_SIZE,
+                                      VMM_PF_PRESENT | VMM_PF_WRITE));
+    TEST_ASSERT_NE(vmm_get_physical(virt + 2 * VMM_PAGE_SIZE), zero);
+
+    /* Outside the VMA nothing is resolved */
+    TEST_ASSERT_EQ(vma_handle_fault(&tree, pml4, virt + 4 * VMM_PAGE_SIZE, false), false);
+
+    vma_get_stats(&after);
+    TEST_ASSERT_EQ(after.vmas, before.vmas + 1);
+    TEST_ASSERT_EQ(after.filled_pages, before.filled_pages + 1);
+    TEST_ASSERT_EQ(after.zero_pages, before.zero_pages + 1);
+
+    TEST_ASSERT(vma_unmap(&tree, pml4, virt, 4 * VMM_PAGE_SIZE));
+    TEST_ASSERT_EQ(vmm_is_mapped(virt + VMM_PAGE_SIZE), false);
+    TEST_ASSERT_EQ(tree.count, 0);
+    vma_tree_destroy(&tree);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Unmapping the middle of a VMA splits it in two
+ */
+TEST_CASE(test_vma_unmap_split) {
+    physaddr_t pml4 = vmm_get_kernel_pml4();
+    virtaddr_t virt = TEST_VMA_BASE + (1 * MB);
+    vma_tree_t tree;
+    vma_t *vma;
+
+    if (vmm_get_current_address_space() != pml4) {
+        TEST_SKIP("not running on the kernel page tables");
+    }
+
+    vma_tree_init(&tree);
+    TEST_ASSERT(vma_map_anon(&tree, virt, 8 * VMM_PAGE_SIZE, VMM_FLAGS_USER));
+
+    /* Overlapping mappings are refused */
+    TEST_ASSERT_EQ(vma_map_anon(&tree, virt + VMM_PAGE_SIZE, VMM_PAGE_SIZE, VMM_FLAGS_USER), false);
+
+    /* A write fault gets a private zeroed page */
+    TEST_ASSERT(vma_handle_fault(&tree, pml4, virt + 3 * VMM_PAGE_SIZE, true));
+    TEST_ASSERT(vmm_is_mapped(virt + 3 * VMM_PAGE_SIZE));
+
+    TEST_ASSERT(vma_unmap(&tree, pml4, virt + 2 * VMM_PAGE_SIZE, 2 * VMM_PAGE_SIZE));
+    TEST_ASSERT_EQ(tree.count, 2);
+    TEST_ASSERT_EQ(vmm_is_mapped(virt + 3 * VMM_PAGE_SIZE), false);
+    TEST_ASSERT_NULL(vma_find(&tree, virt + 3 * VMM_PAGE_SIZE));
+
+    vma = vma_find(&tree, virt + VMM_PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(vma);
+    TEST_ASSERT_EQ(vma->end, virt + 2 * VMM_PAGE_SIZE);
+    vma = vma_find(&tree, virt + 5 * VMM_PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(vma);
+    TEST_ASSERT_EQ(vma->start, virt + 4 * VMM_PAGE_SIZE);
+
+    /* The hole is the first free range at or above it */
+    TEST_ASSERT_EQ(vma_find_free(&tree, virt, 2 * VMM_PAGE_SIZE), virt + 8 * VMM_PAGE_SIZE);
+
+    vma_tree_destroy(&tree);
+    TEST_ASSERT_EQ(tree.count, 0);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Many VMAs stay ordered and findable
+ */
+TEST_CASE(test_vma_tree_order) {
+    virtaddr_t base = TEST_VMA_BASE + (2 * MB);
+    vma_tree_t tree, copy;
+    int i;
+
+    vma_tree_init(&tree);
+
+    /* Insert in an order that exercises rotations on both sides */
+    for (i = 0; i < 64; i++) {
+        int slot = (i * 37) % 64;
+        TEST_ASSERT(vma_map_anon(&tree, base + (virtaddr_t)slot * 2 * VMM_PAGE_SIZE,
+                                 VMM_PAGE_SIZE, VMM_FLAGS_USER));
+    }
+    TEST_ASSERT_EQ(tree.count, 64);
+
+    for (i = 0; i < 64; i++) {
+        virtaddr_t start = base + (virtaddr_t)i * 2 * VMM_PAGE_SIZE;
+        vma_t *vma = vma_find(&tree, start + 100);
+        TEST_ASSERT_NOT_NULL(vma);
+        TEST_ASSERT_EQ(vma->start, start);
+        TEST_ASSERT_NULL(vma_find(&tree, start + VMM_PAGE_SIZE));
+    }
+
+    TEST_ASSERT(vma_tree_clone(&copy, &tree));
+    TEST_ASSERT_EQ(copy.count, 64);
+
+    /* Remove every other VMA, then the rest */
+    for (i = 0; i < 64; i += 2) {
+        TEST_ASSERT(vma_unmap(&tree, vmm_get_kernel_pml4(),
+                              base + (virtaddr_t)i * 2 * VMM_PAGE_SIZE, VMM_PAGE_SIZE));
+    }
+    TEST_ASSERT_EQ(tree.count, 32);
+    TEST_ASSERT_NOT_NULL(vma_find(&tree, base + 2 * VMM_PAGE_SIZE));
+    TEST_ASSERT_NOT_NULL(vma_find(&copy, base));
+
+    vma_tree_destroy(&tree);
+    vma_tree_destroy(&copy);
+
+    TEST_PASS();
+}
@@ -11,6 +11,9 @@
 /* Test virtual address range (use high addresses to avoid conflicts) */
 #define TEST_VIRT_BASE  0xFFFF900000000000ULL
 
+/* User address in a PML4 slot of its own, for copy-on-write tests */
+#define TEST_USER_BASE  0x0000010000000000ULL
+
 /**
  * Test: Map and unmap a single page
  */
@@ -87,6 +90,151 @@ TEST_CASE(test_vmm_map_pages) {
     TEST_PASS();
 }
 
+/**
+ * Test: Range mapping across page table boundaries
+ */
+TEST_CASE(test_vmm_map_pages_range) {
+    /* Start 8 pages before a 2MB boundary so the range spans two PTs */
+    virtaddr_t virt = TEST_VIRT_BASE + (2 * MB) - (8 * VMM_PAGE_SIZE);
+    size_t count = 600;
+    physaddr_t phys;
+    size_t i;
+
+    phys = pmm_alloc_pages(count);
+    TEST_ASSERT_NE(phys, 0);
+
+    TEST_ASSERT_EQ(vmm_map_pages(virt, phys, count, VMM_FLAGS_KERNEL), true);
+
+    for (i = 0; i < count; i++) {
+        TEST_ASSERT_EQ(vmm_get_physical(virt + i * VMM_PAGE_SIZE),
+                       phys + i * VMM_PAGE_SIZE);
+    }
+
+    vmm_unmap_pages(virt, count);
+    for (i = 0; i < count; i++) {
+        TEST_ASSERT_EQ(vmm_is_mapped(virt + i * VMM_PAGE_SIZE), false);
+    }
+
+    pmm_free_pages(phys, count);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: 2MB-aligned ranges use huge pages that split on partial unmap
+ */
+TEST_CASE(test_vmm_huge_page_split) {
+    virtaddr_t virt = TEST_VIRT_BASE + (64 * MB);
+    physaddr_t run, phys;
+    size_t i;
+
+    /* Carve a 2MB-aligned physical block out of a 4MB run */
+    run = pmm_alloc_pages(1024);
+    TEST_ASSERT_NE(run, 0);
+    phys = ALIGN_UP(run, VMM_HUGE_2M_SIZE);
+
+    TEST_ASSERT_EQ(vmm_map_pages(virt, phys, 512, VMM_FLAGS_KERNEL), true);
+    TEST_ASSERT_EQ(vmm_get_physical(virt + 0x12345), phys + 0x12345);
+
+    /* Punch a hole in the middle; the rest must keep its translation */
+    TEST_ASSERT_EQ(vmm_unmap_page(virt + 100 * VMM_PAGE_SIZE),
+                   phys + 100 * VMM_PAGE_SIZE);
+    TEST_ASSERT_EQ(vmm_is_mapped(virt + 100 * VMM_PAGE_SIZE), false);
+    for (i = 0; i < 512; i++) {
+        if (i == 100) {
+            continue;
+        }
+        TEST_ASSERT_EQ(vmm_get_physical(virt + i * VMM_PAGE_SIZE),
+                       phys + i * VMM_PAGE_SIZE);
+    }
+
+    vmm_unmap_pages(virt, 512);
+    TEST_ASSERT_EQ(vmm_is_mapped(virt), false);
+
+    pmm_free_pages(run, 1024);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: A copy-on-write clone shares user pages until the first write
+ */
+TEST_CASE(test_vmm_cow_clone) {
+    virtaddr_t virt = TEST_USER_BASE;
+    physaddr_t phys, copy, child;
+    vmm_cow_stats_t before, after;
+
+    if (vmm_get_current_address_space() != vmm_get_kernel_pml4()) {
+        TEST_SKIP("not running on the kernel page tables");
+    }
+
+    phys = pmm_alloc_page();
+    TEST_ASSERT_NE(phys, 0);
+    *(volatile uint64_t*)phys = 0xC0FFEE;
+    TEST_ASSERT_EQ(vmm_map_page(virt, phys, VMM_FLAGS_USER), true);
+
+    vmm_get_cow_stats(&before);
+    child = vmm_clone_address_space(vmm_get_current_address_space());
+    TEST_ASSERT_NE(child, 0);
+    TEST_ASSERT_EQ(pmm_page_refcount(phys), 2);
+
+    /* Reads are not copy-on-write faults */
+    TEST_ASSERT_EQ(vmm_handle_page_fault(virt, VMM_PF_PRESENT), false);
+
+    /* The first write gives the writer its own copy */
+    TEST_ASSERT(vmm_handle_page_fault(virt + 8, VMM_PF_PRESENT | VMM_PF_WRITE));
+    copy = vmm_get_physical(virt);
+    TEST_ASSERT_NE(copy, phys);
+    TEST_ASSERT_EQ(*(volatile uint64_t*)copy, 0xC0FFEE);
+    TEST_ASSERT_EQ(pmm_page_refcount(phys), 1);
+    TEST_ASSERT_EQ(vmm_handle_page_fault(virt, VMM_PF_PRESENT | VMM_PF_WRITE), false);
+
+    vmm_get_cow_stats(&after);
+    TEST_ASSERT_EQ(after.clones, before.clones + 1);
+    TEST_ASSERT_EQ(after.copied_pages, before.copied_pages + 1);
+
+    /* The child held the last reference to the original frame */
+    vmm_destroy_address_space(child);
+    TEST_ASSERT_EQ(pmm_is_page_free(phys), true);
+
+    TEST_ASSERT_EQ(vmm_unmap_page(virt), copy);
+    pmm_free_page(copy);
+
+    TEST_PASS();
+}
+
+/**
+ * Test: Switching back to an address space reuses its PCID
+ */
+TEST_CASE(test_vmm_pcid_switch) {
+    vmm_pcid_stats_t before, after;
+    physaddr_t kernel = vmm_get_kernel_pml4();
+    physaddr_t space;
+
+    vmm_get_pcid_stats(&before);
+    if (!before.enabled || vmm_get_current_address_space() != kernel) {
+        TEST_SKIP("PCID not enabled");
+    }
+
+    space = vmm_create_address_space();
+    TEST_ASSERT_NE(space, 0);
+
+    vmm_switch_address_space(space);
+    TEST_ASSERT_EQ(vmm_get_current_address_space(), space);
+    vmm_switch_address_space(kernel);
+    vmm_switch_address_space(space);
+    vmm_switch_address_space(kernel);
+    TEST_ASSERT_EQ(vmm_get_current_address_space(), kernel);
+
+    vmm_get_pcid_stats(&after);
+    TEST_ASSERT_EQ(after.misses, before.misses + 1);
+    TEST_ASSERT_EQ(after.hits, before.hits + 1);
+
+    vmm_destroy_address_space(space);
+
+    TEST_PASS();
+}
+
 /**
  * Test: Virtual to physical translation
  */